@@ -0,0 +1,231 @@
+/*! \file    affinity.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    CPU affinity and NUMA placement of media threads
+ * \details  Implementation of the pinning of media threads to a set of
+ * CPUs, optionally split in NUMA nodes. Nodes are read from sysfs rather
+ * than via libnuma, and only those that have some of the media CPUs are
+ * taken into account. Placement groups are mapped to nodes by their ID,
+ * which is cheap and needs no state: members of a group always end up
+ * on the same node, and different groups are evenly spread.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+#include "affinity.h"
+#include "debug.h"
+
+static gboolean affinity_enabled = FALSE;
+static gchar *affinity_cpus = NULL;
+#ifdef __linux__
+/* All the CPUs media threads can run on */
+static cpu_set_t media_cpus;
+/* Media CPUs of each node (nodes with none are skipped) */
+static cpu_set_t *node_cpus = NULL;
+static int *node_ids = NULL;
+#endif
+static int nodes = 0;
+
+#ifdef __linux__
+/* Helper to parse a list of CPUs in the sysfs format ("0-3,8,10-11") */
+static int janus_affinity_parse(const char *list, cpu_set_t *set) {
+	CPU_ZERO(set);
+	if(list == NULL)
+		return -1;
+	int count = 0;
+	gchar **ranges = g_strsplit(list, ",", -1);
+	int i = 0;
+	for(i=0; ranges[i] != NULL; i++) {
+		gchar *range = g_strstrip(ranges[i]);
+		if(*range == '\0')
+			continue;
+		int first = -1, last = -1;
+		int res = sscanf(range, "%d-%d", &first, &last);
+		if(res == 1)
+			last = first;
+		if(res < 1 || first < 0 || last < first || last >= CPU_SETSIZE) {
+			g_strfreev(ranges);
+			return -1;
+		}
+		for(; first <= last; first++) {
+			CPU_SET(first, set);
+			count++;
+		}
+	}
+	g_strfreev(ranges);
+	return count;
+}
+
+/* Helper to write a set of CPUs back in the same format, for logging */
+static gchar *janus_affinity_to_string(cpu_set_t *set) {
+	GString *list = g_string_new(NULL);
+	int cpu = 0;
+	while(cpu < CPU_SETSIZE) {
+		if(!CPU_ISSET(cpu, set)) {
+			cpu++;
+			continue;
+		}
+		int last = cpu;
+		while(last+1 < CPU_SETSIZE && CPU_ISSET(last+1, set))
+			last++;
+		if(list->len > 0)
+			g_string_append_c(list, ',');
+		if(last == cpu)
+			g_string_append_printf(list, "%d", cpu);
+		else
+			g_string_append_printf(list, "%d-%d", cpu, last);
+		cpu = last+1;
+	}
+	return g_string_free(list, FALSE);
+}
+
+/* Reads the NUMA nodes from sysfs, restricted to the media CPUs */
+static void janus_affinity_read_nodes(void) {
+	GDir *dir = g_dir_open("/sys/devices/system/node", 0, NULL);
+	if(dir == NULL)
+		return;
+	GArray *cpus = g_array_new(FALSE, FALSE, sizeof(cpu_set_t));
+	GArray *ids = g_array_new(FALSE, FALSE, sizeof(int));
+	const gchar *name = NULL;
+	while((name = g_dir_read_name(dir)) != NULL) {
+		int id = -1;
+		if(strncmp(name, "node", 4) || sscanf(name+4, "%d", &id) != 1 || id < 0)
+			continue;
+		char path[256];
+		g_snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", name);
+		gchar *contents = NULL;
+		if(!g_file_get_contents(path, &contents, NULL, NULL))
+			continue;
+		cpu_set_t set;
+		int res = janus_affinity_parse(g_strstrip(contents), &set);
+		g_free(contents);
+		if(res <= 0)
+			continue;
+		CPU_AND(&set, &set, &media_cpus);
+		if(CPU_COUNT(&set) == 0)
+			continue;
+		/* Keep the nodes sorted by ID, the directory isn't */
+		guint i = 0;
+		while(i < ids->len && g_array_index(ids, int, i) < id)
+			i++;
+		g_array_insert_val(cpus, i, set);
+		g_array_insert_val(ids, i, id);
+	}
+	g_dir_close(dir);
+	nodes = cpus->len;
+	node_cpus = (cpu_set_t *)g_array_free(cpus, FALSE);
+	node_ids = (int *)g_array_free(ids, FALSE);
+}
+#endif
+
+void janus_affinity_init(const char *cpus, gboolean numa) {
+	if(cpus == NULL && !numa)
+		return;
+#ifndef __linux__
+	JANUS_LOG(LOG_WARN, "CPU affinity is only supported on Linux, media threads won't be pinned\n");
+#else
+	if(cpus != NULL) {
+		if(janus_affinity_parse(cpus, &media_cpus) <= 0) {
+			JANUS_LOG(LOG_WARN, "Invalid list of CPUs for media threads (%s), affinity disabled\n", cpus);
+			return;
+		}
+	} else if(sched_getaffinity(0, sizeof(cpu_set_t), &media_cpus) < 0) {
+		JANUS_LOG(LOG_WARN, "Couldn't get the CPUs we can run on, affinity disabled\n");
+		return;
+	}
+	if(numa)
+		janus_affinity_read_nodes();
+	if(nodes == 0) {
+		if(numa)
+			JANUS_LOG(LOG_WARN, "No NUMA node found for the media CPUs, treating them as a single node\n");
+		nodes = 1;
+		node_cpus = g_malloc(sizeof(cpu_set_t));
+		node_cpus[0] = media_cpus;
+		node_ids = g_malloc0(sizeof(int));
+	}
+	affinity_cpus = janus_affinity_to_string(&media_cpus);
+	affinity_enabled = TRUE;
+	JANUS_LOG(LOG_INFO, "Media threads will be pinned to CPUs %s\n", affinity_cpus);
+	if(numa) {
+		int i = 0;
+		for(i=0; i<nodes; i++) {
+			gchar *list = janus_affinity_to_string(&node_cpus[i]);
+			JANUS_LOG(LOG_INFO, "  -- NUMA node %d: CPUs %s\n", node_ids[i], list);
+			g_free(list);
+		}
+	}
+#endif
+}
+
+void janus_affinity_deinit(void) {
+	affinity_enabled = FALSE;
+	g_free(affinity_cpus);
+	affinity_cpus = NULL;
+#ifdef __linux__
+	g_free(node_cpus);
+	node_cpus = NULL;
+	g_free(node_ids);
+	node_ids = NULL;
+#endif
+	nodes = 0;
+}
+
+gboolean janus_affinity_is_enabled(void) {
+	return affinity_enabled;
+}
+
+int janus_affinity_get_nodes(void) {
+	return affinity_enabled ? nodes : 0;
+}
+
+int janus_affinity_group_node(guint64 group) {
+	if(!affinity_enabled || nodes < 2 || group == 0)
+		return -1;
+	return group % nodes;
+}
+
+int janus_affinity_pin_thread(int node) {
+	if(!affinity_enabled)
+		return 0;
+#ifdef __linux__
+	cpu_set_t *set = (node >= 0 && node < nodes) ? &node_cpus[node] : &media_cpus;
+	int res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), set);
+	if(res != 0) {
+		JANUS_LOG(LOG_WARN, "Couldn't pin thread to the media CPUs (node %d): %d (%s)\n", node, res, strerror(res));
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+json_t *janus_affinity_info(void) {
+	if(!affinity_enabled)
+		return NULL;
+	json_t *info = json_object();
+	json_object_set_new(info, "cpus", json_string(affinity_cpus));
+#ifdef __linux__
+	if(nodes > 1) {
+		json_t *list = json_array();
+		int i = 0;
+		for(i=0; i<nodes; i++) {
+			json_t *node = json_object();
+			gchar *cpus = janus_affinity_to_string(&node_cpus[i]);
+			json_object_set_new(node, "node", json_integer(node_ids[i]));
+			json_object_set_new(node, "cpus", json_string(cpus));
+			g_free(cpus);
+			json_array_append_new(list, node);
+		}
+		json_object_set_new(info, "numa-nodes", list);
+	}
+#endif
+	return info;
+}
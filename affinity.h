@@ -0,0 +1,55 @@
+/*! \file    affinity.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    CPU affinity and NUMA placement of media threads (headers)
+ * \details  Media threads (the ICE loops and send threads in the core, as
+ * well as threads plugins spawn to mix or relay media, e.g., AudioBridge
+ * mixers or Streaming relays) can be pinned to a configured set of CPUs,
+ * rather than be left floating across all the cores. When NUMA awareness
+ * is enabled, that set is further split in the NUMA nodes the CPUs belong
+ * to: handles and threads can then be associated to a placement group (e.g.,
+ * the room or mountpoint they're related to), and all the members of the
+ * same group are kept on the same node. This avoids cross-node wakeups when
+ * the packets of a publisher are relayed to its subscribers.
+ * \note Pinning is only available on Linux: elsewhere these methods are no-ops.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_AFFINITY_H
+#define _JANUS_AFFINITY_H
+
+#include <stdint.h>
+
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief Initialize the placement of media threads
+ * @param[in] cpus List of CPUs media threads should be pinned to (e.g., "2-7,10"), or NULL for those the process can run on
+ * @param[in] numa Whether the CPUs should be split in NUMA nodes, to keep placement groups on the same node
+ * \note Affinity is only enabled if either a list of CPUs is provided or NUMA awareness is requested */
+void janus_affinity_init(const char *cpus, gboolean numa);
+/*! \brief De-initialize the placement of media threads */
+void janus_affinity_deinit(void);
+
+/*! \brief Check whether media threads are pinned
+ * @returns TRUE if so, FALSE otherwise */
+gboolean janus_affinity_is_enabled(void);
+/*! \brief Get the number of NUMA nodes media threads are spread on
+ * @returns The number of nodes (1 if NUMA awareness is disabled), or 0 if affinity is disabled */
+int janus_affinity_get_nodes(void);
+/*! \brief Get the NUMA node the members of a placement group should be served on
+ * @param[in] group The placement group (e.g., a room or mountpoint ID), 0 for none
+ * @returns The node index, or -1 if any node is fine */
+int janus_affinity_group_node(guint64 group);
+/*! \brief Pin the calling thread to the CPUs of a node
+ * @param[in] node The node index (as returned by janus_affinity_group_node), or -1 for all the media CPUs
+ * @returns 0 in case of success (or if affinity is disabled), a negative integer otherwise */
+int janus_affinity_pin_thread(int node);
+
+/*! \brief Get a summary of the media CPUs and nodes (for the Admin API)
+ * @returns A JSON object, or NULL if affinity is disabled */
+json_t *janus_affinity_info(void);
+
+#endif
@@ -0,0 +1,1465 @@
+/*! \file    janus-bench.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Headless load generator for Janus
+ * \details  Simple utility to measure the overhead of the Janus core on the
+ * media path, e.g., to compare different versions or configurations. The
+ * tool establishes a configurable number of PeerConnections with a Janus
+ * instance, using the REST API for signalling, and pumps synthetic RTP at
+ * the configured bitrates: each PeerConnection is a real WebRTC one (ICE via
+ * libnice, DTLS-SRTP via OpenSSL and libsrtp), so Janus handles it exactly
+ * as it would handle a browser. Three plugins can be targeted: the EchoTest,
+ * which sends each packet back on the same PeerConnection, the VideoRoom,
+ * where each stream is a publisher that a second PeerConnection subscribes
+ * to, or the Streaming plugin, where each stream is a listener of the same
+ * live RTP mountpoint, which the tool feeds with plain RTP: the latter is
+ * useful to measure the fan-out cost, i.e., the CPU Janus needs for each
+ * additional listener. Every packet carries the time it was sent in its payload, which means
+ * that the echoed/relayed packets can be used to measure the end-to-end
+ * latency, besides the packets per second that are sent and received.
+ * When passing the PID of the Janus process, the CPU it uses is reported
+ * too, both overall and per stream.
+ *
+ * Using the utility is quite simple: all options have a default, so this
+ * is enough to create 10 EchoTest streams against a local Janus instance
+ * with the HTTP transport enabled, and run them for 30 seconds:
+ *
+\verbatim
+./janus-bench
+\endverbatim
+ *
+ * This, instead, creates 50 VideoRoom publishers (and the related
+ * subscribers) in room 1234, at 32kbps for audio and 300kbps for video,
+ * and includes the CPU usage of Janus in the reports:
+ *
+\verbatim
+./janus-bench --plugin=videoroom --room=1234 --streams=50 --audio=32 --video=300 --pid=`pidof janus`
+\endverbatim
+ *
+ * And this creates 200 listeners of the Streaming mountpoint with id 1,
+ * feeding it via the RTP ports in the \c gstreamer-sample mountpoint of
+ * the sample configuration (Opus with payload type 111 on port 5002, and
+ * VP8 with payload type 100 on port 5004):
+ *
+\verbatim
+./janus-bench --plugin=streaming --mountpoint=1 --streams=200 --pid=`pidof janus`
+\endverbatim
+ *
+ * A report is printed every few seconds (\c --interval), while a summary
+ * is printed at the end of the test: passing \c --json prints the summary
+ * as a JSON object instead, which is easier to compare between runs.
+ *
+ * \ingroup tools
+ * \ref tools
+ */
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <glib.h>
+#include <jansson.h>
+#include <curl/curl.h>
+#include <nice/agent.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509.h>
+
+#include "../debug.h"
+#include "../mutex.h"
+#include "../version.h"
+#include "../rtp.h"
+#include "../rtpsrtp.h"
+
+int janus_log_level = 4;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = TRUE;
+
+/* Marker we put at the beginning of the payload of the packets we send */
+#define JANUS_BENCH_MAGIC		0x4A42454E	/* "JBEN" */
+/* Largest payload we put in a single RTP packet */
+#define JANUS_BENCH_MAX_PAYLOAD	1100
+/* Latency histogram: 100us buckets, up to 2 seconds */
+#define JANUS_BENCH_LATENCY_BUCKET	100
+#define JANUS_BENCH_LATENCY_BUCKETS	20000
+/* How often we send keep-alives for our Janus sessions */
+#define JANUS_BENCH_KEEPALIVE		(25*G_USEC_PER_SEC)
+/* How long we wait for a PeerConnection to be established */
+#define JANUS_BENCH_SETUP_TIMEOUT	(10*G_USEC_PER_SEC)
+/* Payload types we feed Streaming mountpoints with (as in the sample configuration) */
+#define JANUS_BENCH_FEED_AUDIO_PT	111
+#define JANUS_BENCH_FEED_VIDEO_PT	100
+
+/* Options */
+static const char *server = "http://127.0.0.1:8088/janus";
+static gboolean videoroom = FALSE, streaming = FALSE;
+static guint64 room_id = 1234;
+static guint64 mountpoint_id = 1;
+static const char *rtp_host = "127.0.0.1";
+static int audio_port = 5002, video_port = 5004;
+static int streams_num = 10;
+static int audio_kbps = 64, video_kbps = 512;
+static int duration = 30, interval = 5, ramp = 50;
+static int workers_num = 2;
+static int janus_pid = 0;
+static gboolean json_summary = FALSE;
+
+static volatile gint stop = 0;
+
+/* Payload of the packets we send, right after the RTP header (and the VP8 descriptor for video) */
+typedef struct janus_bench_probe {
+	uint32_t magic;
+	uint32_t stream;
+	int64_t sent;
+} __attribute__((packed)) janus_bench_probe;
+
+/* Media threads: each serves a subset of the PeerConnections */
+typedef struct janus_bench_worker {
+	int id;
+	GMainContext *context;
+	GMainLoop *loop;
+	GThread *thread;
+	/* PeerConnections this worker sends media on, only accessed by the worker thread */
+	GSList *pcs;
+	/* Latencies measured by this worker since the last report */
+	janus_mutex mutex;
+	guint latencies[JANUS_BENCH_LATENCY_BUCKETS+1];
+} janus_bench_worker;
+
+typedef enum janus_bench_pc_state {
+	janus_bench_pc_new = 0,
+	janus_bench_pc_dtls,
+	janus_bench_pc_ready,
+	janus_bench_pc_failed
+} janus_bench_pc_state;
+
+typedef struct janus_bench_pc {
+	int index;
+	janus_bench_worker *worker;
+	gboolean offerer, sending;
+	/* ICE */
+	NiceAgent *agent;
+	guint stream_id;
+	volatile gint gathered;
+	/* DTLS-SRTP */
+	gboolean dtls_client;
+	SSL *ssl;
+	BIO *read_bio, *write_bio;
+	srtp_t srtp_in, srtp_out;
+	srtp_policy_t remote_policy, local_policy;
+	guint8 keys[2*SRTP_MASTER_LENGTH];
+	volatile gint state;
+	gint64 started, ready;
+	/* Media */
+	gboolean has_audio, has_video;
+	int audio_pt, video_pt;
+	guint32 audio_ssrc, video_ssrc;
+	guint16 audio_seq, video_seq;
+	guint32 audio_ts, video_ts;
+	/* Plain RTP socket, if this is the feed of a Streaming mountpoint rather than a PeerConnection */
+	int rtp_fd;
+	struct sockaddr_in audio_addr, video_addr;
+	/* Statistics */
+	volatile gint tx_packets, rx_packets, rx_rtcp;
+	volatile guint64 tx_bytes, rx_bytes;
+} janus_bench_pc;
+
+typedef struct janus_bench_stream {
+	int index;
+	guint64 session_id, handle_id, sub_handle_id;
+	guint64 publisher_id;
+	janus_bench_pc *pc;		/* The PeerConnection we send on (and receive on, for the EchoTest) */
+	janus_bench_pc *sub;	/* The PeerConnection we receive on, for the VideoRoom and Streaming */
+	gint64 last_keepalive;
+} janus_bench_stream;
+
+static janus_bench_worker **workers = NULL;
+static janus_bench_stream **streams = NULL;
+static int streams_created = 0;
+/* Plain RTP source all Streaming listeners receive from */
+static janus_bench_pc *feed = NULL;
+
+static SSL_CTX *ssl_ctx = NULL;
+static X509 *ssl_cert = NULL;
+static EVP_PKEY *ssl_key = NULL;
+static char local_fingerprint[160];
+
+
+/* Signal handler */
+static void janus_bench_handle_signal(int signum) {
+	g_atomic_int_set(&stop, 1);
+}
+
+
+/* Signalling via the Janus REST API */
+static size_t janus_bench_http_write(void *ptr, size_t size, size_t nmemb, void *data) {
+	g_string_append_len((GString *)data, ptr, size*nmemb);
+	return size*nmemb;
+}
+
+/* Send a request (or a long poll, if there's no request) and return the parsed response */
+static json_t *janus_bench_http(const char *url, json_t *request, long timeout) {
+	CURL *curl = curl_easy_init();
+	if(curl == NULL)
+		return NULL;
+	GString *response = g_string_new(NULL);
+	char *text = NULL;
+	struct curl_slist *headers = NULL;
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_bench_http_write);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+	if(request != NULL) {
+		text = json_dumps(request, JSON_PRESERVE_ORDER);
+		headers = curl_slist_append(headers, "Content-Type: application/json");
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, text);
+	}
+	CURLcode res = curl_easy_perform(curl);
+	json_t *root = NULL;
+	if(res != CURLE_OK) {
+		JANUS_LOG(LOG_ERR, "Error sending request to %s: %s\n", url, curl_easy_strerror(res));
+	} else {
+		json_error_t error;
+		root = json_loads(response->str, 0, &error);
+		if(root == NULL)
+			JANUS_LOG(LOG_ERR, "Error parsing response from %s: %s\n", url, error.text);
+	}
+	curl_slist_free_all(headers);
+	curl_easy_cleanup(curl);
+	free(text);
+	g_string_free(response, TRUE);
+	return root;
+}
+
+/* Send a request to Janus (the transaction is added automatically) */
+static json_t *janus_bench_request(guint64 session_id, guint64 handle_id, json_t *request) {
+	char url[512], transaction[13];
+	if(handle_id > 0)
+		g_snprintf(url, sizeof(url), "%s/%"SCNu64"/%"SCNu64, server, session_id, handle_id);
+	else if(session_id > 0)
+		g_snprintf(url, sizeof(url), "%s/%"SCNu64, server, session_id);
+	else
+		g_snprintf(url, sizeof(url), "%s", server);
+	int i = 0;
+	for(i=0; i<12; i++)
+		transaction[i] = 'a' + g_random_int_range(0, 26);
+	transaction[12] = '\0';
+	json_object_set_new(request, "transaction", json_string(transaction));
+	json_t *response = janus_bench_http(url, request, 10);
+	json_decref(request);
+	if(response == NULL)
+		return NULL;
+	const char *janus = json_string_value(json_object_get(response, "janus"));
+	if(janus == NULL || !strcmp(janus, "error")) {
+		json_t *error = json_object_get(response, "error");
+		JANUS_LOG(LOG_ERR, "Error from Janus: %s\n", error ? json_string_value(json_object_get(error, "reason")) : "??");
+		json_decref(response);
+		return NULL;
+	}
+	return response;
+}
+
+/* Create a session or a handle, returning its ID */
+static guint64 janus_bench_create(guint64 session_id, const char *plugin) {
+	json_t *request = json_object();
+	json_object_set_new(request, "janus", json_string(plugin ? "attach" : "create"));
+	if(plugin)
+		json_object_set_new(request, "plugin", json_string(plugin));
+	json_t *response = janus_bench_request(session_id, 0, request);
+	if(response == NULL)
+		return 0;
+	guint64 id = json_integer_value(json_object_get(json_object_get(response, "data"), "id"));
+	json_decref(response);
+	return id;
+}
+
+/* Send a message to a plugin, possibly with a JSEP */
+static int janus_bench_message(janus_bench_stream *stream, guint64 handle_id, json_t *body, const char *type, const char *sdp) {
+	json_t *request = json_object();
+	json_object_set_new(request, "janus", json_string("message"));
+	json_object_set_new(request, "body", body);
+	if(type && sdp)
+		json_object_set_new(request, "jsep", json_pack("{ssss}", "type", type, "sdp", sdp));
+	json_t *response = janus_bench_request(stream->session_id, handle_id, request);
+	if(response == NULL)
+		return -1;
+	json_decref(response);
+	stream->last_keepalive = g_get_monotonic_time();
+	return 0;
+}
+
+/* Tell Janus we won't trickle any candidate, as they're all in the SDP */
+static int janus_bench_trickle_completed(janus_bench_stream *stream, guint64 handle_id) {
+	json_t *request = json_object();
+	json_object_set_new(request, "janus", json_string("trickle"));
+	json_object_set_new(request, "candidate", json_pack("{sb}", "completed", 1));
+	json_t *response = janus_bench_request(stream->session_id, handle_id, request);
+	if(response == NULL)
+		return -1;
+	json_decref(response);
+	return 0;
+}
+
+/* Long poll until we get an event from the plugin for a specific handle */
+static json_t *janus_bench_wait_event(janus_bench_stream *stream, guint64 handle_id, gboolean jsep) {
+	char url[512];
+	g_snprintf(url, sizeof(url), "%s/%"SCNu64"?maxev=1", server, stream->session_id);
+	gint64 end = g_get_monotonic_time() + JANUS_BENCH_SETUP_TIMEOUT;
+	while(!g_atomic_int_get(&stop) && g_get_monotonic_time() < end) {
+		json_t *event = janus_bench_http(url, NULL, 35);
+		if(event == NULL)
+			return NULL;
+		stream->last_keepalive = g_get_monotonic_time();
+		/* We may get an array of events, or a single one */
+		json_t *list = json_is_array(event) ? event : NULL;
+		size_t i = 0, count = list ? json_array_size(list) : 1;
+		for(i=0; i<count; i++) {
+			json_t *e = list ? json_array_get(list, i) : event;
+			const char *janus = json_string_value(json_object_get(e, "janus"));
+			if(janus == NULL || strcmp(janus, "event") ||
+					json_integer_value(json_object_get(e, "sender")) != (json_int_t)handle_id)
+				continue;
+			if(jsep && json_object_get(e, "jsep") == NULL) {
+				json_t *data = json_object_get(json_object_get(e, "plugindata"), "data");
+				if(json_object_get(data, "error") != NULL) {
+					JANUS_LOG(LOG_ERR, "[%d] Error from the plugin: %s\n", stream->index,
+						json_string_value(json_object_get(data, "error")));
+					json_decref(event);
+					return NULL;
+				}
+				continue;
+			}
+			json_incref(e);
+			json_decref(event);
+			return e;
+		}
+		json_decref(event);
+	}
+	return NULL;
+}
+
+static void janus_bench_keepalive(janus_bench_stream *stream) {
+	gint64 now = g_get_monotonic_time();
+	if(stream == NULL || stream->session_id == 0 || now - stream->last_keepalive < JANUS_BENCH_KEEPALIVE)
+		return;
+	stream->last_keepalive = now;
+	json_t *request = json_object();
+	json_object_set_new(request, "janus", json_string("keepalive"));
+	json_t *response = janus_bench_request(stream->session_id, 0, request);
+	if(response)
+		json_decref(response);
+}
+
+
+/* Minimal SDP parsing, just what we need to set up our side */
+typedef struct janus_bench_mline {
+	char *type, *proto, *fmt, *mid, *rtpmap;
+	int port;
+} janus_bench_mline;
+
+typedef struct janus_bench_sdp {
+	char *ufrag, *pwd, *setup;
+	GSList *candidates;
+	GSList *mlines;
+} janus_bench_sdp;
+
+static void janus_bench_mline_free(janus_bench_mline *m) {
+	g_free(m->type);
+	g_free(m->proto);
+	g_free(m->fmt);
+	g_free(m->mid);
+	g_free(m->rtpmap);
+	g_free(m);
+}
+
+static void janus_bench_sdp_free(janus_bench_sdp *sdp) {
+	if(sdp == NULL)
+		return;
+	g_free(sdp->ufrag);
+	g_free(sdp->pwd);
+	g_free(sdp->setup);
+	g_slist_free_full(sdp->candidates, g_free);
+	g_slist_free_full(sdp->mlines, (GDestroyNotify)janus_bench_mline_free);
+	g_free(sdp);
+}
+
+static janus_bench_sdp *janus_bench_sdp_parse(const char *text) {
+	janus_bench_sdp *sdp = g_malloc0(sizeof(janus_bench_sdp));
+	janus_bench_mline *m = NULL;
+	gchar **lines = g_strsplit(text, "\n", -1);
+	int i = 0;
+	for(i=0; lines[i] != NULL; i++) {
+		char *line = g_strstrip(lines[i]);
+		if(!strncmp(line, "m=", 2)) {
+			gchar **parts = g_strsplit(line+2, " ", 4);
+			if(parts[0] && parts[1] && parts[2] && parts[3]) {
+				m = g_malloc0(sizeof(janus_bench_mline));
+				m->type = g_strdup(parts[0]);
+				m->port = atoi(parts[1]);
+				m->proto = g_strdup(parts[2]);
+				char *space = strchr(parts[3], ' ');
+				m->fmt = space ? g_strndup(parts[3], space-parts[3]) : g_strdup(parts[3]);
+				sdp->mlines = g_slist_append(sdp->mlines, m);
+			}
+			g_strfreev(parts);
+		} else if(!strncmp(line, "a=ice-ufrag:", 12) && sdp->ufrag == NULL) {
+			sdp->ufrag = g_strdup(line+12);
+		} else if(!strncmp(line, "a=ice-pwd:", 10) && sdp->pwd == NULL) {
+			sdp->pwd = g_strdup(line+10);
+		} else if(!strncmp(line, "a=setup:", 8) && sdp->setup == NULL) {
+			sdp->setup = g_strdup(line+8);
+		} else if(!strncmp(line, "a=candidate:", 12)) {
+			sdp->candidates = g_slist_append(sdp->candidates, g_strdup(line));
+		} else if(m && !strncmp(line, "a=mid:", 6) && m->mid == NULL) {
+			m->mid = g_strdup(line+6);
+		} else if(m && !strncmp(line, "a=rtpmap:", 9) && m->rtpmap == NULL &&
+				!strncmp(line+9, m->fmt, strlen(m->fmt)) && line[9+strlen(m->fmt)] == ' ') {
+			m->rtpmap = g_strdup(line+2);
+		}
+	}
+	g_strfreev(lines);
+	return sdp;
+}
+
+
+/* DTLS-SRTP */
+static int janus_bench_dtls_verify(int preverify_ok, X509_STORE_CTX *ctx) {
+	/* We trust Janus, we're not checking the fingerprint */
+	return 1;
+}
+
+static int janus_bench_dtls_init(void) {
+	SSL_library_init();
+	SSL_load_error_strings();
+	OpenSSL_add_all_algorithms();
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	ssl_ctx = SSL_CTX_new(DTLSv1_method());
+#else
+	ssl_ctx = SSL_CTX_new(DTLS_method());
+#endif
+	if(ssl_ctx == NULL)
+		return -1;
+	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, janus_bench_dtls_verify);
+	if(SSL_CTX_set_tlsext_use_srtp(ssl_ctx, "SRTP_AES128_CM_SHA1_80") != 0)
+		return -1;
+	/* Generate a P-256 key and a self-signed certificate */
+	EC_KEY *ecc_key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+	if(ecc_key == NULL)
+		return -1;
+	EC_KEY_set_asn1_flag(ecc_key, OPENSSL_EC_NAMED_CURVE);
+	ssl_key = EVP_PKEY_new();
+	if(!EC_KEY_generate_key(ecc_key) || !EVP_PKEY_assign_EC_KEY(ssl_key, ecc_key)) {
+		EC_KEY_free(ecc_key);
+		return -1;
+	}
+	ssl_cert = X509_new();
+	X509_set_version(ssl_cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(ssl_cert), (long)g_random_int());
+	X509_gmtime_adj(X509_get_notBefore(ssl_cert), -86400);
+	X509_gmtime_adj(X509_get_notAfter(ssl_cert), 86400);
+	X509_set_pubkey(ssl_cert, ssl_key);
+	X509_NAME *cert_name = X509_get_subject_name(ssl_cert);
+	X509_NAME_add_entry_by_txt(cert_name, "CN", MBSTRING_ASC, (const unsigned char *)"janus-bench", -1, -1, 0);
+	X509_set_issuer_name(ssl_cert, cert_name);
+	if(!X509_sign(ssl_cert, ssl_key, EVP_sha256()))
+		return -1;
+	if(!SSL_CTX_use_certificate(ssl_ctx, ssl_cert) || !SSL_CTX_use_PrivateKey(ssl_ctx, ssl_key))
+		return -1;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	SSL_CTX_set_ecdh_auto(ssl_ctx, 1);
+#endif
+	/* Compute the fingerprint we'll put in the SDP */
+	unsigned int size = 0, i = 0;
+	unsigned char fingerprint[EVP_MAX_MD_SIZE];
+	X509_digest(ssl_cert, EVP_sha256(), fingerprint, &size);
+	char *c = local_fingerprint;
+	for(i=0; i<size; i++) {
+		g_snprintf(c, 4, "%.2X:", fingerprint[i]);
+		c += 3;
+	}
+	*(c-1) = '\0';
+	return 0;
+}
+
+/* Send whatever OpenSSL wants to send */
+static void janus_bench_dtls_flush(janus_bench_pc *pc) {
+	char buf[1500];
+	int len = 0;
+	while(BIO_ctrl_pending(pc->write_bio) > 0 && (len = BIO_read(pc->write_bio, buf, sizeof(buf))) > 0)
+		nice_agent_send(pc->agent, pc->stream_id, 1, len, buf);
+}
+
+static int janus_bench_srtp_create(srtp_t *srtp, srtp_policy_t *policy, guint8 *key, gboolean outbound) {
+	srtp_crypto_policy_set_rtp_default(&policy->rtp);
+	srtp_crypto_policy_set_rtcp_default(&policy->rtcp);
+	policy->ssrc.type = outbound ? ssrc_any_outbound : ssrc_any_inbound;
+	policy->key = key;
+	policy->window_size = 128;
+	policy->allow_repeat_tx = 0;
+	policy->next = NULL;
+	return srtp_create(srtp, policy) == srtp_err_status_ok ? 0 : -1;
+}
+
+static void janus_bench_dtls_check(janus_bench_pc *pc) {
+	if(!SSL_is_init_finished(pc->ssl))
+		return;
+	/* Handshake done, extract the keys: client key, server key, client salt, server salt */
+	guint8 material[2*SRTP_MASTER_LENGTH];
+	if(!SSL_export_keying_material(pc->ssl, material, sizeof(material), "EXTRACTOR-dtls_srtp", 19, NULL, 0, 0)) {
+		JANUS_LOG(LOG_ERR, "[%d] Error extracting the SRTP keys\n", pc->index);
+		g_atomic_int_set(&pc->state, janus_bench_pc_failed);
+		return;
+	}
+	guint8 *local = pc->keys, *remote = pc->keys + SRTP_MASTER_LENGTH;
+	guint8 *client = pc->dtls_client ? local : remote, *server = pc->dtls_client ? remote : local;
+	memcpy(client, material, SRTP_MASTER_KEY_LENGTH);
+	memcpy(server, material + SRTP_MASTER_KEY_LENGTH, SRTP_MASTER_KEY_LENGTH);
+	memcpy(client + SRTP_MASTER_KEY_LENGTH, material + 2*SRTP_MASTER_KEY_LENGTH, SRTP_MASTER_SALT_LENGTH);
+	memcpy(server + SRTP_MASTER_KEY_LENGTH, material + 2*SRTP_MASTER_KEY_LENGTH + SRTP_MASTER_SALT_LENGTH, SRTP_MASTER_SALT_LENGTH);
+	if(janus_bench_srtp_create(&pc->srtp_out, &pc->local_policy, local, TRUE) < 0 ||
+			janus_bench_srtp_create(&pc->srtp_in, &pc->remote_policy, remote, FALSE) < 0) {
+		JANUS_LOG(LOG_ERR, "[%d] Error creating the SRTP contexts\n", pc->index);
+		g_atomic_int_set(&pc->state, janus_bench_pc_failed);
+		return;
+	}
+	pc->ready = g_get_monotonic_time();
+	g_atomic_int_set(&pc->state, janus_bench_pc_ready);
+	JANUS_LOG(LOG_VERB, "[%d] PeerConnection ready (%"SCNi64"ms)\n", pc->index, (pc->ready - pc->started)/1000);
+}
+
+
+/* Media */
+static void janus_bench_latency_record(janus_bench_worker *worker, gint64 latency) {
+	int bucket = latency < 0 ? 0 : latency/JANUS_BENCH_LATENCY_BUCKET;
+	if(bucket > JANUS_BENCH_LATENCY_BUCKETS)
+		bucket = JANUS_BENCH_LATENCY_BUCKETS;
+	janus_mutex_lock_nodebug(&worker->mutex);
+	worker->latencies[bucket]++;
+	janus_mutex_unlock_nodebug(&worker->mutex);
+}
+
+static void janus_bench_incoming_rtp(janus_bench_pc *pc, char *buf, int len) {
+	if(srtp_unprotect(pc->srtp_in, buf, &len) != srtp_err_status_ok)
+		return;
+	g_atomic_int_inc(&pc->rx_packets);
+	__sync_fetch_and_add(&pc->rx_bytes, (guint64)len);
+	janus_rtp_header *header = (janus_rtp_header *)buf;
+	int hlen = RTP_HEADER_SIZE + header->csrccount*4;
+	if(header->extension && len > hlen + 4) {
+		uint16_t ext_len = 0;
+		memcpy(&ext_len, buf + hlen + 2, sizeof(ext_len));
+		hlen += 4 + ntohs(ext_len)*4;
+	}
+	/* Skip the VP8 payload descriptor we added, if this is video */
+	if(pc->has_video && header->type == pc->video_pt)
+		hlen++;
+	if(len < hlen + (int)sizeof(janus_bench_probe))
+		return;
+	janus_bench_probe probe;
+	memcpy(&probe, buf + hlen, sizeof(probe));
+	if(probe.magic != JANUS_BENCH_MAGIC)
+		return;
+	janus_bench_latency_record(pc->worker, g_get_monotonic_time() - probe.sent);
+}
+
+static void janus_bench_recv(NiceAgent *agent, guint stream_id, guint component_id, guint len, gchar *buf, gpointer user_data) {
+	janus_bench_pc *pc = (janus_bench_pc *)user_data;
+	if(len < 2)
+		return;
+	guint8 first = (guint8)buf[0];
+	if(first >= 20 && first <= 63) {
+		/* DTLS */
+		BIO_write(pc->read_bio, buf, len);
+		if(!SSL_is_init_finished(pc->ssl)) {
+			SSL_do_handshake(pc->ssl);
+			janus_bench_dtls_flush(pc);
+			if(g_atomic_int_get(&pc->state) == janus_bench_pc_dtls)
+				janus_bench_dtls_check(pc);
+		} else {
+			char data[1500];
+			if(SSL_read(pc->ssl, data, sizeof(data)) <= 0 && (SSL_get_shutdown(pc->ssl) & SSL_RECEIVED_SHUTDOWN)) {
+				JANUS_LOG(LOG_WARN, "[%d] DTLS alert received, closing\n", pc->index);
+				g_atomic_int_set(&pc->state, janus_bench_pc_failed);
+			}
+			janus_bench_dtls_flush(pc);
+		}
+		return;
+	}
+	if(first < 128 || first > 191 || g_atomic_int_get(&pc->state) != janus_bench_pc_ready)
+		return;
+	guint8 pt = (guint8)buf[1];
+	if(pt >= 192 && pt <= 223) {
+		/* RTCP, we just count it */
+		int rtcp_len = len;
+		if(srtp_unprotect_rtcp(pc->srtp_in, buf, &rtcp_len) == srtp_err_status_ok)
+			g_atomic_int_inc(&pc->rx_rtcp);
+		return;
+	}
+	janus_bench_incoming_rtp(pc, buf, len);
+}
+
+static void janus_bench_gathering_done(NiceAgent *agent, guint stream_id, gpointer user_data) {
+	janus_bench_pc *pc = (janus_bench_pc *)user_data;
+	g_atomic_int_set(&pc->gathered, 1);
+}
+
+static void janus_bench_state_changed(NiceAgent *agent, guint stream_id, guint component_id, guint state, gpointer user_data) {
+	janus_bench_pc *pc = (janus_bench_pc *)user_data;
+	if(state == NICE_COMPONENT_STATE_FAILED) {
+		JANUS_LOG(LOG_ERR, "[%d] ICE failed\n", pc->index);
+		g_atomic_int_set(&pc->state, janus_bench_pc_failed);
+		return;
+	}
+	if((state != NICE_COMPONENT_STATE_CONNECTED && state != NICE_COMPONENT_STATE_READY) ||
+			g_atomic_int_get(&pc->state) != janus_bench_pc_new)
+		return;
+	/* ICE is up, start DTLS */
+	g_atomic_int_set(&pc->state, janus_bench_pc_dtls);
+	if(pc->dtls_client) {
+		SSL_do_handshake(pc->ssl);
+		janus_bench_dtls_flush(pc);
+	}
+}
+
+static void janus_bench_send(janus_bench_pc *pc, gboolean video, gboolean marker, gboolean start, int payload_len) {
+	char buf[RTP_HEADER_SIZE + 1 + JANUS_BENCH_MAX_PAYLOAD + SRTP_MAX_TRAILER_LEN];
+	janus_rtp_header *header = (janus_rtp_header *)buf;
+	memset(buf, 0, RTP_HEADER_SIZE + 1 + payload_len);
+	header->version = 2;
+	header->markerbit = marker;
+	header->type = video ? pc->video_pt : pc->audio_pt;
+	header->seq_number = htons(video ? pc->video_seq++ : pc->audio_seq++);
+	header->timestamp = htonl(video ? pc->video_ts : pc->audio_ts);
+	header->ssrc = htonl(video ? pc->video_ssrc : pc->audio_ssrc);
+	int len = RTP_HEADER_SIZE;
+	if(video) {
+		/* Minimal VP8 payload descriptor, with just the start of partition bit */
+		buf[len] = start ? 0x10 : 0x00;
+		len++;
+	}
+	janus_bench_probe probe = { .magic = JANUS_BENCH_MAGIC, .stream = pc->index, .sent = g_get_monotonic_time() };
+	memcpy(buf + len, &probe, sizeof(probe));
+	len += payload_len;
+	if(pc->rtp_fd > 0) {
+		/* Feeding a Streaming mountpoint, no ICE or DTLS-SRTP involved */
+		struct sockaddr_in *addr = video ? &pc->video_addr : &pc->audio_addr;
+		if(sendto(pc->rtp_fd, buf, len, 0, (struct sockaddr *)addr, sizeof(*addr)) > 0) {
+			g_atomic_int_inc(&pc->tx_packets);
+			__sync_fetch_and_add(&pc->tx_bytes, (guint64)len);
+		}
+		return;
+	}
+	if(srtp_protect(pc->srtp_out, buf, &len) != srtp_err_status_ok)
+		return;
+	if(nice_agent_send(pc->agent, pc->stream_id, 1, len, buf) > 0) {
+		g_atomic_int_inc(&pc->tx_packets);
+		__sync_fetch_and_add(&pc->tx_bytes, (guint64)len);
+	}
+}
+
+static gboolean janus_bench_audio_tick(gpointer user_data) {
+	janus_bench_worker *worker = (janus_bench_worker *)user_data;
+	int size = audio_kbps*1000/8/50;
+	if(size < (int)sizeof(janus_bench_probe))
+		size = sizeof(janus_bench_probe);
+	if(size > JANUS_BENCH_MAX_PAYLOAD)
+		size = JANUS_BENCH_MAX_PAYLOAD;
+	GSList *l = worker->pcs;
+	while(l) {
+		janus_bench_pc *pc = (janus_bench_pc *)l->data;
+		l = l->next;
+		int state = g_atomic_int_get(&pc->state);
+		if(state == janus_bench_pc_dtls && !SSL_is_init_finished(pc->ssl)) {
+			/* Take care of DTLS retransmissions, if needed */
+			if(DTLSv1_handle_timeout(pc->ssl) > 0)
+				janus_bench_dtls_flush(pc);
+			continue;
+		}
+		if(state != janus_bench_pc_ready || !pc->sending || !pc->has_audio || audio_kbps == 0)
+			continue;
+		janus_bench_send(pc, FALSE, FALSE, FALSE, size);
+		pc->audio_ts += 960;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean janus_bench_video_tick(gpointer user_data) {
+	janus_bench_worker *worker = (janus_bench_worker *)user_data;
+	if(video_kbps == 0)
+		return G_SOURCE_CONTINUE;
+	int frame = video_kbps*1000/8/30;
+	if(frame < (int)sizeof(janus_bench_probe))
+		frame = sizeof(janus_bench_probe);
+	GSList *l = worker->pcs;
+	while(l) {
+		janus_bench_pc *pc = (janus_bench_pc *)l->data;
+		l = l->next;
+		if(g_atomic_int_get(&pc->state) != janus_bench_pc_ready || !pc->sending || !pc->has_video)
+			continue;
+		/* Split the frame in as many packets as needed, marking the last one */
+		int left = frame;
+		gboolean start = TRUE;
+		while(left > 0) {
+			int size = left > JANUS_BENCH_MAX_PAYLOAD ? JANUS_BENCH_MAX_PAYLOAD : left;
+			if(size < (int)sizeof(janus_bench_probe))
+				size = sizeof(janus_bench_probe);
+			left -= size;
+			janus_bench_send(pc, TRUE, left <= 0, start, size);
+			start = FALSE;
+		}
+		pc->video_ts += 3000;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean janus_bench_worker_add(gpointer user_data) {
+	janus_bench_pc *pc = (janus_bench_pc *)user_data;
+	pc->worker->pcs = g_slist_append(pc->worker->pcs, pc);
+	return G_SOURCE_REMOVE;
+}
+
+static void *janus_bench_worker_thread(void *data) {
+	janus_bench_worker *worker = (janus_bench_worker *)data;
+	GSource *audio = g_timeout_source_new(20);
+	g_source_set_callback(audio, janus_bench_audio_tick, worker, NULL);
+	g_source_attach(audio, worker->context);
+	g_source_unref(audio);
+	GSource *video = g_timeout_source_new(33);
+	g_source_set_callback(video, janus_bench_video_tick, worker, NULL);
+	g_source_attach(video, worker->context);
+	g_source_unref(video);
+	g_main_loop_run(worker->loop);
+	return NULL;
+}
+
+
+/* PeerConnections */
+static janus_bench_pc *janus_bench_pc_create(int index, gboolean offerer) {
+	janus_bench_pc *pc = g_malloc0(sizeof(janus_bench_pc));
+	pc->index = index;
+	pc->offerer = offerer;
+	pc->worker = workers[index % workers_num];
+	pc->audio_pt = 111;
+	pc->video_pt = 96;
+	pc->audio_ssrc = g_random_int();
+	pc->video_ssrc = g_random_int();
+	pc->audio_seq = g_random_int_range(0, 65536);
+	pc->video_seq = g_random_int_range(0, 65536);
+	pc->audio_ts = g_random_int();
+	pc->video_ts = g_random_int();
+	pc->started = g_get_monotonic_time();
+	pc->ssl = SSL_new(ssl_ctx);
+	pc->read_bio = BIO_new(BIO_s_mem());
+	pc->write_bio = BIO_new(BIO_s_mem());
+	BIO_set_mem_eof_return(pc->read_bio, -1);
+	BIO_set_mem_eof_return(pc->write_bio, -1);
+	SSL_set_bio(pc->ssl, pc->read_bio, pc->write_bio);
+	pc->agent = nice_agent_new(pc->worker->context, NICE_COMPATIBILITY_RFC5245);
+	g_object_set(G_OBJECT(pc->agent), "upnp", FALSE, NULL);
+	g_object_set(G_OBJECT(pc->agent), "controlling-mode", offerer, NULL);
+	g_signal_connect(G_OBJECT(pc->agent), "candidate-gathering-done", G_CALLBACK(janus_bench_gathering_done), pc);
+	g_signal_connect(G_OBJECT(pc->agent), "component-state-changed", G_CALLBACK(janus_bench_state_changed), pc);
+	pc->stream_id = nice_agent_add_stream(pc->agent, 1);
+	nice_agent_attach_recv(pc->agent, pc->stream_id, 1, pc->worker->context, janus_bench_recv, pc);
+	nice_agent_gather_candidates(pc->agent, pc->stream_id);
+	/* Wait for the candidates, as we don't trickle */
+	gint64 end = g_get_monotonic_time() + JANUS_BENCH_SETUP_TIMEOUT;
+	while(!g_atomic_int_get(&pc->gathered) && g_get_monotonic_time() < end)
+		g_usleep(5000);
+	if(!g_atomic_int_get(&pc->gathered))
+		JANUS_LOG(LOG_WARN, "[%d] Gathering not completed, going on anyway\n", index);
+	return pc;
+}
+
+/* Plain RTP source for a Streaming mountpoint: it's driven by the first media thread */
+static janus_bench_pc *janus_bench_feed_create(void) {
+	janus_bench_pc *pc = g_malloc0(sizeof(janus_bench_pc));
+	pc->index = -1;
+	pc->worker = workers[0];
+	pc->sending = TRUE;
+	pc->has_audio = TRUE;
+	pc->has_video = (video_kbps > 0);
+	pc->audio_pt = JANUS_BENCH_FEED_AUDIO_PT;
+	pc->video_pt = JANUS_BENCH_FEED_VIDEO_PT;
+	pc->audio_ssrc = g_random_int();
+	pc->video_ssrc = g_random_int();
+	pc->audio_seq = g_random_int_range(0, 65536);
+	pc->video_seq = g_random_int_range(0, 65536);
+	pc->audio_ts = g_random_int();
+	pc->video_ts = g_random_int();
+	pc->audio_addr.sin_family = AF_INET;
+	pc->audio_addr.sin_port = htons(audio_port);
+	pc->video_addr.sin_family = AF_INET;
+	pc->video_addr.sin_port = htons(video_port);
+	if(inet_pton(AF_INET, rtp_host, &pc->audio_addr.sin_addr) != 1) {
+		JANUS_LOG(LOG_ERR, "Invalid RTP host %s (should be an IPv4 address)\n", rtp_host);
+		g_free(pc);
+		return NULL;
+	}
+	pc->video_addr.sin_addr = pc->audio_addr.sin_addr;
+	pc->rtp_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if(pc->rtp_fd <= 0) {
+		JANUS_LOG(LOG_ERR, "Error creating the RTP socket to feed the mountpoint\n");
+		g_free(pc);
+		return NULL;
+	}
+	g_atomic_int_set(&pc->state, janus_bench_pc_ready);
+	g_main_context_invoke(pc->worker->context, janus_bench_worker_add, pc);
+	return pc;
+}
+
+static void janus_bench_pc_destroy(janus_bench_pc *pc) {
+	if(pc == NULL)
+		return;
+	if(pc->rtp_fd > 0)
+		close(pc->rtp_fd);
+	if(pc->agent)
+		g_object_unref(pc->agent);
+	if(pc->ssl)
+		SSL_free(pc->ssl);	/* This frees the BIOs too */
+	if(pc->srtp_in)
+		srtp_dealloc(pc->srtp_in);
+	if(pc->srtp_out)
+		srtp_dealloc(pc->srtp_out);
+	g_free(pc);
+}
+
+/* Add our ICE and DTLS attributes to an SDP we're generating */
+static void janus_bench_sdp_transport(janus_bench_pc *pc, GString *sdp, gboolean first) {
+	gchar *ufrag = NULL, *pwd = NULL;
+	nice_agent_get_local_credentials(pc->agent, pc->stream_id, &ufrag, &pwd);
+	g_string_append_printf(sdp,
+		"c=IN IP4 0.0.0.0\r\n"
+		"a=ice-ufrag:%s\r\n"
+		"a=ice-pwd:%s\r\n"
+		"a=fingerprint:sha-256 %s\r\n"
+		"a=setup:%s\r\n"
+		"a=rtcp-mux\r\n",
+		ufrag, pwd, local_fingerprint, pc->offerer ? "actpass" : "active");
+	g_free(ufrag);
+	g_free(pwd);
+	if(!first)
+		return;
+	/* Media is bundled, so we only need candidates in the first m-line */
+	GSList *candidates = nice_agent_get_local_candidates(pc->agent, pc->stream_id, 1), *l = candidates;
+	while(l) {
+		gchar *line = nice_agent_generate_local_candidate_sdp(pc->agent, (NiceCandidate *)l->data);
+		if(line) {
+			g_string_append_printf(sdp, "%s\r\n", line);
+			g_free(line);
+		}
+		nice_candidate_free((NiceCandidate *)l->data);
+		l = l->next;
+	}
+	g_slist_free(candidates);
+	g_string_append(sdp, "a=end-of-candidates\r\n");
+}
+
+static char *janus_bench_offer(janus_bench_pc *pc) {
+	GString *sdp = g_string_new(NULL);
+	g_string_append_printf(sdp,
+		"v=0\r\n"
+		"o=- %"SCNu32" 1 IN IP4 127.0.0.1\r\n"
+		"s=janus-bench\r\n"
+		"t=0 0\r\n"
+		"a=group:BUNDLE audio%s\r\n"
+		"a=msid-semantic: WMS bench\r\n"
+		"m=audio 9 UDP/TLS/RTP/SAVPF %d\r\n",
+		g_random_int(), video_kbps > 0 ? " video" : "", pc->audio_pt);
+	janus_bench_sdp_transport(pc, sdp, TRUE);
+	g_string_append_printf(sdp,
+		"a=mid:audio\r\n"
+		"a=sendrecv\r\n"
+		"a=rtpmap:%d opus/48000/2\r\n"
+		"a=ssrc:%"SCNu32" cname:bench%d\r\n",
+		pc->audio_pt, pc->audio_ssrc, pc->index);
+	if(video_kbps > 0) {
+		g_string_append_printf(sdp, "m=video 9 UDP/TLS/RTP/SAVPF %d\r\n", pc->video_pt);
+		janus_bench_sdp_transport(pc, sdp, FALSE);
+		g_string_append_printf(sdp,
+			"a=mid:video\r\n"
+			"a=sendrecv\r\n"
+			"a=rtpmap:%d VP8/90000\r\n"
+			"a=rtcp-fb:%d nack\r\n"
+			"a=rtcp-fb:%d nack pli\r\n"
+			"a=rtcp-fb:%d goog-remb\r\n"
+			"a=ssrc:%"SCNu32" cname:bench%d\r\n",
+			pc->video_pt, pc->video_pt, pc->video_pt, pc->video_pt, pc->video_ssrc, pc->index);
+	}
+	return g_string_free(sdp, FALSE);
+}
+
+static char *janus_bench_answer(janus_bench_pc *pc, janus_bench_sdp *offer) {
+	GString *sdp = g_string_new(NULL);
+	g_string_append_printf(sdp,
+		"v=0\r\n"
+		"o=- %"SCNu32" 1 IN IP4 127.0.0.1\r\n"
+		"s=janus-bench\r\n"
+		"t=0 0\r\n",
+		g_random_int());
+	GString *bundle = g_string_new("a=group:BUNDLE");
+	GSList *l = offer->mlines;
+	while(l) {
+		janus_bench_mline *m = (janus_bench_mline *)l->data;
+		if(m->port > 0 && m->mid && (!strcmp(m->type, "audio") || !strcmp(m->type, "video")))
+			g_string_append_printf(bundle, " %s", m->mid);
+		l = l->next;
+	}
+	g_string_append_printf(sdp, "%s\r\n", bundle->str);
+	g_string_free(bundle, TRUE);
+	gboolean first = TRUE;
+	l = offer->mlines;
+	while(l) {
+		janus_bench_mline *m = (janus_bench_mline *)l->data;
+		l = l->next;
+		if(m->port == 0 || (strcmp(m->type, "audio") && strcmp(m->type, "video"))) {
+			/* Reject anything that isn't audio or video */
+			g_string_append_printf(sdp, "m=%s 0 %s %s\r\n", m->type, m->proto, m->fmt);
+			if(m->mid)
+				g_string_append_printf(sdp, "a=mid:%s\r\n", m->mid);
+			continue;
+		}
+		g_string_append_printf(sdp, "m=%s 9 UDP/TLS/RTP/SAVPF %s\r\n", m->type, m->fmt);
+		janus_bench_sdp_transport(pc, sdp, first);
+		first = FALSE;
+		if(m->mid)
+			g_string_append_printf(sdp, "a=mid:%s\r\n", m->mid);
+		g_string_append(sdp, "a=recvonly\r\n");
+		if(m->rtpmap)
+			g_string_append_printf(sdp, "a=%s\r\n", m->rtpmap);
+		if(!strcmp(m->type, "audio")) {
+			pc->has_audio = TRUE;
+			pc->audio_pt = atoi(m->fmt);
+		} else {
+			pc->has_video = TRUE;
+			pc->video_pt = atoi(m->fmt);
+		}
+	}
+	return g_string_free(sdp, FALSE);
+}
+
+/* Pass the remote candidates and credentials to libnice, and figure out the DTLS role */
+static int janus_bench_pc_remote(janus_bench_pc *pc, janus_bench_sdp *sdp) {
+	if(sdp->ufrag == NULL || sdp->pwd == NULL) {
+		JANUS_LOG(LOG_ERR, "[%d] Missing ICE credentials in the remote SDP\n", pc->index);
+		return -1;
+	}
+	/* If Janus is the DTLS client, we're the server (and the other way around) */
+	pc->dtls_client = !(sdp->setup && !strcasecmp(sdp->setup, "active"));
+	if(pc->dtls_client)
+		SSL_set_connect_state(pc->ssl);
+	else
+		SSL_set_accept_state(pc->ssl);
+	if(pc->offerer) {
+		/* Check what was negotiated in the answer */
+		GSList *l = sdp->mlines;
+		while(l) {
+			janus_bench_mline *m = (janus_bench_mline *)l->data;
+			if(!strcmp(m->type, "audio") && m->port > 0) {
+				pc->has_audio = TRUE;
+				pc->audio_pt = atoi(m->fmt);
+			} else if(!strcmp(m->type, "video") && m->port > 0) {
+				pc->has_video = TRUE;
+				pc->video_pt = atoi(m->fmt);
+			}
+			l = l->next;
+		}
+	}
+	nice_agent_set_remote_credentials(pc->agent, pc->stream_id, sdp->ufrag, sdp->pwd);
+	GSList *candidates = NULL, *l = sdp->candidates;
+	while(l) {
+		NiceCandidate *c = nice_agent_parse_remote_candidate_sdp(pc->agent, pc->stream_id, (const char *)l->data);
+		if(c != NULL && c->component_id == 1)
+			candidates = g_slist_append(candidates, c);
+		else if(c != NULL)
+			nice_candidate_free(c);
+		l = l->next;
+	}
+	if(candidates == NULL) {
+		JANUS_LOG(LOG_ERR, "[%d] No usable candidate in the remote SDP\n", pc->index);
+		return -1;
+	}
+	nice_agent_set_remote_candidates(pc->agent, pc->stream_id, 1, candidates);
+	g_slist_free_full(candidates, (GDestroyNotify)nice_candidate_free);
+	/* The worker can start taking care of this PeerConnection now */
+	g_main_context_invoke(pc->worker->context, janus_bench_worker_add, pc);
+	return 0;
+}
+
+/* Wait for a PeerConnection to be up, or fail */
+static gboolean janus_bench_pc_wait(janus_bench_pc *pc) {
+	gint64 end = g_get_monotonic_time() + JANUS_BENCH_SETUP_TIMEOUT;
+	while(!g_atomic_int_get(&stop) && g_get_monotonic_time() < end) {
+		int state = g_atomic_int_get(&pc->state);
+		if(state == janus_bench_pc_ready)
+			return TRUE;
+		if(state == janus_bench_pc_failed)
+			return FALSE;
+		g_usleep(5000);
+	}
+	return FALSE;
+}
+
+
+/* Streams */
+static int janus_bench_stream_setup(janus_bench_stream *stream) {
+	stream->session_id = janus_bench_create(0, NULL);
+	if(stream->session_id == 0)
+		return -1;
+	stream->last_keepalive = g_get_monotonic_time();
+	stream->handle_id = janus_bench_create(stream->session_id,
+		streaming ? "janus.plugin.streaming" : (videoroom ? "janus.plugin.videoroom" : "janus.plugin.echotest"));
+	if(stream->handle_id == 0)
+		return -1;
+	json_t *event = NULL;
+	if(streaming) {
+		/* Watch the mountpoint: we only receive, the feed is what sends */
+		if(janus_bench_message(stream, stream->handle_id,
+				json_pack("{sssI}", "request", "watch", "id", (json_int_t)mountpoint_id), NULL, NULL) < 0)
+			return -1;
+		event = janus_bench_wait_event(stream, stream->handle_id, TRUE);
+		if(event == NULL)
+			return -1;
+		janus_bench_sdp *offer = janus_bench_sdp_parse(json_string_value(json_object_get(json_object_get(event, "jsep"), "sdp")));
+		json_decref(event);
+		if(offer == NULL) {
+			JANUS_LOG(LOG_ERR, "[%d] Couldn't watch mountpoint %"SCNu64"\n", stream->index, mountpoint_id);
+			return -1;
+		}
+		stream->sub = janus_bench_pc_create(stream->index, FALSE);
+		char *answer = janus_bench_answer(stream->sub, offer);
+		int res = janus_bench_pc_remote(stream->sub, offer);
+		janus_bench_sdp_free(offer);
+		if(res == 0)
+			res = janus_bench_message(stream, stream->handle_id, json_pack("{ss}", "request", "start"), "answer", answer);
+		g_free(answer);
+		if(res < 0 || janus_bench_trickle_completed(stream, stream->handle_id) < 0)
+			return -1;
+		return janus_bench_pc_wait(stream->sub) ? 0 : -1;
+	}
+	if(videoroom) {
+		/* Join as a publisher first, so that we know our ID */
+		char display[32];
+		g_snprintf(display, sizeof(display), "bench-%d", stream->index);
+		if(janus_bench_message(stream, stream->handle_id,
+				json_pack("{sssssIss}", "request", "join", "ptype", "publisher", "room", (json_int_t)room_id, "display", display), NULL, NULL) < 0)
+			return -1;
+		event = janus_bench_wait_event(stream, stream->handle_id, FALSE);
+		if(event == NULL)
+			return -1;
+		stream->publisher_id = json_integer_value(json_object_get(json_object_get(json_object_get(event, "plugindata"), "data"), "id"));
+		json_decref(event);
+		if(stream->publisher_id == 0) {
+			JANUS_LOG(LOG_ERR, "[%d] Couldn't join room %"SCNu64"\n", stream->index, room_id);
+			return -1;
+		}
+	}
+	/* Create the PeerConnection we'll send media on, and negotiate it */
+	stream->pc = janus_bench_pc_create(stream->index, TRUE);
+	stream->pc->sending = TRUE;
+	char *offer = janus_bench_offer(stream->pc);
+	json_t *body = videoroom ?
+		json_pack("{sssbsb}", "request", "configure", "audio", 1, "video", video_kbps > 0) :
+		json_pack("{sbsb}", "audio", 1, "video", video_kbps > 0);
+	int res = janus_bench_message(stream, stream->handle_id, body, "offer", offer);
+	g_free(offer);
+	if(res < 0 || janus_bench_trickle_completed(stream, stream->handle_id) < 0)
+		return -1;
+	event = janus_bench_wait_event(stream, stream->handle_id, TRUE);
+	if(event == NULL)
+		return -1;
+	janus_bench_sdp *answer = janus_bench_sdp_parse(json_string_value(json_object_get(json_object_get(event, "jsep"), "sdp")));
+	json_decref(event);
+	res = janus_bench_pc_remote(stream->pc, answer);
+	janus_bench_sdp_free(answer);
+	if(res < 0 || !janus_bench_pc_wait(stream->pc))
+		return -1;
+	if(!videoroom)
+		return 0;
+	/* Subscribe to ourselves, to have something to receive */
+	stream->sub_handle_id = janus_bench_create(stream->session_id, "janus.plugin.videoroom");
+	if(stream->sub_handle_id == 0)
+		return -1;
+	if(janus_bench_message(stream, stream->sub_handle_id,
+			json_pack("{sssssIsI}", "request", "join", "ptype", "listener", "room", (json_int_t)room_id, "feed", (json_int_t)stream->publisher_id), NULL, NULL) < 0)
+		return -1;
+	event = janus_bench_wait_event(stream, stream->sub_handle_id, TRUE);
+	if(event == NULL)
+		return -1;
+	janus_bench_sdp *sub_offer = janus_bench_sdp_parse(json_string_value(json_object_get(json_object_get(event, "jsep"), "sdp")));
+	json_decref(event);
+	stream->sub = janus_bench_pc_create(stream->index, FALSE);
+	char *sub_answer = janus_bench_answer(stream->sub, sub_offer);
+	res = janus_bench_pc_remote(stream->sub, sub_offer);
+	janus_bench_sdp_free(sub_offer);
+	if(res == 0)
+		res = janus_bench_message(stream, stream->sub_handle_id, json_pack("{sssI}", "request", "start", "room", (json_int_t)room_id), "answer", sub_answer);
+	g_free(sub_answer);
+	if(res < 0 || janus_bench_trickle_completed(stream, stream->sub_handle_id) < 0)
+		return -1;
+	return janus_bench_pc_wait(stream->sub) ? 0 : -1;
+}
+
+static void janus_bench_stream_destroy(janus_bench_stream *stream) {
+	if(stream == NULL)
+		return;
+	if(stream->session_id > 0) {
+		json_t *request = json_object();
+		json_object_set_new(request, "janus", json_string("destroy"));
+		json_t *response = janus_bench_request(stream->session_id, 0, request);
+		if(response)
+			json_decref(response);
+	}
+	janus_bench_pc_destroy(stream->pc);
+	janus_bench_pc_destroy(stream->sub);
+	g_free(stream);
+}
+
+
+/* Statistics */
+typedef struct janus_bench_stats {
+	guint64 tx_packets, rx_packets, tx_bytes, rx_bytes;
+	int connected;
+	gint64 when;
+	guint64 janus_cpu, bench_cpu;	/* In microseconds */
+} janus_bench_stats;
+
+static guint64 janus_bench_janus_cpu(void) {
+	if(janus_pid <= 0)
+		return 0;
+	char path[64], *contents = NULL;
+	g_snprintf(path, sizeof(path), "/proc/%d/stat", janus_pid);
+	if(!g_file_get_contents(path, &contents, NULL, NULL))
+		return 0;
+	/* The command name may contain spaces, so start after its closing bracket */
+	guint64 utime = 0, stime = 0;
+	char *c = strrchr(contents, ')');
+	if(c == NULL || sscanf(c+2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %"SCNu64" %"SCNu64, &utime, &stime) != 2)
+		utime = stime = 0;
+	g_free(contents);
+	return (utime + stime) * G_USEC_PER_SEC / sysconf(_SC_CLK_TCK);
+}
+
+static guint64 janus_bench_own_cpu(void) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (guint64)usage.ru_utime.tv_sec*G_USEC_PER_SEC + usage.ru_utime.tv_usec +
+		(guint64)usage.ru_stime.tv_sec*G_USEC_PER_SEC + usage.ru_stime.tv_usec;
+}
+
+static void janus_bench_stats_get(janus_bench_stats *stats) {
+	memset(stats, 0, sizeof(*stats));
+	stats->when = g_get_monotonic_time();
+	int i = 0;
+	for(i=0; i<streams_created; i++) {
+		janus_bench_stream *stream = streams[i];
+		janus_bench_pc *rx = stream->sub ? stream->sub : stream->pc;
+		if((stream->pc == NULL && !streaming) || rx == NULL)
+			continue;
+		if(g_atomic_int_get(&rx->state) == janus_bench_pc_ready)
+			stats->connected++;
+		if(stream->pc != NULL) {
+			stats->tx_packets += (guint)g_atomic_int_get(&stream->pc->tx_packets);
+			stats->tx_bytes += __sync_fetch_and_add(&stream->pc->tx_bytes, 0);
+		}
+		stats->rx_packets += (guint)g_atomic_int_get(&rx->rx_packets);
+		stats->rx_bytes += __sync_fetch_and_add(&rx->rx_bytes, 0);
+	}
+	if(feed != NULL) {
+		/* All listeners receive what the feed sends */
+		stats->tx_packets = (guint)g_atomic_int_get(&feed->tx_packets);
+		stats->tx_bytes = __sync_fetch_and_add(&feed->tx_bytes, 0);
+	}
+	stats->janus_cpu = janus_bench_janus_cpu();
+	stats->bench_cpu = janus_bench_own_cpu();
+}
+
+/* Collect the latencies all workers measured since the last time, adding them to a histogram */
+static void janus_bench_latencies_collect(guint *histogram) {
+	int i = 0, j = 0;
+	for(i=0; i<workers_num; i++) {
+		janus_bench_worker *worker = workers[i];
+		janus_mutex_lock_nodebug(&worker->mutex);
+		for(j=0; j<=JANUS_BENCH_LATENCY_BUCKETS; j++) {
+			histogram[j] += worker->latencies[j];
+			worker->latencies[j] = 0;
+		}
+		janus_mutex_unlock_nodebug(&worker->mutex);
+	}
+}
+
+/* Get a percentile (in milliseconds) out of a histogram */
+static double janus_bench_latency_percentile(guint *histogram, double quantile) {
+	guint64 count = 0, seen = 0;
+	int i = 0;
+	for(i=0; i<=JANUS_BENCH_LATENCY_BUCKETS; i++)
+		count += histogram[i];
+	if(count == 0)
+		return 0.0;
+	for(i=0; i<=JANUS_BENCH_LATENCY_BUCKETS; i++) {
+		seen += histogram[i];
+		if(seen >= quantile*count)
+			break;
+	}
+	return (double)(i+1)*JANUS_BENCH_LATENCY_BUCKET/1000.0;
+}
+
+static void janus_bench_report(janus_bench_stats *prev, janus_bench_stats *now, guint *histogram, json_t **summary) {
+	double elapsed = (double)(now->when - prev->when)/G_USEC_PER_SEC;
+	if(elapsed <= 0)
+		return;
+	double tx_pps = (now->tx_packets - prev->tx_packets)/elapsed;
+	double rx_pps = (now->rx_packets - prev->rx_packets)/elapsed;
+	double tx_kbps = (now->tx_bytes - prev->tx_bytes)*8/elapsed/1000;
+	double rx_kbps = (now->rx_bytes - prev->rx_bytes)*8/elapsed/1000;
+	/* With the Streaming plugin, every packet we send is expected by each listener */
+	double fanout = (streaming && now->connected > 0) ? now->connected : 1;
+	double loss = now->tx_packets > prev->tx_packets ?
+		100.0*(1.0 - (double)(now->rx_packets - prev->rx_packets)/((now->tx_packets - prev->tx_packets)*fanout)) : 0.0;
+	if(loss < 0)
+		loss = 0;
+	double janus_cpu = janus_pid > 0 ? 100.0*(now->janus_cpu - prev->janus_cpu)/(elapsed*G_USEC_PER_SEC) : -1;
+	double bench_cpu = 100.0*(now->bench_cpu - prev->bench_cpu)/(elapsed*G_USEC_PER_SEC);
+	double p50 = janus_bench_latency_percentile(histogram, 0.5), p90 = janus_bench_latency_percentile(histogram, 0.9),
+		p99 = janus_bench_latency_percentile(histogram, 0.99), max = janus_bench_latency_percentile(histogram, 1.0);
+	if(summary == NULL || !json_summary) {
+		JANUS_LOG(LOG_INFO, "%s%d/%d streams, tx %.0f pps (%.0f kbps), rx %.0f pps (%.0f kbps), loss %.2f%%\n",
+			summary ? "[summary] " : "", now->connected, streams_num, tx_pps, tx_kbps, rx_pps, rx_kbps, loss);
+		JANUS_LOG(LOG_INFO, "%slatency p50 %.1fms, p90 %.1fms, p99 %.1fms, max %.1fms\n",
+			summary ? "[summary] " : "", p50, p90, p99, max);
+		if(janus_pid > 0) {
+			JANUS_LOG(LOG_INFO, "%sJanus CPU %.1f%% (%.2f%% per %s), janus-bench CPU %.1f%%\n",
+				summary ? "[summary] " : "", janus_cpu, now->connected ? janus_cpu/now->connected : 0.0,
+				streaming ? "listener" : "stream", bench_cpu);
+		} else {
+			JANUS_LOG(LOG_INFO, "%sjanus-bench CPU %.1f%%\n", summary ? "[summary] " : "", bench_cpu);
+		}
+	}
+	if(summary == NULL)
+		return;
+	*summary = json_object();
+	json_object_set_new(*summary, "plugin", json_string(streaming ? "streaming" : (videoroom ? "videoroom" : "echotest")));
+	json_object_set_new(*summary, "streams", json_integer(streams_num));
+	json_object_set_new(*summary, "connected", json_integer(now->connected));
+	json_object_set_new(*summary, "duration", json_real(elapsed));
+	json_object_set_new(*summary, "tx_pps", json_real(tx_pps));
+	json_object_set_new(*summary, "rx_pps", json_real(rx_pps));
+	json_object_set_new(*summary, "tx_kbps", json_real(tx_kbps));
+	json_object_set_new(*summary, "rx_kbps", json_real(rx_kbps));
+	json_object_set_new(*summary, "loss", json_real(loss));
+	json_object_set_new(*summary, "latency_ms", json_pack("{sfsfsfsf}", "p50", p50, "p90", p90, "p99", p99, "max", max));
+	if(janus_pid > 0) {
+		json_object_set_new(*summary, "janus_cpu", json_real(janus_cpu));
+		json_object_set_new(*summary, "janus_cpu_per_stream", json_real(now->connected ? janus_cpu/now->connected : 0.0));
+	}
+	json_object_set_new(*summary, "bench_cpu", json_real(bench_cpu));
+}
+
+
+int main(int argc, char *argv[])
+{
+	janus_log_init(FALSE, TRUE, NULL);
+	atexit(janus_log_destroy);
+
+	/* Evaluate arguments */
+	const char *plugin = NULL;
+	gchar *server_opt = NULL;
+	gint64 room_opt = 0, mountpoint_opt = 0;
+	gchar *rtp_host_opt = NULL;
+	GOptionEntry entries[] = {
+		{ "server", 's', 0, G_OPTION_ARG_STRING, &server_opt, "Address of the Janus REST API (default http://127.0.0.1:8088/janus)", "url" },
+		{ "plugin", 'p', 0, G_OPTION_ARG_STRING, &plugin, "Plugin to test, echotest (default), videoroom or streaming", "name" },
+		{ "room", 'r', 0, G_OPTION_ARG_INT64, &room_opt, "VideoRoom room to publish in (default 1234)", "id" },
+		{ "mountpoint", 'm', 0, G_OPTION_ARG_INT64, &mountpoint_opt, "Streaming mountpoint to watch (default 1), it must be a live RTP one", "id" },
+		{ "rtp-host", 'H', 0, G_OPTION_ARG_STRING, &rtp_host_opt, "IPv4 address to send the mountpoint RTP feed to (default 127.0.0.1)", "address" },
+		{ "audio-port", 'A', 0, G_OPTION_ARG_INT, &audio_port, "Port to send the mountpoint audio feed to (default 5002)", "port" },
+		{ "video-port", 'V', 0, G_OPTION_ARG_INT, &video_port, "Port to send the mountpoint video feed to (default 5004)", "port" },
+		{ "streams", 'n', 0, G_OPTION_ARG_INT, &streams_num, "Number of streams (default 10)", "N" },
+		{ "audio", 'a', 0, G_OPTION_ARG_INT, &audio_kbps, "Audio bitrate per stream in kbps (default 64, 0 to disable)", "kbps" },
+		{ "video", 'v', 0, G_OPTION_ARG_INT, &video_kbps, "Video bitrate per stream in kbps (default 512, 0 to disable)", "kbps" },
+		{ "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "How long to send media for, in seconds (default 30)", "seconds" },
+		{ "interval", 'i', 0, G_OPTION_ARG_INT, &interval, "How often to print a report, in seconds (default 5)", "seconds" },
+		{ "ramp", 'R', 0, G_OPTION_ARG_INT, &ramp, "Pause between the creation of two streams, in ms (default 50)", "ms" },
+		{ "threads", 't', 0, G_OPTION_ARG_INT, &workers_num, "Number of media threads (default 2)", "N" },
+		{ "pid", 'P', 0, G_OPTION_ARG_INT, &janus_pid, "PID of the Janus process, to report its CPU usage", "pid" },
+		{ "json", 'j', 0, G_OPTION_ARG_NONE, &json_summary, "Print the final summary as JSON", NULL },
+		{ NULL }
+	};
+	GError *error = NULL;
+	GOptionContext *opts = g_option_context_new("- Janus load generator");
+	g_option_context_add_main_entries(opts, entries, NULL);
+	if(!g_option_context_parse(opts, &argc, &argv, &error)) {
+		JANUS_LOG(LOG_ERR, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(opts);
+		exit(1);
+	}
+	g_option_context_free(opts);
+	if(server_opt)
+		server = server_opt;
+	if(room_opt > 0)
+		room_id = room_opt;
+	if(mountpoint_opt > 0)
+		mountpoint_id = mountpoint_opt;
+	if(rtp_host_opt)
+		rtp_host = rtp_host_opt;
+	if(plugin && !strcasecmp(plugin, "videoroom")) {
+		videoroom = TRUE;
+	} else if(plugin && !strcasecmp(plugin, "streaming")) {
+		streaming = TRUE;
+	} else if(plugin && strcasecmp(plugin, "echotest")) {
+		JANUS_LOG(LOG_ERR, "Unsupported plugin %s (should be echotest, videoroom or streaming)\n", plugin);
+		exit(1);
+	}
+	if(streams_num < 1 || duration < 1 || interval < 1 || workers_num < 1 || audio_kbps < 0 || video_kbps < 0) {
+		JANUS_LOG(LOG_ERR, "Invalid arguments\n");
+		exit(1);
+	}
+	/* Check the JANUS_BENCH_DEBUG environment variable for the debugging level */
+	if(g_getenv("JANUS_BENCH_DEBUG") != NULL) {
+		int val = atoi(g_getenv("JANUS_BENCH_DEBUG"));
+		if(val >= LOG_NONE && val <= LOG_MAX)
+			janus_log_level = val;
+	}
+
+	JANUS_LOG(LOG_INFO, "Janus version: %d (%s)\n", janus_version, janus_version_string);
+	JANUS_LOG(LOG_INFO, "Target: %s (%s), %d streams, audio %dkbps, video %dkbps, %d media threads\n",
+		server, streaming ? "Streaming" : (videoroom ? "VideoRoom" : "EchoTest"), streams_num, audio_kbps, video_kbps, workers_num);
+
+	signal(SIGINT, janus_bench_handle_signal);
+	signal(SIGTERM, janus_bench_handle_signal);
+
+	curl_global_init(CURL_GLOBAL_ALL);
+	if(srtp_init() != srtp_err_status_ok || janus_bench_dtls_init() < 0) {
+		JANUS_LOG(LOG_FATAL, "Error initializing DTLS-SRTP\n");
+		exit(1);
+	}
+
+	/* Start the media threads */
+	workers = g_malloc0(workers_num * sizeof(janus_bench_worker *));
+	int i = 0;
+	for(i=0; i<workers_num; i++) {
+		janus_bench_worker *worker = g_malloc0(sizeof(janus_bench_worker));
+		worker->id = i;
+		worker->context = g_main_context_new();
+		worker->loop = g_main_loop_new(worker->context, FALSE);
+		janus_mutex_init(&worker->mutex);
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "bench %d", i);
+		worker->thread = g_thread_try_new(tname, janus_bench_worker_thread, worker, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch media thread %d...\n",
+				error->code, error->message ? error->message : "??", i);
+			exit(1);
+		}
+		workers[i] = worker;
+	}
+
+	/* With the Streaming plugin, start feeding the mountpoint before anyone watches it */
+	if(streaming) {
+		JANUS_LOG(LOG_INFO, "Feeding mountpoint %"SCNu64" via %s (audio port %d, video port %d)\n",
+			mountpoint_id, rtp_host, audio_port, video_port);
+		feed = janus_bench_feed_create();
+		if(feed == NULL)
+			exit(1);
+	}
+
+	/* Create the streams, one after the other */
+	streams = g_malloc0(streams_num * sizeof(janus_bench_stream *));
+	gint64 setup_time = 0;
+	int failed = 0;
+	for(i=0; i<streams_num && !g_atomic_int_get(&stop); i++) {
+		janus_bench_stream *stream = g_malloc0(sizeof(janus_bench_stream));
+		stream->index = i;
+		streams[i] = stream;
+		streams_created++;
+		gint64 start = g_get_monotonic_time();
+		if(janus_bench_stream_setup(stream) < 0) {
+			JANUS_LOG(LOG_WARN, "[%d] Couldn't set up the stream\n", i);
+			failed++;
+		} else {
+			setup_time += g_get_monotonic_time() - start;
+		}
+		int j = 0;
+		for(j=0; j<streams_created; j++)
+			janus_bench_keepalive(streams[j]);
+		if(ramp > 0)
+			g_usleep(ramp*1000);
+	}
+	JANUS_LOG(LOG_INFO, "%d streams set up (%d failed), %.1fms on average\n",
+		streams_created - failed, failed, streams_created > failed ? (double)setup_time/(streams_created - failed)/1000 : 0.0);
+
+	/* Send media and print the reports */
+	guint *histogram = g_malloc0((JANUS_BENCH_LATENCY_BUCKETS+1) * sizeof(guint));
+	guint *total = g_malloc0((JANUS_BENCH_LATENCY_BUCKETS+1) * sizeof(guint));
+	janus_bench_latencies_collect(histogram);
+	memset(histogram, 0, (JANUS_BENCH_LATENCY_BUCKETS+1) * sizeof(guint));
+	janus_bench_stats first, prev, now;
+	janus_bench_stats_get(&first);
+	prev = first;
+	gint64 end = first.when + (gint64)duration*G_USEC_PER_SEC;
+	while(!g_atomic_int_get(&stop) && g_get_monotonic_time() < end) {
+		gint64 next = prev.when + (gint64)interval*G_USEC_PER_SEC;
+		if(next > end)
+			next = end;
+		while(!g_atomic_int_get(&stop) && g_get_monotonic_time() < next)
+			g_usleep(50000);
+		for(i=0; i<streams_created; i++)
+			janus_bench_keepalive(streams[i]);
+		janus_bench_latencies_collect(histogram);
+		janus_bench_stats_get(&now);
+		janus_bench_report(&prev, &now, histogram, NULL);
+		int j = 0;
+		for(j=0; j<=JANUS_BENCH_LATENCY_BUCKETS; j++) {
+			total[j] += histogram[j];
+			histogram[j] = 0;
+		}
+		prev = now;
+	}
+	json_t *summary = NULL;
+	janus_bench_report(&first, &prev, total, &summary);
+	if(summary != NULL) {
+		json_object_set_new(summary, "setup_ms", json_real(streams_created > failed ? (double)setup_time/(streams_created - failed)/1000 : 0.0));
+		json_object_set_new(summary, "failed", json_integer(failed));
+		if(json_summary) {
+			char *text = json_dumps(summary, JSON_INDENT(3) | JSON_PRESERVE_ORDER);
+			JANUS_PRINT("%s\n", text);
+			free(text);
+		}
+		json_decref(summary);
+	}
+	g_free(histogram);
+	g_free(total);
+
+	/* Done, stop the media threads and get rid of everything */
+	for(i=0; i<workers_num; i++) {
+		g_main_loop_quit(workers[i]->loop);
+		g_thread_join(workers[i]->thread);
+	}
+	for(i=0; i<streams_created; i++)
+		janus_bench_stream_destroy(streams[i]);
+	g_free(streams);
+	janus_bench_pc_destroy(feed);
+	for(i=0; i<workers_num; i++) {
+		g_slist_free(workers[i]->pcs);
+		g_main_loop_unref(workers[i]->loop);
+		g_main_context_unref(workers[i]->context);
+		g_free(workers[i]);
+	}
+	g_free(workers);
+	SSL_CTX_free(ssl_ctx);
+	X509_free(ssl_cert);
+	EVP_PKEY_free(ssl_key);
+	curl_global_cleanup();
+
+	JANUS_LOG(LOG_INFO, "Bye!\n");
+	return failed == streams_num ? 1 : 0;
+}
@@ -0,0 +1,721 @@
+/*! \file    microbench.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Micro-benchmarks for the RTP/RTCP/codec/JSON helpers
+ * \details  Simple utility to measure how long the helpers on the media
+ * path (and the JSON handling on the signalling one) take, e.g., to
+ * verify that a change to one of them actually made
+ * it faster. Each benchmark repeatedly invokes a single helper on inputs
+ * that are generated from a fixed seed, which means that two runs always
+ * process exactly the same packets: the number of iterations is first
+ * calibrated so that a round lasts at least the configured time, and then
+ * the best of a few rounds is printed, in nanoseconds per operation.
+ *
+ * The utility is built and run by \c make \c bench, but it can also be
+ * invoked directly: a pattern can be passed to only run the benchmarks
+ * whose name contains it, e.g.:
+ *
+\verbatim
+./janus-microbench --time=500 rtcp
+\endverbatim
+ *
+ * \note The recorder benchmarks write to a temporary folder (which is
+ * removed at the end), so they depend on the disk and page cache too.
+ *
+ * \ingroup tools
+ * \ref tools
+ */
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "../debug.h"
+#include "../version.h"
+#include "../rtp.h"
+#include "../rtcp.h"
+#include "../utils.h"
+#include "../sdp-utils.h"
+#include "../record.h"
+
+int janus_log_level = LOG_WARN;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = TRUE;
+int lock_debug = 0;
+
+/* Seed all inputs are generated from */
+#define JANUS_MICROBENCH_SEED	0x4A414E55
+/* Number of rounds we keep the best of */
+#define JANUS_MICROBENCH_ROUNDS	3
+
+/* Options */
+static int min_time = 200;	/* In milliseconds */
+
+/* Just to make sure the compiler doesn't optimize calls away */
+static volatile guint64 sink = 0;
+
+/* Simple xorshift PRNG, so that inputs don't depend on the glib version */
+static guint32 seed = JANUS_MICROBENCH_SEED;
+static guint32 janus_microbench_random(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static gint64 janus_microbench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+typedef struct janus_microbench {
+	const char *name;
+	/* Prepare the inputs (optional) */
+	void (*setup)(void);
+	/* Run the helper the specified number of times */
+	void (*run)(guint64 iterations);
+	/* Get rid of the inputs (optional) */
+	void (*teardown)(void);
+} janus_microbench;
+
+
+/* RTP context updates and skew compensation */
+static janus_rtp_switching_context context;
+static char rtp_packet[1500];
+
+static void janus_microbench_rtp_prepare(janus_rtp_header *header, int pt) {
+	memset(rtp_packet, 0, sizeof(rtp_packet));
+	header->version = 2;
+	header->type = pt;
+}
+
+static void janus_microbench_header_update(guint64 iterations, gboolean video) {
+	janus_rtp_switching_context_reset(&context);
+	janus_rtp_header *header = (janus_rtp_header *)rtp_packet;
+	janus_microbench_rtp_prepare(header, video ? 96 : 111);
+	seed = JANUS_MICROBENCH_SEED;
+	guint32 ssrc = janus_microbench_random(), ts = janus_microbench_random();
+	guint16 seq = janus_microbench_random();
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		/* Switch to a different source every 500 packets, as a simulcast/feed switch would */
+		if(i % 500 == 0) {
+			ssrc = janus_microbench_random();
+			ts = janus_microbench_random();
+			seq = janus_microbench_random();
+		}
+		header->ssrc = htonl(ssrc);
+		header->seq_number = htons(seq++);
+		header->timestamp = htonl(ts);
+		ts += video ? 3000 : 960;
+		janus_rtp_header_update(header, &context, video, 0);
+		sink += header->seq_number;
+	}
+}
+
+static void janus_microbench_header_update_audio(guint64 iterations) {
+	janus_microbench_header_update(iterations, FALSE);
+}
+
+static void janus_microbench_header_update_video(guint64 iterations) {
+	janus_microbench_header_update(iterations, TRUE);
+}
+
+static void janus_microbench_skew(guint64 iterations, gboolean video) {
+	janus_rtp_switching_context_reset(&context);
+	janus_rtp_header *header = (janus_rtp_header *)rtp_packet;
+	janus_microbench_rtp_prepare(header, video ? 96 : 111);
+	seed = JANUS_MICROBENCH_SEED;
+	header->ssrc = htonl(janus_microbench_random());
+	guint32 ts = janus_microbench_random();
+	guint16 seq = janus_microbench_random();
+	/* Packets arrive with a constant 0.5% drift, so that compensation eventually kicks in */
+	gint64 now = G_USEC_PER_SEC, step = video ? 33500 : 20100;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		header->seq_number = htons(seq++);
+		header->timestamp = htonl(ts);
+		ts += video ? 3000 : 960;
+		now += step;
+		sink += video ? janus_rtp_skew_compensate_video(header, &context, now) :
+			janus_rtp_skew_compensate_audio(header, &context, now);
+	}
+}
+
+static void janus_microbench_skew_audio(guint64 iterations) {
+	janus_microbench_skew(iterations, FALSE);
+}
+
+static void janus_microbench_skew_video(guint64 iterations) {
+	janus_microbench_skew(iterations, TRUE);
+}
+
+/* NACK receive window, with 2% of the packets lost and some reordering */
+static void janus_microbench_seq_window(guint64 iterations) {
+	static janus_rtp_seq_window window;
+	janus_rtp_seq_nack nacks[JANUS_RTP_SEQ_WINDOW_LEN];
+	janus_rtp_seq_window_reset(&window);
+	seed = JANUS_MICROBENCH_SEED;
+	guint16 seq = janus_microbench_random();
+	gint64 now = G_USEC_PER_SEC;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		guint32 r = janus_microbench_random() % 100;
+		if(r < 2)
+			seq++;	/* Lost */
+		guint16 next = seq;
+		if(r == 2)
+			next = seq - 3;	/* Late */
+		else
+			seq++;
+		now += 1000;
+		sink += janus_rtp_seq_window_update(&window, next, now, nacks);
+	}
+}
+
+
+/* RTCP */
+static char rtcp_template[128];
+static int rtcp_len = 0;
+
+static char *janus_microbench_rtcp_put32(char *buf, guint32 value) {
+	value = htonl(value);
+	memcpy(buf, &value, sizeof(value));
+	return buf + 4;
+}
+
+/* Compound packet browsers typically send: SR, SDES, PLI, REMB and NACK */
+static void janus_microbench_rtcp_setup(void) {
+	seed = JANUS_MICROBENCH_SEED;
+	guint32 local = janus_microbench_random(), remote = janus_microbench_random();
+	memset(rtcp_template, 0, sizeof(rtcp_template));
+	char *c = rtcp_template;
+	/* SR with a report block */
+	c = janus_microbench_rtcp_put32(c, 0x81C8000C);
+	c = janus_microbench_rtcp_put32(c, local);
+	c = janus_microbench_rtcp_put32(c, 0xDE4D2A1B);
+	c = janus_microbench_rtcp_put32(c, 0x3C6EF372);
+	c = janus_microbench_rtcp_put32(c, janus_microbench_random());
+	c = janus_microbench_rtcp_put32(c, 12345);
+	c = janus_microbench_rtcp_put32(c, 12345*1000);
+	c = janus_microbench_rtcp_put32(c, remote);
+	c = janus_microbench_rtcp_put32(c, 0x02000010);
+	c = janus_microbench_rtcp_put32(c, 0x0001A2B3);
+	c = janus_microbench_rtcp_put32(c, 42);
+	c = janus_microbench_rtcp_put32(c, 0x4D2A3C6E);
+	c = janus_microbench_rtcp_put32(c, 6553);
+	/* SDES with a CNAME */
+	c = janus_microbench_rtcp_put32(c, 0x81CA0005);
+	c = janus_microbench_rtcp_put32(c, local);
+	*c++ = 1;
+	*c++ = 12;
+	memcpy(c, "janusbench12", 12);
+	c += 14;
+	/* PLI */
+	c = janus_microbench_rtcp_put32(c, 0x81CE0002);
+	c = janus_microbench_rtcp_put32(c, local);
+	c = janus_microbench_rtcp_put32(c, remote);
+	/* REMB */
+	c = janus_microbench_rtcp_put32(c, 0x8FCE0005);
+	c = janus_microbench_rtcp_put32(c, local);
+	c = janus_microbench_rtcp_put32(c, 0);
+	memcpy(c, "REMB", 4);
+	c += 4;
+	c = janus_microbench_rtcp_put32(c, 0x0107A120);
+	c = janus_microbench_rtcp_put32(c, remote);
+	/* Generic NACK */
+	c = janus_microbench_rtcp_put32(c, 0x81CD0003);
+	c = janus_microbench_rtcp_put32(c, local);
+	c = janus_microbench_rtcp_put32(c, remote);
+	c = janus_microbench_rtcp_put32(c, 0x04D20005);
+	rtcp_len = c - rtcp_template;
+}
+
+static void janus_microbench_rtcp_fix_ssrc(guint64 iterations) {
+	janus_rtcp_context ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.tb = 90000;
+	char packet[sizeof(rtcp_template)];
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		/* The packet is modified in place, so start from a fresh copy every time */
+		memcpy(packet, rtcp_template, rtcp_len);
+		sink += janus_rtcp_fix_ssrc(&ctx, packet, rtcp_len, 1, 0x11223344, 0x55667788);
+	}
+}
+
+static void janus_microbench_rtcp_filter(guint64 iterations) {
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		int newlen = 0;
+		char *filtered = janus_rtcp_filter(rtcp_template, rtcp_len, &newlen);
+		sink += newlen;
+		g_free(filtered);
+	}
+}
+
+
+/* Codec helpers */
+#define JANUS_MICROBENCH_PAYLOADS	64
+static char payloads[JANUS_MICROBENCH_PAYLOADS][64];
+
+static void janus_microbench_vp8_setup(void) {
+	seed = JANUS_MICROBENCH_SEED;
+	int i = 0;
+	for(i=0; i<JANUS_MICROBENCH_PAYLOADS; i++) {
+		char *p = payloads[i];
+		guint16 picid = janus_microbench_random() & 0x7FFF;
+		/* X and S bits, then I, L and T bits, 15-bit Picture ID, TL0PICIDX and TID/Y/KEYIDX */
+		p[0] = (i % 4 == 0) ? 0x90 : 0x80;
+		p[1] = 0xE0;
+		p[2] = 0x80 | (picid >> 8);
+		p[3] = picid & 0xFF;
+		p[4] = i;
+		p[5] = ((i % 3) << 6) | 0x20;
+		p[6] = (i % 8 == 0) ? 0x10 : 0x11;
+	}
+}
+
+static void janus_microbench_vp8_parse_descriptor(guint64 iterations) {
+	uint16_t picid = 0;
+	uint8_t tlzi = 0, tid = 0, ybit = 0, keyidx = 0;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		janus_vp8_parse_descriptor(payloads[i % JANUS_MICROBENCH_PAYLOADS], 64, &picid, &tlzi, &tid, &ybit, &keyidx);
+		sink += picid + tid;
+	}
+}
+
+static void janus_microbench_vp9_setup(void) {
+	seed = JANUS_MICROBENCH_SEED;
+	int i = 0;
+	for(i=0; i<JANUS_MICROBENCH_PAYLOADS; i++) {
+		char *p = payloads[i];
+		guint16 picid = janus_microbench_random() & 0x7FFF;
+		/* Non-flexible mode: I, L and B (or E) bits, 15-bit Picture ID, layer indices and TL0PICIDX */
+		p[0] = (i % 3 == 0) ? 0xA8 : 0xA4;
+		p[1] = 0x80 | (picid >> 8);
+		p[2] = picid & 0xFF;
+		p[3] = ((i % 3) << 5) | ((i % 2) << 4) | ((i % 3) << 1);
+		p[4] = i;
+	}
+}
+
+static void janus_microbench_vp9_parse_svc(guint64 iterations) {
+	int found = 0, spatial = 0, temporal = 0;
+	uint8_t p = 0, d = 0, u = 0, b = 0, e = 0;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		janus_vp9_parse_svc(payloads[i % JANUS_MICROBENCH_PAYLOADS], 64, &found, &spatial, &temporal, &p, &d, &u, &b, &e);
+		sink += spatial + temporal;
+	}
+}
+
+static void janus_microbench_h264_setup(void) {
+	int i = 0;
+	for(i=0; i<JANUS_MICROBENCH_PAYLOADS; i++) {
+		char *p = payloads[i];
+		memset(p, 0, 64);
+		if(i % 16 == 0) {
+			/* Start of an IDR slice, as a FU-A fragment */
+			p[0] = 0x7C;
+			p[1] = 0x85;
+		} else if(i % 4 == 0) {
+			/* Non-IDR slice, as a FU-A fragment */
+			p[0] = 0x5C;
+			p[1] = 0x81;
+		} else {
+			/* Single non-IDR NAL */
+			p[0] = 0x41;
+			p[1] = 0x9A;
+		}
+	}
+}
+
+static void janus_microbench_h264_is_keyframe(guint64 iterations) {
+	guint64 i = 0;
+	for(i=0; i<iterations; i++)
+		sink += janus_h264_is_keyframe(payloads[i % JANUS_MICROBENCH_PAYLOADS], 64);
+}
+
+
+/* SDP, with what a browser would typically offer */
+static const char *sdp_offer =
+	"v=0\r\n"
+	"o=- 4611731400430051336 2 IN IP4 127.0.0.1\r\n"
+	"s=-\r\n"
+	"t=0 0\r\n"
+	"a=group:BUNDLE audio video data\r\n"
+	"a=msid-semantic: WMS lgsCFqt9kN2fVKw5wXF0pSchiXMgO3qYvqMT\r\n"
+	"m=audio 58779 UDP/TLS/RTP/SAVPF 111 103 104 9 0 8 106 105 13 110 112 113 126\r\n"
+	"c=IN IP4 192.168.1.100\r\n"
+	"a=rtcp:9 IN IP4 0.0.0.0\r\n"
+	"a=candidate:1467250027 1 udp 2122260223 192.168.1.100 58779 typ host generation 0\r\n"
+	"a=candidate:1467250027 2 udp 2122260222 192.168.1.100 46323 typ host generation 0\r\n"
+	"a=candidate:435653019 1 tcp 1845501695 192.168.1.100 0 typ host tcptype active generation 0\r\n"
+	"a=candidate:3199090290 1 udp 1686052607 203.0.113.5 58779 typ srflx raddr 192.168.1.100 rport 58779 generation 0\r\n"
+	"a=ice-ufrag:Oyef7uvBlwafI3hT\r\n"
+	"a=ice-pwd:T0teqPLNQQOf+5W+ls+P2p16\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 49:66:12:17:0D:1C:91:AE:57:4C:C6:36:DD:D5:97:D2:7D:62:C9:9A:7F:B9:A3:F4:70:03:E7:43:91:73:23:5E\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:audio\r\n"
+	"a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level\r\n"
+	"a=extmap:3 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time\r\n"
+	"a=extmap:5 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01\r\n"
+	"a=sendrecv\r\n"
+	"a=rtcp-mux\r\n"
+	"a=rtpmap:111 opus/48000/2\r\n"
+	"a=rtcp-fb:111 transport-cc\r\n"
+	"a=fmtp:111 minptime=10;useinbandfec=1\r\n"
+	"a=rtpmap:103 ISAC/16000\r\n"
+	"a=rtpmap:104 ISAC/32000\r\n"
+	"a=rtpmap:9 G722/8000\r\n"
+	"a=rtpmap:0 PCMU/8000\r\n"
+	"a=rtpmap:8 PCMA/8000\r\n"
+	"a=rtpmap:106 CN/32000\r\n"
+	"a=rtpmap:105 CN/16000\r\n"
+	"a=rtpmap:13 CN/8000\r\n"
+	"a=rtpmap:110 telephone-event/48000\r\n"
+	"a=rtpmap:112 telephone-event/32000\r\n"
+	"a=rtpmap:113 telephone-event/16000\r\n"
+	"a=rtpmap:126 telephone-event/8000\r\n"
+	"a=ssrc:3570614608 cname:4TOk42mSjXCkVIa6\r\n"
+	"a=ssrc:3570614608 msid:lgsCFqt9kN2fVKw5wXF0pSchiXMgO3qYvqMT 35429d94-5637-4686-9ecd-7d0622261ce8\r\n"
+	"a=ssrc:3570614608 mslabel:lgsCFqt9kN2fVKw5wXF0pSchiXMgO3qYvqMT\r\n"
+	"a=ssrc:3570614608 label:35429d94-5637-4686-9ecd-7d0622261ce8\r\n"
+	"m=video 60372 UDP/TLS/RTP/SAVPF 96 97 98 99 100 101 102 124 127 123 125\r\n"
+	"c=IN IP4 192.168.1.100\r\n"
+	"a=rtcp:9 IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:Oyef7uvBlwafI3hT\r\n"
+	"a=ice-pwd:T0teqPLNQQOf+5W+ls+P2p16\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 49:66:12:17:0D:1C:91:AE:57:4C:C6:36:DD:D5:97:D2:7D:62:C9:9A:7F:B9:A3:F4:70:03:E7:43:91:73:23:5E\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:video\r\n"
+	"a=extmap:2 urn:ietf:params:rtp-hdrext:toffset\r\n"
+	"a=extmap:3 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time\r\n"
+	"a=extmap:4 urn:3gpp:video-orientation\r\n"
+	"a=extmap:5 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01\r\n"
+	"a=extmap:6 http://www.webrtc.org/experiments/rtp-hdrext/playout-delay\r\n"
+	"a=sendrecv\r\n"
+	"a=rtcp-mux\r\n"
+	"a=rtcp-rsize\r\n"
+	"a=rtpmap:96 VP8/90000\r\n"
+	"a=rtcp-fb:96 goog-remb\r\n"
+	"a=rtcp-fb:96 transport-cc\r\n"
+	"a=rtcp-fb:96 ccm fir\r\n"
+	"a=rtcp-fb:96 nack\r\n"
+	"a=rtcp-fb:96 nack pli\r\n"
+	"a=rtpmap:97 rtx/90000\r\n"
+	"a=fmtp:97 apt=96\r\n"
+	"a=rtpmap:98 VP9/90000\r\n"
+	"a=rtcp-fb:98 goog-remb\r\n"
+	"a=rtcp-fb:98 transport-cc\r\n"
+	"a=rtcp-fb:98 ccm fir\r\n"
+	"a=rtcp-fb:98 nack\r\n"
+	"a=rtcp-fb:98 nack pli\r\n"
+	"a=rtpmap:99 rtx/90000\r\n"
+	"a=fmtp:99 apt=98\r\n"
+	"a=rtpmap:100 H264/90000\r\n"
+	"a=rtcp-fb:100 goog-remb\r\n"
+	"a=rtcp-fb:100 transport-cc\r\n"
+	"a=rtcp-fb:100 ccm fir\r\n"
+	"a=rtcp-fb:100 nack\r\n"
+	"a=rtcp-fb:100 nack pli\r\n"
+	"a=fmtp:100 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=42e01f\r\n"
+	"a=rtpmap:101 rtx/90000\r\n"
+	"a=fmtp:101 apt=100\r\n"
+	"a=rtpmap:102 red/90000\r\n"
+	"a=rtpmap:124 rtx/90000\r\n"
+	"a=fmtp:124 apt=102\r\n"
+	"a=rtpmap:127 ulpfec/90000\r\n"
+	"a=ssrc-group:FID 2231627014 632943048\r\n"
+	"a=ssrc:2231627014 cname:4TOk42mSjXCkVIa6\r\n"
+	"a=ssrc:2231627014 msid:lgsCFqt9kN2fVKw5wXF0pSchiXMgO3qYvqMT daed9400-d0dd-4db3-b949-422499e96e2d\r\n"
+	"a=ssrc:632943048 cname:4TOk42mSjXCkVIa6\r\n"
+	"a=ssrc:632943048 msid:lgsCFqt9kN2fVKw5wXF0pSchiXMgO3qYvqMT daed9400-d0dd-4db3-b949-422499e96e2d\r\n"
+	"m=application 9 DTLS/SCTP 5000\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:Oyef7uvBlwafI3hT\r\n"
+	"a=ice-pwd:T0teqPLNQQOf+5W+ls+P2p16\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 49:66:12:17:0D:1C:91:AE:57:4C:C6:36:DD:D5:97:D2:7D:62:C9:9A:7F:B9:A3:F4:70:03:E7:43:91:73:23:5E\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:data\r\n"
+	"a=sctpmap:5000 webrtc-datachannel 1024\r\n";
+static janus_sdp *sdp_parsed = NULL;
+
+static void janus_microbench_sdp_parse(guint64 iterations) {
+	char error[200];
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		janus_sdp *sdp = janus_sdp_parse(sdp_offer, error, sizeof(error));
+		sink += (sdp != NULL);
+		janus_sdp_free(sdp);
+	}
+}
+
+static void janus_microbench_sdp_write_setup(void) {
+	char error[200];
+	sdp_parsed = janus_sdp_parse(sdp_offer, error, sizeof(error));
+	if(sdp_parsed == NULL)
+		JANUS_LOG(LOG_ERR, "Error parsing the SDP: %s\n", error);
+}
+
+static void janus_microbench_sdp_write(guint64 iterations) {
+	if(sdp_parsed == NULL)
+		return;
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		char *sdp = janus_sdp_write(sdp_parsed);
+		sink += (sdp != NULL);
+		g_free(sdp);
+	}
+}
+
+static void janus_microbench_sdp_write_teardown(void) {
+	janus_sdp_free(sdp_parsed);
+	sdp_parsed = NULL;
+}
+
+
+/* JSON signalling: a plugin message, as a transport would pass it to the core */
+static const char *json_request =
+	"{\"janus\":\"message\",\"session_id\":3815913434914431,\"handle_id\":1820315640356129,"
+	"\"transaction\":\"HqNzAvXfTbEa\",\"body\":{\"request\":\"watch\",\"id\":1,\"pin\":\"adminpwd\"}}";
+/* Same parameters the core and the Streaming plugin check */
+static struct janus_json_parameter json_request_parameters[] = {
+	{"transaction", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
+	{"janus", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
+	{"id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
+static struct janus_json_parameter json_body_parameters[] = {
+	{"body", JSON_OBJECT, JANUS_JSON_PARAM_REQUIRED}
+};
+static struct janus_json_parameter json_watch_parameters[] = {
+	{"request", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
+	{"id", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"pin", JSON_STRING, 0},
+	{"offer_audio", JANUS_JSON_BOOL, 0},
+	{"offer_video", JANUS_JSON_BOOL, 0},
+	{"offer_data", JANUS_JSON_BOOL, 0},
+	{"restart", JANUS_JSON_BOOL, 0},
+	{"substream", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"temporal", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"spatial_layer", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"temporal_layer", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
+static json_t *json_parsed = NULL;
+
+static int janus_microbench_json_validate_request(json_t *root) {
+	int error_code = 0;
+	char error_cause[100];
+	json_t *values[3];
+	JANUS_VALIDATE_JSON_OBJECT_VALUES(root, json_request_parameters, values,
+		error_code, error_cause, FALSE, 1, 2);
+	if(error_code != 0)
+		return error_code;
+	json_t *body_values[1];
+	JANUS_VALIDATE_JSON_OBJECT_VALUES(root, json_body_parameters, body_values,
+		error_code, error_cause, FALSE, 1, 2);
+	if(error_code != 0)
+		return error_code;
+	JANUS_VALIDATE_JSON_OBJECT(body_values[0], json_watch_parameters,
+		error_code, error_cause, FALSE, 1, 2);
+	return error_code;
+}
+
+static void janus_microbench_json_validate_setup(void) {
+	json_parsed = json_loads(json_request, 0, NULL);
+}
+
+static void janus_microbench_json_validate(guint64 iterations) {
+	guint64 i = 0;
+	for(i=0; i<iterations; i++)
+		sink += janus_microbench_json_validate_request(json_parsed);
+}
+
+static void janus_microbench_json_validate_teardown(void) {
+	json_decref(json_parsed);
+	json_parsed = NULL;
+}
+
+static void janus_microbench_json_request(guint64 iterations) {
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		/* Parse, validate and prepare the ack/response, as the core would */
+		json_error_t error;
+		json_t *root = json_loads(json_request, 0, &error);
+		if(root == NULL)
+			continue;
+		sink += janus_microbench_json_validate_request(root);
+		json_t *reply = json_object();
+		json_object_set_new(reply, "janus", json_string("ack"));
+		json_object_set_new(reply, "session_id", json_integer(3815913434914431));
+		json_object_set(reply, "transaction", json_object_get(root, "transaction"));
+		json_object_set_new(reply, "hint", json_string("I'm taking my time!"));
+		char *text = json_dumps(reply, JSON_PRESERVE_ORDER | JSON_COMPACT);
+		sink += strlen(text);
+		free(text);
+		json_decref(reply);
+		json_decref(root);
+	}
+}
+
+/* Recorder: Opus-sized packets, so that the disk isn't what we end up measuring */
+static char *recordings_dir = NULL;
+static janus_recorder *recorder = NULL;
+
+static void janus_microbench_recorder_open(void) {
+	recorder = janus_recorder_create(recordings_dir, "opus", "microbench");
+	if(recorder == NULL)
+		JANUS_LOG(LOG_ERR, "Error creating the recorder in %s\n", recordings_dir);
+}
+
+static void janus_microbench_recorder_close(void) {
+	if(recorder == NULL)
+		return;
+	janus_recorder_close(recorder);
+	char path[1024];
+	g_snprintf(path, sizeof(path), "%s/%s", recorder->dir, recorder->filename);
+	janus_recorder_free(recorder);
+	recorder = NULL;
+	unlink(path);
+}
+
+static void janus_microbench_recorder_async_open(void) {
+	static gboolean async = FALSE;
+	if(!async) {
+		/* Once enabled, we can't go back, which is why this benchmark must be the last one */
+		if(janus_recorder_async_init(1, 4*1024*1024) < 0)
+			JANUS_LOG(LOG_ERR, "Error enabling asynchronous recordings\n");
+		async = TRUE;
+	}
+	janus_microbench_recorder_open();
+}
+
+static void janus_microbench_recorder_save_frame(guint64 iterations) {
+	if(recorder == NULL)
+		return;
+	janus_rtp_header *header = (janus_rtp_header *)rtp_packet;
+	janus_microbench_rtp_prepare(header, 111);
+	seed = JANUS_MICROBENCH_SEED;
+	header->ssrc = htonl(janus_microbench_random());
+	guint32 ts = janus_microbench_random();
+	guint16 seq = janus_microbench_random();
+	guint64 i = 0;
+	for(i=0; i<iterations; i++) {
+		header->seq_number = htons(seq++);
+		header->timestamp = htonl(ts);
+		ts += 960;
+		sink += janus_recorder_save_frame(recorder, rtp_packet, RTP_HEADER_SIZE + 160);
+	}
+}
+
+
+static janus_microbench benchmarks[] = {
+	{ "rtp_header_update_audio", NULL, janus_microbench_header_update_audio, NULL },
+	{ "rtp_header_update_video", NULL, janus_microbench_header_update_video, NULL },
+	{ "rtp_skew_compensate_audio", NULL, janus_microbench_skew_audio, NULL },
+	{ "rtp_skew_compensate_video", NULL, janus_microbench_skew_video, NULL },
+	{ "rtp_seq_window_update", NULL, janus_microbench_seq_window, NULL },
+	{ "rtcp_fix_ssrc", janus_microbench_rtcp_setup, janus_microbench_rtcp_fix_ssrc, NULL },
+	{ "rtcp_filter", janus_microbench_rtcp_setup, janus_microbench_rtcp_filter, NULL },
+	{ "vp8_parse_descriptor", janus_microbench_vp8_setup, janus_microbench_vp8_parse_descriptor, NULL },
+	{ "vp9_parse_svc", janus_microbench_vp9_setup, janus_microbench_vp9_parse_svc, NULL },
+	{ "h264_is_keyframe", janus_microbench_h264_setup, janus_microbench_h264_is_keyframe, NULL },
+	{ "sdp_parse", NULL, janus_microbench_sdp_parse, NULL },
+	{ "sdp_write", janus_microbench_sdp_write_setup, janus_microbench_sdp_write, janus_microbench_sdp_write_teardown },
+	{ "json_validate", janus_microbench_json_validate_setup, janus_microbench_json_validate, janus_microbench_json_validate_teardown },
+	{ "json_request", NULL, janus_microbench_json_request, NULL },
+	{ "recorder_save_frame", janus_microbench_recorder_open, janus_microbench_recorder_save_frame, janus_microbench_recorder_close },
+	{ "recorder_save_frame_async", janus_microbench_recorder_async_open, janus_microbench_recorder_save_frame, janus_microbench_recorder_close },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static gint64 janus_microbench_round(janus_microbench *bench, guint64 iterations) {
+	if(bench->setup)
+		bench->setup();
+	gint64 start = janus_microbench_now();
+	bench->run(iterations);
+	gint64 elapsed = janus_microbench_now() - start;
+	if(bench->teardown)
+		bench->teardown();
+	return elapsed;
+}
+
+
+int main(int argc, char *argv[])
+{
+	janus_log_init(FALSE, TRUE, NULL);
+	atexit(janus_log_destroy);
+
+	/* Evaluate arguments */
+	GOptionEntry entries[] = {
+		{ "time", 't', 0, G_OPTION_ARG_INT, &min_time, "Minimum duration of each round, in milliseconds (default 200)", "ms" },
+		{ NULL }
+	};
+	GError *error = NULL;
+	GOptionContext *opts = g_option_context_new("[pattern] - Janus micro-benchmarks");
+	g_option_context_add_main_entries(opts, entries, NULL);
+	if(!g_option_context_parse(opts, &argc, &argv, &error)) {
+		JANUS_LOG(LOG_ERR, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(opts);
+		exit(1);
+	}
+	g_option_context_free(opts);
+	if(min_time < 1) {
+		JANUS_LOG(LOG_ERR, "Invalid round duration %d\n", min_time);
+		exit(1);
+	}
+	const char *pattern = argc > 1 ? argv[1] : NULL;
+
+	recordings_dir = g_dir_make_tmp("janus-microbench-XXXXXX", &error);
+	if(recordings_dir == NULL) {
+		JANUS_LOG(LOG_ERR, "Error creating a temporary folder: %s\n", error->message);
+		g_error_free(error);
+		exit(1);
+	}
+	janus_recorder_init(FALSE, NULL);
+
+	JANUS_PRINT("Janus version: %d (%s), commit %s\n", janus_version, janus_version_string, janus_build_git_sha);
+	JANUS_PRINT("%-28s %14s %12s\n", "benchmark", "iterations", "ns/op");
+	janus_microbench *bench = benchmarks;
+	for(; bench->name != NULL; bench++) {
+		if(pattern && !strstr(bench->name, pattern))
+			continue;
+		/* Find out how many iterations we need for a round to last long enough */
+		guint64 iterations = 1;
+		gint64 elapsed = 0, target = (gint64)min_time*1000000;
+		while((elapsed = janus_microbench_round(bench, iterations)) < target) {
+			if(elapsed <= 0 || elapsed < target/100) {
+				iterations *= 100;
+			} else {
+				/* Overshoot a little, so that we don't stop right below the target */
+				iterations = (guint64)((double)iterations * target / elapsed * 1.2) + 1;
+			}
+		}
+		/* Keep the best of a few rounds, as the least disturbed one */
+		gint64 best = elapsed;
+		int round = 1;
+		for(round=1; round<JANUS_MICROBENCH_ROUNDS; round++) {
+			elapsed = janus_microbench_round(bench, iterations);
+			if(elapsed < best)
+				best = elapsed;
+		}
+		JANUS_PRINT("%-28s %14"SCNu64" %12.1f\n", bench->name, iterations, (double)best/iterations);
+	}
+
+	janus_recorder_deinit();
+	rmdir(recordings_dir);
+	g_free(recordings_dir);
+	return 0;
+}
@@ -13,6 +13,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "debug.h"
@@ -52,6 +54,83 @@ static char *trim(char *s) {
 }
 
 
+/* Lookup index and write-back journal of a configuration */
+struct janus_config_state {
+	/* Links in the categories list, by name (case insensitive), and the
+	 * tail of that list, so that lookups, appends and removals are O(1) */
+	GHashTable *categories;
+	GList *last;
+	/* File we last parsed or wrote in full, and what it looked like after
+	 * we last touched it: if it's still the same, saving a change to a
+	 * few categories only appends them to the file, rather than
+	 * rewriting it all, and the file is only compacted every now and then */
+	char *path;
+	gint64 size, mtime;
+	GHashTable *changed;	/* Names of the categories changed since */
+	guint appended;			/* Categories appended since the last rewrite */
+	gboolean dirty;			/* Uncategorized items changed: rewrite it all */
+};
+
+/* Case insensitive hashing, to match the strcasecmp lookups */
+static guint janus_config_name_hash(gconstpointer v) {
+	const char *p = (const char *)v;
+	guint32 h = 5381;
+	for(; *p != '\0'; p++)
+		h = (h << 5) + h + g_ascii_tolower(*p);
+	return h;
+}
+
+static gboolean janus_config_name_equal(gconstpointer a, gconstpointer b) {
+	return !g_ascii_strcasecmp((const char *)a, (const char *)b);
+}
+
+static janus_config_state *janus_config_get_state(janus_config *config) {
+	if(config->state == NULL) {
+		config->state = g_malloc0(sizeof(janus_config_state));
+		config->state->categories = g_hash_table_new(janus_config_name_hash, janus_config_name_equal);
+		config->state->last = g_list_last(config->categories);
+		GList *l = config->categories;
+		while(l) {
+			janus_config_category *c = (janus_config_category *)l->data;
+			if(c && c->name)
+				g_hash_table_insert(config->state->categories, (gpointer)c->name, l);
+			l = l->next;
+		}
+	}
+	return config->state;
+}
+
+/* Keeps track of what changed since the file was last written */
+static void janus_config_changed(janus_config *config, const char *category) {
+	janus_config_state *state = janus_config_get_state(config);
+	if(state->path == NULL)
+		return;
+	if(category == NULL) {
+		state->dirty = TRUE;
+		return;
+	}
+	if(state->changed == NULL)
+		state->changed = g_hash_table_new_full(janus_config_name_hash, janus_config_name_equal, g_free, NULL);
+	if(!g_hash_table_contains(state->changed, category))
+		g_hash_table_add(state->changed, g_strdup(category));
+}
+
+static void janus_config_stat(janus_config_state *state, const char *path) {
+	if(state->path != path) {
+		g_free(state->path);
+		state->path = g_strdup(path);
+	}
+	struct stat st;
+	if(stat(path, &st) == 0) {
+		state->size = st.st_size;
+		state->mtime = st.st_mtime;
+	} else {
+		state->size = -1;
+		state->mtime = -1;
+	}
+}
+
+
 /* Memory management helpers */
 static void janus_config_free_item(gpointer data) {
 	janus_config_item *i = (janus_config_item *)data;
@@ -92,10 +171,9 @@ janus_config *janus_config_parse(const char *config_file) {
 		return NULL;
 	}
 	/* Create configuration instance */
-	janus_config *jc = g_malloc0(sizeof(janus_config));
-	jc->name = g_strdup(filename);
+	janus_config *jc = janus_config_create(filename);
 	/* Traverse and parse it */
-	int line_number = 0;
+	int line_number = 0, removed = 0;
 	char line_buffer[BUFSIZ];
 	janus_config_category *cg = NULL;
 	while(fgets(line_buffer, sizeof(line_buffer), file)) {
@@ -136,6 +214,14 @@ janus_config *janus_config_parse(const char *config_file) {
 				JANUS_LOG(LOG_ERR, "Error parsing category at line %d: no name (%s)\n", line_number, filename);
 				goto error;
 			}
+			if(line[0] == '-') {
+				/* Appended by janus_config_save: a more recent version of
+				 * this category (if any) follows, forget what we have */
+				janus_config_remove_category(jc, trim(line+1));
+				removed++;
+				cg = NULL;
+				continue;
+			}
 			cg = janus_config_add_category(jc, line);
 			if(cg == NULL) {
 				JANUS_LOG(LOG_ERR, "Error adding category %s (%s)\n", line, filename);
@@ -178,6 +264,10 @@ janus_config *janus_config_parse(const char *config_file) {
 		}
 	}
 	fclose(file);
+	/* From now on, keep track of what changes */
+	janus_config_state *state = janus_config_get_state(jc);
+	janus_config_stat(state, config_file);
+	state->appended = removed;
 	return jc;
 
 error:
@@ -191,6 +281,7 @@ janus_config *janus_config_create(const char *name) {
 	if(name != NULL) {
 		jc->name = g_strdup(name);
 	}
+	janus_config_get_state(jc);
 	return jc;
 }
 
@@ -205,14 +296,8 @@ janus_config_category *janus_config_get_category(janus_config *config, const cha
 		return NULL;
 	if(config->categories == NULL)
 		return NULL;
-	GList *l = config->categories;
-	while(l) {
-		janus_config_category *c = (janus_config_category *)l->data;
-		if(c && c->name && !strcasecmp(name, c->name))
-			return c;
-		l = l->next;
-	}
-	return NULL;
+	GList *l = g_hash_table_lookup(janus_config_get_state(config)->categories, name);
+	return l ? (janus_config_category *)l->data : NULL;
 }
 
 GList *janus_config_get_items(janus_config_category *category) {
@@ -255,16 +340,33 @@ janus_config_category *janus_config_add_category(janus_config *config, const cha
 	}
 	c = g_malloc0(sizeof(janus_config_category));
 	c->name = g_strdup(category);
-	config->categories = g_list_append(config->categories, c);
+	/* Append to the tail, no need to walk the list */
+	janus_config_state *state = janus_config_get_state(config);
+	GList *link = g_list_alloc();
+	link->data = c;
+	link->prev = state->last;
+	if(state->last != NULL)
+		state->last->next = link;
+	else
+		config->categories = link;
+	state->last = link;
+	g_hash_table_insert(state->categories, (gpointer)c->name, link);
+	janus_config_changed(config, c->name);
 	return c;
 }
 
 int janus_config_remove_category(janus_config *config, const char *category) {
 	if(config == NULL || category == NULL)
 		return -1;
-	janus_config_category *c = janus_config_get_category(config, category);
-	if(c) {
-		config->categories = g_list_remove(config->categories, c);
+	janus_config_state *state = janus_config_get_state(config);
+	GList *link = g_hash_table_lookup(state->categories, category);
+	if(link) {
+		janus_config_category *c = (janus_config_category *)link->data;
+		janus_config_changed(config, c->name);
+		g_hash_table_remove(state->categories, c->name);
+		if(state->last == link)
+			state->last = link->prev;
+		config->categories = g_list_delete_link(config->categories, link);
 		janus_config_free_category(c);
 		return 0;
 	}
@@ -301,6 +403,7 @@ janus_config_item *janus_config_add_item(janus_config *config, const char *categ
 			g_free((gpointer)item->value);
 		item->value = item_value;
 	}
+	janus_config_changed(config, c ? c->name : NULL);
 	return item;
 }
 
@@ -315,6 +418,7 @@ int janus_config_remove_item(janus_config *config, const char *category, const c
 		return -3;
 	c->items = g_list_remove(c->items, item);
 	janus_config_free_item(item);
+	janus_config_changed(config, c->name);
 	return 0;
 }
 
@@ -348,11 +452,72 @@ void janus_config_print(janus_config *config) {
 	}
 }
 
-gboolean janus_config_save(janus_config *config, const char *folder, const char *filename) {
+static void janus_config_write_item(FILE *file, janus_config_item *i) {
+	if(i->name == NULL || i->value == NULL)
+		return;
+	fwrite(i->name, sizeof(char), strlen(i->name), file);
+	fwrite(" = ", sizeof(char), 3, file);
+	/* If the value contains a semicolon, escape it */
+	if(strchr(i->value, ';')) {
+		char *value = g_strdup(i->value);
+		value = janus_string_replace((char *)value, ";", "\\;");
+		fwrite(value, sizeof(char), strlen(value), file);
+		g_free(value);
+	} else {
+		/* No need to escape */
+		fwrite(i->value, sizeof(char), strlen(i->value), file);
+	}
+	fwrite("\n", sizeof(char), 1, file);
+}
+
+static void janus_config_write_category(FILE *file, janus_config_category *c) {
+	if(c->name) {
+		fwrite("[", sizeof(char), 1, file);
+		fwrite(c->name, sizeof(char), strlen(c->name), file);
+		fwrite("]\n", sizeof(char), 2, file);
+		GList *li = c->items;
+		while(li) {
+			janus_config_write_item(file, (janus_config_item *)li->data);
+			li = li->next;
+		}
+	}
+	fwrite("\r\n", sizeof(char), 2, file);
+}
+
+/* Appends the categories changed since the last save to the file: each
+ * is preceded by a [-name] line, so that parsing the file again drops
+ * the older version rather than merging the two */
+static int janus_config_append(janus_config *config, const char *path) {
+	janus_config_state *state = janus_config_get_state(config);
+	FILE *file = fopen(path, "at");
+	if(file == NULL)
+		return -1;
+	GHashTableIter iter;
+	gpointer key;
+	g_hash_table_iter_init(&iter, state->changed);
+	while(g_hash_table_iter_next(&iter, &key, NULL)) {
+		const char *name = (const char *)key;
+		fwrite("[-", sizeof(char), 2, file);
+		fwrite(name, sizeof(char), strlen(name), file);
+		fwrite("]\n", sizeof(char), 2, file);
+		janus_config_category *c = janus_config_get_category(config, name);
+		if(c != NULL)
+			janus_config_write_category(file, c);
+		state->appended++;
+	}
+	if(fflush(file) != 0 || fsync(fileno(file)) < 0) {
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+	return 0;
+}
+
+int janus_config_save(janus_config *config, const char *folder, const char *filename) {
 	if(config == NULL)
 		return -1;
 	FILE *file = NULL;
-	char path[1024];
+	char path[1024], temp[1040];
 	if(folder != NULL) {
 		/* Create folder, if needed */
 		if(janus_mkdir(folder, 0755) < 0) {
@@ -363,9 +528,27 @@ gboolean janus_config_save(janus_config *config, const char *folder, const char
 	} else {
 		g_snprintf(path, 1024, "%s.cfg", filename);
 	}
-	file = fopen(path, "wt");
+	janus_config_state *state = janus_config_get_state(config);
+	guint changed = state->changed ? g_hash_table_size(state->changed) : 0;
+	if(state->path != NULL && !strcmp(state->path, path) && !state->dirty && changed > 0 &&
+			state->appended + changed <= MAX(g_hash_table_size(state->categories), 16)) {
+		/* Only a few categories changed, and the file is still the one we wrote */
+		struct stat st;
+		if(stat(path, &st) == 0 && st.st_size == state->size && st.st_mtime == state->mtime) {
+			if(janus_config_append(config, path) == 0) {
+				g_hash_table_remove_all(state->changed);
+				janus_config_stat(state, path);
+				return 0;
+			}
+			JANUS_LOG(LOG_WARN, "Couldn't append to configuration file '%s', rewriting it...\n", path);
+		}
+	}
+	/* Write everything to a temporary file, and then replace the old one with it:
+	 * this way, a crash or a full disk never leaves a truncated configuration around */
+	g_snprintf(temp, sizeof(temp), "%s.tmp", path);
+	file = fopen(temp, "wt");
 	if(file == NULL) {
-		JANUS_LOG(LOG_ERR, "Couldn't save configuration file, error opening file '%s'...\n", path);
+		JANUS_LOG(LOG_ERR, "Couldn't save configuration file, error opening file '%s'...\n", temp);
 		return -3;
 	}
 	/* Print a header */
@@ -377,56 +560,34 @@ gboolean janus_config_save(janus_config *config, const char *folder, const char
 	g_snprintf(header, 256, ";\n; File automatically generated on %s\n;\n\n", date);
 	fwrite(header, sizeof(char), strlen(header), file);
 	/* Go on with the configuration */
-	if(config->items) {
-		GList *l = config->items;
-		while(l) {
-			janus_config_item *i = (janus_config_item *)l->data;
-			if(i->name && i->value) {
-				fwrite(i->name, sizeof(char), strlen(i->name), file);
-				fwrite(" = ", sizeof(char), 3, file);
-				fwrite(i->value, sizeof(char), strlen(i->value), file);
-				fwrite("\n", sizeof(char), 1, file);
-			}
-			l = l->next;
-		}
+	GList *l = config->items;
+	while(l) {
+		janus_config_write_item(file, (janus_config_item *)l->data);
+		l = l->next;
 	}
-	if(config->categories) {
-		GList *l = config->categories;
-		while(l) {
-			janus_config_category *c = (janus_config_category *)l->data;
-			if(c->name) {
-				fwrite("[", sizeof(char), 1, file);
-				fwrite(c->name, sizeof(char), strlen(c->name), file);
-				fwrite("]\n", sizeof(char), 2, file);
-				if(c->items) {
-					GList *li = c->items;
-					while(li) {
-						janus_config_item *i = (janus_config_item *)li->data;
-						if(i->name && i->value) {
-							fwrite(i->name, sizeof(char), strlen(i->name), file);
-							fwrite(" = ", sizeof(char), 3, file);
-							/* If the value contains a semicolon, escape it */
-							if(strchr(i->value, ';')) {
-								char *value = g_strdup(i->value);
-								value = janus_string_replace((char *)value, ";", "\\;");
-								fwrite(value, sizeof(char), strlen(value), file);
-								fwrite("\n", sizeof(char), 1, file);
-								g_free(value);
-							} else {
-								/* No need to escape */
-								fwrite(i->value, sizeof(char), strlen(i->value), file);
-								fwrite("\n", sizeof(char), 1, file);
-							}
-						}
-						li = li->next;
-					}
-				}
-			}
-			fwrite("\r\n", sizeof(char), 2, file);
-			l = l->next;
-		}
+	l = config->categories;
+	while(l) {
+		janus_config_write_category(file, (janus_config_category *)l->data);
+		l = l->next;
+	}
+	if(fflush(file) != 0 || fsync(fileno(file)) < 0) {
+		JANUS_LOG(LOG_ERR, "Couldn't save configuration file, error writing file '%s'... %d (%s)\n", temp, errno, strerror(errno));
+		fclose(file);
+		unlink(temp);
+		return -4;
 	}
 	fclose(file);
+	if(rename(temp, path) < 0) {
+		JANUS_LOG(LOG_ERR, "Couldn't save configuration file, error renaming '%s'... %d (%s)\n", temp, errno, strerror(errno));
+		unlink(temp);
+		return -5;
+	}
+	/* Start journaling again */
+	janus_config_stat(state, path);
+	if(state->changed)
+		g_hash_table_remove_all(state->changed);
+	state->appended = 0;
+	state->dirty = FALSE;
 	return 0;
 }
 
@@ -441,6 +602,14 @@ void janus_config_destroy(janus_config *config) {
 		g_list_free_full(config->categories, janus_config_free_category);
 		config->categories = NULL;
 	}
+	if(config->state) {
+		g_hash_table_destroy(config->state->categories);
+		if(config->state->changed)
+			g_hash_table_destroy(config->state->changed);
+		g_free(config->state->path);
+		g_free(config->state);
+		config->state = NULL;
+	}
 	if(config->name)
 		g_free((gpointer)config->name);
 	g_free((gpointer)config);
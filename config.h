@@ -32,6 +32,9 @@ typedef struct janus_config_category {
 	GList *items;
 } janus_config_category;
 
+/*! \brief Lookup index and write-back journal of a configuration, managed by the helpers below */
+typedef struct janus_config_state janus_config_state;
+
 /*! \brief 配置文件容器 */
 typedef struct janus_config {
 	/*! \brief Name of the configuration */
@@ -40,6 +43,8 @@ typedef struct janus_config {
 	GList *items;
 	/*! \brief Linked list of categories category */
 	GList *categories;
+	/*! \brief Index of the categories by name, and changes not saved yet */
+	janus_config_state *state;
 } janus_config;
 
 
@@ -118,6 +123,11 @@ int janus_config_remove_item(janus_config *config, const char *category, const c
 void janus_config_print(janus_config *config);
 
 /*! \brief 将配置保存到文件中的助手方法(Helper method to save a configuration to a file)
+ * \note If the file is the one the configuration was parsed from or last
+ * saved to, and only a few categories changed since, they're just appended
+ * to it (each preceded by a \c [-name] line that makes the parser drop the
+ * older version); otherwise, the whole file is written to a temporary file
+ * first, which then atomically replaces the old one
  * @param[in] config The configuration to sav
  * @param[in] folder The folder the file should be saved to
  * @param[in] filename The file name, extension included (should be .cfg)
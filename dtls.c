@@ -17,11 +17,13 @@
 #include "dtls.h"
 #include "rtcp.h"
 #include "events.h"
+#include "metrics.h"
 
 #include <openssl/err.h>
 #include <openssl/bn.h>
 #include <openssl/evp.h>
 #include <openssl/rsa.h>
+#include <openssl/ec.h>
 #include <openssl/asn1.h>
 
 
@@ -92,6 +94,26 @@ static SSL_CTX *ssl_ctx = NULL;
 static X509 *ssl_cert = NULL;
 static EVP_PKEY *ssl_key = NULL;
 
+/* Handshake metrics */
+static janus_metric *metric_handshakes_ok = NULL, *metric_handshakes_failed = NULL,
+	*metric_handshake_time = NULL, *metric_handshake_retransmissions = NULL;
+
+/* Keep track of how a handshake ended */
+static void janus_dtls_handshake_connected(janus_dtls_srtp *dtls) {
+	janus_metrics_inc(metric_handshakes_ok);
+	janus_metrics_add_value(metric_handshake_time, dtls->dtls_connected - dtls->dtls_started);
+	janus_metrics_add_value(metric_handshake_retransmissions, dtls->retransmissions);
+}
+
+static void janus_dtls_handshake_failed(janus_dtls_srtp *dtls) {
+	/* Only count handshakes that were still in progress, or we may count one twice */
+	if(dtls->dtls_state != JANUS_DTLS_STATE_TRYING)
+		return;
+	dtls->dtls_state = JANUS_DTLS_STATE_FAILED;
+	janus_metrics_inc(metric_handshakes_failed);
+	janus_metrics_add_value(metric_handshake_retransmissions, dtls->retransmissions);
+}
+
 static gchar local_fingerprint[160];
 gchar *janus_dtls_get_local_fingerprint(void) {
 	return (gchar *)local_fingerprint;
@@ -101,7 +123,119 @@ gchar *janus_dtls_get_local_fingerprint(void) {
 #ifdef HAVE_SCTP
 /* Helper thread to create a SCTP association that will use this DTLS stack */
 void *janus_dtls_sctp_setup_thread(void *data);
+/* Same thing, when setting up associations is done by a pool instead */
+static void janus_dtls_sctp_setup_task(gpointer data, gpointer user_data);
+static GThreadPool *sctp_workers = NULL;
+#endif
+
+
+/* Handshakes can be offloaded to a pool of crypto workers (see janus_dtls_set_workers):
+ * when that happens, incoming messages are queued per DTLS instance, and each
+ * instance in the pool gets at most a few of them processed before going back
+ * to the end of the line, so that large bursts of new PeerConnections all move
+ * forward at the same pace and the ICE loops never do the crypto themselves */
+#define JANUS_DTLS_WORKER_BATCH		4
+/* Handshake messages we queue per instance, at most: DTLS retransmits anyway */
+#define JANUS_DTLS_MAX_PENDING		32
+static GThreadPool *dtls_workers = NULL;
+static janus_metric *metric_workers_queue = NULL;
+
+typedef struct janus_dtls_pending_msg {
+	uint16_t len;
+	char buf[0];
+} janus_dtls_pending_msg;
+
+static void janus_dtls_srtp_process_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len, gboolean offloaded);
+
+static void janus_dtls_srtp_unref(janus_dtls_srtp *dtls) {
+	if(dtls == NULL || !g_atomic_int_dec_and_test(&dtls->ref))
+		return;
+	if(dtls->pending != NULL)
+		g_queue_free_full(dtls->pending, (GDestroyNotify)g_free);
+	dtls->pending = NULL;
+	janus_mutex_destroy(&dtls->mutex);
+	g_free(dtls);
+}
+
+static void janus_dtls_worker(gpointer data, gpointer user_data) {
+	janus_dtls_srtp *dtls = (janus_dtls_srtp *)data;
+	janus_mutex_lock(&dtls->mutex);
+	int processed = 0;
+	janus_dtls_pending_msg *msg = NULL;
+	while(dtls->component != NULL && processed < JANUS_DTLS_WORKER_BATCH &&
+			(msg = g_queue_pop_head(dtls->pending)) != NULL) {
+		janus_dtls_srtp_process_msg(dtls, msg->buf, msg->len, TRUE);
+		g_free(msg);
+		processed++;
+	}
+	gboolean requeue = (dtls->component != NULL && !g_queue_is_empty(dtls->pending));
+	if(!requeue)
+		dtls->scheduled = FALSE;
+	janus_mutex_unlock(&dtls->mutex);
+	if(requeue) {
+		/* Let the other handshakes in the queue have their turn first: we keep our reference */
+		GError *error = NULL;
+		g_thread_pool_push(dtls_workers, dtls, &error);
+		if(error == NULL)
+			return;
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to requeue a DTLS handshake...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		janus_mutex_lock(&dtls->mutex);
+		dtls->scheduled = FALSE;
+		janus_mutex_unlock(&dtls->mutex);
+	}
+	janus_dtls_srtp_unref(dtls);
+}
+
+/* Invoked on the ICE loop when a handshake completed by a worker is done:
+ * this is where the ICE stack would have found out, had it done it inline.
+ * The component may be freed as soon as we unlock the instance, which is why
+ * after that we only pass it along for janus_ice_dtls_handshake_done to
+ * check, with the handle locked, if it's still the one the stream uses */
+static gboolean janus_dtls_handshake_done_cb(gpointer user_data) {
+	janus_dtls_srtp *dtls = (janus_dtls_srtp *)user_data;
+	janus_mutex_lock(&dtls->mutex);
+	janus_ice_component *component = (janus_ice_component *)dtls->component;
+	janus_ice_stream *stream = component ? component->stream : NULL;
+	janus_ice_handle *handle = stream ? stream->handle : NULL;
+	janus_mutex_unlock(&dtls->mutex);
+	if(handle != NULL)
+		janus_ice_dtls_handshake_done(handle, component);
+	return G_SOURCE_REMOVE;
+}
+
+static gint64 janus_dtls_workers_queue(gpointer user_data) {
+	return dtls_workers ? g_thread_pool_unprocessed(dtls_workers) : 0;
+}
+
+int janus_dtls_set_workers(int workers) {
+	if(workers <= 0 || dtls_workers != NULL)
+		return 0;
+	GError *error = NULL;
+	dtls_workers = g_thread_pool_new(janus_dtls_worker, NULL, workers, FALSE, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the DTLS workers...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		dtls_workers = NULL;
+		return -1;
+	}
+#ifdef HAVE_SCTP
+	sctp_workers = g_thread_pool_new(janus_dtls_sctp_setup_task, NULL, workers, FALSE, &error);
+	if(error != NULL) {
+		/* Not a big deal, we'll just spawn a thread per association as before */
+		JANUS_LOG(LOG_WARN, "Got error %d (%s) trying to launch the SCTP setup workers...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		sctp_workers = NULL;
+	}
 #endif
+	metric_workers_queue = janus_metrics_add_callback("janus_dtls_workers_queue", NULL,
+		"DTLS instances waiting for a crypto worker", JANUS_METRIC_GAUGE, janus_dtls_workers_queue, NULL);
+	JANUS_LOG(LOG_INFO, "DTLS handshakes will be processed by %d crypto workers\n", workers);
+	return 0;
+}
 
 
 #if JANUS_USE_OPENSSL_PRE_1_1_API
@@ -154,52 +288,76 @@ static void janus_dtls_cb_openssl_lock(int mode, int type, const char *file, int
 #endif
 
 
-static int janus_dtls_generate_keys(X509 **certificate, EVP_PKEY **private_key) {
+static int janus_dtls_generate_keys(X509 **certificate, EVP_PKEY **private_key, gboolean rsa) {
 	static const int num_bits = 2048;
 	BIGNUM *bne = NULL;
 	RSA *rsa_key = NULL;
+	EC_KEY *ecc_key = NULL;
 	X509_NAME *cert_name = NULL;
 
-	JANUS_LOG(LOG_VERB, "Generating DTLS key / cert\n");
+	JANUS_LOG(LOG_VERB, "Generating DTLS key / cert (%s)\n", rsa ? "RSA" : "ECDSA");
 
-	/* Create a big number object. */
-	bne = BN_new();
-	if(!bne) {
-		JANUS_LOG(LOG_FATAL, "BN_new() failed\n");
+	/* Create a private key object (needed to hold the RSA or EC key). */
+	*private_key = EVP_PKEY_new();
+	if(!*private_key) {
+		JANUS_LOG(LOG_FATAL, "EVP_PKEY_new() failed\n");
 		goto error;
 	}
 
-	if(!BN_set_word(bne, RSA_F4)) {  /* RSA_F4 == 65537 */
-		JANUS_LOG(LOG_FATAL, "BN_set_word() failed\n");
-		goto error;
-	}
+	if(rsa) {
+		/* Create a big number object. */
+		bne = BN_new();
+		if(!bne) {
+			JANUS_LOG(LOG_FATAL, "BN_new() failed\n");
+			goto error;
+		}
 
-	/* Generate a RSA key. */
-	rsa_key = RSA_new();
-	if(!rsa_key) {
-		JANUS_LOG(LOG_FATAL, "RSA_new() failed\n");
-		goto error;
-	}
+		if(!BN_set_word(bne, RSA_F4)) {  /* RSA_F4 == 65537 */
+			JANUS_LOG(LOG_FATAL, "BN_set_word() failed\n");
+			goto error;
+		}
 
-	/* This takes some time. */
-	if(!RSA_generate_key_ex(rsa_key, num_bits, bne, NULL)) {
-		JANUS_LOG(LOG_FATAL, "RSA_generate_key_ex() failed\n");
-		goto error;
-	}
+		/* Generate a RSA key. */
+		rsa_key = RSA_new();
+		if(!rsa_key) {
+			JANUS_LOG(LOG_FATAL, "RSA_new() failed\n");
+			goto error;
+		}
 
-	/* Create a private key object (needed to hold the RSA key). */
-	*private_key = EVP_PKEY_new();
-	if(!*private_key) {
-		JANUS_LOG(LOG_FATAL, "EVP_PKEY_new() failed\n");
-		goto error;
-	}
+		/* This takes some time. */
+		if(!RSA_generate_key_ex(rsa_key, num_bits, bne, NULL)) {
+			JANUS_LOG(LOG_FATAL, "RSA_generate_key_ex() failed\n");
+			goto error;
+		}
 
-	if(!EVP_PKEY_assign_RSA(*private_key, rsa_key)) {
-		JANUS_LOG(LOG_FATAL, "EVP_PKEY_assign_RSA() failed\n");
-		goto error;
+		if(!EVP_PKEY_assign_RSA(*private_key, rsa_key)) {
+			JANUS_LOG(LOG_FATAL, "EVP_PKEY_assign_RSA() failed\n");
+			goto error;
+		}
+		/* The RSA key now belongs to the private key, so don't clean it up separately. */
+		rsa_key = NULL;
+	} else {
+		/* Generate a P-256 key: signatures are much cheaper and the certificate smaller */
+		ecc_key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+		if(!ecc_key) {
+			JANUS_LOG(LOG_FATAL, "EC_KEY_new_by_curve_name() failed\n");
+			goto error;
+		}
+		/* Make sure the curve is named in the certificate, or browsers won't accept it */
+		EC_KEY_set_asn1_flag(ecc_key, OPENSSL_EC_NAMED_CURVE);
+
+		if(!EC_KEY_generate_key(ecc_key)) {
+			JANUS_LOG(LOG_FATAL, "EC_KEY_generate_key() failed\n");
+			goto error;
+		}
+
+		if(!EVP_PKEY_assign_EC_KEY(*private_key, ecc_key)) {
+			JANUS_LOG(LOG_FATAL, "EVP_PKEY_assign_EC_KEY() failed\n");
+			goto error;
+		}
+		/* The EC key now belongs to the private key, so don't clean it up separately. */
+		ecc_key = NULL;
 	}
-	/* The RSA key now belongs to the private key, so don't clean it up separately. */
-	rsa_key = NULL;
 
 	/* Create the X509 certificate. */
 	*certificate = X509_new();
@@ -240,24 +398,29 @@ static int janus_dtls_generate_keys(X509 **certificate, EVP_PKEY **private_key)
 	}
 
 	/* Sign the certificate with the private key. */
-	if(!X509_sign(*certificate, *private_key, EVP_sha1())) {
+	if(!X509_sign(*certificate, *private_key, EVP_sha256())) {
 		JANUS_LOG(LOG_FATAL, "X509_sign() failed\n");
 		goto error;
 	}
 
 	/* Free stuff and resurn. */
-	BN_free(bne);
+	if(bne)
+		BN_free(bne);
 	return 0;
 
 error:
 	if(bne)
 		BN_free(bne);
-	if(rsa_key && !*private_key)
+	if(rsa_key)
 		RSA_free(rsa_key);
+	if(ecc_key)
+		EC_KEY_free(ecc_key);
 	if(*private_key)
-		EVP_PKEY_free(*private_key);  /* This also frees the RSA key. */
+		EVP_PKEY_free(*private_key);  /* This also frees the key it was assigned. */
+	*private_key = NULL;
 	if(*certificate)
 		X509_free(*certificate);
+	*certificate = NULL;
 	return -1;
 }
 
@@ -305,8 +468,63 @@ error:
 }
 
 
+/* SRTP profiles to negotiate, in order of preference */
+#ifdef HAVE_SRTP_AESGCM
+#define JANUS_DTLS_SRTP_DEFAULT_PROFILES "SRTP_AEAD_AES_256_GCM:SRTP_AEAD_AES_128_GCM:SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32"
+#else
+#define JANUS_DTLS_SRTP_DEFAULT_PROFILES "SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32"
+#endif
+static char janus_dtls_srtp_profiles[256] = JANUS_DTLS_SRTP_DEFAULT_PROFILES;
+const char *janus_dtls_get_srtp_profiles(void) {
+	return janus_dtls_srtp_profiles;
+}
+
+static void janus_dtls_set_srtp_profiles(const char *profiles) {
+	/* AES-GCM doesn't need a separate HMAC-SHA1 pass, so it's cheaper when the CPU can do AES in hardware */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	gboolean aesni = __builtin_cpu_supports("aes");
+	JANUS_LOG(LOG_INFO, "AES-NI %s available on this CPU\n", aesni ? "is" : "is not");
+#ifndef HAVE_SRTP_AESGCM
+	if(aesni)
+		JANUS_LOG(LOG_WARN, "This CPU could make AES-GCM SRTP profiles cheaper, but libsrtp doesn't support them\n");
+#endif
+#endif
+	if(profiles == NULL)
+		return;
+	char list[256];
+	memset(list, 0, sizeof(list));
+	gchar **names = g_strsplit_set(profiles, ":,", -1);
+	int i = 0;
+	for(i=0; names[i] != NULL; i++) {
+		char *name = g_strstrip(names[i]);
+		if(strlen(name) == 0)
+			continue;
+		if(!strcasecmp(name, "SRTP_AEAD_AES_256_GCM") || !strcasecmp(name, "SRTP_AEAD_AES_128_GCM")) {
+#ifndef HAVE_SRTP_AESGCM
+			JANUS_LOG(LOG_WARN, "Ignoring SRTP profile %s, libsrtp doesn't support AES-GCM\n", name);
+			continue;
+#endif
+		} else if(strcasecmp(name, "SRTP_AES128_CM_SHA1_80") && strcasecmp(name, "SRTP_AES128_CM_SHA1_32")) {
+			JANUS_LOG(LOG_WARN, "Ignoring unsupported SRTP profile %s\n", name);
+			continue;
+		}
+		if(strlen(list) > 0)
+			g_strlcat(list, ":", sizeof(list));
+		gchar *upper = g_ascii_strup(name, -1);
+		g_strlcat(list, upper, sizeof(list));
+		g_free(upper);
+	}
+	g_strfreev(names);
+	if(strlen(list) == 0) {
+		JANUS_LOG(LOG_WARN, "No valid SRTP profile in '%s', using the default ones\n", profiles);
+		return;
+	}
+	g_snprintf(janus_dtls_srtp_profiles, sizeof(janus_dtls_srtp_profiles), "%s", list);
+}
+
 /* DTLS-SRTP initialization */
-gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const char *password) {
+gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const char *password, const char *srtp_profiles, gboolean rsa_private_key) {
 	const char *crypto_lib = NULL;
 #if JANUS_USE_OPENSSL_PRE_1_1_API
 #if defined(LIBRESSL_VERSION_NUMBER)
@@ -344,16 +562,16 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 		return -1;
 	}
 	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, janus_dtls_verify_callback);
-	SSL_CTX_set_tlsext_use_srtp(ssl_ctx,
-#ifdef HAVE_SRTP_AESGCM
-		"SRTP_AEAD_AES_256_GCM:SRTP_AEAD_AES_128_GCM:SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32");
-#else
-		"SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32");
-#endif
+	janus_dtls_set_srtp_profiles(srtp_profiles);
+	if(SSL_CTX_set_tlsext_use_srtp(ssl_ctx, janus_dtls_srtp_profiles) != 0) {
+		JANUS_LOG(LOG_FATAL, "Error setting the SRTP profiles (%s)\n", janus_dtls_srtp_profiles);
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "SRTP profiles: %s\n", janus_dtls_srtp_profiles);
 
 	if(!server_pem && !server_key) {
 		JANUS_LOG(LOG_WARN, "No cert/key specified, autogenerating some...\n");
-		if(janus_dtls_generate_keys(&ssl_cert, &ssl_key) != 0) {
+		if(janus_dtls_generate_keys(&ssl_cert, &ssl_key, rsa_private_key) != 0) {
 			JANUS_LOG(LOG_FATAL, "Error generating DTLS key/certificate\n");
 			return -2;
 		}
@@ -392,6 +610,8 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 	}
 	*(lfp-1) = 0;
 	JANUS_LOG(LOG_INFO, "Fingerprint of our certificate: %s\n", local_fingerprint);
+	JANUS_LOG(LOG_INFO, "Certificate key type: %s\n",
+		EVP_PKEY_id(ssl_key) == EVP_PKEY_EC ? "ECDSA" : (EVP_PKEY_id(ssl_key) == EVP_PKEY_RSA ? "RSA" : "other"));
 	SSL_CTX_set_cipher_list(ssl_ctx, DTLS_CIPHERS);
 
 	if(janus_dtls_bio_filter_init() < 0) {
@@ -404,11 +624,40 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 		JANUS_LOG(LOG_FATAL, "Ops, error setting up libsrtp?\n");
 		return 5;
 	}
+
+	metric_handshakes_ok = janus_metrics_add("janus_dtls_handshakes_total", "result=\"connected\"",
+		"DTLS handshakes completed", JANUS_METRIC_COUNTER);
+	metric_handshakes_failed = janus_metrics_add("janus_dtls_handshakes_total", "result=\"failed\"",
+		"DTLS handshakes completed", JANUS_METRIC_COUNTER);
+	metric_handshake_time = janus_metrics_add("janus_dtls_handshake_microseconds_total", NULL,
+		"Time spent on successful DTLS handshakes (divide by the connected handshakes for the average)", JANUS_METRIC_COUNTER);
+	metric_handshake_retransmissions = janus_metrics_add("janus_dtls_handshake_retransmissions_total", NULL,
+		"DTLS retransmissions during handshakes", JANUS_METRIC_COUNTER);
 	return 0;
 }
 
 
 void janus_dtls_srtp_cleanup(void) {
+	janus_metrics_remove(metric_workers_queue);
+	metric_workers_queue = NULL;
+	if(dtls_workers != NULL) {
+		g_thread_pool_free(dtls_workers, FALSE, TRUE);
+		dtls_workers = NULL;
+	}
+#ifdef HAVE_SCTP
+	if(sctp_workers != NULL) {
+		g_thread_pool_free(sctp_workers, FALSE, TRUE);
+		sctp_workers = NULL;
+	}
+#endif
+	janus_metrics_remove(metric_handshakes_ok);
+	metric_handshakes_ok = NULL;
+	janus_metrics_remove(metric_handshakes_failed);
+	metric_handshakes_failed = NULL;
+	janus_metrics_remove(metric_handshake_time);
+	metric_handshake_time = NULL;
+	janus_metrics_remove(metric_handshake_retransmissions);
+	metric_handshake_retransmissions = NULL;
 	if(ssl_cert != NULL) {
 		X509_free(ssl_cert);
 		ssl_cert = NULL;
@@ -441,6 +690,11 @@ janus_dtls_srtp *janus_dtls_srtp_create(void *ice_component, janus_dtls_role rol
 		return NULL;
 	}
 	janus_dtls_srtp *dtls = g_malloc0(sizeof(janus_dtls_srtp));
+	janus_mutex_init(&dtls->mutex);
+	dtls->pending = g_queue_new();
+	dtls->ref = 1;
+	if(handle->icectx != NULL)
+		dtls->context = g_main_context_ref(handle->icectx);
 	/* Create SSL context, at last */
 	dtls->srtp_valid = 0;
 	dtls->ssl = SSL_new(ssl_ctx);
@@ -516,8 +770,13 @@ janus_dtls_srtp *janus_dtls_srtp_create(void *ice_component, janus_dtls_role rol
 }
 
 void janus_dtls_srtp_handshake(janus_dtls_srtp *dtls) {
-	if(dtls == NULL || dtls->ssl == NULL)
+	if(dtls == NULL)
+		return;
+	janus_mutex_lock(&dtls->mutex);
+	if(dtls->ssl == NULL) {
+		janus_mutex_unlock(&dtls->mutex);
 		return;
+	}
 	if(dtls->dtls_state == JANUS_DTLS_STATE_CREATED) {
 		/* Starting the handshake now: enforce the role */
 		dtls->dtls_started = janus_get_monotonic_time();
@@ -533,6 +792,7 @@ void janus_dtls_srtp_handshake(janus_dtls_srtp *dtls) {
 
 	/* Notify event handlers */
 	janus_dtls_notify_state_change(dtls);
+	janus_mutex_unlock(&dtls->mutex);
 }
 
 int janus_dtls_srtp_create_sctp(janus_dtls_srtp *dtls) {
@@ -557,6 +817,18 @@ int janus_dtls_srtp_create_sctp(janus_dtls_srtp *dtls) {
 	}
 	/* We need to start it in a thread, since it has blocking accept/connect stuff */
 	GError *error = NULL;
+	if(sctp_workers != NULL) {
+		/* The task owns a reference, as the instance may be destroyed before it runs */
+		g_atomic_int_inc(&dtls->ref);
+		g_thread_pool_push(sctp_workers, dtls, &error);
+		if(error == NULL)
+			return 0;
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Got error %d (%s) trying to queue the SCTP setup, spawning a thread...\n",
+			handle->handle_id, error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		error = NULL;
+		janus_dtls_srtp_unref(dtls);
+	}
 	char tname[16];
 	g_snprintf(tname, sizeof(tname), "sctpinit %"SCNu64, handle->handle_id);
 	g_thread_try_new(tname, janus_dtls_sctp_setup_thread, dtls, &error);
@@ -577,6 +849,42 @@ void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len
 		JANUS_LOG(LOG_ERR, "No DTLS-SRTP stack, no incoming message...\n");
 		return;
 	}
+	if(dtls_workers != NULL && len > 0) {
+		janus_mutex_lock(&dtls->mutex);
+		if(dtls->scheduled || (dtls->dtls_state == JANUS_DTLS_STATE_TRYING && !dtls->ready)) {
+			/* Handshake in progress, the crypto workers will take care of this */
+			if(g_queue_get_length(dtls->pending) < JANUS_DTLS_MAX_PENDING) {
+				janus_dtls_pending_msg *msg = g_malloc(sizeof(janus_dtls_pending_msg) + len);
+				msg->len = len;
+				memcpy(msg->buf, buf, len);
+				g_queue_push_tail(dtls->pending, msg);
+			} else {
+				JANUS_LOG(LOG_HUGE, "Too many DTLS messages waiting for a worker, dropping this one...\n");
+			}
+			if(!dtls->scheduled) {
+				GError *error = NULL;
+				g_atomic_int_inc(&dtls->ref);
+				g_thread_pool_push(dtls_workers, dtls, &error);
+				if(error != NULL) {
+					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to queue a DTLS handshake...\n",
+						error->code, error->message ? error->message : "??");
+					g_error_free(error);
+					g_atomic_int_dec_and_test(&dtls->ref);
+				} else {
+					dtls->scheduled = TRUE;
+				}
+			}
+			janus_mutex_unlock(&dtls->mutex);
+			return;
+		}
+		janus_mutex_unlock(&dtls->mutex);
+	}
+	janus_dtls_srtp_process_msg(dtls, buf, len, FALSE);
+}
+
+/* Where incoming messages are actually processed: when offloaded, this is
+ * invoked by a crypto worker with the DTLS mutex locked */
+static void janus_dtls_srtp_process_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len, gboolean offloaded) {
 	janus_ice_component *component = (janus_ice_component *)dtls->component;
 	if(component == NULL) {
 		JANUS_LOG(LOG_ERR, "No component, no DTLS...\n");
@@ -684,12 +992,15 @@ void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len
 				JANUS_LOG(LOG_VERB, "[%"SCNu64"]  Fingerprint is a match!\n", handle->handle_id);
 				dtls->dtls_state = JANUS_DTLS_STATE_CONNECTED;
 				dtls->dtls_connected = janus_get_monotonic_time();
+				janus_dtls_handshake_connected(dtls);
+				JANUS_LOG(LOG_VERB, "[%"SCNu64"]  Handshake took %"SCNi64"ms (%d retransmissions)\n", handle->handle_id,
+					(dtls->dtls_connected - dtls->dtls_started)/1000, dtls->retransmissions);
 				/* Notify event handlers */
 				janus_dtls_notify_state_change(dtls);
 			} else {
 				/* FIXME NOT a match! MITM? */
 				JANUS_LOG(LOG_ERR, "[%"SCNu64"]  Fingerprint is NOT a match! got %s, expected %s\n", handle->handle_id, remote_fingerprint, stream->remote_fingerprint);
-				dtls->dtls_state = JANUS_DTLS_STATE_FAILED;
+				janus_dtls_handshake_failed(dtls);
 				/* Notify event handlers */
 				janus_dtls_notify_state_change(dtls);
 				goto done;
@@ -705,17 +1016,21 @@ void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len
 						key_length = SRTP_MASTER_KEY_LENGTH;
 						salt_length = SRTP_MASTER_SALT_LENGTH;
 						master_length = SRTP_MASTER_LENGTH;
+						dtls->srtp_profile = (srtp_profile->id == SRTP_AES128_CM_SHA1_80 ?
+							JANUS_SRTP_AES128_CM_SHA1_80 : JANUS_SRTP_AES128_CM_SHA1_32);
 						break;
 #ifdef HAVE_SRTP_AESGCM
 					case SRTP_AEAD_AES_256_GCM:
 						key_length = SRTP_AESGCM256_MASTER_KEY_LENGTH;
 						salt_length = SRTP_AESGCM256_MASTER_SALT_LENGTH;
 						master_length = SRTP_AESGCM256_MASTER_LENGTH;
+						dtls->srtp_profile = JANUS_SRTP_AEAD_AES_256_GCM;
 						break;
 					case SRTP_AEAD_AES_128_GCM:
 						key_length = SRTP_AESGCM128_MASTER_KEY_LENGTH;
 						salt_length = SRTP_AESGCM128_MASTER_SALT_LENGTH;
 						master_length = SRTP_AESGCM128_MASTER_LENGTH;
+						dtls->srtp_profile = JANUS_SRTP_AEAD_AES_128_GCM;
 						break;
 #endif
 					default:
@@ -847,7 +1162,16 @@ void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len
 done:
 			if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && dtls->srtp_valid) {
 				/* Handshake successfully completed */
-				janus_ice_dtls_handshake_done(handle, component);
+				if(!offloaded) {
+					janus_ice_dtls_handshake_done(handle, component);
+				} else if(dtls->context != NULL) {
+					/* We can't lock the handle from here, let the ICE loop notify the rest of the stack */
+					GSource *source = g_idle_source_new();
+					g_atomic_int_inc(&dtls->ref);
+					g_source_set_callback(source, janus_dtls_handshake_done_cb, dtls, (GDestroyNotify)janus_dtls_srtp_unref);
+					g_source_attach(source, dtls->context);
+					g_source_unref(source);
+				}
 			} else {
 				/* Something went wrong in either DTLS or SRTP... tell the plugin about it */
 				janus_dtls_callback(dtls->ssl, SSL_CB_ALERT, 0);
@@ -859,15 +1183,21 @@ done:
 
 void janus_dtls_srtp_send_alert(janus_dtls_srtp *dtls) {
 	/* Send alert */
-	if(dtls != NULL && dtls->ssl != NULL) {
+	if(dtls == NULL)
+		return;
+	janus_mutex_lock(&dtls->mutex);
+	if(dtls->ssl != NULL) {
 		SSL_shutdown(dtls->ssl);
 		janus_dtls_fd_bridge(dtls);
 	}
+	janus_mutex_unlock(&dtls->mutex);
 }
 
 void janus_dtls_srtp_destroy(janus_dtls_srtp *dtls) {
 	if(dtls == NULL)
 		return;
+	/* If a worker is busy with this instance, wait for it to be done */
+	janus_mutex_lock(&dtls->mutex);
 	dtls->ready = 0;
 	dtls->retransmissions = 0;
 #ifdef HAVE_SCTP
@@ -898,8 +1228,18 @@ void janus_dtls_srtp_destroy(janus_dtls_srtp *dtls) {
 		}
 		/* FIXME What about dtls->remote_policy and dtls->local_policy? */
 	}
-	g_free(dtls);
-	dtls = NULL;
+	/* Messages still waiting for a worker are useless now */
+	janus_dtls_pending_msg *msg = NULL;
+	while((msg = g_queue_pop_head(dtls->pending)) != NULL)
+		g_free(msg);
+	GMainContext *context = dtls->context;
+	dtls->context = NULL;
+	janus_mutex_unlock(&dtls->mutex);
+	/* This may destroy pending sources too, which is why the mutex must be unlocked by now */
+	if(context != NULL)
+		g_main_context_unref(context);
+	/* Workers or sources may still hold a reference, the last one frees the memory */
+	janus_dtls_srtp_unref(dtls);
 }
 
 /* DTLS alert callback */
@@ -929,6 +1269,7 @@ void janus_dtls_callback(const SSL *ssl, int where, int ret) {
 		return;
 	}
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] DTLS alert triggered on stream %"SCNu16" (component %"SCNu16"), closing...\n", handle->handle_id, stream->stream_id, component->component_id);
+	janus_dtls_handshake_failed(dtls);
 	janus_ice_webrtc_hangup(handle, "DTLS alert");
 }
 
@@ -969,7 +1310,7 @@ void janus_dtls_fd_bridge(janus_dtls_srtp *dtls) {
 			/* FIXME Just a warning for now, this will need to be solved with proper fragmentation */
 			JANUS_LOG(LOG_WARN, "[%"SCNu64"] The DTLS stack is trying to send a packet of %d bytes, this may be larger than the MTU and get dropped!\n", handle->handle_id, out);
 		}
-		int bytes = nice_agent_send(handle->agent, component->stream_id, component->component_id, out, outgoing);
+		int bytes = janus_ice_component_send(handle, component, out, outgoing);
 		if(bytes < out) {
 			JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error sending DTLS message on component %d of stream %d (%d)\n", handle->handle_id, component->component_id, stream->stream_id, bytes);
 		} else {
@@ -987,10 +1328,10 @@ void janus_dtls_fd_bridge(janus_dtls_srtp *dtls) {
 }
 
 #ifdef HAVE_SCTP
-void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, char *buf, int len) {
+void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, gboolean binary, char *buf, int len) {
 	if(dtls == NULL || !dtls->ready || dtls->sctp == NULL || buf == NULL || len < 1)
 		return;
-	janus_sctp_send_data(dtls->sctp, buf, len);
+	janus_sctp_send_data(dtls->sctp, binary, buf, len);
 }
 
 int janus_dtls_send_sctp_data(janus_dtls_srtp *dtls, char *buf, int len) {
@@ -1006,7 +1347,7 @@ int janus_dtls_send_sctp_data(janus_dtls_srtp *dtls, char *buf, int len) {
 	return res;
 }
 
-void janus_dtls_notify_data(janus_dtls_srtp *dtls, char *buf, int len) {
+void janus_dtls_notify_data(janus_dtls_srtp *dtls, gboolean binary, char *buf, int len) {
 	if(dtls == NULL || buf == NULL || len < 1)
 		return;
 	janus_ice_component *component = (janus_ice_component *)dtls->component;
@@ -1024,14 +1365,23 @@ void janus_dtls_notify_data(janus_dtls_srtp *dtls, char *buf, int len) {
 		JANUS_LOG(LOG_ERR, "No handle...\n");
 		return;
 	}
-	janus_ice_incoming_data(handle, buf, len);
+	janus_ice_incoming_data(handle, binary, buf, len);
 }
 #endif
 
+static gboolean janus_dtls_retry_locked(janus_dtls_srtp *dtls);
 gboolean janus_dtls_retry(gpointer stack) {
 	janus_dtls_srtp *dtls = (janus_dtls_srtp *)stack;
 	if(dtls == NULL)
 		return FALSE;
+	/* A worker may be processing a message for this instance right now */
+	janus_mutex_lock(&dtls->mutex);
+	gboolean res = janus_dtls_retry_locked(dtls);
+	janus_mutex_unlock(&dtls->mutex);
+	return res;
+}
+
+static gboolean janus_dtls_retry_locked(janus_dtls_srtp *dtls) {
 	janus_ice_component *component = (janus_ice_component *)dtls->component;
 	if(component == NULL)
 		return FALSE;
@@ -1051,6 +1401,8 @@ gboolean janus_dtls_retry(gpointer stack) {
 		/* FIXME Should we really give up after 20 seconds waiting for DTLS? */
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"] DTLS taking too much time for component %d in stream %d...\n",
 			handle->handle_id, component->component_id, stream->stream_id);
+		janus_dtls_handshake_failed(dtls);
+		janus_dtls_notify_state_change(dtls);
 		janus_ice_webrtc_hangup(handle, "DTLS timeout");
 		goto stoptimer;
 	}
@@ -1100,4 +1452,22 @@ void *janus_dtls_sctp_setup_thread(void *data) {
 	g_thread_unref(g_thread_self());
 	return NULL;
 }
+
+static void janus_dtls_sctp_setup_task(gpointer data, gpointer user_data) {
+	janus_dtls_srtp *dtls = (janus_dtls_srtp *)data;
+	if(dtls == NULL)
+		return;
+	/* We own a reference: if the instance was destroyed in the meanwhile, there's nothing to do */
+	janus_mutex_lock(&dtls->mutex);
+	janus_sctp_association *sctp = (dtls->component != NULL) ? (janus_sctp_association *)dtls->sctp : NULL;
+	janus_mutex_unlock(&dtls->mutex);
+	if(sctp == NULL) {
+		JANUS_LOG(LOG_WARN, "DTLS/SCTP stack gone before the SCTP association could be set up\n");
+		janus_dtls_srtp_unref(dtls);
+		return;
+	}
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Setting up the SCTP association\n", sctp->handle_id);
+	janus_sctp_association_setup(sctp);
+	janus_dtls_srtp_unref(dtls);
+}
 #endif
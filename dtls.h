@@ -27,8 +27,15 @@
  * @param[in] server_pem Path to the certificate to use
  * @param[in] server_key Path to the key to use
  * @param[in] password Password needed to use the key, if any
+ * @param[in] srtp_profiles Colon or comma separated list of the SRTP profiles to negotiate, in order
+ * of preference (e.g., "SRTP_AEAD_AES_128_GCM:SRTP_AES128_CM_SHA1_80"), or NULL for the default ones
+ * @param[in] rsa_private_key Whether an RSA key should be generated, rather than an ECDSA (P-256) one,
+ * when no certificate and key are provided
  * @returns 0 in case of success, a negative integer on errors */
-gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const char *password);
+gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const char *password, const char *srtp_profiles, gboolean rsa_private_key);
+/*! \brief Method to get the list of SRTP profiles we negotiate
+ * @returns The colon separated list of SRTP profiles, in order of preference */
+const char *janus_dtls_get_srtp_profiles(void);
 /*! \brief Method to cleanup DTLS stuff before exiting */
 void janus_dtls_srtp_cleanup(void);
 /*! \brief Method to return a string representation (SHA-256) of the certificate fingerprint */
@@ -72,6 +79,8 @@ typedef struct janus_dtls_srtp {
 	BIO *filter_bio;
 	/*! \brief Whether SRTP has been correctly set up for this component or not */
 	gint srtp_valid;
+	/*! \brief SRTP profile negotiated for this component, if any */
+	janus_srtp_profile srtp_profile;
 	/*! \brief libsrtp context for incoming SRTP packets */
 	srtp_t srtp_in;
 	/*! \brief libsrtp context for outgoing SRTP packets */
@@ -90,9 +99,28 @@ typedef struct janus_dtls_srtp {
 	/*! \brief SCTP association, if DataChannels are involved */
 	janus_sctp_association *sctp;
 #endif
+	/*! \brief Mutex serializing access to the DTLS stack, when handshakes are processed by the crypto workers */
+	janus_mutex mutex;
+	/*! \brief Incoming handshake messages waiting for a crypto worker */
+	GQueue *pending;
+	/*! \brief Whether this instance is currently queued in the crypto workers pool */
+	gboolean scheduled;
+	/*! \brief Context of the ICE loop owning this instance, used to notify completed offloaded handshakes */
+	GMainContext *context;
+	/*! \brief Reference counter, as the crypto workers may outlive the component */
+	volatile gint ref;
 } janus_dtls_srtp;
 
 
+/*! \brief Have DTLS handshakes processed by a pool of crypto workers, rather than the ICE loops
+ * \details When enabled, incoming handshake messages are queued and processed by a bounded
+ * pool of threads, a few per DTLS instance at a time, so that established PeerConnections
+ * are not delayed by bursts of new ones: SCTP associations are set up by a pool of the same
+ * size too, rather than a new thread each. Must be called before any PeerConnection is created.
+ * @param[in] workers Number of crypto workers (0 keeps processing handshakes inline)
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_dtls_set_workers(int workers);
+
 /*! \brief Create a janus_dtls_srtp instance
  * @param[in] component Opaque pointer to the component owning that will use the stack
  * @param[in] role The role of the DTLS stack (client/server)
@@ -140,9 +168,10 @@ void janus_dtls_fd_bridge(janus_dtls_srtp *dtls);
 #ifdef HAVE_SCTP
 /*! \brief Callback (called from the ICE handle) to encapsulate in DTLS outgoing SCTP data (DataChannel)
  * @param[in] dtls The janus_dtls_srtp instance to use
+ * @param[in] binary Whether the data is binary, rather than text
  * @param[in] buf The data buffer to encapsulate
  * @param[in] len The data length */
-void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, char *buf, int len);
+void janus_dtls_wrap_sctp_data(janus_dtls_srtp *dtls, gboolean binary, char *buf, int len);
 
 /*! \brief Callback (called from the SCTP stack) to encapsulate in DTLS outgoing SCTP data (DataChannel)
  * @param[in] dtls The janus_dtls_srtp instance to use
@@ -153,9 +182,10 @@ int janus_dtls_send_sctp_data(janus_dtls_srtp *dtls, char *buf, int len);
 
 /*! \brief Callback to be notified about incoming SCTP data (DataChannel) to forward to the handle
  * @param[in] dtls The janus_dtls_srtp instance to use
+ * @param[in] binary Whether the data is binary, rather than text
  * @param[in] buf The data buffer
  * @param[in] len The data length */
-void janus_dtls_notify_data(janus_dtls_srtp *dtls, char *buf, int len);
+void janus_dtls_notify_data(janus_dtls_srtp *dtls, gboolean binary, char *buf, int len);
 #endif
 
 /*! \brief DTLS retransmission timer
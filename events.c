@@ -21,10 +21,148 @@ static GHashTable *eventhandlers = NULL;
 
 static GAsyncQueue *events = NULL;
 static json_t exit_event;
+static volatile gint events_peak = 0;
 
 static GThread *events_thread;
 void *janus_events_thread(void *data);
 
+
+/* MessagePack serialization of a Jansson object (see https://github.com/msgpack/msgpack/blob/master/spec.md) */
+static void janus_events_msgpack_header(GByteArray *buf, guint8 fix, guint32 fixmax, guint8 type16, guint32 size) {
+	guint8 hdr[5];
+	if(size <= fixmax) {
+		hdr[0] = fix | size;
+		g_byte_array_append(buf, hdr, 1);
+	} else if(size <= 0xFFFF) {
+		hdr[0] = type16;
+		hdr[1] = size >> 8;
+		hdr[2] = size & 0xFF;
+		g_byte_array_append(buf, hdr, 3);
+	} else {
+		/* The 32-bit variant always follows the 16-bit one */
+		hdr[0] = type16 + 1;
+		hdr[1] = size >> 24;
+		hdr[2] = (size >> 16) & 0xFF;
+		hdr[3] = (size >> 8) & 0xFF;
+		hdr[4] = size & 0xFF;
+		g_byte_array_append(buf, hdr, 5);
+	}
+}
+
+static void janus_events_msgpack_uint(GByteArray *buf, guint8 type, guint64 value, int bytes) {
+	guint8 data[9];
+	data[0] = type;
+	int i = 0;
+	for(i=0; i<bytes; i++)
+		data[1+i] = (value >> (8*(bytes-1-i))) & 0xFF;
+	g_byte_array_append(buf, data, 1+bytes);
+}
+
+static void janus_events_msgpack_string(GByteArray *buf, const char *str, size_t len) {
+	if(len < 32) {
+		janus_events_msgpack_header(buf, 0xa0, 31, 0xda, len);
+	} else if(len <= 0xFF) {
+		janus_events_msgpack_uint(buf, 0xd9, len, 1);
+	} else {
+		janus_events_msgpack_header(buf, 0xa0, 0, 0xda, len);
+	}
+	g_byte_array_append(buf, (const guint8 *)str, len);
+}
+
+static void janus_events_msgpack_encode(GByteArray *buf, json_t *json) {
+	guint8 byte = 0;
+	switch(json_typeof(json)) {
+		case JSON_OBJECT: {
+			janus_events_msgpack_header(buf, 0x80, 15, 0xde, json_object_size(json));
+			void *iter = json_object_iter(json);
+			while(iter) {
+				const char *key = json_object_iter_key(iter);
+				janus_events_msgpack_string(buf, key, strlen(key));
+				janus_events_msgpack_encode(buf, json_object_iter_value(iter));
+				iter = json_object_iter_next(json, iter);
+			}
+			break;
+		}
+		case JSON_ARRAY: {
+			size_t i = 0, size = json_array_size(json);
+			janus_events_msgpack_header(buf, 0x90, 15, 0xdc, size);
+			for(i=0; i<size; i++)
+				janus_events_msgpack_encode(buf, json_array_get(json, i));
+			break;
+		}
+		case JSON_STRING: {
+			const char *str = json_string_value(json);
+			janus_events_msgpack_string(buf, str, strlen(str));
+			break;
+		}
+		case JSON_INTEGER: {
+			json_int_t value = json_integer_value(json);
+			if(value >= 0) {
+				if(value < 128) {
+					byte = value;
+					g_byte_array_append(buf, &byte, 1);
+				} else if(value <= 0xFF) {
+					janus_events_msgpack_uint(buf, 0xcc, value, 1);
+				} else if(value <= 0xFFFF) {
+					janus_events_msgpack_uint(buf, 0xcd, value, 2);
+				} else if(value <= 0xFFFFFFFFLL) {
+					janus_events_msgpack_uint(buf, 0xce, value, 4);
+				} else {
+					janus_events_msgpack_uint(buf, 0xcf, value, 8);
+				}
+			} else {
+				if(value >= -32) {
+					byte = (guint8)(gint8)value;
+					g_byte_array_append(buf, &byte, 1);
+				} else if(value >= G_MININT8) {
+					janus_events_msgpack_uint(buf, 0xd0, (guint64)value, 1);
+				} else if(value >= G_MININT16) {
+					janus_events_msgpack_uint(buf, 0xd1, (guint64)value, 2);
+				} else if(value >= G_MININT32) {
+					janus_events_msgpack_uint(buf, 0xd2, (guint64)value, 4);
+				} else {
+					janus_events_msgpack_uint(buf, 0xd3, (guint64)value, 8);
+				}
+			}
+			break;
+		}
+		case JSON_REAL: {
+			union { double d; guint64 u; } value;
+			value.d = json_real_value(json);
+			janus_events_msgpack_uint(buf, 0xcb, value.u, 8);
+			break;
+		}
+		case JSON_TRUE:
+			byte = 0xc3;
+			g_byte_array_append(buf, &byte, 1);
+			break;
+		case JSON_FALSE:
+			byte = 0xc2;
+			g_byte_array_append(buf, &byte, 1);
+			break;
+		case JSON_NULL:
+		default:
+			byte = 0xc0;
+			g_byte_array_append(buf, &byte, 1);
+			break;
+	}
+}
+
+/* Serialize an event in one of the encodings handlers can ask for */
+static GBytes *janus_events_encode(json_t *event, int encoding) {
+	if(encoding == JANUS_EVENTHANDLER_ENCODING_JSON) {
+		char *text = json_dumps(event, JSON_COMPACT | JSON_PRESERVE_ORDER);
+		if(text == NULL)
+			return NULL;
+		return g_bytes_new_take(text, strlen(text));
+	} else if(encoding == JANUS_EVENTHANDLER_ENCODING_MSGPACK) {
+		GByteArray *buf = g_byte_array_sized_new(256);
+		janus_events_msgpack_encode(buf, event);
+		return g_byte_array_free_to_bytes(buf);
+	}
+	return NULL;
+}
+
 int janus_events_init(gboolean enabled, char *server_name, GHashTable *handlers) {
 	/* We setup a thread for passing events to the handlers */
 	GError *error = NULL;
@@ -59,6 +197,14 @@ gboolean janus_events_is_enabled(void) {
 	return eventsenabled;
 }
 
+int janus_events_get_queue_depth(void) {
+	return events ? g_async_queue_length(events) : 0;
+}
+
+int janus_events_get_queue_peak(void) {
+	return g_atomic_int_get(&events_peak);
+}
+
 void janus_events_notify_handlers(int type, guint64 session_id, ...) {
 	/* This method has a variable list of arguments, depending on the event type */
 	va_list args;
@@ -218,8 +364,12 @@ void janus_events_notify_handlers(int type, guint64 session_id, ...) {
 	json_object_set_new(event, "event", body);
 	va_end(args);
 
-	/* Enqueue the event */
+	/* Enqueue the event, and keep track of how long the queue got */
 	g_async_queue_push(events, event);
+	gint depth = g_async_queue_length(events);
+	gint peak = g_atomic_int_get(&events_peak);
+	while(depth > peak && !g_atomic_int_compare_and_exchange(&events_peak, peak, depth))
+		peak = g_atomic_int_get(&events_peak);
 }
 
 void *janus_events_thread(void *data) {
@@ -240,14 +390,31 @@ void *janus_events_thread(void *data) {
 		gpointer value;
 		g_hash_table_iter_init(&iter, eventhandlers);
 		json_incref(event);
+		/* Handlers asking for the same encoding share the same serialized event */
+		GBytes *encoded[JANUS_EVENTHANDLER_ENCODING_MSGPACK+1] = { NULL };
 		while(g_hash_table_iter_next(&iter, NULL, &value)) {
 			janus_eventhandler *e = value;
 			if(e == NULL)
 				continue;
 			if(!janus_flags_is_set(&e->events_mask, type))
 				continue;
+			int encoding = e->events_encoding;
+			if(e->incoming_encoded_event != NULL && encoding > JANUS_EVENTHANDLER_ENCODING_NONE &&
+					encoding <= JANUS_EVENTHANDLER_ENCODING_MSGPACK) {
+				if(encoded[encoding] == NULL)
+					encoded[encoding] = janus_events_encode(event, encoding);
+				if(encoded[encoding] != NULL) {
+					e->incoming_encoded_event(event, encoded[encoding]);
+					continue;
+				}
+			}
 			e->incoming_event(event);
 		}
+		int i = 0;
+		for(i=0; i<=JANUS_EVENTHANDLER_ENCODING_MSGPACK; i++) {
+			if(encoded[i] != NULL)
+				g_bytes_unref(encoded[i]);
+		}
 		json_decref(event);
 
 		/* Unref the final event reference, interested handlers will have their own reference */
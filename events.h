@@ -29,6 +29,12 @@ void janus_events_deinit(void);
 /*! \brief Quick method to check whether event handlers are enabled at all or not
  * @returns TRUE if they're enabled, FALSE if not */
 gboolean janus_events_is_enabled(void);
+/*! \brief Method to get how many events are waiting to be passed to handlers
+ * @returns The current depth of the events queue */
+int janus_events_get_queue_depth(void);
+/*! \brief Method to get the maximum depth the events queue ever reached
+ * @returns The peak depth of the events queue */
+int janus_events_get_queue_peak(void);
 
 /*! \brief Notify an event to all interested handlers
  * @note According to the type of event to notify, different arguments may
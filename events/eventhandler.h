@@ -61,6 +61,14 @@ janus_eventhandler *create(void) {
  * reject an event handler plugin that doesn't implement any of the
  * mandatory callbacks.
  * 
+ * Handlers that just serialize events and send them somewhere can also
+ * implement the optional \c incoming_encoded_event() callback, and set
+ * \c events_encoding to one of the available encodings (compact JSON or
+ * MessagePack): in that case the core serializes each event only once
+ * per encoding, and passes the same (reference counted) buffer to all
+ * the handlers that asked for that encoding, instead of having each of
+ * them serialize the event again.
+ * 
  * Additionally, a \c janus_eventhandler instance must also include a
  * mask of the events it is interested in, a \c events_mask janus_flag
  * object that must refer to the available types defined in this header.
@@ -101,7 +109,7 @@ janus_eventhandler *create(void) {
 
 
 /*! \brief Version of the API, to match the one event handler plugins were compiled against */
-#define JANUS_EVENTHANDLER_API_VERSION	2
+#define JANUS_EVENTHANDLER_API_VERSION	3
 
 /*! \brief Initialization of all event handler plugin properties to NULL
  * 
@@ -148,6 +156,20 @@ static janus_eventhandler janus_fake_eventhandler handler plugin =
 #define JANUS_EVENT_TYPE_ALL		(0xffffffff)
 ///@}
 
+/** @name Encodings the core can pass events in
+ * @details Handlers that implement \c incoming_encoded_event can set their
+ * \c events_encoding property to any of these, to get events already
+ * serialized by the core; the default is to only get the json_t object.
+ */
+///@{
+/*! \brief No encoding: events are only notified via incoming_event */
+#define JANUS_EVENTHANDLER_ENCODING_NONE	0
+/*! \brief Compact JSON text (no indentation, no trailing null character) */
+#define JANUS_EVENTHANDLER_ENCODING_JSON	1
+/*! \brief MessagePack (http://msgpack.org) */
+#define JANUS_EVENTHANDLER_ENCODING_MSGPACK	2
+///@}
+
 #define JANUS_EVENTHANDLER_INIT(...) {			\
 		.init = NULL,							\
 		.destroy = NULL,						\
@@ -159,7 +181,9 @@ static janus_eventhandler janus_fake_eventhandler handler plugin =
 		.get_author = NULL,						\
 		.get_package = NULL,					\
 		.incoming_event = NULL,					\
+		.incoming_encoded_event = NULL,			\
 		.events_mask = JANUS_EVENT_TYPE_NONE,	\
+		.events_encoding = JANUS_EVENTHANDLER_ENCODING_NONE,	\
 		## __VA_ARGS__ }
 
 
@@ -227,8 +251,22 @@ struct janus_eventhandler {
 	 * @returns A Jansson object containing the response for the client */
 	json_t *(* const handle_request)(json_t *request);
 
+	/*! \brief Optional method to notify the event handler plugin that a new event is
+	 * available, serialized in the encoding specified in \c events_encoding
+	 * \details If this callback is implemented and \c events_encoding is not
+	 * JANUS_EVENTHANDLER_ENCODING_NONE, it's invoked instead of incoming_event.
+	 * The same rules apply: do NOT handle the event directly in this method. The
+	 * \c payload buffer is shared with other handlers: use \c g_bytes_ref if you
+	 * need to keep it, and \c json_incref for the event object, if needed.
+	 * @param[in] event Jansson object containing the event details
+	 * @param[in] payload The serialized event */
+	void (* const incoming_encoded_event)(json_t *event, GBytes *payload);
+
+
 	/*! \brief Mask of events this handler is interested in, as a janus_flags object */
 	janus_flags events_mask;
+	/*! \brief Encoding events should be passed in to incoming_encoded_event, if any */
+	int events_encoding;
 };
 
 /*! \brief The hook that event handler plugins need to implement to be created from the gateway */
@@ -43,6 +43,7 @@ const char *janus_rabbitmqevh_get_name(void);
 const char *janus_rabbitmqevh_get_author(void);
 const char *janus_rabbitmqevh_get_package(void);
 void janus_rabbitmqevh_incoming_event(json_t *event);
+void janus_rabbitmqevh_incoming_encoded_event(json_t *event, GBytes *payload);
 json_t *janus_rabbitmqevh_handle_request(json_t *request);
 
 /* Event handler setup */
@@ -60,6 +61,7 @@ static janus_eventhandler janus_rabbitmqevh =
 		.get_package = janus_rabbitmqevh_get_package,
 
 		.incoming_event = janus_rabbitmqevh_incoming_event,
+		.incoming_encoded_event = janus_rabbitmqevh_incoming_encoded_event,
 		.handle_request = janus_rabbitmqevh_handle_request,
 
 		.events_mask = JANUS_EVENT_TYPE_NONE
@@ -80,11 +82,36 @@ static void *janus_rabbitmqevh_handler(void *data);
 /* Queue of events to handle */
 static GAsyncQueue *events = NULL;
 static gboolean group_events = TRUE;
+static int max_events = 100;	/* Events per message, when grouping */
 static json_t exit_event;
-static void janus_rabbitmqevh_event_free(json_t *event) {
-	if(!event || event == &exit_event)
+/* Events in the queue may come with their serialized version, if we asked the core for one */
+typedef struct janus_rabbitmqevh_item {
+	json_t *event;
+	GBytes *payload;
+} janus_rabbitmqevh_item;
+static void janus_rabbitmqevh_item_free(janus_rabbitmqevh_item *item) {
+	if(!item)
 		return;
-	json_decref(event);
+	if(item->event && item->event != &exit_event)
+		json_decref(item->event);
+	if(item->payload)
+		g_bytes_unref(item->payload);
+	g_free(item);
+}
+static void janus_rabbitmqevh_queue_push(json_t *event, GBytes *payload) {
+	janus_rabbitmqevh_item *item = g_malloc(sizeof(janus_rabbitmqevh_item));
+	item->event = event;
+	item->payload = payload;
+	g_async_queue_push(events, item);
+}
+static int janus_rabbitmqevh_encoding_from_string(const char *name) {
+	if(name == NULL || !strcasecmp(name, "none"))
+		return JANUS_EVENTHANDLER_ENCODING_NONE;
+	if(!strcasecmp(name, "json"))
+		return JANUS_EVENTHANDLER_ENCODING_JSON;
+	if(!strcasecmp(name, "msgpack"))
+		return JANUS_EVENTHANDLER_ENCODING_MSGPACK;
+	return -1;
 }
 
 /* JSON serialization options */
@@ -106,7 +133,8 @@ static struct janus_json_parameter request_parameters[] = {
 };
 static struct janus_json_parameter tweak_parameters[] = {
 	{"events", JSON_STRING, 0},
-	{"grouping", JANUS_JSON_BOOL, 0}
+	{"grouping", JANUS_JSON_BOOL, 0},
+	{"max_events", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
 /* Error codes (for the tweaking via Admin API */
 #define JANUS_RABBITMQEVH_ERROR_INVALID_REQUEST		411
@@ -232,6 +260,26 @@ int janus_rabbitmqevh_init(const char *config_path) {
 	item = janus_config_get_item_drilldown(config, "general", "grouping");
 	if(item && item->value)
 		group_events = janus_is_true(item->value);
+	/* Should we get events already serialized by the core? */
+	item = janus_config_get_item_drilldown(config, "general", "encoding");
+	if(item && item->value) {
+		int encoding = janus_rabbitmqevh_encoding_from_string(item->value);
+		if(encoding < 0) {
+			JANUS_LOG(LOG_WARN, "Invalid value for 'encoding' (%s), using the 'json' format option\n", item->value);
+		} else {
+			janus_rabbitmqevh.events_encoding = encoding;
+		}
+	}
+	/* How many events can we group in a single message? */
+	item = janus_config_get_item_drilldown(config, "general", "max_events");
+	if(item && item->value) {
+		int me = atoi(item->value);
+		if(me <= 0) {
+			JANUS_LOG(LOG_WARN, "Invalid value for 'max_events' (%s), using %d\n", item->value, max_events);
+		} else {
+			max_events = me;
+		}
+	}
 
 	/* Handle configuration, starting from the server details */
 	item = janus_config_get_item_drilldown(config, "general", "host");
@@ -387,7 +435,7 @@ int janus_rabbitmqevh_init(const char *config_path) {
 	}
 
 	/* Initialize the events queue */
-	events = g_async_queue_new_full((GDestroyNotify) janus_rabbitmqevh_event_free);
+	events = g_async_queue_new_full((GDestroyNotify) janus_rabbitmqevh_item_free);
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
@@ -439,7 +487,7 @@ void janus_rabbitmqevh_destroy(void) {
 		return;
 	g_atomic_int_set(&stopping, 1);
 
-	g_async_queue_push(events, &exit_event);
+	janus_rabbitmqevh_queue_push(&exit_event, NULL);
 	if(handler_thread != NULL) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
@@ -507,7 +555,16 @@ void janus_rabbitmqevh_incoming_event(json_t *event) {
 	 * when the event actually happened on this machine, so that, if relevant, we can compute
 	 * any delay in the actual event processing ourselves. */
 	json_incref(event);
-	g_async_queue_push(events, event);
+	janus_rabbitmqevh_queue_push(event, NULL);
+}
+
+void janus_rabbitmqevh_incoming_encoded_event(json_t *event, GBytes *payload) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return;
+	/* Same as above, but the core already serialized the event for us: we keep
+	 * the object too, as we need it to know what the event is about */
+	json_incref(event);
+	janus_rabbitmqevh_queue_push(event, g_bytes_ref(payload));
 }
 
 json_t *janus_rabbitmqevh_handle_request(json_t *request) {
@@ -537,6 +594,15 @@ json_t *janus_rabbitmqevh_handle_request(json_t *request) {
 		/* Grouping */
 		if(json_object_get(request, "grouping"))
 			group_events = json_is_true(json_object_get(request, "grouping"));
+		if(json_object_get(request, "max_events")) {
+			int me = json_integer_value(json_object_get(request, "max_events"));
+			if(me == 0) {
+				error_code = JANUS_RABBITMQEVH_ERROR_INVALID_ELEMENT;
+				g_snprintf(error_cause, 512, "Invalid value for 'max_events' (must be at least 1)");
+				goto plugin_response;
+			}
+			max_events = me;
+		}
 	} else {
 		JANUS_LOG(LOG_VERB, "Unknown request '%s'\n", request_text);
 		error_code = JANUS_RABBITMQEVH_ERROR_INVALID_REQUEST;
@@ -561,19 +627,34 @@ plugin_response:
 /* Thread to handle incoming events */
 static void *janus_rabbitmqevh_handler(void *data) {
 	JANUS_LOG(LOG_VERB, "Joining RabbitMQEventHandler handler thread\n");
+	janus_rabbitmqevh_item *item = NULL;
 	json_t *event = NULL, *output = NULL;
+	GBytes *payload = NULL;
+	GByteArray *batch = NULL;
 	char *event_text = NULL;
-	int count = 0, max = group_events ? 100 : 1;
+	int encoding = JANUS_EVENTHANDLER_ENCODING_NONE;
+	int count = 0, encoded = 0, max = 1;
 
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
 
-		event = g_async_queue_pop(events);
-		if(event == NULL)
+		item = g_async_queue_pop(events);
+		if(item == NULL)
 			continue;
-		if(event == &exit_event)
+		if(item->event == &exit_event) {
+			janus_rabbitmqevh_item_free(item);
 			break;
+		}
+		event = item->event;
+		payload = item->payload;
+		g_free(item);
 		count = 0;
+		encoded = 0;
 		output = NULL;
+		/* If events come serialized already, we just concatenate them */
+		encoding = janus_rabbitmqevh.events_encoding;
+		if(encoding != JANUS_EVENTHANDLER_ENCODING_NONE)
+			batch = g_byte_array_new();
+		max = group_events ? max_events : 1;
 
 		while(TRUE) {
 			/* Handle event: just for fun, let's see how long it took for us to take care of this */
@@ -784,6 +865,32 @@ static void *janus_rabbitmqevh_handler(void *data) {
 					break;
 			}
 
+			if(batch != NULL) {
+				/* Append the serialized event to the batch, separating them for JSON: if
+				 * the core couldn't serialize this event, we do it ourselves for JSON, while
+				 * for MessagePack we have to leave it out, or the batch would be broken */
+				gsize size = 0;
+				gconstpointer data = payload ? g_bytes_get_data(payload, &size) : NULL;
+				char *text = NULL;
+				if(data == NULL && encoding == JANUS_EVENTHANDLER_ENCODING_JSON) {
+					text = json_dumps(event, JSON_COMPACT | JSON_PRESERVE_ORDER);
+					data = text;
+					size = text ? strlen(text) : 0;
+				}
+				if(data == NULL) {
+					JANUS_LOG(LOG_WARN, "Event not serialized by the core, skipping it\n");
+				} else {
+					if(group_events && encoding == JANUS_EVENTHANDLER_ENCODING_JSON)
+						g_byte_array_append(batch, (const guint8 *)(encoded ? "," : "["), 1);
+					g_byte_array_append(batch, data, size);
+					encoded++;
+				}
+				free(text);
+			}
+			if(payload != NULL) {
+				g_bytes_unref(payload);
+				payload = NULL;
+			}
 			if(!group_events) {
 				/* We're done here, we just need a single event */
 				output = event;
@@ -797,19 +904,61 @@ static void *janus_rabbitmqevh_handler(void *data) {
 			count++;
 			if(count == max)
 				break;
-			event = g_async_queue_try_pop(events);
-			if(event == NULL || event == &exit_event)
+			item = g_async_queue_try_pop(events);
+			if(item == NULL)
 				break;
+			if(item->event == &exit_event) {
+				/* Put the exit marker back, we'll see it after sending what we have */
+				g_async_queue_push_front(events, item);
+				break;
+			}
+			event = item->event;
+			payload = item->payload;
+			g_free(item);
 		}
 
-		if(!g_atomic_int_get(&stopping)) {
-			/* Since this a simple plugin, it does the same for all events: so just convert to string... */
-			event_text = json_dumps(output, json_format);
+		if(batch != NULL) {
+			/* The core serialized the events already, we just need to wrap them in an array */
+			if(encoded > 0 && group_events && encoding == JANUS_EVENTHANDLER_ENCODING_JSON) {
+				g_byte_array_append(batch, (const guint8 *)"]", 1);
+			} else if(encoded > 0 && group_events && encoding == JANUS_EVENTHANDLER_ENCODING_MSGPACK) {
+				guint8 hdr[5];
+				int hdrlen = 1;
+				if(encoded < 16) {
+					hdr[0] = 0x90 | encoded;
+				} else if(encoded <= 0xFFFF) {
+					hdr[0] = 0xdc;
+					hdr[1] = encoded >> 8;
+					hdr[2] = encoded & 0xFF;
+					hdrlen = 3;
+				} else {
+					hdr[0] = 0xdd;
+					hdr[1] = encoded >> 24;
+					hdr[2] = (encoded >> 16) & 0xFF;
+					hdr[3] = (encoded >> 8) & 0xFF;
+					hdr[4] = encoded & 0xFF;
+					hdrlen = 5;
+				}
+				g_byte_array_prepend(batch, hdr, hdrlen);
+			}
+		}
+
+		if(!g_atomic_int_get(&stopping) && (batch == NULL || encoded > 0)) {
 			amqp_basic_properties_t props;
 			props._flags = 0;
 			props._flags |= AMQP_BASIC_CONTENT_TYPE_FLAG;
-			props.content_type = amqp_cstring_bytes("application/json");
-			amqp_bytes_t message = amqp_cstring_bytes(event_text);
+			amqp_bytes_t message;
+			if(batch != NULL) {
+				props.content_type = amqp_cstring_bytes(encoding == JANUS_EVENTHANDLER_ENCODING_MSGPACK ?
+					"application/msgpack" : "application/json");
+				message.len = batch->len;
+				message.bytes = batch->data;
+			} else {
+				/* Since this a simple plugin, it does the same for all events: so just convert to string... */
+				event_text = json_dumps(output, json_format);
+				props.content_type = amqp_cstring_bytes("application/json");
+				message = amqp_cstring_bytes(event_text);
+			}
 			int status = amqp_basic_publish(rmq_conn, rmq_channel, rmq_exchange, rmq_route_key, 0, 0, &props, message);
 			if(status != AMQP_STATUS_OK) {
 				JANUS_LOG(LOG_ERR, "RabbitMQEventHandler: Error publishing... %d, %s\n", status, amqp_error_string2(status));
@@ -817,6 +966,10 @@ static void *janus_rabbitmqevh_handler(void *data) {
 			free(event_text);
 			event_text = NULL;
 		}
+		if(batch != NULL) {
+			g_byte_array_free(batch, TRUE);
+			batch = NULL;
+		}
 
 		/* Done, let's unref the event */
 		json_decref(output);
@@ -42,6 +42,7 @@ const char *janus_sampleevh_get_name(void);
 const char *janus_sampleevh_get_author(void);
 const char *janus_sampleevh_get_package(void);
 void janus_sampleevh_incoming_event(json_t *event);
+void janus_sampleevh_incoming_encoded_event(json_t *event, GBytes *payload);
 json_t *janus_sampleevh_handle_request(json_t *request);
 
 /* Event handler setup */
@@ -59,6 +60,7 @@ static janus_eventhandler janus_sampleevh =
 		.get_package = janus_sampleevh_get_package,
 		
 		.incoming_event = janus_sampleevh_incoming_event,
+		.incoming_encoded_event = janus_sampleevh_incoming_encoded_event,
 		.handle_request = janus_sampleevh_handle_request,
 
 		.events_mask = JANUS_EVENT_TYPE_NONE
@@ -77,14 +79,150 @@ static GThread *handler_thread;
 static void *janus_sampleevh_handler(void *data);
 static janus_mutex evh_mutex;
 
-/* Queue of events to handle */
-static GAsyncQueue *events = NULL;
+/* Queue of events to handle: it can be bounded, in which case new events
+ * are dropped when it's full, and stats can be coalesced, so that only the
+ * most recent stats for the same handle and medium are waiting to be sent */
+static GQueue *events = NULL;
+static GHashTable *pending_stats = NULL;	/* "handle_id/media" -> link in the queue */
+static janus_mutex events_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_condition events_cond;
 static gboolean group_events = TRUE;
+static int max_events = 100;	/* Events per POST, when grouping */
+static int max_delay = 0;		/* How long to wait (ms) for a batch to fill up, if at all */
+static guint queue_size = 0;	/* 0 means unbounded */
+typedef enum janus_sampleevh_overflow {
+	JANUS_SAMPLEEVH_OVERFLOW_DROP = 0,
+	JANUS_SAMPLEEVH_OVERFLOW_COALESCE
+} janus_sampleevh_overflow;
+static janus_sampleevh_overflow overflow = JANUS_SAMPLEEVH_OVERFLOW_DROP;
+static guint64 events_dropped = 0, events_coalesced = 0, events_sent = 0, posts_sent = 0;
+static guint queue_peak = 0;
 static json_t exit_event;
-static void janus_sampleevh_event_free(json_t *event) {
-	if(!event || event == &exit_event)
+/* Events in the queue may come with their serialized version, if we asked the core for one */
+typedef struct janus_sampleevh_item {
+	json_t *event;
+	GBytes *payload;
+} janus_sampleevh_item;
+static void janus_sampleevh_item_free(janus_sampleevh_item *item) {
+	if(!item)
 		return;
-	json_decref(event);
+	if(item->event && item->event != &exit_event)
+		json_decref(item->event);
+	if(item->payload)
+		g_bytes_unref(item->payload);
+	g_free(item);
+}
+static int janus_sampleevh_encoding_from_string(const char *name) {
+	if(name == NULL || !strcasecmp(name, "none"))
+		return JANUS_EVENTHANDLER_ENCODING_NONE;
+	if(!strcasecmp(name, "json"))
+		return JANUS_EVENTHANDLER_ENCODING_JSON;
+	if(!strcasecmp(name, "msgpack"))
+		return JANUS_EVENTHANDLER_ENCODING_MSGPACK;
+	return -1;
+}
+static int janus_sampleevh_overflow_from_string(const char *name) {
+	if(name == NULL || !strcasecmp(name, "drop"))
+		return JANUS_SAMPLEEVH_OVERFLOW_DROP;
+	if(!strcasecmp(name, "coalesce"))
+		return JANUS_SAMPLEEVH_OVERFLOW_COALESCE;
+	return -1;
+}
+static const char *janus_sampleevh_overflow_string(janus_sampleevh_overflow policy) {
+	return policy == JANUS_SAMPLEEVH_OVERFLOW_COALESCE ? "coalesce" : "drop";
+}
+/* Stats events are media events with a "base" property: they're the ones we coalesce */
+static char *janus_sampleevh_stats_key(json_t *event) {
+	if(json_integer_value(json_object_get(event, "type")) != JANUS_EVENT_TYPE_MEDIA)
+		return NULL;
+	json_t *body = json_object_get(event, "event");
+	if(body == NULL || json_object_get(body, "base") == NULL)
+		return NULL;
+	const char *media = json_string_value(json_object_get(body, "media"));
+	if(media == NULL)
+		return NULL;
+	return g_strdup_printf("%"SCNu64"/%s", (guint64)json_integer_value(json_object_get(event, "handle_id")), media);
+}
+static void janus_sampleevh_queue_push(json_t *event, GBytes *payload) {
+	janus_sampleevh_item *item = g_malloc(sizeof(janus_sampleevh_item));
+	item->event = event;
+	item->payload = payload;
+	janus_mutex_lock(&events_mutex);
+	if(event != &exit_event) {
+		char *key = overflow == JANUS_SAMPLEEVH_OVERFLOW_COALESCE ? janus_sampleevh_stats_key(event) : NULL;
+		if(key != NULL) {
+			GList *link = g_hash_table_lookup(pending_stats, key);
+			if(link != NULL) {
+				/* There are older stats for this medium still waiting, replace them */
+				janus_sampleevh_item_free((janus_sampleevh_item *)link->data);
+				link->data = item;
+				events_coalesced++;
+				janus_mutex_unlock(&events_mutex);
+				g_free(key);
+				return;
+			}
+		}
+		if(queue_size > 0 && g_queue_get_length(events) >= queue_size) {
+			/* The backend is not keeping up, drop the event */
+			events_dropped++;
+			if(events_dropped == 1 || events_dropped % 1000 == 0)
+				JANUS_LOG(LOG_WARN, "Events queue full (%u), dropped %"SCNu64" events so far\n", queue_size, events_dropped);
+			janus_mutex_unlock(&events_mutex);
+			g_free(key);
+			janus_sampleevh_item_free(item);
+			return;
+		}
+		g_queue_push_tail(events, item);
+		if(key != NULL)
+			g_hash_table_insert(pending_stats, key, g_queue_peek_tail_link(events));
+	} else {
+		g_queue_push_tail(events, item);
+	}
+	if(g_queue_get_length(events) > queue_peak)
+		queue_peak = g_queue_get_length(events);
+	janus_condition_signal(&events_cond);
+	janus_mutex_unlock(&events_mutex);
+}
+/* Get the next event, and its payload if any: waits until the provided monotonic time (or forever, if 0) */
+static json_t *janus_sampleevh_queue_pop(gint64 until, GBytes **payload) {
+	janus_mutex_lock(&events_mutex);
+	while(g_queue_is_empty(events)) {
+		if(until == 0) {
+			janus_condition_wait(&events_cond, &events_mutex);
+			continue;
+		}
+		gint64 now = janus_get_monotonic_time();
+		if(now >= until)
+			break;
+		gint64 end = g_get_real_time() + (until - now);
+		struct timespec ts;
+		ts.tv_sec = end / G_USEC_PER_SEC;
+		ts.tv_nsec = (end % G_USEC_PER_SEC) * 1000;
+		janus_condition_timedwait(&events_cond, &events_mutex, &ts);
+	}
+	json_t *event = NULL;
+	*payload = NULL;
+	if(!g_queue_is_empty(events)) {
+		janus_sampleevh_item *item = g_queue_peek_head(events);
+		if(item->event == &exit_event && until != 0) {
+			/* Leave the exit marker there, for the next blocking pop */
+			janus_mutex_unlock(&events_mutex);
+			return NULL;
+		}
+		g_queue_pop_head(events);
+		event = item->event;
+		*payload = item->payload;
+		g_free(item);
+		if(event != &exit_event) {
+			char *key = janus_sampleevh_stats_key(event);
+			if(key != NULL) {
+				g_hash_table_remove(pending_stats, key);
+				g_free(key);
+			}
+		}
+	}
+	janus_mutex_unlock(&events_mutex);
+	return event;
 }
 
 /* Retransmission management */
@@ -106,6 +244,10 @@ static struct janus_json_parameter request_parameters[] = {
 static struct janus_json_parameter tweak_parameters[] = {
 	{"events", JSON_STRING, 0},
 	{"grouping", JANUS_JSON_BOOL, 0},
+	{"max_events", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"max_delay", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"queue_size", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"overflow", JSON_STRING, 0},
 	{"backend", JSON_STRING, 0},
 	{"backend_user", JSON_STRING, 0},
 	{"backend_pwd", JSON_STRING, 0},
@@ -241,6 +383,55 @@ int janus_sampleevh_init(const char *config_path) {
 				item = janus_config_get_item_drilldown(config, "general", "grouping");
 				if(item && item->value)
 					group_events = janus_is_true(item->value);
+				/* Should we get events already serialized by the core? */
+				item = janus_config_get_item_drilldown(config, "general", "encoding");
+				if(item && item->value) {
+					int encoding = janus_sampleevh_encoding_from_string(item->value);
+					if(encoding < 0) {
+						JANUS_LOG(LOG_WARN, "Invalid value for 'encoding' (%s), sending indented JSON\n", item->value);
+					} else {
+						janus_sampleevh.events_encoding = encoding;
+					}
+				}
+				/* How should events be batched? */
+				item = janus_config_get_item_drilldown(config, "general", "max_events");
+				if(item && item->value) {
+					int me = atoi(item->value);
+					if(me <= 0) {
+						JANUS_LOG(LOG_WARN, "Invalid negative or null value for 'max_events', using default (%d)\n", max_events);
+					} else {
+						max_events = me;
+					}
+				}
+				item = janus_config_get_item_drilldown(config, "general", "max_delay");
+				if(item && item->value) {
+					int md = atoi(item->value);
+					if(md < 0) {
+						JANUS_LOG(LOG_WARN, "Invalid negative value for 'max_delay', using default (%d)\n", max_delay);
+					} else {
+						max_delay = md;
+					}
+				}
+				/* How big can the queue get, and what should we do when it's full? */
+				item = janus_config_get_item_drilldown(config, "general", "queue_size");
+				if(item && item->value) {
+					int qs = atoi(item->value);
+					if(qs < 0) {
+						JANUS_LOG(LOG_WARN, "Invalid negative value for 'queue_size', using an unbounded queue\n");
+					} else {
+						queue_size = qs;
+					}
+				}
+				item = janus_config_get_item_drilldown(config, "general", "overflow");
+				if(item && item->value) {
+					int policy = janus_sampleevh_overflow_from_string(item->value);
+					if(policy < 0) {
+						JANUS_LOG(LOG_WARN, "Invalid value for 'overflow' (%s), using default (%s)\n",
+							item->value, janus_sampleevh_overflow_string(overflow));
+					} else {
+						overflow = policy;
+					}
+				}
 				/* Done */
 				enabled = TRUE;
 			}
@@ -259,7 +450,9 @@ int janus_sampleevh_init(const char *config_path) {
 	curl_global_init(CURL_GLOBAL_ALL);
 
 	/* Initialize the events queue */
-	events = g_async_queue_new_full((GDestroyNotify) janus_sampleevh_event_free);
+	events = g_queue_new();
+	pending_stats = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
+	janus_condition_init(&events_cond);
 	janus_mutex_init(&evh_mutex);
 
 	g_atomic_int_set(&initialized, 1);
@@ -281,14 +474,19 @@ void janus_sampleevh_destroy(void) {
 		return;
 	g_atomic_int_set(&stopping, 1);
 
-	g_async_queue_push(events, &exit_event);
+	janus_sampleevh_queue_push(&exit_event, NULL);
 	if(handler_thread != NULL) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
 
-	g_async_queue_unref(events);
+	janus_mutex_lock(&events_mutex);
+	g_queue_free_full(events, (GDestroyNotify) janus_sampleevh_item_free);
 	events = NULL;
+	g_hash_table_destroy(pending_stats);
+	pending_stats = NULL;
+	janus_mutex_unlock(&events_mutex);
+	janus_condition_destroy(&events_cond);
 
 	g_free(backend);
 
@@ -341,10 +539,19 @@ void janus_sampleevh_incoming_event(json_t *event) {
 	 * when the event actually happened on this machine, so that, if relevant, we can compute
 	 * any delay in the actual event processing ourselves. */
 	json_incref(event);
-	g_async_queue_push(events, event);
+	janus_sampleevh_queue_push(event, NULL);
 
 }
 
+void janus_sampleevh_incoming_encoded_event(json_t *event, GBytes *payload) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return;
+	/* Same as above, but the core already serialized the event for us: we keep
+	 * the object too, as we need it to know what the event is about */
+	json_incref(event);
+	janus_sampleevh_queue_push(event, g_bytes_ref(payload));
+}
+
 json_t *janus_sampleevh_handle_request(json_t *request) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
 		return NULL;
@@ -369,13 +576,34 @@ json_t *janus_sampleevh_handle_request(json_t *request) {
 		/* Parameters we can change */
 		const char *req_events = NULL, *req_backend = NULL,
 			*req_backend_user = NULL, *req_backend_pwd = NULL;
-		int req_grouping = -1, req_maxretr = -1, req_backoff = -1;
+		int req_grouping = -1, req_maxretr = -1, req_backoff = -1,
+			req_maxevents = -1, req_maxdelay = -1, req_queuesize = -1, req_overflow = -1;
 		/* Events */
 		if(json_object_get(request, "events"))
 			req_events = json_string_value(json_object_get(request, "events"));
 		/* Grouping */
 		if(json_object_get(request, "grouping"))
 			req_grouping = json_is_true(json_object_get(request, "grouping"));
+		/* Batching and queueing */
+		if(json_object_get(request, "max_events"))
+			req_maxevents = json_integer_value(json_object_get(request, "max_events"));
+		if(req_maxevents == 0) {
+			error_code = JANUS_SAMPLEEVH_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, sizeof(error_cause), "Invalid value for 'max_events' (must be at least 1)");
+			goto plugin_response;
+		}
+		if(json_object_get(request, "max_delay"))
+			req_maxdelay = json_integer_value(json_object_get(request, "max_delay"));
+		if(json_object_get(request, "queue_size"))
+			req_queuesize = json_integer_value(json_object_get(request, "queue_size"));
+		if(json_object_get(request, "overflow")) {
+			req_overflow = janus_sampleevh_overflow_from_string(json_string_value(json_object_get(request, "overflow")));
+			if(req_overflow < 0) {
+				error_code = JANUS_SAMPLEEVH_ERROR_INVALID_ELEMENT;
+				g_snprintf(error_cause, sizeof(error_cause), "Invalid value for 'overflow' (should be drop or coalesce)");
+				goto plugin_response;
+			}
+		}
 		/* Backend stuff */
 		if(json_object_get(request, "backend"))
 			req_backend = json_string_value(json_object_get(request, "backend"));
@@ -399,6 +627,18 @@ json_t *janus_sampleevh_handle_request(json_t *request) {
 			janus_sampleevh_edit_events_mask(req_events);
 		if(req_grouping > -1)
 			group_events = req_grouping ? TRUE : FALSE;
+		if(req_maxevents > -1)
+			max_events = req_maxevents;
+		if(req_maxdelay > -1)
+			max_delay = req_maxdelay;
+		if(req_queuesize > -1 || req_overflow > -1) {
+			janus_mutex_lock(&events_mutex);
+			if(req_queuesize > -1)
+				queue_size = req_queuesize;
+			if(req_overflow > -1)
+				overflow = req_overflow;
+			janus_mutex_unlock(&events_mutex);
+		}
 		if(req_backend || req_backend_user || req_backend_pwd) {
 			janus_mutex_lock(&evh_mutex);
 			if(req_backend) {
@@ -419,6 +659,24 @@ json_t *janus_sampleevh_handle_request(json_t *request) {
 			max_retransmissions = req_maxretr;
 		if(req_backoff > -1)
 			retransmissions_backoff = req_backoff;
+	} else if(!strcasecmp(request_text, "stats")) {
+		/* Return some info on the queue of events */
+		json_t *response = json_object();
+		json_object_set_new(response, "result", json_integer(200));
+		janus_mutex_lock(&events_mutex);
+		json_object_set_new(response, "queue_depth", json_integer(g_queue_get_length(events)));
+		json_object_set_new(response, "queue_peak", json_integer(queue_peak));
+		json_object_set_new(response, "queue_size", json_integer(queue_size));
+		json_object_set_new(response, "overflow", json_string(janus_sampleevh_overflow_string(overflow)));
+		json_object_set_new(response, "dropped", json_integer(events_dropped));
+		json_object_set_new(response, "coalesced", json_integer(events_coalesced));
+		json_object_set_new(response, "sent", json_integer(events_sent));
+		json_object_set_new(response, "posts", json_integer(posts_sent));
+		janus_mutex_unlock(&events_mutex);
+		json_object_set_new(response, "grouping", group_events ? json_true() : json_false());
+		json_object_set_new(response, "max_events", json_integer(max_events));
+		json_object_set_new(response, "max_delay", json_integer(max_delay));
+		return response;
 	} else {
 		JANUS_LOG(LOG_VERB, "Unknown request '%s'\n", request_text);
 		error_code = JANUS_SAMPLEEVH_ERROR_INVALID_REQUEST;
@@ -444,18 +702,31 @@ plugin_response:
 static void *janus_sampleevh_handler(void *data) {
 	JANUS_LOG(LOG_VERB, "Joining SampleEventHandler handler thread\n");
 	json_t *event = NULL, *output = NULL;
+	GBytes *payload = NULL;
+	GByteArray *batch = NULL;
 	char *event_text = NULL;
-	int count = 0, max = group_events ? 100 : 1;
+	size_t event_len = 0;
+	int encoding = JANUS_EVENTHANDLER_ENCODING_NONE;
+	int count = 0, encoded = 0, max = 1, sending = 0;
 	int retransmit = 0;
+	gint64 deadline = 0;
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
 		if(!retransmit) {
-			event = g_async_queue_pop(events);
+			event = janus_sampleevh_queue_pop(0, &payload);
 			if(event == NULL)
 				continue;
 			if(event == &exit_event)
 				break;
 			count = 0;
+			encoded = 0;
 			output = NULL;
+			/* If events come serialized already, we just concatenate them */
+			encoding = janus_sampleevh.events_encoding;
+			if(encoding != JANUS_EVENTHANDLER_ENCODING_NONE)
+				batch = g_byte_array_new();
+			max = group_events ? max_events : 1;
+			/* When grouping, we may wait a bit for the batch to fill up */
+			deadline = janus_get_monotonic_time() + (gint64)max_delay*1000;
 
 			while(TRUE) {
 				/* Handle event: just for fun, let's see how long it took for us to take care of this */
@@ -665,6 +936,32 @@ static void *janus_sampleevh_handler(void *data) {
 						JANUS_LOG(LOG_WARN, "Unknown type of event '%d'\n", type);
 						break;
 				}
+				if(batch != NULL) {
+					/* Append the serialized event to the batch, separating them for JSON: if
+					 * the core couldn't serialize this event, we do it ourselves for JSON, while
+					 * for MessagePack we have to leave it out, or the batch would be broken */
+					gsize size = 0;
+					gconstpointer data = payload ? g_bytes_get_data(payload, &size) : NULL;
+					char *text = NULL;
+					if(data == NULL && encoding == JANUS_EVENTHANDLER_ENCODING_JSON) {
+						text = json_dumps(event, JSON_COMPACT | JSON_PRESERVE_ORDER);
+						data = text;
+						size = text ? strlen(text) : 0;
+					}
+					if(data == NULL) {
+						JANUS_LOG(LOG_WARN, "Event not serialized by the core, skipping it\n");
+					} else {
+						if(group_events && encoding == JANUS_EVENTHANDLER_ENCODING_JSON)
+							g_byte_array_append(batch, (const guint8 *)(encoded ? "," : "["), 1);
+						g_byte_array_append(batch, data, size);
+						encoded++;
+					}
+					free(text);
+				}
+				if(payload != NULL) {
+					g_bytes_unref(payload);
+					payload = NULL;
+				}
 				if(!group_events) {
 					/* We're done here, we just need a single event */
 					output = event;
@@ -678,13 +975,53 @@ static void *janus_sampleevh_handler(void *data) {
 				count++;
 				if(count == max)
 					break;
-				event = g_async_queue_try_pop(events);
-				if(event == NULL || event == &exit_event)
+				event = janus_sampleevh_queue_pop(max_delay > 0 ? deadline : janus_get_monotonic_time(), &payload);
+				if(event == NULL)
 					break;
 			}
+			sending = group_events ? count : 1;
 
-			/* Since this a simple plugin, it does the same for all events: so just convert to string... */
-			event_text = json_dumps(output, JSON_INDENT(3) | JSON_PRESERVE_ORDER);
+			if(batch != NULL && encoded == 0) {
+				/* None of the events could be serialized, there's nothing to send */
+				g_byte_array_free(batch, TRUE);
+				batch = NULL;
+				json_decref(output);
+				output = NULL;
+				continue;
+			}
+			if(batch != NULL) {
+				sending = encoded;
+				/* The core serialized the events already, we just need to wrap them in an array */
+				if(group_events && encoding == JANUS_EVENTHANDLER_ENCODING_JSON) {
+					g_byte_array_append(batch, (const guint8 *)"]", 1);
+				} else if(group_events && encoding == JANUS_EVENTHANDLER_ENCODING_MSGPACK) {
+					guint8 hdr[5];
+					int hdrlen = 1;
+					if(encoded < 16) {
+						hdr[0] = 0x90 | encoded;
+					} else if(encoded <= 0xFFFF) {
+						hdr[0] = 0xdc;
+						hdr[1] = encoded >> 8;
+						hdr[2] = encoded & 0xFF;
+						hdrlen = 3;
+					} else {
+						hdr[0] = 0xdd;
+						hdr[1] = encoded >> 24;
+						hdr[2] = (encoded >> 16) & 0xFF;
+						hdr[3] = (encoded >> 8) & 0xFF;
+						hdr[4] = encoded & 0xFF;
+						hdrlen = 5;
+					}
+					g_byte_array_prepend(batch, hdr, hdrlen);
+				}
+				event_len = batch->len;
+				event_text = (char *)g_byte_array_free(batch, FALSE);
+				batch = NULL;
+			} else {
+				/* Since this a simple plugin, it does the same for all events: so just convert to string... */
+				event_text = json_dumps(output, JSON_INDENT(3) | JSON_PRESERVE_ORDER);
+				event_len = event_text ? strlen(event_text) : 0;
+			}
 		}
 		/* Whether we just prepared the event or this is a retransmission, send it via HTTP POST */
 		CURLcode res;
@@ -703,10 +1040,15 @@ static void *janus_sampleevh_handler(void *data) {
 		}
 		janus_mutex_unlock(&evh_mutex);
 		headers = curl_slist_append(headers, "Accept: application/json");
-		headers = curl_slist_append(headers, "Content-Type: application/json");
-		headers = curl_slist_append(headers, "charsets: utf-8");
+		if(encoding == JANUS_EVENTHANDLER_ENCODING_MSGPACK) {
+			headers = curl_slist_append(headers, "Content-Type: application/msgpack");
+		} else {
+			headers = curl_slist_append(headers, "Content-Type: application/json");
+			headers = curl_slist_append(headers, "charsets: utf-8");
+		}
 		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, event_text);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)event_len);
 		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_sampleehv_write_data);
 		/* Don't wait forever (let's say, 10 seconds) */
 		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
@@ -731,6 +1073,10 @@ static void *janus_sampleevh_handler(void *data) {
 		} else {
 			JANUS_LOG(LOG_DBG, "Event sent!\n");
 			retransmit = 0;
+			janus_mutex_lock(&events_mutex);
+			events_sent += sending;
+			posts_sent++;
+			janus_mutex_unlock(&events_mutex);
 		}
 done:
 		/* Cleanup */
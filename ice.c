@@ -20,7 +20,10 @@
 #include <sys/time.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
 #include <stun/usages/bind.h>
+#include <stun/usages/ice.h>
 #include <nice/debug.h>
 
 #include "janus.h"
@@ -34,6 +37,8 @@
 #include "apierror.h"
 #include "ip-utils.h"
 #include "events.h"
+#include "metrics.h"
+#include "affinity.h"
 
 // https://janus.conf.meetecho.com/docs/structjanus__ice__handle.html
 
@@ -77,6 +82,30 @@ char *janus_ice_get_turn_rest_api(void) {
 
 /* ICE-Lite status */
 static gboolean janus_ice_lite_enabled;
+
+/* Aggregated metrics: audio, video and data */
+static janus_metric *metric_handles = NULL;
+static janus_metric *metric_packets_in[3], *metric_bytes_in[3], *metric_packets_out[2], *metric_bytes_out[2];
+static janus_metric *metric_nacks_in[2], *metric_nacks_out[2], *metric_retransmissions = NULL;
+static janus_metric *metric_srtp_errors_in = NULL, *metric_srtp_errors_out = NULL;
+static void janus_ice_metrics_init(void) {
+	const char *media[] = { "media=\"audio\"", "media=\"video\"", "media=\"data\"" };
+	metric_handles = janus_metrics_add("janus_handles", NULL, "Handles currently active", JANUS_METRIC_GAUGE);
+	int i = 0;
+	for(i=0; i<3; i++) {
+		metric_packets_in[i] = janus_metrics_add("janus_packets_received_total", media[i], "Packets received from peers", JANUS_METRIC_COUNTER);
+		metric_bytes_in[i] = janus_metrics_add("janus_bytes_received_total", media[i], "Bytes received from peers", JANUS_METRIC_COUNTER);
+	}
+	for(i=0; i<2; i++) {
+		metric_packets_out[i] = janus_metrics_add("janus_packets_sent_total", media[i], "RTP packets sent to peers", JANUS_METRIC_COUNTER);
+		metric_bytes_out[i] = janus_metrics_add("janus_bytes_sent_total", media[i], "RTP bytes sent to peers", JANUS_METRIC_COUNTER);
+		metric_nacks_in[i] = janus_metrics_add("janus_nacks_received_total", media[i], "NACKs received from peers", JANUS_METRIC_COUNTER);
+		metric_nacks_out[i] = janus_metrics_add("janus_nacks_sent_total", media[i], "NACKs sent to peers", JANUS_METRIC_COUNTER);
+	}
+	metric_retransmissions = janus_metrics_add("janus_retransmissions_total", NULL, "Packets retransmitted in response to NACKs", JANUS_METRIC_COUNTER);
+	metric_srtp_errors_in = janus_metrics_add("janus_srtp_errors_total", "direction=\"in\"", "SRTP/SRTCP errors", JANUS_METRIC_COUNTER);
+	metric_srtp_errors_out = janus_metrics_add("janus_srtp_errors_total", "direction=\"out\"", "SRTP/SRTCP errors", JANUS_METRIC_COUNTER);
+}
 // lite模式时服务端总是controlled，而在full模式时，则根据收到offer或者是发起offer来判断，先发起offer的是controlling。
 gboolean janus_ice_is_ice_lite_enabled(void) {
 	return janus_ice_lite_enabled;
@@ -130,12 +159,265 @@ void janus_ice_debugging_disable(void) {
 }
 
 
+/* Static event loops: instead of spawning a new GMainLoop (and thread)
+ * for each handle, handles can be attached to a pool of shared loops */
+struct janus_ice_static_event_loop {
+	/* Loop index */
+	int id;
+	/* GLib context and loop shared by all the handles attached to this loop */
+	GMainContext *mainctx;
+	GMainLoop *mainloop;
+	/* Thread running the loop */
+	GThread *thread;
+	/* NUMA node the thread is pinned to, if any */
+	int node;
+	/* Handles currently attached to this loop */
+	volatile gint handles;
+	/* How many handles have been attached to this loop so far */
+	volatile gint total;
+};
+static int static_event_loops = 0;
+static janus_ice_static_event_loop *event_loops = NULL;
+static guint next_event_loop = 0;
+static janus_mutex event_loops_mutex;
+
+static void *janus_ice_static_event_loop_thread(void *data) {
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)data;
+	JANUS_LOG(LOG_VERB, "[loop#%d] Event loop thread started\n", loop->id);
+	janus_affinity_pin_thread(loop->node);
+	g_main_loop_run(loop->mainloop);
+	JANUS_LOG(LOG_VERB, "[loop#%d] Event loop thread ended!\n", loop->id);
+	return NULL;
+}
+
+void janus_ice_set_static_event_loops(int loops) {
+	if(loops <= 0)
+		return;
+	if(event_loops != NULL) {
+		JANUS_LOG(LOG_WARN, "Static event loops already configured\n");
+		return;
+	}
+	janus_mutex_init(&event_loops_mutex);
+	event_loops = g_malloc0(loops * sizeof(janus_ice_static_event_loop));
+	/* When NUMA aware, loops are spread evenly across the nodes */
+	int i = 0, nodes = janus_affinity_get_nodes();
+	for(i=0; i<loops; i++) {
+		janus_ice_static_event_loop *loop = &event_loops[i];
+		loop->id = i;
+		loop->node = nodes > 1 ? (i % nodes) : -1;
+		loop->mainctx = g_main_context_new();
+		loop->mainloop = g_main_loop_new(loop->mainctx, FALSE);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "hloop %d", i);
+		loop->thread = g_thread_try_new(tname, &janus_ice_static_event_loop_thread, loop, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch static event loop thread #%d...\n",
+				error->code, error->message ? error->message : "??", i);
+			exit(1);
+		}
+		static_event_loops++;
+	}
+	JANUS_LOG(LOG_INFO, "Spawned %d static event loops (handles won't have a dedicated loop)\n", static_event_loops);
+}
+
+int janus_ice_get_static_event_loops(void) {
+	return static_event_loops;
+}
+
+void janus_ice_stop_static_event_loops(void) {
+	if(event_loops == NULL)
+		return;
+	int i = 0;
+	for(i=0; i<static_event_loops; i++) {
+		janus_ice_static_event_loop *loop = &event_loops[i];
+		if(loop->mainloop != NULL && g_main_loop_is_running(loop->mainloop)) {
+			g_main_loop_quit(loop->mainloop);
+			g_main_context_wakeup(loop->mainctx);
+		}
+		if(loop->thread != NULL)
+			g_thread_join(loop->thread);
+		loop->thread = NULL;
+		g_main_loop_unref(loop->mainloop);
+		g_main_context_unref(loop->mainctx);
+	}
+	g_free(event_loops);
+	event_loops = NULL;
+	static_event_loops = 0;
+}
+
+json_t *janus_ice_static_event_loops_info(void) {
+	if(event_loops == NULL)
+		return NULL;
+	json_t *list = json_array();
+	int i = 0;
+	for(i=0; i<static_event_loops; i++) {
+		janus_ice_static_event_loop *loop = &event_loops[i];
+		json_t *info = json_object();
+		json_object_set_new(info, "id", json_integer(loop->id));
+		if(loop->node >= 0)
+			json_object_set_new(info, "node", json_integer(loop->node));
+		json_object_set_new(info, "handles", json_integer(g_atomic_int_get(&loop->handles)));
+		json_object_set_new(info, "handles-total", json_integer(g_atomic_int_get(&loop->total)));
+		json_array_append_new(list, info);
+	}
+	return list;
+}
+
+int janus_ice_handle_get_static_event_loop(janus_ice_handle *handle) {
+	if(handle == NULL || handle->static_event_loop == NULL)
+		return -1;
+	return handle->static_event_loop->id;
+}
+
+/* Helper to pick the least loaded static loop (round robin in case of ties),
+ * among those on the NUMA node of the placement group of the handle if any */
+static janus_ice_static_event_loop *janus_ice_static_event_loop_pick(janus_ice_handle *handle) {
+	if(event_loops == NULL)
+		return NULL;
+	int node = janus_affinity_group_node(handle->placement_group);
+	if(node >= static_event_loops)
+		node = -1;
+	janus_mutex_lock(&event_loops_mutex);
+	janus_ice_static_event_loop *loop = NULL;
+	int i = 0, min = -1;
+	for(i=0; i<static_event_loops; i++) {
+		janus_ice_static_event_loop *l = &event_loops[(next_event_loop + i) % static_event_loops];
+		if(node >= 0 && l->node != node)
+			continue;
+		int count = g_atomic_int_get(&l->handles);
+		if(min < 0 || count < min) {
+			min = count;
+			loop = l;
+		}
+	}
+	next_event_loop = (loop->id + 1) % static_event_loops;
+	g_atomic_int_inc(&loop->handles);
+	g_atomic_int_inc(&loop->total);
+	janus_mutex_unlock(&event_loops_mutex);
+	return loop;
+}
+
+/* Outgoing traffic handled on the ICE loop (see janus_ice_set_loop_send_enabled) */
+static void janus_ice_outgoing_traffic_start(janus_ice_handle *handle);
+static void janus_ice_outgoing_traffic_stop(janus_ice_handle *handle);
+
+/* Callback invoked on the shared loop when a handle is done with it: this
+ * is what janus_ice_thread does for dedicated loops after the loop quits */
+static gboolean janus_ice_static_event_loop_release(gpointer user_data) {
+	janus_ice_handle *handle = (janus_ice_handle *)user_data;
+	janus_ice_static_event_loop *loop = handle->static_event_loop;
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Detaching from static event loop #%d\n", handle->handle_id, loop ? loop->id : -1);
+	if(handle->cdone == 0)
+		handle->cdone = -1;
+	/* The loop is shared, so make sure our sources don't fire anymore */
+	janus_ice_outgoing_traffic_stop(handle);
+	if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)) {
+		janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_CLEANING);
+		janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ICE_RESTART);
+		janus_ice_webrtc_free(handle);
+	}
+	/* Even if the WebRTC stuff was freed already, make sure we don't keep
+	 * references to the shared loop: both the handles watchdog and
+	 * janus_ice_handle_loop_quit would otherwise quit it as a dedicated one */
+	janus_mutex_lock(&handle->mutex);
+	if(handle->iceloop != NULL) {
+		g_main_loop_unref(handle->iceloop);
+		handle->iceloop = NULL;
+	}
+	if(handle->icectx != NULL) {
+		g_main_context_unref(handle->icectx);
+		handle->icectx = NULL;
+	}
+	janus_mutex_unlock(&handle->mutex);
+	if(loop != NULL)
+		g_atomic_int_dec_and_test(&loop->handles);
+	/* This tells the handles watchdog it's now safe to free the handle */
+	handle->static_event_loop = NULL;
+	return G_SOURCE_REMOVE;
+}
+
+/* Helper to get rid of the loop a handle is using: dedicated loops are
+ * quit (which ends janus_ice_thread), shared loops are just detached */
+static void janus_ice_handle_loop_quit(janus_ice_handle *handle) {
+	if(handle == NULL || handle->iceloop == NULL)
+		return;
+	if(handle->static_event_loop == NULL) {
+		if(g_main_loop_is_running(handle->iceloop)) {
+			g_main_loop_quit(handle->iceloop);
+			if(handle->icectx != NULL)
+				g_main_context_wakeup(handle->icectx);
+		}
+		return;
+	}
+	if(!g_atomic_int_compare_and_exchange(&handle->static_event_loop_released, 0, 1))
+		return;
+	GSource *idle = g_idle_source_new();
+	g_source_set_callback(idle, janus_ice_static_event_loop_release, handle, NULL);
+	g_source_attach(idle, handle->icectx);
+	g_source_unref(idle);
+}
+
+
 /* NAT 1:1 stuff */
 static gboolean nat_1_1_enabled = FALSE;
 void janus_ice_enable_nat_1_1(void) {
 	nat_1_1_enabled = TRUE;
 }
 
+/* Local addresses to gather candidates for: they hardly ever change, so
+ * rather than enumerating interfaces for each new agent we cache them */
+#define JANUS_ICE_LOCAL_ADDRESSES_TTL	(10*G_USEC_PER_SEC)
+static GArray *local_addresses = NULL;
+static gint64 local_addresses_updated = 0;
+static janus_mutex local_addresses_mutex = JANUS_MUTEX_INITIALIZER;
+
+/* Single port ICE muxing: in ICE Lite mode, rather than having libnice bind
+ * ports of its own for each handle, all PeerConnections can share a few UDP
+ * sockets bound to the same port. Connectivity checks are answered by us, and
+ * matched to a handle by the local ufrag they carry; once a peer nominated its
+ * address, anything else coming from there is passed to the loop of the handle
+ * as if libnice had received it. Agents are still created (they provide the
+ * credentials and the state the rest of the code relies on), but never gather */
+#define JANUS_ICE_MUX_MAX_SOCKETS	16
+#define JANUS_ICE_MUX_BUFSIZE	2048
+static uint16_t janus_ice_mux_port = 0;
+static int janus_ice_mux_sockets = 0;
+static int janus_ice_mux_fds[JANUS_ICE_MUX_MAX_SOCKETS];
+static GThread *janus_ice_mux_threads[JANUS_ICE_MUX_MAX_SOCKETS];
+static volatile gint janus_ice_mux_stopping = 0;
+/* Bindings indexed by local ufrag, and by nominated remote address: media
+ * packets only need a read lock to find their binding, while connectivity
+ * checks and (un)registrations, which may change the tables, write lock them */
+static GHashTable *janus_ice_mux_ufrags = NULL, *janus_ice_mux_addresses = NULL;
+static GRWLock janus_ice_mux_lock;
+typedef struct janus_ice_mux_binding {
+	/* Handle this binding belongs to */
+	janus_ice_handle *handle;
+	/* Local credentials of the current agent: checks must match them */
+	gchar *ufrag, *pwd;
+	/* Context of the handle loop, where we deliver incoming packets */
+	GMainContext *icectx;
+	/* Packets waiting to be delivered, and the source on the handle loop that delivers them */
+	GAsyncQueue *incoming;
+	GSource *source;
+	/* Nominated remote address (and its key in the table), and the socket we got it on */
+	struct sockaddr_in remote;
+	guint64 remote_key;
+	int fd;
+	/* Mutex protecting the address and socket, which the send path reads */
+	janus_mutex mutex;
+	/* Bumped whenever the binding is unregistered, to drop packets still in flight */
+	volatile gint generation;
+	/* Owned by the handle, by its source, and by mux threads while dispatching */
+	volatile gint ref;
+} janus_ice_mux_binding;
+static void janus_ice_mux_register(janus_ice_handle *handle);
+static void janus_ice_mux_unregister(janus_ice_handle *handle);
+static void janus_ice_mux_binding_unref(janus_ice_mux_binding *binding);
+static void janus_ice_mux_stop(void);
+static void janus_ice_mux_candidates_to_sdp(janus_ice_handle *handle, janus_sdp_mline *mline);
+
 /* Interface/IP enforce/ignore lists */
 GList *janus_ice_enforce_list = NULL, *janus_ice_ignore_list = NULL;
 janus_mutex ice_list_mutex;
@@ -209,24 +491,185 @@ int janus_ice_get_event_stats_period(void) {
 uint16_t rtp_range_min = 0;
 uint16_t rtp_range_max = 0;
 
-/* Helpers to demultiplex protocols */
-static gboolean janus_is_dtls(gchar *buf) {
-	return ((*buf >= 20) && (*buf <= 64));
+/* Helper to demultiplex protocols (http://tools.ietf.org/html/rfc5761#section-4):
+ * the first byte tells us whether this is DTLS, and for RTP and RTCP the
+ * payload type (without the marker bit) tells us which of the two it is */
+typedef enum janus_ice_demux_type {
+	JANUS_ICE_DEMUX_DTLS = 0,
+	JANUS_ICE_DEMUX_RTP,
+	JANUS_ICE_DEMUX_RTCP
+} janus_ice_demux_type;
+
+static janus_ice_demux_type janus_ice_demux(const gchar *buf, guint len) {
+	guint8 first = (guint8)buf[0];
+	if(first >= 20 && first <= 64)
+		return JANUS_ICE_DEMUX_DTLS;
+	if(len < 2)
+		return JANUS_ICE_DEMUX_RTP;
+	guint8 type = (guint8)buf[1] & 0x7F;
+	return (type >= 64 && type < 96) ? JANUS_ICE_DEMUX_RTCP : JANUS_ICE_DEMUX_RTP;
+}
+
+/* The SSRC lookup table and the additional SSRCs of a stream are read by the
+ * ICE loop and the send path without locking: writers, which are rare, are
+ * serialized by this mutex, and bump a sequence number before and after updating
+ * a table (so it's odd while they're at it), while readers copy what they need
+ * and try again if the number changed */
+static janus_mutex ssrc_tables_mutex = JANUS_MUTEX_INITIALIZER;
+
+/* SSRC lookup table of a stream: rebuilt whenever we learn new peer SSRCs */
+void janus_ice_stream_update_ssrc_map(janus_ice_stream *stream) {
+	if(stream == NULL)
+		return;
+	janus_ice_ssrc_entry map[JANUS_ICE_SSRC_MAP_SIZE];
+	int n = 0, vindex = 0;
+	/* Video first, as that's what the per-field checks used to look at first too */
+	for(vindex=0; vindex<3; vindex++) {
+		if(stream->video_ssrc_peer[vindex]) {
+			map[n].ssrc = stream->video_ssrc_peer[vindex];
+			map[n].video = 1;
+			map[n].vindex = vindex;
+			map[n].rtx = 0;
+			n++;
+		}
+		if(stream->video_ssrc_peer_rtx[vindex]) {
+			map[n].ssrc = stream->video_ssrc_peer_rtx[vindex];
+			map[n].video = 1;
+			map[n].vindex = vindex;
+			map[n].rtx = 1;
+			n++;
+		}
+	}
+	if(stream->audio_ssrc_peer) {
+		map[n].ssrc = stream->audio_ssrc_peer;
+		map[n].video = 0;
+		map[n].vindex = 0;
+		map[n].rtx = 0;
+		n++;
+	}
+	janus_mutex_lock(&ssrc_tables_mutex);
+	g_atomic_int_inc(&stream->ssrc_map_seq);
+	memcpy(stream->ssrc_map, map, n*sizeof(janus_ice_ssrc_entry));
+	g_atomic_int_set(&stream->ssrc_map_size, n);
+	g_atomic_int_inc(&stream->ssrc_map_seq);
+	janus_mutex_unlock(&ssrc_tables_mutex);
+}
+
+static gboolean janus_ice_stream_find_ssrc(janus_ice_stream *stream, guint32 ssrc, janus_ice_ssrc_entry *found) {
+	while(TRUE) {
+		gint seq = g_atomic_int_get(&stream->ssrc_map_seq);
+		if(seq & 1)
+			continue;	/* The table is being updated */
+		gboolean match = FALSE;
+		int i = 0, n = g_atomic_int_get(&stream->ssrc_map_size);
+		for(i=0; i<n; i++) {
+			if(stream->ssrc_map[i].ssrc == ssrc) {
+				*found = stream->ssrc_map[i];
+				match = TRUE;
+				break;
+			}
+		}
+		if(g_atomic_int_get(&stream->ssrc_map_seq) == seq)
+			return match;
+	}
+}
+
+/* Additional local SSRCs: set whenever a plugin SDP advertises some */
+void janus_ice_stream_set_extra_ssrcs(janus_ice_stream *stream, const janus_ice_extra_ssrc *ssrcs, int num) {
+	if(stream == NULL)
+		return;
+	if(num < 0 || ssrcs == NULL)
+		num = 0;
+	if(num > JANUS_ICE_MAX_EXTRA_SSRCS)
+		num = JANUS_ICE_MAX_EXTRA_SSRCS;
+	janus_mutex_lock(&ssrc_tables_mutex);
+	/* Most streams never get any, so we only make room for them now (and keep it until the stream goes away) */
+	if(num > 0 && stream->extra_ssrcs == NULL)
+		g_atomic_pointer_set(&stream->extra_ssrcs, g_malloc0(JANUS_ICE_MAX_EXTRA_SSRCS*sizeof(janus_ice_extra_ssrc)));
+	g_atomic_int_inc(&stream->extra_ssrcs_seq);
+	if(num > 0)
+		memcpy(stream->extra_ssrcs, ssrcs, num*sizeof(janus_ice_extra_ssrc));
+	g_atomic_int_set(&stream->extra_ssrcs_num, num);
+	g_atomic_int_inc(&stream->extra_ssrcs_seq);
+	janus_mutex_unlock(&ssrc_tables_mutex);
+}
+
+gboolean janus_ice_stream_find_extra_ssrc(janus_ice_stream *stream, guint32 ssrc, gboolean *video) {
+	if(stream == NULL || ssrc == 0)
+		return FALSE;
+	while(TRUE) {
+		gint seq = g_atomic_int_get(&stream->extra_ssrcs_seq);
+		if(seq & 1)
+			continue;	/* The list is being updated */
+		janus_ice_extra_ssrc *extra = g_atomic_pointer_get(&stream->extra_ssrcs);
+		gboolean match = FALSE, is_video = FALSE;
+		int i = 0, n = g_atomic_int_get(&stream->extra_ssrcs_num);
+		for(i=0; extra != NULL && i<n; i++) {
+			if(extra[i].ssrc == ssrc) {
+				is_video = extra[i].video;
+				match = TRUE;
+				break;
+			}
+		}
+		if(g_atomic_int_get(&stream->extra_ssrcs_seq) == seq) {
+			if(match && video != NULL)
+				*video = is_video;
+			return match;
+		}
+	}
 }
 
-static gboolean janus_is_rtp(gchar *buf) {
-	janus_rtp_header *header = (janus_rtp_header *)buf;
-	return ((header->type < 64) || (header->type >= 96));
+/* Helpers to tell the NACKs about our own SSRCs in a compound RTCP packet from
+ * those about the additional SSRCs a plugin multiplexes: packets sent with the
+ * latter have sequence numbers of their own, and so retransmit buffers of their own */
+static gboolean janus_ice_stream_is_nack(janus_ice_stream *stream, janus_rtcp_header *rtcp, int size,
+		gboolean extra, guint32 *ssrc, gboolean *video) {
+	if(rtcp->type != RTCP_RTPFB || rtcp->rc != 1 || size < 12)
+		return FALSE;
+	janus_rtcp_fb *fb = (janus_rtcp_fb *)rtcp;
+	if(ssrc != NULL)
+		*ssrc = ntohl(fb->media);
+	return janus_ice_stream_find_extra_ssrc(stream, ntohl(fb->media), video) == extra;
+}
+#define janus_ice_stream_is_own_nack(stream, rtcp, size) janus_ice_stream_is_nack(stream, rtcp, size, FALSE, NULL, NULL)
+
+static GSList *janus_ice_stream_get_nacks(janus_ice_stream *stream, char *buf, int len) {
+	GSList *nacks = NULL;
+	int offset = 0;
+	while(len-offset >= 4) {
+		janus_rtcp_header *rtcp = (janus_rtcp_header *)(buf+offset);
+		int size = (ntohs(rtcp->length)+1)*4;
+		if(rtcp->version != 2 || size > len-offset)
+			break;
+		if(janus_ice_stream_is_own_nack(stream, rtcp, size))
+			nacks = g_slist_concat(nacks, janus_rtcp_get_nacks(buf+offset, size));
+		offset += size;
+	}
+	return nacks;
 }
 
-static gboolean janus_is_rtcp(gchar *buf) {
-	janus_rtp_header *header = (janus_rtp_header *)buf;
-	return ((header->type >= 64) && (header->type < 96));
+static int janus_ice_stream_remove_nacks(janus_ice_stream *stream, char *buf, int len, gboolean extra) {
+	int offset = 0;
+	while(len-offset >= 4) {
+		janus_rtcp_header *rtcp = (janus_rtcp_header *)(buf+offset);
+		int size = (ntohs(rtcp->length)+1)*4;
+		if(rtcp->version != 2 || size > len-offset)
+			break;
+		if(janus_ice_stream_is_nack(stream, rtcp, size, extra, NULL, NULL)) {
+			/* We've handled this one, move what follows over it */
+			memmove(buf+offset, buf+offset+size, len-offset-size);
+			len -= size;
+			continue;
+		}
+		offset += size;
+	}
+	return len;
 }
 
 #define JANUS_ICE_PACKET_AUDIO	0
 #define JANUS_ICE_PACKET_VIDEO	1
 #define JANUS_ICE_PACKET_DATA	2
+#define JANUS_ICE_PACKET_BINARY	3
 /* Janus enqueued (S)RTP/(S)RTCP packet to send */
 typedef struct janus_ice_queued_packet {
 	char *data;					// 数据包
@@ -235,10 +678,104 @@ typedef struct janus_ice_queued_packet {
 	gboolean control;
 	gboolean retransmission;	// 是否需要重传
 	gboolean encrypted;			// 是否加密
+	/* When the packet was queued, if we're tracking latencies */
+	gint64 queued;
+	/* If the payload is shared with other handles, only the first hlen bytes (the header) are in data */
+	janus_plugin_rtp *shared;
+	gint hlen;
+	/* Whether this packet comes from the handle's pool (the buffer is then right after the struct) */
+	gboolean pooled;
+	/* Next available packet, when in the pool */
+	struct janus_ice_queued_packet *next;
 } janus_ice_queued_packet;
 /* This is a static, fake, message we use as a trigger to send a DTLS alert */
 static janus_ice_queued_packet janus_ice_dtls_alert;
 
+/* Packets pool: rather than allocating a packet and a buffer each time we
+ * queue something, handles recycle MTU-sized packets once they've been sent */
+#define JANUS_ICE_PACKET_POOL_BUFSIZE	1500
+#define JANUS_ICE_PACKET_POOL_MAX		256
+#define janus_ice_queued_packet_buffer(pkt) ((char *)(pkt) + sizeof(janus_ice_queued_packet))
+
+static janus_ice_queued_packet *janus_ice_queued_packet_new(janus_ice_handle *handle, int len) {
+	janus_ice_queued_packet *pkt = NULL;
+	if(len > JANUS_ICE_PACKET_POOL_BUFSIZE) {
+		/* Too large for the pool (e.g., data channels), allocate it as usual */
+		janus_mutex_lock(&handle->packets_pool_mutex);
+		handle->packets_pool_misses++;
+		janus_mutex_unlock(&handle->packets_pool_mutex);
+		pkt = g_malloc(sizeof(janus_ice_queued_packet));
+		pkt->data = g_malloc(len);
+		pkt->pooled = FALSE;
+	} else {
+		janus_mutex_lock(&handle->packets_pool_mutex);
+		pkt = handle->packets_pool;
+		if(pkt != NULL) {
+			handle->packets_pool = pkt->next;
+			handle->packets_pool_size--;
+			handle->packets_pool_hits++;
+		} else {
+			handle->packets_pool_misses++;
+		}
+		janus_mutex_unlock(&handle->packets_pool_mutex);
+		if(pkt == NULL)
+			pkt = g_malloc(sizeof(janus_ice_queued_packet) + JANUS_ICE_PACKET_POOL_BUFSIZE);
+		pkt->data = janus_ice_queued_packet_buffer(pkt);
+		pkt->pooled = TRUE;
+	}
+	pkt->next = NULL;
+	pkt->length = len;
+	pkt->queued = 0;
+	pkt->shared = NULL;
+	pkt->hlen = 0;
+	return pkt;
+}
+
+/* Helper to replace the buffer of a queued packet with a new allocated one */
+static void janus_ice_queued_packet_set_data(janus_ice_queued_packet *pkt, char *data, int len) {
+	if(!pkt->pooled || pkt->data != janus_ice_queued_packet_buffer(pkt))
+		g_free(pkt->data);
+	pkt->data = data;
+	pkt->length = len;
+}
+
+static void janus_ice_queued_packet_free(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+	if(pkt == NULL || pkt == &janus_ice_dtls_alert)
+		return;
+	if(pkt->shared != NULL) {
+		janus_plugin_rtp_unref(pkt->shared);
+		pkt->shared = NULL;
+	}
+	if(!pkt->pooled) {
+		g_free(pkt->data);
+		g_free(pkt);
+		return;
+	}
+	if(pkt->data != janus_ice_queued_packet_buffer(pkt))
+		g_free(pkt->data);
+	pkt->data = NULL;
+	janus_mutex_lock(&handle->packets_pool_mutex);
+	if(handle->packets_pool_size < JANUS_ICE_PACKET_POOL_MAX) {
+		pkt->next = handle->packets_pool;
+		handle->packets_pool = pkt;
+		handle->packets_pool_size++;
+		pkt = NULL;
+	}
+	janus_mutex_unlock(&handle->packets_pool_mutex);
+	g_free(pkt);
+}
+
+static void janus_ice_queued_packets_pool_destroy(janus_ice_handle *handle) {
+	janus_mutex_lock(&handle->packets_pool_mutex);
+	while(handle->packets_pool != NULL) {
+		janus_ice_queued_packet *pkt = handle->packets_pool;
+		handle->packets_pool = pkt->next;
+		g_free(pkt);
+	}
+	handle->packets_pool_size = 0;
+	janus_mutex_unlock(&handle->packets_pool_mutex);
+}
+
 /* Janus NACKed packet we're tracking (to avoid duplicates) */
 typedef struct janus_ice_nacked_packet {
 	janus_ice_handle *handle;
@@ -272,6 +809,112 @@ uint janus_get_no_media_timer(void) {
 	return no_media_timer;
 }
 
+/* Limits to the outgoing queue of each handle: by default there's none */
+static uint max_queued_packets = 0;
+void janus_set_max_queued_packets(uint packets) {
+	max_queued_packets = packets;
+	if(max_queued_packets == 0)
+		JANUS_LOG(LOG_VERB, "Disabling the limit to queued packets\n");
+	else
+		JANUS_LOG(LOG_VERB, "Setting the limit to queued packets to %u\n", max_queued_packets);
+}
+
+uint janus_get_max_queued_packets(void) {
+	return max_queued_packets;
+}
+
+static gint64 max_queued_age = 0;
+void janus_set_max_queued_age(uint age) {
+	max_queued_age = (gint64)age*1000;
+	if(max_queued_age == 0)
+		JANUS_LOG(LOG_VERB, "Disabling the limit to the age of queued packets\n");
+	else
+		JANUS_LOG(LOG_VERB, "Setting the limit to the age of queued packets to %ums\n", age);
+}
+
+uint janus_get_max_queued_age(void) {
+	return max_queued_age/1000;
+}
+
+/* We don't ask plugins for keyframes more often than this, when dropping video */
+#define JANUS_ICE_QUEUE_PLI_INTERVAL	G_USEC_PER_SEC
+
+/* Take note of an outgoing packet we dropped: for video, we'll also need a keyframe */
+static void janus_ice_queue_dropped(janus_ice_handle *handle, gboolean video) {
+	if(!video) {
+		g_atomic_int_inc(&handle->queue_dropped_audio);
+		return;
+	}
+	g_atomic_int_inc(&handle->queue_dropped_video);
+	if(!g_atomic_int_get(&handle->queue_dropping)) {
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Outgoing queue too long, dropping video until the next keyframe\n", handle->handle_id);
+		g_atomic_int_set(&handle->queue_dropping, 1);
+	}
+	gint64 now = janus_get_monotonic_time();
+	if(now - handle->queue_last_pli >= JANUS_ICE_QUEUE_PLI_INTERVAL) {
+		/* The PLI is sent by the outgoing thread, as plugins may be holding locks now */
+		handle->queue_last_pli = now;
+		g_atomic_int_set(&handle->queue_pli, 1);
+	}
+}
+
+/* Check whether a video packet we're about to queue is a keyframe */
+static gboolean janus_ice_queue_is_keyframe(janus_ice_handle *handle, char *buf, int len) {
+	janus_ice_stream *stream = handle->stream;
+	if(stream == NULL || stream->video_is_keyframe == NULL)
+		return FALSE;
+	int plen = 0;
+	char *payload = janus_rtp_payload(buf, len, &plen);
+	return payload != NULL && stream->video_is_keyframe(payload, plen);
+}
+
+
+/* Outgoing traffic on the ICE loop */
+static gboolean loop_send_enabled = FALSE;
+void janus_ice_set_loop_send_enabled(gboolean enabled) {
+	loop_send_enabled = enabled;
+	JANUS_LOG(LOG_VERB, "Outgoing traffic will be handled by %s\n", loop_send_enabled ? "the ICE loop" : "a dedicated send thread");
+}
+gboolean janus_ice_is_loop_send_enabled(void) {
+	return loop_send_enabled;
+}
+
+/* Batched sending of outgoing traffic on the ICE loop */
+static gboolean batch_send_enabled = FALSE;
+void janus_ice_set_batch_send_enabled(gboolean enabled) {
+#ifndef HAVE_LIBNICE_SENDMESSAGES
+	if(enabled) {
+		JANUS_LOG(LOG_WARN, "nice_agent_send_messages_nonblocking unavailable, batched sending disabled\n");
+		enabled = FALSE;
+	}
+#endif
+	batch_send_enabled = enabled;
+	JANUS_LOG(LOG_VERB, "Batched sending on the ICE loop is %s\n", batch_send_enabled ? "enabled" : "disabled");
+}
+gboolean janus_ice_is_batch_send_enabled(void) {
+	return batch_send_enabled;
+}
+
+/* Pacing of outgoing video */
+static gboolean pacing_enabled = FALSE;
+#define DEFAULT_PACING_MAX_DELAY	10
+static gint64 pacing_max_delay = DEFAULT_PACING_MAX_DELAY*1000;
+void janus_ice_set_pacing_enabled(gboolean enabled) {
+	pacing_enabled = enabled;
+	JANUS_LOG(LOG_VERB, "Pacing of outgoing video is %s\n", pacing_enabled ? "enabled" : "disabled");
+}
+gboolean janus_ice_is_pacing_enabled(void) {
+	return pacing_enabled;
+}
+void janus_ice_set_pacing_max_delay(uint delay) {
+	if(delay == 0)
+		delay = DEFAULT_PACING_MAX_DELAY;
+	pacing_max_delay = (gint64)delay*1000;
+	JANUS_LOG(LOG_VERB, "Paced video will wait at most %ums\n", delay);
+}
+uint janus_ice_get_pacing_max_delay(void) {
+	return pacing_max_delay/1000;
+}
 
 /* RFC4588 support */
 static gboolean rfc4588_enabled = FALSE;
@@ -302,99 +945,190 @@ uint janus_get_max_nack_queue(void) {
 	return max_nack_queue;
 }
 
-/* Helper to clean old NACK packets in the buffer when they exceed the queue time limit */
-static void janus_cleanup_nack_buffer(gint64 now, janus_ice_stream *stream, gboolean audio, gboolean video) {
-	if(stream && stream->component) {
-		janus_ice_component *component = stream->component;
-		janus_mutex_lock(&component->mutex);
-		if(audio && component->audio_retransmit_buffer) {
-			janus_rtp_packet *p = (janus_rtp_packet *)g_queue_peek_head(component->audio_retransmit_buffer);
-			while(p && (!now || (now - p->created >= (gint64)max_nack_queue*1000))) {
-				/* Packet is too old, get rid of it */
-				g_queue_pop_head(component->audio_retransmit_buffer);
-				/* Remove from hashtable too */
-				janus_rtp_header *header = (janus_rtp_header *)p->data;
-				guint16 seq = ntohs(header->seq_number);
-				g_hash_table_remove(component->audio_retransmit_seqs, GUINT_TO_POINTER(seq));
-				/* Free the packet */
-				g_free(p->data);
-				p->data = NULL;
-				g_free(p);
-				p = (janus_rtp_packet *)g_queue_peek_head(component->audio_retransmit_buffer);
-			}
-		}
-		if(video && component->video_retransmit_buffer) {
-			janus_rtp_packet *p = (janus_rtp_packet *)g_queue_peek_head(component->video_retransmit_buffer);
-			while(p && (!now || (now - p->created >= (gint64)max_nack_queue*1000))) {
-				/* Packet is too old, get rid of it */
-				g_queue_pop_head(component->video_retransmit_buffer);
-				/* Remove from hashtable too */
-				janus_rtp_header *header = (janus_rtp_header *)p->data;
-				guint16 seq = ntohs(header->seq_number);
-				g_hash_table_remove(component->video_retransmit_seqs, GUINT_TO_POINTER(seq));
-				/* Free the packet */
-				g_free(p->data);
-				p->data = NULL;
-				g_free(p);
-				p = (janus_rtp_packet *)g_queue_peek_head(component->video_retransmit_buffer);
-			}
+/* Retransmission buffers */
+#define JANUS_ICE_RETRANSMIT_BUFFER_MIN	64
+#define JANUS_ICE_RETRANSMIT_BUFFER_MAX	16384
+#define janus_ice_retransmit_packet_seq(p) ntohs(((janus_rtp_header *)(p)->data)->seq_number)
+
+static void janus_ice_retransmit_packet_free(janus_rtp_packet *p) {
+	g_free(p->data);
+	g_free(p);
+}
+
+/* Helper to create a new retransmission buffer, able to hold max_nack_queue ms of packets at the provided rate */
+static janus_ice_retransmit_buffer *janus_ice_retransmit_buffer_new(guint packets_per_second) {
+	guint needed = (guint)(((guint64)packets_per_second * max_nack_queue) / 1000), size = JANUS_ICE_RETRANSMIT_BUFFER_MIN;
+	while(size < needed && size < JANUS_ICE_RETRANSMIT_BUFFER_MAX)
+		size *= 2;
+	janus_ice_retransmit_buffer *buffer = g_malloc0(sizeof(janus_ice_retransmit_buffer));
+	buffer->packets = g_malloc0(size * sizeof(janus_rtp_packet *));
+	buffer->mask = size-1;
+	return buffer;
+}
+
+/* Helper to double the size of a retransmission buffer, re-indexing the packets we have */
+static void janus_ice_retransmit_buffer_grow(janus_ice_retransmit_buffer *buffer) {
+	guint size = buffer->mask+1, newsize = size*2, i = 0;
+	janus_rtp_packet **packets = g_malloc0(newsize * sizeof(janus_rtp_packet *));
+	for(i=0; i<size; i++) {
+		janus_rtp_packet *p = buffer->packets[i];
+		if(p == NULL)
+			continue;
+		guint16 index = janus_ice_retransmit_packet_seq(p) & (newsize-1);
+		if(packets[index] != NULL) {
+			/* Only keep the most recent of the two */
+			janus_rtp_packet *older = packets[index]->created < p->created ? packets[index] : p;
+			packets[index] = (older == p) ? packets[index] : p;
+			janus_ice_retransmit_packet_free(older);
+			buffer->count--;
+			continue;
 		}
-		janus_mutex_unlock(&component->mutex);
+		packets[index] = p;
 	}
+	g_free(buffer->packets);
+	buffer->packets = packets;
+	buffer->mask = newsize-1;
 }
 
-
-#define SEQ_MISSING_WAIT 12000 /*  12ms */
-#define SEQ_NACKED_WAIT 155000 /* 155ms */
-/* janus_seq_info list functions */
-static void janus_seq_append(janus_seq_info **head, janus_seq_info *new_seq) {
-	if(*head == NULL) {
-		new_seq->prev = new_seq;
-		new_seq->next = new_seq;
-		*head = new_seq;
-	} else {
-		janus_seq_info *last_seq = (*head)->prev;
-		new_seq->prev = last_seq;
-		new_seq->next = *head;
-		(*head)->prev = new_seq;
-		last_seq->next = new_seq;
+/* Helper to store a packet in a retransmission buffer: takes ownership of the packet */
+static void janus_ice_retransmit_buffer_insert(janus_ice_retransmit_buffer *buffer, guint16 seq, janus_rtp_packet *p) {
+	janus_rtp_packet *old = buffer->packets[seq & buffer->mask];
+	if(old != NULL && janus_ice_retransmit_packet_seq(old) != seq &&
+			p->created - old->created < (gint64)max_nack_queue*1000 && buffer->mask+1 < JANUS_ICE_RETRANSMIT_BUFFER_MAX) {
+		/* We'd overwrite a packet we may still be asked for: make room */
+		janus_ice_retransmit_buffer_grow(buffer);
+		old = buffer->packets[seq & buffer->mask];
+	}
+	if(old != NULL) {
+		janus_ice_retransmit_packet_free(old);
+		buffer->count--;
+	}
+	buffer->packets[seq & buffer->mask] = p;
+	buffer->count++;
+	if(buffer->count == 1) {
+		buffer->head = seq;
+		return;
 	}
+	/* The head only moves forward: packets sent out of order (e.g., older than
+	 * the head) must not make us consider the packets after them stale */
+	gint16 ahead = (gint16)(seq - buffer->head);
+	if(ahead > 0 && (guint16)ahead > buffer->mask)
+		buffer->head = (guint16)(seq - buffer->mask);
 }
 
-static janus_seq_info *janus_seq_pop_head(janus_seq_info **head) {
-	janus_seq_info *pop_seq = *head;
-	if(pop_seq) {
-		janus_seq_info *new_head = pop_seq->next;
-		if(pop_seq == new_head || new_head == NULL) {
-			*head = NULL;
-		} else {
-			*head = new_head;
-			new_head->prev = pop_seq->prev;
-			new_head->prev->next = new_head;
+/* Helper to find a packet in a retransmission buffer */
+static janus_rtp_packet *janus_ice_retransmit_buffer_lookup(janus_ice_retransmit_buffer *buffer, guint16 seq) {
+	if(buffer == NULL)
+		return NULL;
+	janus_rtp_packet *p = buffer->packets[seq & buffer->mask];
+	if(p == NULL || janus_ice_retransmit_packet_seq(p) != seq)
+		return NULL;
+	return p;
+}
+
+/* Helper to get rid of packets older than max_nack_queue (or all of them, if now is 0) */
+static void janus_ice_retransmit_buffer_cleanup(janus_ice_retransmit_buffer *buffer, gint64 now) {
+	if(buffer == NULL)
+		return;
+	while(buffer->count > 0) {
+		guint16 index = buffer->head & buffer->mask;
+		janus_rtp_packet *p = buffer->packets[index];
+		if(p == NULL) {
+			/* Gap in the sequence numbers */
+			buffer->head++;
+			continue;
 		}
+		/* A packet with a different sequence number in this slot is one that
+		 * fell out of the window: it's stale, whatever its age */
+		if(janus_ice_retransmit_packet_seq(p) == buffer->head && now && (now - p->created < (gint64)max_nack_queue*1000))
+			break;
+		/* Packet is too old, get rid of it */
+		buffer->packets[index] = NULL;
+		buffer->count--;
+		buffer->head++;
+		janus_ice_retransmit_packet_free(p);
 	}
-	return pop_seq;
 }
 
-void janus_seq_list_free(janus_seq_info **head) {
-	if(!*head)
+static void janus_ice_retransmit_buffer_destroy(janus_ice_retransmit_buffer *buffer) {
+	if(buffer == NULL)
 		return;
-	janus_seq_info *cur = *head;
-	do {
-		janus_seq_info *next = cur->next;
-		g_free(cur);
-		cur = next;
-	} while(cur != *head);
-	*head = NULL;
+	janus_ice_retransmit_buffer_cleanup(buffer, 0);
+	g_free(buffer->packets);
+	g_free(buffer);
+}
+
+/* Helper to clean old NACK packets in the buffer when they exceed the queue time limit */
+static void janus_cleanup_nack_buffer(gint64 now, janus_ice_stream *stream, gboolean audio, gboolean video) {
+	if(stream && stream->component) {
+		janus_ice_component *component = stream->component;
+		janus_mutex_lock(&component->mutex);
+		if(audio)
+			janus_ice_retransmit_buffer_cleanup(component->audio_retransmit_buffer, now);
+		if(video)
+			janus_ice_retransmit_buffer_cleanup(component->video_retransmit_buffer, now);
+		if(audio && video && component->extra_retransmit_buffers != NULL) {
+			/* Buffers of SSRCs that aren't sent anymore end up empty, get rid of them */
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, component->extra_retransmit_buffers);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_ice_retransmit_buffer *buffer = (janus_ice_retransmit_buffer *)value;
+				janus_ice_retransmit_buffer_cleanup(buffer, now);
+				if(buffer->count == 0)
+					g_hash_table_iter_remove(&iter);
+			}
+		}
+		janus_mutex_unlock(&component->mutex);
+	}
 }
 
-static int janus_seq_in_range(guint16 seqn, guint16 start, guint16 len) {
-	/* Supports wrapping sequence (easier with int range) */
-	int n = seqn;
-	int nh = (1<<16) + n;
-	int s = start;
-	int e = s + len;
-	return (s <= n && n < e) || (s <= nh && nh < e);
+/* Helper to retransmit packets of the additional SSRCs a plugin multiplexes,
+ * when the NACKs in a compound RTCP packet are about them: returns how many */
+static guint janus_ice_stream_retransmit_extra(janus_ice_handle *handle, janus_ice_stream *stream,
+		janus_ice_component *component, char *buf, int len, gint64 now) {
+	guint retransmits = 0;
+	int offset = 0;
+	janus_mutex_lock(&component->mutex);
+	while(component->extra_retransmit_buffers != NULL && len-offset >= 4) {
+		janus_rtcp_header *rtcp = (janus_rtcp_header *)(buf+offset);
+		int size = (ntohs(rtcp->length)+1)*4;
+		if(rtcp->version != 2 || size > len-offset)
+			break;
+		guint32 ssrc = 0;
+		gboolean video = FALSE;
+		janus_ice_retransmit_buffer *buffer = NULL;
+		if(janus_ice_stream_is_nack(stream, rtcp, size, TRUE, &ssrc, &video) &&
+				((!video && component->do_audio_nacks) || (video && component->do_video_nacks)))
+			buffer = g_hash_table_lookup(component->extra_retransmit_buffers, GUINT_TO_POINTER(ssrc));
+		GSList *nacks = buffer ? janus_rtcp_get_nacks(buf+offset, size) : NULL, *list = nacks;
+		while(list) {
+			janus_rtp_packet *p = janus_ice_retransmit_buffer_lookup(buffer, GPOINTER_TO_UINT(list->data));
+			list = list->next;
+			if(p == NULL || (p->last_retransmit > 0 && now-p->last_retransmit < MAX_NACK_IGNORE))
+				continue;
+			p->last_retransmit = now;
+			retransmits++;
+			/* We stored the SRTP packet as it was sent: just send it again */
+			janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, p->length);
+			memcpy(pkt->data, p->data, p->length);
+			pkt->type = video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
+			pkt->control = FALSE;
+			pkt->retransmission = TRUE;
+			pkt->encrypted = TRUE;
+			if(handle->queued_packets != NULL)
+#if GLIB_CHECK_VERSION(2, 46, 0)
+				g_async_queue_push_front(handle->queued_packets, pkt);
+#else
+				g_async_queue_push(handle->queued_packets, pkt);
+#endif
+		}
+		g_slist_free(nacks);
+		offset += size;
+	}
+	component->retransmit_recent_cnt += retransmits;
+	janus_mutex_unlock(&component->mutex);
+	return retransmits;
 }
 
 
@@ -443,6 +1177,12 @@ static gboolean janus_ice_handles_check(gpointer user_data) {
 			if (!handle) {
 				continue;
 			}
+			/* Be sure that the handle has been detached from its static event loop, if any */
+			if(handle->static_event_loop != NULL) {
+				JANUS_LOG(LOG_WARN, "Handle %"SCNu64" cleanup skipped because it's still attached to a static event loop...\n", handle->handle_id);
+				janus_ice_handle_loop_quit(handle);
+				continue;
+			}
 			/* Be sure that iceloop is not running, before freeing */
 			if(handle->iceloop != NULL && g_main_loop_is_running(handle->iceloop)) {
 				JANUS_LOG(LOG_WARN, "Handle %"SCNu64" cleanup skipped because iceloop is still running...\n", handle->handle_id);
@@ -674,6 +1414,7 @@ void janus_ice_trickle_destroy(janus_ice_trickle *trickle) {
 void janus_ice_init(gboolean ice_lite, gboolean ice_tcp, gboolean full_trickle, gboolean ipv6, uint16_t rtp_min_port, uint16_t rtp_max_port) {
 	janus_ice_lite_enabled = ice_lite;
 	janus_ice_tcp_enabled = ice_tcp;
+	janus_ice_metrics_init();
 	janus_full_trickle_enabled = full_trickle;
 	janus_ipv6_enabled = ipv6;
 	JANUS_LOG(LOG_INFO, "Initializing ICE stuff (%s mode, ICE-TCP candidates %s, %s-trickle, IPv6 support %s)\n",
@@ -735,6 +1476,10 @@ void janus_ice_init(gboolean ice_lite, gboolean ice_tcp, gboolean full_trickle,
 }
 
 void janus_ice_deinit(void) {
+	/* Stop the static event loops, if any */
+	janus_ice_stop_static_event_loops();
+	/* Stop the ICE mux threads, if any */
+	janus_ice_mux_stop();
 	JANUS_LOG(LOG_INFO, "Ending ICE handles watchdog mainloop...\n");
 	g_main_loop_quit(handles_watchdog_loop);
 	g_thread_join(handles_watchdog);
@@ -749,6 +1494,11 @@ void janus_ice_deinit(void) {
 #ifdef HAVE_LIBCURL
 	janus_turnrest_deinit();
 #endif
+	janus_mutex_lock(&local_addresses_mutex);
+	if(local_addresses != NULL)
+		g_array_free(local_addresses, TRUE);
+	local_addresses = NULL;
+	janus_mutex_unlock(&local_addresses_mutex);
 }
 
 int janus_ice_set_stun_server(gchar *stun_server, uint16_t stun_port) {
@@ -1006,6 +1756,7 @@ janus_ice_handle *janus_ice_handle_create(void *gateway_session, const char *opa
 	handle->app = NULL;
 	handle->app_handle = NULL;
 	handle->queued_packets = g_async_queue_new();
+	janus_mutex_init(&handle->packets_pool_mutex);
 	janus_mutex_init(&handle->mutex);
 
 	/* Set up other stuff. */
@@ -1014,6 +1765,7 @@ janus_ice_handle *janus_ice_handle_create(void *gateway_session, const char *opa
 	
 	// 传入新的session->ice_handles,对ice_handle进行统一管理
 	g_hash_table_insert(session->ice_handles, janus_uint64_dup(handle->handle_id), handle);
+	janus_metrics_inc(metric_handles);
 
 	return handle;
 }
@@ -1058,6 +1810,7 @@ gint janus_ice_handle_attach_plugin(void *gateway_session, guint64 handle_id, ja
 	}
 	handle->app = plugin;
 	handle->app_handle = session_handle;
+	handle->latency = janus_latency_stats_get(plugin->get_package());
 	/* Add this plugin session to active sessions map */
 	janus_mutex_lock(&plugin_sessions_mutex);
 	g_hash_table_insert(plugin_sessions, session_handle, session_handle);
@@ -1095,9 +1848,7 @@ gint janus_ice_handle_destroy(void *gateway_session, guint64 handle_id) {
 			if(handle->stream_id > 0) {
 				nice_agent_attach_recv(handle->agent, handle->stream_id, 1, g_main_loop_get_context (handle->iceloop), NULL, NULL);
 			}
-			if(handle->iceloop != NULL && g_main_loop_is_running(handle->iceloop)) {
-				g_main_loop_quit(handle->iceloop);
-			}
+			janus_ice_handle_loop_quit(handle);
 		}
 		return 0;
 	}
@@ -1117,9 +1868,7 @@ gint janus_ice_handle_destroy(void *gateway_session, guint64 handle_id) {
 		if(handle->stream_id > 0) {
 			nice_agent_attach_recv(handle->agent, handle->stream_id, 1, g_main_loop_get_context (handle->iceloop), NULL, NULL);
 		}
-		if(handle->iceloop != NULL && g_main_loop_is_running(handle->iceloop)) {
-			g_main_loop_quit(handle->iceloop);
-		}
+		janus_ice_handle_loop_quit(handle);
 	}
 
 	/* Prepare JSON event to notify user/application */
@@ -1142,20 +1891,29 @@ gint janus_ice_handle_destroy(void *gateway_session, guint64 handle_id) {
 	return error;
 }
 
+static void janus_ice_pacer_flush(janus_ice_handle *handle);
 void janus_ice_free(janus_ice_handle *handle) {
 	if(handle == NULL)
 		return;
+	janus_metrics_dec(metric_handles);
 	janus_mutex_lock(&handle->mutex);
 	janus_ice_queued_packet *pkt = NULL;
 	while(g_async_queue_length(handle->queued_packets) > 0) {
 		pkt = g_async_queue_try_pop(handle->queued_packets);
 		if(pkt != NULL && pkt != &janus_ice_dtls_alert) {
-			g_free(pkt->data);
-			g_free(pkt);
+			janus_ice_queued_packet_free(handle, pkt);
 		}
 	}
 	g_async_queue_unref(handle->queued_packets);
 	handle->queued_packets = NULL;
+	if(handle->pacer != NULL) {
+		janus_ice_pacer_flush(handle);
+		g_free(handle->pacer);
+		handle->pacer = NULL;
+	}
+	janus_ice_queued_packets_pool_destroy(handle);
+	g_free(handle->send_batch);
+	handle->send_batch = NULL;
 	handle->session = NULL;
 	handle->app = NULL;
 	if(handle->app_handle != NULL) {
@@ -1169,6 +1927,8 @@ void janus_ice_free(janus_ice_handle *handle) {
 	}
 	janus_mutex_unlock(&handle->mutex);
 	janus_ice_webrtc_free(handle);
+	janus_ice_mux_binding_unref(handle->mux_binding);
+	handle->mux_binding = NULL;
 	JANUS_LOG(LOG_INFO, "[%"SCNu64"] Handle and related resources freed\n", handle->handle_id);
 	g_free(handle->opaque_id);
 	g_free(handle);
@@ -1192,14 +1952,17 @@ void janus_ice_webrtc_hangup(janus_ice_handle *handle, const char *reason) {
 		/* User will be notified only after the actual hangup */
 		handle->hangup_reason = reason;
 	}
-	if(handle->queued_packets != NULL && handle->send_thread_created)
+	if(handle->queued_packets != NULL && handle->send_thread_created) {
 #if GLIB_CHECK_VERSION(2, 46, 0)
 		g_async_queue_push_front(handle->queued_packets, &janus_ice_dtls_alert);
 #else
 		g_async_queue_push(handle->queued_packets, &janus_ice_dtls_alert);
 #endif
-	/* Get rid of the loop */
-	if(handle->send_thread == NULL) {
+		if(handle->outgoing_source != NULL && handle->icectx != NULL)
+			g_main_context_wakeup(handle->icectx);
+	}
+	/* Get rid of the loop (unless the send thread or source will take care of that after sending the alert) */
+	if(handle->send_thread == NULL && handle->outgoing_source == NULL) {
 		if(handle->iceloop != NULL) {
 			if(handle->stream_id > 0) {
 				nice_agent_attach_recv(handle->agent, handle->stream_id, 1, g_main_loop_get_context (handle->iceloop), NULL, NULL);
@@ -1216,10 +1979,7 @@ void janus_ice_webrtc_hangup(janus_ice_handle *handle, const char *reason) {
 			}
 			if(handle->iceloop != NULL && g_main_loop_is_running(handle->iceloop)) {
 				JANUS_LOG(LOG_VERB, "[%"SCNu64"] Forcing ICE loop to quit (%s)\n", handle->handle_id, g_main_loop_is_running(handle->iceloop) ? "running" : "NOT running");
-				g_main_loop_quit(handle->iceloop);
-				if (handle->icectx != NULL) {
-					g_main_context_wakeup(handle->icectx);
-				}
+				janus_ice_handle_loop_quit(handle);
 			}
 		}
 	}
@@ -1230,6 +1990,8 @@ void janus_ice_webrtc_free(janus_ice_handle *handle) {
 		return;
 	janus_mutex_lock(&handle->mutex);
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY);
+	janus_ice_mux_unregister(handle);
+	janus_ice_outgoing_traffic_stop(handle);
 	if(handle->iceloop != NULL) {
 		g_main_loop_unref (handle->iceloop);
 		handle->iceloop = NULL;
@@ -1262,6 +2024,8 @@ void janus_ice_webrtc_free(janus_ice_handle *handle) {
 	handle->rtp_profile = NULL;
 	g_free(handle->local_sdp);
 	handle->local_sdp = NULL;
+	janus_sdp_negotiation_destroy(handle->local_negotiation);
+	handle->local_negotiation = NULL;
 	g_free(handle->remote_sdp);
 	handle->remote_sdp = NULL;
 	handle->stream_mid = NULL;
@@ -1345,8 +2109,11 @@ void janus_ice_stream_free(janus_ice_stream *stream) {
 	if(stream->rtx_nacked[2])
 		g_hash_table_destroy(stream->rtx_nacked[2]);
 	stream->rtx_nacked[2] = NULL;
-	g_slist_free_full(stream->transport_wide_received_seq_nums, (GDestroyNotify)g_free);
-	stream->transport_wide_received_seq_nums = NULL;
+	g_free(stream->transport_wide_cc_arrivals);
+	stream->transport_wide_cc_arrivals = NULL;
+	g_atomic_int_set(&stream->extra_ssrcs_num, 0);
+	g_free(stream->extra_ssrcs);
+	stream->extra_ssrcs = NULL;
 	stream->audio_first_ntp_ts = 0;
 	stream->audio_first_rtp_ts = 0;
 	stream->video_first_ntp_ts[0] = 0;
@@ -1386,36 +2153,21 @@ void janus_ice_component_free(janus_ice_component *component) {
 		janus_dtls_srtp_destroy(component->dtls);
 		component->dtls = NULL;
 	}
-	if(component->audio_retransmit_buffer != NULL) {
-		janus_rtp_packet *p = NULL;
-		while((p = (janus_rtp_packet *)g_queue_pop_head(component->audio_retransmit_buffer)) != NULL) {
-			/* Remove from hashtable too */
-			janus_rtp_header *header = (janus_rtp_header *)p->data;
-			guint16 seq = ntohs(header->seq_number);
-			g_hash_table_remove(component->audio_retransmit_seqs, GUINT_TO_POINTER(seq));
-			/* Free the packet */
-			g_free(p->data);
-			p->data = NULL;
-			g_free(p);
-		}
-		g_queue_free(component->audio_retransmit_buffer);
-		g_hash_table_destroy(component->audio_retransmit_seqs);
-	}
-	if(component->video_retransmit_buffer != NULL) {
-		janus_rtp_packet *p = NULL;
-		while((p = (janus_rtp_packet *)g_queue_pop_head(component->video_retransmit_buffer)) != NULL) {
-			/* Remove from hashtable too */
-			janus_rtp_header *header = (janus_rtp_header *)p->data;
-			guint16 seq = ntohs(header->seq_number);
-			g_hash_table_remove(component->video_retransmit_seqs, GUINT_TO_POINTER(seq));
-			/* Free the packet */
-			g_free(p->data);
-			p->data = NULL;
-			g_free(p);
-		}
-		g_queue_free(component->video_retransmit_buffer);
-		g_hash_table_destroy(component->video_retransmit_seqs);
-	}
+	janus_ice_retransmit_buffer_destroy(component->audio_retransmit_buffer);
+	component->audio_retransmit_buffer = NULL;
+	janus_ice_retransmit_buffer_destroy(component->video_retransmit_buffer);
+	component->video_retransmit_buffer = NULL;
+	if(component->extra_retransmit_buffers != NULL)
+		g_hash_table_destroy(component->extra_retransmit_buffers);
+	component->extra_retransmit_buffers = NULL;
+	g_free(component->last_seqs_audio);
+	component->last_seqs_audio = NULL;
+	g_free(component->last_seqs_video[0]);
+	component->last_seqs_video[0] = NULL;
+	g_free(component->last_seqs_video[1]);
+	component->last_seqs_video[1] = NULL;
+	g_free(component->last_seqs_video[2]);
+	component->last_seqs_video[2] = NULL;
 	if(component->candidates != NULL) {
 		GSList *i = NULL, *candidates = component->candidates;
 		for (i = candidates; i; i = i->next) {
@@ -1458,18 +2210,80 @@ void janus_ice_component_free(janus_ice_component *component) {
 	if(component->selected_pair != NULL)
 		g_free(component->selected_pair);
 	component->selected_pair = NULL;
-	if(component->last_seqs_audio)
-		janus_seq_list_free(&component->last_seqs_audio);
-	if(component->last_seqs_video[0])
-		janus_seq_list_free(&component->last_seqs_video[0]);
-	if(component->last_seqs_video[1])
-		janus_seq_list_free(&component->last_seqs_video[1]);
-	if(component->last_seqs_video[2])
-		janus_seq_list_free(&component->last_seqs_video[2]);
 	g_free(component);
 	//~ janus_mutex_unlock(&handle->mutex);
 }
 
+/* Transport wide CC: arrival times are stored in a circular array indexed by
+ * transport wide seq num, which the RTCP timer then walks to build feedback
+ * (the window must be a power of 2, and no larger than 65536) */
+#define JANUS_ICE_TWCC_WINDOW		1024
+/* Packets to report in each feedback at most, so that it fits in a buffer */
+#define JANUS_ICE_TWCC_FEEDBACK_MAX	256
+
+/* Memory usage: what the handle allocated for its stream and component, including
+ * the state that's only created on demand (which is why it's worth looking at) */
+static gsize janus_ice_retransmit_buffer_memory(janus_ice_retransmit_buffer *buffer) {
+	if(buffer == NULL)
+		return 0;
+	gsize size = sizeof(janus_ice_retransmit_buffer) + (buffer->mask+1)*sizeof(janus_rtp_packet *);
+	guint i = 0;
+	for(i=0; i<=buffer->mask; i++) {
+		if(buffer->packets[i] != NULL)
+			size += sizeof(janus_rtp_packet) + buffer->packets[i]->length;
+	}
+	return size;
+}
+
+gsize janus_ice_handle_memory(janus_ice_handle *handle) {
+	if(handle == NULL)
+		return 0;
+	gsize size = sizeof(janus_ice_handle);
+	janus_mutex_lock(&handle->packets_pool_mutex);
+	size += handle->packets_pool_size * (sizeof(janus_ice_queued_packet) + JANUS_ICE_PACKET_POOL_BUFSIZE);
+	janus_mutex_unlock(&handle->packets_pool_mutex);
+	janus_ice_stream *stream = handle->stream;
+	if(stream != NULL) {
+		size += sizeof(janus_ice_stream);
+		if(stream->extra_ssrcs != NULL)
+			size += JANUS_ICE_MAX_EXTRA_SSRCS*sizeof(janus_ice_extra_ssrc);
+		if(stream->transport_wide_cc_arrivals != NULL)
+			size += JANUS_ICE_TWCC_WINDOW*sizeof(guint64);
+		if(stream->audio_rtcp_ctx != NULL)
+			size += sizeof(janus_rtcp_context);
+		int vindex = 0;
+		for(vindex=0; vindex<3; vindex++) {
+			if(stream->video_rtcp_ctx[vindex] != NULL)
+				size += sizeof(janus_rtcp_context);
+			/* Tracked NACKs are just a key and a value in a hashtable node */
+			if(stream->rtx_nacked[vindex] != NULL)
+				size += g_hash_table_size(stream->rtx_nacked[vindex]) * 4*sizeof(gpointer);
+		}
+		janus_ice_component *component = stream->component;
+		if(component != NULL) {
+			size += sizeof(janus_ice_component);
+			janus_mutex_lock(&component->mutex);
+			if(component->last_seqs_audio != NULL)
+				size += sizeof(janus_rtp_seq_window);
+			for(vindex=0; vindex<3; vindex++) {
+				if(component->last_seqs_video[vindex] != NULL)
+					size += sizeof(janus_rtp_seq_window);
+			}
+			size += janus_ice_retransmit_buffer_memory(component->audio_retransmit_buffer);
+			size += janus_ice_retransmit_buffer_memory(component->video_retransmit_buffer);
+			if(component->extra_retransmit_buffers != NULL) {
+				GHashTableIter iter;
+				gpointer value;
+				g_hash_table_iter_init(&iter, component->extra_retransmit_buffers);
+				while(g_hash_table_iter_next(&iter, NULL, &value))
+					size += janus_ice_retransmit_buffer_memory((janus_ice_retransmit_buffer *)value);
+			}
+			janus_mutex_unlock(&component->mutex);
+		}
+	}
+	return size;
+}
+
 /* Call plugin slow_link callback if enough NACKs within a second */
 #define SLOW_LINK_NACKS_PER_SEC 8
 static void
@@ -1645,11 +2459,16 @@ static void janus_ice_cb_component_state_changed(NiceAgent *agent, guint stream_
 	}
 	/* Handle new state */
 	if((state == NICE_COMPONENT_STATE_CONNECTED || state == NICE_COMPONENT_STATE_READY)
-			&& handle->send_thread == NULL) {
+			&& handle->send_thread == NULL && handle->outgoing_source == NULL) {
 		/* Make sure we're not trying to start the thread more than once */
 		if(!g_atomic_int_compare_and_exchange(&handle->send_thread_created, 0, 1)) {
 			return;
 		}
+		if(loop_send_enabled) {
+			/* No thread needed, the ICE loop will take care of the outgoing data */
+			janus_ice_outgoing_traffic_start(handle);
+			return;
+		}
 		/* Start the outgoing data thread */
 		GError *error = NULL;
 		char tname[16];
@@ -1685,6 +2504,7 @@ static void janus_ice_cb_component_state_changed(NiceAgent *agent, guint stream_
 	}
 }
 
+static void janus_ice_selected_pair_set(janus_ice_handle *handle, janus_ice_component *component, const char *sp);
 #ifndef HAVE_LIBNICE_TCP
 static void janus_ice_cb_new_selected_pair (NiceAgent *agent, guint stream_id, guint component_id, gchar *local, gchar *remote, gpointer ice) {
 #else
@@ -1758,7 +2578,13 @@ static void janus_ice_cb_new_selected_pair (NiceAgent *agent, guint stream_id, g
 	g_snprintf(sp, 200, "%s:%d [%s,%s] <-> %s:%d [%s,%s]",
 		laddress, lport, ltype, local->transport == NICE_CANDIDATE_TRANSPORT_UDP ? "udp" : "tcp",
 		raddress, rport, rtype, remote->transport == NICE_CANDIDATE_TRANSPORT_UDP ? "udp" : "tcp");
+	component->tcp_pair = (local->transport != NICE_CANDIDATE_TRANSPORT_UDP || remote->transport != NICE_CANDIDATE_TRANSPORT_UDP);
 #endif
+	janus_ice_selected_pair_set(handle, component, sp);
+}
+
+/* Takes note of the pair in use, and starts the DTLS handshake if we just got connected */
+static void janus_ice_selected_pair_set(janus_ice_handle *handle, janus_ice_component *component, const char *sp) {
 	gchar *prev_selected_pair = component->selected_pair;
 	component->selected_pair = g_strdup(sp);
 	g_clear_pointer(&prev_selected_pair, g_free);
@@ -1767,8 +2593,8 @@ static void janus_ice_cb_new_selected_pair (NiceAgent *agent, guint stream_id, g
 		janus_session *session = (janus_session *)handle->session;
 		json_t *info = json_object();
 		json_object_set_new(info, "selected-pair", json_string(sp));
-		json_object_set_new(info, "stream_id", json_integer(stream_id));
-		json_object_set_new(info, "component_id", json_integer(component_id));
+		json_object_set_new(info, "stream_id", json_integer(component->stream_id));
+		json_object_set_new(info, "component_id", json_integer(component->component_id));
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_WEBRTC, session->session_id, handle->handle_id, handle->opaque_id, info);
 	}
 	/* Have we been here before? (might happen, when trickling) */
@@ -2038,6 +2864,39 @@ candidatedone:
 }
 
 // libnice获取数据回调
+/* Keep track of when a packet was received: must be called with the stream mutex locked */
+static void janus_ice_transport_wide_cc_received(janus_ice_stream *stream, guint16 seq, guint64 arrival) {
+	if(stream->transport_wide_cc_arrivals == NULL) {
+		stream->transport_wide_cc_arrivals = g_malloc0(JANUS_ICE_TWCC_WINDOW*sizeof(guint64));
+		stream->transport_wide_cc_max_seq_num = seq;
+		stream->transport_wide_cc_last_feedback_seq_num = (guint32)seq-1;
+	}
+	/* Extend the seq num relative to the highest we got, which takes care of both wraps and reordering */
+	guint32 max = stream->transport_wide_cc_max_seq_num;
+	guint32 ext_seq = max + (gint16)(seq - (guint16)max);
+	gint32 ahead = (gint32)(ext_seq - stream->transport_wide_cc_last_feedback_seq_num);
+	if(ahead <= 0) {
+		/* Too late, we already reported this packet as lost */
+		return;
+	}
+	if(ahead > JANUS_ICE_TWCC_WINDOW) {
+		/* We didn't send feedback for too long: give up on the oldest packets */
+		guint32 last = ext_seq - JANUS_ICE_TWCC_WINDOW;
+		guint32 drop = last - stream->transport_wide_cc_last_feedback_seq_num;
+		if(drop >= JANUS_ICE_TWCC_WINDOW) {
+			memset(stream->transport_wide_cc_arrivals, 0, JANUS_ICE_TWCC_WINDOW*sizeof(guint64));
+		} else {
+			guint32 i = 0;
+			for(i=1; i<=drop; i++)
+				stream->transport_wide_cc_arrivals[(stream->transport_wide_cc_last_feedback_seq_num+i) & (JANUS_ICE_TWCC_WINDOW-1)] = 0;
+		}
+		stream->transport_wide_cc_last_feedback_seq_num = last;
+	}
+	stream->transport_wide_cc_arrivals[ext_seq & (JANUS_ICE_TWCC_WINDOW-1)] = arrival;
+	if((gint32)(ext_seq - max) > 0)
+		stream->transport_wide_cc_max_seq_num = ext_seq;
+}
+
 static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint component_id, guint len, gchar *buf, gpointer ice) {
 	janus_ice_component *component = (janus_ice_component *)ice;
 	if(!component) {
@@ -2055,42 +2914,47 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		return;
 	}
 	janus_session *session = (janus_session *)handle->session;
+	gint64 recv_time = janus_latency_is_enabled() ? janus_get_monotonic_time() : 0;
 	if(!component->dtls) {	/* Still waiting for the DTLS stack */
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Still waiting for the DTLS stack for component %d in stream %d...\n", handle->handle_id, component_id, stream_id);
 		return;
 	}
 	/* What is this? */
-	if (janus_is_dtls(buf) || (!janus_is_rtp(buf) && !janus_is_rtcp(buf))) {
+	janus_ice_demux_type demux = janus_ice_demux(buf, len);
+	if(demux == JANUS_ICE_DEMUX_DTLS) {
 		/* This is DTLS: either handshake stuff, or data coming from SCTP DataChannels */
 		JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Looks like DTLS!\n", handle->handle_id);
 		janus_dtls_srtp_incoming_msg(component->dtls, buf, len);
 		/* Update stats (TODO Do the same for the last second window as well) */
 		component->in_stats.data.packets++;
 		component->in_stats.data.bytes += len;
+		janus_metrics_inc(metric_packets_in[2]);
+		janus_metrics_add_value(metric_bytes_in[2], len);
 		return;
 	}
 	/* Not DTLS... RTP or RTCP? (http://tools.ietf.org/html/rfc5761#section-4) */
 	if(len < 12)
 		return;	/* Definitely nothing useful */
 	// 分别处理rtp包和rtcp包
-	if(janus_is_rtp(buf)) {
+	if(demux == JANUS_ICE_DEMUX_RTP) {
 		/* This is RTP */
 		if(!component->dtls || !component->dtls->srtp_valid || !component->dtls->srtp_in) {
 			JANUS_LOG(LOG_WARN, "[%"SCNu64"]     Missing valid SRTP session (packet arrived too early?), skipping...\n", handle->handle_id);
 		} else {
 			janus_rtp_header *header = (janus_rtp_header *)buf;
 			guint32 packet_ssrc = ntohl(header->ssrc);
-			/* Is this audio or video? */
+			/* Is this audio or video? Is it simulcast and/or a retransmission using RFC4588? */
 			int video = 0, vindex = 0, rtx = 0;
-			/* Bundled streams, check SSRC */
-			video = ((stream->video_ssrc_peer[0] == packet_ssrc
-				|| stream->video_ssrc_peer_rtx[0] == packet_ssrc
-				|| stream->video_ssrc_peer[1] == packet_ssrc
-				|| stream->video_ssrc_peer_rtx[1] == packet_ssrc
-				|| stream->video_ssrc_peer[2] == packet_ssrc
-				|| stream->video_ssrc_peer_rtx[2] == packet_ssrc) ? 1 : 0);
-
-			if(!video && stream->audio_ssrc_peer != packet_ssrc) {
+			janus_ice_ssrc_entry entry;
+			if(janus_ice_stream_find_ssrc(stream, packet_ssrc, &entry)) {
+				video = entry.video;
+				vindex = entry.vindex;
+				rtx = entry.rtx;
+				if(vindex > 0 || rtx) {
+					JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Simulcast #%d%s (SSRC %"SCNu32")...\n",
+						handle->handle_id, vindex, rtx ? " rtx" : "", packet_ssrc);
+				}
+			} else {
 				/* FIXME In case it happens, we should check what it is */
 				if(stream->audio_ssrc_peer == 0 || stream->video_ssrc_peer[0] == 0) {
 					/* Apparently we were not told the peer SSRCs, try to guess from the payload type */
@@ -2104,6 +2968,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 								JANUS_LOG(LOG_VERB, "[%"SCNu64"] Unadvertized SSRC (%"SCNu32") is audio! (payload type %"SCNu16")\n", handle->handle_id, packet_ssrc, pt);
 								video = 0;
 								stream->audio_ssrc_peer = packet_ssrc;
+								janus_ice_stream_update_ssrc_map(stream);
 								found = TRUE;
 								break;
 							}
@@ -2118,6 +2983,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 								JANUS_LOG(LOG_VERB, "[%"SCNu64"] Unadvertized SSRC (%"SCNu32") is video! (payload type %"SCNu16")\n", handle->handle_id, packet_ssrc, pt);
 								video = 1;
 								stream->video_ssrc_peer[0] = packet_ssrc;
+								janus_ice_stream_update_ssrc_map(stream);
 								found = TRUE;
 								break;
 							}
@@ -2133,41 +2999,12 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 			/* Make sure we're prepared to receive this media packet */
 			if((!video && !stream->audio_recv) || (video && !stream->video_recv))
 				return;
-			/* If this is video, check if this is simulcast and/or a retransmission using RFC4588 */
-			if(video) {
-				if(stream->video_ssrc_peer[1] == packet_ssrc) {
-					/* FIXME Simulcast (1) */
-					JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Simulcast #1 (SSRC %"SCNu32")...\n", handle->handle_id, packet_ssrc);
-					vindex = 1;
-				} else if(stream->video_ssrc_peer[2] == packet_ssrc) {
-					/* FIXME Simulcast (2) */
-					JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Simulcast #2 (SSRC %"SCNu32")...\n", handle->handle_id, packet_ssrc);
-					vindex = 2;
-				} else {
-					/* Maybe a video retransmission using RFC4588? */
-					if(stream->video_ssrc_peer_rtx[0] == packet_ssrc) {
-						rtx = 1;
-						vindex = 0;
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] RFC4588 rtx packet on video (SSRC %"SCNu32")...\n",
-							handle->handle_id, packet_ssrc);
-					} else if(stream->video_ssrc_peer_rtx[1] == packet_ssrc) {
-						rtx = 1;
-						vindex = 1;
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] RFC4588 rtx packet on video #%d (SSRC %"SCNu32")...\n",
-							handle->handle_id, vindex, packet_ssrc);
-					} else if(stream->video_ssrc_peer_rtx[2] == packet_ssrc) {
-						rtx = 1;
-						vindex = 2;
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] RFC4588 rtx packet on video #%d (SSRC %"SCNu32")...\n",
-							handle->handle_id, vindex, packet_ssrc);
-					}
-				}
-			}
 
 			int buflen = len;
 			srtp_err_status_t res = srtp_unprotect(component->dtls->srtp_in, buf, &buflen);
 			if(res != srtp_err_status_ok) {
 				if(res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+					janus_metrics_inc(metric_srtp_errors_in);
 					/* Only print the error if it's not a 'replay fail' or 'replay old' (which is probably just the result of us NACKing a packet) */
 					guint32 timestamp = ntohl(header->timestamp);
 					guint16 seq = ntohs(header->seq_number);
@@ -2177,11 +3014,13 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				if(video) {
 					if(stream->video_ssrc_peer[0] == 0) {
 						stream->video_ssrc_peer[0] = ntohl(header->ssrc);
+						janus_ice_stream_update_ssrc_map(stream);
 						JANUS_LOG(LOG_VERB, "[%"SCNu64"]     Peer video SSRC: %u\n", handle->handle_id, stream->video_ssrc_peer[0]);
 					}
 				} else {
 					if(stream->audio_ssrc_peer == 0) {
 						stream->audio_ssrc_peer = ntohl(header->ssrc);
+						janus_ice_stream_update_ssrc_map(stream);
 						JANUS_LOG(LOG_VERB, "[%"SCNu64"]     Peer audio SSRC: %u\n", handle->handle_id, stream->audio_ssrc_peer);
 					}
 				}
@@ -2244,7 +3083,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				if(!video && stream->audio_payload_type < 0) {
 					stream->audio_payload_type = header->type;
 					if(stream->audio_codec == NULL) {
-						const char *codec = janus_get_codec_from_pt(handle->local_sdp, stream->audio_payload_type);
+						const char *codec = janus_sdp_negotiation_get_codec_name(handle->local_negotiation, stream->audio_payload_type);
 						if(codec != NULL)
 							stream->audio_codec = g_strdup(codec);
 					}
@@ -2257,7 +3096,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 							handle->handle_id, stream->video_rtx_payload_type);
 					}
 					if(stream->video_codec == NULL) {
-						const char *codec = janus_get_codec_from_pt(handle->local_sdp, stream->video_payload_type);
+						const char *codec = janus_sdp_negotiation_get_codec_name(handle->local_negotiation, stream->video_payload_type);
 						if(codec != NULL)
 							stream->video_codec = g_strdup(codec);
 					}
@@ -2278,30 +3117,31 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						/* Get current timestamp */
 						struct timeval now;
 						gettimeofday(&now,0);
-						/* Create <seq num, time> pair */
-						janus_rtcp_transport_wide_cc_stats *stats = g_malloc0(sizeof(janus_rtcp_transport_wide_cc_stats));
-						/* Check if we have a sequence wrap */
-						if(transport_seq_num<0x0FFF && (stream->transport_wide_cc_last_seq_num&0xFFFF)>0xF000) {
-							/* Increase cycles */
-							stream->transport_wide_cc_cycles++;
-						}
-						/* Get extended value */
-						guint32 transport_ext_seq_num = stream->transport_wide_cc_cycles<<16 | transport_seq_num;
-						/* Store last received transport seq num */
-						stream->transport_wide_cc_last_seq_num = transport_seq_num;
-						/* Set stats values */
-						stats->transport_seq_num = transport_ext_seq_num;
-						stats->timestamp = (((guint64)now.tv_sec)*1E6+now.tv_usec);
-						/* Lock & append to received list*/
 						janus_mutex_lock(&stream->mutex);
-						stream->transport_wide_received_seq_nums = g_slist_prepend(stream->transport_wide_received_seq_nums, stats);
+						janus_ice_transport_wide_cc_received(stream, transport_seq_num, (((guint64)now.tv_sec)*1E6+now.tv_usec));
 						janus_mutex_unlock(&stream->mutex);
 					}
 				}
 				/* 将接收到的数据发送给相关的插件 */
 				janus_plugin *plugin = (janus_plugin *)handle->app;
-				if(plugin && plugin->incoming_rtp)
-					plugin->incoming_rtp(handle->app_handle, video, buf, buflen);
+				if(plugin && (plugin->incoming_rtp_shared || plugin->incoming_rtp)) {
+					if(recv_time > 0) {
+						/* Keep track of when the plugin got this, in case it relays it right away */
+						gint64 now = janus_get_monotonic_time();
+						janus_latency_record(handle->latency, JANUS_LATENCY_RECV_PLUGIN, now - recv_time);
+						janus_latency_mark(now);
+					}
+					if(plugin->incoming_rtp_shared) {
+						/* Copy the packet once: the plugin can then share it with all the handles it relays it to */
+						janus_plugin_rtp *packet = janus_plugin_rtp_new(video, buf, buflen);
+						plugin->incoming_rtp_shared(handle->app_handle, packet);
+						janus_plugin_rtp_unref(packet);
+					} else {
+						plugin->incoming_rtp(handle->app_handle, video, buf, buflen);
+					}
+					if(recv_time > 0)
+						janus_latency_mark(0);
+				}
 					
 				/* Restore the header for the stats (plugins may have messed with it) */
 				*header = backup;
@@ -2317,6 +3157,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						/* Overall audio data */
 						component->in_stats.audio.packets++;
 						component->in_stats.audio.bytes += buflen;
+						janus_metrics_inc(metric_packets_in[0]);
+						janus_metrics_add_value(metric_bytes_in[0], buflen);
 						/* Last second audio data */
 						if(component->in_stats.audio.updated == 0)
 							component->in_stats.audio.updated = now;
@@ -2336,6 +3178,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						/* Overall video data for this SSRC */
 						component->in_stats.video[vindex].packets++;
 						component->in_stats.video[vindex].bytes += buflen;
+						janus_metrics_inc(metric_packets_in[1]);
+						janus_metrics_add_value(metric_bytes_in[1], buflen);
 						/* Last second video data for this SSRC */
 						if(component->in_stats.video[vindex].updated == 0)
 							component->in_stats.video[vindex].updated = now;
@@ -2367,96 +3211,54 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					char *payload = janus_rtp_payload(buf, buflen, &plen);
 					if(stream->video_is_keyframe(payload, plen)) {
 						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Keyframe received, resetting NACK queue\n", handle->handle_id);
-						if(component->last_seqs_video[vindex])
-							janus_seq_list_free(&component->last_seqs_video[vindex]);
+						janus_mutex_lock(&component->mutex);
+						janus_rtp_seq_window_reset(component->last_seqs_video[vindex]);
+						janus_mutex_unlock(&component->mutex);
 					}
 				}
 				guint16 new_seqn = ntohs(header->seq_number);
-				guint16 cur_seqn;
-				int last_seqs_len = 0;
+				GSList *nacks = NULL;
+				gint64 now = janus_get_monotonic_time();
+				janus_rtp_seq_nack missing[JANUS_RTP_SEQ_WINDOW_LEN];
 				janus_mutex_lock(&component->mutex);
-				janus_seq_info **last_seqs = video ? &component->last_seqs_video[vindex] : &component->last_seqs_audio;
-				janus_seq_info *cur_seq = *last_seqs;
-				if(cur_seq) {
-					cur_seq = cur_seq->prev;
-					cur_seqn = cur_seq->seq;
-				} else {
-					/* First seq, set up to add one seq */
-					cur_seqn = new_seqn - (guint16)1; /* Can wrap */
+				janus_rtp_seq_window **window = video ? &component->last_seqs_video[vindex] : &component->last_seqs_audio;
+				if(*window == NULL) {
+					/* First packet we may have to NACK for this SSRC, make room for the receive window */
+					*window = g_malloc0(sizeof(janus_rtp_seq_window));
 				}
-				if(!janus_seq_in_range(new_seqn, cur_seqn, LAST_SEQS_MAX_LEN) &&
-						!janus_seq_in_range(cur_seqn, new_seqn, 1000)) {
-					/* Jump too big, start fresh */
+				janus_rtp_seq_window *last_seqs = *window;
+				guint16 cur_seqn = last_seqs->highest;
+				int missing_count = janus_rtp_seq_window_update(last_seqs, new_seqn, now, missing);
+				if(missing_count < 0) {
+					/* Jump too big, started fresh */
 					JANUS_LOG(LOG_WARN, "[%"SCNu64"] Big sequence number jump %hu -> %hu (%s stream #%d)\n",
 						handle->handle_id, cur_seqn, new_seqn, video ? "video" : "audio", vindex);
-					janus_seq_list_free(last_seqs);
-					cur_seq = NULL;
-					cur_seqn = new_seqn - (guint16)1;
 				}
-
-				GSList *nacks = NULL;
-				gint64 now = janus_get_monotonic_time();
-
-				if(janus_seq_in_range(new_seqn, cur_seqn, LAST_SEQS_MAX_LEN)) {
-					/* Add new seq objs forward */
-					while(cur_seqn != new_seqn) {
-						cur_seqn += (guint16)1; /* can wrap */
-						janus_seq_info *seq_obj = g_malloc0(sizeof(janus_seq_info));
-						seq_obj->seq = cur_seqn;
-						seq_obj->ts = now;
-						seq_obj->state = (cur_seqn == new_seqn) ? SEQ_RECVED : SEQ_MISSING;
-						janus_seq_append(last_seqs, seq_obj);
-						last_seqs_len++;
-					}
-				}
-				if(cur_seq) {
-					/* Scan old seq objs backwards */
-					while(cur_seq != NULL) {
-						last_seqs_len++;
-						if(cur_seq->seq == new_seqn) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Received missed sequence number %"SCNu16" (%s stream #%d)\n",
-								handle->handle_id, cur_seq->seq, video ? "video" : "audio", vindex);
-							cur_seq->state = SEQ_RECVED;
-						} else if(cur_seq->state == SEQ_MISSING && now - cur_seq->ts > SEQ_MISSING_WAIT) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Missed sequence number %"SCNu16" (%s stream #%d), sending 1st NACK\n",
-								handle->handle_id, cur_seq->seq, video ? "video" : "audio", vindex);
-							nacks = g_slist_append(nacks, GUINT_TO_POINTER(cur_seq->seq));
-							cur_seq->state = SEQ_NACKED;
-							if(video && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
-								/* Keep track of this sequence number, we need to avoid duplicates */
-								JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Tracking NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
-									handle->handle_id, cur_seq->seq, packet_ssrc, vindex);
-								if(stream->rtx_nacked[vindex] == NULL)
-									stream->rtx_nacked[vindex] = g_hash_table_new(NULL, NULL);
-								g_hash_table_insert(stream->rtx_nacked[vindex], GUINT_TO_POINTER(cur_seq->seq), GINT_TO_POINTER(1));
-								/* We don't track it forever, though: add a timed source to remove it in a few seconds */
-								janus_ice_nacked_packet *np = g_malloc(sizeof(janus_ice_nacked_packet));
-								np->handle = handle;
-								np->seq_number = new_seqn;
-								np->vindex = vindex;
-								GSource *timeout_source = g_timeout_source_new_seconds(5);
-								g_source_set_callback(timeout_source, janus_ice_nacked_packet_cleanup, np, (GDestroyNotify)g_free);
-								g_source_attach(timeout_source, handle->icectx);
-								g_source_unref(timeout_source);
-							}
-						} else if(cur_seq->state == SEQ_NACKED  && now - cur_seq->ts > SEQ_NACKED_WAIT) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Missed sequence number %"SCNu16" (%s stream #%d), sending 2nd NACK\n",
-								handle->handle_id, cur_seq->seq, video ? "video" : "audio", vindex);
-							nacks = g_slist_append(nacks, GUINT_TO_POINTER(cur_seq->seq));
-							cur_seq->state = SEQ_GIVEUP;
-						}
-						if(cur_seq == *last_seqs) {
-							/* Just processed head */
-							break;
-						}
-						cur_seq = cur_seq->prev;
+				/* NACKs are in sequence number order, so we build the list backwards */
+				int i = 0;
+				for(i=missing_count-1; i>=0; i--) {
+					guint16 seq = missing[i].seq;
+					JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Missed sequence number %"SCNu16" (%s stream #%d), sending %s NACK\n",
+						handle->handle_id, seq, video ? "video" : "audio", vindex, missing[i].retry ? "2nd" : "1st");
+					nacks = g_slist_prepend(nacks, GUINT_TO_POINTER(seq));
+					if(!missing[i].retry && video && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
+						/* Keep track of this sequence number, we need to avoid duplicates */
+						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Tracking NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
+							handle->handle_id, seq, packet_ssrc, vindex);
+						if(stream->rtx_nacked[vindex] == NULL)
+							stream->rtx_nacked[vindex] = g_hash_table_new(NULL, NULL);
+						g_hash_table_insert(stream->rtx_nacked[vindex], GUINT_TO_POINTER(seq), GINT_TO_POINTER(1));
+						/* We don't track it forever, though: add a timed source to remove it in a few seconds */
+						janus_ice_nacked_packet *np = g_malloc(sizeof(janus_ice_nacked_packet));
+						np->handle = handle;
+						np->seq_number = seq;
+						np->vindex = vindex;
+						GSource *timeout_source = g_timeout_source_new_seconds(5);
+						g_source_set_callback(timeout_source, janus_ice_nacked_packet_cleanup, np, (GDestroyNotify)g_free);
+						g_source_attach(timeout_source, handle->icectx);
+						g_source_unref(timeout_source);
 					}
 				}
-				while(last_seqs_len > LAST_SEQS_MAX_LEN) {
-					janus_seq_info *node = janus_seq_pop_head(last_seqs);
-					g_free(node);
-					last_seqs_len--;
-				}
 
 				guint nacks_count = g_slist_length(nacks);
 				if(nacks_count) {
@@ -2479,6 +3281,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					} else {
 						component->out_stats.audio.nacks += nacks_count;
 					}
+					janus_metrics_add_value(metric_nacks_out[video ? 1 : 0], nacks_count);
 					/* Inform the plugin about the slow downlink in case it's needed */
 					janus_slow_link_update(component, handle, nacks_count, video, 0, now);
 				}
@@ -2495,7 +3298,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 			}
 		}
 		return;
-	} else if(janus_is_rtcp(buf)) {
+	} else if(demux == JANUS_ICE_DEMUX_RTCP) {
 		/* This is RTCP */
 		JANUS_LOG(LOG_HUGE, "[%"SCNu64"]  Got an RTCP packet\n", handle->handle_id);
 		if(!component->dtls || !component->dtls->srtp_valid || !component->dtls->srtp_in) {
@@ -2504,14 +3307,18 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 			int buflen = len;
 			srtp_err_status_t res = srtp_unprotect_rtcp(component->dtls->srtp_in, buf, &buflen);
 			if(res != srtp_err_status_ok) {
+				janus_metrics_inc(metric_srtp_errors_in);
 				JANUS_LOG(LOG_ERR, "[%"SCNu64"]     SRTCP unprotect error: %s (len=%d-->%d)\n", handle->handle_id, janus_srtp_error_str(res), len, buflen);
 			} else {
 				/* Do we need to dump this packet for debugging? */
 				if(g_atomic_int_get(&handle->dump_packets))
 					janus_text2pcap_dump(handle->text2pcap, JANUS_TEXT2PCAP_RTCP, TRUE, buf, buflen,
 						"[session=%"SCNu64"][handle=%"SCNu64"]", session->session_id, handle->handle_id);
+				/* Walk the compound packet once, to know what's in there */
+				janus_rtcp_summary summary;
+				janus_rtcp_summarize(buf, buflen, &summary);
 				/* Check if there's an RTCP BYE: in case, let's log it */
-				if(janus_rtcp_has_bye(buf, buflen)) {
+				if(summary.has_bye) {
 					/* Note: we used to use this as a trigger to close the PeerConnection, but not anymore
 					 * Discussion here, https://groups.google.com/forum/#!topic/meetecho-janus/4XtfbYB7Jvc */
 					JANUS_LOG(LOG_VERB, "[%"SCNu64"] Got RTCP BYE on stream %"SCNu16" (component %"SCNu16")\n", handle->handle_id, stream->stream_id, component->component_id);
@@ -2532,14 +3339,17 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						/* We don't know the remote SSRC: this can happen for recvonly clients
 						 * (see https://groups.google.com/forum/#!topic/discuss-webrtc/5yuZjV7lkNc)
 						 * Check the local SSRC, compare it to what we have */
-						guint32 rtcp_ssrc = janus_rtcp_get_receiver_ssrc(buf, len);
+						guint32 rtcp_ssrc = summary.receiver_ssrc;
+						gboolean extra_video = FALSE;
 						if(rtcp_ssrc == stream->audio_ssrc) {
 							video = 0;
 						} else if(rtcp_ssrc == stream->video_ssrc) {
 							video = 1;
+						} else if(janus_ice_stream_find_extra_ssrc(stream, rtcp_ssrc, &extra_video)) {
+							video = extra_video;
 						} else {
 							/* Mh, no SR or RR? Try checking if there's any FIR, PLI or REMB */
-							if(janus_rtcp_has_fir(buf, len) || janus_rtcp_has_pli(buf, len) || janus_rtcp_get_remb(buf, len)) {
+							if(summary.has_fir || summary.has_pli || summary.remb_bitrate > 0) {
 								video = 1;
 							}
 						}
@@ -2548,30 +3358,30 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					} else {
 						/* Check the remote SSRC, compare it to what we have: in case
 						 * we're simulcasting, let's compare to the other SSRCs too */
-						guint32 rtcp_ssrc = janus_rtcp_get_sender_ssrc(buf, len);
-						if(rtcp_ssrc == stream->audio_ssrc_peer) {
-							video = 0;
-						} else if(rtcp_ssrc == stream->video_ssrc_peer[0]) {
-							video = 1;
-						} else if(stream->video_ssrc_peer[1] && rtcp_ssrc == stream->video_ssrc_peer[1]) {
-							video = 1;
-							vindex = 1;
-						} else if(stream->video_ssrc_peer[2] && rtcp_ssrc == stream->video_ssrc_peer[2]) {
-							video = 1;
-							vindex = 2;
+						guint32 rtcp_ssrc = summary.sender_ssrc;
+						janus_ice_ssrc_entry entry;
+						if(janus_ice_stream_find_ssrc(stream, rtcp_ssrc, &entry) && !entry.rtx) {
+							video = entry.video;
+							vindex = entry.vindex;
 						}
 						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Incoming RTCP, bundling: this is %s (remote SSRC: video=%"SCNu32" #%d, audio=%"SCNu32", got %"SCNu32")\n",
 							handle->handle_id, video ? "video" : "audio", stream->video_ssrc_peer[vindex], vindex, stream->audio_ssrc_peer, rtcp_ssrc);
 					}
 				}
 
-				/* Let's process this RTCP (compound?) packet, and update the RTCP context for this stream in case */
+				/* Let's process this RTCP (compound?) packet, and update the RTCP context for this stream in case,
+				 * unless it reports on one of the additional SSRCs the plugin is multiplexing: those are up to it */
 				rtcp_context *rtcp_ctx = video ? stream->video_rtcp_ctx[vindex] : stream->audio_rtcp_ctx;
-				janus_rtcp_parse(rtcp_ctx, buf, buflen);
+				if(summary.receiver_ssrc == 0 || !janus_ice_stream_find_extra_ssrc(stream, summary.receiver_ssrc, NULL))
+					janus_rtcp_parse(rtcp_ctx, buf, buflen);
+
+				/* Keep track of the bandwidth the peer says it has, as the pacer may need it */
+				if(video && summary.remb_bitrate > 0)
+					g_atomic_int_set(&handle->pacing_remb, summary.remb_bitrate > G_MAXINT ? G_MAXINT : (gint)summary.remb_bitrate);
 
-				/* Now let's see if there are any NACKs to handle */
+				/* Now let's see if there are any NACKs to handle (we only keep packets for our own SSRCs) */
 				gint64 now = janus_get_monotonic_time();
-				GSList *nacks = janus_rtcp_get_nacks(buf, buflen);
+				GSList *nacks = summary.has_nack ? janus_ice_stream_get_nacks(stream, buf, buflen) : NULL;
 				guint nacks_count = g_slist_length(nacks);
 				if(nacks_count && ((!video && component->do_audio_nacks) || (video && component->do_video_nacks))) {
 					/* Handle NACK */
@@ -2584,8 +3394,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						JANUS_LOG(LOG_DBG, "[%"SCNu64"]   >> %u\n", handle->handle_id, seqnr);
 						int in_rb = 0;
 						/* Check if we have the packet */
-						janus_rtp_packet *p = g_hash_table_lookup(video ?
-							component->video_retransmit_seqs : component->audio_retransmit_seqs, GUINT_TO_POINTER(seqnr));
+						janus_rtp_packet *p = janus_ice_retransmit_buffer_lookup(video ?
+							component->video_retransmit_buffer : component->audio_retransmit_buffer, seqnr);
 						if(p == NULL) {
 							JANUS_LOG(LOG_HUGE, "[%"SCNu64"]   >> >> Can't retransmit packet %u, we don't have it...\n", handle->handle_id, seqnr);
 						} else {
@@ -2600,10 +3410,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 							p->last_retransmit = now;
 							retransmits_cnt++;
 							/* Enqueue it */
-							janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-							pkt->data = g_malloc(p->length);
+							janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, p->length);
 							memcpy(pkt->data, p->data, p->length);
-							pkt->length = p->length;
 							pkt->type = video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
 							pkt->control = FALSE;
 							pkt->retransmission = TRUE;
@@ -2632,19 +3440,27 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						list = list->next;
 					}
 					component->retransmit_recent_cnt += retransmits_cnt;
-					/* FIXME Remove the NACK compound packet, we've handled it */
-					buflen = janus_rtcp_remove_nacks(buf, buflen);
+					janus_metrics_add_value(metric_retransmissions, retransmits_cnt);
+					/* FIXME Remove the NACK compound packets, we've handled them */
+					buflen = janus_ice_stream_remove_nacks(stream, buf, buflen, FALSE);
 					/* Update stats */
 					if(video) {
 						component->in_stats.video[vindex].nacks += nacks_count;
 					} else {
 						component->in_stats.audio.nacks += nacks_count;
 					}
+					janus_metrics_add_value(metric_nacks_in[video ? 1 : 0], nacks_count);
 					/* Inform the plugin about the slow uplink in case it's needed */
 					janus_slow_link_update(component, handle, retransmits_cnt, video, 1, now);
 					janus_mutex_unlock(&component->mutex);
-					g_slist_free(nacks);
-					nacks = NULL;
+				}
+				g_slist_free(nacks);
+				nacks = NULL;
+				if(summary.has_nack && g_atomic_int_get(&stream->extra_ssrcs_num) > 0) {
+					/* Plugins don't do anything with NACKs about the additional SSRCs they multiplex: we do */
+					guint retransmits_cnt = janus_ice_stream_retransmit_extra(handle, stream, component, buf, buflen, now);
+					janus_metrics_add_value(metric_retransmissions, retransmits_cnt);
+					buflen = janus_ice_stream_remove_nacks(stream, buf, buflen, TRUE);
 				}
 				if(component->retransmit_recent_cnt &&
 						now - component->retransmit_log_ts > 5*G_USEC_PER_SEC) {
@@ -2667,16 +3483,492 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		if(len > 0) {
 			component->in_stats.data.packets++;
 			component->in_stats.data.bytes += len;
+			janus_metrics_inc(metric_packets_in[2]);
+			janus_metrics_add_value(metric_bytes_in[2], len);
+		}
+		return;
+	}
+}
+
+/* Single port ICE muxing */
+typedef struct janus_ice_mux_packet {
+	/* Generation of the binding when the packet was received */
+	gint generation;
+	/* Whether this is the news of a nominated pair (data is a description) rather than a packet */
+	gboolean nominated;
+	guint len;
+	gchar *data;
+} janus_ice_mux_packet;
+
+/* Get rid of packets that were never delivered */
+static void janus_ice_mux_binding_flush(janus_ice_mux_binding *binding) {
+	janus_ice_mux_packet *pkt = NULL;
+	while((pkt = g_async_queue_try_pop(binding->incoming)) != NULL)
+		g_free(pkt);
+}
+
+static void janus_ice_mux_binding_unref(janus_ice_mux_binding *binding) {
+	if(binding == NULL || !g_atomic_int_dec_and_test(&binding->ref))
+		return;
+	g_free(binding->ufrag);
+	g_free(binding->pwd);
+	if(binding->icectx != NULL)
+		g_main_context_unref(binding->icectx);
+	if(binding->incoming != NULL) {
+		janus_ice_mux_binding_flush(binding);
+		g_async_queue_unref(binding->incoming);
+	}
+	janus_mutex_destroy(&binding->mutex);
+	g_free(binding);
+}
+
+static guint64 janus_ice_mux_address_key(struct sockaddr_in *address) {
+	return ((guint64)address->sin_addr.s_addr << 16) | address->sin_port;
+}
+
+/* Invoked on the loop of the handle, to process what a mux thread received */
+static void janus_ice_mux_deliver(janus_ice_mux_binding *binding, janus_ice_mux_packet *pkt) {
+	if(g_atomic_int_get(&binding->generation) != pkt->generation)
+		return;
+	janus_ice_handle *handle = binding->handle;
+	if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+		return;
+	janus_ice_stream *stream = handle->stream;
+	if(stream == NULL || stream->component == NULL)
+		return;
+	if(pkt->nominated) {
+		/* Emulate what libnice would notify us about in a non-muxed agent */
+		janus_ice_cb_component_state_changed(handle->agent, stream->stream_id, 1, NICE_COMPONENT_STATE_READY, handle);
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] New selected pair (muxed): %s\n", handle->handle_id, pkt->data);
+		janus_ice_selected_pair_set(handle, stream->component, pkt->data);
+		return;
+	}
+	janus_ice_cb_nice_recv(handle->agent, stream->stream_id, 1, pkt->len, pkt->data, stream->component);
+}
+
+/* Each binding has a source on the handle loop, which drains its queue of incoming packets */
+typedef struct janus_ice_mux_source {
+	GSource parent;
+	janus_ice_mux_binding *binding;
+} janus_ice_mux_source;
+
+static gboolean janus_ice_mux_source_prepare(GSource *source, gint *timeout) {
+	*timeout = -1;
+	return g_async_queue_length(((janus_ice_mux_source *)source)->binding->incoming) > 0;
+}
+
+static gboolean janus_ice_mux_source_check(GSource *source) {
+	return g_async_queue_length(((janus_ice_mux_source *)source)->binding->incoming) > 0;
+}
+
+static gboolean janus_ice_mux_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+	janus_ice_mux_binding *binding = ((janus_ice_mux_source *)source)->binding;
+	/* Only handle what's queued right now, so that we don't starve the other sources */
+	gint pending = g_async_queue_length(binding->incoming);
+	janus_ice_mux_packet *pkt = NULL;
+	while(pending-- > 0 && (pkt = g_async_queue_try_pop(binding->incoming)) != NULL) {
+		janus_ice_mux_deliver(binding, pkt);
+		g_free(pkt);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+static void janus_ice_mux_source_finalize(GSource *source) {
+	janus_ice_mux_binding_unref(((janus_ice_mux_source *)source)->binding);
+}
+
+static GSourceFuncs janus_ice_mux_source_funcs = {
+	janus_ice_mux_source_prepare,
+	janus_ice_mux_source_check,
+	janus_ice_mux_source_dispatch,
+	janus_ice_mux_source_finalize,
+	NULL, NULL
+};
+
+/* Helper to pass a packet (or a nominated pair) to the handle loop: the caller
+ * must hold a reference to the binding, and one to the context (or the lock) */
+static void janus_ice_mux_dispatch(janus_ice_mux_binding *binding, GMainContext *icectx, gboolean nominated, const char *buf, guint len) {
+	janus_ice_mux_packet *pkt = g_malloc(sizeof(janus_ice_mux_packet) + len);
+	pkt->generation = g_atomic_int_get(&binding->generation);
+	pkt->nominated = nominated;
+	pkt->len = len;
+	pkt->data = (gchar *)pkt + sizeof(janus_ice_mux_packet);
+	memcpy(pkt->data, buf, len);
+	g_async_queue_push(binding->incoming, pkt);
+	g_main_context_wakeup(icectx);
+}
+
+/* Short term credentials lookup for the STUN agent: the local ufrag comes first in the USERNAME */
+static bool janus_ice_mux_stun_credentials(StunAgent *agent, StunMessage *message,
+		uint8_t *username, uint16_t username_len, uint8_t **password, size_t *password_len, void *user_data) {
+	janus_ice_mux_binding **found = (janus_ice_mux_binding **)user_data;
+	char ufrag[256];
+	uint16_t i = 0;
+	while(i < username_len && i < sizeof(ufrag)-1 && username[i] != ':') {
+		ufrag[i] = username[i];
+		i++;
+	}
+	ufrag[i] = '\0';
+	/* We're invoked with the write lock held */
+	janus_ice_mux_binding *binding = g_hash_table_lookup(janus_ice_mux_ufrags, ufrag);
+	if(binding == NULL || binding->pwd == NULL)
+		return FALSE;
+	*password = (uint8_t *)binding->pwd;
+	*password_len = strlen(binding->pwd);
+	*found = binding;
+	return TRUE;
+}
+
+static void janus_ice_mux_incoming(int fd, StunAgent *stun, uint64_t tie, char *buf, guint len, struct sockaddr_storage *address, socklen_t addrlen) {
+	struct sockaddr_in *remote = (struct sockaddr_in *)address;
+	guint64 key = janus_ice_mux_address_key(remote);
+	janus_ice_mux_binding *binding = NULL;
+	if(stun_message_validate_buffer_length((uint8_t *)buf, len, TRUE) != (int)len) {
+		/* Not STUN: we only accept packets from addresses a peer nominated. We
+		 * only hold the lock to find the binding, not to queue the packet */
+		GMainContext *icectx = NULL;
+		g_rw_lock_reader_lock(&janus_ice_mux_lock);
+		binding = g_hash_table_lookup(janus_ice_mux_addresses, &key);
+		if(binding != NULL && binding->icectx != NULL) {
+			g_atomic_int_inc(&binding->ref);
+			icectx = g_main_context_ref(binding->icectx);
+		} else {
+			binding = NULL;
+		}
+		g_rw_lock_reader_unlock(&janus_ice_mux_lock);
+		if(binding == NULL)
+			return;
+		janus_ice_mux_dispatch(binding, icectx, FALSE, buf, len);
+		g_main_context_unref(icectx);
+		janus_ice_mux_binding_unref(binding);
+		return;
+	}
+	/* Make sure this is a valid connectivity check for one of our agents */
+	g_rw_lock_writer_lock(&janus_ice_mux_lock);
+	StunMessage msg;
+	StunValidationStatus status = stun_agent_validate(stun, &msg, (uint8_t *)buf, len, janus_ice_mux_stun_credentials, &binding);
+	if(status != STUN_VALIDATION_SUCCESS || binding == NULL ||
+			stun_message_get_class(&msg) != STUN_REQUEST || stun_message_get_method(&msg) != STUN_BINDING) {
+		g_rw_lock_writer_unlock(&janus_ice_mux_lock);
+		JANUS_LOG(LOG_HUGE, "Ignoring STUN message on the ICE mux socket (validation status %d)\n", status);
+		return;
+	}
+	StunMessage response;
+	uint8_t reply[JANUS_ICE_MUX_BUFSIZE];
+	size_t reply_len = sizeof(reply);
+	bool control = FALSE;
+	StunUsageIceReturn res = stun_usage_ice_conncheck_create_reply(stun, &msg, &response, reply, &reply_len,
+		address, addrlen, &control, tie, STUN_USAGE_ICE_COMPATIBILITY_RFC5245);
+	if(res != STUN_USAGE_ICE_RETURN_SUCCESS) {
+		g_rw_lock_writer_unlock(&janus_ice_mux_lock);
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Error creating the response to a connectivity check (%d)\n", binding->handle->handle_id, res);
+		return;
+	}
+	if(sendto(fd, reply, reply_len, 0, (struct sockaddr *)address, addrlen) < 0) {
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Error sending the response to a connectivity check: %d (%s)\n",
+			binding->handle->handle_id, errno, strerror(errno));
+	}
+	if(stun_usage_ice_conncheck_use_candidate(&msg) && binding->remote_key != key) {
+		/* The peer nominated this address: media will come from (and go to) there */
+		janus_ice_mux_binding *previous = g_hash_table_lookup(janus_ice_mux_addresses, &key);
+		if(previous != NULL) {
+			/* Another binding was using this address: the table entry points to its
+			 * key, so remove the entry before touching that, and stop sending there */
+			g_hash_table_remove(janus_ice_mux_addresses, &key);
+			previous->remote_key = 0;
+			janus_mutex_lock(&previous->mutex);
+			previous->fd = -1;
+			memset(&previous->remote, 0, sizeof(previous->remote));
+			janus_mutex_unlock(&previous->mutex);
+		}
+		if(binding->remote_key != 0)
+			g_hash_table_remove(janus_ice_mux_addresses, &binding->remote_key);
+		janus_mutex_lock(&binding->mutex);
+		binding->remote = *remote;
+		binding->fd = fd;
+		janus_mutex_unlock(&binding->mutex);
+		binding->remote_key = key;
+		g_hash_table_insert(janus_ice_mux_addresses, &binding->remote_key, binding);
+		char raddress[INET_ADDRSTRLEN], sp[200];
+		inet_ntop(AF_INET, &remote->sin_addr, raddress, sizeof(raddress));
+		g_snprintf(sp, sizeof(sp), "0.0.0.0:%"SCNu16" [host,udp] <-> %s:%"SCNu16" [prflx,udp]",
+			janus_ice_mux_port, raddress, ntohs(remote->sin_port));
+		if(binding->icectx != NULL)
+			janus_ice_mux_dispatch(binding, binding->icectx, TRUE, sp, strlen(sp)+1);
+	}
+	g_rw_lock_writer_unlock(&janus_ice_mux_lock);
+}
+
+static void *janus_ice_mux_thread(void *data) {
+	int fd = GPOINTER_TO_INT(data);
+	JANUS_LOG(LOG_VERB, "ICE mux thread started (socket %d)\n", fd);
+	janus_affinity_pin_thread(-1);
+	StunAgent stun;
+	stun_agent_init(&stun, STUN_ALL_KNOWN_ATTRIBUTES, STUN_COMPATIBILITY_RFC5389,
+		STUN_AGENT_USAGE_SHORT_TERM_CREDENTIALS | STUN_AGENT_USAGE_USE_FINGERPRINT);
+	uint64_t tie = ((uint64_t)janus_random_uint32() << 32) | janus_random_uint32();
+	char buffer[JANUS_ICE_MUX_BUFSIZE];
+	struct sockaddr_storage remote;
+	socklen_t addrlen = 0;
+	struct pollfd fds;
+	while(!g_atomic_int_get(&janus_ice_mux_stopping)) {
+		fds.fd = fd;
+		fds.events = POLLIN;
+		fds.revents = 0;
+		int res = poll(&fds, 1, 1000);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "Error polling the ICE mux socket: %d (%s)\n", errno, strerror(errno));
+			break;
+		}
+		if(res == 0 || !(fds.revents & POLLIN))
+			continue;
+		/* Drain the socket before polling again */
+		while(TRUE) {
+			addrlen = sizeof(remote);
+			ssize_t len = recvfrom(fd, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr *)&remote, &addrlen);
+			if(len <= 0)
+				break;
+			if(remote.ss_family != AF_INET)
+				continue;
+			janus_ice_mux_incoming(fd, &stun, tie, buffer, len, &remote, addrlen);
+		}
+	}
+	JANUS_LOG(LOG_VERB, "ICE mux thread leaving (socket %d)\n", fd);
+	return NULL;
+}
+
+int janus_ice_set_mux_port(uint16_t port, int sockets) {
+	if(port == 0)
+		return 0;
+	if(!janus_ice_lite_enabled) {
+		JANUS_LOG(LOG_WARN, "Single port ICE muxing is only supported in ICE Lite mode, disabling\n");
+		return -1;
+	}
+	if(sockets < 1)
+		sockets = 1;
+	if(sockets > JANUS_ICE_MUX_MAX_SOCKETS) {
+		JANUS_LOG(LOG_WARN, "Too many ICE mux sockets (%d), using %d\n", sockets, JANUS_ICE_MUX_MAX_SOCKETS);
+		sockets = JANUS_ICE_MUX_MAX_SOCKETS;
+	}
+#ifndef SO_REUSEPORT
+	if(sockets > 1) {
+		JANUS_LOG(LOG_WARN, "SO_REUSEPORT unavailable, using a single ICE mux socket\n");
+		sockets = 1;
+	}
+#endif
+	int i = 0;
+	for(i=0; i<sockets; i++) {
+		int fd = socket(AF_INET, SOCK_DGRAM, 0);
+		int yes = 1;
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = INADDR_ANY;
+		if(fd < 0 ||
+#ifdef SO_REUSEPORT
+				(sockets > 1 && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) ||
+#endif
+				bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+			JANUS_LOG(LOG_FATAL, "Error binding the ICE mux socket to port %"SCNu16": %d (%s)\n", port, errno, strerror(errno));
+			if(fd >= 0)
+				close(fd);
+			while(i > 0)
+				close(janus_ice_mux_fds[--i]);
+			return -1;
+		}
+		(void)yes;
+		janus_ice_mux_fds[i] = fd;
+	}
+	janus_ice_mux_ufrags = g_hash_table_new(g_str_hash, g_str_equal);
+	janus_ice_mux_addresses = g_hash_table_new(g_int64_hash, g_int64_equal);
+	janus_ice_mux_sockets = sockets;
+	janus_ice_mux_port = port;
+	/* The agents won't gather, so there's nothing to trickle nor any TCP candidate */
+	if(janus_full_trickle_enabled) {
+		JANUS_LOG(LOG_WARN, "Full-trickle is not supported when muxing ICE on a single port, disabling\n");
+		janus_full_trickle_enabled = FALSE;
+	}
+	if(janus_ice_tcp_enabled) {
+		JANUS_LOG(LOG_WARN, "ICE-TCP is not supported when muxing ICE on a single port, disabling\n");
+		janus_ice_tcp_enabled = FALSE;
+	}
+	for(i=0; i<sockets; i++) {
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "icemux %d", i);
+		janus_ice_mux_threads[i] = g_thread_try_new(tname, &janus_ice_mux_thread, GINT_TO_POINTER(janus_ice_mux_fds[i]), &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch the ICE mux thread...\n", error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			janus_ice_mux_threads[i] = NULL;
+			janus_ice_mux_stop();
+			return -1;
 		}
+	}
+	JANUS_LOG(LOG_INFO, "Muxing ICE on UDP port %"SCNu16" (%d socket%s)\n", port, sockets, sockets > 1 ? "s" : "");
+	return 0;
+}
+
+uint16_t janus_ice_get_mux_port(void) {
+	return janus_ice_mux_port;
+}
+
+static void janus_ice_mux_stop(void) {
+	if(janus_ice_mux_sockets == 0)
+		return;
+	g_atomic_int_set(&janus_ice_mux_stopping, 1);
+	int i = 0;
+	for(i=0; i<janus_ice_mux_sockets; i++) {
+		if(janus_ice_mux_threads[i] != NULL)
+			g_thread_join(janus_ice_mux_threads[i]);
+		janus_ice_mux_threads[i] = NULL;
+		close(janus_ice_mux_fds[i]);
+	}
+	janus_ice_mux_sockets = 0;
+	janus_ice_mux_port = 0;
+	/* Bindings are owned by their handles, we only drop the indexes */
+	g_rw_lock_writer_lock(&janus_ice_mux_lock);
+	g_hash_table_destroy(janus_ice_mux_ufrags);
+	janus_ice_mux_ufrags = NULL;
+	g_hash_table_destroy(janus_ice_mux_addresses);
+	janus_ice_mux_addresses = NULL;
+	g_rw_lock_writer_unlock(&janus_ice_mux_lock);
+}
+
+/* Indexes the current local credentials of the handle (again, after an ICE restart) */
+static void janus_ice_mux_register(janus_ice_handle *handle) {
+	gchar *ufrag = NULL, *pwd = NULL;
+	if(!nice_agent_get_local_credentials(handle->agent, handle->stream_id, &ufrag, &pwd)) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Couldn't get the local credentials to mux...\n", handle->handle_id);
+		return;
+	}
+	g_rw_lock_writer_lock(&janus_ice_mux_lock);
+	if(janus_ice_mux_ufrags == NULL) {
+		g_rw_lock_writer_unlock(&janus_ice_mux_lock);
+		g_free(ufrag);
+		g_free(pwd);
+		return;
+	}
+	janus_ice_mux_binding *binding = handle->mux_binding;
+	if(binding == NULL) {
+		binding = g_malloc0(sizeof(janus_ice_mux_binding));
+		binding->handle = handle;
+		binding->fd = -1;
+		janus_mutex_init(&binding->mutex);
+		binding->incoming = g_async_queue_new();
+		g_atomic_int_set(&binding->ref, 1);
+		handle->mux_binding = binding;
+	}
+	if(binding->ufrag != NULL) {
+		if(g_hash_table_lookup(janus_ice_mux_ufrags, binding->ufrag) == binding)
+			g_hash_table_remove(janus_ice_mux_ufrags, binding->ufrag);
+		g_free(binding->ufrag);
+		g_free(binding->pwd);
+	}
+	binding->ufrag = ufrag;
+	binding->pwd = pwd;
+	if(binding->icectx == NULL)
+		binding->icectx = g_main_context_ref(handle->icectx);
+	if(binding->source == NULL) {
+		/* Media has the same priority it would have, were libnice reading the socket */
+		binding->source = g_source_new(&janus_ice_mux_source_funcs, sizeof(janus_ice_mux_source));
+		g_atomic_int_inc(&binding->ref);
+		((janus_ice_mux_source *)binding->source)->binding = binding;
+		g_source_set_priority(binding->source, G_PRIORITY_DEFAULT);
+		g_source_attach(binding->source, binding->icectx);
+	}
+	g_hash_table_insert(janus_ice_mux_ufrags, binding->ufrag, binding);
+	g_rw_lock_writer_unlock(&janus_ice_mux_lock);
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Muxing ICE on port %"SCNu16" (ufrag %s)\n", handle->handle_id, janus_ice_mux_port, ufrag);
+}
+
+static void janus_ice_mux_unregister(janus_ice_handle *handle) {
+	janus_ice_mux_binding *binding = handle->mux_binding;
+	if(binding == NULL)
+		return;
+	g_rw_lock_writer_lock(&janus_ice_mux_lock);
+	g_atomic_int_inc(&binding->generation);
+	if(binding->ufrag != NULL && janus_ice_mux_ufrags != NULL &&
+			g_hash_table_lookup(janus_ice_mux_ufrags, binding->ufrag) == binding)
+		g_hash_table_remove(janus_ice_mux_ufrags, binding->ufrag);
+	g_free(binding->ufrag);
+	binding->ufrag = NULL;
+	g_free(binding->pwd);
+	binding->pwd = NULL;
+	if(binding->remote_key != 0 && janus_ice_mux_addresses != NULL &&
+			g_hash_table_lookup(janus_ice_mux_addresses, &binding->remote_key) == binding)
+		g_hash_table_remove(janus_ice_mux_addresses, &binding->remote_key);
+	binding->remote_key = 0;
+	if(binding->source != NULL) {
+		g_source_destroy(binding->source);
+		g_source_unref(binding->source);
+		binding->source = NULL;
+	}
+	if(binding->icectx != NULL)
+		g_main_context_unref(binding->icectx);
+	binding->icectx = NULL;
+	janus_mutex_lock(&binding->mutex);
+	binding->fd = -1;
+	janus_mutex_unlock(&binding->mutex);
+	g_rw_lock_writer_unlock(&janus_ice_mux_lock);
+	/* Packets queued by mux threads that found the binding before we removed it are dropped */
+	janus_ice_mux_binding_flush(binding);
+}
+
+static gint janus_ice_mux_send(janus_ice_mux_binding *binding, gint len, const gchar *buf) {
+	janus_mutex_lock(&binding->mutex);
+	int fd = binding->fd;
+	struct sockaddr_in remote = binding->remote;
+	janus_mutex_unlock(&binding->mutex);
+	if(fd < 0)
+		return -1;
+	return sendto(fd, buf, len, 0, (struct sockaddr *)&remote, sizeof(remote));
+}
+
+/* All agents share the same host candidates: the local addresses, on the mux port */
+static void janus_ice_mux_candidates_to_sdp(janus_ice_handle *handle, janus_sdp_mline *mline) {
+	if(nat_1_1_enabled) {
+		/* A 1:1 NAT mapping was specified, the public address is the only one to advertise */
+		janus_sdp_attribute *a = janus_sdp_attribute_create("candidate", "1 1 udp %d %s %"SCNu16" typ host",
+			2113937151, janus_get_public_ip(), janus_ice_mux_port);
+		mline->attributes = g_list_append(mline->attributes, a);
 		return;
 	}
+	janus_mutex_lock(&local_addresses_mutex);
+	guint i = 0, count = 0;
+	for(i=0; local_addresses != NULL && i<local_addresses->len; i++) {
+		NiceAddress *address = &g_array_index(local_addresses, NiceAddress, i);
+		if(nice_address_ip_version(address) != 4)
+			continue;
+		gchar ip[NICE_ADDRESS_STRING_LEN];
+		nice_address_to_string(address, ip);
+		janus_sdp_attribute *a = janus_sdp_attribute_create("candidate", "%u 1 udp %u %s %"SCNu16" typ host",
+			count+1, 2113937151 - count*256, ip, janus_ice_mux_port);
+		mline->attributes = g_list_append(mline->attributes, a);
+		count++;
+	}
+	janus_mutex_unlock(&local_addresses_mutex);
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Added %u muxed candidates\n", handle->handle_id, count);
+}
+
+gint janus_ice_component_send(janus_ice_handle *handle, janus_ice_component *component, gint len, const gchar *buf) {
+	if(handle->mux_binding != NULL)
+		return janus_ice_mux_send(handle->mux_binding, len, buf);
+	return nice_agent_send(handle->agent, component->stream_id, component->component_id, len, buf);
 }
 
-void janus_ice_incoming_data(janus_ice_handle *handle, char *buffer, int length) {
+void janus_ice_incoming_data(janus_ice_handle *handle, gboolean binary, char *buffer, int length) {
 	if(handle == NULL || buffer == NULL || length <= 0)
 		return;
 	janus_plugin *plugin = (janus_plugin *)handle->app;
-	if(plugin && plugin->incoming_data)
+	if(plugin == NULL)
+		return;
+	if(binary && plugin->incoming_binary_data)
+		plugin->incoming_binary_data(handle->app_handle, buffer, length);
+	else if(plugin->incoming_data)
 		plugin->incoming_data(handle->app_handle, buffer, length);
 }
 
@@ -2685,6 +3977,7 @@ void janus_ice_incoming_data(janus_ice_handle *handle, char *buffer, int length)
 void *janus_ice_thread(void *data) {
 	janus_ice_handle *handle = data;
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] ICE thread started\n", handle->handle_id);
+	janus_affinity_pin_thread(janus_affinity_group_node(handle->placement_group));
 	GMainLoop *loop = handle->iceloop;
 	if(loop == NULL) {
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Invalid loop...\n", handle->handle_id);
@@ -2881,6 +4174,11 @@ void janus_ice_candidates_to_sdp(janus_ice_handle *handle, janus_sdp_mline *mlin
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"]     No component %d in stream %d??\n", handle->handle_id, component_id, stream_id);
 		return;
 	}
+	if(janus_ice_mux_port > 0) {
+		/* The agent didn't gather anything, advertise the mux port */
+		janus_ice_mux_candidates_to_sdp(handle, mline);
+		return;
+	}
 	NiceAgent *agent = handle->agent;
 	/* Iterate on all */
 	gchar buffer[200];
@@ -2969,6 +4267,67 @@ void janus_ice_setup_remote_candidates(janus_ice_handle *handle, guint stream_id
 	}
 }
 
+/* Refreshes the cached local addresses: must be called with local_addresses_mutex held */
+static void janus_ice_local_addresses_refresh(void) {
+	if(local_addresses == NULL)
+		local_addresses = g_array_new(FALSE, FALSE, sizeof(NiceAddress));
+	g_array_set_size(local_addresses, 0);
+	struct ifaddrs *ifaddr, *ifa;
+	int family, s, n;
+	char host[NI_MAXHOST];
+	if(getifaddrs(&ifaddr) == -1) {
+		JANUS_LOG(LOG_ERR, "Error getting list of interfaces...\n");
+	} else {
+		for(ifa = ifaddr, n = 0; ifa != NULL; ifa = ifa->ifa_next, n++) {
+			if(ifa->ifa_addr == NULL)
+				continue;
+			/* Skip interfaces which are not up and running */
+			if (!((ifa->ifa_flags & IFF_UP) && (ifa->ifa_flags & IFF_RUNNING)))
+				continue;
+			/* Skip loopback interfaces */
+			if (ifa->ifa_flags & IFF_LOOPBACK)
+				continue;
+			family = ifa->ifa_addr->sa_family;
+			if(family != AF_INET && family != AF_INET6)
+				continue;
+			/* We only add IPv6 addresses if support for them has been explicitly enabled (still WIP, mostly) */
+			if(family == AF_INET6 && !janus_ipv6_enabled)
+				continue;
+			/* Check the interface name first, we can ignore that as well: enforce list would be checked later */
+			if(janus_ice_enforce_list == NULL && ifa->ifa_name != NULL && janus_ice_is_ignored(ifa->ifa_name))
+				continue;
+			s = getnameinfo(ifa->ifa_addr,
+					(family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6),
+					host, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
+			if(s != 0) {
+				JANUS_LOG(LOG_ERR, "getnameinfo() failed: %s\n", gai_strerror(s));
+				continue;
+			}
+			/* Skip 0.0.0.0, :: and local scoped addresses  */
+			if(!strcmp(host, "0.0.0.0") || !strcmp(host, "::") || !strncmp(host, "fe80:", 5))
+				continue;
+			/* Check if this IP address is in the ignore/enforce list, now: the enforce list has the precedence */
+			if(janus_ice_enforce_list != NULL) {
+				if(ifa->ifa_name != NULL && !janus_ice_is_enforced(ifa->ifa_name) && !janus_ice_is_enforced(host))
+					continue;
+			} else {
+				if(janus_ice_is_ignored(host))
+					continue;
+			}
+			/* Ok, add interface to the list */
+			JANUS_LOG(LOG_VERB, "Adding %s to the addresses to gather candidates for\n", host);
+			NiceAddress addr_local;
+			nice_address_init (&addr_local);
+			if(!nice_address_set_from_string (&addr_local, host)) {
+				JANUS_LOG(LOG_WARN, "Skipping invalid address %s\n", host);
+				continue;
+			}
+			g_array_append_val(local_addresses, addr_local);
+		}
+		freeifaddrs(ifaddr);
+	}
+}
+
 int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int video, int data, int trickle) {
 	if(!handle)
 		return -1;
@@ -3016,8 +4375,17 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_TRICKLE_SYNCED);
 
 	// The Main Event Loop 	https://developer.gnome.org/glib/2.56/glib-The-Main-Event-Loop.html
-	handle->icectx = g_main_context_new();  //	Creates a new GMainContext structure.
-	handle->iceloop = g_main_loop_new(handle->icectx, FALSE);	// Creates a new GMainLoop structure.
+	handle->static_event_loop = janus_ice_static_event_loop_pick(handle);
+	g_atomic_int_set(&handle->static_event_loop_released, 0);
+	if(handle->static_event_loop != NULL) {
+		/* Use the shared loop: we keep references, so that janus_ice_webrtc_free works the same way */
+		handle->icectx = g_main_context_ref(handle->static_event_loop->mainctx);
+		handle->iceloop = g_main_loop_ref(handle->static_event_loop->mainloop);
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Attached to static event loop #%d\n", handle->handle_id, handle->static_event_loop->id);
+	} else {
+		handle->icectx = g_main_context_new();  //	Creates a new GMainContext structure.
+		handle->iceloop = g_main_loop_new(handle->icectx, FALSE);	// Creates a new GMainLoop structure.
+	}
 	/* Note: NICE_COMPATIBILITY_RFC5245 is only available in more recent versions of libnice */
 	handle->controlling = janus_ice_lite_enabled ? FALSE : !offer;
 	JANUS_LOG(LOG_INFO, "[%"SCNu64"] Creating ICE agent (ICE %s mode, %s)\n", handle->handle_id,
@@ -3035,8 +4403,9 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 	handle->agent_created = janus_get_monotonic_time();
 	handle->srtp_errors_count = 0;
 	handle->last_srtp_error = 0;
-	/* Any STUN server to use? */
-	if(janus_stun_server != NULL && janus_stun_port > 0) {
+	/* Any STUN server to use? In ICE Lite mode with a 1:1 NAT mapping, the public
+	 * address is known already, and srflx candidates would only delay the answer */
+	if(janus_stun_server != NULL && janus_stun_port > 0 && !(janus_ice_lite_enabled && nat_1_1_enabled)) {
 		g_object_set(G_OBJECT(handle->agent),
 			"stun-server", janus_stun_server,
 			"stun-server-port", janus_stun_port,
@@ -3089,60 +4458,17 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 		G_CALLBACK (janus_ice_cb_new_remote_candidate), handle);
 
 	/* 添加所有本地地址，除了忽略列表中的地址*/
-	struct ifaddrs *ifaddr, *ifa;
-	int family, s, n;
-	char host[NI_MAXHOST];
-	if(getifaddrs(&ifaddr) == -1) {
-		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error getting list of interfaces...", handle->handle_id);
-	} else {
-		for(ifa = ifaddr, n = 0; ifa != NULL; ifa = ifa->ifa_next, n++) {
-			if(ifa->ifa_addr == NULL)
-				continue;
-			/* Skip interfaces which are not up and running */
-			if (!((ifa->ifa_flags & IFF_UP) && (ifa->ifa_flags & IFF_RUNNING)))
-				continue;
-			/* Skip loopback interfaces */
-			if (ifa->ifa_flags & IFF_LOOPBACK)
-				continue;
-			family = ifa->ifa_addr->sa_family;
-			if(family != AF_INET && family != AF_INET6)
-				continue;
-			/* We only add IPv6 addresses if support for them has been explicitly enabled (still WIP, mostly) */
-			if(family == AF_INET6 && !janus_ipv6_enabled)
-				continue;
-			/* Check the interface name first, we can ignore that as well: enforce list would be checked later */
-			if(janus_ice_enforce_list == NULL && ifa->ifa_name != NULL && janus_ice_is_ignored(ifa->ifa_name))
-				continue;
-			s = getnameinfo(ifa->ifa_addr,
-					(family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6),
-					host, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
-			if(s != 0) {
-				JANUS_LOG(LOG_ERR, "[%"SCNu64"] getnameinfo() failed: %s\n", handle->handle_id, gai_strerror(s));
-				continue;
-			}
-			/* Skip 0.0.0.0, :: and local scoped addresses  */
-			if(!strcmp(host, "0.0.0.0") || !strcmp(host, "::") || !strncmp(host, "fe80:", 5))
-				continue;
-			/* Check if this IP address is in the ignore/enforce list, now: the enforce list has the precedence */
-			if(janus_ice_enforce_list != NULL) {
-				if(ifa->ifa_name != NULL && !janus_ice_is_enforced(ifa->ifa_name) && !janus_ice_is_enforced(host))
-					continue;
-			} else {
-				if(janus_ice_is_ignored(host))
-					continue;
-			}
-			/* Ok, add interface to the ICE agent */
-			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Adding %s to the addresses to gather candidates for\n", handle->handle_id, host);
-			NiceAddress addr_local;
-			nice_address_init (&addr_local);
-			if(!nice_address_set_from_string (&addr_local, host)) {
-				JANUS_LOG(LOG_WARN, "[%"SCNu64"] Skipping invalid address %s\n", handle->handle_id, host);
-				continue;
-			}
-			nice_agent_add_local_address (handle->agent, &addr_local);
-		}
-		freeifaddrs(ifaddr);
-	}
+	janus_mutex_lock(&local_addresses_mutex);
+	gint64 now = janus_get_monotonic_time();
+	if(local_addresses == NULL || now - local_addresses_updated >= JANUS_ICE_LOCAL_ADDRESSES_TTL) {
+		janus_ice_local_addresses_refresh();
+		local_addresses_updated = now;
+	}
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Adding %u addresses to gather candidates for\n", handle->handle_id, local_addresses->len);
+	guint i = 0;
+	for(i=0; i<local_addresses->len; i++)
+		nice_agent_add_local_address(handle->agent, &g_array_index(local_addresses, NiceAddress, i));
+	janus_mutex_unlock(&local_addresses_mutex);
 
 	handle->cdone = 0;
 	handle->stream_id = 0;
@@ -3235,7 +4561,13 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 	/* FIXME: libnice supports this since 0.1.0, but the 0.1.3 on Fedora fails with an undefined reference! */
 	nice_agent_set_port_range(handle->agent, handle->stream_id, 1, rtp_range_min, rtp_range_max);
 #endif
-	nice_agent_gather_candidates(handle->agent, handle->stream_id);
+	if(janus_ice_mux_port > 0) {
+		/* All handles share the mux sockets: there's nothing to gather, so we're done already */
+		janus_ice_mux_register(handle);
+		janus_ice_cb_candidate_gathering_done(handle->agent, handle->stream_id, handle);
+	} else {
+		nice_agent_gather_candidates(handle->agent, handle->stream_id);
+	}
 	// 接收数据的回调
 	nice_agent_attach_recv(handle->agent, handle->stream_id, 1, g_main_loop_get_context(handle->iceloop), janus_ice_cb_nice_recv, component);
 #ifdef HAVE_LIBCURL
@@ -3252,6 +4584,10 @@ int janus_ice_setup_local(janus_ice_handle *handle, int offer, int audio, int vi
 		janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AGENT);
 		return -1;
 	}
+	if(handle->static_event_loop != NULL) {
+		/* The shared loop is already running, no need for a dedicated thread */
+		return 0;
+	}
 	GError *error = NULL;
 	char tname[16];
 	g_snprintf(tname, sizeof(tname), "iceloop %"SCNu64, handle->handle_id);
@@ -3272,6 +4608,9 @@ void janus_ice_restart(janus_ice_handle *handle) {
 	if(nice_agent_restart(handle->agent) == FALSE) {
 		JANUS_LOG(LOG_WARN, "[%"SCNu64"] ICE restart failed...\n", handle->handle_id);
 	}
+	/* The credentials changed: checks will be matched on the new ones */
+	if(janus_ice_mux_port > 0)
+		janus_ice_mux_register(handle);
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ICE_RESTART);
 }
 
@@ -3306,161 +4645,166 @@ void janus_ice_resend_trickles(janus_ice_handle *handle) {
 	janus_ice_notify_trickle(handle, NULL);
 }
 
-static gint rtcp_transport_wide_cc_stats_comparator(gconstpointer item1, gconstpointer item2) {
-	return ((rtcp_transport_wide_cc_stats*)item1)->transport_seq_num - ((rtcp_transport_wide_cc_stats*)item2)->transport_seq_num;
+/* Helpers for the outgoing traffic: these are used by the ICE send thread
+ * and, when loop_send is enabled, by the sources attached to the ICE loop */
+static void janus_ice_outgoing_reset_lastsec(janus_ice_handle *handle, gint64 now) {
+	/* Reset the last second counters if too much time passed with no data in or out */
+	janus_ice_stream *stream = handle->stream;
+	if(stream && stream->component) {
+		janus_ice_component *component = stream->component;
+		/* Audio */
+		gint64 last = component->in_stats.audio.updated;
+		if(last && now > last && now-last >= 2*G_USEC_PER_SEC && component->in_stats.audio.bytes_lastsec_temp > 0) {
+			component->in_stats.audio.bytes_lastsec = 0;
+			component->in_stats.audio.bytes_lastsec_temp = 0;
+		}
+		last = component->out_stats.audio.updated;
+		if(last && now > last && now-last >= 2*G_USEC_PER_SEC && component->out_stats.audio.bytes_lastsec_temp > 0) {
+			component->out_stats.audio.bytes_lastsec = 0;
+			component->out_stats.audio.bytes_lastsec_temp = 0;
+		}
+		/* Video */
+		int vindex = 0;
+		for(vindex=0; vindex < 3; vindex++) {
+			gint64 last = component->in_stats.video[vindex].updated;
+			if(last && now > last && now-last >= 2*G_USEC_PER_SEC && component->in_stats.video[vindex].bytes_lastsec_temp > 0) {
+				component->in_stats.video[vindex].bytes_lastsec = 0;
+				component->in_stats.video[vindex].bytes_lastsec_temp = 0;
+			}
+			last = component->out_stats.video[vindex].updated;
+			if(last && now > last && now-last >= 2*G_USEC_PER_SEC && component->out_stats.video[vindex].bytes_lastsec_temp > 0) {
+				component->out_stats.video[vindex].bytes_lastsec = 0;
+				component->out_stats.video[vindex].bytes_lastsec_temp = 0;
+			}
+		}
+	}
 }
 
-// NICE_COMPONENT_STATE_CONNECTED之后启动janus_ice_send_thread线程函数，发生数据给对端
-void *janus_ice_send_thread(void *data) {
-	janus_ice_handle *handle = (janus_ice_handle *)data;
-	janus_session *session = (janus_session *)handle->session;
-	JANUS_LOG(LOG_VERB, "[%"SCNu64"] ICE send thread started...\n", handle->handle_id);
-	janus_ice_queued_packet *pkt = NULL;
-	gint64 before = janus_get_monotonic_time(),
-		rtcp_last_sr_rr = before, last_event = before,
-		last_srtp_summary = before, last_nack_cleanup = before;
-	gboolean alert_sent = FALSE;
-	while(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)) {
-		if(handle->queued_packets != NULL) {
-			// 获取插件传入的janus_ice_queued_packet包
-			pkt = g_async_queue_timeout_pop(handle->queued_packets, 500000);
-		} else {
-			g_usleep(100000);
-		}
-		if(pkt == &janus_ice_dtls_alert) {
-			/* The session is over, send an alert on all streams and components */
-			if(!alert_sent && handle->stream && handle->stream->component && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY)) {
-				janus_dtls_srtp_send_alert(handle->stream->component->dtls);
-				alert_sent = TRUE;
-			}
-			while(g_async_queue_length(handle->queued_packets) > 0) {
-				pkt = g_async_queue_try_pop(handle->queued_packets);
-				if(pkt != NULL && pkt != &janus_ice_dtls_alert) {
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-				}
-			}
-			if(handle->iceloop != NULL && g_main_loop_is_running(handle->iceloop)) {
-				g_main_loop_quit(handle->iceloop);
-				if (handle->icectx != NULL) {
-					g_main_context_wakeup(handle->icectx);
-				}
-			}
-			continue;
+static void janus_ice_outgoing_check_no_media(janus_ice_handle *handle, gint64 now) {
+	janus_ice_stream *stream = handle->stream;
+	if(stream && stream->component) {
+		janus_ice_component *component = stream->component;
+		/* Audio */
+		gint64 last = component->in_stats.audio.updated;
+		if(!component->in_stats.audio.notified_lastsec && last &&
+				!component->in_stats.audio.bytes_lastsec && !component->in_stats.audio.bytes_lastsec_temp &&
+					now-last >= (gint64)no_media_timer*G_USEC_PER_SEC) {
+			/* We missed more than no_second_timer seconds of audio! */
+			component->in_stats.audio.notified_lastsec = TRUE;
+			JANUS_LOG(LOG_WARN, "[%"SCNu64"] Didn't receive audio for more than %d seconds...\n", handle->handle_id, no_media_timer);
+			janus_ice_notify_media(handle, FALSE, FALSE);
 		}
-		if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY)) {
-			if(pkt)
-				g_free(pkt->data);
-			g_free(pkt);
-			pkt = NULL;
-			continue;
+		/* Video */
+		last = component->in_stats.video[0].updated;
+		if(!component->in_stats.video[0].notified_lastsec && last &&
+				!component->in_stats.video[0].bytes_lastsec && !component->in_stats.video[0].bytes_lastsec_temp &&
+					now-last >= (gint64)no_media_timer*G_USEC_PER_SEC) {
+			/* We missed more than no_second_timer seconds of video! */
+			component->in_stats.video[0].notified_lastsec = TRUE;
+			JANUS_LOG(LOG_WARN, "[%"SCNu64"] Didn't receive video for more than a second...\n", handle->handle_id);
+			janus_ice_notify_media(handle, TRUE, FALSE);
 		}
-		if(alert_sent)
-			alert_sent = FALSE;
-		/* Reset the last second counters if too much time passed with no data in or out */
-		gint64 now = janus_get_monotonic_time();
-		janus_ice_stream *stream = handle->stream;
-		if(stream && stream->component) {
-			janus_ice_component *component = stream->component;
-			/* Audio */
-			gint64 last = component->in_stats.audio.updated;
-			if(last && now > last && now-last >= 2*G_USEC_PER_SEC && component->in_stats.audio.bytes_lastsec_temp > 0) {
-				component->in_stats.audio.bytes_lastsec = 0;
-				component->in_stats.audio.bytes_lastsec_temp = 0;
-			}
-			last = component->out_stats.audio.updated;
-			if(last && now > last && now-last >= 2*G_USEC_PER_SEC && component->out_stats.audio.bytes_lastsec_temp > 0) {
-				component->out_stats.audio.bytes_lastsec = 0;
-				component->out_stats.audio.bytes_lastsec_temp = 0;
-			}
-			/* Video */
-			int vindex = 0;
-			for(vindex=0; vindex < 3; vindex++) {
-				gint64 last = component->in_stats.video[vindex].updated;
-				if(last && now > last && now-last >= 2*G_USEC_PER_SEC && component->in_stats.video[vindex].bytes_lastsec_temp > 0) {
-					component->in_stats.video[vindex].bytes_lastsec = 0;
-					component->in_stats.video[vindex].bytes_lastsec_temp = 0;
-				}
-				last = component->out_stats.video[vindex].updated;
-				if(last && now > last && now-last >= 2*G_USEC_PER_SEC && component->out_stats.video[vindex].bytes_lastsec_temp > 0) {
-					component->out_stats.video[vindex].bytes_lastsec = 0;
-					component->out_stats.video[vindex].bytes_lastsec_temp = 0;
-				}
-			}
+	}
+}
+
+static void janus_ice_outgoing_rtcp_reports(janus_ice_handle *handle) {
+	janus_ice_stream *stream = handle->stream;
+	/* Audio */
+	if(stream && stream->component && stream->component->out_stats.audio.packets > 0) {
+		/* Create a SR/SDES compound */
+		int srlen = 28;
+		int sdeslen = 20;
+		char rtcpbuf[srlen+sdeslen];
+		memset(rtcpbuf, 0, sizeof(rtcpbuf));
+		rtcp_sr *sr = (rtcp_sr *)&rtcpbuf;
+		sr->header.version = 2;
+		sr->header.type = RTCP_SR;
+		sr->header.rc = 0;
+		sr->header.length = htons((srlen/4)-1);
+		sr->ssrc = htonl(stream->audio_ssrc);
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		uint32_t s = tv.tv_sec + 2208988800u;
+		uint32_t u = tv.tv_usec;
+		uint32_t f = (u << 12) + (u << 8) - ((u * 3650) >> 6);
+		sr->si.ntp_ts_msw = htonl(s);
+		sr->si.ntp_ts_lsw = htonl(f);
+		/* Compute an RTP timestamp coherent with the NTP one */
+		rtcp_context *rtcp_ctx = stream->audio_rtcp_ctx;
+		if(rtcp_ctx == NULL) {
+			sr->si.rtp_ts = htonl(stream->audio_last_ts);	/* FIXME */
+		} else {
+			int64_t ntp = tv.tv_sec*G_USEC_PER_SEC + tv.tv_usec;
+			uint32_t rtp_ts = ((ntp-stream->audio_first_ntp_ts)*(rtcp_ctx->tb))/1000000 + stream->audio_first_rtp_ts;
+			sr->si.rtp_ts = htonl(rtp_ts);
 		}
-		/* Let's see if we need to notify the user about no incoming audio or video */
-		if(no_media_timer > 0 && now-before >= G_USEC_PER_SEC) {
-			stream = handle->stream;
-			if(stream && stream->component) {
-				janus_ice_component *component = stream->component;
-				/* Audio */
-				gint64 last = component->in_stats.audio.updated;
-				if(!component->in_stats.audio.notified_lastsec && last &&
-						!component->in_stats.audio.bytes_lastsec && !component->in_stats.audio.bytes_lastsec_temp &&
-							now-last >= (gint64)no_media_timer*G_USEC_PER_SEC) {
-					/* We missed more than no_second_timer seconds of audio! */
-					component->in_stats.audio.notified_lastsec = TRUE;
-					JANUS_LOG(LOG_WARN, "[%"SCNu64"] Didn't receive audio for more than %d seconds...\n", handle->handle_id, no_media_timer);
-					janus_ice_notify_media(handle, FALSE, FALSE);
-				}
-				/* Video */
-				last = component->in_stats.video[0].updated;
-				if(!component->in_stats.video[0].notified_lastsec && last &&
-						!component->in_stats.video[0].bytes_lastsec && !component->in_stats.video[0].bytes_lastsec_temp &&
-							now-last >= (gint64)no_media_timer*G_USEC_PER_SEC) {
-					/* We missed more than no_second_timer seconds of video! */
-					component->in_stats.video[0].notified_lastsec = TRUE;
-					JANUS_LOG(LOG_WARN, "[%"SCNu64"] Didn't receive video for more than a second...\n", handle->handle_id);
-					janus_ice_notify_media(handle, TRUE, FALSE);
-				}
-			}
-			before = now;
+		sr->si.s_packets = htonl(stream->component->out_stats.audio.packets);
+		sr->si.s_octets = htonl(stream->component->out_stats.audio.bytes);
+		rtcp_sdes *sdes = (rtcp_sdes *)&rtcpbuf[28];
+		janus_rtcp_sdes_cname((char *)sdes, sdeslen, "janusaudio", 10);
+		sdes->chunk.ssrc = htonl(stream->audio_ssrc);
+		/* Enqueue it, we'll send it later */
+		janus_ice_relay_rtcp_internal(handle, 0, rtcpbuf, srlen+sdeslen, FALSE);
+	}
+	if(stream) {
+		/* Create a RR too */
+		int rrlen = 32;
+		char rtcpbuf[32];
+		memset(rtcpbuf, 0, sizeof(rtcpbuf));
+		rtcp_rr *rr = (rtcp_rr *)&rtcpbuf;
+		rr->header.version = 2;
+		rr->header.type = RTCP_RR;
+		rr->header.rc = 1;
+		rr->header.length = htons((rrlen/4)-1);
+		rr->ssrc = htonl(stream->audio_ssrc);
+		janus_rtcp_report_block(stream->audio_rtcp_ctx, &rr->rb[0]);
+		rr->rb[0].ssrc = htonl(stream->audio_ssrc_peer);
+		/* Enqueue it, we'll send it later */
+		janus_ice_relay_rtcp_internal(handle, 0, rtcpbuf, 32, FALSE);
+	}
+	/* Now do the same for video */
+	if(stream && stream->component && stream->component->out_stats.video[0].packets > 0) {
+		/* Create a SR/SDES compound */
+		int srlen = 28;
+		int sdeslen = 20;
+		char rtcpbuf[srlen+sdeslen];
+		memset(rtcpbuf, 0, sizeof(rtcpbuf));
+		rtcp_sr *sr = (rtcp_sr *)&rtcpbuf;
+		sr->header.version = 2;
+		sr->header.type = RTCP_SR;
+		sr->header.rc = 0;
+		sr->header.length = htons((srlen/4)-1);
+		sr->ssrc = htonl(stream->video_ssrc);
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		uint32_t s = tv.tv_sec + 2208988800u;
+		uint32_t u = tv.tv_usec;
+		uint32_t f = (u << 12) + (u << 8) - ((u * 3650) >> 6);
+		sr->si.ntp_ts_msw = htonl(s);
+		sr->si.ntp_ts_lsw = htonl(f);
+		/* Compute an RTP timestamp coherent with the NTP one */
+		rtcp_context *rtcp_ctx = stream->video_rtcp_ctx[0];
+		if(rtcp_ctx == NULL) {
+			sr->si.rtp_ts = htonl(stream->video_last_ts);	/* FIXME */
+		} else {
+			int64_t ntp = tv.tv_sec*G_USEC_PER_SEC + tv.tv_usec;
+			uint32_t rtp_ts = ((ntp-stream->video_first_ntp_ts[0])*(rtcp_ctx->tb))/1000000 + stream->video_first_rtp_ts[0];
+			sr->si.rtp_ts = htonl(rtp_ts);
 		}
-		/* Let's check if it's time to send a RTCP SR/SDES/RR as well */
-		if(now-rtcp_last_sr_rr >= 1*G_USEC_PER_SEC) {
-			rtcp_last_sr_rr = now;
-			janus_ice_stream *stream = handle->stream;
-			/* Audio */
-			if(stream && stream->component && stream->component->out_stats.audio.packets > 0) {
-				/* Create a SR/SDES compound */
-				int srlen = 28;
-				int sdeslen = 20;
-				char rtcpbuf[srlen+sdeslen];
-				memset(rtcpbuf, 0, sizeof(rtcpbuf));
-				rtcp_sr *sr = (rtcp_sr *)&rtcpbuf;
-				sr->header.version = 2;
-				sr->header.type = RTCP_SR;
-				sr->header.rc = 0;
-				sr->header.length = htons((srlen/4)-1);
-				sr->ssrc = htonl(stream->audio_ssrc);
-				struct timeval tv;
-				gettimeofday(&tv, NULL);
-				uint32_t s = tv.tv_sec + 2208988800u;
-				uint32_t u = tv.tv_usec;
-				uint32_t f = (u << 12) + (u << 8) - ((u * 3650) >> 6);
-				sr->si.ntp_ts_msw = htonl(s);
-				sr->si.ntp_ts_lsw = htonl(f);
-				/* Compute an RTP timestamp coherent with the NTP one */
-				rtcp_context *rtcp_ctx = stream->audio_rtcp_ctx;
-				if(rtcp_ctx == NULL) {
-					sr->si.rtp_ts = htonl(stream->audio_last_ts);	/* FIXME */
-				} else {
-					int64_t ntp = tv.tv_sec*G_USEC_PER_SEC + tv.tv_usec;
-					uint32_t rtp_ts = ((ntp-stream->audio_first_ntp_ts)*(rtcp_ctx->tb))/1000000 + stream->audio_first_rtp_ts;
-					sr->si.rtp_ts = htonl(rtp_ts);
-				}
-				sr->si.s_packets = htonl(stream->component->out_stats.audio.packets);
-				sr->si.s_octets = htonl(stream->component->out_stats.audio.bytes);
-				rtcp_sdes *sdes = (rtcp_sdes *)&rtcpbuf[28];
-				janus_rtcp_sdes_cname((char *)sdes, sdeslen, "janusaudio", 10);
-				sdes->chunk.ssrc = htonl(stream->audio_ssrc);
-				/* Enqueue it, we'll send it later */
-				janus_ice_relay_rtcp_internal(handle, 0, rtcpbuf, srlen+sdeslen, FALSE);
-			}
-			if(stream) {
-				/* Create a RR too */
+		sr->si.s_packets = htonl(stream->component->out_stats.video[0].packets);
+		sr->si.s_octets = htonl(stream->component->out_stats.video[0].bytes);
+		rtcp_sdes *sdes = (rtcp_sdes *)&rtcpbuf[28];
+		janus_rtcp_sdes_cname((char *)sdes, sdeslen, "janusvideo", 10);
+		sdes->chunk.ssrc = htonl(stream->video_ssrc);
+		/* Enqueue it, we'll send it later */
+		janus_ice_relay_rtcp_internal(handle, 1, rtcpbuf, srlen+sdeslen, FALSE);
+	}
+	if(stream) {
+		/* Create a RR too (for each SSRC, if we're simulcasting) */
+		int vindex=0;
+		for(vindex=0; vindex<3; vindex++) {
+			if(stream->video_rtcp_ctx[vindex] && stream->video_rtcp_ctx[vindex]->rtp_recvd) {
+				/* Create a RR */
 				int rrlen = 32;
 				char rtcpbuf[32];
 				memset(rtcpbuf, 0, sizeof(rtcpbuf));
@@ -3469,484 +4813,506 @@ void *janus_ice_send_thread(void *data) {
 				rr->header.type = RTCP_RR;
 				rr->header.rc = 1;
 				rr->header.length = htons((rrlen/4)-1);
-				rr->ssrc = htonl(stream->audio_ssrc);
-				janus_rtcp_report_block(stream->audio_rtcp_ctx, &rr->rb[0]);
-				rr->rb[0].ssrc = htonl(stream->audio_ssrc_peer);
+				rr->ssrc = htonl(stream->video_ssrc);
+				janus_rtcp_report_block(stream->video_rtcp_ctx[vindex], &rr->rb[0]);
+				rr->rb[0].ssrc = htonl(stream->video_ssrc_peer[vindex]);
 				/* Enqueue it, we'll send it later */
-				janus_ice_relay_rtcp_internal(handle, 0, rtcpbuf, 32, FALSE);
+				janus_ice_relay_rtcp_internal(handle, 1, rtcpbuf, 32, FALSE);
 			}
-			/* Now do the same for video */
-			if(stream && stream->component && stream->component->out_stats.video[0].packets > 0) {
-				/* Create a SR/SDES compound */
-				int srlen = 28;
-				int sdeslen = 20;
-				char rtcpbuf[srlen+sdeslen];
-				memset(rtcpbuf, 0, sizeof(rtcpbuf));
-				rtcp_sr *sr = (rtcp_sr *)&rtcpbuf;
-				sr->header.version = 2;
-				sr->header.type = RTCP_SR;
-				sr->header.rc = 0;
-				sr->header.length = htons((srlen/4)-1);
-				sr->ssrc = htonl(stream->video_ssrc);
-				struct timeval tv;
-				gettimeofday(&tv, NULL);
-				uint32_t s = tv.tv_sec + 2208988800u;
-				uint32_t u = tv.tv_usec;
-				uint32_t f = (u << 12) + (u << 8) - ((u * 3650) >> 6);
-				sr->si.ntp_ts_msw = htonl(s);
-				sr->si.ntp_ts_lsw = htonl(f);
-				/* Compute an RTP timestamp coherent with the NTP one */
-				rtcp_context *rtcp_ctx = stream->video_rtcp_ctx[0];
-				if(rtcp_ctx == NULL) {
-					sr->si.rtp_ts = htonl(stream->video_last_ts);	/* FIXME */
-				} else {
-					int64_t ntp = tv.tv_sec*G_USEC_PER_SEC + tv.tv_usec;
-					uint32_t rtp_ts = ((ntp-stream->video_first_ntp_ts[0])*(rtcp_ctx->tb))/1000000 + stream->video_first_rtp_ts[0];
-					sr->si.rtp_ts = htonl(rtp_ts);
-				}
-				sr->si.s_packets = htonl(stream->component->out_stats.video[0].packets);
-				sr->si.s_octets = htonl(stream->component->out_stats.video[0].bytes);
-				rtcp_sdes *sdes = (rtcp_sdes *)&rtcpbuf[28];
-				janus_rtcp_sdes_cname((char *)sdes, sdeslen, "janusvideo", 10);
-				sdes->chunk.ssrc = htonl(stream->video_ssrc);
-				/* Enqueue it, we'll send it later */
-				janus_ice_relay_rtcp_internal(handle, 1, rtcpbuf, srlen+sdeslen, FALSE);
+		}
+	}
+	if (stream && stream->do_transport_wide_cc) {
+		/* Create transport wide feedback messages for all the packets received since the last one */
+		size_t size = 1300;
+		char rtcpbuf[1300];
+		guint64 arrivals[JANUS_ICE_TWCC_FEEDBACK_MAX];
+		while(1) {
+			janus_mutex_lock(&stream->mutex);
+			guint32 pending = stream->transport_wide_cc_arrivals ?
+				stream->transport_wide_cc_max_seq_num - stream->transport_wide_cc_last_feedback_seq_num : 0;
+			if(pending == 0 || pending > JANUS_ICE_TWCC_WINDOW) {
+				janus_mutex_unlock(&stream->mutex);
+				break;
 			}
-			if(stream) {
-				/* Create a RR too (for each SSRC, if we're simulcasting) */
-				int vindex=0;
-				for(vindex=0; vindex<3; vindex++) {
-					if(stream->video_rtcp_ctx[vindex] && stream->video_rtcp_ctx[vindex]->rtp_recvd) {
-						/* Create a RR */
-						int rrlen = 32;
-						char rtcpbuf[32];
-						memset(rtcpbuf, 0, sizeof(rtcpbuf));
-						rtcp_rr *rr = (rtcp_rr *)&rtcpbuf;
-						rr->header.version = 2;
-						rr->header.type = RTCP_RR;
-						rr->header.rc = 1;
-						rr->header.length = htons((rrlen/4)-1);
-						rr->ssrc = htonl(stream->video_ssrc);
-						janus_rtcp_report_block(stream->video_rtcp_ctx[vindex], &rr->rb[0]);
-						rr->rb[0].ssrc = htonl(stream->video_ssrc_peer[vindex]);
-						/* Enqueue it, we'll send it later */
-						janus_ice_relay_rtcp_internal(handle, 1, rtcpbuf, 32, FALSE);
-					}
-				}
+			guint count = pending < JANUS_ICE_TWCC_FEEDBACK_MAX ? pending : JANUS_ICE_TWCC_FEEDBACK_MAX;
+			guint32 base_seq_num = stream->transport_wide_cc_last_feedback_seq_num+1;
+			/* Copy the arrival times (missing packets are 0) and free the slots for the packets to come */
+			guint i = 0;
+			for(i=0; i<count; i++) {
+				guint64 *slot = &stream->transport_wide_cc_arrivals[(base_seq_num+i) & (JANUS_ICE_TWCC_WINDOW-1)];
+				arrivals[i] = *slot;
+				*slot = 0;
 			}
-			if (stream && stream->do_transport_wide_cc) {
-				/* Create a transport wide feedback message */
-				size_t size = 1300;
-				char rtcpbuf[1300];
-				/* Lock session */
-				janus_mutex_lock(&handle->stream->mutex);
-				/* Order packet list */
-				GSList *sorted = g_slist_sort(handle->stream->transport_wide_received_seq_nums, rtcp_transport_wide_cc_stats_comparator);
-				/* Create full stats queue */
-				GQueue *packets = g_queue_new();
-				/* For all packets */
-				GSList *it = NULL;
-				for (it = sorted; it; it = it->next) {
-					/* Get stat */
-					janus_rtcp_transport_wide_cc_stats *stats = (janus_rtcp_transport_wide_cc_stats *)it->data;
-					/* Get transport seq */
-					guint32 transport_seq_num = stats->transport_seq_num;
-					/* Check if it is an out of order  */
-					if (transport_seq_num < handle->stream->transport_wide_cc_last_feedback_seq_num)
-						/* Skip, it was already reported as lost */
-						continue;
-					/* If not first */
-					if (handle->stream->transport_wide_cc_last_feedback_seq_num) {
-						/* For each lost */
-						guint32 i = 0;
-						for (i = handle->stream->transport_wide_cc_last_feedback_seq_num+1; i<transport_seq_num; ++i) {
-							/* Create new stat */
-							janus_rtcp_transport_wide_cc_stats *missing = g_malloc(sizeof(janus_rtcp_transport_wide_cc_stats));
-							/* Add missing packet */
-							missing->transport_seq_num = i;
-							missing->timestamp = 0;
-							/* Add it */
-							g_queue_push_tail(packets, missing);
-						}
-					}
-					/* Store last */
-					handle->stream->transport_wide_cc_last_feedback_seq_num = transport_seq_num;
-					/* Add this one */
-					g_queue_push_tail(packets, stats);
-				}
-				/* Clear stats */
-				g_slist_free(handle->stream->transport_wide_received_seq_nums);
-				/* Reset list */
-				handle->stream->transport_wide_received_seq_nums = NULL;
-				/* Get feedback pacakte count and increase it for next one */
-				guint8 feedback_packet_count = handle->stream->transport_wide_cc_feedback_count++;
-				/* Unlock session */
-				janus_mutex_unlock(&handle->stream->mutex);
-				/* Create rtcp packet */
-				int len = janus_rtcp_transport_wide_cc_feedback(rtcpbuf, size, handle->stream->video_ssrc, stream->video_ssrc_peer[0] , feedback_packet_count, packets);
-				/* Enqueue it, we'll send it later */
+			stream->transport_wide_cc_last_feedback_seq_num += count;
+			/* Get feedback pacakte count and increase it for next one */
+			guint8 feedback_packet_count = stream->transport_wide_cc_feedback_count++;
+			janus_mutex_unlock(&stream->mutex);
+			/* Create rtcp packet */
+			int len = janus_rtcp_transport_wide_cc_feedback(rtcpbuf, size, stream->video_ssrc, stream->video_ssrc_peer[0],
+				feedback_packet_count, (guint16)base_seq_num, arrivals, count);
+			/* Enqueue it, we'll send it later */
+			if(len > 0)
 				janus_ice_relay_rtcp_internal(handle, 1, rtcpbuf, len, FALSE);
-				/* Free mem */
-				g_queue_free(packets);
-			}
 		}
-		/* We tell event handlers once per second about RTCP-related stuff
-		 * FIXME Should we really do this here? Would this slow down this thread and add delay? */
-		if(janus_ice_event_stats_period > 0 && now-last_event >= (gint64)janus_ice_event_stats_period*G_USEC_PER_SEC) {
-			last_event = now;
-			janus_ice_stream *stream = handle->stream;
-			/* Audio */
-			if(janus_events_is_enabled() && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO)) {
-				if(stream && stream->audio_rtcp_ctx) {
-					json_t *info = json_object();
-					json_object_set_new(info, "media", json_string("audio"));
-					json_object_set_new(info, "base", json_integer(stream->audio_rtcp_ctx->tb));
-					json_object_set_new(info, "rtt", json_integer(janus_rtcp_context_get_rtt(stream->audio_rtcp_ctx)));
-					json_object_set_new(info, "lost", json_integer(janus_rtcp_context_get_lost_all(stream->audio_rtcp_ctx, FALSE)));
-					json_object_set_new(info, "lost-by-remote", json_integer(janus_rtcp_context_get_lost_all(stream->audio_rtcp_ctx, TRUE)));
-					json_object_set_new(info, "jitter-local", json_integer(janus_rtcp_context_get_jitter(stream->audio_rtcp_ctx, FALSE)));
-					json_object_set_new(info, "jitter-remote", json_integer(janus_rtcp_context_get_jitter(stream->audio_rtcp_ctx, TRUE)));
-					json_object_set_new(info, "in-link-quality", json_integer(janus_rtcp_context_get_in_link_quality(stream->audio_rtcp_ctx)));
-					json_object_set_new(info, "in-media-link-quality", json_integer(janus_rtcp_context_get_in_media_link_quality(stream->audio_rtcp_ctx)));
-					json_object_set_new(info, "out-link-quality", json_integer(janus_rtcp_context_get_out_link_quality(stream->audio_rtcp_ctx)));
-					json_object_set_new(info, "out-media-link-quality", json_integer(janus_rtcp_context_get_out_media_link_quality(stream->audio_rtcp_ctx)));
-					if(stream->component) {
-						json_object_set_new(info, "packets-received", json_integer(stream->component->in_stats.audio.packets));
-						json_object_set_new(info, "packets-sent", json_integer(stream->component->out_stats.audio.packets));
-						json_object_set_new(info, "bytes-received", json_integer(stream->component->in_stats.audio.bytes));
-						json_object_set_new(info, "bytes-sent", json_integer(stream->component->out_stats.audio.bytes));
-						json_object_set_new(info, "bytes-received-lastsec", json_integer(stream->component->in_stats.audio.bytes_lastsec));
-						json_object_set_new(info, "bytes-sent-lastsec", json_integer(stream->component->out_stats.audio.bytes_lastsec));
-						json_object_set_new(info, "nacks-received", json_integer(stream->component->in_stats.audio.nacks));
-						json_object_set_new(info, "nacks-sent", json_integer(stream->component->out_stats.audio.nacks));
-					}
-					janus_events_notify_handlers(JANUS_EVENT_TYPE_MEDIA, session->session_id, handle->handle_id, handle->opaque_id, info);
-				}
+	}
+}
+
+static void janus_ice_outgoing_event_stats(janus_ice_handle *handle) {
+	janus_session *session = (janus_session *)handle->session;
+	janus_ice_stream *stream = handle->stream;
+	/* Audio */
+	if(janus_events_is_enabled() && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO)) {
+		if(stream && stream->audio_rtcp_ctx) {
+			json_t *info = json_object();
+			json_object_set_new(info, "media", json_string("audio"));
+			json_object_set_new(info, "base", json_integer(stream->audio_rtcp_ctx->tb));
+			json_object_set_new(info, "rtt", json_integer(janus_rtcp_context_get_rtt(stream->audio_rtcp_ctx)));
+			json_object_set_new(info, "lost", json_integer(janus_rtcp_context_get_lost_all(stream->audio_rtcp_ctx, FALSE)));
+			json_object_set_new(info, "lost-by-remote", json_integer(janus_rtcp_context_get_lost_all(stream->audio_rtcp_ctx, TRUE)));
+			json_object_set_new(info, "jitter-local", json_integer(janus_rtcp_context_get_jitter(stream->audio_rtcp_ctx, FALSE)));
+			json_object_set_new(info, "jitter-remote", json_integer(janus_rtcp_context_get_jitter(stream->audio_rtcp_ctx, TRUE)));
+			json_object_set_new(info, "in-link-quality", json_integer(janus_rtcp_context_get_in_link_quality(stream->audio_rtcp_ctx)));
+			json_object_set_new(info, "in-media-link-quality", json_integer(janus_rtcp_context_get_in_media_link_quality(stream->audio_rtcp_ctx)));
+			json_object_set_new(info, "out-link-quality", json_integer(janus_rtcp_context_get_out_link_quality(stream->audio_rtcp_ctx)));
+			json_object_set_new(info, "out-media-link-quality", json_integer(janus_rtcp_context_get_out_media_link_quality(stream->audio_rtcp_ctx)));
+			if(stream->component) {
+				json_object_set_new(info, "packets-received", json_integer(stream->component->in_stats.audio.packets));
+				json_object_set_new(info, "packets-sent", json_integer(stream->component->out_stats.audio.packets));
+				json_object_set_new(info, "bytes-received", json_integer(stream->component->in_stats.audio.bytes));
+				json_object_set_new(info, "bytes-sent", json_integer(stream->component->out_stats.audio.bytes));
+				json_object_set_new(info, "bytes-received-lastsec", json_integer(stream->component->in_stats.audio.bytes_lastsec));
+				json_object_set_new(info, "bytes-sent-lastsec", json_integer(stream->component->out_stats.audio.bytes_lastsec));
+				json_object_set_new(info, "nacks-received", json_integer(stream->component->in_stats.audio.nacks));
+				json_object_set_new(info, "nacks-sent", json_integer(stream->component->out_stats.audio.nacks));
 			}
-			/* Do the same for video */
-			if(janus_events_is_enabled() && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO)) {
-				int vindex=0;
-				for(vindex=0; vindex<3; vindex++) {
-					if(stream && stream->video_rtcp_ctx[vindex]) {
-						json_t *info = json_object();
-						if(vindex == 0)
-							json_object_set_new(info, "media", json_string("video"));
-						else if(vindex == 1)
-							json_object_set_new(info, "media", json_string("video-sim1"));
-						else
-							json_object_set_new(info, "media", json_string("video-sim2"));
-						json_object_set_new(info, "base", json_integer(stream->video_rtcp_ctx[vindex]->tb));
-						if(vindex == 0)
-							json_object_set_new(info, "rtt", json_integer(janus_rtcp_context_get_rtt(stream->video_rtcp_ctx[vindex])));
-						json_object_set_new(info, "lost", json_integer(janus_rtcp_context_get_lost_all(stream->video_rtcp_ctx[vindex], FALSE)));
-						json_object_set_new(info, "lost-by-remote", json_integer(janus_rtcp_context_get_lost_all(stream->video_rtcp_ctx[vindex], TRUE)));
-						json_object_set_new(info, "jitter-local", json_integer(janus_rtcp_context_get_jitter(stream->video_rtcp_ctx[vindex], FALSE)));
-						json_object_set_new(info, "jitter-remote", json_integer(janus_rtcp_context_get_jitter(stream->video_rtcp_ctx[vindex], TRUE)));
-						json_object_set_new(info, "in-link-quality", json_integer(janus_rtcp_context_get_in_link_quality(stream->video_rtcp_ctx[vindex])));
-						json_object_set_new(info, "in-media-link-quality", json_integer(janus_rtcp_context_get_in_media_link_quality(stream->video_rtcp_ctx[vindex])));
-						json_object_set_new(info, "out-link-quality", json_integer(janus_rtcp_context_get_out_link_quality(stream->video_rtcp_ctx[vindex])));
-						json_object_set_new(info, "out-media-link-quality", json_integer(janus_rtcp_context_get_out_media_link_quality(stream->video_rtcp_ctx[vindex])));
-						if(stream->component) {
-							json_object_set_new(info, "packets-received", json_integer(stream->component->in_stats.video[vindex].packets));
-							json_object_set_new(info, "packets-sent", json_integer(stream->component->out_stats.video[vindex].packets));
-							json_object_set_new(info, "bytes-received", json_integer(stream->component->in_stats.video[vindex].bytes));
-							json_object_set_new(info, "bytes-sent", json_integer(stream->component->out_stats.video[vindex].bytes));
-							json_object_set_new(info, "bytes-received-lastsec", json_integer(stream->component->in_stats.video[vindex].bytes_lastsec));
-							json_object_set_new(info, "bytes-sent-lastsec", json_integer(stream->component->out_stats.video[vindex].bytes_lastsec));
-							json_object_set_new(info, "nacks-received", json_integer(stream->component->in_stats.video[vindex].nacks));
-							json_object_set_new(info, "nacks-sent", json_integer(stream->component->out_stats.video[vindex].nacks));
-						}
-						janus_events_notify_handlers(JANUS_EVENT_TYPE_MEDIA, session->session_id, handle->handle_id, handle->opaque_id, info);
-					}
+			janus_events_notify_handlers(JANUS_EVENT_TYPE_MEDIA, session->session_id, handle->handle_id, handle->opaque_id, info);
+		}
+	}
+	/* Do the same for video */
+	if(janus_events_is_enabled() && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO)) {
+		int vindex=0;
+		for(vindex=0; vindex<3; vindex++) {
+			if(stream && stream->video_rtcp_ctx[vindex]) {
+				json_t *info = json_object();
+				if(vindex == 0)
+					json_object_set_new(info, "media", json_string("video"));
+				else if(vindex == 1)
+					json_object_set_new(info, "media", json_string("video-sim1"));
+				else
+					json_object_set_new(info, "media", json_string("video-sim2"));
+				json_object_set_new(info, "base", json_integer(stream->video_rtcp_ctx[vindex]->tb));
+				if(vindex == 0)
+					json_object_set_new(info, "rtt", json_integer(janus_rtcp_context_get_rtt(stream->video_rtcp_ctx[vindex])));
+				json_object_set_new(info, "lost", json_integer(janus_rtcp_context_get_lost_all(stream->video_rtcp_ctx[vindex], FALSE)));
+				json_object_set_new(info, "lost-by-remote", json_integer(janus_rtcp_context_get_lost_all(stream->video_rtcp_ctx[vindex], TRUE)));
+				json_object_set_new(info, "jitter-local", json_integer(janus_rtcp_context_get_jitter(stream->video_rtcp_ctx[vindex], FALSE)));
+				json_object_set_new(info, "jitter-remote", json_integer(janus_rtcp_context_get_jitter(stream->video_rtcp_ctx[vindex], TRUE)));
+				json_object_set_new(info, "in-link-quality", json_integer(janus_rtcp_context_get_in_link_quality(stream->video_rtcp_ctx[vindex])));
+				json_object_set_new(info, "in-media-link-quality", json_integer(janus_rtcp_context_get_in_media_link_quality(stream->video_rtcp_ctx[vindex])));
+				json_object_set_new(info, "out-link-quality", json_integer(janus_rtcp_context_get_out_link_quality(stream->video_rtcp_ctx[vindex])));
+				json_object_set_new(info, "out-media-link-quality", json_integer(janus_rtcp_context_get_out_media_link_quality(stream->video_rtcp_ctx[vindex])));
+				if(stream->component) {
+					json_object_set_new(info, "packets-received", json_integer(stream->component->in_stats.video[vindex].packets));
+					json_object_set_new(info, "packets-sent", json_integer(stream->component->out_stats.video[vindex].packets));
+					json_object_set_new(info, "bytes-received", json_integer(stream->component->in_stats.video[vindex].bytes));
+					json_object_set_new(info, "bytes-sent", json_integer(stream->component->out_stats.video[vindex].bytes));
+					json_object_set_new(info, "bytes-received-lastsec", json_integer(stream->component->in_stats.video[vindex].bytes_lastsec));
+					json_object_set_new(info, "bytes-sent-lastsec", json_integer(stream->component->out_stats.video[vindex].bytes_lastsec));
+					json_object_set_new(info, "nacks-received", json_integer(stream->component->in_stats.video[vindex].nacks));
+					json_object_set_new(info, "nacks-sent", json_integer(stream->component->out_stats.video[vindex].nacks));
 				}
+				janus_events_notify_handlers(JANUS_EVENT_TYPE_MEDIA, session->session_id, handle->handle_id, handle->opaque_id, info);
 			}
 		}
-		/* Should we clean up old NACK buffers? (we check each 1/4 of the max_nack_queue time) */
-		if(max_nack_queue > 0 && (now-last_nack_cleanup >= (max_nack_queue*250))) {
-			/* Check if we do for all streams */
-			janus_cleanup_nack_buffer(now, handle->stream, TRUE, TRUE);
-			last_nack_cleanup = now;
+	}
+}
+
+static void janus_ice_outgoing_srtp_summary(janus_ice_handle *handle) {
+	if(handle->srtp_errors_count > 0) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Got %d SRTP/SRTCP errors in the last few seconds (last error: %s)\n",
+			handle->handle_id, handle->srtp_errors_count, janus_srtp_error_str(handle->last_srtp_error));
+		handle->srtp_errors_count = 0;
+		handle->last_srtp_error = 0;
+	}
+}
+
+/* Batched sending: when the ICE loop drains the outgoing queue, rather than
+ * calling nice_agent_send for each packet we copy the SRTP/SRTCP packets
+ * here, and pass them to libnice all at once when we're done (or one by
+ * one, if the libnice we're built against can't send batches) */
+#define JANUS_ICE_SEND_BATCH_SIZE	32
+typedef struct janus_ice_send_batch {
+	/* Whether we're currently collecting packets */
+	gboolean active;
+	/* How many packets we collected so far */
+	guint count;
+#ifdef HAVE_LIBNICE_SENDMESSAGES
+	NiceOutputMessage messages[JANUS_ICE_SEND_BATCH_SIZE];
+	GOutputVector vectors[JANUS_ICE_SEND_BATCH_SIZE];
+#endif
+	gint lengths[JANUS_ICE_SEND_BATCH_SIZE];
+	char buffers[JANUS_ICE_SEND_BATCH_SIZE][JANUS_ICE_PACKET_POOL_BUFSIZE];
+} janus_ice_send_batch;
+
+static void janus_ice_send_batch_flush(janus_ice_handle *handle) {
+	janus_ice_send_batch *batch = handle->send_batch;
+	if(batch == NULL || batch->count == 0)
+		return;
+	janus_ice_stream *stream = handle->stream;
+	if(stream == NULL || stream->component == NULL) {
+		batch->count = 0;
+		return;
+	}
+#ifdef HAVE_LIBNICE_SENDMESSAGES
+	guint i = 0;
+	for(i=0; i<batch->count; i++)
+		batch->vectors[i].size = batch->lengths[i];
+	GError *error = NULL;
+	gint sent = nice_agent_send_messages_nonblocking(handle->agent, stream->stream_id, stream->component->component_id,
+		batch->messages, batch->count, NULL, &error);
+	if(sent < (gint)batch->count) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d packets? (was %u, %s)\n", handle->handle_id,
+			sent, batch->count, error ? error->message : "no error");
+	}
+	if(error != NULL)
+		g_error_free(error);
+#else
+	guint i = 0;
+	for(i=0; i<batch->count; i++)
+		janus_ice_component_send(handle, stream->component, batch->lengths[i], batch->buffers[i]);
+#endif
+	batch->count = 0;
+}
+
+static void janus_ice_send_batch_start(janus_ice_handle *handle) {
+	if(!batch_send_enabled || handle->mux_binding != NULL)
+		return;
+	janus_ice_stream *stream = handle->stream;
+	if(stream == NULL || stream->component == NULL || stream->component->tcp_pair)
+		return;
+	if(handle->send_batch == NULL) {
+		handle->send_batch = g_malloc0(sizeof(janus_ice_send_batch));
+#ifdef HAVE_LIBNICE_SENDMESSAGES
+		int i = 0;
+		for(i=0; i<JANUS_ICE_SEND_BATCH_SIZE; i++) {
+			handle->send_batch->vectors[i].buffer = handle->send_batch->buffers[i];
+			handle->send_batch->messages[i].buffers = &handle->send_batch->vectors[i];
+			handle->send_batch->messages[i].n_buffers = 1;
 		}
-		/* Check if we should also print a summary of SRTP-related errors */
-		if(now-last_srtp_summary >= (2*G_USEC_PER_SEC)) {
-			if(handle->srtp_errors_count > 0) {
-				JANUS_LOG(LOG_ERR, "[%"SCNu64"] Got %d SRTP/SRTCP errors in the last few seconds (last error: %s)\n",
-					handle->handle_id, handle->srtp_errors_count, janus_srtp_error_str(handle->last_srtp_error));
-				handle->srtp_errors_count = 0;
-				handle->last_srtp_error = 0;
-			}
-			last_srtp_summary = now;
+#endif
+	}
+	handle->send_batch->active = TRUE;
+}
+
+static void janus_ice_send_batch_stop(janus_ice_handle *handle) {
+	if(handle->send_batch == NULL || !handle->send_batch->active)
+		return;
+	janus_ice_send_batch_flush(handle);
+	handle->send_batch->active = FALSE;
+}
+
+/* Helper to send an SRTP/SRTCP packet: if we're batching, this only copies the packet */
+static gint janus_ice_send_buffer(janus_ice_handle *handle, janus_ice_stream *stream, janus_ice_component *component, gint len, const gchar *buf) {
+	janus_ice_send_batch *batch = handle->send_batch;
+	if(batch != NULL && batch->active) {
+		if(len <= JANUS_ICE_PACKET_POOL_BUFSIZE) {
+			memcpy(batch->buffers[batch->count], buf, len);
+			batch->lengths[batch->count] = len;
+			batch->count++;
+			if(batch->count == JANUS_ICE_SEND_BATCH_SIZE)
+				janus_ice_send_batch_flush(handle);
+			return len;
 		}
+		/* Too large for the batch: send what we have first, to preserve the order */
+		janus_ice_send_batch_flush(handle);
+	}
+	return janus_ice_component_send(handle, component, len, buf);
+}
 
-		/* Now let's get on with the packets */
-		if(pkt == NULL) {
-			continue;
+/* Sends a packet that was queued by one of the relay methods: takes ownership of pkt */
+static void janus_ice_outgoing_packet(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+	janus_session *session = (janus_session *)handle->session;
+	if(pkt == NULL) {
+		return;
+	}
+	if(pkt->data == NULL) {
+		janus_ice_queued_packet_free(handle, pkt);
+		return;
+	}
+	if(pkt->control) {
+		/* RTCP */
+		int video = (pkt->type == JANUS_ICE_PACKET_VIDEO);
+		janus_ice_stream *stream = handle->stream;
+		if(!stream) {
+			janus_ice_queued_packet_free(handle, pkt);
+			pkt = NULL;
+			return;
 		}
-		if(pkt->data == NULL) {
-			g_free(pkt);
+		janus_ice_component *component = stream->component;
+		if(!component) {
+			janus_ice_queued_packet_free(handle, pkt);
 			pkt = NULL;
-			continue;
+			return;
+		}
+		if(!stream->cdone) {
+			if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && !stream->noerrorlog) {
+				JANUS_LOG(LOG_ERR, "[%"SCNu64"]     %s candidates not gathered yet for stream??\n", handle->handle_id, video ? "video" : "audio");
+				stream->noerrorlog = TRUE;	/* Don't flood with the same error all over again */
+			}
+			janus_ice_queued_packet_free(handle, pkt);
+			pkt = NULL;
+			return;
+		}
+		stream->noerrorlog = FALSE;
+		if(!component->dtls || !component->dtls->srtp_valid || !component->dtls->srtp_out) {
+			if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && !component->noerrorlog) {
+				JANUS_LOG(LOG_WARN, "[%"SCNu64"]     %s stream (#%u) component has no valid SRTP session (yet?)\n", handle->handle_id, video ? "video" : "audio", stream->stream_id);
+				component->noerrorlog = TRUE;	/* Don't flood with the same error all over again */
+			}
+			janus_ice_queued_packet_free(handle, pkt);
+			pkt = NULL;
+			return;
+		}
+		component->noerrorlog = FALSE;
+		if(pkt->encrypted) {
+			/* Already SRTCP */
+			int sent = janus_ice_send_buffer(handle, stream, component, pkt->length, (const gchar *)pkt->data);
+			if(sent < pkt->length) {
+				JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
+			}
+		} else {
+			/* Check if there's anything we need to do before sending */
+			uint32_t bitrate = janus_rtcp_get_remb(pkt->data, pkt->length);
+			if(bitrate > 0) {
+				/* There's a REMB, prepend a RR as it won't work otherwise */
+				int rrlen = 32;
+				char *rtcpbuf = g_malloc0(rrlen+pkt->length);
+				rtcp_rr *rr = (rtcp_rr *)rtcpbuf;
+				rr->header.version = 2;
+				rr->header.type = RTCP_RR;
+				rr->header.rc = 0;
+				rr->header.length = htons((rrlen/4)-1);
+				janus_ice_stream *stream = handle->stream;
+				if(stream && stream->video_rtcp_ctx[0] && stream->video_rtcp_ctx[0]->rtp_recvd) {
+					rr->header.rc = 1;
+					janus_rtcp_report_block(stream->video_rtcp_ctx[0], &rr->rb[0]);
+				}
+				/* Append REMB */
+				memcpy(rtcpbuf+rrlen, pkt->data, pkt->length);
+				/* If we're simulcasting, set the extra SSRCs (the first one will be set by janus_rtcp_fix_ssrc) */
+				if(stream->video_ssrc_peer[1] && pkt->length >= 28) {
+					rtcp_fb *rtcpfb = (rtcp_fb *)(rtcpbuf+rrlen);
+					rtcp_remb *remb = (rtcp_remb *)rtcpfb->fci;
+					remb->ssrc[1] = htonl(stream->video_ssrc_peer[1]);
+					if(stream->video_ssrc_peer[2] && pkt->length >= 32) {
+						remb->ssrc[2] = htonl(stream->video_ssrc_peer[2]);
+					}
+				}
+				/* Free old packet and update */
+				janus_ice_queued_packet_set_data(pkt, rtcpbuf, rrlen+pkt->length);
+			}
+			/* FIXME Copy in a buffer and fix SSRC */
+			char sbuf[JANUS_BUFSIZE];
+			memcpy(sbuf, pkt->data, pkt->length);
+			/* Do we need to dump this packet for debugging? */
+			if(g_atomic_int_get(&handle->dump_packets))
+				janus_text2pcap_dump(handle->text2pcap, JANUS_TEXT2PCAP_RTCP, FALSE, sbuf, pkt->length,
+					"[session=%"SCNu64"][handle=%"SCNu64"]", session->session_id, handle->handle_id);
+			/* Encrypt SRTCP */
+			int protected = pkt->length;
+			int res = srtp_protect_rtcp(component->dtls->srtp_out, sbuf, &protected);
+			if(res != srtp_err_status_ok) {
+				/* We don't spam the logs for every SRTP error: just take note of this, and print a summary later */
+				handle->srtp_errors_count++;
+				handle->last_srtp_error = res;
+				janus_metrics_inc(metric_srtp_errors_out);
+				/* If we're debugging, though, print every occurrence */
+				JANUS_LOG(LOG_DBG, "[%"SCNu64"] ... SRTCP protect error... %s (len=%d-->%d)...\n", handle->handle_id, janus_srtp_error_str(res), pkt->length, protected);
+			} else {
+				/* Shoot! */
+				int sent = janus_ice_send_buffer(handle, stream, component, protected, sbuf);
+				if(sent < protected) {
+					JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
+				}
+			}
 		}
-		if(pkt->control) {
-			/* RTCP */
+		janus_ice_queued_packet_free(handle, pkt);
+		return;
+	} else {
+		/* RTP or data */
+		if(pkt->type == JANUS_ICE_PACKET_AUDIO || pkt->type == JANUS_ICE_PACKET_VIDEO) {
+			/* RTP */
 			int video = (pkt->type == JANUS_ICE_PACKET_VIDEO);
 			janus_ice_stream *stream = handle->stream;
 			if(!stream) {
-				g_free(pkt->data);
-				pkt->data = NULL;
-				g_free(pkt);
+				janus_ice_queued_packet_free(handle, pkt);
 				pkt = NULL;
-				continue;
+				return;
+			}
+			if((!video && !stream->audio_send) || (video && !stream->video_send)) {
+				janus_ice_queued_packet_free(handle, pkt);
+				pkt = NULL;
+				return;
 			}
 			janus_ice_component *component = stream->component;
 			if(!component) {
-				g_free(pkt->data);
-				pkt->data = NULL;
-				g_free(pkt);
+				janus_ice_queued_packet_free(handle, pkt);
 				pkt = NULL;
-				continue;
+				return;
 			}
 			if(!stream->cdone) {
 				if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && !stream->noerrorlog) {
 					JANUS_LOG(LOG_ERR, "[%"SCNu64"]     %s candidates not gathered yet for stream??\n", handle->handle_id, video ? "video" : "audio");
 					stream->noerrorlog = TRUE;	/* Don't flood with the same error all over again */
 				}
-				g_free(pkt->data);
-				pkt->data = NULL;
-				g_free(pkt);
+				janus_ice_queued_packet_free(handle, pkt);
 				pkt = NULL;
-				continue;
+				return;
 			}
 			stream->noerrorlog = FALSE;
 			if(!component->dtls || !component->dtls->srtp_valid || !component->dtls->srtp_out) {
 				if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && !component->noerrorlog) {
-					JANUS_LOG(LOG_WARN, "[%"SCNu64"]     %s stream (#%u) component has no valid SRTP session (yet?)\n", handle->handle_id, video ? "video" : "audio", stream->stream_id);
+					JANUS_LOG(LOG_WARN, "[%"SCNu64"]     %s stream component has no valid SRTP session (yet?)\n", handle->handle_id, video ? "video" : "audio");
 					component->noerrorlog = TRUE;	/* Don't flood with the same error all over again */
 				}
-				g_free(pkt->data);
-				pkt->data = NULL;
-				g_free(pkt);
+				janus_ice_queued_packet_free(handle, pkt);
 				pkt = NULL;
-				continue;
+				return;
 			}
 			component->noerrorlog = FALSE;
+			if(g_atomic_int_compare_and_exchange(&handle->queue_pli, 1, 0)) {
+				/* We dropped some video: ask the plugin for a keyframe, as if the peer sent a PLI */
+				janus_plugin *plugin = (janus_plugin *)handle->app;
+				if(plugin && plugin->incoming_rtcp && handle->app_handle && !handle->app_handle->stopped) {
+					char rtcpbuf[12];
+					janus_rtcp_pli((char *)&rtcpbuf, 12);
+					g_atomic_int_inc(&handle->queue_plis);
+					plugin->incoming_rtcp(handle->app_handle, 1, rtcpbuf, 12);
+				}
+			}
+			if(max_queued_age > 0 && pkt->queued > 0 && !pkt->retransmission &&
+					janus_get_monotonic_time() - pkt->queued > max_queued_age) {
+				/* This packet waited for too long, sending it now would only add latency */
+				janus_ice_queue_dropped(handle, video);
+				janus_ice_queued_packet_free(handle, pkt);
+				pkt = NULL;
+				return;
+			}
 			if(pkt->encrypted) {
-				/* Already SRTCP */
-				int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, pkt->length, (const gchar *)pkt->data);
+				/* Already RTP (probably a retransmission?) */
+				janus_rtp_header *header = (janus_rtp_header *)pkt->data;
+				JANUS_LOG(LOG_HUGE, "[%"SCNu64"] ... Retransmitting seq.nr %"SCNu16"\n\n", handle->handle_id, ntohs(header->seq_number));
+				int sent = janus_ice_send_buffer(handle, stream, component, pkt->length, (const gchar *)pkt->data);
 				if(sent < pkt->length) {
 					JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
 				}
 			} else {
-				/* Check if there's anything we need to do before sending */
-				uint32_t bitrate = janus_rtcp_get_remb(pkt->data, pkt->length);
-				if(bitrate > 0) {
-					/* There's a REMB, prepend a RR as it won't work otherwise */
-					int rrlen = 32;
-					char *rtcpbuf = g_malloc0(rrlen+pkt->length);
-					rtcp_rr *rr = (rtcp_rr *)rtcpbuf;
-					rr->header.version = 2;
-					rr->header.type = RTCP_RR;
-					rr->header.rc = 0;
-					rr->header.length = htons((rrlen/4)-1);
-					janus_ice_stream *stream = handle->stream;
-					if(stream && stream->video_rtcp_ctx[0] && stream->video_rtcp_ctx[0]->rtp_recvd) {
-						rr->header.rc = 1;
-						janus_rtcp_report_block(stream->video_rtcp_ctx[0], &rr->rb[0]);
+				/* FIXME Copy in a buffer and fix SSRC */
+				char sbuf[JANUS_BUFSIZE];
+				if(pkt->shared != NULL) {
+					/* Only the header is ours, the payload is shared with other handles */
+					memcpy(sbuf, pkt->data, pkt->hlen);
+					memcpy(sbuf+pkt->hlen, pkt->shared->buffer+pkt->hlen, pkt->length-pkt->hlen);
+				} else {
+					memcpy(sbuf, pkt->data, pkt->length);
+				}
+				/* Overwrite SSRC */
+				janus_rtp_header *header = (janus_rtp_header *)sbuf;
+				/* ... unless the plugin is multiplexing more streams, and this is one of the additional SSRCs */
+				gboolean extra = FALSE;
+				if(!pkt->retransmission && g_atomic_int_get(&stream->extra_ssrcs_num) > 0)
+					extra = janus_ice_stream_find_extra_ssrc(stream, ntohl(header->ssrc), NULL);
+				if(!pkt->retransmission && !extra) {
+					/* ... but only if this isn't a retransmission (for those we already set it before) */
+					header->ssrc = htonl(video ? stream->video_ssrc : stream->audio_ssrc);
+				}
+				/* Keep track of payload types too */
+				if(!video && stream->audio_payload_type < 0) {
+					stream->audio_payload_type = header->type;
+					if(stream->audio_codec == NULL) {
+						const char *codec = janus_sdp_negotiation_get_codec_name(handle->local_negotiation, stream->audio_payload_type);
+						if(codec != NULL)
+							stream->audio_codec = g_strdup(codec);
 					}
-					/* Append REMB */
-					memcpy(rtcpbuf+rrlen, pkt->data, pkt->length);
-					/* If we're simulcasting, set the extra SSRCs (the first one will be set by janus_rtcp_fix_ssrc) */
-					if(stream->video_ssrc_peer[1] && pkt->length >= 28) {
-						rtcp_fb *rtcpfb = (rtcp_fb *)(rtcpbuf+rrlen);
-						rtcp_remb *remb = (rtcp_remb *)rtcpfb->fci;
-						remb->ssrc[1] = htonl(stream->video_ssrc_peer[1]);
-						if(stream->video_ssrc_peer[2] && pkt->length >= 32) {
-							remb->ssrc[2] = htonl(stream->video_ssrc_peer[2]);
-						}
+				} else if(video && stream->video_payload_type < 0) {
+					stream->video_payload_type = header->type;
+					if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX) &&
+							stream->rtx_payload_types && g_hash_table_size(stream->rtx_payload_types) > 0) {
+						stream->video_rtx_payload_type = GPOINTER_TO_INT(g_hash_table_lookup(stream->rtx_payload_types, GINT_TO_POINTER(stream->video_payload_type)));
+						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Retransmissions will have payload type %d\n",
+							handle->handle_id, stream->video_rtx_payload_type);
+					}
+					if(stream->video_codec == NULL) {
+						const char *codec = janus_sdp_negotiation_get_codec_name(handle->local_negotiation, stream->video_payload_type);
+						if(codec != NULL)
+							stream->video_codec = g_strdup(codec);
+					}
+					if(stream->video_is_keyframe == NULL && stream->video_codec != NULL) {
+						if(!strcasecmp(stream->video_codec, "vp8"))
+							stream->video_is_keyframe = &janus_vp8_is_keyframe;
+						else if(!strcasecmp(stream->video_codec, "vp9"))
+							stream->video_is_keyframe = &janus_vp9_is_keyframe;
+						else if(!strcasecmp(stream->video_codec, "h264"))
+							stream->video_is_keyframe = &janus_h264_is_keyframe;
 					}
-					/* Free old packet and update */
-					char *prev_data = pkt->data;
-					pkt->data = rtcpbuf;
-					pkt->length = rrlen+pkt->length;
-					g_clear_pointer(&prev_data, g_free);
 				}
-				/* FIXME Copy in a buffer and fix SSRC */
-				char sbuf[JANUS_BUFSIZE];
-				memcpy(sbuf, pkt->data, pkt->length);
 				/* Do we need to dump this packet for debugging? */
 				if(g_atomic_int_get(&handle->dump_packets))
-					janus_text2pcap_dump(handle->text2pcap, JANUS_TEXT2PCAP_RTCP, FALSE, sbuf, pkt->length,
+					janus_text2pcap_dump(handle->text2pcap, JANUS_TEXT2PCAP_RTP, FALSE, sbuf, pkt->length,
 						"[session=%"SCNu64"][handle=%"SCNu64"]", session->session_id, handle->handle_id);
-				/* Encrypt SRTCP */
+				/* If this is video, check if this is a keyframe: if so, we empty our retransmit buffer for incoming NACKs */
+				if(video && stream->video_is_keyframe && !extra) {
+					int plen = 0;
+					char *payload = janus_rtp_payload(sbuf, pkt->length, &plen);
+					if(stream->video_is_keyframe(payload, plen)) {
+						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Keyframe sent, cleaning retransmit buffer\n", handle->handle_id);
+						janus_cleanup_nack_buffer(0, stream, FALSE, TRUE);
+					}
+				}
+				/* Encrypt SRTP */
 				int protected = pkt->length;
-				int res = srtp_protect_rtcp(component->dtls->srtp_out, sbuf, &protected);
+				int res = srtp_protect(component->dtls->srtp_out, sbuf, &protected);
 				if(res != srtp_err_status_ok) {
 					/* We don't spam the logs for every SRTP error: just take note of this, and print a summary later */
 					handle->srtp_errors_count++;
 					handle->last_srtp_error = res;
+					janus_metrics_inc(metric_srtp_errors_out);
 					/* If we're debugging, though, print every occurrence */
-					JANUS_LOG(LOG_DBG, "[%"SCNu64"] ... SRTCP protect error... %s (len=%d-->%d)...\n", handle->handle_id, janus_srtp_error_str(res), pkt->length, protected);
+					janus_rtp_header *header = (janus_rtp_header *)sbuf;
+					guint32 timestamp = ntohl(header->timestamp);
+					guint16 seq = ntohs(header->seq_number);
+					JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... SRTP protect error... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n", handle->handle_id, janus_srtp_error_str(res), pkt->length, protected, timestamp, seq);
 				} else {
 					/* Shoot! */
-					int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, protected, sbuf);
+					int sent = janus_ice_send_buffer(handle, stream, component, protected, sbuf);
 					if(sent < protected) {
 						JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
 					}
-				}
-			}
-			g_free(pkt->data);
-			g_free(pkt);
-			continue;
-		} else {
-			/* RTP or data */
-			if(pkt->type == JANUS_ICE_PACKET_AUDIO || pkt->type == JANUS_ICE_PACKET_VIDEO) {
-				/* RTP */
-				int video = (pkt->type == JANUS_ICE_PACKET_VIDEO);
-				janus_ice_stream *stream = handle->stream;
-				if(!stream) {
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-					continue;
-				}
-				if((!video && !stream->audio_send) || (video && !stream->video_send)) {
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-					continue;
-				}
-				janus_ice_component *component = stream->component;
-				if(!component) {
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-					continue;
-				}
-				if(!stream->cdone) {
-					if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && !stream->noerrorlog) {
-						JANUS_LOG(LOG_ERR, "[%"SCNu64"]     %s candidates not gathered yet for stream??\n", handle->handle_id, video ? "video" : "audio");
-						stream->noerrorlog = TRUE;	/* Don't flood with the same error all over again */
-					}
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-					continue;
-				}
-				stream->noerrorlog = FALSE;
-				if(!component->dtls || !component->dtls->srtp_valid || !component->dtls->srtp_out) {
-					if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && !component->noerrorlog) {
-						JANUS_LOG(LOG_WARN, "[%"SCNu64"]     %s stream component has no valid SRTP session (yet?)\n", handle->handle_id, video ? "video" : "audio");
-						component->noerrorlog = TRUE;	/* Don't flood with the same error all over again */
-					}
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-					continue;
-				}
-				component->noerrorlog = FALSE;
-				if(pkt->encrypted) {
-					/* Already RTP (probably a retransmission?) */
-					janus_rtp_header *header = (janus_rtp_header *)pkt->data;
-					JANUS_LOG(LOG_HUGE, "[%"SCNu64"] ... Retransmitting seq.nr %"SCNu16"\n\n", handle->handle_id, ntohs(header->seq_number));
-					int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, pkt->length, (const gchar *)pkt->data);
-					if(sent < pkt->length) {
-						JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
-					}
-				} else {
-					/* FIXME Copy in a buffer and fix SSRC */
-					char sbuf[JANUS_BUFSIZE];
-					memcpy(sbuf, pkt->data, pkt->length);
-					/* Overwrite SSRC */
-					janus_rtp_header *header = (janus_rtp_header *)sbuf;
-					if(!pkt->retransmission) {
-						/* ... but only if this isn't a retransmission (for those we already set it before) */
-						header->ssrc = htonl(video ? stream->video_ssrc : stream->audio_ssrc);
-					}
-					/* Keep track of payload types too */
-					if(!video && stream->audio_payload_type < 0) {
-						stream->audio_payload_type = header->type;
-						if(stream->audio_codec == NULL) {
-							const char *codec = janus_get_codec_from_pt(handle->local_sdp, stream->audio_payload_type);
-							if(codec != NULL)
-								stream->audio_codec = g_strdup(codec);
-						}
-					} else if(video && stream->video_payload_type < 0) {
-						stream->video_payload_type = header->type;
-						if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX) &&
-								stream->rtx_payload_types && g_hash_table_size(stream->rtx_payload_types) > 0) {
-							stream->video_rtx_payload_type = GPOINTER_TO_INT(g_hash_table_lookup(stream->rtx_payload_types, GINT_TO_POINTER(stream->video_payload_type)));
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Retransmissions will have payload type %d\n",
-								handle->handle_id, stream->video_rtx_payload_type);
-						}
-						if(stream->video_codec == NULL) {
-							const char *codec = janus_get_codec_from_pt(handle->local_sdp, stream->video_payload_type);
-							if(codec != NULL)
-								stream->video_codec = g_strdup(codec);
-						}
-						if(stream->video_is_keyframe == NULL && stream->video_codec != NULL) {
-							if(!strcasecmp(stream->video_codec, "vp8"))
-								stream->video_is_keyframe = &janus_vp8_is_keyframe;
-							else if(!strcasecmp(stream->video_codec, "vp9"))
-								stream->video_is_keyframe = &janus_vp9_is_keyframe;
-							else if(!strcasecmp(stream->video_codec, "h264"))
-								stream->video_is_keyframe = &janus_h264_is_keyframe;
-						}
-					}
-					/* Do we need to dump this packet for debugging? */
-					if(g_atomic_int_get(&handle->dump_packets))
-						janus_text2pcap_dump(handle->text2pcap, JANUS_TEXT2PCAP_RTP, FALSE, sbuf, pkt->length,
-							"[session=%"SCNu64"][handle=%"SCNu64"]", session->session_id, handle->handle_id);
-					/* If this is video, check if this is a keyframe: if so, we empty our retransmit buffer for incoming NACKs */
-					if(video && stream->video_is_keyframe) {
-						int plen = 0;
-						char *payload = janus_rtp_payload(sbuf, pkt->length, &plen);
-						if(stream->video_is_keyframe(payload, plen)) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Keyframe sent, cleaning retransmit buffer\n", handle->handle_id);
-							janus_cleanup_nack_buffer(0, stream, FALSE, TRUE);
-						}
-					}
-					/* Encrypt SRTP */
-					int protected = pkt->length;
-					int res = srtp_protect(component->dtls->srtp_out, sbuf, &protected);
-					if(res != srtp_err_status_ok) {
-						/* We don't spam the logs for every SRTP error: just take note of this, and print a summary later */
-						handle->srtp_errors_count++;
-						handle->last_srtp_error = res;
-						/* If we're debugging, though, print every occurrence */
+					/* Update stats */
+					if(sent > 0) {
+						if(pkt->queued > 0)
+							janus_latency_record(handle->latency, JANUS_LATENCY_QUEUE_WIRE, janus_get_monotonic_time() - pkt->queued);
+						/* Update the RTCP context as well */
 						janus_rtp_header *header = (janus_rtp_header *)sbuf;
 						guint32 timestamp = ntohl(header->timestamp);
-						guint16 seq = ntohs(header->seq_number);
-						JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... SRTP protect error... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n", handle->handle_id, janus_srtp_error_str(res), pkt->length, protected, timestamp, seq);
-					} else {
-						/* Shoot! */
-						int sent = nice_agent_send(handle->agent, stream->stream_id, component->component_id, protected, sbuf);
-						if(sent < protected) {
-							JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
-						}
-						/* Update stats */
-						if(sent > 0) {
-							/* Update the RTCP context as well */
-							janus_rtp_header *header = (janus_rtp_header *)sbuf;
-							guint32 timestamp = ntohl(header->timestamp);
-							if(pkt->type == JANUS_ICE_PACKET_AUDIO) {
-								component->out_stats.audio.packets++;
-								component->out_stats.audio.bytes += pkt->length;
-								/* Last second outgoing audio */
-								gint64 now = janus_get_monotonic_time();
-								if(component->out_stats.audio.updated == 0)
-									component->out_stats.audio.updated = now;
-								if(now > component->out_stats.audio.updated &&
-										now - component->out_stats.audio.updated >= G_USEC_PER_SEC) {
-									component->out_stats.audio.bytes_lastsec = component->out_stats.audio.bytes_lastsec_temp;
-									component->out_stats.audio.bytes_lastsec_temp = 0;
-									component->out_stats.audio.updated = now;
-								}
-								component->out_stats.audio.bytes_lastsec_temp += pkt->length;
+						if(pkt->type == JANUS_ICE_PACKET_AUDIO) {
+							component->out_stats.audio.packets++;
+							component->out_stats.audio.bytes += pkt->length;
+							janus_metrics_inc(metric_packets_out[0]);
+							janus_metrics_add_value(metric_bytes_out[0], pkt->length);
+							/* Last second outgoing audio */
+							gint64 now = janus_get_monotonic_time();
+							if(component->out_stats.audio.updated == 0)
+								component->out_stats.audio.updated = now;
+							if(now > component->out_stats.audio.updated &&
+									now - component->out_stats.audio.updated >= G_USEC_PER_SEC) {
+								component->out_stats.audio.bytes_lastsec = component->out_stats.audio.bytes_lastsec_temp;
+								component->out_stats.audio.bytes_lastsec_temp = 0;
+								component->out_stats.audio.updated = now;
+							}
+							component->out_stats.audio.bytes_lastsec_temp += pkt->length;
+							/* Our sender reports only cover our own SSRC */
+							if(!extra) {
 								stream->audio_last_ts = timestamp;
 								if(stream->audio_first_ntp_ts == 0) {
 									struct timeval tv;
@@ -3954,25 +5320,29 @@ void *janus_ice_send_thread(void *data) {
 									stream->audio_first_ntp_ts = (gint64)tv.tv_sec*G_USEC_PER_SEC + tv.tv_usec;
 									stream->audio_first_rtp_ts = timestamp;
 								}
-								/* Let's check if this was G.711: in case we may need to change the timestamp base */
-								rtcp_context *rtcp_ctx = stream->audio_rtcp_ctx;
-								int pt = header->type;
-								if((pt == 0 || pt == 8) && (rtcp_ctx->tb == 48000))
-									rtcp_ctx->tb = 8000;
-							} else if(pkt->type == JANUS_ICE_PACKET_VIDEO) {
-								component->out_stats.video[0].packets++;
-								component->out_stats.video[0].bytes += pkt->length;
-								/* Last second outgoing video */
-								gint64 now = janus_get_monotonic_time();
-								if(component->out_stats.video[0].updated == 0)
-									component->out_stats.video[0].updated = now;
-								if(now > component->out_stats.video[0].updated &&
-										now - component->out_stats.video[0].updated >= G_USEC_PER_SEC) {
-									component->out_stats.video[0].bytes_lastsec = component->out_stats.video[0].bytes_lastsec_temp;
-									component->out_stats.video[0].bytes_lastsec_temp = 0;
-									component->out_stats.video[0].updated = now;
-								}
-								component->out_stats.video[0].bytes_lastsec_temp += pkt->length;
+							}
+							/* Let's check if this was G.711: in case we may need to change the timestamp base */
+							rtcp_context *rtcp_ctx = stream->audio_rtcp_ctx;
+							int pt = header->type;
+							if((pt == 0 || pt == 8) && (rtcp_ctx->tb == 48000))
+								rtcp_ctx->tb = 8000;
+						} else if(pkt->type == JANUS_ICE_PACKET_VIDEO) {
+							component->out_stats.video[0].packets++;
+							component->out_stats.video[0].bytes += pkt->length;
+							janus_metrics_inc(metric_packets_out[1]);
+							janus_metrics_add_value(metric_bytes_out[1], pkt->length);
+							/* Last second outgoing video */
+							gint64 now = janus_get_monotonic_time();
+							if(component->out_stats.video[0].updated == 0)
+								component->out_stats.video[0].updated = now;
+							if(now > component->out_stats.video[0].updated &&
+									now - component->out_stats.video[0].updated >= G_USEC_PER_SEC) {
+								component->out_stats.video[0].bytes_lastsec = component->out_stats.video[0].bytes_lastsec_temp;
+								component->out_stats.video[0].bytes_lastsec_temp = 0;
+								component->out_stats.video[0].updated = now;
+							}
+							component->out_stats.video[0].bytes_lastsec_temp += pkt->length;
+							if(!extra) {
 								stream->video_last_ts = timestamp;
 								if(stream->video_first_ntp_ts[0] == 0) {
 									struct timeval tv;
@@ -3981,130 +5351,346 @@ void *janus_ice_send_thread(void *data) {
 									stream->video_first_rtp_ts[0] = timestamp;
 								}
 							}
-							/* Update sent packets counter */
-							rtcp_context *rtcp_ctx = video ? stream->video_rtcp_ctx[0] : stream->audio_rtcp_ctx;
-							g_atomic_int_inc(&rtcp_ctx->sent_packets_since_last_rr);
 						}
-						if(max_nack_queue > 0) {
-							/* Save the packet for retransmissions that may be needed later */
-							if((pkt->type == JANUS_ICE_PACKET_AUDIO && !component->do_audio_nacks) ||
-									(pkt->type == JANUS_ICE_PACKET_VIDEO && !component->do_video_nacks)) {
-								/* ... unless NACKs are disabled for this medium */
-								g_free(pkt->data);
-								pkt->data = NULL;
-								g_free(pkt);
-								pkt = NULL;
-								continue;
-							}
+						/* Update sent packets counter */
+						rtcp_context *rtcp_ctx = video ? stream->video_rtcp_ctx[0] : stream->audio_rtcp_ctx;
+						g_atomic_int_inc(&rtcp_ctx->sent_packets_since_last_rr);
+					}
+					if(max_nack_queue > 0) {
+						/* Save the packet for retransmissions that may be needed later */
+						if((pkt->type == JANUS_ICE_PACKET_AUDIO && !component->do_audio_nacks) ||
+								(pkt->type == JANUS_ICE_PACKET_VIDEO && !component->do_video_nacks)) {
+							/* ... unless NACKs are disabled for this medium */
+							janus_ice_queued_packet_free(handle, pkt);
+							pkt = NULL;
+							return;
+						}
+						if(extra) {
+							/* An additional SSRC: its sequence numbers would clash with the ones of our own,
+							 * so it gets a buffer of its own, and we always retransmit on the same SSRC */
 							janus_rtp_packet *p = g_malloc(sizeof(janus_rtp_packet));
-							/* What to store and how depends on whether we're doing RFC4588 or not */
-							if(pkt->type == JANUS_ICE_PACKET_AUDIO || !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
-								/* We're not: just store the SRTP packet we just encrypted */
-								p->data = g_malloc(protected);
-								memcpy(p->data, sbuf, protected);
-								p->length = protected;
-							} else {
-								/* We are: make room for two more bytes to store the original sequence number */
-								janus_rtp_header *header = (janus_rtp_header *)pkt->data;
-								guint16 original_seq = header->seq_number;
-								p->data = g_malloc(pkt->length+2);
-								p->length = pkt->length+2;
-								/* Check where the payload starts */
-								int plen = 0;
-								char *payload = janus_rtp_payload(pkt->data, pkt->length, &plen);
-								size_t hsize = payload - pkt->data;
-								/* Copy the header first */
-								memcpy(p->data, pkt->data, hsize);
-								/* Copy the original sequence number */
-								memcpy(p->data+hsize, &original_seq, 2);
-								/* Copy the payload */
-								memcpy(p->data+hsize+2, payload, pkt->length - hsize);
-							}
+							p->data = g_malloc(protected);
+							memcpy(p->data, sbuf, protected);
+							p->length = protected;
 							p->created = janus_get_monotonic_time();
 							p->last_retransmit = 0;
-							janus_mutex_lock(&component->mutex);
 							janus_rtp_header *header = (janus_rtp_header *)sbuf;
-							guint16 seq = ntohs(header->seq_number);
-							if(!video) {
-								if(component->audio_retransmit_buffer == NULL) {
-									component->audio_retransmit_buffer = g_queue_new();
-									component->audio_retransmit_seqs = g_hash_table_new(NULL, NULL);
-								}
-								g_queue_push_tail(component->audio_retransmit_buffer, p);
-								/* Insert in the table too, for quick lookup */
-								g_hash_table_insert(component->audio_retransmit_seqs, GUINT_TO_POINTER(seq), p);
-							} else {
-								if(component->video_retransmit_buffer == NULL) {
-									component->video_retransmit_buffer = g_queue_new();
-									component->video_retransmit_seqs = g_hash_table_new(NULL, NULL);
-								}
-								g_queue_push_tail(component->video_retransmit_buffer, p);
-								/* Insert in the table too, for quick lookup */
-								g_hash_table_insert(component->video_retransmit_seqs, GUINT_TO_POINTER(seq), p);
+							guint32 ssrc = ntohl(header->ssrc);
+							janus_mutex_lock(&component->mutex);
+							if(component->extra_retransmit_buffers == NULL)
+								component->extra_retransmit_buffers = g_hash_table_new_full(NULL, NULL,
+									NULL, (GDestroyNotify)janus_ice_retransmit_buffer_destroy);
+							janus_ice_retransmit_buffer *buffer = g_hash_table_lookup(component->extra_retransmit_buffers, GUINT_TO_POINTER(ssrc));
+							if(buffer == NULL) {
+								buffer = janus_ice_retransmit_buffer_new(video ? 200 : 50);
+								g_hash_table_insert(component->extra_retransmit_buffers, GUINT_TO_POINTER(ssrc), buffer);
 							}
+							janus_ice_retransmit_buffer_insert(buffer, ntohs(header->seq_number), p);
 							janus_mutex_unlock(&component->mutex);
+							janus_ice_queued_packet_free(handle, pkt);
+							pkt = NULL;
+							return;
+						}
+						janus_rtp_packet *p = g_malloc(sizeof(janus_rtp_packet));
+						/* What to store and how depends on whether we're doing RFC4588 or not */
+						if(pkt->type == JANUS_ICE_PACKET_AUDIO || !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
+							/* We're not: just store the SRTP packet we just encrypted */
+							p->data = g_malloc(protected);
+							memcpy(p->data, sbuf, protected);
+							p->length = protected;
+						} else {
+							/* We are: make room for two more bytes to store the original sequence number */
+							janus_rtp_header *header = (janus_rtp_header *)pkt->data;
+							guint16 original_seq = header->seq_number;
+							p->data = g_malloc(pkt->length+2);
+							p->length = pkt->length+2;
+							/* Check where the payload starts */
+							int plen = 0;
+							char *payload = NULL;
+							size_t hsize = 0;
+							if(pkt->shared != NULL) {
+								payload = pkt->shared->buffer+pkt->hlen;
+								hsize = pkt->hlen;
+							} else {
+								payload = janus_rtp_payload(pkt->data, pkt->length, &plen);
+								hsize = payload - pkt->data;
+							}
+							/* Copy the header first */
+							memcpy(p->data, pkt->data, hsize);
+							/* Copy the original sequence number */
+							memcpy(p->data+hsize, &original_seq, 2);
+							/* Copy the payload */
+							memcpy(p->data+hsize+2, payload, pkt->length - hsize);
+						}
+						p->created = janus_get_monotonic_time();
+						p->last_retransmit = 0;
+						janus_mutex_lock(&component->mutex);
+						janus_rtp_header *header = (janus_rtp_header *)sbuf;
+						guint16 seq = ntohs(header->seq_number);
+						if(!video) {
+							/* Audio is usually 50 packets per second */
+							if(component->audio_retransmit_buffer == NULL)
+								component->audio_retransmit_buffer = janus_ice_retransmit_buffer_new(50);
+							janus_ice_retransmit_buffer_insert(component->audio_retransmit_buffer, seq, p);
+						} else {
+							if(component->video_retransmit_buffer == NULL) {
+								/* Estimate the packet rate from the bitrate we're sending (assuming ~1200 bytes packets) */
+								guint pps = component->out_stats.video[0].bytes_lastsec / 1200;
+								component->video_retransmit_buffer = janus_ice_retransmit_buffer_new(pps > 200 ? pps : 200);
+							}
+							janus_ice_retransmit_buffer_insert(component->video_retransmit_buffer, seq, p);
 						}
+						janus_mutex_unlock(&component->mutex);
 					}
 				}
-			} else {
-				/* Data */
-				if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_DATA_CHANNELS)) {
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-					continue;
-				}
+			}
+		} else {
+			/* Data */
+			if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_DATA_CHANNELS)) {
+				janus_ice_queued_packet_free(handle, pkt);
+				pkt = NULL;
+				return;
+			}
 #ifdef HAVE_SCTP
-				janus_ice_stream *stream = handle->stream;
-				if(!stream) {
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-					continue;
-				}
-				janus_ice_component *component = stream->component;
-				if(!component) {
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-					continue;
+			janus_ice_stream *stream = handle->stream;
+			if(!stream) {
+				janus_ice_queued_packet_free(handle, pkt);
+				pkt = NULL;
+				return;
+			}
+			janus_ice_component *component = stream->component;
+			if(!component) {
+				janus_ice_queued_packet_free(handle, pkt);
+				pkt = NULL;
+				return;
+			}
+			if(!stream->cdone) {
+				if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && !stream->noerrorlog) {
+					JANUS_LOG(LOG_ERR, "[%"SCNu64"]     SCTP candidates not gathered yet for stream??\n", handle->handle_id);
+					stream->noerrorlog = TRUE;	/* Don't flood with the same error all over again */
 				}
-				if(!stream->cdone) {
-					if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && !stream->noerrorlog) {
-						JANUS_LOG(LOG_ERR, "[%"SCNu64"]     SCTP candidates not gathered yet for stream??\n", handle->handle_id);
-						stream->noerrorlog = TRUE;	/* Don't flood with the same error all over again */
-					}
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-					continue;
+				janus_ice_queued_packet_free(handle, pkt);
+				pkt = NULL;
+				return;
+			}
+			stream->noerrorlog = FALSE;
+			if(!component->dtls) {
+				if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && !component->noerrorlog) {
+					JANUS_LOG(LOG_WARN, "[%"SCNu64"]     SCTP stream component has no valid DTLS session (yet?)\n", handle->handle_id);
+					component->noerrorlog = TRUE;	/* Don't flood with the same error all over again */
 				}
-				stream->noerrorlog = FALSE;
-				if(!component->dtls) {
-					if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) && !component->noerrorlog) {
-						JANUS_LOG(LOG_WARN, "[%"SCNu64"]     SCTP stream component has no valid DTLS session (yet?)\n", handle->handle_id);
-						component->noerrorlog = TRUE;	/* Don't flood with the same error all over again */
-					}
-					g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
+				janus_ice_queued_packet_free(handle, pkt);
+				pkt = NULL;
+				return;
+			}
+			component->noerrorlog = FALSE;
+			janus_dtls_wrap_sctp_data(component->dtls, pkt->type == JANUS_ICE_PACKET_BINARY,
+				pkt->shared ? pkt->shared->buffer : pkt->data, pkt->length);
+#endif
+		}
+		janus_ice_queued_packet_free(handle, pkt);
+		pkt = NULL;
+		return;
+	}
+}
+
+/* Pacing: rather than sending video back-to-back as soon as it's queued
+ * (which, for keyframes, means dozens of packets in a row), we let it out
+ * of a leaky bucket whose rate follows the estimated bitrate. Audio, RTCP
+ * and data never go through the bucket, so they don't get any latency */
+#define JANUS_ICE_PACING_FACTOR_NUM		5	/* We pace at 2.5x the estimated bitrate */
+#define JANUS_ICE_PACING_FACTOR_DEN		2
+#define JANUS_ICE_PACING_MIN_RATE		(64*1024)	/* Bytes per second, e.g., before we have an estimate */
+#define JANUS_ICE_PACING_MIN_BURST		(2*JANUS_ICE_PACKET_POOL_BUFSIZE)
+typedef struct janus_ice_pacer {
+	/* Video packets waiting to be sent */
+	GQueue packets;
+	/* How many bytes are waiting */
+	gint64 queued_bytes;
+	/* How many bytes we can send right now (negative when we sent more than we should have) */
+	gint64 budget;
+	/* When we last updated the budget */
+	gint64 last;
+} janus_ice_pacer;
+
+static gboolean janus_ice_pacer_is_paced(janus_ice_queued_packet *pkt) {
+	return pkt->type == JANUS_ICE_PACKET_VIDEO && !pkt->control && pkt->data != NULL;
+}
+
+/* Bytes per second we can send right now */
+static gint64 janus_ice_pacer_rate(janus_ice_handle *handle, janus_ice_pacer *pacer) {
+	gint64 estimate = 0;
+	janus_ice_stream *stream = handle->stream;
+	if(stream && stream->component)
+		estimate = stream->component->out_stats.video[0].bytes_lastsec;
+	gint64 remb = g_atomic_int_get(&handle->pacing_remb)/8;
+	if(remb > estimate)
+		estimate = remb;
+	gint64 rate = estimate*JANUS_ICE_PACING_FACTOR_NUM/JANUS_ICE_PACING_FACTOR_DEN;
+	if(rate < JANUS_ICE_PACING_MIN_RATE)
+		rate = JANUS_ICE_PACING_MIN_RATE;
+	/* Never keep packets longer than pacing_max_delay: if that's what the rate would do, speed up */
+	gint64 drain = pacer->queued_bytes*G_USEC_PER_SEC/pacing_max_delay;
+	return drain > rate ? drain : rate;
+}
+
+static void janus_ice_pacer_refill(janus_ice_pacer *pacer, gint64 now, gint64 rate) {
+	if(now > pacer->last) {
+		pacer->budget += (now-pacer->last)*rate/G_USEC_PER_SEC;
+		/* Don't let an idle period accumulate into a new burst */
+		gint64 burst = rate/1000;
+		if(burst < JANUS_ICE_PACING_MIN_BURST)
+			burst = JANUS_ICE_PACING_MIN_BURST;
+		if(pacer->budget > burst)
+			pacer->budget = burst;
+	}
+	pacer->last = now;
+}
+
+/* Check if a queued packet must wait in the pacer: if not, it's accounted
+ * for but not taken, and the caller is expected to send it right away */
+static gboolean janus_ice_pacer_enqueue(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+	if(!pacing_enabled || pkt == NULL || !janus_ice_pacer_is_paced(pkt))
+		return FALSE;
+	janus_ice_pacer *pacer = handle->pacer;
+	if(pacer == NULL) {
+		pacer = g_malloc0(sizeof(janus_ice_pacer));
+		g_queue_init(&pacer->packets);
+		pacer->budget = JANUS_ICE_PACING_MIN_BURST;
+		pacer->last = janus_get_monotonic_time();
+		handle->pacer = pacer;
+	}
+	if(g_queue_is_empty(&pacer->packets)) {
+		janus_ice_pacer_refill(pacer, janus_get_monotonic_time(), janus_ice_pacer_rate(handle, pacer));
+		if(pacer->budget > 0) {
+			pacer->budget -= pkt->length;
+			return FALSE;
+		}
+	}
+	/* Retransmissions are late already, so they skip the line */
+	if(pkt->retransmission)
+		g_queue_push_head(&pacer->packets, pkt);
+	else
+		g_queue_push_tail(&pacer->packets, pkt);
+	pacer->queued_bytes += pkt->length;
+	g_atomic_int_inc(&handle->paced_video);
+	return TRUE;
+}
+
+/* Send all the paced packets the budget allows for: returns how many
+ * microseconds to wait for the next one, or -1 if there's none left */
+static gint64 janus_ice_pacer_drain(janus_ice_handle *handle, gint64 now) {
+	janus_ice_pacer *pacer = handle->pacer;
+	if(pacer == NULL || g_queue_is_empty(&pacer->packets))
+		return -1;
+	gint64 rate = janus_ice_pacer_rate(handle, pacer);
+	janus_ice_pacer_refill(pacer, now, rate);
+	janus_ice_queued_packet *pkt = NULL;
+	while(pacer->budget > 0 && (pkt = g_queue_pop_head(&pacer->packets)) != NULL) {
+		pacer->budget -= pkt->length;
+		pacer->queued_bytes -= pkt->length;
+		janus_ice_outgoing_packet(handle, pkt);
+	}
+	if(g_queue_is_empty(&pacer->packets))
+		return -1;
+	return (-pacer->budget)*G_USEC_PER_SEC/rate + 1;
+}
+
+/* Get rid of whatever is waiting in the pacer, e.g., when the PeerConnection goes away */
+static void janus_ice_pacer_flush(janus_ice_handle *handle) {
+	janus_ice_pacer *pacer = handle->pacer;
+	if(pacer == NULL)
+		return;
+	janus_ice_queued_packet *pkt = NULL;
+	while((pkt = g_queue_pop_head(&pacer->packets)) != NULL)
+		janus_ice_queued_packet_free(handle, pkt);
+	pacer->queued_bytes = 0;
+}
+
+// NICE_COMPONENT_STATE_CONNECTED之后启动janus_ice_send_thread线程函数，发生数据给对端
+void *janus_ice_send_thread(void *data) {
+	janus_ice_handle *handle = (janus_ice_handle *)data;
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] ICE send thread started...\n", handle->handle_id);
+	janus_affinity_pin_thread(janus_affinity_group_node(handle->placement_group));
+	janus_ice_queued_packet *pkt = NULL;
+	gint64 before = janus_get_monotonic_time(),
+		rtcp_last_sr_rr = before, last_event = before,
+		last_srtp_summary = before, last_nack_cleanup = before;
+	gboolean alert_sent = FALSE;
+	/* How long to wait for new packets: less than usual, if there's video waiting in the pacer */
+	gint64 wait = 500000;
+	while(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)) {
+		if(handle->queued_packets != NULL) {
+			// 获取插件传入的janus_ice_queued_packet包
+			pkt = g_async_queue_timeout_pop(handle->queued_packets, wait);
+		} else {
+			g_usleep(100000);
+		}
+		if(pkt == &janus_ice_dtls_alert) {
+			/* The session is over, send an alert on all streams and components */
+			if(!alert_sent && handle->stream && handle->stream->component && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY)) {
+				janus_dtls_srtp_send_alert(handle->stream->component->dtls);
+				alert_sent = TRUE;
+			}
+			janus_ice_pacer_flush(handle);
+			wait = 500000;
+			while(g_async_queue_length(handle->queued_packets) > 0) {
+				pkt = g_async_queue_try_pop(handle->queued_packets);
+				if(pkt != NULL && pkt != &janus_ice_dtls_alert) {
+					janus_ice_queued_packet_free(handle, pkt);
 					pkt = NULL;
-					continue;
 				}
-				component->noerrorlog = FALSE;
-				janus_dtls_wrap_sctp_data(component->dtls, pkt->data, pkt->length);
-#endif
 			}
-			g_free(pkt->data);
-			pkt->data = NULL;
-			g_free(pkt);
+			janus_ice_handle_loop_quit(handle);
+			continue;
+		}
+		if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY)) {
+			if(pkt)
+				janus_ice_queued_packet_free(handle, pkt);
 			pkt = NULL;
+			janus_ice_pacer_flush(handle);
+			wait = 500000;
 			continue;
 		}
+		if(alert_sent)
+			alert_sent = FALSE;
+		/* Reset the last second counters if too much time passed with no data in or out */
+		gint64 now = janus_get_monotonic_time();
+		janus_ice_outgoing_reset_lastsec(handle, now);
+		/* Let's see if we need to notify the user about no incoming audio or video */
+		if(no_media_timer > 0 && now-before >= G_USEC_PER_SEC) {
+			janus_ice_outgoing_check_no_media(handle, now);
+			before = now;
+		}
+		/* Let's check if it's time to send a RTCP SR/SDES/RR as well */
+		if(now-rtcp_last_sr_rr >= 1*G_USEC_PER_SEC) {
+			rtcp_last_sr_rr = now;
+			janus_ice_outgoing_rtcp_reports(handle);
+		}
+		/* We tell event handlers once per second about RTCP-related stuff
+		 * FIXME Should we really do this here? Would this slow down this thread and add delay? */
+		if(janus_ice_event_stats_period > 0 && now-last_event >= (gint64)janus_ice_event_stats_period*G_USEC_PER_SEC) {
+			last_event = now;
+			janus_ice_outgoing_event_stats(handle);
+		}
+		/* Should we clean up old NACK buffers? (we check each 1/4 of the max_nack_queue time) */
+		if(max_nack_queue > 0 && (now-last_nack_cleanup >= (max_nack_queue*250))) {
+			/* Check if we do for all streams */
+			janus_cleanup_nack_buffer(now, handle->stream, TRUE, TRUE);
+			last_nack_cleanup = now;
+		}
+		/* Check if we should also print a summary of SRTP-related errors */
+		if(now-last_srtp_summary >= (2*G_USEC_PER_SEC)) {
+			janus_ice_outgoing_srtp_summary(handle);
+			last_srtp_summary = now;
+		}
+		/* Now let's get on with the packets: video may have to wait in the pacer */
+		if(!janus_ice_pacer_enqueue(handle, pkt))
+			janus_ice_outgoing_packet(handle, pkt);
+		pkt = NULL;
+		wait = janus_ice_pacer_drain(handle, janus_get_monotonic_time());
+		if(wait < 0 || wait > 500000)
+			wait = 500000;
 	}
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] ICE send thread leaving...\n", handle->handle_id);
 	g_thread_unref(g_thread_self());
@@ -4112,26 +5698,237 @@ void *janus_ice_send_thread(void *data) {
 	return NULL;
 }
 
-void janus_ice_relay_rtp(janus_ice_handle *handle, int video, char *buf, int len) {
+/* Outgoing traffic on the ICE loop: rather than having a send thread
+ * waiting on the queue, a source drains it whenever the relay methods
+ * wake the loop up, and the periodic stuff is handled by timers */
+typedef struct janus_ice_outgoing_source {
+	GSource parent;
+	janus_ice_handle *handle;
+} janus_ice_outgoing_source;
+
+static gboolean janus_ice_outgoing_source_pending(GSource *source) {
+	janus_ice_handle *handle = ((janus_ice_outgoing_source *)source)->handle;
+	return handle->queued_packets != NULL && g_async_queue_length(handle->queued_packets) > 0;
+}
+
+static gboolean janus_ice_outgoing_source_prepare(GSource *source, gint *timeout) {
+	*timeout = -1;
+	if(janus_ice_outgoing_source_pending(source))
+		return TRUE;
+	/* If there's video waiting in the pacer, wake up when we can send the next packet */
+	janus_ice_handle *handle = ((janus_ice_outgoing_source *)source)->handle;
+	janus_ice_pacer *pacer = handle->pacer;
+	if(pacer == NULL || g_queue_is_empty(&pacer->packets))
+		return FALSE;
+	gint64 rate = janus_ice_pacer_rate(handle, pacer);
+	janus_ice_pacer_refill(pacer, janus_get_monotonic_time(), rate);
+	if(pacer->budget > 0)
+		return TRUE;
+	*timeout = ((-pacer->budget)*G_USEC_PER_SEC/rate + 999)/1000;
+	return FALSE;
+}
+
+static gboolean janus_ice_outgoing_source_check(GSource *source) {
+	gint timeout = 0;
+	return janus_ice_outgoing_source_prepare(source, &timeout);
+}
+
+static gboolean janus_ice_outgoing_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+	janus_ice_handle *handle = ((janus_ice_outgoing_source *)source)->handle;
+	/* Only handle what's queued right now, so that we don't starve the other sources */
+	gint pending = g_async_queue_length(handle->queued_packets);
+	janus_ice_queued_packet *pkt = NULL;
+	janus_ice_send_batch_start(handle);
+	while(pending-- > 0 && (pkt = g_async_queue_try_pop(handle->queued_packets)) != NULL) {
+		if(pkt == &janus_ice_dtls_alert) {
+			janus_ice_send_batch_stop(handle);
+			/* The session is over, send an alert on all streams and components */
+			if(handle->stream && handle->stream->component && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY))
+				janus_dtls_srtp_send_alert(handle->stream->component->dtls);
+			janus_ice_pacer_flush(handle);
+			while(g_async_queue_length(handle->queued_packets) > 0) {
+				pkt = g_async_queue_try_pop(handle->queued_packets);
+				if(pkt != NULL && pkt != &janus_ice_dtls_alert) {
+					janus_ice_queued_packet_free(handle, pkt);
+				}
+			}
+			janus_ice_handle_loop_quit(handle);
+			break;
+		}
+		if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY)) {
+			janus_ice_queued_packet_free(handle, pkt);
+			janus_ice_pacer_flush(handle);
+			continue;
+		}
+		/* Video may have to wait in the pacer */
+		if(!janus_ice_pacer_enqueue(handle, pkt))
+			janus_ice_outgoing_packet(handle, pkt);
+	}
+	janus_ice_pacer_drain(handle, janus_get_monotonic_time());
+	janus_ice_send_batch_stop(handle);
+	return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs janus_ice_outgoing_source_funcs = {
+	janus_ice_outgoing_source_prepare,
+	janus_ice_outgoing_source_check,
+	janus_ice_outgoing_source_dispatch,
+	NULL, NULL, NULL
+};
+
+static gboolean janus_ice_outgoing_rtcp_timer(gpointer user_data) {
+	janus_ice_handle *handle = (janus_ice_handle *)user_data;
+	if(!janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY))
+		return G_SOURCE_CONTINUE;
+	gint64 now = janus_get_monotonic_time();
+	janus_ice_outgoing_reset_lastsec(handle, now);
+	if(no_media_timer > 0)
+		janus_ice_outgoing_check_no_media(handle, now);
+	janus_ice_outgoing_rtcp_reports(handle);
+	if(janus_ice_event_stats_period > 0 && now-handle->last_event_stats >= (gint64)janus_ice_event_stats_period*G_USEC_PER_SEC) {
+		handle->last_event_stats = now;
+		janus_ice_outgoing_event_stats(handle);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean janus_ice_outgoing_nack_cleanup_timer(gpointer user_data) {
+	janus_ice_handle *handle = (janus_ice_handle *)user_data;
+	if(max_nack_queue > 0)
+		janus_cleanup_nack_buffer(janus_get_monotonic_time(), handle->stream, TRUE, TRUE);
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean janus_ice_outgoing_srtp_summary_timer(gpointer user_data) {
+	janus_ice_outgoing_srtp_summary((janus_ice_handle *)user_data);
+	return G_SOURCE_CONTINUE;
+}
+
+static GSource *janus_ice_outgoing_timer_attach(janus_ice_handle *handle, guint interval, GSourceFunc func) {
+	GSource *timer = g_timeout_source_new(interval);
+	g_source_set_callback(timer, func, handle, NULL);
+	g_source_attach(timer, handle->icectx);
+	return timer;
+}
+
+static void janus_ice_outgoing_traffic_start(janus_ice_handle *handle) {
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Handling outgoing traffic on the ICE loop\n", handle->handle_id);
+	GSource *source = g_source_new(&janus_ice_outgoing_source_funcs, sizeof(janus_ice_outgoing_source));
+	((janus_ice_outgoing_source *)source)->handle = handle;
+	g_source_set_priority(source, G_PRIORITY_DEFAULT);
+	g_source_attach(source, handle->icectx);
+	handle->outgoing_source = source;
+	handle->last_event_stats = janus_get_monotonic_time();
+	handle->rtcp_timer = janus_ice_outgoing_timer_attach(handle, 1000, janus_ice_outgoing_rtcp_timer);
+	/* We check each 1/4 of the max_nack_queue time, as the send thread does */
+	handle->nack_cleanup_timer = janus_ice_outgoing_timer_attach(handle,
+		max_nack_queue > 0 ? max_nack_queue/4 : DEFAULT_MAX_NACK_QUEUE/4, janus_ice_outgoing_nack_cleanup_timer);
+	handle->srtp_summary_timer = janus_ice_outgoing_timer_attach(handle, 2000, janus_ice_outgoing_srtp_summary_timer);
+}
+
+static void janus_ice_outgoing_source_clear(GSource **source) {
+	if(*source == NULL)
+		return;
+	g_source_destroy(*source);
+	g_source_unref(*source);
+	*source = NULL;
+}
+
+static void janus_ice_outgoing_traffic_stop(janus_ice_handle *handle) {
+	if(handle->outgoing_source == NULL)
+		return;
+	janus_ice_outgoing_source_clear(&handle->outgoing_source);
+	janus_ice_outgoing_source_clear(&handle->rtcp_timer);
+	janus_ice_outgoing_source_clear(&handle->nack_cleanup_timer);
+	janus_ice_outgoing_source_clear(&handle->srtp_summary_timer);
+	/* A new PeerConnection on this handle will need new sources */
+	g_atomic_int_set(&handle->send_thread_created, 0);
+}
+
+/* Helper to enqueue an outgoing packet, and wake up the ICE loop if it's the one sending */
+static void janus_ice_queue_packet(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+	if(handle->queued_packets == NULL) {
+		janus_ice_queued_packet_free(handle, pkt);
+		return;
+	}
+	g_async_queue_push(handle->queued_packets, pkt);
+	if(handle->outgoing_source != NULL && handle->icectx != NULL)
+		g_main_context_wakeup(handle->icectx);
+}
+
+static void janus_ice_relay_rtp_internal(janus_ice_handle *handle, int video, char *buf, int len, janus_plugin_rtp *shared) {
 	if(!handle || buf == NULL || len < 1)
 		return;
 	if((!video && !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO))
 			|| (video && !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO)))
 		return;
-	
+	if((max_queued_packets > 0 || max_queued_age > 0) && handle->queued_packets != NULL) {
+		/* Make sure the queue doesn't grow out of control, e.g., because the peer is stalling */
+		guint limit = max_queued_packets > 0 ? max_queued_packets : G_MAXINT;
+		guint queued = g_async_queue_length(handle->queued_packets);
+		if(!video) {
+			/* Audio is cheap and doesn't need keyframes, so we're more lenient with it */
+			if(max_queued_packets > 0 && queued >= 2*limit) {
+				janus_ice_queue_dropped(handle, FALSE);
+				return;
+			}
+		} else if(g_atomic_int_get(&handle->queue_dropping)) {
+			/* We dropped some video already, wait for a keyframe (if we can detect them) before resuming */
+			gboolean resume = janus_ice_queue_is_keyframe(handle, buf, len) ? (queued < limit) :
+				(handle->stream == NULL || handle->stream->video_is_keyframe == NULL) && queued < limit/2;
+			if(!resume) {
+				janus_ice_queue_dropped(handle, TRUE);
+				return;
+			}
+			JANUS_LOG(LOG_INFO, "[%"SCNu64"] Outgoing queue back to normal, resuming video\n", handle->handle_id);
+			g_atomic_int_set(&handle->queue_dropping, 0);
+		} else if(queued >= limit) {
+			janus_ice_queue_dropped(handle, TRUE);
+			return;
+		}
+	}
+
 	/* Queue this packet */
 	// 构建janus_ice_queued_packet包
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(len);
-	memcpy(pkt->data, buf, len);
-	pkt->length = len;
+	janus_ice_queued_packet *pkt = NULL;
+	int plen = 0;
+	char *payload = shared ? janus_rtp_payload(buf, len, &plen) : NULL;
+	if(payload != NULL && plen > 0) {
+		/* Only copy the header (which may have been rewritten for this handle), and reference the payload */
+		int hlen = payload - buf;
+		pkt = janus_ice_queued_packet_new(handle, hlen);
+		memcpy(pkt->data, buf, hlen);
+		pkt->length = len;
+		pkt->hlen = hlen;
+		janus_plugin_rtp_ref(shared);
+		pkt->shared = shared;
+	} else {
+		pkt = janus_ice_queued_packet_new(handle, len);
+		memcpy(pkt->data, buf, len);
+	}
 	pkt->type = video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
 	pkt->control = FALSE;
 	pkt->encrypted = FALSE;
 	pkt->retransmission = FALSE;
+	if(janus_latency_is_enabled() || max_queued_age > 0) {
+		pkt->queued = janus_get_monotonic_time();
+		/* If a plugin is relaying this from its incoming_rtp, we know how long it took */
+		gint64 mark = janus_latency_is_enabled() ? janus_latency_get_mark() : 0;
+		if(mark > 0)
+			janus_latency_record(handle->latency, JANUS_LATENCY_PLUGIN_QUEUE, pkt->queued - mark);
+	}
 	// 数据包添加到队列
-	if(handle->queued_packets != NULL)
-		g_async_queue_push(handle->queued_packets, pkt);
+	janus_ice_queue_packet(handle, pkt);
+}
+
+void janus_ice_relay_rtp(janus_ice_handle *handle, int video, char *buf, int len) {
+	janus_ice_relay_rtp_internal(handle, video, buf, len, NULL);
+}
+
+void janus_ice_relay_rtp_shared(janus_ice_handle *handle, janus_plugin_rtp *packet) {
+	if(packet == NULL || packet->length > JANUS_BUFSIZE)
+		return;
+	janus_ice_relay_rtp_internal(handle, packet->video, packet->buffer, packet->length, packet);
 }
 
 void janus_ice_relay_rtcp_internal(janus_ice_handle *handle, int video, char *buf, int len, gboolean filter_rtcp) {
@@ -4161,16 +5958,13 @@ void janus_ice_relay_rtcp_internal(janus_ice_handle *handle, int video, char *bu
 			video ? stream->video_ssrc_peer[0] : stream->audio_ssrc_peer);
 	}
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(len);
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, rtcp_len);
 	memcpy(pkt->data, rtcp_buf, rtcp_len);
-	pkt->length = rtcp_len;
 	pkt->type = video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
 	pkt->control = TRUE;
 	pkt->encrypted = FALSE;
 	pkt->retransmission = FALSE;
-	if(handle->queued_packets != NULL)
-		g_async_queue_push(handle->queued_packets, pkt);
+	janus_ice_queue_packet(handle, pkt);
 	if(rtcp_buf != buf) {
 		/* We filtered the original packet, deallocate it */
 		g_free(rtcp_buf);
@@ -4182,30 +5976,48 @@ void janus_ice_relay_rtcp(janus_ice_handle *handle, int video, char *buf, int le
 }
 
 #ifdef HAVE_SCTP
-void janus_ice_relay_data(janus_ice_handle *handle, char *buf, int len) {
+void janus_ice_relay_data(janus_ice_handle *handle, gboolean binary, char *buf, int len) {
 	if(!handle || buf == NULL || len < 1)
 		return;
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(len);
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, len);
 	memcpy(pkt->data, buf, len);
-	pkt->length = len;
+	pkt->type = binary ? JANUS_ICE_PACKET_BINARY : JANUS_ICE_PACKET_DATA;
+	pkt->control = FALSE;
+	pkt->encrypted = FALSE;
+	pkt->retransmission = FALSE;
+	janus_ice_queue_packet(handle, pkt);
+}
+
+void janus_ice_relay_data_shared(janus_ice_handle *handle, janus_plugin_rtp *data) {
+	if(!handle || data == NULL || data->length < 1)
+		return;
+	/* Queue this packet, but without copying anything: the whole message is shared */
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(handle, 0);
+	pkt->length = data->length;
+	pkt->hlen = 0;
+	janus_plugin_rtp_ref(data);
+	pkt->shared = data;
 	pkt->type = JANUS_ICE_PACKET_DATA;
 	pkt->control = FALSE;
 	pkt->encrypted = FALSE;
 	pkt->retransmission = FALSE;
-	if(handle->queued_packets != NULL)
-		g_async_queue_push(handle->queued_packets, pkt);
+	janus_ice_queue_packet(handle, pkt);
 }
 #endif
 
 void janus_ice_dtls_handshake_done(janus_ice_handle *handle, janus_ice_component *component) {
 	if(!handle || !component)
 		return;
+	janus_mutex_lock(&handle->mutex);
+	/* When the handshake was done by a crypto worker, the component may be gone by now */
+	if(handle->stream == NULL || handle->stream->component != component) {
+		janus_mutex_unlock(&handle->mutex);
+		return;
+	}
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] The DTLS handshake for the component %d in stream %d has been completed\n",
 		handle->handle_id, component->component_id, component->stream_id);
 	/* Check if all components are ready */
-	janus_mutex_lock(&handle->mutex);
 	if(handle->stream) {
 		if(handle->stream->component && (!handle->stream->component->dtls ||
 				!handle->stream->component->dtls->srtp_valid)) {
@@ -4219,8 +6031,7 @@ void janus_ice_dtls_handshake_done(janus_ice_handle *handle, janus_ice_component
 	while(g_async_queue_length(handle->queued_packets) > 0) {
 		pkt = g_async_queue_try_pop(handle->queued_packets);
 		if(pkt != NULL && pkt != &janus_ice_dtls_alert) {
-			g_free(pkt->data);
-			g_free(pkt);
+			janus_ice_queued_packet_free(handle, pkt);
 		}
 	}
 	if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY)) {
@@ -30,6 +30,7 @@
 #include "sctp.h"
 #include "rtcp.h"
 #include "text2pcap.h"
+#include "latency.h"
 #include "utils.h"
 #include "plugins/plugin.h"
 
@@ -152,6 +153,62 @@ void janus_set_no_media_timer(uint timer);
  * @returns The current no-media event timer */
 uint janus_get_no_media_timer(void);
 
+/*! \brief Method to limit how many packets can be queued for a handle, before we start dropping them
+ * \note When video is dropped, we drop it until the next keyframe, and ask the plugin for a PLI as if
+ * the peer had sent it; audio is only dropped when the queue gets past twice the limit
+ * @param[in] packets The maximum number of packets in the queue of a handle (0 disables the limit) */
+void janus_set_max_queued_packets(uint packets);
+/*! \brief Method to get the current limit to queued packets (see above)
+ * @returns The current limit to queued packets */
+uint janus_get_max_queued_packets(void);
+/*! \brief Method to limit how long a packet can wait in the queue of a handle, before we drop it instead of sending it
+ * @param[in] age The maximum age of queued packets, in milliseconds (0 disables the limit) */
+void janus_set_max_queued_age(uint age);
+/*! \brief Method to get the current limit to the age of queued packets (see above)
+ * @returns The current limit to the age of queued packets, in milliseconds */
+uint janus_get_max_queued_age(void);
+
+/*! \brief Method to choose whether outgoing traffic should be handled by the ICE loop, rather than a dedicated thread
+ * \note When enabled, no "icesend" thread is spawned for handles: packets queued by the relay
+ * methods are sent by a source attached to the handle's loop, and the periodic RTCP, NACK
+ * buffer cleanup and SRTP errors summary are implemented as timers on the same loop
+ * @param[in] enabled Whether the ICE loop should send the outgoing traffic */
+void janus_ice_set_loop_send_enabled(gboolean enabled);
+
+/*! \brief Method to check whether outgoing traffic is handled by the ICE loop
+ * @returns TRUE if it is, FALSE if there's a send thread for each handle */
+gboolean janus_ice_is_loop_send_enabled(void);
+
+/*! \brief Method to choose whether packets sent by the ICE loop should be batched
+ * \note Only makes sense when loop_send is enabled: packets encrypted while draining the
+ * outgoing queue are collected, and passed to libnice all at once at the end of the wakeup
+ * via nice_agent_send_messages_nonblocking. PeerConnections using a TCP pair always send
+ * one packet at a time, as partial writes can happen there
+ * @param[in] enabled Whether outgoing packets should be batched */
+void janus_ice_set_batch_send_enabled(gboolean enabled);
+
+/*! \brief Method to check whether packets sent by the ICE loop are batched
+ * @returns TRUE if they are, FALSE otherwise */
+gboolean janus_ice_is_batch_send_enabled(void);
+
+/*! \brief Method to choose whether outgoing video should be paced
+ * \note When enabled, outgoing video RTP packets go through a leaky bucket per handle, whose rate
+ * is a multiple of the estimated bitrate (what we sent in the last second, or the peer's REMB if
+ * higher), so that bursts (e.g., keyframes) are spread over a few milliseconds rather than sent
+ * back-to-back. Audio, RTCP and data never wait in the pacer
+ * @param[in] enabled Whether outgoing video should be paced */
+void janus_ice_set_pacing_enabled(gboolean enabled);
+/*! \brief Method to check whether outgoing video is paced
+ * @returns TRUE if it is, FALSE otherwise */
+gboolean janus_ice_is_pacing_enabled(void);
+/*! \brief Method to set how long a video packet can wait in the pacer at most
+ * \note The pacer speeds up when needed to respect this: 10ms by default
+ * @param[in] delay The maximum pacing delay, in milliseconds (0 restores the default) */
+void janus_ice_set_pacing_max_delay(uint delay);
+/*! \brief Method to get how long a video packet can wait in the pacer at most (see above)
+ * @returns The maximum pacing delay, in milliseconds */
+uint janus_ice_get_pacing_max_delay(void);
+
 /*! \brief Method to enable or disable the RFC4588 support negotiation
  * @param[in] enabled The new timer value, in seconds */
 void janus_set_rfc4588_enabled(gboolean enabled);
@@ -178,6 +235,40 @@ void janus_ice_debugging_enable(void);
 /*! \brief Method to disable libnice debugging (the default) */
 void janus_ice_debugging_disable(void);
 
+/*! \brief Method to configure a pool of shared event loops for ICE handles
+ * \note By default (loops=0) each handle gets its own GMainLoop and thread:
+ * when a pool is configured, new handles are instead attached to the least
+ * loaded of a fixed set of loops, which own the related NiceAgents. This must
+ * be called before any handle is created, and can't be changed later.
+ * @param[in] loops The number of static event loops to spawn (0 to disable) */
+void janus_ice_set_static_event_loops(int loops);
+
+/*! \brief Method to get the number of static event loops, if any
+ * @returns The number of static event loops, or 0 if disabled */
+int janus_ice_get_static_event_loops(void);
+
+/*! \brief Method to stop and destroy all the static event loops, if any */
+void janus_ice_stop_static_event_loops(void);
+
+/*! \brief Method to get a summary of the static event loops (for the Admin API)
+ * @returns A JSON array with an object for each loop, or NULL if the pool is disabled */
+json_t *janus_ice_static_event_loops_info(void);
+
+/*! \brief Method to have all handles share a few UDP sockets bound to the same port,
+ * rather than have libnice gather candidates on ports of their own
+ * \note Only available in ICE Lite mode: peers are matched to handles by the ufrag
+ * of their connectivity checks, and by their nominated address afterwards. Full-trickle
+ * and ICE-TCP are disabled when muxing. This must be called after janus_ice_init, and
+ * before any handle is created.
+ * @param[in] port The UDP port to bind to (0 to disable)
+ * @param[in] sockets How many sockets to bind to that port via SO_REUSEPORT, each with its own thread
+ * @returns 0 in case of success, a negative integer on errors */
+int janus_ice_set_mux_port(uint16_t port, int sockets);
+
+/*! \brief Method to get the port ICE is muxed on, if any
+ * @returns The port, or 0 if single port muxing is disabled */
+uint16_t janus_ice_get_mux_port(void);
+
 
 /*! \brief Helper method to get a string representation of a libnice ICE state
  * @param[in] state The libnice ICE state
@@ -193,6 +284,38 @@ typedef struct janus_ice_stream janus_ice_stream;
 typedef struct janus_ice_component janus_ice_component;
 /*! \brief Helper to handle pending trickle candidates (e.g., when we're still waiting for an offer) */
 typedef struct janus_ice_trickle janus_ice_trickle;
+/*! \brief Shared event loop a handle can be attached to, when static_event_loops are enabled */
+typedef struct janus_ice_static_event_loop janus_ice_static_event_loop;
+
+/*! \brief Maximum number of peer SSRCs in a stream (audio, plus three video and three video rtx) */
+#define JANUS_ICE_SSRC_MAP_SIZE	7
+/*! \brief Entry in the SSRC lookup table of a stream */
+typedef struct janus_ice_ssrc_entry {
+	/*! \brief The peer SSRC */
+	guint32 ssrc;
+	/*! \brief Whether this is video, which substream (simulcast) and whether it's a RFC4588 retransmission */
+	guint8 video, vindex, rtx;
+} janus_ice_ssrc_entry;
+
+/*! \brief Maximum number of additional local SSRCs a plugin can multiplex in a stream */
+#define JANUS_ICE_MAX_EXTRA_SSRCS	32
+/*! \brief Additional local SSRC a plugin multiplexes in a stream, next to
+ * the one we generate ourselves (e.g., a VideoRoom listener receiving several
+ * feeds in the same PeerConnection): packets using it are sent unchanged,
+ * and are not part of the retransmission buffer or our sender reports */
+typedef struct janus_ice_extra_ssrc {
+	/*! \brief The SSRC, as set by the plugin in the packets it relays */
+	guint32 ssrc;
+	/*! \brief Whether this is a video SSRC */
+	gboolean video;
+	/*! \brief The msid (MediaStream and track IDs) the plugin advertised it with */
+	char msid[96];
+} janus_ice_extra_ssrc;
+
+/*! \brief Method to get the index of the static event loop a handle is attached to
+ * @param[in] handle The janus_ice_handle instance to check
+ * @returns The loop index, or -1 if the handle has a dedicated loop (or none) */
+int janus_ice_handle_get_static_event_loop(janus_ice_handle *handle);
 
 #define JANUS_ICE_HANDLE_WEBRTC_PROCESSING_OFFER	(1 << 0)
 #define JANUS_ICE_HANDLE_WEBRTC_START				(1 << 1)
@@ -260,21 +383,22 @@ void janus_ice_notify_hangup(janus_ice_handle *handle, const char *reason);
 gboolean janus_plugin_session_is_alive(janus_plugin_session *plugin_session);
 
 
-/*! \brief A helper struct for determining when to send NACKs */
-typedef struct janus_seq_info {
-	gint64 ts;
-	guint16 seq;
-	guint16 state;
-	struct janus_seq_info *next;
-	struct janus_seq_info *prev;
-} janus_seq_info;
-void janus_seq_list_free(janus_seq_info **head);
-enum {
-	SEQ_MISSING,
-	SEQ_NACKED,
-	SEQ_GIVEUP,
-	SEQ_RECVED
-};
+/*! \brief Ring buffer of sent RTP packets we may have to retransmit
+ * \note The number of slots is always a power of two, and packets are
+ * stored in the slot identified by their sequence number and the mask,
+ * which means lookups don't need any list or hashtable. The buffer starts
+ * with a size based on max_nack_queue and the outgoing bitrate, and grows
+ * when packets that are still recent enough would be overwritten. */
+typedef struct janus_ice_retransmit_buffer {
+	/*! \brief Slots (mask+1 of them) */
+	janus_rtp_packet **packets;
+	/*! \brief Mask to apply to a sequence number to find its slot */
+	guint16 mask;
+	/*! \brief Number of packets currently stored */
+	guint count;
+	/*! \brief Sequence number of the oldest packet that may still be in the buffer */
+	guint16 head;
+} janus_ice_retransmit_buffer;
 
 
 /*! \brief Janus ICE handle */
@@ -301,6 +425,12 @@ struct janus_ice_handle {
 	GMainLoop *iceloop;
 	/*! \brief GLib thread for libnice */
 	GThread *icethread;
+	/*! \brief Placement group (e.g., room or mountpoint) set by the plugin, to serve related handles on the same NUMA node (0 if none) */
+	guint64 placement_group;
+	/*! \brief Shared event loop this handle is attached to, if any (icectx/iceloop are then references to it) */
+	janus_ice_static_event_loop *static_event_loop;
+	/*! \brief Atomic flag to make sure we only detach from a static event loop once */
+	volatile gint static_event_loop_released;
 	/*! \brief libnice ICE agent */
 	NiceAgent *agent;
 	/*! \brief Monotonic time of when the ICE agent has been created */
@@ -323,6 +453,8 @@ struct janus_ice_handle {
 	gchar *rtp_profile;
 	/*! \brief SDP generated locally (just for debugging purposes) janus_plugin_handle_sdp函数中生成 */
 	gchar *local_sdp;
+	/*! \brief Payload types and RTP extensions negotiated in the local SDP, parsed once */
+	janus_sdp_negotiation *local_negotiation;
 	/*! \brief SDP received by the peer (just for debugging purposes) */
 	gchar *remote_sdp;
 	/*! \brief Reason this handle has been hung up*/
@@ -335,6 +467,28 @@ struct janus_ice_handle {
 	GThread *send_thread;
 	/*! \brief Atomic flag to make sure we only create the thread once */
 	volatile gint send_thread_created;
+	/*! \brief Pool of recycled packets for the outgoing queue, to avoid allocations in the relay methods */
+	struct janus_ice_queued_packet *packets_pool;
+	/*! \brief Number of packets currently available in the pool */
+	guint packets_pool_size;
+	/*! \brief How many times the pool could (hits) or couldn't (misses) provide a packet */
+	guint64 packets_pool_hits, packets_pool_misses;
+	/*! \brief Mutex to lock/unlock the packets pool */
+	janus_mutex packets_pool_mutex;
+	/*! \brief Source draining the outgoing queue on the ICE loop, when there's no send thread */
+	GSource *outgoing_source;
+	/*! \brief Timers on the ICE loop for RTCP reports, NACK buffer cleanups and SRTP errors summaries, when there's no send thread */
+	GSource *rtcp_timer, *nack_cleanup_timer, *srtp_summary_timer;
+	/*! \brief When we last notified event handlers about media statistics, when there's no send thread */
+	gint64 last_event_stats;
+	/*! \brief Batch of SRTP/SRTCP packets to send at the end of an ICE loop wakeup, when batched sending is enabled */
+	struct janus_ice_send_batch *send_batch;
+	/*! \brief Credentials and nominated address of this handle on the shared sockets, when ICE is muxed on a single port */
+	struct janus_ice_mux_binding *mux_binding;
+	/*! \brief Leaky bucket outgoing video waits in, when pacing is enabled */
+	struct janus_ice_pacer *pacer;
+	/*! \brief Latest bitrate the peer reported via REMB, used to estimate the pacing rate */
+	volatile gint pacing_remb;
 	/*! \brief Count of the recent SRTP replay errors, in order to avoid spamming the logs */
 	guint srtp_errors_count;
 	/*! \brief Count of the recent SRTP replay errors, in order to avoid spamming the logs */
@@ -343,6 +497,20 @@ struct janus_ice_handle {
 	volatile gint dump_packets;
 	/*! \brief In case this session must be saved to text2pcap, the instance to dump packets to */
 	janus_text2pcap *text2pcap;
+	/*! \brief Latency histograms of the plugin this handle is attached to */
+	janus_latency_stats *latency;
+	/*! \brief Whether we're dropping outgoing video until the next keyframe, because the queue was too long */
+	volatile gint queue_dropping;
+	/*! \brief Whether we need to ask the plugin for a keyframe, after dropping video */
+	volatile gint queue_pli;
+	/*! \brief When we last asked the plugin for a keyframe, after dropping video */
+	gint64 queue_last_pli;
+	/*! \brief Outgoing packets dropped because the queue was too long (or they were too old) */
+	volatile gint queue_dropped_audio, queue_dropped_video;
+	/*! \brief Keyframes we asked the plugin for, after dropping video */
+	volatile gint queue_plis;
+	/*! \brief Outgoing video packets that had to wait in the pacer */
+	volatile gint paced_video;
 	/*! \brief Mutex to lock/unlock the ICE session */
 	janus_mutex mutex;
 };
@@ -367,6 +535,19 @@ struct janus_ice_stream {
 	guint32 video_ssrc_peer[3], video_ssrc_peer_new[3], video_ssrc_peer_orig[3];
 	/*! \brief Video retransmissions SSRC(s) of the peer for this stream */
 	guint32 video_ssrc_peer_rtx[3], video_ssrc_peer_rtx_new[3], video_ssrc_peer_rtx_orig[3];
+	/*! \brief Lookup table of all the peer SSRCs above, to demultiplex incoming packets in a single pass */
+	janus_ice_ssrc_entry ssrc_map[JANUS_ICE_SSRC_MAP_SIZE];
+	/*! \brief Number of valid entries in the SSRC lookup table */
+	volatile gint ssrc_map_size;
+	/*! \brief Sequence number of the SSRC lookup table, odd while it's being updated (readers don't lock) */
+	volatile gint ssrc_map_seq;
+	/*! \brief Additional local SSRCs the plugin multiplexes in this stream, if any
+	 * \note Only allocated (with room for JANUS_ICE_MAX_EXTRA_SSRCS entries) the first time a plugin advertises some */
+	janus_ice_extra_ssrc *extra_ssrcs;
+	/*! \brief Number of valid additional local SSRCs */
+	volatile gint extra_ssrcs_num;
+	/*! \brief Sequence number of the additional local SSRCs, odd while they're being updated (readers don't lock) */
+	volatile gint extra_ssrcs_seq;
 	/*! \brief Array of RTP Stream IDs (for Firefox simulcasting, if enabled) */
 	char *rid[3];
 	/*! \brief RTP switching context(s) in case of renegotiations (audio+video and/or simulcast) */
@@ -407,16 +588,14 @@ struct janus_ice_stream {
 	gboolean do_transport_wide_cc;
 	/*! \brief Transport wide cc rtp ext ID */
 	guint transport_wide_cc_ext_id;
-	/*! \brief Last received transport wide seq num */
-	guint32 transport_wide_cc_last_seq_num;
-	/*! \brief Last transport wide seq num sent on feedback */
+	/*! \brief Highest received transport wide seq num (extended) */
+	guint32 transport_wide_cc_max_seq_num;
+	/*! \brief Last transport wide seq num sent on feedback (extended) */
 	guint32 transport_wide_cc_last_feedback_seq_num;
-	/*! \brief Transport wide cc transport seq num wrap cycles */
-	guint16 transport_wide_cc_cycles;
 	/*! \brief Transport wide cc rtp ext ID */
 	guint transport_wide_cc_feedback_count;
-	/*! \brief GLib list of transport wide cc stats in reverse received order */
-	GSList *transport_wide_received_seq_nums;
+	/*! \brief Circular array of arrival times (0 if not received yet) indexed by transport wide seq num */
+	guint64 *transport_wide_cc_arrivals;
 	/*! \brief DTLS role of the gateway for this stream */
 	janus_dtls_role dtls_role;
 	/*! \brief 对端使用的散列算法 SHA-256等 */
@@ -438,7 +617,6 @@ struct janus_ice_stream {
 };
 
 // 结构体 https://janus.conf.meetecho.com/docs/structjanus__ice__handle.html
-#define LAST_SEQS_MAX_LEN 160
 /*! \brief Janus ICE component.   */
 struct janus_ice_component {
 	/*! \brief 指向所属的janus_ice_stream对象 */
@@ -459,6 +637,8 @@ struct janus_ice_component {
 	GSList *remote_candidates;
 	/*! \brief String representation of the selected pair as notified by libnice (foundations) */
 	gchar *selected_pair;
+	/*! \brief Whether the selected pair uses TCP on either side */
+	gboolean tcp_pair;
 	/*! \brief Whether the setup of remote candidates for this component has started or not */
 	gboolean process_started;
 	/*! \brief Timer to check when we should consider ICE as failed */
@@ -473,10 +653,10 @@ struct janus_ice_component {
 	gboolean do_audio_nacks;
 	/*! \brief Whether we should do NACKs (in or out) for video */
 	gboolean do_video_nacks;
-	/*! \brief List of previously sent janus_rtp_packet RTP packets, in case we receive NACKs */
-	GQueue *audio_retransmit_buffer, *video_retransmit_buffer;
-	/*! \brief HashTable of retransmittable sequence numbers, in case we receive NACKs */
-	GHashTable *audio_retransmit_seqs, *video_retransmit_seqs;
+	/*! \brief Previously sent janus_rtp_packet RTP packets, indexed by sequence number, in case we receive NACKs */
+	janus_ice_retransmit_buffer *audio_retransmit_buffer, *video_retransmit_buffer;
+	/*! \brief As above, for the additional SSRCs a plugin multiplexes (janus_ice_retransmit_buffer instances, indexed by SSRC) */
+	GHashTable *extra_retransmit_buffers;
 	/*! \brief Current sequence number for the RFC4588 rtx SSRC session */
 	guint16 rtx_seq_number;
 	/*! \brief Last time a log message about sending retransmits was printed */
@@ -487,10 +667,12 @@ struct janus_ice_component {
 	gint64 nack_sent_log_ts;
 	/*! \brief Number of NACKs sent since last log message */
 	guint nack_sent_recent_cnt;
-	/*! \brief List of recently received audio sequence numbers (as a support to NACK generation) */
-	janus_seq_info *last_seqs_audio;
-	/*! \brief List of recently received video sequence numbers (as a support to NACK generation, for each simulcast SSRC) */
-	janus_seq_info *last_seqs_video[3];
+	/*! \brief Receive window of audio sequence numbers (as a support to NACK generation)
+	 * \note Allocated when the first packet we may have to NACK arrives, as most handles never need it */
+	janus_rtp_seq_window *last_seqs_audio;
+	/*! \brief Receive windows of video sequence numbers (as a support to NACK generation, for each simulcast SSRC)
+	 * \note As above, allocated on demand: simulcast substreams we never receive take no room */
+	janus_rtp_seq_window *last_seqs_video[3];
 	/*! \brief Stats for incoming data (audio/video/data) */
 	janus_ice_stats in_stats;
 	/*! \brief Stats for outgoing data (audio/video/data) */
@@ -581,9 +763,33 @@ void janus_ice_webrtc_free(janus_ice_handle *handle);
  * @param[in] stream The Janus ICE stream instance to free */
 void janus_ice_stream_free(janus_ice_stream *stream);
 
+/*! \brief Rebuild the SSRC lookup table of a stream, after the peer SSRCs changed (e.g., after negotiation)
+ * @param[in] stream The Janus ICE stream instance to update */
+void janus_ice_stream_update_ssrc_map(janus_ice_stream *stream);
+/*! \brief Replace the additional local SSRCs a plugin multiplexes in a stream
+ * @param[in] stream The Janus ICE stream instance to update
+ * @param[in] ssrcs The new additional SSRCs
+ * @param[in] num The number of additional SSRCs (at most JANUS_ICE_MAX_EXTRA_SSRCS) */
+void janus_ice_stream_set_extra_ssrcs(janus_ice_stream *stream, const janus_ice_extra_ssrc *ssrcs, int num);
+/*! \brief Check whether an SSRC is one of the additional local SSRCs of a stream
+ * @param[in] stream The Janus ICE stream instance to check
+ * @param[in] ssrc The SSRC to look for
+ * @param[out] video If not NULL, whether the additional SSRC is video, when found
+ * @returns TRUE if the SSRC is one of the additional ones, FALSE otherwise */
+gboolean janus_ice_stream_find_extra_ssrc(janus_ice_stream *stream, guint32 ssrc, gboolean *video);
+
 /*! \brief 释放ICE实例创建janus_ice_component
  * @param[in] component The Janus ICE component instance to free */
 void janus_ice_component_free(janus_ice_component *component);
+
+/*! \brief Rough figure of the memory the WebRTC state of a handle is taking
+ * \note This includes the handle, stream and component structures and whatever they
+ * allocated on demand (receive windows, retransmission buffers, packets pool, etc.),
+ * but not the libnice agent or the DTLS/SRTP contexts, whose size we can't know.
+ * The handle mutex must be locked, as the stream must not go away meanwhile.
+ * @param[in] handle The Janus ICE handle instance to check
+ * @returns The number of bytes */
+gsize janus_ice_handle_memory(janus_ice_handle *handle);
 ///@}
 
 
@@ -596,6 +802,11 @@ void janus_ice_component_free(janus_ice_component *component);
  * @param[in] buf The packet data (buffer)
  * @param[in] len The buffer lenght */
 void janus_ice_relay_rtp(janus_ice_handle *handle, int video, char *buf, int len);
+/*! \brief Gateway RTP callback for refcounted packets: only the header is copied, while
+ * the payload is shared by reference until the packet is actually sent
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] packet The refcounted RTP packet */
+void janus_ice_relay_rtp_shared(janus_ice_handle *handle, janus_plugin_rtp *packet);
 
 /*! \brief 网关RTCP回调，当一个插件有一个RTCP包发送给一个对端时调用
  * @param[in] handle  handle ICE实例
@@ -606,15 +817,24 @@ void janus_ice_relay_rtcp(janus_ice_handle *handle, int video, char *buf, int le
 
 /*! \brief 网关SCTP/DataChannel回调，当一个插件有一个RTP包发送给一个对端时调用
  * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] binary Whether the message is binary, rather than text
  * @param[in] buf The message data (buffer)
  * @param[in] len The buffer lenght */
-void janus_ice_relay_data(janus_ice_handle *handle, char *buf, int len);
+void janus_ice_relay_data(janus_ice_handle *handle, gboolean binary, char *buf, int len);
+/*! \brief Gateway SCTP/DataChannel callback for messages sent to several peers: the
+ * message is not copied, but shared by reference until it's actually sent
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] data The refcounted message (the \c video property is ignored) */
+void janus_ice_relay_data_shared(janus_ice_handle *handle, janus_plugin_rtp *data);
 
 /*! \brief Plugin SCTP/DataChannel callback, called by the SCTP stack when when there's data for a plugin
+ * \note Binary messages are passed to the incoming_binary_data callback of the plugin, if
+ * it implements it, and to the incoming_data callback otherwise
  * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] binary Whether the message is binary, rather than text
  * @param[in] buffer The message data (buffer)
  * @param[in] length The buffer lenght */
-void janus_ice_incoming_data(janus_ice_handle *handle, char *buffer, int length);
+void janus_ice_incoming_data(janus_ice_handle *handle, gboolean binary, char *buffer, int length);
 ///@}
 
 
@@ -656,6 +876,14 @@ void janus_ice_setup_remote_candidates(janus_ice_handle *handle, guint stream_id
  * @param[in] component The Janus ICE component that is now ready to be used */
 void janus_ice_dtls_handshake_done(janus_ice_handle *handle, janus_ice_component *component);
 
+/*! \brief Method to send a packet on the selected pair of a component, via libnice or the shared mux sockets
+ * @param[in] handle The Janus ICE handle the component belongs to
+ * @param[in] component The Janus ICE component to send the packet on
+ * @param[in] len The packet length
+ * @param[in] buf The packet data
+ * @returns The number of bytes sent, or a negative integer on errors */
+gint janus_ice_component_send(janus_ice_handle *handle, janus_ice_component *component, gint len, const gchar *buf);
+
 /*! \brief Method to restart ICE and the connectivity checks
  * @param[in] handle The Janus ICE handle this method refers to */
 void janus_ice_restart(janus_ice_handle *handle);
@@ -36,7 +36,12 @@
 #include "rtcp.h"
 #include "auth.h"
 #include "record.h"
+#include "timer.h"
 #include "events.h"
+#include "metrics.h"
+#include "latency.h"
+#include "ports.h"
+#include "affinity.h"
 
 
 #define JANUS_NAME				"Janus WebRTC Gateway"
@@ -74,12 +79,18 @@ static char *api_secret = NULL, *admin_api_secret = NULL;
 
 /* JSON parameters */
 static int janus_process_error_string(janus_request *request, uint64_t session_id, const char *transaction, gint error, gchar *error_string);
+static int janus_process_batch(janus_request *request, guint64 session_id, guint64 handle_id, const char *transaction_text);
+/* Maximum number of requests in a single batch */
+#define JANUS_BATCH_MAX_REQUESTS	32
 
 static struct janus_json_parameter incoming_request_parameters[] = {
 	{"transaction", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"janus", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
+static struct janus_json_parameter batch_parameters[] = {
+	{"requests", JSON_ARRAY, JANUS_JSON_PARAM_REQUIRED}
+};
 static struct janus_json_parameter attach_parameters[] = {
 	{"plugin", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"opaque_id", JSON_STRING, 0},
@@ -128,6 +139,12 @@ static struct janus_json_parameter mnq_parameters[] = {
 static struct janus_json_parameter nmt_parameters[] = {
 	{"no_media_timer", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
 };
+static struct janus_json_parameter latency_parameters[] = {
+	{"reset", JANUS_JSON_BOOL, 0}
+};
+static struct janus_json_parameter histograms_parameters[] = {
+	{"histograms", JANUS_JSON_BOOL, JANUS_JSON_PARAM_REQUIRED}
+};
 static struct janus_json_parameter queryhandler_parameters[] = {
 	{"handler", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"request", JSON_OBJECT, 0}
@@ -135,10 +152,47 @@ static struct janus_json_parameter queryhandler_parameters[] = {
 static struct janus_json_parameter text2pcap_parameters[] = {
 	{"folder", JSON_STRING, 0},
 	{"filename", JSON_STRING, 0},
-	{"truncate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+	{"truncate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"format", JSON_STRING, 0}
+};
+static struct janus_json_parameter handleinfo_parameters[] = {
+	{"fields", JSON_ARRAY, 0}
+};
+static struct janus_json_parameter listhandles_parameters[] = {
+	{"offset", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"limit", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"fields", JSON_ARRAY, 0}
+};
+
+/* Groups of info a handle_info can return: the identifiers are always there */
+#define JANUS_ADMIN_INFO_PLUGIN				(1 << 0)
+#define JANUS_ADMIN_INFO_PLUGIN_SPECIFIC	(1 << 1)
+#define JANUS_ADMIN_INFO_FLAGS				(1 << 2)
+#define JANUS_ADMIN_INFO_ICE				(1 << 3)
+#define JANUS_ADMIN_INFO_SDPS				(1 << 4)
+#define JANUS_ADMIN_INFO_QUEUES				(1 << 5)
+#define JANUS_ADMIN_INFO_TEXT2PCAP			(1 << 6)
+#define JANUS_ADMIN_INFO_STREAMS			(1 << 7)
+#define JANUS_ADMIN_INFO_ALL				0xFF
+static struct {
+	const char *name;
+	guint32 flag;
+} janus_admin_info_fields[] = {
+	{ "plugin", JANUS_ADMIN_INFO_PLUGIN },
+	{ "plugin_specific", JANUS_ADMIN_INFO_PLUGIN_SPECIFIC },
+	{ "flags", JANUS_ADMIN_INFO_FLAGS },
+	{ "ice", JANUS_ADMIN_INFO_ICE },
+	{ "sdps", JANUS_ADMIN_INFO_SDPS },
+	{ "queues", JANUS_ADMIN_INFO_QUEUES },
+	{ "text2pcap", JANUS_ADMIN_INFO_TEXT2PCAP },
+	{ "streams", JANUS_ADMIN_INFO_STREAMS },
+	{ NULL, 0 }
 };
 
 /* Admin/Monitor helpers */
+static gint janus_admin_id_compare(gconstpointer a, gconstpointer b);
+static int janus_admin_info_fields_parse(json_t *fields, guint32 *mask, char *error_cause, size_t error_size);
+static json_t *janus_admin_handle_info(janus_session *session, janus_ice_handle *handle, guint32 fields);
 json_t *janus_admin_stream_summary(janus_ice_stream *stream);
 json_t *janus_admin_component_summary(janus_ice_component *component);
 
@@ -217,6 +271,8 @@ static json_t *janus_info(const char *transaction) {
 	json_object_set_new(info, "ice-lite", janus_ice_is_ice_lite_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "ice-tcp", janus_ice_is_ice_tcp_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "full-trickle", janus_ice_is_full_trickle_enabled() ? json_true() : json_false());
+	if(janus_ice_get_mux_port() > 0)
+		json_object_set_new(info, "ice-mux-port", json_integer(janus_ice_get_mux_port()));
 	json_object_set_new(info, "rfc-4588", janus_is_rfc4588_enabled() ? json_true() : json_false());
 	if(janus_ice_get_stun_server() != NULL) {
 		char server[255];
@@ -373,7 +429,19 @@ static janus_transport_callbacks janus_handler_transport =
 
 
 
-static GAsyncQueue *requests = NULL;		// 请求队列
+/* Incoming requests are dispatched to a configurable number of workers,
+ * each with its own queue: requests are assigned to a worker by session ID,
+ * so that those related to the same session are still handled in order */
+#define DEFAULT_REQUEST_WORKERS		1
+#define MAX_REQUEST_WORKERS			64
+typedef struct janus_request_worker {
+	guint index;
+	GAsyncQueue *requests;		// 请求队列
+	GThread *thread;
+} janus_request_worker;
+static janus_request_worker *request_workers = NULL;
+static guint request_workers_num = DEFAULT_REQUEST_WORKERS;
+static volatile gint request_workers_next = 0;
 static janus_request exit_message;
 static GThreadPool *tasks = NULL;			// 任务队列(异步处理)
 void janus_transport_task(gpointer data, gpointer user_data);
@@ -387,12 +455,17 @@ void janus_transport_task(gpointer data, gpointer user_data);
  */
 ///@{
 int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep);
+int janus_plugin_push_event_shared(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, janus_plugin_event *event);
 // janus_plugin_push_event中调用janus_plugin_handle_sdp处理返回给客户端的SDP信息
 json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *sdp_type, const char *sdp, gboolean restart);
 void janus_plugin_relay_rtp(janus_plugin_session *plugin_session, int video, char *buf, int len);
+void janus_plugin_relay_rtp_shared(janus_plugin_session *plugin_session, janus_plugin_rtp *packet);
 void janus_plugin_relay_rtcp(janus_plugin_session *plugin_session, int video, char *buf, int len);
 void janus_plugin_relay_data(janus_plugin_session *plugin_session, char *buf, int len);
+void janus_plugin_relay_binary_data(janus_plugin_session *plugin_session, char *buf, int len);
+void janus_plugin_relay_data_broadcast(janus_plugin_session **plugin_sessions, int count, char *buf, int len);
 void janus_plugin_close_pc(janus_plugin_session *plugin_session);
+void janus_plugin_set_placement_group(janus_plugin_session *plugin_session, guint64 group);
 void janus_plugin_end_session(janus_plugin_session *plugin_session);
 void janus_plugin_notify_event(janus_plugin *plugin, janus_plugin_session *plugin_session, json_t *event);
 gboolean janus_plugin_auth_is_signature_valid(janus_plugin *plugin, const char *token);
@@ -400,24 +473,95 @@ gboolean janus_plugin_auth_signature_contains(janus_plugin *plugin, const char *
 static janus_callbacks janus_handler_plugin =
 	{
 		.push_event = janus_plugin_push_event,
+		.push_event_shared = janus_plugin_push_event_shared,
 		.relay_rtp = janus_plugin_relay_rtp,
+		.relay_rtp_shared = janus_plugin_relay_rtp_shared,
 		.relay_rtcp = janus_plugin_relay_rtcp,
 		.relay_data = janus_plugin_relay_data,
+		.relay_binary_data = janus_plugin_relay_binary_data,
+		.relay_data_broadcast = janus_plugin_relay_data_broadcast,
 		.close_pc = janus_plugin_close_pc,
 		.end_session = janus_plugin_end_session,
 		.events_is_enabled = janus_events_is_enabled,
 		.notify_event = janus_plugin_notify_event,
 		.auth_is_signature_valid = janus_plugin_auth_is_signature_valid,
 		.auth_signature_contains = janus_plugin_auth_signature_contains,
+		.port_range_get = janus_port_range_get,
+		.port_range_unref = janus_port_range_unref,
+		.port_allocate = janus_port_allocate,
+		.port_release = janus_port_release,
+		.set_placement_group = janus_plugin_set_placement_group,
 	};
 ///@}
 
 
-/* Gateway Sessions */
-static janus_mutex sessions_mutex;
-static GHashTable *sessions = NULL, *old_sessions = NULL;
+/* Gateway Sessions: the sessions table is split in shards, each with its
+ * own lock, so that lookups for different sessions (e.g., API requests and
+ * keepalives coming from different users) don't contend on a single mutex */
+#define JANUS_SESSIONS_SHARDS	32
+/* Each shard also keeps its sessions in a timer wheel with one slot per
+ * second, indexed by the time they may expire at: the watchdog only looks
+ * at the slots that became due since its last tick. Keepalives just update
+ * last_activity, and sessions that were refreshed are moved to a later slot
+ * when their slot comes up. Deadlines further away than the wheel size wait
+ * for as many laps as needed. */
+#define JANUS_SESSIONS_WHEEL_SLOTS	64
+typedef struct janus_sessions_shard {
+	janus_mutex mutex;
+	GHashTable *sessions, *old_sessions;
+	GQueue wheel[JANUS_SESSIONS_WHEEL_SLOTS];
+	gint64 wheel_tick;
+} janus_sessions_shard;
+static janus_sessions_shard sessions_shards[JANUS_SESSIONS_SHARDS];
+static janus_metric *metric_sessions = NULL;
 static GMainContext *sessions_watchdog_context = NULL;
 
+static janus_sessions_shard *janus_sessions_get_shard(guint64 session_id) {
+	/* Session IDs are random, but fold the high bits in anyway in case they're not */
+	return &sessions_shards[(session_id ^ (session_id >> 32)) % JANUS_SESSIONS_SHARDS];
+}
+
+/* Timer wheel helpers: all of them must be called with the shard mutex locked */
+static void janus_sessions_wheel_add(janus_sessions_shard *shard, janus_session *session) {
+	/* When timeouts are disabled, we still check back every lap, in case they're enabled later */
+	gint64 deadline = session->last_activity/G_USEC_PER_SEC +
+		(session_timeout > 0 ? session_timeout : JANUS_SESSIONS_WHEEL_SLOTS);
+	if(deadline <= shard->wheel_tick)
+		deadline = shard->wheel_tick + 1;
+	else if(deadline > shard->wheel_tick + JANUS_SESSIONS_WHEEL_SLOTS)
+		deadline = shard->wheel_tick + JANUS_SESSIONS_WHEEL_SLOTS;
+	session->timeout_slot = deadline % JANUS_SESSIONS_WHEEL_SLOTS;
+	g_queue_push_tail(&shard->wheel[session->timeout_slot], session);
+	session->timeout_link = g_queue_peek_tail_link(&shard->wheel[session->timeout_slot]);
+}
+
+static void janus_sessions_wheel_remove(janus_sessions_shard *shard, janus_session *session) {
+	if(session->timeout_link == NULL)
+		return;
+	g_queue_delete_link(&shard->wheel[session->timeout_slot], session->timeout_link);
+	session->timeout_link = NULL;
+}
+
+/* Re-evaluates the slot of all sessions, e.g., after the timeout was lowered via Admin API */
+static void janus_sessions_wheel_reschedule(void) {
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions_shards[i];
+		janus_mutex_lock(&shard->mutex);
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, shard->sessions);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_session *session = (janus_session *) value;
+			if(session->timeout_link == NULL)
+				continue;
+			janus_sessions_wheel_remove(shard, session);
+			janus_sessions_wheel_add(shard, session);
+		}
+		janus_mutex_unlock(&shard->mutex);
+	}
+}
+
 
 static gboolean janus_cleanup_session(gpointer user_data) {
 	janus_session *session = (janus_session *) user_data;
@@ -433,8 +577,9 @@ static void janus_session_schedule_destruction(janus_session *session,
 		gboolean lock_sessions, gboolean remove_key, gboolean notify_transport) {
 	if(session == NULL || !g_atomic_int_compare_and_exchange(&session->destroy, 0, 1))
 		return;
+	janus_sessions_shard *shard = janus_sessions_get_shard(session->session_id);
 	if(lock_sessions)
-		janus_mutex_lock(&sessions_mutex);
+		janus_mutex_lock(&shard->mutex);
 	/* Schedule the session for deletion */
 	janus_mutex_lock(&session->mutex);
 	/* Remove all handles */
@@ -452,62 +597,81 @@ static void janus_session_schedule_destruction(janus_session *session,
 		}
 	}
 	janus_mutex_unlock(&session->mutex);
+	janus_sessions_wheel_remove(shard, session);
 	// 删除session
 	if(remove_key)
-		g_hash_table_remove(sessions, &session->session_id);
-	g_hash_table_replace(old_sessions, janus_uint64_dup(session->session_id), session);
+		g_hash_table_remove(shard->sessions, &session->session_id);
+	g_hash_table_replace(shard->old_sessions, janus_uint64_dup(session->session_id), session);
 	GSource *timeout_source = g_timeout_source_new_seconds(3);
 	g_source_set_callback(timeout_source, janus_cleanup_session, session, NULL);
 	g_source_attach(timeout_source, sessions_watchdog_context);
 	g_source_unref(timeout_source);
 	if(lock_sessions)
-		janus_mutex_unlock(&sessions_mutex);
+		janus_mutex_unlock(&shard->mutex);
 	/* Notify the source that the session has been destroyed */
 	// 通知Session结束
 	if(notify_transport && session->source && session->source->transport)
 		session->source->transport->session_over(session->source->instance, session->session_id, FALSE);
 }
 
+static void janus_session_expire(janus_sessions_shard *shard, janus_session *session) {
+	JANUS_LOG(LOG_INFO, "Timeout expired for session %"SCNu64"...\n", session->session_id);
+	/* Mark the session as over, we'll deal with it later */
+	janus_session_schedule_destruction(session, FALSE, FALSE, FALSE);
+	/* Notify the transport */
+	if(session->source) {
+		json_t *event = json_object();
+		json_object_set_new(event, "janus", json_string("timeout"));
+		json_object_set_new(event, "session_id", json_integer(session->session_id));
+		/* Send this to the transport client */
+		session->source->transport->send_message(session->source->instance, NULL, FALSE, event);
+		/* Notify the transport plugin about the session timeout */
+		session->source->transport->session_over(session->source->instance, session->session_id, TRUE);
+	}
+	/* Notify event handlers as well */
+	if(janus_events_is_enabled())
+		janus_events_notify_handlers(JANUS_EVENT_TYPE_SESSION, session->session_id, "timeout", NULL);
+	g_hash_table_remove(shard->sessions, &session->session_id);
+	g_hash_table_replace(shard->old_sessions, janus_uint64_dup(session->session_id), session);
+}
+
 static gboolean janus_check_sessions(gpointer user_data) {
-	if(session_timeout < 1)		/* Session timeouts are disabled */
-		return G_SOURCE_CONTINUE;
-	janus_mutex_lock(&sessions_mutex);
-	if(sessions && g_hash_table_size(sessions) > 0) {
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, sessions);
-		while (g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_session *session = (janus_session *) value;
-			if (!session || g_atomic_int_get(&session->destroy)) {
-				continue;
-			}
-			gint64 now = janus_get_monotonic_time();
-			if (now - session->last_activity >= (gint64)session_timeout * G_USEC_PER_SEC &&
-					!g_atomic_int_compare_and_exchange(&session->timeout, 0, 1)) {
-				JANUS_LOG(LOG_INFO, "Timeout expired for session %"SCNu64"...\n", session->session_id);
-				/* Mark the session as over, we'll deal with it later */
-				janus_session_schedule_destruction(session, FALSE, FALSE, FALSE);
-				/* Notify the transport */
-				if(session->source) {
-					json_t *event = json_object();
-					json_object_set_new(event, "janus", json_string("timeout"));
-					json_object_set_new(event, "session_id", json_integer(session->session_id));
-					/* Send this to the transport client */
-					session->source->transport->send_message(session->source->instance, NULL, FALSE, event);
-					/* Notify the transport plugin about the session timeout */
-					session->source->transport->session_over(session->source->instance, session->session_id, TRUE);
+	gint64 now = janus_get_monotonic_time();
+	gint64 now_tick = now/G_USEC_PER_SEC;
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions_shards[i];
+		janus_mutex_lock(&shard->mutex);
+		int laps = 0;
+		while(shard->wheel_tick < now_tick && laps < JANUS_SESSIONS_WHEEL_SLOTS) {
+			shard->wheel_tick++;
+			laps++;
+			/* Detach the whole slot first, as sessions may be put back in it */
+			GQueue *slot = &shard->wheel[shard->wheel_tick % JANUS_SESSIONS_WHEEL_SLOTS];
+			GList *due = slot->head;
+			g_queue_init(slot);
+			while(due != NULL) {
+				janus_session *session = (janus_session *) due->data;
+				GList *next = due->next;
+				g_list_free_1(due);
+				due = next;
+				session->timeout_link = NULL;
+				if(g_atomic_int_get(&session->destroy))
+					continue;
+				if(session_timeout > 0 &&
+						now - session->last_activity >= (gint64)session_timeout * G_USEC_PER_SEC &&
+						g_atomic_int_compare_and_exchange(&session->timeout, 0, 1)) {
+					janus_session_expire(shard, session);
+					continue;
 				}
-				/* Notify event handlers as well */
-				if(janus_events_is_enabled())
-					janus_events_notify_handlers(JANUS_EVENT_TYPE_SESSION, session->session_id, "timeout", NULL);
-
-				/* FIXME Is this safe? apparently it causes hash table errors on the console */
-				g_hash_table_iter_remove(&iter);
-				g_hash_table_replace(old_sessions, janus_uint64_dup(session->session_id), session);
+				/* Not expired yet (or timeouts disabled): move it where it belongs now */
+				janus_sessions_wheel_add(shard, session);
 			}
 		}
+		/* If we fell behind more than a lap, all slots have been visited anyway */
+		shard->wheel_tick = now_tick;
+		janus_mutex_unlock(&shard->mutex);
 	}
-	janus_mutex_unlock(&sessions_mutex);
 
 	return G_SOURCE_CONTINUE;
 }
@@ -517,7 +681,7 @@ static gpointer janus_sessions_watchdog(gpointer user_data) {
 	GMainContext *watchdog_context = g_main_loop_get_context(loop);
 	GSource *timeout_source;
 
-	timeout_source = g_timeout_source_new_seconds(2);
+	timeout_source = g_timeout_source_new_seconds(1);
 	g_source_set_callback(timeout_source, janus_check_sessions, watchdog_context, NULL);
 	g_source_attach(timeout_source, watchdog_context);
 	g_source_unref(timeout_source);
@@ -548,27 +712,34 @@ janus_session *janus_session_create(guint64 session_id) {
 	g_atomic_int_set(&session->timeout, 0);
 	session->last_activity = janus_get_monotonic_time();
 	session->ice_handles = NULL;
+	session->timeout_link = NULL;
+	session->timeout_slot = 0;
 	janus_mutex_init(&session->mutex);
-	janus_mutex_lock(&sessions_mutex);
+	janus_sessions_shard *shard = janus_sessions_get_shard(session_id);
+	janus_mutex_lock(&shard->mutex);
 	// 进入sessions集中管理
-	g_hash_table_insert(sessions, janus_uint64_dup(session->session_id), session);
-	janus_mutex_unlock(&sessions_mutex);
+	g_hash_table_insert(shard->sessions, janus_uint64_dup(session->session_id), session);
+	janus_sessions_wheel_add(shard, session);
+	janus_mutex_unlock(&shard->mutex);
+	janus_metrics_inc(metric_sessions);
 	return session;
 }
 
 // 根据session_id从hash_table里面获取Session对象指针
 janus_session *janus_session_find(guint64 session_id) {
-	janus_mutex_lock(&sessions_mutex);
-	janus_session *session = g_hash_table_lookup(sessions, &session_id);
-	janus_mutex_unlock(&sessions_mutex);
+	janus_sessions_shard *shard = janus_sessions_get_shard(session_id);
+	janus_mutex_lock(&shard->mutex);
+	janus_session *session = g_hash_table_lookup(shard->sessions, &session_id);
+	janus_mutex_unlock(&shard->mutex);
 	return session;
 }
 
 janus_session *janus_session_find_destroyed(guint64 session_id) {
-	janus_mutex_lock(&sessions_mutex);
-	janus_session *session = g_hash_table_lookup(old_sessions, &session_id);
-	g_hash_table_remove(old_sessions, &session_id);
-	janus_mutex_unlock(&sessions_mutex);
+	janus_sessions_shard *shard = janus_sessions_get_shard(session_id);
+	janus_mutex_lock(&shard->mutex);
+	janus_session *session = g_hash_table_lookup(shard->old_sessions, &session_id);
+	g_hash_table_remove(shard->old_sessions, &session_id);
+	janus_mutex_unlock(&shard->mutex);
 	return session;
 }
 
@@ -583,6 +754,52 @@ void janus_session_notify_event(janus_session *session, json_t *event) {
 	}
 }
 
+void janus_session_notify_shared_event(janus_session *session, guint64 handle_id, const char *transaction, janus_plugin_event *event) {
+	if(session == NULL || event == NULL || g_atomic_int_get(&session->destroy) ||
+			session->source == NULL || session->source->transport == NULL)
+		return;
+	janus_transport *transport = session->source->transport;
+	if(transport->send_message_text == NULL) {
+		/* The transport only takes json_t objects: the plugindata object is shared by
+		 * other events too, and may be serialized by other threads, so copy it */
+		json_t *message = json_object();
+		json_object_set_new(message, "janus", json_string("event"));
+		json_object_set_new(message, "session_id", json_integer(session->session_id));
+		json_object_set_new(message, "sender", json_integer(handle_id));
+		if(transaction != NULL)
+			json_object_set_new(message, "transaction", json_string(transaction));
+		json_object_set_new(message, "plugindata", json_deep_copy(event->plugindata));
+		janus_session_notify_event(session, message);
+		return;
+	}
+	/* Only prepend the envelope to the serialized plugindata */
+	char *tr = NULL;
+	if(transaction != NULL) {
+		json_t *t = json_string(transaction);
+		tr = json_dumps(t, JSON_ENCODE_ANY);
+		json_decref(t);
+	}
+	char envelope[128];
+	int elen = g_snprintf(envelope, sizeof(envelope), "{\"janus\":\"event\",\"session_id\":%"SCNu64",\"sender\":%"SCNu64",",
+		session->session_id, handle_id);
+	size_t tlen = tr ? strlen(tr) : 0;
+	size_t length = elen + (tr ? strlen("\"transaction\":,") + tlen : 0) + strlen("\"plugindata\":") + event->length + 1;
+	char *text = malloc(length + 1), *p = text;
+	memcpy(p, envelope, elen);
+	p += elen;
+	if(tr != NULL) {
+		p += sprintf(p, "\"transaction\":%s,", tr);
+		free(tr);
+	}
+	p += sprintf(p, "\"plugindata\":");
+	memcpy(p, event->text, event->length);
+	p += event->length;
+	*p++ = '}';
+	*p = '\0';
+	JANUS_LOG(LOG_HUGE, "Sending shared event to %s (%p)\n", transport->get_package(), session->source->instance);
+	transport->send_message_text(session->source->instance, NULL, FALSE, text, length);
+}
+
 
 /* Destroys a session but does not remove it from the sessions hash table. */
 gint janus_session_destroy(guint64 session_id) {
@@ -614,6 +831,7 @@ void janus_session_free(janus_session *session) {
 	janus_mutex_unlock(&session->mutex);
 	g_free(session);
 	session = NULL;
+	janus_metrics_dec(metric_sessions);
 }
 
 
@@ -625,6 +843,7 @@ janus_request *janus_request_new(janus_transport *transport, void *instance, voi
 	request->request_id = request_id;
 	request->admin = admin;
 	request->message = message;
+	request->responses = NULL;
 	return request;
 }
 
@@ -662,18 +881,26 @@ int janus_process_incoming_request(janus_request *request) {
 		handle_id = json_integer_value(h);
 
 	/* Get transaction and message request */
-	JANUS_VALIDATE_JSON_OBJECT(root, incoming_request_parameters,
+	json_t *values[G_N_ELEMENTS(incoming_request_parameters)];
+	JANUS_VALIDATE_JSON_OBJECT_VALUES(root, incoming_request_parameters, values,
 		error_code, error_cause, FALSE,
 		JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
 	if(error_code != 0) {
 		ret = janus_process_error_string(request, session_id, NULL, error_code, error_cause);
 		goto jsondone;
 	}
-	json_t *transaction = json_object_get(root, "transaction");
+	/* The validation already looked these up for us */
+	json_t *transaction = values[0];
 	const gchar *transaction_text = json_string_value(transaction);
-	json_t *message = json_object_get(root, "janus");
+	json_t *message = values[1];
 	const gchar *message_text = json_string_value(message);
 
+	if(!strcasecmp(message_text, "batch")) {
+		/* Several requests in one go, processed in order */
+		ret = janus_process_batch(request, session_id, handle_id, transaction_text);
+		goto jsondone;
+	}
+
 	// 请求第一次进入还未分配session_id 和 handle_id
 	if(session_id == 0 && handle_id == 0) {
 		/* Can only be a 'Create new session', a 'Get info' or a 'Ping/Pong' request */
@@ -846,14 +1073,15 @@ int janus_process_incoming_request(janus_request *request) {
 			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_REQUEST_PATH, "Unhandled request '%s' at this path", message_text);
 			goto jsondone;
 		}
-		JANUS_VALIDATE_JSON_OBJECT(root, attach_parameters,
+		json_t *attach_values[G_N_ELEMENTS(attach_parameters)];
+		JANUS_VALIDATE_JSON_OBJECT_VALUES(root, attach_parameters, attach_values,
 			error_code, error_cause, FALSE,
 			JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
 		if(error_code != 0) {
 			ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
 			goto jsondone;
 		}
-		json_t *plugin = json_object_get(root, "plugin");
+		json_t *plugin = attach_values[0];
 		const gchar *plugin_text = json_string_value(plugin);
 		// 根据插件名字获取插件实例
 		janus_plugin *plugin_t = janus_plugin_find(plugin_text);
@@ -988,14 +1216,14 @@ int janus_process_incoming_request(janus_request *request) {
 		}
 		janus_plugin *plugin_t = (janus_plugin *)handle->app;
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] There's a message for %s\n", handle->handle_id, plugin_t->get_name());
-		JANUS_VALIDATE_JSON_OBJECT(root, body_parameters,
+		json_t *body = NULL;
+		JANUS_VALIDATE_JSON_OBJECT_VALUES(root, body_parameters, &body,
 			error_code, error_cause, FALSE,
 			JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
 		if(error_code != 0) {
 			ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
 			goto jsondone;
 		}
-		json_t *body = json_object_get(root, "body");
 		/* Is there an SDP attached? */
 		json_t *jsep = json_object_get(root, "jsep");
 		char *jsep_type = NULL;
@@ -1007,19 +1235,20 @@ int janus_process_incoming_request(janus_request *request) {
 				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_JSON_OBJECT, "Invalid jsep object");
 				goto jsondone;
 			}
-			JANUS_VALIDATE_JSON_OBJECT_FORMAT("JSEP error: missing mandatory element (%s)",
+			json_t *jsep_values[G_N_ELEMENTS(jsep_parameters)];
+			JANUS_VALIDATE_JSON_OBJECT_FORMAT_VALUES("JSEP error: missing mandatory element (%s)",
 				"JSEP error: invalid element type (%s should be %s)",
 				jsep, jsep_parameters, error_code, error_cause, FALSE,
-				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE, jsep_values);
 			if(error_code != 0) {
 				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
 				goto jsondone;
 			}
-			json_t *type = json_object_get(jsep, "type");
+			json_t *type = jsep_values[0];
 			jsep_type = g_strdup(json_string_value(type));
 			type = NULL;
 			gboolean do_trickle = TRUE;
-			json_t *jsep_trickle = json_object_get(jsep, "trickle");
+			json_t *jsep_trickle = jsep_values[1];
 			do_trickle = jsep_trickle ? json_is_true(jsep_trickle) : TRUE;
 			/* Are we still cleaning up from a previous media session? */
 			if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_CLEANING)) {
@@ -1196,7 +1425,9 @@ int janus_process_incoming_request(janus_request *request) {
 					}
 				} else {
 					/* Check if transport wide CC is supported */
-					int transport_wide_cc_ext_id = janus_rtp_header_extension_get_id(jsep_sdp, JANUS_RTP_EXTMAP_TRANSPORT_WIDE_CC);
+					janus_sdp_negotiation *negotiation = janus_sdp_negotiation_create(parsed_sdp);
+					int transport_wide_cc_ext_id = janus_sdp_negotiation_get_extmap_id(negotiation, JANUS_RTP_EXTMAP_TRANSPORT_WIDE_CC);
+					janus_sdp_negotiation_destroy(negotiation);
 					handle->stream->do_transport_wide_cc = TRUE;
 					handle->stream->transport_wide_cc_ext_id = transport_wide_cc_ext_id;
 				}
@@ -1518,13 +1749,34 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			json_t *status = json_object();
 			json_object_set_new(status, "token_auth", janus_auth_is_enabled() ? json_true() : json_false());
 			json_object_set_new(status, "session_timeout", json_integer(session_timeout));
+			json_object_set_new(status, "request_workers", json_integer(request_workers_num));
 			json_object_set_new(status, "log_level", json_integer(janus_log_level));
 			json_object_set_new(status, "log_timestamps", janus_log_timestamps ? json_true() : json_false());
 			json_object_set_new(status, "log_colors", janus_log_colors ? json_true() : json_false());
+			json_object_set_new(status, "log_dropped", json_integer(janus_log_get_dropped()));
+			if(janus_events_is_enabled()) {
+				json_object_set_new(status, "events_queue_depth", json_integer(janus_events_get_queue_depth()));
+				json_object_set_new(status, "events_queue_peak", json_integer(janus_events_get_queue_peak()));
+			}
 			json_object_set_new(status, "locking_debug", lock_debug ? json_true() : json_false());
 			json_object_set_new(status, "libnice_debug", janus_ice_is_ice_debugging_enabled() ? json_true() : json_false());
 			json_object_set_new(status, "max_nack_queue", json_integer(janus_get_max_nack_queue()));
+			json_object_set_new(status, "srtp_profiles", json_string(janus_dtls_get_srtp_profiles()));
 			json_object_set_new(status, "no_media_timer", json_integer(janus_get_no_media_timer()));
+			json_object_set_new(status, "max_queued_packets", json_integer(janus_get_max_queued_packets()));
+			json_object_set_new(status, "max_queued_age", json_integer(janus_get_max_queued_age()));
+			json_object_set_new(status, "loop_send", janus_ice_is_loop_send_enabled() ? json_true() : json_false());
+			json_object_set_new(status, "batch_send", janus_ice_is_batch_send_enabled() ? json_true() : json_false());
+			json_object_set_new(status, "pacing", janus_ice_is_pacing_enabled() ? json_true() : json_false());
+			json_object_set_new(status, "pacing_max_delay", json_integer(janus_ice_get_pacing_max_delay()));
+			json_object_set_new(status, "event_loops", json_integer(janus_ice_get_static_event_loops()));
+			json_object_set_new(status, "latency_histograms", janus_latency_is_enabled() ? json_true() : json_false());
+			json_t *loops = janus_ice_static_event_loops_info();
+			if(loops != NULL)
+				json_object_set_new(status, "event_loops_info", loops);
+			json_t *affinity = janus_affinity_info();
+			if(affinity != NULL)
+				json_object_set_new(status, "media_affinity", affinity);
 			json_object_set_new(reply, "status", status);
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
@@ -1544,7 +1796,12 @@ int janus_process_incoming_admin_request(janus_request *request) {
 				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE, "Invalid element type (timeout should be a positive integer)");
 				goto jsondone;
 			}
+			gboolean lowered = (timeout_num > 0 && (session_timeout == 0 || (uint)timeout_num < session_timeout));
 			session_timeout = timeout_num;
+			if(lowered) {
+				/* Sessions may be waiting in slots that are now too far away */
+				janus_sessions_wheel_reschedule();
+			}
 			/* Prepare JSON reply */
 			json_t *reply = json_object();
 			json_object_set_new(reply, "janus", json_string("success"));
@@ -1701,6 +1958,44 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
+		} else if(!strcasecmp(message_text, "set_latency_histograms")) {
+			/* Enable/disable tracking the latency of the media path */
+			JANUS_VALIDATE_JSON_OBJECT(root, histograms_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			json_t *histograms = json_object_get(root, "histograms");
+			janus_latency_set_enabled(json_is_true(histograms));
+			/* Prepare JSON reply */
+			json_t *reply = json_object();
+			json_object_set_new(reply, "janus", json_string("success"));
+			json_object_set_new(reply, "transaction", json_string(transaction_text));
+			json_object_set_new(reply, "latency_histograms", janus_latency_is_enabled() ? json_true() : json_false());
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "get_latency_stats")) {
+			/* Return a summary of the latency histograms, per plugin */
+			JANUS_VALIDATE_JSON_OBJECT(root, latency_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			gboolean reset = json_is_true(json_object_get(root, "reset"));
+			/* Prepare JSON reply */
+			json_t *reply = json_object();
+			json_object_set_new(reply, "janus", json_string("success"));
+			json_object_set_new(reply, "transaction", json_string(transaction_text));
+			json_object_set_new(reply, "latency_histograms", janus_latency_is_enabled() ? json_true() : json_false());
+			json_object_set_new(reply, "latencies", janus_latency_summary(reset));
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
 		} else if(!strcasecmp(message_text, "query_eventhandler")) {
 			/* Contact an event handler and expect a response */
 			JANUS_VALIDATE_JSON_OBJECT(root, queryhandler_parameters,
@@ -1739,11 +2034,13 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* List sessions */
 			session_id = 0;
 			json_t *list = json_array();
-			if(sessions != NULL && g_hash_table_size(sessions) > 0) {
-				janus_mutex_lock(&sessions_mutex);
+			int i = 0;
+			for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+				janus_sessions_shard *shard = &sessions_shards[i];
+				janus_mutex_lock(&shard->mutex);
 				GHashTableIter iter;
 				gpointer value;
-				g_hash_table_iter_init(&iter, sessions);
+				g_hash_table_iter_init(&iter, shard->sessions);
 				while (g_hash_table_iter_next(&iter, NULL, &value)) {
 					janus_session *session = value;
 					if(session == NULL) {
@@ -1751,7 +2048,7 @@ int janus_process_incoming_admin_request(janus_request *request) {
 					}
 					json_array_append_new(list, json_integer(session->session_id));
 				}
-				janus_mutex_unlock(&sessions_mutex);
+				janus_mutex_unlock(&shard->mutex);
 			}
 			/* Prepare JSON reply */
 			json_t *reply = json_object();
@@ -2133,8 +2430,23 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_REQUEST_PATH, "Unhandled request '%s' at this path", message_text);
 			goto jsondone;
 		}
+		JANUS_VALIDATE_JSON_OBJECT(root, listhandles_parameters,
+			error_code, error_cause, FALSE,
+			JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+		if(error_code != 0) {
+			ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+			goto jsondone;
+		}
+		json_t *offset = json_object_get(root, "offset");
+		json_t *limit = json_object_get(root, "limit");
+		json_t *fields = json_object_get(root, "fields");
+		guint32 mask = 0;
+		if(fields != NULL && janus_admin_info_fields_parse(fields, &mask, error_cause, sizeof(error_cause)) < 0) {
+			ret = janus_process_error_string(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE, error_cause);
+			goto jsondone;
+		}
 		/* List handles */
-		json_t *list = json_array();
+		GArray *ids = g_array_new(FALSE, FALSE, sizeof(guint64));
 		janus_mutex_lock(&session->mutex);
 		if(session->ice_handles != NULL && g_hash_table_size(session->ice_handles) > 0) {
 			GHashTableIter iter;
@@ -2145,16 +2457,46 @@ int janus_process_incoming_admin_request(janus_request *request) {
 				if(handle == NULL) {
 					continue;
 				}
-				json_array_append_new(list, json_integer(handle->handle_id));
+				g_array_append_val(ids, handle->handle_id);
 			}
 		}
 		janus_mutex_unlock(&session->mutex);
+		/* Pages only make sense if the order is always the same */
+		guint total = ids->len, first = 0, last = ids->len;
+		if(offset != NULL || limit != NULL) {
+			g_array_sort(ids, janus_admin_id_compare);
+			first = offset ? MIN(json_integer_value(offset), total) : 0;
+			if(limit != NULL && json_integer_value(limit) < total - first)
+				last = first + json_integer_value(limit);
+		}
+		json_t *list = json_array();
+		guint i = 0;
+		for(i=first; i<last; i++) {
+			guint64 id = g_array_index(ids, guint64, i);
+			if(fields == NULL) {
+				json_array_append_new(list, json_integer(id));
+				continue;
+			}
+			/* The handle may be gone in the meanwhile, in which case we skip it */
+			janus_mutex_lock(&session->mutex);
+			janus_ice_handle *handle = janus_ice_handle_find(session, id);
+			janus_mutex_unlock(&session->mutex);
+			if(handle == NULL)
+				continue;
+			json_array_append_new(list, janus_admin_handle_info(session, handle, mask));
+		}
+		g_array_free(ids, TRUE);
 		/* Prepare JSON reply */
 		json_t *reply = json_object();
 		json_object_set_new(reply, "janus", json_string("success"));
 		json_object_set_new(reply, "transaction", json_string(transaction_text));
 		json_object_set_new(reply, "session_id", json_integer(session_id));
 		json_object_set_new(reply, "handles", list);
+		if(offset != NULL || limit != NULL) {
+			json_object_set_new(reply, "total", json_integer(total));
+			if(last < total)
+				json_object_set_new(reply, "next_offset", json_integer(last));
+		}
 		/* Send the success reply */
 		ret = janus_process_success(request, reply);
 		goto jsondone;
@@ -2172,11 +2514,16 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			const char *folder = json_string_value(json_object_get(root, "folder"));
 			const char *filename = json_string_value(json_object_get(root, "filename"));
 			int truncate = json_integer_value(json_object_get(root, "truncate"));
+			int format = janus_text2pcap_format_from_string(json_string_value(json_object_get(root, "format")));
+			if(format < 0) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE, "Invalid element (format should be text or pcap)");
+				goto jsondone;
+			}
 			if(handle->text2pcap != NULL) {
 				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN, "text2pcap already started");
 				goto jsondone;
 			}
-			handle->text2pcap = janus_text2pcap_create(folder, filename, truncate);
+			handle->text2pcap = janus_text2pcap_create(folder, filename, truncate, format);
 			if(handle->text2pcap == NULL) {
 				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN, "Error starting text2pcap dump");
 				goto jsondone;
@@ -2212,86 +2559,21 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_REQUEST_PATH, "Unhandled request '%s' at this path", message_text);
 			goto jsondone;
 		}
-		/* Prepare info */
-		janus_mutex_lock(&handle->mutex);
-		json_t *info = json_object();
-		json_object_set_new(info, "session_id", json_integer(session_id));
-		json_object_set_new(info, "session_last_activity", json_integer(session->last_activity));
-		if(session->source && session->source->transport)
-			json_object_set_new(info, "session_transport", json_string(session->source->transport->get_package()));
-		json_object_set_new(info, "handle_id", json_integer(handle_id));
-		if(handle->opaque_id)
-			json_object_set_new(info, "opaque_id", json_string(handle->opaque_id));
-		json_object_set_new(info, "created", json_integer(handle->created));
-		json_object_set_new(info, "send_thread_created", g_atomic_int_get(&handle->send_thread_created) ? json_true() : json_false());
-		json_object_set_new(info, "current_time", json_integer(janus_get_monotonic_time()));
-		if(handle->app && handle->app_handle && janus_plugin_session_is_alive(handle->app_handle)) {
-			janus_plugin *plugin = (janus_plugin *)handle->app;
-			json_object_set_new(info, "plugin", json_string(plugin->get_package()));
-			if(plugin->query_session) {
-				/* FIXME This check will NOT work with legacy plugins that were compiled BEFORE the method was specified in plugin.h */
-				json_t *query = plugin->query_session(handle->app_handle);
-				if(query != NULL) {
-					/* Make sure this is a JSON object */
-					if(!json_is_object(query)) {
-						JANUS_LOG(LOG_WARN, "Ignoring invalid query response from the plugin (not an object)\n");
-						json_decref(query);
-					} else {
-						json_object_set_new(info, "plugin_specific", query);
-					}
-					query = NULL;
-				}
-			}
-		}
-		json_t *flags = json_object();
-		json_object_set_new(flags, "got-offer", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_GOT_OFFER) ? json_true() : json_false());
-		json_object_set_new(flags, "got-answer", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_GOT_ANSWER) ? json_true() : json_false());
-		json_object_set_new(flags, "processing-offer", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_PROCESSING_OFFER) ? json_true() : json_false());
-		json_object_set_new(flags, "starting", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_START) ? json_true() : json_false());
-		json_object_set_new(flags, "ice-restart", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ICE_RESTART) ? json_true() : json_false());
-		json_object_set_new(flags, "ready", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY) ? json_true() : json_false());
-		json_object_set_new(flags, "stopped", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP) ? json_true() : json_false());
-		json_object_set_new(flags, "alert", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) ? json_true() : json_false());
-		json_object_set_new(flags, "trickle", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_TRICKLE) ? json_true() : json_false());
-		json_object_set_new(flags, "all-trickles", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALL_TRICKLES) ? json_true() : json_false());
-		json_object_set_new(flags, "resend-trickles", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RESEND_TRICKLES) ? json_true() : json_false());
-		json_object_set_new(flags, "trickle-synced", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_TRICKLE_SYNCED) ? json_true() : json_false());
-		json_object_set_new(flags, "data-channels", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_DATA_CHANNELS) ? json_true() : json_false());
-		json_object_set_new(flags, "has-audio", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO) ? json_true() : json_false());
-		json_object_set_new(flags, "has-video", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO) ? json_true() : json_false());
-		json_object_set_new(flags, "rfc4588-rtx", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX) ? json_true() : json_false());
-		json_object_set_new(flags, "cleaning", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_CLEANING) ? json_true() : json_false());
-		json_object_set_new(info, "flags", flags);
-		if(handle->agent) {
-			json_object_set_new(info, "agent-created", json_integer(handle->agent_created));
-			json_object_set_new(info, "ice-mode", json_string(janus_ice_is_ice_lite_enabled() ? "lite" : "full"));
-			json_object_set_new(info, "ice-role", json_string(handle->controlling ? "controlling" : "controlled"));
-		}
-		json_t *sdps = json_object();
-		if(handle->rtp_profile)
-			json_object_set_new(sdps, "profile", json_string(handle->rtp_profile));
-		if(handle->local_sdp)
-			json_object_set_new(sdps, "local", json_string(handle->local_sdp));
-		if(handle->remote_sdp)
-			json_object_set_new(sdps, "remote", json_string(handle->remote_sdp));
-		json_object_set_new(info, "sdps", sdps);
-		if(handle->pending_trickles)
-			json_object_set_new(info, "pending-trickles", json_integer(g_list_length(handle->pending_trickles)));
-		if(handle->queued_packets)
-			json_object_set_new(info, "queued-packets", json_integer(g_async_queue_length(handle->queued_packets)));
-		if(g_atomic_int_get(&handle->dump_packets)) {
-			json_object_set_new(info, "dump-to-text2pcap", json_true());
-			if(handle->text2pcap && handle->text2pcap->filename)
-			json_object_set_new(info, "text2pcap-file", json_string(handle->text2pcap->filename));
+		JANUS_VALIDATE_JSON_OBJECT(root, handleinfo_parameters,
+			error_code, error_cause, FALSE,
+			JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+		if(error_code != 0) {
+			ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+			goto jsondone;
 		}
-		json_t *streams = json_array();
-		if(handle->stream) {
-			json_t *s = janus_admin_stream_summary(handle->stream);
-			if(s)
-				json_array_append_new(streams, s);
+		guint32 mask = JANUS_ADMIN_INFO_ALL;
+		json_t *fields = json_object_get(root, "fields");
+		if(fields != NULL && janus_admin_info_fields_parse(fields, &mask, error_cause, sizeof(error_cause)) < 0) {
+			ret = janus_process_error_string(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE, error_cause);
+			goto jsondone;
 		}
-		json_object_set_new(info, "streams", streams);
-		janus_mutex_unlock(&handle->mutex);
+		/* Prepare info */
+		json_t *info = janus_admin_handle_info(session, handle, mask);
 		/* Prepare JSON reply */
 		json_t *reply = json_object();
 		json_object_set_new(reply, "janus", json_string("success"));
@@ -2309,11 +2591,74 @@ jsondone:
 	return ret;
 }
 
+/* Batch requests: each request in the array is processed as if it had been
+ * sent on its own, with the session/handle identifiers and API secret/token
+ * of the batch as defaults, and the responses are returned all together */
+static int janus_process_batch(janus_request *request, guint64 session_id, guint64 handle_id, const char *transaction_text) {
+	int error_code = 0;
+	char error_cause[100];
+	json_t *root = request->message;
+	if(request->responses != NULL) {
+		return janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_REQUEST_PATH, "Nested batch requests are not allowed");
+	}
+	JANUS_VALIDATE_JSON_OBJECT(root, batch_parameters,
+		error_code, error_cause, FALSE,
+		JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+	if(error_code != 0)
+		return janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+	json_t *requests = json_object_get(root, "requests");
+	size_t count = json_array_size(requests);
+	if(count == 0 || count > JANUS_BATCH_MAX_REQUESTS) {
+		return janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE,
+			"Invalid number of requests in batch (%zu, should be 1-%d)", count, JANUS_BATCH_MAX_REQUESTS);
+	}
+	json_t *apisecret = json_object_get(root, "apisecret");
+	json_t *token = json_object_get(root, "token");
+	json_t *responses = json_array();
+	size_t i = 0;
+	for(i=0; i<count; i++) {
+		json_t *item = json_array_get(requests, i);
+		if(!json_is_object(item)) {
+			janus_request dummy = { .transport = request->transport, .instance = request->instance,
+				.request_id = NULL, .admin = FALSE, .message = NULL, .responses = responses };
+			janus_process_error(&dummy, session_id, transaction_text, JANUS_ERROR_INVALID_JSON_OBJECT, "JSON error: not an object");
+			continue;
+		}
+		/* Inherit what the request doesn't specify itself */
+		if(session_id > 0 && json_object_get(item, "session_id") == NULL)
+			json_object_set_new(item, "session_id", json_integer(session_id));
+		if(handle_id > 0 && json_object_get(item, "handle_id") == NULL)
+			json_object_set_new(item, "handle_id", json_integer(handle_id));
+		if(apisecret != NULL && json_object_get(item, "apisecret") == NULL)
+			json_object_set(item, "apisecret", apisecret);
+		if(token != NULL && json_object_get(item, "token") == NULL)
+			json_object_set(item, "token", token);
+		json_incref(item);
+		janus_request *sub = janus_request_new(request->transport, request->instance, NULL, FALSE, item);
+		sub->responses = responses;
+		janus_process_incoming_request(sub);
+		janus_request_destroy(sub);
+	}
+	/* Send all the responses back */
+	json_t *reply = json_object();
+	json_object_set_new(reply, "janus", json_string("batch"));
+	if(session_id > 0)
+		json_object_set_new(reply, "session_id", json_integer(session_id));
+	json_object_set_new(reply, "transaction", json_string(transaction_text));
+	json_object_set_new(reply, "responses", responses);
+	return janus_process_success(request, reply);
+}
+
 // transport发送操作成功的消息
 int janus_process_success(janus_request *request, json_t *payload)
 {
 	if(!request || !payload)
 		return -1;
+	if(request->responses != NULL) {
+		/* Part of a batch, the response will be sent together with the others */
+		json_array_append_new(request->responses, payload);
+		return 0;
+	}
 	/* Pass to the right transport plugin */
 	JANUS_LOG(LOG_HUGE, "Sending %s API response to %s (%p)\n", request->admin ? "admin" : "Janus", request->transport->get_package(), request->instance);
 	return request->transport->send_message(request->instance, request->request_id, request->admin, payload);
@@ -2337,6 +2682,11 @@ static int janus_process_error_string(janus_request *request, uint64_t session_i
 	json_object_set_new(error_data, "code", json_integer(error));
 	json_object_set_new(error_data, "reason", json_string(error_string));
 	json_object_set_new(reply, "error", error_data);
+	if(request->responses != NULL) {
+		/* Part of a batch, the error will be sent together with the other responses */
+		json_array_append_new(request->responses, reply);
+		return 0;
+	}
 	/* Pass to the right transport plugin */
 	return request->transport->send_message(request->instance, request->request_id, request->admin, reply);
 }
@@ -2362,6 +2712,142 @@ int janus_process_error(janus_request *request, uint64_t session_id, const char
 }
 
 /* Admin/monitor helpers */
+static gint janus_admin_id_compare(gconstpointer a, gconstpointer b) {
+	guint64 ia = *(const guint64 *)a, ib = *(const guint64 *)b;
+	return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+static int janus_admin_info_fields_parse(json_t *fields, guint32 *mask, char *error_cause, size_t error_size) {
+	*mask = 0;
+	size_t i = 0;
+	for(i=0; i<json_array_size(fields); i++) {
+		json_t *field = json_array_get(fields, i);
+		const char *name = json_string_value(field);
+		if(name == NULL) {
+			g_snprintf(error_cause, error_size, "Invalid element type (fields should be an array of strings)");
+			return -1;
+		}
+		int f = 0;
+		while(janus_admin_info_fields[f].name != NULL && strcasecmp(janus_admin_info_fields[f].name, name))
+			f++;
+		if(janus_admin_info_fields[f].name == NULL) {
+			g_snprintf(error_cause, error_size, "Unsupported field '%s'", name);
+			return -1;
+		}
+		*mask |= janus_admin_info_fields[f].flag;
+	}
+	return 0;
+}
+
+/* Prepare the info on a handle, limited to the groups in the mask */
+static json_t *janus_admin_handle_info(janus_session *session, janus_ice_handle *handle, guint32 fields) {
+	janus_mutex_lock(&handle->mutex);
+	json_t *info = json_object();
+	json_object_set_new(info, "session_id", json_integer(session->session_id));
+	json_object_set_new(info, "session_last_activity", json_integer(session->last_activity));
+	if(session->source && session->source->transport)
+		json_object_set_new(info, "session_transport", json_string(session->source->transport->get_package()));
+	json_object_set_new(info, "handle_id", json_integer(handle->handle_id));
+	if(handle->opaque_id)
+		json_object_set_new(info, "opaque_id", json_string(handle->opaque_id));
+	json_object_set_new(info, "created", json_integer(handle->created));
+	json_object_set_new(info, "send_thread_created", g_atomic_int_get(&handle->send_thread_created) ? json_true() : json_false());
+	json_object_set_new(info, "current_time", json_integer(janus_get_monotonic_time()));
+	if((fields & (JANUS_ADMIN_INFO_PLUGIN | JANUS_ADMIN_INFO_PLUGIN_SPECIFIC)) &&
+			handle->app && handle->app_handle && janus_plugin_session_is_alive(handle->app_handle)) {
+		janus_plugin *plugin = (janus_plugin *)handle->app;
+		json_object_set_new(info, "plugin", json_string(plugin->get_package()));
+		if((fields & JANUS_ADMIN_INFO_PLUGIN_SPECIFIC) && plugin->query_session) {
+			/* FIXME This check will NOT work with legacy plugins that were compiled BEFORE the method was specified in plugin.h */
+			json_t *query = plugin->query_session(handle->app_handle);
+			if(query != NULL) {
+				/* Make sure this is a JSON object */
+				if(!json_is_object(query)) {
+					JANUS_LOG(LOG_WARN, "Ignoring invalid query response from the plugin (not an object)\n");
+					json_decref(query);
+				} else {
+					json_object_set_new(info, "plugin_specific", query);
+				}
+				query = NULL;
+			}
+		}
+	}
+	if(fields & JANUS_ADMIN_INFO_FLAGS) {
+		json_t *flags = json_object();
+		json_object_set_new(flags, "got-offer", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_GOT_OFFER) ? json_true() : json_false());
+		json_object_set_new(flags, "got-answer", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_GOT_ANSWER) ? json_true() : json_false());
+		json_object_set_new(flags, "processing-offer", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_PROCESSING_OFFER) ? json_true() : json_false());
+		json_object_set_new(flags, "starting", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_START) ? json_true() : json_false());
+		json_object_set_new(flags, "ice-restart", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ICE_RESTART) ? json_true() : json_false());
+		json_object_set_new(flags, "ready", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY) ? json_true() : json_false());
+		json_object_set_new(flags, "stopped", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP) ? json_true() : json_false());
+		json_object_set_new(flags, "alert", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT) ? json_true() : json_false());
+		json_object_set_new(flags, "trickle", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_TRICKLE) ? json_true() : json_false());
+		json_object_set_new(flags, "all-trickles", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALL_TRICKLES) ? json_true() : json_false());
+		json_object_set_new(flags, "resend-trickles", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RESEND_TRICKLES) ? json_true() : json_false());
+		json_object_set_new(flags, "trickle-synced", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_TRICKLE_SYNCED) ? json_true() : json_false());
+		json_object_set_new(flags, "data-channels", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_DATA_CHANNELS) ? json_true() : json_false());
+		json_object_set_new(flags, "has-audio", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO) ? json_true() : json_false());
+		json_object_set_new(flags, "has-video", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_VIDEO) ? json_true() : json_false());
+		json_object_set_new(flags, "rfc4588-rtx", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX) ? json_true() : json_false());
+		json_object_set_new(flags, "cleaning", janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_CLEANING) ? json_true() : json_false());
+		json_object_set_new(info, "flags", flags);
+	}
+	if(fields & JANUS_ADMIN_INFO_ICE) {
+		if(handle->agent) {
+			json_object_set_new(info, "agent-created", json_integer(handle->agent_created));
+			json_object_set_new(info, "ice-mode", json_string(janus_ice_is_ice_lite_enabled() ? "lite" : "full"));
+			json_object_set_new(info, "ice-role", json_string(handle->controlling ? "controlling" : "controlled"));
+		}
+		if(janus_ice_handle_get_static_event_loop(handle) >= 0)
+			json_object_set_new(info, "event-loop", json_integer(janus_ice_handle_get_static_event_loop(handle)));
+	}
+	if(fields & JANUS_ADMIN_INFO_SDPS) {
+		json_t *sdps = json_object();
+		if(handle->rtp_profile)
+			json_object_set_new(sdps, "profile", json_string(handle->rtp_profile));
+		if(handle->local_sdp)
+			json_object_set_new(sdps, "local", json_string(handle->local_sdp));
+		if(handle->remote_sdp)
+			json_object_set_new(sdps, "remote", json_string(handle->remote_sdp));
+		json_object_set_new(info, "sdps", sdps);
+	}
+	if(fields & JANUS_ADMIN_INFO_QUEUES) {
+		if(handle->pending_trickles)
+			json_object_set_new(info, "pending-trickles", json_integer(g_list_length(handle->pending_trickles)));
+		if(handle->queued_packets)
+			json_object_set_new(info, "queued-packets", json_integer(g_async_queue_length(handle->queued_packets)));
+		json_t *pool = json_object();
+		janus_mutex_lock(&handle->packets_pool_mutex);
+		json_object_set_new(pool, "available", json_integer(handle->packets_pool_size));
+		json_object_set_new(pool, "hits", json_integer(handle->packets_pool_hits));
+		json_object_set_new(pool, "misses", json_integer(handle->packets_pool_misses));
+		janus_mutex_unlock(&handle->packets_pool_mutex);
+		json_object_set_new(info, "packets-pool", pool);
+		json_object_set_new(info, "memory", json_integer(janus_ice_handle_memory(handle)));
+	}
+	if(fields & JANUS_ADMIN_INFO_TEXT2PCAP) {
+		if(g_atomic_int_get(&handle->dump_packets)) {
+			json_object_set_new(info, "dump-to-text2pcap", json_true());
+			if(handle->text2pcap && handle->text2pcap->filename)
+			json_object_set_new(info, "text2pcap-file", json_string(handle->text2pcap->filename));
+			if(handle->text2pcap)
+				json_object_set_new(info, "text2pcap-format", json_string(handle->text2pcap->format == JANUS_TEXT2PCAP_FORMAT_PCAP ? "pcap" : "text"));
+		}
+	}
+	if(fields & JANUS_ADMIN_INFO_STREAMS) {
+		json_t *streams = json_array();
+		if(handle->stream) {
+			json_t *s = janus_admin_stream_summary(handle->stream);
+			if(s)
+				json_array_append_new(streams, s);
+		}
+		json_object_set_new(info, "streams", streams);
+	}
+	janus_mutex_unlock(&handle->mutex);
+	return info;
+}
+
 json_t *janus_admin_stream_summary(janus_ice_stream *stream) {
 	if(stream == NULL)
 		return NULL;
@@ -2524,11 +3010,16 @@ json_t *janus_admin_component_summary(janus_ice_component *component) {
 		json_object_set_new(d, "dtls-state", json_string(janus_get_dtls_srtp_state(dtls->dtls_state)));
 		json_object_set_new(d, "retransmissions", json_integer(dtls->retransmissions));
 		json_object_set_new(d, "valid", dtls->srtp_valid ? json_true() : json_false());
+		if(dtls->srtp_valid && janus_srtp_profile_str(dtls->srtp_profile) != NULL)
+			json_object_set_new(d, "srtp-profile", json_string(janus_srtp_profile_str(dtls->srtp_profile)));
 		json_object_set_new(d, "ready", dtls->ready ? json_true() : json_false());
 		if(dtls->dtls_started > 0)
 			json_object_set_new(d, "handshake-started", json_integer(dtls->dtls_started));
-		if(dtls->dtls_connected > 0)
+		if(dtls->dtls_connected > 0) {
 			json_object_set_new(d, "connected", json_integer(dtls->dtls_connected));
+			if(dtls->dtls_started > 0)
+				json_object_set_new(d, "handshake-duration", json_integer(dtls->dtls_connected - dtls->dtls_started));
+		}
 		if(handle && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AUDIO)) {
 			json_object_set_new(in_stats, "audio_packets", json_integer(component->in_stats.audio.packets));
 			json_object_set_new(in_stats, "audio_bytes", json_integer(component->in_stats.audio.bytes));
@@ -2572,6 +3063,14 @@ json_t *janus_admin_component_summary(janus_ice_component *component) {
 		}
 		json_object_set_new(out_stats, "data_packets", json_integer(component->out_stats.data.packets));
 		json_object_set_new(out_stats, "data_bytes", json_integer(component->out_stats.data.bytes));
+		if(handle) {
+			/* Packets we dropped because the outgoing queue was too long */
+			json_object_set_new(out_stats, "queue_dropped_audio", json_integer(g_atomic_int_get(&handle->queue_dropped_audio)));
+			json_object_set_new(out_stats, "queue_dropped_video", json_integer(g_atomic_int_get(&handle->queue_dropped_video)));
+			json_object_set_new(out_stats, "queue_plis", json_integer(g_atomic_int_get(&handle->queue_plis)));
+			json_object_set_new(out_stats, "paced_video", json_integer(g_atomic_int_get(&handle->paced_video)));
+			json_object_set_new(out_stats, "queue_dropping", g_atomic_int_get(&handle->queue_dropping) ? json_true() : json_false());
+		}
 #ifdef HAVE_SCTP
 		/* FIXME Actually check if this succeeded? */
 		json_object_set_new(d, "sctp-association", dtls->sctp ? json_true() : json_false());
@@ -2606,18 +3105,32 @@ void janus_transport_incoming_request(janus_transport *plugin, void *transport,
 	JANUS_LOG(LOG_VERB, "Got %s API request from %s (%p)\n", admin ? "an admin" : "a Janus", plugin->get_package(), transport);
 	/* Create a janus_request instance to handle the request */
 	janus_request *request = janus_request_new(plugin, transport, request_id, admin, message);
+	/* Pick the worker: requests with no session (e.g., create) can go anywhere */
+	guint64 session_id = 0;
+	json_t *s = message ? json_object_get(message, "session_id") : NULL;
+	if(s && json_is_integer(s))
+		session_id = json_integer_value(s);
+	guint index = 0;
+	if(request_workers_num > 1) {
+		if(session_id > 0)
+			index = (session_id ^ (session_id >> 32)) % request_workers_num;
+		else
+			index = (guint)g_atomic_int_add(&request_workers_next, 1) % request_workers_num;
+	}
 	/* Enqueue the request, the thread will pick it up */
-	g_async_queue_push(requests, request); 	// glib实现
+	g_async_queue_push(request_workers[index].requests, request); 	// glib实现
 }
 
 void janus_transport_gone(janus_transport *plugin, void *transport) {
 	/* Get rid of sessions this transport was handling */
 	JANUS_LOG(LOG_VERB, "A %s transport instance has gone away (%p)\n", plugin->get_package(), transport);
-	janus_mutex_lock(&sessions_mutex);
-	if(sessions && g_hash_table_size(sessions) > 0) {
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions_shards[i];
+		janus_mutex_lock(&shard->mutex);
 		GHashTableIter iter;
 		gpointer value;
-		g_hash_table_iter_init(&iter, sessions);
+		g_hash_table_iter_init(&iter, shard->sessions);
 		while(g_hash_table_iter_next(&iter, NULL, &value)) {
 			janus_session *session = (janus_session *) value;
 			if(!session || g_atomic_int_get(&session->destroy) || g_atomic_int_get(&session->timeout) || session->last_activity == 0)
@@ -2629,8 +3142,8 @@ void janus_transport_gone(janus_transport *plugin, void *transport) {
 				g_hash_table_iter_remove(&iter);
 			}
 		}
+		janus_mutex_unlock(&shard->mutex);
 	}
-	janus_mutex_unlock(&sessions_mutex);
 }
 
 gboolean janus_transport_is_api_secret_needed(janus_transport *plugin) {
@@ -2684,11 +3197,12 @@ void janus_transport_task(gpointer data, gpointer user_data) {
 
 /* Thread to handle incoming requests: may involve an asynchronous task for plugin messaging */
 static void *janus_transport_requests(void *data) {
-	JANUS_LOG(LOG_INFO, "Joining Janus requests handler thread\n");
+	janus_request_worker *worker = (janus_request_worker *)data;
+	JANUS_LOG(LOG_INFO, "Joining Janus requests handler thread #%u\n", worker->index);
 	janus_request *request = NULL;
 	gboolean destroy = FALSE;
 	while(!g_atomic_int_get(&stop)) {
-		request = g_async_queue_pop(requests);
+		request = g_async_queue_pop(worker->requests);
 		if(request == &exit_message)
 			break;
 		/* Should we process the request synchronously or with a task from the thread pool? */
@@ -2698,7 +3212,7 @@ static void *janus_transport_requests(void *data) {
 			json_t *message = json_object_get(request->message, "janus");
 			const gchar *message_text = json_string_value(message);
 			// message类型的消息，转移到task队列
-			if(message_text && !strcasecmp(message_text, "message")) {
+			if(message_text && (!strcasecmp(message_text, "message") || !strcasecmp(message_text, "batch"))) {
 				/* Spawn a task thread */
 				GError *tperror = NULL;
 				g_thread_pool_push(tasks, request, &tperror);
@@ -2723,7 +3237,7 @@ static void *janus_transport_requests(void *data) {
 		if(destroy)
 			janus_request_destroy(request);
 	}
-	JANUS_LOG(LOG_INFO, "Leaving Janus requests handler thread\n");
+	JANUS_LOG(LOG_INFO, "Leaving Janus requests handler thread #%u\n", worker->index);
 	return NULL;
 }
 
@@ -2839,6 +3353,24 @@ int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *
 	return JANUS_OK;
 }
 
+int janus_plugin_push_event_shared(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, janus_plugin_event *event) {
+	if(!plugin || !event)
+		return -1;
+	if(!plugin_session || plugin_session < (janus_plugin_session *)0x1000 ||
+			!janus_plugin_session_is_alive(plugin_session) || plugin_session->stopped)
+		return -2;
+	janus_ice_handle *ice_handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!ice_handle || janus_flags_is_set(&ice_handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP))
+		return JANUS_ERROR_SESSION_NOT_FOUND;
+	janus_session *session = ice_handle->session;
+	if(!session || g_atomic_int_get(&session->destroy))
+		return JANUS_ERROR_SESSION_NOT_FOUND;
+	/* Send the event */
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending shared event to transport...\n", ice_handle->handle_id);
+	janus_session_notify_shared_event(session, ice_handle->handle_id, transaction, event);
+	return JANUS_OK;
+}
+
 json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *sdp_type, const char *sdp, gboolean restart) {
 	if(!plugin_session || plugin_session < (janus_plugin_session *)0x1000 ||
 			!janus_plugin_session_is_alive(plugin_session) || plugin_session->stopped ||
@@ -2944,6 +3476,8 @@ json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plug
 			}
 		}
 	}
+	/* Take note of any additional SSRC the plugin wants to multiplex, before anonymizing the SDP */
+	janus_sdp_extra_ssrcs(ice_handle, parsed_sdp);
 	/* Anonymize SDP */
 	if(janus_sdp_anonymize(parsed_sdp) < 0) {
 		/* Invalid SDP */
@@ -2963,9 +3497,11 @@ json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plug
 		janus_mutex_unlock(&ice_handle->mutex);
 		return NULL;
 	}
+	/* Parse the payload types and extensions we're negotiating only once */
+	janus_sdp_negotiation *negotiation = janus_sdp_negotiation_create(parsed_sdp);
 	if (!offer) {
 		/* Check if transport wide CC is supported */
-		int transport_wide_cc_ext_id = janus_rtp_header_extension_get_id(sdp, JANUS_RTP_EXTMAP_TRANSPORT_WIDE_CC);
+		int transport_wide_cc_ext_id = janus_sdp_negotiation_get_extmap_id(negotiation, JANUS_RTP_EXTMAP_TRANSPORT_WIDE_CC);
 		stream->do_transport_wide_cc = TRUE;
 		stream->transport_wide_cc_ext_id = transport_wide_cc_ext_id;
 	}
@@ -3007,6 +3543,7 @@ json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plug
 		/* Couldn't merge SDP */
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error merging SDP\n", ice_handle->handle_id);
 		janus_sdp_free(parsed_sdp);
+		janus_sdp_negotiation_destroy(negotiation);
 		janus_mutex_unlock(&ice_handle->mutex);
 		return NULL;
 	}
@@ -3100,8 +3637,11 @@ json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plug
 	json_object_set_new(jsep, "sdp", json_string(sdp_merged));
 	char *tmp = ice_handle->local_sdp;
 	ice_handle->local_sdp = sdp_merged;
+	janus_sdp_negotiation *tmp_negotiation = ice_handle->local_negotiation;
+	ice_handle->local_negotiation = negotiation;
 	janus_mutex_unlock(&ice_handle->mutex);
 	g_free(tmp);
+	janus_sdp_negotiation_destroy(tmp_negotiation);
 	return jsep;
 }
 
@@ -3118,6 +3658,16 @@ void janus_plugin_relay_rtp(janus_plugin_session *plugin_session, int video, cha
 	janus_ice_relay_rtp(handle, video, buf, len);
 }
 
+void janus_plugin_relay_rtp_shared(janus_plugin_session *plugin_session, janus_plugin_rtp *packet) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || plugin_session->stopped || packet == NULL)
+		return;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)
+			|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+		return;
+	janus_ice_relay_rtp_shared(handle, packet);
+}
+
 void janus_plugin_relay_rtcp(janus_plugin_session *plugin_session, int video, char *buf, int len) {
 	if((plugin_session < (janus_plugin_session *)0x1000) || plugin_session->stopped || buf == NULL || len < 1)
 		return;
@@ -3128,7 +3678,7 @@ void janus_plugin_relay_rtcp(janus_plugin_session *plugin_session, int video, ch
 	janus_ice_relay_rtcp(handle, video, buf, len);
 }
 
-void janus_plugin_relay_data(janus_plugin_session *plugin_session, char *buf, int len) {
+static void janus_plugin_relay_data_internal(janus_plugin_session *plugin_session, gboolean binary, char *buf, int len) {
 	if((plugin_session < (janus_plugin_session *)0x1000) || plugin_session->stopped || buf == NULL || len < 1)
 		return;
 	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
@@ -3136,7 +3686,38 @@ void janus_plugin_relay_data(janus_plugin_session *plugin_session, char *buf, in
 			|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
 		return;
 #ifdef HAVE_SCTP
-	janus_ice_relay_data(handle, buf, len);
+	janus_ice_relay_data(handle, binary, buf, len);
+#else
+	JANUS_LOG(LOG_WARN, "Asked to relay data, but Data Channels support has not been compiled...\n");
+#endif
+}
+
+void janus_plugin_relay_data(janus_plugin_session *plugin_session, char *buf, int len) {
+	janus_plugin_relay_data_internal(plugin_session, FALSE, buf, len);
+}
+
+void janus_plugin_relay_binary_data(janus_plugin_session *plugin_session, char *buf, int len) {
+	janus_plugin_relay_data_internal(plugin_session, TRUE, buf, len);
+}
+
+void janus_plugin_relay_data_broadcast(janus_plugin_session **plugin_sessions, int count, char *buf, int len) {
+	if(plugin_sessions == NULL || count < 1 || buf == NULL || len < 1)
+		return;
+#ifdef HAVE_SCTP
+	/* Copy the message once: all the queues will reference the same buffer */
+	janus_plugin_rtp *data = janus_plugin_rtp_new(0, buf, len);
+	int i = 0;
+	for(i=0; i<count; i++) {
+		janus_plugin_session *plugin_session = plugin_sessions[i];
+		if((plugin_session < (janus_plugin_session *)0x1000) || plugin_session->stopped)
+			continue;
+		janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+		if(!handle || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)
+				|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+			continue;
+		janus_ice_relay_data_shared(handle, data);
+	}
+	janus_plugin_rtp_unref(data);
 #else
 	JANUS_LOG(LOG_WARN, "Asked to relay data, but Data Channels support has not been compiled...\n");
 #endif
@@ -3200,6 +3781,16 @@ void janus_plugin_end_session(janus_plugin_session *plugin_session) {
 	g_source_unref(timeout_source);
 }
 
+void janus_plugin_set_placement_group(janus_plugin_session *plugin_session, guint64 group) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || !janus_plugin_session_is_alive(plugin_session) || plugin_session->stopped)
+		return;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle)
+		return;
+	/* This is only used the next time the handle gets a loop */
+	handle->placement_group = group;
+}
+
 void janus_plugin_notify_event(janus_plugin *plugin, janus_plugin_session *plugin_session, json_t *event) {
 	/* A plugin asked to notify an event to the handlers */
 	if(!plugin || !event || !json_is_object(event))
@@ -3242,6 +3833,15 @@ gboolean janus_plugin_auth_signature_contains(janus_plugin *plugin, const char *
 	return janus_auth_check_signature_contains(token, plugin->get_package(), descriptor);
 }
 
+/* Metrics whose value we can get from other modules when needed */
+static gint64 janus_metrics_log_dropped(gpointer user_data) {
+	return (gint64)janus_log_get_dropped();
+}
+
+static gint64 janus_metrics_events_depth(gpointer user_data) {
+	return janus_events_is_enabled() ? janus_events_get_queue_depth() : 0;
+}
+
 
 /* Main主函数 */
 gint main(int argc, char *argv[])
@@ -3671,6 +4271,18 @@ gint main(int argc, char *argv[])
 		}
 	}
 
+	/* How many threads should process incoming requests? */
+	item = janus_config_get_item_drilldown(config, "general", "request_workers");
+	if(item && item->value) {
+		int rw = atoi(item->value);
+		if(rw < 1 || rw > MAX_REQUEST_WORKERS) {
+			JANUS_LOG(LOG_WARN, "Invalid request_workers value (should be between 1 and %d), using %d\n",
+				MAX_REQUEST_WORKERS, DEFAULT_REQUEST_WORKERS);
+		} else {
+			request_workers_num = rw;
+		}
+	}
+
 	/* Is there any API secret to consider? */
 	api_secret = NULL;
 	item = janus_config_get_item_drilldown(config, "general", "api_secret");
@@ -3699,6 +4311,33 @@ gint main(int argc, char *argv[])
 	} else {
 		janus_recorder_init(FALSE, NULL);
 	}
+	item = janus_config_get_item_drilldown(config, "general", "recordings_writers");
+	if(item && item->value) {
+		int writers = atoi(item->value);
+		if(writers > 0) {
+			/* Recordings should be saved by dedicated threads */
+			size_t buffer_size = 1024*1024;
+			item = janus_config_get_item_drilldown(config, "general", "recordings_buffer");
+			if(item && item->value && atoi(item->value) > 0)
+				buffer_size = (size_t)atoi(item->value) * 1024;
+			if(janus_recorder_async_init(writers, buffer_size) < 0)
+				JANUS_LOG(LOG_WARN, "Couldn't enable asynchronous recordings, frames will be saved synchronously\n");
+		}
+	}
+
+	/* Should media threads be pinned to some CPUs (and NUMA nodes)? This must happen before any timer thread or loop is spawned */
+	item = janus_config_get_item_drilldown(config, "media", "cpu_affinity");
+	const char *cpu_affinity = (item && item->value) ? item->value : NULL;
+	item = janus_config_get_item_drilldown(config, "media", "numa_aware");
+	janus_affinity_init(cpu_affinity, item && item->value && janus_is_true(item->value));
+	/* Initialize the timer service plugins can use for paced loops */
+	int timer_threads = 0;
+	item = janus_config_get_item_drilldown(config, "general", "timer_threads");
+	if(item && item->value)
+		timer_threads = atoi(item->value);
+	if(janus_timer_init(timer_threads) < 0) {
+		JANUS_LOG(LOG_WARN, "Couldn't create the timer threads pool, falling back to dedicated threads\n");
+	}
 
 	/* Setup ICE stuff (e.g., checking if the provided STUN server is correct) */
 	char *stun_server = NULL, *turn_server = NULL;
@@ -3790,9 +4429,42 @@ gint main(int argc, char *argv[])
 	if(item && item->value)
 		turn_rest_api_method = (char *)item->value;
 #endif
+	/* Core metrics: the ICE stack adds its own when initialized */
+	metric_sessions = janus_metrics_add("janus_sessions", NULL, "Sessions currently active", JANUS_METRIC_GAUGE);
+	janus_metrics_add_callback("janus_log_dropped_total", NULL, "Log lines dropped because the logger was falling behind",
+		JANUS_METRIC_COUNTER, janus_metrics_log_dropped, NULL);
+	janus_metrics_add_callback("janus_events_queue_depth", NULL, "Events waiting to be dispatched to event handlers",
+		JANUS_METRIC_GAUGE, janus_metrics_events_depth, NULL);
 	/* Initialize the ICE stack now */
 	// 初始化ICE
 	janus_ice_init(ice_lite, ice_tcp, full_trickle, ipv6, rtp_min_port, rtp_max_port);
+	/* Should handles share a pool of event loops, rather than have one thread each? */
+	item = janus_config_get_item_drilldown(config, "nat", "event_loops");
+	if(item && item->value) {
+		int loops = atoi(item->value);
+		if(loops < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring event_loops value as it's not a positive integer\n");
+		} else if(loops > 0) {
+			janus_ice_set_static_event_loops(loops);
+		}
+	}
+	/* Should all handles share the same port, rather than gather candidates on ports of their own? */
+	item = janus_config_get_item_drilldown(config, "nat", "ice_mux_port");
+	if(item && item->value) {
+		int mux_port = atoi(item->value);
+		if(mux_port < 0 || mux_port > 65535) {
+			JANUS_LOG(LOG_WARN, "Ignoring ice_mux_port value as it's not a valid port\n");
+		} else if(mux_port > 0) {
+			int mux_sockets = 1;
+			item = janus_config_get_item_drilldown(config, "nat", "ice_mux_sockets");
+			if(item && item->value)
+				mux_sockets = atoi(item->value);
+			if(janus_ice_set_mux_port(mux_port, mux_sockets) < 0 && janus_ice_is_ice_lite_enabled()) {
+				JANUS_LOG(LOG_FATAL, "Couldn't mux ICE on port %d\n", mux_port);
+				exit(1);
+			}
+		}
+	}
 	if(janus_ice_set_stun_server(stun_server, stun_port) < 0) {
 		JANUS_LOG(LOG_FATAL, "Invalid STUN address %s:%u\n", stun_server, stun_port);
 		exit(1);
@@ -3868,11 +4540,62 @@ gint main(int argc, char *argv[])
 			janus_set_no_media_timer(nmt);
 		}
 	}
+	/* Should we limit the outgoing queue of handles? */
+	item = janus_config_get_item_drilldown(config, "media", "max_queued_packets");
+	if(item && item->value) {
+		int mqp = atoi(item->value);
+		if(mqp < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring max_queued_packets value as it's not a positive integer\n");
+		} else {
+			janus_set_max_queued_packets(mqp);
+		}
+	}
+	item = janus_config_get_item_drilldown(config, "media", "max_queued_age");
+	if(item && item->value) {
+		int mqa = atoi(item->value);
+		if(mqa < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring max_queued_age value as it's not a positive integer\n");
+		} else {
+			janus_set_max_queued_age(mqa);
+		}
+	}
+	/* Should the ICE loop take care of outgoing traffic too? */
+	item = janus_config_get_item_drilldown(config, "media", "loop_send");
+	if(item && item->value) {
+		janus_ice_set_loop_send_enabled(janus_is_true(item->value));
+	}
+	/* If so, should packets be passed to libnice in batches? */
+	item = janus_config_get_item_drilldown(config, "media", "batch_send");
+	if(item && item->value) {
+		if(!janus_ice_is_loop_send_enabled())
+			JANUS_LOG(LOG_WARN, "Ignoring batch_send as loop_send is disabled\n");
+		else
+			janus_ice_set_batch_send_enabled(janus_is_true(item->value));
+	}
+	/* Should outgoing video be paced? */
+	item = janus_config_get_item_drilldown(config, "media", "pacing");
+	if(item && item->value) {
+		janus_ice_set_pacing_enabled(janus_is_true(item->value));
+	}
+	item = janus_config_get_item_drilldown(config, "media", "pacing_max_delay");
+	if(item && item->value) {
+		int pmd = atoi(item->value);
+		if(pmd < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring pacing_max_delay value as it's not a positive integer\n");
+		} else {
+			janus_ice_set_pacing_max_delay(pmd);
+		}
+	}
 	/* RFC4588 support */
 	item = janus_config_get_item_drilldown(config, "media", "rfc_4588");
 	if(item && item->value) {
 		janus_set_rfc4588_enabled(janus_is_true(item->value));
 	}
+	/* Should we track the latency of the media path? */
+	item = janus_config_get_item_drilldown(config, "media", "latency_histograms");
+	janus_latency_init(item && item->value && janus_is_true(item->value));
+	/* Plugins get their RTP/RTCP ports from a shared allocator */
+	janus_ports_init();
 
 	/* Setup OpenSSL stuff */
 	const char *server_pem;
@@ -3897,22 +4620,56 @@ gint main(int argc, char *argv[])
 		password = item->value;
 	}
 	JANUS_LOG(LOG_VERB, "Using certificates:\n\t%s\n\t%s\n", server_pem, server_key);
+	/* Autogenerated certificates use ECDSA keys, unless RSA is explicitly asked for */
+	gboolean rsa_private_key = FALSE;
+	item = janus_config_get_item_drilldown(config, "certificates", "rsa_private_key");
+	if(item && item->value)
+		rsa_private_key = janus_is_true(item->value);
 
 	SSL_library_init();
 	SSL_load_error_strings();
 	OpenSSL_add_all_algorithms();
 	/* ... and DTLS-SRTP in particular */
-	if(janus_dtls_srtp_init(server_pem, server_key, password) < 0) {
+	item = janus_config_get_item_drilldown(config, "media", "srtp_profiles");
+	if(janus_dtls_srtp_init(server_pem, server_key, password, (item && item->value) ? item->value : NULL, rsa_private_key) < 0) {
 		exit(1);
 	}
 	/* Check if there's any custom value for the starting MTU to use in the BIO filter */
 	item = janus_config_get_item_drilldown(config, "media", "dtls_mtu");
 	if(item && item->value)
 		janus_dtls_bio_filter_set_mtu(atoi(item->value));
+	/* Check if handshakes should be processed by a pool of crypto workers */
+	item = janus_config_get_item_drilldown(config, "media", "dtls_workers");
+	if(item && item->value) {
+		int workers = atoi(item->value);
+		if(workers < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring dtls_workers, invalid value\n");
+		} else if(janus_dtls_set_workers(workers) < 0) {
+			JANUS_LOG(LOG_WARN, "Error creating the DTLS crypto workers, handshakes will be processed inline\n");
+		}
+	}
 
 #ifdef HAVE_SCTP
 	/* Initialize SCTP for DataChannels */
-	if(janus_sctp_init() < 0) {
+	int sctp_workers = 0;
+	item = janus_config_get_item_drilldown(config, "media", "sctp_workers");
+	if(item && item->value) {
+		sctp_workers = atoi(item->value);
+		if(sctp_workers < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring sctp_workers, invalid value\n");
+			sctp_workers = 0;
+		}
+	}
+	gint64 sctp_coalesce = 0;
+	item = janus_config_get_item_drilldown(config, "media", "sctp_coalesce_time");
+	if(item && item->value) {
+		sctp_coalesce = atoll(item->value);
+		if(sctp_coalesce < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring sctp_coalesce_time, invalid value\n");
+			sctp_coalesce = 0;
+		}
+	}
+	if(janus_sctp_init(sctp_workers, sctp_coalesce) < 0) {
 		exit(1);
 	}
 #else
@@ -3921,10 +4678,17 @@ gint main(int argc, char *argv[])
 
 	/* Sessions */
 	// GHashTable
-	sessions = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
-	old_sessions = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
+	int s = 0;
+	for(s=0; s<JANUS_SESSIONS_SHARDS; s++) {
+		sessions_shards[s].sessions = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
+		sessions_shards[s].old_sessions = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
+		janus_mutex_init(&sessions_shards[s].mutex);
+		int w = 0;
+		for(w=0; w<JANUS_SESSIONS_WHEEL_SLOTS; w++)
+			g_queue_init(&sessions_shards[s].wheel[w]);
+		sessions_shards[s].wheel_tick = janus_get_monotonic_time()/G_USEC_PER_SEC;
+	}
 
-	janus_mutex_init(&sessions_mutex);
 	/* Start the sessions watchdog 类似定时器定期检查会话*/
 	sessions_watchdog_context = g_main_context_new();
 	GMainLoop *watchdog_loop = g_main_loop_new(sessions_watchdog_context, FALSE);
@@ -3936,13 +4700,23 @@ gint main(int argc, char *argv[])
 	}
  
 	// 启动分发传入请求的线程
-	requests = g_async_queue_new_full((GDestroyNotify) janus_request_destroy);
-	// 线程主要处理请求队列(处理函数 janus_transport_requests)
-	GThread *requests_thread = g_thread_try_new("sessions requests", &janus_transport_requests, NULL, &error);
-	if(error != NULL) {
-		JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to start requests thread...\n", error->code, error->message ? error->message : "??");
-		exit(1);
+	request_workers = g_malloc0(request_workers_num * sizeof(janus_request_worker));
+	guint rw = 0;
+	for(rw=0; rw<request_workers_num; rw++) {
+		janus_request_worker *worker = &request_workers[rw];
+		worker->index = rw;
+		worker->requests = g_async_queue_new_full((GDestroyNotify) janus_request_destroy);
+		// 线程主要处理请求队列(处理函数 janus_transport_requests)
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "requests %u", rw);
+		worker->thread = g_thread_try_new(tname, &janus_transport_requests, worker, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to start requests thread...\n", error->code, error->message ? error->message : "??");
+			exit(1);
+		}
 	}
+	if(request_workers_num > 1)
+		JANUS_LOG(LOG_INFO, "Started %u request workers\n", request_workers_num);
 	/* Create a thread pool to handle asynchronous requests, no matter what the transport */
 	// 线程池主要处理任务队列
 	error = NULL;
@@ -4205,11 +4979,11 @@ gint main(int argc, char *argv[])
 			JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_plugin->get_package(), janus_plugin->get_name());
 			JANUS_LOG(LOG_VERB, "\t   %s\n", janus_plugin->get_description());
 			JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_plugin->get_api_compatibility());
-			if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && !janus_plugin->incoming_data) {
+			if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtp_shared && !janus_plugin->incoming_rtcp && !janus_plugin->incoming_data && !janus_plugin->incoming_binary_data) {
 				JANUS_LOG(LOG_WARN, "The '%s' plugin doesn't implement any callback for RTP/RTCP/data... is this on purpose?\n",
 					janus_plugin->get_package());
 			}
-			if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && janus_plugin->incoming_data) {
+			if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtp_shared && !janus_plugin->incoming_rtcp && janus_plugin->incoming_data) {
 				JANUS_LOG(LOG_WARN, "The '%s' plugin will only handle data channels (no RTP/RTCP)... is this on purpose?\n",
 					janus_plugin->get_package());
 			}
@@ -4408,15 +5182,25 @@ gint main(int argc, char *argv[])
 	}
 	/* Get rid of requests tasks and thread too */
 	g_thread_pool_free(tasks, FALSE, FALSE);
-	JANUS_LOG(LOG_INFO, "Ending requests thread...\n");
-	g_async_queue_push(requests, &exit_message);
-	g_thread_join(requests_thread);
-	requests_thread = NULL;
-	g_async_queue_unref(requests);
+	JANUS_LOG(LOG_INFO, "Ending requests threads...\n");
+	for(rw=0; rw<request_workers_num; rw++)
+		g_async_queue_push(request_workers[rw].requests, &exit_message);
+	for(rw=0; rw<request_workers_num; rw++) {
+		g_thread_join(request_workers[rw].thread);
+		request_workers[rw].thread = NULL;
+		g_async_queue_unref(request_workers[rw].requests);
+	}
+	g_free(request_workers);
+	request_workers = NULL;
 
 	JANUS_LOG(LOG_INFO, "Destroying sessions...\n");
-	g_clear_pointer(&sessions, g_hash_table_destroy);
-	g_clear_pointer(&old_sessions, g_hash_table_destroy);
+	for(s=0; s<JANUS_SESSIONS_SHARDS; s++) {
+		g_clear_pointer(&sessions_shards[s].sessions, g_hash_table_destroy);
+		g_clear_pointer(&sessions_shards[s].old_sessions, g_hash_table_destroy);
+		int w = 0;
+		for(w=0; w<JANUS_SESSIONS_WHEEL_SLOTS; w++)
+			g_queue_clear(&sessions_shards[s].wheel[w]);
+	}
 	JANUS_LOG(LOG_INFO, "Freeing crypto resources...\n");
 	janus_dtls_srtp_cleanup();
 	EVP_cleanup();
@@ -4449,6 +5233,10 @@ gint main(int argc, char *argv[])
 		g_hash_table_destroy(eventhandlers_so);
 	}
 
+	janus_timer_deinit();
+	janus_latency_deinit();
+	janus_ports_deinit();
+	janus_affinity_deinit();
 	janus_recorder_deinit();
 	g_free(local_ip);
 
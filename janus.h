@@ -57,6 +57,10 @@ typedef struct janus_session {
 	volatile gint destroy;
 	/*! \brief Flag to notify there's been a session timeout */
 	volatile gint timeout;
+	/*! \brief Link to this session in the sessions timer wheel, if scheduled */
+	GList *timeout_link;
+	/*! \brief Slot of the sessions timer wheel this session is in */
+	guint timeout_slot;
 	/*! \brief Mutex to lock/unlock this session */
 	janus_mutex mutex;
 } janus_session;
@@ -77,6 +81,12 @@ janus_session *janus_session_find(guint64 session_id);
  * @param[in] session The Janus Gateway-Client session instance to notify
  * @param[in] event The event to notify as a Jansson JSON object */
 void janus_session_notify_event(janus_session *session, json_t *event);
+/*! \brief Method to notify a shared event, serialized once, originated by a handle of this session
+ * @param[in] session The Janus Gateway-Client session instance to notify
+ * @param[in] handle_id The handle the event comes from
+ * @param[in] transaction The transaction the event refers to, if any
+ * @param[in] event The shared event to notify */
+void janus_session_notify_shared_event(janus_session *session, guint64 handle_id, const char *transaction, janus_plugin_event *event);
 /*! \brief Method to find an existing Janus Gateway-Client session scheduled to be destroyed from its ID
  * @param[in] session_id The Janus Gateway-Client session ID
  * @returns The created Janus Gateway-Client session if successful, NULL otherwise */
@@ -110,6 +120,8 @@ struct janus_request {
 	gboolean admin;
 	/*! \brief 消息内容 */
 	json_t *message;
+	/*! \brief If not NULL, the array responses are collected in rather than sent (batch requests) */
+	json_t *responses;
 };
 /*! \brief Helper to allocate a janus_request instance
  * @param[in] transport Pointer to the transport
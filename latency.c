@@ -0,0 +1,203 @@
+/*! \file    latency.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Media path latency histograms
+ * \details  Implementation of optional histograms tracking how long RTP
+ * packets spend in the different stages of the media path, aggregated
+ * per plugin. Histograms are log-linear: the first 8 buckets map values
+ * 0-7 directly, while after that each power of two gets 8 buckets of its
+ * own. Buckets are updated atomically, so media threads never contend on
+ * a lock, and percentiles are only computed when the summary is requested.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include "latency.h"
+#include "debug.h"
+#include "mutex.h"
+
+/* Sub-buckets for each power of two (as bits) */
+#define JANUS_LATENCY_SUB_BITS		3
+#define JANUS_LATENCY_SUB_BUCKETS	(1 << JANUS_LATENCY_SUB_BITS)
+/* Largest value we track (~35 minutes), anything above that is capped */
+#define JANUS_LATENCY_MAX_BITS		31
+#define JANUS_LATENCY_BUCKETS		((JANUS_LATENCY_MAX_BITS - JANUS_LATENCY_SUB_BITS + 2) * JANUS_LATENCY_SUB_BUCKETS)
+
+typedef struct janus_latency_histogram {
+	volatile guint buckets[JANUS_LATENCY_BUCKETS];
+	volatile guint64 sum;
+	volatile guint64 max;
+} janus_latency_histogram;
+
+struct janus_latency_stats {
+	char *package;
+	janus_latency_histogram stages[JANUS_LATENCY_STAGES];
+};
+
+static const char *janus_latency_stage_names[JANUS_LATENCY_STAGES] = {
+	"recv_plugin", "plugin_queue", "queue_wire"
+};
+
+static volatile gint enabled = 0;
+/* Histograms per plugin package: entries are never removed until deinit */
+static GHashTable *stats = NULL;
+static janus_mutex stats_mutex = JANUS_MUTEX_INITIALIZER;
+/* When the current thread passed a packet to a plugin */
+static GPrivate mark_key = G_PRIVATE_INIT(g_free);
+
+
+static void janus_latency_stats_free(janus_latency_stats *s) {
+	if(s == NULL)
+		return;
+	g_free(s->package);
+	g_free(s);
+}
+
+void janus_latency_init(gboolean enable) {
+	janus_mutex_lock(&stats_mutex);
+	if(stats == NULL)
+		stats = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)janus_latency_stats_free);
+	janus_mutex_unlock(&stats_mutex);
+	janus_latency_set_enabled(enable);
+}
+
+void janus_latency_deinit(void) {
+	g_atomic_int_set(&enabled, 0);
+	janus_mutex_lock(&stats_mutex);
+	if(stats != NULL)
+		g_hash_table_destroy(stats);
+	stats = NULL;
+	janus_mutex_unlock(&stats_mutex);
+}
+
+void janus_latency_set_enabled(gboolean enable) {
+	g_atomic_int_set(&enabled, enable ? 1 : 0);
+	JANUS_LOG(LOG_INFO, "Media path latency histograms %s\n", enable ? "enabled" : "disabled");
+}
+
+gboolean janus_latency_is_enabled(void) {
+	return g_atomic_int_get(&enabled);
+}
+
+janus_latency_stats *janus_latency_stats_get(const char *package) {
+	if(package == NULL)
+		return NULL;
+	janus_mutex_lock(&stats_mutex);
+	if(stats == NULL) {
+		janus_mutex_unlock(&stats_mutex);
+		return NULL;
+	}
+	janus_latency_stats *s = g_hash_table_lookup(stats, package);
+	if(s == NULL) {
+		s = g_malloc0(sizeof(janus_latency_stats));
+		s->package = g_strdup(package);
+		g_hash_table_insert(stats, s->package, s);
+	}
+	janus_mutex_unlock(&stats_mutex);
+	return s;
+}
+
+/* Map a value to its bucket, and a bucket to the highest value it contains */
+static int janus_latency_bucket(guint64 value) {
+	if(value < JANUS_LATENCY_SUB_BUCKETS)
+		return (int)value;
+	if(value >= ((guint64)1 << (JANUS_LATENCY_MAX_BITS+1)))
+		return JANUS_LATENCY_BUCKETS-1;
+	int msb = 63 - __builtin_clzll(value);
+	int sub = (value >> (msb - JANUS_LATENCY_SUB_BITS)) & (JANUS_LATENCY_SUB_BUCKETS-1);
+	return (msb - JANUS_LATENCY_SUB_BITS + 1) * JANUS_LATENCY_SUB_BUCKETS + sub;
+}
+
+static guint64 janus_latency_bucket_value(int bucket) {
+	if(bucket < JANUS_LATENCY_SUB_BUCKETS)
+		return bucket;
+	int msb = bucket / JANUS_LATENCY_SUB_BUCKETS + JANUS_LATENCY_SUB_BITS - 1;
+	int sub = bucket % JANUS_LATENCY_SUB_BUCKETS;
+	return (((guint64)(JANUS_LATENCY_SUB_BUCKETS + sub + 1)) << (msb - JANUS_LATENCY_SUB_BITS)) - 1;
+}
+
+void janus_latency_record(janus_latency_stats *s, janus_latency_stage stage, gint64 usec) {
+	if(s == NULL || stage >= JANUS_LATENCY_STAGES || !g_atomic_int_get(&enabled))
+		return;
+	if(usec < 0)
+		usec = 0;
+	janus_latency_histogram *h = &s->stages[stage];
+	g_atomic_int_inc(&h->buckets[janus_latency_bucket(usec)]);
+	__sync_fetch_and_add(&h->sum, (guint64)usec);
+	guint64 max = h->max;
+	while((guint64)usec > max) {
+		if(__sync_bool_compare_and_swap(&h->max, max, (guint64)usec))
+			break;
+		max = h->max;
+	}
+}
+
+void janus_latency_mark(gint64 when) {
+	gint64 *mark = g_private_get(&mark_key);
+	if(mark == NULL) {
+		if(when == 0)
+			return;
+		mark = g_malloc(sizeof(gint64));
+		g_private_set(&mark_key, mark);
+	}
+	*mark = when;
+}
+
+gint64 janus_latency_get_mark(void) {
+	gint64 *mark = g_private_get(&mark_key);
+	return mark ? *mark : 0;
+}
+
+static json_t *janus_latency_histogram_summary(janus_latency_histogram *h, gboolean reset) {
+	/* Take a snapshot first, as the histogram may be updated while we read it */
+	guint buckets[JANUS_LATENCY_BUCKETS];
+	guint64 count = 0;
+	int i = 0;
+	for(i=0; i<JANUS_LATENCY_BUCKETS; i++) {
+		buckets[i] = reset ? (guint)g_atomic_int_and(&h->buckets[i], 0) : (guint)g_atomic_int_get(&h->buckets[i]);
+		count += buckets[i];
+	}
+	guint64 sum = reset ? __sync_fetch_and_and(&h->sum, 0) : __sync_fetch_and_add(&h->sum, 0);
+	guint64 max = reset ? __sync_fetch_and_and(&h->max, 0) : __sync_fetch_and_add(&h->max, 0);
+	json_t *summary = json_object();
+	json_object_set_new(summary, "count", json_integer(count));
+	if(count == 0)
+		return summary;
+	json_object_set_new(summary, "mean", json_integer(sum/count));
+	/* Percentiles, as the highest value of the bucket they fall in */
+	const char *names[] = { "p50", "p90", "p99", "p999" };
+	const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	guint64 seen = 0;
+	int q = 0;
+	for(i=0; i<JANUS_LATENCY_BUCKETS && q<4; i++) {
+		seen += buckets[i];
+		while(q < 4 && seen >= (guint64)(quantiles[q]*count + 0.5) && seen > 0) {
+			guint64 value = janus_latency_bucket_value(i);
+			json_object_set_new(summary, names[q], json_integer(value < max ? value : max));
+			q++;
+		}
+	}
+	json_object_set_new(summary, "max", json_integer(max));
+	return summary;
+}
+
+json_t *janus_latency_summary(gboolean reset) {
+	json_t *summary = json_object();
+	janus_mutex_lock(&stats_mutex);
+	if(stats != NULL) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, stats);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_latency_stats *s = (janus_latency_stats *)value;
+			json_t *plugin = json_object();
+			int i = 0;
+			for(i=0; i<JANUS_LATENCY_STAGES; i++)
+				json_object_set_new(plugin, janus_latency_stage_names[i], janus_latency_histogram_summary(&s->stages[i], reset));
+			json_object_set_new(summary, s->package, plugin);
+		}
+	}
+	janus_mutex_unlock(&stats_mutex);
+	return summary;
+}
@@ -0,0 +1,79 @@
+/*! \file    latency.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Media path latency histograms (headers)
+ * \details  Implementation of optional histograms tracking how long RTP
+ * packets spend in the different stages of the media path, aggregated
+ * per plugin: from the moment the ICE loop receives a packet to when it's
+ * passed to the plugin (decryption, RTCP handling, etc.), from the plugin
+ * receiving it to when it relays the packet to a handle (the plugin logic
+ * itself), and from the packet being queued to it actually being sent on
+ * the wire (the outgoing queue and encryption). Histograms are HDR-style,
+ * i.e., log-linear, with a constant relative precision: each power of two
+ * is split in 8 sub-buckets, which means values are accurate to ~12% no
+ * matter how large they are, while updating a histogram only takes a
+ * couple of atomic operations and no lock.
+ * \note The plugin stage can only be measured when the plugin relays the
+ * packet from within its incoming_rtp callback (e.g., VideoRoom or EchoTest):
+ * packets relayed by other threads (e.g., mixers) don't contribute to it.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_LATENCY_H
+#define _JANUS_LATENCY_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief Stages of the media path we track */
+typedef enum janus_latency_stage {
+	/*! \brief From receiving a packet in the ICE loop, to passing it to the plugin */
+	JANUS_LATENCY_RECV_PLUGIN = 0,
+	/*! \brief From the plugin receiving a packet, to it relaying it to a handle */
+	JANUS_LATENCY_PLUGIN_QUEUE,
+	/*! \brief From a packet being queued, to it being sent on the wire */
+	JANUS_LATENCY_QUEUE_WIRE,
+	JANUS_LATENCY_STAGES
+} janus_latency_stage;
+
+/*! \brief Per-plugin latency histograms, opaque */
+typedef struct janus_latency_stats janus_latency_stats;
+
+/*! \brief Initialize the latency histograms
+ * @param[in] enabled Whether latencies should be tracked right away */
+void janus_latency_init(gboolean enabled);
+/*! \brief De-initialize the latency histograms */
+void janus_latency_deinit(void);
+/*! \brief Enable or disable tracking latencies on the fly
+ * @param[in] enabled Whether latencies should be tracked */
+void janus_latency_set_enabled(gboolean enabled);
+/*! \brief Check whether latencies are currently tracked
+ * @returns TRUE if so, FALSE otherwise */
+gboolean janus_latency_is_enabled(void);
+
+/*! \brief Get the histograms for a plugin, creating them if needed
+ * \note The returned pointer is valid until janus_latency_deinit is called
+ * @param[in] package The package name of the plugin
+ * @returns A pointer to the histograms for the plugin */
+janus_latency_stats *janus_latency_stats_get(const char *package);
+/*! \brief Add a sample to one of the histograms of a plugin
+ * @param[in] stats The plugin histograms
+ * @param[in] stage The stage the sample refers to
+ * @param[in] usec The latency to add, in microseconds */
+void janus_latency_record(janus_latency_stats *stats, janus_latency_stage stage, gint64 usec);
+
+/*! \brief Keep track of when the current thread passed a packet to a plugin, or 0 when done
+ * @param[in] when The monotonic time the packet was passed to the plugin */
+void janus_latency_mark(gint64 when);
+/*! \brief Get the time the current thread passed a packet to a plugin, if it did
+ * @returns The monotonic time the packet was passed to the plugin, or 0 if there's none */
+gint64 janus_latency_get_mark(void);
+
+/*! \brief Get a summary of all the histograms (count, mean, percentiles and max per stage and plugin)
+ * @param[in] reset Whether the histograms should be reset after being read
+ * @returns A JSON object with the summary */
+json_t *janus_latency_summary(gboolean reset);
+
+#endif
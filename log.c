@@ -3,9 +3,17 @@
  * \copyright GNU General Public License v3
  * \brief     Buffered logging
  * \details   Implementation of a simple buffered logger designed to remove
- * I/O wait from threads that may be sensitive to such delays. Buffers are
- * saved and reused to reduce allocation calls. The logger output can then
- * be printed to stdout and/or a log file.
+ * I/O wait from threads that may be sensitive to such delays. Each thread
+ * that logs something gets its own ring buffer, that only that thread
+ * writes to and only the logger thread reads from: this means there's no
+ * lock to contend on when logging, and no allocation either. If a ring
+ * is full because the logger thread is falling behind, lines are dropped
+ * and counted, rather than blocking the thread that wanted to log them.
+ * The logger output can then be printed to stdout and/or a log file:
+ * lines logged before the logger is initialized are kept in the rings
+ * too, and printed to the configured outputs once it starts.
+ * \note Since rings are drained one after the other, lines logged by
+ * different threads at about the same time may be printed out of order.
  *
  * \ingroup core
  * \ref core
@@ -19,15 +27,27 @@
 
 #define THREAD_NAME "log"
 
-typedef struct janus_log_buffer janus_log_buffer;
-struct janus_log_buffer {
-	size_t allocated;
-	janus_log_buffer *next;
-	/* str is grown by allocating beyond the struct */
-	char str[1];
-};
+/* Size of each per-thread ring (must be a power of 2) */
+#define JANUS_LOG_RING_SIZE		32768
+/* Lines longer than this are truncated */
+#define JANUS_LOG_MAX_LINE		(JANUS_LOG_RING_SIZE/4)
+/* Size of the stack buffer lines are formatted in, before going to the ring */
+#define INITIAL_BUFSZ			2000
+/* Marker telling the reader there's nothing else until the end of the ring */
+#define JANUS_LOG_RING_WRAP		0xFFFFFFFF
+/* How long the logger thread sleeps, at most, before checking the rings again */
+#define JANUS_LOG_FLUSH_INTERVAL	(100*G_TIME_SPAN_MILLISECOND)
 
-#define INITIAL_BUFSZ		2000
+/* Single-producer/single-consumer ring: entries are a length header,
+ * followed by the string itself padded to 4 bytes, and head and tail
+ * are free running counters that are only masked when accessing data */
+typedef struct janus_log_ring {
+	volatile guint head;	/* Updated by the logger thread only */
+	volatile guint tail;	/* Updated by the owner thread only */
+	volatile guint dropped;	/* Lines dropped since the logger thread last checked */
+	volatile gint orphaned;	/* Whether the owner thread is gone */
+	char data[JANUS_LOG_RING_SIZE];
+} janus_log_ring;
 
 static gboolean janus_log_console = TRUE;
 static char *janus_log_filepath = NULL;
@@ -35,16 +55,16 @@ static FILE *janus_log_file = NULL;
 
 static gint initialized = 0;
 static gint stopping = 0;
-static gint poolsz = 0;
-static gint maxpoolsz = 32;
-/* Buffers over this size will be freed */
-static size_t maxbuffersz = 8000;
+static gint pending = 0;
+static guint64 dropped = 0;
 static GMutex lock;
 static GCond cond;
 static GThread *printthread = NULL;
-static janus_log_buffer *printhead = NULL;
-static janus_log_buffer *printtail = NULL;
-static janus_log_buffer *bufferpool = NULL;
+/* All the rings, protected by the lock: only touched when threads log for the first time */
+static GSList *rings = NULL;
+
+static void janus_log_ring_release(gpointer data);
+static GPrivate ring_key = G_PRIVATE_INIT(janus_log_ring_release);
 
 
 gboolean janus_log_is_stdout_enabled(void) {
@@ -59,93 +79,147 @@ char *janus_log_get_logfile_path(void) {
 	return janus_log_filepath;
 }
 
+guint64 janus_log_get_dropped(void) {
+	g_mutex_lock(&lock);
+	guint64 total = dropped;
+	g_mutex_unlock(&lock);
+	return total;
+}
 
-static void janus_log_freebuffers(janus_log_buffer **list) {
-	janus_log_buffer *b, *head = *list;
 
-	while (head) {
-		b = head;
-		head = b->next;
-		g_free(b);
+/* Invoked when a thread exits: the logger thread will free the ring once drained */
+static void janus_log_ring_release(gpointer data) {
+	janus_log_ring *ring = (janus_log_ring *)data;
+	if(ring != NULL)
+		g_atomic_int_set(&ring->orphaned, 1);
+}
+
+static janus_log_ring *janus_log_getring(void) {
+	janus_log_ring *ring = g_private_get(&ring_key);
+	if(ring == NULL) {
+		ring = g_malloc0(sizeof(janus_log_ring));
+		g_mutex_lock(&lock);
+		rings = g_slist_prepend(rings, ring);
+		g_mutex_unlock(&lock);
+		g_private_set(&ring_key, ring);
 	}
-	*list = NULL;
+	return ring;
+}
+
+static void janus_log_print(const char *str) {
+	if(janus_log_console)
+		fputs(str, stdout);
+	if(janus_log_file)
+		fputs(str, janus_log_file);
 }
 
-static janus_log_buffer *janus_log_getbuf(void) {
-	janus_log_buffer *b;
+/* Add a line to the ring of this thread: returns FALSE if there's no room for it */
+static gboolean janus_log_ring_write(janus_log_ring *ring, const char *str, guint len) {
+	guint size = 4 + ((len + 1 + 3) & ~3);
+	guint head = g_atomic_int_get(&ring->head);
+	guint tail = ring->tail;
+	guint offset = tail & (JANUS_LOG_RING_SIZE-1);
+	guint skip = 0;
+	if(offset + size > JANUS_LOG_RING_SIZE) {
+		/* Not enough contiguous room until the end, we'll have to wrap */
+		skip = JANUS_LOG_RING_SIZE - offset;
+	}
+	if(JANUS_LOG_RING_SIZE - (tail - head) < skip + size)
+		return FALSE;
+	if(skip > 0) {
+		*(guint32 *)(ring->data + offset) = JANUS_LOG_RING_WRAP;
+		tail += skip;
+		offset = 0;
+	}
+	*(guint32 *)(ring->data + offset) = len;
+	memcpy(ring->data + offset + 4, str, len);
+	ring->data[offset + 4 + len] = '\0';
+	/* Publish the entry only after it's been written */
+	g_atomic_int_set(&ring->tail, tail + size);
+	return TRUE;
+}
 
+/* Print all the lines in a ring: returns how many were dropped in the meanwhile */
+static guint janus_log_ring_drain(janus_log_ring *ring) {
+	guint head = ring->head;
+	guint tail = g_atomic_int_get(&ring->tail);
+	while(head != tail) {
+		guint offset = head & (JANUS_LOG_RING_SIZE-1);
+		guint32 len = *(guint32 *)(ring->data + offset);
+		if(len == JANUS_LOG_RING_WRAP) {
+			head += JANUS_LOG_RING_SIZE - offset;
+			continue;
+		}
+		janus_log_print(ring->data + offset + 4);
+		head += 4 + ((len + 1 + 3) & ~3);
+	}
+	/* Give the room back to the owner */
+	g_atomic_int_set(&ring->head, head);
+	guint lost = g_atomic_int_get(&ring->dropped);
+	if(lost > 0)
+		g_atomic_int_add(&ring->dropped, -(gint)lost);
+	return lost;
+}
+
+/* Drain all the rings, freeing those whose thread is gone */
+static gboolean janus_log_drain(void) {
+	gboolean printed = FALSE;
+	guint lost = 0;
+	/* Only the logger thread removes rings from the list, so we can print
+	 * without holding the lock: threads logging for the first time would
+	 * otherwise have to wait for our writes on stdout or the log file */
 	g_mutex_lock(&lock);
-	b = bufferpool;
-	if (b) {
-		bufferpool = b->next;
-		b->next = NULL;
-	} else {
-		poolsz++;
+	GSList *list = g_slist_copy(rings), *l = NULL, *gone = NULL;
+	g_mutex_unlock(&lock);
+	for(l = list; l; l = l->next) {
+		janus_log_ring *ring = (janus_log_ring *)l->data;
+		/* Check this before draining, or we may miss lines written right before exiting */
+		gboolean orphaned = g_atomic_int_get(&ring->orphaned);
+		if(ring->head != g_atomic_int_get(&ring->tail))
+			printed = TRUE;
+		lost += janus_log_ring_drain(ring);
+		if(orphaned)
+			gone = g_slist_prepend(gone, ring);
 	}
+	g_slist_free(list);
+	g_mutex_lock(&lock);
+	for(l = gone; l; l = l->next)
+		rings = g_slist_remove(rings, l->data);
+	dropped += lost;
 	g_mutex_unlock(&lock);
-	if (b == NULL) {
-		b = g_malloc(INITIAL_BUFSZ + sizeof(*b));
-		b->allocated = INITIAL_BUFSZ;
-		b->next = NULL;
+	g_slist_free_full(gone, g_free);
+	if(lost > 0) {
+		char note[64];
+		g_snprintf(note, sizeof(note), "[log] %u lines dropped, logger falling behind\n", lost);
+		janus_log_print(note);
+		printed = TRUE;
 	}
-	return b;
+	return printed;
 }
 
 static void *janus_log_thread(void *ctx) {
-	janus_log_buffer *head, *b, *tofree = NULL;
-
-	while (!g_atomic_int_get(&stopping)) {
+	while(!g_atomic_int_get(&stopping)) {
 		g_mutex_lock(&lock);
-		if (!printhead) {
-			g_cond_wait(&cond, &lock);
+		if(!g_atomic_int_get(&pending)) {
+			gint64 end = g_get_monotonic_time() + JANUS_LOG_FLUSH_INTERVAL;
+			g_cond_wait_until(&cond, &lock, end);
 		}
-		head = printhead;
-		printhead = printtail = NULL;
+		g_atomic_int_set(&pending, 0);
 		g_mutex_unlock(&lock);
 
-		if (head) {
-			for (b = head; b; b = b->next) {
-				if(janus_log_console)
-					fputs(b->str, stdout);
-				if(janus_log_file)
-					fputs(b->str, janus_log_file);
-			}
-			g_mutex_lock(&lock);
-			while (head) {
-				b = head;
-				head = b->next;
-				if (poolsz >= maxpoolsz || b->allocated > maxbuffersz) {
-					b->next = tofree;
-					tofree = b;
-					poolsz--;
-				} else {
-					b->next = bufferpool;
-					bufferpool = b;
-				}
-			}
-			g_mutex_unlock(&lock);
+		if(janus_log_drain()) {
 			if(janus_log_console)
 				fflush(stdout);
 			if(janus_log_file)
 				fflush(janus_log_file);
-			janus_log_freebuffers(&tofree);
 		}
 	}
 	/* print any remaining messages, stdout flushed on exit */
-	for (b = printhead; b; b = b->next) {
-		if(janus_log_console)
-			fputs(b->str, stdout);
-		if(janus_log_file)
-			fputs(b->str, janus_log_file);
-	}
+	janus_log_drain();
 	if(janus_log_console)
 		fflush(stdout);
 	if(janus_log_file)
 		fflush(janus_log_file);
-	janus_log_freebuffers(&printhead);
-	janus_log_freebuffers(&bufferpool);
-	g_mutex_clear(&lock);
-	g_cond_clear(&cond);
 
 	if(janus_log_file)
 		fclose(janus_log_file);
@@ -159,39 +233,57 @@ static void *janus_log_thread(void *ctx) {
 void janus_vprintf(const char *format, ...) {
 	int len;
 	va_list ap, ap2;
-	janus_log_buffer *b = janus_log_getbuf();
+	char buffer[INITIAL_BUFSZ];
+	char *str = buffer;
 
 	va_start(ap, format);
 	va_copy(ap2, ap);
 	/* first try */
-	len = vsnprintf(b->str, b->allocated, format, ap);
+	len = vsnprintf(buffer, sizeof(buffer), format, ap);
 	va_end(ap);
-	if (len >= (int) b->allocated) {
-		/* buffer wasn't big enough */
-		b = g_realloc(b, len + 1 + sizeof(*b));
-		b->allocated = len + 1;
-		vsnprintf(b->str, b->allocated, format, ap2);
+	if(len < 0) {
+		va_end(ap2);
+		return;
+	}
+	if(len >= (int)sizeof(buffer)) {
+		/* buffer wasn't big enough: this is rare, and we'll truncate huge lines anyway */
+		if(len >= JANUS_LOG_MAX_LINE)
+			len = JANUS_LOG_MAX_LINE-1;
+		str = g_malloc(len + 1);
+		vsnprintf(str, len + 1, format, ap2);
+		if(len == JANUS_LOG_MAX_LINE-1)
+			str[len-1] = '\n';
 	}
 	va_end(ap2);
 
-	g_mutex_lock(&lock);
-	if (!printhead) {
-		printhead = printtail = b;
+	if(g_atomic_int_get(&stopping)) {
+		/* No logger thread to hand this to anymore, just print it */
+		fputs(str, stdout);
 	} else {
-		printtail->next = b;
-		printtail = b;
+		/* If the logger isn't initialized yet, the line waits in the ring
+		 * until the logger thread starts, and then goes to all the sinks */
+		janus_log_ring *ring = janus_log_getring();
+		if(!janus_log_ring_write(ring, str, len)) {
+			/* The logger thread is falling behind: drop the line rather than waiting */
+			g_atomic_int_inc(&ring->dropped);
+		} else if(g_atomic_int_get(&initialized) && !g_atomic_int_get(&pending) &&
+				g_atomic_int_compare_and_exchange(&pending, 0, 1)) {
+			/* Only the first writer wakes the logger thread up: the others don't touch the lock at all */
+			g_mutex_lock(&lock);
+			g_cond_signal(&cond);
+			g_mutex_unlock(&lock);
+		}
 	}
-	g_cond_signal(&cond);
-	g_mutex_unlock(&lock);
+	if(str != buffer)
+		g_free(str);
 }
 
 int janus_log_init(gboolean daemon, gboolean console, const char *logfile) {
 	if (g_atomic_int_get(&initialized)) {
 		return 0;
 	}
-	g_atomic_int_set(&initialized, 1);
-	g_mutex_init(&lock);
-	g_cond_init(&cond);
+	/* The lock and cond are static, and may have been used already by
+	 * lines logged before this: no need (and no way) to initialize them */
 	if(console) {
 		/* Set stdout to block buffering, see BUFSIZ in stdio.h */
 		setvbuf(stdout, NULL, _IOFBF, 0);
@@ -225,7 +317,10 @@ int janus_log_init(gboolean daemon, gboolean console, const char *logfile) {
 			return -1;
 		}
 	}
+	/* Have the logger thread print what was logged so far right away */
+	g_atomic_int_set(&pending, 1);
 	printthread = g_thread_new(THREAD_NAME, &janus_log_thread, NULL);
+	g_atomic_int_set(&initialized, 1);
 	return 0;
 }
 
@@ -236,4 +331,5 @@ void janus_log_destroy(void) {
 	g_cond_signal(&cond);
 	g_mutex_unlock(&lock);
 	g_thread_join(printthread);
+	/* Rings of threads that are still around can't be freed: their owners may still log */
 }
@@ -3,9 +3,11 @@
  * \copyright GNU General Public License v3
  * \brief    Buffered logging (headers)
  * \details  Implementation of a simple buffered logger designed to remove
- * I/O wait from threads that may be sensitive to such delays. Buffers are
- * saved and reused to reduce allocation calls. The logger output can then
- * be printed to stdout and/or a log file.
+ * I/O wait from threads that may be sensitive to such delays. Each thread
+ * logs to a ring buffer of its own, drained by the logger thread, so that
+ * logging never blocks: if the logger falls behind, lines are dropped and
+ * counted instead. The logger output can then be printed to stdout and/or
+ * a log file.
  *
  * \ingroup core
  * \ref core
@@ -19,7 +21,8 @@
 
 /*! \brief Buffered vprintf
 * @param[in] format Format string as defined by glib
-* \note This output is buffered and may not appear immediately on stdout. */
+* \note This output is buffered and may not appear immediately on stdout.
+* If the buffer of the calling thread is full, the line is dropped. */
 void janus_vprintf(const char *format, ...) G_GNUC_PRINTF(1, 2);
 
 /*! \brief 日志初始化
@@ -41,5 +44,8 @@ gboolean janus_log_is_logfile_enabled(void);
 /*! \brief Method to get the path to the log file
  * @returns The full path to the log file, or NULL otherwise */
 char *janus_log_get_logfile_path(void);
+/*! \brief Method to get how many lines were dropped because the logger was falling behind
+ * @returns The number of lines dropped so far */
+guint64 janus_log_get_dropped(void);
 
 #endif
@@ -0,0 +1,153 @@
+/*! \file    metrics.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Aggregated metrics
+ * \details  Implementation of a simple registry of counters and gauges
+ * that the core, plugins and transports can update on their hot paths,
+ * and that can be exported in the Prometheus text exposition format,
+ * e.g., by the HTTP transport. Counters are sharded: each thread updates
+ * its own cache line with an atomic operation, and shards are only summed
+ * when the metrics are read, which means there's no contention between
+ * media threads and no need to walk sessions and handles to get totals.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "mutex.h"
+
+/* Number of shards for each metric: threads are assigned one in a round robin fashion */
+#define JANUS_METRICS_SHARDS	16
+
+/* Each shard gets a cache line of its own, to avoid false sharing */
+typedef struct janus_metric_shard {
+	volatile gint64 value;
+	char padding[64-sizeof(gint64)];
+} janus_metric_shard;
+
+struct janus_metric {
+	char *name;
+	char *labels;
+	char *help;
+	janus_metric_type type;
+	janus_metric_callback callback;
+	gpointer user_data;
+	janus_metric_shard shards[JANUS_METRICS_SHARDS];
+};
+
+/* All the metrics, in the order they were added */
+static GList *metrics = NULL;
+static janus_mutex metrics_mutex = JANUS_MUTEX_INITIALIZER;
+
+/* Shard to use for the current thread (index+1, so that NULL means unassigned) */
+static GPrivate shard_key;
+static volatile gint shard_next = 0;
+
+static int janus_metrics_shard(void) {
+	int index = GPOINTER_TO_INT(g_private_get(&shard_key));
+	if(index == 0) {
+		index = ((guint)g_atomic_int_add(&shard_next, 1) % JANUS_METRICS_SHARDS) + 1;
+		g_private_set(&shard_key, GINT_TO_POINTER(index));
+	}
+	return index-1;
+}
+
+static janus_metric *janus_metrics_new(const char *name, const char *labels, const char *help,
+		janus_metric_type type, janus_metric_callback callback, gpointer user_data) {
+	if(name == NULL)
+		return NULL;
+	/* Sharded metrics are updated with 64-bit atomics, so they must be properly aligned */
+	janus_metric *metric = NULL;
+	if(posix_memalign((void **)&metric, 64, sizeof(janus_metric)) != 0)
+		return NULL;
+	memset(metric, 0, sizeof(janus_metric));
+	metric->name = g_strdup(name);
+	metric->labels = labels ? g_strdup(labels) : NULL;
+	metric->help = help ? g_strdup(help) : NULL;
+	metric->type = type;
+	metric->callback = callback;
+	metric->user_data = user_data;
+	janus_mutex_lock(&metrics_mutex);
+	metrics = g_list_append(metrics, metric);
+	janus_mutex_unlock(&metrics_mutex);
+	return metric;
+}
+
+janus_metric *janus_metrics_add(const char *name, const char *labels, const char *help, janus_metric_type type) {
+	return janus_metrics_new(name, labels, help, type, NULL, NULL);
+}
+
+janus_metric *janus_metrics_add_callback(const char *name, const char *labels, const char *help,
+		janus_metric_type type, janus_metric_callback callback, gpointer user_data) {
+	if(callback == NULL)
+		return NULL;
+	return janus_metrics_new(name, labels, help, type, callback, user_data);
+}
+
+void janus_metrics_remove(janus_metric *metric) {
+	if(metric == NULL)
+		return;
+	janus_mutex_lock(&metrics_mutex);
+	metrics = g_list_remove(metrics, metric);
+	janus_mutex_unlock(&metrics_mutex);
+	g_free(metric->name);
+	g_free(metric->labels);
+	g_free(metric->help);
+	free(metric);
+}
+
+void janus_metrics_add_value(janus_metric *metric, gint64 value) {
+	if(metric == NULL || metric->callback != NULL)
+		return;
+	__sync_fetch_and_add(&metric->shards[janus_metrics_shard()].value, value);
+}
+
+gint64 janus_metrics_get(janus_metric *metric) {
+	if(metric == NULL)
+		return 0;
+	if(metric->callback != NULL)
+		return metric->callback(metric->user_data);
+	gint64 total = 0;
+	int i = 0;
+	for(i=0; i<JANUS_METRICS_SHARDS; i++)
+		total += __sync_fetch_and_add(&metric->shards[i].value, 0);
+	return total;
+}
+
+char *janus_metrics_render(void) {
+	GString *output = g_string_sized_new(4096);
+	/* Metrics with the same name (but different labels) share the same HELP and TYPE lines */
+	GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+	janus_mutex_lock(&metrics_mutex);
+	GList *temp = metrics;
+	while(temp) {
+		janus_metric *metric = (janus_metric *)temp->data;
+		temp = temp->next;
+		if(g_hash_table_lookup(seen, metric->name) != NULL)
+			continue;
+		g_hash_table_insert(seen, metric->name, metric);
+		if(metric->help)
+			g_string_append_printf(output, "# HELP %s %s\n", metric->name, metric->help);
+		g_string_append_printf(output, "# TYPE %s %s\n", metric->name,
+			metric->type == JANUS_METRIC_COUNTER ? "counter" : "gauge");
+		GList *same = g_list_find(metrics, metric);
+		while(same) {
+			janus_metric *m = (janus_metric *)same->data;
+			same = same->next;
+			if(strcmp(m->name, metric->name))
+				continue;
+			if(m->labels)
+				g_string_append_printf(output, "%s{%s} %"SCNi64"\n", m->name, m->labels, janus_metrics_get(m));
+			else
+				g_string_append_printf(output, "%s %"SCNi64"\n", m->name, janus_metrics_get(m));
+		}
+	}
+	janus_mutex_unlock(&metrics_mutex);
+	g_hash_table_destroy(seen);
+	return g_string_free(output, FALSE);
+}
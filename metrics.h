@@ -0,0 +1,81 @@
+/*! \file    metrics.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Aggregated metrics (headers)
+ * \details  Implementation of a simple registry of counters and gauges
+ * that the core, plugins and transports can update on their hot paths,
+ * and that can be exported in the Prometheus text exposition format,
+ * e.g., by the HTTP transport. Counters are sharded: each thread updates
+ * its own cache line with an atomic operation, and shards are only summed
+ * when the metrics are read, which means there's no contention between
+ * media threads and no need to walk sessions and handles to get totals.
+ * Metrics whose value is cheap to compute when needed (e.g., the number
+ * of rooms in a plugin, or the depth of a queue) can be registered with
+ * a callback instead.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_METRICS_H
+#define _JANUS_METRICS_H
+
+#include <glib.h>
+
+/*! \brief Type of metric */
+typedef enum janus_metric_type {
+	/*! \brief Monotonically increasing counter */
+	JANUS_METRIC_COUNTER = 0,
+	/*! \brief Value that can go up and down */
+	JANUS_METRIC_GAUGE
+} janus_metric_type;
+
+/*! \brief Callback to get the current value of a metric
+ * @param[in] user_data The opaque pointer provided when adding the metric
+ * @returns The current value of the metric */
+typedef gint64 (*janus_metric_callback)(gpointer user_data);
+
+/*! \brief Metric, opaque */
+typedef struct janus_metric janus_metric;
+
+/*! \brief Add a new sharded metric
+ * @param[in] name Name of the metric (e.g., janus_packets_received_total)
+ * @param[in] labels Labels for this instance of the metric, if any (e.g., media="audio")
+ * @param[in] help Description of the metric
+ * @param[in] type Type of the metric
+ * @returns A pointer to the new metric */
+janus_metric *janus_metrics_add(const char *name, const char *labels, const char *help, janus_metric_type type);
+/*! \brief Add a new metric whose value is returned by a callback when needed
+ * \note The callback is invoked by whatever thread is reading the metrics,
+ * and so must be thread safe and quick
+ * @param[in] name Name of the metric
+ * @param[in] labels Labels for this instance of the metric, if any
+ * @param[in] help Description of the metric
+ * @param[in] type Type of the metric
+ * @param[in] callback Callback to invoke to get the value
+ * @param[in] user_data Opaque pointer to pass to the callback
+ * @returns A pointer to the new metric */
+janus_metric *janus_metrics_add_callback(const char *name, const char *labels, const char *help,
+	janus_metric_type type, janus_metric_callback callback, gpointer user_data);
+/*! \brief Remove a metric, and free it (e.g., when a plugin is unloaded)
+ * @param[in] metric The metric to remove */
+void janus_metrics_remove(janus_metric *metric);
+
+/*! \brief Add a value to a sharded metric (negative values are fine for gauges)
+ * @param[in] metric The metric to update
+ * @param[in] value The value to add */
+void janus_metrics_add_value(janus_metric *metric, gint64 value);
+/*! \brief Shortcut to increase a sharded metric by one */
+#define janus_metrics_inc(metric) janus_metrics_add_value(metric, 1)
+/*! \brief Shortcut to decrease a sharded metric by one */
+#define janus_metrics_dec(metric) janus_metrics_add_value(metric, -1)
+/*! \brief Get the current value of a metric
+ * @param[in] metric The metric to read
+ * @returns The current value */
+gint64 janus_metrics_get(janus_metric *metric);
+
+/*! \brief Render all the metrics in the Prometheus text exposition format
+ * @returns A string containing the metrics, to free with g_free */
+char *janus_metrics_render(void);
+
+#endif
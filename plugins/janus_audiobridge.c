@@ -30,6 +30,8 @@ audiolevel_ext = yes|no (whether the ssrc-audio-level RTP extension must be
 	negotiated/used or not for new joins, default=yes)
 record = true|false (whether this room should be recorded, default=false)
 record_file =	/path/to/recording.wav (where to save the recording)
+record_format = wav|mjr (whether to record the mix to a .wav file, or to an Opus
+	.mjr file that janus-pp-rec can convert to .opus, default=wav)
 
 	[The following lines are only needed if you want the mixed audio
 	to be automatically forwarded via plain RTP to an external component
@@ -43,6 +45,8 @@ rtp_forward_ptype = payload type to use when streaming (optional: 100 used if mi
 rtp_forward_srtp_suite = length of authentication tag (32 or 80)
 rtp_forward_srtp_crypto = key to use as crypto (base64 encoded key as in SDES)
 rtp_forward_always_on = true|false, whether silence should be forwarded when the room is empty (optional: false used if missing)
+rtp_forward_ttl = TTL to use when rtp_forward_host is a multicast group (optional: 1 used if missing)
+rtp_forward_iface = IPv4 address of the interface to send multicast from (optional: system default if missing)
 \endverbatim
  *
  * \section bridgeapi Audio Bridge API
@@ -53,7 +57,7 @@ rtp_forward_always_on = true|false, whether silence should be forwarded when the
  * synchronous error response even for asynchronous requests. 
  * 
  * \c create , \c edit , \c destroy , \c exists, \c allowed, \c kick, \c list,
- * \c listparticipants and \c resetdecoder are synchronous requests,
+ * \c listparticipants , \c resetdecoder and \c mixerstats are synchronous requests,
  * which means you'll get a response directly within the context of the
  * transaction. \c create allows you to create a new audio conference bridge
  * dynamically, as an alternative to using the configuration file; \c edit
@@ -66,7 +70,8 @@ rtp_forward_always_on = true|false, whether silence should be forwarded when the
  * the participants of a specific room and their details; finally,
  * \c resetdecoder marks the Opus decoder for the participant as invalid,
  * and forces it to be recreated (which might be needed if the audio
- * for generated by the participant becomes garbled). 
+ * for generated by the participant becomes garbled); \c mixerstats
+ * returns timing information on the mixer of a room. 
  * 
  * The \c join , \c configure , \c changeroom and \c leave requests
  * instead are all asynchronous, which means you'll get a notification
@@ -105,8 +110,11 @@ rtp_forward_always_on = true|false, whether silence should be forwarded when the
 	"audiolevel_event" : yes|no (whether to emit event to other users or not),
 	"audio_active_packets" : 100 (number of packets with audio level, default=100, 2 seconds),
 	"audio_level_average" : 25 (average value of audio level, 127=muted, 0='too loud', default=25),
+	"max_speakers" : <only decode and mix the N loudest participants, as per the audio level extension, default 0 (everybody)>,
+	"dtx" : <true|false, whether participants should use DTX (discontinuous transmission) when silent, default false>,
 	"record" : <true|false, whether to record the room or not, default false>,
 	"record_file" : "</path/to/the/recording.wav, optional>",
+	"record_format" : "<wav|mjr, whether to record the mix to a .wav file, or to an Opus .mjr file (much smaller), default wav>"
 }
 \endverbatim
  *
@@ -353,9 +361,17 @@ rtp_forward_always_on = true|false, whether silence should be forwarded when the
 	"port" : <port to forward the RTP packets to>,
 	"srtp_suite" : <length of authentication tag (32 or 80)>,
 	"srtp_crypto" : "<key to use as crypto (base64 encoded key as in SDES)>",
-	"always_on" : <true|false, whether silence should be forwarded when the room is empty>
+	"always_on" : <true|false, whether silence should be forwarded when the room is empty>,
+	"ttl" : <TTL to use if host is a multicast group (optional: 1 used if missing)>,
+	"iface" : "<IPv4 address of the interface to send multicast from (optional)>"
 }
 \endverbatim
+ *
+ * The mix is encoded once per frame, no matter how many forwarders
+ * there are (and shared with the participants that aren't talking).
+ * If \c host is a multicast group, a single packet per frame serves
+ * all the recorders, transcribers and other consumers that joined it,
+ * which is much cheaper than a forwarder per consumer.
  *
  * A successful request will result in a \c success response:
  *
@@ -412,11 +428,49 @@ rtp_forward_always_on = true|false, whether silence should be forwarded when the
 			"ip" : "<IP this forwarder is streaming to>",
 			"port" : <port this forwarder is streaming to>,
 			"ssrc" : <SSRC this forwarder is using, if any>,
-			"ptype" : <payload type this forwarder is using, if any>
+			"ptype" : <payload type this forwarder is using, if any>,
+			"srtp" : <true|false, whether this forwarder is using SRTP>,
+			"multicast" : <true|false, whether this forwarder is streaming to a multicast group>,
+			"ttl" : <multicast TTL this forwarder is using, if multicast>
 		},
 		// Other forwarders
 	]
 }
+\endverbatim
+ *
+ * Large rooms may put some strain on the mixer, which must prepare a new
+ * frame for each participant every 20ms. To see how close a room mixer
+ * is to missing those deadlines, you can send a \c mixerstats request:
+ *
+\verbatim
+{
+	"request" : "mixerstats",
+	"room" : <unique numeric ID of the room>,
+	"secret" : "<room secret, mandatory if configured>"
+}
+\endverbatim
+ *
+ * A successful request will return a \c mixerstats response, with a
+ * histogram of how long after they were due frames were ready (i.e.,
+ * scheduling delay plus mixing time). Frames counted in \c late missed
+ * their deadline: if that keeps growing, consider setting
+ * \c encoding_threads in the plugin configuration, so that encoding
+ * is spread across a pool of workers, or splitting the room.
+ *
+\verbatim
+{
+	"audiobridge" : "mixerstats",
+	"room" : <unique numeric ID of the room>,
+	"max_us" : <longest time it took to prepare a frame, in microseconds>,
+	"histogram" : {
+		"1ms" : <frames prepared within 1ms>,
+		"2ms" : <frames prepared within 2ms>,
+		"5ms" : <frames prepared within 5ms>,
+		"10ms" : <frames prepared within 10ms>,
+		"20ms" : <frames prepared within 20ms>,
+		"late" : <frames that took longer than 20ms>
+	}
+}
 \endverbatim
  *
  * That completes the list of synchronous requests you can send to the
@@ -599,6 +653,9 @@ rtp_forward_always_on = true|false, whether silence should be forwarded when the
 #include "../record.h"
 #include "../sdp-utils.h"
 #include "../utils.h"
+#include "../timer.h"
+#include "../affinity.h"
+#include "../metrics.h"
 
 
 /* Plugin information */
@@ -675,11 +732,14 @@ static struct janus_json_parameter create_parameters[] = {
 	{"sampling", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"record", JANUS_JSON_BOOL, 0},
 	{"record_file", JSON_STRING, 0},
+	{"record_format", JSON_STRING, 0},
 	{"permanent", JANUS_JSON_BOOL, 0},
 	{"audiolevel_ext", JANUS_JSON_BOOL, 0},
 	{"audiolevel_event", JANUS_JSON_BOOL, 0},
 	{"audio_active_packets", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"audio_level_average", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"max_speakers", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"dtx", JANUS_JSON_BOOL, 0},
 	{"room", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
 static struct janus_json_parameter edit_parameters[] = {
@@ -735,7 +795,9 @@ static struct janus_json_parameter rtp_forward_parameters[] = {
 	{"host", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"srtp_suite", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"srtp_crypto", JSON_STRING, 0},
-	{"always_on", JANUS_JSON_BOOL, 0}
+	{"always_on", JANUS_JSON_BOOL, 0},
+	{"ttl", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"iface", JSON_STRING, 0}
 };
 static struct janus_json_parameter stop_rtp_forward_parameters[] = {
 	{"room", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
@@ -751,12 +813,13 @@ static janus_mutex config_mutex = JANUS_MUTEX_INITIALIZER;
 static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
 static janus_callbacks *gateway = NULL;
-static GThread *handler_thread;
+static janus_handler_pool *handlers = NULL;
 static GThread *watchdog;
 static void *janus_audiobridge_handler(void *data);
 static void janus_audiobridge_relay_rtp_packet(gpointer data, gpointer user_data);
-static void *janus_audiobridge_mixer_thread(void *data);
+static void janus_audiobridge_mixer_select(void);
 static void *janus_audiobridge_participant_thread(void *data);
+static void janus_audiobridge_encoding_worker(gpointer data, gpointer user_data);
 static void janus_audiobridge_hangup_media_internal(janus_plugin_session *handle);
 
 typedef struct janus_audiobridge_message {
@@ -765,8 +828,15 @@ typedef struct janus_audiobridge_message {
 	json_t *message;
 	json_t *jsep;
 } janus_audiobridge_message;
-static GAsyncQueue *messages = NULL;
+/* Upper bounds (in us) of the mixer timing histogram buckets: the last
+ * bucket counts the frames that missed their 20ms deadline */
+static const gint64 janus_audiobridge_mix_buckets[] = { 1000, 2000, 5000, 10000, 20000 };
+#define JANUS_AUDIOBRIDGE_MIX_BUCKETS	6
 static janus_audiobridge_message exit_message;
+/* Mixed frames are encoded by a dedicated thread per participant, unless
+ * encoding_threads is set in the [general] section: in that case a shared
+ * pool of workers encodes them, which scales way better with large rooms */
+static GThreadPool *encoders = NULL;
 
 static void janus_audiobridge_message_free(janus_audiobridge_message *msg) {
 	if(!msg || msg == &exit_message)
@@ -798,26 +868,38 @@ typedef struct janus_audiobridge_room {
 	gboolean audiolevel_event;	/* Whether to emit event to other users about audiolevel */
 	int audio_active_packets;	/* amount of packets with audio level for checkup */
 	int audio_level_average;	/* average audio level */
+	int max_speakers;			/* If > 0, only the N loudest participants (as per audio levels) are decoded and mixed */
+	gboolean dtx;				/* Whether participants are asked to use DTX when silent (DTX frames are never decoded) */
 	gboolean record;			/* Whether this room has to be recorded or not */
 	gchar *record_file;			/* Path of the recording file */
-	FILE *recording;			/* File to record the room into */
-	gint64 record_lastupdate;	/* Time when we last updated the wav header */
+	gboolean record_mjr;		/* Whether the mix should be recorded as Opus to a .mjr file, rather than to a .wav */
 	gboolean destroy;			/* Value to flag the room for destruction */
 	GHashTable *participants;	/* Map of participants */
 	gboolean check_tokens;		/* Whether to check tokens when participants join (see below) */
 	GHashTable *allowed;		/* Map of participants (as tokens) allowed to join */
-	GThread *thread;			/* Mixer thread for this room */
+	janus_timer_task *mixer;	/* Mixer task for this room */
+	guint64 mix_ticks[JANUS_AUDIOBRIDGE_MIX_BUCKETS];	/* Histogram of how long it took to prepare frames, since they were due */
+	gint64 mix_max;				/* Longest time it took to prepare a frame */
 	gint64 destroyed;			/* When this room has been destroyed */
 	janus_mutex mutex;			/* Mutex to lock this room instance */
 	/* RTP forwarders for this room's mix */
 	GHashTable *rtp_forwarders;	/* RTP forwarders list (as a hashmap) */
-	OpusEncoder *rtp_encoder;	/* Opus encoder instance to use for all RTP forwarders */
+	OpusEncoder *rtp_encoder;	/* Opus encoder for the RTP forwarders, if the shared mix one is missing */
 	janus_mutex rtp_mutex;		/* Mutex to lock the RTP forwarders list */
 	int rtp_udp_sock;			/* UDP socket to use to forward RTP packets */
 } janus_audiobridge_room;
 static GHashTable *rooms;
 static janus_mutex rooms_mutex = JANUS_MUTEX_INITIALIZER;
+/* Exported via the core metrics */
+static janus_metric *metric_rooms = NULL;
+static gint64 janus_audiobridge_metric_rooms(gpointer user_data) {
+	janus_mutex_lock(&rooms_mutex);
+	gint64 count = rooms ? g_hash_table_size(rooms) : 0;
+	janus_mutex_unlock(&rooms_mutex);
+	return count;
+}
 static GList *old_rooms;
+static janus_timer_task *janus_audiobridge_mixer_start(janus_audiobridge_room *audiobridge);
 static char *admin_key = NULL;
 
 typedef struct janus_audiobridge_session {
@@ -856,12 +938,20 @@ typedef struct janus_audiobridge_participant {
 	int audio_active_packets;	/* Participant's number of audio packets to accumulate */
 	int audio_dBov_sum;	    /* Participant's accumulated dBov value for audio level */
 	gboolean talking;		/* Whether this participant is currently talking (uses audio levels extension) */
+	int mix_level;			/* Smoothed audio level, used to pick the loudest participants when max_speakers is set */
+	volatile gint selected;	/* Whether the mixer picked this participant as one of the loudest ones */
+	guint16 last_seq;		/* Highest RTP sequence number received so far, to detect losses */
+	gboolean last_seq_valid;	/* Whether we received any packet yet */
+	guint16 fec_seq;		/* Sequence number of the last packet recovered via FEC, to drop it if it shows up late */
+	gboolean fec_valid;		/* Whether we recovered any packet via FEC yet */
 	janus_rtp_switching_context context;	/* Needed in case the participant changes room */
 	/* Opus stuff */
 	OpusEncoder *encoder;		/* Opus encoder instance */
 	OpusDecoder *decoder;		/* Opus decoder instance */
 	gboolean reset;				/* Whether or not the Opus context must be reset, without re-joining the room */
 	GThread *thread;			/* Encoding thread for this participant */
+	volatile gint encoding;		/* Whether an encoding worker is taking care of this participant's queue */
+	guint quiet_frames;			/* How many frames in a row this participant didn't contribute to (only used by the mixer) */
 	janus_recorder *arc;		/* The Janus recorder instance for this user's audio, if enabled */
 	janus_mutex rec_mutex;		/* Mutex to protect the recorder from race conditions */
 	gint64 destroyed;			/* When this participant has been destroyed */
@@ -875,6 +965,7 @@ typedef struct janus_audiobridge_rtp_relay_packet {
 	uint32_t timestamp;
 	uint16_t seq_number;
 	gboolean silence;
+	gboolean encoded;	/* Whether data is an Opus payload already (shared mix), rather than samples */
 } janus_audiobridge_rtp_relay_packet;
 
 /* RTP forwarder instance: address to send to, and current RTP header info */
@@ -885,18 +976,65 @@ typedef struct janus_audiobridge_rtp_forwarder {
 	uint16_t seq_number;
 	uint32_t timestamp;
 	gboolean always_on;
+	/* Only needed for multicast forwarders, which get their own socket */
+	gboolean multicast;
+	int ttl;
+	int fd;
 	/* Only needed for SRTP forwarders */
 	gboolean is_srtp;
 	srtp_t srtp_ctx;
 	srtp_policy_t srtp_policy;
 } janus_audiobridge_rtp_forwarder;
+static void janus_audiobridge_rtp_forwarder_free(janus_audiobridge_rtp_forwarder *rf) {
+	if(rf == NULL)
+		return;
+	if(rf->fd > 0)
+		close(rf->fd);
+	if(rf->is_srtp) {
+		srtp_dealloc(rf->srtp_ctx);
+		g_free(rf->srtp_policy.key);
+	}
+	g_free(rf);
+}
 static guint32 janus_audiobridge_rtp_forwarder_add_helper(janus_audiobridge_room *room,
 		const gchar* host, uint16_t port, uint32_t ssrc, int pt,
 		int srtp_suite, const char *srtp_crypto,
-		gboolean always_on, guint32 stream_id) {
+		gboolean always_on, int ttl, const char *iface, guint32 stream_id) {
 	if(room == NULL || host == NULL)
 		return 0;
+	struct in_addr addr;
+	if(inet_pton(AF_INET, host, &addr) != 1) {
+		JANUS_LOG(LOG_ERR, "Invalid RTP forwarder address (%s)\n", host);
+		return 0;
+	}
+	struct in_addr mcast_iface = { .s_addr = htonl(INADDR_ANY) };
+	if(iface != NULL && inet_pton(AF_INET, iface, &mcast_iface) != 1) {
+		JANUS_LOG(LOG_ERR, "Invalid RTP forwarder multicast interface (%s)\n", iface);
+		return 0;
+	}
 	janus_audiobridge_rtp_forwarder *rf = g_malloc0(sizeof(janus_audiobridge_rtp_forwarder));
+	rf->fd = -1;
+	if(IN_MULTICAST(ntohl(addr.s_addr))) {
+		/* Multicast group: we use a dedicated socket, so that the TTL and
+		 * outgoing interface of this forwarder don't affect the others */
+		rf->multicast = TRUE;
+		rf->ttl = ttl > 0 ? ttl : 1;
+		rf->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if(rf->fd < 0) {
+			JANUS_LOG(LOG_ERR, "Could not open UDP socket for multicast RTP forwarder (room %"SCNu64")\n", room->room_id);
+			g_free(rf);
+			return 0;
+		}
+		unsigned char mttl = rf->ttl > 255 ? 255 : rf->ttl;
+		if(setsockopt(rf->fd, IPPROTO_IP, IP_MULTICAST_TTL, &mttl, sizeof(mttl)) < 0 ||
+				setsockopt(rf->fd, IPPROTO_IP, IP_MULTICAST_IF, &mcast_iface, sizeof(mcast_iface)) < 0) {
+			JANUS_LOG(LOG_ERR, "Error configuring multicast RTP forwarder (room %"SCNu64"): %d (%s)\n",
+				room->room_id, errno, strerror(errno));
+			close(rf->fd);
+			g_free(rf);
+			return 0;
+		}
+	}
 	/* First of all, let's check if we need to setup an SRTP forwarder */
 	if(srtp_suite > 0 && srtp_crypto != NULL) {
 		/* Base64 decode the crypto string and set it as the SRTP context */
@@ -905,7 +1043,7 @@ static guint32 janus_audiobridge_rtp_forwarder_add_helper(janus_audiobridge_room
 		if(len < SRTP_MASTER_LENGTH) {
 			JANUS_LOG(LOG_ERR, "Invalid SRTP crypto (%s)\n", srtp_crypto);
 			g_free(decoded);
-			g_free(rf);
+			janus_audiobridge_rtp_forwarder_free(rf);
 			return 0;
 		}
 		/* Set SRTP policy */
@@ -926,14 +1064,14 @@ static guint32 janus_audiobridge_rtp_forwarder_add_helper(janus_audiobridge_room
 			JANUS_LOG(LOG_ERR, "Error creating forwarder SRTP session: %d (%s)\n", res, janus_srtp_error_str(res));
 			g_free(decoded);
 			policy->key = NULL;
-			g_free(rf);
+			janus_audiobridge_rtp_forwarder_free(rf);
 			return 0;
 		}
 		rf->is_srtp = TRUE;
 	}
 	/* Resolve address */
 	rf->serv_addr.sin_family = AF_INET;
-	inet_pton(AF_INET, host, &(rf->serv_addr.sin_addr));
+	rf->serv_addr.sin_addr = addr;
 	rf->serv_addr.sin_port = htons(port);
 	/* Setup RTP info (we'll use the stream ID as SSRC) */
 	rf->ssrc = ssrc;
@@ -958,8 +1096,8 @@ static guint32 janus_audiobridge_rtp_forwarder_add_helper(janus_audiobridge_room
 
 	janus_mutex_unlock(&room->rtp_mutex);
 
-	JANUS_LOG(LOG_VERB, "Added RTP forwarder to room %"SCNu64": %s:%d (ID: %"SCNu32")\n",
-		room->room_id, host, port, actual_stream_id);
+	JANUS_LOG(LOG_VERB, "Added %sRTP forwarder to room %"SCNu64": %s:%d (ID: %"SCNu32")\n",
+		rf->multicast ? "multicast " : "", room->room_id, host, port, actual_stream_id);
 
 	return actual_stream_id;
 }
@@ -1010,7 +1148,12 @@ typedef struct wav_header {
 #define	BUFFER_SAMPLES	8000
 #define	OPUS_SAMPLES	160
 #define USE_FEC			0
+#define DTX_MAX_SIZE	2	/* Opus DTX frames are no larger than this */
+#define MJR_OPUS_PT		111	/* Payload type in .mjr recordings of the mix */
 #define DEFAULT_COMPLEXITY	4
+/* How many frames a participant must be quiet for before getting the shared mix: switching
+ * encoders breaks the Opus state (and FEC), so we don't do that at every pause in a sentence */
+#define JANUS_AUDIOBRIDGE_SHARED_MIX_HOLD	50
 
 
 /* Error codes */
@@ -1126,6 +1269,15 @@ static int janus_audiobridge_create_static_rtp_forwarder(janus_config_category *
 		always_on = janus_is_true(always_on_item->value);
 	}
 
+	int ttl = 0;
+	janus_config_item *ttl_item = janus_config_get_item(cat, "rtp_forward_ttl");
+	if(ttl_item != NULL && ttl_item->value != NULL)
+		ttl = atoi(ttl_item->value);
+	janus_config_item *iface_item = janus_config_get_item(cat, "rtp_forward_iface");
+	const char *iface = NULL;
+	if(iface_item != NULL && iface_item->value != NULL && strlen(iface_item->value) > 0)
+		iface = iface_item->value;
+
 	/* Update room */
 	janus_mutex_lock(&rooms_mutex);
 	janus_mutex_lock(&audiobridge->mutex);
@@ -1144,7 +1296,7 @@ static int janus_audiobridge_create_static_rtp_forwarder(janus_config_category *
 
 	janus_audiobridge_rtp_forwarder_add_helper(audiobridge,
 		host, port, ssrc_value, ptype, srtp_suite, srtp_crypto,
-		always_on, forwarder_id);
+		always_on, ttl, iface, forwarder_id);
 
 	janus_mutex_unlock(&audiobridge->mutex);
 	janus_mutex_unlock(&rooms_mutex);
@@ -1253,9 +1405,31 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 	
 	rooms = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
 	sessions = g_hash_table_new(NULL, NULL);
-	messages = g_async_queue_new_full((GDestroyNotify) janus_audiobridge_message_free);
+	guint handler_threads_num = 1;
+	if(config != NULL) {
+		janus_config_item *threads = janus_config_get_item_drilldown(config, "general", "handler_threads");
+		if(threads != NULL && threads->value != NULL)
+			handler_threads_num = janus_handler_pool_size(threads->value);
+		janus_config_item *workers = janus_config_get_item_drilldown(config, "general", "encoding_threads");
+		if(workers != NULL && workers->value != NULL && atoi(workers->value) > 0) {
+			GError *error = NULL;
+			encoders = g_thread_pool_new(janus_audiobridge_encoding_worker, NULL, atoi(workers->value), FALSE, &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_WARN, "Got error %d (%s) trying to create the encoding workers, using a thread per participant...\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				encoders = NULL;
+			} else {
+				JANUS_LOG(LOG_INFO, "Mixed frames will be encoded by %d shared workers\n", atoi(workers->value));
+			}
+		}
+	}
+	/* Messages are handled by a pool of threads (handler_threads in the [general] section, default=1) */
+	handlers = janus_handler_pool_create(handler_threads_num, (GDestroyNotify) janus_audiobridge_message_free);
 	/* This is the callback we'll need to invoke to contact the gateway */
 	gateway = callback;
+	/* Check which mixing kernels we can use */
+	janus_audiobridge_mixer_select();
 
 	/* Parse configuration to populate the rooms list */
 	if(config != NULL) {
@@ -1285,10 +1459,13 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_item *audiolevel_event = janus_config_get_item(cat, "audiolevel_event");
 			janus_config_item *audio_active_packets = janus_config_get_item(cat, "audio_active_packets");
 			janus_config_item *audio_level_average = janus_config_get_item(cat, "audio_level_average");
+			janus_config_item *max_speakers = janus_config_get_item(cat, "max_speakers");
+			janus_config_item *dtx = janus_config_get_item(cat, "dtx");
 			janus_config_item *secret = janus_config_get_item(cat, "secret");
 			janus_config_item *pin = janus_config_get_item(cat, "pin");
 			janus_config_item *record = janus_config_get_item(cat, "record");
 			janus_config_item *recfile = janus_config_get_item(cat, "record_file");
+			janus_config_item *recformat = janus_config_get_item(cat, "record_format");
 			if(sampling == NULL || sampling->value == NULL) {
 				JANUS_LOG(LOG_ERR, "Can't add the audio room, missing mandatory information...\n");
 				cl = cl->next;
@@ -1342,6 +1519,14 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 					}
 				}
 			}
+			if(max_speakers != NULL && max_speakers->value != NULL) {
+				if(atoi(max_speakers->value) >= 0) {
+					audiobridge->max_speakers = atoi(max_speakers->value);
+				} else {
+					JANUS_LOG(LOG_WARN, "Invalid max_speakers value provided, mixing everybody\n");
+				}
+			}
+			audiobridge->dtx = (dtx != NULL && dtx->value != NULL && janus_is_true(dtx->value));
 
 			if(secret != NULL && secret->value != NULL) {
 				audiobridge->room_secret = g_strdup(secret->value);
@@ -1354,14 +1539,19 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 				audiobridge->record = TRUE;
 			if(recfile && recfile->value)
 				audiobridge->record_file = g_strdup(recfile->value);
-			audiobridge->recording = NULL;
+			if(recformat && recformat->value) {
+				if(!strcasecmp(recformat->value, "mjr"))
+					audiobridge->record_mjr = TRUE;
+				else if(strcasecmp(recformat->value, "wav"))
+					JANUS_LOG(LOG_WARN, "Unsupported record_format '%s', recording to .wav\n", recformat->value);
+			}
 			audiobridge->destroy = 0;
 			audiobridge->participants = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
 			audiobridge->check_tokens = FALSE;	/* Static rooms can't have an "allowed" list yet, no hooks to the configuration file */
 			audiobridge->allowed = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
 			audiobridge->destroyed = 0;
 			janus_mutex_init(&audiobridge->mutex);
-			audiobridge->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_free);
+			audiobridge->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_audiobridge_rtp_forwarder_free);
 			audiobridge->rtp_encoder = NULL;
 			audiobridge->rtp_udp_sock = -1;
 			janus_mutex_init(&audiobridge->rtp_mutex);
@@ -1375,14 +1565,15 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 				JANUS_LOG(LOG_ERR, "Error creating static RTP forwarder (room %"SCNu64")\n", audiobridge->room_id);
 			}
 
-			/* We need a thread for the mix */
-			GError *error = NULL;
-			char tname[16];
-			g_snprintf(tname, sizeof(tname), "mixer %"SCNu64, audiobridge->room_id);
-			audiobridge->thread = g_thread_try_new(tname, &janus_audiobridge_mixer_thread, audiobridge, &error);
-			if(error != NULL) {
+			/* We need a task for the mix. Notice that, unlike lazy Streaming mountpoints,
+			 * static rooms are fully set up here, even if nobody ever joins them: this
+			 * schedules a timer task (a thread of its own, if timer_threads is 0), creates
+			 * the Opus encoder and, if recording, opens the recording file, on top of the
+			 * UDP socket the static RTP forwarders above may have opened already */
+			audiobridge->mixer = janus_audiobridge_mixer_start(audiobridge);
+			if(audiobridge->mixer == NULL) {
 				/* FIXME We should clear some resources... */
-				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the mixer thread...\n", error->code, error->message ? error->message : "??");
+				JANUS_LOG(LOG_ERR, "Error starting the mixer for room %"SCNu64"...\n", audiobridge->room_id);
 			} else {
 				janus_mutex_lock(&rooms_mutex);
 				g_hash_table_insert(rooms, janus_uint64_dup(audiobridge->room_id), audiobridge);
@@ -1405,6 +1596,8 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 	}
 	janus_mutex_unlock(&rooms_mutex);
 
+	metric_rooms = janus_metrics_add_callback("janus_plugin_rooms", "plugin=\"" JANUS_AUDIOBRIDGE_PACKAGE "\"",
+		"Rooms currently available in the plugin", JANUS_METRIC_GAUGE, janus_audiobridge_metric_rooms, NULL);
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
@@ -1416,9 +1609,8 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_destroy(config);
 		return -1;
 	}
-	/* Launch the thread that will handle incoming messages */
-	handler_thread = g_thread_try_new("audiobridge handler", janus_audiobridge_handler, NULL, &error);
-	if(error != NULL) {
+	/* Launch the threads that will handle incoming messages */
+	if(janus_handler_pool_start(handlers, "audiobridge", janus_audiobridge_handler, &error) < 0) {
 		g_atomic_int_set(&initialized, 0);
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the AudioBridge handler thread...\n", error->code, error->message ? error->message : "??");
 		janus_config_destroy(config);
@@ -1432,11 +1624,30 @@ void janus_audiobridge_destroy(void) {
 	if(!g_atomic_int_get(&initialized))
 		return;
 	g_atomic_int_set(&stopping, 1);
+	janus_metrics_remove(metric_rooms);
+	metric_rooms = NULL;
 
-	g_async_queue_push(messages, &exit_message);
-	if(handler_thread != NULL) {
-		g_thread_join(handler_thread);
-		handler_thread = NULL;
+	janus_handler_pool_stop(handlers, &exit_message);
+	/* Mixers may still push encoding jobs: wait for them to notice we're stopping.
+	 * Destroyed rooms don't count, as their mixer was joined by the handler already */
+	GList *mixers = NULL;
+	janus_mutex_lock(&rooms_mutex);
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, rooms);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_audiobridge_room *audiobridge = (janus_audiobridge_room *)value;
+		if(audiobridge->mixer != NULL && audiobridge->destroyed == 0) {
+			mixers = g_list_prepend(mixers, audiobridge->mixer);
+			audiobridge->mixer = NULL;
+		}
+	}
+	janus_mutex_unlock(&rooms_mutex);
+	g_list_free_full(mixers, (GDestroyNotify)janus_timer_join);
+	/* Now nobody can use the encoding pool anymore */
+	if(encoders != NULL) {
+		g_thread_pool_free(encoders, TRUE, TRUE);
+		encoders = NULL;
 	}
 	if(watchdog != NULL) {
 		g_thread_join(watchdog);
@@ -1449,8 +1660,8 @@ void janus_audiobridge_destroy(void) {
 	janus_mutex_lock(&rooms_mutex);
 	g_hash_table_destroy(rooms);
 	janus_mutex_unlock(&rooms_mutex);
-	g_async_queue_unref(messages);
-	messages = NULL;
+	janus_handler_pool_destroy(handlers);
+	handlers = NULL;
 	sessions = NULL;
 
 	janus_config_destroy(config);
@@ -1684,8 +1895,11 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 		json_t *audiolevel_event = json_object_get(root, "audiolevel_event");
 		json_t *audio_active_packets = json_object_get(root, "audio_active_packets");
 		json_t *audio_level_average = json_object_get(root, "audio_level_average");
+		json_t *max_speakers = json_object_get(root, "max_speakers");
+		json_t *dtx = json_object_get(root, "dtx");
 		json_t *record = json_object_get(root, "record");
 		json_t *recfile = json_object_get(root, "record_file");
+		json_t *recformat = json_object_get(root, "record_format");
 		json_t *permanent = json_object_get(root, "permanent");
 		if(allowed) {
 			/* Make sure the "allowed" array only contains strings */
@@ -1707,6 +1921,12 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 				goto plugin_response;
 			}
 		}
+		if(recformat && strcasecmp(json_string_value(recformat), "wav") && strcasecmp(json_string_value(recformat), "mjr")) {
+			JANUS_LOG(LOG_ERR, "Invalid element (record_format should be either wav or mjr)\n");
+			error_code = JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Invalid element (record_format should be either wav or mjr)");
+			goto plugin_response;
+		}
 		gboolean save = permanent ? json_is_true(permanent) : FALSE;
 		if(save && config == NULL) {
 			JANUS_LOG(LOG_ERR, "No configuration file, can't create permanent room\n");
@@ -1779,6 +1999,8 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 				JANUS_LOG(LOG_WARN, "Invalid audio_level_average value provided, using default: %d\n", audiobridge->audio_level_average);
 			}
 		}
+		audiobridge->max_speakers = max_speakers ? json_integer_value(max_speakers) : 0;
+		audiobridge->dtx = dtx ? json_is_true(dtx) : FALSE;
 		switch(audiobridge->sampling_rate) {
 			case 8000:
 			case 12000:
@@ -1799,7 +2021,8 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 			audiobridge->record = TRUE;
 		if(recfile)
 			audiobridge->record_file = g_strdup(json_string_value(recfile));
-		audiobridge->recording = NULL;
+		if(recformat && !strcasecmp(json_string_value(recformat), "mjr"))
+			audiobridge->record_mjr = TRUE;
 		audiobridge->destroy = 0;
 		audiobridge->participants = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
 		audiobridge->allowed = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
@@ -1817,7 +2040,7 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 		}
 		audiobridge->destroyed = 0;
 		janus_mutex_init(&audiobridge->mutex);
-		audiobridge->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_free);
+		audiobridge->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_audiobridge_rtp_forwarder_free);
 		audiobridge->rtp_encoder = NULL;
 		audiobridge->rtp_udp_sock = -1;
 		janus_mutex_init(&audiobridge->rtp_mutex);
@@ -1827,16 +2050,13 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 			audiobridge->is_private ? "private" : "public",
 			audiobridge->room_secret ? audiobridge->room_secret : "no secret",
 			audiobridge->room_pin ? audiobridge->room_pin : "no pin");
-		/* We need a thread for the mix */
-		GError *error = NULL;
-		char tname[16];
-		g_snprintf(tname, sizeof(tname), "mixer %"SCNu64, audiobridge->room_id);
-		audiobridge->thread = g_thread_try_new(tname, &janus_audiobridge_mixer_thread, audiobridge, &error);
-		if(error != NULL) {
+		/* We need a task for the mix */
+		audiobridge->mixer = janus_audiobridge_mixer_start(audiobridge);
+		if(audiobridge->mixer == NULL) {
 			janus_mutex_unlock(&rooms_mutex);
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the mixer thread...\n", error->code, error->message ? error->message : "??");
+			JANUS_LOG(LOG_ERR, "Error starting the mixer for room %"SCNu64"...\n", audiobridge->room_id);
 			error_code = JANUS_AUDIOBRIDGE_ERROR_UNKNOWN_ERROR;
-			g_snprintf(error_cause, 512, "Got error %d (%s) trying to launch the mixer thread", error->code, error->message ? error->message : "??");
+			g_snprintf(error_cause, 512, "Error starting the mixer");
 			g_free(audiobridge->room_name);
 			g_free(audiobridge->room_secret);
 			g_free(audiobridge->record_file);
@@ -1879,10 +2099,18 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 					janus_config_add_item(config, cat, "audio_level_average", value);
 				}
 			}
+			if(audiobridge->max_speakers > 0) {
+				g_snprintf(value, BUFSIZ, "%d", audiobridge->max_speakers);
+				janus_config_add_item(config, cat, "max_speakers", value);
+			}
+			if(audiobridge->dtx)
+				janus_config_add_item(config, cat, "dtx", "yes");
 			if(audiobridge->record_file) {
 				janus_config_add_item(config, cat, "record", "yes");
 				janus_config_add_item(config, cat, "record_file", audiobridge->record_file);
 			}
+			if(audiobridge->record_mjr)
+				janus_config_add_item(config, cat, "record_format", "mjr");
 			/* Save modified configuration */
 			if(janus_config_save(config, config_folder, JANUS_AUDIOBRIDGE_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room is not permanent */
@@ -1988,6 +2216,8 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 				janus_config_add_item(config, cat, "record", "yes");
 				janus_config_add_item(config, cat, "record_file", audiobridge->record_file);
 			}
+			if(audiobridge->record_mjr)
+				janus_config_add_item(config, cat, "record_format", "mjr");
 			/* Save modified configuration */
 			if(janus_config_save(config, config_folder, JANUS_AUDIOBRIDGE_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room changes are not permanent */
@@ -2103,11 +2333,11 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 			json_object_set_new(info, "room", json_integer(room_id));
 			gateway->notify_event(&janus_audiobridge_plugin, session->handle, info);
 		}
-		JANUS_LOG(LOG_VERB, "Waiting for the mixer thread to complete...\n");
+		JANUS_LOG(LOG_VERB, "Waiting for the mixer to complete...\n");
 		audiobridge->destroyed = janus_get_monotonic_time();
 		janus_mutex_unlock(&audiobridge->mutex);
 		janus_mutex_unlock(&rooms_mutex);
-		g_thread_join(audiobridge->thread);
+		janus_timer_join(audiobridge->mixer);
 		/* Done */
 		response = json_object();
 		json_object_set_new(response, "audiobridge", json_string("destroyed"));
@@ -2401,6 +2631,10 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 		const gchar* host = json_string_value(json_host);
 		json_t *always = json_object_get(root, "always_on");
 		gboolean always_on = always ? json_is_true(always) : FALSE;
+		json_t *json_ttl = json_object_get(root, "ttl");
+		int ttl = json_ttl ? json_integer_value(json_ttl) : 0;
+		json_t *json_iface = json_object_get(root, "iface");
+		const char *iface = json_string_value(json_iface);
 		/* Besides, we may need to SRTP-encrypt this stream */
 		int srtp_suite = 0;
 		const char *srtp_crypto = NULL;
@@ -2460,9 +2694,14 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 		}
 
 		guint32 stream_id = janus_audiobridge_rtp_forwarder_add_helper(audiobridge,
-			host, port, ssrc_value, ptype, srtp_suite, srtp_crypto, always_on, 0);
+			host, port, ssrc_value, ptype, srtp_suite, srtp_crypto, always_on, ttl, iface, 0);
 		janus_mutex_unlock(&audiobridge->mutex);
 		janus_mutex_unlock(&rooms_mutex);
+		if(stream_id == 0) {
+			error_code = JANUS_AUDIOBRIDGE_ERROR_UNKNOWN_ERROR;
+			g_snprintf(error_cause, 512, "Error adding RTP forwarder");
+			goto plugin_response;
+		}
 
 		/* Done, prepare response */
 		response = json_object();
@@ -2564,6 +2803,10 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 			json_object_set_new(fl, "ssrc", json_integer(rf->ssrc ? rf->ssrc : stream_id));
 			json_object_set_new(fl, "ptype", json_integer(rf->payload_type));
 			json_object_set_new(fl, "always_on", rf->always_on ? json_true() : json_false());
+			json_object_set_new(fl, "srtp", rf->is_srtp ? json_true() : json_false());
+			json_object_set_new(fl, "multicast", rf->multicast ? json_true() : json_false());
+			if(rf->multicast)
+				json_object_set_new(fl, "ttl", json_integer(rf->ttl));
 			json_array_append_new(list, fl);
 		}
 		janus_mutex_unlock(&audiobridge->rtp_mutex);
@@ -2573,6 +2816,51 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 		json_object_set_new(response, "room", json_integer(room_id));
 		json_object_set_new(response, "rtp_forwarders", list);
 		goto plugin_response;
+	} else if(!strcasecmp(request_text, "mixerstats")) {
+		/* Return timing information on the mixer of a room */
+		JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto plugin_response;
+		json_t *room = json_object_get(root, "room");
+		guint64 room_id = json_integer_value(room);
+		janus_mutex_lock(&rooms_mutex);
+		janus_audiobridge_room *audiobridge = g_hash_table_lookup(rooms, &room_id);
+		if(audiobridge == NULL || audiobridge->destroyed) {
+			JANUS_LOG(LOG_ERR, "No such room (%"SCNu64")\n", room_id);
+			error_code = JANUS_AUDIOBRIDGE_ERROR_NO_SUCH_ROOM;
+			g_snprintf(error_cause, 512, "No such room (%"SCNu64")", room_id);
+			janus_mutex_unlock(&rooms_mutex);
+			goto plugin_response;
+		}
+		/* A secret may be required for this action */
+		JANUS_CHECK_SECRET(audiobridge->room_secret, root, "secret", error_code, error_cause,
+			JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_UNAUTHORIZED);
+		if(error_code != 0) {
+			janus_mutex_unlock(&rooms_mutex);
+			goto plugin_response;
+		}
+		json_t *histogram = json_object();
+		int i = 0;
+		janus_mutex_lock(&audiobridge->mutex);
+		for(i=0; i<JANUS_AUDIOBRIDGE_MIX_BUCKETS; i++) {
+			char bucket[16];
+			if(i < JANUS_AUDIOBRIDGE_MIX_BUCKETS-1)
+				g_snprintf(bucket, sizeof(bucket), "%"SCNi64"ms", janus_audiobridge_mix_buckets[i]/1000);
+			else
+				g_snprintf(bucket, sizeof(bucket), "late");
+			json_object_set_new(histogram, bucket, json_integer(audiobridge->mix_ticks[i]));
+		}
+		gint64 mix_max = audiobridge->mix_max;
+		janus_mutex_unlock(&audiobridge->mutex);
+		janus_mutex_unlock(&rooms_mutex);
+		response = json_object();
+		json_object_set_new(response, "audiobridge", json_string("mixerstats"));
+		json_object_set_new(response, "room", json_integer(room_id));
+		json_object_set_new(response, "max_us", json_integer(mix_max));
+		json_object_set_new(response, "histogram", histogram);
+		goto plugin_response;
 	} else if(!strcasecmp(request_text, "join") || !strcasecmp(request_text, "configure")
 			|| !strcasecmp(request_text, "changeroom") || !strcasecmp(request_text, "leave")) {
 		/* These messages are handled asynchronously */
@@ -2583,7 +2871,7 @@ struct janus_plugin_result *janus_audiobridge_handle_message(janus_plugin_sessio
 		msg->message = root;
 		msg->jsep = jsep;
 
-		g_async_queue_push(messages, msg);
+		g_async_queue_push(janus_handler_pool_queue(handlers, msg->handle), msg);
 
 		return janus_plugin_result_new(JANUS_PLUGIN_OK_WAIT, NULL, NULL);
 	} else {
@@ -2676,6 +2964,44 @@ void janus_audiobridge_setup_media(janus_plugin_session *handle) {
 	janus_mutex_unlock(&rooms_mutex);
 }
 
+/* Helper to add a decoded frame to the queue of a participant, sorted by sequence number */
+static void janus_audiobridge_participant_enqueue(janus_audiobridge_participant *participant, janus_audiobridge_rtp_relay_packet *pkt) {
+	janus_mutex_lock(&participant->qmutex);
+	/* Insert packets sorting by sequence number */
+	participant->inbuf = g_list_insert_sorted(participant->inbuf, pkt, &janus_audiobridge_rtp_sort);
+	if(participant->prebuffering) {
+		/* Still pre-buffering: do we have enough packets now? */
+		if(g_list_length(participant->inbuf) == DEFAULT_PREBUFFERING) {
+			participant->prebuffering = FALSE;
+			JANUS_LOG(LOG_VERB, "Prebuffering done! Finally adding the user to the mix\n");
+		} else {
+			JANUS_LOG(LOG_VERB, "Still prebuffering (got %d packets), not adding the user to the mix yet\n", g_list_length(participant->inbuf));
+		}
+	} else {
+		/* Make sure we're not queueing too many packets: if so, get rid of the older ones */
+		if(g_list_length(participant->inbuf) >= DEFAULT_PREBUFFERING*2) {
+			gint64 now = janus_get_monotonic_time();
+			if(now - participant->last_drop > 5*G_USEC_PER_SEC) {
+				JANUS_LOG(LOG_VERB, "Too many packets in queue (%d > %d), removing older ones\n",
+					g_list_length(participant->inbuf), DEFAULT_PREBUFFERING*2);
+				participant->last_drop = now;
+			}
+			while(g_list_length(participant->inbuf) > DEFAULT_PREBUFFERING*2) {
+				/* Remove this packet: it's too old */
+				GList *first = g_list_first(participant->inbuf);
+				janus_audiobridge_rtp_relay_packet *old = (janus_audiobridge_rtp_relay_packet *)first->data;
+				participant->inbuf = g_list_remove_link(participant->inbuf, first);
+				g_list_free(first);
+				if(old == NULL)
+					continue;
+				g_free(old->data);
+				g_free(old);
+			}
+		}
+	}
+	janus_mutex_unlock(&participant->qmutex);
+}
+
 void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len) {
 	if(handle == NULL || handle->stopped || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
 		return;
@@ -2702,24 +3028,18 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, int video, cha
 				JANUS_LOG(LOG_VERB, "Opus decoder reset\n");
 			}
 			participant->reset = FALSE;
+			participant->last_seq_valid = FALSE;
 		}
-		/* Decode frame (Opus -> slinear) */
-		janus_rtp_header *rtp = (janus_rtp_header *)buf;
-		janus_audiobridge_rtp_relay_packet *pkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
-		pkt->data = g_malloc0(BUFFER_SAMPLES*sizeof(opus_int16));
-		pkt->ssrc = 0;
-		pkt->timestamp = ntohl(rtp->timestamp);
-		pkt->seq_number = ntohs(rtp->seq_number);
 		/* We might check the audio level extension to see if this is silence */
-		pkt->silence = FALSE;
-		pkt->length = 0;
-
+		gboolean silence = FALSE;
 		if(participant->extmap_id > 0) {
 			/* Check the audio levels, in case we need to notify participants about who's talking */
 			int level = 0;
 			if(janus_rtp_header_extension_parse_audio_level(buf, len, participant->extmap_id, &level) == 0) {
 				/* Is this silence? */
-				pkt->silence = (level == 127);
+				silence = (level == 127);
+				/* Keep track of how loud this participant is, in case only the loudest are mixed */
+				participant->mix_level = (participant->mix_level*3 + level + 3)/4;
 				if(participant->room->audiolevel_event) {
 					/* We also need to detect who's talking: update our monitoring stuff */
 					participant->audio_dBov_sum += level;
@@ -2764,17 +3084,73 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, int video, cha
 				}
 			}
 		}
-		participant->working = TRUE;
+		if(participant->room->max_speakers > 0 && participant->extmap_id > 0 && !g_atomic_int_get(&participant->selected)) {
+			/* Not one of the loudest participants right now, no need to decode this */
+			return;
+		}
+		janus_rtp_header *rtp = (janus_rtp_header *)buf;
 		int plen = 0;
 		const unsigned char *payload = (const unsigned char *)janus_rtp_payload(buf, len, &plen);
 		if(!payload) {
 			JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error accessing the RTP payload\n");
-			g_free(pkt->data);
-			g_free(pkt);
-		  	participant->working = FALSE;
 			return;
 		}
-		pkt->length = opus_decode(participant->decoder, payload, plen, (opus_int16 *)pkt->data, BUFFER_SAMPLES, USE_FEC);
+		/* Keep track of the sequence numbers, to spot losses we can recover from */
+		guint16 seq = ntohs(rtp->seq_number);
+		gint16 gap = participant->last_seq_valid ? (gint16)(seq - participant->last_seq) : 1;
+		if(gap <= 0 && participant->fec_valid && seq == participant->fec_seq) {
+			/* We recovered this packet via FEC already */
+			return;
+		}
+		if(gap > 0) {
+			participant->last_seq = seq;
+			participant->last_seq_valid = TRUE;
+			if(gap > DEFAULT_PREBUFFERING*2) {
+				/* Too far ahead to be a loss (e.g., the peer restarted its stream) */
+				gap = 1;
+			}
+		}
+		/* Is this a DTX frame? When silent, peers using DTX only send a tiny
+		 * comfort noise update every 400ms: there's nothing worth decoding or
+		 * mixing in there, so we skip it, and the mixer skips the participant */
+		if(plen <= DTX_MAX_SIZE)
+			return;
+		participant->working = TRUE;
+		if(gap > 1) {
+			/* We lost one or more packets: the one right before this can be recovered
+			 * via the in-band FEC this packet carries (if it has none, we get PLC) */
+			int samples = opus_decoder_get_nb_samples(participant->decoder, payload, plen);
+			if(samples > 0 && samples <= BUFFER_SAMPLES) {
+				janus_audiobridge_rtp_relay_packet *fec = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
+				fec->data = g_malloc0(BUFFER_SAMPLES*sizeof(opus_int16));
+				fec->ssrc = 0;
+				fec->timestamp = ntohl(rtp->timestamp) - samples*(48000/participant->room->sampling_rate);
+				fec->seq_number = seq-1;
+				fec->silence = silence;
+				fec->encoded = FALSE;
+				fec->length = opus_decode(participant->decoder, payload, plen, (opus_int16 *)fec->data, samples, 1);
+				if(fec->length < 0) {
+					JANUS_LOG(LOG_WARN, "[Opus] Couldn't recover packet %"SCNu16" via FEC: %d (%s)\n",
+						fec->seq_number, fec->length, opus_strerror(fec->length));
+					g_free(fec->data);
+					g_free(fec);
+				} else {
+					JANUS_LOG(LOG_HUGE, "[Opus] Recovered packet %"SCNu16" via FEC (%d lost)\n", fec->seq_number, gap-1);
+					participant->fec_seq = fec->seq_number;
+					participant->fec_valid = TRUE;
+					janus_audiobridge_participant_enqueue(participant, fec);
+				}
+			}
+		}
+		/* Decode frame (Opus -> slinear) */
+		janus_audiobridge_rtp_relay_packet *pkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
+		pkt->data = g_malloc0(BUFFER_SAMPLES*sizeof(opus_int16));
+		pkt->ssrc = 0;
+		pkt->timestamp = ntohl(rtp->timestamp);
+		pkt->seq_number = seq;
+		pkt->silence = silence;
+		pkt->encoded = FALSE;
+		pkt->length = opus_decode(participant->decoder, payload, plen, (opus_int16 *)pkt->data, BUFFER_SAMPLES, 0);
 		participant->working = FALSE;
 		if(pkt->length < 0) {
 			JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error decoding the Opus frame: %d (%s)\n", pkt->length, opus_strerror(pkt->length));
@@ -2783,43 +3159,7 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, int video, cha
 			return;
 		}
 		/* Enqueue the decoded frame */
-		janus_mutex_lock(&participant->qmutex);
-		/* Insert packets sorting by sequence number */
-		participant->inbuf = g_list_insert_sorted(participant->inbuf, pkt, &janus_audiobridge_rtp_sort);
-		if(participant->prebuffering) {
-			/* Still pre-buffering: do we have enough packets now? */
-			if(g_list_length(participant->inbuf) == DEFAULT_PREBUFFERING) {
-				participant->prebuffering = FALSE;
-				JANUS_LOG(LOG_VERB, "Prebuffering done! Finally adding the user to the mix\n");
-			} else {
-				JANUS_LOG(LOG_VERB, "Still prebuffering (got %d packets), not adding the user to the mix yet\n", g_list_length(participant->inbuf));
-			}
-		} else {
-			/* Make sure we're not queueing too many packets: if so, get rid of the older ones */
-			if(g_list_length(participant->inbuf) >= DEFAULT_PREBUFFERING*2) {
-				gint64 now = janus_get_monotonic_time();
-				if(now - participant->last_drop > 5*G_USEC_PER_SEC) {
-					JANUS_LOG(LOG_VERB, "Too many packets in queue (%d > %d), removing older ones\n",
-						g_list_length(participant->inbuf), DEFAULT_PREBUFFERING*2);
-					participant->last_drop = now;
-				}
-				while(g_list_length(participant->inbuf) > DEFAULT_PREBUFFERING*2) {
-					/* Remove this packet: it's too old */
-					GList *first = g_list_first(participant->inbuf);
-					janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-					participant->inbuf = g_list_remove_link(participant->inbuf, first);
-					first = NULL;
-					if(pkt == NULL)
-						continue;
-					if(pkt->data)
-						g_free(pkt->data);
-					pkt->data = NULL;
-					g_free(pkt);
-					pkt = NULL;
-				}
-			}
-		}
-		janus_mutex_unlock(&participant->qmutex);
+		janus_audiobridge_participant_enqueue(participant, pkt);
 	}
 }
 
@@ -2939,13 +3279,14 @@ static void janus_audiobridge_hangup_media_internal(janus_plugin_session *handle
 
 /* Thread to handle incoming messages */
 static void *janus_audiobridge_handler(void *data) {
+	GAsyncQueue *queue = (GAsyncQueue *)data;
 	JANUS_LOG(LOG_VERB, "Joining AudioBridge handler thread\n");
 	janus_audiobridge_message *msg = NULL;
 	int error_code = 0;
 	char error_cause[512];
 	json_t *root = NULL;
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		msg = g_async_queue_pop(messages);
+		msg = g_async_queue_pop(queue);
 		if(msg == &exit_message)
 			break;
 		if(msg->handle == NULL) {
@@ -3108,6 +3449,7 @@ static void *janus_audiobridge_handler(void *data) {
 				participant->extmap_id = 0;
 				participant->dBov_level = 0;
 				participant->talking = FALSE;
+				participant->mix_level = 127;
 			}
 			JANUS_LOG(LOG_VERB, "Creating Opus encoder/decoder (sampling rate %d)\n", audiobridge->sampling_rate);
 			/* Opus encoder */
@@ -3167,8 +3509,8 @@ static void *janus_audiobridge_handler(void *data) {
 				}
 			}
 			participant->reset = FALSE;
-			/* Finally, start the encoding thread if it hasn't already */
-			if(participant->thread == NULL) {
+			/* Finally, start the encoding thread if it hasn't already (and we're not using workers) */
+			if(participant->thread == NULL && encoders == NULL) {
 				GError *error = NULL;
 				char roomtrunc[5], parttrunc[5];
 				g_snprintf(roomtrunc, sizeof(roomtrunc), "%"SCNu64, audiobridge->room_id);
@@ -3184,6 +3526,8 @@ static void *janus_audiobridge_handler(void *data) {
 			
 			/* Done */
 			session->participant = participant;
+			/* Keep the PeerConnection on the same NUMA node as the room mixer */
+			gateway->set_placement_group(session->handle, audiobridge->room_id);
 			g_hash_table_insert(audiobridge->participants, janus_uint64_dup(participant->user_id), participant);
 			/* Notify the other participants */
 			json_t *newuser = json_object();
@@ -3623,6 +3967,7 @@ static void *janus_audiobridge_handler(void *data) {
 			g_free(participant->display);
 			participant->display = display_text ? g_strdup(display_text) : NULL;
 			participant->room = audiobridge;
+			gateway->set_placement_group(session->handle, audiobridge->room_id);
 			participant->muted = muted ? json_is_true(muted) : FALSE;	/* When switching to a new room, you're unmuted by default */
 			participant->audio_active_packets = 0;
 			participant->audio_dBov_sum = 0;
@@ -3852,8 +4197,9 @@ static void *janus_audiobridge_handler(void *data) {
 			answer->s_name = g_strdup(s_name);
 			/* Add a fmtp attribute */
 			janus_sdp_attribute *a = janus_sdp_attribute_create("fmtp",
-				"%d maxplaybackrate=%"SCNu32"; stereo=0; sprop-stereo=0; useinbandfec=0\r\n",
-					participant->opus_pt, participant->room->sampling_rate);
+				"%d maxplaybackrate=%"SCNu32"; stereo=0; sprop-stereo=0; useinbandfec=1%s\r\n",
+					participant->opus_pt, participant->room->sampling_rate,
+					participant->room->dtx ? "; usedtx=1" : "");
 			janus_sdp_attribute_add_to_mline(janus_sdp_mline_find(answer, JANUS_SDP_AUDIO), a);
 			/* Is the audio level extension negotiated? */
 			participant->extmap_id = 0;
@@ -3924,298 +4270,770 @@ error:
 	return NULL;
 }
 
-/* Thread to mix the contributions from all participants */
-static void *janus_audiobridge_mixer_thread(void *data) {
-	JANUS_LOG(LOG_VERB, "Audio bridge thread starting...\n");
-	janus_audiobridge_room *audiobridge = (janus_audiobridge_room *)data;
-	if(!audiobridge) {
-		JANUS_LOG(LOG_ERR, "Invalid room!\n");
-		return NULL;
+/* Helper to sort participants by how loud they are (lower is louder) */
+static gint janus_audiobridge_level_sort(gconstpointer a, gconstpointer b) {
+	const janus_audiobridge_participant *p1 = (const janus_audiobridge_participant *)a;
+	const janus_audiobridge_participant *p2 = (const janus_audiobridge_participant *)b;
+	return p1->mix_level - p2->mix_level;
+}
+
+/* When a room only mixes the loudest participants, pick them for the next frame:
+ * participants that don't send audio levels can't be ranked, so they're always in */
+static void janus_audiobridge_select_speakers(janus_audiobridge_room *audiobridge, GList *participants) {
+	GList *candidates = NULL, *ps = participants;
+	while(ps) {
+		janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
+		if(p->extmap_id == 0)
+			g_atomic_int_set(&p->selected, 1);
+		else
+			candidates = g_list_prepend(candidates, p);
+		ps = ps->next;
+	}
+	candidates = g_list_sort(candidates, &janus_audiobridge_level_sort);
+	int n = 0;
+	ps = candidates;
+	while(ps) {
+		janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
+		if(n < audiobridge->max_speakers && p->active && !p->muted && p->mix_level < 127) {
+			n++;
+			g_atomic_int_set(&p->selected, 1);
+		} else if(g_atomic_int_compare_and_exchange(&p->selected, 1, 0)) {
+			/* Not loud enough anymore: get rid of what we decoded already */
+			janus_mutex_lock(&p->qmutex);
+			while(p->inbuf) {
+				GList *first = g_list_first(p->inbuf);
+				janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
+				p->inbuf = g_list_remove_link(p->inbuf, first);
+				first = NULL;
+				if(pkt == NULL)
+					continue;
+				if(pkt->data)
+					g_free(pkt->data);
+				pkt->data = NULL;
+				g_free(pkt);
+				pkt = NULL;
+			}
+			janus_mutex_unlock(&p->qmutex);
+		}
+		ps = ps->next;
 	}
-	JANUS_LOG(LOG_VERB, "Thread is for mixing room %"SCNu64" (%s) at rate %"SCNu32"...\n", audiobridge->room_id, audiobridge->room_name, audiobridge->sampling_rate);
+	g_list_free(candidates);
+}
 
-	/* Do we need to record the mix? */
-	if(audiobridge->record) {
-		char filename[255];
-		if(audiobridge->record_file) {
-			g_snprintf(filename, 255, "%s", audiobridge->record_file);
-		} else {
-			g_snprintf(filename, 255, "janus-audioroom-%"SCNu64".wav", audiobridge->room_id);
+/* Mixing kernels: the mixer adds the decoded samples of all participants
+ * to a 32-bit mix, and then removes each participant's own contribution
+ * to get what it should receive, saturating the result to 16-bit. These
+ * are the hottest loops in the plugin, so we use vectorized versions of
+ * both when the CPU supports them, picking the best one at startup */
+typedef void (*janus_audiobridge_mix_kernel)(opus_int32 *mix, const opus_int16 *samples, int count);
+typedef void (*janus_audiobridge_unmix_kernel)(opus_int16 *out, const opus_int32 *mix, const opus_int16 *samples, int count);
+
+static inline opus_int16 janus_audiobridge_saturate(opus_int32 sample) {
+	return sample > 32767 ? 32767 : (sample < -32768 ? -32768 : sample);
+}
+
+static void janus_audiobridge_mix_scalar(opus_int32 *mix, const opus_int16 *samples, int count) {
+	int i = 0;
+	for(i=0; i<count; i++)
+		mix[i] += samples[i];
+}
+
+/* Removes samples from the mix (if any) and saturates the result in out */
+static void janus_audiobridge_unmix_scalar(opus_int16 *out, const opus_int32 *mix, const opus_int16 *samples, int count) {
+	int i = 0;
+	for(i=0; i<count; i++)
+		out[i] = janus_audiobridge_saturate(mix[i] - (samples ? samples[i] : 0));
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JANUS_AUDIOBRIDGE_X86_KERNELS
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static void janus_audiobridge_mix_sse2(opus_int32 *mix, const opus_int16 *samples, int count) {
+	int i = 0;
+	for(; i+8<=count; i+=8) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(samples+i));
+		/* Sign-extend the 16-bit samples to 32-bit */
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+		_mm_storeu_si128((__m128i *)(mix+i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(mix+i)), lo));
+		_mm_storeu_si128((__m128i *)(mix+i+4), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(mix+i+4)), hi));
+	}
+	janus_audiobridge_mix_scalar(mix+i, samples+i, count-i);
+}
+
+__attribute__((target("sse2")))
+static void janus_audiobridge_unmix_sse2(opus_int16 *out, const opus_int32 *mix, const opus_int16 *samples, int count) {
+	int i = 0;
+	for(; i+8<=count; i+=8) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)(mix+i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(mix+i+4));
+		if(samples) {
+			__m128i s = _mm_loadu_si128((const __m128i *)(samples+i));
+			lo = _mm_sub_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+			hi = _mm_sub_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
 		}
-		audiobridge->recording = fopen(filename, "wb");
-		if(audiobridge->recording == NULL) {
-			JANUS_LOG(LOG_WARN, "Recording requested, but could NOT open file %s for writing...\n", filename);
-		} else {
-			JANUS_LOG(LOG_VERB, "Recording requested, opened file %s for writing\n", filename);
-			/* Write WAV header */
-			wav_header header = {
-				{'R', 'I', 'F', 'F'},
-				0,
-				{'W', 'A', 'V', 'E'},
-				{'f', 'm', 't', ' '},
-				16,
-				1,
-				1,
-				audiobridge->sampling_rate,
-				audiobridge->sampling_rate * 2,
-				2,
-				16,
-				{'d', 'a', 't', 'a'},
-				0
-			};
-			if(fwrite(&header, 1, sizeof(header), audiobridge->recording) != sizeof(header)) {
-				JANUS_LOG(LOG_ERR, "Error writing WAV header...\n");
-			}
-			fflush(audiobridge->recording);
-			audiobridge->record_lastupdate = janus_get_monotonic_time();
+		/* The pack saturates to 16-bit for us */
+		_mm_storeu_si128((__m128i *)(out+i), _mm_packs_epi32(lo, hi));
+	}
+	janus_audiobridge_unmix_scalar(out+i, mix+i, samples ? samples+i : NULL, count-i);
+}
+
+__attribute__((target("avx2")))
+static void janus_audiobridge_mix_avx2(opus_int32 *mix, const opus_int16 *samples, int count) {
+	int i = 0;
+	for(; i+16<=count; i+=16) {
+		__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples+i)));
+		__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples+i+8)));
+		_mm256_storeu_si256((__m256i *)(mix+i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(mix+i)), lo));
+		_mm256_storeu_si256((__m256i *)(mix+i+8), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(mix+i+8)), hi));
+	}
+	janus_audiobridge_mix_scalar(mix+i, samples+i, count-i);
+}
+
+__attribute__((target("avx2")))
+static void janus_audiobridge_unmix_avx2(opus_int16 *out, const opus_int32 *mix, const opus_int16 *samples, int count) {
+	int i = 0;
+	for(; i+16<=count; i+=16) {
+		__m256i lo = _mm256_loadu_si256((const __m256i *)(mix+i));
+		__m256i hi = _mm256_loadu_si256((const __m256i *)(mix+i+8));
+		if(samples) {
+			lo = _mm256_sub_epi32(lo, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples+i))));
+			hi = _mm256_sub_epi32(hi, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples+i+8))));
+		}
+		/* The pack saturates, but works within 128-bit lanes: fix the order */
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+		_mm256_storeu_si256((__m256i *)(out+i), packed);
+	}
+	janus_audiobridge_unmix_scalar(out+i, mix+i, samples ? samples+i : NULL, count-i);
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define JANUS_AUDIOBRIDGE_NEON_KERNELS
+#include <arm_neon.h>
+
+static void janus_audiobridge_mix_neon(opus_int32 *mix, const opus_int16 *samples, int count) {
+	int i = 0;
+	for(; i+8<=count; i+=8) {
+		int16x8_t s = vld1q_s16(samples+i);
+		vst1q_s32(mix+i, vaddw_s16(vld1q_s32(mix+i), vget_low_s16(s)));
+		vst1q_s32(mix+i+4, vaddw_s16(vld1q_s32(mix+i+4), vget_high_s16(s)));
+	}
+	janus_audiobridge_mix_scalar(mix+i, samples+i, count-i);
+}
+
+static void janus_audiobridge_unmix_neon(opus_int16 *out, const opus_int32 *mix, const opus_int16 *samples, int count) {
+	int i = 0;
+	for(; i+8<=count; i+=8) {
+		int32x4_t lo = vld1q_s32(mix+i);
+		int32x4_t hi = vld1q_s32(mix+i+4);
+		if(samples) {
+			int16x8_t s = vld1q_s16(samples+i);
+			lo = vsubw_s16(lo, vget_low_s16(s));
+			hi = vsubw_s16(hi, vget_high_s16(s));
 		}
+		/* Saturating narrow */
+		vst1q_s16(out+i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
 	}
+	janus_audiobridge_unmix_scalar(out+i, mix+i, samples ? samples+i : NULL, count-i);
+}
+#endif
+
+static janus_audiobridge_mix_kernel janus_audiobridge_mix = janus_audiobridge_mix_scalar;
+static janus_audiobridge_unmix_kernel janus_audiobridge_unmix = janus_audiobridge_unmix_scalar;
+
+/* Pick the mixing kernels to use, and check them against the scalar ones:
+ * this also works as a quick micro-benchmark, whose results we print */
+#define JANUS_AUDIOBRIDGE_KERNEL_RUNS	200
+static void janus_audiobridge_mixer_select(void) {
+	const char *name = "scalar";
+#if defined(JANUS_AUDIOBRIDGE_X86_KERNELS)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		janus_audiobridge_mix = janus_audiobridge_mix_avx2;
+		janus_audiobridge_unmix = janus_audiobridge_unmix_avx2;
+		name = "AVX2";
+	} else if(__builtin_cpu_supports("sse2")) {
+		janus_audiobridge_mix = janus_audiobridge_mix_sse2;
+		janus_audiobridge_unmix = janus_audiobridge_unmix_sse2;
+		name = "SSE2";
+	}
+#elif defined(JANUS_AUDIOBRIDGE_NEON_KERNELS)
+	janus_audiobridge_mix = janus_audiobridge_mix_neon;
+	janus_audiobridge_unmix = janus_audiobridge_unmix_neon;
+	name = "NEON";
+#endif
+	if(janus_audiobridge_mix == janus_audiobridge_mix_scalar) {
+		JANUS_LOG(LOG_INFO, "Using scalar audio mixing kernels\n");
+		return;
+	}
+	/* Mix the same frame many times, so that we get to saturate too (odd size to test the tails) */
+	int count = 957, i = 0, run = 0;
+	opus_int16 samples[960], out[960], ref_out[960];
+	opus_int32 mix[960], ref_mix[960];
+	for(i=0; i<count; i++) {
+		samples[i] = g_random_int_range(-32768, 32768);
+		mix[i] = ref_mix[i] = 0;
+	}
+	gint64 start = janus_get_monotonic_time();
+	for(run=0; run<JANUS_AUDIOBRIDGE_KERNEL_RUNS; run++) {
+		janus_audiobridge_mix(mix, samples, count);
+		janus_audiobridge_unmix(out, mix, run % 2 ? samples : NULL, count);
+	}
+	gint64 simd_time = janus_get_monotonic_time()-start;
+	start = janus_get_monotonic_time();
+	for(run=0; run<JANUS_AUDIOBRIDGE_KERNEL_RUNS; run++) {
+		janus_audiobridge_mix_scalar(ref_mix, samples, count);
+		janus_audiobridge_unmix_scalar(ref_out, ref_mix, run % 2 ? samples : NULL, count);
+	}
+	gint64 scalar_time = janus_get_monotonic_time()-start;
+	if(memcmp(mix, ref_mix, count*sizeof(opus_int32)) || memcmp(out, ref_out, count*sizeof(opus_int16))) {
+		JANUS_LOG(LOG_WARN, "%s audio mixing kernels don't match the scalar ones, falling back to scalar\n", name);
+		janus_audiobridge_mix = janus_audiobridge_mix_scalar;
+		janus_audiobridge_unmix = janus_audiobridge_unmix_scalar;
+		return;
+	}
+	JANUS_LOG(LOG_INFO, "Using %s audio mixing kernels (%d frames in %"SCNi64"us, %"SCNi64"us scalar)\n",
+		name, JANUS_AUDIOBRIDGE_KERNEL_RUNS, simd_time, scalar_time);
+}
+
+/* State of the mixer of a room: the mixer is a task driven by the timer
+ * service, that prepares a new frame every 20ms */
+typedef struct janus_audiobridge_mixer {
+	janus_audiobridge_room *room;
+	gint64 next;				/* When the next frame is due (monotonic) */
+	OpusEncoder *mix_encoder;	/* Encoder for the shared full mix */
+	unsigned char *mixbuffer;	/* Buffer for the shared full mix (payload of rtpbuffer) */
+	opus_int32 mix_length;
+	gboolean mix_encoded;
+	unsigned char *rtpbuffer;	/* Base RTP packet, in case there are forwarders involved */
+	janus_rtp_header *rtph;
+	char sbuf[1600];			/* Buffer for SRTP forwarders (with room for the auth tag) */
+	struct janus_audiobridge_wav_writer *wav;	/* Writer of the .wav recording of the mix, if any */
+	janus_recorder *mjr;		/* Recorder of the Opus encoded mix, if recording to .mjr */
+	guint16 mjr_seq;
+	guint32 mjr_ts;
+	gint16 seq;
+	gint32 ts;
+	int prev_count;
+} janus_audiobridge_mixer;
+
+/* Recording the mix to a .wav file means lots of small writes and a
+ * periodic header update: none of that should ever delay the mixer, so
+ * we queue the frames for a dedicated thread instead, and drop them if
+ * the disk can't keep up. Opus (.mjr) recordings use janus_recorder,
+ * and so are written asynchronously when recordings_writers is set */
+typedef struct janus_audiobridge_wav_writer {
+	gchar *filename;
+	FILE *file;
+	GAsyncQueue *frames;
+	volatile gint dropped;
+} janus_audiobridge_wav_writer;
+/* How many frames can be queued before we start dropping (5 seconds) */
+#define JANUS_AUDIOBRIDGE_WAV_QUEUE	250
+/* Frame that tells the writer the recording is over */
+static char janus_audiobridge_wav_eos;
+
+/* Helper to update the lengths in the header of a .wav recording */
+static void janus_audiobridge_wav_update_header(FILE *file) {
+	fseek(file, 0, SEEK_END);
+	long int size = ftell(file);
+	if(size >= 44) {
+		uint32_t len = size - 8;
+		fseek(file, 4, SEEK_SET);
+		fwrite(&len, sizeof(uint32_t), 1, file);
+		len = size - 44;
+		fseek(file, 40, SEEK_SET);
+		fwrite(&len, sizeof(uint32_t), 1, file);
+		fflush(file);
+		fseek(file, 0, SEEK_END);
+	}
+}
+
+static void *janus_audiobridge_wav_writer_thread(void *data) {
+	janus_audiobridge_wav_writer *writer = (janus_audiobridge_wav_writer *)data;
+	JANUS_LOG(LOG_VERB, "Joining .wav writer thread (%s)\n", writer->filename);
+	gint64 lastupdate = janus_get_monotonic_time();
+	gboolean failed = FALSE;
+	while(TRUE) {
+		gpointer frame = g_async_queue_pop(writer->frames);
+		if(frame == &janus_audiobridge_wav_eos)
+			break;
+		gsize len = 0;
+		gconstpointer samples = g_bytes_get_data((GBytes *)frame, &len);
+		if(fwrite(samples, 1, len, writer->file) != len && !failed) {
+			JANUS_LOG(LOG_ERR, "Error saving mix to %s: %d (%s)\n", writer->filename, errno, strerror(errno));
+			failed = TRUE;
+		}
+		g_bytes_unref((GBytes *)frame);
+		/* Every 5 seconds we update the wav header */
+		gint64 now = janus_get_monotonic_time();
+		if(now - lastupdate >= 5*G_USEC_PER_SEC) {
+			lastupdate = now;
+			janus_audiobridge_wav_update_header(writer->file);
+		}
+	}
+	janus_audiobridge_wav_update_header(writer->file);
+	fclose(writer->file);
+	int dropped = g_atomic_int_get(&writer->dropped);
+	if(dropped > 0)
+		JANUS_LOG(LOG_WARN, "%d frames dropped, as the disk couldn't keep up: %s\n", dropped, writer->filename);
+	JANUS_LOG(LOG_VERB, "Leaving .wav writer thread (%s)\n", writer->filename);
+	g_async_queue_unref(writer->frames);
+	g_free(writer->filename);
+	g_free(writer);
+	return NULL;
+}
+
+/* Open the .wav recording and start its writer thread */
+static janus_audiobridge_wav_writer *janus_audiobridge_wav_writer_start(const char *filename, uint32_t sampling_rate) {
+	FILE *file = fopen(filename, "wb");
+	if(file == NULL) {
+		JANUS_LOG(LOG_WARN, "Recording requested, but could NOT open file %s for writing...\n", filename);
+		return NULL;
+	}
+	JANUS_LOG(LOG_VERB, "Recording requested, opened file %s for writing\n", filename);
+	/* Write WAV header */
+	wav_header header = {
+		{'R', 'I', 'F', 'F'},
+		0,
+		{'W', 'A', 'V', 'E'},
+		{'f', 'm', 't', ' '},
+		16,
+		1,
+		1,
+		sampling_rate,
+		sampling_rate * 2,
+		2,
+		16,
+		{'d', 'a', 't', 'a'},
+		0
+	};
+	if(fwrite(&header, 1, sizeof(header), file) != sizeof(header)) {
+		JANUS_LOG(LOG_ERR, "Error writing WAV header...\n");
+	}
+	fflush(file);
+	janus_audiobridge_wav_writer *writer = g_malloc0(sizeof(janus_audiobridge_wav_writer));
+	writer->filename = g_strdup(filename);
+	writer->file = file;
+	writer->frames = g_async_queue_new();
+	GError *error = NULL;
+	GThread *thread = g_thread_try_new("abwav", &janus_audiobridge_wav_writer_thread, writer, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the .wav writer thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		fclose(file);
+		g_async_queue_unref(writer->frames);
+		g_free(writer->filename);
+		g_free(writer);
+		return NULL;
+	}
+	/* The thread frees the writer by itself when done */
+	g_thread_unref(thread);
+	return writer;
+}
+
+static void janus_audiobridge_mixer_free(janus_audiobridge_mixer *mixer) {
+	if(mixer->wav != NULL)
+		g_async_queue_push(mixer->wav->frames, &janus_audiobridge_wav_eos);
+	mixer->wav = NULL;
+	if(mixer->mjr != NULL) {
+		janus_recorder_close(mixer->mjr);
+		JANUS_LOG(LOG_INFO, "Closed room recording %s\n", mixer->mjr->filename ? mixer->mjr->filename : "??");
+		janus_recorder_free(mixer->mjr);
+	}
+	mixer->mjr = NULL;
+	g_free(mixer->rtpbuffer);
+	if(mixer->mix_encoder)
+		opus_encoder_destroy(mixer->mix_encoder);
+	g_free(mixer);
+}
+
+/* Helper to encode the shared full mix, at most once per frame */
+static opus_int32 janus_audiobridge_mixer_encode(janus_audiobridge_mixer *mixer,
+		opus_int16 *outBuffer, const opus_int32 *buffer, int samples) {
+	if(!mixer->mix_encoded) {
+		mixer->mix_encoded = TRUE;
+		janus_audiobridge_unmix(outBuffer, buffer, NULL, samples);
+		mixer->mix_length = opus_encode(mixer->mix_encoder, outBuffer, samples, mixer->mixbuffer, 1500-12);
+		if(mixer->mix_length < 0)
+			JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the shared Opus frame: %d (%s)\n", mixer->mix_length, opus_strerror(mixer->mix_length));
+	}
+	return mixer->mix_length;
+}
+
+static gint64 janus_audiobridge_mixer_tick(gint64 now, gpointer data) {
+	janus_audiobridge_mixer *mixer = (janus_audiobridge_mixer *)data;
+	janus_audiobridge_room *audiobridge = mixer->room;
+	if(g_atomic_int_get(&stopping) || audiobridge->destroyed != 0) {	/* FIXME We need a per-room watchdog as well */
+		/* This also closes the recording of the mix, if any */
+		janus_audiobridge_mixer_free(mixer);
+		JANUS_LOG(LOG_VERB, "Leaving mixer for room %"SCNu64" (%s)...\n", audiobridge->room_id, audiobridge->room_name);
+		/* We'll let the watchdog worry about free resources */
+		old_rooms = g_list_append(old_rooms, audiobridge);
+		return -1;
+	}
+	if(mixer->next == 0) {
+		/* First tick */
+		JANUS_LOG(LOG_VERB, "Mixing room %"SCNu64" (%s) at rate %"SCNu32"...\n", audiobridge->room_id, audiobridge->room_name, audiobridge->sampling_rate);
+		mixer->next = now;
+	}
+	/* Schedule the next frame: we don't use the current time as a reference,
+	 * as the deadlines would otherwise drift because of the processing */
+	gint64 due = mixer->next;
+	mixer->next += 20000;
 
 	/* Buffer (we allocate assuming 48kHz, although we'll likely use less than that) */
 	int samples = audiobridge->sampling_rate/50;
 	opus_int32 buffer[960], sumBuffer[960];
 	opus_int16 outBuffer[960], *curBuffer = NULL;
-	memset(buffer, 0, 960*4);
-	memset(sumBuffer, 0, 960*4);
-	memset(outBuffer, 0, 960*2);
-
-	/* Base RTP packet, in case there are forwarders involved */
-	unsigned char *rtpbuffer = g_malloc0(1500);
-	janus_rtp_header *rtph = (janus_rtp_header *)rtpbuffer;
-	rtph->version = 2;
-
-	/* Timer */
-	struct timeval now, before;
-	gettimeofday(&before, NULL);
-	now.tv_sec = before.tv_sec;
-	now.tv_usec = before.tv_usec;
-	time_t passed, d_s, d_us;
-
-	/* RTP */
-	gint16 seq = 0;
-	gint32 ts = 0;
-
-	/* Loop */
-	int i=0;
-	int count = 0, rf_count = 0, prev_count = 0;
-	while(!g_atomic_int_get(&stopping) && audiobridge->destroyed == 0) {	/* FIXME We need a per-room watchdog as well */
-		/* See if it's time to prepare a frame */
-		gettimeofday(&now, NULL);
-		d_s = now.tv_sec - before.tv_sec;
-		d_us = now.tv_usec - before.tv_usec;
-		if(d_us < 0) {
-			d_us += 1000000;
-			--d_s;
+	int i = 0, count = 0, rf_count = 0;
+
+	/* Do we need to mix at all? */
+	janus_mutex_lock_nodebug(&audiobridge->mutex);
+	count = g_hash_table_size(audiobridge->participants);
+	rf_count = g_hash_table_size(audiobridge->rtp_forwarders);
+	janus_mutex_unlock_nodebug(&audiobridge->mutex);
+	if((count+rf_count) == 0) {
+		/* No participant and RTP forwarders, do nothing */
+		if(mixer->prev_count > 0) {
+			JANUS_LOG(LOG_VERB, "Last user/forwarder just left room %"SCNu64", going idle...\n", audiobridge->room_id);
+			mixer->prev_count = 0;
 		}
-		passed = d_s*1000000 + d_us;
-		if(passed < 15000) {	/* Let's wait about 15ms at max */
-			g_usleep(5000);
+		return mixer->next;
+	}
+	if(mixer->prev_count == 0) {
+		JANUS_LOG(LOG_VERB, "First user/forwarder just joined room %"SCNu64", waking it up...\n", audiobridge->room_id);
+	}
+	mixer->prev_count = count+rf_count;
+	/* Update RTP header information */
+	mixer->seq++;
+	mixer->ts += 960;
+	/* Mix all contributions */
+	janus_mutex_lock_nodebug(&audiobridge->mutex);
+	GList *participants_list = g_hash_table_get_values(audiobridge->participants);
+	janus_mutex_unlock_nodebug(&audiobridge->mutex);
+	if(audiobridge->max_speakers > 0)
+		janus_audiobridge_select_speakers(audiobridge, participants_list);
+	for(i=0; i<samples; i++)
+		buffer[i] = 0;
+	GList *ps = participants_list;
+	while(ps) {
+		janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
+		janus_mutex_lock(&p->qmutex);
+		if(!p->session || !p->session->started || !p->active || p->muted || p->prebuffering || !p->inbuf) {
+			janus_mutex_unlock(&p->qmutex);
+			ps = ps->next;
 			continue;
 		}
-		/* Update the reference time */
-		before.tv_usec += 20000;
-		if(before.tv_usec > 1000000) {
-			before.tv_sec++;
-			before.tv_usec -= 1000000;
-		}
-		/* Do we need to mix at all? */
-		janus_mutex_lock_nodebug(&audiobridge->mutex);
-		count = g_hash_table_size(audiobridge->participants);
-		rf_count = g_hash_table_size(audiobridge->rtp_forwarders);
-		janus_mutex_unlock_nodebug(&audiobridge->mutex);
-		if((count+rf_count) == 0) {
-			/* No participant and RTP forwarders, do nothing */
-			if(prev_count > 0) {
-				JANUS_LOG(LOG_VERB, "Last user/forwarder just left room %"SCNu64", going idle...\n", audiobridge->room_id);
-				prev_count = 0;
+		GList *peek = g_list_first(p->inbuf);
+		janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)(peek ? peek->data : NULL);
+		if(pkt != NULL && !pkt->silence) {
+			curBuffer = (opus_int16 *)pkt->data;
+			if(p->volume_gain == 100) {
+				janus_audiobridge_mix(buffer, curBuffer, samples);
+			} else {
+				for(i=0; i<samples; i++)
+					buffer[i] += (curBuffer[i]*p->volume_gain)/100;
 			}
-			continue;
 		}
-		if(prev_count == 0) {
-			JANUS_LOG(LOG_VERB, "First user/forwarder just joined room %"SCNu64", waking it up...\n", audiobridge->room_id);
+		janus_mutex_unlock(&p->qmutex);
+		ps = ps->next;
+	}
+	mixer->mix_encoded = FALSE;
+	mixer->mix_length = 0;
+	/* Are we recording the mix? (only do it if there's someone in, though...) */
+	if(mixer->wav != NULL && g_list_length(participants_list) > 0) {
+		/* FIXME Smoothen/Normalize instead of saturating? */
+		janus_audiobridge_unmix(outBuffer, buffer, NULL, samples);
+		if(g_async_queue_length(mixer->wav->frames) < JANUS_AUDIOBRIDGE_WAV_QUEUE) {
+			g_async_queue_push(mixer->wav->frames, g_bytes_new(outBuffer, samples*sizeof(opus_int16)));
+		} else if(g_atomic_int_add(&mixer->wav->dropped, 1) == 0) {
+			JANUS_LOG(LOG_WARN, "Recording queue full, dropping frames: %s\n", mixer->wav->filename);
 		}
-		prev_count = count+rf_count;
-		/* Update RTP header information */
-		seq++;
-		ts += 960;
-		/* Mix all contributions */
-		janus_mutex_lock_nodebug(&audiobridge->mutex);
-		GList *participants_list = g_hash_table_get_values(audiobridge->participants);
-		janus_mutex_unlock_nodebug(&audiobridge->mutex);
-		for(i=0; i<samples; i++)
-			buffer[i] = 0;
-		GList *ps = participants_list;
-		while(ps) {
-			janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
-			janus_mutex_lock(&p->qmutex);
-			if(!p->session || !p->session->started || !p->active || p->muted || p->prebuffering || !p->inbuf) {
-				janus_mutex_unlock(&p->qmutex);
-				ps = ps->next;
-				continue;
-			}
-			GList *peek = g_list_first(p->inbuf);
-			janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)(peek ? peek->data : NULL);
-			if(pkt != NULL && !pkt->silence) {
-				curBuffer = (opus_int16 *)pkt->data;
-				for(i=0; i<samples; i++) {
-					if(p->volume_gain == 100) {
-						buffer[i] += curBuffer[i];
-					} else {
-						buffer[i] += (curBuffer[i]*p->volume_gain)/100;
-					}
-				}
-			}
-			janus_mutex_unlock(&p->qmutex);
+	}
+	if(mixer->mjr != NULL && g_list_length(participants_list) > 0) {
+		/* Record the same shared mix that we send around */
+		opus_int32 length = janus_audiobridge_mixer_encode(mixer, outBuffer, buffer, samples);
+		if(length > 0) {
+			mixer->rtph->type = MJR_OPUS_PT;
+			mixer->rtph->ssrc = htonl(audiobridge->room_id);
+			mixer->rtph->seq_number = htons(mixer->mjr_seq++);
+			mixer->rtph->timestamp = htonl(mixer->mjr_ts);
+			janus_recorder_save_frame(mixer->mjr, (char *)mixer->rtpbuffer, length+12);
+		}
+		mixer->mjr_ts += 960;
+	}
+	/* Send proper packet to each participant (remove own contribution) */
+	ps = participants_list;
+	while(ps) {
+		janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
+		if(!p->session || !p->session->started) {
 			ps = ps->next;
+			continue;
 		}
-		/* Are we recording the mix? (only do it if there's someone in, though...) */
-		if(audiobridge->recording != NULL && g_list_length(participants_list) > 0) {
-			for(i=0; i<samples; i++) {
-				/* FIXME Smoothen/Normalize instead of truncating? */
-				outBuffer[i] = buffer[i];
-			}
-			fwrite(outBuffer, sizeof(opus_int16), samples, audiobridge->recording);
-			/* Every 5 seconds we update the wav header */
-			gint64 now = janus_get_monotonic_time();
-			if(now - audiobridge->record_lastupdate >= 5*G_USEC_PER_SEC) {
-				audiobridge->record_lastupdate = now;
-				/* Update the length in the header */
-				fseek(audiobridge->recording, 0, SEEK_END);
-				long int size = ftell(audiobridge->recording);
-				if(size >= 8) {
-					size -= 8;
-					fseek(audiobridge->recording, 4, SEEK_SET);
-					fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
-					size += 8;
-					fseek(audiobridge->recording, 40, SEEK_SET);
-					fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
-					fflush(audiobridge->recording);
-					fseek(audiobridge->recording, 0, SEEK_END);
-				}
-			}
+		janus_audiobridge_rtp_relay_packet *pkt = NULL;
+		janus_mutex_lock(&p->qmutex);
+		if(p->active && !p->muted && !p->prebuffering && p->inbuf) {
+			GList *first = g_list_first(p->inbuf);
+			pkt = (janus_audiobridge_rtp_relay_packet *)(first ? first->data : NULL);
+			p->inbuf = g_list_delete_link(p->inbuf, first);
 		}
-		/* Send proper packet to each participant (remove own contribution) */
-		ps = participants_list;
-		while(ps) {
-			janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
-			if(!p->session || !p->session->started) {
-				ps = ps->next;
-				continue;
-			}
-			janus_audiobridge_rtp_relay_packet *pkt = NULL;
-			janus_mutex_lock(&p->qmutex);
-			if(p->active && !p->muted && !p->prebuffering && p->inbuf) {
-				GList *first = g_list_first(p->inbuf);
-				pkt = (janus_audiobridge_rtp_relay_packet *)(first ? first->data : NULL);
-				p->inbuf = g_list_delete_link(p->inbuf, first);
+		janus_mutex_unlock(&p->qmutex);
+		curBuffer = (opus_int16 *)((pkt && !pkt->silence) ? pkt->data : NULL);
+		janus_audiobridge_rtp_relay_packet *mixedpkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
+		mixedpkt->encoded = FALSE;
+		if(curBuffer != NULL)
+			p->quiet_frames = 0;
+		else if(p->quiet_frames < JANUS_AUDIOBRIDGE_SHARED_MIX_HOLD)
+			p->quiet_frames++;
+		if(curBuffer == NULL && p->quiet_frames >= JANUS_AUDIOBRIDGE_SHARED_MIX_HOLD &&
+				mixer->mix_encoder != NULL && p->opus_complexity == DEFAULT_COMPLEXITY) {
+			/* Not contributing for a while: use the shared full mix, encoding it if nobody asked before */
+			if(janus_audiobridge_mixer_encode(mixer, outBuffer, buffer, samples) > 0) {
+				mixedpkt->data = g_malloc(mixer->mix_length);
+				memcpy(mixedpkt->data, mixer->mixbuffer, mixer->mix_length);
+				mixedpkt->length = mixer->mix_length;	/* This is the payload length, instead */
+				mixedpkt->encoded = TRUE;
 			}
-			janus_mutex_unlock(&p->qmutex);
-			curBuffer = (opus_int16 *)((pkt && !pkt->silence) ? pkt->data : NULL);
-			for(i=0; i<samples; i++) {
-				if(p->volume_gain == 100)
-					sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]) : 0);
-				else
-					sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]*p->volume_gain)/100 : 0);
-			}
-			for(i=0; i<samples; i++)
-				/* FIXME Smoothen/Normalize instead of truncating? */
-				outBuffer[i] = sumBuffer[i];
+		}
+		if(!mixedpkt->encoded) {
 			/* Enqueue this mixed frame for encoding in the participant thread */
-			janus_audiobridge_rtp_relay_packet *mixedpkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
 			mixedpkt->data = g_malloc(samples*2);
-			memcpy(mixedpkt->data, outBuffer, samples*2);
+			/* FIXME Smoothen/Normalize instead of saturating? */
+			if(p->volume_gain == 100 || curBuffer == NULL) {
+				janus_audiobridge_unmix((opus_int16 *)mixedpkt->data, buffer, curBuffer, samples);
+			} else {
+				for(i=0; i<samples; i++)
+					sumBuffer[i] = buffer[i] - (curBuffer[i]*p->volume_gain)/100;
+				janus_audiobridge_unmix((opus_int16 *)mixedpkt->data, sumBuffer, NULL, samples);
+			}
 			mixedpkt->length = samples;	/* We set the number of samples here, not the data length */
-			mixedpkt->timestamp = ts;
-			mixedpkt->seq_number = seq;
-			mixedpkt->ssrc = audiobridge->room_id;
-			mixedpkt->silence = FALSE;
-			g_async_queue_push(p->outbuf, mixedpkt);
-			if(pkt) {
-				if(pkt->data)
-					g_free(pkt->data);
-				pkt->data = NULL;
-				g_free(pkt);
-				pkt = NULL;
+		}
+		mixedpkt->timestamp = mixer->ts;
+		mixedpkt->seq_number = mixer->seq;
+		mixedpkt->ssrc = audiobridge->room_id;
+		mixedpkt->silence = FALSE;
+		g_async_queue_push(p->outbuf, mixedpkt);
+		if(encoders != NULL && g_atomic_int_compare_and_exchange(&p->encoding, 0, 1))
+			g_thread_pool_push(encoders, p, NULL);
+		if(pkt) {
+			if(pkt->data)
+				g_free(pkt->data);
+			pkt->data = NULL;
+			g_free(pkt);
+			pkt = NULL;
+		}
+		ps = ps->next;
+	}
+	g_list_free(participants_list);
+	/* Forward the mixed packet as RTP to any RTP forwarder that may be listening */
+	janus_mutex_lock(&audiobridge->rtp_mutex);
+	if(g_hash_table_size(audiobridge->rtp_forwarders) > 0 && (mixer->mix_encoder || audiobridge->rtp_encoder)) {
+		/* If the room is empty, check if there's any RTP forwarder with an "always on" option */
+		gboolean go_on = FALSE;
+		if(count == 0) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_audiobridge_rtp_forwarder* forwarder = (janus_audiobridge_rtp_forwarder *)value;
+				if(forwarder->always_on) {
+					go_on = TRUE;
+					break;
+				}
 			}
-			ps = ps->next;
+		} else {
+			go_on = TRUE;
 		}
-		g_list_free(participants_list);
-		/* Forward the mixed packet as RTP to any RTP forwarder that may be listening */
-		janus_mutex_lock(&audiobridge->rtp_mutex);
-		if(g_hash_table_size(audiobridge->rtp_forwarders) > 0 && audiobridge->rtp_encoder) {
-			/* If the room is empty, check if there's any RTP forwarder with an "always on" option */
-			gboolean go_on = FALSE;
-			if(count == 0) {
+		if(go_on) {
+			/* Encode the mixed frame first: this is the same shared mix the non-talking
+			 * participants get, so it may have been encoded already for this frame */
+			opus_int32 length = 0;
+			if(mixer->mix_encoder) {
+				length = janus_audiobridge_mixer_encode(mixer, outBuffer, buffer, samples);
+			} else {
+				janus_audiobridge_unmix(outBuffer, buffer, NULL, samples);
+				length = opus_encode(audiobridge->rtp_encoder, outBuffer, samples, mixer->rtpbuffer+12, 1500-12);
+			}
+			if(length < 0) {
+				JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", length, opus_strerror(length));
+			} else {
+				/* Then send it to everybody */
 				GHashTableIter iter;
-				gpointer value;
+				gpointer key, value;
 				g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
-				while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				while(g_hash_table_iter_next(&iter, &key, &value)) {
+					guint32 stream_id = GPOINTER_TO_UINT(key);
 					janus_audiobridge_rtp_forwarder* forwarder = (janus_audiobridge_rtp_forwarder *)value;
-					if(forwarder->always_on) {
-						go_on = TRUE;
-						break;
-					}
-				}
-			} else {
-				go_on = TRUE;
-			}
-			if(go_on) {
-				/* Encode the mixed frame first*/
-				for(i=0; i<samples; i++)
-					outBuffer[i] = buffer[i];
-				opus_int32 length = opus_encode(audiobridge->rtp_encoder, outBuffer, samples, rtpbuffer+12, 1500-12);
-				if(length < 0) {
-					JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", length, opus_strerror(length));
-				} else {
-					/* Then send it to everybody */
-					GHashTableIter iter;
-					gpointer key, value;
-					g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
-					while(audiobridge->rtp_udp_sock > 0 && g_hash_table_iter_next(&iter, &key, &value)) {
-						guint32 stream_id = GPOINTER_TO_UINT(key);
-						janus_audiobridge_rtp_forwarder* forwarder = (janus_audiobridge_rtp_forwarder *)value;
-						if(count == 0 && !forwarder->always_on)
+					if(count == 0 && !forwarder->always_on)
+						continue;
+					/* Update header */
+					mixer->rtph->type = forwarder->payload_type;
+					mixer->rtph->ssrc = htonl(forwarder->ssrc ? forwarder->ssrc : stream_id);
+					forwarder->seq_number++;
+					mixer->rtph->seq_number = htons(forwarder->seq_number);
+					forwarder->timestamp += 960;
+					mixer->rtph->timestamp = htonl(forwarder->timestamp);
+					int fd = forwarder->fd > 0 ? forwarder->fd : audiobridge->rtp_udp_sock;
+					if(fd <= 0)
+						continue;
+					char *pkt = (char *)mixer->rtpbuffer;
+					int pktlen = length+12;
+					if(forwarder->is_srtp) {
+						/* Each forwarder has its own SSRC and keys, so we protect a copy */
+						memcpy(mixer->sbuf, mixer->rtpbuffer, pktlen);
+						int res = srtp_protect(forwarder->srtp_ctx, mixer->sbuf, &pktlen);
+						if(res != srtp_err_status_ok) {
+							JANUS_LOG(LOG_HUGE, "Error encrypting mixed RTP packet for room %"SCNu64"... %s (len=%d)...\n",
+								audiobridge->room_id, janus_srtp_error_str(res), length+12);
 							continue;
-						/* Update header */
-						rtph->type = forwarder->payload_type;
-						rtph->ssrc = htonl(forwarder->ssrc ? forwarder->ssrc : stream_id);
-						forwarder->seq_number++;
-						rtph->seq_number = htons(forwarder->seq_number);
-						forwarder->timestamp += 960;
-						rtph->timestamp = htonl(forwarder->timestamp);
-						/* Send RTP packet */
-						if(sendto(audiobridge->rtp_udp_sock, rtpbuffer, length+12, 0, (struct sockaddr*)&forwarder->serv_addr, sizeof(forwarder->serv_addr)) < 0) {
-							JANUS_LOG(LOG_HUGE, "Error forwarding mixed RTP packet for room %"SCNu64"... %s (len=%d)...\n",
-								audiobridge->room_id, strerror(errno), length+12);
 						}
+						pkt = mixer->sbuf;
+					}
+					/* Send RTP packet */
+					if(sendto(fd, pkt, pktlen, 0, (struct sockaddr*)&forwarder->serv_addr, sizeof(forwarder->serv_addr)) < 0) {
+						JANUS_LOG(LOG_HUGE, "Error forwarding mixed RTP packet for room %"SCNu64"... %s (len=%d)...\n",
+							audiobridge->room_id, strerror(errno), pktlen);
 					}
 				}
 			}
 		}
-		janus_mutex_unlock(&audiobridge->rtp_mutex);
 	}
-	if(audiobridge->recording) {
-		/* Update the length in the header */
-		fseek(audiobridge->recording, 0, SEEK_END);
-		long int size = ftell(audiobridge->recording);
-		if(size >= 8) {
-			size -= 8;
-			fseek(audiobridge->recording, 4, SEEK_SET);
-			fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
-			size += 8;
-			fseek(audiobridge->recording, 40, SEEK_SET);
-			fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
-			fflush(audiobridge->recording);
-			fclose(audiobridge->recording);
+	janus_mutex_unlock(&audiobridge->rtp_mutex);
+
+	/* Keep track of how close we got to missing the deadline */
+	gint64 took = janus_get_monotonic_time() - due;
+	for(i=0; i<JANUS_AUDIOBRIDGE_MIX_BUCKETS-1; i++) {
+		if(took < janus_audiobridge_mix_buckets[i])
+			break;
+	}
+	janus_mutex_lock_nodebug(&audiobridge->mutex);
+	audiobridge->mix_ticks[i]++;
+	if(took > audiobridge->mix_max)
+		audiobridge->mix_max = took;
+	janus_mutex_unlock_nodebug(&audiobridge->mutex);
+
+	return mixer->next;
+}
+
+static janus_timer_task *janus_audiobridge_mixer_start(janus_audiobridge_room *audiobridge) {
+	janus_audiobridge_mixer *mixer = g_malloc0(sizeof(janus_audiobridge_mixer));
+	mixer->room = audiobridge;
+	/* Participants that aren't contributing any audio all get the full mix: we
+	 * encode it once per frame here, instead of once per participant, using
+	 * the same settings they'd use by default (DEFAULT_COMPLEXITY) */
+	int error = 0;
+	mixer->rtpbuffer = g_malloc0(1500);
+	mixer->rtph = (janus_rtp_header *)mixer->rtpbuffer;
+	mixer->rtph->version = 2;
+	/* The shared mix is encoded right after the RTP header used by the forwarders */
+	mixer->mixbuffer = mixer->rtpbuffer+12;
+	OpusEncoder *mix_encoder = opus_encoder_create(audiobridge->sampling_rate, 1, OPUS_APPLICATION_VOIP, &error);
+	if(error != OPUS_OK) {
+		JANUS_LOG(LOG_WARN, "Error creating Opus encoder for the shared mix (room %"SCNu64"), participants will encode their own\n", audiobridge->room_id);
+		mix_encoder = NULL;
+	} else {
+		if(audiobridge->sampling_rate == 8000) {
+			opus_encoder_ctl(mix_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_NARROWBAND));
+		} else if(audiobridge->sampling_rate == 12000) {
+			opus_encoder_ctl(mix_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_MEDIUMBAND));
+		} else if(audiobridge->sampling_rate == 16000) {
+			opus_encoder_ctl(mix_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_WIDEBAND));
+		} else if(audiobridge->sampling_rate == 24000) {
+			opus_encoder_ctl(mix_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_SUPERWIDEBAND));
+		} else if(audiobridge->sampling_rate == 48000) {
+			opus_encoder_ctl(mix_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_FULLBAND));
+		} else {
+			opus_encoder_ctl(mix_encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_WIDEBAND));
+		}
+		opus_encoder_ctl(mix_encoder, OPUS_SET_INBAND_FEC(USE_FEC));
+		opus_encoder_ctl(mix_encoder, OPUS_SET_COMPLEXITY(DEFAULT_COMPLEXITY));
+	}
+	mixer->mix_encoder = mix_encoder;
+
+	/* Do we need to record the mix? */
+	if(audiobridge->record) {
+		char filename[255];
+		if(audiobridge->record_mjr) {
+			/* The recorder adds the .mjr extension by itself */
+			if(audiobridge->record_file) {
+				g_snprintf(filename, 255, "%s", audiobridge->record_file);
+				size_t len = strlen(filename);
+				if(len > 4 && !strcasecmp(filename+len-4, ".mjr"))
+					filename[len-4] = '\0';
+			} else {
+				g_snprintf(filename, 255, "janus-audioroom-%"SCNu64, audiobridge->room_id);
+			}
+			if(mixer->mix_encoder == NULL) {
+				JANUS_LOG(LOG_WARN, "Recording requested, but there's no Opus encoder for the mix...\n");
+			} else {
+				mixer->mjr = janus_recorder_create(NULL, "opus", filename);
+				if(mixer->mjr == NULL)
+					JANUS_LOG(LOG_WARN, "Recording requested, but could NOT open file %s.mjr for writing...\n", filename);
+				else
+					JANUS_LOG(LOG_VERB, "Recording requested, opened file %s for writing\n", mixer->mjr->filename);
+			}
+		} else {
+			if(audiobridge->record_file) {
+				g_snprintf(filename, 255, "%s", audiobridge->record_file);
+			} else {
+				g_snprintf(filename, 255, "janus-audioroom-%"SCNu64".wav", audiobridge->room_id);
+			}
+			mixer->wav = janus_audiobridge_wav_writer_start(filename, audiobridge->sampling_rate);
 		}
 	}
-	g_free(rtpbuffer);
-	JANUS_LOG(LOG_VERB, "Leaving mixer thread for room %"SCNu64" (%s)...\n", audiobridge->room_id, audiobridge->room_name);
 
-	/* We'll let the watchdog worry about free resources */
-	old_rooms = g_list_append(old_rooms, audiobridge);
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "mixer %"SCNu64, audiobridge->room_id);
+	/* The mixer runs on the same NUMA node as the participants of the room, if NUMA aware */
+	janus_timer_task *task = janus_timer_add_placed(tname, janus_get_monotonic_time(), janus_audiobridge_mixer_tick, mixer, audiobridge->room_id);
+	if(task == NULL)
+		janus_audiobridge_mixer_free(mixer);
+	return task;
+}
 
-	return NULL;
+/* Helper to encode a mixed frame and send it to a specific participant */
+static void janus_audiobridge_participant_encode(janus_audiobridge_participant *participant,
+		janus_audiobridge_rtp_relay_packet *mixedpkt, janus_audiobridge_rtp_relay_packet *outpkt) {
+	janus_audiobridge_session *session = participant->session;
+	unsigned char *payload = (unsigned char *)outpkt->data;
+	if(session->destroyed == 0 && session->started) {
+		if(participant->active && (mixedpkt->encoded || participant->encoder)) {
+			if(mixedpkt->encoded) {
+				/* The mixer encoded this for us already (shared full mix) */
+				memcpy(payload+12, mixedpkt->data, mixedpkt->length);
+				outpkt->length = mixedpkt->length;
+			} else {
+				/* Encode raw frame to Opus */
+				participant->working = TRUE;
+				opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
+				outpkt->length = opus_encode(participant->encoder, outBuffer, mixedpkt->length, payload+12, BUFFER_SAMPLES-12);
+				participant->working = FALSE;
+			}
+			if(outpkt->length < 0) {
+				JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", outpkt->length, opus_strerror(outpkt->length));
+			} else {
+				outpkt->length += 12;	/* Take the RTP header into consideration */
+				/* Update RTP header */
+				outpkt->data->version = 2;
+				outpkt->data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
+				outpkt->data->seq_number = htons(mixedpkt->seq_number);
+				outpkt->data->timestamp = htonl(mixedpkt->timestamp);
+				outpkt->data->ssrc = htonl(mixedpkt->ssrc);	/* The gateway will fix this anyway */
+				/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
+				outpkt->ssrc = mixedpkt->ssrc;
+				outpkt->timestamp = mixedpkt->timestamp;
+				outpkt->seq_number = mixedpkt->seq_number;
+				janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
+			}
+		}
+	}
+	if(mixedpkt->data)
+		g_free(mixedpkt->data);
+	mixedpkt->data = NULL;
+	g_free(mixedpkt);
 }
 
 /* Thread to encode a mixed frame and send it to a specific participant */
@@ -4229,6 +5047,7 @@ static void *janus_audiobridge_participant_thread(void *data) {
 	}
 	JANUS_LOG(LOG_VERB, "Thread is for participant %"SCNu64" (%s)\n", participant->user_id, participant->display ? participant->display : "??");
 	janus_audiobridge_session *session = participant->session;
+	janus_affinity_pin_thread(janus_affinity_group_node(participant->room ? participant->room->room_id : 0));
 
 	/* Output buffer */
 	janus_audiobridge_rtp_relay_packet *outpkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
@@ -4238,43 +5057,14 @@ static void *janus_audiobridge_participant_thread(void *data) {
 	outpkt->seq_number = 0;
 	outpkt->length = 0;
 	outpkt->silence = FALSE;
-	unsigned char *payload = (unsigned char *)outpkt->data;
 
 	janus_audiobridge_rtp_relay_packet *mixedpkt = NULL;
 
 	/* Start working: check the outgoing queue for packets, then encode and send them */
 	while(!g_atomic_int_get(&stopping) && session->destroyed == 0) {
 		mixedpkt = g_async_queue_timeout_pop(participant->outbuf, 100000);
-		if(mixedpkt != NULL && session->destroyed == 0 && session->started) {
-			/* Encode raw frame to Opus */
-			if(participant->active && participant->encoder) {
-				participant->working = TRUE;
-				opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
-				outpkt->length = opus_encode(participant->encoder, outBuffer, mixedpkt->length, payload+12, BUFFER_SAMPLES-12);
-				participant->working = FALSE;
-				if(outpkt->length < 0) {
-					JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", outpkt->length, opus_strerror(outpkt->length));
-				} else {
-					outpkt->length += 12;	/* Take the RTP header into consideration */
-					/* Update RTP header */
-					outpkt->data->version = 2;
-					outpkt->data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
-					outpkt->data->seq_number = htons(mixedpkt->seq_number);
-					outpkt->data->timestamp = htonl(mixedpkt->timestamp);
-					outpkt->data->ssrc = htonl(mixedpkt->ssrc);	/* The gateway will fix this anyway */
-					/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
-					outpkt->ssrc = mixedpkt->ssrc;
-					outpkt->timestamp = mixedpkt->timestamp;
-					outpkt->seq_number = mixedpkt->seq_number;
-					janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
-				}
-			}
-			if(mixedpkt->data)
-				g_free(mixedpkt->data);
-			mixedpkt->data = NULL;
-			g_free(mixedpkt);
-			mixedpkt = NULL;
-		}
+		if(mixedpkt != NULL)
+			janus_audiobridge_participant_encode(participant, mixedpkt, outpkt);
 	}
 	/* We're done, get rid of the resources */
 	g_free(outpkt->data);
@@ -4292,6 +5082,26 @@ static void *janus_audiobridge_participant_thread(void *data) {
 	return NULL;
 }
 
+/* Encoding worker: drains the outgoing queue of a participant, when we
+ * use a shared pool instead of a thread per participant. The encoding
+ * flag makes sure only one worker at a time handles the same participant,
+ * so that frames are still encoded in order */
+static void janus_audiobridge_encoding_worker(gpointer data, gpointer user_data) {
+	janus_audiobridge_participant *participant = (janus_audiobridge_participant *)data;
+	char buffer[1500];
+	janus_audiobridge_rtp_relay_packet outpkt = { 0 };
+	outpkt.data = (janus_rtp_header *)buffer;
+	memset(buffer, 0, sizeof(buffer));
+	janus_audiobridge_rtp_relay_packet *mixedpkt = NULL;
+	do {
+		while((mixedpkt = g_async_queue_try_pop(participant->outbuf)) != NULL)
+			janus_audiobridge_participant_encode(participant, mixedpkt, &outpkt);
+		g_atomic_int_set(&participant->encoding, 0);
+		/* The mixer may have queued something right before we cleared the flag */
+	} while(g_async_queue_length(participant->outbuf) > 0 &&
+		g_atomic_int_compare_and_exchange(&participant->encoding, 0, 1));
+}
+
 static void janus_audiobridge_relay_rtp_packet(gpointer data, gpointer user_data) {
 	janus_audiobridge_rtp_relay_packet *packet = (janus_audiobridge_rtp_relay_packet *)user_data;
 	if(!packet || !packet->data || packet->length < 1) {
@@ -56,6 +56,7 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <poll.h>
+#include <sys/epoll.h>
 
 #include <jansson.h>
 
@@ -165,6 +166,7 @@ static janus_callbacks *gateway = NULL;
 static char *local_ip = NULL;
 static uint16_t rtp_range_min = 10000;
 static uint16_t rtp_range_max = 60000;
+static struct janus_port_range *rtp_ports = NULL;
 
 static GThread *handler_thread;
 static GThread *watchdog;
@@ -199,6 +201,23 @@ static void janus_nosip_message_free(janus_nosip_message *msg) {
 }
 
 
+/* What each file descriptor served by the relay is for */
+typedef enum janus_nosip_relay_kind {
+	JANUS_NOSIP_RELAY_AUDIO_RTP = 0,
+	JANUS_NOSIP_RELAY_AUDIO_RTCP,
+	JANUS_NOSIP_RELAY_VIDEO_RTP,
+	JANUS_NOSIP_RELAY_VIDEO_RTCP,
+	JANUS_NOSIP_RELAY_PIPE,
+	JANUS_NOSIP_RELAY_KINDS
+} janus_nosip_relay_kind;
+struct janus_nosip_session;
+struct janus_nosip_relay_worker;
+/* What a shared relay worker gets back from epoll for each file descriptor */
+typedef struct janus_nosip_relay_ref {
+	struct janus_nosip_session *session;
+	janus_nosip_relay_kind kind;
+} janus_nosip_relay_ref;
+
 typedef struct janus_nosip_media {
 	char *remote_ip;
 	int ready:1;
@@ -228,6 +247,14 @@ typedef struct janus_nosip_media {
 	janus_rtp_switching_context context;
 	int pipefd[2];
 	gboolean updated;
+	/* Relay state, whether it's a thread of its own or a shared worker serving the call */
+	struct sockaddr_in relay_addr;
+	gboolean relay_have_addr;
+	int relay_pollerrs;
+	int relay_astep, relay_vstep;
+	guint32 relay_ats, relay_vts;
+	struct janus_nosip_relay_worker *relay_worker;
+	janus_nosip_relay_ref relay_refs[JANUS_NOSIP_RELAY_KINDS];
 } janus_nosip_media;
 
 typedef struct janus_nosip_session {
@@ -241,6 +268,7 @@ typedef struct janus_nosip_session {
 	janus_recorder *vrc_peer;	/* The Janus recorder instance for the peer's video, if enabled */
 	janus_mutex rec_mutex;		/* Mutex to protect the recorders from race conditions */
 	volatile gint hangingup;
+	volatile gint relay_ref;	/* References the shared relay workers hold: the watchdog waits for them to go away */
 	gint64 destroyed;	/* Time at which this session was marked as destroyed */
 	janus_mutex mutex;
 } janus_nosip_session;
@@ -457,7 +485,22 @@ void janus_nosip_sdp_process(janus_nosip_session *session, janus_sdp *sdp, gbool
 char *janus_nosip_sdp_manipulate(janus_nosip_session *session, janus_sdp *sdp, gboolean answer);
 /* Media */
 static int janus_nosip_allocate_local_ports(janus_nosip_session *session);
-static void *janus_nosip_relay_thread(void *data);
+static void janus_nosip_relay_start(janus_nosip_session *session);
+/* Shared relay workers: when relay_threads is set in the configuration,
+ * sessions don't get a relay thread of their own, but have their sockets
+ * served by the least loaded of a few epoll loops instead */
+#define JANUS_NOSIP_RELAY_MAX_EVENTS	64
+typedef struct janus_nosip_relay_worker {
+	guint index;
+	GThread *thread;
+	int efd;
+	volatile gint calls;
+	GList *sessions;	/* Sessions served by this worker, protected by the mutex */
+	janus_mutex mutex;
+} janus_nosip_relay_worker;
+static janus_nosip_relay_worker **relay_workers = NULL;
+static guint relay_workers_num = 0;
+static void *janus_nosip_relay_worker_thread(void *data);
 
 
 /* Error codes */
@@ -492,7 +535,7 @@ static void *janus_nosip_watchdog(void *data) {
 					sl = sl->next;
 					continue;
 				}
-				if(now-session->destroyed >= 5*G_USEC_PER_SEC) {
+				if(now-session->destroyed >= 5*G_USEC_PER_SEC && g_atomic_int_get(&session->relay_ref) == 0) {
 					/* We're lazy and actually get rid of the stuff only after a few seconds */
 					JANUS_LOG(LOG_VERB, "Freeing old NoSIP session\n");
 					GList *rm = sl->next;
@@ -581,6 +624,16 @@ int janus_nosip_init(janus_callbacks *callback, const char *config_path) {
 			JANUS_LOG(LOG_VERB, "NoSIP RTP/RTCP port range: %u -- %u\n", rtp_range_min, rtp_range_max);
 		}
 
+		item = janus_config_get_item_drilldown(config, "general", "relay_threads");
+		if(item && item->value) {
+			int threads = atoi(item->value);
+			if(threads < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid number of relay threads (%s), using a thread per session\n", item->value);
+			} else {
+				relay_workers_num = threads;
+			}
+		}
+
 		item = janus_config_get_item_drilldown(config, "general", "events");
 		if(item != NULL && item->value != NULL)
 			notify_events = janus_is_true(item->value);
@@ -610,6 +663,11 @@ int janus_nosip_init(janus_callbacks *callback, const char *config_path) {
 	messages = g_async_queue_new_full((GDestroyNotify) janus_nosip_message_free);
 	/* This is the callback we'll need to invoke to contact the gateway */
 	gateway = callback;
+	/* RTP/RTCP ports are picked from a shared allocator */
+	rtp_ports = gateway->port_range_get(rtp_range_min, rtp_range_max);
+	if(rtp_ports == NULL) {
+		JANUS_LOG(LOG_WARN, "Invalid RTP/RTCP port range %u -- %u, calls will fail\n", rtp_range_min, rtp_range_max);
+	}
 
 	g_atomic_int_set(&initialized, 1);
 
@@ -621,6 +679,32 @@ int janus_nosip_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the NoSIP watchdog thread...\n", error->code, error->message ? error->message : "??");
 		return -1;
 	}
+	/* Start the shared relay workers, if we're not going to have a relay thread per session */
+	if(relay_workers_num > 0) {
+		relay_workers = g_malloc0(relay_workers_num * sizeof(janus_nosip_relay_worker *));
+		guint i = 0;
+		for(i=0; i<relay_workers_num; i++) {
+			janus_nosip_relay_worker *worker = g_malloc0(sizeof(janus_nosip_relay_worker));
+			worker->index = i;
+			janus_mutex_init(&worker->mutex);
+			worker->efd = epoll_create1(EPOLL_CLOEXEC);
+			relay_workers[i] = worker;
+			if(worker->efd < 0) {
+				g_atomic_int_set(&initialized, 0);
+				JANUS_LOG(LOG_ERR, "Error creating epoll instance for NoSIP relay worker #%u: %d (%s)\n", i, errno, strerror(errno));
+				return -1;
+			}
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "nosiprtp wrk %u", i);
+			worker->thread = g_thread_try_new(tname, janus_nosip_relay_worker_thread, worker, &error);
+			if(error != NULL) {
+				g_atomic_int_set(&initialized, 0);
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch NoSIP relay worker #%u...\n", error->code, error->message ? error->message : "??", i);
+				return -1;
+			}
+		}
+		JANUS_LOG(LOG_INFO, "Relaying NoSIP media on %u shared worker(s)\n", relay_workers_num);
+	}
 	/* Launch the thread that will handle incoming messages */
 	handler_thread = g_thread_try_new("nosip handler", janus_nosip_handler, NULL, &error);
 	if(error != NULL) {
@@ -646,6 +730,23 @@ void janus_nosip_destroy(void) {
 		g_thread_join(watchdog);
 		watchdog = NULL;
 	}
+	if(relay_workers != NULL) {
+		guint i = 0;
+		for(i=0; i<relay_workers_num; i++) {
+			janus_nosip_relay_worker *worker = relay_workers[i];
+			if(worker == NULL)
+				continue;
+			if(worker->thread != NULL)
+				g_thread_join(worker->thread);
+			if(worker->efd >= 0)
+				close(worker->efd);
+			g_list_free(worker->sessions);
+			g_free(worker);
+		}
+		g_free(relay_workers);
+		relay_workers = NULL;
+	}
+	relay_workers_num = 0;
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -653,6 +754,8 @@ void janus_nosip_destroy(void) {
 	janus_mutex_unlock(&sessions_mutex);
 	g_async_queue_unref(messages);
 	messages = NULL;
+	gateway->port_range_unref(rtp_ports);
+	rtp_ports = NULL;
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
 
@@ -745,6 +848,7 @@ void janus_nosip_create_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_init(&session->rec_mutex);
 	session->destroyed = 0;
 	g_atomic_int_set(&session->hangingup, 0);
+	g_atomic_int_set(&session->relay_ref, 0);
 	janus_mutex_init(&session->mutex);
 	handle->plugin_handle = session;
 
@@ -1289,13 +1393,7 @@ static void *janus_nosip_handler(void *data) {
 			if(!sdp_update && !offer) {
 				/* Start the media */
 				session->media.ready = 1;	/* FIXME Maybe we need a better way to signal this */
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "nosiprtp %p", session);
-				g_thread_try_new(tname, janus_nosip_relay_thread, session, &error);
-				if(error != NULL) {
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
-				}
+				janus_nosip_relay_start(session);
 			}
 		} else if(!strcasecmp(request_text, "hangup")) {
 			/* Get rid of an ongoing session */
@@ -1711,6 +1809,8 @@ static int janus_nosip_allocate_local_ports(janus_nosip_session *session) {
 		close(session->media.audio_rtcp_fd);
 		session->media.audio_rtcp_fd = -1;
 	}
+	if(session->media.local_audio_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_audio_rtp_port);
 	session->media.local_audio_rtp_port = 0;
 	session->media.local_audio_rtcp_port = 0;
 	session->media.audio_ssrc = 0;
@@ -1722,6 +1822,8 @@ static int janus_nosip_allocate_local_ports(janus_nosip_session *session) {
 		close(session->media.video_rtcp_fd);
 		session->media.video_rtcp_fd = -1;
 	}
+	if(session->media.local_video_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_video_rtp_port);
 	session->media.local_video_rtp_port = 0;
 	session->media.local_video_rtcp_port = 0;
 	session->media.video_ssrc = 0;
@@ -1751,9 +1853,11 @@ static int janus_nosip_allocate_local_ports(janus_nosip_session *session) {
 				JANUS_LOG(LOG_ERR, "Error creating audio sockets...\n");
 				return -1;
 			}
-			int rtp_port = g_random_int_range(rtp_range_min, rtp_range_max);
-			if(rtp_port % 2)
-				rtp_port++;	/* Pick an even port for RTP */
+			int rtp_port = gateway->port_allocate(rtp_ports);
+			if(rtp_port < 0) {
+				JANUS_LOG(LOG_ERR, "No RTP/RTCP port pair available in range %u -- %u\n", rtp_range_min, rtp_range_max);
+				return -1;
+			}
 			audio_rtp_address.sin_family = AF_INET;
 			audio_rtp_address.sin_port = htons(rtp_port);
 			inet_pton(AF_INET, local_ip, &audio_rtp_address.sin_addr.s_addr);
@@ -1761,6 +1865,7 @@ static int janus_nosip_allocate_local_ports(janus_nosip_session *session) {
 				JANUS_LOG(LOG_ERR, "Bind failed for audio RTP (port %d), trying a different one...\n", rtp_port);
 				close(session->media.audio_rtp_fd);
 				session->media.audio_rtp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -1776,6 +1881,7 @@ static int janus_nosip_allocate_local_ports(janus_nosip_session *session) {
 				session->media.audio_rtp_fd = -1;
 				close(session->media.audio_rtcp_fd);
 				session->media.audio_rtcp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -1800,9 +1906,11 @@ static int janus_nosip_allocate_local_ports(janus_nosip_session *session) {
 				JANUS_LOG(LOG_ERR, "Error creating video sockets...\n");
 				return -1;
 			}
-			int rtp_port = g_random_int_range(rtp_range_min, rtp_range_max);
-			if(rtp_port % 2)
-				rtp_port++;	/* Pick an even port for RTP */
+			int rtp_port = gateway->port_allocate(rtp_ports);
+			if(rtp_port < 0) {
+				JANUS_LOG(LOG_ERR, "No RTP/RTCP port pair available in range %u -- %u\n", rtp_range_min, rtp_range_max);
+				return -1;
+			}
 			video_rtp_address.sin_family = AF_INET;
 			video_rtp_address.sin_port = htons(rtp_port);
 			inet_pton(AF_INET, local_ip, &video_rtp_address.sin_addr.s_addr);
@@ -1810,6 +1918,7 @@ static int janus_nosip_allocate_local_ports(janus_nosip_session *session) {
 				JANUS_LOG(LOG_ERR, "Bind failed for video RTP (port %d), trying a different one...\n", rtp_port);
 				close(session->media.video_rtp_fd);
 				session->media.video_rtp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -1825,6 +1934,7 @@ static int janus_nosip_allocate_local_ports(janus_nosip_session *session) {
 				session->media.video_rtp_fd = -1;
 				close(session->media.video_rtcp_fd);
 				session->media.video_rtcp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -1879,244 +1989,246 @@ static void janus_nosip_connect_sockets(janus_nosip_session *session, struct soc
 
 }
 
-/* Thread to relay RTP/RTCP frames coming from the peer */
-static void *janus_nosip_relay_thread(void *data) {
-	janus_nosip_session *session = (janus_nosip_session *)data;
-	if(!session) {
-		g_thread_unref(g_thread_self());
-		return NULL;
+/* Helpers to receive packets in batches in the relay: where recvmmsg is
+ * available we drain up to JANUS_NOSIP_RECV_BATCH datagrams with a single
+ * syscall, otherwise we just read one */
+#define JANUS_NOSIP_RECV_BATCH	16
+typedef struct janus_nosip_recv_batch {
+	char buffers[JANUS_NOSIP_RECV_BATCH][1500];
+	int lengths[JANUS_NOSIP_RECV_BATCH];
+#ifdef HAVE_RECVMMSG
+	struct iovec iovecs[JANUS_NOSIP_RECV_BATCH];
+	struct mmsghdr msgs[JANUS_NOSIP_RECV_BATCH];
+#endif
+} janus_nosip_recv_batch;
+
+static janus_nosip_recv_batch *janus_nosip_recv_batch_create(void) {
+	janus_nosip_recv_batch *batch = g_malloc0(sizeof(janus_nosip_recv_batch));
+#ifdef HAVE_RECVMMSG
+	int i = 0;
+	for(i=0; i<JANUS_NOSIP_RECV_BATCH; i++) {
+		batch->iovecs[i].iov_base = batch->buffers[i];
+		batch->iovecs[i].iov_len = sizeof(batch->buffers[i]);
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
 	}
-	JANUS_LOG(LOG_INFO, "[NoSIP-%p] Starting relay thread\n", session);
+#endif
+	return batch;
+}
+
+static int janus_nosip_recv_batch_read(int fd, janus_nosip_recv_batch *batch) {
+#ifdef HAVE_RECVMMSG
+	/* poll/epoll told us there's at least a packet, so we don't need to block */
+	int count = recvmmsg(fd, batch->msgs, JANUS_NOSIP_RECV_BATCH, MSG_DONTWAIT, NULL);
+	int i = 0;
+	for(i=0; i<count; i++)
+		batch->lengths[i] = batch->msgs[i].msg_len;
+	return count < 0 ? 0 : count;
+#else
+	batch->lengths[0] = recvfrom(fd, batch->buffers[0], sizeof(batch->buffers[0]), MSG_DONTWAIT, NULL, NULL);
+	return batch->lengths[0] < 0 ? 0 : 1;
+#endif
+}
 
-	gboolean have_server_ip = TRUE;
-	struct sockaddr_in server_addr;
-	memset(&server_addr, 0, sizeof(server_addr));
-	server_addr.sin_family = AF_INET;
+/* Helper to get the file descriptor the relay uses for something */
+static int *janus_nosip_relay_fd(janus_nosip_session *session, janus_nosip_relay_kind kind) {
+	switch(kind) {
+		case JANUS_NOSIP_RELAY_AUDIO_RTP:
+			return &session->media.audio_rtp_fd;
+		case JANUS_NOSIP_RELAY_AUDIO_RTCP:
+			return &session->media.audio_rtcp_fd;
+		case JANUS_NOSIP_RELAY_VIDEO_RTP:
+			return &session->media.video_rtp_fd;
+		case JANUS_NOSIP_RELAY_VIDEO_RTCP:
+			return &session->media.video_rtcp_fd;
+		case JANUS_NOSIP_RELAY_PIPE:
+			return &session->media.pipefd[0];
+		default:
+			break;
+	}
+	return NULL;
+}
+
+/* Whether we should stop relaying media for a session */
+static gboolean janus_nosip_relay_is_over(janus_nosip_session *session) {
+	return session->destroyed || g_atomic_int_get(&session->hangingup);
+}
+
+/* Resolve the address of the peer, and connect the sockets to it */
+static void janus_nosip_relay_setup(janus_nosip_session *session) {
+	session->media.relay_pollerrs = 0;
+	session->media.relay_astep = 0;
+	session->media.relay_vstep = 0;
+	session->media.relay_ats = 0;
+	session->media.relay_vts = 0;
+	session->media.relay_have_addr = TRUE;
+	struct sockaddr_in *server_addr = &session->media.relay_addr;
+	memset(server_addr, 0, sizeof(*server_addr));
+	server_addr->sin_family = AF_INET;
 	if(session->media.remote_ip == NULL) {
 		JANUS_LOG(LOG_WARN, "[NoSIP-%p] No remote IP?\n", session);
 	} else {
-		if((inet_aton(session->media.remote_ip, &server_addr.sin_addr)) <= 0) {	/* Not a numeric IP... */
+		if((inet_aton(session->media.remote_ip, &server_addr->sin_addr)) <= 0) {	/* Not a numeric IP... */
 			struct hostent *host = gethostbyname(session->media.remote_ip);	/* ...resolve name */
 			if(!host) {
 				JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't get host (%s)\n", session, session->media.remote_ip);
-				have_server_ip = FALSE;
+				session->media.relay_have_addr = FALSE;
 			} else {
-				server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
+				server_addr->sin_addr = *(struct in_addr *)host->h_addr_list;
 			}
 		}
 	}
-	if(have_server_ip) {
-		janus_nosip_connect_sockets(session, &server_addr);
+	if(session->media.relay_have_addr)
+		janus_nosip_connect_sockets(session, server_addr);
+}
+
+/* Reconnect the sockets after a session update */
+static void janus_nosip_relay_update(janus_nosip_session *session) {
+	/* Apparently there was a session update */
+	if(session->media.remote_ip != NULL && (inet_aton(session->media.remote_ip, &session->media.relay_addr.sin_addr) != 0)) {
+		janus_nosip_connect_sockets(session, &session->media.relay_addr);
+	} else {
+		JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: missing or invalid remote IP address? (%s)\n",
+			session, session->media.remote_ip);
 	}
+	session->media.updated = FALSE;
+}
 
-	/* File descriptors */
-	socklen_t addrlen;
-	struct sockaddr_in remote;
-	int resfd = 0, bytes = 0, pollerrs = 0;
-	struct pollfd fds[5];
-	int pipe_fd = session->media.pipefd[0];
-	char buffer[1500];
-	memset(buffer, 0, 1500);
-	/* Loop */
-	int num = 0;
-	gboolean goon = TRUE;
-	int astep = 0, vstep = 0;
-	guint32 ats = 0, vts = 0;
-	while(goon && session != NULL &&
-			!session->destroyed && !g_atomic_int_get(&session->hangingup)) {
-		if(session->media.updated) {
-			/* Apparently there was a session update */
-			if(have_server_ip && (inet_aton(session->media.remote_ip, &server_addr.sin_addr) == 0)) {
-				janus_nosip_connect_sockets(session, &server_addr);
+/* Handle an RTP/RTCP packet coming from the peer */
+static void janus_nosip_relay_incoming(janus_nosip_session *session, janus_nosip_relay_kind kind, char *buffer, int bytes) {
+	/* Let's check what this is */
+	gboolean video = kind == JANUS_NOSIP_RELAY_VIDEO_RTP || kind == JANUS_NOSIP_RELAY_VIDEO_RTCP;
+	gboolean rtcp = kind == JANUS_NOSIP_RELAY_AUDIO_RTCP || kind == JANUS_NOSIP_RELAY_VIDEO_RTCP;
+	if(!rtcp) {
+		/* Audio or Video RTP */
+		session->media.relay_pollerrs = 0;
+		rtp_header *header = (rtp_header *)buffer;
+		if((video && session->media.video_ssrc_peer != ntohl(header->ssrc)) ||
+				(!video && session->media.audio_ssrc_peer != ntohl(header->ssrc))) {
+			if(video) {
+				session->media.video_ssrc_peer = ntohl(header->ssrc);
 			} else {
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p] Couldn't update session details: missing or invalid remote IP address? (%s)\n",
-					session, session->media.remote_ip);
+				session->media.audio_ssrc_peer = ntohl(header->ssrc);
 			}
-			session->media.updated = FALSE;
-		}
-
-		/* Prepare poll */
-		num = 0;
-		if(session->media.audio_rtp_fd != -1) {
-			fds[num].fd = session->media.audio_rtp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
-		}
-		if(session->media.audio_rtcp_fd != -1) {
-			fds[num].fd = session->media.audio_rtcp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
-		}
-		if(session->media.video_rtp_fd != -1) {
-			fds[num].fd = session->media.video_rtp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
-		}
-		if(session->media.video_rtcp_fd != -1) {
-			fds[num].fd = session->media.video_rtcp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
-		}
-		if(pipe_fd != -1) {
-			fds[num].fd = pipe_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
+			JANUS_LOG(LOG_VERB, "[NoSIP-%p] Got SIP peer %s SSRC: %"SCNu32"\n",
+				session, video ? "video" : "audio", ntohl(header->ssrc));
 		}
-		/* Wait for some data */
-		resfd = poll(fds, num, 1000);
-		if(resfd < 0) {
-			if(errno == EINTR) {
-				JANUS_LOG(LOG_HUGE, "[NoSIP-%p] Got an EINTR (%s), ignoring...\n", session, strerror(errno));
-				continue;
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(
+				(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
+				buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
 			}
-			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Error polling...\n", session);
-			JANUS_LOG(LOG_ERR, "[NoSIP-%p]   -- %d (%s)\n", session, errno, strerror(errno));
-			break;
-		} else if(resfd == 0) {
-			/* No data, keep going */
-			continue;
+			bytes = buflen;
 		}
-		if(session == NULL || session->destroyed)
-			break;
-		int i = 0;
-		for(i=0; i<num; i++) {
-			if(fds[i].revents & (POLLERR | POLLHUP)) {
-				/* If we just updated the session, let's wait until things have calmed down */
-				if(session->media.updated)
-					break;
-				/* Check the socket error */
-				int error = 0;
-				socklen_t errlen = sizeof(error);
-				getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
-				if(error == 0) {
-					/* Maybe not a breaking error after all? */
-					continue;
-				} else if(error == 111) {
-					/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
-					if(fds[i].fd == session->media.audio_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the audio RTCP socket, closing it\n",
-							session, strerror(error));
-						close(session->media.audio_rtcp_fd);
-						session->media.audio_rtcp_fd = -1;
-					} else if(fds[i].fd == session->media.video_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the video RTCP socket, closing it\n",
-							session, strerror(error));
-						close(session->media.video_rtcp_fd);
-						session->media.video_rtcp_fd = -1;
-					}
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		guint32 timestamp = ntohl(header->timestamp);
+		janus_rtp_header_update(header, &session->media.context, video,
+			(video ? (session->media.relay_vstep ? session->media.relay_vstep : 4500) :
+				(session->media.relay_astep ? session->media.relay_astep : 960)));
+		if(video) {
+			if(session->media.relay_vts == 0) {
+				session->media.relay_vts = timestamp;
+			} else if(session->media.relay_vstep == 0) {
+				session->media.relay_vstep = timestamp-session->media.relay_vts;
+				if(session->media.relay_vstep < 0) {
+					session->media.relay_vstep = 0;
 				}
-				/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
-				pollerrs++;
-				if(pollerrs < 100)
-					continue;
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p] Too many errors polling %d (socket #%d): %s...\n", session,
-					fds[i].fd, i, fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
-				JANUS_LOG(LOG_ERR, "[NoSIP-%p]   -- %d (%s)\n", session, error, strerror(error));
-				/* Can we assume it's pretty much over, after a POLLERR? */
-				goon = FALSE;
-				/* FIXME Close the PeerConnection */
-				gateway->close_pc(session->handle);
-				break;
-			} else if(fds[i].revents & POLLIN) {
-				if(pipe_fd != -1 && fds[i].fd == pipe_fd) {
-					/* Poll interrupted for a reason, go on */
-					int code = 0;
-					(void)read(pipe_fd, &code, sizeof(int));
-					break;
-				}
-				/* Got an RTP/RTCP packet */
-				addrlen = sizeof(remote);
-				bytes = recvfrom(fds[i].fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-				if(bytes < 0) {
-					/* Failed to read? */
-					continue;
-				}
-				/* Let's check what this is */
-				gboolean video = fds[i].fd == session->media.video_rtp_fd || fds[i].fd == session->media.video_rtcp_fd;
-				gboolean rtcp = fds[i].fd == session->media.audio_rtcp_fd || fds[i].fd == session->media.video_rtcp_fd;
-				if(!rtcp) {
-					/* Audio or Video RTP */
-					pollerrs = 0;
-					rtp_header *header = (rtp_header *)buffer;
-					if((video && session->media.video_ssrc_peer != ntohl(header->ssrc)) ||
-							(!video && session->media.audio_ssrc_peer != ntohl(header->ssrc))) {
-						if(video) {
-							session->media.video_ssrc_peer = ntohl(header->ssrc);
-						} else {
-							session->media.audio_ssrc_peer = ntohl(header->ssrc);
-						}
-						JANUS_LOG(LOG_VERB, "[NoSIP-%p] Got SIP peer %s SSRC: %"SCNu32"\n",
-							session, video ? "video" : "audio", session->media.audio_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(
-							(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
-							buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					guint32 timestamp = ntohl(header->timestamp);
-					janus_rtp_header_update(header, &session->media.context, video,
-						(video ? (vstep ? vstep : 4500) : (astep ? astep : 960)));
-					if(video) {
-						if(vts == 0) {
-							vts = timestamp;
-						} else if(vstep == 0) {
-							vstep = timestamp-vts;
-							if(vstep < 0) {
-								vstep = 0;
-							}
-						}
-					} else {
-						if(ats == 0) {
-							ats = timestamp;
-						} else if(astep == 0) {
-							astep = timestamp-ats;
-							if(astep < 0) {
-								astep = 0;
-							}
-						}
-					}
-					/* Save the frame if we're recording */
-					janus_recorder_save_frame(video ? session->vrc_peer : session->arc_peer, buffer, bytes);
-					/* Relay to browser */
-					gateway->relay_rtp(session->handle, video, buffer, bytes);
-					continue;
-				} else {
-					/* Audio or Video RTCP */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(
-							(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
-							buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTCP unprotect error: %s (len=%d-->%d)\n",
-								session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to browser */
-					gateway->relay_rtcp(session->handle, video, buffer, bytes);
-					continue;
+			}
+		} else {
+			if(session->media.relay_ats == 0) {
+				session->media.relay_ats = timestamp;
+			} else if(session->media.relay_astep == 0) {
+				session->media.relay_astep = timestamp-session->media.relay_ats;
+				if(session->media.relay_astep < 0) {
+					session->media.relay_astep = 0;
 				}
 			}
 		}
+		/* Save the frame if we're recording */
+		janus_recorder_save_frame(video ? session->vrc_peer : session->arc_peer, buffer, bytes);
+		/* Relay to browser */
+		gateway->relay_rtp(session->handle, video, buffer, bytes);
+	} else {
+		/* Audio or Video RTCP */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(
+				(video ? session->media.video_srtp_in : session->media.audio_srtp_in),
+				buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[NoSIP-%p] %s SRTCP unprotect error: %s (len=%d-->%d)\n",
+					session, video ? "Video" : "Audio", janus_srtp_error_str(res), bytes, buflen);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Relay to browser */
+		gateway->relay_rtcp(session->handle, video, buffer, bytes);
+	}
+}
+
+/* Read all the packets we can from one of the sockets */
+static void janus_nosip_relay_read(janus_nosip_session *session, janus_nosip_relay_kind kind, janus_nosip_recv_batch *batch) {
+	int fd = *janus_nosip_relay_fd(session, kind);
+	if(fd == -1)
+		return;
+	int count = janus_nosip_recv_batch_read(fd, batch);
+	int i = 0;
+	for(i=0; i<count; i++)
+		janus_nosip_relay_incoming(session, kind, batch->buffers[i], batch->lengths[i]);
+}
+
+/* Handle an error on one of the sockets: returns FALSE if it's time to stop relaying media */
+static gboolean janus_nosip_relay_error(janus_nosip_session *session, janus_nosip_relay_kind kind, gboolean hup) {
+	int fd = *janus_nosip_relay_fd(session, kind);
+	if(fd == -1)
+		return TRUE;
+	/* Check the socket error */
+	int error = 0;
+	socklen_t errlen = sizeof(error);
+	getsockopt(fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
+	if(error == 0) {
+		/* Maybe not a breaking error after all? */
+		return TRUE;
+	} else if(error == 111) {
+		/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
+		if(kind == JANUS_NOSIP_RELAY_AUDIO_RTCP) {
+			JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the audio RTCP socket, closing it\n",
+				session, strerror(error));
+			close(session->media.audio_rtcp_fd);
+			session->media.audio_rtcp_fd = -1;
+			return TRUE;
+		} else if(kind == JANUS_NOSIP_RELAY_VIDEO_RTCP) {
+			JANUS_LOG(LOG_WARN, "[NoSIP-%p] Got a '%s' on the video RTCP socket, closing it\n",
+				session, strerror(error));
+			close(session->media.video_rtcp_fd);
+			session->media.video_rtcp_fd = -1;
+			return TRUE;
+		}
 	}
+	/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
+	session->media.relay_pollerrs++;
+	if(session->media.relay_pollerrs < 100)
+		return TRUE;
+	JANUS_LOG(LOG_ERR, "[NoSIP-%p] Too many errors polling %d (socket #%d): %s...\n", session,
+		fd, kind, hup ? "POLLHUP" : "POLLERR");
+	JANUS_LOG(LOG_ERR, "[NoSIP-%p]   -- %d (%s)\n", session, error, strerror(error));
+	/* Can we assume it's pretty much over, after a POLLERR? */
+	/* FIXME Close the PeerConnection */
+	gateway->close_pc(session->handle);
+	return FALSE;
+}
+
+/* Close the sockets and get rid of the SRTP stuff when a call is over */
+static void janus_nosip_relay_cleanup(janus_nosip_session *session) {
 	if(session->media.audio_rtp_fd != -1) {
 		close(session->media.audio_rtp_fd);
 		session->media.audio_rtp_fd = -1;
@@ -2125,6 +2237,8 @@ static void *janus_nosip_relay_thread(void *data) {
 		close(session->media.audio_rtcp_fd);
 		session->media.audio_rtcp_fd = -1;
 	}
+	if(session->media.local_audio_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_audio_rtp_port);
 	session->media.local_audio_rtp_port = 0;
 	session->media.local_audio_rtcp_port = 0;
 	session->media.audio_ssrc = 0;
@@ -2136,6 +2250,8 @@ static void *janus_nosip_relay_thread(void *data) {
 		close(session->media.video_rtcp_fd);
 		session->media.video_rtcp_fd = -1;
 	}
+	if(session->media.local_video_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_video_rtp_port);
 	session->media.local_video_rtp_port = 0;
 	session->media.local_video_rtcp_port = 0;
 	session->media.video_ssrc = 0;
@@ -2149,8 +2265,260 @@ static void *janus_nosip_relay_thread(void *data) {
 	}
 	/* Clean up SRTP stuff, if needed */
 	janus_nosip_srtp_cleanup(session);
+}
+
+/* Thread to relay RTP/RTCP frames coming from the peer */
+static void *janus_nosip_relay_thread(void *data) {
+	janus_nosip_session *session = (janus_nosip_session *)data;
+	if(!session) {
+		g_thread_unref(g_thread_self());
+		return NULL;
+	}
+	JANUS_LOG(LOG_INFO, "[NoSIP-%p] Starting relay thread\n", session);
+	janus_nosip_relay_setup(session);
+
+	/* File descriptors */
+	int resfd = 0;
+	struct pollfd fds[JANUS_NOSIP_RELAY_KINDS];
+	janus_nosip_relay_kind kinds[JANUS_NOSIP_RELAY_KINDS];
+	janus_nosip_recv_batch *batch = janus_nosip_recv_batch_create();
+	/* Loop */
+	int num = 0;
+	gboolean goon = TRUE;
+	while(goon && !janus_nosip_relay_is_over(session)) {
+		if(session->media.updated)
+			janus_nosip_relay_update(session);
+
+		/* Prepare poll */
+		num = 0;
+		janus_nosip_relay_kind kind = 0;
+		for(kind=0; kind<JANUS_NOSIP_RELAY_KINDS; kind++) {
+			int fd = *janus_nosip_relay_fd(session, kind);
+			if(fd == -1)
+				continue;
+			fds[num].fd = fd;
+			fds[num].events = POLLIN;
+			fds[num].revents = 0;
+			kinds[num] = kind;
+			num++;
+		}
+		/* Wait for some data */
+		resfd = poll(fds, num, 1000);
+		if(resfd < 0) {
+			if(errno == EINTR) {
+				JANUS_LOG(LOG_HUGE, "[NoSIP-%p] Got an EINTR (%s), ignoring...\n", session, strerror(errno));
+				continue;
+			}
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p] Error polling...\n", session);
+			JANUS_LOG(LOG_ERR, "[NoSIP-%p]   -- %d (%s)\n", session, errno, strerror(errno));
+			break;
+		} else if(resfd == 0) {
+			/* No data, keep going */
+			continue;
+		}
+		if(janus_nosip_relay_is_over(session))
+			break;
+		int i = 0;
+		for(i=0; i<num; i++) {
+			if(fds[i].revents & (POLLERR | POLLHUP)) {
+				/* If we just updated the session, let's wait until things have calmed down */
+				if(session->media.updated)
+					break;
+				if(!janus_nosip_relay_error(session, kinds[i], !(fds[i].revents & POLLERR))) {
+					goon = FALSE;
+					break;
+				}
+			} else if(fds[i].revents & POLLIN) {
+				if(kinds[i] == JANUS_NOSIP_RELAY_PIPE) {
+					/* Poll interrupted for a reason, go on */
+					int code = 0;
+					(void)read(fds[i].fd, &code, sizeof(int));
+					break;
+				}
+				/* Got an RTP/RTCP packet */
+				janus_nosip_relay_read(session, kinds[i], batch);
+			}
+		}
+	}
+	g_free(batch);
+	janus_nosip_relay_cleanup(session);
 	/* Done */
 	JANUS_LOG(LOG_INFO, "Leaving NoSIP relay thread\n");
 	g_thread_unref(g_thread_self());
 	return NULL;
 }
+
+static void janus_nosip_relay_attach(janus_nosip_session *session) {
+	janus_nosip_relay_worker *worker = session->media.relay_worker;
+	if(worker == NULL) {
+		/* Pick the worker serving the fewest calls */
+		guint i = 0;
+		for(i=0; i<relay_workers_num; i++) {
+			if(worker == NULL || g_atomic_int_get(&relay_workers[i]->calls) < g_atomic_int_get(&worker->calls))
+				worker = relay_workers[i];
+		}
+	}
+	JANUS_LOG(LOG_VERB, "[NoSIP-%p] Relaying media on worker #%u\n", session, worker->index);
+	janus_nosip_relay_setup(session);
+	janus_mutex_lock(&worker->mutex);
+	if(session->media.relay_worker == NULL) {
+		/* The worker keeps a reference until the call is detached */
+		g_atomic_int_inc(&session->relay_ref);
+		session->media.relay_worker = worker;
+		worker->sessions = g_list_prepend(worker->sessions, session);
+		g_atomic_int_inc(&worker->calls);
+	}
+	janus_nosip_relay_kind kind = 0;
+	for(kind=0; kind<JANUS_NOSIP_RELAY_KINDS; kind++) {
+		int fd = *janus_nosip_relay_fd(session, kind);
+		if(fd == -1)
+			continue;
+		janus_nosip_relay_ref *ref = &session->media.relay_refs[kind];
+		ref->session = session;
+		ref->kind = kind;
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = ref;
+		if(epoll_ctl(worker->efd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno != EEXIST)
+			JANUS_LOG(LOG_WARN, "[NoSIP-%p] Error adding socket to relay worker #%u: %d (%s)\n",
+				session, worker->index, errno, strerror(errno));
+	}
+	janus_mutex_unlock(&worker->mutex);
+}
+
+/* Returns TRUE if the call was detached: the caller must then release the reference
+ * the worker held, once it's done with any event from epoll that may still point to it */
+static gboolean janus_nosip_relay_detach(janus_nosip_relay_worker *worker, janus_nosip_session *session) {
+	janus_mutex_lock(&worker->mutex);
+	if(session->media.relay_worker != worker) {
+		janus_mutex_unlock(&worker->mutex);
+		return FALSE;
+	}
+	session->media.relay_worker = NULL;
+	worker->sessions = g_list_remove(worker->sessions, session);
+	g_atomic_int_add(&worker->calls, -1);
+	/* Closing the sockets takes care of removing them from epoll as well */
+	janus_nosip_relay_cleanup(session);
+	janus_mutex_unlock(&worker->mutex);
+	JANUS_LOG(LOG_VERB, "[NoSIP-%p] Media relay on worker #%u stopped\n", session, worker->index);
+	return TRUE;
+}
+
+static void *janus_nosip_relay_worker_thread(void *data) {
+	janus_nosip_relay_worker *worker = (janus_nosip_relay_worker *)data;
+	JANUS_LOG(LOG_VERB, "Joining NoSIP relay worker #%u\n", worker->index);
+	struct epoll_event events[JANUS_NOSIP_RELAY_MAX_EVENTS];
+	janus_nosip_recv_batch *batch = janus_nosip_recv_batch_create();
+	gint64 last_check = janus_get_monotonic_time();
+	GList *detached = NULL, *l = NULL;
+	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
+		int res = epoll_wait(worker->efd, events, JANUS_NOSIP_RELAY_MAX_EVENTS, 500);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "Error polling on NoSIP relay worker #%u: %d (%s)\n", worker->index, errno, strerror(errno));
+			break;
+		}
+		int i = 0;
+		for(i=0; i<res; i++) {
+			janus_nosip_relay_ref *ref = (janus_nosip_relay_ref *)events[i].data.ptr;
+			janus_nosip_session *session = ref->session;
+			if(session->media.relay_worker != worker)
+				continue;
+			if(janus_nosip_relay_is_over(session)) {
+				if(janus_nosip_relay_detach(worker, session))
+					detached = g_list_prepend(detached, session);
+				continue;
+			}
+			int fd = *janus_nosip_relay_fd(session, ref->kind);
+			if(fd == -1)
+				continue;
+			if(ref->kind == JANUS_NOSIP_RELAY_PIPE) {
+				/* Something changed in the session */
+				int code = 0;
+				(void)read(fd, &code, sizeof(int));
+				if(session->media.updated)
+					janus_nosip_relay_update(session);
+			} else if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+				/* If we just updated the session, let's wait until things have calmed down */
+				if(session->media.updated)
+					continue;
+				if(!janus_nosip_relay_error(session, ref->kind, !(events[i].events & EPOLLERR)) &&
+						janus_nosip_relay_detach(worker, session))
+					detached = g_list_prepend(detached, session);
+			} else if(events[i].events & EPOLLIN) {
+				/* Got RTP/RTCP packets */
+				janus_nosip_relay_read(session, ref->kind, batch);
+			}
+		}
+		/* Calls with no traffic won't wake us up: check every now and then which ones are over */
+		gint64 now = janus_get_monotonic_time();
+		if(now-last_check >= G_USEC_PER_SEC/2) {
+			last_check = now;
+			GList *over = NULL;
+			janus_mutex_lock(&worker->mutex);
+			for(l = worker->sessions; l; l = l->next) {
+				janus_nosip_session *session = (janus_nosip_session *)l->data;
+				if(janus_nosip_relay_is_over(session))
+					over = g_list_prepend(over, session);
+			}
+			janus_mutex_unlock(&worker->mutex);
+			for(l = over; l; l = l->next) {
+				if(janus_nosip_relay_detach(worker, (janus_nosip_session *)l->data))
+					detached = g_list_prepend(detached, l->data);
+			}
+			g_list_free(over);
+		}
+		/* Now that we're done with this round of events, the watchdog can free the calls we detached */
+		for(l = detached; l; l = l->next)
+			g_atomic_int_add(&((janus_nosip_session *)l->data)->relay_ref, -1);
+		g_list_free(detached);
+		detached = NULL;
+	}
+	g_free(batch);
+	JANUS_LOG(LOG_VERB, "Leaving NoSIP relay worker #%u\n", worker->index);
+	return NULL;
+}
+
+/* Resolving the address of the peer may block, and we're on the handler
+ * thread: when it's not a numeric address, we attach the call from here instead */
+static void *janus_nosip_relay_resolve_thread(void *data) {
+	janus_nosip_session *session = (janus_nosip_session *)data;
+	janus_nosip_relay_attach(session);
+	g_atomic_int_add(&session->relay_ref, -1);
+	g_thread_unref(g_thread_self());
+	return NULL;
+}
+
+/* Start relaying the media of a call, on a thread of its own or on a shared worker */
+static void janus_nosip_relay_start(janus_nosip_session *session) {
+	if(relay_workers_num > 0) {
+		struct in_addr addr;
+		if(session->media.remote_ip == NULL || inet_aton(session->media.remote_ip, &addr) != 0) {
+			janus_nosip_relay_attach(session);
+			return;
+		}
+		/* Keep the session around until the name is resolved */
+		g_atomic_int_inc(&session->relay_ref);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "nosipdns %p", session);
+		g_thread_try_new(tname, janus_nosip_relay_resolve_thread, session, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the NoSIP resolver thread, resolving here...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			janus_nosip_relay_attach(session);
+			g_atomic_int_add(&session->relay_ref, -1);
+		}
+		return;
+	}
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "nosiprtp %p", session);
+	g_thread_try_new(tname, janus_nosip_relay_thread, session, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
+	}
+}
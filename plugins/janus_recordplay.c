@@ -43,7 +43,11 @@
  * get a response directly within the context of the transaction. \c list
  * lists all the available recordings, while \c update forces the plugin
  * to scan the folder of recordings again in case some were added manually
- * and not indexed in the meanwhile.
+ * and not indexed in the meanwhile. The plugin keeps a catalog of the
+ * recordings it knows about (\c recordplay.catalog in the recordings
+ * folder): this way only new \c .nfo files need to be parsed, and if
+ * nothing changed in the folder since the last scan, there's no scan
+ * at all, both at startup and when handling \c update requests.
  * 
  * The \c record , \c play , \c start and \c stop requests instead are
  * all asynchronous, which means you'll get a notification about their
@@ -53,6 +57,18 @@
  * actual playout, and \c stop stops whatever the session was for, i.e.,
  * recording or replaying.
  * 
+ * By default each viewer gets a playout of its own. Setting a
+ * \c broadcast_window (in milliseconds) in the plugin configuration
+ * enables broadcast replays instead: viewers asking to \c play the same
+ * recording within that window from the first one all join a single
+ * shared playout, which starts when the window is over, much like
+ * listeners of a Streaming mountpoint. Packets are read only once and
+ * relayed to all viewers, at the cost of a short startup delay. Since
+ * viewers can't be sent a keyframe again, the playout waits for all of
+ * them to have their PeerConnection up before starting, or for a few
+ * seconds more at most, after which those that are still not ready
+ * start receiving the media from where it is.
+ * 
  * The \c list request has to be formatted as follows:
  *
 \verbatim
@@ -247,8 +263,11 @@
 
 #include <dirent.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include <jansson.h>
 
 #include "../debug.h"
@@ -260,6 +279,9 @@
 #include "../rtp.h"
 #include "../rtcp.h"
 #include "../utils.h"
+#include "../timer.h"
+
+#define ntohll(x) ((1==ntohl(1)) ? (x) : ((gint64)ntohl((x) & 0xFFFFFFFF) << 32) | ntohl((x) >> 32))
 
 
 /* Plugin information */
@@ -375,6 +397,14 @@ typedef struct janus_recordplay_frame_packet {
 } janus_recordplay_frame_packet;
 janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, const char *filename);
 
+/* Memory mapping of a recording file, shared by all the viewers that are
+ * watching it: it's kept around as long as at least one of them is */
+typedef struct janus_recordplay_mapping {
+	char *data;			/* Contents of the file */
+	size_t size;		/* Size of the mapping */
+	guint viewers;		/* How many viewers are using this mapping */
+} janus_recordplay_mapping;
+
 typedef struct janus_recordplay_recording {
 	guint64 id;			/* Recording unique ID */
 	char *name;			/* Name of the recording */
@@ -386,6 +416,8 @@ typedef struct janus_recordplay_recording {
 	const char *vcodec;	/* Codec used for video, if available */
 	int video_pt;		/* Payload types to use for audio when playing recordings */
 	gboolean completed;	/* Whether this recording was completed or still going on */
+	char *nfo_file;		/* Name of the .nfo file of this recording, once it's in the catalog */
+	janus_recordplay_mapping *amap, *vmap;	/* Audio and video files mappings, while they're being played */
 	char *offer;		/* The SDP offer that will be sent to watchers */
 	GList *viewers;		/* List of users watching this recording */
 	gint64 destroyed;	/* Lazy timestamp to mark recordings as destroyed */
@@ -407,6 +439,7 @@ typedef struct janus_recordplay_session {
 	janus_mutex rec_mutex;	/* Mutex to protect the recorders from race conditions */
 	janus_recordplay_frame_packet *aframes;	/* Audio frames (for playout) */
 	janus_recordplay_frame_packet *vframes;	/* Video frames (for playout) */
+	struct janus_recordplay_playout *broadcast;	/* Broadcast replay this viewer joined, if any */
 	guint video_remb_startup;
 	gint64 video_remb_last;
 	guint32 video_bitrate;
@@ -424,7 +457,30 @@ static janus_mutex sessions_mutex = JANUS_MUTEX_INITIALIZER;
 
 static char *recordings_path = NULL;
 void janus_recordplay_update_recordings_list(void);
-static void *janus_recordplay_playout_thread(void *data);
+
+/* Broadcast replay: viewers asking for the same recording within a
+ * configurable window share a single playout, rather than getting one each */
+static gint64 broadcast_window = 0;
+/* How long a broadcast replay waits, once the window is over, for viewers that are still not ready */
+#define JANUS_RECORDPLAY_BROADCAST_SETUP_WAIT	(5*G_USEC_PER_SEC)
+static GHashTable *broadcasts = NULL;	/* Broadcasts that can still be joined, by recording ID */
+static janus_mutex broadcasts_mutex = JANUS_MUTEX_INITIALIZER;
+static gboolean janus_recordplay_broadcast_join(janus_recordplay_session *session, janus_recordplay_recording *rec);
+static gboolean janus_recordplay_broadcast_create(janus_recordplay_session *session, janus_recordplay_recording *rec);
+static void janus_recordplay_broadcast_leave(janus_recordplay_session *session);
+
+/* Recordings catalog: rather than parsing all the .nfo files (and opening
+ * the .mjr files they refer to, to find out the codecs) every time, we
+ * keep an append-only index of the recordings in the recordings folder.
+ * Each line either adds (+) or removes (-) a recording: when there are
+ * way more lines than recordings, the file is compacted. */
+#define JANUS_RECORDPLAY_CATALOG	"recordplay.catalog"
+static FILE *catalog = NULL;
+static GHashTable *catalog_nfos = NULL;	/* .nfo file name -> recording ID */
+static guint catalog_lines = 0;
+static time_t catalog_scanned = 0;		/* Changes to the folder before this time are in the catalog */
+static void janus_recordplay_catalog_add(janus_recordplay_recording *rec);
+static gboolean janus_recordplay_playout_start(janus_recordplay_session *session);
 
 /* Helper to send RTCP feedback back to recorders, if needed */
 void janus_recordplay_send_rtcp_feedback(janus_plugin_session *handle, int video, char *buf, int len);
@@ -498,7 +554,12 @@ static const char *janus_recordplay_parse_codec(const char *dir, const char *fil
 			bytes = fread(&len, sizeof(uint16_t), 1, file);
 			len = ntohs(len);
 			offset += 2;
-			if(len > 0 && !parsed_header) {
+			if(parsed_header) {
+				/* Not RTP (e.g., a seek index chunk), skip */
+				offset += len;
+				continue;
+			}
+			if(len > 0) {
 				/* This is the info header */
 				bytes = fread(prebuffer, sizeof(char), len, file);
 				if(bytes < 0) {
@@ -694,6 +755,17 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 		if(!notify_events && callback->events_is_enabled()) {
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_RECORDPLAY_NAME);
 		}
+		janus_config_item *window = janus_config_get_item_drilldown(config, "general", "broadcast_window");
+		if(window != NULL && window->value != NULL) {
+			int ms = atoi(window->value);
+			if(ms < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid broadcast window (%d), disabling broadcast replays\n", ms);
+				ms = 0;
+			}
+			broadcast_window = (gint64)ms*1000;
+			if(broadcast_window > 0)
+				JANUS_LOG(LOG_INFO, "Viewers starting within %dms will share broadcast replays\n", ms);
+		}
 		/* Done */
 		janus_config_destroy(config);
 		config = NULL;
@@ -713,6 +785,7 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 		}
 	}
 	recordings = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
+	broadcasts = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
 	janus_recordplay_update_recordings_list();
 	
 	sessions = g_hash_table_new(NULL, NULL);
@@ -762,6 +835,14 @@ void janus_recordplay_destroy(void) {
 	g_async_queue_unref(messages);
 	messages = NULL;
 	sessions = NULL;
+	janus_mutex_lock(&recordings_mutex);
+	if(catalog != NULL)
+		fclose(catalog);
+	catalog = NULL;
+	if(catalog_nfos != NULL)
+		g_hash_table_destroy(catalog_nfos);
+	catalog_nfos = NULL;
+	janus_mutex_unlock(&recordings_mutex);
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
 	JANUS_LOG(LOG_INFO, "%s destroyed!\n", JANUS_RECORDPLAY_NAME);
@@ -1053,12 +1134,11 @@ void janus_recordplay_setup_media(janus_plugin_session *handle) {
 	g_atomic_int_set(&session->hangingup, 0);
 	/* Take note of the fact that the session is now active */
 	session->active = TRUE;
-	if(!session->recorder) {
-		GError *error = NULL;
-		g_thread_try_new("recordplay playout thread", &janus_recordplay_playout_thread, session, &error);
-		if(error != NULL) {
+	if(!session->recorder && session->broadcast == NULL) {
+		/* Viewers of a broadcast replay don't need a playout of their own */
+		if(!janus_recordplay_playout_start(session)) {
 			/* FIXME Should we notify this back to the user somehow? */
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Record&Play playout thread...\n", error->code, error->message ? error->message : "??");
+			JANUS_LOG(LOG_ERR, "Error starting the Record&Play playout...\n");
 		}
 	}
 	janus_mutex_unlock(&sessions_mutex);
@@ -1187,6 +1267,8 @@ static void janus_recordplay_hangup_media_internal(janus_plugin_session *handle)
 		return;
 	}
 	session->active = FALSE;
+	/* If we were watching a broadcast replay, leave it */
+	janus_recordplay_broadcast_leave(session);
 	if(session->destroyed || !session->recorder) {
 		return;
 	}
@@ -1262,6 +1344,11 @@ static void janus_recordplay_hangup_media_internal(janus_plugin_session *handle)
 				JANUS_LOG(LOG_WARN, "Could not generate offer for recording %"SCNu64"...\n", session->recording->id);
 			}
 			session->recording->completed = TRUE;
+			/* Add the recording to the catalog too */
+			janus_mutex_lock(&recordings_mutex);
+			session->recording->nfo_file = g_strdup_printf("%"SCNu64".nfo", session->recording->id);
+			janus_recordplay_catalog_add(session->recording);
+			janus_mutex_unlock(&recordings_mutex);
 		}
 	}
 }
@@ -1555,6 +1642,9 @@ recdone:
 				g_snprintf(error_cause, 512, "No such recording");
 				goto error;
 			}
+			/* If a broadcast replay of this recording is about to start, just join it */
+			if(broadcast_window > 0 && janus_recordplay_broadcast_join(session, rec))
+				goto joined;
 			/* Access the frames */
 			if(rec->arc_file) {
 				session->aframes = janus_recordplay_get_frames(recordings_path, rec->arc_file);
@@ -1575,9 +1665,15 @@ recdone:
 				g_snprintf(error_cause, 512, "Error opening recording files");
 				goto error;
 			}
+			/* Other viewers starting within the window will share this playout */
+			if(broadcast_window > 0 && !janus_recordplay_broadcast_create(session, rec))
+				JANUS_LOG(LOG_WARN, "Couldn't create a broadcast replay, falling back to a regular playout\n");
+joined:
 			session->recording = rec;
 			session->recorder = FALSE;
+			janus_mutex_lock(&rec->mutex);
 			rec->viewers = g_list_append(rec->viewers, session);
+			janus_mutex_unlock(&rec->mutex);
 			/* Send this viewer the prepared offer  */
 			sdp = g_strdup(rec->offer);
 playdone:
@@ -1689,11 +1785,205 @@ error:
 	return NULL;
 }
 
+/* Helper to finish setting up a recording we imported, once we know its files and codecs */
+static void janus_recordplay_recording_setup(janus_recordplay_recording *rec) {
+	rec->audio_pt = AUDIO_PT;
+	if(rec->acodec) {
+		/* Some audio codecs have a fixed payload type that we can't mess with */
+		if(!strcasecmp(rec->acodec, "pcmu"))
+			rec->audio_pt = 0;
+		else if(!strcasecmp(rec->acodec, "pcma"))
+			rec->audio_pt = 8;
+		else if(!strcasecmp(rec->acodec, "g722"))
+			rec->audio_pt = 9;
+	}
+	rec->video_pt = VIDEO_PT;
+	rec->viewers = NULL;
+	rec->destroyed = 0;
+	rec->completed = TRUE;
+	if(janus_recordplay_generate_offer(rec) < 0) {
+		JANUS_LOG(LOG_WARN, "Could not generate offer for recording %"SCNu64"...\n", rec->id);
+	}
+	janus_mutex_init(&rec->mutex);
+}
+
+/* Helper to get rid of a recording, if no one's watching it: the recordings mutex must be locked */
+static void janus_recordplay_recording_destroy(janus_recordplay_recording *rec) {
+	janus_mutex_lock(&rec->mutex);
+	rec->destroyed = janus_get_monotonic_time();
+	if(rec->viewers == NULL) {
+		JANUS_LOG(LOG_VERB, "Recording %"SCNu64" has no viewers, destroying it now\n", rec->id);
+		janus_mutex_unlock(&rec->mutex);
+		g_free(rec->name);
+		g_free(rec->date);
+		g_free(rec->arc_file);
+		g_free(rec->vrc_file);
+		g_free(rec->offer);
+		g_free(rec->nfo_file);
+		g_free(rec);
+	} else {
+		JANUS_LOG(LOG_VERB, "Recording %"SCNu64" still has viewers, delaying its destruction until later\n", rec->id);
+		janus_mutex_unlock(&rec->mutex);
+	}
+}
+
+/* Catalog fields can't contain separators */
+static void janus_recordplay_catalog_field(GString *line, const char *value) {
+	g_string_append_c(line, '\t');
+	if(value == NULL)
+		return;
+	const char *c = value;
+	for(c = value; *c != '\0'; c++)
+		g_string_append_c(line, (*c == '\t' || *c == '\r' || *c == '\n') ? ' ' : *c);
+}
+
+static void janus_recordplay_catalog_write(FILE *file, janus_recordplay_recording *rec) {
+	GString *line = g_string_new(NULL);
+	g_string_append_printf(line, "+\t%"SCNu64, rec->id);
+	janus_recordplay_catalog_field(line, rec->nfo_file);
+	janus_recordplay_catalog_field(line, rec->name);
+	janus_recordplay_catalog_field(line, rec->date);
+	janus_recordplay_catalog_field(line, rec->arc_file);
+	janus_recordplay_catalog_field(line, rec->acodec);
+	janus_recordplay_catalog_field(line, rec->vrc_file);
+	janus_recordplay_catalog_field(line, rec->vcodec);
+	g_string_append_c(line, '\n');
+	if(fwrite(line->str, sizeof(char), line->len, file) != line->len)
+		JANUS_LOG(LOG_WARN, "Error writing to the recordings catalog...\n");
+	g_string_free(line, TRUE);
+}
+
+/* The following catalog helpers expect the recordings mutex to be locked */
+static void janus_recordplay_catalog_add(janus_recordplay_recording *rec) {
+	if(rec->nfo_file == NULL)
+		return;
+	g_hash_table_insert(catalog_nfos, g_strdup(rec->nfo_file), janus_uint64_dup(rec->id));
+	if(catalog == NULL)
+		return;
+	janus_recordplay_catalog_write(catalog, rec);
+	fflush(catalog);
+	catalog_lines++;
+}
+
+static void janus_recordplay_catalog_remove(janus_recordplay_recording *rec) {
+	if(rec->nfo_file == NULL)
+		return;
+	g_hash_table_remove(catalog_nfos, rec->nfo_file);
+	if(catalog == NULL)
+		return;
+	fprintf(catalog, "-\t%"SCNu64"\n", rec->id);
+	fflush(catalog);
+	catalog_lines++;
+}
+
+static void janus_recordplay_catalog_compact(void) {
+	char path[1024], tmppath[1024];
+	g_snprintf(path, sizeof(path), "%s/%s", recordings_path, JANUS_RECORDPLAY_CATALOG);
+	g_snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	FILE *file = fopen(tmppath, "wt");
+	if(file == NULL) {
+		JANUS_LOG(LOG_WARN, "Couldn't compact the recordings catalog: %s\n", strerror(errno));
+		return;
+	}
+	guint lines = 0;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, recordings);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_recordplay_recording *rec = value;
+		if(rec->nfo_file == NULL)
+			continue;
+		janus_recordplay_catalog_write(file, rec);
+		lines++;
+	}
+	fclose(file);
+	if(rename(tmppath, path) < 0) {
+		JANUS_LOG(LOG_WARN, "Couldn't compact the recordings catalog: %s\n", strerror(errno));
+		unlink(tmppath);
+		return;
+	}
+	JANUS_LOG(LOG_VERB, "Compacted the recordings catalog (%u --> %u lines)\n", catalog_lines, lines);
+	if(catalog != NULL)
+		fclose(catalog);
+	catalog = fopen(path, "at");
+	catalog_lines = lines;
+}
+
+/* Load the recordings from the catalog, and open it to append new changes */
+static void janus_recordplay_catalog_load(void) {
+	char path[1024];
+	g_snprintf(path, sizeof(path), "%s/%s", recordings_path, JANUS_RECORDPLAY_CATALOG);
+	catalog_nfos = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)g_free);
+	FILE *file = fopen(path, "rt");
+	if(file != NULL) {
+		struct stat st;
+		if(fstat(fileno(file), &st) == 0)
+			catalog_scanned = st.st_mtime;
+		char line[4096];
+		while(fgets(line, sizeof(line), file) != NULL) {
+			catalog_lines++;
+			g_strchomp(line);
+			gchar **fields = g_strsplit(line, "\t", -1);
+			guint num = g_strv_length(fields);
+			guint64 id = num > 1 ? g_ascii_strtoull(fields[1], NULL, 0) : 0;
+			if(id == 0 || (fields[0][0] == '+' && num < 9)) {
+				JANUS_LOG(LOG_WARN, "Invalid line %u in the recordings catalog, skipping...\n", catalog_lines);
+				g_strfreev(fields);
+				continue;
+			}
+			/* Whether it's an addition or a removal, get rid of the previous version */
+			janus_recordplay_recording *rec = g_hash_table_lookup(recordings, &id);
+			if(rec != NULL) {
+				g_hash_table_remove(recordings, &id);
+				if(rec->nfo_file)
+					g_hash_table_remove(catalog_nfos, rec->nfo_file);
+				janus_recordplay_recording_destroy(rec);
+			}
+			if(fields[0][0] == '+') {
+				rec = g_malloc0(sizeof(janus_recordplay_recording));
+				rec->id = id;
+				rec->nfo_file = g_strdup(fields[2]);
+				rec->name = g_strdup(fields[3]);
+				rec->date = g_strdup(fields[4]);
+				if(strlen(fields[5]) > 0) {
+					rec->arc_file = g_strdup(fields[5]);
+					if(strlen(fields[6]) > 0)
+						rec->acodec = janus_sdp_match_preferred_codec(JANUS_SDP_AUDIO, fields[6]);
+				}
+				if(strlen(fields[7]) > 0) {
+					rec->vrc_file = g_strdup(fields[7]);
+					if(strlen(fields[8]) > 0)
+						rec->vcodec = janus_sdp_match_preferred_codec(JANUS_SDP_VIDEO, fields[8]);
+				}
+				janus_recordplay_recording_setup(rec);
+				g_hash_table_insert(recordings, janus_uint64_dup(rec->id), rec);
+				g_hash_table_insert(catalog_nfos, g_strdup(rec->nfo_file), janus_uint64_dup(rec->id));
+			}
+			g_strfreev(fields);
+		}
+		fclose(file);
+		JANUS_LOG(LOG_INFO, "Loaded %u recordings from the catalog\n", g_hash_table_size(recordings));
+	}
+	catalog = fopen(path, "at");
+	if(catalog == NULL)
+		JANUS_LOG(LOG_WARN, "Couldn't open the recordings catalog %s (%s), changes won't be saved\n", path, strerror(errno));
+}
+
 void janus_recordplay_update_recordings_list(void) {
 	if(recordings_path == NULL)
 		return;
-	JANUS_LOG(LOG_VERB, "Updating recordings list in %s\n", recordings_path);
 	janus_mutex_lock(&recordings_mutex);
+	if(catalog_nfos == NULL)
+		janus_recordplay_catalog_load();
+	/* If nothing changed in the folder since we last looked, we're done */
+	struct stat st;
+	if(stat(recordings_path, &st) == 0 && st.st_mtime < catalog_scanned) {
+		JANUS_LOG(LOG_VERB, "Recordings list in %s is up to date\n", recordings_path);
+		janus_mutex_unlock(&recordings_mutex);
+		return;
+	}
+	JANUS_LOG(LOG_VERB, "Updating recordings list in %s\n", recordings_path);
+	time_t scan_started = time(NULL);
 	/* First of all, let's keep track of which recordings are currently available */
 	GList *old_recordings = NULL;
 	if(recordings != NULL && g_hash_table_size(recordings) > 0) {
@@ -1723,6 +2013,13 @@ void janus_recordplay_update_recordings_list(void) {
 			continue;
 		if(strcasecmp(recent->d_name+len-4, ".nfo"))
 			continue;
+		/* If we know about this recording already, there's nothing to parse */
+		guint64 *known = g_hash_table_lookup(catalog_nfos, recent->d_name);
+		janus_recordplay_recording *rec = known ? g_hash_table_lookup(recordings, known) : NULL;
+		if(rec != NULL) {
+			old_recordings = g_list_remove(old_recordings, &rec->id);
+			continue;
+		}
 		JANUS_LOG(LOG_VERB, "Importing recording '%s'...\n", recent->d_name);
 		memset(recpath, 0, 1024);
 		g_snprintf(recpath, 1024, "%s/%s", recordings_path, recent->d_name);
@@ -1744,7 +2041,7 @@ void janus_recordplay_update_recordings_list(void) {
 			janus_config_destroy(nfo);
 			continue;
 		}
-		janus_recordplay_recording *rec = g_hash_table_lookup(recordings, &id);
+		rec = g_hash_table_lookup(recordings, &id);
 		if(rec != NULL) {
 			JANUS_LOG(LOG_VERB, "Skipping recording with ID %"SCNu64", it's already in the list...\n", id);
 			janus_config_destroy(nfo);
@@ -1786,62 +2083,218 @@ void janus_recordplay_update_recordings_list(void) {
 			/* Check which codec is in this recording */
 			rec->vcodec = janus_recordplay_parse_codec(recordings_path, rec->vrc_file);
 		}
-		rec->audio_pt = AUDIO_PT;
-		if(rec->acodec) {
-			/* Some audio codecs have a fixed payload type that we can't mess with */
-			if(!strcasecmp(rec->acodec, "pcmu"))
-				rec->audio_pt = 0;
-			else if(!strcasecmp(rec->acodec, "pcma"))
-				rec->audio_pt = 8;
-			else if(!strcasecmp(rec->acodec, "g722"))
-				rec->audio_pt = 9;
-		}
-		rec->video_pt = VIDEO_PT;
-		rec->viewers = NULL;
-		rec->destroyed = 0;
-		rec->completed = TRUE;
-		if(janus_recordplay_generate_offer(rec) < 0) {
-			JANUS_LOG(LOG_WARN, "Could not generate offer for recording %"SCNu64"...\n", rec->id);
-		}
-		janus_mutex_init(&rec->mutex);
+		rec->nfo_file = g_strdup(recent->d_name);
+		janus_recordplay_recording_setup(rec);
 		
 		janus_config_destroy(nfo);
 
-		/* Add to the list of recordings */
+		/* Add to the list of recordings, and to the catalog */
 		g_hash_table_insert(recordings, janus_uint64_dup(rec->id), rec);
+		janus_recordplay_catalog_add(rec);
 	}
 	closedir(dir);
 	/* Now let's check if any of the previously existing recordings was removed */
-	if(old_recordings != NULL) {
-		while(old_recordings != NULL) {
-			guint64 id = *((guint64 *)old_recordings->data);
-			JANUS_LOG(LOG_VERB, "Recording %"SCNu64" is not available anymore, removing...\n", id);
-			janus_recordplay_recording *old_rec = g_hash_table_lookup(recordings, &id);
-			if(old_rec != NULL) {
-				/* Remove it */
-				g_hash_table_remove(recordings, &id);
-				/* Only destroy the object if no one's watching, though */
-				janus_mutex_lock(&old_rec->mutex);
-				old_rec->destroyed = janus_get_monotonic_time();
-				if(old_rec->viewers == NULL) {
-					JANUS_LOG(LOG_VERB, "Recording %"SCNu64" has no viewers, destroying it now\n", id);
-					janus_mutex_unlock(&old_rec->mutex);
-					g_free(old_rec->name);
-					g_free(old_rec->date);
-					g_free(old_rec->arc_file);
-					g_free(old_rec->vrc_file);
-					g_free(old_rec->offer);
-					g_free(old_rec);
+	GList *ol = old_recordings;
+	while(ol != NULL) {
+		guint64 id = *((guint64 *)ol->data);
+		JANUS_LOG(LOG_VERB, "Recording %"SCNu64" is not available anymore, removing...\n", id);
+		janus_recordplay_recording *old_rec = g_hash_table_lookup(recordings, &id);
+		if(old_rec != NULL) {
+			/* Remove it */
+			janus_recordplay_catalog_remove(old_rec);
+			g_hash_table_remove(recordings, &id);
+			/* Only destroy the object if no one's watching, though */
+			janus_recordplay_recording_destroy(old_rec);
+		}
+		ol = ol->next;
+	}
+	g_list_free(old_recordings);
+	catalog_scanned = scan_started;
+	/* Compact the catalog, if it got too big */
+	if(catalog_lines > 2*g_hash_table_size(catalog_nfos) + 64)
+		janus_recordplay_catalog_compact();
+	janus_mutex_unlock(&recordings_mutex);
+}
+
+/* Seek index entry, as read from a recording */
+typedef struct janus_recordplay_index_entry {
+	long offset;
+	uint32_t ts;
+	uint16_t seq;
+	uint16_t len;
+} janus_recordplay_index_entry;
+
+/* Load the seek index of a recording, if it has one: the entries are
+ * returned in the order the packets were saved, NULL means the whole
+ * file will have to be scanned instead (e.g., older recordings) */
+static janus_recordplay_index_entry *janus_recordplay_read_index(FILE *file, long fsize, uint32_t *entries_num) {
+	if(fsize < JANUS_RECORDER_TRAILER_SIZE)
+		return NULL;
+	char block[JANUS_RECORDER_TRAILER_SIZE];
+	uint16_t len = 0;
+	uint32_t total = 0;
+	uint64_t chunk = 0;
+	fseek(file, fsize-JANUS_RECORDER_TRAILER_SIZE, SEEK_SET);
+	if(fread(block, sizeof(char), JANUS_RECORDER_TRAILER_SIZE, file) != JANUS_RECORDER_TRAILER_SIZE ||
+			memcmp(block, JANUS_RECORDER_TRAILER_HEADER, 8))
+		return NULL;
+	memcpy(&len, block+8, sizeof(uint16_t));
+	memcpy(&total, block+10, sizeof(uint32_t));
+	memcpy(&chunk, block+18, sizeof(uint64_t));
+	total = ntohl(total);
+	chunk = ntohll(chunk);
+	if(ntohs(len) != JANUS_RECORDER_INDEX_PREFIX_SIZE || total == 0)
+		return NULL;
+	/* Chunks are linked backwards, starting from the last one */
+	janus_recordplay_index_entry *entries = g_malloc(total * sizeof(janus_recordplay_index_entry));
+	char *data = g_malloc(JANUS_RECORDER_INDEX_CHUNK_ENTRIES * JANUS_RECORDER_INDEX_ENTRY_SIZE * 2);
+	uint32_t left = total, n = 0, i = 0;
+	while(left > 0 && chunk > 0 && chunk < (uint64_t)fsize) {
+		fseek(file, chunk, SEEK_SET);
+		if(fread(block, sizeof(char), JANUS_RECORDER_TRAILER_SIZE, file) != JANUS_RECORDER_TRAILER_SIZE ||
+				memcmp(block, JANUS_RECORDER_INDEX_HEADER, 8))
+			break;
+		memcpy(&len, block+8, sizeof(uint16_t));
+		memcpy(&n, block+10, sizeof(uint32_t));
+		memcpy(&chunk, block+18, sizeof(uint64_t));
+		len = ntohs(len);
+		n = ntohl(n);
+		chunk = ntohll(chunk);
+		if(n == 0 || n > left || n > JANUS_RECORDER_INDEX_CHUNK_ENTRIES*2 ||
+				len != JANUS_RECORDER_INDEX_PREFIX_SIZE + n*JANUS_RECORDER_INDEX_ENTRY_SIZE)
+			break;
+		if(fread(data, sizeof(char), n*JANUS_RECORDER_INDEX_ENTRY_SIZE, file) != n*JANUS_RECORDER_INDEX_ENTRY_SIZE)
+			break;
+		left -= n;
+		for(i=0; i<n; i++) {
+			char *entry = data + i*JANUS_RECORDER_INDEX_ENTRY_SIZE;
+			janus_recordplay_index_entry *e = &entries[left+i];
+			uint64_t offset = 0;
+			memcpy(&offset, entry, sizeof(uint64_t));
+			e->offset = ntohll(offset);
+			memcpy(&e->ts, entry+8, sizeof(uint32_t));
+			e->ts = ntohl(e->ts);
+			memcpy(&e->seq, entry+12, sizeof(uint16_t));
+			e->seq = ntohs(e->seq);
+			memcpy(&e->len, entry+14, sizeof(uint16_t));
+			e->len = ntohs(e->len);
+		}
+	}
+	g_free(data);
+	if(left > 0) {
+		JANUS_LOG(LOG_WARN, "Broken seek index, scanning the file instead...\n");
+		g_free(entries);
+		return NULL;
+	}
+	*entries_num = total;
+	return entries;
+}
+
+/* Check whether a packet timestamp signals a timestamp reset in the recording */
+static void janus_recordplay_check_reset(uint32_t ts, uint32_t *first_ts, uint32_t *last_ts, uint32_t *reset) {
+	if(*last_ts == 0) {
+		*first_ts = ts;
+		if(*first_ts > 1000*1000)	/* Just used to check whether a packet is pre- or post-reset */
+			*first_ts -= 1000*1000;
+	} else {
+		if(ts < *last_ts) {
+			/* The new timestamp is smaller than the next one, is it a timestamp reset or simply out of order? */
+			if(*last_ts-ts > 2*1000*1000*1000) {
+				*reset = ts;
+				JANUS_LOG(LOG_VERB, "Timestamp reset: %"SCNu32"\n", *reset);
+			}
+		} else if(ts < *reset) {
+			JANUS_LOG(LOG_VERB, "Updating timestamp reset: %"SCNu32" (was %"SCNu32")\n", ts, *reset);
+			*reset = ts;
+		}
+	}
+	*last_ts = ts;
+}
+
+/* Turn a packet timestamp into the 64-bit timestamp we order packets by */
+static uint64_t janus_recordplay_frame_ts(uint32_t ts, uint32_t first_ts, uint32_t reset) {
+	if(reset == 0) {
+		/* Simple enough... */
+		return ts;
+	}
+	/* Is this packet pre- or post-reset? */
+	if(ts > first_ts) {
+		/* Pre-reset... */
+		return ts;
+	}
+	/* Post-reset... */
+	uint64_t max32 = UINT32_MAX;
+	max32++;
+	return max32+ts;
+}
+
+/* Insert a frame packet in the ordered list, starting from the end */
+static void janus_recordplay_frame_insert(janus_recordplay_frame_packet **list, janus_recordplay_frame_packet **last, janus_recordplay_frame_packet *p) {
+	if(*list == NULL) {
+		/* First element becomes the list itself (and the last item), at least for now */
+		*list = p;
+		*last = p;
+	} else {
+		/* Check where we should insert this, starting from the end */
+		int added = 0;
+		janus_recordplay_frame_packet *tmp = *last;
+		while(tmp) {
+			if(tmp->ts < p->ts) {
+				/* The new timestamp is greater than the last one we have, append */
+				added = 1;
+				if(tmp->next != NULL) {
+					/* We're inserting */
+					tmp->next->prev = p;
+					p->next = tmp->next;
 				} else {
-					JANUS_LOG(LOG_VERB, "Recording %"SCNu64" still has viewers, delaying its destruction until later\n", id);
-					janus_mutex_unlock(&old_rec->mutex);
+					/* Update the last packet */
+					*last = p;
+				}
+				tmp->next = p;
+				p->prev = tmp;
+				break;
+			} else if(tmp->ts == p->ts) {
+				/* Same timestamp, check the sequence number */
+				if(tmp->seq < p->seq && (abs(tmp->seq - p->seq) < 10000)) {
+					/* The new sequence number is greater than the last one we have, append */
+					added = 1;
+					if(tmp->next != NULL) {
+						/* We're inserting */
+						tmp->next->prev = p;
+						p->next = tmp->next;
+					} else {
+						/* Update the last packet */
+						*last = p;
+					}
+					tmp->next = p;
+					p->prev = tmp;
+					break;
+				} else if(tmp->seq > p->seq && (abs(tmp->seq - p->seq) > 10000)) {
+					/* The new sequence number (resetted) is greater than the last one we have, append */
+					added = 1;
+					if(tmp->next != NULL) {
+						/* We're inserting */
+						tmp->next->prev = p;
+						p->next = tmp->next;
+					} else {
+						/* Update the last packet */
+						*last = p;
+					}
+					tmp->next = p;
+					p->prev = tmp;
+					break;
 				}
 			}
-			old_recordings = old_recordings->next;
+			/* If either the timestamp ot the sequence number we just got is smaller, keep going back */
+			tmp = tmp->prev;
+		}
+		if(!added) {
+			/* We reached the start */
+			p->next = *list;
+			(*list)->prev = p;
+			*list = p;
 		}
-		g_list_free(old_recordings);
 	}
-	janus_mutex_unlock(&recordings_mutex);
 }
 
 janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, const char *filename) {
@@ -1863,6 +2316,12 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 	fseek(file, 0L, SEEK_SET);
 	JANUS_LOG(LOG_VERB, "File is %zu bytes\n", fsize);
 
+	/* If the recording has a seek index, we don't need to scan it */
+	uint32_t index_num = 0, index_next = 0;
+	janus_recordplay_index_entry *index = janus_recordplay_read_index(file, fsize, &index_num);
+	if(index != NULL)
+		JANUS_LOG(LOG_VERB, "Using the seek index of %s (%"SCNu32" packets)\n", source, index_num);
+
 	/* Pre-parse */
 	JANUS_LOG(LOG_VERB, "Pre-parsing file %s to generate ordered index...\n", source);
 	gboolean parsed_header = FALSE;
@@ -1872,8 +2331,8 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 	uint32_t first_ts = 0, last_ts = 0, reset = 0;	/* To handle whether there's a timestamp reset in the recording */
 	char prebuffer[1500];
 	memset(prebuffer, 0, 1500);
-	/* Let's look for timestamp resets first */
-	while(offset < fsize) {
+	/* Let's look for timestamp resets first (the seek index has all the timestamps already, if we have it) */
+	while(index == NULL && offset < fsize) {
 		/* Read frame header */
 		fseek(file, offset, SEEK_SET);
 		bytes = fread(prebuffer, sizeof(char), 8, file);
@@ -1990,6 +2449,9 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 				JANUS_LOG(LOG_VERB, "  -- Written: %"SCNi64"\n", w_time);
 				json_decref(info);
 			}
+			/* Whether this was the info header or not (e.g., a seek index chunk), it's not RTP */
+			offset += len;
+			continue;
 		} else {
 			JANUS_LOG(LOG_ERR, "Invalid header...\n");
 			fclose(file);
@@ -1998,30 +2460,16 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 		/* Only read RTP header */
 		bytes = fread(prebuffer, sizeof(char), 16, file);
 		janus_rtp_header *rtp = (janus_rtp_header *)prebuffer;
-		if(last_ts == 0) {
-			first_ts = ntohl(rtp->timestamp);
-			if(first_ts > 1000*1000)	/* Just used to check whether a packet is pre- or post-reset */
-				first_ts -= 1000*1000;
-		} else {
-			if(ntohl(rtp->timestamp) < last_ts) {
-				/* The new timestamp is smaller than the next one, is it a timestamp reset or simply out of order? */
-				if(last_ts-ntohl(rtp->timestamp) > 2*1000*1000*1000) {
-					reset = ntohl(rtp->timestamp);
-					JANUS_LOG(LOG_VERB, "Timestamp reset: %"SCNu32"\n", reset);
-				}
-			} else if(ntohl(rtp->timestamp) < reset) {
-				JANUS_LOG(LOG_VERB, "Updating timestamp reset: %"SCNu32" (was %"SCNu32")\n", ntohl(rtp->timestamp), reset);
-				reset = ntohl(rtp->timestamp);
-			}
-		}
-		last_ts = ntohl(rtp->timestamp);
+		janus_recordplay_check_reset(ntohl(rtp->timestamp), &first_ts, &last_ts, &reset);
 		/* Skip data for now */
 		offset += len;
 	}
+	for(index_next = 0; index != NULL && index_next < index_num; index_next++)
+		janus_recordplay_check_reset(index[index_next].ts, &first_ts, &last_ts, &reset);
 	/* Now let's parse the frames and order them */
 	offset = 0;
 	janus_recordplay_frame_packet *list = NULL, *last = NULL;
-	while(offset < fsize) {
+	while(index == NULL && offset < fsize) {
 		/* Read frame header */
 		fseek(file, offset, SEEK_SET);
 		bytes = fread(prebuffer, sizeof(char), 8, file);
@@ -2050,94 +2498,28 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 		/* Generate frame packet and insert in the ordered list */
 		janus_recordplay_frame_packet *p = g_malloc(sizeof(janus_recordplay_frame_packet));
 		p->seq = ntohs(rtp->seq_number);
-		if(reset == 0) {
-			/* Simple enough... */
-			p->ts = ntohl(rtp->timestamp);
-		} else {
-			/* Is this packet pre- or post-reset? */
-			if(ntohl(rtp->timestamp) > first_ts) {
-				/* Pre-reset... */
-				p->ts = ntohl(rtp->timestamp);
-			} else {
-				/* Post-reset... */
-				uint64_t max32 = UINT32_MAX;
-				max32++;
-				p->ts = max32+ntohl(rtp->timestamp);
-			}
-		}
+		p->ts = janus_recordplay_frame_ts(ntohl(rtp->timestamp), first_ts, reset);
 		p->len = len;
 		p->offset = offset;
 		p->next = NULL;
 		p->prev = NULL;
-		if(list == NULL) {
-			/* First element becomes the list itself (and the last item), at least for now */
-			list = p;
-			last = p;
-		} else {
-			/* Check where we should insert this, starting from the end */
-			int added = 0;
-			janus_recordplay_frame_packet *tmp = last;
-			while(tmp) {
-				if(tmp->ts < p->ts) {
-					/* The new timestamp is greater than the last one we have, append */
-					added = 1;
-					if(tmp->next != NULL) {
-						/* We're inserting */
-						tmp->next->prev = p;
-						p->next = tmp->next;
-					} else {
-						/* Update the last packet */
-						last = p;
-					}
-					tmp->next = p;
-					p->prev = tmp;
-					break;
-				} else if(tmp->ts == p->ts) {
-					/* Same timestamp, check the sequence number */
-					if(tmp->seq < p->seq && (abs(tmp->seq - p->seq) < 10000)) {
-						/* The new sequence number is greater than the last one we have, append */
-						added = 1;
-						if(tmp->next != NULL) {
-							/* We're inserting */
-							tmp->next->prev = p;
-							p->next = tmp->next;
-						} else {
-							/* Update the last packet */
-							last = p;
-						}
-						tmp->next = p;
-						p->prev = tmp;
-						break;
-					} else if(tmp->seq > p->seq && (abs(tmp->seq - p->seq) > 10000)) {
-						/* The new sequence number (resetted) is greater than the last one we have, append */
-						added = 1;
-						if(tmp->next != NULL) {
-							/* We're inserting */
-							tmp->next->prev = p;
-							p->next = tmp->next;
-						} else {
-							/* Update the last packet */
-							last = p;
-						}
-						tmp->next = p;
-						p->prev = tmp;
-						break;
-					}
-				}
-				/* If either the timestamp ot the sequence number we just got is smaller, keep going back */
-				tmp = tmp->prev;
-			}
-			if(!added) {
-				/* We reached the start */
-				p->next = list;
-				list->prev = p;
-				list = p;
-			}
-		}
+		janus_recordplay_frame_insert(&list, &last, p);
 		/* Skip data for now */
 		offset += len;
 		count++;
 	}
+	for(index_next = 0; index != NULL && index_next < index_num; index_next++) {
+		janus_recordplay_frame_packet *p = g_malloc(sizeof(janus_recordplay_frame_packet));
+		p->seq = index[index_next].seq;
+		p->ts = janus_recordplay_frame_ts(index[index_next].ts, first_ts, reset);
+		p->len = index[index_next].len;
+		p->offset = index[index_next].offset;
+		p->next = NULL;
+		p->prev = NULL;
+		janus_recordplay_frame_insert(&list, &last, p);
+		count++;
+	}
+	g_free(index);
 	
 	JANUS_LOG(LOG_VERB, "Counted %"SCNu16" RTP packets\n", count);
 	janus_recordplay_frame_packet *tmp = list;
@@ -2154,261 +2536,420 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 	return list;
 }
 
-static void *janus_recordplay_playout_thread(void *data) {
-	janus_recordplay_session *session = (janus_recordplay_session *)data;
-	if(!session) {
-		JANUS_LOG(LOG_ERR, "Invalid session, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+/* State of a playout: it's a task driven by the timer service, that is
+ * invoked when the next audio or video packet is due. A playout is either
+ * for a single viewer, or a broadcast replay shared by many of them */
+typedef struct janus_recordplay_playout {
+	janus_recordplay_session *session;	/* Viewer, if this is not a broadcast */
+	janus_recordplay_recording *recording;
+	janus_recordplay_frame_packet *aframes, *vframes;	/* Frames (only owned by broadcasts) */
+	GList *viewers;		/* Viewers of a broadcast */
+	gboolean started;	/* Whether a broadcast started */
+	gint64 closes;		/* When the broadcast window is over, and the broadcast can't be joined anymore */
+	janus_mutex mutex;	/* Mutex to protect the viewers list */
+	janus_recordplay_mapping *amap, *vmap;	/* Shared mappings of the files, if available */
+	FILE *afile, *vfile;	/* Only used if we couldn't map the files */
+	char *buffer;
+	janus_recordplay_frame_packet *audio, *video;	/* Next packets to send */
+	gint64 adue, vdue;	/* When they're due (monotonic) */
+	int audio_pt, video_pt;
+	int akhz, vkhz;
+} janus_recordplay_playout;
+
+/* Open a recording file for playout: we try to use a mapping shared by all
+ * the viewers of the recording first, and fallback to reading the file */
+static gboolean janus_recordplay_playout_open(janus_recordplay_recording *rec, gboolean video,
+		janus_recordplay_mapping **map, FILE **file) {
+	char source[1024];
+	const char *name = video ? rec->vrc_file : rec->arc_file;
+	if(strstr(name, ".mjr"))
+		g_snprintf(source, 1024, "%s/%s", recordings_path, name);
+	else
+		g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, name);
+	janus_mutex_lock(&rec->mutex);
+	janus_recordplay_mapping **shared = video ? &rec->vmap : &rec->amap;
+	if(*shared == NULL) {
+		int fd = open(source, O_RDONLY);
+		struct stat st;
+		if(fd > -1 && fstat(fd, &st) == 0 && st.st_size > 0) {
+			void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if(data != MAP_FAILED) {
+				*shared = g_malloc0(sizeof(janus_recordplay_mapping));
+				(*shared)->data = data;
+				(*shared)->size = st.st_size;
+				JANUS_LOG(LOG_VERB, "Mapped %s for playout (%zu bytes)\n", source, (*shared)->size);
+			} else {
+				JANUS_LOG(LOG_WARN, "Couldn't map %s (%s), reading it instead\n", source, strerror(errno));
+			}
+		}
+		if(fd > -1)
+			close(fd);
 	}
-	if(session->recorder) {
-		JANUS_LOG(LOG_ERR, "This is a recorder, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+	if(*shared != NULL) {
+		(*shared)->viewers++;
+		*map = *shared;
+		janus_mutex_unlock(&rec->mutex);
+		return TRUE;
 	}
-	if(!session->aframes && !session->vframes) {
-		JANUS_LOG(LOG_ERR, "No audio and no video frames, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+	janus_mutex_unlock(&rec->mutex);
+	*file = fopen(source, "rb");
+	if(*file == NULL) {
+		JANUS_LOG(LOG_ERR, "Could not open %s file %s, can't start playout...\n", video ? "video" : "audio", source);
+		return FALSE;
 	}
-	JANUS_LOG(LOG_INFO, "Joining playout thread\n");
-	/* Open the files */
-	FILE *afile = NULL, *vfile = NULL;
-	if(session->aframes) {
-		char source[1024];
-		if(strstr(session->recording->arc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, session->recording->arc_file);
+	return TRUE;
+}
+
+/* Stop using a recording file for playout: the last viewer unmaps it */
+static void janus_recordplay_playout_close(janus_recordplay_recording *rec, gboolean video,
+		janus_recordplay_mapping *map, FILE *file) {
+	if(file != NULL)
+		fclose(file);
+	if(map == NULL)
+		return;
+	janus_mutex_lock(&rec->mutex);
+	map->viewers--;
+	if(map->viewers == 0) {
+		munmap(map->data, map->size);
+		g_free(map);
+		if(video)
+			rec->vmap = NULL;
 		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, session->recording->arc_file);
-		afile = fopen(source, "rb");
-		if(afile == NULL) {
-			JANUS_LOG(LOG_ERR, "Could not open audio file %s, can't start playout thread...\n", source);
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
+			rec->amap = NULL;
 	}
-	if(session->vframes) {
-		char source[1024];
-		if(strstr(session->recording->vrc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, session->recording->vrc_file);
-		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, session->recording->vrc_file);
-		vfile = fopen(source, "rb");
-		if(vfile == NULL) {
-			JANUS_LOG(LOG_ERR, "Could not open video file %s, can't start playout thread...\n", source);
-			if(afile)
-				fclose(afile);
-			afile = NULL;
-			g_thread_unref(g_thread_self());
-			return NULL;
+	janus_mutex_unlock(&rec->mutex);
+}
+
+/* Get a frame to send, either from the shared mapping or from the file */
+static int janus_recordplay_playout_read(janus_recordplay_mapping *map, FILE *file,
+		char *buffer, janus_recordplay_frame_packet *frame) {
+	if(map != NULL) {
+		if(frame->offset < 0 || (size_t)frame->offset + frame->len > map->size)
+			return 0;
+		memcpy(buffer, map->data + frame->offset, frame->len);
+		return frame->len;
+	}
+	return pread(fileno(file), buffer, frame->len, frame->offset);
+}
+
+static void janus_recordplay_frames_free(janus_recordplay_frame_packet *list) {
+	janus_recordplay_frame_packet *tmp = NULL;
+	while(list) {
+		tmp = list->next;
+		g_free(list);
+		list = tmp;
+	}
+}
+
+/* A viewer is done with a recording: if the recording was destroyed in
+ * the meanwhile, the last viewer to leave gets rid of it */
+static void janus_recordplay_viewer_done(janus_recordplay_session *session) {
+	if(session->recording == NULL || !session->recording->destroyed)
+		return;
+	/* Remove from the list of viewers */
+	janus_mutex_lock(&session->recording->mutex);
+	session->recording->viewers = g_list_remove(session->recording->viewers, session);
+	if(session->recording->viewers == NULL) {
+		/* This was the last viewer, destroying the recording */
+		JANUS_LOG(LOG_VERB, "Last viewer stopped playout of recording %"SCNu64", destroying it now\n", session->recording->id);
+		janus_mutex_unlock(&session->recording->mutex);
+		g_free(session->recording->name);
+		g_free(session->recording->date);
+		g_free(session->recording->arc_file);
+		g_free(session->recording->vrc_file);
+		g_free(session->recording->offer);
+		g_free(session->recording->nfo_file);
+		g_free(session->recording);
+		session->recording = NULL;
+	} else {
+		/* Other viewers still on, don't do anything */
+		JANUS_LOG(LOG_VERB, "Recording %"SCNu64" still has viewers, delaying its destruction until later\n", session->recording->id);
+		janus_mutex_unlock(&session->recording->mutex);
+	}
+}
+
+static void janus_recordplay_playout_done(janus_recordplay_playout *playout) {
+	janus_recordplay_session *session = playout->session;
+	g_free(playout->buffer);
+
+	if(playout->amap || playout->afile)
+		janus_recordplay_playout_close(playout->recording, FALSE, playout->amap, playout->afile);
+	if(playout->vmap || playout->vfile)
+		janus_recordplay_playout_close(playout->recording, TRUE, playout->vmap, playout->vfile);
+
+	GList *viewers = NULL;
+	if(session != NULL) {
+		/* Get rid of the indexes */
+		janus_recordplay_frames_free(session->aframes);
+		session->aframes = NULL;
+		janus_recordplay_frames_free(session->vframes);
+		session->vframes = NULL;
+		viewers = g_list_append(NULL, session);
+	} else {
+		/* This is a broadcast: detach all the viewers that are still here */
+		janus_mutex_lock(&broadcasts_mutex);
+		if(g_hash_table_lookup(broadcasts, &playout->recording->id) == playout)
+			g_hash_table_remove(broadcasts, &playout->recording->id);
+		janus_mutex_lock(&playout->mutex);
+		viewers = playout->viewers;
+		playout->viewers = NULL;
+		janus_mutex_unlock(&playout->mutex);
+		GList *vl = viewers;
+		while(vl) {
+			janus_recordplay_session *viewer = (janus_recordplay_session *)vl->data;
+			viewer->broadcast = NULL;
+			viewer->aframes = NULL;
+			viewer->vframes = NULL;
+			vl = vl->next;
 		}
+		janus_mutex_unlock(&broadcasts_mutex);
+		janus_recordplay_frames_free(playout->aframes);
+		janus_recordplay_frames_free(playout->vframes);
+		JANUS_LOG(LOG_INFO, "Broadcast replay of recording %"SCNu64" over (%d viewers left)\n",
+			playout->recording->id, g_list_length(viewers));
 	}
-	
-	/* Timer */
-	gboolean asent = FALSE, vsent = FALSE;
-	struct timeval now, abefore, vbefore;
-	time_t d_s, d_us;
-	gettimeofday(&now, NULL);
-	gettimeofday(&abefore, NULL);
-	gettimeofday(&vbefore, NULL);
-
-	janus_recordplay_frame_packet *audio = session->aframes, *video = session->vframes;
-	char *buffer = g_malloc0(1500);
-	int bytes = 0;
-	int64_t ts_diff = 0, passed = 0;
+	janus_mutex_destroy(&playout->mutex);
+	g_free(playout);
+
+	GList *vl = viewers;
+	while(vl) {
+		janus_recordplay_session *viewer = (janus_recordplay_session *)vl->data;
+		janus_recordplay_viewer_done(viewer);
+		/* Tell the core to tear down the PeerConnection, hangup_media will do the rest */
+		gateway->close_pc(viewer->handle);
+		vl = vl->next;
+	}
+	g_list_free(viewers);
 
-	int audio_pt = session->recording->audio_pt;
-	int video_pt = session->recording->video_pt;
+	JANUS_LOG(LOG_INFO, "Leaving playout\n");
+}
 
-	int akhz = 48;
-	if(audio_pt == 0 || audio_pt == 8 || audio_pt == 9)
-		akhz = 8;
-	int vkhz = 90;
+/* Send a packet to the viewer of a playout, or to all the viewers of a broadcast */
+static void janus_recordplay_playout_relay(janus_recordplay_playout *playout, int video, char *buffer, int len) {
+	if(gateway == NULL)
+		return;
+	if(playout->session != NULL) {
+		gateway->relay_rtp(playout->session->handle, video, buffer, len);
+		return;
+	}
+	janus_mutex_lock_nodebug(&playout->mutex);
+	GList *vl = playout->viewers;
+	while(vl) {
+		janus_recordplay_session *viewer = (janus_recordplay_session *)vl->data;
+		if(viewer->active && !viewer->destroyed)
+			gateway->relay_rtp(viewer->handle, video, buffer, len);
+		vl = vl->next;
+	}
+	janus_mutex_unlock_nodebug(&playout->mutex);
+}
 
-	while(!session->destroyed && session->active && !session->recording->destroyed && (audio || video)) {
-		if(!asent && !vsent) {
-			/* We skipped the last round, so sleep a bit (5ms) */
-			g_usleep(5000);
+static gint64 janus_recordplay_playout_tick(gint64 now, gpointer data) {
+	janus_recordplay_playout *playout = (janus_recordplay_playout *)data;
+	janus_recordplay_session *session = playout->session;
+	if(g_atomic_int_get(&stopping) || playout->recording->destroyed ||
+			(session && (session->destroyed || !session->active))) {
+		janus_recordplay_playout_done(playout);
+		return -1;
+	}
+	if(session == NULL) {
+		if(!playout->started) {
+			/* The broadcast window is over, new viewers will get a new playout */
+			janus_mutex_lock(&broadcasts_mutex);
+			if(g_hash_table_lookup(broadcasts, &playout->recording->id) == playout)
+				g_hash_table_remove(broadcasts, &playout->recording->id);
+			janus_mutex_unlock(&broadcasts_mutex);
 		}
-		asent = FALSE;
-		vsent = FALSE;
-		if(audio) {
-			if(audio == session->aframes) {
-				/* First packet, send now */
-				fseek(afile, audio->offset, SEEK_SET);
-				bytes = fread(buffer, sizeof(char), audio->len, afile);
-				if(bytes != audio->len)
-					JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, audio->len);
-				/* Update payload type */
-				janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-				rtp->type = audio_pt;
-				if(gateway != NULL)
-					gateway->relay_rtp(session->handle, 0, (char *)buffer, bytes);
-				gettimeofday(&now, NULL);
-				abefore.tv_sec = now.tv_sec;
-				abefore.tv_usec = now.tv_usec;
-				asent = TRUE;
-				audio = audio->next;
-			} else {
-				/* What's the timestamp skip from the previous packet? */
-				ts_diff = audio->ts - audio->prev->ts;
-				ts_diff = (ts_diff*1000)/akhz;
-				/* Check if it's time to send */
-				gettimeofday(&now, NULL);
-				d_s = now.tv_sec - abefore.tv_sec;
-				d_us = now.tv_usec - abefore.tv_usec;
-				if(d_us < 0) {
-					d_us += 1000000;
-					--d_s;
-				}
-				passed = d_s*1000000 + d_us;
-				if(passed < (ts_diff-5000)) {
-					asent = FALSE;
-				} else {
-					/* Update the reference time */
-					abefore.tv_usec += ts_diff%1000000;
-					if(abefore.tv_usec > 1000000) {
-						abefore.tv_sec++;
-						abefore.tv_usec -= 1000000;
-					}
-					if(ts_diff/1000000 > 0) {
-						abefore.tv_sec += ts_diff/1000000;
-						abefore.tv_usec -= ts_diff/1000000;
-					}
-					/* Send now */
-					fseek(afile, audio->offset, SEEK_SET);
-					bytes = fread(buffer, sizeof(char), audio->len, afile);
-					if(bytes != audio->len)
-						JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, audio->len);
-					/* Update payload type */
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					rtp->type = audio_pt;
-					if(gateway != NULL)
-						gateway->relay_rtp(session->handle, 0, (char *)buffer, bytes);
-					asent = TRUE;
-					audio = audio->next;
-				}
-			}
+		janus_mutex_lock_nodebug(&playout->mutex);
+		guint viewers = 0, ready = 0;
+		GList *vl = playout->viewers;
+		while(vl) {
+			janus_recordplay_session *viewer = (janus_recordplay_session *)vl->data;
+			viewers++;
+			if(viewer->active && !viewer->destroyed)
+				ready++;
+			vl = vl->next;
 		}
-		if(video) {
-			if(video == session->vframes) {
-				/* First packets: there may be many of them with the same timestamp, send them all */
-				uint64_t ts = video->ts;
-				while(video && video->ts == ts) {
-					fseek(vfile, video->offset, SEEK_SET);
-					bytes = fread(buffer, sizeof(char), video->len, vfile);
-					if(bytes != video->len)
-						JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, video->len);
-					/* Update payload type */
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					rtp->type = video_pt;
-					if(gateway != NULL)
-						gateway->relay_rtp(session->handle, 1, (char *)buffer, bytes);
-					video = video->next;
-				}
-				vsent = TRUE;
-				gettimeofday(&now, NULL);
-				vbefore.tv_sec = now.tv_sec;
-				vbefore.tv_usec = now.tv_usec;
-			} else {
-				/* What's the timestamp skip from the previous packet? */
-				ts_diff = video->ts - video->prev->ts;
-				ts_diff = (ts_diff*1000)/vkhz;
-				/* Check if it's time to send */
-				gettimeofday(&now, NULL);
-				d_s = now.tv_sec - vbefore.tv_sec;
-				d_us = now.tv_usec - vbefore.tv_usec;
-				if(d_us < 0) {
-					d_us += 1000000;
-					--d_s;
-				}
-				passed = d_s*1000000 + d_us;
-				if(passed < (ts_diff-5000)) {
-					vsent = FALSE;
-				} else {
-					/* Update the reference time */
-					vbefore.tv_usec += ts_diff%1000000;
-					if(vbefore.tv_usec > 1000000) {
-						vbefore.tv_sec++;
-						vbefore.tv_usec -= 1000000;
-					}
-					if(ts_diff/1000000 > 0) {
-						vbefore.tv_sec += ts_diff/1000000;
-						vbefore.tv_usec -= ts_diff/1000000;
-					}
-					/* There may be multiple packets with the same timestamp, send them all */
-					uint64_t ts = video->ts;
-					while(video && video->ts == ts) {
-						/* Send now */
-						fseek(vfile, video->offset, SEEK_SET);
-						bytes = fread(buffer, sizeof(char), video->len, vfile);
-						if(bytes != video->len)
-							JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, video->len);
-						/* Update payload type */
-						janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-						rtp->type = video_pt;
-						if(gateway != NULL)
-							gateway->relay_rtp(session->handle, 1, (char *)buffer, bytes);
-						video = video->next;
-					}
-					vsent = TRUE;
-				}
-			}
+		janus_mutex_unlock_nodebug(&playout->mutex);
+		if(viewers == 0) {
+			/* Everybody left */
+			janus_recordplay_playout_done(playout);
+			return -1;
+		}
+		if(!playout->started) {
+			/* Viewers that join the start get the first keyframe: wait for the
+			 * PeerConnections that are still being set up, but not forever */
+			if(ready == 0 || (ready < viewers && now - playout->closes < JANUS_RECORDPLAY_BROADCAST_SETUP_WAIT))
+				return now + G_USEC_PER_SEC/20;
+			playout->started = TRUE;
+			playout->adue = playout->vdue = now;
+			JANUS_LOG(LOG_INFO, "Starting broadcast replay of recording %"SCNu64" (%u/%u viewers ready)\n",
+				playout->recording->id, ready, viewers);
 		}
 	}
-	
-	g_free(buffer);
-
-	/* Get rid of the indexes */
-	janus_recordplay_frame_packet *tmp = NULL;
-	audio = session->aframes;
-	while(audio) {
-		tmp = audio->next;
-		g_free(audio);
-		audio = tmp;
-	}
-	session->aframes = NULL;
-	video = session->vframes;
-	while(video) {
-		tmp = video->next;
-		g_free(video);
-		video = tmp;
-	}
-	session->vframes = NULL;
-
-	if(afile)
-		fclose(afile);
-	afile = NULL;
-	if(vfile)
-		fclose(vfile);
-	vfile = NULL;
-
-	if(session->recording->destroyed) {
-		/* Remove from the list of viewers */
-		janus_mutex_lock(&session->recording->mutex);
-		session->recording->viewers = g_list_remove(session->recording->viewers, session);
-		if(session->recording->viewers == NULL) {
-			/* This was the last viewer, destroying the recording */
-			JANUS_LOG(LOG_VERB, "Last viewer stopped playout of recording %"SCNu64", destroying it now\n", session->recording->id);
-			janus_mutex_unlock(&session->recording->mutex);
-			g_free(session->recording->name);
-			g_free(session->recording->date);
-			g_free(session->recording->arc_file);
-			g_free(session->recording->vrc_file);
-			g_free(session->recording->offer);
-			g_free(session->recording);
-			session->recording = NULL;
-		} else {
-			/* Other viewers still on, don't do anything */
-			JANUS_LOG(LOG_VERB, "Recording %"SCNu64" still has viewers, delaying its destruction until later\n", session->recording->id);
-			janus_mutex_unlock(&session->recording->mutex);
+	int bytes = 0;
+	/* Send all the audio packets that are due */
+	while(playout->audio && playout->adue <= now) {
+		janus_recordplay_frame_packet *audio = playout->audio;
+		bytes = janus_recordplay_playout_read(playout->amap, playout->afile, playout->buffer, audio);
+		if(bytes != audio->len)
+			JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, audio->len);
+		/* Update payload type */
+		janus_rtp_header *rtp = (janus_rtp_header *)playout->buffer;
+		rtp->type = playout->audio_pt;
+		janus_recordplay_playout_relay(playout, 0, playout->buffer, bytes);
+		playout->audio = audio->next;
+		/* The timestamp skip from this packet tells us when the next one is due */
+		if(playout->audio)
+			playout->adue += ((int64_t)(playout->audio->ts - audio->ts)*1000)/playout->akhz;
+	}
+	/* Same for video: there may be multiple packets with the same timestamp, send them all */
+	while(playout->video && playout->vdue <= now) {
+		janus_recordplay_frame_packet *video = playout->video;
+		uint64_t ts = video->ts;
+		while(video && video->ts == ts) {
+			bytes = janus_recordplay_playout_read(playout->vmap, playout->vfile, playout->buffer, video);
+			if(bytes != video->len)
+				JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, video->len);
+			/* Update payload type */
+			janus_rtp_header *rtp = (janus_rtp_header *)playout->buffer;
+			rtp->type = playout->video_pt;
+			janus_recordplay_playout_relay(playout, 1, playout->buffer, bytes);
+			video = video->next;
 		}
+		playout->video = video;
+		if(video)
+			playout->vdue += ((int64_t)(video->ts - ts)*1000)/playout->vkhz;
+	}
+	if(!playout->audio && !playout->video) {
+		/* We're done */
+		janus_recordplay_playout_done(playout);
+		return -1;
 	}
+	/* Wake us up when the earliest of the next packets is due */
+	if(playout->audio && (!playout->video || playout->adue < playout->vdue))
+		return playout->adue;
+	return playout->vdue;
+}
 
-	/* Tell the core to tear down the PeerConnection, hangup_media will do the rest */
-	gateway->close_pc(session->handle);
-	
-	JANUS_LOG(LOG_INFO, "Leaving playout thread\n");
-	g_thread_unref(g_thread_self());
-	return NULL;
+/* Create a new playout for the provided frames, and schedule it */
+static janus_recordplay_playout *janus_recordplay_playout_create(janus_recordplay_recording *rec,
+		janus_recordplay_session *session, janus_recordplay_frame_packet *aframes, janus_recordplay_frame_packet *vframes, gint64 when) {
+	/* Open the files */
+	janus_recordplay_playout *playout = g_malloc0(sizeof(janus_recordplay_playout));
+	playout->session = session;
+	playout->recording = rec;
+	if(aframes && !janus_recordplay_playout_open(rec, FALSE, &playout->amap, &playout->afile)) {
+		g_free(playout);
+		return NULL;
+	}
+	if(vframes && !janus_recordplay_playout_open(rec, TRUE, &playout->vmap, &playout->vfile)) {
+		if(aframes)
+			janus_recordplay_playout_close(rec, FALSE, playout->amap, playout->afile);
+		g_free(playout);
+		return NULL;
+	}
+	playout->buffer = g_malloc0(1500);
+	playout->audio = aframes;
+	playout->video = vframes;
+	if(session == NULL) {
+		playout->aframes = aframes;
+		playout->vframes = vframes;
+	}
+	playout->audio_pt = rec->audio_pt;
+	playout->video_pt = rec->video_pt;
+	playout->akhz = 48;
+	if(playout->audio_pt == 0 || playout->audio_pt == 8 || playout->audio_pt == 9)
+		playout->akhz = 8;
+	playout->vkhz = 90;
+	janus_mutex_init(&playout->mutex);
+	/* The first packets are sent as soon as the playout starts */
+	playout->adue = playout->vdue = when;
+	playout->closes = when;
+	janus_timer_task *task = janus_timer_add("recordplay playout", when, janus_recordplay_playout_tick, playout);
+	if(task == NULL) {
+		if(aframes)
+			janus_recordplay_playout_close(rec, FALSE, playout->amap, playout->afile);
+		if(vframes)
+			janus_recordplay_playout_close(rec, TRUE, playout->vmap, playout->vfile);
+		janus_mutex_destroy(&playout->mutex);
+		g_free(playout->buffer);
+		g_free(playout);
+		return NULL;
+	}
+	/* Nobody waits for the playout: it cleans up after itself when done */
+	janus_timer_detach(task);
+	return playout;
+}
+
+static gboolean janus_recordplay_playout_start(janus_recordplay_session *session) {
+	if(!session) {
+		JANUS_LOG(LOG_ERR, "Invalid session, can't start playout...\n");
+		return FALSE;
+	}
+	if(session->recorder) {
+		JANUS_LOG(LOG_ERR, "This is a recorder, can't start playout...\n");
+		return FALSE;
+	}
+	if(!session->aframes && !session->vframes) {
+		JANUS_LOG(LOG_ERR, "No audio and no video frames, can't start playout...\n");
+		return FALSE;
+	}
+	JANUS_LOG(LOG_INFO, "Starting playout\n");
+	return janus_recordplay_playout_create(session->recording, session,
+		session->aframes, session->vframes, janus_get_monotonic_time()) != NULL;
+}
+
+/* Join the broadcast replay of a recording, if there's one we're still in time for */
+static gboolean janus_recordplay_broadcast_join(janus_recordplay_session *session, janus_recordplay_recording *rec) {
+	janus_mutex_lock(&broadcasts_mutex);
+	janus_recordplay_playout *playout = g_hash_table_lookup(broadcasts, &rec->id);
+	if(playout == NULL) {
+		janus_mutex_unlock(&broadcasts_mutex);
+		return FALSE;
+	}
+	janus_mutex_lock(&playout->mutex);
+	playout->viewers = g_list_append(playout->viewers, session);
+	janus_mutex_unlock(&playout->mutex);
+	session->broadcast = playout;
+	/* We share the frames of the broadcast, but they're not ours */
+	session->aframes = playout->aframes;
+	session->vframes = playout->vframes;
+	janus_mutex_unlock(&broadcasts_mutex);
+	JANUS_LOG(LOG_VERB, "Joined the broadcast replay of recording %"SCNu64"\n", rec->id);
+	return TRUE;
+}
+
+/* Start a new broadcast replay of a recording, with the frames this viewer prepared */
+static gboolean janus_recordplay_broadcast_create(janus_recordplay_session *session, janus_recordplay_recording *rec) {
+	janus_mutex_lock(&broadcasts_mutex);
+	janus_recordplay_playout *playout = janus_recordplay_playout_create(rec, NULL,
+		session->aframes, session->vframes, janus_get_monotonic_time() + broadcast_window);
+	if(playout == NULL) {
+		janus_mutex_unlock(&broadcasts_mutex);
+		return FALSE;
+	}
+	janus_mutex_lock(&playout->mutex);
+	playout->viewers = g_list_append(playout->viewers, session);
+	janus_mutex_unlock(&playout->mutex);
+	session->broadcast = playout;
+	g_hash_table_insert(broadcasts, janus_uint64_dup(rec->id), playout);
+	janus_mutex_unlock(&broadcasts_mutex);
+	JANUS_LOG(LOG_VERB, "Created a broadcast replay of recording %"SCNu64", starting in %"SCNi64"ms\n",
+		rec->id, broadcast_window/1000);
+	return TRUE;
+}
+
+/* Leave the broadcast replay we joined, if any */
+static void janus_recordplay_broadcast_leave(janus_recordplay_session *session) {
+	janus_mutex_lock(&broadcasts_mutex);
+	janus_recordplay_playout *playout = session->broadcast;
+	if(playout != NULL) {
+		janus_mutex_lock(&playout->mutex);
+		playout->viewers = g_list_remove(playout->viewers, session);
+		janus_mutex_unlock(&playout->mutex);
+		session->broadcast = NULL;
+		session->aframes = NULL;
+		session->vframes = NULL;
+	}
+	janus_mutex_unlock(&broadcasts_mutex);
 }
@@ -56,6 +56,7 @@
 
 #include <arpa/inet.h>
 #include <net/if.h>
+#include <sys/epoll.h>
 
 #include <jansson.h>
 
@@ -207,6 +208,7 @@ static char *user_agent;
 static int register_ttl = JANUS_DEFAULT_REGISTER_TTL;
 static uint16_t rtp_range_min = 10000;
 static uint16_t rtp_range_max = 60000;
+static struct janus_port_range *rtp_ports = NULL;
 
 static GThread *handler_thread;
 static GThread *watchdog;
@@ -323,6 +325,23 @@ typedef struct janus_sip_account {
 	janus_sip_registration_status registration_status;
 } janus_sip_account;
 
+/* What each file descriptor served by the relay is for */
+typedef enum janus_sip_relay_kind {
+	JANUS_SIP_RELAY_AUDIO_RTP = 0,
+	JANUS_SIP_RELAY_AUDIO_RTCP,
+	JANUS_SIP_RELAY_VIDEO_RTP,
+	JANUS_SIP_RELAY_VIDEO_RTCP,
+	JANUS_SIP_RELAY_PIPE,
+	JANUS_SIP_RELAY_KINDS
+} janus_sip_relay_kind;
+struct janus_sip_session;
+struct janus_sip_relay_worker;
+/* What a shared relay worker gets back from epoll for each file descriptor */
+typedef struct janus_sip_relay_ref {
+	struct janus_sip_session *session;
+	janus_sip_relay_kind kind;
+} janus_sip_relay_ref;
+
 typedef struct janus_sip_media {
 	char *remote_ip;
 	gboolean earlymedia;
@@ -341,6 +360,7 @@ typedef struct janus_sip_media {
 	const char *audio_pt_name;
 	srtp_t audio_srtp_in, audio_srtp_out;
 	srtp_policy_t audio_remote_policy, audio_local_policy;
+	char *audio_local_profile, *audio_local_crypto, *audio_remote_crypto;
 	gboolean audio_send;
 	janus_sdp_mdirection pre_hold_audio_dir;
 	gboolean has_video;
@@ -353,11 +373,23 @@ typedef struct janus_sip_media {
 	const char *video_pt_name;
 	srtp_t video_srtp_in, video_srtp_out;
 	srtp_policy_t video_remote_policy, video_local_policy;
+	char *video_local_profile, *video_local_crypto, *video_remote_crypto;
 	gboolean video_send;
 	janus_sdp_mdirection pre_hold_video_dir;
 	janus_rtp_switching_context context;
 	int pipefd[2];
 	gboolean updated;
+	/* Origin of the last remote SDP we processed, to detect unchanged session refreshes */
+	gboolean has_remote_sdp_origin;
+	guint64 remote_sdp_sessid, remote_sdp_version;
+	/* Relay state, whether it's a thread of its own or a shared worker serving the call */
+	struct sockaddr_in relay_addr;
+	gboolean relay_have_addr;
+	int relay_pollerrs;
+	int relay_astep, relay_vstep;
+	guint32 relay_ats, relay_vts;
+	struct janus_sip_relay_worker *relay_worker;
+	janus_sip_relay_ref relay_refs[JANUS_SIP_RELAY_KINDS];
 } janus_sip_media;
 
 typedef struct janus_sip_session {
@@ -376,6 +408,7 @@ typedef struct janus_sip_session {
 	janus_recorder *vrc_peer;	/* The Janus recorder instance for the peer's video, if enabled */
 	janus_mutex rec_mutex;		/* Mutex to protect the recorders from race conditions */
 	volatile gint hangingup;
+	volatile gint relay_ref;	/* References the shared relay workers hold: the watchdog waits for them to go away */
 	gint64 destroyed;	/* Time at which this session was marked as destroyed */
 	janus_mutex mutex;
 } janus_sip_session;
@@ -406,6 +439,16 @@ struct ssip_s {
 static int janus_sip_srtp_set_local(janus_sip_session *session, gboolean video, char **profile, char **crypto) {
 	if(session == NULL)
 		return -1;
+	/* If we negotiated a key already, keep on using it: a re-INVITE doesn't need a new context */
+	char *cur_profile = video ? session->media.video_local_profile : session->media.audio_local_profile;
+	char *cur_crypto = video ? session->media.video_local_crypto : session->media.audio_local_crypto;
+	if(cur_profile && cur_crypto && (video ? session->media.video_srtp_out : session->media.audio_srtp_out)) {
+		JANUS_LOG(LOG_VERB, "[SIP-%s] Reusing existing %s outbound SRTP session\n",
+			session->account.username, video ? "video" : "audio");
+		*profile = g_strdup(cur_profile);
+		*crypto = g_strdup(cur_crypto);
+		return 0;
+	}
 	/* Which SRTP profile are we going to negotiate? */
 	int key_length = 0, salt_length = 0, master_length = 0;
 	if(session->media.srtp_profile == JANUS_SRTP_AES128_CM_SHA1_32) {
@@ -485,6 +528,18 @@ static int janus_sip_srtp_set_local(janus_sip_session *session, gboolean video,
 	if((video && session->media.video_srtp_out) || (!video && session->media.audio_srtp_out)) {
 		JANUS_LOG(LOG_VERB, "%s outbound SRTP session created\n", video ? "Video" : "Audio");
 	}
+	/* Take note of what we offered, in case we need it again for an update */
+	if(video) {
+		g_free(session->media.video_local_profile);
+		session->media.video_local_profile = g_strdup(*profile);
+		g_free(session->media.video_local_crypto);
+		session->media.video_local_crypto = g_strdup(*crypto);
+	} else {
+		g_free(session->media.audio_local_profile);
+		session->media.audio_local_profile = g_strdup(*profile);
+		g_free(session->media.audio_local_crypto);
+		session->media.audio_local_crypto = g_strdup(*crypto);
+	}
 	return 0;
 }
 static int janus_sip_srtp_set_remote(janus_sip_session *session, gboolean video, const char *profile, const char *crypto) {
@@ -591,6 +646,12 @@ static void janus_sip_srtp_cleanup(janus_sip_session *session) {
 	session->media.audio_srtp_in = NULL;
 	g_free(session->media.audio_remote_policy.key);
 	session->media.audio_remote_policy.key = NULL;
+	g_free(session->media.audio_local_profile);
+	session->media.audio_local_profile = NULL;
+	g_free(session->media.audio_local_crypto);
+	session->media.audio_local_crypto = NULL;
+	g_free(session->media.audio_remote_crypto);
+	session->media.audio_remote_crypto = NULL;
 	/* Video */
 	if(session->media.video_srtp_out)
 		srtp_dealloc(session->media.video_srtp_out);
@@ -602,6 +663,16 @@ static void janus_sip_srtp_cleanup(janus_sip_session *session) {
 	session->media.video_srtp_in = NULL;
 	g_free(session->media.video_remote_policy.key);
 	session->media.video_remote_policy.key = NULL;
+	g_free(session->media.video_local_profile);
+	session->media.video_local_profile = NULL;
+	g_free(session->media.video_local_crypto);
+	session->media.video_local_crypto = NULL;
+	g_free(session->media.video_remote_crypto);
+	session->media.video_remote_crypto = NULL;
+	/* A new negotiation will follow, so forget about the last remote SDP too */
+	session->media.has_remote_sdp_origin = FALSE;
+	session->media.remote_sdp_sessid = 0;
+	session->media.remote_sdp_version = 0;
 }
 
 
@@ -611,10 +682,26 @@ gpointer janus_sip_sofia_thread(gpointer user_data);
 void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase, nua_t *nua, nua_magic_t *magic, nua_handle_t *nh, nua_hmagic_t *hmagic, sip_t const *sip, tagi_t tags[]);
 /* SDP parsing and manipulation */
 void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean answer, gboolean update, gboolean *changed);
+static gboolean janus_sip_sdp_is_refresh(janus_sip_session *session, const char *sdp);
 char *janus_sip_sdp_manipulate(janus_sip_session *session, janus_sdp *sdp, gboolean answer);
 /* Media */
 static int janus_sip_allocate_local_ports(janus_sip_session *session);
-static void *janus_sip_relay_thread(void *data);
+static void janus_sip_relay_start(janus_sip_session *session);
+/* Shared relay workers: when relay_threads is set in the configuration,
+ * calls don't get a relay thread of their own, but have their sockets
+ * served by the least loaded of a few epoll loops instead */
+#define JANUS_SIP_RELAY_MAX_EVENTS	64
+typedef struct janus_sip_relay_worker {
+	guint index;
+	GThread *thread;
+	int efd;
+	volatile gint calls;
+	GList *sessions;	/* Calls served by this worker, protected by the mutex */
+	janus_mutex mutex;
+} janus_sip_relay_worker;
+static janus_sip_relay_worker **relay_workers = NULL;
+static guint relay_workers_num = 0;
+static void *janus_sip_relay_worker_thread(void *data);
 
 
 /* URI parsing utilies */
@@ -675,7 +762,7 @@ static void *janus_sip_watchdog(void *data) {
 					sl = sl->next;
 					continue;
 				}
-				if (now-session->destroyed >= 5*G_USEC_PER_SEC) {
+				if (now-session->destroyed >= 5*G_USEC_PER_SEC && g_atomic_int_get(&session->relay_ref) == 0) {
 					/* We're lazy and actually get rid of the stuff only after a few seconds */
 					JANUS_LOG(LOG_VERB, "Freeing old SIP session\n");
 					GList *rm = sl->next;
@@ -960,6 +1047,16 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 			JANUS_LOG(LOG_VERB, "SIP RTP/RTCP port range: %u -- %u\n", rtp_range_min, rtp_range_max);
 		}
 
+		item = janus_config_get_item_drilldown(config, "general", "relay_threads");
+		if(item && item->value) {
+			int threads = atoi(item->value);
+			if(threads < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid number of relay threads (%s), using a thread per call\n", item->value);
+			} else {
+				relay_workers_num = threads;
+			}
+		}
+
 		item = janus_config_get_item_drilldown(config, "general", "events");
 		if(item != NULL && item->value != NULL)
 			notify_events = janus_is_true(item->value);
@@ -999,6 +1096,11 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 	messages = g_async_queue_new_full((GDestroyNotify) janus_sip_message_free);
 	/* This is the callback we'll need to invoke to contact the gateway */
 	gateway = callback;
+	/* RTP/RTCP ports are picked from a shared allocator */
+	rtp_ports = gateway->port_range_get(rtp_range_min, rtp_range_max);
+	if(rtp_ports == NULL) {
+		JANUS_LOG(LOG_WARN, "Invalid RTP/RTCP port range %u -- %u, calls will fail\n", rtp_range_min, rtp_range_max);
+	}
 
 	g_atomic_int_set(&initialized, 1);
 
@@ -1010,6 +1112,32 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the SIP watchdog thread...\n", error->code, error->message ? error->message : "??");
 		return -1;
 	}
+	/* Start the shared relay workers, if we're not going to have a relay thread per call */
+	if(relay_workers_num > 0) {
+		relay_workers = g_malloc0(relay_workers_num * sizeof(janus_sip_relay_worker *));
+		guint i = 0;
+		for(i=0; i<relay_workers_num; i++) {
+			janus_sip_relay_worker *worker = g_malloc0(sizeof(janus_sip_relay_worker));
+			worker->index = i;
+			janus_mutex_init(&worker->mutex);
+			worker->efd = epoll_create1(EPOLL_CLOEXEC);
+			relay_workers[i] = worker;
+			if(worker->efd < 0) {
+				g_atomic_int_set(&initialized, 0);
+				JANUS_LOG(LOG_ERR, "Error creating epoll instance for SIP relay worker #%u: %d (%s)\n", i, errno, strerror(errno));
+				return -1;
+			}
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "siprtp worker %u", i);
+			worker->thread = g_thread_try_new(tname, janus_sip_relay_worker_thread, worker, &error);
+			if(error != NULL) {
+				g_atomic_int_set(&initialized, 0);
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch SIP relay worker #%u...\n", error->code, error->message ? error->message : "??", i);
+				return -1;
+			}
+		}
+		JANUS_LOG(LOG_INFO, "Relaying SIP media on %u shared worker(s)\n", relay_workers_num);
+	}
 	/* Launch the thread that will handle incoming messages */
 	handler_thread = g_thread_try_new("sip handler", janus_sip_handler, NULL, &error);
 	if(error != NULL) {
@@ -1035,6 +1163,23 @@ void janus_sip_destroy(void) {
 		g_thread_join(watchdog);
 		watchdog = NULL;
 	}
+	if(relay_workers != NULL) {
+		guint i = 0;
+		for(i=0; i<relay_workers_num; i++) {
+			janus_sip_relay_worker *worker = relay_workers[i];
+			if(worker == NULL)
+				continue;
+			if(worker->thread != NULL)
+				g_thread_join(worker->thread);
+			if(worker->efd >= 0)
+				close(worker->efd);
+			g_list_free(worker->sessions);
+			g_free(worker);
+		}
+		g_free(relay_workers);
+		relay_workers = NULL;
+	}
+	relay_workers_num = 0;
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -1046,6 +1191,8 @@ void janus_sip_destroy(void) {
 	janus_mutex_unlock(&sessions_mutex);
 	g_async_queue_unref(messages);
 	messages = NULL;
+	gateway->port_range_unref(rtp_ports);
+	rtp_ports = NULL;
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
 
@@ -1166,6 +1313,7 @@ void janus_sip_create_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_init(&session->rec_mutex);
 	session->destroyed = 0;
 	g_atomic_int_set(&session->hangingup, 0);
+	g_atomic_int_set(&session->relay_ref, 0);
 	janus_mutex_init(&session->mutex);
 	handle->plugin_handle = session;
 
@@ -2312,14 +2460,16 @@ static void *janus_sip_handler(void *data) {
 				g_snprintf(error_cause, 512, "Could not allocate RTP/RTCP ports");
 				goto error;
 			}
+			janus_sdp_negotiation *negotiation = janus_sdp_negotiation_create(parsed_sdp);
 			if(session->media.audio_pt > -1) {
-				session->media.audio_pt_name = janus_get_codec_from_pt(sdp, session->media.audio_pt);
+				session->media.audio_pt_name = janus_sdp_negotiation_get_codec_name(negotiation, session->media.audio_pt);
 				JANUS_LOG(LOG_VERB, "Detected audio codec: %d (%s)\n", session->media.audio_pt, session->media.audio_pt_name);
 			}
 			if(session->media.video_pt > -1) {
-				session->media.video_pt_name = janus_get_codec_from_pt(sdp, session->media.video_pt);
+				session->media.video_pt_name = janus_sdp_negotiation_get_codec_name(negotiation, session->media.video_pt);
 				JANUS_LOG(LOG_VERB, "Detected video codec: %d (%s)\n", session->media.video_pt, session->media.video_pt_name);
 			}
+			janus_sdp_negotiation_destroy(negotiation);
 			/* Take note of the SDP (may be useful for UPDATEs or re-INVITEs) */
 			janus_sdp_free(session->sdp);
 			session->sdp = parsed_sdp;
@@ -2361,13 +2511,7 @@ static void *janus_sip_handler(void *data) {
 			if(answer) {
 				/* Start the media */
 				session->media.ready = TRUE;	/* FIXME Maybe we need a better way to signal this */
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
-				g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
-				if(error != NULL) {
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
-				}
+				janus_sip_relay_start(session);
 			}
 		} else if(!strcasecmp(request_text, "update")) {
 			/* Update an existing call */
@@ -3099,6 +3243,11 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 			janus_sdp *sdp = NULL;
 			if(!sip->sip_payload) {
 				JANUS_LOG(LOG_VERB,"Received offerless %s\n", reinvite ? "re-INVITE" : "INVITE");
+			} else if(reinvite && janus_sip_sdp_is_refresh(session, sip->sip_payload->pl_data)) {
+				/* Same SDP as before (e.g., a session refresh), keep sockets and SRTP contexts as they are */
+				JANUS_LOG(LOG_VERB, "[SIP-%s] re-INVITE doesn't change the session, just refreshing it\n", session->account.username);
+				nua_respond(nh, 200, sip_status_phrase(200), TAG_END());
+				break;
 			} else {
 				char sdperror[100];
 				sdp = janus_sdp_parse(sip->sip_payload->pl_data, sdperror, sizeof(sdperror));
@@ -3375,6 +3524,20 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				nua_respond(nh, 488, sip_status_phrase(488), TAG_END());
 				break;
 			}
+			if(!in_progress && session->media.ready && !session->media.earlymedia && !session->media.update &&
+					janus_sip_sdp_is_refresh(session, sip->sip_payload->pl_data)) {
+				/* Answer to a hold/unhold or refresh we sent, with the same SDP as before: nothing to update */
+				JANUS_LOG(LOG_VERB, "[SIP-%s] Peer answered with the same SDP, keeping the current session\n", session->account.username);
+				if(!session->media.autoack) {
+					char *route = sip->sip_record_route ? url_as_string(session->stack->s_home, sip->sip_record_route->r_url) : NULL;
+					JANUS_LOG(LOG_INFO, "Sending ACK (route=%s)\n", route ? route : "none");
+					nua_ack(nh,
+						TAG_IF(route, NTATAG_DEFAULT_PROXY(route)),
+						TAG_END());
+				}
+				session->status = janus_sip_call_status_incall;
+				break;
+			}
 			char sdperror[100];
 			janus_sdp *sdp = janus_sdp_parse(sip->sip_payload->pl_data, sdperror, sizeof(sdperror));
 			if(!sdp) {
@@ -3427,14 +3590,16 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				session->callee = NULL;
 				break;
 			}
+			janus_sdp_negotiation *negotiation = janus_sdp_negotiation_create(sdp);
 			if(session->media.audio_pt > -1) {
-				session->media.audio_pt_name = janus_get_codec_from_pt(fixed_sdp, session->media.audio_pt);
+				session->media.audio_pt_name = janus_sdp_negotiation_get_codec_name(negotiation, session->media.audio_pt);
 				JANUS_LOG(LOG_VERB, "Detected audio codec: %d (%s)\n", session->media.audio_pt, session->media.audio_pt_name);
 			}
 			if(session->media.video_pt > -1) {
-				session->media.video_pt_name = janus_get_codec_from_pt(fixed_sdp, session->media.video_pt);
+				session->media.video_pt_name = janus_sdp_negotiation_get_codec_name(negotiation, session->media.video_pt);
 				JANUS_LOG(LOG_VERB, "Detected video codec: %d (%s)\n", session->media.video_pt, session->media.video_pt_name);
 			}
+			janus_sdp_negotiation_destroy(negotiation);
 			session->media.ready = TRUE;	/* FIXME Maybe we need a better way to signal this */
 			if(update && !session->media.earlymedia && !session->media.update) {
 				/* Don't push to the browser if this is in response to a hold/unhold we sent ourselves */
@@ -3442,13 +3607,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				break;
 			}
 			if(!session->media.earlymedia && !session->media.update) {
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
-				g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
-				if(error != NULL) {
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
-				}
+				janus_sip_relay_start(session);
 			}
 			/* Send event back to the browser */
 			json_t *jsep = NULL;
@@ -3695,7 +3854,7 @@ void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean
 			g_free(session->media.remote_ip);
 			session->media.remote_ip = g_strdup(m->c_addr);
 		}
-		if(update) {
+		if(update && !session->media.has_srtp_remote) {
 			/* FIXME This is a session update, we only accept changes in IP/ports */
 			temp = temp->next;
 			continue;
@@ -3706,6 +3865,8 @@ void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean
 			if(a->name) {
 				if(!strcasecmp(a->name, "crypto")) {
 					if(m->type == JANUS_SDP_AUDIO || m->type == JANUS_SDP_VIDEO) {
+						gboolean video = (m->type == JANUS_SDP_VIDEO);
+						char **remote_crypto = video ? &session->media.video_remote_crypto : &session->media.audio_remote_crypto;
 						gint32 tag = 0;
 						char profile[101], crypto[101];
 						/* FIXME inline can be more complex than that, and we're currently only offering SHA1_80 */
@@ -3713,9 +3874,25 @@ void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean
 							&tag, profile, crypto);
 						if(res != 3) {
 							JANUS_LOG(LOG_WARN, "Failed to parse crypto line, ignoring... %s\n", a->value);
+						} else if(update && *remote_crypto && !strcmp(*remote_crypto, a->value)) {
+							/* Same key as before, keep the inbound context we have */
 						} else {
-							gboolean video = (m->type == JANUS_SDP_VIDEO);
-							janus_sip_srtp_set_remote(session, video, profile, crypto);
+							if(update) {
+								/* The peer is changing its key: get rid of the old inbound context first */
+								JANUS_LOG(LOG_VERB, "[SIP-%s] Remote %s SRTP key changed, updating inbound context\n",
+									session->account.username, video ? "video" : "audio");
+								srtp_t *srtp_in = video ? &session->media.video_srtp_in : &session->media.audio_srtp_in;
+								srtp_policy_t *policy = video ? &session->media.video_remote_policy : &session->media.audio_remote_policy;
+								if(*srtp_in)
+									srtp_dealloc(*srtp_in);
+								*srtp_in = NULL;
+								g_free(policy->key);
+								policy->key = NULL;
+							}
+							if(janus_sip_srtp_set_remote(session, video, profile, crypto) == 0) {
+								g_free(*remote_crypto);
+								*remote_crypto = g_strdup(a->value);
+							}
 							session->media.has_srtp_remote = TRUE;
 						}
 					}
@@ -3723,6 +3900,11 @@ void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean
 			}
 			tempA = tempA->next;
 		}
+		if(update) {
+			/* Only IP/ports and SRTP keys are updated by a session update */
+			temp = temp->next;
+			continue;
+		}
 		if(answer && (m->type == JANUS_SDP_AUDIO || m->type == JANUS_SDP_VIDEO)) {
 			/* Check which codec was negotiated eventually */
 			int pt = -1;
@@ -3738,6 +3920,10 @@ void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean
 		}
 		temp = temp->next;
 	}
+	/* Take note of the SDP origin, so that we can spot refreshes of the same description later */
+	session->media.has_remote_sdp_origin = TRUE;
+	session->media.remote_sdp_sessid = sdp->o_sessid;
+	session->media.remote_sdp_version = sdp->o_version;
 	if(update && changed && *changed) {
 		/* Something changed: mark this on the session, so that the thread can update the sockets */
 		session->media.updated = TRUE;
@@ -3751,6 +3937,28 @@ void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean
 	}
 }
 
+/* Check whether a remote SDP is the very same description we processed last:
+ * RFC 3264 mandates the o= version to be incremented whenever something changes,
+ * which means that for session refreshes (e.g., session timers, or a re-INVITE
+ * that only re-sends the same SDP) we can avoid parsing the SDP entirely */
+static gboolean janus_sip_sdp_is_refresh(janus_sip_session *session, const char *sdp) {
+	if(session == NULL || sdp == NULL || !session->media.has_remote_sdp_origin)
+		return FALSE;
+	const char *o = NULL;
+	if(!strncmp(sdp, "o=", 2)) {
+		o = sdp;
+	} else {
+		o = strstr(sdp, "\no=");
+		if(o == NULL)
+			return FALSE;
+		o++;
+	}
+	guint64 sessid = 0, version = 0;
+	if(sscanf(o, "o=%*s %"SCNu64" %"SCNu64, &sessid, &version) != 2)
+		return FALSE;
+	return sessid == session->media.remote_sdp_sessid && version == session->media.remote_sdp_version;
+}
+
 char *janus_sip_sdp_manipulate(janus_sip_session *session, janus_sdp *sdp, gboolean answer) {
 	if(!session || !session->stack || !sdp)
 		return NULL;
@@ -3820,6 +4028,8 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session) {
 		close(session->media.audio_rtcp_fd);
 		session->media.audio_rtcp_fd = -1;
 	}
+	if(session->media.local_audio_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_audio_rtp_port);
 	session->media.local_audio_rtp_port = 0;
 	session->media.local_audio_rtcp_port = 0;
 	session->media.audio_ssrc = 0;
@@ -3831,6 +4041,8 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session) {
 		close(session->media.video_rtcp_fd);
 		session->media.video_rtcp_fd = -1;
 	}
+	if(session->media.local_video_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_video_rtp_port);
 	session->media.local_video_rtp_port = 0;
 	session->media.local_video_rtcp_port = 0;
 	session->media.video_ssrc = 0;
@@ -3860,9 +4072,11 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session) {
 				JANUS_LOG(LOG_ERR, "Error creating audio sockets...\n");
 				return -1;
 			}
-			int rtp_port = g_random_int_range(rtp_range_min, rtp_range_max);
-			if(rtp_port % 2)
-				rtp_port++;	/* Pick an even port for RTP */
+			int rtp_port = gateway->port_allocate(rtp_ports);
+			if(rtp_port < 0) {
+				JANUS_LOG(LOG_ERR, "No RTP/RTCP port pair available in range %u -- %u\n", rtp_range_min, rtp_range_max);
+				return -1;
+			}
 			audio_rtp_address.sin_family = AF_INET;
 			audio_rtp_address.sin_port = htons(rtp_port);
 			inet_pton(AF_INET, local_ip, &audio_rtp_address.sin_addr.s_addr);
@@ -3870,6 +4084,7 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session) {
 				JANUS_LOG(LOG_ERR, "Bind failed for audio RTP (port %d), trying a different one...\n", rtp_port);
 				close(session->media.audio_rtp_fd);
 				session->media.audio_rtp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -3885,6 +4100,7 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session) {
 				session->media.audio_rtp_fd = -1;
 				close(session->media.audio_rtcp_fd);
 				session->media.audio_rtcp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -3909,9 +4125,11 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session) {
 				JANUS_LOG(LOG_ERR, "Error creating video sockets...\n");
 				return -1;
 			}
-			int rtp_port = g_random_int_range(rtp_range_min, rtp_range_max);
-			if(rtp_port % 2)
-				rtp_port++;	/* Pick an even port for RTP */
+			int rtp_port = gateway->port_allocate(rtp_ports);
+			if(rtp_port < 0) {
+				JANUS_LOG(LOG_ERR, "No RTP/RTCP port pair available in range %u -- %u\n", rtp_range_min, rtp_range_max);
+				return -1;
+			}
 			video_rtp_address.sin_family = AF_INET;
 			video_rtp_address.sin_port = htons(rtp_port);
 			inet_pton(AF_INET, local_ip, &video_rtp_address.sin_addr.s_addr);
@@ -3919,6 +4137,7 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session) {
 				JANUS_LOG(LOG_ERR, "Bind failed for video RTP (port %d), trying a different one...\n", rtp_port);
 				close(session->media.video_rtp_fd);
 				session->media.video_rtp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -3934,6 +4153,7 @@ static int janus_sip_allocate_local_ports(janus_sip_session *session) {
 				session->media.video_rtp_fd = -1;
 				close(session->media.video_rtcp_fd);
 				session->media.video_rtcp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -3988,30 +4208,324 @@ static void janus_sip_connect_sockets(janus_sip_session *session, struct sockadd
 
 }
 
-/* Thread to relay RTP/RTCP frames coming from the SIP peer */
-static void *janus_sip_relay_thread(void *data) {
-	janus_sip_session *session = (janus_sip_session *)data;
-	if(!session || !session->account.username || !session->callee) {
-		g_thread_unref(g_thread_self());
-		return NULL;
+/* Helpers to receive packets in batches in the relay: where recvmmsg is
+ * available we drain up to JANUS_SIP_RECV_BATCH datagrams with a single
+ * syscall, otherwise we just read one */
+#define JANUS_SIP_RECV_BATCH	16
+typedef struct janus_sip_recv_batch {
+	char buffers[JANUS_SIP_RECV_BATCH][1500];
+	int lengths[JANUS_SIP_RECV_BATCH];
+#ifdef HAVE_RECVMMSG
+	struct iovec iovecs[JANUS_SIP_RECV_BATCH];
+	struct mmsghdr msgs[JANUS_SIP_RECV_BATCH];
+#endif
+} janus_sip_recv_batch;
+
+static janus_sip_recv_batch *janus_sip_recv_batch_create(void) {
+	janus_sip_recv_batch *batch = g_malloc0(sizeof(janus_sip_recv_batch));
+#ifdef HAVE_RECVMMSG
+	int i = 0;
+	for(i=0; i<JANUS_SIP_RECV_BATCH; i++) {
+		batch->iovecs[i].iov_base = batch->buffers[i];
+		batch->iovecs[i].iov_len = sizeof(batch->buffers[i]);
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
 	}
-	JANUS_LOG(LOG_VERB, "Starting relay thread (%s <--> %s)\n", session->account.username, session->callee);
+#endif
+	return batch;
+}
+
+static int janus_sip_recv_batch_read(int fd, janus_sip_recv_batch *batch) {
+#ifdef HAVE_RECVMMSG
+	/* poll/epoll told us there's at least a packet, so we don't need to block */
+	int count = recvmmsg(fd, batch->msgs, JANUS_SIP_RECV_BATCH, MSG_DONTWAIT, NULL);
+	int i = 0;
+	for(i=0; i<count; i++)
+		batch->lengths[i] = batch->msgs[i].msg_len;
+	return count < 0 ? 0 : count;
+#else
+	batch->lengths[0] = recvfrom(fd, batch->buffers[0], sizeof(batch->buffers[0]), MSG_DONTWAIT, NULL, NULL);
+	return batch->lengths[0] < 0 ? 0 : 1;
+#endif
+}
+
+/* Helper to get the file descriptor the relay uses for something */
+static int *janus_sip_relay_fd(janus_sip_session *session, janus_sip_relay_kind kind) {
+	switch(kind) {
+		case JANUS_SIP_RELAY_AUDIO_RTP:
+			return &session->media.audio_rtp_fd;
+		case JANUS_SIP_RELAY_AUDIO_RTCP:
+			return &session->media.audio_rtcp_fd;
+		case JANUS_SIP_RELAY_VIDEO_RTP:
+			return &session->media.video_rtp_fd;
+		case JANUS_SIP_RELAY_VIDEO_RTCP:
+			return &session->media.video_rtcp_fd;
+		case JANUS_SIP_RELAY_PIPE:
+			return &session->media.pipefd[0];
+		default:
+			break;
+	}
+	return NULL;
+}
+
+/* Whether we should stop relaying media for a call */
+static gboolean janus_sip_relay_is_over(janus_sip_session *session) {
+	return session->destroyed || session->status <= janus_sip_call_status_idle ||
+		session->status >= janus_sip_call_status_closing;	/* FIXME We need a per-call watchdog as well */
+}
 
-	gboolean have_server_ip = TRUE;
-	struct sockaddr_in server_addr;
-	memset(&server_addr, 0, sizeof(server_addr));
-	server_addr.sin_family = AF_INET;
-	if(inet_aton(session->media.remote_ip, &server_addr.sin_addr) == 0) {	/* Not a numeric IP... */
+/* Resolve the address of the SIP peer, and connect the sockets to it */
+static void janus_sip_relay_setup(janus_sip_session *session) {
+	session->media.relay_pollerrs = 0;
+	session->media.relay_astep = 0;
+	session->media.relay_vstep = 0;
+	session->media.relay_ats = 0;
+	session->media.relay_vts = 0;
+	session->media.relay_have_addr = TRUE;
+	struct sockaddr_in *server_addr = &session->media.relay_addr;
+	memset(server_addr, 0, sizeof(*server_addr));
+	server_addr->sin_family = AF_INET;
+	if(inet_aton(session->media.remote_ip, &server_addr->sin_addr) == 0) {	/* Not a numeric IP... */
 		struct hostent *host = gethostbyname(session->media.remote_ip);	/* ...resolve name */
 		if(!host) {
 			JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't get host (%s)\n", session->account.username, session->media.remote_ip);
-			have_server_ip = FALSE;
+			session->media.relay_have_addr = FALSE;
 		} else {
-			server_addr.sin_addr = *(struct in_addr *)host->h_addr_list;
+			server_addr->sin_addr = *(struct in_addr *)host->h_addr_list;
 		}
 	}
-	if(have_server_ip)
-		janus_sip_connect_sockets(session, &server_addr);
+	if(session->media.relay_have_addr)
+		janus_sip_connect_sockets(session, server_addr);
+}
+
+/* Reconnect the sockets after a session update */
+static void janus_sip_relay_update(janus_sip_session *session) {
+	/* Apparently there was a session update */
+	if(session->media.remote_ip != NULL && (inet_aton(session->media.remote_ip, &session->media.relay_addr.sin_addr) != 0)) {
+		janus_sip_connect_sockets(session, &session->media.relay_addr);
+	} else {
+		JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't update session details: missing or invalid remote IP address? (%s)\n",
+			session->account.username, session->media.remote_ip);
+	}
+	session->media.updated = FALSE;
+}
+
+/* Handle an RTP/RTCP packet coming from the SIP peer */
+static void janus_sip_relay_incoming(janus_sip_session *session, janus_sip_relay_kind kind, char *buffer, int bytes) {
+	if(kind == JANUS_SIP_RELAY_AUDIO_RTP) {
+		/* Got something audio (RTP) */
+		session->media.relay_pollerrs = 0;
+		janus_rtp_header *header = (janus_rtp_header *)buffer;
+		if(session->media.audio_ssrc_peer != ntohl(header->ssrc)) {
+			session->media.audio_ssrc_peer = ntohl(header->ssrc);
+			JANUS_LOG(LOG_VERB, "Got SIP peer audio SSRC: %"SCNu32"\n", session->media.audio_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(session->media.audio_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		guint32 timestamp = ntohl(header->timestamp);
+		janus_rtp_header_update(header, &session->media.context, FALSE,
+			session->media.relay_astep ? session->media.relay_astep : 960);
+		if(session->media.relay_ats == 0) {
+			session->media.relay_ats = timestamp;
+		} else if(session->media.relay_astep == 0) {
+			session->media.relay_astep = timestamp-session->media.relay_ats;
+			if(session->media.relay_astep < 0)
+				session->media.relay_astep = 0;
+		}
+		/* Save the frame if we're recording */
+		janus_recorder_save_frame(session->arc_peer, buffer, bytes);
+		/* Relay to browser */
+		gateway->relay_rtp(session->handle, 0, buffer, bytes);
+	} else if(kind == JANUS_SIP_RELAY_AUDIO_RTCP) {
+		/* Got something audio (RTCP) */
+		session->media.relay_pollerrs = 0;
+		/* Is this SRTCP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(session->media.audio_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTCP unprotect error: %s (len=%d-->%d)\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Relay to browser */
+		gateway->relay_rtcp(session->handle, 0, buffer, bytes);
+	} else if(kind == JANUS_SIP_RELAY_VIDEO_RTP) {
+		/* Got something video (RTP) */
+		session->media.relay_pollerrs = 0;
+		janus_rtp_header *header = (janus_rtp_header *)buffer;
+		if(session->media.video_ssrc_peer != ntohl(header->ssrc)) {
+			session->media.video_ssrc_peer = ntohl(header->ssrc);
+			JANUS_LOG(LOG_VERB, "Got SIP peer video SSRC: %"SCNu32"\n", session->media.video_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(session->media.video_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		janus_rtp_header_update(header, &session->media.context, TRUE,
+			session->media.relay_vstep ? session->media.relay_vstep : 4500);
+		guint32 timestamp = ntohl(header->timestamp);
+		if(session->media.relay_vts == 0) {
+			session->media.relay_vts = timestamp;
+		} else if(session->media.relay_vstep == 0) {
+			session->media.relay_vstep = timestamp-session->media.relay_vts;
+			if(session->media.relay_vstep < 0)
+				session->media.relay_vstep = 0;
+		}
+		/* Save the frame if we're recording */
+		janus_recorder_save_frame(session->vrc_peer, buffer, bytes);
+		/* Relay to browser */
+		gateway->relay_rtp(session->handle, 1, buffer, bytes);
+	} else if(kind == JANUS_SIP_RELAY_VIDEO_RTCP) {
+		/* Got something video (RTCP) */
+		session->media.relay_pollerrs = 0;
+		/* Is this SRTCP? */
+		if(session->media.has_srtp_remote) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(session->media.video_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d)\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen);
+				return;
+			}
+			bytes = buflen;
+		}
+		/* Relay to browser */
+		gateway->relay_rtcp(session->handle, 1, buffer, bytes);
+	}
+}
+
+/* Read all the packets we can from one of the sockets */
+static void janus_sip_relay_read(janus_sip_session *session, janus_sip_relay_kind kind, janus_sip_recv_batch *batch) {
+	int fd = *janus_sip_relay_fd(session, kind);
+	if(fd == -1)
+		return;
+	int count = janus_sip_recv_batch_read(fd, batch);
+	int i = 0;
+	for(i=0; i<count; i++)
+		janus_sip_relay_incoming(session, kind, batch->buffers[i], batch->lengths[i]);
+}
+
+/* Handle an error on one of the sockets: returns FALSE if it's time to stop relaying media */
+static gboolean janus_sip_relay_error(janus_sip_session *session, janus_sip_relay_kind kind, gboolean hup) {
+	int fd = *janus_sip_relay_fd(session, kind);
+	if(fd == -1)
+		return TRUE;
+	/* Check the socket error */
+	int error = 0;
+	socklen_t errlen = sizeof(error);
+	getsockopt(fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
+	if(error == 0) {
+		/* Maybe not a breaking error after all? */
+		return TRUE;
+	} else if(error == 111) {
+		/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
+		if(kind == JANUS_SIP_RELAY_AUDIO_RTCP) {
+			JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the audio RTCP socket, closing it\n",
+				session->account.username, strerror(error));
+			close(session->media.audio_rtcp_fd);
+			session->media.audio_rtcp_fd = -1;
+			return TRUE;
+		} else if(kind == JANUS_SIP_RELAY_VIDEO_RTCP) {
+			JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the video RTCP socket, closing it\n",
+				session->account.username, strerror(error));
+			close(session->media.video_rtcp_fd);
+			session->media.video_rtcp_fd = -1;
+			return TRUE;
+		}
+	}
+	/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
+	session->media.relay_pollerrs++;
+	if(session->media.relay_pollerrs < 100)
+		return TRUE;
+	JANUS_LOG(LOG_ERR, "[SIP-%s] Too many errors polling %d (socket #%d): %s...\n", session->account.username,
+		fd, kind, hup ? "POLLHUP" : "POLLERR");
+	JANUS_LOG(LOG_ERR, "[SIP-%s]   -- %d (%s)\n", session->account.username, error, strerror(error));
+	/* Can we assume it's pretty much over, after a POLLERR? */
+	/* FIXME Simulate a "hangup" coming from the browser */
+	janus_sip_message *msg = g_malloc(sizeof(janus_sip_message));
+	msg->handle = session->handle;
+	msg->message = json_pack("{ss}", "request", "hangup");
+	msg->transaction = NULL;
+	msg->jsep = NULL;
+	g_async_queue_push(messages, msg);
+	return FALSE;
+}
+
+/* Close the sockets and get rid of the SRTP stuff when a call is over */
+static void janus_sip_relay_cleanup(janus_sip_session *session) {
+	if(session->media.audio_rtp_fd != -1) {
+		close(session->media.audio_rtp_fd);
+		session->media.audio_rtp_fd = -1;
+	}
+	if(session->media.audio_rtcp_fd != -1) {
+		close(session->media.audio_rtcp_fd);
+		session->media.audio_rtcp_fd = -1;
+	}
+	if(session->media.local_audio_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_audio_rtp_port);
+	session->media.local_audio_rtp_port = 0;
+	session->media.local_audio_rtcp_port = 0;
+	session->media.audio_ssrc = 0;
+	if(session->media.video_rtp_fd != -1) {
+		close(session->media.video_rtp_fd);
+		session->media.video_rtp_fd = -1;
+	}
+	if(session->media.video_rtcp_fd != -1) {
+		close(session->media.video_rtcp_fd);
+		session->media.video_rtcp_fd = -1;
+	}
+	if(session->media.local_video_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_video_rtp_port);
+	session->media.local_video_rtp_port = 0;
+	session->media.local_video_rtcp_port = 0;
+	session->media.video_ssrc = 0;
+	session->media.simulcast_ssrc = 0;
+	if(session->media.pipefd[0] > 0) {
+		close(session->media.pipefd[0]);
+		session->media.pipefd[0] = -1;
+	}
+	if(session->media.pipefd[1] > 0) {
+		close(session->media.pipefd[1]);
+		session->media.pipefd[1] = -1;
+	}
+	/* Clean up SRTP stuff, if needed */
+	janus_sip_srtp_cleanup(session);
+}
+
+/* Thread to relay RTP/RTCP frames coming from the SIP peer */
+static void *janus_sip_relay_thread(void *data) {
+	janus_sip_session *session = (janus_sip_session *)data;
+	if(!session || !session->account.username || !session->callee) {
+		g_thread_unref(g_thread_self());
+		return NULL;
+	}
+	JANUS_LOG(LOG_VERB, "Starting relay thread (%s <--> %s)\n", session->account.username, session->callee);
+	janus_sip_relay_setup(session);
 
 	if(!session->callee) {
 		JANUS_LOG(LOG_VERB, "[SIP-%s] Leaving thread, no callee...\n", session->account.username);
@@ -4019,63 +4533,28 @@ static void *janus_sip_relay_thread(void *data) {
 		return NULL;
 	}
 	/* File descriptors */
-	socklen_t addrlen;
-	struct sockaddr_in remote;
-	int resfd = 0, bytes = 0, pollerrs = 0;
-	struct pollfd fds[5];
-	int pipe_fd = session->media.pipefd[0];
-	char buffer[1500];
-	memset(buffer, 0, 1500);
+	int resfd = 0;
+	struct pollfd fds[JANUS_SIP_RELAY_KINDS];
+	janus_sip_relay_kind kinds[JANUS_SIP_RELAY_KINDS];
+	janus_sip_recv_batch *batch = janus_sip_recv_batch_create();
 	/* Loop */
 	int num = 0;
 	gboolean goon = TRUE;
-	int astep = 0, vstep = 0;
-	guint32 ats = 0, vts = 0;
-	while(goon && session != NULL && !session->destroyed &&
-			session->status > janus_sip_call_status_idle &&
-			session->status < janus_sip_call_status_closing) {	/* FIXME We need a per-call watchdog as well */
-
-		if(session->media.updated) {
-			/* Apparently there was a session update */
-			if(session->media.remote_ip != NULL && (inet_aton(session->media.remote_ip, &server_addr.sin_addr) != 0)) {
-				janus_sip_connect_sockets(session, &server_addr);
-			} else {
-				JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: missing or invalid remote IP address? (%s)\n",
-					session->account.username, session->media.remote_ip);
-			}
-			session->media.updated = FALSE;
-		}
+	while(goon && !janus_sip_relay_is_over(session)) {
+		if(session->media.updated)
+			janus_sip_relay_update(session);
 
 		/* Prepare poll */
 		num = 0;
-		if(session->media.audio_rtp_fd != -1) {
-			fds[num].fd = session->media.audio_rtp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
-		}
-		if(session->media.audio_rtcp_fd != -1) {
-			fds[num].fd = session->media.audio_rtcp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
-		}
-		if(session->media.video_rtp_fd != -1) {
-			fds[num].fd = session->media.video_rtp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
-		}
-		if(session->media.video_rtcp_fd != -1) {
-			fds[num].fd = session->media.video_rtcp_fd;
-			fds[num].events = POLLIN;
-			fds[num].revents = 0;
-			num++;
-		}
-		if(pipe_fd != -1) {
-			fds[num].fd = pipe_fd;
+		janus_sip_relay_kind kind = 0;
+		for(kind=0; kind<JANUS_SIP_RELAY_KINDS; kind++) {
+			int fd = *janus_sip_relay_fd(session, kind);
+			if(fd == -1)
+				continue;
+			fds[num].fd = fd;
 			fds[num].events = POLLIN;
 			fds[num].revents = 0;
+			kinds[num] = kind;
 			num++;
 		}
 		/* Wait for some data */
@@ -4092,9 +4571,7 @@ static void *janus_sip_relay_thread(void *data) {
 			/* No data, keep going */
 			continue;
 		}
-		if(session == NULL || session->destroyed ||
-				session->status <= janus_sip_call_status_idle ||
-				session->status >= janus_sip_call_status_closing)
+		if(janus_sip_relay_is_over(session))
 			break;
 		int i = 0;
 		for(i=0; i<num; i++) {
@@ -4102,226 +4579,205 @@ static void *janus_sip_relay_thread(void *data) {
 				/* If we just updated the session, let's wait until things have calmed down */
 				if(session->media.updated)
 					break;
-				/* Check the socket error */
-				int error = 0;
-				socklen_t errlen = sizeof(error);
-				getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
-				if(error == 0) {
-					/* Maybe not a breaking error after all? */
-					continue;
-				} else if(error == 111) {
-					/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
-					if(fds[i].fd == session->media.audio_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the audio RTCP socket, closing it\n",
-							session->account.username, strerror(error));
-						close(session->media.audio_rtcp_fd);
-						session->media.audio_rtcp_fd = -1;
-						continue;
-					} else if(fds[i].fd == session->media.video_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the video RTCP socket, closing it\n",
-							session->account.username, strerror(error));
-						close(session->media.video_rtcp_fd);
-						session->media.video_rtcp_fd = -1;
-						continue;
-					}
+				if(!janus_sip_relay_error(session, kinds[i], !(fds[i].revents & POLLERR))) {
+					goon = FALSE;
+					break;
 				}
-				/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
-				pollerrs++;
-				if(pollerrs < 100)
-					continue;
-				JANUS_LOG(LOG_ERR, "[SIP-%s] Too many errors polling %d (socket #%d): %s...\n", session->account.username,
-					fds[i].fd, i, fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
-				JANUS_LOG(LOG_ERR, "[SIP-%s]   -- %d (%s)\n", session->account.username, error, strerror(error));
-				goon = FALSE;	/* Can we assume it's pretty much over, after a POLLERR? */
-				/* FIXME Simulate a "hangup" coming from the browser */
-				janus_sip_message *msg = g_malloc(sizeof(janus_sip_message));
-				msg->handle = session->handle;
-				msg->message = json_pack("{ss}", "request", "hangup");
-				msg->transaction = NULL;
-				msg->jsep = NULL;
-				g_async_queue_push(messages, msg);
-				break;
 			} else if(fds[i].revents & POLLIN) {
-				if(pipe_fd != -1 && fds[i].fd == pipe_fd) {
+				if(kinds[i] == JANUS_SIP_RELAY_PIPE) {
 					/* Poll interrupted for a reason, go on */
 					int code = 0;
-					(void)read(pipe_fd, &code, sizeof(int));
+					(void)read(fds[i].fd, &code, sizeof(int));
 					break;
 				}
 				/* Got an RTP/RTCP packet */
-				if(session->media.audio_rtp_fd != -1 && fds[i].fd == session->media.audio_rtp_fd) {
-					/* Got something audio (RTP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.audio_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					pollerrs = 0;
-					janus_rtp_header *header = (janus_rtp_header *)buffer;
-					if(session->media.audio_ssrc_peer != ntohl(header->ssrc)) {
-						session->media.audio_ssrc_peer = ntohl(header->ssrc);
-						JANUS_LOG(LOG_VERB, "Got SIP peer audio SSRC: %"SCNu32"\n", session->media.audio_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(session->media.audio_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					guint32 timestamp = ntohl(header->timestamp);
-					janus_rtp_header_update(header, &session->media.context, FALSE, astep ? astep : 960);
-					if(ats == 0) {
-						ats = timestamp;
-					} else if(astep == 0) {
-						astep = timestamp-ats;
-						if(astep < 0)
-							astep = 0;
-					}
-					/* Save the frame if we're recording */
-					janus_recorder_save_frame(session->arc_peer, buffer, bytes);
-					/* Relay to browser */
-					gateway->relay_rtp(session->handle, 0, buffer, bytes);
-					continue;
-				} else if(session->media.audio_rtcp_fd != -1 && fds[i].fd == session->media.audio_rtcp_fd) {
-					/* Got something audio (RTCP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.audio_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					pollerrs = 0;
-					/* Is this SRTCP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(session->media.audio_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTCP unprotect error: %s (len=%d-->%d)\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to browser */
-					gateway->relay_rtcp(session->handle, 0, buffer, bytes);
-					continue;
-				} else if(session->media.video_rtp_fd != -1 && fds[i].fd == session->media.video_rtp_fd) {
-					/* Got something video (RTP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.video_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					pollerrs = 0;
-					janus_rtp_header *header = (janus_rtp_header *)buffer;
-					if(session->media.video_ssrc_peer != ntohl(header->ssrc)) {
-						session->media.video_ssrc_peer = ntohl(header->ssrc);
-						JANUS_LOG(LOG_VERB, "Got SIP peer video SSRC: %"SCNu32"\n", session->media.video_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(session->media.video_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					janus_rtp_header_update(header, &session->media.context, TRUE, vstep ? vstep : 4500);
-					guint32 timestamp = ntohl(header->timestamp);
-					if(vts == 0) {
-						vts = timestamp;
-					} else if(vstep == 0) {
-						vstep = timestamp-vts;
-						if(vstep < 0)
-							vstep = 0;
-					}
-					/* Save the frame if we're recording */
-					janus_recorder_save_frame(session->vrc_peer, buffer, bytes);
-					/* Relay to browser */
-					gateway->relay_rtp(session->handle, 1, buffer, bytes);
-					continue;
-				} else if(session->media.video_rtcp_fd != -1 && fds[i].fd == session->media.video_rtcp_fd) {
-					/* Got something video (RTCP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.video_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					pollerrs = 0;
-					/* Is this SRTCP? */
-					if(session->media.has_srtp_remote) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(session->media.video_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d)\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to browser */
-					gateway->relay_rtcp(session->handle, 1, buffer, bytes);
-					continue;
-				}
+				janus_sip_relay_read(session, kinds[i], batch);
 			}
 		}
 	}
-	if(session->media.audio_rtp_fd != -1) {
-		close(session->media.audio_rtp_fd);
-		session->media.audio_rtp_fd = -1;
-	}
-	if(session->media.audio_rtcp_fd != -1) {
-		close(session->media.audio_rtcp_fd);
-		session->media.audio_rtcp_fd = -1;
+	g_free(batch);
+	janus_sip_relay_cleanup(session);
+	/* Done */
+	JANUS_LOG(LOG_VERB, "Leaving SIP relay thread\n");
+	g_thread_unref(g_thread_self());
+	return NULL;
+}
+
+static void janus_sip_relay_attach(janus_sip_session *session) {
+	janus_sip_relay_worker *worker = session->media.relay_worker;
+	if(worker == NULL) {
+		/* Pick the worker serving the fewest calls */
+		guint i = 0;
+		for(i=0; i<relay_workers_num; i++) {
+			if(worker == NULL || g_atomic_int_get(&relay_workers[i]->calls) < g_atomic_int_get(&worker->calls))
+				worker = relay_workers[i];
+		}
 	}
-	session->media.local_audio_rtp_port = 0;
-	session->media.local_audio_rtcp_port = 0;
-	session->media.audio_ssrc = 0;
-	if(session->media.video_rtp_fd != -1) {
-		close(session->media.video_rtp_fd);
-		session->media.video_rtp_fd = -1;
+	JANUS_LOG(LOG_VERB, "Relaying media on worker #%u (%s <--> %s)\n", worker->index, session->account.username, session->callee);
+	janus_sip_relay_setup(session);
+	janus_mutex_lock(&worker->mutex);
+	if(session->media.relay_worker == NULL) {
+		/* The worker keeps a reference until the call is detached */
+		g_atomic_int_inc(&session->relay_ref);
+		session->media.relay_worker = worker;
+		worker->sessions = g_list_prepend(worker->sessions, session);
+		g_atomic_int_inc(&worker->calls);
 	}
-	if(session->media.video_rtcp_fd != -1) {
-		close(session->media.video_rtcp_fd);
-		session->media.video_rtcp_fd = -1;
+	janus_sip_relay_kind kind = 0;
+	for(kind=0; kind<JANUS_SIP_RELAY_KINDS; kind++) {
+		int fd = *janus_sip_relay_fd(session, kind);
+		if(fd == -1)
+			continue;
+		janus_sip_relay_ref *ref = &session->media.relay_refs[kind];
+		ref->session = session;
+		ref->kind = kind;
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = ref;
+		if(epoll_ctl(worker->efd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno != EEXIST)
+			JANUS_LOG(LOG_WARN, "[SIP-%s] Error adding socket to relay worker #%u: %d (%s)\n",
+				session->account.username, worker->index, errno, strerror(errno));
 	}
-	session->media.local_video_rtp_port = 0;
-	session->media.local_video_rtcp_port = 0;
-	session->media.video_ssrc = 0;
-	session->media.simulcast_ssrc = 0;
-	if(session->media.pipefd[0] > 0) {
-		close(session->media.pipefd[0]);
-		session->media.pipefd[0] = -1;
+	janus_mutex_unlock(&worker->mutex);
+}
+
+/* Returns TRUE if the call was detached: the caller must then release the reference
+ * the worker held, once it's done with any event from epoll that may still point to it */
+static gboolean janus_sip_relay_detach(janus_sip_relay_worker *worker, janus_sip_session *session) {
+	janus_mutex_lock(&worker->mutex);
+	if(session->media.relay_worker != worker) {
+		janus_mutex_unlock(&worker->mutex);
+		return FALSE;
 	}
-	if(session->media.pipefd[1] > 0) {
-		close(session->media.pipefd[1]);
-		session->media.pipefd[1] = -1;
+	session->media.relay_worker = NULL;
+	worker->sessions = g_list_remove(worker->sessions, session);
+	g_atomic_int_add(&worker->calls, -1);
+	/* Closing the sockets takes care of removing them from epoll as well */
+	janus_sip_relay_cleanup(session);
+	janus_mutex_unlock(&worker->mutex);
+	JANUS_LOG(LOG_VERB, "[SIP-%s] Media relay on worker #%u stopped\n", session->account.username, worker->index);
+	return TRUE;
+}
+
+static void *janus_sip_relay_worker_thread(void *data) {
+	janus_sip_relay_worker *worker = (janus_sip_relay_worker *)data;
+	JANUS_LOG(LOG_VERB, "Joining SIP relay worker #%u\n", worker->index);
+	struct epoll_event events[JANUS_SIP_RELAY_MAX_EVENTS];
+	janus_sip_recv_batch *batch = janus_sip_recv_batch_create();
+	gint64 last_check = janus_get_monotonic_time();
+	GList *detached = NULL, *l = NULL;
+	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
+		int res = epoll_wait(worker->efd, events, JANUS_SIP_RELAY_MAX_EVENTS, 500);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "Error polling on SIP relay worker #%u: %d (%s)\n", worker->index, errno, strerror(errno));
+			break;
+		}
+		int i = 0;
+		for(i=0; i<res; i++) {
+			janus_sip_relay_ref *ref = (janus_sip_relay_ref *)events[i].data.ptr;
+			janus_sip_session *session = ref->session;
+			if(session->media.relay_worker != worker)
+				continue;
+			if(janus_sip_relay_is_over(session)) {
+				if(janus_sip_relay_detach(worker, session))
+					detached = g_list_prepend(detached, session);
+				continue;
+			}
+			int fd = *janus_sip_relay_fd(session, ref->kind);
+			if(fd == -1)
+				continue;
+			if(ref->kind == JANUS_SIP_RELAY_PIPE) {
+				/* Something changed in the session */
+				int code = 0;
+				(void)read(fd, &code, sizeof(int));
+				if(session->media.updated)
+					janus_sip_relay_update(session);
+			} else if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+				/* If we just updated the session, let's wait until things have calmed down */
+				if(session->media.updated)
+					continue;
+				if(!janus_sip_relay_error(session, ref->kind, !(events[i].events & EPOLLERR)) &&
+						janus_sip_relay_detach(worker, session))
+					detached = g_list_prepend(detached, session);
+			} else if(events[i].events & EPOLLIN) {
+				/* Got RTP/RTCP packets */
+				janus_sip_relay_read(session, ref->kind, batch);
+			}
+		}
+		/* Calls with no traffic won't wake us up: check every now and then which ones are over */
+		gint64 now = janus_get_monotonic_time();
+		if(now-last_check >= G_USEC_PER_SEC/2) {
+			last_check = now;
+			GList *over = NULL;
+			janus_mutex_lock(&worker->mutex);
+			for(l = worker->sessions; l; l = l->next) {
+				janus_sip_session *session = (janus_sip_session *)l->data;
+				if(janus_sip_relay_is_over(session))
+					over = g_list_prepend(over, session);
+			}
+			janus_mutex_unlock(&worker->mutex);
+			for(l = over; l; l = l->next) {
+				if(janus_sip_relay_detach(worker, (janus_sip_session *)l->data))
+					detached = g_list_prepend(detached, l->data);
+			}
+			g_list_free(over);
+		}
+		/* Now that we're done with this round of events, the watchdog can free the calls we detached */
+		for(l = detached; l; l = l->next)
+			g_atomic_int_add(&((janus_sip_session *)l->data)->relay_ref, -1);
+		g_list_free(detached);
+		detached = NULL;
 	}
-	/* Clean up SRTP stuff, if needed */
-	janus_sip_srtp_cleanup(session);
-	/* Done */
-	JANUS_LOG(LOG_VERB, "Leaving SIP relay thread\n");
+	g_free(batch);
+	JANUS_LOG(LOG_VERB, "Leaving SIP relay worker #%u\n", worker->index);
+	return NULL;
+}
+
+/* Resolving the address of the SIP peer may block, and we may be on the sofia
+ * thread: when it's not a numeric address, we attach the call from here instead */
+static void *janus_sip_relay_resolve_thread(void *data) {
+	janus_sip_session *session = (janus_sip_session *)data;
+	janus_sip_relay_attach(session);
+	g_atomic_int_add(&session->relay_ref, -1);
 	g_thread_unref(g_thread_self());
 	return NULL;
 }
 
+/* Start relaying the media of a call, on a thread of its own or on a shared worker */
+static void janus_sip_relay_start(janus_sip_session *session) {
+	if(relay_workers_num > 0) {
+		struct in_addr addr;
+		if(session->media.remote_ip == NULL || inet_aton(session->media.remote_ip, &addr) != 0) {
+			janus_sip_relay_attach(session);
+			return;
+		}
+		/* Keep the session around until the name is resolved */
+		g_atomic_int_inc(&session->relay_ref);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "sipdns %s", session->account.username);
+		g_thread_try_new(tname, janus_sip_relay_resolve_thread, session, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the SIP resolver thread, resolving here...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			janus_sip_relay_attach(session);
+			g_atomic_int_add(&session->relay_ref, -1);
+		}
+		return;
+	}
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
+	g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n", error->code, error->message ? error->message : "??");
+	}
+}
+
 
 /* Sofia Event thread */
 gpointer janus_sip_sofia_thread(gpointer user_data) {
@@ -203,6 +203,7 @@ static char *user_agent;
 static uint32_t register_ttl = JANUS_DEFAULT_REGISTER_TTL;
 static uint16_t rtp_range_min = 10000;
 static uint16_t rtp_range_max = 60000;
+static struct janus_port_range *rtp_ports = NULL;
 
 static GThread *handler_thread;
 static GThread *watchdog;
@@ -1016,6 +1017,11 @@ int janus_sipre_init(janus_callbacks *callback, const char *config_path) {
 	messages = g_async_queue_new_full((GDestroyNotify) janus_sipre_message_free);
 	/* This is the callback we'll need to invoke to contact the gateway */
 	gateway = callback;
+	/* RTP/RTCP ports are picked from a shared allocator */
+	rtp_ports = gateway->port_range_get(rtp_range_min, rtp_range_max);
+	if(rtp_ports == NULL) {
+		JANUS_LOG(LOG_WARN, "Invalid RTP/RTCP port range %u -- %u, calls will fail\n", rtp_range_min, rtp_range_max);
+	}
 
 	g_atomic_int_set(&initialized, 1);
 
@@ -1094,6 +1100,8 @@ void janus_sipre_destroy(void) {
 	janus_mutex_unlock(&sessions_mutex);
 	g_async_queue_unref(messages);
 	messages = NULL;
+	gateway->port_range_unref(rtp_ports);
+	rtp_ports = NULL;
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
 
@@ -2147,14 +2155,16 @@ static void *janus_sipre_handler(void *data) {
 				g_snprintf(error_cause, 512, "Could not allocate RTP/RTCP ports");
 				goto error;
 			}
+			janus_sdp_negotiation *negotiation = janus_sdp_negotiation_create(parsed_sdp);
 			if(session->media.audio_pt > -1) {
-				session->media.audio_pt_name = janus_get_codec_from_pt(sdp, session->media.audio_pt);
+				session->media.audio_pt_name = janus_sdp_negotiation_get_codec_name(negotiation, session->media.audio_pt);
 				JANUS_LOG(LOG_VERB, "Detected audio codec: %d (%s)\n", session->media.audio_pt, session->media.audio_pt_name);
 			}
 			if(session->media.video_pt > -1) {
-				session->media.video_pt_name = janus_get_codec_from_pt(sdp, session->media.video_pt);
+				session->media.video_pt_name = janus_sdp_negotiation_get_codec_name(negotiation, session->media.video_pt);
 				JANUS_LOG(LOG_VERB, "Detected video codec: %d (%s)\n", session->media.video_pt, session->media.video_pt_name);
 			}
+			janus_sdp_negotiation_destroy(negotiation);
 			/* Take note of the SDP (may be useful for UPDATEs or re-INVITEs) */
 			janus_sdp_free(session->sdp);
 			session->sdp = parsed_sdp;
@@ -2932,6 +2942,8 @@ static int janus_sipre_allocate_local_ports(janus_sipre_session *session) {
 		close(session->media.audio_rtcp_fd);
 		session->media.audio_rtcp_fd = -1;
 	}
+	if(session->media.local_audio_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_audio_rtp_port);
 	session->media.local_audio_rtp_port = 0;
 	session->media.local_audio_rtcp_port = 0;
 	session->media.audio_ssrc = 0;
@@ -2943,6 +2955,8 @@ static int janus_sipre_allocate_local_ports(janus_sipre_session *session) {
 		close(session->media.video_rtcp_fd);
 		session->media.video_rtcp_fd = -1;
 	}
+	if(session->media.local_video_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_video_rtp_port);
 	session->media.local_video_rtp_port = 0;
 	session->media.local_video_rtcp_port = 0;
 	session->media.video_ssrc = 0;
@@ -2972,9 +2986,11 @@ static int janus_sipre_allocate_local_ports(janus_sipre_session *session) {
 				JANUS_LOG(LOG_ERR, "Error creating audio sockets...\n");
 				return -1;
 			}
-			int rtp_port = g_random_int_range(rtp_range_min, rtp_range_max);
-			if(rtp_port % 2)
-				rtp_port++;	/* Pick an even port for RTP */
+			int rtp_port = gateway->port_allocate(rtp_ports);
+			if(rtp_port < 0) {
+				JANUS_LOG(LOG_ERR, "No RTP/RTCP port pair available in range %u -- %u\n", rtp_range_min, rtp_range_max);
+				return -1;
+			}
 			audio_rtp_address.sin_family = AF_INET;
 			audio_rtp_address.sin_port = htons(rtp_port);
 			inet_pton(AF_INET, local_ip, &audio_rtp_address.sin_addr.s_addr);
@@ -2982,6 +2998,7 @@ static int janus_sipre_allocate_local_ports(janus_sipre_session *session) {
 				JANUS_LOG(LOG_ERR, "Bind failed for audio RTP (port %d), trying a different one...\n", rtp_port);
 				close(session->media.audio_rtp_fd);
 				session->media.audio_rtp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -2997,6 +3014,7 @@ static int janus_sipre_allocate_local_ports(janus_sipre_session *session) {
 				session->media.audio_rtp_fd = -1;
 				close(session->media.audio_rtcp_fd);
 				session->media.audio_rtcp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -3021,9 +3039,11 @@ static int janus_sipre_allocate_local_ports(janus_sipre_session *session) {
 				JANUS_LOG(LOG_ERR, "Error creating video sockets...\n");
 				return -1;
 			}
-			int rtp_port = g_random_int_range(rtp_range_min, rtp_range_max);
-			if(rtp_port % 2)
-				rtp_port++;	/* Pick an even port for RTP */
+			int rtp_port = gateway->port_allocate(rtp_ports);
+			if(rtp_port < 0) {
+				JANUS_LOG(LOG_ERR, "No RTP/RTCP port pair available in range %u -- %u\n", rtp_range_min, rtp_range_max);
+				return -1;
+			}
 			video_rtp_address.sin_family = AF_INET;
 			video_rtp_address.sin_port = htons(rtp_port);
 			inet_pton(AF_INET, local_ip, &video_rtp_address.sin_addr.s_addr);
@@ -3031,6 +3051,7 @@ static int janus_sipre_allocate_local_ports(janus_sipre_session *session) {
 				JANUS_LOG(LOG_ERR, "Bind failed for video RTP (port %d), trying a different one...\n", rtp_port);
 				close(session->media.video_rtp_fd);
 				session->media.video_rtp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -3046,6 +3067,7 @@ static int janus_sipre_allocate_local_ports(janus_sipre_session *session) {
 				session->media.video_rtp_fd = -1;
 				close(session->media.video_rtcp_fd);
 				session->media.video_rtcp_fd = -1;
+				gateway->port_release(rtp_ports, rtp_port);
 				attempts--;
 				continue;
 			}
@@ -3359,6 +3381,8 @@ static void *janus_sipre_relay_thread(void *data) {
 		close(session->media.audio_rtcp_fd);
 		session->media.audio_rtcp_fd = -1;
 	}
+	if(session->media.local_audio_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_audio_rtp_port);
 	session->media.local_audio_rtp_port = 0;
 	session->media.local_audio_rtcp_port = 0;
 	session->media.audio_ssrc = 0;
@@ -3370,6 +3394,8 @@ static void *janus_sipre_relay_thread(void *data) {
 		close(session->media.video_rtcp_fd);
 		session->media.video_rtcp_fd = -1;
 	}
+	if(session->media.local_video_rtp_port > 0)
+		gateway->port_release(rtp_ports, session->media.local_video_rtp_port);
 	session->media.local_video_rtp_port = 0;
 	session->media.local_video_rtcp_port = 0;
 	session->media.video_ssrc = 0;
@@ -3782,14 +3808,16 @@ int janus_sipre_cb_answer(const struct sip_msg *msg, void *arg) {
 		session->callee = NULL;
 		return EINVAL;
 	}
+	janus_sdp_negotiation *negotiation = janus_sdp_negotiation_create(sdp);
 	if(session->media.audio_pt > -1) {
-		session->media.audio_pt_name = janus_get_codec_from_pt(sdp_answer, session->media.audio_pt);
+		session->media.audio_pt_name = janus_sdp_negotiation_get_codec_name(negotiation, session->media.audio_pt);
 		JANUS_LOG(LOG_VERB, "Detected audio codec: %d (%s)\n", session->media.audio_pt, session->media.audio_pt_name);
 	}
 	if(session->media.video_pt > -1) {
-		session->media.video_pt_name = janus_get_codec_from_pt(sdp_answer, session->media.video_pt);
+		session->media.video_pt_name = janus_sdp_negotiation_get_codec_name(negotiation, session->media.video_pt);
 		JANUS_LOG(LOG_VERB, "Detected video codec: %d (%s)\n", session->media.video_pt, session->media.video_pt_name);
 	}
+	janus_sdp_negotiation_destroy(negotiation);
 	session->media.ready = TRUE;	/* FIXME Maybe we need a better way to signal this */
 	if(update && !session->media.earlymedia && !session->media.update) {
 		/* Don't push to the browser if this is in response to a hold/unhold we sent ourselves */
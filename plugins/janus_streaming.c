@@ -80,8 +80,11 @@ videopt = <video RTP payload type> (e.g., 100)
 videortpmap = RTP map of the video codec (e.g., VP8/90000)
 videofmtp = Codec specific parameters, if any
 videobufferkf = yes|no (whether the plugin should store the latest
-	keyframe and send it immediately for new viewers, EXPERIMENTAL)
+	keyframe, of each substream when simulcasting, and send it immediately
+	for new viewers, EXPERIMENTAL)
 videosimulcast = yes|no (do|don't enable video simulcasting)
+videoautosimulcast = yes|no (whether the substream to send viewers should be picked
+	automatically, according to the bandwidth they advertise via REMB, default=no)
 videoport2 = second local port for receiving video frames (only for rtp, and simulcasting)
 videoport3 = third local port for receiving video frames (only for rtp, and simulcasting)
 videoskew = yes|no (whether the plugin should perform skew
@@ -89,10 +92,22 @@ videoskew = yes|no (whether the plugin should perform skew
 collision = in case of collision (more than one SSRC hitting the same port), the plugin
 	will discard incoming RTP packets with a new SSRC unless this many milliseconds
 	passed, which would then change the current SSRC (0=disabled)
+threads = number of helper threads to split the listeners of this mountpoint
+	across, each relaying packets to its share of them, which helps when a
+	mountpoint has thousands of viewers (only for rtp, 0=disabled, default)
 dataport = local port for receiving data messages to relay
 dataiface = network interface or IP address to bind to, if any (binds to all otherwise)
 databuffermsg = yes|no (whether the plugin should store the latest
 	message and send it immediately for new viewers)
+cascade = host:port of another instance of this plugin to cascade the
+	mountpoint from, getting audio, video and data on a single socket
+	instead of ports (the origin must have cascade_port set in [general])
+cascade_id = ID of the mountpoint to cascade on the origin
+cascade_pin = PIN of the mountpoint on the origin, if any
+lazy = yes|no (whether sockets, threads and RTSP connections should only be
+	created the first time the mountpoint is needed, that is by an authorized
+	watch, switch, enable or recording request; needs an id, default is
+	lazy_mountpoints in [general])
 
 In case you want to use SRTP for your RTP-based mountpoint, you'll need
 to configure the SRTP-related properties as well, namely the suite to
@@ -109,6 +124,17 @@ rtsp_user = RTSP authorization username, if needed
 rtsp_pwd = RTSP authorization password, if needed
 rtsp_failcheck = whether an error should be returned if connecting to the RTSP server fails (default=yes)
 rtspiface = network interface IP address or device name to listen on when receiving RTSP streams
+rtsp_transport = how RTP should be received, either "udp" (default, one
+	port per stream) or "tcp" (interleaved on the RTSP connection itself,
+	which helps when the server is behind a NAT or firewall)
+videobufferkf = yes|no (whether the latest keyframe should be kept, and
+	sent to new viewers right away, default=no: notice that the keyframe
+	survives reconnections to the RTSP server)
+
+If the RTSP server goes away (no media for 5 seconds, or the interleaved
+connection drops) the plugin tries to reconnect right away, and if that
+fails it keeps on trying with an exponential backoff (from 500ms up to
+30 seconds between attempts).
 \endverbatim
  *
  * \section streamapi Streaming API
@@ -118,12 +144,16 @@ rtspiface = network interface IP address or device name to listen on when receiv
  * (invalid JSON, invalid request) which will always result in a
  * synchronous error response even for asynchronous requests.
  *
- * \c list , \c create , \c destroy , \c recording , \c edit , \c enable and
- * \c disable are synchronous requests, which means you'll
+ * \c list , \c create , \c destroy , \c reload , \c recording , \c edit ,
+ * \c enable and \c disable are synchronous requests, which means you'll
  * get a response directly within the context of the transaction. \c list
  * lists all the available streams; \c create allows you to create a new
  * mountpoint dynamically, as an alternative to using the configuration
- * file; \c destroy removes a mountpoint and destroys it; \c recording
+ * file; \c destroy removes a mountpoint and destroys it; \c reload
+ * reads the configuration file again and only applies what changed,
+ * that is creating new mountpoints, destroying removed ones and
+ * recreating the ones whose properties changed (mountpoints created
+ * via API and not saved are left alone); \c recording
  * instructs the plugin on whether or not a live RTP stream should be
  * recorded while it's broadcasted; \c enable and \c disable respectively
  * enable and disable a mountpoint, that is decide whether or not a
@@ -146,7 +176,7 @@ rtspiface = network interface IP address or device name to listen on when receiv
  * configure an admin \c admin_key in the plugin settings. When
  * configured, only "create" requests that include the correct
  * \c admin_key value in an "admin_key" property will succeed, and will
- * be rejected otherwise.
+ * be rejected otherwise. The same key protects \c reload requests.
  *
  * Actual API docs: TBD.
  *
@@ -161,6 +191,9 @@ rtspiface = network interface IP address or device name to listen on when receiv
 #include <errno.h>
 #include <sys/poll.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netdb.h>
 
 #ifdef HAVE_LIBCURL
 #include <curl/curl.h>
@@ -175,7 +208,10 @@ rtspiface = network interface IP address or device name to listen on when receiv
 #include "../rtcp.h"
 #include "../record.h"
 #include "../utils.h"
+#include "../timer.h"
+#include "../affinity.h"
 #include "../ip-utils.h"
+#include "../metrics.h"
 
 
 /* Plugin information */
@@ -278,8 +314,12 @@ static struct janus_json_parameter rtp_parameters[] = {
 	{"video", JANUS_JSON_BOOL, 0},
 	{"data", JANUS_JSON_BOOL, 0},
 	{"collision", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"threads", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"srtpsuite", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
-	{"srtpcrypto", JSON_STRING, 0}
+	{"srtpcrypto", JSON_STRING, 0},
+	{"cascade", JSON_STRING, 0},
+	{"cascade_id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"cascade_pin", JSON_STRING, 0}
 };
 static struct janus_json_parameter live_parameters[] = {
 	{"id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
@@ -315,12 +355,14 @@ static struct janus_json_parameter rtsp_parameters[] = {
 	{"videortpmap", JSON_STRING, 0},
 	{"videofmtp", JSON_STRING, 0},
 	{"rtspiface", JSON_STRING, 0},
-	{"rtsp_failcheck", JANUS_JSON_BOOL, 0}
+	{"rtsp_failcheck", JANUS_JSON_BOOL, 0},
+	{"rtsp_transport", JSON_STRING, 0},
+	{"videobufferkf", JANUS_JSON_BOOL, 0}
 };
 #endif
 static struct janus_json_parameter rtp_audio_parameters[] = {
 	{"audiomcast", JSON_STRING, 0},
-	{"audioport", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"audioport", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"audiopt", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
 	{"audiortpmap", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"audiofmtp", JSON_STRING, 0},
@@ -329,19 +371,20 @@ static struct janus_json_parameter rtp_audio_parameters[] = {
 };
 static struct janus_json_parameter rtp_video_parameters[] = {
 	{"videomcast", JSON_STRING, 0},
-	{"videoport", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"videoport", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"videopt", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
 	{"videortpmap", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"videofmtp", JSON_STRING, 0},
 	{"videobufferkf", JANUS_JSON_BOOL, 0},
 	{"videoiface", JSON_STRING, 0},
 	{"videosimulcast", JANUS_JSON_BOOL, 0},
+	{"videoautosimulcast", JANUS_JSON_BOOL, 0},
 	{"videoport2", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"videoport3", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"videoskew", JANUS_JSON_BOOL, 0},
 };
 static struct janus_json_parameter rtp_data_parameters[] = {
-	{"dataport", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"dataport", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"databuffermsg", JANUS_JSON_BOOL, 0},
 	{"dataiface", JSON_STRING, 0}
 };
@@ -385,11 +428,9 @@ static janus_mutex config_mutex = JANUS_MUTEX_INITIALIZER;
 static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
 static janus_callbacks *gateway = NULL;
-static GThread *handler_thread;
+static janus_handler_pool *handlers = NULL;
 static GThread *watchdog;
 static void *janus_streaming_handler(void *data);
-static void *janus_streaming_ondemand_thread(void *data);
-static void *janus_streaming_filesource_thread(void *data);
 static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data);
 static void *janus_streaming_relay_thread(void *data);
 static void janus_streaming_hangup_media_internal(janus_plugin_session *handle);
@@ -409,13 +450,16 @@ typedef enum janus_streaming_source {
 } janus_streaming_source;
 
 // 关键帧信息
+/* Keyframes larger than this (in packets) are not cached */
+#define JANUS_STREAMING_KEYFRAME_PACKETS	128
+#define JANUS_STREAMING_KEYFRAME_MTU		1500
+/* Keyframe cache for a substream, see below */
+typedef struct janus_streaming_rtp_keyframe_ring janus_streaming_rtp_keyframe_ring;
+
 typedef struct janus_streaming_rtp_keyframe {
 	gboolean enabled;
-	/* If enabled, we store the packets of the last keyframe, to immediately send them for new viewers */
-	GList *latest_keyframe;
-	/* This is where we store packets while we're still collecting the whole keyframe */
-	GList *temp_keyframe;
-	guint32 temp_ts;
+	/* If enabled, we store the packets of the last keyframe of each substream, to immediately send them for new viewers */
+	janus_streaming_rtp_keyframe_ring *rings[3];
 	janus_mutex mutex;
 } janus_streaming_rtp_keyframe;
 
@@ -427,6 +471,8 @@ typedef struct janus_streaming_buffer {
 #endif
 
 // rtp 源
+/* Length of the cookies origins hand to cascade edges (see janus_streaming_cascade_cookie) */
+#define JANUS_STREAMING_CASCADE_COOKIE_LEN	32
 typedef struct janus_streaming_rtp_source {
 	gint audio_port;
 	in_addr_t audio_mcast;
@@ -442,6 +488,8 @@ typedef struct janus_streaming_rtp_source {
 	int video_fd[3];
 	int data_fd;
 	gboolean simulcast;
+	gboolean simulcast_auto;	/* Whether viewers get the substream that fits their REMB */
+	janus_simulcast_bitrates sc_bitrates;	/* Bitrate of each substream, if so */
 	gboolean askew, vskew;
 	gint64 last_received_audio;
 	gint64 last_received_video;
@@ -454,10 +502,16 @@ typedef struct janus_streaming_rtp_source {
 	char *rtsp_username, *rtsp_password;
 	int ka_timeout;
 	gboolean reconnecting;
-	gint64 reconnect_timer;
+	gint64 reconnect_timer;		/* When we last got media, or 0 if the connection dropped */
+	gint64 reconnect_next;		/* When we should try reconnecting next, if we're not connected */
+	int reconnect_attempts;		/* Failed attempts since we were last connected, for the backoff */
 	janus_mutex rtsp_mutex;
 	int audio_rtcp_fd;
 	int video_rtcp_fd;
+	gboolean rtsp_tcp;			/* Whether RTP is interleaved on the RTSP connection */
+	int rtsp_fd;				/* The RTSP connection socket, if interleaved (owned by libcurl) */
+	struct janus_streaming_recv_batch *rtsp_batch;	/* Where interleaved packets go while reading */
+	int rtsp_received;
 #endif
 	janus_streaming_rtp_keyframe keyframe;
 	gboolean buffermsg;
@@ -471,6 +525,14 @@ typedef struct janus_streaming_rtp_source {
 	gboolean is_srtp;
 	srtp_t srtp_ctx;
 	srtp_policy_t srtp_policy;
+	/* Only needed for mountpoints cascaded from a remote origin */
+	int cascade_fd;
+	char *cascade_origin;
+	guint64 cascade_id;
+	char *cascade_pin;
+	char cascade_cookie[JANUS_STREAMING_CASCADE_COOKIE_LEN+1];
+	gboolean cascade_ok;
+	gint64 cascade_subscribed, cascade_kfr;
 } janus_streaming_rtp_source;
 
 // 文件源
@@ -484,6 +546,13 @@ typedef struct multiple_fds {
 	int rtcp_fd;
 } multiple_fds;
 
+/* Channels RTP is interleaved on, when receiving RTSP streams over TCP (RTCP uses the next one) */
+#define JANUS_STREAMING_RTSP_CHANNEL_VIDEO	0
+#define JANUS_STREAMING_RTSP_CHANNEL_AUDIO	2
+/* How long we wait before trying to reconnect to an RTSP server again, the first retry is immediate */
+#define JANUS_STREAMING_RTSP_BACKOFF_MIN	(500*G_TIME_SPAN_MILLISECOND)
+#define JANUS_STREAMING_RTSP_BACKOFF_MAX	(30*G_USEC_PER_SEC)
+
 #define JANUS_STREAMING_VP8		0
 #define JANUS_STREAMING_H264	1
 #define JANUS_STREAMING_VP9		2
@@ -497,6 +566,11 @@ typedef struct janus_streaming_codecs {
 	char *video_fmtp;
 } janus_streaming_codecs;
 
+/* Helper thread relaying packets to a share of the listeners of a mountpoint */
+typedef struct janus_streaming_helper janus_streaming_helper;
+/* Edge node subscribed to a mountpoint of ours via the cascade socket */
+typedef struct janus_streaming_cascade_edge janus_streaming_cascade_edge;
+
 typedef struct janus_streaming_mountpoint {
 	guint64 id;
 	char *name;
@@ -513,15 +587,49 @@ typedef struct janus_streaming_mountpoint {
 	janus_streaming_codecs codecs;
 	gboolean audio, video, data;
 	GList/*<unowned janus_streaming_session>*/ *listeners;
+	int helper_threads;	/* Number of helper threads the listeners are split across, if any */
+	GList/*<owned janus_streaming_helper>*/ *threads;
+	GList/*<owned janus_streaming_cascade_edge>*/ *edges;
 	gint64 destroyed;
 	janus_mutex mutex;
 } janus_streaming_mountpoint;
 GHashTable *mountpoints;
 static GList *old_mountpoints;
 janus_mutex mountpoints_mutex;
+/* Exported via the core metrics */
+static janus_metric *metric_mountpoints = NULL;
+static gint64 janus_streaming_metric_mountpoints(gpointer user_data) {
+	janus_mutex_lock(&mountpoints_mutex);
+	gint64 count = mountpoints ? g_hash_table_size(mountpoints) : 0;
+	janus_mutex_unlock(&mountpoints_mutex);
+	return count;
+}
 static char *admin_key = NULL;
 
+/* Mountpoints from the configuration file that haven't been created yet:
+ * either lazy ones, waiting for someone to address them, or ones a "reload"
+ * changed, waiting for the instance they replace to release its sockets */
+typedef struct janus_streaming_deferred_mountpoint {
+	guint64 id;		/* 0 if the configuration doesn't specify one */
+	char *name;
+	gboolean lazy;
+	janus_config *config;	/* Private copy of the category */
+} janus_streaming_deferred_mountpoint;
+static GList/*<owned janus_streaming_deferred_mountpoint>*/ *deferred_mountpoints = NULL;	/* Protected by mountpoints_mutex */
+/* Serializes activations and reloads: always locked before mountpoints_mutex */
+static janus_mutex deferred_mutex = JANUS_MUTEX_INITIALIZER;
+/* Default for the per-mountpoint "lazy" property */
+static gboolean lazy_mountpoints = FALSE;
+
 static void janus_streaming_mountpoint_free(janus_streaming_mountpoint *mp);
+static janus_streaming_mountpoint *janus_streaming_mountpoint_from_config(janus_config_category *cat, struct ifaddrs *ifas);
+static void janus_streaming_mountpoint_load(janus_config_category *cat, struct ifaddrs *ifas, gboolean replacing);
+static void janus_streaming_mountpoint_unload(const char *name);
+static void janus_streaming_mountpoint_unmount(janus_streaming_mountpoint *mp);
+static void janus_streaming_mountpoint_activate(guint64 id, json_t *root, const char *member);
+static void janus_streaming_deferred_free(janus_streaming_deferred_mountpoint *dm);
+static janus_streaming_deferred_mountpoint *janus_streaming_deferred_find(guint64 id, const char *name);
+static void janus_streaming_deferred_check(void);
 
 /* Helper to create an RTP live source (e.g., from gstreamer/ffmpeg/vlc/etc.) */
 janus_streaming_mountpoint *janus_streaming_create_rtp_source(
@@ -530,7 +638,8 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		gboolean doaudio, char *amcast, const janus_network_address *aiface, uint16_t aport, uint8_t acodec, char *artpmap, char *afmtp, gboolean doaskew,
 		gboolean dovideo, char *vmcast, const janus_network_address *viface, uint16_t vport, uint8_t vcodec, char *vrtpmap, char *vfmtp, gboolean bufferkf,
 			gboolean simulcast, uint16_t vport2, uint16_t vport3, gboolean dovskew, int rtp_collision,
-		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean buffermsg);
+		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean buffermsg, int threads,
+		char *cascade, guint64 cascade_id, char *cascade_pin);
 
 /* Helper to create a file/ondemand live source */
 janus_streaming_mountpoint *janus_streaming_create_file_source(
@@ -543,7 +652,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 		char *url, char *username, char *password,
 		gboolean doaudio, char *artpmap, char *afmtp,
 		gboolean dovideo, char *vrtpmap, char *vfmtp,
-		const janus_network_address *iface,
+		const janus_network_address *iface, gboolean tcp, gboolean bufferkf,
 		gboolean error_on_failure);
 
 
@@ -553,7 +662,6 @@ typedef struct janus_streaming_message {
 	json_t *message;
 	json_t *jsep;
 } janus_streaming_message;
-static GAsyncQueue *messages = NULL;
 static janus_streaming_message exit_message;
 
 static void janus_streaming_message_free(janus_streaming_message *msg) {
@@ -590,13 +698,16 @@ typedef struct janus_streaming_session {
 	int templayer_target;	/* As above, but to handle transitions (e.g., wait for keyframe) */
 	gint64 last_relayed;	/* When we relayed the last packet (used to detect when substreams become unavailable) */
 	janus_vp8_simulcast_context simulcast_context;
+	janus_simulcast_bwe_context bwe;	/* Bandwidth estimation, if the substream is picked automatically */
 	gboolean stopping;
 	volatile gint hangingup;
+	janus_streaming_helper *helper;	/* Helper thread relaying packets to this listener, if any */
 	gint64 destroyed;	/* Time at which this session was marked as destroyed */
 } janus_streaming_session;
 static GHashTable *sessions;
 static GList *old_sessions;
 static janus_mutex sessions_mutex = JANUS_MUTEX_INITIALIZER;
+static gboolean janus_streaming_filesource_start(janus_streaming_mountpoint *mountpoint, janus_streaming_session *session);
 
 /* Packets we get from outside and relay */
 typedef struct janus_streaming_rtp_relay_packet {
@@ -607,9 +718,98 @@ typedef struct janus_streaming_rtp_relay_packet {
 	gboolean is_keyframe;
 	gboolean simulcast;
 	int codec, substream;
+	janus_video_info video;	/* Codec specific info, only parsed for video when the keyframe cache or simulcast need it */
 	uint32_t timestamp;
 	uint16_t seq_number;
+	janus_rtp_switching_context *rewritten;	/* Context of the listener the header has been rewritten for, if any */
 } janus_streaming_rtp_relay_packet;
+static void janus_streaming_relay_rtp_to_listeners(GList *listeners, janus_streaming_rtp_relay_packet *packet);
+static void janus_streaming_restore_header(janus_streaming_rtp_relay_packet *packet);
+
+/* Helper threads: each has its own share of the listeners, and gets a reference
+ * to each packet the relay thread receives, which it then copies to relay it:
+ * listeners are never moved, and a new one goes to the least busy helper */
+struct janus_streaming_helper {
+	janus_streaming_mountpoint *mp;
+	guint id;
+	GThread *thread;
+	int num_listeners;
+	GList/*<unowned janus_streaming_session>*/ *listeners;
+	GAsyncQueue *queued_packets;
+	janus_mutex mutex;
+};
+typedef struct janus_streaming_shared_packet {
+	janus_streaming_rtp_relay_packet packet;
+	volatile gint ref;
+	char data[0];
+} janus_streaming_shared_packet;
+static janus_streaming_shared_packet exit_packet;
+/* Largest packet a helper can relay (RTP, or data messages plus the terminator) */
+#define JANUS_STREAMING_HELPER_MTU	2048
+static void *janus_streaming_helper_thread(void *data);
+static void janus_streaming_helpers_start(janus_streaming_mountpoint *mp, int threads);
+static void janus_streaming_helpers_stop(janus_streaming_mountpoint *mp);
+static void janus_streaming_relay_to_mountpoint(janus_streaming_mountpoint *mp, janus_streaming_rtp_relay_packet *packet);
+/* These must be called with the mountpoint mutex locked */
+static void janus_streaming_listener_add(janus_streaming_mountpoint *mp, janus_streaming_session *session);
+static void janus_streaming_listener_remove(janus_streaming_mountpoint *mp, janus_streaming_session *session);
+
+struct janus_streaming_rtp_keyframe_ring {
+	/* Two slots of preallocated packets: one has the latest complete keyframe, the other one
+	 * is the one we're collecting the next keyframe in, and they're swapped when that's done */
+	janus_streaming_rtp_relay_packet packets[2][JANUS_STREAMING_KEYFRAME_PACKETS];
+	int count[2];
+	int latest;		/* Slot with the latest complete keyframe, -1 if we have none yet */
+	guint32 temp_ts;	/* Timestamp of the keyframe we're collecting, 0 if none */
+	gboolean overflow;	/* Whether the keyframe we're collecting didn't fit in the slot */
+	char *buffers;	/* Where the packets data lives */
+};
+
+/* Cascading: an origin can relay its RTP mountpoints to edges (other instances
+ * of this plugin) over a single UDP socket, rather than forwarding each stream
+ * to a different port. Edges subscribe to a mountpoint with a text request
+ * ("SUB <id> [<pin>]") they repeat as a keep-alive, ask for a keyframe when
+ * they need one ("KFR <id>") and unsubscribe when done ("BYE <id>"): the origin
+ * sends them all the packets of the mountpoint, each followed by a byte telling
+ * them what it is (which keeps RTP headers aligned), and replies to requests */
+#define JANUS_STREAMING_KIND_AUDIO		0
+#define JANUS_STREAMING_KIND_VIDEO		1	/* Plus the substream */
+#define JANUS_STREAMING_KIND_DATA		4
+#define JANUS_STREAMING_KIND_KEYFRAME	5	/* Plus the substream, cached keyframes sent on request */
+#define JANUS_STREAMING_KIND_CONTROL	8
+/* How often edges refresh their subscriptions, and when origins give up on them */
+#define JANUS_STREAMING_CASCADE_REFRESH	(3*G_USEC_PER_SEC)
+#define JANUS_STREAMING_CASCADE_TIMEOUT	(10*G_USEC_PER_SEC)
+/* Before sending anything to an edge, origins make sure it can receive
+ * packets on the address it claims, by replying to its first SUB with a
+ * cookie it must then include: cookies are an HMAC of the address, and
+ * are valid for one or two periods. As replies go to addresses we didn't
+ * verify yet, requests are padded to be larger than any reply */
+#define JANUS_STREAMING_CASCADE_COOKIE_PERIOD	(60*G_USEC_PER_SEC)
+#define JANUS_STREAMING_CASCADE_REQUEST_SIZE	160
+struct janus_streaming_cascade_edge {
+	struct sockaddr_in address;
+	gint64 last_seen;
+	gboolean is_srtp;
+	srtp_t srtp_ctx;
+	srtp_policy_t srtp_policy;
+};
+static int cascade_port = 0, cascade_fd = -1;
+static GThread *cascade_thread = NULL;
+static int cascade_srtpsuite = 0;
+static char *cascade_srtpcrypto = NULL;
+static char cascade_secret[33];
+/* If set, only edges whose address starts with one of these can subscribe */
+static GList *cascade_acl = NULL;
+static int janus_streaming_create_fd(int port, in_addr_t mcast, const janus_network_address *iface, const char *listenername, const char *medianame, const char *mountpointname);
+static void *janus_streaming_cascade_thread(void *data);
+static void janus_streaming_cascade_edge_free(janus_streaming_cascade_edge *edge);
+/* Must be called with the mountpoint mutex locked */
+static void janus_streaming_cascade_relay(janus_streaming_mountpoint *mp, janus_streaming_rtp_relay_packet *packet);
+/* Edge side */
+static int janus_streaming_cascade_connect(const char *origin, const char *name);
+static void janus_streaming_cascade_request(janus_streaming_rtp_source *source, const char *verb);
+static void janus_streaming_cascade_refresh(janus_streaming_mountpoint *mp);
 
 
 /* Error codes */
@@ -684,12 +884,644 @@ static void *janus_streaming_watchdog(void *data) {
 			}
 		}
 		janus_mutex_unlock(&mountpoints_mutex);
+		/* Check if any mountpoint changed by a reload can be recreated */
+		janus_streaming_deferred_check();
 		g_usleep(500000);
 	}
 	JANUS_LOG(LOG_INFO, "Streaming watchdog stopped\n");
 	return NULL;
 }
 
+/* Helper to create a mountpoint out of a category of the configuration file */
+static janus_streaming_mountpoint *janus_streaming_mountpoint_from_config(janus_config_category *cat, struct ifaddrs *ifas) {
+	if(cat == NULL || cat->name == NULL)
+		return NULL;
+	janus_streaming_mountpoint *mp = NULL;
+	JANUS_LOG(LOG_VERB, "Adding stream '%s'\n", cat->name);
+	janus_config_item *type = janus_config_get_item(cat, "type");
+	if(type == NULL || type->value == NULL) {
+		JANUS_LOG(LOG_WARN, "  -- Invalid type, skipping stream '%s'...\n", cat->name);
+		return NULL;
+	}
+	// 输入为rtp类型
+	if(!strcasecmp(type->value, "rtp")) {
+		janus_network_address video_iface, audio_iface, data_iface;
+		/* RTP live source (e.g., from gstreamer/ffmpeg/vlc/etc.) */
+		janus_config_item *id = janus_config_get_item(cat, "id");
+		janus_config_item *desc = janus_config_get_item(cat, "description");
+		janus_config_item *priv = janus_config_get_item(cat, "is_private");
+		janus_config_item *secret = janus_config_get_item(cat, "secret");
+		janus_config_item *pin = janus_config_get_item(cat, "pin");
+		janus_config_item *audio = janus_config_get_item(cat, "audio");
+		janus_config_item *askew = janus_config_get_item(cat, "audioskew");
+		janus_config_item *video = janus_config_get_item(cat, "video");
+		janus_config_item *vskew = janus_config_get_item(cat, "videoskew");
+		janus_config_item *data = janus_config_get_item(cat, "data");
+		janus_config_item *diface = janus_config_get_item(cat, "dataiface");
+		janus_config_item *amcast = janus_config_get_item(cat, "audiomcast");
+		janus_config_item *aiface = janus_config_get_item(cat, "audioiface");
+		janus_config_item *aport = janus_config_get_item(cat, "audioport");
+		janus_config_item *acodec = janus_config_get_item(cat, "audiopt");
+		janus_config_item *artpmap = janus_config_get_item(cat, "audiortpmap");
+		janus_config_item *afmtp = janus_config_get_item(cat, "audiofmtp");
+		janus_config_item *vmcast = janus_config_get_item(cat, "videomcast");
+		janus_config_item *viface = janus_config_get_item(cat, "videoiface");
+		janus_config_item *vport = janus_config_get_item(cat, "videoport");
+		janus_config_item *vcodec = janus_config_get_item(cat, "videopt");
+		janus_config_item *vrtpmap = janus_config_get_item(cat, "videortpmap");
+		janus_config_item *vfmtp = janus_config_get_item(cat, "videofmtp");
+		janus_config_item *vkf = janus_config_get_item(cat, "videobufferkf");
+		janus_config_item *vsc = janus_config_get_item(cat, "videosimulcast");
+		janus_config_item *vasc = janus_config_get_item(cat, "videoautosimulcast");
+		janus_config_item *vport2 = janus_config_get_item(cat, "videoport2");
+		janus_config_item *vport3 = janus_config_get_item(cat, "videoport3");
+		janus_config_item *dport = janus_config_get_item(cat, "dataport");
+		janus_config_item *dbm = janus_config_get_item(cat, "databuffermsg");
+		janus_config_item *rtpcollision = janus_config_get_item(cat, "collision");
+		janus_config_item *threads = janus_config_get_item(cat, "threads");
+		janus_config_item *ssuite = janus_config_get_item(cat, "srtpsuite");
+		janus_config_item *scrypto = janus_config_get_item(cat, "srtpcrypto");
+		janus_config_item *cascade = janus_config_get_item(cat, "cascade");
+		janus_config_item *cascade_id = janus_config_get_item(cat, "cascade_id");
+		janus_config_item *cascade_pin = janus_config_get_item(cat, "cascade_pin");
+		gboolean cascaded = cascade && cascade->value;
+		gboolean is_private = priv && priv->value && janus_is_true(priv->value);
+		gboolean doaudio = audio && audio->value && janus_is_true(audio->value);
+		gboolean doaskew = audio && askew && askew->value && janus_is_true(askew->value);
+		gboolean dovideo = video && video->value && janus_is_true(video->value);
+		gboolean dovskew = video && vskew && vskew->value && janus_is_true(vskew->value);
+		gboolean dodata = data && data->value && janus_is_true(data->value);
+		gboolean bufferkf = video && vkf && vkf->value && janus_is_true(vkf->value);
+		gboolean simulcast = video && vsc && vsc->value && janus_is_true(vsc->value);
+		gboolean buffermsg = data && dbm && dbm->value && janus_is_true(dbm->value);
+		if(!doaudio && !dovideo && !dodata) {
+			JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', no audio, video or data have to be streamed...\n", cat->name);
+			return NULL;
+		}
+		if(doaudio &&
+				((!cascaded && (aport == NULL || aport->value == NULL || atoi(aport->value) == 0)) ||
+				acodec == NULL || acodec->value == NULL ||
+				artpmap == NULL || artpmap->value == NULL)) {
+			JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', missing mandatory information for audio...\n", cat->name);
+			return NULL;
+		}
+		if(doaudio && aiface) {
+			if(!ifas) {
+				JANUS_LOG(LOG_ERR, "Skipping 'rtp' stream '%s', it relies on network configuration but network device information is unavailable...\n", cat->name);
+				return NULL;
+			}
+			if(janus_network_lookup_interface(ifas, aiface->value, &audio_iface) != 0) {
+				JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', invalid network interface configuration for audio...\n", cat->name);
+				return NULL;
+			}
+		}
+		if(dovideo &&
+				((!cascaded && (vport == NULL || vport->value == NULL || atoi(vport->value) == 0)) ||
+				vcodec == NULL || vcodec->value == NULL ||
+				vrtpmap == NULL || vrtpmap->value == NULL)) {
+			JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', missing mandatory information for video...\n", cat->name);
+			return NULL;
+		}
+		if(dodata && !cascaded && (dport == NULL || dport->value == NULL || atoi(dport->value) == 0)) {
+			JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', missing mandatory information for data...\n", cat->name);
+			return NULL;
+		}
+#ifndef HAVE_SCTP
+		if(dodata) {
+			JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s': no datachannels support......\n", cat->name);
+			return NULL;
+		}
+#endif
+		if(dodata && diface) {
+			if(!ifas) {
+				JANUS_LOG(LOG_ERR, "Skipping 'rtp' stream '%s', it relies on network configuration but network device information is unavailable...\n", cat->name);
+				return NULL;
+			}
+			if(janus_network_lookup_interface(ifas, diface->value, &data_iface) != 0) {
+				JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', invalid network interface configuration for data...\n", cat->name);
+				return NULL;
+			}
+		}
+		if(dovideo && viface) {
+			if(!ifas) {
+				JANUS_LOG(LOG_ERR, "Skipping 'rtp' stream '%s', it relies on network configuration but network device information is unavailable...\n", cat->name);
+				return NULL;
+			}
+			if(janus_network_lookup_interface(ifas, viface->value, &video_iface) != 0) {
+				JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', invalid network interface configuration for video...\n", cat->name);
+				return NULL;
+			}
+		}
+		if(ssuite && ssuite->value && atoi(ssuite->value) != 32 && atoi(ssuite->value) != 80) {
+			JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', invalid SRTP suite...\n", cat->name);
+			return NULL;
+		}
+		if(cascaded && (cascade_id == NULL || cascade_id->value == NULL || g_ascii_strtoull(cascade_id->value, 0, 10) == 0)) {
+			JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', missing the ID of the mountpoint to cascade...\n", cat->name);
+			return NULL;
+		}
+		if(id == NULL || id->value == NULL) {
+			JANUS_LOG(LOG_VERB, "Missing id for stream '%s', will generate a random one...\n", cat->name);
+		} else {
+			janus_mutex_lock(&mountpoints_mutex);
+			guint64 mpid = g_ascii_strtoull(id->value, 0, 10);
+			gboolean taken = g_hash_table_lookup(mountpoints, &mpid) != NULL || janus_streaming_deferred_find(mpid, NULL) != NULL;
+			janus_mutex_unlock(&mountpoints_mutex);
+			if(taken) {
+				JANUS_LOG(LOG_ERR, "A stream with the provided ID %s already exists, skipping '%s'\n", id->value, cat->name);
+				return NULL;
+			}
+		}
+		JANUS_LOG(LOG_VERB, "Audio %s, Video %s, Data %s\n",
+			doaudio ? "enabled" : "NOT enabled",
+			dovideo ? "enabled" : "NOT enabled",
+			dodata ? "enabled" : "NOT enabled");
+		janus_streaming_mountpoint *mp = NULL;
+		if((mp = janus_streaming_create_rtp_source(
+				(id && id->value) ? g_ascii_strtoull(id->value, 0, 10) : 0,
+				(char *)cat->name,
+				desc ? (char *)desc->value : NULL,
+				ssuite && ssuite->value ? atoi(ssuite->value) : 0,
+				scrypto && scrypto->value ? (char *)scrypto->value : NULL,
+				doaudio,
+				amcast ? (char *)amcast->value : NULL,
+				doaudio && aiface && aiface->value ? &audio_iface : NULL,
+				(aport && aport->value) ? atoi(aport->value) : 0,
+				(acodec && acodec->value) ? atoi(acodec->value) : 0,
+				artpmap ? (char *)artpmap->value : NULL,
+				afmtp ? (char *)afmtp->value : NULL,
+				doaskew,
+				dovideo,
+				vmcast ? (char *)vmcast->value : NULL,
+				dovideo && viface && viface->value ? &video_iface : NULL,
+				(vport && vport->value) ? atoi(vport->value) : 0,
+				(vcodec && vcodec->value) ? atoi(vcodec->value) : 0,
+				vrtpmap ? (char *)vrtpmap->value : NULL,
+				vfmtp ? (char *)vfmtp->value : NULL,
+				bufferkf,
+				simulcast,
+				(vport2 && vport2->value) ? atoi(vport2->value) : 0,
+				(vport3 && vport3->value) ? atoi(vport3->value) : 0,
+				dovskew,
+				(rtpcollision && rtpcollision->value) ?  atoi(rtpcollision->value) : 0,
+				dodata,
+				dodata && diface && diface->value ? &data_iface : NULL,
+				(dport && dport->value) ? atoi(dport->value) : 0,
+				buffermsg,
+				(threads && threads->value) ? atoi(threads->value) : 0,
+				cascaded ? (char *)cascade->value : NULL,
+				cascaded ? g_ascii_strtoull(cascade_id->value, 0, 10) : 0,
+				cascade_pin ? (char *)cascade_pin->value : NULL)) == NULL) {
+			JANUS_LOG(LOG_ERR, "Error creating 'rtp' stream '%s'...\n", cat->name);
+			return NULL;
+		}
+		mp->is_private = is_private;
+		if(secret && secret->value)
+			mp->secret = g_strdup(secret->value);
+		if(pin && pin->value)
+			mp->pin = g_strdup(pin->value);
+		if(simulcast && vasc && vasc->value && janus_is_true(vasc->value))
+			((janus_streaming_rtp_source *)mp->source)->simulcast_auto = TRUE;
+	} else if(!strcasecmp(type->value, "live")) {
+		/* File live source */
+		janus_config_item *id = janus_config_get_item(cat, "id");
+		janus_config_item *desc = janus_config_get_item(cat, "description");
+		janus_config_item *priv = janus_config_get_item(cat, "is_private");
+		janus_config_item *secret = janus_config_get_item(cat, "secret");
+		janus_config_item *pin = janus_config_get_item(cat, "pin");
+		janus_config_item *file = janus_config_get_item(cat, "filename");
+		janus_config_item *audio = janus_config_get_item(cat, "audio");
+		janus_config_item *video = janus_config_get_item(cat, "video");
+		if(file == NULL || file->value == NULL) {
+			JANUS_LOG(LOG_ERR, "Can't add 'live' stream '%s', missing mandatory information...\n", cat->name);
+			return NULL;
+		}
+		gboolean is_private = priv && priv->value && janus_is_true(priv->value);
+		gboolean doaudio = audio && audio->value && janus_is_true(audio->value);
+		gboolean dovideo = video && video->value && janus_is_true(video->value);
+		/* TODO We should support something more than raw a-Law and mu-Law streams... */
+		if(!doaudio || dovideo) {
+			JANUS_LOG(LOG_ERR, "Can't add 'live' stream '%s', we only support audio file streaming right now...\n", cat->name);
+			return NULL;
+		}
+		if(!strstr(file->value, ".alaw") && !strstr(file->value, ".mulaw")) {
+			JANUS_LOG(LOG_ERR, "Can't add 'live' stream '%s', unsupported format (we only support raw mu-Law and a-Law files right now)\n", cat->name);
+			return NULL;
+		}
+		FILE *audiofile = fopen(file->value, "rb");
+		if(!audiofile) {
+			JANUS_LOG(LOG_ERR, "Can't add 'live' stream, no such file '%s'...\n", file->value);
+			return NULL;
+		}
+		fclose(audiofile);
+		if(id == NULL || id->value == NULL) {
+			JANUS_LOG(LOG_VERB, "Missing id for stream '%s', will generate a random one...\n", cat->name);
+		} else {
+			janus_mutex_lock(&mountpoints_mutex);
+			guint64 mpid = g_ascii_strtoull(id->value, 0, 10);
+			gboolean taken = g_hash_table_lookup(mountpoints, &mpid) != NULL || janus_streaming_deferred_find(mpid, NULL) != NULL;
+			janus_mutex_unlock(&mountpoints_mutex);
+			if(taken) {
+				JANUS_LOG(LOG_ERR, "A stream with the provided ID %s already exists, skipping '%s'\n", id->value, cat->name);
+				return NULL;
+			}
+		}
+		janus_streaming_mountpoint *mp = NULL;
+		if((mp = janus_streaming_create_file_source(
+				(id && id->value) ? g_ascii_strtoull(id->value, 0, 10) : 0,
+				(char *)cat->name,
+				desc ? (char *)desc->value : NULL,
+				(char *)file->value,
+				TRUE, doaudio, dovideo)) == NULL) {
+			JANUS_LOG(LOG_ERR, "Error creating 'live' stream '%s'...\n", cat->name);
+			return NULL;
+		}
+		mp->is_private = is_private;
+		if(secret && secret->value)
+			mp->secret = g_strdup(secret->value);
+		if(pin && pin->value)
+			mp->pin = g_strdup(pin->value);
+	} else if(!strcasecmp(type->value, "ondemand")) {
+		/* mu-Law file on demand source */
+		janus_config_item *id = janus_config_get_item(cat, "id");
+		janus_config_item *desc = janus_config_get_item(cat, "description");
+		janus_config_item *priv = janus_config_get_item(cat, "is_private");
+		janus_config_item *secret = janus_config_get_item(cat, "secret");
+		janus_config_item *pin = janus_config_get_item(cat, "pin");
+		janus_config_item *file = janus_config_get_item(cat, "filename");
+		janus_config_item *audio = janus_config_get_item(cat, "audio");
+		janus_config_item *video = janus_config_get_item(cat, "video");
+		if(file == NULL || file->value == NULL) {
+			JANUS_LOG(LOG_ERR, "Can't add 'ondemand' stream '%s', missing mandatory information...\n", cat->name);
+			return NULL;
+		}
+		gboolean is_private = priv && priv->value && janus_is_true(priv->value);
+		gboolean doaudio = audio && audio->value && janus_is_true(audio->value);
+		gboolean dovideo = video && video->value && janus_is_true(video->value);
+		/* TODO We should support something more than raw a-Law and mu-Law streams... */
+		if(!doaudio || dovideo) {
+			JANUS_LOG(LOG_ERR, "Can't add 'ondemand' stream '%s', we only support audio file streaming right now...\n", cat->name);
+			return NULL;
+		}
+		if(!strstr(file->value, ".alaw") && !strstr(file->value, ".mulaw")) {
+			JANUS_LOG(LOG_ERR, "Can't add 'ondemand' stream '%s', unsupported format (we only support raw mu-Law and a-Law files right now)\n", cat->name);
+			return NULL;
+		}
+		FILE *audiofile = fopen(file->value, "rb");
+		if(!audiofile) {
+			JANUS_LOG(LOG_ERR, "Can't add 'ondemand' stream, no such file '%s'...\n", file->value);
+			return NULL;
+		}
+		fclose(audiofile);
+		if(id == NULL || id->value == NULL) {
+			JANUS_LOG(LOG_VERB, "Missing id for stream '%s', will generate a random one...\n", cat->name);
+		} else {
+			janus_mutex_lock(&mountpoints_mutex);
+			guint64 mpid = g_ascii_strtoull(id->value, 0, 10);
+			gboolean taken = g_hash_table_lookup(mountpoints, &mpid) != NULL || janus_streaming_deferred_find(mpid, NULL) != NULL;
+			janus_mutex_unlock(&mountpoints_mutex);
+			if(taken) {
+				JANUS_LOG(LOG_ERR, "A stream with the provided ID %s already exists, skipping '%s'\n", id->value, cat->name);
+				return NULL;
+			}
+		}
+		janus_streaming_mountpoint *mp = NULL;
+		if((mp = janus_streaming_create_file_source(
+				(id && id->value) ? g_ascii_strtoull(id->value, 0, 10) : 0,
+				(char *)cat->name,
+				desc ? (char *)desc->value : NULL,
+				(char *)file->value,
+				FALSE, doaudio, dovideo)) == NULL) {
+			JANUS_LOG(LOG_ERR, "Error creating 'ondemand' stream '%s'...\n", cat->name);
+			return NULL;
+		}
+		mp->is_private = is_private;
+		if(secret && secret->value)
+			mp->secret = g_strdup(secret->value);
+		if(pin && pin->value)
+			mp->pin = g_strdup(pin->value);
+	} else if(!strcasecmp(type->value, "rtsp")) {
+#ifndef HAVE_LIBCURL
+		JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream '%s', libcurl support not compiled...\n", cat->name);
+		return NULL;
+#else
+		janus_config_item *id = janus_config_get_item(cat, "id");
+		janus_config_item *desc = janus_config_get_item(cat, "description");
+		janus_config_item *priv = janus_config_get_item(cat, "is_private");
+		janus_config_item *secret = janus_config_get_item(cat, "secret");
+		janus_config_item *pin = janus_config_get_item(cat, "pin");
+		janus_config_item *file = janus_config_get_item(cat, "url");
+		janus_config_item *username = janus_config_get_item(cat, "rtsp_user");
+		janus_config_item *password = janus_config_get_item(cat, "rtsp_pwd");
+		janus_config_item *audio = janus_config_get_item(cat, "audio");
+		janus_config_item *artpmap = janus_config_get_item(cat, "audiortpmap");
+		janus_config_item *afmtp = janus_config_get_item(cat, "audiofmtp");
+		janus_config_item *video = janus_config_get_item(cat, "video");
+		janus_config_item *vrtpmap = janus_config_get_item(cat, "videortpmap");
+		janus_config_item *vfmtp = janus_config_get_item(cat, "videofmtp");
+		janus_config_item *iface = janus_config_get_item(cat, "rtspiface");
+		janus_config_item *failerr = janus_config_get_item(cat, "rtsp_failcheck");
+		janus_config_item *transport = janus_config_get_item(cat, "rtsp_transport");
+		janus_config_item *vkf = janus_config_get_item(cat, "videobufferkf");
+		janus_network_address iface_value;
+		if(file == NULL || file->value == NULL) {
+			JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream '%s', missing mandatory information...\n", cat->name);
+			return NULL;
+		}
+		gboolean is_private = priv && priv->value && janus_is_true(priv->value);
+		gboolean doaudio = audio && audio->value && janus_is_true(audio->value);
+		gboolean dovideo = video && video->value && janus_is_true(video->value);
+		gboolean error_on_failure = TRUE;
+		if(failerr && failerr->value)
+			error_on_failure = janus_is_true(failerr->value);
+		gboolean tcp = FALSE;
+		if(transport && transport->value) {
+			if(!strcasecmp(transport->value, "tcp")) {
+				tcp = TRUE;
+			} else if(strcasecmp(transport->value, "udp")) {
+				JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream '%s', invalid transport '%s'...\n", cat->name, transport->value);
+				return NULL;
+			}
+		}
+		gboolean bufferkf = dovideo && vkf && vkf->value && janus_is_true(vkf->value);
+
+		if((doaudio || dovideo) && iface && iface->value) {
+			if(!ifas) {
+				JANUS_LOG(LOG_ERR, "Skipping 'rtsp' stream '%s', it relies on network configuration but network device information is unavailable...\n", cat->name);
+				return NULL;
+			}
+			if(janus_network_lookup_interface(ifas, iface->value, &iface_value) != 0) {
+				JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream '%s', invalid network interface configuration for stream...\n", cat->name);
+				return NULL;
+			}
+		}
+
+		if(id == NULL || id->value == NULL) {
+			JANUS_LOG(LOG_VERB, "Missing id for stream '%s', will generate a random one...\n", cat->name);
+		} else {
+			janus_mutex_lock(&mountpoints_mutex);
+			guint64 mpid = g_ascii_strtoull(id->value, 0, 10);
+			gboolean taken = g_hash_table_lookup(mountpoints, &mpid) != NULL || janus_streaming_deferred_find(mpid, NULL) != NULL;
+			janus_mutex_unlock(&mountpoints_mutex);
+			if(taken) {
+				JANUS_LOG(LOG_ERR, "A stream with the provided ID %s already exists, skipping '%s'\n", id->value, cat->name);
+				return NULL;
+			}
+		}
+		janus_streaming_mountpoint *mp = NULL;
+		if((mp = janus_streaming_create_rtsp_source(
+				(id && id->value) ? g_ascii_strtoull(id->value, 0, 10) : 0,
+				(char *)cat->name,
+				desc ? (char *)desc->value : NULL,
+				(char *)file->value,
+				username ? (char *)username->value : NULL,
+				password ? (char *)password->value : NULL,
+				doaudio,
+				artpmap ? (char *)artpmap->value : NULL,
+				afmtp ? (char *)afmtp->value : NULL,
+				dovideo,
+				vrtpmap ? (char *)vrtpmap->value : NULL,
+				vfmtp ? (char *)vfmtp->value : NULL,
+				iface && iface->value ? &iface_value : NULL,
+				tcp, bufferkf,
+				error_on_failure)) == NULL) {
+			JANUS_LOG(LOG_ERR, "Error creating 'rtsp' stream '%s'...\n", cat->name);
+			return NULL;
+		}
+		mp->is_private = is_private;
+		if(secret && secret->value)
+			mp->secret = g_strdup(secret->value);
+		if(pin && pin->value)
+			mp->pin = g_strdup(pin->value);
+#endif
+	} else {
+		JANUS_LOG(LOG_WARN, "Ignoring unknown stream type '%s' (%s)...\n", type->value, cat->name);
+	}
+	return mp;
+}
+
+
+/* Helpers to create a mountpoint out of a category right away, or defer it */
+static janus_streaming_mountpoint *janus_streaming_deferred_create(janus_streaming_deferred_mountpoint *dm) {
+	struct ifaddrs *ifas = NULL;
+	if(getifaddrs(&ifas) != 0)
+		ifas = NULL;
+	janus_streaming_mountpoint *mp = janus_streaming_mountpoint_from_config(
+		janus_config_get_category(dm->config, dm->name), ifas);
+	if(ifas)
+		freeifaddrs(ifas);
+	if(mp == NULL)
+		JANUS_LOG(LOG_ERR, "Error creating deferred stream '%s'...\n", dm->name);
+	return mp;
+}
+
+static void janus_streaming_deferred_free(janus_streaming_deferred_mountpoint *dm) {
+	if(dm == NULL)
+		return;
+	g_free(dm->name);
+	janus_config_destroy(dm->config);
+	g_free(dm);
+}
+
+/* Must be called with mountpoints_mutex held */
+static janus_streaming_deferred_mountpoint *janus_streaming_deferred_find(guint64 id, const char *name) {
+	GList *l = deferred_mountpoints;
+	while(l) {
+		janus_streaming_deferred_mountpoint *dm = (janus_streaming_deferred_mountpoint *)l->data;
+		if((id > 0 && dm->id == id) || (name != NULL && !strcasecmp(dm->name, name)))
+			return dm;
+		l = l->next;
+	}
+	return NULL;
+}
+
+static void janus_streaming_mountpoint_load(janus_config_category *cat, struct ifaddrs *ifas, gboolean replacing) {
+	if(cat == NULL || cat->name == NULL)
+		return;
+	janus_config_item *id = janus_config_get_item(cat, "id");
+	janus_config_item *lazy = janus_config_get_item(cat, "lazy");
+	guint64 mpid = (id && id->value) ? g_ascii_strtoull(id->value, 0, 10) : 0;
+	gboolean defer = (lazy && lazy->value) ? janus_is_true(lazy->value) : lazy_mountpoints;
+	if(defer && mpid == 0) {
+		/* Nobody could address it before it exists */
+		JANUS_LOG(LOG_WARN, "Stream '%s' has no id, can't be lazy\n", cat->name);
+		defer = FALSE;
+	}
+	if(!defer && !replacing) {
+		janus_streaming_mountpoint_from_config(cat, ifas);
+		return;
+	}
+	/* Keep a copy of the category around, we'll create the mountpoint later */
+	janus_streaming_deferred_mountpoint *dm = g_malloc0(sizeof(janus_streaming_deferred_mountpoint));
+	dm->id = mpid;
+	dm->name = g_strdup(cat->name);
+	dm->lazy = defer;
+	dm->config = janus_config_create(cat->name);
+	janus_config_add_category(dm->config, cat->name);
+	GList *il = cat->items;
+	while(il) {
+		janus_config_item *item = (janus_config_item *)il->data;
+		janus_config_add_item(dm->config, cat->name, item->name, item->value);
+		il = il->next;
+	}
+	janus_mutex_lock(&mountpoints_mutex);
+	if((mpid > 0 && g_hash_table_lookup(mountpoints, &mpid) != NULL) || janus_streaming_deferred_find(mpid, cat->name) != NULL) {
+		janus_mutex_unlock(&mountpoints_mutex);
+		JANUS_LOG(LOG_ERR, "A stream with the provided ID %"SCNu64" already exists, skipping '%s'\n", mpid, cat->name);
+		janus_streaming_deferred_free(dm);
+		return;
+	}
+	deferred_mountpoints = g_list_append(deferred_mountpoints, dm);
+	janus_mutex_unlock(&mountpoints_mutex);
+	JANUS_LOG(LOG_VERB, "Stream '%s' will be created %s\n", cat->name,
+		dm->lazy ? "the first time it's addressed" : "as soon as the previous instance is gone");
+}
+
+/* Creates a lazy mountpoint, if it hasn't been created already: since the
+ * request that addresses it will check the secret (or pin) in member on the
+ * mountpoint, we check the configured one first, so that requests that would
+ * be rejected anyway can't spawn sockets and threads for us to keep around */
+static void janus_streaming_mountpoint_activate(guint64 id, json_t *root, const char *member) {
+	if(id == 0)
+		return;
+	janus_mutex_lock(&deferred_mutex);
+	janus_mutex_lock(&mountpoints_mutex);
+	janus_streaming_deferred_mountpoint *dm = NULL;
+	if(g_hash_table_lookup(mountpoints, &id) == NULL) {
+		dm = janus_streaming_deferred_find(id, NULL);
+		if(dm != NULL && dm->lazy) {
+			janus_config_item *item = janus_config_get_item(janus_config_get_category(dm->config, dm->name), member);
+			if(item != NULL && item->value != NULL) {
+				json_t *provided = json_object_get(root, member);
+				if(!json_is_string(provided) || !janus_strcmp_const_time(item->value, json_string_value(provided)))
+					dm = NULL;
+			}
+		} else {
+			dm = NULL;
+		}
+		if(dm != NULL)
+			deferred_mountpoints = g_list_remove(deferred_mountpoints, dm);
+	}
+	janus_mutex_unlock(&mountpoints_mutex);
+	if(dm != NULL) {
+		JANUS_LOG(LOG_INFO, "Activating lazy mountpoint %"SCNu64" (%s)\n", id, dm->name);
+		janus_streaming_deferred_create(dm);
+		janus_streaming_deferred_free(dm);
+	}
+	janus_mutex_unlock(&deferred_mutex);
+}
+
+/* Creates the mountpoints a reload changed, once the instances they replace are gone */
+static void janus_streaming_deferred_check(void) {
+	janus_mutex_lock(&deferred_mutex);
+	janus_mutex_lock(&mountpoints_mutex);
+	GList *ready = NULL, *l = deferred_mountpoints;
+	while(l) {
+		janus_streaming_deferred_mountpoint *dm = (janus_streaming_deferred_mountpoint *)l->data;
+		GList *next = l->next;
+		if(!dm->lazy) {
+			gboolean busy = FALSE;
+			GList *ol = old_mountpoints;
+			while(ol && !busy) {
+				janus_streaming_mountpoint *old = (janus_streaming_mountpoint *)ol->data;
+				if(old && ((dm->id > 0 && old->id == dm->id) || (old->name && !strcasecmp(old->name, dm->name))))
+					busy = TRUE;
+				ol = ol->next;
+			}
+			if(!busy) {
+				deferred_mountpoints = g_list_delete_link(deferred_mountpoints, l);
+				ready = g_list_append(ready, dm);
+			}
+		}
+		l = next;
+	}
+	janus_mutex_unlock(&mountpoints_mutex);
+	l = ready;
+	while(l) {
+		janus_streaming_deferred_mountpoint *dm = (janus_streaming_deferred_mountpoint *)l->data;
+		JANUS_LOG(LOG_INFO, "Recreating stream '%s' after a reload\n", dm->name);
+		janus_streaming_deferred_create(dm);
+		janus_streaming_deferred_free(dm);
+		l = l->next;
+	}
+	g_list_free(ready);
+	janus_mutex_unlock(&deferred_mutex);
+}
+
+/* Kicks the viewers of a mountpoint and schedules it for destruction: must be called with mountpoints_mutex held */
+static void janus_streaming_mountpoint_unmount(janus_streaming_mountpoint *mp) {
+	/* FIXME Should we kick the current viewers as well? */
+	janus_mutex_lock(&mp->mutex);
+	GList *viewer = g_list_first(mp->listeners);
+	/* Prepare JSON event */
+	json_t *event = json_object();
+	json_object_set_new(event, "streaming", json_string("event"));
+	json_t *result = json_object();
+	json_object_set_new(result, "status", json_string("stopped"));
+	json_object_set_new(event, "result", result);
+	while(viewer) {
+		janus_streaming_session *session = (janus_streaming_session *)viewer->data;
+		if(session != NULL) {
+			session->stopping = TRUE;
+			session->started = FALSE;
+			session->paused = FALSE;
+			session->mountpoint = NULL;
+			/* Tell the core to tear down the PeerConnection, hangup_media will do the rest */
+			gateway->push_event(session->handle, &janus_streaming_plugin, NULL, event, NULL);
+			gateway->close_pc(session->handle);
+		}
+		janus_streaming_listener_remove(mp, session);
+		viewer = g_list_first(mp->listeners);
+	}
+	json_decref(event);
+	janus_mutex_unlock(&mp->mutex);
+	/* Remove mountpoint from the hashtable: this will get it destroyed */
+	if(!mp->destroyed) {
+		mp->destroyed = janus_get_monotonic_time();
+		g_hash_table_remove(mountpoints, &mp->id);
+		/* Cleaning up and removing the mountpoint is done in a lazy way */
+		old_mountpoints = g_list_append(old_mountpoints, mp);
+	}
+}
+
+/* Gets rid of whatever a category of the configuration file created */
+static void janus_streaming_mountpoint_unload(const char *name) {
+	janus_mutex_lock(&mountpoints_mutex);
+	janus_streaming_deferred_mountpoint *dm = janus_streaming_deferred_find(0, name);
+	if(dm != NULL) {
+		deferred_mountpoints = g_list_remove(deferred_mountpoints, dm);
+		janus_streaming_deferred_free(dm);
+	}
+	janus_streaming_mountpoint *mp = NULL;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, mountpoints);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_streaming_mountpoint *m = value;
+		if(m->name && !strcasecmp(m->name, name)) {
+			mp = m;
+			break;
+		}
+	}
+	if(mp != NULL)
+		janus_streaming_mountpoint_unmount(mp);
+	janus_mutex_unlock(&mountpoints_mutex);
+}
+
+static gboolean janus_streaming_config_category_equal(janus_config_category *a, janus_config_category *b) {
+	if(g_list_length(a->items) != g_list_length(b->items))
+		return FALSE;
+	GList *la = a->items, *lb = b->items;
+	while(la && lb) {
+		janus_config_item *ia = (janus_config_item *)la->data, *ib = (janus_config_item *)lb->data;
+		if(g_strcmp0(ia->name, ib->name) || g_strcmp0(ia->value, ib->value))
+			return FALSE;
+		la = la->next;
+		lb = lb->next;
+	}
+	return TRUE;
+}
+
 /* Plugin implementation */
 int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 #ifdef HAVE_LIBCURL
@@ -720,6 +1552,9 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 
 	mountpoints = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
 
+	metric_mountpoints = janus_metrics_add_callback("janus_plugin_mountpoints", "plugin=\"" JANUS_STREAMING_PACKAGE "\"",
+		"Mountpoints currently available in the plugin", JANUS_METRIC_GAUGE, janus_streaming_metric_mountpoints, NULL);
+
 	/* Threads will expect this to be set */
 	g_atomic_int_set(&initialized, 1);
 
@@ -735,6 +1570,55 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 		if(!notify_events && callback->events_is_enabled()) {
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_STREAMING_NAME);
 		}
+		/* Should we act as an origin other instances can cascade our mountpoints from? */
+		janus_config_item *cport = janus_config_get_item_drilldown(config, "general", "cascade_port");
+		if(cport != NULL && cport->value != NULL && atoi(cport->value) > 0) {
+			cascade_port = atoi(cport->value);
+			/* Edges can be limited to an interface, and to a list of addresses */
+			janus_network_address cascade_iface;
+			janus_network_address_nullify(&cascade_iface);
+			janus_config_item *ciface = janus_config_get_item_drilldown(config, "general", "cascade_interface");
+			if(ciface != NULL && ciface->value != NULL &&
+					(ifas == NULL || janus_network_lookup_interface(ifas, ciface->value, &cascade_iface) != 0)) {
+				JANUS_LOG(LOG_ERR, "Invalid cascade_interface '%s', edges won't be able to subscribe\n", ciface->value);
+				cascade_port = 0;
+			} else {
+				cascade_fd = janus_streaming_create_fd(cascade_port, INADDR_ANY, &cascade_iface, "Cascade", "cascade", "origin");
+				if(cascade_fd < 0)
+					JANUS_LOG(LOG_ERR, "Can't bind to port %d for cascading, edges won't be able to subscribe\n", cascade_port);
+			}
+			janus_config_item *cacl = janus_config_get_item_drilldown(config, "general", "cascade_acl");
+			if(cascade_fd > -1 && cacl != NULL && cacl->value != NULL) {
+				gchar **list = g_strsplit(cacl->value, ",", -1);
+				int i = 0;
+				for(i=0; list[i] != NULL; i++) {
+					g_strstrip(list[i]);
+					if(strlen(list[i]) > 0) {
+						JANUS_LOG(LOG_INFO, "Adding '%s' to the cascade edges allowed list...\n", list[i]);
+						cascade_acl = g_list_append(cascade_acl, g_strdup(list[i]));
+					}
+				}
+				g_strfreev(list);
+			}
+			/* Secret for the cookies we give edges to check their address */
+			g_snprintf(cascade_secret, sizeof(cascade_secret), "%016"SCNx64"%016"SCNx64, janus_random_uint64(), janus_random_uint64());
+		}
+		janus_config_item *lazy = janus_config_get_item_drilldown(config, "general", "lazy_mountpoints");
+		if(lazy != NULL && lazy->value != NULL)
+			lazy_mountpoints = janus_is_true(lazy->value);
+		janus_config_item *csuite = janus_config_get_item_drilldown(config, "general", "cascade_srtpsuite");
+		janus_config_item *ccrypto = janus_config_get_item_drilldown(config, "general", "cascade_srtpcrypto");
+		if(cascade_fd > -1 && csuite != NULL && csuite->value != NULL && ccrypto != NULL && ccrypto->value != NULL) {
+			gsize len = 0;
+			guchar *decoded = g_base64_decode(ccrypto->value, &len);
+			g_free(decoded);
+			if((atoi(csuite->value) != 32 && atoi(csuite->value) != 80) || len < SRTP_MASTER_LENGTH) {
+				JANUS_LOG(LOG_ERR, "Invalid cascade SRTP suite or crypto, packets to edges won't be encrypted\n");
+			} else {
+				cascade_srtpsuite = atoi(csuite->value);
+				cascade_srtpcrypto = g_strdup(ccrypto->value);
+			}
+		}
 		/* Iterate on all mountpoints */
 		GList *cl = janus_config_get_categories(config);
 		while(cl != NULL) {
@@ -743,415 +1627,7 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				cl = cl->next;
 				continue;
 			}
-			JANUS_LOG(LOG_VERB, "Adding stream '%s'\n", cat->name);
-			janus_config_item *type = janus_config_get_item(cat, "type");
-			if(type == NULL || type->value == NULL) {
-				JANUS_LOG(LOG_WARN, "  -- Invalid type, skipping stream '%s'...\n", cat->name);
-				cl = cl->next;
-				continue;
-			}
-			// 输入为rtp类型
-			if(!strcasecmp(type->value, "rtp")) {
-				janus_network_address video_iface, audio_iface, data_iface;
-				/* RTP live source (e.g., from gstreamer/ffmpeg/vlc/etc.) */
-				janus_config_item *id = janus_config_get_item(cat, "id");
-				janus_config_item *desc = janus_config_get_item(cat, "description");
-				janus_config_item *priv = janus_config_get_item(cat, "is_private");
-				janus_config_item *secret = janus_config_get_item(cat, "secret");
-				janus_config_item *pin = janus_config_get_item(cat, "pin");
-				janus_config_item *audio = janus_config_get_item(cat, "audio");
-				janus_config_item *askew = janus_config_get_item(cat, "audioskew");
-				janus_config_item *video = janus_config_get_item(cat, "video");
-				janus_config_item *vskew = janus_config_get_item(cat, "videoskew");
-				janus_config_item *data = janus_config_get_item(cat, "data");
-				janus_config_item *diface = janus_config_get_item(cat, "dataiface");
-				janus_config_item *amcast = janus_config_get_item(cat, "audiomcast");
-				janus_config_item *aiface = janus_config_get_item(cat, "audioiface");
-				janus_config_item *aport = janus_config_get_item(cat, "audioport");
-				janus_config_item *acodec = janus_config_get_item(cat, "audiopt");
-				janus_config_item *artpmap = janus_config_get_item(cat, "audiortpmap");
-				janus_config_item *afmtp = janus_config_get_item(cat, "audiofmtp");
-				janus_config_item *vmcast = janus_config_get_item(cat, "videomcast");
-				janus_config_item *viface = janus_config_get_item(cat, "videoiface");
-				janus_config_item *vport = janus_config_get_item(cat, "videoport");
-				janus_config_item *vcodec = janus_config_get_item(cat, "videopt");
-				janus_config_item *vrtpmap = janus_config_get_item(cat, "videortpmap");
-				janus_config_item *vfmtp = janus_config_get_item(cat, "videofmtp");
-				janus_config_item *vkf = janus_config_get_item(cat, "videobufferkf");
-				janus_config_item *vsc = janus_config_get_item(cat, "videosimulcast");
-				janus_config_item *vport2 = janus_config_get_item(cat, "videoport2");
-				janus_config_item *vport3 = janus_config_get_item(cat, "videoport3");
-				janus_config_item *dport = janus_config_get_item(cat, "dataport");
-				janus_config_item *dbm = janus_config_get_item(cat, "databuffermsg");
-				janus_config_item *rtpcollision = janus_config_get_item(cat, "collision");
-				janus_config_item *ssuite = janus_config_get_item(cat, "srtpsuite");
-				janus_config_item *scrypto = janus_config_get_item(cat, "srtpcrypto");
-				gboolean is_private = priv && priv->value && janus_is_true(priv->value);
-				gboolean doaudio = audio && audio->value && janus_is_true(audio->value);
-				gboolean doaskew = audio && askew && askew->value && janus_is_true(askew->value);
-				gboolean dovideo = video && video->value && janus_is_true(video->value);
-				gboolean dovskew = video && vskew && vskew->value && janus_is_true(vskew->value);
-				gboolean dodata = data && data->value && janus_is_true(data->value);
-				gboolean bufferkf = video && vkf && vkf->value && janus_is_true(vkf->value);
-				gboolean simulcast = video && vsc && vsc->value && janus_is_true(vsc->value);
-				if(simulcast && bufferkf) {
-					/* FIXME We'll need to take care of this */
-					JANUS_LOG(LOG_WARN, "Simulcasting enabled, so disabling buffering of keyframes\n");
-					bufferkf = FALSE;
-				}
-				gboolean buffermsg = data && dbm && dbm->value && janus_is_true(dbm->value);
-				if(!doaudio && !dovideo && !dodata) {
-					JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', no audio, video or data have to be streamed...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				if(doaudio &&
-						(aport == NULL || aport->value == NULL || atoi(aport->value) == 0 ||
-						acodec == NULL || acodec->value == NULL ||
-						artpmap == NULL || artpmap->value == NULL)) {
-					JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', missing mandatory information for audio...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				if(doaudio && aiface) {
-					if(!ifas) {
-						JANUS_LOG(LOG_ERR, "Skipping 'rtp' stream '%s', it relies on network configuration but network device information is unavailable...\n", cat->name);
-						cl = cl->next;
-						continue;
-					}
-					if(janus_network_lookup_interface(ifas, aiface->value, &audio_iface) != 0) {
-						JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', invalid network interface configuration for audio...\n", cat->name);
-						cl = cl->next;
-						continue;
-					}
-				}
-				if(dovideo &&
-						(vport == NULL || vport->value == NULL || atoi(vport->value) == 0 ||
-						vcodec == NULL || vcodec->value == NULL ||
-						vrtpmap == NULL || vrtpmap->value == NULL)) {
-					JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', missing mandatory information for video...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				if(dodata && (dport == NULL || dport->value == NULL || atoi(dport->value) == 0)) {
-					JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', missing mandatory information for data...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-#ifndef HAVE_SCTP
-				if(dodata) {
-					JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s': no datachannels support......\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-#endif
-				if(dodata && diface) {
-					if(!ifas) {
-						JANUS_LOG(LOG_ERR, "Skipping 'rtp' stream '%s', it relies on network configuration but network device information is unavailable...\n", cat->name);
-						cl = cl->next;
-						continue;
-					}
-					if(janus_network_lookup_interface(ifas, diface->value, &data_iface) != 0) {
-						JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', invalid network interface configuration for data...\n", cat->name);
-						cl = cl->next;
-						continue;
-					}
-				}
-				if(dovideo && viface) {
-					if(!ifas) {
-						JANUS_LOG(LOG_ERR, "Skipping 'rtp' stream '%s', it relies on network configuration but network device information is unavailable...\n", cat->name);
-						cl = cl->next;
-						continue;
-					}
-					if(janus_network_lookup_interface(ifas, viface->value, &video_iface) != 0) {
-						JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', invalid network interface configuration for video...\n", cat->name);
-						cl = cl->next;
-						continue;
-					}
-				}
-				if(ssuite && ssuite->value && atoi(ssuite->value) != 32 && atoi(ssuite->value) != 80) {
-					JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream '%s', invalid SRTP suite...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				if(id == NULL || id->value == NULL) {
-					JANUS_LOG(LOG_VERB, "Missing id for stream '%s', will generate a random one...\n", cat->name);
-				} else {
-					janus_mutex_lock(&mountpoints_mutex);
-					guint64 mpid = g_ascii_strtoull(id->value, 0, 10);
-					janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &mpid);
-					janus_mutex_unlock(&mountpoints_mutex);
-					if(mp != NULL) {
-						JANUS_LOG(LOG_ERR, "A stream with the provided ID %s already exists, skipping '%s'\n", id->value, cat->name);
-						cl = cl->next;
-						continue;
-					}
-				}
-				JANUS_LOG(LOG_VERB, "Audio %s, Video %s, Data %s\n",
-					doaudio ? "enabled" : "NOT enabled",
-					dovideo ? "enabled" : "NOT enabled",
-					dodata ? "enabled" : "NOT enabled");
-				janus_streaming_mountpoint *mp = NULL;
-				if((mp = janus_streaming_create_rtp_source(
-						(id && id->value) ? g_ascii_strtoull(id->value, 0, 10) : 0,
-						(char *)cat->name,
-						desc ? (char *)desc->value : NULL,
-						ssuite && ssuite->value ? atoi(ssuite->value) : 0,
-						scrypto && scrypto->value ? (char *)scrypto->value : NULL,
-						doaudio,
-						amcast ? (char *)amcast->value : NULL,
-						doaudio && aiface && aiface->value ? &audio_iface : NULL,
-						(aport && aport->value) ? atoi(aport->value) : 0,
-						(acodec && acodec->value) ? atoi(acodec->value) : 0,
-						artpmap ? (char *)artpmap->value : NULL,
-						afmtp ? (char *)afmtp->value : NULL,
-						doaskew,
-						dovideo,
-						vmcast ? (char *)vmcast->value : NULL,
-						dovideo && viface && viface->value ? &video_iface : NULL,
-						(vport && vport->value) ? atoi(vport->value) : 0,
-						(vcodec && vcodec->value) ? atoi(vcodec->value) : 0,
-						vrtpmap ? (char *)vrtpmap->value : NULL,
-						vfmtp ? (char *)vfmtp->value : NULL,
-						bufferkf,
-						simulcast,
-						(vport2 && vport2->value) ? atoi(vport2->value) : 0,
-						(vport3 && vport3->value) ? atoi(vport3->value) : 0,
-						dovskew,
-						(rtpcollision && rtpcollision->value) ?  atoi(rtpcollision->value) : 0,
-						dodata,
-						dodata && diface && diface->value ? &data_iface : NULL,
-						(dport && dport->value) ? atoi(dport->value) : 0,
-						buffermsg)) == NULL) {
-					JANUS_LOG(LOG_ERR, "Error creating 'rtp' stream '%s'...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				mp->is_private = is_private;
-				if(secret && secret->value)
-					mp->secret = g_strdup(secret->value);
-				if(pin && pin->value)
-					mp->pin = g_strdup(pin->value);
-			} else if(!strcasecmp(type->value, "live")) {
-				/* File live source */
-				janus_config_item *id = janus_config_get_item(cat, "id");
-				janus_config_item *desc = janus_config_get_item(cat, "description");
-				janus_config_item *priv = janus_config_get_item(cat, "is_private");
-				janus_config_item *secret = janus_config_get_item(cat, "secret");
-				janus_config_item *pin = janus_config_get_item(cat, "pin");
-				janus_config_item *file = janus_config_get_item(cat, "filename");
-				janus_config_item *audio = janus_config_get_item(cat, "audio");
-				janus_config_item *video = janus_config_get_item(cat, "video");
-				if(file == NULL || file->value == NULL) {
-					JANUS_LOG(LOG_ERR, "Can't add 'live' stream '%s', missing mandatory information...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				gboolean is_private = priv && priv->value && janus_is_true(priv->value);
-				gboolean doaudio = audio && audio->value && janus_is_true(audio->value);
-				gboolean dovideo = video && video->value && janus_is_true(video->value);
-				/* TODO We should support something more than raw a-Law and mu-Law streams... */
-				if(!doaudio || dovideo) {
-					JANUS_LOG(LOG_ERR, "Can't add 'live' stream '%s', we only support audio file streaming right now...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				if(!strstr(file->value, ".alaw") && !strstr(file->value, ".mulaw")) {
-					JANUS_LOG(LOG_ERR, "Can't add 'live' stream '%s', unsupported format (we only support raw mu-Law and a-Law files right now)\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				FILE *audiofile = fopen(file->value, "rb");
-				if(!audiofile) {
-					JANUS_LOG(LOG_ERR, "Can't add 'live' stream, no such file '%s'...\n", file->value);
-					cl = cl->next;
-					continue;
-				}
-				fclose(audiofile);
-				if(id == NULL || id->value == NULL) {
-					JANUS_LOG(LOG_VERB, "Missing id for stream '%s', will generate a random one...\n", cat->name);
-				} else {
-					janus_mutex_lock(&mountpoints_mutex);
-					guint64 mpid = g_ascii_strtoull(id->value, 0, 10);
-					janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &mpid);
-					janus_mutex_unlock(&mountpoints_mutex);
-					if(mp != NULL) {
-						JANUS_LOG(LOG_ERR, "A stream with the provided ID %s already exists, skipping '%s'\n", id->value, cat->name);
-						cl = cl->next;
-						continue;
-					}
-				}
-				janus_streaming_mountpoint *mp = NULL;
-				if((mp = janus_streaming_create_file_source(
-						(id && id->value) ? g_ascii_strtoull(id->value, 0, 10) : 0,
-						(char *)cat->name,
-						desc ? (char *)desc->value : NULL,
-						(char *)file->value,
-						TRUE, doaudio, dovideo)) == NULL) {
-					JANUS_LOG(LOG_ERR, "Error creating 'live' stream '%s'...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				mp->is_private = is_private;
-				if(secret && secret->value)
-					mp->secret = g_strdup(secret->value);
-				if(pin && pin->value)
-					mp->pin = g_strdup(pin->value);
-			} else if(!strcasecmp(type->value, "ondemand")) {
-				/* mu-Law file on demand source */
-				janus_config_item *id = janus_config_get_item(cat, "id");
-				janus_config_item *desc = janus_config_get_item(cat, "description");
-				janus_config_item *priv = janus_config_get_item(cat, "is_private");
-				janus_config_item *secret = janus_config_get_item(cat, "secret");
-				janus_config_item *pin = janus_config_get_item(cat, "pin");
-				janus_config_item *file = janus_config_get_item(cat, "filename");
-				janus_config_item *audio = janus_config_get_item(cat, "audio");
-				janus_config_item *video = janus_config_get_item(cat, "video");
-				if(file == NULL || file->value == NULL) {
-					JANUS_LOG(LOG_ERR, "Can't add 'ondemand' stream '%s', missing mandatory information...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				gboolean is_private = priv && priv->value && janus_is_true(priv->value);
-				gboolean doaudio = audio && audio->value && janus_is_true(audio->value);
-				gboolean dovideo = video && video->value && janus_is_true(video->value);
-				/* TODO We should support something more than raw a-Law and mu-Law streams... */
-				if(!doaudio || dovideo) {
-					JANUS_LOG(LOG_ERR, "Can't add 'ondemand' stream '%s', we only support audio file streaming right now...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				if(!strstr(file->value, ".alaw") && !strstr(file->value, ".mulaw")) {
-					JANUS_LOG(LOG_ERR, "Can't add 'ondemand' stream '%s', unsupported format (we only support raw mu-Law and a-Law files right now)\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				FILE *audiofile = fopen(file->value, "rb");
-				if(!audiofile) {
-					JANUS_LOG(LOG_ERR, "Can't add 'ondemand' stream, no such file '%s'...\n", file->value);
-					cl = cl->next;
-					continue;
-				}
-				fclose(audiofile);
-				if(id == NULL || id->value == NULL) {
-					JANUS_LOG(LOG_VERB, "Missing id for stream '%s', will generate a random one...\n", cat->name);
-				} else {
-					janus_mutex_lock(&mountpoints_mutex);
-					guint64 mpid = g_ascii_strtoull(id->value, 0, 10);
-					janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &mpid);
-					janus_mutex_unlock(&mountpoints_mutex);
-					if(mp != NULL) {
-						JANUS_LOG(LOG_ERR, "A stream with the provided ID %s already exists, skipping '%s'\n", id->value, cat->name);
-						cl = cl->next;
-						continue;
-					}
-				}
-				janus_streaming_mountpoint *mp = NULL;
-				if((mp = janus_streaming_create_file_source(
-						(id && id->value) ? g_ascii_strtoull(id->value, 0, 10) : 0,
-						(char *)cat->name,
-						desc ? (char *)desc->value : NULL,
-						(char *)file->value,
-						FALSE, doaudio, dovideo)) == NULL) {
-					JANUS_LOG(LOG_ERR, "Error creating 'ondemand' stream '%s'...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				mp->is_private = is_private;
-				if(secret && secret->value)
-					mp->secret = g_strdup(secret->value);
-				if(pin && pin->value)
-					mp->pin = g_strdup(pin->value);
-			} else if(!strcasecmp(type->value, "rtsp")) {
-#ifndef HAVE_LIBCURL
-				JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream '%s', libcurl support not compiled...\n", cat->name);
-				cl = cl->next;
-				continue;
-#else
-				janus_config_item *id = janus_config_get_item(cat, "id");
-				janus_config_item *desc = janus_config_get_item(cat, "description");
-				janus_config_item *priv = janus_config_get_item(cat, "is_private");
-				janus_config_item *secret = janus_config_get_item(cat, "secret");
-				janus_config_item *pin = janus_config_get_item(cat, "pin");
-				janus_config_item *file = janus_config_get_item(cat, "url");
-				janus_config_item *username = janus_config_get_item(cat, "rtsp_user");
-				janus_config_item *password = janus_config_get_item(cat, "rtsp_pwd");
-				janus_config_item *audio = janus_config_get_item(cat, "audio");
-				janus_config_item *artpmap = janus_config_get_item(cat, "audiortpmap");
-				janus_config_item *afmtp = janus_config_get_item(cat, "audiofmtp");
-				janus_config_item *video = janus_config_get_item(cat, "video");
-				janus_config_item *vrtpmap = janus_config_get_item(cat, "videortpmap");
-				janus_config_item *vfmtp = janus_config_get_item(cat, "videofmtp");
-				janus_config_item *iface = janus_config_get_item(cat, "rtspiface");
-				janus_config_item *failerr = janus_config_get_item(cat, "rtsp_failcheck");
-				janus_network_address iface_value;
-				if(file == NULL || file->value == NULL) {
-					JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream '%s', missing mandatory information...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				gboolean is_private = priv && priv->value && janus_is_true(priv->value);
-				gboolean doaudio = audio && audio->value && janus_is_true(audio->value);
-				gboolean dovideo = video && video->value && janus_is_true(video->value);
-				gboolean error_on_failure = TRUE;
-				if(failerr && failerr->value)
-					error_on_failure = janus_is_true(failerr->value);
-
-				if((doaudio || dovideo) && iface && iface->value) {
-					if(!ifas) {
-						JANUS_LOG(LOG_ERR, "Skipping 'rtsp' stream '%s', it relies on network configuration but network device information is unavailable...\n", cat->name);
-						cl = cl->next;
-						continue;
-					}
-					if(janus_network_lookup_interface(ifas, iface->value, &iface_value) != 0) {
-						JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream '%s', invalid network interface configuration for stream...\n", cat->name);
-						cl = cl->next;
-						continue;
-					}
-				}
-
-				if(id == NULL || id->value == NULL) {
-					JANUS_LOG(LOG_VERB, "Missing id for stream '%s', will generate a random one...\n", cat->name);
-				} else {
-					janus_mutex_lock(&mountpoints_mutex);
-					guint64 mpid = g_ascii_strtoull(id->value, 0, 10);
-					janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &mpid);
-					janus_mutex_unlock(&mountpoints_mutex);
-					if(mp != NULL) {
-						JANUS_LOG(LOG_ERR, "A stream with the provided ID %s already exists, skipping '%s'\n", id->value, cat->name);
-						cl = cl->next;
-						continue;
-					}
-				}
-				janus_streaming_mountpoint *mp = NULL;
-				if((mp = janus_streaming_create_rtsp_source(
-						(id && id->value) ? g_ascii_strtoull(id->value, 0, 10) : 0,
-						(char *)cat->name,
-						desc ? (char *)desc->value : NULL,
-						(char *)file->value,
-						username ? (char *)username->value : NULL,
-						password ? (char *)password->value : NULL,
-						doaudio,
-						artpmap ? (char *)artpmap->value : NULL,
-						afmtp ? (char *)afmtp->value : NULL,
-						dovideo,
-						vrtpmap ? (char *)vrtpmap->value : NULL,
-						vfmtp ? (char *)vfmtp->value : NULL,
-						iface && iface->value ? &iface_value : NULL,
-						error_on_failure)) == NULL) {
-					JANUS_LOG(LOG_ERR, "Error creating 'rtsp' stream '%s'...\n", cat->name);
-					cl = cl->next;
-					continue;
-				}
-				mp->is_private = is_private;
-				if(secret && secret->value)
-					mp->secret = g_strdup(secret->value);
-				if(pin && pin->value)
-					mp->pin = g_strdup(pin->value);
-#endif
-			} else {
-				JANUS_LOG(LOG_WARN, "Ignoring unknown stream type '%s' (%s)...\n", type->value, cat->name);
-			}
+			janus_streaming_mountpoint_load(cat, ifas, FALSE);
 			cl = cl->next;
 		}
 		/* Done: we keep the configuration file open in case we get a "create" or "destroy" with permanent=true */
@@ -1176,7 +1652,14 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 	janus_mutex_unlock(&mountpoints_mutex);
 
 	sessions = g_hash_table_new(NULL, NULL);
-	messages = g_async_queue_new_full((GDestroyNotify) janus_streaming_message_free);
+	guint handler_threads_num = 1;
+	if(config != NULL) {
+		janus_config_item *threads = janus_config_get_item_drilldown(config, "general", "handler_threads");
+		if(threads != NULL && threads->value != NULL)
+			handler_threads_num = janus_handler_pool_size(threads->value);
+	}
+	/* Messages are handled by a pool of threads (handler_threads in the [general] section, default=1) */
+	handlers = janus_handler_pool_create(handler_threads_num, (GDestroyNotify) janus_streaming_message_free);
 	/* This is the callback we'll need to invoke to contact the gateway */
 	gateway = callback;
 
@@ -1189,9 +1672,22 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_destroy(config);
 		return -1;
 	}
-	/* Launch the thread that will handle incoming messages */
-	handler_thread = g_thread_try_new("streaming handler", janus_streaming_handler, NULL, &error);
-	if(error != NULL) {
+	if(cascade_fd > -1) {
+		/* Start the thread handling requests from edges */
+		cascade_thread = g_thread_try_new("streaming cascade", &janus_streaming_cascade_thread, NULL, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Streaming cascade thread...\n", error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			error = NULL;
+			close(cascade_fd);
+			cascade_fd = -1;
+		} else {
+			JANUS_LOG(LOG_INFO, "Edges can cascade our mountpoints via port %d%s\n",
+				cascade_port, cascade_srtpsuite > 0 ? " (SRTP)" : "");
+		}
+	}
+	/* Launch the threads that will handle incoming messages */
+	if(janus_handler_pool_start(handlers, "streaming", janus_streaming_handler, &error) < 0) {
 		g_atomic_int_set(&initialized, 0);
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Streaming handler thread...\n", error->code, error->message ? error->message : "??");
 		janus_config_destroy(config);
@@ -1205,13 +1701,22 @@ void janus_streaming_destroy(void) {
 	if(!g_atomic_int_get(&initialized))
 		return;
 	g_atomic_int_set(&stopping, 1);
+	janus_metrics_remove(metric_mountpoints);
+	metric_mountpoints = NULL;
 
-	g_async_queue_push(messages, &exit_message);
-
-	if(handler_thread != NULL) {
-		g_thread_join(handler_thread);
-		handler_thread = NULL;
+	janus_handler_pool_stop(handlers, &exit_message);
+	if(cascade_thread != NULL) {
+		g_thread_join(cascade_thread);
+		cascade_thread = NULL;
 	}
+	if(cascade_fd > -1)
+		close(cascade_fd);
+	cascade_fd = -1;
+	g_free(cascade_srtpcrypto);
+	cascade_srtpcrypto = NULL;
+	cascade_srtpsuite = 0;
+	g_list_free_full(cascade_acl, (GDestroyNotify)g_free);
+	cascade_acl = NULL;
 
 	/* Remove all mountpoints */
 	janus_mutex_lock(&mountpoints_mutex);
@@ -1225,6 +1730,8 @@ void janus_streaming_destroy(void) {
 			old_mountpoints = g_list_append(old_mountpoints, mp);
 		}
 	}
+	g_list_free_full(deferred_mountpoints, (GDestroyNotify)janus_streaming_deferred_free);
+	deferred_mountpoints = NULL;
 	janus_mutex_unlock(&mountpoints_mutex);
 	if(watchdog != NULL) {
 		g_thread_join(watchdog);
@@ -1239,8 +1746,8 @@ void janus_streaming_destroy(void) {
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
 	janus_mutex_unlock(&sessions_mutex);
-	g_async_queue_unref(messages);
-	messages = NULL;
+	janus_handler_pool_destroy(handlers);
+	handlers = NULL;
 	sessions = NULL;
 
 	janus_config_destroy(config);
@@ -1326,7 +1833,7 @@ void janus_streaming_destroy_session(janus_plugin_session *handle, int *error) {
 		janus_streaming_mountpoint *mp = session->mountpoint;
 		if(mp) {
 			janus_mutex_lock(&mp->mutex);
-			mp->listeners = g_list_remove_all(mp->listeners, session);
+			janus_streaming_listener_remove(mp, session);
 			janus_mutex_unlock(&mp->mutex);
 		}
 		janus_streaming_hangup_media_internal(handle);
@@ -1443,6 +1950,25 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 			}
 			json_array_append_new(list, ml);
 		}
+		/* Lazy mountpoints are listed too, even though they don't exist yet */
+		GList *dl = deferred_mountpoints;
+		while(dl) {
+			janus_streaming_deferred_mountpoint *dm = (janus_streaming_deferred_mountpoint *)dl->data;
+			dl = dl->next;
+			if(dm->id == 0)
+				continue;
+			janus_config_item *priv = janus_config_get_item_drilldown(dm->config, dm->name, "is_private");
+			if(priv && priv->value && janus_is_true(priv->value))
+				continue;
+			janus_config_item *desc = janus_config_get_item_drilldown(dm->config, dm->name, "description");
+			janus_config_item *type = janus_config_get_item_drilldown(dm->config, dm->name, "type");
+			json_t *ml = json_object();
+			json_object_set_new(ml, "id", json_integer(dm->id));
+			json_object_set_new(ml, "description", json_string(desc && desc->value ? desc->value : dm->name));
+			json_object_set_new(ml, "type", json_string(type && type->value && !strcasecmp(type->value, "ondemand") ? "on demand" : "live"));
+			json_object_set_new(ml, "lazy", json_true());
+			json_array_append_new(list, ml);
+		}
 		janus_mutex_unlock(&mountpoints_mutex);
 		/* Send info back */
 		response = json_object();
@@ -1462,6 +1988,22 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 		janus_mutex_lock(&mountpoints_mutex);
 		janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &id_value);
 		if(mp == NULL) {
+			/* An info request doesn't activate a lazy mountpoint, we only say it's there */
+			janus_streaming_deferred_mountpoint *dm = janus_streaming_deferred_find(id_value, NULL);
+			if(dm != NULL && dm->lazy) {
+				janus_config_item *desc = janus_config_get_item_drilldown(dm->config, dm->name, "description");
+				janus_config_item *type = janus_config_get_item_drilldown(dm->config, dm->name, "type");
+				json_t *ml = json_object();
+				json_object_set_new(ml, "id", json_integer(dm->id));
+				json_object_set_new(ml, "description", json_string(desc && desc->value ? desc->value : dm->name));
+				json_object_set_new(ml, "type", json_string(type && type->value && !strcasecmp(type->value, "ondemand") ? "on demand" : "live"));
+				json_object_set_new(ml, "lazy", json_true());
+				janus_mutex_unlock(&mountpoints_mutex);
+				response = json_object();
+				json_object_set_new(response, "streaming", json_string("info"));
+				json_object_set_new(response, "info", ml);
+				goto plugin_response;
+			}
 			janus_mutex_unlock(&mountpoints_mutex);
 			JANUS_LOG(LOG_VERB, "No such mountpoint/stream %"SCNu64"\n", id_value);
 			error_code = JANUS_STREAMING_ERROR_NO_SUCH_MOUNTPOINT;
@@ -1529,7 +2071,10 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 						json_object_set_new(ml, "rtsp_user", json_string(source->rtsp_username));
 					if(source->rtsp_password)
 						json_object_set_new(ml, "rtsp_pwd", json_string(source->rtsp_password));
+					if(source->reconnect_attempts > 0)
+						json_object_set_new(ml, "rtsp_reconnect_attempts", json_integer(source->reconnect_attempts));
 				}
+				json_object_set_new(ml, "rtsp_transport", json_string(source->rtsp_tcp ? "tcp" : "udp"));
 			}
 #endif
 			if(source->keyframe.enabled) {
@@ -1537,6 +2082,8 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 			}
 			if(source->simulcast) {
 				json_object_set_new(ml, "videosimulcast", json_true());
+				if(source->simulcast_auto)
+					json_object_set_new(ml, "videoautosimulcast", json_true());
 			}
 			if(source->askew)
 				json_object_set_new(ml, "audioskew", json_true());
@@ -1544,6 +2091,8 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				json_object_set_new(ml, "videoskew", json_true());
 			if(source->rtp_collision > 0)
 				json_object_set_new(ml, "collision", json_integer(source->rtp_collision));
+			if(mp->helper_threads > 0)
+				json_object_set_new(ml, "threads", json_integer(mp->helper_threads));
 			if(admin) {
 				if(mp->audio)
 					json_object_set_new(ml, "audioport", json_integer(source->audio_port));
@@ -1556,12 +2105,22 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				}
 				if(mp->data)
 					json_object_set_new(ml, "dataport", json_integer(source->data_port));
+				if(source->cascade_origin) {
+					json_object_set_new(ml, "cascade", json_string(source->cascade_origin));
+					json_object_set_new(ml, "cascade_id", json_integer(source->cascade_id));
+					json_object_set_new(ml, "cascade_subscribed", source->cascade_ok ? json_true() : json_false());
+				}
+				janus_mutex_lock(&mp->mutex);
+				if(mp->edges)
+					json_object_set_new(ml, "cascade_edges", json_integer(g_list_length(mp->edges)));
+				janus_mutex_unlock(&mp->mutex);
 			}
-			if(source->audio_fd != -1)
+			gboolean cascaded = (source->cascade_fd != -1);
+			if(source->audio_fd != -1 || (cascaded && mp->audio))
 				json_object_set_new(ml, "audio_age_ms", json_integer((now - source->last_received_audio) / 1000));
-			if(source->video_fd[0] != -1 || source->video_fd[1] != -1 || source->video_fd[2] != -1)
+			if(source->video_fd[0] != -1 || source->video_fd[1] != -1 || source->video_fd[2] != -1 || (cascaded && mp->video))
 				json_object_set_new(ml, "video_age_ms", json_integer((now - source->last_received_video) / 1000));
-			if(source->data_fd != -1)
+			if(source->data_fd != -1 || (cascaded && mp->data))
 				json_object_set_new(ml, "data_age_ms", json_integer((now - source->last_received_data) / 1000));
 			janus_mutex_lock(&source->rec_mutex);
 			if(admin && (source->arc || source->vrc || source->drc)) {
@@ -1635,8 +2194,12 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 			json_t *video = json_object_get(root, "video");
 			json_t *data = json_object_get(root, "data");
 			json_t *rtpcollision = json_object_get(root, "collision");
+			json_t *threads = json_object_get(root, "threads");
 			json_t *ssuite = json_object_get(root, "srtpsuite");
 			json_t *scrypto = json_object_get(root, "srtpcrypto");
+			json_t *cascade = json_object_get(root, "cascade");
+			json_t *cascade_id = json_object_get(root, "cascade_id");
+			json_t *cascade_pin = json_object_get(root, "cascade_pin");
 			gboolean doaudio = audio ? json_is_true(audio) : FALSE;
 			gboolean dovideo = video ? json_is_true(video) : FALSE;
 			gboolean dodata = data ? json_is_true(data) : FALSE;
@@ -1653,6 +2216,28 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				g_snprintf(error_cause, 512, "Can't add 'rtp' stream, invalid SRTP suite...");
 				goto plugin_response;
 			}
+			if(cascade && !cascade_id) {
+				JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream, missing the ID of the mountpoint to cascade...\n");
+				error_code = JANUS_STREAMING_ERROR_MISSING_ELEMENT;
+				g_snprintf(error_cause, 512, "Missing mandatory element (cascade_id)");
+				goto plugin_response;
+			}
+			/* Cascaded mountpoints get everything from the origin, so they don't need any port */
+			const char *missing_port = NULL;
+			if(!cascade) {
+				if(doaudio && !json_object_get(root, "audioport"))
+					missing_port = "audioport";
+				else if(dovideo && !json_object_get(root, "videoport"))
+					missing_port = "videoport";
+				else if(dodata && !json_object_get(root, "dataport"))
+					missing_port = "dataport";
+			}
+			if(missing_port != NULL) {
+				JANUS_LOG(LOG_ERR, "Missing mandatory element (%s)\n", missing_port);
+				error_code = JANUS_STREAMING_ERROR_MISSING_ELEMENT;
+				g_snprintf(error_cause, 512, "Missing mandatory element (%s)", missing_port);
+				goto plugin_response;
+			}
 			uint16_t aport = 0;
 			uint8_t acodec = 0;
 			char *artpmap = NULL, *afmtp = NULL, *amcast = NULL;
@@ -1690,7 +2275,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 			uint16_t vport = 0, vport2 = 0, vport3 = 0;
 			uint8_t vcodec = 0;
 			char *vrtpmap = NULL, *vfmtp = NULL, *vmcast = NULL;
-			gboolean bufferkf = FALSE, simulcast = FALSE;
+			gboolean bufferkf = FALSE, simulcast = FALSE, simulcast_auto = FALSE;
 			if(dovideo) {
 				JANUS_VALIDATE_JSON_OBJECT(root, rtp_video_parameters,
 					error_code, error_cause, TRUE,
@@ -1711,11 +2296,8 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				bufferkf = vkf ? json_is_true(vkf) : FALSE;
 				json_t *vsc = json_object_get(root, "videosimulcast");
 				simulcast = vsc ? json_is_true(vsc) : FALSE;
-				if(simulcast && bufferkf) {
-					/* FIXME We'll need to take care of this */
-					JANUS_LOG(LOG_WARN, "Simulcasting enabled, so disabling buffering of keyframes\n");
-					bufferkf = FALSE;
-				}
+				json_t *vasc = json_object_get(root, "videoautosimulcast");
+				simulcast_auto = simulcast && vasc ? json_is_true(vasc) : FALSE;
 				json_t *videoport2 = json_object_get(root, "videoport2");
 				vport2 = json_integer_value(videoport2);
 				json_t *videoport3 = json_object_get(root, "videoport3");
@@ -1773,8 +2355,9 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				janus_mutex_lock(&mountpoints_mutex);
 				guint64 mpid = json_integer_value(id);
 				mp = g_hash_table_lookup(mountpoints, &mpid);
+				gboolean deferred = janus_streaming_deferred_find(mpid, NULL) != NULL;
 				janus_mutex_unlock(&mountpoints_mutex);
-				if(mp != NULL) {
+				if(mp != NULL || deferred) {
 					JANUS_LOG(LOG_ERR, "A stream with the provided ID already exists\n");
 					error_code = JANUS_STREAMING_ERROR_CANT_CREATE;
 					g_snprintf(error_cause, 512, "A stream with the provided ID already exists");
@@ -1792,7 +2375,11 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 					dovideo, vmcast, &video_iface, vport, vcodec, vrtpmap, vfmtp, bufferkf,
 					simulcast, vport2, vport3, dovskew,
 					rtpcollision ? json_integer_value(rtpcollision) : 0,
-					dodata, &data_iface, dport, buffermsg);
+					dodata, &data_iface, dport, buffermsg,
+					threads ? json_integer_value(threads) : 0,
+					cascade ? (char *)json_string_value(cascade) : NULL,
+					cascade_id ? json_integer_value(cascade_id) : 0,
+					cascade_pin ? (char *)json_string_value(cascade_pin) : NULL);
 			if(mp == NULL) {
 				JANUS_LOG(LOG_ERR, "Error creating 'rtp' stream...\n");
 				error_code = JANUS_STREAMING_ERROR_CANT_CREATE;
@@ -1800,6 +2387,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				goto plugin_response;
 			}
 			mp->is_private = is_private ? json_is_true(is_private) : FALSE;
+			((janus_streaming_rtp_source *)mp->source)->simulcast_auto = simulcast_auto;
 		} else if(!strcasecmp(type_text, "live")) {
 			/* File live source */
 			JANUS_VALIDATE_JSON_OBJECT(root, live_parameters,
@@ -1844,8 +2432,9 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				janus_mutex_lock(&mountpoints_mutex);
 				guint64 mpid = json_integer_value(id);
 				mp = g_hash_table_lookup(mountpoints, &mpid);
+				gboolean deferred = janus_streaming_deferred_find(mpid, NULL) != NULL;
 				janus_mutex_unlock(&mountpoints_mutex);
-				if(mp != NULL) {
+				if(mp != NULL || deferred) {
 					JANUS_LOG(LOG_ERR, "A stream with the provided ID already exists\n");
 					error_code = JANUS_STREAMING_ERROR_CANT_CREATE;
 					g_snprintf(error_cause, 512, "A stream with the provided ID already exists");
@@ -1909,8 +2498,9 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				janus_mutex_lock(&mountpoints_mutex);
 				guint64 mpid = json_integer_value(id);
 				mp = g_hash_table_lookup(mountpoints, &mpid);
+				gboolean deferred = janus_streaming_deferred_find(mpid, NULL) != NULL;
 				janus_mutex_unlock(&mountpoints_mutex);
-				if(mp != NULL) {
+				if(mp != NULL || deferred) {
 					JANUS_LOG(LOG_ERR, "A stream with the provided ID already exists\n");
 					error_code = JANUS_STREAMING_ERROR_CANT_CREATE;
 					g_snprintf(error_cause, 512, "A stream with the provided ID already exists");
@@ -1959,9 +2549,19 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 			json_t *password = json_object_get(root, "rtsp_pwd");
 			json_t *iface = json_object_get(root, "rtspiface");
 			json_t *failerr = json_object_get(root, "rtsp_check");
+			json_t *transport = json_object_get(root, "rtsp_transport");
+			json_t *vkf = json_object_get(root, "videobufferkf");
 			gboolean doaudio = audio ? json_is_true(audio) : FALSE;
 			gboolean dovideo = video ? json_is_true(video) : FALSE;
 			gboolean error_on_failure = failerr ? json_is_true(failerr) : TRUE;
+			gboolean bufferkf = dovideo && vkf && json_is_true(vkf);
+			const char *transport_text = transport ? json_string_value(transport) : "udp";
+			if(strcasecmp(transport_text, "udp") && strcasecmp(transport_text, "tcp")) {
+				JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream, invalid transport '%s'...\n", transport_text);
+				error_code = JANUS_STREAMING_ERROR_INVALID_ELEMENT;
+				g_snprintf(error_cause, 512, "Invalid RTSP transport '%s' (should be udp or tcp)", transport_text);
+				goto plugin_response;
+			}
 			if(!doaudio && !dovideo) {
 				JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream, no audio or video have to be streamed...\n");
 				error_code = JANUS_STREAMING_ERROR_CANT_CREATE;
@@ -1989,7 +2589,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 					password ? (char *)json_string_value(password) : NULL,
 					doaudio, (char *)json_string_value(audiortpmap), (char *)json_string_value(audiofmtp),
 					dovideo, (char *)json_string_value(videortpmap), (char *)json_string_value(videofmtp),
-					&multicast_iface,
+					&multicast_iface, !strcasecmp(transport_text, "tcp"), bufferkf,
 					error_on_failure);
 			if(mp == NULL) {
 				JANUS_LOG(LOG_ERR, "Error creating 'rtsp' stream...\n");
@@ -2063,6 +2663,8 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 						janus_config_add_item(config, mp->name, "videobufferkf", "yes");
 					if(source->simulcast) {
 						janus_config_add_item(config, mp->name, "videosimulcast", "yes");
+						if(source->simulcast_auto)
+							janus_config_add_item(config, mp->name, "videoautosimulcast", "yes");
 						if(source->video_port[1]) {
 							g_snprintf(value, BUFSIZ, "%d", source->video_port[1]);
 							janus_config_add_item(config, mp->name, "videoport2", value);
@@ -2082,6 +2684,17 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 					g_snprintf(value, BUFSIZ, "%d", source->rtp_collision);
 					janus_config_add_item(config, mp->name, "collision", value);
 				}
+				if(mp->helper_threads > 0) {
+					g_snprintf(value, BUFSIZ, "%d", mp->helper_threads);
+					janus_config_add_item(config, mp->name, "threads", value);
+				}
+				if(source->cascade_origin != NULL) {
+					janus_config_add_item(config, mp->name, "cascade", source->cascade_origin);
+					g_snprintf(value, BUFSIZ, "%"SCNu64, source->cascade_id);
+					janus_config_add_item(config, mp->name, "cascade_id", value);
+					if(source->cascade_pin)
+						janus_config_add_item(config, mp->name, "cascade_pin", source->cascade_pin);
+				}
 				janus_config_add_item(config, mp->name, "data", mp->data ? "yes" : "no");
 				if(source->data_port > -1) {
 					g_snprintf(value, BUFSIZ, "%d", source->data_port);
@@ -2106,6 +2719,10 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 					janus_config_add_item(config, mp->name, "rtsp_user", source->rtsp_username);
 				if(source->rtsp_password)
 					janus_config_add_item(config, mp->name, "rtsp_pwd", source->rtsp_password);
+				if(source->rtsp_tcp)
+					janus_config_add_item(config, mp->name, "rtsp_transport", "tcp");
+				if(source->keyframe.enabled)
+					janus_config_add_item(config, mp->name, "videobufferkf", "yes");
 #endif
 				if(mp->codecs.audio_pt >= 0) {
 					janus_config_add_item(config, mp->name, "audio", mp->codecs.audio_pt ? "yes" : "no");
@@ -2275,6 +2892,10 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 						janus_config_add_item(config, mp->name, "rtsp_user", source->rtsp_username);
 					if(source->rtsp_password)
 						janus_config_add_item(config, mp->name, "rtsp_pwd", source->rtsp_password);
+					if(source->rtsp_tcp)
+						janus_config_add_item(config, mp->name, "rtsp_transport", "tcp");
+					if(source->keyframe.enabled)
+						janus_config_add_item(config, mp->name, "videobufferkf", "yes");
 #endif
 					if(mp->codecs.audio_pt >= 0) {
 						janus_config_add_item(config, mp->name, "audio", mp->codecs.audio_pt ? "yes" : "no");
@@ -2330,6 +2951,8 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 							janus_config_add_item(config, mp->name, "videobufferkf", "yes");
 						if(source->simulcast) {
 							janus_config_add_item(config, mp->name, "videosimulcast", "yes");
+							if(source->simulcast_auto)
+								janus_config_add_item(config, mp->name, "videoautosimulcast", "yes");
 							if(source->video_port[1]) {
 								g_snprintf(value, BUFSIZ, "%d", source->video_port[1]);
 								janus_config_add_item(config, mp->name, "videoport2", value);
@@ -2349,6 +2972,17 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 						g_snprintf(value, BUFSIZ, "%d", source->rtp_collision);
 						janus_config_add_item(config, mp->name, "collision", value);
 					}
+					if(mp->helper_threads > 0) {
+						g_snprintf(value, BUFSIZ, "%d", mp->helper_threads);
+						janus_config_add_item(config, mp->name, "threads", value);
+					}
+					if(source->cascade_origin != NULL) {
+						janus_config_add_item(config, mp->name, "cascade", source->cascade_origin);
+						g_snprintf(value, BUFSIZ, "%"SCNu64, source->cascade_id);
+						janus_config_add_item(config, mp->name, "cascade_id", value);
+						if(source->cascade_pin)
+							janus_config_add_item(config, mp->name, "cascade_pin", source->cascade_pin);
+					}
 					janus_config_add_item(config, mp->name, "data", mp->data ? "yes" : "no");
 					if(source->data_port > -1) {
 						g_snprintf(value, BUFSIZ, "%d", source->data_port);
@@ -2428,31 +3062,6 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 			goto plugin_response;
 		}
 		JANUS_LOG(LOG_VERB, "Request to unmount mountpoint/stream %"SCNu64"\n", id_value);
-		/* FIXME Should we kick the current viewers as well? */
-		janus_mutex_lock(&mp->mutex);
-		GList *viewer = g_list_first(mp->listeners);
-		/* Prepare JSON event */
-		json_t *event = json_object();
-		json_object_set_new(event, "streaming", json_string("event"));
-		json_t *result = json_object();
-		json_object_set_new(result, "status", json_string("stopped"));
-		json_object_set_new(event, "result", result);
-		while(viewer) {
-			janus_streaming_session *session = (janus_streaming_session *)viewer->data;
-			if(session != NULL) {
-				session->stopping = TRUE;
-				session->started = FALSE;
-				session->paused = FALSE;
-				session->mountpoint = NULL;
-				/* Tell the core to tear down the PeerConnection, hangup_media will do the rest */
-				gateway->push_event(session->handle, &janus_streaming_plugin, NULL, event, NULL);
-				gateway->close_pc(session->handle);
-			}
-			mp->listeners = g_list_remove_all(mp->listeners, session);
-			viewer = g_list_first(mp->listeners);
-		}
-		json_decref(event);
-		janus_mutex_unlock(&mp->mutex);
 		if(save) {
 			/* This change is permanent: save to the configuration file too
 			 * FIXME: We should check if anything fails... */
@@ -2465,13 +3074,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 				save = FALSE;	/* This will notify the user the mountpoint is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
-		/* Remove mountpoint from the hashtable: this will get it destroyed */
-		if(!mp->destroyed) {
-			mp->destroyed = janus_get_monotonic_time();
-			g_hash_table_remove(mountpoints, &id_value);
-			/* Cleaning up and removing the mountpoint is done in a lazy way */
-			old_mountpoints = g_list_append(old_mountpoints, mp);
-		}
+		janus_streaming_mountpoint_unmount(mp);
 		/* Also notify event handlers */
 		if(notify_events && gateway->events_is_enabled()) {
 			json_t *info = json_object();
@@ -2485,6 +3088,87 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 		json_object_set_new(response, "streaming", json_string("destroyed"));
 		json_object_set_new(response, "destroyed", json_integer(id_value));
 		goto plugin_response;
+	} else if(!strcasecmp(request_text, "reload")) {
+		/* Read the configuration file again, and only apply what changed in the mountpoints it lists */
+		if(admin_key != NULL) {
+			/* An admin key was specified: make sure it was provided, and that it's valid */
+			JANUS_VALIDATE_JSON_OBJECT(root, adminkey_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_STREAMING_ERROR_MISSING_ELEMENT, JANUS_STREAMING_ERROR_INVALID_ELEMENT);
+			if(error_code != 0)
+				goto plugin_response;
+			JANUS_CHECK_SECRET(admin_key, root, "admin_key", error_code, error_cause,
+				JANUS_STREAMING_ERROR_MISSING_ELEMENT, JANUS_STREAMING_ERROR_INVALID_ELEMENT, JANUS_STREAMING_ERROR_UNAUTHORIZED);
+			if(error_code != 0)
+				goto plugin_response;
+		}
+		char filename[255];
+		g_snprintf(filename, 255, "%s/%s.cfg", config_folder, JANUS_STREAMING_PACKAGE);
+		janus_config *reloaded = janus_config_parse(filename);
+		if(reloaded == NULL) {
+			JANUS_LOG(LOG_ERR, "Couldn't parse the configuration file %s, nothing reloaded\n", filename);
+			error_code = JANUS_STREAMING_ERROR_UNKNOWN_ERROR;
+			g_snprintf(error_cause, 512, "Couldn't parse the configuration file");
+			goto plugin_response;
+		}
+		JANUS_LOG(LOG_INFO, "Reloading the Streaming mountpoints from %s\n", filename);
+		if(getifaddrs(&ifas) || ifas == NULL) {
+			JANUS_LOG(LOG_ERR, "Unable to acquire list of network devices/interfaces; some configurations may not work as expected...\n");
+		}
+		janus_mutex_lock(&deferred_mutex);
+		janus_mutex_lock(&config_mutex);
+		janus_config *previous = config;
+		config = reloaded;
+		janus_mutex_unlock(&config_mutex);
+		json_t *added = json_array(), *removed = json_array(), *updated = json_array();
+		/* Whatever is gone or different goes away first, so that ports are released */
+		GList *cl = previous ? janus_config_get_categories(previous) : NULL;
+		while(cl != NULL) {
+			janus_config_category *cat = (janus_config_category *)cl->data;
+			cl = cl->next;
+			if(cat->name == NULL)
+				continue;
+			janus_config_category *now = janus_config_get_category(reloaded, cat->name);
+			if(!strcasecmp(cat->name, "general")) {
+				if(now == NULL || !janus_streaming_config_category_equal(cat, now))
+					JANUS_LOG(LOG_WARN, "Changes to the general settings are only applied after a restart\n");
+				continue;
+			}
+			if(now != NULL && janus_streaming_config_category_equal(cat, now))
+				continue;
+			JANUS_LOG(LOG_VERB, "Stream '%s' %s\n", cat->name, now ? "changed" : "removed");
+			janus_streaming_mountpoint_unload(cat->name);
+			if(now == NULL) {
+				json_array_append_new(removed, json_string(cat->name));
+			} else {
+				json_array_append_new(updated, json_string(cat->name));
+				/* The new instance waits for the old one to release its sockets */
+				janus_streaming_mountpoint_load(now, ifas, TRUE);
+			}
+		}
+		cl = janus_config_get_categories(reloaded);
+		while(cl != NULL) {
+			janus_config_category *cat = (janus_config_category *)cl->data;
+			cl = cl->next;
+			if(cat->name == NULL || !strcasecmp(cat->name, "general"))
+				continue;
+			if(previous && janus_config_get_category(previous, cat->name) != NULL)
+				continue;
+			json_array_append_new(added, json_string(cat->name));
+			janus_streaming_mountpoint_load(cat, ifas, FALSE);
+		}
+		janus_mutex_unlock(&deferred_mutex);
+		if(previous != NULL)
+			janus_config_destroy(previous);
+		JANUS_LOG(LOG_INFO, "Streaming mountpoints reloaded: %zu added, %zu removed, %zu updated\n",
+			json_array_size(added), json_array_size(removed), json_array_size(updated));
+		/* Send info back */
+		response = json_object();
+		json_object_set_new(response, "streaming", json_string("reloaded"));
+		json_object_set_new(response, "added", added);
+		json_object_set_new(response, "removed", removed);
+		json_object_set_new(response, "updated", updated);
+		goto plugin_response;
 	} else if(!strcasecmp(request_text, "recording")) {
 		/* We can start/stop recording a live, RTP-based stream */
 		JANUS_VALIDATE_JSON_OBJECT(root, recording_parameters,
@@ -2502,6 +3186,8 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 		}
 		json_t *id = json_object_get(root, "id");
 		guint64 id_value = json_integer_value(id);
+		/* Lazy mountpoints are created the first time they're addressed */
+		janus_streaming_mountpoint_activate(id_value, root, "secret");
 		janus_mutex_lock(&mountpoints_mutex);
 		janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &id_value);
 		if(mp == NULL) {
@@ -2691,6 +3377,9 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 			goto plugin_response;
 		json_t *id = json_object_get(root, "id");
 		guint64 id_value = json_integer_value(id);
+		/* Lazy mountpoints are created the first time they're addressed (disabling one is a no-op) */
+		if(!strcasecmp(request_text, "enable"))
+			janus_streaming_mountpoint_activate(id_value, root, "secret");
 		janus_mutex_lock(&mountpoints_mutex);
 		janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &id_value);
 		if(mp == NULL) {
@@ -2761,7 +3450,7 @@ struct janus_plugin_result *janus_streaming_handle_message(janus_plugin_session
 		msg->message = root;
 		msg->jsep = jsep;
 
-		g_async_queue_push(messages, msg);
+		g_async_queue_push(janus_handler_pool_queue(handlers, msg->handle), msg);
 		return janus_plugin_result_new(JANUS_PLUGIN_OK_WAIT, NULL, NULL);
 	} else {
 		JANUS_LOG(LOG_VERB, "Unknown request '%s'\n", request_text);
@@ -2823,13 +3512,23 @@ void janus_streaming_setup_media(janus_plugin_session *handle) {
 		janus_streaming_rtp_source *source = mountpoint->source;
 		if(source->keyframe.enabled) {
 			JANUS_LOG(LOG_HUGE, "Any keyframe to send?\n");
+			/* When simulcasting, send the keyframe of the substream the viewer wants (or the step towards it) */
+			int index = source->simulcast ? session->substream_target : 0;
+			if(index < 0 || index > 2)
+				index = 0;
 			janus_mutex_lock(&source->keyframe.mutex);
-			if(source->keyframe.latest_keyframe != NULL) {
-				JANUS_LOG(LOG_HUGE, "Yep! %d packets\n", g_list_length(source->keyframe.latest_keyframe));
-				GList *temp = source->keyframe.latest_keyframe;
-				while(temp) {
-					janus_streaming_relay_rtp_packet(session, temp->data);
-					temp = temp->next;
+			janus_streaming_rtp_keyframe_ring *ring = source->keyframe.rings[index];
+			if((ring == NULL || ring->latest < 0) && index == 2) {
+				index = 1;
+				ring = source->keyframe.rings[index];
+			}
+			if(ring != NULL && ring->latest >= 0) {
+				JANUS_LOG(LOG_HUGE, "Yep! %d packets (substream %d)\n", ring->count[ring->latest], index);
+				int i = 0;
+				for(i=0; i<ring->count[ring->latest]; i++) {
+					janus_streaming_rtp_relay_packet *pkt = &ring->packets[ring->latest][i];
+					janus_streaming_relay_rtp_packet(session, pkt);
+					janus_streaming_restore_header(pkt);
 				}
 			}
 			janus_mutex_unlock(&source->keyframe.mutex);
@@ -2867,10 +3566,26 @@ void janus_streaming_incoming_rtcp(janus_plugin_session *handle, int video, char
 	if(handle == NULL || handle->stopped || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
 		return;
 	/* We might interested in the available bandwidth that the user advertizes */
-	uint64_t bw = janus_rtcp_get_remb(buf, len);
+	uint32_t bw = janus_rtcp_get_remb(buf, len);
 	if(bw > 0) {
-		JANUS_LOG(LOG_HUGE, "REMB for this PeerConnection: %"SCNu64"\n", bw);
-		/* TODO Use this somehow (e.g., notification towards application?) */
+		JANUS_LOG(LOG_HUGE, "REMB for this PeerConnection: %"SCNu32"\n", bw);
+		/* If we pick simulcast substreams automatically, check which one fits */
+		janus_mutex_lock(&sessions_mutex);
+		janus_streaming_session *session = janus_streaming_lookup_session(handle);
+		janus_streaming_mountpoint *mp = session && !session->destroyed ? session->mountpoint : NULL;
+		if(mp && mp->streaming_source == janus_streaming_source_rtp) {
+			janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)mp->source;
+			if(source && source->simulcast && source->simulcast_auto) {
+				int target = janus_simulcast_bwe_pick(&session->bwe, &source->sc_bitrates,
+					session->substream_target, bw, janus_get_monotonic_time());
+				if(target != session->substream_target) {
+					JANUS_LOG(LOG_VERB, "[%s] Viewer estimates %"SCNu32" bps, switching to substream %d (was %d)\n",
+						mp->name, bw, target, session->substream_target);
+					session->substream_target = target;
+				}
+			}
+		}
+		janus_mutex_unlock(&sessions_mutex);
 	}
 	/* FIXME Maybe we should care about RTCP, but not now */
 }
@@ -2918,7 +3633,7 @@ static void janus_streaming_hangup_media_internal(janus_plugin_session *handle)
 		if(g_list_find(mp->listeners, session) != NULL) {
 			JANUS_LOG(LOG_VERB, "  -- -- Found!\n");
 		}
-		mp->listeners = g_list_remove_all(mp->listeners, session);
+		janus_streaming_listener_remove(mp, session);
 		janus_mutex_unlock(&mp->mutex);
 	}
 	session->mountpoint = NULL;
@@ -2926,13 +3641,14 @@ static void janus_streaming_hangup_media_internal(janus_plugin_session *handle)
 
 /* Thread to handle incoming messages */
 static void *janus_streaming_handler(void *data) {
+	GAsyncQueue *queue = (GAsyncQueue *)data;
 	JANUS_LOG(LOG_VERB, "Joining Streaming handler thread\n");
 	janus_streaming_message *msg = NULL;
 	int error_code = 0;
 	char error_cause[512];
 	json_t *root = NULL;
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		msg = g_async_queue_pop(messages);
+		msg = g_async_queue_pop(queue);
 		if(msg == &exit_message)
 			break;
 		if(msg->handle == NULL) {
@@ -2989,6 +3705,8 @@ static void *janus_streaming_handler(void *data) {
 			guint64 id_value = json_integer_value(id);
 			json_t *restart = json_object_get(root, "restart");
 			do_restart = restart ? json_is_true(restart) : FALSE;
+			/* Lazy mountpoints are created the first time they're addressed */
+			janus_streaming_mountpoint_activate(id_value, root, "pin");
 			janus_mutex_lock(&mountpoints_mutex);
 			janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &id_value);
 			if(mp == NULL) {
@@ -3033,6 +3751,8 @@ static void *janus_streaming_handler(void *data) {
 			JANUS_LOG(LOG_VERB, "Request to watch mountpoint/stream %"SCNu64"\n", id_value);
 			session->stopping = FALSE;
 			session->mountpoint = mp;
+			/* Keep viewers on the same NUMA node as the relay thread of the mountpoint */
+			gateway->set_placement_group(session->handle, mp->id);
 			session->sdp_version = 1;	/* This needs to be increased when it changes */
 			session->sdp_sessid = janus_get_real_time();
 			/* Check what we should offer */
@@ -3055,15 +3775,11 @@ static void *janus_streaming_handler(void *data) {
 				goto error;
 			}
 			if(mp->streaming_type == janus_streaming_type_on_demand) {
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "mp %"SCNu64, id_value);
-				g_thread_try_new(tname, &janus_streaming_ondemand_thread, session, &error);
-				if(error != NULL) {
+				if(!janus_streaming_filesource_start(mp, session)) {
 					janus_mutex_unlock(&mp->mutex);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the on-demand thread...\n", error->code, error->message ? error->message : "??");
+					JANUS_LOG(LOG_ERR, "Error starting the on-demand file source...\n");
 					error_code = JANUS_STREAMING_ERROR_UNKNOWN_ERROR;
-					g_snprintf(error_cause, 512, "Got error %d (%s) trying to launch the on-demand thread", error->code, error->message ? error->message : "??");
+					g_snprintf(error_cause, 512, "Error starting the on-demand file source");
 					goto error;
 				}
 			} else if(mp->streaming_source == janus_streaming_source_rtp) {
@@ -3082,10 +3798,13 @@ static void *janus_streaming_handler(void *data) {
 					session->templayer = -1;
 					session->templayer_target = 2;
 					janus_vp8_simulcast_context_reset(&session->simulcast_context);
+					janus_simulcast_bwe_context_reset(&session->bwe);
 					/* Unless the request contains a target */
 					json_t *substream = json_object_get(root, "substream");
 					if(substream) {
 						session->substream_target = json_integer_value(substream);
+						/* If we pick substreams automatically, this is the highest we can send */
+						session->bwe.max_substream = session->substream_target;
 						JANUS_LOG(LOG_VERB, "Setting video substream to let through (simulcast): %d (was %d)\n",
 							session->substream_target, session->substream);
 					}
@@ -3097,7 +3816,7 @@ static void *janus_streaming_handler(void *data) {
 					}
 				}
 			}
-			mp->listeners = g_list_append(mp->listeners, session);
+			janus_streaming_listener_add(mp, session);
 done:
 			/* Let's prepare an offer now, but let's also check if there's something we need to skip */
 			sdp_type = "offer";
@@ -3246,10 +3965,13 @@ done:
 					session->templayer = -1;
 					session->templayer_target = 2;
 					janus_vp8_simulcast_context_reset(&session->simulcast_context);
+					janus_simulcast_bwe_context_reset(&session->bwe);
 					/* Unless the request contains a target */
 					json_t *substream = json_object_get(root, "substream");
 					if(substream) {
 						session->substream_target = json_integer_value(substream);
+						/* If we pick substreams automatically, this is the highest we can send */
+						session->bwe.max_substream = session->substream_target;
 						JANUS_LOG(LOG_VERB, "Setting video substream to let through (simulcast): %d (was %d)\n",
 							session->substream_target, session->substream);
 						if(session->substream_target == session->substream) {
@@ -3310,6 +4032,8 @@ done:
 				goto error;
 			json_t *id = json_object_get(root, "id");
 			guint64 id_value = json_integer_value(id);
+			/* Lazy mountpoints are created the first time they're addressed */
+			janus_streaming_mountpoint_activate(id_value, root, "pin");
 			janus_mutex_lock(&mountpoints_mutex);
 			janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &id_value);
 			if(mp == NULL) {
@@ -3332,13 +4056,14 @@ done:
 			session->paused = TRUE;
 			/* Unsubscribe from the previous mountpoint and subscribe to the new one */
 			janus_mutex_lock(&oldmp->mutex);
-			oldmp->listeners = g_list_remove_all(oldmp->listeners, session);
+			janus_streaming_listener_remove(oldmp, session);
 			janus_mutex_unlock(&oldmp->mutex);
 			/* Subscribe to the new one */
 			janus_mutex_lock(&mp->mutex);
-			mp->listeners = g_list_append(mp->listeners, session);
+			janus_streaming_listener_add(mp, session);
 			janus_mutex_unlock(&mp->mutex);
 			session->mountpoint = mp;
+			gateway->set_placement_group(session->handle, mp->id);
 			session->paused = FALSE;
 			/* Done */
 			result = json_object();
@@ -3508,6 +4233,119 @@ static int janus_streaming_get_fd_port(int fd) {
 	return ntohs(server.sin_port);
 }
 
+/* Keyframe cache helpers */
+static janus_streaming_rtp_keyframe_ring *janus_streaming_rtp_keyframe_ring_new(void) {
+	janus_streaming_rtp_keyframe_ring *ring = g_malloc0(sizeof(janus_streaming_rtp_keyframe_ring));
+	ring->buffers = g_malloc0(2 * JANUS_STREAMING_KEYFRAME_PACKETS * JANUS_STREAMING_KEYFRAME_MTU);
+	int s = 0, i = 0;
+	for(s=0; s<2; s++) {
+		for(i=0; i<JANUS_STREAMING_KEYFRAME_PACKETS; i++) {
+			ring->packets[s][i].data = (janus_rtp_header *)(ring->buffers +
+				(s * JANUS_STREAMING_KEYFRAME_PACKETS + i) * JANUS_STREAMING_KEYFRAME_MTU);
+			ring->packets[s][i].is_rtp = TRUE;
+			ring->packets[s][i].is_video = TRUE;
+			ring->packets[s][i].is_keyframe = TRUE;
+		}
+	}
+	ring->latest = -1;
+	return ring;
+}
+
+static void janus_streaming_rtp_keyframe_ring_free(janus_streaming_rtp_keyframe_ring *ring) {
+	if(ring == NULL)
+		return;
+	g_free(ring->buffers);
+	g_free(ring);
+}
+
+/* Inspect a video packet of a mountpoint, so that it's only parsed once */
+static void janus_streaming_video_inspect(janus_streaming_mountpoint *mountpoint, char *buffer, int bytes, janus_video_info *video) {
+	janus_videocodec codec = JANUS_VIDEOCODEC_NONE;
+	switch(mountpoint->codecs.video_codec) {
+		case JANUS_STREAMING_VP8:
+			codec = JANUS_VIDEOCODEC_VP8;
+			break;
+		case JANUS_STREAMING_VP9:
+			codec = JANUS_VIDEOCODEC_VP9;
+			break;
+		case JANUS_STREAMING_H264:
+			codec = JANUS_VIDEOCODEC_H264;
+			break;
+		default:
+			break;
+	}
+	int plen = 0;
+	char *payload = janus_rtp_payload(buffer, bytes, &plen);
+	if(payload == NULL) {
+		memset(video, 0, sizeof(*video));
+		return;
+	}
+	janus_video_info_parse(codec, payload, plen, video);
+}
+
+/* Invoked by the relay thread for each video packet: only the slot which is not
+ * the latest keyframe is written to, so the mutex is only needed when swapping.
+ * The video info is the one the relay thread already parsed, if available */
+static void janus_streaming_rtp_keyframe_store(janus_streaming_mountpoint *mountpoint, int index, char *buffer, int bytes, janus_video_info *video) {
+	janus_streaming_rtp_source *source = mountpoint->source;
+	janus_streaming_rtp_keyframe_ring *ring = (index >= 0 && index < 3) ? source->keyframe.rings[index] : NULL;
+	if(ring == NULL || bytes < 12)
+		return;
+	janus_video_info info;
+	if(video == NULL) {
+		janus_streaming_video_inspect(mountpoint, buffer, bytes, &info);
+		video = &info;
+	}
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	guint32 timestamp = ntohl(rtp->timestamp);
+	int slot = (ring->latest == 0 ? 1 : 0);
+	if(ring->temp_ts > 0 && timestamp != ring->temp_ts) {
+		/* We received the last part of the keyframe, use this from now on (unless it didn't fit) */
+		JANUS_LOG(LOG_HUGE, "[%s] ... ... last part of keyframe received! ts=%"SCNu32", %d packets (substream %d)\n",
+			mountpoint->name, ring->temp_ts, ring->count[slot], index);
+		if(ring->overflow) {
+			JANUS_LOG(LOG_VERB, "[%s] Keyframe too large to cache (more than %d packets), keeping the previous one\n",
+				mountpoint->name, JANUS_STREAMING_KEYFRAME_PACKETS);
+		} else if(ring->count[slot] > 0) {
+			janus_mutex_lock(&source->keyframe.mutex);
+			ring->latest = slot;
+			janus_mutex_unlock(&source->keyframe.mutex);
+			slot = (slot == 0 ? 1 : 0);
+		}
+		ring->temp_ts = 0;
+	}
+	if(ring->temp_ts == 0) {
+		/* Is this the beginning of a new keyframe? */
+		if(!video->keyframe)
+			return;
+		/* New keyframe, start saving it */
+		JANUS_LOG(LOG_HUGE, "[%s] New keyframe received! ts=%"SCNu32" (substream %d)\n", mountpoint->name, timestamp, index);
+		ring->temp_ts = timestamp;
+		ring->count[slot] = 0;
+		ring->overflow = FALSE;
+	}
+	if(ring->overflow)
+		return;
+	if(ring->count[slot] >= JANUS_STREAMING_KEYFRAME_PACKETS || bytes > JANUS_STREAMING_KEYFRAME_MTU) {
+		ring->overflow = TRUE;
+		return;
+	}
+	/* Part of the keyframe we're currently saving, store */
+	janus_streaming_rtp_relay_packet *pkt = &ring->packets[slot][ring->count[slot]];
+	memcpy(pkt->data, buffer, bytes);
+	pkt->data->ssrc = htons(1);
+	pkt->data->type = mountpoint->codecs.video_pt;
+	pkt->length = bytes;
+	pkt->timestamp = timestamp;
+	pkt->seq_number = ntohs(rtp->seq_number);
+	pkt->simulcast = source->simulcast;
+	pkt->substream = index;
+	pkt->codec = mountpoint->codecs.video_codec;
+	pkt->video = *video;
+	pkt->rewritten = NULL;
+	ring->count[slot]++;
+}
+
 /* Helpers to destroy a streaming mountpoint. */
 static void janus_streaming_rtp_source_free(janus_streaming_rtp_source *source) {
 	if(source->audio_fd > -1) {
@@ -3525,6 +4363,13 @@ static void janus_streaming_rtp_source_free(janus_streaming_rtp_source *source)
 	if(source->data_fd > -1) {
 		close(source->data_fd);
 	}
+	if(source->cascade_fd > -1) {
+		/* Let the origin know we're done, rather than having it wait for a timeout */
+		janus_streaming_cascade_request(source, "BYE");
+		close(source->cascade_fd);
+	}
+	g_free(source->cascade_origin);
+	g_free(source->cascade_pin);
 #ifdef HAVE_LIBCURL
 	if(source->audio_rtcp_fd > -1) {
 		close(source->audio_rtcp_fd);
@@ -3534,25 +4379,11 @@ static void janus_streaming_rtp_source_free(janus_streaming_rtp_source *source)
 	}
 #endif
 	janus_mutex_lock(&source->keyframe.mutex);
-	GList *temp = NULL;
-	while(source->keyframe.latest_keyframe) {
-		temp = g_list_first(source->keyframe.latest_keyframe);
-		source->keyframe.latest_keyframe = g_list_remove_link(source->keyframe.latest_keyframe, temp);
-		janus_streaming_rtp_relay_packet *pkt = (janus_streaming_rtp_relay_packet *)temp->data;
-		g_free(pkt->data);
-		g_free(pkt);
-		g_list_free(temp);
-	}
-	source->keyframe.latest_keyframe = NULL;
-	while(source->keyframe.temp_keyframe) {
-		temp = g_list_first(source->keyframe.temp_keyframe);
-		source->keyframe.temp_keyframe = g_list_remove_link(source->keyframe.temp_keyframe, temp);
-		janus_streaming_rtp_relay_packet *pkt = (janus_streaming_rtp_relay_packet *)temp->data;
-		g_free(pkt->data);
-		g_free(pkt);
-		g_list_free(temp);
+	int i = 0;
+	for(i=0; i<3; i++) {
+		janus_streaming_rtp_keyframe_ring_free(source->keyframe.rings[i]);
+		source->keyframe.rings[i] = NULL;
 	}
-	source->keyframe.latest_keyframe = NULL;
 	janus_mutex_unlock(&source->keyframe.mutex);
 	janus_mutex_lock(&source->buffermsg_mutex);
 	if(source->last_msg) {
@@ -3598,18 +4429,22 @@ static void janus_streaming_file_source_free(janus_streaming_file_source *source
 static void janus_streaming_mountpoint_free(janus_streaming_mountpoint *mp) {
 	mp->destroyed = janus_get_monotonic_time();
 
-	g_free(mp->name);
-	g_free(mp->description);
-	g_free(mp->secret);
-	g_free(mp->pin);
+	/* Stop the helpers first, as they may still use the mountpoint (e.g., its name when logging) */
+	janus_streaming_helpers_stop(mp);
 	janus_mutex_lock(&mp->mutex);
 	g_list_free(mp->listeners);
+	g_list_free_full(mp->edges, (GDestroyNotify)janus_streaming_cascade_edge_free);
+	mp->edges = NULL;
 	janus_mutex_unlock(&mp->mutex);
 
 	if(mp->source != NULL && mp->source_destroy != NULL) {
 		mp->source_destroy(mp->source);
 	}
 
+	g_free(mp->name);
+	g_free(mp->description);
+	g_free(mp->secret);
+	g_free(mp->pin);
 	g_free(mp->codecs.audio_rtpmap);
 	g_free(mp->codecs.audio_fmtp);
 	g_free(mp->codecs.video_rtpmap);
@@ -3626,7 +4461,8 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		gboolean doaudio, char *amcast, const janus_network_address *aiface, uint16_t aport, uint8_t acodec, char *artpmap, char *afmtp, gboolean doaskew,
 		gboolean dovideo, char *vmcast, const janus_network_address *viface, uint16_t vport, uint8_t vcodec, char *vrtpmap, char *vfmtp, gboolean bufferkf,
 			gboolean simulcast, uint16_t vport2, uint16_t vport3, gboolean dovskew, int rtp_collision,
-		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean buffermsg) {
+		gboolean dodata, const janus_network_address *diface, uint16_t dport, gboolean buffermsg, int threads,
+		char *cascade, guint64 cascade_id, char *cascade_pin) {
 	janus_mutex_lock(&mountpoints_mutex);
 	if(id == 0) {
 		JANUS_LOG(LOG_VERB, "Missing id, will generate a random one...\n");
@@ -3663,9 +4499,14 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		doaudio ? "enabled" : "NOT enabled",
 		dovideo ? "enabled" : "NOT enabled",
 		dodata ? "enabled" : "NOT enabled");
-	/* First of all, let's check if the requested ports are free */
+	if(cascade != NULL && cascade_id == 0) {
+		JANUS_LOG(LOG_ERR, "Can't add 'rtp' stream, missing the ID of the mountpoint to cascade...\n");
+		janus_mutex_unlock(&mountpoints_mutex);
+		return NULL;
+	}
+	/* First of all, let's check if the requested ports are free (cascaded mountpoints get everything from a single socket) */
 	int audio_fd = -1;
-	if(doaudio) {
+	if(doaudio && cascade == NULL) {
 		audio_fd = janus_streaming_create_fd(aport, amcast ? inet_addr(amcast) : INADDR_ANY, aiface,
 			"Audio", "audio", name ? name : tempname);
 		if(audio_fd < 0) {
@@ -3675,7 +4516,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		}
 	}
 	int video_fd[3] = {-1, -1, -1};
-	if(dovideo) {
+	if(dovideo && cascade == NULL) {
 		video_fd[0] = janus_streaming_create_fd(vport, vmcast ? inet_addr(vmcast) : INADDR_ANY, viface,
 			"Video", "video", name ? name : tempname);
 		if(video_fd[0] < 0) {
@@ -3717,7 +4558,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		}
 	}
 	int data_fd = -1;
-	if(dodata) {
+	if(dodata && cascade == NULL) {
 #ifdef HAVE_SCTP
 		data_fd = janus_streaming_create_fd(dport, INADDR_ANY, diface,
 			"Data", "data", name ? name : tempname);
@@ -3739,6 +4580,17 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		dodata = FALSE;
 #endif
 	}
+	int cascade_fd = -1;
+	if(cascade != NULL) {
+#ifndef HAVE_SCTP
+		dodata = FALSE;
+#endif
+		cascade_fd = janus_streaming_cascade_connect(cascade, name ? name : tempname);
+		if(cascade_fd < 0) {
+			janus_mutex_unlock(&mountpoints_mutex);
+			return NULL;
+		}
+	}
 	/* Create the mountpoint */
 	janus_network_address nil;
 	janus_network_address_nullify(&nil);
@@ -3778,6 +4630,8 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 				close(video_fd[2]);
 			if(data_fd > -1)
 				close(data_fd);
+			if(cascade_fd > -1)
+				close(cascade_fd);
 			janus_mutex_unlock(&mountpoints_mutex);
 			g_free(live_rtp_source);
 			g_free(live_rtp->name);
@@ -3812,6 +4666,8 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 				close(video_fd[2]);
 			if(data_fd > -1)
 				close(data_fd);
+			if(cascade_fd > -1)
+				close(cascade_fd);
 			janus_mutex_unlock(&mountpoints_mutex);
 			g_free(live_rtp_source);
 			g_free(live_rtp->name);
@@ -3846,13 +4702,24 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	live_rtp_source->video_fd[1] = video_fd[1];
 	live_rtp_source->video_fd[2] = video_fd[2];
 	live_rtp_source->data_fd = data_fd;
+	live_rtp_source->cascade_fd = cascade_fd;
+	if(cascade != NULL) {
+		live_rtp_source->cascade_origin = g_strdup(cascade);
+		live_rtp_source->cascade_id = cascade_id;
+		live_rtp_source->cascade_pin = cascade_pin ? g_strdup(cascade_pin) : NULL;
+	}
 	live_rtp_source->last_received_audio = janus_get_monotonic_time();
 	live_rtp_source->last_received_video = janus_get_monotonic_time();
 	live_rtp_source->last_received_data = janus_get_monotonic_time();
 	live_rtp_source->keyframe.enabled = bufferkf;
-	live_rtp_source->keyframe.latest_keyframe = NULL;
-	live_rtp_source->keyframe.temp_keyframe = NULL;
-	live_rtp_source->keyframe.temp_ts = 0;
+	if(bufferkf) {
+		/* Preallocate the keyframe cache of each substream we'll receive */
+		live_rtp_source->keyframe.rings[0] = janus_streaming_rtp_keyframe_ring_new();
+		if(simulcast && (vport2 > 0 || cascade != NULL))
+			live_rtp_source->keyframe.rings[1] = janus_streaming_rtp_keyframe_ring_new();
+		if(simulcast && (vport3 > 0 || cascade != NULL))
+			live_rtp_source->keyframe.rings[2] = janus_streaming_rtp_keyframe_ring_new();
+	}
 	janus_mutex_init(&live_rtp_source->keyframe.mutex);
 	live_rtp_source->rtp_collision = rtp_collision;
 	live_rtp_source->buffermsg = buffermsg;
@@ -3878,6 +4745,8 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	live_rtp->listeners = NULL;
 	live_rtp->destroyed = 0;
 	janus_mutex_init(&live_rtp->mutex);
+	if(threads > 0)
+		janus_streaming_helpers_start(live_rtp, threads);
 	g_hash_table_insert(mountpoints, janus_uint64_dup(live_rtp->id), live_rtp);
 	janus_mutex_unlock(&mountpoints_mutex);
 	GError *error = NULL;
@@ -3967,12 +4836,8 @@ janus_streaming_mountpoint *janus_streaming_create_file_source(
 	g_hash_table_insert(mountpoints, janus_uint64_dup(file_source->id), file_source);
 	janus_mutex_unlock(&mountpoints_mutex);
 	if(live) {
-		GError *error = NULL;
-		char tname[16];
-		g_snprintf(tname, sizeof(tname), "mp %"SCNu64, file_source->id);
-		g_thread_try_new(tname, &janus_streaming_filesource_thread, file_source, &error);
-		if(error != NULL) {
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the live filesource thread...\n", error->code, error->message ? error->message : "??");
+		if(!janus_streaming_filesource_start(file_source, NULL)) {
+			JANUS_LOG(LOG_ERR, "Error starting the live file source...\n");
 			g_free(file_source->name);
 			g_free(description);
 			g_free(file_source_source);
@@ -3997,8 +4862,21 @@ static size_t janus_streaming_rtsp_curl_callback(void *payload, size_t size, siz
 	return realsize;
 }
 
+static void janus_streaming_rtsp_close_fds(multiple_fds *fds) {
+	if(fds->fd > -1)
+		close(fds->fd);
+	fds->fd = -1;
+	if(fds->rtcp_fd > -1)
+		close(fds->rtcp_fd);
+	fds->rtcp_fd = -1;
+}
+
+/* Interleaved RTP packets are handled after janus_streaming_recv_batch is defined */
+static size_t janus_streaming_rtsp_interleave_callback(void *payload, size_t size, size_t nmemb, void *data);
+
 static int janus_streaming_rtsp_parse_sdp(const char *buffer, const char *name, const char *media, int *pt,
-		char *transport, char *rtpmap, char *fmtp, char *control, const janus_network_address *iface, multiple_fds *fds) {
+		char *transport, char *rtpmap, char *fmtp, char *control, const janus_network_address *iface,
+		gboolean tcp, int channel, multiple_fds *fds) {
 	char pattern[256];
 	g_snprintf(pattern, sizeof(pattern), "m=%s", media);
 	char *m = strstr(buffer, pattern);
@@ -4021,6 +4899,11 @@ static int janus_streaming_rtsp_parse_sdp(const char *buffer, const char *name,
 	if(f != NULL) {
 		sscanf(f, "a=fmtp:%*d %2047[^\r\n]s", fmtp);
 	}
+	if(tcp) {
+		/* RTP and RTCP will be interleaved on the RTSP connection, no need for sockets */
+		g_snprintf(transport, 1024, "RTP/AVP/TCP;unicast;interleaved=%d-%d", channel, channel+1);
+		return 0;
+	}
 	char *c = strstr(m, "c=IN IP4");
 	char ip[256];
 	in_addr_t mcast = INADDR_ANY;
@@ -4108,6 +4991,11 @@ static int janus_streaming_rtsp_connect_to_server(janus_streaming_mountpoint *mp
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, curldata);
 	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, janus_streaming_rtsp_curl_callback);
 	curl_easy_setopt(curl, CURLOPT_HEADERDATA, curldata);
+	if(source->rtsp_tcp) {
+		/* RTP packets will be interleaved with RTSP messages on the same connection */
+		curl_easy_setopt(curl, CURLOPT_INTERLEAVEFUNCTION, janus_streaming_rtsp_interleave_callback);
+		curl_easy_setopt(curl, CURLOPT_INTERLEAVEDATA, source);
+	}
 	int res = curl_easy_perform(curl);
 	if(res != CURLE_OK) {
 		JANUS_LOG(LOG_ERR, "Couldn't send DESCRIBE request: %s\n", curl_easy_strerror(res));
@@ -4152,11 +5040,13 @@ static int janus_streaming_rtsp_connect_to_server(janus_streaming_mountpoint *mp
 	/* Parse both video and audio first before proceed to setup as curldata will be reused */
 	int vresult;
 	vresult = janus_streaming_rtsp_parse_sdp(curldata->buffer, name, "video", &vpt,
-		vtransport, vrtpmap, vfmtp, vcontrol, &source->video_iface, &video_fds);
+		vtransport, vrtpmap, vfmtp, vcontrol, &source->video_iface,
+		source->rtsp_tcp, JANUS_STREAMING_RTSP_CHANNEL_VIDEO, &video_fds);
 
 	int aresult;
 	aresult = janus_streaming_rtsp_parse_sdp(curldata->buffer, name, "audio", &apt,
-		atransport, artpmap, afmtp, acontrol, &source->audio_iface, &audio_fds);
+		atransport, artpmap, afmtp, acontrol, &source->audio_iface,
+		source->rtsp_tcp, JANUS_STREAMING_RTSP_CHANNEL_AUDIO, &audio_fds);
 
 	if(vresult != -1) {
 		/* Send an RTSP SETUP for video */
@@ -4179,6 +5069,8 @@ static int janus_streaming_rtsp_connect_to_server(janus_streaming_mountpoint *mp
 			curl_easy_cleanup(curl);
 			g_free(curldata->buffer);
 			g_free(curldata);
+			janus_streaming_rtsp_close_fds(&video_fds);
+			janus_streaming_rtsp_close_fds(&audio_fds);
 			return -5;
 		}
 		JANUS_LOG(LOG_VERB, "SETUP answer:%s\n", curldata->buffer);
@@ -4206,6 +5098,8 @@ static int janus_streaming_rtsp_connect_to_server(janus_streaming_mountpoint *mp
 			curl_easy_cleanup(curl);
 			g_free(curldata->buffer);
 			g_free(curldata);
+			janus_streaming_rtsp_close_fds(&video_fds);
+			janus_streaming_rtsp_close_fds(&audio_fds);
 			return -6;
 		}
 		JANUS_LOG(LOG_VERB, "SETUP answer:%s\n", curldata->buffer);
@@ -4231,6 +5125,35 @@ static int janus_streaming_rtsp_connect_to_server(janus_streaming_mountpoint *mp
 		mp->codecs.video_rtpmap = dovideo ? g_strdup(vrtpmap) : NULL;
 	if(mp->codecs.video_fmtp == NULL)
 		mp->codecs.video_fmtp = dovideo ? g_strdup(vfmtp) : NULL;
+	if(dovideo && mp->codecs.video_rtpmap != NULL) {
+		/* We need to know the codec to spot keyframes */
+		if(strstr(mp->codecs.video_rtpmap, "vp8") || strstr(mp->codecs.video_rtpmap, "VP8"))
+			mp->codecs.video_codec = JANUS_STREAMING_VP8;
+		else if(strstr(mp->codecs.video_rtpmap, "vp9") || strstr(mp->codecs.video_rtpmap, "VP9"))
+			mp->codecs.video_codec = JANUS_STREAMING_VP9;
+		else if(strstr(mp->codecs.video_rtpmap, "h264") || strstr(mp->codecs.video_rtpmap, "H264"))
+			mp->codecs.video_codec = JANUS_STREAMING_H264;
+	}
+	source->rtsp_fd = -1;
+	if(source->rtsp_tcp) {
+		/* We'll poll the RTSP connection ourselves, to know when there are packets to read */
+		res = CURLE_UNSUPPORTED_PROTOCOL;
+#if LIBCURL_VERSION_NUM >= 0x072d00
+		curl_socket_t fd = CURL_SOCKET_BAD;
+		res = curl_easy_getinfo(curl, CURLINFO_ACTIVESOCKET, &fd);
+#else
+		long fd = -1;
+		res = curl_easy_getinfo(curl, CURLINFO_LASTSOCKET, &fd);
+#endif
+		if(res != CURLE_OK || fd < 0) {
+			JANUS_LOG(LOG_ERR, "Couldn't get the RTSP connection socket: %s\n", curl_easy_strerror(res));
+			curl_easy_cleanup(curl);
+			g_free(curldata->buffer);
+			g_free(curldata);
+			return -7;
+		}
+		source->rtsp_fd = fd;
+	}
 	source->audio_fd = audio_fds.fd;
 	source->audio_rtcp_fd = audio_fds.rtcp_fd;
 	source->video_fd[0] = video_fds.fd;
@@ -4266,13 +5189,62 @@ static int janus_streaming_rtsp_play(janus_streaming_rtp_source *source) {
 	return 0;
 }
 
+/* Helper to get rid of the RTSP connection and sockets, before reconnecting: notice
+ * that we keep the latest keyframe, so that new viewers can still get it right away */
+static void janus_streaming_rtsp_disconnect(janus_streaming_rtp_source *source) {
+	if(source == NULL)
+		return;
+	janus_mutex_lock(&source->rtsp_mutex);
+	if(source->curl)
+		curl_easy_cleanup(source->curl);
+	source->curl = NULL;
+	/* The interleaved connection socket belonged to libcurl, so it's gone already */
+	source->rtsp_fd = -1;
+	if(source->curldata)
+		g_free(source->curldata->buffer);
+	g_free(source->curldata);
+	source->curldata = NULL;
+	janus_mutex_unlock(&source->rtsp_mutex);
+	if(source->audio_fd > -1) {
+		close(source->audio_fd);
+	}
+	source->audio_fd = -1;
+	int i = 0;
+	for(i=0; i<3; i++) {
+		if(source->video_fd[i] > -1) {
+			close(source->video_fd[i]);
+		}
+		source->video_fd[i] = -1;
+	}
+	if(source->data_fd > -1) {
+		close(source->data_fd);
+	}
+	source->data_fd = -1;
+	if(source->audio_rtcp_fd > -1) {
+		close(source->audio_rtcp_fd);
+	}
+	source->audio_rtcp_fd = -1;
+	if(source->video_rtcp_fd > -1) {
+		close(source->video_rtcp_fd);
+	}
+	source->video_rtcp_fd = -1;
+	/* A keyframe we were in the middle of collecting will never be completed, though */
+	for(i=0; i<3; i++) {
+		janus_streaming_rtp_keyframe_ring *ring = source->keyframe.rings[i];
+		if(ring == NULL)
+			continue;
+		ring->temp_ts = 0;
+		ring->overflow = FALSE;
+	}
+}
+
 /* Helper to create an RTSP source */
 janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 		uint64_t id, char *name, char *desc,
 		char *url, char *username, char *password,
 		gboolean doaudio, char *artpmap, char *afmtp,
 		gboolean dovideo, char *vrtpmap, char *vfmtp,
-		const janus_network_address *iface,
+		const janus_network_address *iface, gboolean tcp, gboolean bufferkf,
 		gboolean error_on_failure) {
 	if(url == NULL) {
 		JANUS_LOG(LOG_ERR, "Can't add 'rtsp' stream, missing url...\n");
@@ -4321,6 +5293,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 	live_rtsp->data = FALSE;
 	live_rtsp->streaming_type = janus_streaming_type_live;
 	live_rtsp->streaming_source = janus_streaming_source_rtp;
+	live_rtsp->codecs.video_codec = -1;
 	janus_streaming_rtp_source *live_rtsp_source = g_malloc0(sizeof(janus_streaming_rtp_source));
 	live_rtsp_source->rtsp = TRUE;
 	live_rtsp_source->rtsp_url = g_strdup(url);
@@ -4336,11 +5309,23 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 	live_rtsp_source->video_fd[1] = -1;
 	live_rtsp_source->video_fd[2] = -1;
 	live_rtsp_source->video_rtcp_fd = -1;
+	live_rtsp_source->cascade_fd = -1;
 	live_rtsp_source->video_iface = iface ? *iface : nil;
 	live_rtsp_source->data_fd = -1;
 	live_rtsp_source->data_iface = nil;
 	live_rtsp_source->reconnect_timer = 0;
+	live_rtsp_source->reconnect_next = 0;
+	live_rtsp_source->reconnect_attempts = 0;
+	live_rtsp_source->rtsp_tcp = tcp;
+	live_rtsp_source->rtsp_fd = -1;
 	janus_mutex_init(&live_rtsp_source->rtsp_mutex);
+	live_rtsp_source->keyframe.enabled = dovideo && bufferkf;
+	if(live_rtsp_source->keyframe.enabled) {
+		/* RTSP sources only have a single video stream, the ring survives reconnections */
+		live_rtsp_source->keyframe.rings[0] = janus_streaming_rtp_keyframe_ring_new();
+	}
+	janus_mutex_init(&live_rtsp_source->keyframe.mutex);
+	janus_mutex_init(&live_rtsp_source->buffermsg_mutex);
 	live_rtsp->source = live_rtsp_source;
 	live_rtsp->source_destroy = (GDestroyNotify) janus_streaming_rtp_source_free;
 	live_rtsp->listeners = NULL;
@@ -4390,7 +5375,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 		char *url, char *username, char *password,
 		gboolean doaudio, char *audiortpmap, char *audiofmtp,
 		gboolean dovideo, char *videortpmap, char *videofmtp,
-		const janus_network_address *iface,
+		const janus_network_address *iface, gboolean tcp, gboolean bufferkf,
 		gboolean error_on_failure) {
 	JANUS_LOG(LOG_ERR, "RTSP need libcurl\n");
 	return NULL;
@@ -4398,250 +5383,310 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 #endif
 
 /* FIXME Thread to send RTP packets from a file (on demand) */
-static void *janus_streaming_ondemand_thread(void *data) {
-	JANUS_LOG(LOG_VERB, "Filesource (on demand) RTP thread starting...\n");
-	janus_streaming_session *session = (janus_streaming_session *)data;
-	if(!session) {
-		JANUS_LOG(LOG_ERR, "Invalid session!\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+/* File sources (live or on demand) are tasks driven by the timer service,
+ * that read and send a new frame every 20ms */
+typedef struct janus_streaming_filesource {
+	janus_streaming_mountpoint *mountpoint;
+	janus_streaming_session *session;	/* Only for on demand file sources */
+	FILE *audio;
+	char *buf;
+	char *name;
+	janus_rtp_header *header;
+	gint16 seq;
+	gint32 ts;
+	gint64 next;	/* When the next frame is due (monotonic) */
+} janus_streaming_filesource;
+
+static void janus_streaming_filesource_free(janus_streaming_filesource *fs) {
+	if(fs->audio)
+		fclose(fs->audio);
+	g_free(fs->name);
+	g_free(fs->buf);
+	g_free(fs);
+}
+
+static gint64 janus_streaming_filesource_tick(gint64 now, gpointer data) {
+	janus_streaming_filesource *fs = (janus_streaming_filesource *)data;
+	janus_streaming_mountpoint *mountpoint = fs->mountpoint;
+	janus_streaming_session *session = fs->session;
+	janus_streaming_file_source *source = mountpoint->source;
+	if(g_atomic_int_get(&stopping) || mountpoint->destroyed || (session && (session->stopping || session->destroyed))) {
+		JANUS_LOG(LOG_VERB, "[%s] Leaving filesource (%s)\n", fs->name, session ? "ondemand" : "live");
+		janus_streaming_filesource_free(fs);
+		return -1;
 	}
-	janus_streaming_mountpoint *mountpoint = session->mountpoint;
+	/* Schedule the next frame: we don't use the current time as a reference,
+	 * as the deadlines would otherwise drift because of the processing */
+	fs->next = (fs->next ? fs->next : now) + 20000;
+	/* If not started or paused, wait some more */
+	if(!mountpoint->enabled || (session && (!session->started || session->paused)))
+		return fs->next;
+	/* Read frame from file... */
+	gint read = fread(fs->buf + RTP_HEADER_SIZE, sizeof(char), 160, fs->audio);
+	if(feof(fs->audio)) {
+		/* FIXME We're doing this forever... should this be configurable? */
+		JANUS_LOG(LOG_VERB, "[%s] Rewind! (%s)\n", fs->name, source->filename);
+		fseek(fs->audio, 0, SEEK_SET);
+		return fs->next;
+	}
+	if(read < 0) {
+		JANUS_LOG(LOG_VERB, "[%s] Leaving filesource (%s)\n", fs->name, session ? "ondemand" : "live");
+		janus_streaming_filesource_free(fs);
+		return -1;
+	}
+	if(mountpoint->active == FALSE)
+		mountpoint->active = TRUE;
+	/* Relay on all sessions */
+	janus_streaming_rtp_relay_packet packet;
+	packet.data = fs->header;
+	packet.length = RTP_HEADER_SIZE + read;
+	packet.is_rtp = TRUE;
+	packet.is_video = FALSE;
+	packet.is_keyframe = FALSE;
+	/* Backup the actual timestamp and sequence number */
+	packet.timestamp = ntohl(packet.data->timestamp);
+	packet.seq_number = ntohs(packet.data->seq_number);
+	packet.rewritten = NULL;
+	/* Go! */
+	if(session) {
+		janus_streaming_relay_rtp_packet(session, &packet);
+		janus_streaming_restore_header(&packet);
+	} else {
+		janus_mutex_lock_nodebug(&mountpoint->mutex);
+		janus_streaming_relay_rtp_to_listeners(mountpoint->listeners, &packet);
+		janus_mutex_unlock_nodebug(&mountpoint->mutex);
+	}
+	/* Update header */
+	fs->seq++;
+	fs->header->seq_number = htons(fs->seq);
+	fs->ts += 160;
+	fs->header->timestamp = htonl(fs->ts);
+	fs->header->markerbit = 0;
+	return fs->next;
+}
+
+/* Start sending RTP packets from a file: live if session is NULL, on demand otherwise */
+static gboolean janus_streaming_filesource_start(janus_streaming_mountpoint *mountpoint, janus_streaming_session *session) {
 	if(!mountpoint) {
 		JANUS_LOG(LOG_ERR, "Invalid mountpoint!\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+		return FALSE;
 	}
 	if(mountpoint->streaming_source != janus_streaming_source_file) {
 		JANUS_LOG(LOG_ERR, "[%s] Not an file source mountpoint!\n", mountpoint->name);
-		g_thread_unref(g_thread_self());
-		return NULL;
+		return FALSE;
 	}
-	if(mountpoint->streaming_type != janus_streaming_type_on_demand) {
-		JANUS_LOG(LOG_ERR, "[%s] Not an on-demand file source mountpoint!\n", mountpoint->name);
-		g_thread_unref(g_thread_self());
-		return NULL;
+	if(mountpoint->streaming_type != (session ? janus_streaming_type_on_demand : janus_streaming_type_live)) {
+		JANUS_LOG(LOG_ERR, "[%s] Not %s file source mountpoint!\n", mountpoint->name, session ? "an on-demand" : "a live");
+		return FALSE;
 	}
 	janus_streaming_file_source *source = mountpoint->source;
 	if(source == NULL || source->filename == NULL) {
-		g_thread_unref(g_thread_self());
 		JANUS_LOG(LOG_ERR, "[%s] Invalid file source mountpoint!\n", mountpoint->name);
-		return NULL;
+		return FALSE;
 	}
 	JANUS_LOG(LOG_VERB, "[%s] Opening file source %s...\n", mountpoint->name, source->filename);
 	FILE *audio = fopen(source->filename, "rb");
 	if(!audio) {
 		JANUS_LOG(LOG_ERR, "[%s] Ooops, audio file missing!\n", mountpoint->name);
-		g_thread_unref(g_thread_self());
-		return NULL;
+		return FALSE;
 	}
 	JANUS_LOG(LOG_VERB, "[%s] Streaming audio file: %s\n", mountpoint->name, source->filename);
+	janus_streaming_filesource *fs = g_malloc0(sizeof(janus_streaming_filesource));
+	fs->mountpoint = mountpoint;
+	fs->session = session;
+	fs->audio = audio;
 	/* Buffer */
-	char *buf = g_malloc0(1024);
-	char *name = g_strdup(mountpoint->name ? mountpoint->name : "??");
+	fs->buf = g_malloc0(1024);
+	fs->name = g_strdup(mountpoint->name ? mountpoint->name : "??");
 	/* Set up RTP */
-	gint16 seq = 1;
-	gint32 ts = 0;
-	janus_rtp_header *header = (janus_rtp_header *)buf;
-	header->version = 2;
-	header->markerbit = 1;
-	header->type = mountpoint->codecs.audio_pt;
-	header->seq_number = htons(seq);
-	header->timestamp = htonl(ts);
-	header->ssrc = htonl(1);	/* The gateway will fix this anyway */
-	/* Timer */
-	struct timeval now, before;
-	gettimeofday(&before, NULL);
-	now.tv_sec = before.tv_sec;
-	now.tv_usec = before.tv_usec;
-	time_t passed, d_s, d_us;
-	/* Loop */
-	gint read = 0;
-	janus_streaming_rtp_relay_packet packet;
-	while(!g_atomic_int_get(&stopping) && !mountpoint->destroyed && !session->stopping && !session->destroyed) {
-		/* See if it's time to prepare a frame */
-		gettimeofday(&now, NULL);
-		d_s = now.tv_sec - before.tv_sec;
-		d_us = now.tv_usec - before.tv_usec;
-		if(d_us < 0) {
-			d_us += 1000000;
-			--d_s;
-		}
-		passed = d_s*1000000 + d_us;
-		if(passed < 18000) {	/* Let's wait about 18ms */
-			g_usleep(5000);
-			continue;
-		}
-		/* Update the reference time */
-		before.tv_usec += 20000;
-		if(before.tv_usec > 1000000) {
-			before.tv_sec++;
-			before.tv_usec -= 1000000;
-		}
-		/* If not started or paused, wait some more */
-		if(!session->started || session->paused || !mountpoint->enabled)
-			continue;
-		/* Read frame from file... */
-		read = fread(buf + RTP_HEADER_SIZE, sizeof(char), 160, audio);
-		if(feof(audio)) {
-			/* FIXME We're doing this forever... should this be configurable? */
-			JANUS_LOG(LOG_VERB, "[%s] Rewind! (%s)\n", name, source->filename);
-			fseek(audio, 0, SEEK_SET);
-			continue;
-		}
-		if(read < 0)
-			break;
-		if(mountpoint->active == FALSE)
-			mountpoint->active = TRUE;
-		//~ JANUS_LOG(LOG_VERB, " ... Preparing RTP packet (pt=%u, seq=%u, ts=%u)...\n",
-			//~ header->type, ntohs(header->seq_number), ntohl(header->timestamp));
-		//~ JANUS_LOG(LOG_VERB, " ... Read %d bytes from the audio file...\n", read);
-		/* Relay on all sessions */
-		packet.data = header;
-		packet.length = RTP_HEADER_SIZE + read;
-		packet.is_rtp = TRUE;
-		packet.is_video = FALSE;
-		packet.is_keyframe = FALSE;
-		/* Backup the actual timestamp and sequence number */
-		packet.timestamp = ntohl(packet.data->timestamp);
-		packet.seq_number = ntohs(packet.data->seq_number);
-		/* Go! */
-		janus_streaming_relay_rtp_packet(session, &packet);
-		/* Update header */
-		seq++;
-		header->seq_number = htons(seq);
-		ts += 160;
-		header->timestamp = htonl(ts);
-		header->markerbit = 0;
-	}
-	JANUS_LOG(LOG_VERB, "[%s] Leaving filesource (ondemand) thread\n", name);
-	g_free(name);
-	g_free(buf);
-	fclose(audio);
-	g_thread_unref(g_thread_self());
-	return NULL;
+	fs->seq = 1;
+	fs->ts = 0;
+	fs->header = (janus_rtp_header *)fs->buf;
+	fs->header->version = 2;
+	fs->header->markerbit = 1;
+	fs->header->type = mountpoint->codecs.audio_pt;
+	fs->header->seq_number = htons(fs->seq);
+	fs->header->timestamp = htonl(fs->ts);
+	fs->header->ssrc = htonl(1);	/* The gateway will fix this anyway */
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "mp %"SCNu64, mountpoint->id);
+	janus_timer_task *task = janus_timer_add_placed(tname, janus_get_monotonic_time(), janus_streaming_filesource_tick, fs, mountpoint->id);
+	if(task == NULL) {
+		janus_streaming_filesource_free(fs);
+		return FALSE;
+	}
+	/* Nobody waits for file sources: they just stop when we're done */
+	janus_timer_detach(task);
+	return TRUE;
 }
 
-/* FIXME Thread to send RTP packets from a file (live) */
-static void *janus_streaming_filesource_thread(void *data) {
-	JANUS_LOG(LOG_VERB, "Filesource (live) thread starting...\n");
-	janus_streaming_mountpoint *mountpoint = (janus_streaming_mountpoint *)data;
-	if(!mountpoint) {
-		JANUS_LOG(LOG_ERR, "Invalid mountpoint!\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+/* Helpers to receive packets in batches in the relay thread: where
+ * recvmmsg is available we drain up to JANUS_STREAMING_RECV_BATCH
+ * datagrams with a single syscall, otherwise we just read one */
+#define JANUS_STREAMING_RECV_BATCH	32
+typedef struct janus_streaming_recv_batch {
+	char buffers[JANUS_STREAMING_RECV_BATCH][1500];
+	int lengths[JANUS_STREAMING_RECV_BATCH];
+	int kinds[JANUS_STREAMING_RECV_BATCH];	/* What each packet is, see JANUS_STREAMING_KIND_* */
+#ifdef HAVE_RECVMMSG
+	struct iovec iovecs[JANUS_STREAMING_RECV_BATCH];
+	struct mmsghdr msgs[JANUS_STREAMING_RECV_BATCH];
+#endif
+} janus_streaming_recv_batch;
+
+static janus_streaming_recv_batch *janus_streaming_recv_batch_create(void) {
+	janus_streaming_recv_batch *batch = g_malloc0(sizeof(janus_streaming_recv_batch));
+#ifdef HAVE_RECVMMSG
+	int i = 0;
+	for(i=0; i<JANUS_STREAMING_RECV_BATCH; i++) {
+		batch->iovecs[i].iov_base = batch->buffers[i];
+		batch->iovecs[i].iov_len = sizeof(batch->buffers[i]);
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
 	}
-	if(mountpoint->streaming_source != janus_streaming_source_file) {
-		JANUS_LOG(LOG_ERR, "[%s] Not an file source mountpoint!\n", mountpoint->name);
-		g_thread_unref(g_thread_self());
-		return NULL;
+#endif
+	return batch;
+}
+
+static int janus_streaming_recv_batch_read(int fd, janus_streaming_recv_batch *batch) {
+#ifdef HAVE_RECVMMSG
+	/* poll told us there's at least a packet, so we don't need to block */
+	int count = recvmmsg(fd, batch->msgs, JANUS_STREAMING_RECV_BATCH, MSG_DONTWAIT, NULL);
+	int i = 0;
+	for(i=0; i<count; i++)
+		batch->lengths[i] = batch->msgs[i].msg_len;
+	return count < 0 ? 0 : count;
+#else
+	batch->lengths[0] = recvfrom(fd, batch->buffers[0], sizeof(batch->buffers[0]), 0, NULL, NULL);
+	return batch->lengths[0] < 0 ? 0 : 1;
+#endif
+}
+
+/* Read a batch of packets from the origin of a cascaded mountpoint: media
+ * packets get the kind the origin tagged them with, while cached keyframes and
+ * replies to our requests are taken care of right away (their kind is -1) */
+static void janus_streaming_cascade_keyframe(janus_streaming_mountpoint *mp, int index, char *buffer, int bytes) {
+	janus_streaming_rtp_source *source = mp->source;
+	janus_streaming_rtp_keyframe_ring *ring = source->keyframe.enabled ? source->keyframe.rings[index] : NULL;
+	if(ring == NULL || ring->latest >= 0 || bytes < 12)
+		return;
+	if(source->is_srtp) {
+		int buflen = bytes;
+		if(srtp_unprotect(source->srtp_ctx, buffer, &buflen) != srtp_err_status_ok)
+			return;
+		bytes = buflen;
 	}
-	if(mountpoint->streaming_type != janus_streaming_type_live) {
-		JANUS_LOG(LOG_ERR, "[%s] Not a live file source mountpoint!\n", mountpoint->name);
-		g_thread_unref(g_thread_self());
-		return NULL;
+	/* Don't mix it with a keyframe we may be collecting ourselves in the meanwhile */
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	if(ring->temp_ts > 0 && ring->temp_ts != ntohl(rtp->timestamp))
+		return;
+	/* The next live packet will complete it, as with any other keyframe */
+	janus_streaming_rtp_keyframe_store(mp, index, buffer, bytes, NULL);
+}
+
+static int janus_streaming_cascade_read(janus_streaming_mountpoint *mp, janus_streaming_recv_batch *batch) {
+	janus_streaming_rtp_source *source = mp->source;
+	int count = janus_streaming_recv_batch_read(source->cascade_fd, batch), m = 0;
+	for(m=0; m<count; m++) {
+		int bytes = batch->lengths[m] - 1;
+		int kind = bytes > 0 ? (unsigned char)batch->buffers[m][bytes] : -1;
+		batch->lengths[m] = bytes;
+		batch->kinds[m] = -1;
+		if(kind == JANUS_STREAMING_KIND_AUDIO) {
+			if(mp->audio)
+				batch->kinds[m] = kind;
+		} else if(kind >= JANUS_STREAMING_KIND_VIDEO && kind < JANUS_STREAMING_KIND_VIDEO+3) {
+			/* If we're not simulcasting, we only care about the base substream */
+			if(mp->video && (kind == JANUS_STREAMING_KIND_VIDEO || source->simulcast))
+				batch->kinds[m] = kind;
+		} else if(kind == JANUS_STREAMING_KIND_DATA) {
+			if(mp->data)
+				batch->kinds[m] = kind;
+		} else if(kind >= JANUS_STREAMING_KIND_KEYFRAME && kind < JANUS_STREAMING_KIND_KEYFRAME+3) {
+			janus_streaming_cascade_keyframe(mp, kind - JANUS_STREAMING_KIND_KEYFRAME, batch->buffers[m], bytes);
+		} else if(kind == JANUS_STREAMING_KIND_CONTROL) {
+			/* Only log when our subscription changes state, as we get a reply to each refresh */
+			char *reply = batch->buffers[m];
+			reply[bytes] = '\0';
+			if(!strncmp(reply, "CHL ", 4)) {
+				/* The origin wants to check our address: subscribe again with the cookie it gave us */
+				if(sscanf(reply, "CHL %*s %32s", source->cascade_cookie) == 1)
+					janus_streaming_cascade_request(source, "SUB");
+				continue;
+			}
+			gboolean ok = !strncmp(reply, "OK", 2);
+			if(ok != source->cascade_ok) {
+				JANUS_LOG(ok ? LOG_INFO : LOG_WARN, "[%s] %s cascade origin %s (%s)\n", mp->name,
+					ok ? "Subscribed to" : "Couldn't subscribe to", source->cascade_origin, reply);
+				source->cascade_ok = ok;
+			}
+		}
 	}
-	janus_streaming_file_source *source = mountpoint->source;
-	if(source == NULL || source->filename == NULL) {
-		JANUS_LOG(LOG_ERR, "[%s] Invalid file source mountpoint!\n", mountpoint->name);
-		g_thread_unref(g_thread_self());
-		return NULL;
+	return count;
+}
+
+#ifdef HAVE_LIBCURL
+/* Invoked by libcurl for each packet interleaved on the RTSP connection ('$', channel,
+ * 16-bit length and the packet itself): we only care about RTP, and put it in the
+ * batch the relay thread is reading in, if any (e.g., packets that arrive while we
+ * wait for the response to a keep-alive are dropped, as nobody would handle them) */
+static size_t janus_streaming_rtsp_interleave_callback(void *payload, size_t size, size_t nmemb, void *data) {
+	size_t realsize = size * nmemb;
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)data;
+	unsigned char *frame = (unsigned char *)payload;
+	if(source == NULL || realsize < 4 || frame[0] != '$')
+		return realsize;
+	int kind = -1;
+	if(frame[1] == JANUS_STREAMING_RTSP_CHANNEL_AUDIO)
+		kind = JANUS_STREAMING_KIND_AUDIO;
+	else if(frame[1] == JANUS_STREAMING_RTSP_CHANNEL_VIDEO)
+		kind = JANUS_STREAMING_KIND_VIDEO;
+	else
+		return realsize;
+	size_t len = (frame[2] << 8) | frame[3];
+	janus_streaming_recv_batch *batch = source->rtsp_batch;
+	if(batch == NULL || len > realsize-4 || len > sizeof(batch->buffers[0]))
+		return realsize;
+	if(source->rtsp_received >= JANUS_STREAMING_RECV_BATCH) {
+		JANUS_LOG(LOG_HUGE, "Too many interleaved packets at once, dropping one\n");
+		return realsize;
 	}
-	JANUS_LOG(LOG_VERB, "[%s] Opening file source %s...\n", mountpoint->name, source->filename);
-	FILE *audio = fopen(source->filename, "rb");
-	if(!audio) {
-		JANUS_LOG(LOG_ERR, "[%s] Ooops, audio file missing!\n", mountpoint->name);
-		g_thread_unref(g_thread_self());
-		return NULL;
+	int m = source->rtsp_received;
+	memcpy(batch->buffers[m], frame+4, len);
+	batch->lengths[m] = len;
+	batch->kinds[m] = kind;
+	source->rtsp_received++;
+	return realsize;
+}
+
+/* Read the RTP packets interleaved on the RTSP connection: returns -1 if the connection is gone */
+static int janus_streaming_rtsp_read(janus_streaming_mountpoint *mp, janus_streaming_recv_batch *batch) {
+	janus_streaming_rtp_source *source = mp->source;
+	janus_mutex_lock(&source->rtsp_mutex);
+	if(source->curl == NULL) {
+		janus_mutex_unlock(&source->rtsp_mutex);
+		return -1;
 	}
-	JANUS_LOG(LOG_VERB, "[%s] Streaming audio file: %s\n", mountpoint->name, source->filename);
-	/* Buffer */
-	char *buf = g_malloc0(1024);
-	char *name = g_strdup(mountpoint->name ? mountpoint->name : "??");
-	/* Set up RTP */
-	gint16 seq = 1;
-	gint32 ts = 0;
-	janus_rtp_header *header = (janus_rtp_header *)buf;
-	header->version = 2;
-	header->markerbit = 1;
-	header->type = mountpoint->codecs.audio_pt;
-	header->seq_number = htons(seq);
-	header->timestamp = htonl(ts);
-	header->ssrc = htonl(1);	/* The gateway will fix this anyway */
-	/* Timer */
-	struct timeval now, before;
-	gettimeofday(&before, NULL);
-	now.tv_sec = before.tv_sec;
-	now.tv_usec = before.tv_usec;
-	time_t passed, d_s, d_us;
-	/* Loop */
-	gint read = 0;
-	janus_streaming_rtp_relay_packet packet;
-	while(!g_atomic_int_get(&stopping) && !mountpoint->destroyed) {
-		/* See if it's time to prepare a frame */
-		gettimeofday(&now, NULL);
-		d_s = now.tv_sec - before.tv_sec;
-		d_us = now.tv_usec - before.tv_usec;
-		if(d_us < 0) {
-			d_us += 1000000;
-			--d_s;
-		}
-		passed = d_s*1000000 + d_us;
-		if(passed < 18000) {	/* Let's wait about 18ms */
-			g_usleep(5000);
-			continue;
-		}
-		/* Update the reference time */
-		before.tv_usec += 20000;
-		if(before.tv_usec > 1000000) {
-			before.tv_sec++;
-			before.tv_usec -= 1000000;
-		}
-		/* If paused, wait some more */
-		if(!mountpoint->enabled)
-			continue;
-		/* Read frame from file... */
-		read = fread(buf + RTP_HEADER_SIZE, sizeof(char), 160, audio);
-		if(feof(audio)) {
-			/* FIXME We're doing this forever... should this be configurable? */
-			JANUS_LOG(LOG_VERB, "[%s] Rewind! (%s)\n", name, source->filename);
-			fseek(audio, 0, SEEK_SET);
-			continue;
-		}
-		if(read < 0)
-			break;
-		if(mountpoint->active == FALSE)
-			mountpoint->active = TRUE;
-		// JANUS_LOG(LOG_VERB, " ... Preparing RTP packet (pt=%u, seq=%u, ts=%u)...\n",
-			// header->type, ntohs(header->seq_number), ntohl(header->timestamp));
-		// JANUS_LOG(LOG_VERB, " ... Read %d bytes from the audio file...\n", read);
-		/* Relay on all sessions */
-		packet.data = header;
-		packet.length = RTP_HEADER_SIZE + read;
-		packet.is_rtp = TRUE;
-		packet.is_video = FALSE;
-		packet.is_keyframe = FALSE;
-		/* Backup the actual timestamp and sequence number */
-		packet.timestamp = ntohl(packet.data->timestamp);
-		packet.seq_number = ntohs(packet.data->seq_number);
-		/* Go! */
-		janus_mutex_lock_nodebug(&mountpoint->mutex);
-		g_list_foreach(mountpoint->listeners, janus_streaming_relay_rtp_packet, &packet);
-		janus_mutex_unlock_nodebug(&mountpoint->mutex);
-		/* Update header */
-		seq++;
-		header->seq_number = htons(seq);
-		ts += 160;
-		header->timestamp = htonl(ts);
-		header->markerbit = 0;
-	}
-	JANUS_LOG(LOG_VERB, "[%s] Leaving filesource (live) thread\n", name);
-	g_free(name);
-	g_free(buf);
-	fclose(audio);
-	g_thread_unref(g_thread_self());
-	return NULL;
+	source->rtsp_batch = batch;
+	source->rtsp_received = 0;
+	curl_easy_setopt(source->curl, CURLOPT_RTSP_REQUEST, (long)CURL_RTSPREQ_RECEIVE);
+	int res = curl_easy_perform(source->curl);
+	source->rtsp_batch = NULL;
+	int count = source->rtsp_received;
+	janus_mutex_unlock(&source->rtsp_mutex);
+	if(res != CURLE_OK) {
+		JANUS_LOG(LOG_WARN, "[%s] Error reading from the RTSP connection: %s\n", mp->name, curl_easy_strerror(res));
+		return -1;
+	}
+	int m = 0;
+	for(m=0; m<count; m++) {
+		if((batch->kinds[m] == JANUS_STREAMING_KIND_AUDIO && !mp->audio) ||
+				(batch->kinds[m] == JANUS_STREAMING_KIND_VIDEO && !mp->video))
+			batch->kinds[m] = -1;
+	}
+	return count;
 }
+#endif
 
 /* FIXME Test thread to relay RTP frames coming from gstreamer/ffmpeg/others */
 static void *janus_streaming_relay_thread(void *data) {
@@ -4666,22 +5711,24 @@ static void *janus_streaming_relay_thread(void *data) {
 	int audio_fd = source->audio_fd;
 	int video_fd[3] = {source->video_fd[0], source->video_fd[1], source->video_fd[2]};
 	int data_fd = source->data_fd;
+	int cascade_fd = source->cascade_fd;
+	int rtsp_fd = -1;
 	char *name = g_strdup(mountpoint->name ? mountpoint->name : "??");
+	janus_affinity_pin_thread(janus_affinity_group_node(mountpoint->id));
 	/* Needed to fix seq and ts */
 	uint32_t ssrc = 0, a_last_ssrc = 0, v_last_ssrc[3] = {0, 0, 0};
 	/* File descriptors */
-	socklen_t addrlen;
-	struct sockaddr_in remote;
 	int resfd = 0, bytes = 0;
-	struct pollfd fds[5];
-	char buffer[1500];
-	memset(buffer, 0, 1500);
+	struct pollfd fds[7];
+	/* We read as many packets as we can each time poll wakes us up */
+	janus_streaming_recv_batch *batch = janus_streaming_recv_batch_create();
 #ifdef HAVE_LIBCURL
 	/* In case this is an RTSP restreamer, we may have to send keep-alives from time to time */
 	gint64 now = janus_get_monotonic_time(), before = now, ka_timeout = 0;
 	if(source->rtsp) {
 		source->reconnect_timer = now;
 		ka_timeout = ((gint64)source->ka_timeout*G_USEC_PER_SEC)/2;
+		rtsp_fd = source->rtsp_fd;
 	}
 #endif
 	/* Loop */
@@ -4691,84 +5738,71 @@ static void *janus_streaming_relay_thread(void *data) {
 #ifdef HAVE_LIBCURL
 		/* Let's check regularly if the RTSP server seems to be gone */
 		if(source->rtsp) {
-			if(source->reconnecting) {
-				/* We're still reconnecting, wait some more */
-				g_usleep(250000);
-				continue;
-			}
 			now = janus_get_monotonic_time();
-			if(!source->reconnecting && (now - source->reconnect_timer > 5*G_USEC_PER_SEC)) {
-				/* 5 seconds passed and no media? Assume the RTSP server has gone and schedule a reconnect */
-				JANUS_LOG(LOG_WARN, "[%s] %"SCNi64"s passed with no media, trying to reconnect the RTSP stream\n",
-					name, (now - source->reconnect_timer)/G_USEC_PER_SEC);
+			if(source->reconnect_next == 0 && (source->curl == NULL || source->reconnect_timer == 0 ||
+					now - source->reconnect_timer > 5*G_USEC_PER_SEC)) {
+				/* No media for 5 seconds (or the connection dropped)? Assume the RTSP server
+				 * has gone, and try to reconnect right away: we only back off if that fails */
+				if(source->curl != NULL) {
+					JANUS_LOG(LOG_WARN, "[%s] %s, trying to reconnect the RTSP stream\n", name,
+						source->reconnect_timer == 0 ? "RTSP connection lost" : "No media for 5 seconds");
+				}
 				audio_fd = -1;
 				video_fd[0] = -1;
 				video_fd[1] = -1;
 				video_fd[2] = -1;
 				data_fd = -1;
-				source->reconnect_timer = now;
+				rtsp_fd = -1;
+				janus_streaming_rtsp_disconnect(source);
+				source->reconnect_attempts = 0;
+				source->reconnect_next = now;
+			}
+			if(source->reconnect_next > 0 && now >= source->reconnect_next) {
+				/* Now let's try to (re)connect */
 				source->reconnecting = TRUE;
-				/* Let's clean up the source first */
-				curl_easy_cleanup(source->curl);
-				source->curl = NULL;
-				if(source->curldata)
-					g_free(source->curldata->buffer);
-				g_free(source->curldata);
-				source->curldata = NULL;
-				if(source->audio_fd > -1) {
-					close(source->audio_fd);
-				}
-				source->audio_fd = -1;
-				if(source->video_fd[0] > -1) {
-					close(source->video_fd[0]);
-				}
-				source->video_fd[0] = -1;
-				if(source->video_fd[1] > -1) {
-					close(source->video_fd[1]);
-				}
-				source->video_fd[1] = -1;
-				if(source->video_fd[2] > -1) {
-					close(source->video_fd[2]);
-				}
-				source->video_fd[2] = -1;
-				if(source->data_fd > -1) {
-					close(source->data_fd);
+				int res = janus_streaming_rtsp_connect_to_server(mountpoint);
+				if(res < 0) {
+					JANUS_LOG(LOG_WARN, "[%s] Reconnection of the RTSP stream failed\n", name);
+				} else if((res = janus_streaming_rtsp_play(source)) < 0) {
+					JANUS_LOG(LOG_WARN, "[%s] RTSP PLAY failed\n", name);
+					janus_streaming_rtsp_disconnect(source);
 				}
-				source->data_fd = -1;
-				if(source->audio_rtcp_fd > -1) {
-					close(source->audio_rtcp_fd);
-				}
-				source->audio_rtcp_fd = -1;
-				if(source->video_rtcp_fd > -1) {
-					close(source->video_rtcp_fd);
-				}
-				source->video_rtcp_fd = -1;
-				/* Now let's try to reconnect */
-				if(janus_streaming_rtsp_connect_to_server(mountpoint) < 0) {
-					/* Reconnection failed? Let's try again later */
-					JANUS_LOG(LOG_WARN, "[%s] Reconnection of the RTSP stream failed, trying again in a few seconds...\n", name);
+				now = janus_get_monotonic_time();
+				if(res < 0) {
+					/* Try again later, waiting longer and longer */
+					gint64 delay = (gint64)JANUS_STREAMING_RTSP_BACKOFF_MIN << MIN(source->reconnect_attempts, 10);
+					if(delay > JANUS_STREAMING_RTSP_BACKOFF_MAX)
+						delay = JANUS_STREAMING_RTSP_BACKOFF_MAX;
+					source->reconnect_attempts++;
+					source->reconnect_next = now + delay;
+					JANUS_LOG(LOG_WARN, "[%s] Trying to reconnect again in %"SCNi64"ms (attempt #%d)\n",
+						name, delay/1000, source->reconnect_attempts+1);
 				} else {
-					/* We're connected, let's send a PLAY */
-					if(janus_streaming_rtsp_play(source) < 0) {
-						/* Error trying to play? Let's try again later */
-						JANUS_LOG(LOG_WARN, "[%s] RTSP PLAY failed, trying again in a few seconds...\n", name);
-					} else {
-						/* Everything should be back to normal, let's update the file descriptors */
-						JANUS_LOG(LOG_INFO, "[%s] Reconnected to the RTSP server, streaming again\n", name);
-						audio_fd = source->audio_fd;
-						video_fd[0] = source->video_fd[0];
-						data_fd = source->data_fd;
-						ka_timeout = ((gint64)source->ka_timeout*G_USEC_PER_SEC)/2;
-					}
+					/* Everything should be back to normal, let's update the file descriptors */
+					JANUS_LOG(LOG_INFO, "[%s] Connected to the RTSP server, streaming%s\n", name,
+						source->rtsp_tcp ? " (RTP over TCP)" : "");
+					audio_fd = source->audio_fd;
+					video_fd[0] = source->video_fd[0];
+					data_fd = source->data_fd;
+					rtsp_fd = source->rtsp_fd;
+					ka_timeout = ((gint64)source->ka_timeout*G_USEC_PER_SEC)/2;
+					before = now;
+					source->reconnect_next = 0;
+					source->reconnect_attempts = 0;
+					source->reconnect_timer = now;
 				}
-				source->reconnect_timer = janus_get_monotonic_time();
 				source->reconnecting = FALSE;
+			}
+			if(source->reconnect_next > 0) {
+				/* Still waiting to reconnect */
+				gint64 wait = source->reconnect_next - now;
+				g_usleep(wait < 250000 ? (wait > 0 ? wait : 0) : 250000);
 				continue;
 			}
 		}
-		if(audio_fd < 0 && video_fd[0] < 0 && video_fd[1] < 0 && video_fd[2] < 0 && data_fd < 0) {
+		if(audio_fd < 0 && video_fd[0] < 0 && video_fd[1] < 0 && video_fd[2] < 0 && data_fd < 0 && cascade_fd < 0 && rtsp_fd < 0) {
 			/* No socket, we may be in the process of reconnecting, or waiting to reconnect */
-			g_usleep(5000000);
+			g_usleep(250000);
 			continue;
 		}
 		/* We may also need to occasionally send a GET_PARAMETER request as a keep-alive */
@@ -4788,6 +5822,9 @@ static void *janus_streaming_relay_thread(void *data) {
 				resfd = curl_easy_perform(source->curl);
 				if(resfd != CURLE_OK) {
 					JANUS_LOG(LOG_ERR, "[%s] Couldn't send GET_PARAMETER request: %s\n", name, curl_easy_strerror(resfd));
+					/* If media is interleaved, there's no point waiting for it to stop */
+					if(source->rtsp_tcp)
+						source->reconnect_timer = 0;
 				}
 				janus_mutex_unlock(&source->rtsp_mutex);
 			}
@@ -4825,6 +5862,20 @@ static void *janus_streaming_relay_thread(void *data) {
 			fds[num].revents = 0;
 			num++;
 		}
+		if(cascade_fd != -1) {
+			/* Keep our subscription to the origin alive */
+			janus_streaming_cascade_refresh(mountpoint);
+			fds[num].fd = cascade_fd;
+			fds[num].events = POLLIN;
+			fds[num].revents = 0;
+			num++;
+		}
+		if(rtsp_fd != -1) {
+			fds[num].fd = rtsp_fd;
+			fds[num].events = POLLIN;
+			fds[num].revents = 0;
+			num++;
+		}
 		/* Wait for some data */
 		resfd = poll(fds, num, 1000);
 		if(resfd < 0) {
@@ -4841,306 +5892,281 @@ static void *janus_streaming_relay_thread(void *data) {
 		}
 		int i = 0;
 		for(i=0; i<num; i++) {
-			if(fds[i].revents & (POLLERR | POLLHUP)) {
+			if(cascade_fd != -1 && fds[i].fd == cascade_fd && (fds[i].revents & POLLERR)) {
+				/* The origin may just not be there (yet): clear the error and keep on trying */
+				int error = 0;
+				socklen_t errlen = sizeof(error);
+				getsockopt(cascade_fd, SOL_SOCKET, SO_ERROR, &error, &errlen);
+				if(source->cascade_ok) {
+					JANUS_LOG(LOG_WARN, "[%s] Error on the cascade socket, origin gone? %d (%s)\n", name, error, strerror(error));
+					source->cascade_ok = FALSE;
+				}
+				continue;
+#ifdef HAVE_LIBCURL
+			} else if(rtsp_fd != -1 && fds[i].fd == rtsp_fd && (fds[i].revents & (POLLERR | POLLHUP))) {
+				/* The RTSP server closed the connection: reconnect, rather than disabling the mountpoint */
+				JANUS_LOG(LOG_WARN, "[%s] Error on the RTSP connection: %s\n", name,
+					fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
+				rtsp_fd = -1;
+				source->reconnect_timer = 0;
+				break;
+#endif
+			} else if(fds[i].revents & (POLLERR | POLLHUP)) {
 				/* Socket error? */
 				JANUS_LOG(LOG_ERR, "[%s] Error polling: %s... %d (%s)\n", name,
 					fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP", errno, strerror(errno));
 				mountpoint->enabled = FALSE;
 				break;
 			} else if(fds[i].revents & POLLIN) {
-				/* Got an RTP or data packet */
-				if(audio_fd != -1 && fds[i].fd == audio_fd) {
-					/* Got something audio (RTP) */
-					if(mountpoint->active == FALSE)
-						mountpoint->active = TRUE;
-					gint64 now = janus_get_monotonic_time();
-					gint64 real_time = janus_get_real_time();
+				/* Got RTP or data packets: when cascading, they all come from the same socket */
+				int count = 0, kind = -1, kinds = 0, m = 0;
+				if(cascade_fd != -1 && fds[i].fd == cascade_fd) {
+					count = janus_streaming_cascade_read(mountpoint, batch);
 #ifdef HAVE_LIBCURL
-					source->reconnect_timer = now;
-#endif
-					addrlen = sizeof(remote);
-					bytes = recvfrom(audio_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					ssrc = ntohl(rtp->ssrc);
-					if(source->rtp_collision > 0 && a_last_ssrc && ssrc != a_last_ssrc &&
-							(now-source->last_received_audio) < (gint64)1000*source->rtp_collision) {
-						JANUS_LOG(LOG_WARN, "[%s] RTP collision on audio mountpoint, dropping packet (ssrc=%u)\n", name, ssrc);
-						continue;
-					}
-					source->last_received_audio = now;
-					//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the audio channel...\n", bytes);
-					/* If paused, ignore this packet */
-					if(!mountpoint->enabled)
-						continue;
-					/* Is this SRTP? */
-					if(source->is_srtp) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
-						//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-						if(res != srtp_err_status_ok) {
-							guint32 timestamp = ntohl(rtp->timestamp);
-							guint16 seq = ntohs(rtp->seq_number);
-							JANUS_LOG(LOG_ERR, "[%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
-						//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
-					/* Relay on all sessions */
-					packet.data = rtp;
-					packet.length = bytes;
-					packet.is_rtp = TRUE;
-					packet.is_video = FALSE;
-					packet.is_keyframe = FALSE;
-					/* Do we have a new stream? */
-					if(ssrc != a_last_ssrc) {
-						a_last_ssrc = ssrc;
-						JANUS_LOG(LOG_INFO, "[%s] New audio stream! (ssrc=%u)\n", name, a_last_ssrc);
-					}
-					packet.data->type = mountpoint->codecs.audio_pt;
-					/* Is there a recorder? */
-					janus_rtp_header_update(packet.data, &source->context[0], FALSE, 0);
-					if (source->askew) {
-						int ret = janus_rtp_skew_compensate_audio(packet.data, &source->context[0], real_time);
-						if (ret < 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, audio source clock is too fast (ssrc=%u)\n", name, -ret, a_last_ssrc);
-							continue;
-						} else if (ret > 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, audio source clock is too slow (ssrc=%u)\n", name, ret, a_last_ssrc);
-						}
+				} else if(rtsp_fd != -1 && fds[i].fd == rtsp_fd) {
+					/* RTP interleaved on the RTSP connection */
+					count = janus_streaming_rtsp_read(mountpoint, batch);
+					if(count < 0) {
+						rtsp_fd = -1;
+						source->reconnect_timer = 0;
+						break;
 					}
-					packet.data->ssrc = ntohl((uint32_t)mountpoint->id);
-					janus_recorder_save_frame(source->arc, buffer, bytes);
-					packet.data->ssrc = ssrc;
-					/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
-					packet.timestamp = ntohl(packet.data->timestamp);
-					packet.seq_number = ntohs(packet.data->seq_number);
-					/* Go! */
-					janus_mutex_lock(&mountpoint->mutex);
-					g_list_foreach(mountpoint->listeners, janus_streaming_relay_rtp_packet, &packet);
-					janus_mutex_unlock(&mountpoint->mutex);
-					continue;
-				} else if((video_fd[0] != -1 && fds[i].fd == video_fd[0]) ||
-						(video_fd[1] != -1 && fds[i].fd == video_fd[1]) ||
-						(video_fd[2] != -1 && fds[i].fd == video_fd[2])) {
-					/* Got something video (RTP) */
-					int index = -1;
-					if(fds[i].fd == video_fd[0])
-						index = 0;
+#endif
+				} else {
+					if(fds[i].fd == audio_fd)
+						kind = JANUS_STREAMING_KIND_AUDIO;
+					else if(fds[i].fd == video_fd[0])
+						kind = JANUS_STREAMING_KIND_VIDEO;
 					else if(fds[i].fd == video_fd[1])
-						index = 1;
+						kind = JANUS_STREAMING_KIND_VIDEO + 1;
 					else if(fds[i].fd == video_fd[2])
-						index = 2;
-					if(mountpoint->active == FALSE)
-						mountpoint->active = TRUE;
-					gint64 now = janus_get_monotonic_time();
-					gint64 real_time = janus_get_real_time();
+						kind = JANUS_STREAMING_KIND_VIDEO + 2;
+					else if(fds[i].fd == data_fd)
+						kind = JANUS_STREAMING_KIND_DATA;
+					count = janus_streaming_recv_batch_read(fds[i].fd, batch);
+					for(m=0; m<count; m++)
+						batch->kinds[m] = kind;
+				}
+				/* Handle what we got one kind at a time */
+				for(m=0; m<count; m++) {
+					if(batch->kinds[m] >= 0)
+						kinds |= (1 << batch->kinds[m]);
+				}
+				for(kind=JANUS_STREAMING_KIND_AUDIO; kind<=JANUS_STREAMING_KIND_DATA; kind++) {
+					if(!(kinds & (1 << kind)))
+						continue;
+					if(kind == JANUS_STREAMING_KIND_AUDIO) {
+						/* Got something audio (RTP) */
+						if(mountpoint->active == FALSE)
+							mountpoint->active = TRUE;
+						gint64 now = janus_get_monotonic_time();
+						gint64 real_time = janus_get_real_time();
 #ifdef HAVE_LIBCURL
-					source->reconnect_timer = now;
+						source->reconnect_timer = now;
 #endif
-					addrlen = sizeof(remote);
-					bytes = recvfrom(fds[i].fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
-						continue;
-					}
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					ssrc = ntohl(rtp->ssrc);
-					if(source->rtp_collision > 0 && v_last_ssrc[index] && ssrc != v_last_ssrc[index] &&
-							(now-source->last_received_video) < (gint64)1000*source->rtp_collision) {
-						JANUS_LOG(LOG_WARN, "[%s] RTP collision on video mountpoint, dropping packet (ssrc=%u)\n", name, ssrc);
-						continue;
-					}
-					source->last_received_video = now;
-					//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the video channel...\n", bytes);
-					/* Is this SRTP? */
-					if(source->is_srtp) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
-						//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-						if(res != srtp_err_status_ok) {
-							guint32 timestamp = ntohl(rtp->timestamp);
-							guint16 seq = ntohs(rtp->seq_number);
-							JANUS_LOG(LOG_ERR, "[%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
+						for(m=0; m<count; m++) {
+							if(batch->kinds[m] != kind)
+								continue;
+							char *buffer = batch->buffers[m];
+							bytes = batch->lengths[m];
+							janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+							ssrc = ntohl(rtp->ssrc);
+							if(source->rtp_collision > 0 && a_last_ssrc && ssrc != a_last_ssrc &&
+									(now-source->last_received_audio) < (gint64)1000*source->rtp_collision) {
+								JANUS_LOG(LOG_WARN, "[%s] RTP collision on audio mountpoint, dropping packet (ssrc=%u)\n", name, ssrc);
+								continue;
+							}
+							source->last_received_audio = now;
+							//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the audio channel...\n", bytes);
+							/* If paused, ignore this packet */
+							if(!mountpoint->enabled)
+								continue;
+							/* Is this SRTP? */
+							if(source->is_srtp) {
+								int buflen = bytes;
+								srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
+								//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+								if(res != srtp_err_status_ok) {
+									guint32 timestamp = ntohl(rtp->timestamp);
+									guint16 seq = ntohs(rtp->seq_number);
+									JANUS_LOG(LOG_ERR, "[%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+										name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+									continue;
+								}
+								bytes = buflen;
+							}
+							//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
+								//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
+							/* Relay on all sessions */
+							packet.data = rtp;
+							packet.length = bytes;
+							packet.is_rtp = TRUE;
+							packet.is_video = FALSE;
+							packet.is_keyframe = FALSE;
+							/* Do we have a new stream? */
+							if(ssrc != a_last_ssrc) {
+								a_last_ssrc = ssrc;
+								JANUS_LOG(LOG_INFO, "[%s] New audio stream! (ssrc=%u)\n", name, a_last_ssrc);
+							}
+							packet.data->type = mountpoint->codecs.audio_pt;
+							/* Is there a recorder? */
+							janus_rtp_header_update(packet.data, &source->context[0], FALSE, 0);
+							if (source->askew) {
+								int ret = janus_rtp_skew_compensate_audio(packet.data, &source->context[0], real_time);
+								if (ret < 0) {
+									JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, audio source clock is too fast (ssrc=%u)\n", name, -ret, a_last_ssrc);
+									continue;
+								} else if (ret > 0) {
+									JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, audio source clock is too slow (ssrc=%u)\n", name, ret, a_last_ssrc);
+								}
+							}
+							packet.data->ssrc = ntohl((uint32_t)mountpoint->id);
+							janus_recorder_save_frame(source->arc, buffer, bytes);
+							packet.data->ssrc = ssrc;
+							/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
+							packet.timestamp = ntohl(packet.data->timestamp);
+							packet.seq_number = ntohs(packet.data->seq_number);
+							/* Go! */
+							janus_mutex_lock(&mountpoint->mutex);
+							janus_streaming_relay_to_mountpoint(mountpoint, &packet);
+							janus_mutex_unlock(&mountpoint->mutex);
 						}
-						bytes = buflen;
-					}
-					/* First of all, let's check if this is (part of) a keyframe that we may need to save it for future reference */
-					if(source->keyframe.enabled) {
-						if(source->keyframe.temp_ts > 0 && ntohl(rtp->timestamp) != source->keyframe.temp_ts) {
-							/* We received the last part of the keyframe, get rid of the old one and use this from now on */
-							JANUS_LOG(LOG_HUGE, "[%s] ... ... last part of keyframe received! ts=%"SCNu32", %d packets\n",
-								name, source->keyframe.temp_ts, g_list_length(source->keyframe.temp_keyframe));
-							source->keyframe.temp_ts = 0;
-							janus_mutex_lock(&source->keyframe.mutex);
-							GList *temp = NULL;
-							while(source->keyframe.latest_keyframe) {
-								temp = g_list_first(source->keyframe.latest_keyframe);
-								source->keyframe.latest_keyframe = g_list_remove_link(source->keyframe.latest_keyframe, temp);
-								janus_streaming_rtp_relay_packet *pkt = (janus_streaming_rtp_relay_packet *)temp->data;
-								g_free(pkt->data);
-								g_free(pkt);
-								g_list_free(temp);
+						continue;
+					} else if(kind >= JANUS_STREAMING_KIND_VIDEO && kind < JANUS_STREAMING_KIND_VIDEO+3) {
+						/* Got something video (RTP) */
+						int index = kind - JANUS_STREAMING_KIND_VIDEO;
+						if(mountpoint->active == FALSE)
+							mountpoint->active = TRUE;
+						gint64 now = janus_get_monotonic_time();
+						gint64 real_time = janus_get_real_time();
+#ifdef HAVE_LIBCURL
+						source->reconnect_timer = now;
+#endif
+						for(m=0; m<count; m++) {
+							if(batch->kinds[m] != kind)
+								continue;
+							char *buffer = batch->buffers[m];
+							bytes = batch->lengths[m];
+							janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+							ssrc = ntohl(rtp->ssrc);
+							if(source->rtp_collision > 0 && v_last_ssrc[index] && ssrc != v_last_ssrc[index] &&
+									(now-source->last_received_video) < (gint64)1000*source->rtp_collision) {
+								JANUS_LOG(LOG_WARN, "[%s] RTP collision on video mountpoint, dropping packet (ssrc=%u)\n", name, ssrc);
+								continue;
 							}
-							source->keyframe.latest_keyframe = source->keyframe.temp_keyframe;
-							source->keyframe.temp_keyframe = NULL;
-							janus_mutex_unlock(&source->keyframe.mutex);
-						} else if(ntohl(rtp->timestamp) == source->keyframe.temp_ts) {
-							/* Part of the keyframe we're currently saving, store */
-							janus_mutex_lock(&source->keyframe.mutex);
-							JANUS_LOG(LOG_HUGE, "[%s] ... other part of keyframe received! ts=%"SCNu32"\n", name, source->keyframe.temp_ts);
-							janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
-							pkt->data = g_malloc(bytes);
-							memcpy(pkt->data, buffer, bytes);
-							pkt->data->ssrc = htons(1);
-							pkt->data->type = mountpoint->codecs.video_pt;
+							source->last_received_video = now;
+							//~ JANUS_LOG(LOG_VERB, "************************\nGot %d bytes on the video channel...\n", bytes);
+							/* Is this SRTP? */
+							if(source->is_srtp) {
+								int buflen = bytes;
+								srtp_err_status_t res = srtp_unprotect(source->srtp_ctx, buffer, &buflen);
+								//~ if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+								if(res != srtp_err_status_ok) {
+									guint32 timestamp = ntohl(rtp->timestamp);
+									guint16 seq = ntohs(rtp->seq_number);
+									JANUS_LOG(LOG_ERR, "[%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+										name, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+									continue;
+								}
+								bytes = buflen;
+							}
+							/* Inspect the packet once, if the keyframe cache or simulcast listeners will need to know what's in there */
+							if(source->keyframe.enabled || source->simulcast)
+								janus_streaming_video_inspect(mountpoint, buffer, bytes, &packet.video);
+							else
+								memset(&packet.video, 0, sizeof(packet.video));
+							/* First of all, let's check if this is (part of) a keyframe that we may need to save it for future reference */
+							if(source->keyframe.enabled)
+								janus_streaming_rtp_keyframe_store(mountpoint, index, buffer, bytes, &packet.video);
+							/* If paused, ignore this packet */
+							if(!mountpoint->enabled)
+								continue;
+							//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
+								//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
+							/* Relay on all sessions */
+							packet.data = rtp;
+							packet.length = bytes;
 							packet.is_rtp = TRUE;
 							packet.is_video = TRUE;
-							packet.is_keyframe = TRUE;
-							pkt->length = bytes;
-							pkt->timestamp = source->keyframe.temp_ts;
-							pkt->seq_number = ntohs(rtp->seq_number);
-							source->keyframe.temp_keyframe = g_list_append(source->keyframe.temp_keyframe, pkt);
-							janus_mutex_unlock(&source->keyframe.mutex);
-						} else {
-							gboolean kf = FALSE;
-							/* Parse RTP header first */
-							janus_rtp_header *header = (janus_rtp_header *)buffer;
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_HUGE, "Checking if packet (size=%d, seq=%"SCNu16", ts=%"SCNu32") is a key frame...\n",
-								bytes, seq, timestamp);
-							int plen = 0;
-							char *payload = janus_rtp_payload(buffer, bytes, &plen);
-							if(payload) {
-								switch(mountpoint->codecs.video_codec) {
-									case JANUS_STREAMING_VP8:
-										kf = janus_vp8_is_keyframe(payload, plen);
-										break;
-									case JANUS_STREAMING_VP9:
-										kf = janus_vp9_is_keyframe(payload, plen);
-										break;
-									case JANUS_STREAMING_H264:
-										kf = janus_h264_is_keyframe(payload, plen);
-										break;
-									default:
-										break;
-								}
-								if(kf) {
-									/* New keyframe, start saving it */
-									source->keyframe.temp_ts = ntohl(rtp->timestamp);
-									JANUS_LOG(LOG_HUGE, "[%s] New keyframe received! ts=%"SCNu32"\n", name, source->keyframe.temp_ts);
-									janus_mutex_lock(&source->keyframe.mutex);
-									janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
-									pkt->data = g_malloc(bytes);
-									memcpy(pkt->data, buffer, bytes);
-									pkt->data->ssrc = htons(1);
-									pkt->data->type = mountpoint->codecs.video_pt;
-									packet.is_rtp = TRUE;
-									packet.is_video = TRUE;
-									packet.is_keyframe = TRUE;
-									pkt->length = bytes;
-									pkt->timestamp = source->keyframe.temp_ts;
-									pkt->seq_number = ntohs(rtp->seq_number);
-									source->keyframe.temp_keyframe = g_list_append(source->keyframe.temp_keyframe, pkt);
-									janus_mutex_unlock(&source->keyframe.mutex);
+							packet.is_keyframe = FALSE;
+							packet.simulcast = source->simulcast;
+							packet.substream = index;
+							if(source->simulcast_auto)
+								janus_simulcast_bitrates_update(&source->sc_bitrates, index, bytes, janus_get_monotonic_time());
+							packet.codec = mountpoint->codecs.video_codec;
+							/* Do we have a new stream? */
+							if(ssrc != v_last_ssrc[index]) {
+								v_last_ssrc[index] = ssrc;
+								JANUS_LOG(LOG_INFO, "[%s] New video stream! (ssrc=%u, index %d)\n", name, v_last_ssrc[index], index);
+							}
+							packet.data->type = mountpoint->codecs.video_pt;
+							/* Is there a recorder? (FIXME notice we only record the first substream, if simulcasting) */
+							janus_rtp_header_update(packet.data, &source->context[index], TRUE, 0);
+							if (source->vskew) {
+								int ret = janus_rtp_skew_compensate_video(packet.data, &source->context[index], real_time);
+								if (ret < 0) {
+									JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, video source clock is too fast (ssrc=%u, index %d)\n", name, -ret, v_last_ssrc[index], index);
+									continue;
+								} else if (ret > 0) {
+									JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, video source clock is too slow (ssrc=%u, index %d)\n", name, ret, v_last_ssrc[index], index);
 								}
 							}
+							if(index == 0) {
+								packet.data->ssrc = ntohl((uint32_t)mountpoint->id);
+								janus_recorder_save_frame(source->vrc, buffer, bytes);
+								packet.data->ssrc = ssrc;
+							}
+							/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
+							packet.timestamp = ntohl(packet.data->timestamp);
+							packet.seq_number = ntohs(packet.data->seq_number);
+							/* Go! */
+							janus_mutex_lock(&mountpoint->mutex);
+							janus_streaming_relay_to_mountpoint(mountpoint, &packet);
+							janus_mutex_unlock(&mountpoint->mutex);
 						}
-					}
-					/* If paused, ignore this packet */
-					if(!mountpoint->enabled)
 						continue;
-					//~ JANUS_LOG(LOG_VERB, " ... parsed RTP packet (ssrc=%u, pt=%u, seq=%u, ts=%u)...\n",
-						//~ ntohl(rtp->ssrc), rtp->type, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
-					/* Relay on all sessions */
-					packet.data = rtp;
-					packet.length = bytes;
-					packet.is_rtp = TRUE;
-					packet.is_video = TRUE;
-					packet.is_keyframe = FALSE;
-					packet.simulcast = source->simulcast;
-					packet.substream = index;
-					packet.codec = mountpoint->codecs.video_codec;
-					/* Do we have a new stream? */
-					if(ssrc != v_last_ssrc[index]) {
-						v_last_ssrc[index] = ssrc;
-						JANUS_LOG(LOG_INFO, "[%s] New video stream! (ssrc=%u, index %d)\n", name, v_last_ssrc[index], index);
-					}
-					packet.data->type = mountpoint->codecs.video_pt;
-					/* Is there a recorder? (FIXME notice we only record the first substream, if simulcasting) */
-					janus_rtp_header_update(packet.data, &source->context[index], TRUE, 0);
-					if (source->vskew) {
-						int ret = janus_rtp_skew_compensate_video(packet.data, &source->context[index], real_time);
-						if (ret < 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Dropping %d packets, video source clock is too fast (ssrc=%u, index %d)\n", name, -ret, v_last_ssrc[index], index);
-							continue;
-						} else if (ret > 0) {
-							JANUS_LOG(LOG_WARN, "[%s] Jumping %d RTP sequence numbers, video source clock is too slow (ssrc=%u, index %d)\n", name, ret, v_last_ssrc[index], index);
-						}
-					}
-					if(index == 0) {
-						packet.data->ssrc = ntohl((uint32_t)mountpoint->id);
-						janus_recorder_save_frame(source->vrc, buffer, bytes);
-						packet.data->ssrc = ssrc;
-					}
-					/* Backup the actual timestamp and sequence number set by the restreamer, in case switching is involved */
-					packet.timestamp = ntohl(packet.data->timestamp);
-					packet.seq_number = ntohs(packet.data->seq_number);
-					/* Go! */
-					janus_mutex_lock(&mountpoint->mutex);
-					g_list_foreach(mountpoint->listeners, janus_streaming_relay_rtp_packet, &packet);
-					janus_mutex_unlock(&mountpoint->mutex);
-					continue;
-				} else if(data_fd != -1 && fds[i].fd == data_fd) {
-					/* Got something data (text) */
-					if(mountpoint->active == FALSE)
-						mountpoint->active = TRUE;
-					source->last_received_data = janus_get_monotonic_time();
+					} else if(kind == JANUS_STREAMING_KIND_DATA) {
+						/* Got something data (text) */
+						if(mountpoint->active == FALSE)
+							mountpoint->active = TRUE;
+						source->last_received_data = janus_get_monotonic_time();
 #ifdef HAVE_LIBCURL
-					source->reconnect_timer = janus_get_monotonic_time();
+						source->reconnect_timer = janus_get_monotonic_time();
 #endif
-					addrlen = sizeof(remote);
-					bytes = recvfrom(data_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0) {
-						/* Failed to read? */
+						for(m=0; m<count; m++) {
+							if(batch->kinds[m] != kind)
+								continue;
+							char *buffer = batch->buffers[m];
+							bytes = batch->lengths[m];
+							/* Get a string out of the data */
+							char *text = g_malloc(bytes+1);
+							memcpy(text, buffer, bytes);
+							*(text+bytes) = '\0';
+							/* Relay on all sessions */
+							packet.data = (janus_rtp_header *)text;
+							packet.length = bytes+1;
+							packet.is_rtp = FALSE;
+							/* Is there a recorder? */
+							janus_recorder_save_frame(source->drc, text, strlen(text));
+							/* Are we keeping track of the last message being relayed? */
+							if(source->buffermsg) {
+								janus_mutex_lock(&source->buffermsg_mutex);
+								janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
+								pkt->data = g_malloc(bytes+1);
+								memcpy(pkt->data, text, bytes+1);
+								packet.is_rtp = FALSE;
+								pkt->length = bytes+1;
+								janus_mutex_unlock(&source->buffermsg_mutex);
+							}
+							/* Go! */
+							janus_mutex_lock(&mountpoint->mutex);
+							janus_streaming_relay_to_mountpoint(mountpoint, &packet);
+							janus_mutex_unlock(&mountpoint->mutex);
+							packet.data = NULL;
+							g_free(text);
+						}
 						continue;
 					}
-					/* Get a string out of the data */
-					char *text = g_malloc(bytes+1);
-					memcpy(text, buffer, bytes);
-					*(text+bytes) = '\0';
-					/* Relay on all sessions */
-					packet.data = (janus_rtp_header *)text;
-					packet.length = bytes+1;
-					packet.is_rtp = FALSE;
-					/* Is there a recorder? */
-					janus_recorder_save_frame(source->drc, text, strlen(text));
-					/* Are we keeping track of the last message being relayed? */
-					if(source->buffermsg) {
-						janus_mutex_lock(&source->buffermsg_mutex);
-						janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
-						pkt->data = g_malloc(bytes+1);
-						memcpy(pkt->data, text, bytes+1);
-						packet.is_rtp = FALSE;
-						pkt->length = bytes+1;
-						janus_mutex_unlock(&source->buffermsg_mutex);
-					}
-					/* Go! */
-					janus_mutex_lock(&mountpoint->mutex);
-					g_list_foreach(mountpoint->listeners, janus_streaming_relay_rtp_packet, &packet);
-					janus_mutex_unlock(&mountpoint->mutex);
-					packet.data = NULL;
-					g_free(text);
-					continue;
 				}
 			}
 		}
@@ -5166,18 +6192,570 @@ static void *janus_streaming_relay_thread(void *data) {
 			gateway->push_event(session->handle, &janus_streaming_plugin, NULL, event, NULL);
 			gateway->close_pc(session->handle);
 		}
-		mountpoint->listeners = g_list_remove_all(mountpoint->listeners, session);
+		janus_streaming_listener_remove(mountpoint, session);
 		viewer = g_list_first(mountpoint->listeners);
 	}
 	json_decref(event);
 	janus_mutex_unlock(&mountpoint->mutex);
 
 	JANUS_LOG(LOG_VERB, "[%s] Leaving streaming relay thread\n", name);
+	g_free(batch);
 	g_free(name);
 	g_thread_unref(g_thread_self());
 	return NULL;
 }
 
+/* Listeners whose switching contexts are in sync (same SSRC and same
+ * offsets, which is what happens when they started watching the same
+ * stream and never switched since) would get byte-identical headers: in
+ * that case we rewrite the header once for the whole group, rather than
+ * rewriting it and restoring it again for each of them */
+static gboolean janus_streaming_contexts_in_sync(janus_rtp_switching_context *a, janus_rtp_switching_context *b, gboolean video) {
+	if(video) {
+		return !b->v_seq_reset && a->v_last_ssrc == b->v_last_ssrc &&
+			a->v_base_ts == b->v_base_ts && a->v_base_ts_prev == b->v_base_ts_prev &&
+			a->v_base_seq == b->v_base_seq && a->v_base_seq_prev == b->v_base_seq_prev;
+	}
+	return !b->a_seq_reset && a->a_last_ssrc == b->a_last_ssrc &&
+		a->a_base_ts == b->a_base_ts && a->a_base_ts_prev == b->a_base_ts_prev &&
+		a->a_base_seq == b->a_base_seq && a->a_base_seq_prev == b->a_base_seq_prev;
+}
+
+static void janus_streaming_rewrite_header(janus_streaming_session *session, janus_streaming_rtp_relay_packet *packet) {
+	janus_rtp_switching_context *context = &session->context, *synced = packet->rewritten;
+	gboolean video = packet->is_video;
+	if(synced != NULL && synced != context && janus_streaming_contexts_in_sync(synced, context, video)) {
+		/* The header is already what we'd send: just update the context as janus_rtp_header_update would */
+		if(video) {
+			context->v_prev_ts = context->v_last_ts;
+			context->v_last_ts = synced->v_last_ts;
+			context->v_prev_seq = context->v_last_seq;
+			context->v_last_seq = synced->v_last_seq;
+			context->v_last_time = synced->v_last_time;
+		} else {
+			context->a_prev_ts = context->a_last_ts;
+			context->a_last_ts = synced->a_last_ts;
+			context->a_prev_seq = context->a_last_seq;
+			context->a_last_seq = synced->a_last_seq;
+			context->a_last_time = synced->a_last_time;
+		}
+		return;
+	}
+	janus_streaming_restore_header(packet);
+	/* A listener that just started watching gets the timestamps and sequence
+	 * numbers of the source as they are, so that all new listeners are in sync */
+	if(video && context->v_last_ssrc == 0 && context->v_last_time == 0) {
+		context->v_last_ts = packet->timestamp;
+		context->v_last_seq = packet->seq_number-1;
+	} else if(!video && context->a_last_ssrc == 0 && context->a_last_time == 0) {
+		context->a_last_ts = packet->timestamp;
+		context->a_last_seq = packet->seq_number-1;
+	}
+	janus_rtp_header_update(packet->data, context, video, 0);
+	packet->rewritten = context;
+}
+
+/* Restore the timestamp and sequence number to what the source set them to */
+static void janus_streaming_restore_header(janus_streaming_rtp_relay_packet *packet) {
+	if(packet->rewritten == NULL)
+		return;
+	packet->data->timestamp = htonl(packet->timestamp);
+	packet->data->seq_number = htons(packet->seq_number);
+	packet->rewritten = NULL;
+}
+
+static void janus_streaming_relay_rtp_to_listeners(GList *listeners, janus_streaming_rtp_relay_packet *packet) {
+	packet->rewritten = NULL;
+	g_list_foreach(listeners, janus_streaming_relay_rtp_packet, packet);
+	janus_streaming_restore_header(packet);
+}
+
+/* Helper threads management */
+static void janus_streaming_shared_packet_unref(janus_streaming_shared_packet *pkt) {
+	if(pkt != NULL && pkt != &exit_packet && g_atomic_int_dec_and_test(&pkt->ref))
+		g_free(pkt);
+}
+
+static void janus_streaming_helpers_start(janus_streaming_mountpoint *mp, int threads) {
+	int i = 0;
+	for(i=0; i<threads; i++) {
+		janus_streaming_helper *helper = g_malloc0(sizeof(janus_streaming_helper));
+		helper->mp = mp;
+		helper->id = i+1;
+		helper->queued_packets = g_async_queue_new_full((GDestroyNotify)janus_streaming_shared_packet_unref);
+		janus_mutex_init(&helper->mutex);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "help %u-%"SCNu64, helper->id, mp->id);
+		helper->thread = g_thread_try_new(tname, &janus_streaming_helper_thread, helper, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "[%s] Got error %d (%s) trying to launch helper thread %d...\n",
+				mp->name, error->code, error->message ? error->message : "??", helper->id);
+			g_error_free(error);
+			g_async_queue_unref(helper->queued_packets);
+			janus_mutex_destroy(&helper->mutex);
+			g_free(helper);
+			break;
+		}
+		mp->threads = g_list_append(mp->threads, helper);
+	}
+	mp->helper_threads = g_list_length(mp->threads);
+	if(mp->helper_threads > 0)
+		JANUS_LOG(LOG_VERB, "[%s] Listeners will be split across %d helper threads\n", mp->name, mp->helper_threads);
+}
+
+static void janus_streaming_helpers_stop(janus_streaming_mountpoint *mp) {
+	janus_mutex_lock(&mp->mutex);
+	GList *threads = mp->threads;
+	mp->threads = NULL;
+	mp->helper_threads = 0;
+	janus_mutex_unlock(&mp->mutex);
+	GList *temp = threads;
+	while(temp) {
+		janus_streaming_helper *helper = (janus_streaming_helper *)temp->data;
+		g_async_queue_push(helper->queued_packets, &exit_packet);
+		g_thread_join(helper->thread);
+		g_async_queue_unref(helper->queued_packets);
+		g_list_free(helper->listeners);
+		janus_mutex_destroy(&helper->mutex);
+		g_free(helper);
+		temp = temp->next;
+	}
+	g_list_free(threads);
+}
+
+static void janus_streaming_listener_add(janus_streaming_mountpoint *mp, janus_streaming_session *session) {
+	mp->listeners = g_list_append(mp->listeners, session);
+	session->helper = NULL;
+	if(mp->threads == NULL)
+		return;
+	/* Pick the helper with the fewest listeners */
+	janus_streaming_helper *helper = NULL;
+	GList *temp = mp->threads;
+	while(temp) {
+		janus_streaming_helper *h = (janus_streaming_helper *)temp->data;
+		if(helper == NULL || h->num_listeners < helper->num_listeners)
+			helper = h;
+		temp = temp->next;
+	}
+	janus_mutex_lock(&helper->mutex);
+	helper->listeners = g_list_append(helper->listeners, session);
+	helper->num_listeners++;
+	janus_mutex_unlock(&helper->mutex);
+	session->helper = helper;
+	JANUS_LOG(LOG_VERB, "[%s] Listener assigned to helper thread %u (%d listeners)\n",
+		mp->name, helper->id, helper->num_listeners);
+}
+
+static void janus_streaming_listener_remove(janus_streaming_mountpoint *mp, janus_streaming_session *session) {
+	mp->listeners = g_list_remove_all(mp->listeners, session);
+	janus_streaming_helper *helper = session->helper;
+	if(helper == NULL || helper->mp != mp)
+		return;
+	janus_mutex_lock(&helper->mutex);
+	if(g_list_find(helper->listeners, session) != NULL) {
+		helper->listeners = g_list_remove_all(helper->listeners, session);
+		helper->num_listeners--;
+	}
+	janus_mutex_unlock(&helper->mutex);
+	session->helper = NULL;
+}
+
+/* Relay a packet to all the listeners of a mountpoint, either directly or via
+ * its helper threads: the mountpoint mutex must be locked */
+static void janus_streaming_relay_to_mountpoint(janus_streaming_mountpoint *mp, janus_streaming_rtp_relay_packet *packet) {
+	if(mp->edges != NULL)
+		janus_streaming_cascade_relay(mp, packet);
+	if(mp->threads == NULL) {
+		if(packet->is_rtp)
+			janus_streaming_relay_rtp_to_listeners(mp->listeners, packet);
+		else
+			g_list_foreach(mp->listeners, janus_streaming_relay_rtp_packet, packet);
+		return;
+	}
+	if(mp->listeners == NULL || packet->length > JANUS_STREAMING_HELPER_MTU)
+		return;
+	/* A single copy of the packet, shared by all the helpers that have listeners */
+	janus_streaming_shared_packet *pkt = NULL;
+	GList *temp = mp->threads;
+	while(temp) {
+		janus_streaming_helper *helper = (janus_streaming_helper *)temp->data;
+		temp = temp->next;
+		if(helper->num_listeners == 0)
+			continue;
+		if(pkt == NULL) {
+			pkt = g_malloc(sizeof(janus_streaming_shared_packet) + packet->length);
+			pkt->packet = *packet;
+			pkt->packet.data = (janus_rtp_header *)pkt->data;
+			pkt->packet.rewritten = NULL;
+			memcpy(pkt->data, packet->data, packet->length);
+			pkt->ref = 1;
+		} else {
+			g_atomic_int_inc(&pkt->ref);
+		}
+		g_async_queue_push(helper->queued_packets, pkt);
+	}
+}
+
+static void *janus_streaming_helper_thread(void *data) {
+	janus_streaming_helper *helper = (janus_streaming_helper *)data;
+	janus_streaming_mountpoint *mp = helper->mp;
+	JANUS_LOG(LOG_VERB, "[%s/#%u] Joining Streaming helper thread\n", mp->name, helper->id);
+	janus_affinity_pin_thread(janus_affinity_group_node(mp->id));
+	/* Listeners get their headers rewritten in place, so we relay a private copy */
+	char buffer[JANUS_STREAMING_HELPER_MTU];
+	janus_streaming_shared_packet *pkt = NULL;
+	while(!g_atomic_int_get(&stopping)) {
+		pkt = g_async_queue_pop(helper->queued_packets);
+		if(pkt == &exit_packet)
+			break;
+		janus_streaming_rtp_relay_packet packet = pkt->packet;
+		memcpy(buffer, pkt->data, packet.length);
+		packet.data = (janus_rtp_header *)buffer;
+		janus_streaming_shared_packet_unref(pkt);
+		janus_mutex_lock(&helper->mutex);
+		if(packet.is_rtp)
+			janus_streaming_relay_rtp_to_listeners(helper->listeners, &packet);
+		else
+			g_list_foreach(helper->listeners, janus_streaming_relay_rtp_packet, &packet);
+		janus_mutex_unlock(&helper->mutex);
+	}
+	JANUS_LOG(LOG_VERB, "[%s/#%u] Leaving Streaming helper thread\n", mp->name, helper->id);
+	return NULL;
+}
+
+/* Cascading helpers, origin side */
+static janus_streaming_cascade_edge *janus_streaming_cascade_edge_new(struct sockaddr_in *address) {
+	janus_streaming_cascade_edge *edge = g_malloc0(sizeof(janus_streaming_cascade_edge));
+	edge->address = *address;
+	if(cascade_srtpsuite > 0 && cascade_srtpcrypto != NULL) {
+		/* Each edge gets its own SRTP context, as it keeps track of what was sent */
+		gsize len = 0;
+		guchar *decoded = g_base64_decode(cascade_srtpcrypto, &len);
+		srtp_policy_t *policy = &edge->srtp_policy;
+		srtp_crypto_policy_set_rtp_default(&(policy->rtp));
+		if(cascade_srtpsuite == 32) {
+			srtp_crypto_policy_set_aes_cm_128_hmac_sha1_32(&(policy->rtp));
+		} else if(cascade_srtpsuite == 80) {
+			srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&(policy->rtp));
+		}
+		policy->ssrc.type = ssrc_any_outbound;
+		policy->key = decoded;
+		policy->next = NULL;
+		srtp_err_status_t res = srtp_create(&edge->srtp_ctx, policy);
+		if(res != srtp_err_status_ok) {
+			JANUS_LOG(LOG_ERR, "Error creating cascade SRTP session: %d (%s)\n", res, janus_srtp_error_str(res));
+			g_free(decoded);
+			g_free(edge);
+			return NULL;
+		}
+		edge->is_srtp = TRUE;
+	}
+	return edge;
+}
+
+static void janus_streaming_cascade_edge_free(janus_streaming_cascade_edge *edge) {
+	if(edge == NULL)
+		return;
+	if(edge->is_srtp) {
+		srtp_dealloc(edge->srtp_ctx);
+		g_free(edge->srtp_policy.key);
+	}
+	g_free(edge);
+}
+
+static janus_streaming_cascade_edge *janus_streaming_cascade_edge_find(janus_streaming_mountpoint *mp, struct sockaddr_in *address) {
+	GList *temp = mp->edges;
+	while(temp) {
+		janus_streaming_cascade_edge *edge = (janus_streaming_cascade_edge *)temp->data;
+		if(edge->address.sin_addr.s_addr == address->sin_addr.s_addr && edge->address.sin_port == address->sin_port)
+			return edge;
+		temp = temp->next;
+	}
+	return NULL;
+}
+
+/* Send a packet to an edge, followed by its kind */
+static void janus_streaming_cascade_send(janus_streaming_cascade_edge *edge, int kind, char *data, int length, gboolean rtp) {
+	char buffer[JANUS_STREAMING_HELPER_MTU];
+	if(data == NULL || length < 1 || length + SRTP_MAX_TRAILER_LEN + 1 > (int)sizeof(buffer))
+		return;
+	memcpy(buffer, data, length);
+	if(rtp && edge->is_srtp) {
+		int protected = length;
+		srtp_err_status_t res = srtp_protect(edge->srtp_ctx, buffer, &protected);
+		if(res != srtp_err_status_ok) {
+			/* This includes cached keyframes we already sent to this edge */
+			JANUS_LOG(LOG_HUGE, "Cascade SRTP protect error... %s (len=%d-->%d)\n", janus_srtp_error_str(res), length, protected);
+			return;
+		}
+		length = protected;
+	}
+	buffer[length] = kind;
+	sendto(cascade_fd, buffer, length+1, 0, (struct sockaddr *)&edge->address, sizeof(edge->address));
+}
+
+static void janus_streaming_cascade_relay(janus_streaming_mountpoint *mp, janus_streaming_rtp_relay_packet *packet) {
+	int kind = JANUS_STREAMING_KIND_DATA, length = packet->length;
+	if(packet->is_rtp) {
+		kind = packet->is_video ? JANUS_STREAMING_KIND_VIDEO + packet->substream : JANUS_STREAMING_KIND_AUDIO;
+	} else {
+		/* Data messages include the string terminator, edges will add their own */
+		length--;
+	}
+	gint64 now = janus_get_monotonic_time();
+	GList *temp = mp->edges;
+	while(temp) {
+		janus_streaming_cascade_edge *edge = (janus_streaming_cascade_edge *)temp->data;
+		GList *next = temp->next;
+		if(now - edge->last_seen > JANUS_STREAMING_CASCADE_TIMEOUT) {
+			/* This edge stopped refreshing its subscription, get rid of it */
+			char address[INET_ADDRSTRLEN];
+			JANUS_LOG(LOG_WARN, "[%s] Cascade edge %s:%d timed out, removing it\n", mp->name,
+				inet_ntop(AF_INET, &edge->address.sin_addr, address, sizeof(address)), ntohs(edge->address.sin_port));
+			mp->edges = g_list_delete_link(mp->edges, temp);
+			janus_streaming_cascade_edge_free(edge);
+		} else {
+			janus_streaming_cascade_send(edge, kind, (char *)packet->data, length, packet->is_rtp);
+		}
+		temp = next;
+	}
+}
+
+/* We can't ask RTP sources for keyframes, so we send edges the ones we cached */
+static void janus_streaming_cascade_send_keyframe(janus_streaming_mountpoint *mp, janus_streaming_cascade_edge *edge) {
+	janus_streaming_rtp_source *source = mp->source;
+	if(!source->keyframe.enabled)
+		return;
+	char buffer[JANUS_STREAMING_KEYFRAME_MTU];
+	janus_mutex_lock(&source->keyframe.mutex);
+	int index = 0, i = 0;
+	for(index=0; index<3; index++) {
+		janus_streaming_rtp_keyframe_ring *ring = source->keyframe.rings[index];
+		if(ring == NULL || ring->latest < 0)
+			continue;
+		for(i=0; i<ring->count[ring->latest]; i++) {
+			janus_streaming_rtp_relay_packet *pkt = &ring->packets[ring->latest][i];
+			/* Cached packets all have the same SSRC: make substreams distinct for SRTP */
+			memcpy(buffer, pkt->data, pkt->length);
+			((janus_rtp_header *)buffer)->ssrc = htonl(index+1);
+			janus_streaming_cascade_send(edge, JANUS_STREAMING_KIND_KEYFRAME + index, buffer, pkt->length, TRUE);
+		}
+	}
+	janus_mutex_unlock(&source->keyframe.mutex);
+}
+
+static void janus_streaming_cascade_reply(struct sockaddr_in *address, const char *reply) {
+	char buffer[256];
+	int len = g_snprintf(buffer, sizeof(buffer)-1, "%s", reply);
+	if(len > (int)sizeof(buffer)-2)
+		len = sizeof(buffer)-2;
+	buffer[len] = JANUS_STREAMING_KIND_CONTROL;
+	sendto(cascade_fd, buffer, len+1, 0, (struct sockaddr *)address, sizeof(*address));
+}
+
+static gboolean janus_streaming_cascade_is_allowed(const char *address) {
+	if(cascade_acl == NULL)
+		return TRUE;
+	GList *temp = cascade_acl;
+	while(temp) {
+		if(g_str_has_prefix(address, (const char *)temp->data))
+			return TRUE;
+		temp = temp->next;
+	}
+	return FALSE;
+}
+
+/* Cookie for an edge address, in the period before or after the current one */
+static void janus_streaming_cascade_cookie(struct sockaddr_in *address, gint64 period, char *cookie) {
+	char data[64];
+	g_snprintf(data, sizeof(data), "%08"SCNx32":%u:%"SCNi64, ntohl(address->sin_addr.s_addr),
+		ntohs(address->sin_port), period);
+	gchar *hmac = g_compute_hmac_for_string(G_CHECKSUM_SHA256, (const guchar *)cascade_secret,
+		strlen(cascade_secret), data, -1);
+	g_strlcpy(cookie, hmac, JANUS_STREAMING_CASCADE_COOKIE_LEN+1);
+	g_free(hmac);
+}
+
+static gboolean janus_streaming_cascade_cookie_check(struct sockaddr_in *address, const char *cookie) {
+	char expected[JANUS_STREAMING_CASCADE_COOKIE_LEN+1];
+	gint64 period = janus_get_monotonic_time()/JANUS_STREAMING_CASCADE_COOKIE_PERIOD;
+	janus_streaming_cascade_cookie(address, period, expected);
+	if(!strcmp(cookie, expected))
+		return TRUE;
+	janus_streaming_cascade_cookie(address, period-1, expected);
+	return !strcmp(cookie, expected);
+}
+
+static void *janus_streaming_cascade_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining Streaming cascade thread\n");
+	char buffer[256], reply[128], verb[4], cookie[JANUS_STREAMING_CASCADE_COOKIE_LEN+1], pin[128];
+	char address_str[INET_ADDRSTRLEN];
+	struct sockaddr_in address;
+	socklen_t addrlen = 0;
+	struct pollfd fds[1];
+	while(!g_atomic_int_get(&stopping)) {
+		fds[0].fd = cascade_fd;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		int res = poll(fds, 1, 1000);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "Error polling the cascade socket... %d (%s)\n", errno, strerror(errno));
+			break;
+		} else if(res == 0 || !(fds[0].revents & POLLIN)) {
+			continue;
+		}
+		addrlen = sizeof(address);
+		int bytes = recvfrom(cascade_fd, buffer, sizeof(buffer)-1, 0, (struct sockaddr *)&address, &addrlen);
+		if(bytes <= 0)
+			continue;
+		buffer[bytes] = '\0';
+		inet_ntop(AF_INET, &address.sin_addr, address_str, sizeof(address_str));
+		if(!janus_streaming_cascade_is_allowed(address_str)) {
+			JANUS_LOG(LOG_WARN, "Cascade request from %s:%d not allowed, ignoring\n", address_str, ntohs(address.sin_port));
+			continue;
+		}
+		if(bytes < JANUS_STREAMING_CASCADE_REQUEST_SIZE) {
+			/* We don't reply to requests smaller than our replies, the source may be spoofed */
+			JANUS_LOG(LOG_WARN, "Unpadded cascade request from %s:%d, ignoring\n", address_str, ntohs(address.sin_port));
+			continue;
+		}
+		/* Requests are "<verb> <mountpoint id> <cookie|-> [<pin>]" */
+		guint64 id = 0;
+		cookie[0] = '\0';
+		pin[0] = '\0';
+		if(sscanf(buffer, "%3s %"SCNu64" %32s %127s", verb, &id, cookie, pin) < 3) {
+			JANUS_LOG(LOG_WARN, "Invalid cascade request from %s:%d\n", address_str, ntohs(address.sin_port));
+			continue;
+		}
+		reply[0] = '\0';
+		if(strcmp(verb, "KFR") && !janus_streaming_cascade_cookie_check(&address, cookie)) {
+			/* Before doing anything, make sure the edge is really at this address */
+			char expected[JANUS_STREAMING_CASCADE_COOKIE_LEN+1];
+			janus_streaming_cascade_cookie(&address, janus_get_monotonic_time()/JANUS_STREAMING_CASCADE_COOKIE_PERIOD, expected);
+			g_snprintf(reply, sizeof(reply), "CHL %"SCNu64" %s", id, expected);
+			janus_streaming_cascade_reply(&address, reply);
+			continue;
+		}
+		janus_mutex_lock(&mountpoints_mutex);
+		janus_streaming_mountpoint *mp = g_hash_table_lookup(mountpoints, &id);
+		if(mp == NULL || mp->destroyed || mp->streaming_source != janus_streaming_source_rtp) {
+			janus_mutex_unlock(&mountpoints_mutex);
+			g_snprintf(reply, sizeof(reply), "ERR %"SCNu64" no such mountpoint", id);
+			janus_streaming_cascade_reply(&address, reply);
+			continue;
+		}
+		janus_mutex_lock(&mp->mutex);
+		janus_streaming_cascade_edge *edge = janus_streaming_cascade_edge_find(mp, &address);
+		if(!strcmp(verb, "SUB")) {
+			if(mp->pin && strcmp(mp->pin, pin)) {
+				JANUS_LOG(LOG_WARN, "[%s] Unauthorized cascade subscription from %s:%d\n", mp->name, address_str, ntohs(address.sin_port));
+				g_snprintf(reply, sizeof(reply), "ERR %"SCNu64" unauthorized", id);
+			} else {
+				if(edge == NULL) {
+					edge = janus_streaming_cascade_edge_new(&address);
+					if(edge != NULL) {
+						JANUS_LOG(LOG_INFO, "[%s] New cascade edge %s:%d\n", mp->name, address_str, ntohs(address.sin_port));
+						mp->edges = g_list_append(mp->edges, edge);
+					}
+				}
+				if(edge != NULL) {
+					edge->last_seen = janus_get_monotonic_time();
+					g_snprintf(reply, sizeof(reply), "OK %"SCNu64, id);
+				} else {
+					g_snprintf(reply, sizeof(reply), "ERR %"SCNu64" can't subscribe", id);
+				}
+			}
+		} else if(!strcmp(verb, "KFR")) {
+			/* Only edges that subscribed can ask for a keyframe */
+			if(edge != NULL)
+				janus_streaming_cascade_send_keyframe(mp, edge);
+		} else if(!strcmp(verb, "BYE")) {
+			if(edge != NULL) {
+				JANUS_LOG(LOG_INFO, "[%s] Cascade edge %s:%d is gone\n", mp->name, address_str, ntohs(address.sin_port));
+				mp->edges = g_list_remove(mp->edges, edge);
+				janus_streaming_cascade_edge_free(edge);
+			}
+		} else {
+			JANUS_LOG(LOG_WARN, "Unsupported cascade request '%s' from %s:%d\n", verb, address_str, ntohs(address.sin_port));
+		}
+		janus_mutex_unlock(&mp->mutex);
+		janus_mutex_unlock(&mountpoints_mutex);
+		if(reply[0] != '\0')
+			janus_streaming_cascade_reply(&address, reply);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving Streaming cascade thread\n");
+	return NULL;
+}
+
+/* Cascading helpers, edge side */
+static int janus_streaming_cascade_connect(const char *origin, const char *name) {
+	/* The origin is in the host:port format */
+	char *host = g_strdup(origin);
+	char *port = strrchr(host, ':');
+	if(port == NULL || atoi(port+1) <= 0) {
+		JANUS_LOG(LOG_ERR, "[%s] Invalid cascade origin '%s' (should be host:port)\n", name, origin);
+		g_free(host);
+		return -1;
+	}
+	*port = '\0';
+	port++;
+	struct addrinfo hints, *res = NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	if(getaddrinfo(host, port, &hints, &res) != 0 || res == NULL) {
+		JANUS_LOG(LOG_ERR, "[%s] Couldn't resolve cascade origin '%s'\n", name, origin);
+		g_free(host);
+		return -1;
+	}
+	/* We connect the socket, so that we only get packets from the origin */
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+		JANUS_LOG(LOG_ERR, "[%s] Couldn't connect to cascade origin '%s'... %d (%s)\n", name, origin, errno, strerror(errno));
+		if(fd > -1)
+			close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	g_free(host);
+	return fd;
+}
+
+static void janus_streaming_cascade_request(janus_streaming_rtp_source *source, const char *verb) {
+	char request[256];
+	int len = g_snprintf(request, sizeof(request), "%s %"SCNu64" %s%s%s", verb, source->cascade_id,
+		source->cascade_cookie[0] ? source->cascade_cookie : "-",
+		source->cascade_pin ? " " : "", source->cascade_pin ? source->cascade_pin : "");
+	if(len > (int)sizeof(request)-1)
+		len = sizeof(request)-1;
+	/* Origins ignore requests that are smaller than their replies */
+	if(len < JANUS_STREAMING_CASCADE_REQUEST_SIZE) {
+		memset(request+len, ' ', JANUS_STREAMING_CASCADE_REQUEST_SIZE-len);
+		len = JANUS_STREAMING_CASCADE_REQUEST_SIZE;
+	}
+	if(send(source->cascade_fd, request, len, 0) < 0)
+		JANUS_LOG(LOG_HUGE, "Error sending cascade request... %d (%s)\n", errno, strerror(errno));
+}
+
+/* Invoked by the relay thread: the subscription is refreshed regularly, and
+ * if we cache keyframes we keep on asking for one until we get it */
+static void janus_streaming_cascade_refresh(janus_streaming_mountpoint *mp) {
+	janus_streaming_rtp_source *source = mp->source;
+	gint64 now = janus_get_monotonic_time();
+	if(now - source->cascade_subscribed >= JANUS_STREAMING_CASCADE_REFRESH) {
+		source->cascade_subscribed = now;
+		janus_streaming_cascade_request(source, "SUB");
+	}
+	if(source->keyframe.enabled && source->keyframe.rings[0] != NULL && source->keyframe.rings[0]->latest < 0 &&
+			source->cascade_ok && now - source->cascade_kfr >= G_USEC_PER_SEC) {
+		source->cascade_kfr = now;
+		janus_streaming_cascade_request(source, "KFR");
+	}
+}
+
 static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data) {
 	janus_streaming_rtp_relay_packet *packet = (janus_streaming_rtp_relay_packet *)user_data;
 	if(!packet || !packet->data || packet->length < 1) {
@@ -5210,7 +6788,7 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 					/* There has been a change: let's wait for a keyframe on the target */
 					int step = (session->substream < 1 && session->substream_target == 2);
 					if(packet->substream == session->substream_target || (step && packet->substream == step)) {
-						if(janus_vp8_is_keyframe(payload, plen)) {
+						if(packet->video.keyframe) {
 							JANUS_LOG(LOG_VERB, "Received keyframe on substream %d, switching (was %d)\n",
 								packet->substream, session->substream);
 							session->substream = packet->substream;
@@ -5264,32 +6842,25 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 				char vp8pd[6];
 				if(packet->codec == JANUS_STREAMING_VP8) {
 					/* Check if there's any temporal scalability to take into account */
-					uint16_t picid = 0;
-					uint8_t tlzi = 0;
-					uint8_t tid = 0;
-					uint8_t ybit = 0;
-					uint8_t keyidx = 0;
-					if(janus_vp8_parse_descriptor(payload, plen, &picid, &tlzi, &tid, &ybit, &keyidx) == 0) {
-						//~ JANUS_LOG(LOG_WARN, "%"SCNu16", %u, %u, %u, %u\n", picid, tlzi, tid, ybit, keyidx);
-						if(session->templayer != session->templayer_target) {
-							/* FIXME We should be smarter in deciding when to switch */
-							session->templayer = session->templayer_target;
-								/* Notify the viewer */
-								json_t *event = json_object();
-								json_object_set_new(event, "streaming", json_string("event"));
-								json_t *result = json_object();
-								json_object_set_new(result, "temporal", json_integer(session->templayer));
-								json_object_set_new(event, "result", result);
-								gateway->push_event(session->handle, &janus_streaming_plugin, NULL, event, NULL);
-								json_decref(event);
-						}
-						if(tid > session->templayer) {
-							JANUS_LOG(LOG_HUGE, "Dropping packet (it's temporal layer %d, but we're capping at %d)\n",
-								tid, session->templayer);
-							/* We increase the base sequence number, or there will be gaps when delivering later */
-							session->context.v_base_seq++;
-							return;
-						}
+					int tid = packet->video.temporal_layer;
+					if(session->templayer != session->templayer_target) {
+						/* FIXME We should be smarter in deciding when to switch */
+						session->templayer = session->templayer_target;
+							/* Notify the viewer */
+							json_t *event = json_object();
+							json_object_set_new(event, "streaming", json_string("event"));
+							json_t *result = json_object();
+							json_object_set_new(result, "temporal", json_integer(session->templayer));
+							json_object_set_new(event, "result", result);
+							gateway->push_event(session->handle, &janus_streaming_plugin, NULL, event, NULL);
+							json_decref(event);
+					}
+					if(tid > session->templayer) {
+						JANUS_LOG(LOG_HUGE, "Dropping packet (it's temporal layer %d, but we're capping at %d)\n",
+							tid, session->templayer);
+						/* We increase the base sequence number, or there will be gaps when delivering later */
+						session->context.v_base_seq++;
+						return;
 					}
 					/* If we got here, update the RTP header and send the packet */
 					janus_rtp_header_update(packet->data, &session->context, TRUE, 0);
@@ -5308,23 +6879,17 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 				}
 			} else {
 				/* Fix sequence number and timestamp (switching may be involved) */
-				janus_rtp_header_update(packet->data, &session->context, TRUE, 0);
+				janus_streaming_rewrite_header(session, packet);
 				if(gateway != NULL)
 					gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
-				/* Restore the timestamp and sequence number to what the publisher set them to */
-				packet->data->timestamp = htonl(packet->timestamp);
-				packet->data->seq_number = htons(packet->seq_number);
 			}
 		} else {
 			if(!session->audio)
 				return;
 			/* Fix sequence number and timestamp (switching may be involved) */
-			janus_rtp_header_update(packet->data, &session->context, FALSE, 0);
+			janus_streaming_rewrite_header(session, packet);
 			if(gateway != NULL)
 				gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
-			/* Restore the timestamp and sequence number to what the publisher set them to */
-			packet->data->timestamp = htonl(packet->timestamp);
-			packet->data->seq_number = htons(packet->seq_number);
 		}
 	} else {
 		/* We're broadcasting a data channel message */
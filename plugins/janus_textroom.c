@@ -89,6 +89,7 @@ void janus_textroom_setup_media(janus_plugin_session *handle);
 void janus_textroom_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len);
 void janus_textroom_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len);
 void janus_textroom_incoming_data(janus_plugin_session *handle, char *buf, int len);
+void janus_textroom_incoming_binary_data(janus_plugin_session *handle, char *buf, int len);
 void janus_textroom_slow_link(janus_plugin_session *handle, int uplink, int video);
 void janus_textroom_hangup_media(janus_plugin_session *handle);
 void janus_textroom_destroy_session(janus_plugin_session *handle, int *error);
@@ -114,6 +115,7 @@ static janus_plugin janus_textroom_plugin =
 		.incoming_rtp = janus_textroom_incoming_rtp,
 		.incoming_rtcp = janus_textroom_incoming_rtcp,
 		.incoming_data = janus_textroom_incoming_data,
+		.incoming_binary_data = janus_textroom_incoming_binary_data,
 		.slow_link = janus_textroom_slow_link,
 		.hangup_media = janus_textroom_hangup_media,
 		.destroy_session = janus_textroom_destroy_session,
@@ -197,7 +199,7 @@ static void *janus_textroom_handler(void *data);
 static void janus_textroom_hangup_media_internal(janus_plugin_session *handle);
 
 /* JSON serialization options */
-static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+static size_t json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 
 
 typedef struct janus_textroom_message {
@@ -372,6 +374,59 @@ static void *janus_textroom_watchdog(void *data) {
 static size_t janus_textroom_write_data(void *buffer, size_t size, size_t nmemb, void *userp) {
 	return size*nmemb;
 }
+
+/* Messages are relayed to HTTP backends by a dedicated thread: data
+ * channel messages are handled on the SCTP stack threads, which are
+ * shared by other PeerConnections and must never block on a backend */
+typedef struct janus_textroom_backend_post {
+	char *url;
+	char *text;
+} janus_textroom_backend_post;
+static GAsyncQueue *backend_posts = NULL;
+static janus_textroom_backend_post exit_post;
+static GThread *backend_thread = NULL;
+
+static void janus_textroom_backend_post_free(janus_textroom_backend_post *post) {
+	if(!post || post == &exit_post)
+		return;
+	g_free(post->url);
+	g_free(post->text);
+	g_free(post);
+}
+
+static void *janus_textroom_backend_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining TextRoom backend thread\n");
+	janus_textroom_backend_post *post = NULL;
+	while((post = g_async_queue_pop(backend_posts)) != &exit_post) {
+		/* Prepare the libcurl context */
+		CURLcode res;
+		CURL *curl = curl_easy_init();
+		if(curl == NULL) {
+			JANUS_LOG(LOG_ERR, "Error initializing CURL context\n");
+		} else {
+			curl_easy_setopt(curl, CURLOPT_URL, post->url);
+			struct curl_slist *headers = NULL;
+			headers = curl_slist_append(headers, "Accept: application/json");
+			headers = curl_slist_append(headers, "Content-Type: application/json");
+			headers = curl_slist_append(headers, "charsets: utf-8");
+			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post->text);
+			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_textroom_write_data);
+			/* Send the request */
+			res = curl_easy_perform(curl);
+			if(res != CURLE_OK) {
+				JANUS_LOG(LOG_ERR, "Couldn't relay event to the backend: %s\n", curl_easy_strerror(res));
+			} else {
+				JANUS_LOG(LOG_DBG, "Event sent!\n");
+			}
+			curl_easy_cleanup(curl);
+			curl_slist_free_all(headers);
+		}
+		janus_textroom_backend_post_free(post);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving TextRoom backend thread\n");
+	return NULL;
+}
 #endif
 
 /* We use this method to handle incoming requests. Since most of the requests 
@@ -418,17 +473,17 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 		if(item && item->value) {
 			/* Check how we need to format/serialize the JSON output */
 			if(!strcasecmp(item->value, "indented")) {
-				/* Default: indented, we use three spaces for that */
+				/* Indented, we use three spaces for that */
 				json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 			} else if(!strcasecmp(item->value, "plain")) {
 				/* Not indented and no new lines, but still readable */
 				json_format = JSON_INDENT(0) | JSON_PRESERVE_ORDER;
 			} else if(!strcasecmp(item->value, "compact")) {
-				/* Compact, so no spaces between separators */
+				/* Default: compact, so no spaces between separators */
 				json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 			} else {
-				JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (indented)\n", item->value);
-				json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+				JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (compact)\n", item->value);
+				json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 			}
 		}
 		/* Any admin key to limit who can "create"? */
@@ -508,11 +563,21 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 
 #ifdef HAVE_LIBCURL
 	curl_global_init(CURL_GLOBAL_ALL);
+	backend_posts = g_async_queue_new_full((GDestroyNotify) janus_textroom_backend_post_free);
 #endif
 
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
+#ifdef HAVE_LIBCURL
+	/* Launch the thread that will relay messages to HTTP backends */
+	backend_thread = g_thread_try_new("textroom backend", janus_textroom_backend_thread, NULL, &error);
+	if(error != NULL) {
+		g_atomic_int_set(&initialized, 0);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the TextRoom backend thread...\n", error->code, error->message ? error->message : "??");
+		return -1;
+	}
+#endif
 	/* Start the sessions watchdog */
 	watchdog = g_thread_try_new("textroom watchdog", &janus_textroom_watchdog, NULL, &error);
 	if(error != NULL) {
@@ -541,6 +606,13 @@ void janus_textroom_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+#ifdef HAVE_LIBCURL
+	g_async_queue_push(backend_posts, &exit_post);
+	if(backend_thread != NULL) {
+		g_thread_join(backend_thread);
+		backend_thread = NULL;
+	}
+#endif
 	/* Remove all textrooms */
 	janus_mutex_lock(&rooms_mutex);
 	GHashTableIter iter;
@@ -571,6 +643,8 @@ void janus_textroom_destroy(void) {
 	sessions = NULL;
 
 #ifdef HAVE_LIBCURL
+	g_async_queue_unref(backend_posts);
+	backend_posts = NULL;
 	curl_global_cleanup();
 #endif
 
@@ -619,6 +693,31 @@ static janus_textroom_session *janus_textroom_lookup_session(janus_plugin_sessio
 	return session;
 }
 
+/* Helper to send the same message to all the participants in a room (but one, if
+ * needed): the core only copies the message once, no matter how many they are */
+static void janus_textroom_broadcast(janus_textroom_room *textroom, janus_textroom_participant *skip, char *text) {
+	if(textroom->participants == NULL || text == NULL)
+		return;
+	guint size = g_hash_table_size(textroom->participants);
+	if(size == 0)
+		return;
+	janus_plugin_session **handles = g_malloc(size * sizeof(janus_plugin_session *));
+	int count = 0;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, textroom->participants);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_textroom_participant *top = value;
+		if(top == skip)
+			continue;
+		handles[count++] = top->session->handle;
+	}
+	JANUS_LOG(LOG_HUGE, "  >> To %d participants in %"SCNu64"\n", count, textroom->room_id);
+	if(count > 0)
+		gateway->relay_data_broadcast(handles, count, text, strlen(text));
+	g_free(handles);
+}
+
 void janus_textroom_create_session(janus_plugin_session *handle, int *error) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
 		*error = -1;
@@ -840,6 +939,19 @@ void janus_textroom_incoming_data(janus_plugin_session *handle, char *buf, int l
 	janus_textroom_handle_incoming_request(handle, text, NULL, FALSE);
 }
 
+void janus_textroom_incoming_binary_data(janus_plugin_session *handle, char *buf, int len) {
+	if(handle == NULL || handle->stopped || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return;
+	if(buf == NULL || len <= 0)
+		return;
+	/* Our protocol is JSON: we accept it in binary messages too, as long as it's valid UTF-8 */
+	if(!g_utf8_validate(buf, len, NULL)) {
+		JANUS_LOG(LOG_WARN, "Ignoring binary DataChannel message (%d bytes), not UTF-8 text\n", len);
+		return;
+	}
+	janus_textroom_incoming_data(handle, buf, len);
+}
+
 /* Helper method to handle incoming messages from the data channel */
 janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session *handle, char *text, json_t *json, gboolean internal) {
 	janus_textroom_session *session = (janus_textroom_session *)handle->plugin_handle;
@@ -941,60 +1053,37 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			/* A limited number of users */
 			json_t *sent = json_object();
 			size_t i = 0;
+			int count = 0;
+			janus_plugin_session **handles = g_malloc(json_array_size(usernames) * sizeof(janus_plugin_session *));
 			for(i=0; i<json_array_size(usernames); i++) {
 				json_t *u = json_array_get(usernames, i);
 				const char *to = json_string_value(u);
 				JANUS_LOG(LOG_VERB, "To %s in %"SCNu64": %s\n", to, room_id, message);
 				janus_textroom_participant *top = g_hash_table_lookup(textroom->participants, to);
 				if(top) {
-					gateway->relay_data(top->session->handle, msg_text, strlen(msg_text));
+					handles[count++] = top->session->handle;
 					json_object_set_new(sent, to, json_true());
 				} else {
 					JANUS_LOG(LOG_WARN, "User %s is not in room %"SCNu64", failed to send message\n", to, room_id);
 					json_object_set_new(sent, to, json_false());
 				}
 			}
+			if(count > 0)
+				gateway->relay_data_broadcast(handles, count, msg_text, strlen(msg_text));
+			g_free(handles);
 			json_object_set_new(reply, "sent", sent);
 		} else {
 			/* Everybody in the room */
 			JANUS_LOG(LOG_VERB, "To everybody in %"SCNu64": %s\n", room_id, message);
-			if(textroom->participants) {
-				GHashTableIter iter;
-				gpointer value;
-				g_hash_table_iter_init(&iter, textroom->participants);
-				while(g_hash_table_iter_next(&iter, NULL, &value)) {
-					janus_textroom_participant *top = value;
-					JANUS_LOG(LOG_VERB, "  >> To %s in %"SCNu64": %s\n", top->username, room_id, message);
-					gateway->relay_data(top->session->handle, msg_text, strlen(msg_text));
-				}
-			}
+			janus_textroom_broadcast(textroom, NULL, msg_text);
 #ifdef HAVE_LIBCURL
 			/* Is there a backend waiting for this message too? */
 			if(textroom->http_backend) {
-				/* Prepare the libcurl context */
-				CURLcode res;
-				CURL *curl = curl_easy_init();
-				if(curl == NULL) {
-					JANUS_LOG(LOG_ERR, "Error initializing CURL context\n");
-				} else {
-					curl_easy_setopt(curl, CURLOPT_URL, textroom->http_backend);
-					struct curl_slist *headers = NULL;
-					headers = curl_slist_append(headers, "Accept: application/json");
-					headers = curl_slist_append(headers, "Content-Type: application/json");
-					headers = curl_slist_append(headers, "charsets: utf-8");
-					curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-					curl_easy_setopt(curl, CURLOPT_POSTFIELDS, msg_text);
-					curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_textroom_write_data);
-					/* Send the request */
-					res = curl_easy_perform(curl);
-					if(res != CURLE_OK) {
-						JANUS_LOG(LOG_ERR, "Couldn't relay event to the backend: %s\n", curl_easy_strerror(res));
-					} else {
-						JANUS_LOG(LOG_DBG, "Event sent!\n");
-					}
-					curl_easy_cleanup(curl);
-					curl_slist_free_all(headers);
-				}
+				/* The backend thread will send it: we can't block here */
+				janus_textroom_backend_post *post = g_malloc(sizeof(janus_textroom_backend_post));
+				post->url = g_strdup(textroom->http_backend);
+				post->text = g_strdup(msg_text);
+				g_async_queue_push(backend_posts, post);
 			}
 #endif
 		}
@@ -1083,6 +1172,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			json_decref(event);
 			gateway->relay_data(handle, event_text, strlen(event_text));
 			/* Broadcast */
+			janus_textroom_broadcast(textroom, participant, event_text);
 			GHashTableIter iter;
 			gpointer value;
 			g_hash_table_iter_init(&iter, textroom->participants);
@@ -1090,8 +1180,6 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				janus_textroom_participant *top = value;
 				if(top == participant)
 					continue;	/* Skip us */
-				JANUS_LOG(LOG_VERB, "  >> To %s in %"SCNu64"\n", top->username, room_id);
-				gateway->relay_data(top->session->handle, event_text, strlen(event_text));
 				/* Take note of this user */
 				json_t *p = json_object();
 				json_object_set_new(p, "username", json_string(top->username));
@@ -1164,16 +1252,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			json_decref(event);
 			gateway->relay_data(handle, event_text, strlen(event_text));
 			/* Broadcast */
-			GHashTableIter iter;
-			gpointer value;
-			g_hash_table_iter_init(&iter, textroom->participants);
-			while(g_hash_table_iter_next(&iter, NULL, &value)) {
-				janus_textroom_participant *top = value;
-				if(top == participant)
-					continue;	/* Skip us */
-				JANUS_LOG(LOG_VERB, "  >> To %s in %"SCNu64"\n", top->username, room_id);
-				gateway->relay_data(top->session->handle, event_text, strlen(event_text));
-			}
+			janus_textroom_broadcast(textroom, participant, event_text);
 			free(event_text);
 		}
 		/* Also notify event handlers */
@@ -1378,14 +1457,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			char *event_text = json_dumps(event, json_format);
 			json_decref(event);
 			/* Broadcast */
-			GHashTableIter iter;
-			gpointer value;
-			g_hash_table_iter_init(&iter, textroom->participants);
-			while(g_hash_table_iter_next(&iter, NULL, &value)) {
-				janus_textroom_participant *top = value;
-				JANUS_LOG(LOG_VERB, "  >> To %s in %"SCNu64"\n", top->username, room_id);
-				gateway->relay_data(top->session->handle, event_text, strlen(event_text));
-			}
+			janus_textroom_broadcast(textroom, NULL, event_text);
 			free(event_text);
 		}
 		/* Also notify event handlers */
@@ -1776,13 +1848,12 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			json_decref(event);
 			gateway->relay_data(handle, event_text, strlen(event_text));
 			/* Broadcast */
+			janus_textroom_broadcast(textroom, NULL, event_text);
 			GHashTableIter iter;
 			gpointer value;
 			g_hash_table_iter_init(&iter, textroom->participants);
 			while(g_hash_table_iter_next(&iter, NULL, &value)) {
 				janus_textroom_participant *top = value;
-				JANUS_LOG(LOG_VERB, "  >> To %s in %"SCNu64"\n", top->username, room_id);
-				gateway->relay_data(top->session->handle, event_text, strlen(event_text));
 				janus_mutex_lock(&top->session->mutex);
 				g_hash_table_remove(top->session->rooms, &room_id);
 				janus_mutex_unlock(&top->session->mutex);
@@ -267,6 +267,7 @@ void janus_videocall_setup_media(janus_plugin_session *handle);
 void janus_videocall_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len);
 void janus_videocall_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len);
 void janus_videocall_incoming_data(janus_plugin_session *handle, char *buf, int len);
+void janus_videocall_incoming_binary_data(janus_plugin_session *handle, char *buf, int len);
 void janus_videocall_slow_link(janus_plugin_session *handle, int uplink, int video);
 void janus_videocall_hangup_media(janus_plugin_session *handle);
 void janus_videocall_destroy_session(janus_plugin_session *handle, int *error);
@@ -292,6 +293,7 @@ static janus_plugin janus_videocall_plugin =
 		.incoming_rtp = janus_videocall_incoming_rtp,
 		.incoming_rtcp = janus_videocall_incoming_rtcp,
 		.incoming_data = janus_videocall_incoming_data,
+		.incoming_binary_data = janus_videocall_incoming_binary_data,
 		.slow_link = janus_videocall_slow_link,
 		.hangup_media = janus_videocall_hangup_media,
 		.destroy_session = janus_videocall_destroy_session,
@@ -913,6 +915,29 @@ void janus_videocall_incoming_data(janus_plugin_session *handle, char *buf, int
 	}
 }
 
+void janus_videocall_incoming_binary_data(janus_plugin_session *handle, char *buf, int len) {
+	if(handle == NULL || handle->stopped || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return;
+	if(gateway) {
+		janus_videocall_session *session = (janus_videocall_session *)handle->plugin_handle;
+		if(!session) {
+			JANUS_LOG(LOG_ERR, "No session associated with this handle...\n");
+			return;
+		}
+		if(!session->peer) {
+			JANUS_LOG(LOG_ERR, "Session has no peer...\n");
+			return;
+		}
+		if(session->destroyed || session->peer->destroyed)
+			return;
+		if(buf == NULL || len <= 0)
+			return;
+		JANUS_LOG(LOG_VERB, "Got a binary DataChannel message (%d bytes) to forward\n", len);
+		/* Forward the message to the peer as it is (data recordings are text, so we don't save it) */
+		gateway->relay_binary_data(session->peer->handle, buf, len);
+	}
+}
+
 void janus_videocall_slow_link(janus_plugin_session *handle, int uplink, int video) {
 	/* The core is informing us that our peer got or sent too many NACKs, are we pushing media too hard? */
 	if(handle == NULL || handle->stopped || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
@@ -1225,6 +1250,7 @@ static void *janus_videocall_handler(void *data) {
 					g_snprintf(error_cause, 512, "Error parsing offer: %s", error_str);
 					goto error;
 				}
+				gboolean offer_vp8 = (janus_sdp_get_codec_pt(offer, "vp8") > 0);
 				janus_sdp_free(offer);
 				janus_mutex_lock(&sessions_mutex);
 				session->peer = peer;  // 赋值为被呼叫方的janus_videocall_session
@@ -1238,7 +1264,7 @@ static void *janus_videocall_handler(void *data) {
 				JANUS_LOG(LOG_VERB, "This is involving a negotiation (%s) as well:\n%s\n", msg_sdp_type, msg_sdp);
 				/* Check if this user will simulcast */
 				json_t *msg_simulcast = json_object_get(msg->jsep, "simulcast");
-				if(msg_simulcast && janus_get_codec_pt(msg_sdp, "vp8") > 0) {
+				if(msg_simulcast && offer_vp8) {
 					JANUS_LOG(LOG_VERB, "VideoCall caller (%s) is going to do simulcasting\n", session->username);
 					session->ssrc[0] = json_integer_value(json_object_get(msg_simulcast, "ssrc-0"));
 					session->ssrc[1] = json_integer_value(json_object_get(msg_simulcast, "ssrc-1"));
@@ -1298,7 +1324,7 @@ static void *janus_videocall_handler(void *data) {
 			session->has_data = (strstr(msg_sdp, "DTLS/SCTP") != NULL);
 			/* Check if this user will simulcast */
 			json_t *msg_simulcast = json_object_get(msg->jsep, "simulcast");
-			if(msg_simulcast && janus_get_codec_pt(msg_sdp, "vp8") > 0) {
+			if(msg_simulcast && janus_sdp_get_codec_pt(answer, "vp8") > 0) {
 				JANUS_LOG(LOG_VERB, "VideoCall callee (%s) is going to do simulcasting\n", session->username);
 				session->ssrc[0] = json_integer_value(json_object_get(msg_simulcast, "ssrc-0"));
 				session->ssrc[1] = json_integer_value(json_object_get(msg_simulcast, "ssrc-1"));
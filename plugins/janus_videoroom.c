@@ -16,7 +16,13 @@
  * For what concerns the subscriber side, there's a generic 'listener', which can attach to
  * a single feed, which means that if you want to watch more feeds at the
  * same time, you'll need to create multiple 'listeners' to attach at any
- * of them.
+ * of them. Alternatively, a listener can pass a \c multiplex array with the
+ * IDs of additional feeds when joining: they will all be sent on the same
+ * PeerConnection, each as a separate SSRC (Plan B style) in the audio and video
+ * m-lines, whose msid stream ID is \c janus followed by the feed ID. This saves
+ * the ICE/DTLS handshakes and threads of a PeerConnection per feed, but requires
+ * a Plan B capable client. A \c configure request can target one of the
+ * additional feeds by passing its ID as \c feed.
  * 
  * Considering that this plugin allows for several different WebRTC PeerConnections
  * to be on at the same time for the same peer (specifically, each peer
@@ -57,6 +63,9 @@ publishers = <max number of concurrent senders> (e.g., 6 for a video
              conference or 1 for a webinar, default=3)
 bitrate = <max video bitrate for senders> (e.g., 128000)
 fir_freq = <send a FIR to publishers every fir_freq seconds> (0=disable)
+fanout_workers = <number of threads relaying media to subscribers> (0=disable,
+	the default, in which case each publisher's thread relays to all of them;
+	useful for webinar-like rooms with hundreds of subscribers)
 audiocodec = opus|g722|pcmu|pcma|isac32|isac16 (audio codec to force on publishers, default=opus
 			can be a comma separated list in order of preference, e.g., opus,pcmu)
 videocodec = vp8|vp9|h264 (video codec to force on publishers, default=vp8
@@ -74,6 +83,9 @@ playoutdelay_ext = yes|no (whether the playout-delay RTP extension must be
 transport_wide_cc_ext = yes|no (whether the transport wide CC RTP extension must be
 	negotiated/used or not for new publishers, default=no note that this currently
 	doesn't work correctly when the publisher is doing simulcasting)
+simulcast_auto = yes|no (whether the simulcast substream to send subscribers should
+	be picked automatically, according to the bandwidth they advertise via REMB; the
+	substream subscribers ask for is then used as the highest one, default=no)
 record = true|false (whether this room should be recorded, default=false)
 rec_dir = <folder where recordings should be stored, when enabled>
 notify_joining = true|false (optional, whether to notify all participants when a new
@@ -149,6 +161,7 @@ notify_joining = true|false (optional, whether to notify all participants when a
 #include "../record.h"
 #include "../sdp-utils.h"
 #include "../utils.h"
+#include "../metrics.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 
@@ -176,8 +189,10 @@ void janus_videoroom_create_session(janus_plugin_session *handle, int *error);
 struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session *handle, char *transaction, json_t *message, json_t *jsep);
 void janus_videoroom_setup_media(janus_plugin_session *handle);
 void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len);
+void janus_videoroom_incoming_rtp_shared(janus_plugin_session *handle, janus_plugin_rtp *packet);
 void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len);
 void janus_videoroom_incoming_data(janus_plugin_session *handle, char *buf, int len);
+void janus_videoroom_incoming_binary_data(janus_plugin_session *handle, char *buf, int len);
 void janus_videoroom_slow_link(janus_plugin_session *handle, int uplink, int video);
 void janus_videoroom_hangup_media(janus_plugin_session *handle);
 void janus_videoroom_destroy_session(janus_plugin_session *handle, int *error);
@@ -201,8 +216,10 @@ static janus_plugin janus_videoroom_plugin =
 		.handle_message = janus_videoroom_handle_message,
 		.setup_media = janus_videoroom_setup_media,
 		.incoming_rtp = janus_videoroom_incoming_rtp,
+		.incoming_rtp_shared = janus_videoroom_incoming_rtp_shared,
 		.incoming_rtcp = janus_videoroom_incoming_rtcp,
 		.incoming_data = janus_videoroom_incoming_data,
+		.incoming_binary_data = janus_videoroom_incoming_binary_data,
 		.slow_link = janus_videoroom_slow_link,
 		.hangup_media = janus_videoroom_hangup_media,
 		.destroy_session = janus_videoroom_destroy_session,
@@ -237,6 +254,7 @@ static struct janus_json_parameter create_parameters[] = {
 	{"require_pvtid", JANUS_JSON_BOOL, 0},
 	{"bitrate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"fir_freq", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"fanout_workers", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"publishers", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"audiocodec", JSON_STRING, 0},
 	{"videocodec", JSON_STRING, 0},
@@ -248,6 +266,7 @@ static struct janus_json_parameter create_parameters[] = {
 	{"videoorient_ext", JANUS_JSON_BOOL, 0},
 	{"playoutdelay_ext", JANUS_JSON_BOOL, 0},
 	{"transport_wide_cc_ext", JANUS_JSON_BOOL, 0},
+	{"simulcast_auto", JANUS_JSON_BOOL, 0},
 	{"record", JANUS_JSON_BOOL, 0},
 	{"rec_dir", JSON_STRING, 0},
 	{"permanent", JANUS_JSON_BOOL, 0},
@@ -357,9 +376,12 @@ static struct janus_json_parameter configure_parameters[] = {
 	{"temporal_layer", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	/* The following is to handle a renegotiation */
 	{"update", JANUS_JSON_BOOL, 0},
+	/* For multiplexed listeners, which of the feeds to configure */
+	{"feed", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 };
 static struct janus_json_parameter listener_parameters[] = {
 	{"feed", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"multiplex", JSON_ARRAY, 0},
 	{"private_id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"close_pc", JANUS_JSON_BOOL, 0},
 	{"audio", JANUS_JSON_BOOL, 0},
@@ -378,12 +400,19 @@ static janus_mutex config_mutex = JANUS_MUTEX_INITIALIZER;
 /* Useful stuff */
 static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
+static gint64 keyframe_min_interval = 500000;	/* Minimum interval between keyframe requests to a publisher, in us */
 static janus_callbacks *gateway = NULL;
-static GThread *handler_thread;
+static janus_handler_pool *handlers = NULL;
 static GThread *watchdog;
 static void *janus_videoroom_handler(void *data);
 // 转发RTP数据包
 static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data);
+/* Data channel message to relay to listeners */
+typedef struct janus_videoroom_data_packet {
+	char *buf;
+	int len;
+	gboolean binary;
+} janus_videoroom_data_packet;
 static void janus_videoroom_relay_data_packet(gpointer data, gpointer user_data);
 static void janus_videoroom_hangup_media_internal(janus_plugin_session *handle);
 
@@ -405,7 +434,6 @@ typedef struct janus_videoroom_message {
 
 
 // 消息队列
-static GAsyncQueue *messages = NULL;
 static janus_videoroom_message exit_message;
 
 static void janus_videoroom_message_free(janus_videoroom_message *msg) {
@@ -547,6 +575,20 @@ static janus_videoroom_videocodec janus_videoroom_videocodec_from_name(const cha
 	return JANUS_VIDEOROOM_NOVIDEO;
 }
 
+/* Map our codecs to the ones the shared helpers know, so that packets are only inspected once */
+static janus_videocodec janus_videoroom_videocodec_inspect(janus_videoroom_videocodec vcodec) {
+	switch(vcodec) {
+		case JANUS_VIDEOROOM_VP8:
+			return JANUS_VIDEOCODEC_VP8;
+		case JANUS_VIDEOROOM_VP9:
+			return JANUS_VIDEOCODEC_VP9;
+		case JANUS_VIDEOROOM_H264:
+			return JANUS_VIDEOCODEC_H264;
+		default:
+			return JANUS_VIDEOCODEC_NONE;
+	}
+}
+
 // 获取payload type值
 static int janus_videoroom_videocodec_pt(janus_videoroom_videocodec vcodec) {
 	switch(vcodec) {
@@ -575,6 +617,8 @@ typedef struct janus_videoroom {
 	int max_publishers;			/* Maximum number of concurrent publishers */
 	uint32_t bitrate;			/* Global bitrate limit */
 	uint16_t fir_freq;			/* Regular FIR frequency (0=disabled) */
+	guint fanout_workers;		/* Number of threads relaying media to listeners (0=disabled) */
+	struct janus_videoroom_fanout_worker *fanout;	/* Fan-out threads, if enabled */
 	janus_videoroom_audiocodec acodec[3];	/* Audio codec(s) to force on publishers */
 	janus_videoroom_videocodec vcodec[3];	/* Video codec(s) to force on publishers */
 	gboolean do_svc;			/* Whether SVC must be done for video (note: only available for VP9 right now) */
@@ -585,6 +629,7 @@ typedef struct janus_videoroom {
 	gboolean videoorient_ext;	/* Whether the video-orientation extension must be negotiated or not for new publishers */
 	gboolean playoutdelay_ext;	/* Whether the playout-delay extension must be negotiated or not for new publishers */
 	gboolean transport_wide_cc_ext;	/* Whether the transport wide cc extension must be negotiated or not for new publishers */
+	gboolean simulcast_auto;	/* Whether the simulcast substream to send listeners is picked according to their REMB */
 	gboolean record;			/* Whether the feeds from publishers in this room should be recorded */
 	char *rec_dir;				/* Where to save the recordings of this room, if enabled */
 	gint64 destroyed;			/* Value to flag the room for destruction, done lazily */
@@ -599,6 +644,14 @@ typedef struct janus_videoroom {
 // 插件全部的房间管理
 static GHashTable *rooms;
 static janus_mutex rooms_mutex = JANUS_MUTEX_INITIALIZER;
+/* Exported via the core metrics */
+static janus_metric *metric_rooms = NULL;
+static gint64 janus_videoroom_metric_rooms(gpointer user_data) {
+	janus_mutex_lock(&rooms_mutex);
+	gint64 count = rooms ? g_hash_table_size(rooms) : 0;
+	janus_mutex_unlock(&rooms_mutex);
+	return count;
+}
 static GList *old_rooms;
 static char *admin_key = NULL;
 static void janus_videoroom_free(janus_videoroom *room);
@@ -648,6 +701,21 @@ struct janus_videoroom_srtp_context {
 	uint8_t count;
 };
 
+/* Immutable array of the listeners of a publisher: every time the list
+ * changes a new one is built and swapped in, so that the media path can
+ * iterate on it without taking the listeners mutex. The publisher holds a
+ * reference to the current snapshot, and so does whoever iterates on it:
+ * a snapshot is freed when the last reference is released. When the room
+ * has fan-out workers, the listeners are grouped by the worker relaying
+ * to them, so that each worker only looks at its own share */
+typedef struct janus_videoroom_listeners_snapshot {
+	volatile gint refs;
+	guint count;
+	guint shards;		/* How many workers the listeners are grouped for (0 if not grouped) */
+	guint *offsets;		/* If grouped, where the listeners of each worker start (shards+1 entries) */
+	gpointer listeners[];
+} janus_videoroom_listeners_snapshot;
+
 // 参与者
 typedef struct janus_videoroom_participant {
 	janus_videoroom_session *session; 
@@ -665,6 +733,7 @@ typedef struct janus_videoroom_participant {
 	guint32 audio_ssrc;		/* Audio SSRC of this publisher */
 	guint32 video_ssrc;		/* Video SSRC of this publisher */
 	uint32_t ssrc[3];		/* Only needed in case VP8 simulcasting is involved */
+	janus_simulcast_bitrates sc_bitrates;	/* Bitrate of each substream, if we pick them automatically for listeners */
 	int rtpmapid_extmap_id;	/* Only needed in case Firefox's RID-based simulcasting is involved */
 	char *rid[3];			/* Only needed in case Firefox's RID-based simulcasting is involved */
 	guint8 audio_level_extmap_id;		/* Audio level extmap ID */
@@ -684,6 +753,7 @@ typedef struct janus_videoroom_participant {
 	gint64 remb_latest;	/* Time of latest sent REMB (to avoid flooding) */
 	gint64 fir_latest;	/* Time of latest sent FIR (to avoid flooding) */
 	gint fir_seq;		/* FIR sequence number */
+	janus_rtcp_keyframe_coalescer keyframe_requests;	/* Coalesces the keyframe requests triggered by listeners */
 	gboolean recording_active;	/* Whether this publisher has to be recorded or not */
 	gchar *recording_base;	/* Base name for the recording (e.g., /path/to/filename, will generate /path/to/filename-audio.mjr and/or /path/to/filename-video.mjr */
 	janus_recorder *arc;	/* The Janus recorder instance for this publisher's audio, if enabled */
@@ -693,6 +763,8 @@ typedef struct janus_videoroom_participant {
 	GSList *listeners;		/* Subscriptions to this publisher (who's watching this publisher)  */
 	GSList *subscriptions;	/* Subscriptions this publisher has created (who this publisher is watching) */
 	janus_mutex listeners_mutex;
+	janus_videoroom_listeners_snapshot *listeners_snapshot;	/* Immutable copy of listeners the media path iterates on without the listeners mutex */
+	janus_mutex snapshot_mutex;	/* Only held to swap the snapshot, or to take a reference to it */
 	GHashTable *rtp_forwarders;
 	GHashTable *srtp_contexts;
 	janus_mutex rtp_forwarders_mutex;
@@ -701,6 +773,10 @@ typedef struct janus_videoroom_participant {
 } janus_videoroom_participant;
 
 static void janus_videoroom_participant_free(janus_videoroom_participant *p);
+static void janus_videoroom_reqkey(janus_videoroom_participant *p, gboolean fir, const char *reason);
+static void janus_videoroom_sendkey(janus_videoroom_participant *p, gboolean fir, const char *reason);
+static void janus_videoroom_participant_listeners_update(janus_videoroom_participant *p);
+static void janus_videoroom_participant_listeners_foreach(janus_videoroom_participant *p, GFunc func, gpointer user_data);
 static void janus_videoroom_rtp_forwarder_free_helper(gpointer data);
 static void janus_videoroom_srtp_context_free_helper(gpointer data);
 static guint32 janus_videoroom_rtp_forwarder_add_helper(janus_videoroom_participant *p,
@@ -709,11 +785,18 @@ static guint32 janus_videoroom_rtp_forwarder_add_helper(janus_videoroom_particip
 	int substream, gboolean is_video, gboolean is_data);
 
 // 维护janus_videoroom_participant和janus_videoroom_listener的关系
+/* Additional feeds a listener can get on the same PeerConnection: each of them
+ * takes an audio and a video SSRC, and the core can multiplex up to 32 of them */
+#define JANUS_VIDEOROOM_MAX_MULTIPLEXED_FEEDS	16
+
 typedef struct janus_videoroom_listener {
 	janus_videoroom_session *session;
 	janus_videoroom *room;	/* Room */
 	guint64 room_id;		/* Unique room ID */
 	janus_videoroom_participant *feed;	/* Participant this listener is subscribed to */
+	struct janus_videoroom_listener *primary;	/* If this feed is multiplexed on another listener's PeerConnection, the listener owning it */
+	GList *multiplexed;		/* Additional feeds multiplexed on this listener's PeerConnection, if any */
+	guint32 audio_ssrc, video_ssrc;	/* SSRCs a multiplexed feed is sent with (the core rewrites the primary's) */
 	gboolean close_pc;		/* Whether we should automatically close the PeerConnection when the publisher goes away */
 	guint32 pvt_id;			/* Private ID of the participant that is subscribing (if available/provided) */
 	janus_sdp *sdp;			/* Offer we sent this listener (may be updated within renegotiations) */
@@ -724,6 +807,7 @@ typedef struct janus_videoroom_listener {
 	int templayer_target;	/* As above, but to handle transitions (e.g., wait for keyframe) */
 	gint64 last_relayed;	/* When we relayed the last packet (used to detect when substreams become unavailable) */
 	janus_vp8_simulcast_context simulcast_context;
+	janus_simulcast_bwe_context bwe;	/* Bandwidth estimation, if the substream is picked automatically */
 	gboolean audio, video, data;		/* Whether audio, video and/or data must be sent to this listener */
 	/* As above, but can't change dynamically (says whether something was negotiated at all in SDP) */
 	gboolean audio_offered, video_offered, data_offered;
@@ -733,24 +817,51 @@ typedef struct janus_videoroom_listener {
 	 * simulcast, which has similar info (substream/templayer) but in a completely different context */
 	int spatial_layer, target_spatial_layer;
 	int temporal_layer, target_temporal_layer;
+	guint fanout_shard;		/* Which fan-out worker relays media to this listener, if the room has any (modulo their number) */
 } janus_videoroom_listener;
 
 static void janus_videoroom_listener_free(janus_videoroom_listener *l);
+static janus_videoroom_listener *janus_videoroom_listener_find(janus_videoroom_listener *l, guint64 feed_id);
+static janus_videoroom_listener *janus_videoroom_listener_by_ssrc(janus_videoroom_listener *l, guint32 ssrc);
+static gboolean janus_videoroom_listener_has_feeds(janus_videoroom_listener *l);
+static void janus_videoroom_listener_unsubscribe(janus_videoroom_listener *l);
+static void janus_videoroom_listener_sdp_multiplex(janus_videoroom_listener *l, janus_sdp_mline *m);
+static json_t *janus_videoroom_listener_event(janus_videoroom_listener *listener);
 
 typedef struct janus_videoroom_rtp_relay_packet {
 	janus_rtp_header *data;
 	gint length;
+	/* If set, data is its buffer, and listeners can share the payload by reference */
+	janus_plugin_rtp *shared;
 	gboolean is_video;
 	uint32_t ssrc[3];
 	uint32_t timestamp;
 	uint16_t seq_number;
-	/* The following are only relevant if we're doing VP9 SVC*/
-	gboolean svc;
-	int spatial_layer;
-	int temporal_layer;
-	uint8_t pbit, dbit, ubit, bbit, ebit;
+	/* Codec specific info (keyframe, layers, VP9 SVC bits), parsed once by the publisher */
+	janus_video_info video;
 } janus_videoroom_rtp_relay_packet;
 
+/* Parallel fan-out: rooms with fanout_workers set get a pool of threads,
+ * each relaying the media of all publishers to its own share of listeners */
+typedef struct janus_videoroom_fanout_worker {
+	guint index, count;
+	GThread *thread;
+	GAsyncQueue *jobs;
+} janus_videoroom_fanout_worker;
+typedef struct janus_videoroom_fanout_job {
+	janus_videoroom_participant *participant;
+	janus_videoroom_listeners_snapshot *snapshot;
+	janus_videoroom_rtp_relay_packet packet;
+	/* Each worker gets its own copy of the packet, as relaying modifies it */
+	janus_plugin_rtp *rtp;
+} janus_videoroom_fanout_job;
+static janus_videoroom_fanout_job exit_job;
+/* Listeners are assigned to fan-out workers in a round robin fashion */
+static volatile gint fanout_next_shard = 0;
+static void janus_videoroom_fanout_start(janus_videoroom *room);
+static void janus_videoroom_fanout_stop(janus_videoroom *room);
+static void janus_videoroom_participant_relay_rtp(janus_videoroom_participant *p, janus_videoroom_rtp_relay_packet *packet);
+
 
 /* Error codes */
 #define JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR		499
@@ -1012,7 +1123,14 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		(GDestroyNotify)g_free, (GDestroyNotify) janus_videoroom_free);
 	sessions = g_hash_table_new(NULL, NULL);
 
-	messages = g_async_queue_new_full((GDestroyNotify) janus_videoroom_message_free);
+	guint handler_threads_num = 1;
+	if(config != NULL) {
+		janus_config_item *threads = janus_config_get_item_drilldown(config, "general", "handler_threads");
+		if(threads != NULL && threads->value != NULL)
+			handler_threads_num = janus_handler_pool_size(threads->value);
+	}
+	/* Messages are handled by a pool of threads (handler_threads in the [general] section, default=1) */
+	handlers = janus_handler_pool_create(handler_threads_num, (GDestroyNotify) janus_videoroom_message_free);
 
 	/* This is the callback we'll need to invoke to contact the gateway */
 	gateway = callback;
@@ -1026,6 +1144,15 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_item *events = janus_config_get_item_drilldown(config, "general", "events");
 		if(events != NULL && events->value != NULL)
 			notify_events = janus_is_true(events->value);
+		janus_config_item *kf_interval = janus_config_get_item_drilldown(config, "general", "keyframe_min_interval");
+		if(kf_interval != NULL && kf_interval->value != NULL) {
+			int ms = atoi(kf_interval->value);
+			if(ms < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid keyframe_min_interval value, using the default (%"SCNi64"ms)\n", keyframe_min_interval/1000);
+			} else {
+				keyframe_min_interval = (gint64)ms*1000;
+			}
+		}
 		if(!notify_events && callback->events_is_enabled()) {
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_VIDEOROOM_NAME);
 		}
@@ -1046,6 +1173,7 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_item *bitrate = janus_config_get_item(cat, "bitrate");
 			janus_config_item *maxp = janus_config_get_item(cat, "publishers");
 			janus_config_item *firfreq = janus_config_get_item(cat, "fir_freq");
+			janus_config_item *fanout = janus_config_get_item(cat, "fanout_workers");
 			janus_config_item *audiocodec = janus_config_get_item(cat, "audiocodec");
 			janus_config_item *videocodec = janus_config_get_item(cat, "videocodec");
 			janus_config_item *svc = janus_config_get_item(cat, "video_svc");
@@ -1056,6 +1184,7 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_item *videoorient_ext = janus_config_get_item(cat, "videoorient_ext");
 			janus_config_item *playoutdelay_ext = janus_config_get_item(cat, "playoutdelay_ext");
 			janus_config_item *transport_wide_cc_ext = janus_config_get_item(cat, "transport_wide_cc_ext");
+			janus_config_item *simulcast_auto = janus_config_get_item(cat, "simulcast_auto");
 			janus_config_item *notify_joining = janus_config_get_item(cat, "notify_joining");
 			janus_config_item *record = janus_config_get_item(cat, "record");
 			janus_config_item *rec_dir = janus_config_get_item(cat, "rec_dir");
@@ -1089,6 +1218,9 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			videoroom->fir_freq = 0;
 			if(firfreq != NULL && firfreq->value != NULL)
 				videoroom->fir_freq = atol(firfreq->value);
+			videoroom->fanout_workers = 0;
+			if(fanout != NULL && fanout->value != NULL && atoi(fanout->value) > 0)
+				videoroom->fanout_workers = atoi(fanout->value);
 			/* By default, we force Opus as the only audio codec */
 			videoroom->acodec[0] = JANUS_VIDEOROOM_OPUS;
 			videoroom->acodec[1] = JANUS_VIDEOROOM_NOAUDIO;
@@ -1177,6 +1309,9 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			videoroom->transport_wide_cc_ext = FALSE;
 			if(transport_wide_cc_ext != NULL && transport_wide_cc_ext->value != NULL)
 				videoroom->transport_wide_cc_ext = janus_is_true(transport_wide_cc_ext->value);
+			videoroom->simulcast_auto = FALSE;
+			if(simulcast_auto != NULL && simulcast_auto->value != NULL)
+				videoroom->simulcast_auto = janus_is_true(simulcast_auto->value);
 			if(record && record->value) {
 				videoroom->record = janus_is_true(record->value);
 			}
@@ -1190,6 +1325,7 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 				videoroom->notify_joining = janus_is_true(notify_joining->value);
 			videoroom->destroyed = 0;
 			janus_mutex_init(&videoroom->mutex);
+			janus_videoroom_fanout_start(videoroom);
 			videoroom->participants = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
 			videoroom->private_ids = g_hash_table_new(NULL, NULL);
 			videoroom->check_allowed = FALSE;	/* Static rooms can't have an "allowed" list yet, no hooks to the configuration file */
@@ -1272,6 +1408,8 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 	}
 	janus_mutex_unlock(&rooms_mutex);
 
+	metric_rooms = janus_metrics_add_callback("janus_plugin_rooms", "plugin=\"" JANUS_VIDEOROOM_PACKAGE "\"",
+		"Rooms currently available in the plugin", JANUS_METRIC_GAUGE, janus_videoroom_metric_rooms, NULL);
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
@@ -1283,9 +1421,8 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_destroy(config);
 		return -1;
 	}
-	/* Launch the thread that will handle incoming messages */
-	handler_thread = g_thread_try_new("videoroom handler", janus_videoroom_handler, NULL, &error);
-	if(error != NULL) {
+	/* Launch the threads that will handle incoming messages */
+	if(janus_handler_pool_start(handlers, "videoroom", janus_videoroom_handler, &error) < 0) {
 		g_atomic_int_set(&initialized, 0);
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the VideoRoom handler thread...\n", error->code, error->message ? error->message : "??");
 		janus_config_destroy(config);
@@ -1299,12 +1436,10 @@ void janus_videoroom_destroy(void) {
 	if(!g_atomic_int_get(&initialized))
 		return;
 	g_atomic_int_set(&stopping, 1);
+	janus_metrics_remove(metric_rooms);
+	metric_rooms = NULL;
 
-	g_async_queue_push(messages, &exit_message);
-	if(handler_thread != NULL) {
-		g_thread_join(handler_thread);
-		handler_thread = NULL;
-	}
+	janus_handler_pool_stop(handlers, &exit_message);
 	if(watchdog != NULL) {
 		g_thread_join(watchdog);
 		watchdog = NULL;
@@ -1323,8 +1458,8 @@ void janus_videoroom_destroy(void) {
 	janus_mutex_unlock(&rooms_mutex);
 	janus_mutex_destroy(&rooms_mutex);
 
-	g_async_queue_unref(messages);
-	messages = NULL;
+	janus_handler_pool_destroy(handlers);
+	handlers = NULL;
 
 	janus_config_destroy(config);
 	g_free(admin_key);
@@ -1399,6 +1534,10 @@ static void janus_videoroom_notify_participants(janus_videoroom_participant *par
 	/* participant->room->mutex has to be locked. */
 	if(participant->room == NULL)
 		return;
+	/* The event is the same for everybody, so we only serialize it once */
+	janus_plugin_event *event = janus_plugin_event_new(&janus_videoroom_plugin, msg);
+	if(event == NULL)
+		return;
 	GHashTableIter iter;
 	gpointer value;
 	g_hash_table_iter_init(&iter, participant->room->participants);
@@ -1406,10 +1545,11 @@ static void janus_videoroom_notify_participants(janus_videoroom_participant *par
 		janus_videoroom_participant *p = value;
 		if(p && p->session && p != participant) {
 			JANUS_LOG(LOG_VERB, "Notifying participant %"SCNu64" (%s)\n", p->user_id, p->display ? p->display : "??");
-			int ret = gateway->push_event(p->session->handle, &janus_videoroom_plugin, NULL, msg, NULL);
+			int ret = gateway->push_event_shared(p->session->handle, &janus_videoroom_plugin, NULL, event);
 			JANUS_LOG(LOG_VERB, "  >> %d (%s)\n", ret, janus_get_api_error(ret));
 		}
 	}
+	janus_plugin_event_unref(event);
 }
 
 // 通知相关参与者(同一个会议下面的全部的数据推送者)有新的参与者加入
@@ -1592,6 +1732,17 @@ json_t *janus_videoroom_query_session(janus_plugin_session *handle) {
 					if(feed->display)
 						json_object_set_new(info, "feed_display", json_string(feed->display));
 				}
+				if(participant->multiplexed != NULL) {
+					json_t *list = json_array();
+					GList *temp = participant->multiplexed;
+					while(temp) {
+						janus_videoroom_listener *s = (janus_videoroom_listener *)temp->data;
+						if(s->feed)
+							json_array_append_new(list, json_integer(s->feed->user_id));
+						temp = temp->next;
+					}
+					json_object_set_new(info, "multiplexed", list);
+				}
 				json_t *media = json_object();
 				json_object_set_new(media, "audio", participant->audio ? json_true() : json_false());
 				json_object_set_new(media, "audio-offered", participant->audio_offered ? json_true() : json_false());
@@ -1754,6 +1905,7 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 		json_t *pin = json_object_get(root, "pin");
 		json_t *bitrate = json_object_get(root, "bitrate");
 		json_t *fir_freq = json_object_get(root, "fir_freq");
+		json_t *fanout_workers = json_object_get(root, "fanout_workers");
 		json_t *publishers = json_object_get(root, "publishers");
 		json_t *allowed = json_object_get(root, "allowed");
 		json_t *audiocodec = json_object_get(root, "audiocodec");
@@ -1819,6 +1971,7 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 		json_t *videoorient_ext = json_object_get(root, "videoorient_ext");
 		json_t *playoutdelay_ext = json_object_get(root, "playoutdelay_ext");
 		json_t *transport_wide_cc_ext = json_object_get(root, "transport_wide_cc_ext");
+		json_t *simulcast_auto = json_object_get(root, "simulcast_auto");
 		json_t *notify_joining = json_object_get(root, "notify_joining");
 		json_t *record = json_object_get(root, "record");
 		json_t *rec_dir = json_object_get(root, "rec_dir");
@@ -1914,6 +2067,9 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 		videoroom->fir_freq = 0;
 		if(fir_freq)
 			videoroom->fir_freq = json_integer_value(fir_freq);
+		videoroom->fanout_workers = 0;
+		if(fanout_workers)
+			videoroom->fanout_workers = json_integer_value(fanout_workers);
 		/* By default, we force Opus as the only audio codec */
 		videoroom->acodec[0] = JANUS_VIDEOROOM_OPUS;
 		videoroom->acodec[1] = JANUS_VIDEOROOM_NOAUDIO;
@@ -1990,6 +2146,7 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 		videoroom->videoorient_ext = videoorient_ext ? json_is_true(videoorient_ext) : TRUE;
 		videoroom->playoutdelay_ext = playoutdelay_ext ? json_is_true(playoutdelay_ext) : TRUE;
 		videoroom->transport_wide_cc_ext = transport_wide_cc_ext ? json_is_true(transport_wide_cc_ext) : FALSE;
+		videoroom->simulcast_auto = simulcast_auto ? json_is_true(simulcast_auto) : FALSE;
 		/* By default, the videoroom plugin does not notify about participants simply joining the room.
 		   It only notifies when the participant actually starts publishing media. */
 		videoroom->notify_joining = notify_joining ? json_is_true(notify_joining) : FALSE;
@@ -2001,6 +2158,7 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 		}
 		videoroom->destroyed = 0;
 		janus_mutex_init(&videoroom->mutex);
+		janus_videoroom_fanout_start(videoroom);
 		videoroom->participants = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
 		videoroom->private_ids = g_hash_table_new(NULL, NULL);
 		videoroom->allowed = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
@@ -2071,6 +2229,10 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 				g_snprintf(value, BUFSIZ, "%"SCNu16, videoroom->fir_freq);
 				janus_config_add_item(config, cat, "fir_freq", value);
 			}
+			if(videoroom->fanout_workers) {
+				g_snprintf(value, BUFSIZ, "%u", videoroom->fanout_workers);
+				janus_config_add_item(config, cat, "fanout_workers", value);
+			}
 			char audio_codecs[100];
 			memset(audio_codecs, 0, sizeof(audio_codecs));
 			g_snprintf(audio_codecs, sizeof(audio_codecs), "%s", janus_videoroom_audiocodec_name(videoroom->acodec[0]));
@@ -2120,6 +2282,8 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 				janus_config_add_item(config, cat, "playoutdelay_ext", "yes");
 			if(videoroom->transport_wide_cc_ext)
 				janus_config_add_item(config, cat, "transport_wide_cc_ext", "yes");
+			if(videoroom->simulcast_auto)
+				janus_config_add_item(config, cat, "simulcast_auto", "yes");
 			if(videoroom->notify_joining)
 				janus_config_add_item(config, cat, "notify_joining", "yes");
 			if(videoroom->record)
@@ -2243,6 +2407,10 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 				g_snprintf(value, BUFSIZ, "%"SCNu16, videoroom->fir_freq);
 				janus_config_add_item(config, cat, "fir_freq", value);
 			}
+			if(videoroom->fanout_workers) {
+				g_snprintf(value, BUFSIZ, "%u", videoroom->fanout_workers);
+				janus_config_add_item(config, cat, "fanout_workers", value);
+			}
 			char audio_codecs[100];
 			memset(audio_codecs, 0, sizeof(audio_codecs));
 			g_snprintf(audio_codecs, sizeof(audio_codecs), "%s", janus_videoroom_audiocodec_name(videoroom->acodec[0]));
@@ -2273,6 +2441,8 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 				janus_config_add_item(config, cat, "secret", videoroom->room_secret);
 			if(videoroom->room_pin)
 				janus_config_add_item(config, cat, "pin", videoroom->room_pin);
+			if(videoroom->simulcast_auto)
+				janus_config_add_item(config, cat, "simulcast_auto", "yes");
 			if(videoroom->record)
 				janus_config_add_item(config, cat, "record", "yes");
 			if(videoroom->rec_dir)
@@ -2424,6 +2594,8 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 				json_object_set_new(rl, "videocodec", json_string(video_codecs));
 				if(room->do_svc)
 					json_object_set_new(rl, "video_svc", json_true());
+				if(room->simulcast_auto)
+					json_object_set_new(rl, "simulcast_auto", json_true());
 				json_object_set_new(rl, "record", room->record ? json_true() : json_false());
 				json_object_set_new(rl, "rec_dir", json_string(room->rec_dir));
 				/* TODO: Should we list participants as well? or should there be a separate API call on a specific room for this? */
@@ -2570,17 +2742,8 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 			json_object_set_new(rtp_stream, "audio", json_integer(audio_port));
 		}
 		if(video_handle[0] > 0 || video_handle[1] > 0 || video_handle[2] > 0) {
-			/* Send a FIR to the new RTP forward publisher */
-			char buf[20];
-			janus_rtcp_fir((char *)&buf, 20, &publisher->fir_seq);
-			JANUS_LOG(LOG_VERB, "New RTP forward publisher, sending FIR to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-			gateway->relay_rtcp(publisher->session->handle, 1, buf, 20);
-			/* Send a PLI too, just in case... */
-			janus_rtcp_pli((char *)&buf, 12);
-			JANUS_LOG(LOG_VERB, "New RTP forward publisher, sending PLI to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-			gateway->relay_rtcp(publisher->session->handle, 1, buf, 12);
-			/* Update the time of when we last sent a keyframe request */
-			publisher->fir_latest = janus_get_monotonic_time();
+			/* Ask the publisher for a keyframe */
+			janus_videoroom_reqkey(publisher, TRUE, "New RTP forward publisher");
 			/* Done */
 			if(video_handle[0] > 0) {
 				json_object_set_new(rtp_stream, "video_stream_id", json_integer(video_handle[0]));
@@ -3000,7 +3163,7 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 		msg->transaction = transaction;
 		msg->message = root;
 		msg->jsep = jsep;
-		g_async_queue_push(messages, msg);
+		g_async_queue_push(janus_handler_pool_queue(handlers, msg->handle), msg);
 
 		return janus_plugin_result_new(JANUS_PLUGIN_OK_WAIT, NULL, NULL);
 	} else {
@@ -3107,16 +3270,16 @@ void janus_videoroom_setup_media(janus_plugin_session *handle) {
 				// 获取他监听的数据发送者对象
 				janus_videoroom_participant *p = l->feed;
 				if(p && p->session) {
-					/* Send a FIR */
+					/* Ask the publisher for a keyframe */
 					// 视频关键帧重传请求
-					char buf[20];
-					janus_rtcp_fir((char *)&buf, 20, &p->fir_seq);
-					JANUS_LOG(LOG_VERB, "New listener available, sending FIR to %"SCNu64" (%s)\n", p->user_id, p->display ? p->display : "??");
-					gateway->relay_rtcp(p->session->handle, 1, buf, 20);
-					/* Send a PLI too, just in case... */
-					janus_rtcp_pli((char *)&buf, 12);
-					JANUS_LOG(LOG_VERB, "New listener available, sending PLI to %"SCNu64" (%s)\n", p->user_id, p->display ? p->display : "??");
-					gateway->relay_rtcp(p->session->handle, 1, buf, 12);
+					janus_videoroom_reqkey(p, TRUE, "New listener available");
+					GList *temp = l->multiplexed;
+					while(temp) {
+						janus_videoroom_listener *s = (janus_videoroom_listener *)temp->data;
+						if(s->feed)
+							janus_videoroom_reqkey(s->feed, TRUE, "New multiplexed listener available");
+						temp = temp->next;
+					}
 					/* Also notify event handlers */
 					if(notify_events && gateway->events_is_enabled()) {
 						json_t *info = json_object();
@@ -3132,7 +3295,49 @@ void janus_videoroom_setup_media(janus_plugin_session *handle) {
 	janus_mutex_unlock(&sessions_mutex);
 }
 
+/* Keyframe requests: all the reasons for asking a publisher for a keyframe (new
+ * listeners, substream changes, listeners' own PLI/FIR, etc.) go through its
+ * coalescer, so that a wave of them results in a single request */
+static void janus_videoroom_sendkey(janus_videoroom_participant *p, gboolean fir, const char *reason) {
+	if(p == NULL || p->session == NULL || p->session->handle == NULL)
+		return;
+	char buf[20];
+	if(fir) {
+		janus_rtcp_fir((char *)&buf, 20, &p->fir_seq);
+		JANUS_LOG(LOG_VERB, "%s, sending FIR to %"SCNu64" (%s)\n", reason, p->user_id, p->display ? p->display : "??");
+		gateway->relay_rtcp(p->session->handle, 1, buf, 20);
+	}
+	/* Send a PLI too, just in case... */
+	janus_rtcp_pli((char *)&buf, 12);
+	JANUS_LOG(LOG_VERB, "%s, sending PLI to %"SCNu64" (%s)\n", reason, p->user_id, p->display ? p->display : "??");
+	gateway->relay_rtcp(p->session->handle, 1, buf, 12);
+	/* Update the time of when we last sent a keyframe request */
+	p->fir_latest = janus_get_monotonic_time();
+}
+
+static void janus_videoroom_reqkey(janus_videoroom_participant *p, gboolean fir, const char *reason) {
+	if(p == NULL || p->session == NULL || p->session->handle == NULL)
+		return;
+	if(!janus_rtcp_keyframe_coalescer_request(&p->keyframe_requests, janus_get_monotonic_time())) {
+		JANUS_LOG(LOG_HUGE, "%s, keyframe request to %"SCNu64" (%s) coalesced with a recent one\n",
+			reason, p->user_id, p->display ? p->display : "??");
+		return;
+	}
+	janus_videoroom_sendkey(p, fir, reason);
+}
+
+static void janus_videoroom_incoming_rtp_internal(janus_plugin_session *handle, int video, char *buf, int len, janus_plugin_rtp *shared);
 void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len) {
+	janus_videoroom_incoming_rtp_internal(handle, video, buf, len, NULL);
+}
+
+void janus_videoroom_incoming_rtp_shared(janus_plugin_session *handle, janus_plugin_rtp *packet) {
+	if(packet == NULL)
+		return;
+	janus_videoroom_incoming_rtp_internal(handle, packet->video, packet->buffer, packet->length, packet);
+}
+
+static void janus_videoroom_incoming_rtp_internal(janus_plugin_session *handle, int video, char *buf, int len, janus_plugin_rtp *shared) {
 	if(handle == NULL || handle->stopped || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized) || !gateway)
 		return;
 	janus_videoroom_session *session = (janus_videoroom_session *)handle->plugin_handle;
@@ -3265,6 +3470,8 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 			rtp->ssrc = htonl(ssrc);
 		}
 		janus_mutex_unlock(&participant->rtp_forwarders_mutex);
+		if(sc != -1 && videoroom->simulcast_auto)
+			janus_simulcast_bitrates_update(&participant->sc_bitrates, sc, len, janus_get_monotonic_time());
 		if(sc < 1) {
 			/* Save the frame if we're recording
 			 * FIXME: for video, we're currently only recording the base substream, when simulcasting */
@@ -3274,28 +3481,20 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 		janus_videoroom_rtp_relay_packet packet;
 		packet.data = rtp;
 		packet.length = len;
+		/* Simulcast listeners may rewrite the VP8 payload descriptor, so we can't share those */
+		packet.shared = (sc == -1 ? shared : NULL);
 		packet.is_video = video;
-		packet.svc = FALSE;
-		if(video && videoroom->do_svc) {
-			/* We're doing SVC: let's parse this packet to see which layers are there */
+		/* Inspect the video payload once: listeners (simulcast and SVC) and the FIR check all use this */
+		memset(&packet.video, 0, sizeof(packet.video));
+		if(video) {
 			int plen = 0;
 			char *payload = janus_rtp_payload(buf, len, &plen);
 			if(payload == NULL)
 				return;
-			uint8_t pbit = 0, dbit = 0, ubit = 0, bbit = 0, ebit = 0;
-			int found = 0, spatial_layer = 0, temporal_layer = 0;
-			if(janus_vp9_parse_svc(payload, plen, &found, &spatial_layer, &temporal_layer, &pbit, &dbit, &ubit, &bbit, &ebit) == 0) {
-				if(found) {
-					packet.svc = TRUE;
-					packet.spatial_layer = spatial_layer;
-					packet.temporal_layer = temporal_layer;
-					packet.pbit = pbit;
-					packet.dbit = dbit;
-					packet.ubit = ubit;
-					packet.bbit = bbit;
-					packet.ebit = ebit;
-				}
-			}
+			janus_video_info_parse(janus_videoroom_videocodec_inspect(participant->vcodec), payload, plen, &packet.video);
+			/* We only do SVC (VP9 only, right now) if the room was configured for it */
+			if(!videoroom->do_svc)
+				packet.video.svc = FALSE;
 		}
 		packet.ssrc[0] = (sc != -1 ? participant->ssrc[0] : 0);
 		packet.ssrc[1] = (sc != -1 ? participant->ssrc[1] : 0);
@@ -3306,9 +3505,7 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 		
 		/* Go: some viewers may decide to drop the packet, but that's up to them */
 		// 转发数据给相关的客户端
-		janus_mutex_lock_nodebug(&participant->listeners_mutex);
-		g_slist_foreach(participant->listeners, janus_videoroom_relay_rtp_packet, &packet);
-		janus_mutex_unlock_nodebug(&participant->listeners_mutex);
+		janus_videoroom_participant_relay_rtp(participant, &packet);
 
 		/* Check if we need to send any REMB, FIR or PLI back to this publisher */
 		if(video && participant->video_active) {
@@ -3341,33 +3538,17 @@ void janus_videoroom_incoming_rtp(janus_plugin_session *handle, int video, char
 				/* We generate RTCP every tot seconds/frames */
 				gint64 now = janus_get_monotonic_time();
 				/* First check if this is a keyframe, though: if so, we reset the timer */
-				int plen = 0;
-				char *payload = janus_rtp_payload(buf, len, &plen);
-				if(payload == NULL)
-					return;
-				if(participant->vcodec == JANUS_VIDEOROOM_VP8) {
-					if(janus_vp8_is_keyframe(payload, plen))
-						participant->fir_latest = now;
-				} else if(participant->vcodec == JANUS_VIDEOROOM_VP9) {
-					if(janus_vp9_is_keyframe(payload, plen))
-						participant->fir_latest = now;
-				} else if(participant->vcodec == JANUS_VIDEOROOM_H264) {
-					if(janus_h264_is_keyframe(payload, plen))
-						participant->fir_latest = now;
-				}
+				if(packet.video.keyframe)
+					participant->fir_latest = now;
 				if((now-participant->fir_latest) >= ((gint64)videoroom->fir_freq*G_USEC_PER_SEC)) {
 					/* FIXME We send a FIR every tot seconds */
 					participant->fir_latest = now;
-					char rtcpbuf[24];
-					janus_rtcp_fir((char *)&rtcpbuf, 20, &participant->fir_seq);
-					JANUS_LOG(LOG_VERB, "Sending FIR to %"SCNu64" (%s)\n", participant->user_id, participant->display ? participant->display : "??");
-					gateway->relay_rtcp(handle, video, rtcpbuf, 20);
-					/* Send a PLI too, just in case... */
-					janus_rtcp_pli((char *)&rtcpbuf, 12);
-					JANUS_LOG(LOG_VERB, "Sending PLI to %"SCNu64" (%s)\n", participant->user_id, participant->display ? participant->display : "??");
-					gateway->relay_rtcp(handle, video, rtcpbuf, 12);
+					janus_videoroom_reqkey(participant, TRUE, "Periodic keyframe request");
 				}
 			}
+			/* If keyframe requests were coalesced and no keyframe came in the meanwhile, send one now */
+			if(janus_rtcp_keyframe_coalescer_update(&participant->keyframe_requests, packet.video.keyframe, 0))
+				janus_videoroom_sendkey(participant, TRUE, "Coalesced keyframe requests");
 		}
 	}
 }
@@ -3385,45 +3566,49 @@ void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, int video, char
 	if(session->participant_type == janus_videoroom_p_type_subscriber) {
 		/* A listener sent some RTCP, check what it is and if we need to forward it to the publisher */
 		janus_videoroom_listener *l = (janus_videoroom_listener *)session->participant;
-		if(!l || !l->video)
+		if(!l || !video)
 			return;	/* The only feedback we handle is video related anyway... */
-		if(janus_rtcp_has_fir(buf, len)) {
-			/* We got a FIR, forward it to the publisher */
-			if(l->feed) {
+		janus_rtcp_summary summary;
+		if(janus_rtcp_summarize(buf, len, &summary) < 0)
+			return;
+		if(summary.has_fir || summary.has_pli) {
+			/* We got a FIR and/or a PLI, forward it to the publisher (unless it's coalesced with others):
+			 * if feeds are multiplexed on this PeerConnection, the media SSRC tells us which one */
+			janus_videoroom_listener *target = janus_videoroom_listener_by_ssrc(l, summary.keyframe_ssrc);
+			if(target->video && target->feed) {
 				// 当收到FIR包时候我们转发给发送者
-				janus_videoroom_participant *p = l->feed;
-				if(p && p->session) {
-					char rtcpbuf[20];
-					janus_rtcp_fir((char *)&rtcpbuf, 20, &p->fir_seq);
-					JANUS_LOG(LOG_VERB, "Got a FIR from a listener, forwarding it to %"SCNu64" (%s)\n", p->user_id, p->display ? p->display : "??");
-					gateway->relay_rtcp(p->session->handle, 1, rtcpbuf, 20);
-					/* Update the time of when we last sent a keyframe request */
-					p->fir_latest = janus_get_monotonic_time();
-				}
+				janus_videoroom_participant *p = target->feed;
+				if(p && p->session)
+					janus_videoroom_reqkey(p, summary.has_fir, "Got a keyframe request from a listener");
 			}
 		}
-		if(janus_rtcp_has_pli(buf, len)) {
-			/* We got a PLI, forward it to the publisher */
-			if(l->feed) {
-				janus_videoroom_participant *p = l->feed;
-				if(p && p->session) {
-					char rtcpbuf[12];
-					janus_rtcp_pli((char *)&rtcpbuf, 12);
-					JANUS_LOG(LOG_VERB, "Got a PLI from a listener, forwarding it to %"SCNu64" (%s)\n", p->user_id, p->display ? p->display : "??");
-					gateway->relay_rtcp(p->session->handle, 1, rtcpbuf, 12);
-					/* Update the time of when we last sent a keyframe request */
-					p->fir_latest = janus_get_monotonic_time();
+		if(summary.remb_bitrate > 0 && l->room && l->room->simulcast_auto) {
+			/* We got a REMB from this listener: check which substream fits what it can receive (the
+			 * estimate is for the whole PeerConnection, so it's split among multiplexed feeds) */
+			guint32 bitrate = summary.remb_bitrate / (1 + g_list_length(l->multiplexed));
+			janus_videoroom_listener *target = l;
+			GList *temp = l->multiplexed;
+			while(target) {
+				janus_videoroom_participant *p = target->feed;
+				if(target->video && p && p->session && p->ssrc[0] != 0) {
+					int substream = janus_simulcast_bwe_pick(&target->bwe, &p->sc_bitrates,
+						target->substream_target, bitrate, janus_get_monotonic_time());
+					if(substream != target->substream_target) {
+						JANUS_LOG(LOG_VERB, "Listener estimates %"SCNu32" bps, switching to substream %d (was %d)\n",
+							bitrate, substream, target->substream_target);
+						target->substream_target = substream;
+						/* Send a PLI, so that we can switch as soon as possible */
+						janus_videoroom_reqkey(p, FALSE, "Automatic substream switch");
+					}
 				}
+				target = temp ? (janus_videoroom_listener *)temp->data : NULL;
+				temp = temp ? temp->next : NULL;
 			}
 		}
-		uint32_t bitrate = janus_rtcp_get_remb(buf, len);
-		if(bitrate > 0) {
-			/* FIXME We got a REMB from this listener, should we do something about it? */
-		}
 	}
 }
 
-void janus_videoroom_incoming_data(janus_plugin_session *handle, char *buf, int len) {
+static void janus_videoroom_incoming_data_internal(janus_plugin_session *handle, gboolean binary, char *buf, int len) {
 	if(handle == NULL || handle->stopped || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized) || !gateway)
 		return;
 	if(buf == NULL || len <= 0)
@@ -3450,6 +3635,13 @@ void janus_videoroom_incoming_data(janus_plugin_session *handle, char *buf, int
 		}
 	}
 	janus_mutex_unlock(&participant->rtp_forwarders_mutex);
+	janus_videoroom_data_packet packet = { .buf = buf, .len = len, .binary = binary };
+	if(binary) {
+		/* Binary data is relayed as it is, but not saved: data recordings are text */
+		JANUS_LOG(LOG_VERB, "Got a binary DataChannel message (%d bytes) to forward\n", len);
+		janus_videoroom_participant_listeners_foreach(participant, janus_videoroom_relay_data_packet, &packet);
+		return;
+	}
 	/* Get a string out of the data */
 	char *text = g_malloc(len+1);
 	memcpy(text, buf, len);
@@ -3458,12 +3650,20 @@ void janus_videoroom_incoming_data(janus_plugin_session *handle, char *buf, int
 	/* Save the message if we're recording */
 	janus_recorder_save_frame(participant->drc, text, strlen(text));
 	/* Relay to all listeners */
-	janus_mutex_lock_nodebug(&participant->listeners_mutex);
-	g_slist_foreach(participant->listeners, janus_videoroom_relay_data_packet, text);
-	janus_mutex_unlock_nodebug(&participant->listeners_mutex);
+	packet.buf = text;
+	packet.len = strlen(text);
+	janus_videoroom_participant_listeners_foreach(participant, janus_videoroom_relay_data_packet, &packet);
 	g_free(text);
 }
 
+void janus_videoroom_incoming_data(janus_plugin_session *handle, char *buf, int len) {
+	janus_videoroom_incoming_data_internal(handle, FALSE, buf, len);
+}
+
+void janus_videoroom_incoming_binary_data(janus_plugin_session *handle, char *buf, int len) {
+	janus_videoroom_incoming_data_internal(handle, TRUE, buf, len);
+}
+
 void janus_videoroom_slow_link(janus_plugin_session *handle, int uplink, int video) {
 	/* The core is informing us that our peer got too many NACKs, are we pushing media too hard? */
 	if(handle == NULL || handle->stopped || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized) || !gateway)
@@ -3640,6 +3840,7 @@ static void janus_videoroom_hangup_media_internal(janus_plugin_session *handle)
 		participant->remb_latest = 0;
 		participant->fir_latest = 0;
 		participant->fir_seq = 0;
+		janus_rtcp_keyframe_coalescer_reset(&participant->keyframe_requests);
 		/* Get rid of the recorders, if available */
 		janus_mutex_lock(&participant->rec_mutex);
 		janus_videoroom_recorder_close(participant);
@@ -3650,12 +3851,13 @@ static void janus_videoroom_hangup_media_internal(janus_plugin_session *handle)
 			if(l) {
 				participant->listeners = g_slist_remove(participant->listeners, l);
 				l->feed = NULL;
-				if(l->session && l->close_pc) {
+				if(l->session && l->close_pc && !janus_videoroom_listener_has_feeds(l)) {
 					l->room = NULL;
 					gateway->close_pc(l->session->handle);
 				}
 			}
 		}
+		janus_videoroom_participant_listeners_update(participant);
 		janus_mutex_unlock(&participant->listeners_mutex);
 		janus_videoroom_leave_or_unpublish(participant, FALSE, FALSE);
 		/* Also notify event handlers */
@@ -3675,6 +3877,7 @@ static void janus_videoroom_hangup_media_internal(janus_plugin_session *handle)
 			if(publisher != NULL) {
 				janus_mutex_lock(&publisher->listeners_mutex);
 				publisher->listeners = g_slist_remove(publisher->listeners, listener);
+				janus_videoroom_participant_listeners_update(publisher);
 				janus_mutex_unlock(&publisher->listeners_mutex);
 				listener->feed = NULL;
 				if(listener->pvt_id > 0) {
@@ -3694,6 +3897,12 @@ static void janus_videoroom_hangup_media_internal(janus_plugin_session *handle)
 					gateway->notify_event(&janus_videoroom_plugin, session->handle, info);
 				}
 			}
+			/* The feeds multiplexed on this PeerConnection are gone as well */
+			GList *temp = listener->multiplexed;
+			while(temp) {
+				janus_videoroom_listener_unsubscribe((janus_videoroom_listener *)temp->data);
+				temp = temp->next;
+			}
 		}
 		/* TODO Should we close the handle as well? */
 	}
@@ -3701,13 +3910,14 @@ static void janus_videoroom_hangup_media_internal(janus_plugin_session *handle)
 
 /* Thread to handle incoming messages */
 static void *janus_videoroom_handler(void *data) {
+	GAsyncQueue *queue = (GAsyncQueue *)data;
 	JANUS_LOG(LOG_VERB, "Joining VideoRoom handler thread\n");
 	janus_videoroom_message *msg = NULL;
 	int error_code = 0;
 	char error_cause[512];
 	json_t *root = NULL;
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		msg = g_async_queue_pop(messages);
+		msg = g_async_queue_pop(queue);
 		if(msg == &exit_message)
 			break;
 		if(msg->handle == NULL) {
@@ -3860,6 +4070,8 @@ static void *janus_videoroom_handler(void *data) {
 				publisher->listeners = NULL;
 				publisher->subscriptions = NULL;
 				janus_mutex_init(&publisher->listeners_mutex);
+				publisher->listeners_snapshot = NULL;
+				janus_mutex_init(&publisher->snapshot_mutex);
 				publisher->audio_pt = -1;	/* We'll deal with this later */
 				publisher->video_pt = -1;	/* We'll deal with this later */
 				publisher->audio_ssrc = janus_random_uint32(); // SDP中需要使用到
@@ -3872,6 +4084,7 @@ static void *janus_videoroom_handler(void *data) {
 				publisher->remb_latest = 0;
 				publisher->fir_latest = 0;
 				publisher->fir_seq = 0;
+				janus_rtcp_keyframe_coalescer_init(&publisher->keyframe_requests, keyframe_min_interval);
 				janus_mutex_init(&publisher->rtp_forwarders_mutex);
 				publisher->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_videoroom_rtp_forwarder_free_helper);
 				publisher->srtp_contexts = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)janus_videoroom_srtp_context_free_helper);
@@ -3915,6 +4128,8 @@ static void *janus_videoroom_handler(void *data) {
 				/* Done */
 				session->participant_type = janus_videoroom_p_type_publisher;
 				session->participant = publisher;
+				/* Publishers and their subscribers are kept on the same NUMA node, if NUMA aware */
+				gateway->set_placement_group(session->handle, videoroom->room_id);
 				/* Return a list of all available publishers (those with an SDP available, that is) */
 				json_t *list = json_array();
 				GHashTableIter iter;
@@ -3982,6 +4197,7 @@ static void *janus_videoroom_handler(void *data) {
 				json_t *offer_audio = json_object_get(root, "offer_audio");
 				json_t *offer_video = json_object_get(root, "offer_video");
 				json_t *offer_data = json_object_get(root, "offer_data");
+				json_t *multiplex = json_object_get(root, "multiplex");
 				janus_mutex_lock(&videoroom->mutex);
 				janus_videoroom_participant *owner = NULL;
 				janus_videoroom_participant *publisher = g_hash_table_lookup(videoroom->participants, &feed_id);
@@ -4004,12 +4220,50 @@ static void *janus_videoroom_handler(void *data) {
 							goto error;
 						}
 					}
+					/* Any additional feed to multiplex on the same PeerConnection? */
+					GList *feeds = NULL;
+					if(multiplex != NULL && json_array_size(multiplex) > 0) {
+						if(json_array_size(multiplex) > JANUS_VIDEOROOM_MAX_MULTIPLEXED_FEEDS) {
+							JANUS_LOG(LOG_ERR, "Too many feeds to multiplex (max %d)\n", JANUS_VIDEOROOM_MAX_MULTIPLEXED_FEEDS);
+							error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+							g_snprintf(error_cause, 512, "Too many feeds to multiplex (max %d)", JANUS_VIDEOROOM_MAX_MULTIPLEXED_FEEDS);
+							goto error;
+						}
+						size_t i = 0;
+						janus_mutex_lock(&videoroom->mutex);
+						for(i=0; i<json_array_size(multiplex); i++) {
+							json_t *mfeed = json_array_get(multiplex, i);
+							guint64 mfeed_id = json_is_integer(mfeed) ? json_integer_value(mfeed) : 0;
+							janus_videoroom_participant *p = mfeed_id > 0 ?
+								g_hash_table_lookup(videoroom->participants, &mfeed_id) : NULL;
+							if(p == NULL || p->sdp == NULL || p == publisher || g_list_find(feeds, p)) {
+								JANUS_LOG(LOG_ERR, "Invalid feed to multiplex (%"SCNu64")\n", mfeed_id);
+								error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
+								g_snprintf(error_cause, 512, "Invalid feed to multiplex (%"SCNu64")", mfeed_id);
+								break;
+							}
+							if((p->audio && publisher->audio && p->acodec != publisher->acodec) ||
+									(p->video && publisher->video && p->vcodec != publisher->vcodec)) {
+								JANUS_LOG(LOG_ERR, "Feed %"SCNu64" is not using the same codecs, can't multiplex it\n", mfeed_id);
+								error_code = JANUS_VIDEOROOM_ERROR_INVALID_SDP;
+								g_snprintf(error_cause, 512, "Feed %"SCNu64" is not using the same codecs, can't multiplex it", mfeed_id);
+								break;
+							}
+							feeds = g_list_append(feeds, p);
+						}
+						janus_mutex_unlock(&videoroom->mutex);
+						if(error_code != 0) {
+							g_list_free(feeds);
+							goto error;
+						}
+					}
 					// 创建数据接受者
 					janus_videoroom_listener *listener = g_malloc0(sizeof(janus_videoroom_listener));
 					listener->session = session;			// 关联janus_videoroom_session
 					listener->room_id = videoroom->room_id;
 					listener->room = videoroom;
 					listener->feed = publisher;				// 关联数据发送者
+					listener->fanout_shard = (guint)g_atomic_int_add(&fanout_next_shard, 1);
 					listener->pvt_id = pvt_id;
 					listener->close_pc = close_pc;
 					/* Initialize the listener context */
@@ -4022,6 +4276,7 @@ static void *janus_videoroom_handler(void *data) {
 							(!publisher->video || !listener->video_offered) &&
 							(!publisher->data || !listener->data_offered)) {
 						g_free(listener);
+						g_list_free(feeds);
 						JANUS_LOG(LOG_ERR, "Can't offer an SDP with no audio, video or data\n");
 						error_code = JANUS_VIDEOROOM_ERROR_INVALID_SDP;
 						g_snprintf(error_cause, 512, "Can't offer an SDP with no audio, video or data");
@@ -4043,7 +4298,9 @@ static void *janus_videoroom_handler(void *data) {
 					listener->templayer_target = 2;
 					listener->last_relayed = 0;
 					janus_vp8_simulcast_context_reset(&listener->simulcast_context);
+					janus_simulcast_bwe_context_reset(&listener->bwe);
 					session->participant = listener;
+					gateway->set_placement_group(session->handle, videoroom->room_id);
 					if(videoroom->do_svc) {
 						/* This listener belongs to a room where VP9 SVC has been enabled,
 						 * let's assume we're interested in all layers for the time being */
@@ -4056,18 +4313,82 @@ static void *janus_videoroom_handler(void *data) {
 					// 数据转发是基于 发布和订阅模型，接收到rtp包之后通过轮询监听者完成转发。
 					janus_mutex_lock(&publisher->listeners_mutex);
 					publisher->listeners = g_slist_append(publisher->listeners, listener);
+					janus_videoroom_participant_listeners_update(publisher);
 					janus_mutex_unlock(&publisher->listeners_mutex);
 					if(owner != NULL) {
 						janus_mutex_lock(&owner->listeners_mutex);
 						owner->subscriptions = g_slist_append(owner->subscriptions, listener);
 						janus_mutex_unlock(&owner->listeners_mutex);
 					}
+					/* The multiplexed feeds, if any, share this session (and so the PeerConnection) */
+					json_t *list = feeds ? json_array() : NULL;
+					GList *temp = feeds;
+					while(temp) {
+						janus_videoroom_participant *p = (janus_videoroom_participant *)temp->data;
+						janus_videoroom_listener *s = g_malloc0(sizeof(janus_videoroom_listener));
+						s->session = session;
+						s->room_id = videoroom->room_id;
+						s->room = videoroom;
+						s->feed = p;
+						s->primary = listener;
+						s->fanout_shard = (guint)g_atomic_int_add(&fanout_next_shard, 1);
+						s->pvt_id = pvt_id;
+						s->close_pc = close_pc;
+						janus_rtp_switching_context_reset(&s->context);
+						/* This feed can only use the m-lines of the primary's offer */
+						s->audio_offered = p->audio && publisher->audio && listener->audio_offered;
+						s->video_offered = p->video && publisher->video && listener->video_offered;
+						s->data_offered = FALSE;
+						s->audio = s->audio_offered && (audio ? json_is_true(audio) : TRUE);
+						s->video = s->video_offered && (video ? json_is_true(video) : TRUE);
+						s->data = FALSE;
+						if(s->audio_offered)
+							s->audio_ssrc = janus_random_uint32();
+						if(s->video_offered)
+							s->video_ssrc = janus_random_uint32();
+						s->paused = TRUE;
+						s->substream = -1;
+						s->substream_target = 2;
+						s->templayer = -1;
+						s->templayer_target = 2;
+						s->last_relayed = 0;
+						janus_vp8_simulcast_context_reset(&s->simulcast_context);
+						janus_simulcast_bwe_context_reset(&s->bwe);
+						if(videoroom->do_svc) {
+							s->spatial_layer = -1;
+							s->target_spatial_layer = 1;
+							s->temporal_layer = -1;
+							s->target_temporal_layer = 2;
+						}
+						listener->multiplexed = g_list_append(listener->multiplexed, s);
+						janus_mutex_lock(&p->listeners_mutex);
+						p->listeners = g_slist_append(p->listeners, s);
+						janus_videoroom_participant_listeners_update(p);
+						janus_mutex_unlock(&p->listeners_mutex);
+						if(owner != NULL) {
+							janus_mutex_lock(&owner->listeners_mutex);
+							owner->subscriptions = g_slist_append(owner->subscriptions, s);
+							janus_mutex_unlock(&owner->listeners_mutex);
+						}
+						json_t *mfeed = json_object();
+						json_object_set_new(mfeed, "id", json_integer(p->user_id));
+						if(p->display)
+							json_object_set_new(mfeed, "display", json_string(p->display));
+						char stream[32];
+						g_snprintf(stream, sizeof(stream), "janus%"SCNu64, p->user_id);
+						json_object_set_new(mfeed, "stream", json_string(stream));
+						json_array_append_new(list, mfeed);
+						temp = temp->next;
+					}
+					g_list_free(feeds);
 					event = json_object();
 					json_object_set_new(event, "videoroom", json_string("attached"));
 					json_object_set_new(event, "room", json_integer(videoroom->room_id));
 					json_object_set_new(event, "id", json_integer(feed_id));
 					if(publisher->display)
 						json_object_set_new(event, "display", json_string(publisher->display));
+					if(list != NULL)
+						json_object_set_new(event, "multiplexed", list);
 					session->participant_type = janus_videoroom_p_type_subscriber;
 					JANUS_LOG(LOG_VERB, "Preparing JSON event as a reply\n");
 					/* Negotiate by sending the selected publisher SDP back */
@@ -4091,6 +4412,10 @@ static void *janus_videoroom_handler(void *data) {
 							if(publisher->data && !listener->data_offered)
 								janus_sdp_mline_remove(offer, JANUS_SDP_APPLICATION);
 						}
+						if(listener->multiplexed != NULL) {
+							janus_videoroom_listener_sdp_multiplex(listener, janus_sdp_mline_find(offer, JANUS_SDP_AUDIO));
+							janus_videoroom_listener_sdp_multiplex(listener, janus_sdp_mline_find(offer, JANUS_SDP_VIDEO));
+						}
 						sdp = janus_sdp_write(offer);
 						json_t *jsep = json_pack("{ssss}", "type", "offer", "sdp", sdp);
 						g_free(sdp);
@@ -4279,20 +4604,8 @@ static void *janus_videoroom_handler(void *data) {
 							strstr(participant->sdp, "m=video") != NULL,
 							strstr(participant->sdp, "m=application") != NULL);
 						if(strstr(participant->sdp, "m=video")) {
-							/* Send a FIR */
-							char buf[20];
-							memset(buf, 0, 20);
-							janus_rtcp_fir((char *)&buf, 20, &participant->fir_seq);
-							JANUS_LOG(LOG_VERB, "Recording video, sending FIR to %"SCNu64" (%s)\n",
-								participant->user_id, participant->display ? participant->display : "??");
-							gateway->relay_rtcp(participant->session->handle, 1, buf, 20);
-							/* Send a PLI too, just in case... */
-							janus_rtcp_pli((char *)&buf, 12);
-							JANUS_LOG(LOG_VERB, "Recording video, sending PLI to %"SCNu64" (%s)\n",
-								participant->user_id, participant->display ? participant->display : "??");
-							gateway->relay_rtcp(participant->session->handle, 1, buf, 12);
-							/* Update the time of when we last sent a keyframe request */
-							participant->fir_latest = janus_get_monotonic_time();
+							/* Ask the publisher for a keyframe */
+							janus_videoroom_reqkey(participant, TRUE, "Recording video");
 						}
 					}
 				}
@@ -4403,6 +4716,11 @@ static void *janus_videoroom_handler(void *data) {
 			} else if(!strcasecmp(request_text, "start")) {
 				/* Start/restart receiving the publisher streams */
 				listener->paused = FALSE;
+				GList *temp = listener->multiplexed;
+				while(temp) {
+					((janus_videoroom_listener *)temp->data)->paused = FALSE;
+					temp = temp->next;
+				}
 				event = json_object();
 				json_object_set_new(event, "videoroom", json_string("event"));
 				json_object_set_new(event, "room", json_integer(listener->room_id));
@@ -4440,6 +4758,25 @@ static void *janus_videoroom_handler(void *data) {
 					g_snprintf(error_cause, 512, "Invalid value (temporal should be 0, 1 or 2)");
 					goto error;
 				}
+				json_t *feed = json_object_get(root, "feed");
+				if(feed != NULL) {
+					/* Configure one of the feeds multiplexed on this PeerConnection */
+					guint64 feed_id = json_integer_value(feed);
+					janus_videoroom_listener *target = janus_videoroom_listener_find(listener, feed_id);
+					if(target == NULL) {
+						JANUS_LOG(LOG_ERR, "No such feed on this listener (%"SCNu64")\n", feed_id);
+						error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
+						g_snprintf(error_cause, 512, "No such feed on this listener (%"SCNu64")", feed_id);
+						goto error;
+					}
+					if(target != listener && (sdp_update || (restart && json_is_true(restart)) || (update && json_is_true(update)))) {
+						JANUS_LOG(LOG_ERR, "Can't renegotiate when configuring a multiplexed feed\n");
+						error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+						g_snprintf(error_cause, 512, "Can't renegotiate when configuring a multiplexed feed");
+						goto error;
+					}
+					listener = target;
+				}
 				/* Update the audio/video/data flags, if set */
 				janus_videoroom_participant *publisher = listener->feed;
 				if(publisher) {
@@ -4448,17 +4785,8 @@ static void *janus_videoroom_handler(void *data) {
 					if(video && publisher->video && listener->video_offered) {
 						listener->video = json_is_true(video);
 						if(listener->video) {
-							/* Send a FIR */
-							char buf[20];
-							janus_rtcp_fir((char *)&buf, 20, &publisher->fir_seq);
-							JANUS_LOG(LOG_VERB, "Restoring video for listener, sending FIR to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-							gateway->relay_rtcp(publisher->session->handle, 1, buf, 20);
-							/* Send a PLI too, just in case... */
-							janus_rtcp_pli((char *)&buf, 12);
-							JANUS_LOG(LOG_VERB, "Restoring video for listener, sending PLI to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-							gateway->relay_rtcp(publisher->session->handle, 1, buf, 12);
-							/* Update the time of when we last sent a keyframe request */
-							publisher->fir_latest = janus_get_monotonic_time();
+							/* Ask the publisher for a keyframe */
+							janus_videoroom_reqkey(publisher, TRUE, "Restoring video for listener");
 						}
 					}
 					if(data && publisher->data && listener->data_offered)
@@ -4466,28 +4794,19 @@ static void *janus_videoroom_handler(void *data) {
 					/* Check if a simulcasting-related request is involved */
 					if(sc_substream && publisher->ssrc[0] != 0) {
 						listener->substream_target = json_integer_value(sc_substream);
+						/* If we pick substreams automatically, this is the highest we can send */
+						listener->bwe.max_substream = listener->substream_target;
 						JANUS_LOG(LOG_VERB, "Setting video SSRC to let through (simulcast): %"SCNu32" (index %d, was %d)\n",
 							publisher->ssrc[listener->substream], listener->substream_target, listener->substream);
 						if(listener->substream_target == listener->substream) {
 							/* No need to do anything, we're already getting the right substream, so notify the user */
-							json_t *event = json_object();
-							json_object_set_new(event, "videoroom", json_string("event"));
-							json_object_set_new(event, "room", json_integer(listener->room_id));
+							json_t *event = janus_videoroom_listener_event(listener);
 							json_object_set_new(event, "substream", json_integer(listener->substream));
 							gateway->push_event(msg->handle, &janus_videoroom_plugin, NULL, event, NULL);
 							json_decref(event);
 						} else {
-							/* Send a FIR */
-							char buf[20];
-							janus_rtcp_fir((char *)&buf, 20, &publisher->fir_seq);
-							JANUS_LOG(LOG_VERB, "Simulcasting substream change, sending FIR to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-							gateway->relay_rtcp(publisher->session->handle, 1, buf, 20);
-							/* Send a PLI too, just in case... */
-							janus_rtcp_pli((char *)&buf, 12);
-							JANUS_LOG(LOG_VERB, "Simulcasting substream change, sending PLI to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-							gateway->relay_rtcp(publisher->session->handle, 1, buf, 12);
-							/* Update the time of when we last sent a keyframe request */
-							publisher->fir_latest = janus_get_monotonic_time();
+							/* Ask the publisher for a keyframe */
+							janus_videoroom_reqkey(publisher, TRUE, "Simulcasting substream change");
 						}
 					}
 					if(sc_temporal && publisher->ssrc[0] != 0) {
@@ -4496,24 +4815,13 @@ static void *janus_videoroom_handler(void *data) {
 							listener->templayer_target, listener->templayer);
 						if(listener->templayer_target == listener->templayer) {
 							/* No need to do anything, we're already getting the right temporal, so notify the user */
-							json_t *event = json_object();
-							json_object_set_new(event, "videoroom", json_string("event"));
-							json_object_set_new(event, "room", json_integer(listener->room_id));
+							json_t *event = janus_videoroom_listener_event(listener);
 							json_object_set_new(event, "temporal", json_integer(listener->templayer));
 							gateway->push_event(msg->handle, &janus_videoroom_plugin, NULL, event, NULL);
 							json_decref(event);
 						} else {
-							/* Send a FIR */
-							char buf[20];
-							janus_rtcp_fir((char *)&buf, 20, &publisher->fir_seq);
-							JANUS_LOG(LOG_VERB, "Simulcasting temporal layer change, sending FIR to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-							gateway->relay_rtcp(publisher->session->handle, 1, buf, 20);
-							/* Send a PLI too, just in case... */
-							janus_rtcp_pli((char *)&buf, 12);
-							JANUS_LOG(LOG_VERB, "Simulcasting temporal layer change, sending PLI to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-							gateway->relay_rtcp(publisher->session->handle, 1, buf, 12);
-							/* Update the time of when we last sent a keyframe request */
-							publisher->fir_latest = janus_get_monotonic_time();
+							/* Ask the publisher for a keyframe */
+							janus_videoroom_reqkey(publisher, TRUE, "Simulcasting temporal layer change");
 						}
 					}
 				}
@@ -4526,24 +4834,13 @@ static void *janus_videoroom_handler(void *data) {
 						}
 						if(spatial_layer == listener->spatial_layer) {
 							/* No need to do anything, we're already getting the right spatial layer, so notify the user */
-							json_t *event = json_object();
-							json_object_set_new(event, "videoroom", json_string("event"));
-							json_object_set_new(event, "room", json_integer(listener->room_id));
+							json_t *event = janus_videoroom_listener_event(listener);
 							json_object_set_new(event, "spatial_layer", json_integer(listener->spatial_layer));
 							gateway->push_event(msg->handle, &janus_videoroom_plugin, NULL, event, NULL);
 							json_decref(event);
 						} else if(spatial_layer != listener->target_spatial_layer) {
-							/* Send a FIR to the new RTP forward publisher */
-							char buf[20];
-							janus_rtcp_fir((char *)&buf, 20, &publisher->fir_seq);
-							JANUS_LOG(LOG_VERB, "Need to downscale spatially, sending FIR to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-							gateway->relay_rtcp(publisher->session->handle, 1, buf, 20);
-							/* Send a PLI too, just in case... */
-							janus_rtcp_pli((char *)&buf, 12);
-							JANUS_LOG(LOG_VERB, "Need to downscale spatially, sending PLI to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-							gateway->relay_rtcp(publisher->session->handle, 1, buf, 12);
-							/* Update the time of when we last sent a keyframe request */
-							publisher->fir_latest = janus_get_monotonic_time();
+							/* Ask the publisher for a keyframe */
+							janus_videoroom_reqkey(publisher, TRUE, "Need to downscale spatially");
 						}
 						listener->target_spatial_layer = spatial_layer;
 					}
@@ -4554,9 +4851,7 @@ static void *janus_videoroom_handler(void *data) {
 						}
 						if(temporal_layer == listener->temporal_layer) {
 							/* No need to do anything, we're already getting the right temporal layer, so notify the user */
-							json_t *event = json_object();
-							json_object_set_new(event, "videoroom", json_string("event"));
-							json_object_set_new(event, "room", json_integer(listener->room_id));
+							json_t *event = janus_videoroom_listener_event(listener);
 							json_object_set_new(event, "temporal_layer", json_integer(listener->temporal_layer));
 							gateway->push_event(msg->handle, &janus_videoroom_plugin, NULL, event, NULL);
 							json_decref(event);
@@ -4564,9 +4859,7 @@ static void *janus_videoroom_handler(void *data) {
 						listener->target_temporal_layer = temporal_layer;
 					}
 				}
-				event = json_object();
-				json_object_set_new(event, "videoroom", json_string("event"));
-				json_object_set_new(event, "room", json_integer(listener->room_id));
+				event = janus_videoroom_listener_event(listener);
 				json_object_set_new(event, "configured", json_string("ok"));
 				/* The user may be interested in an ICE restart */
 				gboolean do_restart = restart ? json_is_true(restart) : FALSE;
@@ -4638,6 +4931,7 @@ static void *janus_videoroom_handler(void *data) {
 											janus_sdp_attribute_create(a->name, "%s", a->value));
 										attr = attr->next;
 									}
+									janus_videoroom_listener_sdp_multiplex(listener, m);
 								}
 							}
 						}
@@ -4668,6 +4962,11 @@ static void *janus_videoroom_handler(void *data) {
 			} else if(!strcasecmp(request_text, "pause")) {
 				/* Stop receiving the publisher streams for a while */
 				listener->paused = TRUE;
+				GList *temp = listener->multiplexed;
+				while(temp) {
+					((janus_videoroom_listener *)temp->data)->paused = TRUE;
+					temp = temp->next;
+				}
 				event = json_object();
 				json_object_set_new(event, "videoroom", json_string("event"));
 				json_object_set_new(event, "room", json_integer(listener->room_id));
@@ -4721,6 +5020,7 @@ static void *janus_videoroom_handler(void *data) {
 					/* Go on */
 					janus_mutex_lock(&prev_feed->listeners_mutex);
 					prev_feed->listeners = g_slist_remove(prev_feed->listeners, listener);
+					janus_videoroom_participant_listeners_update(prev_feed);
 					janus_mutex_unlock(&prev_feed->listeners_mutex);
 					listener->feed = NULL;
 				}
@@ -4744,19 +5044,11 @@ static void *janus_videoroom_handler(void *data) {
 				}
 				janus_mutex_lock(&publisher->listeners_mutex);
 				publisher->listeners = g_slist_append(publisher->listeners, listener);
+				janus_videoroom_participant_listeners_update(publisher);
 				janus_mutex_unlock(&publisher->listeners_mutex);
 				listener->feed = publisher;
-				/* Send a FIR to the new publisher */
-				char buf[20];
-				janus_rtcp_fir((char *)&buf, 20, &publisher->fir_seq);
-				JANUS_LOG(LOG_VERB, "Switching existing listener to new publisher, sending FIR to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-				gateway->relay_rtcp(publisher->session->handle, 1, buf, 20);
-				/* Send a PLI too, just in case... */
-				janus_rtcp_pli((char *)&buf, 12);
-				JANUS_LOG(LOG_VERB, "Switching existing listener to new publisher, sending PLI to %"SCNu64" (%s)\n", publisher->user_id, publisher->display ? publisher->display : "??");
-				gateway->relay_rtcp(publisher->session->handle, 1, buf, 12);
-				/* Update the time of when we last sent a keyframe request */
-				publisher->fir_latest = janus_get_monotonic_time();
+				/* Ask the publisher for a keyframe */
+				janus_videoroom_reqkey(publisher, TRUE, "Switching existing listener to new publisher");
 				/* Done */
 				listener->paused = paused;
 				event = json_object();
@@ -4779,6 +5071,7 @@ static void *janus_videoroom_handler(void *data) {
 				if(publisher != NULL) {
 					janus_mutex_lock(&publisher->listeners_mutex);
 					publisher->listeners = g_slist_remove(publisher->listeners, listener);
+					janus_videoroom_participant_listeners_update(publisher);
 					janus_mutex_unlock(&publisher->listeners_mutex);
 					listener->feed = NULL;
 				}
@@ -4794,6 +5087,11 @@ static void *janus_videoroom_handler(void *data) {
 				json_object_set_new(event, "videoroom", json_string("event"));
 				json_object_set_new(event, "room", json_integer(listener->room_id));
 				json_object_set_new(event, "left", json_string("ok"));
+				GList *temp = listener->multiplexed;
+				while(temp) {
+					janus_videoroom_listener_unsubscribe((janus_videoroom_listener *)temp->data);
+					temp = temp->next;
+				}
 				session->started = FALSE;
 			} else {
 				JANUS_LOG(LOG_ERR, "Unknown request '%s'\n", request_text);
@@ -4949,12 +5247,13 @@ static void *janus_videoroom_handler(void *data) {
 				JANUS_LOG(LOG_VERB, "The publisher %s going to send a video stream\n", participant->video ? "is" : "is NOT");
 				JANUS_LOG(LOG_VERB, "The publisher %s going to open a data channel\n", participant->data ? "is" : "is NOT");
 				/* Check the codecs we can use, or the ones we should */
+				janus_sdp_negotiation *negotiation = janus_sdp_negotiation_create(offer);
 				if(participant->acodec == JANUS_VIDEOROOM_NOAUDIO) {
 					int i=0;
 					for(i=0; i<3; i++) {
 						if(participant->room->acodec[i] == JANUS_VIDEOROOM_NOAUDIO)
 							continue;
-						if(janus_sdp_get_codec_pt(offer, janus_videoroom_audiocodec_name(participant->room->acodec[i])) != -1) {
+						if(janus_sdp_negotiation_get_codec_pt(negotiation, janus_videoroom_audiocodec_name(participant->room->acodec[i])) != -1) {
 							participant->acodec = participant->room->acodec[i];
 							break;
 						}
@@ -4967,12 +5266,13 @@ static void *janus_videoroom_handler(void *data) {
 					for(i=0; i<3; i++) {
 						if(participant->room->vcodec[i] == JANUS_VIDEOROOM_NOVIDEO)
 							continue;
-						if(janus_sdp_get_codec_pt(offer, janus_videoroom_videocodec_name(participant->room->vcodec[i])) != -1) {
+						if(janus_sdp_negotiation_get_codec_pt(negotiation, janus_videoroom_videocodec_name(participant->room->vcodec[i])) != -1) {
 							participant->vcodec = participant->room->vcodec[i];
 							break;
 						}
 					}
 				}
+				janus_sdp_negotiation_destroy(negotiation);
 				JANUS_LOG(LOG_VERB, "The publisher is going to use the %s video codec\n", janus_videoroom_videocodec_name(participant->vcodec));
 				participant->video_pt = janus_videoroom_videocodec_pt(participant->vcodec);
 				// 根据传入的offer和传入的参数创建answer
@@ -5188,7 +5488,7 @@ static void *janus_videoroom_handler(void *data) {
 							msg->transaction = NULL;
 							msg->jsep = NULL;
 							json_incref(update);
-							g_async_queue_push(messages, msg);
+							g_async_queue_push(janus_handler_pool_queue(handlers, msg->handle), msg);
 						}
 						s = s->next;
 					}
@@ -5222,6 +5522,38 @@ error:
 
 /* Helper to quickly relay RTP packets from publishers to subscribers */
 // 转发RTP数据
+/* Relays a packet whose header has been updated for a listener: the payload is shared, if possible */
+static void janus_videoroom_relay_rtp_send(janus_videoroom_session *session, janus_videoroom_rtp_relay_packet *packet) {
+	if(packet->shared != NULL)
+		gateway->relay_rtp_shared(session->handle, packet->shared);
+	else
+		gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+}
+
+static void janus_videoroom_relay_rtp_listener(janus_videoroom_listener *listener, janus_videoroom_rtp_relay_packet *packet) {
+	if(listener->primary == NULL) {
+		/* The core will rewrite the SSRC for this PeerConnection */
+		janus_videoroom_relay_rtp_send(listener->session, packet);
+		return;
+	}
+	/* Multiplexed feed: the core leaves the SSRC we advertised for it alone (payload
+	 * types are fine already, as they only depend on the codecs, which must match) */
+	uint32_t ssrc = packet->data->ssrc;
+	packet->data->ssrc = htonl(packet->is_video ? listener->video_ssrc : listener->audio_ssrc);
+	janus_videoroom_relay_rtp_send(listener->session, packet);
+	packet->data->ssrc = ssrc;
+}
+
+/* Events for a listener mention the feed as well, if it's multiplexed */
+static json_t *janus_videoroom_listener_event(janus_videoroom_listener *listener) {
+	json_t *event = json_object();
+	json_object_set_new(event, "videoroom", json_string("event"));
+	json_object_set_new(event, "room", json_integer(listener->room_id));
+	if(listener->primary != NULL && listener->feed != NULL)
+		json_object_set_new(event, "feed", json_integer(listener->feed->user_id));
+	return event;
+}
+
 static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data) {
 	janus_videoroom_rtp_relay_packet *packet = (janus_videoroom_rtp_relay_packet *)user_data;
 	if(!packet || !packet->data || packet->length < 1) {
@@ -5255,7 +5587,7 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			return;
 		}
 		/* Check if there's any SVC info to take into account */
-		if(packet->svc) {
+		if(packet->video.svc) {
 			/* There is: check if this is a layer that can be dropped for this viewer
 			 * Note: Following core inspired by the excellent job done by Sergio Garcia Murillo here:
 			 * https://github.com/medooze/media-server/blob/master/src/vp9/VP9LayerSelector.cpp */
@@ -5264,15 +5596,13 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			if(listener->target_temporal_layer > listener->temporal_layer) {
 				/* We need to upscale */
 				JANUS_LOG(LOG_HUGE, "We need to upscale temporally:\n");
-				if(packet->ubit && packet->bbit && packet->temporal_layer <= listener->target_temporal_layer) {
+				if(packet->video.ubit && packet->video.bbit && packet->video.temporal_layer <= listener->target_temporal_layer) {
 					JANUS_LOG(LOG_HUGE, "  -- Upscaling temporal layer: %u --> %u\n",
-						packet->temporal_layer, listener->target_temporal_layer);
-					listener->temporal_layer = packet->temporal_layer;
+						packet->video.temporal_layer, listener->target_temporal_layer);
+					listener->temporal_layer = packet->video.temporal_layer;
 					temporal_layer = listener->temporal_layer;
 					/* Notify the viewer */
-					json_t *event = json_object();
-					json_object_set_new(event, "videoroom", json_string("event"));
-					json_object_set_new(event, "room", json_integer(listener->room_id));
+					json_t *event = janus_videoroom_listener_event(listener);
 					json_object_set_new(event, "temporal_layer", json_integer(listener->temporal_layer));
 					gateway->push_event(listener->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
 					json_decref(event);
@@ -5280,22 +5610,20 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			} else if(listener->target_temporal_layer < listener->temporal_layer) {
 				/* We need to downscale */
 				JANUS_LOG(LOG_HUGE, "We need to downscale temporally:\n");
-				if(packet->ebit) {
+				if(packet->video.ebit) {
 					JANUS_LOG(LOG_HUGE, "  -- Downscaling temporal layer: %u --> %u\n",
 						listener->temporal_layer, listener->target_temporal_layer);
 					listener->temporal_layer = listener->target_temporal_layer;
 					/* Notify the viewer */
-					json_t *event = json_object();
-					json_object_set_new(event, "videoroom", json_string("event"));
-					json_object_set_new(event, "room", json_integer(listener->room_id));
+					json_t *event = janus_videoroom_listener_event(listener);
 					json_object_set_new(event, "temporal_layer", json_integer(listener->temporal_layer));
 					gateway->push_event(listener->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
 					json_decref(event);
 				}
 			}
-			if(temporal_layer < packet->temporal_layer) {
+			if(temporal_layer < packet->video.temporal_layer) {
 				/* Drop the packet: update the context to make sure sequence number is increased normally later */
-				JANUS_LOG(LOG_HUGE, "Dropping packet (temporal layer %d < %d)\n", temporal_layer, packet->temporal_layer);
+				JANUS_LOG(LOG_HUGE, "Dropping packet (temporal layer %d < %d)\n", temporal_layer, packet->video.temporal_layer);
 				listener->context.v_base_seq++;
 				return;
 			}
@@ -5303,15 +5631,13 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			if(listener->target_spatial_layer > listener->spatial_layer) {
 				JANUS_LOG(LOG_HUGE, "We need to upscale spatially:\n");
 				/* We need to upscale */
-				if(packet->pbit == 0 && packet->bbit && packet->spatial_layer == listener->spatial_layer+1) {
+				if(packet->video.pbit == 0 && packet->video.bbit && packet->video.spatial_layer == listener->spatial_layer+1) {
 					JANUS_LOG(LOG_HUGE, "  -- Upscaling spatial layer: %u --> %u\n",
-						packet->spatial_layer, listener->target_spatial_layer);
-					listener->spatial_layer = packet->spatial_layer;
+						packet->video.spatial_layer, listener->target_spatial_layer);
+					listener->spatial_layer = packet->video.spatial_layer;
 					spatial_layer = listener->spatial_layer;
 					/* Notify the viewer */
-					json_t *event = json_object();
-					json_object_set_new(event, "videoroom", json_string("event"));
-					json_object_set_new(event, "room", json_integer(listener->room_id));
+					json_t *event = janus_videoroom_listener_event(listener);
 					json_object_set_new(event, "spatial_layer", json_integer(listener->spatial_layer));
 					gateway->push_event(listener->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
 					json_decref(event);
@@ -5319,39 +5645,37 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			} else if(listener->target_spatial_layer < listener->spatial_layer) {
 				/* We need to downscale */
 				JANUS_LOG(LOG_HUGE, "We need to downscale spatially:\n");
-				if(packet->ebit) {
+				if(packet->video.ebit) {
 					JANUS_LOG(LOG_HUGE, "  -- Downscaling spatial layer: %u --> %u\n",
 						listener->spatial_layer, listener->target_spatial_layer);
 					listener->spatial_layer = listener->target_spatial_layer;
 					/* Notify the viewer */
-					json_t *event = json_object();
-					json_object_set_new(event, "videoroom", json_string("event"));
-					json_object_set_new(event, "room", json_integer(listener->room_id));
+					json_t *event = janus_videoroom_listener_event(listener);
 					json_object_set_new(event, "spatial_layer", json_integer(listener->spatial_layer));
 					gateway->push_event(listener->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
 					json_decref(event);
 				}
 			}
-			if(spatial_layer < packet->spatial_layer) {
+			if(spatial_layer < packet->video.spatial_layer) {
 				/* Drop the packet: update the context to make sure sequence number is increased normally later */
-				JANUS_LOG(LOG_HUGE, "Dropping packet (spatial layer %d < %d)\n", spatial_layer, packet->spatial_layer);
+				JANUS_LOG(LOG_HUGE, "Dropping packet (spatial layer %d < %d)\n", spatial_layer, packet->video.spatial_layer);
 				listener->context.v_base_seq++;
 				return;
-			} else if(packet->ebit && spatial_layer == packet->spatial_layer) {
+			} else if(packet->video.ebit && spatial_layer == packet->video.spatial_layer) {
 				/* If we stop at layer 0, we need a marker bit now, as the one from layer 1 will not be received */
 				override_mark_bit = TRUE;
 			}
 			/* If we got here, we can send the frame: this doesn't necessarily mean it's
 			 * one of the layers the user wants, as there may be dependencies involved */
 			JANUS_LOG(LOG_HUGE, "Sending packet (spatial=%d, temporal=%d)\n",
-				packet->spatial_layer, packet->temporal_layer);
+				packet->video.spatial_layer, packet->video.temporal_layer);
 			/* Fix sequence number and timestamp (publisher switching may be involved) */
 			janus_rtp_header_update(packet->data, &listener->context, TRUE, 4500);
 			if(override_mark_bit && !has_marker_bit) {
 				packet->data->markerbit = 1;
 			}
 			if(gateway != NULL)
-				gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+				janus_videoroom_relay_rtp_listener(listener, packet);
 			if(override_mark_bit && !has_marker_bit) {
 				packet->data->markerbit = 0;
 			}
@@ -5378,9 +5702,7 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 						listener->substream = (ssrc == packet->ssrc[listener->substream_target] ? listener->substream_target : step);;
 						switched = TRUE;
 						/* Notify the viewer */
-						json_t *event = json_object();
-						json_object_set_new(event, "videoroom", json_string("event"));
-						json_object_set_new(event, "room", json_integer(listener->room_id));
+						json_t *event = janus_videoroom_listener_event(listener);
 						json_object_set_new(event, "substream", json_integer(listener->substream));
 						gateway->push_event(listener->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
 						json_decref(event);
@@ -5406,19 +5728,9 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 							listener->substream, substream);
 						listener->substream = substream;
 						/* Send a PLI */
-						JANUS_LOG(LOG_VERB, "Just (re-)enabled	 video, sending a PLI to recover it\n");
-						char rtcpbuf[12];
-						memset(rtcpbuf, 0, 12);
-						janus_rtcp_pli((char *)&rtcpbuf, 12);
-						if(listener->feed && listener->feed->session && listener->feed->session->handle) {
-							gateway->relay_rtcp(listener->feed->session->handle, 1, rtcpbuf, 12);
-							/* Update the time of when we last sent a keyframe request */
-							listener->feed->fir_latest = janus_get_monotonic_time();
-						}
+						janus_videoroom_reqkey(listener->feed, FALSE, "Falling back to a lower substream");
 						/* Notify the viewer */
-						json_t *event = json_object();
-						json_object_set_new(event, "videoroom", json_string("event"));
-						json_object_set_new(event, "room", json_integer(listener->room_id));
+						json_t *event = janus_videoroom_listener_event(listener);
 						json_object_set_new(event, "substream", json_integer(listener->substream));
 						gateway->push_event(listener->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
 						json_decref(event);
@@ -5432,31 +5744,22 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			}
 			listener->last_relayed = janus_get_monotonic_time();
 			/* Check if there's any temporal scalability to take into account */
-			uint16_t picid = 0;
-			uint8_t tlzi = 0;
-			uint8_t tid = 0;
-			uint8_t ybit = 0;
-			uint8_t keyidx = 0;
-			if(janus_vp8_parse_descriptor(payload, plen, &picid, &tlzi, &tid, &ybit, &keyidx) == 0) {
-				//~ JANUS_LOG(LOG_WARN, "%"SCNu16", %u, %u, %u, %u\n", picid, tlzi, tid, ybit, keyidx);
-				if(listener->templayer != listener->templayer_target) {
-					/* FIXME We should be smarter in deciding when to switch */
-					listener->templayer = listener->templayer_target;
-					/* Notify the user */
-					json_t *event = json_object();
-					json_object_set_new(event, "videoroom", json_string("event"));
-					json_object_set_new(event, "room", json_integer(listener->room_id));
-					json_object_set_new(event, "temporal", json_integer(listener->templayer));
-					gateway->push_event(listener->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
-					json_decref(event);
-				}
-				if(tid > listener->templayer) {
-					JANUS_LOG(LOG_HUGE, "Dropping packet (it's temporal layer %d, but we're capping at %d)\n",
-						tid, listener->templayer);
-					/* We increase the base sequence number, or there will be gaps when delivering later */
-					listener->context.v_base_seq++;
-					return;
-				}
+			int tid = packet->video.temporal_layer;
+			if(listener->templayer != listener->templayer_target) {
+				/* FIXME We should be smarter in deciding when to switch */
+				listener->templayer = listener->templayer_target;
+				/* Notify the user */
+				json_t *event = janus_videoroom_listener_event(listener);
+				json_object_set_new(event, "temporal", json_integer(listener->templayer));
+				gateway->push_event(listener->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
+				json_decref(event);
+			}
+			if(tid > listener->templayer) {
+				JANUS_LOG(LOG_HUGE, "Dropping packet (it's temporal layer %d, but we're capping at %d)\n",
+					tid, listener->templayer);
+				/* We increase the base sequence number, or there will be gaps when delivering later */
+				listener->context.v_base_seq++;
+				return;
 			}
 			/* If we got here, update the RTP header and send the packet */
 			janus_rtp_header_update(packet->data, &listener->context, TRUE, 4500);
@@ -5465,7 +5768,7 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			janus_vp8_simulcast_descriptor_update(payload, plen, &listener->simulcast_context, switched);
 			/* Send the packet */
 			if(gateway != NULL)
-				gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+				janus_videoroom_relay_rtp_listener(listener, packet);
 			/* Restore the timestamp and sequence number to what the publisher set them to */
 			packet->data->timestamp = htonl(packet->timestamp);
 			packet->data->seq_number = htons(packet->seq_number);
@@ -5476,7 +5779,7 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			janus_rtp_header_update(packet->data, &listener->context, TRUE, 4500);
 			/* Send the packet */
 			if(gateway != NULL)
-				gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+				janus_videoroom_relay_rtp_listener(listener, packet);
 			/* Restore the timestamp and sequence number to what the publisher set them to */
 			packet->data->timestamp = htonl(packet->timestamp);
 			packet->data->seq_number = htons(packet->seq_number);
@@ -5491,7 +5794,7 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 		janus_rtp_header_update(packet->data, &listener->context, FALSE, 960);
 		/* Send the packet */
 		if(gateway != NULL)
-			gateway->relay_rtp(session->handle, packet->is_video, (char *)packet->data, packet->length);
+			janus_videoroom_relay_rtp_listener(listener, packet);
 		/* Restore the timestamp and sequence number to what the publisher set them to */
 		packet->data->timestamp = htonl(packet->timestamp);
 		packet->data->seq_number = htons(packet->seq_number);
@@ -5501,7 +5804,7 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 }
 
 static void janus_videoroom_relay_data_packet(gpointer data, gpointer user_data) {
-	char *text = (char *)user_data;
+	janus_videoroom_data_packet *packet = (janus_videoroom_data_packet *)user_data;
 	janus_videoroom_listener *listener = (janus_videoroom_listener *)data;
 	if(!listener || !listener->session || !listener->data || listener->paused) {
 		return;
@@ -5513,9 +5816,13 @@ static void janus_videoroom_relay_data_packet(gpointer data, gpointer user_data)
 	if(!session->started) {
 		return;
 	}
-	if(gateway != NULL && text != NULL) {
-		JANUS_LOG(LOG_VERB, "Forwarding DataChannel message (%zu bytes) to viewer: %s\n", strlen(text), text);
-		gateway->relay_data(session->handle, text, strlen(text));
+	if(gateway != NULL && packet != NULL && packet->buf != NULL) {
+		JANUS_LOG(LOG_VERB, "Forwarding %sDataChannel message (%d bytes) to viewer\n",
+			packet->binary ? "binary " : "", packet->len);
+		if(packet->binary)
+			gateway->relay_binary_data(session->handle, packet->buf, packet->len);
+		else
+			gateway->relay_data(session->handle, packet->buf, packet->len);
 	}
 	return;
 }
@@ -5523,6 +5830,7 @@ static void janus_videoroom_relay_data_packet(gpointer data, gpointer user_data)
 /* Helper to free janus_videoroom structs. */
 static void janus_videoroom_free(janus_videoroom *room) {
 	if(room) {
+		janus_videoroom_fanout_stop(room);
 		janus_mutex_lock(&room->mutex);
 		g_free(room->room_name);
 		g_free(room->room_secret);
@@ -5540,10 +5848,278 @@ static void janus_videoroom_free(janus_videoroom *room) {
 
 static void janus_videoroom_listener_free(janus_videoroom_listener *l) {
 	JANUS_LOG(LOG_VERB, "Freeing listener\n");
+	/* Multiplexed feeds have already been unsubscribed when hanging up */
+	g_list_free_full(l->multiplexed, (GDestroyNotify)janus_videoroom_listener_free);
 	janus_sdp_free(l->sdp);
 	g_free(l);
 }
 
+/* Multiplexed listeners: besides its own feed, a listener may carry additional
+ * ones on the same PeerConnection, each as a sibling listener with its own SSRCs */
+static janus_videoroom_listener *janus_videoroom_listener_find(janus_videoroom_listener *l, guint64 feed_id) {
+	if(l->feed != NULL && l->feed->user_id == feed_id)
+		return l;
+	GList *temp = l->multiplexed;
+	while(temp) {
+		janus_videoroom_listener *s = (janus_videoroom_listener *)temp->data;
+		if(s->feed != NULL && s->feed->user_id == feed_id)
+			return s;
+		temp = temp->next;
+	}
+	return NULL;
+}
+
+static janus_videoroom_listener *janus_videoroom_listener_by_ssrc(janus_videoroom_listener *l, guint32 ssrc) {
+	GList *temp = l->multiplexed;
+	while(ssrc != 0 && temp) {
+		janus_videoroom_listener *s = (janus_videoroom_listener *)temp->data;
+		if(s->video_ssrc == ssrc || s->audio_ssrc == ssrc)
+			return s;
+		temp = temp->next;
+	}
+	/* Anything else is about the SSRCs the core uses for the primary feed */
+	return l;
+}
+
+static gboolean janus_videoroom_listener_has_feeds(janus_videoroom_listener *l) {
+	if(l->primary != NULL)
+		l = l->primary;
+	if(l->feed != NULL)
+		return TRUE;
+	GList *temp = l->multiplexed;
+	while(temp) {
+		janus_videoroom_listener *s = (janus_videoroom_listener *)temp->data;
+		if(s->feed != NULL)
+			return TRUE;
+		temp = temp->next;
+	}
+	return FALSE;
+}
+
+static void janus_videoroom_listener_unsubscribe(janus_videoroom_listener *l) {
+	l->paused = TRUE;
+	janus_videoroom_participant *publisher = l->feed;
+	if(publisher == NULL)
+		return;
+	janus_mutex_lock(&publisher->listeners_mutex);
+	publisher->listeners = g_slist_remove(publisher->listeners, l);
+	janus_videoroom_participant_listeners_update(publisher);
+	janus_mutex_unlock(&publisher->listeners_mutex);
+	l->feed = NULL;
+	if(l->pvt_id > 0 && publisher->room != NULL) {
+		janus_videoroom_participant *owner = g_hash_table_lookup(publisher->room->private_ids, GUINT_TO_POINTER(l->pvt_id));
+		if(owner != NULL) {
+			janus_mutex_lock(&owner->listeners_mutex);
+			owner->subscriptions = g_slist_remove(owner->subscriptions, l);
+			janus_mutex_unlock(&owner->listeners_mutex);
+		}
+	}
+}
+
+/* Advertises the SSRCs of the multiplexed feeds in an m-line of the offer: the
+ * core picks them up (and the msid) when merging the SDP, and relays them as they are */
+static void janus_videoroom_listener_sdp_multiplex(janus_videoroom_listener *l, janus_sdp_mline *m) {
+	if(m == NULL || (m->type != JANUS_SDP_AUDIO && m->type != JANUS_SDP_VIDEO))
+		return;
+	gboolean video = (m->type == JANUS_SDP_VIDEO);
+	GList *temp = l->multiplexed;
+	while(temp) {
+		janus_videoroom_listener *s = (janus_videoroom_listener *)temp->data;
+		guint32 ssrc = video ? s->video_ssrc : s->audio_ssrc;
+		if(s->feed != NULL && ssrc != 0) {
+			janus_sdp_attribute *a = janus_sdp_attribute_create("ssrc", "%"SCNu32" msid:janus%"SCNu64" janus%s%"SCNu64,
+				ssrc, s->feed->user_id, video ? "v" : "a", s->feed->user_id);
+			janus_sdp_attribute_add_to_mline(m, a);
+		}
+		temp = temp->next;
+	}
+}
+
+/* Get a reference to the current snapshot of the listeners of a publisher, and release it */
+static janus_videoroom_listeners_snapshot *janus_videoroom_listeners_snapshot_get(janus_videoroom_participant *p) {
+	/* The lock is only held for as long as it takes to get a reference, so
+	 * that the snapshot can't be replaced and freed before we have one */
+	janus_mutex_lock_nodebug(&p->snapshot_mutex);
+	janus_videoroom_listeners_snapshot *snapshot = p->listeners_snapshot;
+	if(snapshot != NULL)
+		g_atomic_int_inc(&snapshot->refs);
+	janus_mutex_unlock_nodebug(&p->snapshot_mutex);
+	return snapshot;
+}
+
+static void janus_videoroom_listeners_snapshot_put(janus_videoroom_listeners_snapshot *snapshot) {
+	if(snapshot != NULL && g_atomic_int_dec_and_test(&snapshot->refs))
+		g_free(snapshot);
+}
+
+/* A listener is always relayed media by the same fan-out worker, so that packets are never reordered */
+#define janus_videoroom_fanout_shard(listener, count) (((janus_videoroom_listener *)(listener))->fanout_shard % (count))
+/* Must be called with listeners_mutex locked, whenever p->listeners changes */
+static void janus_videoroom_participant_listeners_update(janus_videoroom_participant *p) {
+	guint count = g_slist_length(p->listeners);
+	guint shards = (p->room && p->room->fanout) ? p->room->fanout_workers : 0;
+	janus_videoroom_listeners_snapshot *snapshot = g_malloc(sizeof(janus_videoroom_listeners_snapshot) +
+		count * sizeof(gpointer) + (shards ? (shards + 1) * sizeof(guint) : 0));
+	snapshot->refs = 1;
+	snapshot->count = count;
+	snapshot->shards = shards;
+	snapshot->offsets = NULL;
+	GSList *l = p->listeners;
+	guint i = 0;
+	if(shards == 0) {
+		while(l) {
+			snapshot->listeners[i++] = l->data;
+			l = l->next;
+		}
+	} else {
+		/* Group the listeners by worker: count how many each has first */
+		snapshot->offsets = (guint *)&snapshot->listeners[count];
+		memset(snapshot->offsets, 0, (shards + 1) * sizeof(guint));
+		for(l = p->listeners; l; l = l->next)
+			snapshot->offsets[janus_videoroom_fanout_shard(l->data, shards) + 1]++;
+		for(i=0; i<shards; i++)
+			snapshot->offsets[i+1] += snapshot->offsets[i];
+		guint *next = g_alloca(shards * sizeof(guint));
+		memcpy(next, snapshot->offsets, shards * sizeof(guint));
+		for(l = p->listeners; l; l = l->next)
+			snapshot->listeners[next[janus_videoroom_fanout_shard(l->data, shards)]++] = l->data;
+	}
+	janus_mutex_lock_nodebug(&p->snapshot_mutex);
+	janus_videoroom_listeners_snapshot *old = p->listeners_snapshot;
+	p->listeners_snapshot = snapshot;
+	janus_mutex_unlock_nodebug(&p->snapshot_mutex);
+	/* Whoever is relaying media may still be using the old snapshot: it will
+	 * be freed when they're done, and listeners in it are only freed a few
+	 * seconds after they're gone, as sessions are */
+	janus_videoroom_listeners_snapshot_put(old);
+}
+
+static void janus_videoroom_participant_listeners_foreach(janus_videoroom_participant *p, GFunc func, gpointer user_data) {
+	janus_videoroom_listeners_snapshot *snapshot = janus_videoroom_listeners_snapshot_get(p);
+	if(snapshot != NULL) {
+		guint i = 0;
+		for(i=0; i<snapshot->count; i++)
+			func(snapshot->listeners[i], user_data);
+	}
+	janus_videoroom_listeners_snapshot_put(snapshot);
+}
+
+static void *janus_videoroom_fanout_thread(void *data) {
+	janus_videoroom_fanout_worker *worker = (janus_videoroom_fanout_worker *)data;
+	janus_videoroom_fanout_job *job = NULL;
+	while((job = g_async_queue_pop(worker->jobs)) != &exit_job) {
+		janus_videoroom_listeners_snapshot *snapshot = job->snapshot;
+		guint i = 0;
+		if(snapshot->shards == worker->count) {
+			/* Only go through the listeners that are ours */
+			for(i=snapshot->offsets[worker->index]; i<snapshot->offsets[worker->index+1]; i++)
+				janus_videoroom_relay_rtp_packet(snapshot->listeners[i], &job->packet);
+		} else {
+			/* Snapshot taken before the workers were set up, look for ours */
+			for(i=0; i<snapshot->count; i++) {
+				if(janus_videoroom_fanout_shard(snapshot->listeners[i], worker->count) == worker->index)
+					janus_videoroom_relay_rtp_packet(snapshot->listeners[i], &job->packet);
+			}
+		}
+		/* We're done with the snapshot */
+		janus_videoroom_listeners_snapshot_put(job->snapshot);
+		janus_plugin_rtp_unref(job->rtp);
+		g_free(job);
+	}
+	return NULL;
+}
+
+static void janus_videoroom_fanout_start(janus_videoroom *room) {
+	if(room->fanout_workers == 0)
+		return;
+	room->fanout = g_malloc0(room->fanout_workers * sizeof(janus_videoroom_fanout_worker));
+	guint i = 0;
+	for(i=0; i<room->fanout_workers; i++) {
+		janus_videoroom_fanout_worker *worker = &room->fanout[i];
+		worker->index = i;
+		worker->jobs = g_async_queue_new();
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "vfanout %"SCNu64, room->room_id);
+		worker->thread = g_thread_try_new(tname, &janus_videoroom_fanout_thread, worker, &error);
+		if(error != NULL) {
+			/* The workers we managed to create will just get more listeners each */
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch fan-out thread %u for room %"SCNu64"...\n",
+				error->code, error->message ? error->message : "??", i, room->room_id);
+			g_error_free(error);
+			g_async_queue_unref(worker->jobs);
+			worker->jobs = NULL;
+			break;
+		}
+	}
+	/* Shard the listeners on the workers that actually exist */
+	room->fanout_workers = i;
+	for(i=0; i<room->fanout_workers; i++)
+		room->fanout[i].count = room->fanout_workers;
+	if(room->fanout_workers == 0) {
+		g_free(room->fanout);
+		room->fanout = NULL;
+		return;
+	}
+	JANUS_LOG(LOG_VERB, "Room %"SCNu64" will use %u fan-out threads\n", room->room_id, room->fanout_workers);
+}
+
+static void janus_videoroom_fanout_stop(janus_videoroom *room) {
+	if(room->fanout == NULL)
+		return;
+	guint i = 0;
+	for(i=0; i<room->fanout_workers; i++) {
+		janus_videoroom_fanout_worker *worker = &room->fanout[i];
+		g_async_queue_push(worker->jobs, &exit_job);
+		g_thread_join(worker->thread);
+		/* Anything that was still queued is dropped */
+		janus_videoroom_fanout_job *job = NULL;
+		while((job = g_async_queue_try_pop(worker->jobs)) != NULL) {
+			if(job == &exit_job)
+				continue;
+			janus_videoroom_listeners_snapshot_put(job->snapshot);
+			janus_plugin_rtp_unref(job->rtp);
+			g_free(job);
+		}
+		g_async_queue_unref(worker->jobs);
+	}
+	g_free(room->fanout);
+	room->fanout = NULL;
+	room->fanout_workers = 0;
+}
+
+/* Relays an RTP packet to all the listeners of a publisher, either directly or via the room's fan-out workers */
+static void janus_videoroom_participant_relay_rtp(janus_videoroom_participant *p, janus_videoroom_rtp_relay_packet *packet) {
+	janus_videoroom *room = p->room;
+	if(room == NULL || room->fanout == NULL) {
+		janus_videoroom_participant_listeners_foreach(p, janus_videoroom_relay_rtp_packet, packet);
+		return;
+	}
+	janus_videoroom_listeners_snapshot *snapshot = janus_videoroom_listeners_snapshot_get(p);
+	if(snapshot != NULL && snapshot->count <= room->fanout_workers) {
+		/* Not worth waking the workers up */
+		guint i = 0;
+		for(i=0; i<snapshot->count; i++)
+			janus_videoroom_relay_rtp_packet(snapshot->listeners[i], packet);
+	} else if(snapshot != NULL) {
+		guint i = 0;
+		for(i=0; i<room->fanout_workers; i++) {
+			janus_videoroom_fanout_job *job = g_malloc(sizeof(janus_videoroom_fanout_job));
+			job->participant = p;
+			job->snapshot = snapshot;
+			job->packet = *packet;
+			job->rtp = janus_plugin_rtp_new(packet->is_video, (char *)packet->data, packet->length);
+			job->packet.data = (janus_rtp_header *)job->rtp->buffer;
+			/* The listeners of this worker can still share its copy of the payload */
+			job->packet.shared = packet->shared ? job->rtp : NULL;
+			/* The worker will release the snapshot when done */
+			g_atomic_int_inc(&snapshot->refs);
+			g_async_queue_push(room->fanout[i].jobs, job);
+		}
+	}
+	janus_videoroom_listeners_snapshot_put(snapshot);
+}
+
 static void janus_videoroom_participant_free(janus_videoroom_participant *p) {
 	JANUS_LOG(LOG_VERB, "Freeing publisher\n");
 	g_free(p->display);
@@ -5568,12 +6144,13 @@ static void janus_videoroom_participant_free(janus_videoroom_participant *p) {
 		if(l) {
 			p->listeners = g_slist_remove(p->listeners, l);
 			l->feed = NULL;
-			if(l->session && l->close_pc) {
+			if(l->session && l->close_pc && !janus_videoroom_listener_has_feeds(l)) {
 				l->room = NULL;
 				gateway->close_pc(l->session->handle);
 			}
 		}
 	}
+	janus_videoroom_participant_listeners_update(p);
 	g_slist_free(p->subscriptions);
 	janus_mutex_unlock(&p->listeners_mutex);
 	janus_mutex_lock(&p->rtp_forwarders_mutex);
@@ -5587,6 +6164,9 @@ static void janus_videoroom_participant_free(janus_videoroom_participant *p) {
 	p->srtp_contexts = NULL;
 	janus_mutex_unlock(&p->rtp_forwarders_mutex);
 	g_slist_free(p->listeners);
+	janus_videoroom_listeners_snapshot_put(p->listeners_snapshot);
+	p->listeners_snapshot = NULL;
+	janus_mutex_destroy(&p->snapshot_mutex);
 
 	janus_mutex_destroy(&p->listeners_mutex);
 	janus_mutex_destroy(&p->rtp_forwarders_mutex);
@@ -17,6 +17,11 @@
  * By default the plugin saves the recordings in the \c html folder of
  * this project, meaning that it can work out of the box with the VoiceMail
  * demo we provide in the same folder.
+ * 
+ * Ogg pages are saved via a raw recorder, which means that, when the
+ * asynchronous mode of the recorder is enabled in janus.cfg
+ * (recordings_writers), the media path only ever copies pages to memory,
+ * and the recorder writer threads take care of the actual disk writes.
  *
  * \section vmailapi VoiceMail API
  * 
@@ -108,7 +113,9 @@
 #include "../config.h"
 #include "../mutex.h"
 #include "../rtp.h"
+#include "../record.h"
 #include "../utils.h"
+#include "../metrics.h"
 
 
 /* Plugin information */
@@ -177,6 +184,9 @@ static struct janus_json_parameter request_parameters[] = {
 /* Useful stuff */
 static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
+
+/* Metrics */
+static janus_metric *metric_recordings = NULL, *metric_writes = NULL, *metric_write_time = NULL;
 static janus_callbacks *gateway = NULL;
 static GThread *handler_thread;
 static GThread *watchdog;
@@ -218,8 +228,10 @@ typedef struct janus_voicemail_session {
 	guint64 recording_id;
 	gint64 start_time;
 	char *filename;
-	FILE *file;
+	janus_recorder *rc;		/* Raw recorder the Ogg pages are saved to */
 	ogg_stream_state *stream;
+	GByteArray *pages;		/* Ogg pages waiting to be handed to the recorder */
+	janus_mutex rec_mutex;	/* Mutex to protect the recorder and the Ogg stream */
 	int seq;
 	gboolean started;
 	gboolean stopping;
@@ -254,6 +266,7 @@ ogg_packet *op_from_pkt(const unsigned char *pkt, int len);
 void op_free(ogg_packet *op);
 int ogg_write(janus_voicemail_session *session);
 int ogg_flush(janus_voicemail_session *session);
+static void janus_voicemail_close_recording(janus_voicemail_session *session);
 
 
 /* Error codes */
@@ -293,6 +306,7 @@ static void *janus_voicemail_watchdog(void *data) {
 					old_sessions = g_list_delete_link(old_sessions, sl);
 					sl = rm;
 					session->handle = NULL;
+					g_byte_array_free(session->pages, TRUE);
 					g_free(session);
 					session = NULL;
 					continue;
@@ -367,6 +381,12 @@ int janus_voicemail_init(janus_callbacks *callback, const char *config_path) {
 		}
 	}
 	
+	metric_recordings = janus_metrics_add("janus_plugin_recordings", "plugin=\"" JANUS_VOICEMAIL_PACKAGE "\"",
+		"Recordings currently in progress", JANUS_METRIC_GAUGE);
+	metric_writes = janus_metrics_add("janus_plugin_recording_writes_total", "plugin=\"" JANUS_VOICEMAIL_PACKAGE "\"",
+		"Batches of Ogg pages saved by the media path", JANUS_METRIC_COUNTER);
+	metric_write_time = janus_metrics_add("janus_plugin_recording_write_microseconds_total", "plugin=\"" JANUS_VOICEMAIL_PACKAGE "\"",
+		"Time the media path spent saving Ogg pages", JANUS_METRIC_COUNTER);
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
@@ -409,6 +429,12 @@ void janus_voicemail_destroy(void) {
 	g_async_queue_unref(messages);
 	messages = NULL;
 	sessions = NULL;
+	janus_metrics_remove(metric_recordings);
+	metric_recordings = NULL;
+	janus_metrics_remove(metric_writes);
+	metric_writes = NULL;
+	janus_metrics_remove(metric_write_time);
+	metric_write_time = NULL;
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
 	JANUS_LOG(LOG_INFO, "%s destroyed!\n", JANUS_VOICEMAIL_NAME);
@@ -464,7 +490,9 @@ void janus_voicemail_create_session(janus_plugin_session *handle, int *error) {
 	char f[255];
 	g_snprintf(f, 255, "%s/janus-voicemail-%"SCNu64".opus", recordings_path, session->recording_id);
 	session->filename = g_strdup(f);
-	session->file = NULL;
+	session->rc = NULL;
+	session->pages = g_byte_array_new();
+	janus_mutex_init(&session->rec_mutex);
 	session->seq = 0;
 	session->started = FALSE;
 	session->stopping = FALSE;
@@ -604,9 +632,13 @@ void janus_voicemail_incoming_rtp(janus_plugin_session *handle, int video, char
 	ogg_packet *op = op_from_pkt(payload, plen);
 	//~ JANUS_LOG(LOG_VERB, "\tWriting at position %d (%d)\n", seq-session->seq+1, 960*(seq-session->seq+1));
 	op->granulepos = 960*(seq-session->seq+1); // FIXME: get this from the toc byte
-	ogg_stream_packetin(session->stream, op);
+	janus_mutex_lock(&session->rec_mutex);
+	if(session->stream != NULL) {
+		ogg_stream_packetin(session->stream, op);
+		ogg_write(session);
+	}
+	janus_mutex_unlock(&session->rec_mutex);
 	g_free(op);
-	ogg_write(session);
 }
 
 void janus_voicemail_incoming_rtcp(janus_plugin_session *handle, int video, char *buf, int len) {
@@ -636,12 +668,23 @@ static void janus_voicemail_hangup_media_internal(janus_plugin_session *handle)
 	if(g_atomic_int_add(&session->hangingup, 1))
 		return;
 	/* Close and reset stuff */
-	if(session->file)
-		fclose(session->file);
-	session->file = NULL;
+	janus_voicemail_close_recording(session);
+}
+
+/* Helper to save what's left of the Ogg stream, and close the recording */
+static void janus_voicemail_close_recording(janus_voicemail_session *session) {
+	janus_mutex_lock(&session->rec_mutex);
+	if(session->rc) {
+		ogg_flush(session);
+		janus_recorder_close(session->rc);
+		janus_recorder_free(session->rc);
+		janus_metrics_dec(metric_recordings);
+	}
+	session->rc = NULL;
 	if(session->stream)
 		ogg_stream_destroy(session->stream);
 	session->stream = NULL;
+	janus_mutex_unlock(&session->rec_mutex);
 }
 
 /* Thread to handle incoming messages */
@@ -702,26 +745,33 @@ static void *janus_voicemail_handler(void *data) {
 			sdp_update = json_is_true(json_object_get(msg->jsep, "update"));
 		if(!strcasecmp(request_text, "record")) {
 			JANUS_LOG(LOG_VERB, "Starting new recording\n");
-			if(session->file != NULL) {
+			if(session->rc != NULL) {
 				JANUS_LOG(LOG_ERR, "Already recording (%s)\n", session->filename ? session->filename : "??");
 				error_code = JANUS_VOICEMAIL_ERROR_ALREADY_RECORDING;
 				g_snprintf(error_cause, 512, "Already recording");
 				goto error;
 			}
-			session->stream = g_malloc0(sizeof(ogg_stream_state));
-			if(ogg_stream_init(session->stream, rand()) < 0) {
+			janus_mutex_lock(&session->rec_mutex);
+			ogg_stream_state *stream = g_malloc0(sizeof(ogg_stream_state));
+			if(ogg_stream_init(stream, rand()) < 0) {
+				janus_mutex_unlock(&session->rec_mutex);
+				g_free(stream);
 				JANUS_LOG(LOG_ERR, "Couldn't initialize Ogg stream state\n");
 				error_code = JANUS_VOICEMAIL_ERROR_LIBOGG_ERROR;
 				g_snprintf(error_cause, 512, "Couldn't initialize Ogg stream state\n");
 				goto error;
 			}
-			session->file = fopen(session->filename, "wb");
-			if(session->file == NULL) {
+			session->rc = janus_recorder_create_raw(session->filename);
+			if(session->rc == NULL) {
+				janus_mutex_unlock(&session->rec_mutex);
+				ogg_stream_destroy(stream);
 				JANUS_LOG(LOG_ERR, "Couldn't open output file\n");
 				error_code = JANUS_VOICEMAIL_ERROR_IO_ERROR;
 				g_snprintf(error_cause, 512, "Couldn't open output file");
 				goto error;
 			}
+			janus_metrics_inc(metric_recordings);
+			session->stream = stream;
 			session->seq = 0;
 			/* Write stream headers */
 			ogg_packet *op = op_opushead();
@@ -731,6 +781,7 @@ static void *janus_voicemail_handler(void *data) {
 			ogg_stream_packetin(session->stream, op);
 			op_free(op);
 			ogg_flush(session);
+			janus_mutex_unlock(&session->rec_mutex);
 			/* Done: now wait for the setup_media callback to be called */
 			event = json_object();
 			json_object_set_new(event, "voicemail", json_string("event"));
@@ -758,12 +809,7 @@ static void *janus_voicemail_handler(void *data) {
 			/* Stop the recording */
 			session->started = FALSE;
 			session->stopping = TRUE;
-			if(session->file)
-				fclose(session->file);
-			session->file = NULL;
-			if(session->stream)
-				ogg_stream_destroy(session->stream);
-			session->stream = NULL;
+			janus_voicemail_close_recording(session);
 			/* Done: send the event and close the handle */
 			event = json_object();
 			json_object_set_new(event, "voicemail", json_string("event"));
@@ -950,50 +996,40 @@ void op_free(ogg_packet *op) {
 	}
 }
 
-/* Write out available ogg pages */
-int ogg_write(janus_voicemail_session *session) {
+/* Hand the Ogg pages libogg has ready to the recorder: pages are collected
+ * first and saved at once, so that the media path (in asynchronous mode)
+ * only copies them to memory, and a page is never saved only in part */
+static int ogg_save_pages(janus_voicemail_session *session, gboolean flush) {
 	ogg_page page;
-	size_t written;
 
-	if(!session || !session->stream || !session->file) {
+	if(!session || !session->stream || !session->rc) {
 		return -1;
 	}
 
-	while (ogg_stream_pageout(session->stream, &page)) {
-		written = fwrite(page.header, 1, page.header_len, session->file);
-		if(written != (size_t)page.header_len) {
-			JANUS_LOG(LOG_ERR, "Error writing Ogg page header\n");
-			return -2;
-		}
-		written = fwrite(page.body, 1, page.body_len, session->file);
-		if(written != (size_t)page.body_len) {
-			JANUS_LOG(LOG_ERR, "Error writing Ogg page body\n");
-			return -3;
-		}
+	g_byte_array_set_size(session->pages, 0);
+	while(flush ? ogg_stream_flush(session->stream, &page) : ogg_stream_pageout(session->stream, &page)) {
+		g_byte_array_append(session->pages, page.header, page.header_len);
+		g_byte_array_append(session->pages, page.body, page.body_len);
+	}
+	if(session->pages->len == 0)
+		return 0;
+	gint64 start = janus_get_monotonic_time();
+	int res = janus_recorder_save_data(session->rc, (const char *)session->pages->data, session->pages->len);
+	janus_metrics_inc(metric_writes);
+	janus_metrics_add_value(metric_write_time, janus_get_monotonic_time() - start);
+	if(res < 0) {
+		JANUS_LOG(LOG_HUGE, "Error saving Ogg pages (%d)\n", res);
+		return -2;
 	}
 	return 0;
 }
 
+/* Write out available ogg pages */
+int ogg_write(janus_voicemail_session *session) {
+	return ogg_save_pages(session, FALSE);
+}
+
 /* Flush remaining ogg data */
 int ogg_flush(janus_voicemail_session *session) {
-	ogg_page page;
-	size_t written;
-
-	if(!session || !session->stream || !session->file) {
-		return -1;
-	}
-
-	while (ogg_stream_flush(session->stream, &page)) {
-		written = fwrite(page.header, 1, page.header_len, session->file);
-		if(written != (size_t)page.header_len) {
-			JANUS_LOG(LOG_ERR, "Error writing Ogg page header\n");
-			return -2;
-		}
-		written = fwrite(page.body, 1, page.body_len, session->file);
-		if(written != (size_t)page.body_len) {
-			JANUS_LOG(LOG_ERR, "Error writing Ogg page body\n");
-			return -3;
-		}
-	}
-	return 0;
+	return ogg_save_pages(session, TRUE);
 }
@@ -38,3 +38,65 @@ void janus_plugin_result_destroy(janus_plugin_result *result) {
 	g_free(result);
 }
 
+
+janus_plugin_rtp *janus_plugin_rtp_new(int video, char *buf, int len) {
+	if(buf == NULL || len < 1)
+		return NULL;
+	/* Allocate the buffer right after the struct, to only need one allocation */
+	janus_plugin_rtp *packet = g_malloc(sizeof(janus_plugin_rtp) + len);
+	packet->video = video;
+	packet->buffer = (char *)packet + sizeof(janus_plugin_rtp);
+	memcpy(packet->buffer, buf, len);
+	packet->length = len;
+	packet->ref = 1;
+	return packet;
+}
+
+void janus_plugin_rtp_ref(janus_plugin_rtp *packet) {
+	if(packet == NULL)
+		return;
+	g_atomic_int_inc(&packet->ref);
+}
+
+void janus_plugin_rtp_unref(janus_plugin_rtp *packet) {
+	if(packet == NULL)
+		return;
+	if(g_atomic_int_dec_and_test(&packet->ref))
+		g_free(packet);
+}
+
+
+janus_plugin_event *janus_plugin_event_new(janus_plugin *plugin, json_t *message) {
+	if(plugin == NULL || message == NULL || !json_is_object(message))
+		return NULL;
+	json_t *plugindata = json_object();
+	json_object_set_new(plugindata, "plugin", json_string(plugin->get_package()));
+	json_object_set(plugindata, "data", message);
+	char *text = json_dumps(plugindata, JSON_COMPACT | JSON_PRESERVE_ORDER);
+	if(text == NULL) {
+		json_decref(plugindata);
+		return NULL;
+	}
+	janus_plugin_event *event = g_malloc(sizeof(janus_plugin_event));
+	event->plugindata = plugindata;
+	event->text = text;
+	event->length = strlen(text);
+	event->ref = 1;
+	return event;
+}
+
+void janus_plugin_event_ref(janus_plugin_event *event) {
+	if(event == NULL)
+		return;
+	g_atomic_int_inc(&event->ref);
+}
+
+void janus_plugin_event_unref(janus_plugin_event *event) {
+	if(event == NULL)
+		return;
+	if(g_atomic_int_dec_and_test(&event->ref)) {
+		json_decref(event->plugindata);
+		free(event->text);
+		g_free(event);
+	}
+}
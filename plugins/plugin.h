@@ -19,8 +19,19 @@
  * important thing is that it MUST be a JSON object, as it will be included
  * as such within the Janus session/handle protocol;
  * - \c relay_rtp(): to send/relay the peer an RTP packet;
+ * - \c relay_rtp_shared(): to send/relay the peer an RTP packet that may be
+ * shared with other peers as well (see \ref janus_plugin_rtp);
+ * - \c push_event_shared(): to send the same JSON event to several peers,
+ * serializing it only once (see \ref janus_plugin_event);
  * - \c relay_rtcp(): to send/relay the peer an RTCP message.
  * - \c relay_data(): to send/relay the peer a SCTP DataChannel message.
+ * - \c relay_binary_data(): same as \c relay_data, but for binary messages.
+ * - \c relay_data_broadcast(): to send the same SCTP DataChannel message
+ * to several peers, copying it only once.
+ * - \c port_allocate() and \c port_release(): to get RTP/RTCP port pairs
+ * for plain RTP sockets (e.g., SIP or NoSIP) from a shared allocator.
+ * - \c set_placement_group(): to keep the PeerConnections of peers in the
+ * same room on the same NUMA node.
  *
  * On the other hand, a plugin that wants to register at the gateway
  * needs to implement the \c janus_plugin interface. Besides, as a
@@ -62,15 +73,19 @@ janus_plugin *create(void) {
  * - \c handle_message(): a callback to notify you the peer sent you a message/request;
  * - \c setup_media(): a callback to notify you the peer PeerConnection is now ready to be used;
  * - \c incoming_rtp(): a callback to notify you a peer has sent you a RTP packet;
+ * - \c incoming_rtp_shared(): same as \c incoming_rtp, but passing a refcounted packet you can keep around;
  * - \c incoming_rtcp(): a callback to notify you a peer has sent you a RTCP message;
  * - \c incoming_data(): a callback to notify you a peer has sent you a message on a SCTP DataChannel;
+ * - \c incoming_binary_data(): same as \c incoming_data, but for binary messages (if missing, they're passed to \c incoming_data instead);
  * - \c slow_link(): a callback to notify you a peer has sent a lot of NACKs recently, and the media path may be slow;
  * - \c hangup_media(): a callback to notify you the peer PeerConnection has been closed (e.g., after a DTLS alert);
  * - \c query_session(): this method is called by the gateway to get plugin-specific info on a session between you and a peer;
  * - \c destroy_session(): this method is called by the gateway to destroy a session between you and a peer.
  *
  * All the above methods and callbacks, except for \c incoming_rtp ,
- * \c incoming_rtcp , \c incoming_data and \c slow_link , are mandatory:
+ * \c incoming_rtp_shared , \c incoming_rtcp , \c incoming_data ,
+ * \c incoming_binary_data and
+ * \c slow_link , are mandatory:
  * the Janus core will reject a plugin that doesn't implement any of the
  * mandatory callbacks. The previously mentioned ones, instead, are
  * optional, so you're free to implement only those you care about. If
@@ -166,7 +181,7 @@ janus_plugin *create(void) {
  * gateway or it will crash.
  *
  */
-#define JANUS_PLUGIN_API_VERSION	9
+#define JANUS_PLUGIN_API_VERSION	15
 
 /*! \brief Initialization of all plugin properties to NULL
  *
@@ -198,8 +213,10 @@ static janus_plugin janus_echotest_plugin =
 		.handle_message = NULL,			\
 		.setup_media = NULL,			\
 		.incoming_rtp = NULL,			\
+		.incoming_rtp_shared = NULL,	\
 		.incoming_rtcp = NULL,			\
 		.incoming_data = NULL,			\
+		.incoming_binary_data = NULL,	\
 		.slow_link = NULL,				\
 		.hangup_media = NULL,			\
 		.destroy_session = NULL,		\
@@ -215,6 +232,10 @@ typedef struct janus_plugin janus_plugin;
 typedef struct janus_plugin_session janus_plugin_session;
 /*! \brief Result of individual requests passed to plugins */
 typedef struct janus_plugin_result janus_plugin_result;
+/*! \brief Refcounted RTP packet, shared by the core and plugins */
+typedef struct janus_plugin_rtp janus_plugin_rtp;
+/*! \brief Refcounted and pre-serialized event, shared by the core and plugins */
+typedef struct janus_plugin_event janus_plugin_event;
 
 /* Use forward declaration to avoid including jansson.h */
 typedef struct json_t json_t;
@@ -279,6 +300,14 @@ struct janus_plugin {
 	 * @param[in] buf 数据存储内存
 	 * @param[in] len 数据的长度 */
 	void (* const incoming_rtp)(janus_plugin_session *handle, int video, char *buf, int len);
+	/*! \brief Method to handle an incoming RTP packet from a peer, as a refcounted packet
+	 * \note If a plugin implements this, the core invokes it instead of \c incoming_rtp .
+	 * The core releases its own reference when the callback returns: plugins that
+	 * want to keep the packet around (e.g., to relay it from another thread) must
+	 * call janus_plugin_rtp_ref on it, and janus_plugin_rtp_unref when done.
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] packet The RTP packet */
+	void (* const incoming_rtp_shared)(janus_plugin_session *handle, janus_plugin_rtp *packet);
 
 	/*! \brief 方法用于处理介绍对端的rtcp包
 	 * @param[in] handle 对端使用的The plugin/gateway session
@@ -289,6 +318,12 @@ struct janus_plugin {
 	
 	/*! \brief 方法用于处理介绍对端 SCTP/DataChannel数据(text only, for the moment)*/
 	void (* const incoming_data)(janus_plugin_session *handle, char *buf, int len);
+	/*! \brief Method to handle an incoming binary SCTP/DataChannel message from a peer
+	 * \note Optional: binary messages are passed to incoming_data, if this is not implemented
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] buf The message data (buffer)
+	 * @param[in] len The buffer length */
+	void (* const incoming_binary_data)(janus_plugin_session *handle, char *buf, int len);
 	
 	/*! \brief 当很多NACKS被发送或者接收到的时候被核心触发，对端被暴露在一个缓慢的或潜在不可靠的网络中
 	 * \note 方法会多次被调用,
@@ -324,6 +359,16 @@ struct janus_callbacks {
 	 * @param[in] message The json_t object containing the JSON message
 	 * @param[in] jsep The json_t object containing the JSEP type, the SDP attached to the message/event, if any (offer/answer), and whether this is an update */
 	int (* const push_event)(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep);
+	/*! \brief Callback to push the same event to several peers, e.g., notifications in a room
+	 * \note The event is serialized once, when created with janus_plugin_event_new, and only
+	 * the envelope (session and handle identifiers, transaction) is added for each peer by
+	 * the core. No JSEP can be attached. The core takes its own references to the event if
+	 * needed, which means plugins must still call janus_plugin_event_unref when done.
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] plugin The plugin instance that is sending the event
+	 * @param[in] transaction The transaction identifier this event refers to, if any
+	 * @param[in] event The shared event */
+	int (* const push_event_shared)(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, janus_plugin_event *event);
 
 	/*! \brief 发送RTP数据给对端
 	 * @param[in] handle The plugin/gateway session used for this peer
@@ -331,6 +376,16 @@ struct janus_callbacks {
 	 * @param[in] buf 数据buffer
 	 * @param[in] len buffer大小 */
 	void (* const relay_rtp)(janus_plugin_session *handle, int video, char *buf, int len);
+	/*! \brief Callback to relay a refcounted RTP packet to a peer
+	 * \note Only the RTP header is copied, so plugins can still rewrite it in
+	 * place (SSRC, sequence number, timestamp) before relaying the packet to
+	 * each peer. The payload is instead shared by reference until it's
+	 * actually sent, which means it MUST NOT be modified after this call: in
+	 * case a plugin needs to change it (e.g., the VP8 payload descriptor
+	 * for simulcast), it has to use \c relay_rtp instead.
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] packet The RTP packet */
+	void (* const relay_rtp_shared)(janus_plugin_session *handle, janus_plugin_rtp *packet);
 
 	/*! \brief 发送RTCP数据给对端
 	 * @param[in] handle The plugin/gateway session that will be used for this peer
@@ -344,6 +399,20 @@ struct janus_callbacks {
 	 * @param[in] buf The message data (buffer)
 	 * @param[in] len The buffer lenght */
 	void (* const relay_data)(janus_plugin_session *handle, char *buf, int len);
+	/*! \brief Callback to relay binary SCTP/DataChannel messages to a peer
+	 * @param[in] handle The plugin/gateway session that will be used for this peer
+	 * @param[in] buf The message data (buffer)
+	 * @param[in] len The buffer length */
+	void (* const relay_binary_data)(janus_plugin_session *handle, char *buf, int len);
+	/*! \brief Callback to relay the same SCTP/DataChannel message to several peers
+	 * \note The message is copied once, and that copy is then shared by reference by
+	 * the outgoing queues of all the peers until it's sent, which means plugins can
+	 * free their buffer as soon as this returns. Invalid handles are skipped.
+	 * @param[in] handles The plugin/gateway sessions of the peers to send the message to
+	 * @param[in] count The number of sessions in the array
+	 * @param[in] buf The message data (buffer)
+	 * @param[in] len The buffer length */
+	void (* const relay_data_broadcast)(janus_plugin_session **handles, int count, char *buf, int len);
 
 	/*! \brief Callback to ask the core to close a WebRTC PeerConnection
 	 * \note A call to this method will result in the core invoking the hangup_media
@@ -377,12 +446,125 @@ struct janus_callbacks {
 	 * @param[in] desc The descriptor to search for
 	 * @returns TRUE if the token is valid, not expired and contains the descriptor, FALSE otherwise */
 	gboolean (* const auth_signature_contains)(janus_plugin *plugin, const char *token, const char *descriptor);
+
+	/*! \brief Callback to get the shared allocator for a range of RTP/RTCP ports
+	 * \note Plugins asking for the same range share the same allocator, and a
+	 * pair is never handed out twice, even when ranges from different plugins
+	 * overlap. The range must be released with \c port_range_unref when done.
+	 * @param[in] min_port The lower end of the range
+	 * @param[in] max_port The upper end of the range
+	 * @returns A pointer to the range allocator, or NULL if the range contains no pair */
+	struct janus_port_range *(* const port_range_get)(uint16_t min_port, uint16_t max_port);
+	/*! \brief Callback to release a range allocator obtained with \c port_range_get
+	 * @param[in] range The range allocator */
+	void (* const port_range_unref)(struct janus_port_range *range);
+	/*! \brief Callback to allocate a RTP/RTCP pair of ports in O(1)
+	 * \note If the RTP or RTCP port can't be bound (e.g., because another application
+	 * is using it), release the pair with \c port_release and allocate a new one
+	 * @param[in] range The range allocator
+	 * @returns The even port of the pair, to use for RTP (RTCP being the following one), or -1 if the range is full */
+	int (* const port_allocate)(struct janus_port_range *range);
+	/*! \brief Callback to give a RTP/RTCP pair of ports back, once the sockets have been closed
+	 * @param[in] range The range allocator the pair was allocated from
+	 * @param[in] port The even port of the pair */
+	void (* const port_release)(struct janus_port_range *range, int port);
+
+	/*! \brief Callback to tell the core which placement group (e.g., room or mountpoint) a peer belongs to
+	 * \note When the core is configured to be NUMA aware, the PeerConnections of peers in the
+	 * same group are served by loops and threads on the same NUMA node. The group is only taken
+	 * into account the next time a PeerConnection is set up for the handle, which means it should
+	 * be set as soon as it's known (e.g., when joining a room), and before any SDP is exchanged.
+	 * \note Threads plugins spawn themselves can be placed on the node of a group via janus_affinity_pin_thread.
+	 * @param[in] handle The plugin/gateway session of the peer
+	 * @param[in] group The placement group (0 for none) */
+	void (* const set_placement_group)(janus_plugin_session *handle, guint64 group);
 };
 
 /*! \brief The hook that plugins need to implement to be created from the gateway */
 typedef janus_plugin* create_p(void);
 
 
+/** @name Janus refcounted RTP packets
+ * @brief Plugins that relay the same packet to several peers (e.g., a
+ * publisher in the VideoRoom, or a mountpoint in the Streaming plugin)
+ * would normally end up copying it once per peer. Using the refcounted
+ * janus_plugin_rtp instead, the payload is allocated once when the packet is
+ * received, and it's then shared by reference by all the outgoing queues
+ * it's relayed to, until it's sent: only the RTP header, which usually
+ * needs to be rewritten for each peer, is copied every time.
+ */
+///@{
+/*! \brief Refcounted RTP packet */
+struct janus_plugin_rtp {
+	/*! \brief Whether this is a video or an audio packet */
+	int video;
+	/*! \brief The packet data */
+	char *buffer;
+	/*! \brief The packet length */
+	int length;
+	/*! \brief Reference counter */
+	volatile gint ref;
+};
+
+/*! \brief Helper to create a janus_plugin_rtp instance, copying the packet
+ * \note The packet is returned with a single reference
+ * @param[in] video Whether this is a video or an audio packet
+ * @param[in] buf The packet data to copy
+ * @param[in] len The packet length
+ * @returns A new janus_plugin_rtp instance, if successful, or NULL otherwise */
+janus_plugin_rtp *janus_plugin_rtp_new(int video, char *buf, int len);
+
+/*! \brief Helper to add a reference to a janus_plugin_rtp instance
+ * @param[in] packet The janus_plugin_rtp instance */
+void janus_plugin_rtp_ref(janus_plugin_rtp *packet);
+
+/*! \brief Helper to remove a reference from a janus_plugin_rtp instance, freeing it if it was the last one
+ * @param[in] packet The janus_plugin_rtp instance */
+void janus_plugin_rtp_unref(janus_plugin_rtp *packet);
+///@}
+
+
+/** @name Janus shared events
+ * @brief Plugins often notify the same event to all the participants of
+ * a room (e.g., someone joining, or a message in the TextRoom). Passing
+ * the same json_t object to \c push_event for each of them means the core
+ * wraps it in a new envelope, and transports serialize it once per peer.
+ * A janus_plugin_event, instead, serializes the \c plugindata part of the
+ * event once when it's created: the core then only needs to prepend the
+ * envelope that is specific to each peer, and transports that support it
+ * can send the resulting text as it is.
+ */
+///@{
+/*! \brief Refcounted and pre-serialized event */
+struct janus_plugin_event {
+	/*! \brief The \c plugindata object (plugin package and event data) */
+	json_t *plugindata;
+	/*! \brief The compact serialization of \c plugindata */
+	char *text;
+	/*! \brief The length of the serialization */
+	size_t length;
+	/*! \brief Reference counter */
+	volatile gint ref;
+};
+
+/*! \brief Helper to create a janus_plugin_event instance, serializing the event
+ * \note The event is returned with a single reference, and a reference to the
+ * message is added as well, which means plugins must still decref it themselves
+ * @param[in] plugin The plugin instance originating the event
+ * @param[in] message The json_t object containing the JSON event (MUST be an object)
+ * @returns A new janus_plugin_event instance, if successful, or NULL otherwise */
+janus_plugin_event *janus_plugin_event_new(janus_plugin *plugin, json_t *message);
+
+/*! \brief Helper to add a reference to a janus_plugin_event instance
+ * @param[in] event The janus_plugin_event instance */
+void janus_plugin_event_ref(janus_plugin_event *event);
+
+/*! \brief Helper to remove a reference from a janus_plugin_event instance, freeing it if it was the last one
+ * @param[in] event The janus_plugin_event instance */
+void janus_plugin_event_unref(janus_plugin_event *event);
+///@}
+
+
 /** @name Janus plugin results
  * @brief When a client sends a message to a plugin (e.g., a request or a
  * command) this is notified to the plugin through a handle_message()
@@ -0,0 +1,167 @@
+/*! \file    ports.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    RTP/RTCP port allocator
+ * \details  Implementation of a shared allocator for RTP/RTCP port pairs.
+ * Each range keeps the pairs it can hand out in a circular queue, while
+ * a bitmap covering the whole port space keeps track of the pairs that
+ * are in use: this way allocating and releasing a pair only take a couple
+ * of operations, no matter how busy the range is. A pair that is in use
+ * because of an overlapping range is simply moved to the end of the queue
+ * when found, since it will be given back to the other range when done.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <string.h>
+
+#include "ports.h"
+#include "debug.h"
+#include "mutex.h"
+
+/* Number of even/odd pairs in the whole port space */
+#define JANUS_PORTS_PAIRS	32768
+
+struct janus_port_range {
+	uint16_t min_port, max_port;
+	/* Circular queue of the pairs (as indexes, i.e., port/2) this range can hand out */
+	guint16 *queue;
+	guint size, head, count;
+	gint refs;
+};
+
+/* Pairs currently in use, no matter which range they were allocated from */
+static guint32 pairs_in_use[JANUS_PORTS_PAIRS/32];
+/* Ranges, indexed by min/max port */
+static GHashTable *ranges = NULL;
+static janus_mutex ports_mutex = JANUS_MUTEX_INITIALIZER;
+
+
+static void janus_port_range_free(janus_port_range *range) {
+	if(range == NULL)
+		return;
+	g_free(range->queue);
+	g_free(range);
+}
+
+void janus_ports_init(void) {
+	janus_mutex_lock(&ports_mutex);
+	if(ranges == NULL)
+		ranges = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_port_range_free);
+	memset(pairs_in_use, 0, sizeof(pairs_in_use));
+	janus_mutex_unlock(&ports_mutex);
+}
+
+void janus_ports_deinit(void) {
+	janus_mutex_lock(&ports_mutex);
+	if(ranges != NULL)
+		g_hash_table_destroy(ranges);
+	ranges = NULL;
+	janus_mutex_unlock(&ports_mutex);
+}
+
+janus_port_range *janus_port_range_get(uint16_t min_port, uint16_t max_port) {
+	if(min_port > max_port) {
+		uint16_t temp_port = min_port;
+		min_port = max_port;
+		max_port = temp_port;
+	}
+	/* RTP goes on even ports, RTCP on the one that follows */
+	guint first = (min_port + 1) / 2, last = max_port > 0 ? (max_port - 1) / 2 : 0;
+	if(first == 0)
+		first = 1;
+	if(max_port == 0 || first > last) {
+		JANUS_LOG(LOG_ERR, "No RTP/RTCP port pair in range %u-%u\n", min_port, max_port);
+		return NULL;
+	}
+	gpointer key = GUINT_TO_POINTER(((guint)min_port << 16) | max_port);
+	janus_mutex_lock(&ports_mutex);
+	if(ranges == NULL) {
+		janus_mutex_unlock(&ports_mutex);
+		return NULL;
+	}
+	janus_port_range *range = g_hash_table_lookup(ranges, key);
+	if(range != NULL) {
+		range->refs++;
+		janus_mutex_unlock(&ports_mutex);
+		return range;
+	}
+	range = g_malloc0(sizeof(janus_port_range));
+	range->min_port = min_port;
+	range->max_port = max_port;
+	range->size = last - first + 1;
+	range->queue = g_malloc(range->size * sizeof(guint16));
+	guint i = 0;
+	for(i=0; i<range->size; i++)
+		range->queue[i] = first + i;
+	/* Shuffle the pairs, so that the ports we pick are not predictable */
+	for(i=range->size-1; i>0; i--) {
+		guint j = g_random_int_range(0, i+1);
+		guint16 temp = range->queue[i];
+		range->queue[i] = range->queue[j];
+		range->queue[j] = temp;
+	}
+	range->head = 0;
+	range->count = range->size;
+	range->refs = 1;
+	g_hash_table_insert(ranges, key, range);
+	janus_mutex_unlock(&ports_mutex);
+	JANUS_LOG(LOG_VERB, "Created RTP/RTCP port allocator for range %u-%u (%u pairs)\n",
+		min_port, max_port, range->size);
+	return range;
+}
+
+void janus_port_range_unref(janus_port_range *range) {
+	if(range == NULL)
+		return;
+	janus_mutex_lock(&ports_mutex);
+	range->refs--;
+	if(range->refs == 0 && ranges != NULL)
+		g_hash_table_remove(ranges, GUINT_TO_POINTER(((guint)range->min_port << 16) | range->max_port));
+	janus_mutex_unlock(&ports_mutex);
+}
+
+int janus_port_allocate(janus_port_range *range) {
+	if(range == NULL)
+		return -1;
+	int port = -1;
+	janus_mutex_lock(&ports_mutex);
+	/* Pairs taken by an overlapping range are put back at the end of the queue */
+	guint checked = 0, total = range->count;
+	while(range->count > 0 && checked < total) {
+		guint16 pair = range->queue[range->head];
+		range->head = (range->head + 1) % range->size;
+		range->count--;
+		checked++;
+		if(pairs_in_use[pair/32] & (1U << (pair%32))) {
+			range->queue[(range->head + range->count) % range->size] = pair;
+			range->count++;
+			continue;
+		}
+		pairs_in_use[pair/32] |= (1U << (pair%32));
+		port = pair*2;
+		break;
+	}
+	janus_mutex_unlock(&ports_mutex);
+	return port;
+}
+
+void janus_port_release(janus_port_range *range, int port) {
+	if(range == NULL || port <= 0 || port % 2)
+		return;
+	guint16 pair = port/2;
+	janus_mutex_lock(&ports_mutex);
+	if(!(pairs_in_use[pair/32] & (1U << (pair%32))) || range->count == range->size ||
+			(guint)port < range->min_port || (guint)port+1 > range->max_port) {
+		/* Not something we handed out from this range */
+		janus_mutex_unlock(&ports_mutex);
+		JANUS_LOG(LOG_WARN, "Port %d is not in use in range %u-%u, not releasing it\n",
+			port, range->min_port, range->max_port);
+		return;
+	}
+	pairs_in_use[pair/32] &= ~(1U << (pair%32));
+	range->queue[(range->head + range->count) % range->size] = pair;
+	range->count++;
+	janus_mutex_unlock(&ports_mutex);
+}
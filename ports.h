@@ -0,0 +1,57 @@
+/*! \file    ports.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    RTP/RTCP port allocator (headers)
+ * \details  Implementation of a shared allocator for the RTP/RTCP port
+ * pairs plugins bind their sockets to. Rather than picking a random port
+ * and trying to bind it until it works, which gets slower and slower
+ * when a range is almost full, each range keeps a queue of the pairs it
+ * has available: allocating and releasing a pair are O(1) operations.
+ * Pairs are recycled in FIFO order, so that a port that was just released
+ * isn't reused right away, and are initially shuffled, so that ports are
+ * still hard to guess. Ranges are shared: plugins asking for the same
+ * range get the same allocator, and a core bitmap makes sure a port is
+ * never handed out twice, even when different ranges overlap.
+ * \note Allocating a pair doesn't mean it can always be bound, as other
+ * applications may be using it: in that case, the pair should be released
+ * right away (which puts it at the end of the queue) and a new one taken.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_PORTS_H
+#define _JANUS_PORTS_H
+
+#include <stdint.h>
+
+#include <glib.h>
+
+/*! \brief Range of RTP/RTCP port pairs, opaque */
+typedef struct janus_port_range janus_port_range;
+
+/*! \brief Initialize the port allocator */
+void janus_ports_init(void);
+/*! \brief De-initialize the port allocator */
+void janus_ports_deinit(void);
+
+/*! \brief Get the allocator for a range of ports, creating it if needed
+ * \note Ranges are refcounted, and must be released with janus_port_range_unref when done
+ * @param[in] min_port The lower end of the range
+ * @param[in] max_port The upper end of the range
+ * @returns A pointer to the range allocator, or NULL if the range contains no even/odd pair */
+janus_port_range *janus_port_range_get(uint16_t min_port, uint16_t max_port);
+/*! \brief Release a reference to a range allocator
+ * @param[in] range The range allocator */
+void janus_port_range_unref(janus_port_range *range);
+
+/*! \brief Allocate a pair of ports from a range
+ * @param[in] range The range allocator
+ * @returns The even port of the pair (RTP), the odd one (RTCP) being the next one, or -1 if the range is full */
+int janus_port_allocate(janus_port_range *range);
+/*! \brief Give a pair of ports back to a range
+ * @param[in] range The range allocator
+ * @param[in] port The even port of the pair, as returned by janus_port_allocate */
+void janus_port_release(janus_port_range *range, int port);
+
+#endif
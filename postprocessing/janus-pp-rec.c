@@ -37,13 +37,37 @@
 \verbatim
 ./janus-pp-rec --header /path/to/source.mjr
 ./janus-pp-rec --parse /path/to/source.mjr
+\endverbatim
+ *
+ * Long recordings can be processed while they're still being parsed,
+ * by passing \c --stream: in that case packets are reordered within a
+ * window (1000 packets by default, which can be changed using the
+ * \c JANUS_PPREC_REORDERWINDOW environment variable), and those that
+ * are older than what's been processed already are dropped. Several
+ * recordings can also be processed in parallel, one process each, by
+ * passing \c --jobs=N and a list of source/destination pairs. For
+ * large batches (e.g., a day of recordings) the pairs can be read from a
+ * file instead, one "source destination" pair per line, by passing
+ * \c --list=FILE (use \c - for the standard input):
+ *
+\verbatim
+./janus-pp-rec --stream /path/to/source.mjr /path/to/destination.webm
+./janus-pp-rec --jobs=4 /path/to/a.mjr /path/to/a.opus /path/to/b.mjr /path/to/b.webm
+./janus-pp-rec --jobs=8 --list=/path/to/recordings.txt
+\endverbatim
+ *
+ * Opus and VP8/VP9 recordings belonging to the same media session can
+ * also be muxed in a single .webm (or .mkv) file in a single pass, with
+ * the two aligned according to when their first frame was written:
+ *
+\verbatim
+./janus-pp-rec --mux /path/to/audio.mjr /path/to/video.mjr /path/to/destination.webm
 \endverbatim
  *
  * \note This utility does not do any form of transcoding. It just
  * depacketizes the RTP frames in order to get the payload, and saves
  * the frames in a valid container. Any further post-processing (e.g.,
- * muxing audio and video belonging to the same media session in a single
- * .webm file) is up to third-party applications.
+ * muxing audio and video in other formats) is up to third-party applications.
  * 
  * \ingroup postprocessing
  * \ref postprocessing
@@ -59,12 +83,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/wait.h>
 
 #include <glib.h>
 #include <jansson.h>
 
 #include "../debug.h"
 #include "../version.h"
+#include "../record.h"
 #include "pp-rtp.h"
 #include "pp-webm.h"
 #include "pp-h264.h"
@@ -85,6 +114,23 @@ static janus_pp_frame_packet *list = NULL, *last = NULL;
 static int working = 0;
 
 static int post_reset_trigger = 200;
+static gboolean header_only = FALSE;
+
+/* What's in the recording we're processing */
+static int video = 0, data = 0;
+static int opus = 0, g711 = 0, g722 = 0, vp8 = 0, vp9 = 0, h264 = 0;
+
+/* Streaming mode: packets are processed while the recording is still being
+ * parsed, so that memory usage doesn't depend on the recording length. Only
+ * the last reorder_window packets can still be reordered: everything up to
+ * window_final is settled, and can be processed (and then freed) */
+static gboolean streaming = FALSE;
+static int reorder_window = 1000;
+static janus_mutex window_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_condition window_cond;
+static janus_pp_frame_packet *window_final = NULL;
+static int window_pending = 0;
+static gboolean window_done = FALSE;
 
 
 /* Signal handler */
@@ -92,83 +138,310 @@ static void janus_pp_handle_signal(int signum) {
 	working = 0;
 }
 
+janus_pp_frame_packet *janus_pp_frame_next(janus_pp_frame_packet *pkt) {
+	if(!streaming)
+		return pkt->next;
+	janus_mutex_lock_nodebug(&window_mutex);
+	while(!window_done && pkt == window_final)
+		janus_condition_wait(&window_cond, &window_mutex);
+	janus_pp_frame_packet *next = pkt->next;
+	/* Free what processors won't look at anymore, except the first packet */
+	janus_pp_frame_packet *old = pkt->prev ? pkt->prev->prev : NULL;
+	if(old != NULL && old != list) {
+		old->prev->next = old->next;
+		old->next->prev = old->prev;
+		g_free(old);
+	}
+	janus_mutex_unlock_nodebug(&window_mutex);
+	return next;
+}
 
-/* Main Code */
-int main(int argc, char *argv[])
-{
-	janus_log_init(FALSE, TRUE, NULL);
-	atexit(janus_log_destroy);
+/* Bulk reader: packets are ordered by sequence number, which mostly follows
+ * the order they were saved in, so most of them are found in the buffer.
+ * When refilling, we keep a bit of what precedes the packet too, for the
+ * packets that were saved late */
+struct janus_pp_reader {
+	int fd;
+	uint8_t *buffer;
+	size_t size;
+	off_t offset;	/* Offset in the file of the first byte in the buffer */
+	size_t len;		/* Bytes currently in the buffer */
+};
+#define JANUS_PP_READER_SIZE	(4*1024*1024)
+#define JANUS_PP_READER_BACKLOG	(64*1024)
 
-	JANUS_LOG(LOG_INFO, "Janus version: %d (%s)\n", janus_version, janus_version_string);
-	JANUS_LOG(LOG_INFO, "Janus commit: %s\n", janus_build_git_sha);
-	JANUS_LOG(LOG_INFO, "Compiled on:  %s\n\n", janus_build_git_time);
+janus_pp_reader *janus_pp_reader_create(FILE *file) {
+	janus_pp_reader *reader = g_malloc0(sizeof(janus_pp_reader));
+	reader->fd = fileno(file);
+	reader->size = JANUS_PP_READER_SIZE;
+	reader->buffer = g_malloc(reader->size);
+#ifdef POSIX_FADV_SEQUENTIAL
+	/* Let the kernel read ahead more aggressively */
+	posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	return reader;
+}
 
-	/* Check the JANUS_PPREC_DEBUG environment variable for the debugging level */
-	if(g_getenv("JANUS_PPREC_DEBUG") != NULL) {
-		int val = atoi(g_getenv("JANUS_PPREC_DEBUG"));
-		if(val >= LOG_NONE && val <= LOG_MAX)
-			janus_log_level = val;
-		JANUS_LOG(LOG_INFO, "Logging level: %d\n", janus_log_level);
+uint8_t *janus_pp_reader_payload(janus_pp_reader *reader, janus_pp_frame_packet *pkt, int *len) {
+	if(!reader || !pkt || !len)
+		return NULL;
+	*len = 0;
+	int plen = pkt->len-12-pkt->skip;
+	if(plen < 0)
+		return NULL;
+	off_t start = pkt->offset+12+pkt->skip;
+	if(start < reader->offset || start+plen > reader->offset+(off_t)reader->len) {
+		/* Not in the buffer, read the next chunk of the file (we use pread,
+		 * so that the position of the FILE isn't affected) */
+		off_t from = start > JANUS_PP_READER_BACKLOG ? start-JANUS_PP_READER_BACKLOG : 0;
+		size_t got = 0;
+		while(got < reader->size) {
+			ssize_t res = pread(reader->fd, reader->buffer+got, reader->size-got, from+got);
+			if(res < 0 && errno == EINTR)
+				continue;
+			if(res <= 0)
+				break;
+			got += res;
+		}
+		reader->offset = from;
+		reader->len = got;
+		if(start+plen > from+(off_t)got) {
+			JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d)...\n", plen);
+			return NULL;
+		}
 	}
-	if(g_getenv("JANUS_PPREC_POSTRESETTRIGGER") != NULL) {
-		int val = atoi(g_getenv("JANUS_PPREC_POSTRESETTRIGGER"));
-		if(val >= 0)
-			post_reset_trigger = val;
-		JANUS_LOG(LOG_INFO, "Post reset trigger: %d\n", post_reset_trigger);
+	*len = plen;
+	return reader->buffer + (start-reader->offset);
+}
+
+void janus_pp_reader_destroy(janus_pp_reader *reader) {
+	if(!reader)
+		return;
+	g_free(reader->buffer);
+	g_free(reader);
+}
+
+/* Update the reorder window after a new packet has been added to the list */
+static void janus_pp_window_update(void) {
+	window_pending++;
+	if(window_pending > reorder_window) {
+		window_final = window_final ? window_final->next : list;
+		window_pending--;
+		janus_condition_signal(&window_cond);
 	}
-	
-	/* Evaluate arguments */
-	if(argc != 3) {
-		JANUS_LOG(LOG_INFO, "Usage: %s source.mjr destination.[opus|wav|webm|mp4|srt]\n", argv[0]);
-		JANUS_LOG(LOG_INFO, "       %s --header source.mjr (only parse header)\n", argv[0]);
-		JANUS_LOG(LOG_INFO, "       %s --parse source.mjr (only parse and re-order packets)\n", argv[0]);
-		return -1;
+}
+
+/* Seek index entry, as read from a recording */
+typedef struct janus_pp_index_entry {
+	long offset;
+	uint16_t len;
+} janus_pp_index_entry;
+
+/* Load the seek index of a recording, if it has one: the entries are
+ * returned in the order the packets were saved, NULL means the whole
+ * file will have to be scanned instead (e.g., older recordings) */
+static janus_pp_index_entry *janus_pp_read_index(FILE *file, long fsize, uint32_t *entries_num) {
+	if(fsize < JANUS_RECORDER_TRAILER_SIZE)
+		return NULL;
+	char block[JANUS_RECORDER_TRAILER_SIZE];
+	uint16_t len = 0;
+	uint32_t total = 0;
+	uint64_t chunk = 0;
+	fseek(file, fsize-JANUS_RECORDER_TRAILER_SIZE, SEEK_SET);
+	if(fread(block, sizeof(char), JANUS_RECORDER_TRAILER_SIZE, file) != JANUS_RECORDER_TRAILER_SIZE ||
+			memcmp(block, JANUS_RECORDER_TRAILER_HEADER, 8))
+		return NULL;
+	memcpy(&len, block+8, sizeof(uint16_t));
+	memcpy(&total, block+10, sizeof(uint32_t));
+	memcpy(&chunk, block+18, sizeof(uint64_t));
+	total = ntohl(total);
+	chunk = ntohll(chunk);
+	if(ntohs(len) != JANUS_RECORDER_INDEX_PREFIX_SIZE || total == 0)
+		return NULL;
+	/* Chunks are linked backwards, starting from the last one */
+	janus_pp_index_entry *entries = g_malloc(total * sizeof(janus_pp_index_entry));
+	char *data = g_malloc(JANUS_RECORDER_INDEX_CHUNK_ENTRIES * JANUS_RECORDER_INDEX_ENTRY_SIZE * 2);
+	uint32_t left = total, n = 0, i = 0;
+	while(left > 0 && chunk > 0 && chunk < (uint64_t)fsize) {
+		fseek(file, chunk, SEEK_SET);
+		if(fread(block, sizeof(char), JANUS_RECORDER_TRAILER_SIZE, file) != JANUS_RECORDER_TRAILER_SIZE ||
+				memcmp(block, JANUS_RECORDER_INDEX_HEADER, 8))
+			break;
+		memcpy(&len, block+8, sizeof(uint16_t));
+		memcpy(&n, block+10, sizeof(uint32_t));
+		memcpy(&chunk, block+18, sizeof(uint64_t));
+		len = ntohs(len);
+		n = ntohl(n);
+		chunk = ntohll(chunk);
+		if(n == 0 || n > left || n > JANUS_RECORDER_INDEX_CHUNK_ENTRIES*2 ||
+				len != JANUS_RECORDER_INDEX_PREFIX_SIZE + n*JANUS_RECORDER_INDEX_ENTRY_SIZE)
+			break;
+		if(fread(data, sizeof(char), n*JANUS_RECORDER_INDEX_ENTRY_SIZE, file) != n*JANUS_RECORDER_INDEX_ENTRY_SIZE)
+			break;
+		left -= n;
+		for(i=0; i<n; i++) {
+			char *entry = data + i*JANUS_RECORDER_INDEX_ENTRY_SIZE;
+			uint64_t offset = 0;
+			memcpy(&offset, entry, sizeof(uint64_t));
+			entries[left+i].offset = ntohll(offset);
+			memcpy(&entries[left+i].len, entry+14, sizeof(uint16_t));
+			entries[left+i].len = ntohs(entries[left+i].len);
+		}
 	}
-	char *source = NULL, *destination = NULL, *extension = NULL;
-	gboolean header_only = !strcmp(argv[1], "--header");
-	gboolean parse_only = !strcmp(argv[1], "--parse");
-	if(header_only || parse_only) {
-		/* Only parse the .mjr header and/or re-order the packets, no processing */
-		source = argv[2];
+	g_free(data);
+	if(left > 0) {
+		JANUS_LOG(LOG_WARN, "Broken seek index, scanning the file instead...\n");
+		g_free(entries);
+		return NULL;
+	}
+	*entries_num = total;
+	return entries;
+}
+
+
+/* Pre-process the packets, where needed (e.g., to get the video resolution) */
+static int janus_pp_preprocess(FILE *file) {
+	if(video) {
+		/* Look for maximum width and height, if possible, and for the average framerate */
+		if(vp8 || vp9) {
+			if(janus_pp_webm_preprocess(file, list, vp8) < 0) {
+				JANUS_LOG(LOG_ERR, "Error pre-processing %s RTP frames...\n", vp8 ? "VP8" : "VP9");
+				return -1;
+			}
+		} else if(h264) {
+			if(janus_pp_h264_preprocess(file, list) < 0) {
+				JANUS_LOG(LOG_ERR, "Error pre-processing H.264 RTP frames...\n");
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Create the target file */
+static int janus_pp_create(char *destination) {
+	if(!video && !data) {
+		if(opus) {
+			if(janus_pp_opus_create(destination) < 0) {
+				JANUS_LOG(LOG_ERR, "Error creating .opus file...\n");
+				return -1;
+			}
+		} else if(g711) {
+			if(janus_pp_g711_create(destination) < 0) {
+				JANUS_LOG(LOG_ERR, "Error creating .wav file...\n");
+				return -1;
+			}
+		} else if(g722) {
+			if(janus_pp_g722_create(destination) < 0) {
+				JANUS_LOG(LOG_ERR, "Error creating .wav file...\n");
+				return -1;
+			}
+		}
+	} else if(data) {
+		if(janus_pp_srt_create(destination) < 0) {
+			JANUS_LOG(LOG_ERR, "Error creating .srt file...\n");
+			return -1;
+		}
 	} else {
-		/* Post-process the .mjr recording */
-		source = argv[1];
-		destination = argv[2];
-		JANUS_LOG(LOG_INFO, "%s --> %s\n", source, destination);
-		/* Check the extension */
-		extension = strrchr(destination, '.');
-		if(extension == NULL) {
-			/* No extension? */
-			JANUS_LOG(LOG_ERR, "No extension? Unsupported target file\n");
-			exit(1);
+		if(vp8 || vp9) {
+			if(janus_pp_webm_create(destination, vp8) < 0) {
+				JANUS_LOG(LOG_ERR, "Error creating .webm file...\n");
+				return -1;
+			}
+		} else if(h264) {
+			if(janus_pp_h264_create(destination) < 0) {
+				JANUS_LOG(LOG_ERR, "Error creating .mp4 file...\n");
+				return -1;
+			}
 		}
-		if(strcasecmp(extension, ".opus") && strcasecmp(extension, ".wav") &&
-				strcasecmp(extension, ".webm") && strcasecmp(extension, ".mp4") &&
-				strcasecmp(extension, ".srt")) {
-			/* Unsupported extension? */
-			JANUS_LOG(LOG_ERR, "Unsupported extension '%s'\n", extension);
-			exit(1);
+	}
+	return 0;
+}
+
+/* Process the ordered packets, and save them to the target file */
+static void janus_pp_process(FILE *file) {
+	if(!video && !data) {
+		if(opus) {
+			if(janus_pp_opus_process(file, list, &working) < 0) {
+				JANUS_LOG(LOG_ERR, "Error processing Opus RTP frames...\n");
+			}
+		} else if(g711) {
+			if(janus_pp_g711_process(file, list, &working) < 0) {
+				JANUS_LOG(LOG_ERR, "Error processing G.711 RTP frames...\n");
+			}
+		} else if(g722) {
+			if(janus_pp_g722_process(file, list, &working) < 0) {
+				JANUS_LOG(LOG_ERR, "Error processing G.722 RTP frames...\n");
+			}
+		}
+	} else if(data) {
+		if(janus_pp_srt_process(file, list, &working) < 0) {
+			JANUS_LOG(LOG_ERR, "Error processing text data frames...\n");
+		}
+	} else {
+		if(vp8 || vp9) {
+			if(janus_pp_webm_process(file, list, vp8, &working) < 0) {
+				JANUS_LOG(LOG_ERR, "Error processing %s RTP frames...\n", vp8 ? "VP8" : "VP9");
+			}
+		} else {
+			if(janus_pp_h264_process(file, list, &working) < 0) {
+				JANUS_LOG(LOG_ERR, "Error processing H.264 RTP frames...\n");
+			}
 		}
 	}
+}
+
+/* Thread processing packets while they're still being parsed, when streaming */
+static void *janus_pp_process_thread(void *data) {
+	char *source = (char *)data;
+	/* We need our own file, as the parser is still reading the other one */
 	FILE *file = fopen(source, "rb");
 	if(file == NULL) {
 		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
-		return -1;
+		working = 0;
+		return NULL;
 	}
+	janus_pp_process(file);
+	fclose(file);
+	return NULL;
+}
+
+/* Start processing the packets settled so far, when streaming */
+static GThread *janus_pp_stream_start(FILE *file, char *source, char *destination) {
+	if(janus_pp_preprocess(file) < 0 || janus_pp_create(destination) < 0)
+		exit(1);
+	JANUS_LOG(LOG_INFO, "Processing packets while parsing (reorder window: %d packets)\n", reorder_window);
+	GError *error = NULL;
+	GThread *thread = g_thread_try_new("pp-process", &janus_pp_process_thread, source, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the processing thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		exit(1);
+	}
+	return thread;
+}
+
+/* Parse a recording and order its packets in the list: when streaming,
+ * processing is started as soon as enough packets are settled. The
+ * extension of the target file, if any, is checked against the codec */
+static FILE *janus_pp_parse(char *source, char *destination, char *extension,
+		long *size, gint64 *written, GThread **processor) {
+	FILE *file = fopen(source, "rb");
+	if(file == NULL) {
+		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
+		return NULL;
+	}
+	/* Parsing reads small headers all over the file: a larger buffer means fewer reads */
+	setvbuf(file, NULL, _IOFBF, 1024*1024);
 	fseek(file, 0L, SEEK_END);
 	long fsize = ftell(file);
 	fseek(file, 0L, SEEK_SET);
 	JANUS_LOG(LOG_INFO, "File is %zu bytes\n", fsize);
 
-	/* Handle SIGINT */
-	working = 1;
-	signal(SIGINT, janus_pp_handle_signal);
-
 	/* Pre-parse */
 	JANUS_LOG(LOG_INFO, "Pre-parsing file to generate ordered index...\n");
 	gboolean parsed_header = FALSE;
-	int video = 0, data = 0;
-	int opus = 0, g711 = 0, g722 = 0, vp8 = 0, vp9 = 0, h264 = 0;
 	gint64 c_time = 0, w_time = 0;
 	int bytes = 0, skip = 0;
 	long offset = 0;
@@ -177,12 +450,21 @@ int main(int argc, char *argv[])
 	uint32_t ssrc = 0;
 	char prebuffer[1500];
 	memset(prebuffer, 0, 1500);
+	/* If the recording has a seek index, we won't need to scan it */
+	uint32_t index_num = 0, index_next = 0;
+	janus_pp_index_entry *index = janus_pp_read_index(file, fsize, &index_num);
+	if(index != NULL)
+		JANUS_LOG(LOG_INFO, "Recording has a seek index (%"SCNu32" packets)\n", index_num);
 	/* Let's look for timestamp resets first */
 	while(working && offset < fsize) {
 		if(header_only && parsed_header) {
 			/* We only needed to parse the header */
 			exit(0);
 		}
+		if(index != NULL && parsed_header) {
+			/* The index tells us everything else */
+			break;
+		}
 		/* Read frame header */
 		skip = 0;
 		fseek(file, offset, SEEK_SET);
@@ -372,6 +654,12 @@ int main(int argc, char *argv[])
 	}
 	if(!working)
 		exit(0);
+	if(streaming && data) {
+		/* Text data is never reordered anyway */
+		streaming = FALSE;
+	}
+	if(streaming)
+		janus_condition_init(&window_cond);
 	/* Now let's parse the frames and order them */
 	uint32_t last_ts = 0, reset = 0;
 	int times_resetted = 0;
@@ -387,24 +675,34 @@ int main(int argc, char *argv[])
 	while(working && offset < fsize) {
 		/* Read frame header */
 		skip = 0;
-		fseek(file, offset, SEEK_SET);
-		bytes = fread(prebuffer, sizeof(char), 8, file);
-		if(bytes != 8 || prebuffer[0] != 'M') {
-			/* Broken packet? Stop here */
-			break;
-		}
-		prebuffer[8] = '\0';
-		JANUS_LOG(LOG_VERB, "Header: %s\n", prebuffer);
-		offset += 8;
-		bytes = fread(&len, sizeof(uint16_t), 1, file);
-		len = ntohs(len);
-		JANUS_LOG(LOG_VERB, "  -- Length: %"SCNu16"\n", len);
-		offset += 2;
-		if(prebuffer[1] == 'J' || (!data && len < 12)) {
-			/* Not RTP, skip */
-			JANUS_LOG(LOG_VERB, "  -- Not RTP, skipping\n");
-			offset += len;
-			continue;
+		if(index != NULL && !data) {
+			/* We know where the next packet is already */
+			if(index_next == index_num)
+				break;
+			offset = index[index_next].offset;
+			len = index[index_next].len;
+			index_next++;
+			fseek(file, offset, SEEK_SET);
+		} else {
+			fseek(file, offset, SEEK_SET);
+			bytes = fread(prebuffer, sizeof(char), 8, file);
+			if(bytes != 8 || prebuffer[0] != 'M') {
+				/* Broken packet? Stop here */
+				break;
+			}
+			prebuffer[8] = '\0';
+			JANUS_LOG(LOG_VERB, "Header: %s\n", prebuffer);
+			offset += 8;
+			bytes = fread(&len, sizeof(uint16_t), 1, file);
+			len = ntohs(len);
+			JANUS_LOG(LOG_VERB, "  -- Length: %"SCNu16"\n", len);
+			offset += 2;
+			if(prebuffer[1] == 'J' || (!data && len < 12)) {
+				/* Not RTP, skip */
+				JANUS_LOG(LOG_VERB, "  -- Not RTP, skipping\n");
+				offset += len;
+				continue;
+			}
 		}
 		if(!data && len > 2000) {
 			/* Way too large, very likely not RTP, skip */
@@ -532,10 +830,14 @@ int main(int argc, char *argv[])
 		p->skip = skip;
 		p->next = NULL;
 		p->prev = NULL;
+		if(streaming)
+			janus_mutex_lock_nodebug(&window_mutex);
 		if(list == NULL) {
 			/* First element becomes the list itself (and the last item), at least for now */
 			list = p;
 			last = p;
+			if(streaming)
+				janus_pp_window_update();
 		} else if(!p->drop) {
 			/* Check where we should insert this, starting from the end */
 			int added = 0;
@@ -592,125 +894,355 @@ int main(int argc, char *argv[])
 						break;
 					}
 				}
+				/* When streaming, we can't go back past what may have been processed already */
+				if(tmp == window_final)
+					break;
 				/* If either the timestamp ot the sequence number we just got is smaller, keep going back */
 				tmp = tmp->prev;
 			}
+			if(!p->drop && !added && window_final != NULL) {
+				/* Too late for the reorder window */
+				JANUS_LOG(LOG_WARN, "Dropping packet out of the reorder window (seq=%"SCNu16")\n", p->seq);
+				p->drop = 1;
+			}
 			if(p->drop) {
 				/* We don't need this */
 				g_free(p);
-			} else if(!added) {
-				/* We reached the start */
-				p->next = list;
-				list->prev = p;
-				list = p;
+			} else {
+				if(!added) {
+					/* We reached the start */
+					p->next = list;
+					list->prev = p;
+					list = p;
+				}
+				if(streaming)
+					janus_pp_window_update();
+			}
+		}
+		if(streaming) {
+			janus_mutex_unlock_nodebug(&window_mutex);
+			if(*processor == NULL && window_final != NULL) {
+				/* Enough packets are settled, start processing them */
+				*processor = janus_pp_stream_start(file, source, destination);
 			}
 		}
 		/* Skip data for now */
 		offset += len;
 		count++;
 	}
+	g_free(index);
 	if(!working)
 		exit(0);
-	
 	JANUS_LOG(LOG_INFO, "Counted %"SCNu32" RTP packets\n", count);
-	janus_pp_frame_packet *tmp = list;
-	count = 0;
-	while(tmp) {
-		count++;
-		if(!data)
-			JANUS_LOG(LOG_VERB, "[%10lu][%4d] seq=%"SCNu16", ts=%"SCNu64", time=%"SCNu64"s\n", tmp->offset, tmp->len, tmp->seq, tmp->ts, (tmp->ts-list->ts)/90000);
-		else
-			JANUS_LOG(LOG_VERB, "[%10lu][%4d] time=%"SCNu64"s\n", tmp->offset, tmp->len, tmp->ts);
-		tmp = tmp->next;
+	if(size)
+		*size = fsize;
+	if(written)
+		*written = w_time;
+	return file;
+}
+
+/* Mux an Opus and a VP8/VP9 recording in a single .webm/.mkv file, in a
+ * single pass: the recordings are aligned using the time the first frame
+ * of each was written. The video file is returned, and the video packets
+ * are left in the list, so that they can be cleaned up as usual */
+static FILE *janus_pp_mux(char *audio_source, char *video_source, char *destination) {
+	gint64 audio_time = 0, video_time = 0;
+	FILE *audio_file = janus_pp_parse(audio_source, destination, NULL, NULL, &audio_time, NULL);
+	if(audio_file == NULL)
+		return NULL;
+	if(video || data || !opus) {
+		JANUS_LOG(LOG_ERR, "%s is not an Opus recording\n", audio_source);
+		exit(1);
+	}
+	janus_pp_frame_packet *audio_list = list;
+	list = NULL;
+	last = NULL;
+	FILE *file = janus_pp_parse(video_source, destination, NULL, NULL, &video_time, NULL);
+	if(file == NULL)
+		exit(1);
+	if(!video || !(vp8 || vp9)) {
+		JANUS_LOG(LOG_ERR, "%s is not a VP8 or VP9 recording\n", video_source);
+		exit(1);
 	}
-	JANUS_LOG(LOG_INFO, "Counted %"SCNu32" frame packets\n", count);
+	/* Which one started first? */
+	gint64 audio_delay = 0, video_delay = 0;
+	if(audio_time == 0 || video_time == 0) {
+		JANUS_LOG(LOG_WARN, "Missing written time in the info header, assuming the recordings are aligned\n");
+	} else if(audio_time > video_time) {
+		audio_delay = (audio_time-video_time)/1000;
+	} else {
+		video_delay = (video_time-audio_time)/1000;
+	}
+	JANUS_LOG(LOG_INFO, "Muxing audio (delay: %"SCNi64"ms) and video (delay: %"SCNi64"ms)\n", audio_delay, video_delay);
+	if(audio_list != NULL && janus_pp_webm_add_audio(audio_file, audio_list, audio_delay, video_delay) < 0) {
+		JANUS_LOG(LOG_ERR, "Error adding Opus RTP frames...\n");
+		exit(1);
+	}
+	if(janus_pp_preprocess(file) < 0 || janus_pp_create(destination) < 0)
+		exit(1);
+	janus_pp_process(file);
+	/* We don't need the audio anymore */
+	fclose(audio_file);
+	janus_pp_frame_packet *temp = audio_list, *next = NULL;
+	while(temp) {
+		next = temp->next;
+		g_free(temp);
+		temp = next;
+	}
+	return file;
+}
 
-	if(video) {
-		/* Look for maximum width and height, if possible, and for the average framerate */
-		if(vp8 || vp9) {
-			if(janus_pp_webm_preprocess(file, list, vp8) < 0) {
-				JANUS_LOG(LOG_ERR, "Error pre-processing %s RTP frames...\n", vp8 ? "VP8" : "VP9");
-				exit(1);
-			}
-		} else if(h264) {
-			if(janus_pp_h264_preprocess(file, list) < 0) {
-				JANUS_LOG(LOG_ERR, "Error pre-processing H.264 RTP frames...\n");
-				exit(1);
-			}
+/* Read the source/destination pairs to process in batch from a file (or
+ * from the standard input, if "-"), one pair per line: pairs are appended
+ * to the provided array, and the number of pairs found is returned */
+static int janus_pp_batch_list(const char *path, GPtrArray *pairs) {
+	FILE *list_file = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if(list_file == NULL) {
+		fprintf(stderr, "Could not open list %s\n", path);
+		return -1;
+	}
+	int count = 0;
+	char line[2048];
+	while(fgets(line, sizeof(line), list_file) != NULL) {
+		gchar **items = g_strsplit_set(g_strstrip(line), " \t", -1);
+		char *src = NULL, *dst = NULL;
+		int i = 0;
+		for(i=0; items[i] != NULL; i++) {
+			if(strlen(items[i]) == 0)
+				continue;
+			if(src == NULL)
+				src = items[i];
+			else if(dst == NULL)
+				dst = items[i];
 		}
+		if(src != NULL && dst != NULL) {
+			g_ptr_array_add(pairs, g_strdup(src));
+			g_ptr_array_add(pairs, g_strdup(dst));
+			count++;
+		} else if(src != NULL && src[0] != '#') {
+			fprintf(stderr, "Ignoring invalid line in list: %s\n", line);
+		}
+		g_strfreev(items);
 	}
+	if(list_file != stdin)
+		fclose(list_file);
+	return count;
+}
 
-	if(parse_only) {
-		/* We only needed to parse and re-order the packets, we're done here */
-		JANUS_LOG(LOG_INFO, "Parsing and reordering completed, bye!\n");
-		exit(0);
+/* Batch mode: process the source/destination pairs that start at argv[arg],
+ * forking up to jobs children at the same time. Processors keep their state
+ * in globals, so a process per recording is what lets us use more cores.
+ * Children get the index of the pair they must process, while the parent
+ * only gets -1, once all children are done. This is called before logging
+ * is initialized, as its thread would not survive a fork */
+static int janus_pp_batch(int argc, char *argv[], int arg, int jobs, int *failed) {
+	int running = 0, status = 0, i = 0;
+	for(i=arg; i+1<argc; i+=2) {
+		if(running == jobs && wait(&status) > 0) {
+			running--;
+			if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				(*failed)++;
+		}
+		pid_t pid = fork();
+		if(pid == 0)
+			return i;
+		if(pid < 0) {
+			(*failed)++;
+			continue;
+		}
+		running++;
+	}
+	while(running > 0 && wait(&status) > 0) {
+		running--;
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			(*failed)++;
 	}
+	return -1;
+}
 
-	if(!video && !data) {
-		if(opus) {
-			if(janus_pp_opus_create(destination) < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating .opus file...\n");
-				exit(1);
-			}
-		} else if(g711) {
-			if(janus_pp_g711_create(destination) < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating .wav file...\n");
-				exit(1);
-			}
-		} else if(g722) {
-			if(janus_pp_g722_create(destination) < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating .wav file...\n");
-				exit(1);
-			}
+
+/* Main Code */
+int main(int argc, char *argv[])
+{
+	/* Check the options first: when processing recordings in batch,
+	 * we need to fork before any thread is started */
+	int arg = 1, jobs = 0;
+	const char *list_path = NULL;
+	while(arg < argc) {
+		if(!strcmp(argv[arg], "--stream")) {
+			streaming = TRUE;
+		} else if(!strncmp(argv[arg], "--jobs=", strlen("--jobs="))) {
+			jobs = atoi(argv[arg]+strlen("--jobs="));
+		} else if(!strncmp(argv[arg], "--list=", strlen("--list="))) {
+			list_path = argv[arg]+strlen("--list=");
+		} else {
+			break;
 		}
-	} else if(data) {
-		if(janus_pp_srt_create(destination) < 0) {
-			JANUS_LOG(LOG_ERR, "Error creating .srt file...\n");
+		arg++;
+	}
+	if(list_path != NULL && arg == argc) {
+		/* Get the pairs from the list, and process them as if they were arguments */
+		GPtrArray *pairs = g_ptr_array_new();
+		g_ptr_array_add(pairs, argv[0]);
+		if(janus_pp_batch_list(list_path, pairs) < 0)
 			exit(1);
+		g_ptr_array_add(pairs, NULL);
+		argc = pairs->len-1;
+		argv = (char **)g_ptr_array_free(pairs, FALSE);
+		arg = 1;
+		if(jobs < 1)
+			jobs = 1;
+		if(argc == 1) {
+			fprintf(stderr, "No recordings to process in %s\n", list_path);
+			exit(0);
 		}
-	} else {
-		if(vp8 || vp9) {
-			if(janus_pp_webm_create(destination, vp8) < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating .webm file...\n");
-				exit(1);
-			}
-		} else if(h264) {
-			if(janus_pp_h264_create(destination) < 0) {
-				JANUS_LOG(LOG_ERR, "Error creating .mp4 file...\n");
-				exit(1);
-			}
+	}
+	if(jobs > 0 && argc-arg >= 2 && (argc-arg) % 2 == 0) {
+		int failed = 0;
+		int pair = janus_pp_batch(argc, argv, arg, jobs, &failed);
+		if(pair < 0) {
+			janus_log_init(FALSE, TRUE, NULL);
+			atexit(janus_log_destroy);
+			JANUS_LOG(LOG_INFO, "Processed %d recordings, %d failed\n", (argc-arg)/2, failed);
+			exit(failed ? 1 : 0);
 		}
+		/* We're a child: process our own pair as usual */
+		arg = pair;
+		argc = arg+2;
+		jobs = 0;
+	}
+
+	janus_log_init(FALSE, TRUE, NULL);
+	atexit(janus_log_destroy);
+
+	JANUS_LOG(LOG_INFO, "Janus version: %d (%s)\n", janus_version, janus_version_string);
+	JANUS_LOG(LOG_INFO, "Janus commit: %s\n", janus_build_git_sha);
+	JANUS_LOG(LOG_INFO, "Compiled on:  %s\n\n", janus_build_git_time);
+
+	/* Check the JANUS_PPREC_DEBUG environment variable for the debugging level */
+	if(g_getenv("JANUS_PPREC_DEBUG") != NULL) {
+		int val = atoi(g_getenv("JANUS_PPREC_DEBUG"));
+		if(val >= LOG_NONE && val <= LOG_MAX)
+			janus_log_level = val;
+		JANUS_LOG(LOG_INFO, "Logging level: %d\n", janus_log_level);
+	}
+	if(g_getenv("JANUS_PPREC_POSTRESETTRIGGER") != NULL) {
+		int val = atoi(g_getenv("JANUS_PPREC_POSTRESETTRIGGER"));
+		if(val >= 0)
+			post_reset_trigger = val;
+		JANUS_LOG(LOG_INFO, "Post reset trigger: %d\n", post_reset_trigger);
+	}
+	if(g_getenv("JANUS_PPREC_REORDERWINDOW") != NULL) {
+		int val = atoi(g_getenv("JANUS_PPREC_REORDERWINDOW"));
+		if(val > 0)
+			reorder_window = val;
+		JANUS_LOG(LOG_INFO, "Reorder window: %d\n", reorder_window);
 	}
 	
-	/* Loop */
-	if(!video && !data) {
-		if(opus) {
-			if(janus_pp_opus_process(file, list, &working) < 0) {
-				JANUS_LOG(LOG_ERR, "Error processing Opus RTP frames...\n");
-			}
-		} else if(g711) {
-			if(janus_pp_g711_process(file, list, &working) < 0) {
-				JANUS_LOG(LOG_ERR, "Error processing G.711 RTP frames...\n");
-			}
-		} else if(g722) {
-			if(janus_pp_g722_process(file, list, &working) < 0) {
-				JANUS_LOG(LOG_ERR, "Error processing G.722 RTP frames...\n");
-			}
+	/* Evaluate arguments */
+	gboolean mux = (argc-arg == 4 && !strcmp(argv[arg], "--mux"));
+	if(argc-arg != 2 && !mux) {
+		JANUS_LOG(LOG_INFO, "Usage: %s [--stream] source.mjr destination.[opus|wav|webm|mp4|srt]\n", argv[0]);
+		JANUS_LOG(LOG_INFO, "       %s [--stream] --jobs=N source1.mjr destination1.ext [source2.mjr destination2.ext ...]\n", argv[0]);
+		JANUS_LOG(LOG_INFO, "       %s [--stream] [--jobs=N] --list=FILE (source/destination pairs, one per line)\n", argv[0]);
+		JANUS_LOG(LOG_INFO, "       %s --mux audio.mjr video.mjr destination.[webm|mkv] (mux Opus and VP8/VP9)\n", argv[0]);
+		JANUS_LOG(LOG_INFO, "       %s --header source.mjr (only parse header)\n", argv[0]);
+		JANUS_LOG(LOG_INFO, "       %s --parse source.mjr (only parse and re-order packets)\n", argv[0]);
+		return -1;
+	}
+	char *source = NULL, *destination = NULL, *extension = NULL, *audio_source = NULL;
+	header_only = !strcmp(argv[arg], "--header");
+	gboolean parse_only = !strcmp(argv[arg], "--parse");
+	if(header_only || parse_only) {
+		/* Only parse the .mjr header and/or re-order the packets, no processing */
+		source = argv[arg+1];
+		streaming = FALSE;
+	} else if(mux) {
+		/* Mux an audio and a video .mjr recording */
+		audio_source = argv[arg+1];
+		source = argv[arg+2];
+		destination = argv[arg+3];
+		JANUS_LOG(LOG_INFO, "%s + %s --> %s\n", audio_source, source, destination);
+		extension = strrchr(destination, '.');
+		if(extension == NULL || (strcasecmp(extension, ".webm") && strcasecmp(extension, ".mkv"))) {
+			JANUS_LOG(LOG_ERR, "Audio and video can only be muxed to a .webm or .mkv file\n");
+			exit(1);
 		}
-	} else if(data) {
-		if(janus_pp_srt_process(file, list, &working) < 0) {
-			JANUS_LOG(LOG_ERR, "Error processing text data frames...\n");
+		/* The processing needs both lists to be complete */
+		streaming = FALSE;
+	} else {
+		/* Post-process the .mjr recording */
+		source = argv[arg];
+		destination = argv[arg+1];
+		JANUS_LOG(LOG_INFO, "%s --> %s\n", source, destination);
+		/* Check the extension */
+		extension = strrchr(destination, '.');
+		if(extension == NULL) {
+			/* No extension? */
+			JANUS_LOG(LOG_ERR, "No extension? Unsupported target file\n");
+			exit(1);
 		}
+		if(strcasecmp(extension, ".opus") && strcasecmp(extension, ".wav") &&
+				strcasecmp(extension, ".webm") && strcasecmp(extension, ".mp4") &&
+				strcasecmp(extension, ".srt")) {
+			/* Unsupported extension? */
+			JANUS_LOG(LOG_ERR, "Unsupported extension '%s'\n", extension);
+			exit(1);
+		}
+	}
+	/* Handle SIGINT */
+	working = 1;
+	signal(SIGINT, janus_pp_handle_signal);
+
+	GThread *processor = NULL;
+	long fsize = 0;
+	FILE *file = NULL;
+	if(mux) {
+		/* Parse and process both recordings in one go */
+		file = janus_pp_mux(audio_source, source, destination);
 	} else {
-		if(vp8 || vp9) {
-			if(janus_pp_webm_process(file, list, vp8, &working) < 0) {
-				JANUS_LOG(LOG_ERR, "Error processing %s RTP frames...\n", vp8 ? "VP8" : "VP9");
-			}
-		} else {
-			if(janus_pp_h264_process(file, list, &working) < 0) {
-				JANUS_LOG(LOG_ERR, "Error processing H.264 RTP frames...\n");
-			}
+		file = janus_pp_parse(source, destination, extension, &fsize, NULL, &processor);
+	}
+	if(file == NULL)
+		return -1;
+
+	if(streaming) {
+		/* Recordings shorter than the reorder window are processed only now */
+		if(processor == NULL)
+			processor = janus_pp_stream_start(file, source, destination);
+		/* Let the processing thread know there are no more packets, and wait for it */
+		janus_mutex_lock_nodebug(&window_mutex);
+		window_done = TRUE;
+		janus_condition_signal(&window_cond);
+		janus_mutex_unlock_nodebug(&window_mutex);
+		g_thread_join(processor);
+	} else if(!mux) {
+		janus_pp_frame_packet *tmp = list;
+		uint32_t count = 0;
+		while(tmp) {
+			count++;
+			if(!data)
+				JANUS_LOG(LOG_VERB, "[%10lu][%4d] seq=%"SCNu16", ts=%"SCNu64", time=%"SCNu64"s\n", tmp->offset, tmp->len, tmp->seq, tmp->ts, (tmp->ts-list->ts)/90000);
+			else
+				JANUS_LOG(LOG_VERB, "[%10lu][%4d] time=%"SCNu64"s\n", tmp->offset, tmp->len, tmp->ts);
+			tmp = tmp->next;
+		}
+		JANUS_LOG(LOG_INFO, "Counted %"SCNu32" frame packets\n", count);
+
+		if(janus_pp_preprocess(file) < 0)
+			exit(1);
+
+		if(parse_only) {
+			/* We only needed to parse and re-order the packets, we're done here */
+			JANUS_LOG(LOG_INFO, "Parsing and reordering completed, bye!\n");
+			exit(0);
 		}
+
+		if(janus_pp_create(destination) < 0)
+			exit(1);
+
+		/* Loop */
+		janus_pp_process(file);
 	}
 
 	/* Clean up */
@@ -228,9 +228,8 @@ int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list) {
 	if(!file || !list)
 		return -1;
 	janus_pp_frame_packet *tmp = list;
-	int bytes = 0, min_ts_diff = 0, max_ts_diff = 0;
-	char prebuffer[1500];
-	memset(prebuffer, 0, 1500);
+	int min_ts_diff = 0, max_ts_diff = 0;
+	janus_pp_reader *reader = janus_pp_reader_create(file);
 	while(tmp) {
 		if(tmp->prev != NULL && tmp->ts > tmp->prev->ts) {
 			if(tmp->ts > tmp->prev->ts) {
@@ -246,11 +245,12 @@ int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list) {
 			}
 		}
 		/* Parse H264 header now */
-		fseek(file, tmp->offset+12+tmp->skip, SEEK_SET);
-		int len = tmp->len-12-tmp->skip;
-		bytes = fread(prebuffer, sizeof(char), len, file);
-		if(bytes != len)
-			JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, len);
+		int len = 0;
+		char *prebuffer = (char *)janus_pp_reader_payload(reader, tmp, &len);
+		if(prebuffer == NULL || len < 1) {
+			tmp = tmp->next;
+			continue;
+		}
 		if((prebuffer[0] & 0x1F) == 7) {
 			/* SPS, see if we can extract the width/height as well */
 			JANUS_LOG(LOG_VERB, "Parsing width/height\n");
@@ -267,11 +267,13 @@ int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list) {
 			buffer++;
 			int tot = len-1;
 			uint16_t psize = 0;
-			while(tot > 0) {
+			while(tot > 2) {
 				memcpy(&psize, buffer, 2);
 				psize = ntohs(psize);
 				buffer += 2;
 				tot -= 2;
+				if(psize > tot)
+					break;
 				int nal = *buffer & 0x1F;
 				JANUS_LOG(LOG_HUGE, "  -- NALU of size %u: %d\n", psize, nal);
 				if(nal == 7) {
@@ -295,6 +297,7 @@ int janus_pp_h264_preprocess(FILE *file, janus_pp_frame_packet *list) {
 		}
 		tmp = tmp->next;
 	}
+	janus_pp_reader_destroy(reader);
 	int mean_ts = min_ts_diff;	/* FIXME: was an actual mean, (max_ts_diff+min_ts_diff)/2; */
 	fps = (90000/(mean_ts > 0 ? mean_ts : 30));
 	JANUS_LOG(LOG_INFO, "  -- %dx%d (fps [%d,%d] ~ %d)\n", max_width, max_height, min_ts_diff, max_ts_diff, fps);
@@ -315,9 +318,12 @@ int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working)
 		return -1;
 	janus_pp_frame_packet *tmp = list;
 
-	int bytes = 0, numBytes = max_width*max_height*3;	/* FIXME */
+	/* NALs are assembled in the frame buffer straight from the buffer of the
+	 * reader, so each byte of payload is only copied once */
+	janus_pp_reader *reader = janus_pp_reader_create(file);
+	int numBytes = max_width*max_height*3;	/* FIXME */
 	uint8_t *received_frame = g_malloc0(numBytes);
-	uint8_t *buffer = g_malloc0(10000), *start = buffer;
+	uint8_t *buffer = NULL;
 	int len = 0, frameLen = 0;
 	int keyFrame = 0;
 	uint32_t keyframe_ts = 0;
@@ -327,20 +333,21 @@ int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working)
 		frameLen = 0;
 		len = 0;
 		while(1) {
-			if(tmp->drop) {
+			/* RTP payload */
+			buffer = tmp->drop ? NULL : janus_pp_reader_payload(reader, tmp, &len);
+			if(buffer == NULL || len < 2) {
 				/* Check if timestamp changes: marker bit is not mandatory, and may be lost as well */
-				if(tmp->next == NULL || tmp->next->ts > tmp->ts)
+				janus_pp_frame_packet *next = janus_pp_frame_next(tmp);
+				if(next == NULL || next->ts > tmp->ts)
 					break;
-				tmp = tmp->next;
+				tmp = next;
 				continue;
 			}
-			/* RTP payload */
-			buffer = start;
-			fseek(file, tmp->offset+12+tmp->skip, SEEK_SET);
-			len = tmp->len-12-tmp->skip;
-			bytes = fread(buffer, sizeof(char), len, file);
-			if(bytes != len)
-				JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, len);
+			if(frameLen + 2*len + 4 + FF_INPUT_BUFFER_PADDING_SIZE > numBytes) {
+				/* Larger than what the pre-processed resolution suggested (e.g., when streaming) */
+				numBytes = 2*(frameLen + 2*len + 4 + FF_INPUT_BUFFER_PADDING_SIZE);
+				received_frame = g_realloc(received_frame, numBytes);
+			}
 			/* H.264 depay */
 			int jump = 0;
 			uint8_t fragment = *buffer & 0x1F;
@@ -373,11 +380,13 @@ int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working)
 				int tot = len-1;
 				uint16_t psize = 0;
 				frameLen = 0;
-				while(tot > 0) {
+				while(tot > 2) {
 					memcpy(&psize, buffer, 2);
 					psize = ntohs(psize);
 					buffer += 2;
 					tot -= 2;
+					if(psize > tot)
+						break;
 					/* Now we have a single NAL */
 					uint8_t *temp = received_frame + frameLen;
 					memset(temp, 0x00, 1);
@@ -391,7 +400,7 @@ int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working)
 					tot -= psize;
 				}
 				/* Done, we'll wait for the next video data to write the frame */
-				tmp = tmp->next;
+				tmp = janus_pp_frame_next(tmp);
 				continue;
 			} else if((fragment == 28) || (fragment == 29)) {	/* FIXME true fr FU-A, not FU-B */
 				uint8_t indicator = *buffer;
@@ -415,9 +424,10 @@ int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working)
 			if(len == 0)
 				break;
 			/* Check if timestamp changes: marker bit is not mandatory, and may be lost as well */
-			if(tmp->next == NULL || tmp->next->ts > tmp->ts)
+			janus_pp_frame_packet *next = janus_pp_frame_next(tmp);
+			if(next == NULL || next->ts > tmp->ts)
 				break;
-			tmp = tmp->next;
+			tmp = next;
 		}
 		if(frameLen > 0) {
 			/* Save the frame */
@@ -443,10 +453,10 @@ int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working)
 				}
 			}
 		}
-		tmp = tmp->next;
+		tmp = janus_pp_frame_next(tmp);
 	}
 	g_free(received_frame);
-	g_free(start);
+	janus_pp_reader_destroy(reader);
 	return 0;
 }
 
@@ -94,7 +94,7 @@ int janus_pp_opus_process(FILE *file, janus_pp_frame_packet *list, int *working)
 		if(tmp->drop) {
 			/* We marked this packet as one to drop, before */
 			JANUS_LOG(LOG_WARN, "Dropping previously marked audio packet (time ~%"SCNu64"s)\n", (tmp->ts-list->ts)/48000);
-			tmp = tmp->next;
+			tmp = janus_pp_frame_next(tmp);
 			continue;
 		}
 		guint16 diff = tmp->prev == NULL ? 1 : (tmp->seq - tmp->prev->seq);
@@ -121,7 +121,7 @@ int janus_pp_opus_process(FILE *file, janus_pp_frame_packet *list, int *working)
 		g_free(op);
 		ogg_write();
 		ogg_flush();
-		tmp = tmp->next;
+		tmp = janus_pp_frame_next(tmp);
 	}
 	g_free(buffer);
 	return 0;
@@ -54,5 +54,35 @@ typedef struct janus_pp_frame_packet {
 	struct janus_pp_frame_packet *prev;
 } janus_pp_frame_packet;
 
+/*! \brief Get the packet that follows the provided one in the ordered list
+ * \note Processors must always use this, rather than the \c next pointer: when
+ * streaming, the list is still being built while they traverse it, and the
+ * packets they're done with are freed (only the first packet, and the one
+ * preceding the returned one, are guaranteed to still be available)
+ * @param[in] pkt The packet to start from
+ * @returns The next packet, or NULL if there are no more packets */
+janus_pp_frame_packet *janus_pp_frame_next(janus_pp_frame_packet *pkt);
+
+/*! \brief Bulk reader of the packets in a recording
+ * \details Rather than seeking and reading each packet on its own, processors
+ * can get the payload of packets straight from a large buffer, which is only
+ * refilled (with a single read) once a packet falls outside of it */
+typedef struct janus_pp_reader janus_pp_reader;
+/*! \brief Create a bulk reader for a recording
+ * @param[in] file The recording to read from
+ * @returns A new reader */
+janus_pp_reader *janus_pp_reader_create(FILE *file);
+/*! \brief Get the RTP payload of a packet, reading more of the recording if needed
+ * \note The returned data lives in the buffer of the reader, and so is
+ * only valid until the next call: it can be modified in place, though
+ * @param[in] reader The reader to use
+ * @param[in] pkt The packet to get the payload of
+ * @param[out] len The length of the payload
+ * @returns A pointer to the payload, or NULL if it couldn't be read */
+uint8_t *janus_pp_reader_payload(janus_pp_reader *reader, janus_pp_frame_packet *pkt, int *len);
+/*! \brief Destroy a bulk reader
+ * @param[in] reader The reader to destroy */
+void janus_pp_reader_destroy(janus_pp_reader *reader);
+
 
 #endif
@@ -65,15 +65,16 @@ int janus_pp_srt_process(FILE *file, janus_pp_frame_packet *list, int *working)
 		if(tmp->drop) {
 			/* We marked this packet as one to drop, before */
 			JANUS_LOG(LOG_WARN, "Dropping previously marked text packet (time ~%"SCNu64"s)\n", tmp->ts);
-			tmp = tmp->next;
+			tmp = janus_pp_frame_next(tmp);
 			continue;
 		}
 		/* Increase sequence number */
 		seq++;
 		/* Compute from/to times */
 		janus_pp_srt_format_time(from, sizeof(from), tmp->ts);
-		if(tmp->next)
-			janus_pp_srt_format_time(to, sizeof(from), tmp->next->ts-1000);
+		janus_pp_frame_packet *next = janus_pp_frame_next(tmp);
+		if(next)
+			janus_pp_srt_format_time(to, sizeof(from), next->ts-1000);
 		else
 			janus_pp_srt_format_time(to, sizeof(from), tmp->ts + 5*G_USEC_PER_SEC);
 		/* Write the header lines */
@@ -106,7 +107,7 @@ int janus_pp_srt_process(FILE *file, janus_pp_frame_packet *list, int *working)
 		}
 		fflush(srt_file);
 		/* Next? */
-		tmp = tmp->next;
+		tmp = janus_pp_frame_next(tmp);
 	}
 	g_free(buffer);
 
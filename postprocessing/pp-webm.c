@@ -66,6 +66,59 @@ static AVCodecContext *vEncoder;
 #endif
 static int max_width = 0, max_height = 0, fps = 0;
 
+/* Opus audio to mux, if any */
+static AVStream *aStream;
+static FILE *audio_file = NULL;
+static janus_pp_frame_packet *audio_list = NULL, *audio_next = NULL;
+static uint8_t *audio_buffer = NULL;
+static int64_t audio_delay = 0, video_delay = 0;
+
+int janus_pp_webm_add_audio(FILE *file, janus_pp_frame_packet *list, int64_t adelay, int64_t vdelay) {
+	if(!file || !list || adelay < 0 || vdelay < 0)
+		return -1;
+	audio_file = file;
+	audio_list = list;
+	audio_next = list;
+	audio_delay = adelay;
+	video_delay = vdelay;
+	return 0;
+}
+
+/* Write the audio packets that come before the provided time (in ms), or all of them when it's negative */
+static void janus_pp_webm_write_audio(int64_t until, int *working) {
+	if(fctx == NULL || aStream == NULL)
+		return;
+	if(audio_buffer == NULL)
+		audio_buffer = g_malloc0(1500);
+	while(*working && audio_next != NULL) {
+		janus_pp_frame_packet *tmp = audio_next;
+		int64_t pts = (tmp->ts-audio_list->ts)/48 + audio_delay;
+		if(until >= 0 && pts > until)
+			break;
+		audio_next = janus_pp_frame_next(tmp);
+		if(tmp->drop)
+			continue;
+		fseek(audio_file, tmp->offset+12+tmp->skip, SEEK_SET);
+		int len = tmp->len-12-tmp->skip;
+		if(len <= 0 || len > 1500)
+			continue;
+		int bytes = fread(audio_buffer, sizeof(char), len, audio_file);
+		if(bytes != len)
+			JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, len);
+		AVPacket packet;
+		av_init_packet(&packet);
+		packet.stream_index = aStream->index;
+		packet.data = audio_buffer;
+		packet.size = bytes;
+		packet.flags |= AV_PKT_FLAG_KEY;
+		packet.dts = pts;
+		packet.pts = pts;
+		if(av_write_frame(fctx, &packet) < 0) {
+			JANUS_LOG(LOG_ERR, "Error writing audio frame to file...\n");
+		}
+	}
+}
+
 int janus_pp_webm_create(char *destination, int vp8) {
 	if(destination == NULL)
 		return -1;
@@ -91,7 +144,8 @@ int janus_pp_webm_create(char *destination, int vp8) {
 		return -1;
 	}
 	//~ fctx->oformat = guess_format("webm", NULL, NULL);
-	fctx->oformat = av_guess_format("webm", NULL, NULL);
+	const char *extension = strrchr(destination, '.');
+	fctx->oformat = av_guess_format((extension && !strcasecmp(extension, ".mkv")) ? "matroska" : "webm", NULL, NULL);
 	if(fctx->oformat == NULL) {
 		JANUS_LOG(LOG_ERR, "Error guessing format\n");
 		return -1;
@@ -151,6 +205,44 @@ int janus_pp_webm_create(char *destination, int vp8) {
 	if (fctx->flags & AVFMT_GLOBALHEADER)
 		vStream->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
 #endif
+	if(audio_list != NULL) {
+		/* We're muxing Opus audio as well: no encoder needed, we only need an OpusHead */
+#if LIBAVCODEC_VER_AT_LEAST(54, 25)
+		aStream = avformat_new_stream(fctx, 0);
+		if(aStream == NULL) {
+			JANUS_LOG(LOG_ERR, "Error adding audio stream\n");
+			return -1;
+		}
+		aStream->id = fctx->nb_streams-1;
+		uint8_t *opushead = av_mallocz(19 + FF_INPUT_BUFFER_PADDING_SIZE);
+		memcpy(opushead, "OpusHead", 8);	/* identifier */
+		opushead[8] = 1;					/* version */
+		opushead[9] = 2;					/* channels */
+		opushead[12] = 0x80;				/* original sample rate (48000, little endian) */
+		opushead[13] = 0xBB;
+#ifdef USE_CODECPAR
+		aStream->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+		aStream->codecpar->codec_id = AV_CODEC_ID_OPUS;
+		aStream->codecpar->sample_rate = 48000;
+		aStream->codecpar->channels = 2;
+		aStream->codecpar->extradata = opushead;
+		aStream->codecpar->extradata_size = 19;
+#else
+		avcodec_get_context_defaults3(aStream->codec, AVMEDIA_TYPE_AUDIO);
+		aStream->codec->codec_type = AVMEDIA_TYPE_AUDIO;
+		aStream->codec->codec_id = AV_CODEC_ID_OPUS;
+		aStream->codec->sample_rate = 48000;
+		aStream->codec->channels = 2;
+		aStream->codec->extradata = opushead;
+		aStream->codec->extradata_size = 19;
+		if (fctx->flags & AVFMT_GLOBALHEADER)
+			aStream->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+#endif
+#else
+		JANUS_LOG(LOG_FATAL, "Your FFmpeg version does not support Opus\n");
+		return -1;
+#endif
+	}
 	//~ fctx->timestamp = 0;
 	//~ if(url_fopen(&fctx->pb, fctx->filename, URL_WRONLY) < 0) {
 	if(avio_open(&fctx->pb, fctx->filename, AVIO_FLAG_WRITE) < 0) {
@@ -372,9 +464,10 @@ int janus_pp_webm_process(FILE *file, janus_pp_frame_packet *list, int vp8, int
 		while(1) {
 			if(tmp->drop) {
 				/* Check if timestamp changes: marker bit is not mandatory, and may be lost as well */
-				if(tmp->next == NULL || tmp->next->ts > tmp->ts)
+				janus_pp_frame_packet *next = janus_pp_frame_next(tmp);
+				if(next == NULL || next->ts > tmp->ts)
 					break;
-				tmp = tmp->next;
+				tmp = next;
 				continue;
 			}
 			/* RTP payload */
@@ -576,14 +669,20 @@ int janus_pp_webm_process(FILE *file, janus_pp_frame_packet *list, int vp8, int
 				}
 			}
 			/* Frame manipulation */
+			if(frameLen + len + FF_INPUT_BUFFER_PADDING_SIZE > numBytes) {
+				/* Larger than what the pre-processed resolution suggested (e.g., when streaming) */
+				numBytes = 2*(frameLen + len + FF_INPUT_BUFFER_PADDING_SIZE);
+				received_frame = g_realloc(received_frame, numBytes);
+			}
 			memcpy(received_frame + frameLen, buffer, len);
 			frameLen += len;
 			if(len == 0)
 				break;
 			/* Check if timestamp changes: marker bit is not mandatory, and may be lost as well */
-			if(tmp->next == NULL || tmp->next->ts > tmp->ts)
+			janus_pp_frame_packet *next = janus_pp_frame_next(tmp);
+			if(next == NULL || next->ts > tmp->ts)
 				break;
-			tmp = tmp->next;
+			tmp = next;
 		}
 		if(frameLen > 0) {
 			memset(received_frame + frameLen, 0, FF_INPUT_BUFFER_PADDING_SIZE);
@@ -600,16 +699,20 @@ int janus_pp_webm_process(FILE *file, janus_pp_frame_packet *list, int vp8, int
 			/* First we save to the file... */
 			//~ packet.dts = AV_NOPTS_VALUE;
 			//~ packet.pts = AV_NOPTS_VALUE;
-			packet.dts = (tmp->ts-list->ts)/90;
-			packet.pts = (tmp->ts-list->ts)/90;
+			packet.dts = (tmp->ts-list->ts)/90 + video_delay;
+			packet.pts = (tmp->ts-list->ts)/90 + video_delay;
+			/* ...after any audio that should come before it, if we're muxing */
+			janus_pp_webm_write_audio(packet.pts, working);
 			if(fctx) {
 				if(av_write_frame(fctx, &packet) < 0) {
 					JANUS_LOG(LOG_ERR, "Error writing video frame to file...\n");
 				}
 			}
 		}
-		tmp = tmp->next;
+		tmp = janus_pp_frame_next(tmp);
 	}
+	/* Write the audio that's left, if any */
+	janus_pp_webm_write_audio(-1, working);
 	g_free(received_frame);
 	g_free(start);
 	return 0;
@@ -632,6 +735,14 @@ void janus_pp_webm_close(void) {
 #endif
 		av_free(fctx->streams[0]);
 	}
+	if(fctx != NULL && aStream != NULL) {
+#ifndef USE_CODECPAR
+		av_free(aStream->codec);
+#endif
+		av_free(aStream);
+	}
+	g_free(audio_buffer);
+	audio_buffer = NULL;
 	if(fctx != NULL) {
 		//~ url_fclose(fctx->pb);
 		avio_close(fctx->pb);
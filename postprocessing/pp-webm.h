@@ -13,10 +13,12 @@
 #define _JANUS_PP_WEBM
 
 #include <stdio.h>
+#include <inttypes.h>
 
 #include "pp-rtp.h"
 
 /* WebM stuff */
+int janus_pp_webm_add_audio(FILE *file, janus_pp_frame_packet *list, int64_t adelay, int64_t vdelay);
 int janus_pp_webm_create(char *destination, int vp8);
 int janus_pp_webm_preprocess(FILE *file, janus_pp_frame_packet *list, int vp8);
 int janus_pp_webm_process(FILE *file, janus_pp_frame_packet *list, int vp8, int *working);
@@ -18,15 +18,21 @@
  
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <errno.h>
 #include <libgen.h>
 
 #include <glib.h>
 #include <jansson.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 
 #include "record.h"
 #include "debug.h"
 #include "utils.h"
+#include "rtp.h"
 
 #define htonll(x) ((1==htonl(1)) ? (x) : ((gint64)htonl((x) & 0xFFFFFFFF) << 32) | htonl((x) >> 32))
 #define ntohll(x) ((1==ntohl(1)) ? (x) : ((gint64)ntohl((x) & 0xFFFFFFFF) << 32) | ntohl((x) >> 32))
@@ -42,6 +48,57 @@ static gboolean rec_tempname = FALSE;
 /* Extension to add in case tempnames is true (default="tmp" --> ".tmp") */
 static char *rec_tempext = NULL;
 
+/* Asynchronous writing: each recorder gets a ring buffer that the media
+ * path copies frames to, while one of the writer threads periodically
+ * drains it to disk. The ring has a single consumer (the writer), and
+ * producers are already serialized by the recorder mutex, which the
+ * writer never takes: this way a stalled disk can only fill the ring */
+typedef struct janus_recorder_ring {
+	/* Buffer, and its size (always a power of two) */
+	char *data;
+	guint size;
+	/* Free running positions, only updated by the producer and consumer respectively */
+	volatile gint head, tail;
+	/* Offset in the file the next flush will write at */
+	off_t offset;
+	/* Writer thread this ring is flushed by */
+	struct janus_recorder_writer *writer;
+	/* Whether flushing to file failed, in which case we just discard what's queued */
+	gboolean failed;
+} janus_recorder_ring;
+
+typedef struct janus_recorder_writer {
+	guint index;
+	GThread *thread;
+	/* Recorders this writer is responsible for */
+	GList *recorders;
+	janus_mutex mutex;
+#ifdef HAVE_LIBURING
+	/* When available, io_uring lets a writer submit the writes for all its recorders at once */
+	struct io_uring uring;
+	gboolean uring_ready;
+#endif
+} janus_recorder_writer;
+
+/* How often writer threads flush the recorders they're responsible for */
+#define JANUS_RECORDER_FLUSH_INTERVAL	20000
+/* Limits for the writer threads and the rings size */
+#define JANUS_RECORDER_MAX_WRITERS		16
+#define JANUS_RECORDER_MIN_RING_SIZE	(128*1024)
+#define JANUS_RECORDER_MAX_RING_SIZE	(64*1024*1024)
+#ifdef HAVE_LIBURING
+/* How many writes a writer submits to io_uring in a single batch */
+#define JANUS_RECORDER_URING_DEPTH		64
+#endif
+
+static janus_recorder_writer *rec_writers = NULL;
+static int rec_writers_num = 0;
+static guint rec_ring_size = 0;
+static volatile gint rec_writers_stop = 0, rec_writers_next = 0;
+
+static void *janus_recorder_writer_thread(void *data);
+
+
 void janus_recorder_init(gboolean tempnames, const char *extension) {
 	JANUS_LOG(LOG_INFO, "Initializing recorder code\n");
 	if(tempnames) {
@@ -56,11 +113,238 @@ void janus_recorder_init(gboolean tempnames, const char *extension) {
 	}
 }
 
+int janus_recorder_async_init(int writers, size_t buffer_size) {
+	if(rec_writers != NULL || writers < 1)
+		return -1;
+	if(writers > JANUS_RECORDER_MAX_WRITERS) {
+		JANUS_LOG(LOG_WARN, "Too many recorder writer threads (%d), limiting to %d\n", writers, JANUS_RECORDER_MAX_WRITERS);
+		writers = JANUS_RECORDER_MAX_WRITERS;
+	}
+	if(buffer_size < JANUS_RECORDER_MIN_RING_SIZE)
+		buffer_size = JANUS_RECORDER_MIN_RING_SIZE;
+	else if(buffer_size > JANUS_RECORDER_MAX_RING_SIZE)
+		buffer_size = JANUS_RECORDER_MAX_RING_SIZE;
+	/* Positions are masked, so the size must be a power of two */
+	rec_ring_size = JANUS_RECORDER_MIN_RING_SIZE;
+	while(rec_ring_size < buffer_size)
+		rec_ring_size <<= 1;
+	g_atomic_int_set(&rec_writers_stop, 0);
+	rec_writers = g_malloc0(writers * sizeof(janus_recorder_writer));
+	int i = 0;
+	for(i=0; i<writers; i++) {
+		janus_recorder_writer *writer = &rec_writers[i];
+		writer->index = i;
+		janus_mutex_init(&writer->mutex);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "recwriter %d", i);
+		writer->thread = g_thread_try_new(tname, &janus_recorder_writer_thread, writer, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the recorder writer thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			break;
+		}
+	}
+	rec_writers_num = i;
+	if(rec_writers_num == 0) {
+		g_free(rec_writers);
+		rec_writers = NULL;
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "  -- Asynchronous writing enabled (%d writer threads, %u bytes per recorder)\n",
+		rec_writers_num, rec_ring_size);
+	return 0;
+}
+
 void janus_recorder_deinit(void) {
 	rec_tempname = FALSE;
 	g_free(rec_tempext);
+	if(rec_writers != NULL) {
+		g_atomic_int_set(&rec_writers_stop, 1);
+		int i = 0;
+		for(i=0; i<rec_writers_num; i++) {
+			g_thread_join(rec_writers[i].thread);
+			g_list_free(rec_writers[i].recorders);
+		}
+		g_free(rec_writers);
+		rec_writers = NULL;
+		rec_writers_num = 0;
+	}
+}
+
+/* Copy some data to a ring at the provided (unmasked) position, wrapping if needed */
+static void janus_recorder_ring_copy(janus_recorder_ring *ring, guint pos, const void *src, guint len) {
+	guint offset = pos & (ring->size-1);
+	guint first = MIN(len, ring->size - offset);
+	memcpy(ring->data + offset, src, first);
+	if(first < len)
+		memcpy(ring->data, (const char *)src + first, len - first);
 }
 
+/* Write whatever is queued in the ring of a recorder to file: only
+ * called by its writer thread, or on close, with the writer mutex locked */
+static void janus_recorder_ring_flush(janus_recorder *recorder) {
+	janus_recorder_ring *ring = recorder->ring;
+	guint tail = (guint)g_atomic_int_get(&ring->tail);
+	guint head = (guint)g_atomic_int_get(&ring->head);
+	if(ring->failed) {
+		g_atomic_int_set(&ring->tail, (gint)head);
+		return;
+	}
+	int fd = fileno(recorder->file);
+	while(head != tail) {
+		guint queued = head - tail;
+		guint offset = tail & (ring->size-1);
+		guint first = MIN(queued, ring->size - offset);
+		struct iovec iov[2];
+		iov[0].iov_base = ring->data + offset;
+		iov[0].iov_len = first;
+		iov[1].iov_base = ring->data;
+		iov[1].iov_len = queued - first;
+		ssize_t res = pwritev(fd, iov, queued > first ? 2 : 1, ring->offset);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "Error saving frames to %s: %d (%s), discarding from now on\n",
+				recorder->filename, errno, strerror(errno));
+			ring->failed = TRUE;
+			tail = head;
+		} else {
+			tail += res;
+			ring->offset += res;
+		}
+		g_atomic_int_set(&ring->tail, (gint)tail);
+	}
+}
+
+#ifdef HAVE_LIBURING
+/* Same as janus_recorder_ring_flush, but for all the recorders of a writer:
+ * a write is prepared for each ring with queued data, and they're submitted
+ * together with a single system call. Short writes are simply completed at
+ * the next round. Called by the writer thread with the writer mutex locked */
+static int janus_recorder_writer_submit(janus_recorder_writer *writer) {
+	struct iovec iov[JANUS_RECORDER_URING_DEPTH][2];
+	GList *l = writer->recorders;
+	while(l) {
+		int pending = 0;
+		for(; l && pending < JANUS_RECORDER_URING_DEPTH; l = l->next) {
+			janus_recorder *recorder = (janus_recorder *)l->data;
+			janus_recorder_ring *ring = recorder->ring;
+			guint tail = (guint)g_atomic_int_get(&ring->tail);
+			guint head = (guint)g_atomic_int_get(&ring->head);
+			if(ring->failed) {
+				g_atomic_int_set(&ring->tail, (gint)head);
+				continue;
+			}
+			if(head == tail)
+				continue;
+			struct io_uring_sqe *sqe = io_uring_get_sqe(&writer->uring);
+			if(sqe == NULL)
+				break;
+			guint queued = head - tail;
+			guint offset = tail & (ring->size-1);
+			guint first = MIN(queued, ring->size - offset);
+			iov[pending][0].iov_base = ring->data + offset;
+			iov[pending][0].iov_len = first;
+			iov[pending][1].iov_base = ring->data;
+			iov[pending][1].iov_len = queued - first;
+			io_uring_prep_writev(sqe, fileno(recorder->file), iov[pending], queued > first ? 2 : 1, ring->offset);
+			io_uring_sqe_set_data(sqe, recorder);
+			pending++;
+		}
+		if(pending == 0)
+			break;
+		int res = io_uring_submit_and_wait(&writer->uring, pending);
+		if(res < 0) {
+			JANUS_LOG(LOG_ERR, "Error submitting recorder writes to io_uring: %d (%s)\n", -res, strerror(-res));
+			return -1;
+		}
+		while(pending > 0) {
+			struct io_uring_cqe *cqe = NULL;
+			if(io_uring_wait_cqe(&writer->uring, &cqe) < 0 || cqe == NULL)
+				return -1;
+			janus_recorder *recorder = (janus_recorder *)io_uring_cqe_get_data(cqe);
+			janus_recorder_ring *ring = recorder->ring;
+			res = cqe->res;
+			io_uring_cqe_seen(&writer->uring, cqe);
+			pending--;
+			if(res == -EINTR || res == -EAGAIN)
+				continue;
+			if(res < 0) {
+				JANUS_LOG(LOG_ERR, "Error saving frames to %s: %d (%s), discarding from now on\n",
+					recorder->filename, -res, strerror(-res));
+				ring->failed = TRUE;
+				continue;
+			}
+			ring->offset += res;
+			g_atomic_int_add(&ring->tail, res);
+		}
+	}
+	return 0;
+}
+#endif
+
+static void *janus_recorder_writer_thread(void *data) {
+	janus_recorder_writer *writer = (janus_recorder_writer *)data;
+	JANUS_LOG(LOG_VERB, "Joining recorder writer thread #%u\n", writer->index);
+#ifdef HAVE_LIBURING
+	int res = io_uring_queue_init(JANUS_RECORDER_URING_DEPTH, &writer->uring, 0);
+	if(res < 0) {
+		JANUS_LOG(LOG_WARN, "Couldn't setup io_uring for recorder writer thread #%u (%d, %s), using plain writes\n",
+			writer->index, -res, strerror(-res));
+	} else {
+		writer->uring_ready = TRUE;
+	}
+#endif
+	while(!g_atomic_int_get(&rec_writers_stop)) {
+		janus_mutex_lock(&writer->mutex);
+#ifdef HAVE_LIBURING
+		if(writer->uring_ready && janus_recorder_writer_submit(writer) < 0) {
+			/* Something went wrong with io_uring itself, stop using it */
+			io_uring_queue_exit(&writer->uring);
+			writer->uring_ready = FALSE;
+		}
+		if(!writer->uring_ready) {
+#endif
+		GList *l = writer->recorders;
+		while(l) {
+			janus_recorder_ring_flush((janus_recorder *)l->data);
+			l = l->next;
+		}
+#ifdef HAVE_LIBURING
+		}
+#endif
+		janus_mutex_unlock(&writer->mutex);
+		g_usleep(JANUS_RECORDER_FLUSH_INTERVAL);
+	}
+#ifdef HAVE_LIBURING
+	if(writer->uring_ready)
+		io_uring_queue_exit(&writer->uring);
+	writer->uring_ready = FALSE;
+#endif
+	JANUS_LOG(LOG_VERB, "Leaving recorder writer thread #%u\n", writer->index);
+	return NULL;
+}
+
+
+/* If asynchronous writing is enabled, add a ring to a new recorder, and
+ * assign it to one of the writer threads */
+static void janus_recorder_attach_writer(janus_recorder *rc) {
+	if(rec_writers == NULL)
+		return;
+	/* Frames will be queued and written by one of the writer threads */
+	fflush(rc->file);
+	rc->ring = g_malloc0(sizeof(janus_recorder_ring));
+	rc->ring->offset = ftell(rc->file);
+	rc->ring->data = g_malloc(rec_ring_size);
+	rc->ring->size = rec_ring_size;
+	guint index = (guint)g_atomic_int_add(&rec_writers_next, 1) % rec_writers_num;
+	rc->ring->writer = &rec_writers[index];
+	janus_mutex_lock(&rc->ring->writer->mutex);
+	rc->ring->writer->recorders = g_list_prepend(rc->ring->writer->recorders, rc);
+	janus_mutex_unlock(&rc->ring->writer->mutex);
+}
 
 janus_recorder *janus_recorder_create(const char *dir, const char *codec, const char *filename) {
 	janus_recorder_medium type = JANUS_RECORDER_AUDIO;
@@ -74,8 +358,8 @@ janus_recorder *janus_recorder_create(const char *dir, const char *codec, const
 			|| !strcasecmp(codec, "g711") || !strcasecmp(codec, "pcmu") || !strcasecmp(codec, "pcma")
 			|| !strcasecmp(codec, "g722")) {
 		type = JANUS_RECORDER_AUDIO;
-	} else if(!strcasecmp(codec, "text")) {
-		/* FIXME We only handle text on data channels, so that's the only thing we can save too */
+	} else if(!strcasecmp(codec, "text") || !strcasecmp(codec, "binary")) {
+		/* Data channel messages, either text or binary (the codec tells them apart) */
 		type = JANUS_RECORDER_DATA;
 	} else {
 		/* We don't recognize the codec: while we might go on anyway, we'd rather fail instead */
@@ -88,6 +372,7 @@ janus_recorder *janus_recorder_create(const char *dir, const char *codec, const
 	rc->filename = NULL;
 	rc->file = NULL;
 	rc->codec = g_strdup(codec);
+	rc->vcodec = (type == JANUS_RECORDER_VIDEO ? janus_videocodec_from_name(codec) : JANUS_VIDEOCODEC_NONE);
 	rc->created = janus_get_real_time();
 	const char *rec_dir = NULL;
 	const char *rec_file = NULL;
@@ -181,17 +466,254 @@ janus_recorder *janus_recorder_create(const char *dir, const char *codec, const
 	rc->type = type;
 	/* Write the first part of the header */
 	fwrite(header, sizeof(char), strlen(header), rc->file);
+	rc->written = strlen(header);
+	if(type != JANUS_RECORDER_DATA) {
+		/* Audio and video recordings are indexed */
+		rc->index = g_byte_array_sized_new(JANUS_RECORDER_INDEX_CHUNK_ENTRIES*JANUS_RECORDER_INDEX_ENTRY_SIZE);
+	}
 	g_atomic_int_set(&rc->writable, 1);
 	/* We still need to also write the info header first */
 	g_atomic_int_set(&rc->header, 0);
 	janus_mutex_init(&rc->mutex);
+	janus_recorder_attach_writer(rc);
 	g_free(copy_for_parent);
 	g_free(copy_for_base);
 	return rc;
 }
 
+/* Prepare the JSON formatted info header */
+static gchar *janus_recorder_info_header(janus_recorder *recorder) {
+	json_t *info = json_object();
+	/* FIXME Codecs should be configurable in the future */
+	const char *type = NULL;
+	if(recorder->type == JANUS_RECORDER_AUDIO)
+		type = "a";
+	else if(recorder->type == JANUS_RECORDER_VIDEO)
+		type = "v";
+	else if(recorder->type == JANUS_RECORDER_DATA)
+		type = "d";
+	json_object_set_new(info, "t", json_string(type));								/* Audio/Video/Data */
+	json_object_set_new(info, "c", json_string(recorder->codec));					/* Media codec */
+	json_object_set_new(info, "s", json_integer(recorder->created));				/* Created time */
+	json_object_set_new(info, "u", json_integer(janus_get_real_time()));			/* First frame written time */
+	gchar *info_text = json_dumps(info, JSON_PRESERVE_ORDER);
+	json_decref(info);
+	return info_text;
+}
+
+/* Copy a frame (and the info header, if needed) to the ring of a recorder */
+static int janus_recorder_queue_frame(janus_recorder *recorder, char *buffer, uint length, gint64 *offset) {
+	janus_recorder_ring *ring = recorder->ring;
+	gchar *info_text = NULL;
+	uint16_t info_len = 0;
+	if(!g_atomic_int_get(&recorder->header)) {
+		info_text = janus_recorder_info_header(recorder);
+		info_len = strlen(info_text);
+	}
+	guint frame_header_len = strlen(frame_header);
+	guint needed = frame_header_len + sizeof(uint16_t) + length;
+	if(recorder->type == JANUS_RECORDER_DATA)
+		needed += sizeof(gint64);
+	if(info_text != NULL)
+		needed += sizeof(uint16_t) + info_len;
+	guint head = (guint)g_atomic_int_get(&ring->head);
+	guint tail = (guint)g_atomic_int_get(&ring->tail);
+	if(ring->size - (head - tail) < needed) {
+		/* The writer can't keep up: drop the frame, rather than wait */
+		if(g_atomic_int_add(&recorder->dropped, 1) == 0)
+			JANUS_LOG(LOG_WARN, "Recorder buffer full, dropping frames: %s\n", recorder->filename);
+		free(info_text);
+		return -5;
+	}
+	if(info_text != NULL) {
+		uint16_t info_bytes = htons(info_len);
+		janus_recorder_ring_copy(ring, head, &info_bytes, sizeof(uint16_t));
+		head += sizeof(uint16_t);
+		janus_recorder_ring_copy(ring, head, info_text, info_len);
+		head += info_len;
+		free(info_text);
+		g_atomic_int_set(&recorder->header, 1);
+	}
+	janus_recorder_ring_copy(ring, head, frame_header, frame_header_len);
+	head += frame_header_len;
+	uint16_t header_bytes = htons(recorder->type == JANUS_RECORDER_DATA ? (length+sizeof(gint64)) : length);
+	janus_recorder_ring_copy(ring, head, &header_bytes, sizeof(uint16_t));
+	head += sizeof(uint16_t);
+	if(recorder->type == JANUS_RECORDER_DATA) {
+		gint64 now = htonll(janus_get_real_time());
+		janus_recorder_ring_copy(ring, head, &now, sizeof(gint64));
+		head += sizeof(gint64);
+	}
+	*offset = recorder->written + (head - (guint)g_atomic_int_get(&ring->head));
+	janus_recorder_ring_copy(ring, head, buffer, length);
+	head += length;
+	recorder->written += needed;
+	/* Make the whole frame visible to the writer at once */
+	g_atomic_int_set(&ring->head, (gint)head);
+	return 0;
+}
+
+/* Save a block that is not a frame (e.g., a seek index chunk), with the
+ * provided frame header: returns 0 in case of success, -1 otherwise */
+static int janus_recorder_save_block(janus_recorder *recorder, const char *block_header,
+		const guint8 *prefix, const guint8 *data, guint len) {
+	uint16_t block_bytes = htons(JANUS_RECORDER_INDEX_PREFIX_SIZE + len);
+	guint needed = strlen(block_header) + sizeof(uint16_t) + JANUS_RECORDER_INDEX_PREFIX_SIZE + len;
+	janus_recorder_ring *ring = recorder->ring;
+	if(ring != NULL && ring->writer != NULL) {
+		guint head = (guint)g_atomic_int_get(&ring->head);
+		guint tail = (guint)g_atomic_int_get(&ring->tail);
+		if(ring->size - (head - tail) < needed)
+			return -1;
+		janus_recorder_ring_copy(ring, head, block_header, strlen(block_header));
+		head += strlen(block_header);
+		janus_recorder_ring_copy(ring, head, &block_bytes, sizeof(uint16_t));
+		head += sizeof(uint16_t);
+		janus_recorder_ring_copy(ring, head, prefix, JANUS_RECORDER_INDEX_PREFIX_SIZE);
+		head += JANUS_RECORDER_INDEX_PREFIX_SIZE;
+		if(len > 0)
+			janus_recorder_ring_copy(ring, head, data, len);
+		head += len;
+		g_atomic_int_set(&ring->head, (gint)head);
+	} else {
+		if(fwrite(block_header, sizeof(char), strlen(block_header), recorder->file) != strlen(block_header) ||
+				fwrite(&block_bytes, sizeof(uint16_t), 1, recorder->file) != 1 ||
+				fwrite(prefix, sizeof(guint8), JANUS_RECORDER_INDEX_PREFIX_SIZE, recorder->file) != JANUS_RECORDER_INDEX_PREFIX_SIZE ||
+				(len > 0 && fwrite(data, sizeof(guint8), len, recorder->file) != len))
+			return -1;
+	}
+	recorder->written += needed;
+	return 0;
+}
+
+/* Prepare the prefix seek index chunks and the trailer start with */
+static void janus_recorder_index_prefix(janus_recorder *recorder, guint32 entries, guint8 *prefix) {
+	guint32 value = htonl(entries);
+	memcpy(prefix, &value, sizeof(guint32));
+	value = htonl(recorder->index_last_ts);
+	memcpy(prefix+4, &value, sizeof(guint32));
+	gint64 last = htonll(recorder->index_last);
+	memcpy(prefix+8, &last, sizeof(gint64));
+}
+
+/* Save the seek index entries we have so far as a new chunk */
+static int janus_recorder_index_save(janus_recorder *recorder) {
+	guint entries = recorder->index->len / JANUS_RECORDER_INDEX_ENTRY_SIZE;
+	if(entries == 0)
+		return 0;
+	guint8 prefix[JANUS_RECORDER_INDEX_PREFIX_SIZE];
+	janus_recorder_index_prefix(recorder, entries, prefix);
+	gint64 chunk = recorder->written;
+	if(janus_recorder_save_block(recorder, JANUS_RECORDER_INDEX_HEADER, prefix, recorder->index->data, recorder->index->len) < 0) {
+		if(entries < (G_MAXUINT16-JANUS_RECORDER_INDEX_PREFIX_SIZE)/JANUS_RECORDER_INDEX_ENTRY_SIZE) {
+			/* Keep the entries, we'll try again with the next frame */
+			return -1;
+		}
+		/* A broken chain of chunks is useless, readers will have to scan the file */
+		JANUS_LOG(LOG_WARN, "Couldn't save the seek index, disabling it: %s\n", recorder->filename);
+		g_byte_array_free(recorder->index, TRUE);
+		recorder->index = NULL;
+		return -1;
+	}
+	recorder->index_last = chunk;
+	g_byte_array_set_size(recorder->index, 0);
+	return 0;
+}
+
+/* Add a newly saved RTP packet to the seek index */
+static void janus_recorder_index_frame(janus_recorder *recorder, char *buffer, uint length, gint64 offset) {
+	if(recorder->index == NULL || length < 12)
+		return;
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	guint8 flags = 0;
+	if(recorder->type == JANUS_RECORDER_VIDEO) {
+		int plen = 0;
+		char *payload = janus_rtp_payload(buffer, length, &plen);
+		janus_video_info info;
+		if(payload != NULL && plen > 0 && janus_video_info_parse(recorder->vcodec, payload, plen, &info) == 0 && info.keyframe)
+			flags |= JANUS_RECORDER_INDEX_KEYFRAME;
+	}
+	guint8 entry[JANUS_RECORDER_INDEX_ENTRY_SIZE];
+	memset(entry, 0, sizeof(entry));
+	gint64 entry_offset = htonll(offset);
+	memcpy(entry, &entry_offset, sizeof(gint64));
+	memcpy(entry+8, &rtp->timestamp, sizeof(guint32));
+	memcpy(entry+12, &rtp->seq_number, sizeof(guint16));
+	guint16 entry_len = htons(length);
+	memcpy(entry+14, &entry_len, sizeof(guint16));
+	entry[16] = flags;
+	g_byte_array_append(recorder->index, entry, sizeof(entry));
+	recorder->index_entries++;
+	recorder->index_last_ts = ntohl(rtp->timestamp);
+	if(recorder->index->len >= JANUS_RECORDER_INDEX_CHUNK_ENTRIES*JANUS_RECORDER_INDEX_ENTRY_SIZE)
+		janus_recorder_index_save(recorder);
+}
+
+janus_recorder *janus_recorder_create_raw(const char *filename) {
+	if(filename == NULL) {
+		JANUS_LOG(LOG_ERR, "Missing filename\n");
+		return NULL;
+	}
+	FILE *file = fopen(filename, "wb");
+	if(file == NULL) {
+		JANUS_LOG(LOG_ERR, "fopen error: %d\n", errno);
+		return NULL;
+	}
+	janus_recorder *rc = g_malloc0(sizeof(janus_recorder));
+	rc->filename = g_strdup(filename);
+	rc->file = file;
+	rc->vcodec = JANUS_VIDEOCODEC_NONE;
+	rc->created = janus_get_real_time();
+	rc->raw = TRUE;
+	/* There's no info header in raw recordings */
+	g_atomic_int_set(&rc->header, 1);
+	g_atomic_int_set(&rc->writable, 1);
+	janus_mutex_init(&rc->mutex);
+	janus_recorder_attach_writer(rc);
+	return rc;
+}
+
+int janus_recorder_save_data(janus_recorder *recorder, const char *buffer, uint length) {
+	if(!recorder || !recorder->raw)
+		return -1;
+	janus_mutex_lock_nodebug(&recorder->mutex);
+	if(!buffer || length < 1) {
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return -2;
+	}
+	if(!recorder->file) {
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return -3;
+	}
+	if(!g_atomic_int_get(&recorder->writable)) {
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return -4;
+	}
+	janus_recorder_ring *ring = recorder->ring;
+	if(ring != NULL) {
+		/* Just queue the data, a writer thread will save it */
+		guint head = (guint)g_atomic_int_get(&ring->head);
+		guint tail = (guint)g_atomic_int_get(&ring->tail);
+		if(ring->size - (head - tail) < length) {
+			if(g_atomic_int_add(&recorder->dropped, 1) == 0)
+				JANUS_LOG(LOG_WARN, "Recorder buffer full, dropping data: %s\n", recorder->filename);
+			janus_mutex_unlock_nodebug(&recorder->mutex);
+			return -5;
+		}
+		janus_recorder_ring_copy(ring, head, buffer, length);
+		g_atomic_int_set(&ring->head, (gint)(head + length));
+	} else if(fwrite(buffer, sizeof(char), length, recorder->file) != length) {
+		JANUS_LOG(LOG_ERR, "Error saving data...\n");
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return -5;
+	}
+	recorder->written += length;
+	janus_mutex_unlock_nodebug(&recorder->mutex);
+	return 0;
+}
+
 int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint length) {
-	if(!recorder)
+	if(!recorder || recorder->raw)
 		return -1;
 	janus_mutex_lock_nodebug(&recorder->mutex);
 	if(!buffer || length < 1) {
@@ -206,26 +728,22 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		janus_mutex_unlock_nodebug(&recorder->mutex);
 		return -4;
 	}
+	if(recorder->ring != NULL) {
+		/* Just queue the frame, a writer thread will save it */
+		gint64 offset = 0;
+		int res = janus_recorder_queue_frame(recorder, buffer, length, &offset);
+		if(res == 0)
+			janus_recorder_index_frame(recorder, buffer, length, offset);
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return res;
+	}
 	if(!g_atomic_int_get(&recorder->header)) {
 		/* Write info header as a JSON formatted info */
-		json_t *info = json_object();
-		/* FIXME Codecs should be configurable in the future */
-		const char *type = NULL;
-		if(recorder->type == JANUS_RECORDER_AUDIO)
-			type = "a";
-		else if(recorder->type == JANUS_RECORDER_VIDEO)
-			type = "v";
-		else if(recorder->type == JANUS_RECORDER_DATA)
-			type = "d";
-		json_object_set_new(info, "t", json_string(type));								/* Audio/Video/Data */
-		json_object_set_new(info, "c", json_string(recorder->codec));					/* Media codec */
-		json_object_set_new(info, "s", json_integer(recorder->created));				/* Created time */
-		json_object_set_new(info, "u", json_integer(janus_get_real_time()));			/* First frame written time */
-		gchar *info_text = json_dumps(info, JSON_PRESERVE_ORDER);
-		json_decref(info);
+		gchar *info_text = janus_recorder_info_header(recorder);
 		uint16_t info_bytes = htons(strlen(info_text));
 		fwrite(&info_bytes, sizeof(uint16_t), 1, recorder->file);
 		fwrite(info_text, sizeof(char), strlen(info_text), recorder->file);
+		recorder->written += sizeof(uint16_t) + strlen(info_text);
 		free(info_text);
 		/* Done */
 		g_atomic_int_set(&recorder->header, 1);
@@ -238,18 +756,28 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		/* If it's data, then we need to prepend timing related info, as it's not there by itself */
 		gint64 now = htonll(janus_get_real_time());
 		fwrite(&now, sizeof(gint64), 1, recorder->file);
+		recorder->written += sizeof(gint64);
 	}
+	recorder->written += strlen(frame_header) + sizeof(uint16_t);
+	gint64 offset = recorder->written;
 	/* Save packet on file */
 	int temp = 0, tot = length;
 	while(tot > 0) {
 		temp = fwrite(buffer+length-tot, sizeof(char), tot, recorder->file);
 		if(temp <= 0) {
 			JANUS_LOG(LOG_ERR, "Error saving frame...\n");
+			if(recorder->index != NULL) {
+				/* We can't trust the offsets anymore */
+				g_byte_array_free(recorder->index, TRUE);
+				recorder->index = NULL;
+			}
 			janus_mutex_unlock_nodebug(&recorder->mutex);
 			return -5;
 		}
 		tot -= temp;
 	}
+	recorder->written += length;
+	janus_recorder_index_frame(recorder, buffer, length, offset);
 	/* Done */
 	janus_mutex_unlock_nodebug(&recorder->mutex);
 	return 0;
@@ -259,13 +787,39 @@ int janus_recorder_close(janus_recorder *recorder) {
 	if(!recorder || !g_atomic_int_compare_and_exchange(&recorder->writable, 1, 0))
 		return -1;
 	janus_mutex_lock_nodebug(&recorder->mutex);
+	if(recorder->ring != NULL && recorder->ring->writer != NULL) {
+		/* Save what's still queued, and detach from the writer thread */
+		janus_recorder_writer *writer = recorder->ring->writer;
+		janus_mutex_lock(&writer->mutex);
+		if(recorder->file)
+			janus_recorder_ring_flush(recorder);
+		writer->recorders = g_list_remove(writer->recorders, recorder);
+		janus_mutex_unlock(&writer->mutex);
+		recorder->ring->writer = NULL;
+		int dropped = g_atomic_int_get(&recorder->dropped);
+		if(dropped > 0)
+			JANUS_LOG(LOG_WARN, "%d frames dropped, as the disk couldn't keep up: %s\n", dropped, recorder->filename);
+		/* Anything else will be written here */
+		if(recorder->file)
+			fseek(recorder->file, 0L, SEEK_END);
+	}
+	if(recorder->file && recorder->index != NULL && recorder->index_entries > 0) {
+		/* Save the last seek index chunk, and the trailer pointing to it */
+		if(janus_recorder_index_save(recorder) == 0) {
+			guint8 prefix[JANUS_RECORDER_INDEX_PREFIX_SIZE];
+			janus_recorder_index_prefix(recorder, recorder->index_entries, prefix);
+			if(janus_recorder_save_block(recorder, JANUS_RECORDER_TRAILER_HEADER, prefix, NULL, 0) < 0)
+				JANUS_LOG(LOG_WARN, "Error saving the seek index trailer: %s\n", recorder->filename);
+		}
+		fflush(recorder->file);
+	}
 	if(recorder->file) {
 		fseek(recorder->file, 0L, SEEK_END);
 		size_t fsize = ftell(recorder->file);
 		fseek(recorder->file, 0L, SEEK_SET);
 		JANUS_LOG(LOG_INFO, "File is %zu bytes: %s\n", fsize, recorder->filename);
 	}
-	if(rec_tempname) {
+	if(rec_tempname && !recorder->raw) {
 		/* We need to rename the file, to remove the temporary extension */
 		char newname[1024];
 		memset(newname, 0, 1024);
@@ -306,6 +860,15 @@ int janus_recorder_free(janus_recorder *recorder) {
 	recorder->file = NULL;
 	g_free(recorder->codec);
 	recorder->codec = NULL;
+	if(recorder->index != NULL) {
+		g_byte_array_free(recorder->index, TRUE);
+		recorder->index = NULL;
+	}
+	if(recorder->ring != NULL) {
+		g_free(recorder->ring->data);
+		g_free(recorder->ring);
+		recorder->ring = NULL;
+	}
 	janus_mutex_unlock_nodebug(&recorder->mutex);
 	g_free(recorder);
 	return 0;
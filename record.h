@@ -11,6 +11,31 @@
  * \note If you want to record both audio and video, you'll have to use
  * two different recorders. Any muxing in the same container will have
  * to be done in the post-processing phase.
+ * \note By default frames are written to file from the thread calling
+ * janus_recorder_save_frame. When asynchronous mode is enabled via
+ * janus_recorder_async_init, frames are instead copied to a bounded
+ * per-recorder ring buffer, and a pool of writer threads takes care of
+ * flushing them to disk in batches, so that a slow or stalled disk never
+ * blocks the media path: if a ring fills up, new frames are dropped and
+ * counted rather than waited for.
+ * \note Audio and video recordings also carry a seek index, so that readers
+ * don't need to scan the whole file to know where each RTP packet is. The
+ * index is saved in chunks of up to \c JANUS_RECORDER_INDEX_CHUNK_ENTRIES
+ * entries, as \c MJRINDEX blocks interleaved with the frames, and a final
+ * \c MJRTRAIL block (always the last \c JANUS_RECORDER_TRAILER_SIZE bytes
+ * of the file) points to the last chunk. Each chunk and the trailer start
+ * with the same 16 bytes: number of entries (32 bits), RTP timestamp of the
+ * last indexed packet (32 bits) and offset of the previous chunk (64 bits,
+ * 0 if there's none). Every entry is \c JANUS_RECORDER_INDEX_ENTRY_SIZE bytes:
+ * offset of the RTP packet in the file (64 bits), RTP timestamp (32 bits),
+ * sequence number (16 bits), length (16 bits) and flags (8 bits, followed
+ * by 3 reserved bytes). All values are in network byte order. Readers that
+ * don't know about the index just skip these blocks, as with any \c MJ
+ * header that follows the info header.
+ * \note Plugins that need a different container (e.g., Ogg) can create a
+ * raw recorder with janus_recorder_create_raw instead, and save data as is
+ * via janus_recorder_save_data: no header, frame or index is added, but the
+ * data goes through the same writer threads when asynchronous mode is on.
  * 
  * \ingroup core
  * \ref core
@@ -25,7 +50,24 @@
 #include <stdlib.h>
 
 #include "mutex.h"
+#include "utils.h"
 
+struct janus_recorder_ring;
+
+/*! \brief Frame header of the chunks the seek index is saved in */
+#define JANUS_RECORDER_INDEX_HEADER			"MJRINDEX"
+/*! \brief Frame header of the trailer pointing to the last seek index chunk */
+#define JANUS_RECORDER_TRAILER_HEADER		"MJRTRAIL"
+/*! \brief Size of the trailer, including its frame header and length */
+#define JANUS_RECORDER_TRAILER_SIZE			26
+/*! \brief Size of the common prefix of seek index chunks and trailer */
+#define JANUS_RECORDER_INDEX_PREFIX_SIZE	16
+/*! \brief Size of an entry in the seek index */
+#define JANUS_RECORDER_INDEX_ENTRY_SIZE		20
+/*! \brief Maximum number of entries in a seek index chunk */
+#define JANUS_RECORDER_INDEX_CHUNK_ENTRIES	3200
+/*! \brief Seek index entry flag for packets that are part of a keyframe */
+#define JANUS_RECORDER_INDEX_KEYFRAME		0x01
 
 /*! \brief Media types we can record */
 typedef enum janus_recorder_medium {
@@ -42,8 +84,10 @@ typedef struct janus_recorder {
 	char *filename;
 	/*! \brief Recording file */
 	FILE *file;
-	/*! \brief Codec the packets to record are encoded in ("vp8", "vp9", "h264", "opus", "pcma", "pcmu", "g722") */
+	/*! \brief Codec the packets to record are encoded in ("vp8", "vp9", "h264", "opus", "pcma", "pcmu", "g722", or "text"/"binary" for data) */
 	char *codec;
+	/*! \brief Video codec, as understood by janus_video_info_parse (JANUS_VIDEOCODEC_NONE if not video) */
+	janus_videocodec vcodec;
 	/*! \brief When the recording file has been created */
 	gint64 created;
 	/*! \brief Media this instance is recording */
@@ -52,6 +96,22 @@ typedef struct janus_recorder {
 	volatile int header;
 	/*! \brief Whether this recorder instance can be used for writing or not */ 
 	volatile int writable;
+	/*! \brief Whether this is a raw recorder (see janus_recorder_create_raw) */
+	gboolean raw;
+	/*! \brief Ring buffer frames are queued to, when asynchronous writing is enabled (NULL otherwise) */
+	struct janus_recorder_ring *ring;
+	/*! \brief Number of frames dropped because the asynchronous writer couldn't keep up */
+	volatile gint dropped;
+	/*! \brief Offset in the file the next block will be saved at */
+	gint64 written;
+	/*! \brief Seek index entries not saved to file yet (NULL if the recording isn't indexed) */
+	GByteArray *index;
+	/*! \brief Number of entries in the seek index so far */
+	guint32 index_entries;
+	/*! \brief RTP timestamp of the last indexed packet */
+	guint32 index_last_ts;
+	/*! \brief Offset of the last seek index chunk saved to file (0 if none) */
+	gint64 index_last;
 	/*! \brief Mutex to lock/unlock this recorder instance */ 
 	janus_mutex mutex;
 } janus_recorder;
@@ -60,6 +120,12 @@ typedef struct janus_recorder {
  * @param[in] tempnames Whether the filenames should have a temporary extension, while saving, or not
  * @param[in] extension Extension to add in case tempnames is true */
 void janus_recorder_init(gboolean tempnames, const char *extension);
+/*! \brief Enable asynchronous writing for all the recorders created from now on
+ * \note Must be called after janus_recorder_init, and before any recorder is created
+ * @param[in] writers Number of writer threads flushing the recorders buffers to disk
+ * @param[in] buffer_size Size, in bytes, of the ring buffer each recorder queues frames to (rounded up to a power of two)
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_recorder_async_init(int writers, size_t buffer_size);
 /*! \brief De-initialize the recorder code */
 void janus_recorder_deinit(void);
 
@@ -67,7 +133,7 @@ void janus_recorder_deinit(void);
  * \note If no target directory is provided, the current directory will be used. If no filename
  * is passed, a random filename will be used.
  * @param[in] dir Path of the directory to save the recording into (will try to create it if it doesn't exist)
- * @param[in] codec Codec the packets to record are encoded in ("vp8", "opus", "h264", "g711", "vp9")
+ * @param[in] codec Codec the packets to record are encoded in ("vp8", "opus", "h264", "g711", "vp9", or "text"/"binary" for data channel messages)
  * @param[in] filename Filename to use for the recording
  * @returns A valid janus_recorder instance in case of success, NULL otherwise */
 janus_recorder *janus_recorder_create(const char *dir, const char *codec, const char *filename);
@@ -77,6 +143,19 @@ janus_recorder *janus_recorder_create(const char *dir, const char *codec, const
  * @param[in] length The frame data length
  * @returns 0 in case of success, a negative integer otherwise */
 int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint length);
+/*! \brief Create a new raw recorder, that saves data as is to a file in a custom format
+ * \note Unlike janus_recorder_create, the filename is used as it is, with
+ * no extension added: temporary extensions, if configured, are not used either
+ * @param[in] filename Path of the file to save data to
+ * @returns A valid janus_recorder instance in case of success, NULL otherwise */
+janus_recorder *janus_recorder_create_raw(const char *filename);
+/*! \brief Save data as is in a raw recorder
+ * \note In asynchronous mode, data is either queued completely or dropped
+ * @param[in] recorder The raw janus_recorder instance to save the data to
+ * @param[in] buffer The data to save
+ * @param[in] length The data length
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_recorder_save_data(janus_recorder *recorder, const char *buffer, uint length);
 /*! \brief Close the recorder
  * @param[in] recorder The janus_recorder instance to close
  * @returns 0 in case of success, a negative integer otherwise */
@@ -26,99 +26,135 @@ int janus_rtcp_parse(janus_rtcp_context *ctx, char *packet, int len) {
 	return janus_rtcp_fix_ssrc(ctx, packet, len, 0, 0, 0);
 }
 
-guint32 janus_rtcp_get_sender_ssrc(char *packet, int len) {
-	if(packet == NULL || len == 0)
-		return 0;
+int janus_rtcp_summarize(char *packet, int len, janus_rtcp_summary *summary) {
+	if(summary == NULL)
+		return -1;
+	memset(summary, 0, sizeof(*summary));
+	summary->sr_offset = -1;
+	summary->rr_offset = -1;
+	summary->nack_offset = -1;
+	if(packet == NULL || len < (int)sizeof(janus_rtcp_header))
+		return -1;
 	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
 	if(rtcp->version != 2)
-		return 0;
-	int pno = 0, total = len;
-	while(rtcp) {
-		pno++;
+		return -1;
+	int offset = 0;
+	while(len - offset >= (int)sizeof(janus_rtcp_header)) {
+		rtcp = (janus_rtcp_header *)(packet + offset);
+		int length = ntohs(rtcp->length);
+		int size = length*4+4;
+		if(size > len - offset) {
+			/* Truncated message, don't look past its header */
+			break;
+		}
+		summary->messages++;
 		switch(rtcp->type) {
+			case RTCP_FIR:
+				summary->has_fir = TRUE;
+				if(size >= 8 && summary->keyframe_ssrc == 0)
+					summary->keyframe_ssrc = ntohl(*(uint32_t *)(packet + offset + 4));
+				break;
 			case RTCP_SR: {
 				/* SR, sender report */
 				janus_rtcp_sr *sr = (janus_rtcp_sr *)rtcp;
-				return ntohl(sr->ssrc);
+				if(summary->sr_offset < 0)
+					summary->sr_offset = offset;
+				if(size < 8)
+					break;
+				if(summary->sender_ssrc == 0)
+					summary->sender_ssrc = ntohl(sr->ssrc);
+				summary->report_blocks += sr->header.rc;
+				if(sr->header.rc > 0 && summary->receiver_ssrc == 0 && size >= 28+24)
+					summary->receiver_ssrc = ntohl(sr->rb[0].ssrc);
+				break;
 			}
 			case RTCP_RR: {
 				/* RR, receiver report */
 				janus_rtcp_rr *rr = (janus_rtcp_rr *)rtcp;
-				return ntohl(rr->ssrc);
+				if(summary->rr_offset < 0)
+					summary->rr_offset = offset;
+				if(size < 8)
+					break;
+				if(summary->sender_ssrc == 0)
+					summary->sender_ssrc = ntohl(rr->ssrc);
+				summary->report_blocks += rr->header.rc;
+				if(rr->header.rc > 0 && summary->receiver_ssrc == 0 && size >= 8+24)
+					summary->receiver_ssrc = ntohl(rr->rb[0].ssrc);
+				break;
 			}
+			case RTCP_BYE:
+				summary->has_bye = TRUE;
+				break;
 			case RTCP_RTPFB: {
 				/* RTPFB, Transport layer FB message (rfc4585) */
 				janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
-				return ntohl(rtcpfb->ssrc);
+				if(size >= 8 && summary->sender_ssrc == 0)
+					summary->sender_ssrc = ntohl(rtcpfb->ssrc);
+				if(rtcp->rc == 1 && !summary->has_nack) {
+					summary->has_nack = TRUE;
+					summary->nack_offset = offset;
+					summary->nack_length = size;
+				} else if(rtcp->rc == 15) {
+					summary->has_twcc = TRUE;
+				}
+				break;
 			}
 			case RTCP_PSFB: {
 				/* PSFB, Payload-specific FB message (rfc4585) */
 				janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
-				return ntohl(rtcpfb->ssrc);
+				if(size >= 8 && summary->sender_ssrc == 0)
+					summary->sender_ssrc = ntohl(rtcpfb->ssrc);
+				if(rtcp->rc == 1) {
+					summary->has_pli = TRUE;
+					if(size >= 12 && summary->keyframe_ssrc == 0)
+						summary->keyframe_ssrc = ntohl(rtcpfb->media);
+				} else if(rtcp->rc == 15 && !summary->has_remb && size >= 20) {
+					janus_rtcp_fb_remb *remb = (janus_rtcp_fb_remb *)rtcpfb->fci;
+					if(remb->id[0] == 'R' && remb->id[1] == 'E' && remb->id[2] == 'M' && remb->id[3] == 'B') {
+						/* FIXME From rtcp_utility.cc */
+						unsigned char *_ptrRTCPData = (unsigned char *)remb;
+						_ptrRTCPData += 4;	/* Skip unique identifier and num ssrc */
+						uint8_t brExp = (_ptrRTCPData[1] >> 2) & 0x3F;
+						uint32_t brMantissa = (_ptrRTCPData[1] & 0x03) << 16;
+						brMantissa += (_ptrRTCPData[2] << 8);
+						brMantissa += (_ptrRTCPData[3]);
+						summary->has_remb = TRUE;
+						summary->remb_bitrate = brMantissa << brExp;
+						JANUS_LOG(LOG_HUGE, "Got REMB bitrate %"SCNu32"\n", summary->remb_bitrate);
+					}
+				}
+				break;
 			}
 			case RTCP_XR: {
 				/* XR, extended reports (rfc3611) */
 				janus_rtcp_xr *xr = (janus_rtcp_xr *)rtcp;
-				return ntohl(xr->ssrc);
+				if(size >= 8 && summary->sender_ssrc == 0)
+					summary->sender_ssrc = ntohl(xr->ssrc);
+				break;
 			}
 			default:
 				break;
 		}
 		/* Is this a compound packet? */
-		int length = ntohs(rtcp->length);
-		if(length == 0) {
-			break;
-		}
-		total -= length*4+4;
-		if(total <= 0) {
+		if(length == 0)
 			break;
-		}
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
+		offset += size;
 	}
 	return 0;
 }
 
-guint32 janus_rtcp_get_receiver_ssrc(char *packet, int len) {
-	if(packet == NULL || len == 0)
+guint32 janus_rtcp_get_sender_ssrc(char *packet, int len) {
+	janus_rtcp_summary summary;
+	if(janus_rtcp_summarize(packet, len, &summary) < 0)
 		return 0;
-	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
-	if(rtcp->version != 2)
+	return summary.sender_ssrc;
+}
+
+guint32 janus_rtcp_get_receiver_ssrc(char *packet, int len) {
+	janus_rtcp_summary summary;
+	if(janus_rtcp_summarize(packet, len, &summary) < 0)
 		return 0;
-	int pno = 0, total = len;
-	while(rtcp) {
-		pno++;
-		switch(rtcp->type) {
-			case RTCP_SR: {
-				/* SR, sender report */
-				janus_rtcp_sr *sr = (janus_rtcp_sr *)rtcp;
-				if(sr->header.rc > 0) {
-					return ntohl(sr->rb[0].ssrc);
-				}
-				break;
-			}
-			case RTCP_RR: {
-				/* RR, receiver report */
-				janus_rtcp_rr *rr = (janus_rtcp_rr *)rtcp;
-				if(rr->header.rc > 0) {
-					return ntohl(rr->rb[0].ssrc);
-				}
-				break;
-			}
-			default:
-				break;
-		}
-		/* Is this a compound packet? */
-		int length = ntohs(rtcp->length);
-		if(length == 0) {
-			break;
-		}
-		total -= length*4+4;
-		if(total <= 0) {
-			break;
-		}
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
-	}
-	return 0;
+	return summary.receiver_ssrc;
 }
 
 /* Helper to handle an incoming SR: triggered by a call to janus_rtcp_fix_ssrc with fixssrc=0 */
@@ -658,90 +694,24 @@ int janus_rtcp_report_block(janus_rtcp_context *ctx, janus_report_block *rb) {
 
 
 int janus_rtcp_has_bye(char *packet, int len) {
-	gboolean got_bye = FALSE;
-	/* Parse RTCP compound packet */
-	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
-	if(rtcp->version != 2)
+	janus_rtcp_summary summary;
+	if(janus_rtcp_summarize(packet, len, &summary) < 0)
 		return FALSE;
-	int pno = 0, total = len;
-	while(rtcp) {
-		pno++;
-		switch(rtcp->type) {
-			case RTCP_BYE:
-				got_bye = TRUE;
-				break;
-			default:
-				break;
-		}
-		/* Is this a compound packet? */
-		int length = ntohs(rtcp->length);
-		if(length == 0)
-			break;
-		total -= length*4+4;
-		if(total <= 0)
-			break;
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
-	}
-	return got_bye ? TRUE : FALSE;
+	return summary.has_bye;
 }
 
 int janus_rtcp_has_fir(char *packet, int len) {
-	gboolean got_fir = FALSE;
-	/* Parse RTCP compound packet */
-	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
-	if(rtcp->version != 2)
+	janus_rtcp_summary summary;
+	if(janus_rtcp_summarize(packet, len, &summary) < 0)
 		return FALSE;
-	int pno = 0, total = len;
-	while(rtcp) {
-		pno++;
-		switch(rtcp->type) {
-			case RTCP_FIR:
-				got_fir = TRUE;
-				break;
-			default:
-				break;
-		}
-		/* Is this a compound packet? */
-		int length = ntohs(rtcp->length);
-		if(length == 0)
-			break;
-		total -= length*4+4;
-		if(total <= 0)
-			break;
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
-	}
-	return got_fir ? TRUE : FALSE;
+	return summary.has_fir;
 }
 
 int janus_rtcp_has_pli(char *packet, int len) {
-	gboolean got_pli = FALSE;
-	/* Parse RTCP compound packet */
-	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
-	if(rtcp->version != 2)
+	janus_rtcp_summary summary;
+	if(janus_rtcp_summarize(packet, len, &summary) < 0)
 		return FALSE;
-	int pno = 0, total = len;
-	while(rtcp) {
-		pno++;
-		switch(rtcp->type) {
-			case RTCP_PSFB: {
-				gint fmt = rtcp->rc;
-				if(fmt == 1)
-					got_pli = TRUE;
-				break;
-			}
-			default:
-				break;
-		}
-		/* Is this a compound packet? */
-		int length = ntohs(rtcp->length);
-		if(length == 0)
-			break;
-		total -= length*4+4;
-		if(total <= 0)
-			break;
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
-	}
-	return got_pli ? TRUE : FALSE;
+	return summary.has_pli;
 }
 
 GSList *janus_rtcp_get_nacks(char *packet, int len) {
@@ -796,93 +766,25 @@ GSList *janus_rtcp_get_nacks(char *packet, int len) {
 }
 
 int janus_rtcp_remove_nacks(char *packet, int len) {
-	if(packet == NULL || len == 0)
+	janus_rtcp_summary summary;
+	if(janus_rtcp_summarize(packet, len, &summary) < 0 || !summary.has_nack)
 		return len;
-	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
-	if(rtcp->version != 2)
-		return len;
-	/* Find the NACK message */
-	char *nacks = NULL;
-	int total = len, nacks_len = 0;
-	while(rtcp) {
-		if(rtcp->type == RTCP_RTPFB) {
-			gint fmt = rtcp->rc;
-			if(fmt == 1) {
-				nacks = (char *)rtcp;
-			}
-		}
-		/* Is this a compound packet? */
-		int length = ntohs(rtcp->length);
-		if(length == 0)
-			break;
-		if(nacks != NULL) {
-			nacks_len = length*4+4;
-			break;
-		}
-		total -= length*4+4;
-		if(total <= 0)
-			break;
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
-	}
-	if(nacks != NULL) {
-		total = len - ((nacks-packet)+nacks_len);
-		if(total < 0) {
-			/* FIXME Should never happen, but you never know: do nothing */
-			return len;
-		} else if(total == 0) {
-			/* NACK was the last compound packet, easy enough */
-			return len-nacks_len;
-		} else {
-			/* NACK is between two compound packets, move them around */
-			int i=0;
-			for(i=0; i<total; i++)
-				*(nacks+i) = *(nacks+nacks_len+i);
-			return len-nacks_len;
-		}
+	char *nacks = packet + summary.nack_offset;
+	int nacks_len = summary.nack_length;
+	int total = len - (summary.nack_offset+nacks_len);
+	if(total > 0) {
+		/* NACK is between two compound packets, move them around */
+		memmove(nacks, nacks+nacks_len, total);
 	}
-	return len;
+	return len-nacks_len;
 }
 
 /* Query an existing REMB message */
 uint32_t janus_rtcp_get_remb(char *packet, int len) {
-	if(packet == NULL || len == 0)
-		return 0;
-	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
-	if(rtcp->version != 2)
+	janus_rtcp_summary summary;
+	if(janus_rtcp_summarize(packet, len, &summary) < 0)
 		return 0;
-	/* Get REMB bitrate, if any */
-	int total = len;
-	while(rtcp) {
-		if(rtcp->type == RTCP_PSFB) {
-			gint fmt = rtcp->rc;
-			if(fmt == 15) {
-				janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
-				janus_rtcp_fb_remb *remb = (janus_rtcp_fb_remb *)rtcpfb->fci;
-				if(remb->id[0] == 'R' && remb->id[1] == 'E' && remb->id[2] == 'M' && remb->id[3] == 'B') {
-					/* FIXME From rtcp_utility.cc */
-					unsigned char *_ptrRTCPData = (unsigned char *)remb;
-					_ptrRTCPData += 4;	/* Skip unique identifier and num ssrc */
-					//~ JANUS_LOG(LOG_VERB, " %02X %02X %02X %02X\n", _ptrRTCPData[0], _ptrRTCPData[1], _ptrRTCPData[2], _ptrRTCPData[3]);
-					uint8_t brExp = (_ptrRTCPData[1] >> 2) & 0x3F;
-					uint32_t brMantissa = (_ptrRTCPData[1] & 0x03) << 16;
-					brMantissa += (_ptrRTCPData[2] << 8);
-					brMantissa += (_ptrRTCPData[3]);
-					uint32_t bitrate = brMantissa << brExp;
-					JANUS_LOG(LOG_HUGE, "Got REMB bitrate %"SCNu32"\n", bitrate);
-					return bitrate;
-				}
-			}
-		}
-		/* Is this a compound packet? */
-		int length = ntohs(rtcp->length);
-		if(length == 0)
-			break;
-		total -= length*4+4;
-		if(total <= 0)
-			break;
-		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
-	}
-	return 0;
+	return summary.remb_bitrate;
 }
 
 /* Change an existing REMB message */
@@ -1086,6 +988,65 @@ int janus_rtcp_pli(char *packet, int len) {
 	return 12;
 }
 
+/* Keyframe request coalescing */
+void janus_rtcp_keyframe_coalescer_init(janus_rtcp_keyframe_coalescer *c, gint64 min_interval) {
+	if(c == NULL)
+		return;
+	c->min_interval = min_interval > 0 ? min_interval : 0;
+	c->last_sent = 0;
+	g_atomic_int_set(&c->pending, 0);
+	g_atomic_int_set(&c->coalesced, 0);
+	janus_mutex_init(&c->mutex);
+}
+
+void janus_rtcp_keyframe_coalescer_reset(janus_rtcp_keyframe_coalescer *c) {
+	if(c == NULL)
+		return;
+	janus_mutex_lock_nodebug(&c->mutex);
+	c->last_sent = 0;
+	g_atomic_int_set(&c->pending, 0);
+	janus_mutex_unlock_nodebug(&c->mutex);
+}
+
+gboolean janus_rtcp_keyframe_coalescer_request(janus_rtcp_keyframe_coalescer *c, gint64 now) {
+	if(c == NULL)
+		return TRUE;
+	gboolean send = FALSE;
+	janus_mutex_lock_nodebug(&c->mutex);
+	if(c->min_interval == 0 || c->last_sent == 0 || now-c->last_sent >= c->min_interval) {
+		/* Far enough from the previous one, any pending request is covered by this */
+		c->last_sent = now;
+		g_atomic_int_set(&c->pending, 0);
+		send = TRUE;
+	} else {
+		/* Too soon: the next keyframe will do, or we'll ask again when the interval expires */
+		g_atomic_int_set(&c->pending, 1);
+		g_atomic_int_inc(&c->coalesced);
+	}
+	janus_mutex_unlock_nodebug(&c->mutex);
+	return send;
+}
+
+gboolean janus_rtcp_keyframe_coalescer_update(janus_rtcp_keyframe_coalescer *c, gboolean keyframe, gint64 now) {
+	if(c == NULL || !g_atomic_int_get(&c->pending))
+		return FALSE;
+	gboolean send = FALSE;
+	if(now == 0)
+		now = janus_get_monotonic_time();
+	janus_mutex_lock_nodebug(&c->mutex);
+	if(keyframe) {
+		/* Whoever was waiting, this keyframe is what they needed */
+		g_atomic_int_set(&c->pending, 0);
+	} else if(g_atomic_int_get(&c->pending) && now-c->last_sent >= c->min_interval) {
+		/* No keyframe arrived in time, send the pending request now */
+		c->last_sent = now;
+		g_atomic_int_set(&c->pending, 0);
+		send = TRUE;
+	}
+	janus_mutex_unlock_nodebug(&c->mutex);
+	return send;
+}
+
 /* Generate a new NACK message */
 int janus_rtcp_nacks(char *packet, int len, GSList *nacks) {
 	if(packet == NULL || len < 16 || nacks == NULL)
@@ -1138,8 +1099,14 @@ typedef enum janus_rtp_packet_status {
 	janus_rtp_packet_status_reserved = 3
 } janus_rtp_packet_status;
 
-int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssrc, guint32 media, guint8 feedback_packet_count, GQueue *transport_wide_cc_stats) {
-	if(packet == NULL || size < sizeof(janus_rtcp_header) || transport_wide_cc_stats == NULL || g_queue_is_empty(transport_wide_cc_stats))
+int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssrc, guint32 media, guint8 feedback_packet_count,
+		guint16 base_seq_num, const guint64 *arrivals, guint count) {
+	if(packet == NULL || size < sizeof(janus_rtcp_header) || arrivals == NULL || count == 0)
+		return -1;
+	/* In the worst case, each packet needs a 2 bits status and a 2 bytes delta:
+	 * make sure that fits in the buffer, which also bounds our stack arrays */
+	if(count > JANUS_RTCP_TWCC_MAX_PACKETS ||
+			size < sizeof(janus_rtcp_header) + 16 + 2*((count+6)/7) + 2*count + 3)
 		return -1;
 
 	memset(packet, 0, size);
@@ -1153,13 +1120,10 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 	rtcpfb->ssrc = htonl(ssrc);
 	rtcpfb->media = htonl(media);
 
-	/* Get first packet */
-	janus_rtcp_transport_wide_cc_stats *stat = (janus_rtcp_transport_wide_cc_stats *) g_queue_pop_head (transport_wide_cc_stats);
 	/* Calculate temporal info */
-	guint16 base_seq_num = stat->transport_seq_num;
 	gboolean first_received	= FALSE;
 	guint64 reference_time = 0;
-	guint packet_status_count = g_queue_get_length(transport_wide_cc_stats) + 1;
+	guint packet_status_count = count;
 
 	/*
 		0                   1                   2                   3
@@ -1189,26 +1153,30 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 	/* Initial time in us */
 	guint64 timestamp = 0;
 
-	/* Store delta array */
-	GQueue *deltas = g_queue_new();
-	GQueue *statuses = g_queue_new();
+	/* Store delta array, and the statuses we still have to write (from head to tail) */
+	gint deltas[JANUS_RTCP_TWCC_MAX_PACKETS];
+	guint deltas_count = 0;
+	janus_rtp_packet_status statuses[JANUS_RTCP_TWCC_MAX_PACKETS];
+	guint statuses_head = 0, statuses_tail = 0;
 	janus_rtp_packet_status last_status = janus_rtp_packet_status_reserved;
 	janus_rtp_packet_status max_status = janus_rtp_packet_status_notreceived;
 	gboolean all_same = TRUE;
 
 	/* For each packet  */
-	while (stat != NULL) {
+	guint n = 0;
+	for (n=0; n<count; n++) {
 		janus_rtp_packet_status status = janus_rtp_packet_status_notreceived;
+		guint64 arrival = arrivals[n];
 
 		/* If got packet */
-		if (stat->timestamp) {
+		if (arrival) {
 			int delta = 0;
 			/* If first received */
 			if (!first_received) {
 				/* Got it  */
 				first_received = TRUE;
 				/* Set it */
-				reference_time = (stat->timestamp/64000);
+				reference_time = (arrival/64000);
 				/* Get initial time */
 				timestamp = reference_time * 64000;
 				/* also in bufffer */
@@ -1216,10 +1184,10 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 			}
 
 			/* Get delta */
-			if (stat->timestamp>timestamp)
-				delta = (stat->timestamp-timestamp)/250;
+			if (arrival>timestamp)
+				delta = (arrival-timestamp)/250;
 			else
-				delta = -(int)((timestamp-stat->timestamp)/250);
+				delta = -(int)((timestamp-arrival)/250);
 			/* If it is negative or too big */
 			if (delta<0 || delta> 127) {
 				/* Big one */
@@ -1229,15 +1197,15 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				status = janus_rtp_packet_status_smalldelta;
 			}
 			/* Store delta */
-			g_queue_push_tail(deltas, GINT_TO_POINTER(delta));
+			deltas[deltas_count++] = delta;
 			/* Set last time */
-			timestamp = stat->timestamp;
+			timestamp = arrival;
 		}
 
 		/* Check if all previoues ones were equal and this one the firt different */
 		if (all_same && last_status!=janus_rtp_packet_status_reserved && status!=last_status) {
 			/* How big was the same run */
-			if (g_queue_get_length(statuses)>7) {
+			if (statuses_tail-statuses_head>7) {
 				guint32 word = 0;
 				/* Write run! */
 				/*
@@ -1250,12 +1218,12 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				 */
 				word = janus_push_bits(word, 1, 0);
 				word = janus_push_bits(word, 2, last_status);
-				word = janus_push_bits(word, 13, g_queue_get_length(statuses));
+				word = janus_push_bits(word, 13, statuses_tail-statuses_head);
 				/* Write word */
 				janus_set2(data, len, word);
 				len += 2;
 				/* Remove all statuses */
-				g_queue_clear(statuses);
+				statuses_head = statuses_tail = 0;
 				/* Reset status */
 				last_status = janus_rtp_packet_status_reserved;
 				max_status = janus_rtp_packet_status_notreceived;
@@ -1267,7 +1235,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 		}
 
 		/* Push back statuses, it will be handled later */
-		g_queue_push_tail(statuses, GUINT_TO_POINTER(status));
+		statuses[statuses_tail++] = status;
 
 		/* If it is bigger */
 		if (status>max_status) {
@@ -1280,7 +1248,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 		/* Check if we can still be enquing for a run */
 		if (!all_same) {
 			/* Check  */
-			if (!all_same && max_status==janus_rtp_packet_status_largeornegativedelta && g_queue_get_length(statuses)>6) {
+			if (!all_same && max_status==janus_rtp_packet_status_largeornegativedelta && statuses_tail-statuses_head>6) {
 				guint32 word = 0;
 				/*
 					0                   1
@@ -1297,7 +1265,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				size_t i = 0;
 				for (i=0;i<7;++i) {
 					/* Get status */
-					janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
+					janus_rtp_packet_status status = statuses[statuses_head++];
 					/* Write */
 					word = janus_push_bits(word, 2, (guint8)status);
 				}
@@ -1310,9 +1278,9 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				all_same = TRUE;
 
 				/* We need to restore the values, as there may be more elements on the buffer */
-				for (i=0; i<g_queue_get_length(statuses); ++i) {
+				for (i=statuses_head; i<statuses_tail; ++i) {
 					/* Get status */
-					status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_peek_nth(statuses, i));
+					status = statuses[i];
 					/* If it is bigger */
 					if (status>max_status) {
 						/* Store it */
@@ -1326,7 +1294,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 					/* Store las status */
 					last_status = status;
 				}
-			} else if (!all_same && g_queue_get_length(statuses)>13) {
+			} else if (!all_same && statuses_tail-statuses_head>13) {
 				guint32 word = 0;
 				/*
 					0                   1
@@ -1343,7 +1311,7 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				guint32 i = 0;
 				for (i=0;i<14;++i) {
 					/* Get status */
-					janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
+					janus_rtp_packet_status status = statuses[statuses_head++];
 					/* Write */
 					word = janus_push_bits(word, 1, (guint8)status);
 				}
@@ -1356,15 +1324,10 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 				all_same = TRUE;
 			}
 		}
-		/* Free mem */
-		free(stat);
-
-		/* Get next packet stat */
-		stat = (janus_rtcp_transport_wide_cc_stats *) g_queue_pop_head (transport_wide_cc_stats);
 	}
 
 	/* Get status len */
-	size_t statuses_len = g_queue_get_length(statuses);
+	size_t statuses_len = statuses_tail-statuses_head;
 
 	/* If not finished yet */
 	if (statuses_len>0) {
@@ -1384,13 +1347,13 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 			word = janus_push_bits(word, 1, 1);
 			word = janus_push_bits(word, 1, 1);
 			/* Get fist status */
-			janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
+			janus_rtp_packet_status status = statuses[statuses_head++];
 			/* Write rest */
-			while(!g_queue_is_empty(statuses)) {
+			while(statuses_head < statuses_tail) {
 				/* Write */
 				word = janus_push_bits(word, 2, (guint8)status);
 				/* Next */
-				status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
+				status = statuses[statuses_head++];
 			}
 			/* Write pending */
 			word = janus_push_bits(word, 14-statuses_len*2, 0);
@@ -1403,13 +1366,13 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 			word = janus_push_bits(word, 1, 1);
 			word = janus_push_bits(word, 1, 0);
 			/* Get fist status */
-			janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
+			janus_rtp_packet_status status = statuses[statuses_head++];
 			/* Write rest */
-			while(!g_queue_is_empty(statuses)) {
+			while(statuses_head < statuses_tail) {
 				/* Write */
 				word = janus_push_bits(word, 1, (guint8)status);
 				/* Next */
-				status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
+				status = statuses[statuses_head++];
 			}
 			/* Write pending */
 			word = janus_push_bits(word, 14-statuses_len, 0);
@@ -1420,9 +1383,10 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 	}
 
 	/* Write now the deltas */
-	while (!g_queue_is_empty(deltas)) {
+	guint d = 0;
+	for (d=0; d<deltas_count; d++) {
 		/* Get next delta */
-		gint delta = GPOINTER_TO_INT(g_queue_pop_head (deltas));
+		gint delta = deltas[d];
 		/* Check size */
 		if (delta<0 || delta>127) {
 			/* 2 bytes */
@@ -1437,10 +1401,6 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 		}
 	}
 
-	/* Clean mem */
-	g_queue_free(statuses);
-	g_queue_free(deltas);
-
 	/* Add zero padding */
 	while (len%4) {
 		/* Add padding */
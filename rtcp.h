@@ -25,6 +25,8 @@
 #include <inttypes.h>
 #include <string.h>
 
+#include "mutex.h"
+
 /*! \brief RTCP Packet Types (http://www.networksorcery.com/enp/protocol/rtcp.htm) */
 typedef enum {
     RTCP_FIR = 192,
@@ -280,15 +282,83 @@ typedef struct rtcp_context
 } rtcp_context;
 typedef rtcp_context janus_rtcp_context;
 
-/*! \brief Stores transport wide packet reception statistics */
-typedef struct rtcp_transport_wide_cc_stats
+/*! \brief Summary of an RTCP compound packet, filled in a single pass by janus_rtcp_summarize */
+typedef struct rtcp_summary
 {
-	/*! \brief Transwport wide sequence number */
-	guint32 transport_seq_num;
-	/*! \brief Reception time */
-	guint64 timestamp;
-} rtcp_transport_wide_cc_stats;
-typedef rtcp_transport_wide_cc_stats janus_rtcp_transport_wide_cc_stats;
+	/*! \brief Number of RTCP messages in the compound packet */
+	int messages;
+	/*! \brief SSRC of the first message carrying a sender SSRC (SR, RR, RTPFB, PSFB or XR), if any */
+	guint32 sender_ssrc;
+	/*! \brief SSRC of the first report block in an SR or RR, if any */
+	guint32 receiver_ssrc;
+	/*! \brief Offsets of the first SR and RR in the compound packet, or -1 if there's none */
+	int sr_offset, rr_offset;
+	/*! \brief Number of report blocks in all SR and RR messages */
+	int report_blocks;
+	/*! \brief Whether there's a BYE message */
+	gboolean has_bye;
+	/*! \brief Whether there's a (legacy, RFC2032) FIR request */
+	gboolean has_fir;
+	/*! \brief Whether there's a PLI request */
+	gboolean has_pli;
+	/*! \brief Media SSRC the first FIR or PLI request is about, if any */
+	guint32 keyframe_ssrc;
+	/*! \brief Whether there's a NACK message */
+	gboolean has_nack;
+	/*! \brief Whether there's a REMB message */
+	gboolean has_remb;
+	/*! \brief Whether there's a transport-wide CC feedback message */
+	gboolean has_twcc;
+	/*! \brief Offset and length of the first NACK message, if any */
+	int nack_offset, nack_length;
+	/*! \brief Bitrate reported in the first REMB message, if any */
+	uint32_t remb_bitrate;
+} rtcp_summary;
+typedef rtcp_summary janus_rtcp_summary;
+
+/*! \brief Coalescer for the keyframe requests (PLI/FIR) sent to a single media source
+ * \details Many receivers of the same source (e.g., subscribers joining
+ * a room, or switching substream) may need a keyframe at about the same
+ * time: rather than sending a request for each of them, which would make
+ * the source emit back-to-back keyframes, requests are never sent more
+ * often than \c min_interval. A request received too soon after the
+ * previous one is just marked as pending, and is only actually sent when
+ * the interval expires if no keyframe arrived in the meanwhile, as that
+ * keyframe would be shared by all the receivers waiting for it anyway. */
+typedef struct janus_rtcp_keyframe_coalescer {
+	/*! \brief Minimum interval between two requests, in microseconds (0 disables coalescing) */
+	gint64 min_interval;
+	/*! \brief Monotonic time of the latest request that was actually sent */
+	gint64 last_sent;
+	/*! \brief Whether a request was coalesced and is still waiting for a keyframe */
+	volatile gint pending;
+	/*! \brief Number of requests that were coalesced so far */
+	volatile gint coalesced;
+	/*! \brief Mutex to lock/unlock the coalescer */
+	janus_mutex mutex;
+} janus_rtcp_keyframe_coalescer;
+
+/*! \brief Method to initialize a keyframe request coalescer
+ * @param[in] c The coalescer to initialize
+ * @param[in] min_interval Minimum interval between two requests, in microseconds (0 disables coalescing) */
+void janus_rtcp_keyframe_coalescer_init(janus_rtcp_keyframe_coalescer *c, gint64 min_interval);
+/*! \brief Method to reset a keyframe request coalescer, e.g., when the source changes
+ * @param[in] c The coalescer to reset */
+void janus_rtcp_keyframe_coalescer_reset(janus_rtcp_keyframe_coalescer *c);
+/*! \brief Method to check whether a keyframe request should be sent right away
+ * \note If it returns FALSE the request is pending, and will be returned by
+ * janus_rtcp_keyframe_coalescer_update when due, unless a keyframe arrives first
+ * @param[in] c The coalescer of the source to send the request to
+ * @param[in] now The current monotonic time
+ * @returns TRUE if the caller should send the request now, FALSE if it's been coalesced */
+gboolean janus_rtcp_keyframe_coalescer_request(janus_rtcp_keyframe_coalescer *c, gint64 now);
+/*! \brief Method to update a keyframe request coalescer for each (video) packet of the source
+ * \note When nothing is pending this only costs an atomic read, so it can be used on the media path
+ * @param[in] c The coalescer of the source the packet came from
+ * @param[in] keyframe Whether the packet is (the beginning of) a keyframe
+ * @param[in] now The current monotonic time, or 0 to only get it when actually needed
+ * @returns TRUE if a pending request is due and the caller should send it now, FALSE otherwise */
+gboolean janus_rtcp_keyframe_coalescer_update(janus_rtcp_keyframe_coalescer *c, gboolean keyframe, gint64 now);
 
 /*! \brief Method to retrieve the estimated round-trip time from an existing RTCP context
  * @param[in] ctx The RTCP context to query
@@ -331,6 +401,16 @@ guint32 janus_rtcp_get_sender_ssrc(char *packet, int len);
  * @returns The receiver SSRC, or 0 in case of error */
 guint32 janus_rtcp_get_receiver_ssrc(char *packet, int len);
 
+/*! \brief Method to walk an RTCP compound packet once, and summarize what it contains
+ * \note Code that needs to check several things about the same packet (e.g., SSRCs,
+ * PLI/FIR and REMB) should use this, and then look at the summary, rather than
+ * calling the individual helpers, each of which would walk the packet on its own
+ * @param[in] packet The message data
+ * @param[in] len The message data length in bytes
+ * @param[out] summary The summary to fill in
+ * @returns 0 in case of success, -1 if this is not a valid RTCP packet */
+int janus_rtcp_summarize(char *packet, int len, janus_rtcp_summary *summary);
+
 /*! \brief Method to parse/validate an RTCP message
  * @param[in] ctx RTCP context to update, if needed (optional)
  * @param[in] packet The message data
@@ -467,14 +547,21 @@ int janus_rtcp_pli(char *packet, int len);
  * @returns The message data length in bytes, if successful, -1 on errors */
 int janus_rtcp_nacks(char *packet, int len, GSList *nacks);
 
+/*! \brief Maximum number of packets a single transport wide feedback can report */
+#define JANUS_RTCP_TWCC_MAX_PACKETS	512
 /*! \brief Method to generate a new RTCP transport wide message to report reception stats
+ * \note The buffer must be large enough for the worst case, i.e., 2 bits of status
+ * and 2 bytes of delta per packet, or the method fails
  * @param[in] packet The buffer data (MUST be at least 16 chars)
  * @param[in] len The message data length in bytes
  * @param[ssrc] ssrc SSRC of the origin stream
  * @param[media] madia SSRC of the destination stream
  * @param[media] feedback_packet_count Feedback paccket count
- * @param[media] transport_wide_cc_stats List of rtp packet reception stats
+ * @param[media] base_seq_num Transport wide seq num of the first packet to report
+ * @param[media] arrivals Reception times in us of the packets to report, starting from base_seq_num (0 if not received)
+ * @param[media] count Number of packets to report (at most JANUS_RTCP_TWCC_MAX_PACKETS)
  * @returns The message data length in bytes, if successful, -1 on errors */
-int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t len, guint32 ssrc, guint32 media, guint8 feedback_packet_count, GQueue *transport_wide_cc_stats);
+int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t len, guint32 ssrc, guint32 media, guint8 feedback_packet_count,
+	guint16 base_seq_num, const guint64 *arrivals, guint count);
 
 #endif
@@ -106,58 +106,101 @@ const char *janus_rtp_header_extension_get_from_id(const char *sdp, int id) {
 	return NULL;
 }
 
-/* Static helper to quickly find the extension data */
-static int janus_rtp_header_extension_find(char *buf, int len, int id,
-		uint8_t *byte, uint32_t *word, char **ref) {
+int janus_rtp_header_extensions_parse(char *buf, int len, janus_rtp_header_extensions *exts) {
+	if(!exts)
+		return -1;
+	exts->count = 0;
+	exts->two_byte = FALSE;
 	if(!buf || len < 12)
 		return -1;
 	janus_rtp_header *rtp = (janus_rtp_header *)buf;
 	int hlen = 12;
 	if(rtp->csrccount)	/* Skip CSRC if needed */
 		hlen += rtp->csrccount*4;
-	if(rtp->extension) {
-		janus_rtp_header_extension *ext = (janus_rtp_header_extension *)(buf+hlen);
-		int extlen = ntohs(ext->length)*4;
-		hlen += 4;
-		if(len > (hlen + extlen)) {
-			/* 1-Byte extension */
-			if(ntohs(ext->type) == 0xBEDE) {
-				const uint8_t padding = 0x00, reserved = 0xF;
-				uint8_t extid = 0, idlen;
-				int i = 0;
-				while(i < extlen) {
-					extid = buf[hlen+i] >> 4;
-					if(extid == reserved) {
-						break;
-					} else if(extid == padding) {
-						i++;
-						continue;
-					}
-					idlen = (buf[hlen+i] & 0xF)+1;
-					if(extid == id) {
-						/* Found! */
-						if(byte)
-							*byte = buf[hlen+i+1];
-						if(word)
-							*word = ntohl(*(uint32_t *)(buf+hlen+i));
-						if(ref)
-							*ref = &buf[hlen+i];
-						return 0;
-					}
-					i += 1 + idlen;
-				}
+	if(!rtp->extension)
+		return 0;
+	if(len < hlen + 4)
+		return -1;
+	janus_rtp_header_extension *ext = (janus_rtp_header_extension *)(buf+hlen);
+	int extlen = ntohs(ext->length)*4;
+	uint16_t profile = ntohs(ext->type);
+	hlen += 4;
+	if(len <= (hlen + extlen))
+		return -1;
+	int i = 0;
+	uint8_t extid = 0, idlen = 0;
+	if(profile == 0xBEDE) {
+		/* 1-Byte extensions */
+		while(i < extlen) {
+			extid = (uint8_t)buf[hlen+i] >> 4;
+			if(extid == 0x0F) {
+				/* Reserved, stop here */
+				break;
+			} else if(extid == 0) {
+				/* Padding */
+				i++;
+				continue;
 			}
-			hlen += extlen;
+			idlen = (buf[hlen+i] & 0xF)+1;
+			if(i + 1 + idlen > extlen)
+				break;
+			if(exts->count < JANUS_RTP_EXTENSIONS_MAX) {
+				exts->ext[exts->count].id = extid;
+				exts->ext[exts->count].len = idlen;
+				exts->ext[exts->count].offset = hlen+i+1;
+				exts->count++;
+			}
+			i += 1 + idlen;
+		}
+	} else if((profile & 0xFFF0) == 0x1000) {
+		/* 2-Byte extensions (RFC 8285), the last 4 bits are application specific */
+		exts->two_byte = TRUE;
+		while(i < extlen) {
+			extid = (uint8_t)buf[hlen+i];
+			if(extid == 0) {
+				/* Padding */
+				i++;
+				continue;
+			}
+			if(i + 2 > extlen)
+				break;
+			idlen = (uint8_t)buf[hlen+i+1];
+			if(i + 2 + idlen > extlen)
+				break;
+			if(exts->count < JANUS_RTP_EXTENSIONS_MAX) {
+				exts->ext[exts->count].id = extid;
+				exts->ext[exts->count].len = idlen;
+				exts->ext[exts->count].offset = hlen+i+2;
+				exts->count++;
+			}
+			i += 2 + idlen;
 		}
 	}
-	return -1;
+	return 0;
 }
 
-int janus_rtp_header_extension_parse_audio_level(char *buf, int len, int id, int *level) {
-	uint8_t byte = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, &byte, NULL, NULL) < 0)
+/* Static helper to quickly find the extension data in an index */
+static char *janus_rtp_header_extensions_lookup(const janus_rtp_header_extensions *exts,
+		char *buf, int id, int *len) {
+	if(!exts || !buf || id < 1)
+		return NULL;
+	uint8_t i = 0;
+	for(i=0; i<exts->count; i++) {
+		if(exts->ext[i].id == id) {
+			if(len)
+				*len = exts->ext[i].len;
+			return buf + exts->ext[i].offset;
+		}
+	}
+	return NULL;
+}
+
+/* Static helpers to decode the content of the extensions we know about */
+static int janus_rtp_header_extension_decode_audio_level(char *data, int dlen, int *level) {
+	if(data == NULL || dlen < 1)
 		return -1;
 	/* a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level */
+	uint8_t byte = (uint8_t)data[0];
 	int v = (byte & 0x80) >> 7;
 	int value = byte & 0x7F;
 	JANUS_LOG(LOG_DBG, "%02x --> v=%d, level=%d\n", byte, v, value);
@@ -166,12 +209,12 @@ int janus_rtp_header_extension_parse_audio_level(char *buf, int len, int id, int
 	return 0;
 }
 
-int janus_rtp_header_extension_parse_video_orientation(char *buf, int len, int id,
+static int janus_rtp_header_extension_decode_video_orientation(char *data, int dlen,
 		gboolean *c, gboolean *f, gboolean *r1, gboolean *r0) {
-	uint8_t byte = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, &byte, NULL, NULL) < 0)
+	if(data == NULL || dlen < 1)
 		return -1;
 	/* a=extmap:4 urn:3gpp:video-orientation */
+	uint8_t byte = (uint8_t)data[0];
 	gboolean cbit = (byte & 0x08) >> 3;
 	gboolean fbit = (byte & 0x04) >> 2;
 	gboolean r1bit = (byte & 0x02) >> 1;
@@ -188,15 +231,15 @@ int janus_rtp_header_extension_parse_video_orientation(char *buf, int len, int i
 	return 0;
 }
 
-int janus_rtp_header_extension_parse_playout_delay(char *buf, int len, int id,
+static int janus_rtp_header_extension_decode_playout_delay(char *data, int dlen,
 		uint16_t *min_delay, uint16_t *max_delay) {
-	uint32_t bytes = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, &bytes, NULL) < 0)
+	if(data == NULL || dlen < 3)
 		return -1;
 	/* a=extmap:6 http://www.webrtc.org/experiments/rtp-hdrext/playout-delay */
-	uint16_t min = (bytes & 0x00FFF000) >> 12;
-	uint16_t max = bytes & 0x00000FFF;
-	JANUS_LOG(LOG_DBG, "%"SCNu32"x --> min=%"SCNu16", max=%"SCNu16"\n", bytes, min, max);
+	uint8_t *bytes = (uint8_t *)data;
+	uint16_t min = (bytes[0] << 4) | (bytes[1] >> 4);
+	uint16_t max = ((bytes[1] & 0x0F) << 8) | bytes[2];
+	JANUS_LOG(LOG_DBG, "%02x%02x%02x --> min=%"SCNu16", max=%"SCNu16"\n", bytes[0], bytes[1], bytes[2], min, max);
 	if(min_delay)
 		*min_delay = min;
 	if(max_delay)
@@ -204,27 +247,23 @@ int janus_rtp_header_extension_parse_playout_delay(char *buf, int len, int id,
 	return 0;
 }
 
-int janus_rtp_header_extension_parse_rtp_stream_id(char *buf, int len, int id,
+static int janus_rtp_header_extension_decode_rtp_stream_id(char *data, int dlen,
 		char *sdes_item, int sdes_len) {
-	char *ext = NULL;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, NULL, &ext) < 0)
-		return -1;
 	/* a=extmap:3/sendonly urn:ietf:params:rtp-hdrext:sdes:rtp-stream-id */
-	if(ext == NULL)
+	if(data == NULL)
 		return -2;
-	int val_len = (*ext & 0x0F) + 1;
+	int val_len = dlen;
 	if(val_len > (sdes_len-1)) {
 		JANUS_LOG(LOG_WARN, "SDES buffer is too small (%d < %d), RTP stream ID will be cut\n", val_len, sdes_len);
 		val_len = sdes_len-1;
 	}
-	memcpy(sdes_item, ext+1, val_len);
+	memcpy(sdes_item, data, val_len);
 	*(sdes_item+val_len) = '\0';
 	return 0;
 }
 
-int janus_rtp_header_extension_parse_transport_wide_cc(char *buf, int len, int id, uint16_t *transSeqNum) {
-	uint32_t bytes = 0;
-	if(janus_rtp_header_extension_find(buf, len, id, NULL, &bytes, NULL) < 0)
+static int janus_rtp_header_extension_decode_transport_wide_cc(char *data, int dlen, uint16_t *transSeqNum) {
+	if(data == NULL || dlen < 2)
 		return -1;
 	/*  0                   1                   2                   3
 	    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
@@ -232,10 +271,88 @@ int janus_rtp_header_extension_parse_transport_wide_cc(char *buf, int len, int i
 	   |  ID   | L=1   |transport-wide sequence number | zero padding  |
 	   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 	*/ 
-	*transSeqNum = (bytes & 0x00FFFF00) >> 8;
+	uint8_t *bytes = (uint8_t *)data;
+	if(transSeqNum)
+		*transSeqNum = (bytes[0] << 8) | bytes[1];
 	return 0;
 }
 
+/* Static helper to quickly find the extension data, when there's no index */
+static char *janus_rtp_header_extension_find(char *buf, int len, int id, int *dlen) {
+	janus_rtp_header_extensions exts;
+	if(janus_rtp_header_extensions_parse(buf, len, &exts) < 0)
+		return NULL;
+	return janus_rtp_header_extensions_lookup(&exts, buf, id, dlen);
+}
+
+int janus_rtp_header_extension_parse_audio_level(char *buf, int len, int id, int *level) {
+	int dlen = 0;
+	char *data = janus_rtp_header_extension_find(buf, len, id, &dlen);
+	return data ? janus_rtp_header_extension_decode_audio_level(data, dlen, level) : -1;
+}
+
+int janus_rtp_header_extension_parse_video_orientation(char *buf, int len, int id,
+		gboolean *c, gboolean *f, gboolean *r1, gboolean *r0) {
+	int dlen = 0;
+	char *data = janus_rtp_header_extension_find(buf, len, id, &dlen);
+	return data ? janus_rtp_header_extension_decode_video_orientation(data, dlen, c, f, r1, r0) : -1;
+}
+
+int janus_rtp_header_extension_parse_playout_delay(char *buf, int len, int id,
+		uint16_t *min_delay, uint16_t *max_delay) {
+	int dlen = 0;
+	char *data = janus_rtp_header_extension_find(buf, len, id, &dlen);
+	return data ? janus_rtp_header_extension_decode_playout_delay(data, dlen, min_delay, max_delay) : -1;
+}
+
+int janus_rtp_header_extension_parse_rtp_stream_id(char *buf, int len, int id,
+		char *sdes_item, int sdes_len) {
+	int dlen = 0;
+	char *data = janus_rtp_header_extension_find(buf, len, id, &dlen);
+	return data ? janus_rtp_header_extension_decode_rtp_stream_id(data, dlen, sdes_item, sdes_len) : -1;
+}
+
+int janus_rtp_header_extension_parse_transport_wide_cc(char *buf, int len, int id, uint16_t *transSeqNum) {
+	int dlen = 0;
+	char *data = janus_rtp_header_extension_find(buf, len, id, &dlen);
+	return data ? janus_rtp_header_extension_decode_transport_wide_cc(data, dlen, transSeqNum) : -1;
+}
+
+int janus_rtp_header_extensions_get_audio_level(const janus_rtp_header_extensions *exts,
+		char *buf, int id, int *level) {
+	int dlen = 0;
+	char *data = janus_rtp_header_extensions_lookup(exts, buf, id, &dlen);
+	return data ? janus_rtp_header_extension_decode_audio_level(data, dlen, level) : -1;
+}
+
+int janus_rtp_header_extensions_get_video_orientation(const janus_rtp_header_extensions *exts,
+		char *buf, int id, gboolean *c, gboolean *f, gboolean *r1, gboolean *r0) {
+	int dlen = 0;
+	char *data = janus_rtp_header_extensions_lookup(exts, buf, id, &dlen);
+	return data ? janus_rtp_header_extension_decode_video_orientation(data, dlen, c, f, r1, r0) : -1;
+}
+
+int janus_rtp_header_extensions_get_playout_delay(const janus_rtp_header_extensions *exts,
+		char *buf, int id, uint16_t *min_delay, uint16_t *max_delay) {
+	int dlen = 0;
+	char *data = janus_rtp_header_extensions_lookup(exts, buf, id, &dlen);
+	return data ? janus_rtp_header_extension_decode_playout_delay(data, dlen, min_delay, max_delay) : -1;
+}
+
+int janus_rtp_header_extensions_get_rtp_stream_id(const janus_rtp_header_extensions *exts,
+		char *buf, int id, char *sdes_item, int sdes_len) {
+	int dlen = 0;
+	char *data = janus_rtp_header_extensions_lookup(exts, buf, id, &dlen);
+	return data ? janus_rtp_header_extension_decode_rtp_stream_id(data, dlen, sdes_item, sdes_len) : -1;
+}
+
+int janus_rtp_header_extensions_get_transport_wide_cc(const janus_rtp_header_extensions *exts,
+		char *buf, int id, uint16_t *transSeqNum) {
+	int dlen = 0;
+	char *data = janus_rtp_header_extensions_lookup(exts, buf, id, &dlen);
+	return data ? janus_rtp_header_extension_decode_transport_wide_cc(data, dlen, transSeqNum) : -1;
+}
+
 /* RTP context related methods */
 void janus_rtp_switching_context_reset(janus_rtp_switching_context *context) {
 	if(context == NULL)
@@ -526,6 +643,89 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 }
 
 
+/* NACK receive window */
+#define janus_rtp_seq_window_bit(seq)	((seq) & (JANUS_RTP_SEQ_WINDOW_BITS-1))
+#define janus_rtp_seq_window_set(window, seq) \
+	(window)->received[janus_rtp_seq_window_bit(seq)/32] |= (1U << (janus_rtp_seq_window_bit(seq) % 32))
+#define janus_rtp_seq_window_clear(window, seq) \
+	(window)->received[janus_rtp_seq_window_bit(seq)/32] &= ~(1U << (janus_rtp_seq_window_bit(seq) % 32))
+#define janus_rtp_seq_window_isset(window, seq) \
+	((window)->received[janus_rtp_seq_window_bit(seq)/32] & (1U << (janus_rtp_seq_window_bit(seq) % 32)))
+
+void janus_rtp_seq_window_reset(janus_rtp_seq_window *window) {
+	if(window == NULL)
+		return;
+	window->started = FALSE;
+	window->missing_count = 0;
+}
+
+int janus_rtp_seq_window_update(janus_rtp_seq_window *window, guint16 seq, gint64 now, janus_rtp_seq_nack *nacks) {
+	if(window == NULL || nacks == NULL)
+		return 0;
+	gint16 diff = (gint16)(seq - window->highest);	/* Can wrap */
+	int res = 0;
+	if(!window->started || diff >= JANUS_RTP_SEQ_WINDOW_LEN || diff <= -1000) {
+		/* First packet, or jump too big: start fresh */
+		res = window->started ? -1 : 0;
+		memset(window->received, 0, sizeof(window->received));
+		window->missing_count = 0;
+		window->started = TRUE;
+		window->highest = seq;
+		janus_rtp_seq_window_set(window, seq);
+		return res;
+	}
+	if(diff > 0) {
+		/* Move forward: whatever is in between is missing */
+		guint16 cur = window->highest;
+		while(cur != seq) {
+			cur++;	/* Can wrap */
+			janus_rtp_seq_window_clear(window, cur);
+			if(cur == seq)
+				break;
+			if(window->missing_count == JANUS_RTP_SEQ_WINDOW_LEN) {
+				/* Drop the oldest */
+				memmove(&window->missing[0], &window->missing[1], (JANUS_RTP_SEQ_WINDOW_LEN-1)*sizeof(janus_rtp_seq_missing));
+				window->missing_count--;
+			}
+			janus_rtp_seq_missing *m = &window->missing[window->missing_count++];
+			m->ts = now;
+			m->seq = cur;
+			m->nacked = FALSE;
+		}
+		window->highest = seq;
+		janus_rtp_seq_window_set(window, seq);
+	} else if(diff < 0 && -diff < JANUS_RTP_SEQ_WINDOW_LEN && !janus_rtp_seq_window_isset(window, seq)) {
+		/* A packet we were missing: we'll drop it from the list below */
+		janus_rtp_seq_window_set(window, seq);
+	}
+	/* Go through the missing packets, and check which ones we need to NACK */
+	guint i = 0, kept = 0;
+	for(i=0; i<window->missing_count; i++) {
+		janus_rtp_seq_missing *m = &window->missing[i];
+		if((guint16)(window->highest - m->seq) >= JANUS_RTP_SEQ_WINDOW_LEN || janus_rtp_seq_window_isset(window, m->seq)) {
+			/* Received, or too old to care */
+			continue;
+		}
+		if(!m->nacked && now - m->ts > JANUS_RTP_SEQ_MISSING_WAIT) {
+			nacks[res].seq = m->seq;
+			nacks[res].retry = FALSE;
+			res++;
+			m->nacked = TRUE;
+		} else if(m->nacked && now - m->ts > JANUS_RTP_SEQ_NACKED_WAIT) {
+			nacks[res].seq = m->seq;
+			nacks[res].retry = TRUE;
+			res++;
+			/* We give up on this packet */
+			continue;
+		}
+		if(kept != i)
+			window->missing[kept] = *m;
+		kept++;
+	}
+	window->missing_count = kept;
+	return res;
+}
+
 /* SRTP stuff: we may need our own randomizer */
 #ifdef HAVE_SRTP_2
 int srtp_crypto_get_random(uint8_t *key, int len) {
@@ -601,3 +801,19 @@ const char *janus_srtp_error_str(int error) {
 		return NULL;
 	return janus_srtp_error[error];
 }
+
+const char *janus_srtp_profile_str(janus_srtp_profile profile) {
+	switch(profile) {
+		case JANUS_SRTP_AES128_CM_SHA1_32:
+			return "SRTP_AES128_CM_SHA1_32";
+		case JANUS_SRTP_AES128_CM_SHA1_80:
+			return "SRTP_AES128_CM_SHA1_80";
+		case JANUS_SRTP_AEAD_AES_128_GCM:
+			return "SRTP_AEAD_AES_128_GCM";
+		case JANUS_SRTP_AEAD_AES_256_GCM:
+			return "SRTP_AEAD_AES_256_GCM";
+		default:
+			break;
+	}
+	return NULL;
+}
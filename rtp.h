@@ -151,6 +151,53 @@ int janus_rtp_header_extension_parse_rtp_stream_id(char *buf, int len, int id,
 int janus_rtp_header_extension_parse_transport_wide_cc(char *buf, int len, int id,
 	uint16_t *transSeqNum);
 
+/*! \brief Maximum number of RTP extensions indexed per packet */
+#define JANUS_RTP_EXTENSIONS_MAX	16
+/*! \brief Index of the RTP extensions in a packet, built in a single pass
+ * by janus_rtp_header_extensions_parse: this allows for looking up many
+ * extensions in the same packet without walking the extension block each time */
+typedef struct janus_rtp_header_extensions {
+	/*! \brief Number of extensions in the index */
+	uint8_t count;
+	/*! \brief Whether the packet used two-byte (RFC 8285) rather than one-byte headers */
+	gboolean two_byte;
+	/*! \brief Extension ID, data length and data offset (from the start of the packet) */
+	struct {
+		uint8_t id;
+		uint8_t len;
+		uint16_t offset;
+	} ext[JANUS_RTP_EXTENSIONS_MAX];
+} janus_rtp_header_extensions;
+
+/*! \brief Helper to index all the RTP extensions in a packet in a single pass
+ * @note Both one-byte and two-byte (RFC 8285) headers are supported
+ * @param[in] buf The packet data
+ * @param[in] len The packet data length in bytes
+ * @param[out] exts The index to fill
+ * @returns 0 in case of success (even if there are no extensions), -1 if the packet is invalid */
+int janus_rtp_header_extensions_parse(char *buf, int len, janus_rtp_header_extensions *exts);
+
+/*! \brief Same as janus_rtp_header_extension_parse_audio_level, but using an index
+ * @param[in] exts The index built by janus_rtp_header_extensions_parse
+ * @param[in] buf The packet data that was indexed
+ * @param[in] id The extension ID to look for
+ * @param[out] level The level value in dBov (0=max, 127=min)
+ * @returns 0 if found, -1 otherwise */
+int janus_rtp_header_extensions_get_audio_level(const janus_rtp_header_extensions *exts,
+	char *buf, int id, int *level);
+/*! \brief Same as janus_rtp_header_extension_parse_video_orientation, but using an index */
+int janus_rtp_header_extensions_get_video_orientation(const janus_rtp_header_extensions *exts,
+	char *buf, int id, gboolean *c, gboolean *f, gboolean *r1, gboolean *r0);
+/*! \brief Same as janus_rtp_header_extension_parse_playout_delay, but using an index */
+int janus_rtp_header_extensions_get_playout_delay(const janus_rtp_header_extensions *exts,
+	char *buf, int id, uint16_t *min_delay, uint16_t *max_delay);
+/*! \brief Same as janus_rtp_header_extension_parse_rtp_stream_id, but using an index */
+int janus_rtp_header_extensions_get_rtp_stream_id(const janus_rtp_header_extensions *exts,
+	char *buf, int id, char *sdes_item, int sdes_len);
+/*! \brief Same as janus_rtp_header_extension_parse_transport_wide_cc, but using an index */
+int janus_rtp_header_extensions_get_transport_wide_cc(const janus_rtp_header_extensions *exts,
+	char *buf, int id, uint16_t *transSeqNum);
+
 /*! \brief RTP context, in order to make sure SSRC changes result in coherent seq/ts increases */
 typedef struct janus_rtp_switching_context {
 	uint32_t a_last_ssrc, a_last_ts, a_base_ts, a_base_ts_prev, a_prev_ts, a_target_ts, a_start_ts,
@@ -195,4 +242,61 @@ int janus_rtp_skew_compensate_audio(janus_rtp_header *header, janus_rtp_switchin
  * @returns 0 if no compensation is needed, -N if a N packets drop must be performed, N if a N sequence numbers jump has been performed */
 int janus_rtp_skew_compensate_video(janus_rtp_header *header, janus_rtp_switching_context *context, gint64 now);
 
+
+/*! \brief How many sequence numbers the NACK receive window covers */
+#define JANUS_RTP_SEQ_WINDOW_LEN	160
+/*! \brief Size of the bitmap of received packets, in bits (must be a power of 2 larger than the window) */
+#define JANUS_RTP_SEQ_WINDOW_BITS	256
+/*! \brief How long to wait before sending the first NACK for a missing packet, in us */
+#define JANUS_RTP_SEQ_MISSING_WAIT	12000
+/*! \brief How long to wait (since we figured out it was missing) before sending the second and last NACK, in us */
+#define JANUS_RTP_SEQ_NACKED_WAIT	155000
+
+/*! \brief A packet we're still waiting for */
+typedef struct janus_rtp_seq_missing {
+	/*! \brief When we figured out the packet was missing */
+	gint64 ts;
+	/*! \brief Sequence number of the packet */
+	guint16 seq;
+	/*! \brief Whether we sent a NACK for it already */
+	gboolean nacked;
+} janus_rtp_seq_missing;
+
+/*! \brief A sequence number to NACK, as returned by janus_rtp_seq_window_update */
+typedef struct janus_rtp_seq_nack {
+	/*! \brief Sequence number of the packet */
+	guint16 seq;
+	/*! \brief Whether this is the second (and last) NACK for the packet */
+	gboolean retry;
+} janus_rtp_seq_nack;
+
+/*! \brief Receive window, to figure out which packets to NACK: a bitmap
+ * of the latest sequence numbers we got, plus the packets still missing
+ * sorted by sequence number, which means that updating it allocates nothing
+ * and that NACKs are generated in O(missing) rather than O(window) */
+typedef struct janus_rtp_seq_window {
+	/*! \brief Whether we got a packet already */
+	gboolean started;
+	/*! \brief Highest sequence number we got */
+	guint16 highest;
+	/*! \brief Bitmap of received packets, indexed by sequence number */
+	guint32 received[JANUS_RTP_SEQ_WINDOW_BITS/32];
+	/*! \brief Packets still missing, oldest first */
+	janus_rtp_seq_missing missing[JANUS_RTP_SEQ_WINDOW_LEN];
+	/*! \brief Number of packets still missing */
+	guint missing_count;
+} janus_rtp_seq_window;
+
+/*! \brief Reset a receive window, e.g., after a keyframe or an SSRC change
+ * @param[in] window The receive window to reset */
+void janus_rtp_seq_window_reset(janus_rtp_seq_window *window);
+/*! \brief Update a receive window with a new packet, and get the packets to NACK, if any
+ * \note NACKs are always returned in sequence number order
+ * @param[in] window The receive window to update
+ * @param[in] seq The sequence number of the packet we just got
+ * @param[in] now The packet arrival monotonic time
+ * @param[out] nacks Where to put the sequence numbers to NACK (at least JANUS_RTP_SEQ_WINDOW_LEN items)
+ * @returns The number of sequence numbers to NACK, or -1 if the jump was too big and the window started from scratch */
+int janus_rtp_seq_window_update(janus_rtp_seq_window *window, guint16 seq, gint64 now, janus_rtp_seq_nack *nacks);
+
 #endif
@@ -64,4 +64,9 @@ typedef enum janus_srtp_profile {
  * @returns A string representation of the error code */
 const char *janus_srtp_error_str(int error);
 
+/*! \brief Helper method to get a string representation of an SRTP profile
+ * @param[in] profile The SRTP profile
+ * @returns A string representation of the profile (as in the DTLS-SRTP extension), or NULL if invalid */
+const char *janus_srtp_profile_str(janus_srtp_profile profile);
+
 #endif
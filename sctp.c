@@ -68,7 +68,7 @@ int janus_sctp_send_open_response_message(struct socket *sock, uint16_t stream);
 int janus_sctp_send_open_ack_message(struct socket *sock, uint16_t stream);
 void janus_sctp_send_deferred_messages(janus_sctp_association *sctp);
 int janus_sctp_open_channel(janus_sctp_association *sctp, uint8_t unordered, uint16_t pr_policy, uint32_t pr_value);
-int janus_sctp_send_text(janus_sctp_association *sctp, uint16_t id, char *text, size_t length);
+int janus_sctp_send_message(janus_sctp_association *sctp, uint16_t id, gboolean binary, char *data, size_t length);
 void janus_sctp_reset_outgoing_stream(janus_sctp_association *sctp, uint16_t stream);
 void janus_sctp_send_outgoing_stream_reset(janus_sctp_association *sctp);
 int janus_sctp_close_channel(janus_sctp_association *sctp, uint16_t id);
@@ -76,7 +76,7 @@ void janus_sctp_handle_open_request_message(janus_sctp_association *sctp, janus_
 void janus_sctp_handle_open_response_message(janus_sctp_association *sctp, janus_datachannel_open_response *rsp, size_t length, uint16_t stream);
 void janus_sctp_handle_open_ack_message(janus_sctp_association *sctp, janus_datachannel_ack *ack, size_t length, uint16_t stream);
 void janus_sctp_handle_unknown_message(char *msg, size_t length, uint16_t stream);
-void janus_sctp_handle_data_message(janus_sctp_association *sctp, char *buffer, size_t length, uint16_t stream);
+void janus_sctp_handle_data_message(janus_sctp_association *sctp, char *buffer, size_t length, uint16_t stream, gboolean binary);
 void janus_sctp_handle_message(janus_sctp_association *sctp, char *buffer, size_t length, uint32_t ppid, uint16_t stream, int flags);
 void janus_sctp_handle_association_change_event(struct sctp_assoc_change *sac);
 void janus_sctp_handle_peer_address_change_event(struct sctp_paddr_change *spc);
@@ -87,17 +87,70 @@ void janus_sctp_handle_remote_error_event(struct sctp_remote_error *sre);
 void janus_sctp_handle_send_failed_event(struct sctp_send_failed_event *ssfe);
 void janus_sctp_handle_notification(janus_sctp_association *sctp, union sctp_notification *notif, size_t n);
 
-void *janus_sctp_thread(void *data);
-janus_sctp_message *janus_sctp_message_create(gboolean incoming, char *buffer, size_t length);
+static void *janus_sctp_worker_thread(void *data);
+janus_sctp_message *janus_sctp_message_create(janus_sctp_association *sctp, gboolean incoming, char *buffer, size_t length);
 void janus_sctp_message_destroy(janus_sctp_message *message);
 static janus_sctp_message exit_message;
 
+/* Rather than having a thread per association, associations are spread on
+ * a pool of workers: each worker has a queue of messages (incoming SCTP
+ * packets, outgoing SCTP packets to encapsulate in DTLS, and possibly data
+ * from plugins), and an association always sticks to the same worker, which
+ * means its messages are still handled in order */
+typedef struct janus_sctp_worker {
+	int index;
+	GThread *thread;
+	GAsyncQueue *messages;
+	volatile gint associations;
+} janus_sctp_worker;
+static janus_sctp_worker *workers = NULL;
+static int workers_num = 0;
+/* If enabled, small messages from plugins are held for up to this many microseconds:
+ * all those sent in the meanwhile are then passed to usrsctp in a single burst, with
+ * Nagle enabled but for the last one, so that they end up sharing SCTP packets */
+static gint64 coalesce_time = 0;
+/* Messages larger than this are sent right away, together with any that are waiting */
+#define JANUS_SCTP_COALESCE_MAX_MESSAGE	1024
+/* When there's this much data waiting, we don't wait for the timer */
+#define JANUS_SCTP_COALESCE_MAX_BYTES	8192
+
 static gboolean sctp_running;
-int janus_sctp_init(void) {
+int janus_sctp_init(int num_workers, gint64 coalesce) {
 	/* Initialize the SCTP stack */
 	usrsctp_init(0, janus_sctp_data_to_dtls, NULL);
 	sctp_running = TRUE;
 
+	/* Start the workers */
+	if(num_workers <= 0)
+		num_workers = MIN(g_get_num_processors(), 4);
+	coalesce_time = coalesce > 0 ? coalesce : 0;
+	workers = g_malloc0(num_workers * sizeof(janus_sctp_worker));
+	int i = 0;
+	for(i=0; i<num_workers; i++) {
+		workers[i].index = i;
+		workers[i].messages = g_async_queue_new_full((GDestroyNotify) janus_sctp_message_destroy);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "sctp %d", i);
+		workers[i].thread = g_thread_try_new(tname, &janus_sctp_worker_thread, &workers[i], &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch SCTP worker #%d...\n",
+				error->code, error->message ? error->message : "??", i);
+			g_error_free(error);
+			g_async_queue_unref(workers[i].messages);
+			workers_num = i;
+			janus_sctp_deinit();
+			return -1;
+		}
+	}
+	workers_num = num_workers;
+	if(coalesce_time > 0) {
+		JANUS_LOG(LOG_INFO, "SCTP associations handled by %d workers, coalescing small messages for up to %"SCNi64"us\n",
+			workers_num, coalesce_time);
+	} else {
+		JANUS_LOG(LOG_INFO, "SCTP associations handled by %d workers\n", workers_num);
+	}
+
 #ifdef DEBUG_SCTP
 	JANUS_LOG(LOG_WARN, "SCTP debugging to files enabled: going to save them in %s\n", debug_folder);
 	if(janus_mkdir(debug_folder, 0755) < 0) {
@@ -108,8 +161,17 @@ int janus_sctp_init(void) {
 }
 
 void janus_sctp_deinit(void) {
-	usrsctp_finish();
 	sctp_running = FALSE;
+	int i = 0;
+	for(i=0; i<workers_num; i++) {
+		g_async_queue_push(workers[i].messages, &exit_message);
+		g_thread_join(workers[i].thread);
+		g_async_queue_unref(workers[i].messages);
+	}
+	g_free(workers);
+	workers = NULL;
+	workers_num = 0;
+	usrsctp_finish();
 }
 
 janus_sctp_association *janus_sctp_association_create(void *dtls, uint64_t handle_id, uint16_t udp_port) {
@@ -231,27 +293,27 @@ janus_sctp_association *janus_sctp_association_create(void *dtls, uint64_t handl
 	sctp->debug_dump = fopen(debug_file, "wt");
 #endif
 
-	/* We're done for now, the setup is done elsewhere */
+	/* We're done for now, the setup is done elsewhere: pick the least busy worker */
+	int w = 0, worker = 0;
+	for(w=1; w<workers_num; w++) {
+		if(g_atomic_int_get(&workers[w].associations) < g_atomic_int_get(&workers[worker].associations))
+			worker = w;
+	}
+	g_atomic_int_inc(&workers[worker].associations);
 	janus_mutex_lock(&sctp->mutex);
 	sctp->sock = sock;
-	sctp->messages = g_async_queue_new_full((GDestroyNotify) janus_sctp_message_destroy);
+	sctp->worker = worker;
+	sctp->messages = workers[worker].messages;
+	sctp->sent_data = FALSE;
+	sctp->pending = g_queue_new();
+	sctp->pending_bytes = 0;
+	sctp->pending_deadline = 0;
+	sctp->destroyed = 0;
 	sctp->buffer = NULL;
 	sctp->buflen = 0;
 	sctp->offset = 0;
-	GError *error = NULL;
-	char tname[16];
-	g_snprintf(tname, sizeof(tname), "sctp %"SCNu64, sctp->handle_id);
-	sctp->thread = g_thread_try_new(tname, &janus_sctp_thread, sctp, &error);
-	if(error != NULL) {
-		/* Something went wrong... */
-		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Got error %d (%s) trying to launch the SCTP thread...\n", handle_id, error->code, error->message ? error->message : "??");
-		g_async_queue_unref(sctp->messages);
-		sctp->messages = NULL;
-		g_free(sctp);
-		sctp = NULL;
-		return NULL;
-	}
 	janus_mutex_unlock(&sctp->mutex);
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] SCTP association handled by worker #%d\n", handle_id, worker);
 	return sctp;
 }
 
@@ -291,8 +353,14 @@ void janus_sctp_association_destroy(janus_sctp_association *sctp) {
 	usrsctp_shutdown(sctp->sock, SHUT_RDWR);
 	usrsctp_close(sctp->sock);
 	janus_mutex_lock(&sctp->mutex);
-	sctp->dtls = NULL;	/* This will get rid of the thread */
-	g_async_queue_push(sctp->messages, &exit_message);
+	sctp->dtls = NULL;
+	/* Let the worker know: it will free the association when it's safe to do so */
+	if(sctp->messages != NULL) {
+		janus_sctp_message *message = g_malloc0(sizeof(janus_sctp_message));
+		message->sctp = sctp;
+		g_async_queue_push(sctp->messages, message);
+	}
+	sctp->messages = NULL;
 	janus_mutex_unlock(&sctp->mutex);
 }
 
@@ -302,7 +370,7 @@ void janus_sctp_data_from_dtls(janus_sctp_association *sctp, char *buf, int len)
 	JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Data from DTLS to SCTP stack: %d bytes\n", sctp->handle_id, len);
 	janus_mutex_lock(&sctp->mutex);
 	if(sctp->messages != NULL)
-		g_async_queue_push(sctp->messages, janus_sctp_message_create(TRUE, buf, len));
+		g_async_queue_push(sctp->messages, janus_sctp_message_create(sctp, TRUE, buf, len));
 	janus_mutex_unlock(&sctp->mutex);
 }
 
@@ -313,7 +381,7 @@ int janus_sctp_data_to_dtls(void *instance, void *buffer, size_t length, uint8_t
 	JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Data from SCTP to DTLS stack: %zu bytes\n", sctp->handle_id, length);
 	janus_mutex_lock(&sctp->mutex);
 	if(sctp->messages != NULL)
-		g_async_queue_push(sctp->messages, janus_sctp_message_create(FALSE, buffer, length));
+		g_async_queue_push(sctp->messages, janus_sctp_message_create(sctp, FALSE, buffer, length));
 	janus_mutex_unlock(&sctp->mutex);
 	return 0;
 }
@@ -333,10 +401,33 @@ static int janus_sctp_incoming_data(struct socket *sock, union sctp_sockstore ad
 	return 1;
 }
 
-void janus_sctp_send_data(janus_sctp_association *sctp, char *buf, int len) {
+static void janus_sctp_send_data_internal(janus_sctp_association *sctp, gboolean binary, char *buf, int len);
+void janus_sctp_send_data(janus_sctp_association *sctp, gboolean binary, char *buf, int len) {
 	if(sctp == NULL || buf == NULL || len <= 0)
 		return;
-	JANUS_LOG(LOG_VERB, "[%"SCNu64"] SCTP data to send (%d bytes) coming from a plugin: %.*s\n", sctp->handle_id, len, len, buf);
+	if(coalesce_time == 0) {
+		/* Send it right away */
+		janus_sctp_send_data_internal(sctp, binary, buf, len);
+		return;
+	}
+	/* Let the worker send it, possibly together with other messages: notice that we
+	 * do this for large messages too, or they may overtake the ones waiting */
+	janus_mutex_lock(&sctp->mutex);
+	if(sctp->dtls != NULL && sctp->messages != NULL) {
+		janus_sctp_message *message = janus_sctp_message_create(sctp, FALSE, buf, len);
+		message->plugin = TRUE;
+		message->binary = binary;
+		g_async_queue_push(sctp->messages, message);
+	}
+	janus_mutex_unlock(&sctp->mutex);
+}
+
+static void janus_sctp_send_data_internal(janus_sctp_association *sctp, gboolean binary, char *buf, int len) {
+	if(binary) {
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] SCTP binary data to send (%d bytes) coming from a plugin\n", sctp->handle_id, len);
+	} else {
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] SCTP data to send (%d bytes) coming from a plugin: %.*s\n", sctp->handle_id, len, len, buf);
+	}
 	/* FIXME Is there any open channel we can use? */
 	int i = 0, found = 0;
 	for(i = 0; i < NUMBER_OF_CHANNELS; i++) {
@@ -366,8 +457,7 @@ void janus_sctp_send_data(janus_sctp_association *sctp, char *buf, int len) {
 			//~ return;
 		//~ }
 	}
-	/* FIXME We're assuming this is a string (we don't support binary data yet) */
-	janus_sctp_send_text(sctp, i, buf, len);
+	janus_sctp_send_message(sctp, i, binary, buf, len);
 }
 
 
@@ -647,8 +737,8 @@ int janus_sctp_open_channel(janus_sctp_association *sctp, uint8_t unordered, uin
 	return 0;
 }
 
-int janus_sctp_send_text(janus_sctp_association *sctp, uint16_t id, char *text, size_t length) {
-	if(id >= NUMBER_OF_CHANNELS || text == NULL)
+int janus_sctp_send_message(janus_sctp_association *sctp, uint16_t id, gboolean binary, char *data, size_t length) {
+	if(id >= NUMBER_OF_CHANNELS || data == NULL)
 		return -1;
 	struct sctp_sendv_spa spa;
 	janus_sctp_channel *channel = &sctp->channels[id];
@@ -669,14 +759,14 @@ int janus_sctp_send_text(janus_sctp_association *sctp, uint16_t id, char *text,
 	} else {
 		spa.sendv_sndinfo.snd_flags = SCTP_EOR;
 	}
-	spa.sendv_sndinfo.snd_ppid = htonl(DATA_CHANNEL_PPID_DOMSTRING);
+	spa.sendv_sndinfo.snd_ppid = htonl(binary ? DATA_CHANNEL_PPID_BINARY : DATA_CHANNEL_PPID_DOMSTRING);
 	spa.sendv_flags = SCTP_SEND_SNDINFO_VALID;
 	if((channel->pr_policy == SCTP_PR_SCTP_TTL) || (channel->pr_policy == SCTP_PR_SCTP_RTX)) {
 		spa.sendv_prinfo.pr_policy = channel->pr_policy;
 		spa.sendv_prinfo.pr_value = channel->pr_value;
 		spa.sendv_flags |= SCTP_SEND_PRINFO_VALID;
 	}
-	if(usrsctp_sendv(sctp->sock, text, length, NULL, 0,
+	if(usrsctp_sendv(sctp->sock, data, length, NULL, 0,
 			&spa, (socklen_t)sizeof(struct sctp_sendv_spa),
 			SCTP_SENDV_SPA, 0) < 0) {
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"] sctp_sendv error (%d)\n", sctp->handle_id, errno);
@@ -886,7 +976,7 @@ void janus_sctp_handle_unknown_message(char *msg, size_t length, uint16_t stream
 	return;
 }
 
-void janus_sctp_handle_data_message(janus_sctp_association *sctp, char *buffer, size_t length, uint16_t stream) {
+void janus_sctp_handle_data_message(janus_sctp_association *sctp, char *buffer, size_t length, uint16_t stream, gboolean binary) {
 	janus_sctp_channel *channel;
 
 	channel = janus_sctp_find_channel_by_stream(sctp, stream);
@@ -905,12 +995,15 @@ void janus_sctp_handle_data_message(janus_sctp_association *sctp, char *buffer,
 		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Got data from this SCTP association but channel isn't open yet...\n", sctp->handle_id);
 		return;
 	} else {
-		/* Assuming DATA_CHANNEL_PPID_DOMSTRING */
-		/* XXX: Protect for non 0 terminated buffer */
-		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Message received of length %zu on channel with id %d: %.*s\n",
-		       sctp->handle_id, length, channel->id, (int)length, buffer);
-		/* FIXME: notify this to the core */
-		janus_dtls_notify_data((janus_dtls_srtp *)sctp->dtls, buffer, (int)length);
+		if(binary) {
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Binary message received of length %zu on channel with id %d\n",
+			       sctp->handle_id, length, channel->id);
+		} else {
+			/* XXX: Protect for non 0 terminated buffer */
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Message received of length %zu on channel with id %d: %.*s\n",
+			       sctp->handle_id, length, channel->id, (int)length, buffer);
+		}
+		janus_dtls_notify_data((janus_dtls_srtp *)sctp->dtls, binary, buffer, (int)length);
 	}
 	return;
 }
@@ -965,14 +1058,23 @@ void janus_sctp_handle_message(janus_sctp_association *sctp, char *buffer, size_
 					ppid != DATA_CHANNEL_PPID_BINARY_PARTIAL) {
 				/* Message is complete, send it */
 				if(sctp->offset > 0) {
-					/* We buffered multiple partial messages */
-					janus_sctp_handle_data_message(sctp, sctp->buffer, sctp->offset, stream);
+					/* We buffered multiple partial messages: append this last chunk too */
+					if(length > (sctp->buflen - sctp->offset)) {
+						sctp->buffer = g_realloc(sctp->buffer, sctp->offset + length);
+						sctp->buflen = sctp->offset + length;
+					}
+					memcpy(sctp->buffer + sctp->offset, buffer, length);
+					sctp->offset += length;
+					janus_sctp_handle_data_message(sctp, sctp->buffer, sctp->offset, stream, sctp->buffer_binary);
 					sctp->offset = 0;
 				} else {
 					/* No buffering done, send this message as it is */
-					janus_sctp_handle_data_message(sctp, buffer, length, stream);
+					janus_sctp_handle_data_message(sctp, buffer, length, stream, ppid == DATA_CHANNEL_PPID_BINARY);
 				}
 			} else {
+				/* Partial message, keep track of whether it's binary or text */
+				if(sctp->offset == 0)
+					sctp->buffer_binary = (ppid == DATA_CHANNEL_PPID_BINARY || ppid == DATA_CHANNEL_PPID_BINARY_PARTIAL);
 				/* Partial message, buffer only for now */
 				if(length > (sctp->buflen - sctp->offset)) {
 					/* (re)Allocate the buffer */
@@ -1252,77 +1354,84 @@ void janus_sctp_handle_notification(janus_sctp_association *sctp, union sctp_not
 }
 
 
-void *janus_sctp_thread(void *data) {
-	janus_sctp_association *sctp = (janus_sctp_association *)data;
-	if(sctp == NULL) {
-		JANUS_LOG(LOG_ERR, "Invalid SCTP association, closing thread\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+/* Handle an SCTP packet, either coming from the DTLS stack or to send via DTLS */
+static void janus_sctp_handle_packet(janus_sctp_association *sctp, janus_sctp_message *message) {
+	janus_mutex_lock(&sctp->mutex);
+	if(sctp->dtls == NULL) {
+		/* No DTLS stack anymore, the association is being destroyed */
+		janus_mutex_unlock(&sctp->mutex);
+		return;
 	}
-	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Starting thread for SCTP association\n", sctp->handle_id);
-	janus_sctp_message *message = NULL;
-	gboolean sent_data = FALSE;
-	while(sctp->dtls != NULL && sctp_running) {
-		/* Anything to do at all? */
-		message = g_async_queue_pop(sctp->messages);
-		if(message == NULL)
-			continue;
-		if(message == &exit_message)
-			break;
-		janus_mutex_lock(&sctp->mutex);
-		if(sctp->dtls == NULL) {
-			/* No DTLS stack anymore, we're done */
-			janus_sctp_message_destroy(message);
-			message = NULL;
-			janus_mutex_unlock(&sctp->mutex);
-			break;
-		}
-		/* Check incoming/outgoing messages */
-		if(!message->incoming) {
+	/* Check incoming/outgoing messages */
+	if(!message->incoming) {
 #ifdef DEBUG_SCTP
-			if(sctp->debug_dump != NULL) {
-				/* Dump outgoing message */
-				char *dump = usrsctp_dumppacket(message->buffer, message->length, SCTP_DUMP_OUTBOUND);
-				if(dump != NULL) {
-					fwrite(dump, sizeof(char), strlen(dump), sctp->debug_dump);
-					fflush(sctp->debug_dump);
-					usrsctp_freedumpbuffer(dump);
-				}
+		if(sctp->debug_dump != NULL) {
+			/* Dump outgoing message */
+			char *dump = usrsctp_dumppacket(message->buffer, message->length, SCTP_DUMP_OUTBOUND);
+			if(dump != NULL) {
+				fwrite(dump, sizeof(char), strlen(dump), sctp->debug_dump);
+				fflush(sctp->debug_dump);
+				usrsctp_freedumpbuffer(dump);
 			}
+		}
 #endif
-			/* Encapsulate this data in DTLS and send it */
-			janus_dtls_send_sctp_data((janus_dtls_srtp *)sctp->dtls, message->buffer, message->length);
-			janus_sctp_message_destroy(message);
-			message = NULL;
-			if(!sent_data)
-				sent_data = TRUE;
-		} else if(message->incoming && sent_data) {
+		/* Encapsulate this data in DTLS and send it */
+		janus_dtls_send_sctp_data((janus_dtls_srtp *)sctp->dtls, message->buffer, message->length);
+		sctp->sent_data = TRUE;
+	} else if(sctp->sent_data) {
 #ifdef DEBUG_SCTP
-			if(sctp->debug_dump != NULL) {
-				/* Dump incoming message */
-				char *dump = usrsctp_dumppacket(message->buffer, message->length, SCTP_DUMP_INBOUND);
-				if(dump != NULL) {
-					fwrite(dump, sizeof(char), strlen(dump), sctp->debug_dump);
-					fflush(sctp->debug_dump);
-					usrsctp_freedumpbuffer(dump);
-				}
+		if(sctp->debug_dump != NULL) {
+			/* Dump incoming message */
+			char *dump = usrsctp_dumppacket(message->buffer, message->length, SCTP_DUMP_INBOUND);
+			if(dump != NULL) {
+				fwrite(dump, sizeof(char), strlen(dump), sctp->debug_dump);
+				fflush(sctp->debug_dump);
+				usrsctp_freedumpbuffer(dump);
 			}
-#endif
-			/* Pass this data to the SCTP association */
-			janus_mutex_unlock(&sctp->mutex);
-			usrsctp_conninput((void *)sctp, message->buffer, message->length, 0);
-			janus_mutex_lock(&sctp->mutex);
 		}
+#endif
+		/* Pass this data to the SCTP association */
 		janus_mutex_unlock(&sctp->mutex);
+		usrsctp_conninput((void *)sctp, message->buffer, message->length, 0);
+		return;
+	}
+	janus_mutex_unlock(&sctp->mutex);
+}
+
+/* Send all the messages from plugins that were waiting to be coalesced */
+static void janus_sctp_flush_pending(janus_sctp_association *sctp) {
+	guint count = g_queue_get_length(sctp->pending);
+	sctp->pending_bytes = 0;
+	sctp->pending_deadline = 0;
+	if(count == 0)
+		return;
+	if(sctp->dtls == NULL) {
+		/* The association is being destroyed, don't bother */
+		g_queue_foreach(sctp->pending, (GFunc)janus_sctp_message_destroy, NULL);
+		g_queue_clear(sctp->pending);
+		return;
+	}
+	JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Sending %u coalesced messages\n", sctp->handle_id, count);
+	uint32_t nodelay = 0;
+	if(count > 1) {
+		/* With Nagle enabled, usrsctp will queue the messages after the first one... */
+		usrsctp_setsockopt(sctp->sock, IPPROTO_SCTP, SCTP_NODELAY, &nodelay, sizeof(nodelay));
+	}
+	janus_sctp_message *message = NULL;
+	while((message = g_queue_pop_head(sctp->pending)) != NULL) {
+		if(count > 1 && g_queue_is_empty(sctp->pending)) {
+			/* ... and disabling it again before the last one gets them all bundled and sent */
+			nodelay = 1;
+			usrsctp_setsockopt(sctp->sock, IPPROTO_SCTP, SCTP_NODELAY, &nodelay, sizeof(nodelay));
+		}
+		janus_sctp_send_data_internal(sctp, message->binary, message->buffer, message->length);
 		janus_sctp_message_destroy(message);
-		message = NULL;
 	}
-	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Leaving SCTP association thread\n", sctp->handle_id);
-	/* This association has been destroyed, wait a bit and then free all the resources */
-	g_usleep (1*G_USEC_PER_SEC);
-	g_async_queue_unref(sctp->messages);
-	sctp->messages = NULL;
-	sctp->thread = NULL;
+}
+
+static void janus_sctp_association_free(janus_sctp_association *sctp) {
+	g_queue_free_full(sctp->pending, (GDestroyNotify)janus_sctp_message_destroy);
+	sctp->pending = NULL;
 #ifdef DEBUG_SCTP
 	if(sctp->debug_dump != NULL)
 		fclose(sctp->debug_dump);
@@ -1330,19 +1439,106 @@ void *janus_sctp_thread(void *data) {
 #endif
 	g_free(sctp->buffer);
 	g_free(sctp);
-	sctp = NULL;
-	g_thread_unref(g_thread_self());
+}
+
+static void *janus_sctp_worker_thread(void *data) {
+	janus_sctp_worker *worker = (janus_sctp_worker *)data;
+	JANUS_LOG(LOG_VERB, "Starting SCTP worker #%d\n", worker->index);
+	/* Associations with messages waiting to be coalesced, and associations that are gone */
+	GList *waiting = NULL, *dying = NULL, *l = NULL, *next = NULL;
+	janus_sctp_message *message = NULL;
+	while(sctp_running) {
+		/* Any coalesced messages to send, or association to free? */
+		gint64 now = janus_get_monotonic_time(), wait = -1;
+		for(l = waiting; l != NULL; l = next) {
+			janus_sctp_association *sctp = (janus_sctp_association *)l->data;
+			next = l->next;
+			if(sctp->pending_deadline <= now) {
+				janus_sctp_flush_pending(sctp);
+				waiting = g_list_delete_link(waiting, l);
+			} else if(wait < 0 || sctp->pending_deadline - now < wait) {
+				wait = sctp->pending_deadline - now;
+			}
+		}
+		for(l = dying; l != NULL; l = next) {
+			janus_sctp_association *sctp = (janus_sctp_association *)l->data;
+			next = l->next;
+			/* Wait a bit before freeing the resources, usrsctp may still be using them */
+			if(now - sctp->destroyed >= G_USEC_PER_SEC) {
+				JANUS_LOG(LOG_VERB, "[%"SCNu64"] Freeing SCTP association\n", sctp->handle_id);
+				janus_sctp_association_free(sctp);
+				g_atomic_int_add(&worker->associations, -1);
+				dying = g_list_delete_link(dying, l);
+			} else if(wait < 0 || sctp->destroyed + G_USEC_PER_SEC - now < wait) {
+				wait = sctp->destroyed + G_USEC_PER_SEC - now;
+			}
+		}
+		/* Wait for something to do */
+		message = (wait < 0 ? g_async_queue_pop(worker->messages) :
+			g_async_queue_timeout_pop(worker->messages, wait));
+		if(message == NULL)
+			continue;
+		if(message == &exit_message)
+			break;
+		janus_sctp_association *sctp = message->sctp;
+		if(message->buffer == NULL) {
+			/* This association has been destroyed, we'll free it in a bit */
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] SCTP association destroyed\n", sctp->handle_id);
+			waiting = g_list_remove(waiting, sctp);
+			janus_sctp_flush_pending(sctp);
+			sctp->destroyed = janus_get_monotonic_time();
+			dying = g_list_append(dying, sctp);
+			janus_sctp_message_destroy(message);
+			continue;
+		}
+		if(message->plugin) {
+			/* Data from a plugin: wait a bit before sending it, unless there's enough already */
+			if(sctp->pending_deadline == 0) {
+				sctp->pending_deadline = janus_get_monotonic_time() + coalesce_time;
+				waiting = g_list_append(waiting, sctp);
+			}
+			g_queue_push_tail(sctp->pending, message);
+			sctp->pending_bytes += message->length;
+			if(message->length > JANUS_SCTP_COALESCE_MAX_MESSAGE || sctp->pending_bytes >= JANUS_SCTP_COALESCE_MAX_BYTES) {
+				waiting = g_list_remove(waiting, sctp);
+				janus_sctp_flush_pending(sctp);
+			}
+			continue;
+		}
+		janus_sctp_handle_packet(sctp, message);
+		janus_sctp_message_destroy(message);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving SCTP worker #%d\n", worker->index);
+	/* We're shutting down: drop whatever is still queued, freeing the
+	 * associations that were destroyed in the meanwhile, and then those
+	 * that were already gone */
+	g_list_free(waiting);
+	while((message = g_async_queue_try_pop(worker->messages)) != NULL) {
+		if(message != &exit_message && message->buffer == NULL) {
+			janus_sctp_association_free(message->sctp);
+			g_atomic_int_add(&worker->associations, -1);
+		}
+		janus_sctp_message_destroy(message);
+	}
+	for(l = dying; l != NULL; l = l->next) {
+		janus_sctp_association_free((janus_sctp_association *)l->data);
+		g_atomic_int_add(&worker->associations, -1);
+	}
+	g_list_free(dying);
 	return NULL;
 }
 
-janus_sctp_message *janus_sctp_message_create(gboolean incoming, char *buffer, size_t length) {
+janus_sctp_message *janus_sctp_message_create(janus_sctp_association *sctp, gboolean incoming, char *buffer, size_t length) {
 	if(buffer == NULL || length == 0)
 		return NULL;
 	janus_sctp_message *message = g_malloc(sizeof(janus_sctp_message));
+	message->sctp = sctp;
 	message->buffer = g_malloc(length);
 	memcpy(message->buffer, buffer, length);
 	message->length = length;
 	message->incoming = incoming;
+	message->plugin = FALSE;
+	message->binary = FALSE;
 	return message;
 }
 
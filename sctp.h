@@ -47,8 +47,13 @@
 
 
 /*! \brief SCTP stuff initialization
+ * \note Associations are spread on a pool of worker threads, rather than
+ * getting a thread each. Small messages from plugins can optionally be held
+ * for a short while, so that the ones sent in a burst share SCTP packets.
+ * \param[in] workers Number of SCTP worker threads (0 to pick one per core, up to 4)
+ * \param[in] coalesce_time How long small outgoing messages can be held to be coalesced, in microseconds (0 disables it)
  * \returns 0 on success, a negative integer otherwise */
-int janus_sctp_init(void);
+int janus_sctp_init(int workers, gint64 coalesce_time);
 
 /*! \brief SCTP stuff de-initialization */
 void janus_sctp_deinit(void);
@@ -109,16 +114,28 @@ typedef struct janus_sctp_association {
 	uint16_t local_port;
 	/*! \brief Remote port to be used for SCTP */
 	uint16_t remote_port;
-	/*! \brief Queue of incoming/outgoing messages */
+	/*! \brief Queue of incoming/outgoing messages (the one of the worker handling this association) */
 	GAsyncQueue *messages;
+	/*! \brief Index of the worker handling this association */
+	int worker;
+	/*! \brief Whether we sent something already (we ignore incoming messages until then) */
+	gboolean sent_data;
+	/*! \brief Small messages from plugins waiting to be coalesced, if enabled */
+	GQueue *pending;
+	/*! \brief Size of the messages waiting to be coalesced */
+	size_t pending_bytes;
+	/*! \brief When the messages waiting to be coalesced must be sent, at the latest */
+	gint64 pending_deadline;
+	/*! \brief When this association was destroyed, if it was */
+	gint64 destroyed;
 	/*! \brief Buffer for handling partial messages */
 	char *buffer;
 	/*! \brief Current size of the buffer for handling partial messages */
 	size_t buflen;
 	/*! \brief Current offset of the buffer for handling partial messages */
 	size_t offset;
-	/*! \brief Thread for handling SCTP messaging */
-	GThread *thread;
+	/*! \brief Whether the partial messages being buffered are binary */
+	gboolean buffer_binary;
 #ifdef DEBUG_SCTP
 	FILE *debug_dump;
 #endif
@@ -128,9 +145,15 @@ typedef struct janus_sctp_association {
 
 /*! \brief Helper structure to handle incoming and outgoing messages */
 typedef struct janus_sctp_message {
+	/*! \brief The SCTP association this message is for */
+	struct janus_sctp_association *sctp;
 	/*! \brief Whether the message is incoming or outgoing */
 	gboolean incoming;
-	/*! \brief The message data */
+	/*! \brief Whether this is data from a plugin to send on a channel, rather than an SCTP packet */
+	gboolean plugin;
+	/*! \brief Whether the data from a plugin is binary, rather than text */
+	gboolean binary;
+	/*! \brief The message data (NULL if the association is being destroyed) */
 	char *buffer;
 	/*! \brief The message length */
 	size_t length;
@@ -208,9 +231,10 @@ void janus_sctp_data_from_dtls(janus_sctp_association *sctp, char *buf, int len)
 
 /*! \brief Method to send data via SCTP to the peer
  * \param[in] sctp The SCTP association this data is from
+ * \param[in] binary Whether this is binary data (PPID 53) rather than text (PPID 51)
  * \param[in] buf The data buffer
  * \param[in] len The buffer length */
-void janus_sctp_send_data(janus_sctp_association *sctp, char *buf, int len);
+void janus_sctp_send_data(janus_sctp_association *sctp, gboolean binary, char *buf, int len);
 
 #endif
 
@@ -230,15 +230,17 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 	gboolean success = TRUE;
 	janus_sdp_mline *mline = NULL;
 
-	gchar **parts = g_strsplit(sdp, "\r\n", -1);
-	if(parts) {
-		int index = 0;
-		char *line = NULL;
-		while(success && (line = parts[index]) != NULL) {
-			if(*line == '\0') {
-				index++;
-				continue;
-			}
+	/* We work on a single copy of the SDP, splitting lines in place: lists
+	 * are built by prepending, and reversed when we're done, to avoid
+	 * walking them each time something is added */
+	char *copy = g_strdup(sdp);
+	if(copy != NULL) {
+		char *line = copy, *next = strstr(line, "\r\n");
+		if(next != NULL)
+			*next = '\0';
+		while(success && line != NULL) {
+			if(*line == '\0')
+				goto nextline;
 			if(strlen(line) < 3) {
 				if(error)
 					g_snprintf(error, errlen, "Invalid line (%zu bytes): %s", strlen(line), line);
@@ -347,7 +349,7 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 							if(strstr(line, "/inactive"))
 								a->direction = JANUS_SDP_INACTIVE;
 						}
-						imported->attributes = g_list_append(imported->attributes, a);
+						imported->attributes = g_list_prepend(imported->attributes, a);
 						break;
 					}
 					case 'm': {
@@ -368,28 +370,21 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 						m->c_ipv4 = TRUE;
 						if(m->port > 0) {
 							/* Now let's check the payload types/formats */
-							gchar **mline_parts = g_strsplit(line+2, " ", -1);
-							if(!mline_parts) {
-								if(error)
-									g_snprintf(error, errlen, "Invalid m= line (no payload types/formats): %s", line);
-								success = FALSE;
-								break;
-							}
+							const char *token = line+2, *end = NULL;
 							int mindex = 0;
-							while(mline_parts[mindex]) {
-								if(mindex < 3) {
-									/* We've parsed these before */
-									mindex++;
-									continue;
+							while(*token != '\0') {
+								end = strchr(token, ' ');
+								if(end == NULL)
+									end = token + strlen(token);
+								if(end > token && mindex++ >= 3) {
+									/* Add string fmt (the first three items we parsed before) */
+									m->fmts = g_list_prepend(m->fmts, g_strndup(token, end-token));
+									/* Add numeric payload type */
+									int ptype = atoi(token);
+									m->ptypes = g_list_prepend(m->ptypes, GINT_TO_POINTER(ptype));
 								}
-								/* Add string fmt */
-								m->fmts = g_list_append(m->fmts, g_strdup(mline_parts[mindex]));
-								/* Add numeric payload type */
-								int ptype = atoi(mline_parts[mindex]);
-								m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(ptype));
-								mindex++;
+								token = (*end == ' ') ? end+1 : end;
 							}
-							g_strfreev(mline_parts);
 							if(m->fmts == NULL || m->ptypes == NULL) {
 								if(error)
 									g_snprintf(error, errlen, "Invalid m= line (no payload types/formats): %s", line);
@@ -397,8 +392,8 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 								break;
 							}
 						}
-						/* Append to the list of m-lines */
-						imported->m_lines = g_list_append(imported->m_lines, m);
+						/* Add to the list of m-lines */
+						imported->m_lines = g_list_prepend(imported->m_lines, m);
 						/* From now on, we parse this m-line */
 						mline = m;
 						break;
@@ -479,7 +474,7 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 							if(strstr(line, "/inactive"))
 								a->direction = JANUS_SDP_INACTIVE;
 						}
-						mline->attributes = g_list_append(mline->attributes, a);
+						mline->attributes = g_list_prepend(mline->attributes, a);
 						break;
 					}
 					case 'm': {
@@ -492,9 +487,26 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 						break;
 				}
 			}
-			index++;
+nextline:
+			line = next ? (next+2) : NULL;
+			if(line != NULL) {
+				next = strstr(line, "\r\n");
+				if(next != NULL)
+					*next = '\0';
+			}
 		}
-		g_strfreev(parts);
+	}
+	g_free(copy);
+	/* Put all lists back in the right order */
+	imported->attributes = g_list_reverse(imported->attributes);
+	imported->m_lines = g_list_reverse(imported->m_lines);
+	GList *ml = imported->m_lines;
+	while(ml) {
+		janus_sdp_mline *m = (janus_sdp_mline *)ml->data;
+		m->attributes = g_list_reverse(m->attributes);
+		m->fmts = g_list_reverse(m->fmts);
+		m->ptypes = g_list_reverse(m->ptypes);
+		ml = ml->next;
 	}
 	/* FIXME Do a last check: is all the stuff that's supposed to be there available? */
 	if(imported->o_name == NULL || imported->o_addr == NULL || imported->s_name == NULL || imported->m_lines == NULL) {
@@ -537,52 +549,69 @@ int janus_sdp_remove_payload_type(janus_sdp *sdp, int pt) {
 	return 0;
 }
 
+/* Codecs we know about, and the rtpmap formats to look for (note that we only parse what browsers can negotiate) */
+static const struct janus_sdp_codec_format {
+	const char *name;
+	const char *format, *format2;
+	gboolean video;
+} janus_sdp_codec_formats[JANUS_SDP_NEGOTIATION_CODECS] = {
+	{ "opus", "opus/48000/2", "OPUS/48000/2", FALSE },
+	{ "pcmu", "pcmu/8000", "PCMU/8000", FALSE },
+	{ "pcma", "pcma/8000", "PCMA/8000", FALSE },
+	{ "g722", "g722/8000", "G722/8000", FALSE },
+	{ "isac16", "isac/16000", "ISAC/16000", FALSE },
+	{ "isac32", "isac/32000", "ISAC/32000", FALSE },
+	{ "dtmf", "telephone-event/8000", "TELEPHONE-EVENT/8000", FALSE },
+	{ "vp8", "vp8/90000", "VP8/90000", TRUE },
+	{ "vp9", "vp9/90000", "VP9/90000", TRUE },
+	{ "h264", "h264/90000", "H264/90000", TRUE },
+};
+
+static int janus_sdp_codec_index(const char *codec) {
+	int i = 0;
+	for(i=0; i<JANUS_SDP_NEGOTIATION_CODECS; i++) {
+		if(!strcasecmp(codec, janus_sdp_codec_formats[i].name))
+			return i;
+	}
+	return -1;
+}
+
+/* Static helper to get the codec name out of an rtpmap attribute value */
+static const char *janus_sdp_codec_from_rtpmap(const char *value) {
+	if(strstr(value, "vp8") || strstr(value, "VP8"))
+		return "vp8";
+	if(strstr(value, "vp9") || strstr(value, "VP9"))
+		return "vp9";
+	if(strstr(value, "h264") || strstr(value, "H264"))
+		return "h264";
+	if(strstr(value, "opus") || strstr(value, "OPUS"))
+		return "opus";
+	if(strstr(value, "pcmu") || strstr(value, "PCMU"))
+		return "pcmu";
+	if(strstr(value, "pcma") || strstr(value, "PCMA"))
+		return "pcma";
+	if(strstr(value, "g722") || strstr(value, "G722"))
+		return "g722";
+	if(strstr(value, "isac/16") || strstr(value, "ISAC/16"))
+		return "isac16";
+	if(strstr(value, "isac/32") || strstr(value, "ISAC/32"))
+		return "isac32";
+	if(strstr(value, "telephone-event/8000") || strstr(value, "TELEPHONE-EVENT/8000"))
+		return "dtmf";
+	return NULL;
+}
+
 int janus_sdp_get_codec_pt(janus_sdp *sdp, const char *codec) {
 	if(sdp == NULL || codec == NULL)
 		return -1;
-	/* Check the format string (note that we only parse what browsers can negotiate) */
-	gboolean video = FALSE;
-	const char *format = NULL, *format2 = NULL;
-	if(!strcasecmp(codec, "opus")) {
-		format = "opus/48000/2";
-		format2 = "OPUS/48000/2";
-	} else if(!strcasecmp(codec, "pcmu")) {
-		/* We know the payload type is 0: we just need to make sure it's there */
-		format = "pcmu/8000";
-		format2 = "PCMU/8000";
-	} else if(!strcasecmp(codec, "pcma")) {
-		/* We know the payload type is 8: we just need to make sure it's there */
-		format = "pcma/8000";
-		format2 = "PCMA/8000";
-	} else if(!strcasecmp(codec, "g722")) {
-		/* We know the payload type is 9: we just need to make sure it's there */
-		format = "g722/8000";
-		format2 = "G722/8000";
-	} else if(!strcasecmp(codec, "isac16")) {
-		format = "isac/16000";
-		format2 = "ISAC/16000";
-	} else if(!strcasecmp(codec, "isac32")) {
-		format = "isac/32000";
-		format2 = "ISAC/32000";
-	} else if(!strcasecmp(codec, "dtmf")) {
-		format = "telephone-event/8000";
-		format2 = "TELEPHONE-EVENT/8000";
-	} else if(!strcasecmp(codec, "vp8")) {
-		video = TRUE;
-		format = "vp8/90000";
-		format2 = "VP8/90000";
-	} else if(!strcasecmp(codec, "vp9")) {
-		video = TRUE;
-		format = "vp9/90000";
-		format2 = "VP9/90000";
-	} else if(!strcasecmp(codec, "h264")) {
-		video = TRUE;
-		format = "h264/90000";
-		format2 = "H264/90000";
-	} else {
+	int index = janus_sdp_codec_index(codec);
+	if(index < 0) {
 		JANUS_LOG(LOG_ERR, "Unsupported codec '%s'\n", codec);
 		return -1;
 	}
+	gboolean video = janus_sdp_codec_formats[index].video;
+	const char *format = janus_sdp_codec_formats[index].format,
+		*format2 = janus_sdp_codec_formats[index].format2;
 	/* Check all m->lines */
 	GList *ml = sdp->m_lines;
 	while(ml) {
@@ -627,28 +656,10 @@ const char *janus_sdp_get_codec_name(janus_sdp *sdp, int pt) {
 				int a_pt = atoi(a->value);
 				if(a_pt == pt) {
 					/* Found! */
-					if(strstr(a->value, "vp8") || strstr(a->value, "VP8"))
-						return "vp8";
-					if(strstr(a->value, "vp9") || strstr(a->value, "VP9"))
-						return "vp9";
-					if(strstr(a->value, "h264") || strstr(a->value, "H264"))
-						return "h264";
-					if(strstr(a->value, "opus") || strstr(a->value, "OPUS"))
-						return "opus";
-					if(strstr(a->value, "pcmu") || strstr(a->value, "PCMU"))
-						return "pcmu";
-					if(strstr(a->value, "pcma") || strstr(a->value, "PCMA"))
-						return "pcma";
-					if(strstr(a->value, "g722") || strstr(a->value, "G722"))
-						return "g722";
-					if(strstr(a->value, "isac/16") || strstr(a->value, "ISAC/16"))
-						return "isac16";
-					if(strstr(a->value, "isac/32") || strstr(a->value, "ISAC/32"))
-						return "isac32";
-					if(strstr(a->value, "telephone-event/8000") || strstr(a->value, "telephone-event/8000"))
-						return "dtmf";
-					JANUS_LOG(LOG_ERR, "Unsupported codec '%s'\n", a->value);
-					return NULL;
+					const char *name = janus_sdp_codec_from_rtpmap(a->value);
+					if(name == NULL)
+						JANUS_LOG(LOG_ERR, "Unsupported codec '%s'\n", a->value);
+					return name;
 				}
 			}
 			ma = ma->next;
@@ -658,6 +669,100 @@ const char *janus_sdp_get_codec_name(janus_sdp *sdp, int pt) {
 	return NULL;
 }
 
+janus_sdp_negotiation *janus_sdp_negotiation_create(janus_sdp *sdp) {
+	if(sdp == NULL)
+		return NULL;
+	janus_sdp_negotiation *n = g_malloc0(sizeof(janus_sdp_negotiation));
+	int i = 0;
+	for(i=0; i<JANUS_SDP_NEGOTIATION_CODECS; i++)
+		n->codec_pt[i] = -1;
+	/* Static payload types are always mapped */
+	n->codec_name[0] = "pcmu";
+	n->codec_name[8] = "pcma";
+	n->codec_name[9] = "g722";
+	/* Go through all the m-lines only once */
+	GList *ml = sdp->m_lines;
+	while(ml) {
+		janus_sdp_mline *m = (janus_sdp_mline *)ml->data;
+		GList *ma = m->attributes;
+		while(ma) {
+			janus_sdp_attribute *a = (janus_sdp_attribute *)ma->data;
+			ma = ma->next;
+			if(a->name == NULL || a->value == NULL)
+				continue;
+			if(!strcasecmp(a->name, "rtpmap")) {
+				int pt = atoi(a->value);
+				if(pt < 0 || pt > 127)
+					continue;
+				if(n->codec_name[pt] == NULL)
+					n->codec_name[pt] = janus_sdp_codec_from_rtpmap(a->value);
+				if(m->type != JANUS_SDP_AUDIO && m->type != JANUS_SDP_VIDEO)
+					continue;
+				for(i=0; i<JANUS_SDP_NEGOTIATION_CODECS; i++) {
+					if(n->codec_pt[i] != -1 || janus_sdp_codec_formats[i].video != (m->type == JANUS_SDP_VIDEO))
+						continue;
+					if(strstr(a->value, janus_sdp_codec_formats[i].format) || strstr(a->value, janus_sdp_codec_formats[i].format2))
+						n->codec_pt[i] = pt;
+				}
+			} else if(!strcasecmp(a->name, "extmap")) {
+				/* a=extmap:<id>[/<direction>] <uri> [<attributes>] */
+				int id = atoi(a->value);
+				const char *uri = strchr(a->value, ' ');
+				if(id < 1 || id > 255 || uri == NULL || n->extmap_index[id] > 0 ||
+						n->extmaps_num >= JANUS_SDP_NEGOTIATION_EXTMAPS)
+					continue;
+				uri++;
+				const char *end = strchr(uri, ' ');
+				n->extmap[n->extmaps_num].id = id;
+				n->extmap[n->extmaps_num].uri = end ? g_strndup(uri, end-uri) : g_strdup(uri);
+				n->extmaps_num++;
+				n->extmap_index[id] = n->extmaps_num;
+			}
+		}
+		ml = ml->next;
+	}
+	return n;
+}
+
+void janus_sdp_negotiation_destroy(janus_sdp_negotiation *n) {
+	if(n == NULL)
+		return;
+	int i = 0;
+	for(i=0; i<n->extmaps_num; i++)
+		g_free(n->extmap[i].uri);
+	g_free(n);
+}
+
+int janus_sdp_negotiation_get_codec_pt(const janus_sdp_negotiation *n, const char *codec) {
+	if(n == NULL || codec == NULL)
+		return -1;
+	int index = janus_sdp_codec_index(codec);
+	return index < 0 ? -1 : n->codec_pt[index];
+}
+
+const char *janus_sdp_negotiation_get_codec_name(const janus_sdp_negotiation *n, int pt) {
+	if(n == NULL || pt < 0 || pt > 127)
+		return NULL;
+	return n->codec_name[pt];
+}
+
+int janus_sdp_negotiation_get_extmap_id(const janus_sdp_negotiation *n, const char *extension) {
+	if(n == NULL || extension == NULL)
+		return -1;
+	int i = 0;
+	for(i=0; i<n->extmaps_num; i++) {
+		if(!strcasecmp(n->extmap[i].uri, extension))
+			return n->extmap[i].id;
+	}
+	return -1;
+}
+
+const char *janus_sdp_negotiation_get_extmap_uri(const janus_sdp_negotiation *n, int id) {
+	if(n == NULL || id < 1 || id > 255 || n->extmap_index[id] == 0)
+		return NULL;
+	return n->extmap[n->extmap_index[id]-1].uri;
+}
+
 const char *janus_sdp_get_codec_rtpmap(const char *codec) {
 	if(codec == NULL)
 		return NULL;
@@ -688,46 +793,40 @@ const char *janus_sdp_get_codec_rtpmap(const char *codec) {
 char *janus_sdp_write(janus_sdp *imported) {
 	if(!imported)
 		return NULL;
-	char *sdp = g_malloc(JANUS_BUFSIZE), buffer[512];
-	*sdp = '\0';
+	/* We append to a growable string that keeps track of its length, so
+	 * there's no fixed size limit and no rescanning of what we wrote */
+	GString *sdp = g_string_sized_new(JANUS_BUFSIZE/2);
 	/* v= */
-	g_snprintf(buffer, sizeof(buffer), "v=%d\r\n", imported->version);
-	g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+	g_string_append_printf(sdp, "v=%d\r\n", imported->version);
 	/* o= */
-	g_snprintf(buffer, sizeof(buffer), "o=%s %"SCNu64" %"SCNu64" IN %s %s\r\n",
+	g_string_append_printf(sdp, "o=%s %"SCNu64" %"SCNu64" IN %s %s\r\n",
 		imported->o_name, imported->o_sessid, imported->o_version,
 		imported->o_ipv4 ? "IP4" : "IP6", imported->o_addr);
-	g_strlcat(sdp, buffer, JANUS_BUFSIZE);
 	/* s= */
-	g_snprintf(buffer, sizeof(buffer), "s=%s\r\n", imported->s_name);
-	g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+	g_string_append_printf(sdp, "s=%s\r\n", imported->s_name);
 	/* t= */
-	g_snprintf(buffer, sizeof(buffer), "t=%"SCNu64" %"SCNu64"\r\n", imported->t_start, imported->t_stop);
-	g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+	g_string_append_printf(sdp, "t=%"SCNu64" %"SCNu64"\r\n", imported->t_start, imported->t_stop);
 	/* c= */
 	if(imported->c_addr != NULL) {
-		g_snprintf(buffer, sizeof(buffer), "c=IN %s %s\r\n",
+		g_string_append_printf(sdp, "c=IN %s %s\r\n",
 			imported->c_ipv4 ? "IP4" : "IP6", imported->c_addr);
-		g_strlcat(sdp, buffer, JANUS_BUFSIZE);
 	}
 	/* a= */
 	GList *temp = imported->attributes;
 	while(temp) {
 		janus_sdp_attribute *a = (janus_sdp_attribute *)temp->data;
 		if(a->value != NULL) {
-			g_snprintf(buffer, sizeof(buffer), "a=%s:%s\r\n", a->name, a->value);
+			g_string_append_printf(sdp, "a=%s:%s\r\n", a->name, a->value);
 		} else {
-			g_snprintf(buffer, sizeof(buffer), "a=%s\r\n", a->name);
+			g_string_append_printf(sdp, "a=%s\r\n", a->name);
 		}
-		g_strlcat(sdp, buffer, JANUS_BUFSIZE);
 		temp = temp->next;
 	}
 	/* m= */
 	temp = imported->m_lines;
 	while(temp) {
 		janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
-		g_snprintf(buffer, sizeof(buffer), "m=%s %d %s", m->type_str, m->port, m->proto);
-		g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+		g_string_append_printf(sdp, "m=%s %d %s", m->type_str, m->port, m->proto);
 		if(m->port == 0) {
 			/* Remove all payload types/formats if we're rejecting the media */
 			g_list_free_full(m->fmts, (GDestroyNotify)g_free);
@@ -735,45 +834,40 @@ char *janus_sdp_write(janus_sdp *imported) {
 			g_list_free(m->ptypes);
 			m->ptypes = NULL;
 			m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(0));
-			g_strlcat(sdp, " 0", JANUS_BUFSIZE);
+			g_string_append(sdp, " 0");
 		} else {
 			if(m->proto != NULL && strstr(m->proto, "RTP") != NULL) {
 				/* RTP profile, use payload types */
 				GList *ptypes = m->ptypes;
 				while(ptypes) {
-					g_snprintf(buffer, sizeof(buffer), " %d", GPOINTER_TO_INT(ptypes->data));
-					g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+					g_string_append_printf(sdp, " %d", GPOINTER_TO_INT(ptypes->data));
 					ptypes = ptypes->next;
 				}
 			} else {
 				/* Something else, use formats */
 				GList *fmts = m->fmts;
 				while(fmts) {
-					g_snprintf(buffer, sizeof(buffer), " %s", (char *)(fmts->data));
-					g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+					g_string_append_printf(sdp, " %s", (char *)(fmts->data));
 					fmts = fmts->next;
 				}
 			}
 		}
-		g_strlcat(sdp, "\r\n", JANUS_BUFSIZE);
+		g_string_append(sdp, "\r\n");
 		/* c= */
 		if(m->c_addr != NULL) {
-			g_snprintf(buffer, sizeof(buffer), "c=IN %s %s\r\n",
+			g_string_append_printf(sdp, "c=IN %s %s\r\n",
 				m->c_ipv4 ? "IP4" : "IP6", m->c_addr);
-			g_strlcat(sdp, buffer, JANUS_BUFSIZE);
 		}
 		if(m->port > 0) {
 			/* b= */
 			if(m->b_name != NULL) {
-				g_snprintf(buffer, sizeof(buffer), "b=%s:%d\r\n", m->b_name, m->b_value);
-				g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+				g_string_append_printf(sdp, "b=%s:%d\r\n", m->b_name, m->b_value);
 			}
 		}
 		/* a= (note that we don't format the direction if it's JANUS_SDP_DEFAULT) */
 		const char *direction = m->direction != JANUS_SDP_DEFAULT ? janus_sdp_mdirection_str(m->direction) : NULL;
 		if(direction != NULL) {
-			g_snprintf(buffer, sizeof(buffer), "a=%s\r\n", direction);
-			g_strlcat(sdp, buffer, JANUS_BUFSIZE);
+			g_string_append_printf(sdp, "a=%s\r\n", direction);
 		}
 		if(m->port == 0) {
 			/* No point going on */
@@ -784,16 +878,15 @@ char *janus_sdp_write(janus_sdp *imported) {
 		while(temp2) {
 			janus_sdp_attribute *a = (janus_sdp_attribute *)temp2->data;
 			if(a->value != NULL) {
-				g_snprintf(buffer, sizeof(buffer), "a=%s:%s\r\n", a->name, a->value);
+				g_string_append_printf(sdp, "a=%s:%s\r\n", a->name, a->value);
 			} else {
-				g_snprintf(buffer, sizeof(buffer), "a=%s\r\n", a->name);
+				g_string_append_printf(sdp, "a=%s\r\n", a->name);
 			}
-			g_strlcat(sdp, buffer, JANUS_BUFSIZE);
 			temp2 = temp2->next;
 		}
 		temp = temp->next;
 	}
-	return sdp;
+	return g_string_free(sdp, FALSE);
 }
 
 void janus_sdp_find_preferred_codecs(janus_sdp *sdp, const char **acodec, const char **vcodec) {
@@ -313,6 +313,51 @@ int janus_sdp_get_codec_pt(janus_sdp *sdp, const char *codec);
  * @returns The codec name, if found, or NULL otherwise */
 const char *janus_sdp_get_codec_name(janus_sdp *sdp, int pt);
 
+/*! \brief Number of codecs janus_sdp_negotiation keeps track of */
+#define JANUS_SDP_NEGOTIATION_CODECS	10
+/*! \brief Maximum number of extmap attributes janus_sdp_negotiation keeps track of */
+#define JANUS_SDP_NEGOTIATION_EXTMAPS	16
+/*! \brief Payload types and RTP extensions of a negotiated session, parsed
+ * once out of a janus_sdp so that they can be looked up at any time
+ * without going through the SDP again */
+typedef struct janus_sdp_negotiation {
+	/*! \brief Codec name (as returned by janus_sdp_get_codec_name) by payload type */
+	const char *codec_name[128];
+	/*! \brief First payload type of each codec we know about, or -1 */
+	int codec_pt[JANUS_SDP_NEGOTIATION_CODECS];
+	/*! \brief RTP extensions (extmap) that were negotiated */
+	struct {
+		int id;
+		char *uri;
+	} extmap[JANUS_SDP_NEGOTIATION_EXTMAPS];
+	/*! \brief Number of negotiated RTP extensions */
+	int extmaps_num;
+	/*! \brief Position+1 in \c extmap by extension ID (0 if not negotiated) */
+	guint8 extmap_index[256];
+} janus_sdp_negotiation;
+
+/*! \brief Helper to parse the payload types and RTP extensions of a Janus SDP instance
+ * @param sdp The Janus SDP instance to process
+ * @returns A pointer to a janus_sdp_negotiation instance, if successful, NULL otherwise */
+janus_sdp_negotiation *janus_sdp_negotiation_create(janus_sdp *sdp);
+/*! \brief Helper to free a janus_sdp_negotiation instance
+ * @param n The janus_sdp_negotiation instance to free */
+void janus_sdp_negotiation_destroy(janus_sdp_negotiation *n);
+/*! \brief Same as janus_sdp_get_codec_pt, but using a parsed negotiation */
+int janus_sdp_negotiation_get_codec_pt(const janus_sdp_negotiation *n, const char *codec);
+/*! \brief Same as janus_sdp_get_codec_name, but using a parsed negotiation */
+const char *janus_sdp_negotiation_get_codec_name(const janus_sdp_negotiation *n, int pt);
+/*! \brief Helper to get the ID of a negotiated RTP extension
+ * @param n The janus_sdp_negotiation instance to query
+ * @param extension The extension namespace to look for (e.g., JANUS_RTP_EXTMAP_AUDIO_LEVEL)
+ * @returns The extension ID, if negotiated, -1 otherwise */
+int janus_sdp_negotiation_get_extmap_id(const janus_sdp_negotiation *n, const char *extension);
+/*! \brief Helper to get the namespace of a negotiated RTP extension
+ * @param n The janus_sdp_negotiation instance to query
+ * @param id The extension ID to look for
+ * @returns The extension namespace, if negotiated, NULL otherwise */
+const char *janus_sdp_negotiation_get_extmap_uri(const janus_sdp_negotiation *n, int id);
+
 /*! \brief Helper to get the rtpmap associated to a specific codec
  * @param codec The codec name, as a string (e.g., "opus")
  * @returns The rtpmap value, if found (e.g., "opus/48000/2"), or -1 otherwise */
@@ -512,8 +512,7 @@ int janus_sdp_process(void *ice_handle, janus_sdp *remote_sdp, gboolean update)
 						memset(stream->audio_rtcp_ctx, 0, sizeof(*stream->audio_rtcp_ctx));
 						stream->audio_rtcp_ctx->tb = 48000;	/* May change later */
 					}
-					if(component->last_seqs_audio)
-						janus_seq_list_free(&component->last_seqs_audio);
+					janus_rtp_seq_window_reset(component->last_seqs_audio);
 					janus_mutex_unlock(&component->mutex);
 				}
 				stream->audio_ssrc_peer = stream->audio_ssrc_peer_new;
@@ -534,8 +533,7 @@ int janus_sdp_process(void *ice_handle, janus_sdp *remote_sdp, gboolean update)
 								memset(stream->video_rtcp_ctx[vindex], 0, sizeof(*stream->video_rtcp_ctx[vindex]));
 								stream->video_rtcp_ctx[vindex]->tb = 90000;
 							}
-							if(component->last_seqs_video[vindex])
-								janus_seq_list_free(&component->last_seqs_video[vindex]);
+							janus_rtp_seq_window_reset(component->last_seqs_video[vindex]);
 							janus_mutex_unlock(&component->mutex);
 						}
 					}
@@ -565,6 +563,8 @@ int janus_sdp_process(void *ice_handle, janus_sdp *remote_sdp, gboolean update)
 		}
 		temp = temp->next;
 	}
+	/* Precompute the SSRC lookup table the ICE loop uses to demultiplex incoming packets */
+	janus_ice_stream_update_ssrc_map(stream);
 	/* Disable RFC4588 if the peer didn't negotiate it */
 	if(!rtx) {
 		janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX);
@@ -927,6 +927,53 @@ int janus_sdp_parse_ssrc(void *ice_stream, const char *ssrc_attr, int video) {
 	return 0;
 }
 
+int janus_sdp_extra_ssrcs(void *ice_handle, janus_sdp *sdp) {
+	if(ice_handle == NULL || sdp == NULL)
+		return 0;
+	janus_ice_handle *handle = (janus_ice_handle *)ice_handle;
+	janus_ice_stream *stream = handle->stream;
+	if(stream == NULL)
+		return 0;
+	janus_ice_extra_ssrc extra[JANUS_ICE_MAX_EXTRA_SSRCS];
+	int num = 0;
+	GList *temp = sdp->m_lines;
+	while(temp) {
+		janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
+		if((m->type == JANUS_SDP_AUDIO || m->type == JANUS_SDP_VIDEO) && m->port > 0) {
+			GList *tempA = m->attributes;
+			while(tempA) {
+				janus_sdp_attribute *a = (janus_sdp_attribute *)tempA->data;
+				tempA = tempA->next;
+				if(a->name == NULL || a->value == NULL || strcasecmp(a->name, "ssrc"))
+					continue;
+				/* We only care about the msid, the rest we'll add ourselves */
+				const char *msid = strstr(a->value, " msid:");
+				if(msid == NULL)
+					continue;
+				msid += strlen(" msid:");
+				guint32 ssrc = strtoul(a->value, NULL, 10);
+				if(ssrc == 0 || ssrc == stream->audio_ssrc || ssrc == stream->video_ssrc || ssrc == stream->video_ssrc_rtx)
+					continue;
+				if(num == JANUS_ICE_MAX_EXTRA_SSRCS) {
+					JANUS_LOG(LOG_WARN, "[%"SCNu64"] Too many additional SSRCs in the plugin SDP, ignoring %"SCNu32"\n",
+						handle->handle_id, ssrc);
+					continue;
+				}
+				extra[num].ssrc = ssrc;
+				extra[num].video = (m->type == JANUS_SDP_VIDEO);
+				g_strlcpy(extra[num].msid, msid, sizeof(extra[num].msid));
+				num++;
+			}
+		}
+		temp = temp->next;
+	}
+	if(num > 0 || g_atomic_int_get(&stream->extra_ssrcs_num) > 0) {
+		JANUS_LOG(LOG_VERB, "[%"SCNu64"] The plugin is multiplexing %d additional SSRCs\n", handle->handle_id, num);
+		janus_ice_stream_set_extra_ssrcs(stream, extra, num);
+	}
+	return num;
+}
+
 int janus_sdp_anonymize(janus_sdp *anon) {
 	if(anon == NULL)
 		return -1;
@@ -1046,6 +1093,32 @@ int janus_sdp_anonymize(janus_sdp *anon) {
 	return 0;
 }
 
+/* Advertise the additional SSRCs a plugin is multiplexing in an m-line, if any */
+static void janus_sdp_merge_extra_ssrcs(janus_ice_stream *stream, janus_sdp_mline *m, gboolean video) {
+	int i = 0, n = g_atomic_int_get(&stream->extra_ssrcs_num);
+	for(i=0; i<n; i++) {
+		janus_ice_extra_ssrc *extra = &stream->extra_ssrcs[i];
+		if(extra->video != video)
+			continue;
+		/* The msid is "<stream> <track>", Plan B endpoints want those as mslabel and label too */
+		char mslabel[96];
+		g_strlcpy(mslabel, extra->msid, sizeof(mslabel));
+		char *label = strchr(mslabel, ' ');
+		if(label != NULL)
+			*label++ = '\0';
+		janus_sdp_attribute *a = janus_sdp_attribute_create("ssrc", "%"SCNu32" cname:%s", extra->ssrc, video ? "janusvideo" : "janusaudio");
+		m->attributes = g_list_append(m->attributes, a);
+		a = janus_sdp_attribute_create("ssrc", "%"SCNu32" msid:%s", extra->ssrc, extra->msid);
+		m->attributes = g_list_append(m->attributes, a);
+		a = janus_sdp_attribute_create("ssrc", "%"SCNu32" mslabel:%s", extra->ssrc, mslabel);
+		m->attributes = g_list_append(m->attributes, a);
+		if(label != NULL) {
+			a = janus_sdp_attribute_create("ssrc", "%"SCNu32" label:%s", extra->ssrc, label);
+			m->attributes = g_list_append(m->attributes, a);
+		}
+	}
+}
+
 // 生成sdp
 char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 	if(ice_handle == NULL || anon == NULL)
@@ -1313,6 +1386,7 @@ char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 			m->attributes = g_list_append(m->attributes, a);
 			a = janus_sdp_attribute_create("ssrc", "%"SCNu32" label:janusa0", stream->audio_ssrc);
 			m->attributes = g_list_append(m->attributes, a);
+			janus_sdp_merge_extra_ssrcs(stream, m, FALSE);
 		} else if(m->type == JANUS_SDP_VIDEO &&
 				(m->direction == JANUS_SDP_DEFAULT || m->direction == JANUS_SDP_SENDRECV || m->direction == JANUS_SDP_SENDONLY)) {
 			a = janus_sdp_attribute_create("ssrc", "%"SCNu32" cname:janusvideo", stream->video_ssrc);
@@ -1323,6 +1397,7 @@ char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 			m->attributes = g_list_append(m->attributes, a);
 			a = janus_sdp_attribute_create("ssrc", "%"SCNu32" label:janusv0", stream->video_ssrc);
 			m->attributes = g_list_append(m->attributes, a);
+			janus_sdp_merge_extra_ssrcs(stream, m, TRUE);
 			if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
 				/* Add rtx SSRC group to negotiate the RFC4588 stuff */
 				a = janus_sdp_attribute_create("ssrc", "%"SCNu32" cname:janusvideo", stream->video_ssrc_rtx);
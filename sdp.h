@@ -80,6 +80,16 @@ int janus_sdp_parse_ssrc_group(void *stream, const char *group_attr, int video);
  * @returns 0 in case of success, a non-zero integer in case of an error */
 int janus_sdp_parse_ssrc(void *stream, const char *ssrc_attr, int video);
 
+/*! \brief Method to take note of the additional SSRCs a plugin SDP advertises, before it's anonymized
+ * \note Plugins multiplexing several streams in the same m-line (e.g., a VideoRoom
+ * listener receiving more feeds) add an \c a=ssrc:<ssrc> \c msid:<stream> \c <track>
+ * attribute for each additional SSRC they'll send: the core will then relay those
+ * packets as they are, and advertise the SSRCs again when merging the SDP
+ * @param[in] handle The ICE handle the plugin SDP is for
+ * @param[in] sdp The Janus SDP description object the plugin provided
+ * @returns The number of additional SSRCs found */
+int janus_sdp_extra_ssrcs(void *handle, janus_sdp *sdp);
+
 /*! \brief Method to strip/anonymize a session description
  * @param[in,out] sdp The Janus SDP description object to strip/anonymize
  * @returns 0 in case of success, a non-zero integer in case of an error */
@@ -33,11 +33,46 @@
 
 #include <errno.h>
 #include <sys/time.h>
+#include <arpa/inet.h>
  
 #include "text2pcap.h"
 #include "debug.h"
 #include "utils.h"
 
+/* Binary dumps: packets are buffered and written by a thread, up to this much */
+#define JANUS_TEXT2PCAP_MAX_PENDING	(4*1024*1024)
+/* How often the writer thread flushes the buffered packets, at most */
+#define JANUS_TEXT2PCAP_FLUSH_INTERVAL	(250*G_TIME_SPAN_MILLISECOND)
+
+/* pcap file header and packet headers (see https://wiki.wireshark.org/Development/LibpcapFileFormat) */
+typedef struct janus_pcap_header {
+	guint32 magic;
+	guint16 version_major, version_minor;
+	gint32 thiszone;
+	guint32 sigfigs;
+	guint32 snaplen;
+	guint32 network;
+} janus_pcap_header;
+typedef struct janus_pcap_packet_header {
+	guint32 ts_sec, ts_usec;
+	guint32 incl_len, orig_len;
+} janus_pcap_packet_header;
+/* Fake IPv4 and UDP headers */
+typedef struct janus_pcap_ipv4_header {
+	guint8 version_ihl, tos;
+	guint16 length, id, fragment;
+	guint8 ttl, protocol;
+	guint16 checksum;
+	guint32 src, dst;
+} janus_pcap_ipv4_header;
+typedef struct janus_pcap_udp_header {
+	guint16 src_port, dst_port;
+	guint16 length, checksum;
+} janus_pcap_udp_header;
+#define JANUS_PCAP_MAGIC		0xa1b2c3d4
+#define JANUS_PCAP_LINKTYPE_RAW	101
+#define JANUS_PCAP_SNAPLEN		65535
+
 #define CASE_STR(name) case name: return #name
 const char *janus_text2pcap_packet_string(janus_text2pcap_packet type) {
 	switch(type) {
@@ -50,7 +85,61 @@ const char *janus_text2pcap_packet_string(janus_text2pcap_packet type) {
 	return NULL;
 }
 
-janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, int truncate) {
+int janus_text2pcap_format_from_string(const char *name) {
+	if(name == NULL || !strcasecmp(name, "text"))
+		return JANUS_TEXT2PCAP_FORMAT_TEXT;
+	if(!strcasecmp(name, "pcap"))
+		return JANUS_TEXT2PCAP_FORMAT_PCAP;
+	return -1;
+}
+
+static int janus_text2pcap_write(FILE *file, const char *buffer, size_t buflen) {
+	size_t temp = 0, tot = buflen;
+	while(tot > 0) {
+		temp = fwrite(buffer+buflen-tot, sizeof(char), tot, file);
+		if(temp <= 0)
+			return -1;
+		tot -= temp;
+	}
+	return 0;
+}
+
+/* Thread writing binary dumps, so that the media path only has to copy packets */
+static void *janus_text2pcap_writer(void *data) {
+	janus_text2pcap *instance = (janus_text2pcap *)data;
+	GByteArray *packets = g_byte_array_sized_new(65536);
+	gboolean done = FALSE;
+	while(!done) {
+		janus_mutex_lock_nodebug(&instance->mutex);
+		if(g_atomic_int_get(&instance->writable) && instance->pending->len == 0) {
+			gint64 end = g_get_real_time() + JANUS_TEXT2PCAP_FLUSH_INTERVAL;
+			struct timespec ts;
+			ts.tv_sec = end / G_USEC_PER_SEC;
+			ts.tv_nsec = (end % G_USEC_PER_SEC) * 1000;
+			janus_condition_timedwait(&instance->cond, &instance->mutex, &ts);
+		}
+		done = !g_atomic_int_get(&instance->writable);
+		/* Swap the buffers, and write the packets without holding the lock */
+		GByteArray *tmp = instance->pending;
+		instance->pending = packets;
+		packets = tmp;
+		guint dropped = instance->dropped;
+		instance->dropped = 0;
+		janus_mutex_unlock_nodebug(&instance->mutex);
+		if(dropped > 0)
+			JANUS_LOG(LOG_WARN, "Dropped %u packets while dumping to %s, writer falling behind\n", dropped, instance->filename);
+		if(packets->len > 0) {
+			if(janus_text2pcap_write(instance->file, (const char *)packets->data, packets->len) < 0)
+				JANUS_LOG(LOG_ERR, "Error dumping packets to %s...\n", instance->filename);
+			fflush(instance->file);
+			g_byte_array_set_size(packets, 0);
+		}
+	}
+	g_byte_array_free(packets, TRUE);
+	return NULL;
+}
+
+janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, int truncate, janus_text2pcap_format format) {
 	janus_text2pcap *tp;
 	char newname[1024];
 	char *fname;
@@ -62,7 +151,8 @@ janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, i
 	/* Copy given filename or generate a random one */
 	if (filename == NULL)
 		g_snprintf(newname, sizeof(newname),
-		    "janus-text2pcap-%"SCNu32".txt", janus_random_uint32());
+		    "janus-text2pcap-%"SCNu32".%s", janus_random_uint32(),
+			format == JANUS_TEXT2PCAP_FORMAT_PCAP ? "pcap" : "txt");
 	else
 		g_strlcpy(newname, filename, sizeof(newname));
 
@@ -85,49 +175,148 @@ janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, i
 		g_free(fname);
 		return NULL;
 	}
+	if(format == JANUS_TEXT2PCAP_FORMAT_PCAP) {
+		/* If this is a new file, write the pcap header first */
+		fseek(f, 0, SEEK_END);
+		if(ftell(f) == 0) {
+			janus_pcap_header header = {
+				.magic = JANUS_PCAP_MAGIC,
+				.version_major = 2,
+				.version_minor = 4,
+				.thiszone = 0,
+				.sigfigs = 0,
+				.snaplen = JANUS_PCAP_SNAPLEN,
+				.network = JANUS_PCAP_LINKTYPE_RAW
+			};
+			if(janus_text2pcap_write(f, (const char *)&header, sizeof(header)) < 0) {
+				JANUS_LOG(LOG_ERR, "Error writing pcap header to %s...\n", fname);
+				fclose(f);
+				g_free(fname);
+				return NULL;
+			}
+		}
+	}
 
 	/* Create the text2pcap instance */
-	tp = g_malloc(sizeof(janus_text2pcap));
+	tp = g_malloc0(sizeof(janus_text2pcap));
 	tp->filename = fname;
 	tp->file = f;
 	tp->truncate = truncate;
+	tp->format = format;
 	g_atomic_int_set(&tp->writable, 1);
 	janus_mutex_init(&tp->mutex);
+	janus_condition_init(&tp->cond);
+	if(format == JANUS_TEXT2PCAP_FORMAT_PCAP) {
+		tp->pending = g_byte_array_sized_new(65536);
+		GError *error = NULL;
+		tp->writer = g_thread_try_new("text2pcap", &janus_text2pcap_writer, tp, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the text2pcap writer thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_byte_array_free(tp->pending, TRUE);
+			janus_mutex_destroy(&tp->mutex);
+			janus_condition_destroy(&tp->cond);
+			fclose(f);
+			g_free(fname);
+			g_free(tp);
+			return NULL;
+		}
+	}
 
 	return tp;
 }
 
-int janus_text2pcap_dump(janus_text2pcap *instance,
-		janus_text2pcap_packet type, gboolean incoming, char *buf, int len, const char *format, ...) {
-	if(instance == NULL || buf == NULL || len < 1)
-		return -1;
+/* Binary dumps: just queue the packet, with its fake headers, for the writer thread */
+static int janus_text2pcap_dump_pcap(janus_text2pcap *instance, gboolean incoming, char *buf, int len) {
+	int stop = instance->truncate ? (len > instance->truncate ? instance->truncate : len) : len;
+	if(stop > JANUS_PCAP_SNAPLEN - (int)(sizeof(janus_pcap_ipv4_header) + sizeof(janus_pcap_udp_header)))
+		stop = JANUS_PCAP_SNAPLEN - sizeof(janus_pcap_ipv4_header) - sizeof(janus_pcap_udp_header);
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	janus_pcap_packet_header ph;
+	ph.ts_sec = tv.tv_sec;
+	ph.ts_usec = tv.tv_usec;
+	ph.orig_len = sizeof(janus_pcap_ipv4_header) + sizeof(janus_pcap_udp_header) + len;
+	ph.incl_len = sizeof(janus_pcap_ipv4_header) + sizeof(janus_pcap_udp_header) + stop;
+	/* The lengths in the fake headers are those of the original packet */
+	guint16 iplen = ph.orig_len > 65535 ? 65535 : ph.orig_len;
+	janus_pcap_ipv4_header ip = {
+		.version_ihl = 0x45,
+		.length = htons(iplen),
+		.ttl = 64,
+		.protocol = 17,
+		.src = htonl(incoming ? 0x0A000002 : 0x0A000001),
+		.dst = htonl(incoming ? 0x0A000001 : 0x0A000002)
+	};
+	/* Compute the IP header checksum, so that Wireshark doesn't complain */
+	guint32 sum = 0;
+	guint16 *words = (guint16 *)&ip;
+	size_t i = 0;
+	for(i=0; i<sizeof(ip)/2; i++)
+		sum += words[i];
+	while(sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	ip.checksum = ~sum;
+	janus_pcap_udp_header udp = {
+		.src_port = htons(incoming ? 2000 : 1000),
+		.dst_port = htons(incoming ? 1000 : 2000),
+		.length = htons(iplen - sizeof(janus_pcap_ipv4_header)),
+		.checksum = 0
+	};
 	janus_mutex_lock_nodebug(&instance->mutex);
 	if(instance->file == NULL || !g_atomic_int_get(&instance->writable)) {
 		janus_mutex_unlock_nodebug(&instance->mutex);
 		return -1;
 	}
+	if(instance->pending->len + ph.incl_len + sizeof(ph) > JANUS_TEXT2PCAP_MAX_PENDING) {
+		/* The writer thread is falling behind, drop the packet rather than waiting */
+		instance->dropped++;
+		janus_mutex_unlock_nodebug(&instance->mutex);
+		return -2;
+	}
+	/* Wake the writer thread up early if there's a lot to write already */
+	gboolean wakeup = (instance->pending->len < 65536);
+	g_byte_array_append(instance->pending, (const guint8 *)&ph, sizeof(ph));
+	g_byte_array_append(instance->pending, (const guint8 *)&ip, sizeof(ip));
+	g_byte_array_append(instance->pending, (const guint8 *)&udp, sizeof(udp));
+	g_byte_array_append(instance->pending, (const guint8 *)buf, stop);
+	if(wakeup && instance->pending->len >= 65536)
+		janus_condition_signal(&instance->cond);
+	janus_mutex_unlock_nodebug(&instance->mutex);
+	return 0;
+}
+
+int janus_text2pcap_dump(janus_text2pcap *instance,
+		janus_text2pcap_packet type, gboolean incoming, char *buf, int len, const char *format, ...) {
+	if(instance == NULL || buf == NULL || len < 1)
+		return -1;
+	if(instance->format == JANUS_TEXT2PCAP_FORMAT_PCAP)
+		return janus_text2pcap_dump_pcap(instance, incoming, buf, len);
 	/* Prepare text representation of the packet */
-	char buffer[5000], timestamp[20], usec[10], byte[10];
+	static const char hex[] = "0123456789abcdef";
+	char buffer[5000], timestamp[20], usec[10];
 	memset(timestamp, 0, sizeof(timestamp));
 	memset(usec, 0, sizeof(usec));
 	time_t t = time(NULL);
-	struct tm *tm = localtime(&t);
+	struct tm tm;
+	localtime_r(&t, &tm);
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
-	strftime(timestamp, sizeof(timestamp), "%H:%M:%S", tm);
+	strftime(timestamp, sizeof(timestamp), "%H:%M:%S", &tm);
 	g_snprintf(usec, sizeof(usec), ".%ld", tv.tv_usec);
 	g_strlcat(timestamp, usec, sizeof(timestamp));
-	memset(buffer, 0, sizeof(buffer));
-	g_snprintf(buffer, sizeof(buffer), "%s %s 000000 ", incoming ? "I" : "O", timestamp);
+	int offset = g_snprintf(buffer, sizeof(buffer), "%s %s 000000 ", incoming ? "I" : "O", timestamp);
 	int i=0;
 	int stop = instance->truncate ? (len > instance->truncate ? instance->truncate : len) : len;
-	for(i=0; i<stop; i++) {
-		memset(byte, 0, sizeof(byte));
-		g_snprintf(byte, sizeof(byte), " %02x", (unsigned char)buf[i]);
-		g_strlcat(buffer, byte, sizeof(buffer));
+	/* Leave room for the packet type, the custom string and the line ending */
+	int room = sizeof(buffer) - 600;
+	for(i=0; i<stop && offset+3 < room; i++) {
+		buffer[offset++] = ' ';
+		buffer[offset++] = hex[((unsigned char)buf[i]) >> 4];
+		buffer[offset++] = hex[((unsigned char)buf[i]) & 0x0F];
 	}
-	g_strlcat(buffer, " ", sizeof(buffer));
-	g_strlcat(buffer, janus_text2pcap_packet_string(type), sizeof(buffer));
+	offset += g_snprintf(buffer+offset, sizeof(buffer)-offset, " %s", janus_text2pcap_packet_string(type));
 	if(format) {
 		/* This callback has variable arguments (error string) */
 		char custom[512];
@@ -135,20 +324,23 @@ int janus_text2pcap_dump(janus_text2pcap *instance,
 		va_start(ap, format);
 		g_vsnprintf(custom, sizeof(custom), format, ap);
 		va_end(ap);
-		g_strlcat(buffer, " ", sizeof(buffer));
-		g_strlcat(buffer, custom, sizeof(buffer));
+		offset += g_snprintf(buffer+offset, sizeof(buffer)-offset, " %s", custom);
 	}
-	g_strlcat(buffer, "\r\n", sizeof(buffer));
+	if(offset > (int)sizeof(buffer)-3)
+		offset = sizeof(buffer)-3;
+	buffer[offset++] = '\r';
+	buffer[offset++] = '\n';
+	buffer[offset] = '\0';
 	/* Save textified packet on file */
-	int temp = 0, buflen = strlen(buffer), tot = buflen;
-	while(tot > 0) {
-		temp = fwrite(buffer+buflen-tot, sizeof(char), tot, instance->file);
-		if(temp <= 0) {
-			JANUS_LOG(LOG_ERR, "Error dumping packet...\n");
-			janus_mutex_unlock_nodebug(&instance->mutex);
-			return -2;
-		}
-		tot -= temp;
+	janus_mutex_lock_nodebug(&instance->mutex);
+	if(instance->file == NULL || !g_atomic_int_get(&instance->writable)) {
+		janus_mutex_unlock_nodebug(&instance->mutex);
+		return -1;
+	}
+	if(janus_text2pcap_write(instance->file, buffer, offset) < 0) {
+		JANUS_LOG(LOG_ERR, "Error dumping packet...\n");
+		janus_mutex_unlock_nodebug(&instance->mutex);
+		return -2;
 	}
 	/* Done */
 	janus_mutex_unlock_nodebug(&instance->mutex);
@@ -163,6 +355,14 @@ int janus_text2pcap_close(janus_text2pcap *instance) {
 		janus_mutex_unlock_nodebug(&instance->mutex);
 		return 0;
 	}
+	janus_condition_signal(&instance->cond);
+	janus_mutex_unlock_nodebug(&instance->mutex);
+	if(instance->writer != NULL) {
+		/* Wait for the writer thread to flush what's left */
+		g_thread_join(instance->writer);
+		instance->writer = NULL;
+	}
+	janus_mutex_lock_nodebug(&instance->mutex);
 	fclose(instance->file);
 	instance->file = NULL;
 	janus_mutex_unlock_nodebug(&instance->mutex);
@@ -173,6 +373,9 @@ void janus_text2pcap_free(janus_text2pcap *instance) {
 	if(instance == NULL)
 		return;
 	janus_text2pcap_close(instance);
+	if(instance->pending != NULL)
+		g_byte_array_free(instance->pending, TRUE);
+	janus_condition_destroy(&instance->cond);
 	g_free(instance->filename);
 	g_free(instance);
 }
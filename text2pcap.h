@@ -20,6 +20,13 @@
  * of that section for more details. Notice that starting a new dump on
  * an existing filename will result in the new packets to be appended.
  *
+ * Since formatting each packet as text is expensive, packets can also
+ * be saved directly in the binary \c .pcap format, wrapped in fake IPv4
+ * and UDP headers (port 1000 for Janus, 2000 for the peer): in that case
+ * packets are only copied in a buffer on the media path, and a dedicated
+ * thread takes care of writing them to the file. The resulting file can
+ * be opened in Wireshark as it is, with no need for \c text2pcap .
+ *
  * \note Motivation and inspiration for this work came from a
  * <a href="https://blog.mozilla.org/webrtc/debugging-encrypted-rtp-is-more-fun-than-it-used-to-be/">similar effort</a>
  * recently done in Firefox, and from a discussion related to a
@@ -43,6 +50,18 @@
 
 #include "mutex.h"
 
+/*! \brief Formats we can dump packets in */
+typedef enum janus_text2pcap_format {
+	/*! \brief Text format, to convert via text2pcap */
+	JANUS_TEXT2PCAP_FORMAT_TEXT = 0,
+	/*! \brief Binary pcap format, with fake IPv4/UDP headers */
+	JANUS_TEXT2PCAP_FORMAT_PCAP
+} janus_text2pcap_format;
+/*! \brief Helper method to parse a format name (\c text or \c pcap)
+ * @param[in] name The format name
+ * @returns The format, or -1 if the name is invalid */
+int janus_text2pcap_format_from_string(const char *name);
+
 /*! \brief Instance of a text2pcap recorder */
 typedef struct janus_text2pcap {
 	/*! \brief Absolute path to where the text2pcap file is stored */ 
@@ -51,6 +70,16 @@ typedef struct janus_text2pcap {
 	FILE *file;
 	/*! \brief Number of bytes to truncate at */
 	int truncate;
+	/*! \brief Format packets are dumped in */
+	janus_text2pcap_format format;
+	/*! \brief Packets waiting to be written by the writer thread (binary format only) */
+	GByteArray *pending;
+	/*! \brief Number of packets dropped because the writer thread was falling behind */
+	guint dropped;
+	/*! \brief Writer thread (binary format only) */
+	GThread *writer;
+	/*! \brief Condition to wake the writer thread up */
+	janus_condition cond;
 	/*! \brief Whether we can write to this file or not */
 	volatile int writable;
 	/*! \brief Mutex to lock/unlock this recorder instance */ 
@@ -71,8 +100,9 @@ const char *janus_text2pcap_packet_string(janus_text2pcap_packet type);
  * @param[in] dir Path of the directory to save the recording into (will try to create it if it doesn't exist)
  * @param[in] filename Filename to use for the recording
  * @param[in] truncate Number of bytes to truncate each packet at (0 to not truncate at all)
+ * @param[in] format Format to save the packets in
  * @returns A valid janus_text2pcap instance in case of success, NULL otherwise */
-janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, int truncate);
+janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, int truncate, janus_text2pcap_format format);
 
 /*! \brief Dump an RTP or RTCP packet
  * @param[in] instance Instance of the janus_text2pcap recorder to dump the packet to
@@ -81,6 +111,7 @@ janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, i
  * @param[in] buf Packet data to dump
  * @param[in] len Size of the packet data to dump
  * @param[in] format Format for the optional string to append to the line, if any
+ * \note The optional string is ignored when dumping to the binary pcap format
  * @returns 0 in case of success, a negative integer otherwise */
 int janus_text2pcap_dump(janus_text2pcap *instance,
 	janus_text2pcap_packet type, gboolean incoming, char *buf, int len, const char *format, ...) G_GNUC_PRINTF(6, 7);
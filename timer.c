@@ -0,0 +1,293 @@
+/*! \file    timer.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared timer service
+ * \details  Implementation of a simple timer service that plugins can use
+ * to drive loops that need to do something at precise times, e.g., mixers
+ * preparing a frame every 20ms, or file sources sending packets at the
+ * pace their timestamps dictate. Each timer thread keeps its tasks sorted
+ * by deadline, and waits on a condition bound to the monotonic clock
+ * until the earliest one is due: this way new tasks can still wake the
+ * thread up, while there's no need to poll the clock in the meanwhile.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "timer.h"
+#include "debug.h"
+#include "mutex.h"
+#include "utils.h"
+#include "affinity.h"
+
+/* Timer thread: either shared by several tasks (pool) or dedicated to one */
+typedef struct janus_timer_thread {
+	GThread *thread;
+	GList *tasks;		/* Sorted by deadline */
+	gboolean dedicated;
+	/* NUMA node the thread is pinned to, if any */
+	int node;
+	volatile gint stop;
+	janus_mutex mutex;
+	janus_condition cond;
+} janus_timer_thread;
+
+struct janus_timer_task {
+	char *name;
+	janus_timer_callback callback;
+	gpointer user_data;
+	gint64 next;
+	gboolean done, detached;
+};
+
+/* Pool of shared threads, if configured */
+static janus_timer_thread **pool = NULL;
+static int pool_size = 0;
+static volatile gint pool_next = 0;
+/* Used to track when tasks are done, for joining/detaching */
+static janus_mutex tasks_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_condition tasks_cond = PTHREAD_COND_INITIALIZER;
+
+
+static void janus_timer_task_done(janus_timer_task *task) {
+	janus_mutex_lock(&tasks_mutex);
+	task->done = TRUE;
+	if(task->detached) {
+		g_free(task->name);
+		g_free(task);
+	} else {
+		janus_condition_broadcast(&tasks_cond);
+	}
+	janus_mutex_unlock(&tasks_mutex);
+}
+
+static gint janus_timer_task_compare(gconstpointer a, gconstpointer b) {
+	const janus_timer_task *ta = (const janus_timer_task *)a, *tb = (const janus_timer_task *)b;
+	return ta->next < tb->next ? -1 : (ta->next > tb->next ? 1 : 0);
+}
+
+/* Wait on the thread condition until the provided monotonic time: the mutex must be locked */
+static void janus_timer_thread_wait(janus_timer_thread *tt, gint64 when) {
+	struct timespec ts;
+#ifdef __MACH__
+	/* No monotonic conditions here, convert to the realtime clock */
+	gint64 delay = when - janus_get_monotonic_time();
+	if(delay < 0)
+		delay = 0;
+	when = g_get_real_time() + delay;
+#endif
+	ts.tv_sec = when / G_USEC_PER_SEC;
+	ts.tv_nsec = (when % G_USEC_PER_SEC) * 1000;
+	janus_condition_timedwait(&tt->cond, &tt->mutex, &ts);
+}
+
+static void janus_timer_thread_destroy(janus_timer_thread *tt) {
+	janus_mutex_destroy(&tt->mutex);
+	janus_condition_destroy(&tt->cond);
+	g_free(tt);
+}
+
+static void *janus_timer_thread_run(void *data) {
+	janus_timer_thread *tt = (janus_timer_thread *)data;
+	JANUS_LOG(LOG_VERB, "Timer thread started (%s)\n", tt->dedicated ? "dedicated" : "pool");
+	janus_affinity_pin_thread(tt->node);
+	janus_mutex_lock(&tt->mutex);
+	while(!g_atomic_int_get(&tt->stop)) {
+		if(tt->tasks == NULL) {
+			if(tt->dedicated)
+				break;
+			janus_condition_wait(&tt->cond, &tt->mutex);
+			continue;
+		}
+		janus_timer_task *task = (janus_timer_task *)tt->tasks->data;
+		gint64 now = janus_get_monotonic_time();
+		if(task->next > now) {
+			janus_timer_thread_wait(tt, task->next);
+			continue;
+		}
+		/* The task is due: invoke the callback without holding the lock */
+		tt->tasks = g_list_delete_link(tt->tasks, tt->tasks);
+		janus_mutex_unlock(&tt->mutex);
+		gint64 lateness = now - task->next;
+		if(lateness > 5000)
+			JANUS_LOG(LOG_HUGE, "Timer task '%s' is late (%"SCNi64"us)\n", task->name, lateness);
+		task->next = task->callback(now, task->user_data);
+		if(task->next < 0) {
+			janus_timer_task_done(task);
+			janus_mutex_lock(&tt->mutex);
+			continue;
+		}
+		janus_mutex_lock(&tt->mutex);
+		tt->tasks = g_list_insert_sorted(tt->tasks, task, janus_timer_task_compare);
+	}
+	/* Any task still here (we're shutting down) is considered done */
+	GList *tasks = tt->tasks;
+	tt->tasks = NULL;
+	janus_mutex_unlock(&tt->mutex);
+	GList *tmp = tasks;
+	while(tmp) {
+		janus_timer_task *task = (janus_timer_task *)tmp->data;
+		JANUS_LOG(LOG_WARN, "Timer task '%s' still active, stopping it\n", task->name);
+		janus_timer_task_done(task);
+		tmp = tmp->next;
+	}
+	g_list_free(tasks);
+	JANUS_LOG(LOG_VERB, "Timer thread leaving\n");
+	if(tt->dedicated) {
+		/* Nobody's going to join us, clean up ourselves */
+		janus_timer_thread_destroy(tt);
+	}
+	return NULL;
+}
+
+static janus_timer_thread *janus_timer_thread_create(gboolean dedicated, int node) {
+	janus_timer_thread *tt = g_malloc0(sizeof(janus_timer_thread));
+	tt->dedicated = dedicated;
+	tt->node = node;
+	janus_mutex_init(&tt->mutex);
+#ifndef __MACH__
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&tt->cond, &attr);
+	pthread_condattr_destroy(&attr);
+#else
+	janus_condition_init(&tt->cond);
+#endif
+	return tt;
+}
+
+static GThread *janus_timer_thread_start(janus_timer_thread *tt, const char *name) {
+	GError *error = NULL;
+	GThread *thread = g_thread_try_new(name, janus_timer_thread_run, tt, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the timer thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		return NULL;
+	}
+	return thread;
+}
+
+
+int janus_timer_init(int threads) {
+	if(threads < 0)
+		threads = 0;
+	if(threads == 0) {
+		JANUS_LOG(LOG_INFO, "Timer tasks will be driven by dedicated threads\n");
+		return 0;
+	}
+	pool = g_malloc0(threads * sizeof(janus_timer_thread *));
+	/* When NUMA aware, pool threads are spread evenly across the nodes */
+	int i = 0, nodes = janus_affinity_get_nodes();
+	for(i=0; i<threads; i++) {
+		janus_timer_thread *tt = janus_timer_thread_create(FALSE, nodes > 1 ? (i % nodes) : -1);
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "timer %d", i);
+		tt->thread = janus_timer_thread_start(tt, tname);
+		if(tt->thread == NULL) {
+			janus_timer_thread_destroy(tt);
+			break;
+		}
+		pool[i] = tt;
+	}
+	pool_size = i;
+	if(pool_size == 0) {
+		g_free(pool);
+		pool = NULL;
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "Timer tasks will be driven by a pool of %d threads\n", pool_size);
+	return 0;
+}
+
+void janus_timer_deinit(void) {
+	int i = 0;
+	for(i=0; i<pool_size; i++) {
+		janus_timer_thread *tt = pool[i];
+		janus_mutex_lock(&tt->mutex);
+		g_atomic_int_set(&tt->stop, 1);
+		janus_condition_signal(&tt->cond);
+		janus_mutex_unlock(&tt->mutex);
+		g_thread_join(tt->thread);
+		janus_timer_thread_destroy(tt);
+	}
+	g_free(pool);
+	pool = NULL;
+	pool_size = 0;
+}
+
+janus_timer_task *janus_timer_add(const char *name, gint64 first, janus_timer_callback callback, gpointer user_data) {
+	return janus_timer_add_placed(name, first, callback, user_data, 0);
+}
+
+janus_timer_task *janus_timer_add_placed(const char *name, gint64 first, janus_timer_callback callback, gpointer user_data, guint64 group) {
+	if(callback == NULL)
+		return NULL;
+	janus_timer_task *task = g_malloc0(sizeof(janus_timer_task));
+	task->name = g_strdup(name ? name : "timer task");
+	task->callback = callback;
+	task->user_data = user_data;
+	task->next = first;
+	JANUS_LOG(LOG_VERB, "Adding timer task '%s'\n", task->name);
+	int node = janus_affinity_group_node(group);
+	if(pool_size > 0) {
+		/* Assign tasks to the pool threads in a round robin fashion, only
+		 * considering those on the node of the group, if there's any */
+		guint next = (guint)g_atomic_int_add(&pool_next, 1);
+		janus_timer_thread *tt = pool[next % pool_size];
+		int nodes = janus_affinity_get_nodes();
+		if(node >= 0 && pool_size >= nodes) {
+			/* Pool threads are on node i % nodes: pick one of those on ours */
+			guint threads = (pool_size - node + nodes - 1) / nodes;
+			tt = pool[node + (next % threads) * nodes];
+		}
+		janus_mutex_lock(&tt->mutex);
+		tt->tasks = g_list_insert_sorted(tt->tasks, task, janus_timer_task_compare);
+		janus_condition_signal(&tt->cond);
+		janus_mutex_unlock(&tt->mutex);
+		return task;
+	}
+	/* No pool, spawn a dedicated thread: it will clean up after itself when the task is done */
+	janus_timer_thread *tt = janus_timer_thread_create(TRUE, node);
+	tt->tasks = g_list_append(NULL, task);
+	GThread *thread = janus_timer_thread_start(tt, task->name);
+	if(thread == NULL) {
+		g_list_free(tt->tasks);
+		janus_timer_thread_destroy(tt);
+		g_free(task->name);
+		g_free(task);
+		return NULL;
+	}
+	g_thread_unref(thread);
+	return task;
+}
+
+void janus_timer_join(janus_timer_task *task) {
+	if(task == NULL)
+		return;
+	janus_mutex_lock(&tasks_mutex);
+	while(!task->done)
+		janus_condition_wait(&tasks_cond, &tasks_mutex);
+	janus_mutex_unlock(&tasks_mutex);
+	g_free(task->name);
+	g_free(task);
+}
+
+void janus_timer_detach(janus_timer_task *task) {
+	if(task == NULL)
+		return;
+	janus_mutex_lock(&tasks_mutex);
+	if(task->done) {
+		g_free(task->name);
+		g_free(task);
+	} else {
+		task->detached = TRUE;
+	}
+	janus_mutex_unlock(&tasks_mutex);
+}
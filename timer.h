@@ -0,0 +1,74 @@
+/*! \file    timer.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared timer service (headers)
+ * \details  Implementation of a simple timer service that plugins can use
+ * to drive loops that need to do something at precise times, e.g., mixers
+ * preparing a frame every 20ms, or file sources sending packets at the
+ * pace their timestamps dictate. Rather than having each of those loops
+ * in its own thread, polling the clock every few milliseconds, loops are
+ * registered as tasks: a task is a callback that is invoked at the time
+ * it asked for, and that returns the next time it wants to be invoked.
+ * Threads sleep until the earliest deadline of the tasks they're
+ * responsible for, using absolute monotonic timers, which means less
+ * wakeups and less jitter. By default each task gets a dedicated thread,
+ * while janus_timer_init can be used to have a small pool of threads
+ * drive all of them instead.
+ * \note Since tasks on the same pool thread are invoked one after the
+ * other, callbacks must never block: a slow task delays the others.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _JANUS_TIMER_H
+#define _JANUS_TIMER_H
+
+#include <glib.h>
+
+/*! \brief Timer task callback
+ * @param[in] now The current monotonic time, in microseconds
+ * @param[in] user_data The opaque pointer provided when adding the task
+ * @returns The monotonic time when the task should be invoked next, or
+ * a negative value if the task is done and should be removed */
+typedef gint64 (*janus_timer_callback)(gint64 now, gpointer user_data);
+
+/*! \brief Timer task, opaque */
+typedef struct janus_timer_task janus_timer_task;
+
+/*! \brief Initialize the timer service
+ * @param[in] threads Number of threads that should drive all the timer
+ * tasks, or 0 to have each task driven by its own dedicated thread
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_timer_init(int threads);
+/*! \brief De-initialize the timer service */
+void janus_timer_deinit(void);
+
+/*! \brief Add a new task to the timer service
+ * \note The task must either be joined, via janus_timer_join, or detached,
+ * via janus_timer_detach, in the same way as threads are
+ * @param[in] name Name of the task, for debugging purposes
+ * @param[in] first Monotonic time when the callback should be invoked first
+ * @param[in] callback Callback to invoke
+ * @param[in] user_data Opaque pointer to pass to the callback
+ * @returns A pointer to the new task in case of success, NULL otherwise */
+janus_timer_task *janus_timer_add(const char *name, gint64 first, janus_timer_callback callback, gpointer user_data);
+/*! \brief Add a new task to the timer service, placing it on the NUMA node of a group
+ * \note Same as janus_timer_add, but when media threads are NUMA aware (see affinity.h) the
+ * task is driven by a thread on the node the peers of the group (e.g., a room) are served on
+ * @param[in] name Name of the task, for debugging purposes
+ * @param[in] first Monotonic time when the callback should be invoked first
+ * @param[in] callback Callback to invoke
+ * @param[in] user_data Opaque pointer to pass to the callback
+ * @param[in] group The placement group, or 0 for none
+ * @returns A pointer to the new task in case of success, NULL otherwise */
+janus_timer_task *janus_timer_add_placed(const char *name, gint64 first, janus_timer_callback callback, gpointer user_data, guint64 group);
+/*! \brief Wait for a task to be done (i.e., its callback returned a negative
+ * value), and then free it: must never be called from the task callback
+ * @param[in] task The task to join */
+void janus_timer_join(janus_timer_task *task);
+/*! \brief Let a task free itself when it's done, without waiting for it
+ * @param[in] task The task to detach */
+void janus_timer_detach(janus_timer_task *task);
+
+#endif
@@ -42,6 +42,7 @@
 #include "../mutex.h"
 #include "../ip-utils.h"
 #include "../utils.h"
+#include "../metrics.h"
 
 
 /* Transport plugin information */
@@ -106,8 +107,16 @@ static gboolean http_janus_api_enabled = FALSE;
 static gboolean http_admin_api_enabled = FALSE;
 static gboolean notify_events = TRUE;
 
+/* Whether long polls should be suspended, rather than keeping a thread busy */
+#if MHD_VERSION >= 0x00093400
+#define JANUS_HTTP_SUSPEND_RESUME	MHD_USE_SUSPEND_RESUME
+#else
+#define JANUS_HTTP_SUSPEND_RESUME	0
+#endif
+static gboolean long_poll_suspend = FALSE;
+
 /* JSON serialization options */
-static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+static size_t json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 
 
 /* Incoming HTTP message */
@@ -123,6 +132,9 @@ typedef struct janus_http_msg {
 	janus_condition wait_cond;			/* Response condition */
 	gboolean got_response;				/* Whether this message got a response from the core */
 	json_t *response;					/* The response from the core */
+	int max_events;						/* How many events this long poll can return, when suspended */
+	gint64 poll_deadline;				/* When this suspended long poll should be turned into a keepalive */
+	int suspended;						/* Whether this long poll is suspended (1) or has been resumed (2) */
 } janus_http_msg;
 static GHashTable *messages = NULL;
 static janus_mutex messages_mutex = JANUS_MUTEX_INITIALIZER;
@@ -132,6 +144,7 @@ static janus_mutex messages_mutex = JANUS_MUTEX_INITIALIZER;
 typedef struct janus_http_session {
 	GAsyncQueue *events;	/* Events to notify for this session */
 	gint64 destroyed;		/* Whether this session has been destroyed */
+	GList *polls;			/* Suspended long polls waiting for events, if any */
 } janus_http_session;
 /* We keep track of created sessions as we handle long polls */
 const char *keepalive_id = "keepalive";
@@ -155,6 +168,10 @@ int janus_http_headers(void *cls, enum MHD_ValueKind kind, const char *key, cons
 void janus_http_request_completed (void *cls, struct MHD_Connection *connection, void **con_cls, enum MHD_RequestTerminationCode toe);
 /* Worker to handle requests that are actually long polls */
 int janus_http_notifier(janus_http_msg *msg, int max_events);
+/* Helper to resume suspended long polls of a session (all of them, the first one, or those that expired) */
+static void janus_http_resume_polls(janus_http_session *session, gboolean all, gint64 now);
+/* Helper to answer a long poll that has been resumed */
+static int janus_http_resumed_poll(janus_http_msg *msg);
 /* Helper to quickly send a success response */
 int janus_http_return_success(janus_http_msg *msg, char *payload);
 /* Helper to quickly send an error response */
@@ -169,6 +186,8 @@ static char *cert_pem_bytes = NULL, *cert_key_bytes = NULL;
 /* Admin/Monitor MHD Web Server */
 static struct MHD_Daemon *admin_ws = NULL, *admin_sws = NULL;
 static char *admin_ws_path = NULL;
+/* Path to export the core metrics on, if enabled */
+static char *admin_metrics_path = NULL;
 
 /* Custom Access-Control-Allow-Origin value, if specified */
 static char *allow_origin = NULL;
@@ -250,6 +269,8 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 		const char *server_pem, const char *server_key, const char *password) {
 	struct MHD_Daemon *daemon = NULL;
 	gboolean secure = server_pem && server_key;
+	/* Long polls can only be suspended on the Janus API, when using a thread pool */
+	unsigned int suspend = (!admin && long_poll_suspend) ? JANUS_HTTP_SUSPEND_RESUME : 0;
 	/* Any interface or IP address we need to limit ourselves to?
 	 * NOTE WELL: specifying an interface does NOT bind to all IPs associated
 	 * with that interface, but only to the first one that's detected */
@@ -404,7 +425,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				JANUS_LOG(LOG_VERB, "Binding to all interfaces for the %s API %s webserver\n",
 					admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 				daemon = MHD_start_daemon(
-					MHD_USE_SELECT_INTERNALLY | MHD_USE_DUAL_STACK,
+					MHD_USE_SELECT_INTERNALLY | MHD_USE_DUAL_STACK | suspend,
 					port,
 					admin ? janus_http_admin_client_connect : janus_http_client_connect,
 					NULL,
@@ -419,7 +440,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 					ip ? "IP" : "interface", ip ? ip : interface,
 					admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 				daemon = MHD_start_daemon(
-					MHD_USE_SELECT_INTERNALLY | (ipv6 ? MHD_USE_IPv6 : 0),
+					MHD_USE_SELECT_INTERNALLY | (ipv6 ? MHD_USE_IPv6 : 0) | suspend,
 					port,
 					admin ? janus_http_admin_client_connect : janus_http_client_connect,
 					NULL,
@@ -500,7 +521,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				JANUS_LOG(LOG_VERB, "Binding to all interfaces for the %s API %s webserver\n",
 					admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 				daemon = MHD_start_daemon(
-					MHD_USE_SSL | MHD_USE_SELECT_INTERNALLY | MHD_USE_DUAL_STACK,
+					MHD_USE_SSL | MHD_USE_SELECT_INTERNALLY | MHD_USE_DUAL_STACK | suspend,
 					port,
 					admin ? janus_http_admin_client_connect : janus_http_client_connect,
 					NULL,
@@ -520,7 +541,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 					ip ? "IP" : "interface", ip ? ip : interface,
 					admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 				daemon = MHD_start_daemon(
-					MHD_USE_SSL | MHD_USE_SELECT_INTERNALLY | (ipv6 ? MHD_USE_IPv6 : 0),
+					MHD_USE_SSL | MHD_USE_SELECT_INTERNALLY | (ipv6 ? MHD_USE_IPv6 : 0) | suspend,
 					port,
 					admin ? janus_http_admin_client_connect : janus_http_client_connect,
 					NULL,
@@ -550,6 +571,14 @@ static void *janus_http_sessions_watchdog(void *data) {
 		janus_mutex_lock(&sessions_mutex);
 		/* Iterate on all the sessions */
 		now = janus_get_monotonic_time();
+		if(long_poll_suspend) {
+			/* Suspended long polls that waited too long are answered with a keepalive */
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, sessions);
+			while(g_hash_table_iter_next(&iter, NULL, &value))
+				janus_http_resume_polls((janus_http_session *)value, FALSE, now);
+		}
 		if(old_sessions != NULL) {
 			GList *sl = old_sessions;
 			JANUS_LOG(LOG_HUGE, "Checking %d old HTTP/Janus sessions sessions...\n", g_list_length(old_sessions));
@@ -559,7 +588,7 @@ static void *janus_http_sessions_watchdog(void *data) {
 					sl = sl->next;
 					continue;
 				}
-				if(now-session->destroyed >= G_USEC_PER_SEC) {
+				if(now-session->destroyed >= G_USEC_PER_SEC && session->polls == NULL) {
 					/* We're lazy and actually get rid of the stuff only after a few seconds */
 					JANUS_LOG(LOG_VERB, "Freeing old HTTP/Janus session\n");
 					GList *rm = sl->next;
@@ -641,17 +670,17 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 		if(item && item->value) {
 			/* Check how we need to format/serialize the JSON output */
 			if(!strcasecmp(item->value, "indented")) {
-				/* Default: indented, we use three spaces for that */
+				/* Indented, we use three spaces for that */
 				json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 			} else if(!strcasecmp(item->value, "plain")) {
 				/* Not indented and no new lines, but still readable */
 				json_format = JSON_INDENT(0) | JSON_PRESERVE_ORDER;
 			} else if(!strcasecmp(item->value, "compact")) {
-				/* Compact, so no spaces between separators */
+				/* Default: compact, so no spaces between separators */
 				json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 			} else {
-				JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (indented)\n", item->value);
-				json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+				JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (compact)\n", item->value);
+				json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 			}
 		}
 
@@ -693,6 +722,16 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 		} else {
 			admin_ws_path = g_strdup("/admin");
 		}
+		/* Should we export the core metrics too? */
+		item = janus_config_get_item_drilldown(config, "admin", "admin_metrics_path");
+		if(item && item->value) {
+			if(item->value[0] != '/') {
+				JANUS_LOG(LOG_FATAL, "Invalid metrics path %s (it should start with a /, e.g., /metrics\n", item->value);
+				return -1;
+			}
+			admin_metrics_path = g_strdup(item->value);
+			JANUS_LOG(LOG_INFO, "Metrics will be exported on the admin/monitor web server (%s)\n", admin_metrics_path);
+		}
 
 		/* Any ACL for either the Janus or Admin API? */
 		item = janus_config_get_item_drilldown(config, "general", "acl");
@@ -757,6 +796,17 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 				}
 			}
 		}
+		item = janus_config_get_item_drilldown(config, "general", "long_poll_suspend");
+		if(item && item->value && janus_is_true(item->value)) {
+			if(threads == 0) {
+				JANUS_LOG(LOG_WARN, "Suspending long polls requires a thread pool, ignoring long_poll_suspend\n");
+			} else if(JANUS_HTTP_SUSPEND_RESUME == 0) {
+				JANUS_LOG(LOG_WARN, "The installed libmicrohttpd version can't suspend connections, ignoring long_poll_suspend\n");
+			} else {
+				long_poll_suspend = TRUE;
+				JANUS_LOG(LOG_INFO, "Long polls will be suspended until events are available\n");
+			}
+		}
 		item = janus_config_get_item_drilldown(config, "general", "http");
 		if(!item || !item->value || !janus_is_true(item->value)) {
 			JANUS_LOG(LOG_WARN, "HTTP webserver disabled\n");
@@ -926,6 +976,22 @@ void janus_http_destroy(void) {
 		return;
 	g_atomic_int_set(&stopping, 1);
 
+	if(long_poll_suspend) {
+		/* MHD can't stop a daemon with suspended connections: wake them all up */
+		janus_mutex_lock(&sessions_mutex);
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, sessions);
+		while(g_hash_table_iter_next(&iter, NULL, &value))
+			janus_http_resume_polls((janus_http_session *)value, TRUE, 0);
+		GList *sl = old_sessions;
+		while(sl) {
+			janus_http_resume_polls((janus_http_session *)sl->data, TRUE, 0);
+			sl = sl->next;
+		}
+		janus_mutex_unlock(&sessions_mutex);
+	}
+
 	JANUS_LOG(LOG_INFO, "Stopping webserver(s)...\n");
 	if(ws)
 		MHD_stop_daemon(ws);
@@ -1020,6 +1086,8 @@ int janus_http_send_message(void *transport, void *request_id, gboolean admin, j
 			return -1;
 		}
 		g_async_queue_push(session->events, message);
+		/* If a long poll is suspended waiting for events, wake it up */
+		janus_http_resume_polls(session, FALSE, 0);
 		janus_mutex_unlock(&sessions_mutex);
 	} else {
 		if(request_id == keepalive_id) {
@@ -1071,6 +1139,7 @@ void janus_http_session_created(void *transport, guint64 session_id) {
 	janus_http_session *session = g_malloc(sizeof(janus_http_session));
 	session->events = g_async_queue_new();
 	session->destroyed = 0;
+	session->polls = NULL;
 	g_hash_table_insert(sessions, janus_uint64_dup(session_id), session);
 	janus_mutex_unlock(&sessions_mutex);
 }
@@ -1091,6 +1160,7 @@ void janus_http_session_over(void *transport, guint64 session_id, gboolean timeo
 	g_hash_table_remove(sessions, &session_id);
 	/* We leave it to the watchdog to remove the session */
 	session->destroyed = janus_get_monotonic_time();
+	janus_http_resume_polls(session, TRUE, 0);
 	old_sessions = g_list_append(old_sessions, session);
 	janus_mutex_unlock(&sessions_mutex);
 }
@@ -1307,6 +1377,11 @@ int janus_http_handler(void *cls, struct MHD_Connection *connection, const char
 			goto done;
 		}
 		msg->session_id = session_id;
+		if(msg->suspended == 2) {
+			/* This is a suspended long poll we just resumed, we have events (or a keepalive) to send */
+			ret = janus_http_resumed_poll(msg);
+			goto done;
+		}
 
 		/* Since we handle long polls ourselves, the core isn't involved (if not for providing us with events)
 		 * A long poll, though, can act as a keepalive, so we pass a fake one to the core to avoid undesirable timeouts */
@@ -1410,6 +1485,25 @@ int janus_http_handler(void *cls, struct MHD_Connection *connection, const char
 				json_decref(list);
 				ret = janus_http_return_success(msg, list_text);
 			}
+		} else if(long_poll_suspend) {
+#if MHD_VERSION >= 0x00093400
+			/* Still no message, suspend the connection until we get one: we check the queue
+			 * again while holding the lock, as an event may have arrived in the meanwhile */
+			msg->max_events = max_events;
+			janus_mutex_lock(&sessions_mutex);
+			if(session->destroyed || g_atomic_int_get(&stopping) || g_async_queue_length(session->events) > 0) {
+				janus_mutex_unlock(&sessions_mutex);
+				ret = janus_http_resumed_poll(msg);
+				goto done;
+			}
+			msg->poll_deadline = janus_get_monotonic_time() + 30*G_USEC_PER_SEC;
+			msg->suspended = 1;
+			session->polls = g_list_append(session->polls, msg);
+			MHD_suspend_connection(connection);
+			janus_mutex_unlock(&sessions_mutex);
+			JANUS_LOG(LOG_DBG, "Long poll for session %"SCNu64" suspended\n", session_id);
+			ret = MHD_YES;
+#endif
 		} else {
 			/* Still no message, wait */
 			ret = janus_http_notifier(msg, max_events);
@@ -1535,6 +1629,19 @@ int janus_http_admin_handler(void *cls, struct MHD_Connection *connection, const
 		ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
 		MHD_destroy_response(response);
 	}
+	/* Is this a request for the metrics? */
+	if(admin_metrics_path != NULL && !strcasecmp(method, "GET") && !strcmp(url, admin_metrics_path)) {
+		if(firstround)
+			return ret;
+		char *metrics = janus_metrics_render();
+		response = MHD_create_response_from_buffer(strlen(metrics), metrics, MHD_RESPMEM_MUST_COPY);
+		g_free(metrics);
+		MHD_add_response_header(response, "Content-Type", "text/plain; version=0.0.4");
+		janus_http_add_cors_headers(msg, response);
+		ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+		MHD_destroy_response(response);
+		return ret;
+	}
 	/* Get path components */
 	if(strcasecmp(url, admin_ws_path)) {
 		if(strlen(admin_ws_path) > 1) {
@@ -1811,6 +1918,54 @@ int janus_http_notifier(janus_http_msg *msg, int max_events) {
 	return ret;
 }
 
+/* Helper to resume suspended long polls: the sessions mutex must be locked */
+static void janus_http_resume_polls(janus_http_session *session, gboolean all, gint64 now) {
+#if MHD_VERSION >= 0x00093400
+	if(session == NULL)
+		return;
+	GList *pl = session->polls;
+	while(pl) {
+		janus_http_msg *msg = (janus_http_msg *)pl->data;
+		GList *next = pl->next;
+		if(all || now == 0 || msg->poll_deadline <= now) {
+			session->polls = g_list_delete_link(session->polls, pl);
+			msg->suspended = 2;
+			MHD_resume_connection(msg->connection);
+			/* When notifying an event, one long poll is enough */
+			if(!all && now == 0)
+				break;
+		}
+		pl = next;
+	}
+#endif
+}
+
+/* Helper to answer a long poll that has been resumed (or didn't need to be suspended) */
+static int janus_http_resumed_poll(janus_http_msg *msg) {
+	int max_events = msg->max_events > 0 ? msg->max_events : 1;
+	guint64 session_id = msg->session_id;
+	janus_mutex_lock(&sessions_mutex);
+	janus_http_session *session = g_hash_table_lookup(sessions, &session_id);
+	json_t *list = json_array();
+	if(session != NULL && !session->destroyed) {
+		json_t *event = NULL;
+		while(json_array_size(list) < (size_t)max_events && (event = g_async_queue_try_pop(session->events)) != NULL)
+			json_array_append_new(list, event);
+	}
+	janus_mutex_unlock(&sessions_mutex);
+	if(json_array_size(list) == 0) {
+		JANUS_LOG(LOG_VERB, "Long poll time out for session %"SCNu64"...\n", session_id);
+		/* Turn this into a "keepalive" response */
+		json_t *event = json_object();
+		json_object_set_new(event, "janus", json_string("keepalive"));
+		json_array_append_new(list, event);
+	}
+	char *payload_text = json_dumps(max_events == 1 ? json_array_get(list, 0) : list, json_format);
+	json_decref(list);
+	JANUS_LOG(LOG_HUGE, "We have a message to serve...\n\t%s\n", payload_text);
+	return janus_http_return_success(msg, payload_text);
+}
+
 /* Helper to quickly send a success response */
 int janus_http_return_success(janus_http_msg *msg, char *payload) {
 	if(!msg || !msg->connection) {
@@ -32,6 +32,7 @@
 
 #include "../debug.h"
 #include "../config.h"
+#include "../metrics.h"
 #include "../utils.h"
 
 /* Transport plugin information */
@@ -95,7 +96,10 @@ static gboolean janus_mqtt_admin_api_enabled_ = FALSE;
 static gboolean notify_events = TRUE;
 
 /* JSON serialization options */
-static size_t json_format_ = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+static size_t json_format_ = JSON_COMPACT | JSON_PRESERVE_ORDER;
+
+/* How many QoS>0 messages can be waiting for an acknowledgement from the broker */
+#define JANUS_MQTT_DEFAULT_MAX_INFLIGHT	64
 
 /* MQTT client context */
 typedef struct janus_mqtt_context {
@@ -117,6 +121,7 @@ typedef struct janus_mqtt_context {
 	struct {
 		char *topic;
 		int qos;
+		int max_inflight;
 	} publish;
 	struct {
 		struct {
@@ -134,8 +139,20 @@ typedef struct janus_mqtt_context {
 	char *cert_file;
 	char *key_file;
 	gboolean verify_peer;
+	/* Threads parsing incoming requests, if more than one */
+	GThreadPool *consumers;
+	/* Queue depth metrics */
+	janus_metric *inflight_metric;
+	janus_metric *incoming_metric;
 } janus_mqtt_context;
 
+/* MQTT request, when parsed by the consumer threads */
+typedef struct janus_mqtt_request {
+	gboolean admin;
+	char *payload;
+	int length;
+} janus_mqtt_request;
+
 /* Transport client methods */
 void janus_mqtt_client_connection_lost(void *context, char *cause);
 int janus_mqtt_client_message_arrived(void *context, char *topicName, int topicLen, MQTTAsync_message *message);
@@ -160,6 +177,8 @@ void janus_mqtt_client_publish_janus_failure(void *context, MQTTAsync_failureDat
 void janus_mqtt_client_publish_admin_success(void *context, MQTTAsync_successData *response);
 void janus_mqtt_client_publish_admin_failure(void *context, MQTTAsync_failureData *response);
 void janus_mqtt_client_destroy_context(janus_mqtt_context **ctx);
+static void janus_mqtt_client_consumer(gpointer data, gpointer user_data);
+static gint64 janus_mqtt_client_incoming_depth(gpointer user_data);
 
 /* We only handle a single client */
 static janus_mqtt_context *context_ = NULL;
@@ -201,17 +220,17 @@ int janus_mqtt_init(janus_transport_callbacks *callback, const char *config_path
 	if(json_item && json_item->value) {
 		/* Check how we need to format/serialize the JSON output */
 		if(!strcasecmp(json_item->value, "indented")) {
-			/* Default: indented, we use three spaces for that */
+			/* Indented, we use three spaces for that */
 			json_format_ = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 		} else if(!strcasecmp(json_item->value, "plain")) {
 			/* Not indented and no new lines, but still readable */
 			json_format_ = JSON_INDENT(0) | JSON_PRESERVE_ORDER;
 		} else if(!strcasecmp(json_item->value, "compact")) {
-			/* Compact, so no spaces between separators */
+			/* Default: compact, so no spaces between separators */
 			json_format_ = JSON_COMPACT | JSON_PRESERVE_ORDER;
 		} else {
-			JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (indented)\n", json_item->value);
-			json_format_ = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+			JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (compact)\n", json_item->value);
+			json_format_ = JSON_COMPACT | JSON_PRESERVE_ORDER;
 		}
 	}
 
@@ -268,6 +287,34 @@ int janus_mqtt_init(janus_transport_callbacks *callback, const char *config_path
 	janus_config_item *cleansession_item = janus_config_get_item_drilldown(config, "general", "cleansession");
 	ctx->connect.cleansession = (cleansession_item && cleansession_item->value) ? atoi(cleansession_item->value) : 0;
 
+	/* Publishing window: the broker acknowledgements for QoS>0 messages are our confirms */
+	janus_config_item *max_inflight_item = janus_config_get_item_drilldown(config, "general", "max_inflight");
+	ctx->publish.max_inflight = (max_inflight_item && max_inflight_item->value) ? atoi(max_inflight_item->value) : JANUS_MQTT_DEFAULT_MAX_INFLIGHT;
+	if(ctx->publish.max_inflight < 1) {
+		JANUS_LOG(LOG_WARN, "Invalid max_inflight value, using %d\n", JANUS_MQTT_DEFAULT_MAX_INFLIGHT);
+		ctx->publish.max_inflight = JANUS_MQTT_DEFAULT_MAX_INFLIGHT;
+	}
+
+	/* Consumers configuration */
+	janus_config_item *consumers_item = janus_config_get_item_drilldown(config, "general", "consumers");
+	int consumers = (consumers_item && consumers_item->value) ? atoi(consumers_item->value) : 1;
+	if(consumers > 1) {
+		GError *error = NULL;
+		ctx->consumers = g_thread_pool_new(janus_mqtt_client_consumer, ctx, consumers, FALSE, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_WARN, "Got error %d (%s) trying to launch the MQTT consumers, parsing requests in the client thread\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			ctx->consumers = NULL;
+		} else {
+			JANUS_LOG(LOG_INFO, "MQTT requests will be parsed by %d consumer threads\n", consumers);
+			ctx->incoming_metric = janus_metrics_add_callback("janus_mqtt_queue_depth", "queue=\"incoming\"",
+				"Messages waiting in the MQTT transport queues", JANUS_METRIC_GAUGE, janus_mqtt_client_incoming_depth, ctx);
+		}
+	}
+	ctx->inflight_metric = janus_metrics_add("janus_mqtt_queue_depth", "queue=\"inflight\"",
+		"Messages waiting in the MQTT transport queues", JANUS_METRIC_GAUGE);
+
 	/* Disconnect configuration */
 	janus_config_item *disconnect_timeout_item = janus_config_get_item_drilldown(config, "general", "disconnect_timeout");
 	ctx->disconnect.timeout = (disconnect_timeout_item && disconnect_timeout_item->value) ? atoi(disconnect_timeout_item->value) : 100;
@@ -447,6 +494,8 @@ int janus_mqtt_send_message(void *context, void *request_id, gboolean admin, jso
 	if(rc != MQTTASYNC_SUCCESS) {
 		JANUS_LOG(LOG_ERR, "Can't publish to MQTT topic: %s, return code: %d\n", admin ? ctx->admin.publish.topic : ctx->publish.topic, rc);
 	}
+	/* The client library keeps its own copy of the payload */
+	free(payload);
 
 	return 0;
 }
@@ -480,11 +529,20 @@ int janus_mqtt_client_message_arrived(void *context, char *topicName, int topicL
 	g_free(topic);
 
 	if((janus || admin) && message->payloadlen) {
-		JANUS_LOG(LOG_HUGE, "Receiving %s API message over MQTT: %s\n", admin ? "admin" : "Janus", (char *)message->payload);
-
-		json_error_t error;
-		json_t *root = json_loadb(message->payload, message->payloadlen, 0, &error);
-		ctx->gateway->incoming_request(&janus_mqtt_transport_, ctx, NULL, admin, root, &error);
+		JANUS_LOG(LOG_HUGE, "Receiving %s API message over MQTT: %.*s\n", admin ? "admin" : "Janus", message->payloadlen, (char *)message->payload);
+
+		if(ctx->consumers != NULL) {
+			/* Let one of the consumers parse it, so that the client thread can go on */
+			janus_mqtt_request *request = g_malloc(sizeof(janus_mqtt_request));
+			request->admin = admin;
+			request->payload = g_memdup(message->payload, message->payloadlen);
+			request->length = message->payloadlen;
+			g_thread_pool_push(ctx->consumers, request, NULL);
+		} else {
+			json_error_t error;
+			json_t *root = json_loadb(message->payload, message->payloadlen, 0, &error);
+			ctx->gateway->incoming_request(&janus_mqtt_transport_, ctx, NULL, admin, root, &error);
+		}
 	}
 
 	MQTTAsync_freeMessage(&message);
@@ -495,6 +553,21 @@ int janus_mqtt_client_message_arrived(void *context, char *topicName, int topicL
 void janus_mqtt_client_delivery_complete(void *context, MQTTAsync_token token) {
 }
 
+static void janus_mqtt_client_consumer(gpointer data, gpointer user_data) {
+	janus_mqtt_context *ctx = (janus_mqtt_context *)user_data;
+	janus_mqtt_request *request = (janus_mqtt_request *)data;
+	json_error_t error;
+	json_t *root = json_loadb(request->payload, request->length, 0, &error);
+	ctx->gateway->incoming_request(&janus_mqtt_transport_, ctx, NULL, request->admin, root, &error);
+	g_free(request->payload);
+	g_free(request);
+}
+
+static gint64 janus_mqtt_client_incoming_depth(gpointer user_data) {
+	janus_mqtt_context *ctx = (janus_mqtt_context *)user_data;
+	return ctx->consumers ? g_thread_pool_unprocessed(ctx->consumers) : 0;
+}
+
 int janus_mqtt_client_connect(janus_mqtt_context *ctx) {
 	MQTTAsync_connectOptions options = MQTTAsync_connectOptions_initializer;
 	options.keepAliveInterval = ctx->connect.keep_alive_interval;
@@ -502,6 +575,7 @@ int janus_mqtt_client_connect(janus_mqtt_context *ctx) {
 	options.username = ctx->connect.username;
 	options.password = ctx->connect.password;
 	options.automaticReconnect = TRUE;
+	options.maxInflight = ctx->publish.max_inflight;
 	options.onSuccess = janus_mqtt_client_connect_success;
 	options.onFailure = janus_mqtt_client_connect_failure;
 	/* Is SSL enabled? */
@@ -680,37 +754,46 @@ int janus_mqtt_client_publish_message(janus_mqtt_context *ctx, char *payload, gb
 	msg.qos = ctx->publish.qos;
 	msg.retained = 0;
 
-	MQTTAsync_responseOptions options;
+	MQTTAsync_responseOptions options = MQTTAsync_responseOptions_initializer;
 	options.context = ctx;
+	int rc = 0;
 	if(admin) {
 		options.onSuccess = janus_mqtt_client_publish_admin_success;
 		options.onFailure = janus_mqtt_client_publish_admin_failure;
-		return MQTTAsync_sendMessage(ctx->client, ctx->admin.publish.topic, &msg, &options);
+		rc = MQTTAsync_sendMessage(ctx->client, ctx->admin.publish.topic, &msg, &options);
 	} else {
 		options.onSuccess = janus_mqtt_client_publish_janus_success;
 		options.onFailure = janus_mqtt_client_publish_janus_failure;
-		return MQTTAsync_sendMessage(ctx->client, ctx->publish.topic, &msg, &options);
+		rc = MQTTAsync_sendMessage(ctx->client, ctx->publish.topic, &msg, &options);
 	}
+	/* Either callback will be invoked when the broker is done with it */
+	if(rc == MQTTASYNC_SUCCESS)
+		janus_metrics_inc(ctx->inflight_metric);
+	return rc;
 }
 
 void janus_mqtt_client_publish_janus_success(void *context, MQTTAsync_successData *response) {
 	janus_mqtt_context *ctx = (janus_mqtt_context *)context;
+	janus_metrics_dec(ctx->inflight_metric);
 	JANUS_LOG(LOG_HUGE, "MQTT client has been successfully published to MQTT topic: %s\n", ctx->publish.topic);
 }
 
 void janus_mqtt_client_publish_janus_failure(void *context, MQTTAsync_failureData *response) {
 	janus_mqtt_context *ctx = (janus_mqtt_context *)context;
+	janus_metrics_dec(ctx->inflight_metric);
 	int rc = response ? response->code : 0;
 	JANUS_LOG(LOG_ERR, "MQTT client has failed publishing to MQTT topic: %s, return code: %d\n", ctx->publish.topic, rc);
 }
 
 void janus_mqtt_client_publish_admin_success(void *context, MQTTAsync_successData *response) {
 	janus_mqtt_context *ctx = (janus_mqtt_context *)context;
+	janus_metrics_dec(ctx->inflight_metric);
 	JANUS_LOG(LOG_HUGE, "MQTT client has been successfully published to MQTT topic: %s\n", ctx->admin.publish.topic);
 }
 
 void janus_mqtt_client_publish_admin_failure(void *context, MQTTAsync_failureData *response) {
 	janus_mqtt_context *ctx = (janus_mqtt_context *)context;
+	janus_metrics_dec(ctx->inflight_metric);
 	int rc = response ? response->code : 0;
 	JANUS_LOG(LOG_ERR, "MQTT client has failed publishing to MQTT topic: %s, return code: %d\n", ctx->admin.publish.topic, rc);
 }
@@ -719,6 +802,10 @@ void janus_mqtt_client_destroy_context(janus_mqtt_context **ptr) {
 	janus_mqtt_context *ctx = (janus_mqtt_context *)*ptr;
 	if(ctx) {
 		MQTTAsync_destroy(&ctx->client);
+		janus_metrics_remove(ctx->incoming_metric);
+		if(ctx->consumers)
+			g_thread_pool_free(ctx->consumers, FALSE, TRUE);
+		janus_metrics_remove(ctx->inflight_metric);
 		g_free(ctx->subscribe.topic);
 		g_free(ctx->publish.topic);
 		g_free(ctx->connect.username);
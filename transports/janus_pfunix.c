@@ -21,6 +21,12 @@
  * the events related to it is done automatically, so no need for an
  * explicit request as the GET in the plain HTTP API. Closing a client
  * Unix Socket will also destroy all the sessions it created.
+ * \note When using \c SOCK_SEQPACKET, payloads larger than a configurable
+ * threshold can be returned out of band: the payload is written to an
+ * anonymous shared memory segment, whose file descriptor is passed to the
+ * client (\c SCM_RIGHTS ) together with a short JSON message in the
+ * \c {"janus":"shm","length":<bytes>} format. The client is then
+ * responsible for mapping or reading the descriptor, and closing it.
  *
  * \ingroup transports
  * \ref transports
@@ -29,8 +35,10 @@
 #include "transport.h"
 
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
-#include <poll.h>
 #include <sys/un.h>
 
 #include "../debug.h"
@@ -101,9 +109,11 @@ static janus_transport_callbacks *gateway = NULL;
 static gboolean notify_events = TRUE;
 
 /* JSON serialization options */
-static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+static size_t json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 
 #define BUFFER_SIZE		8192
+/* How many events we get from each epoll_wait call, at most */
+#define JANUS_PFUNIX_MAX_EVENTS	64
 
 struct sockaddr_un sizecheck;
 #ifndef UNIX_PATH_MAX
@@ -117,8 +127,12 @@ void *janus_pfunix_thread(void *data);
 /* Unix Sockets servers (and whether they should be SOCK_SEQPACKET or SOCK_DGRAM) */
 static int pfd = -1, admin_pfd = -1;
 static gboolean dgram = FALSE, admin_dgram = FALSE;
-/* Socket pair to notify about the need for outgoing data */
+/* Socket pair to wake the thread up (e.g., when stopping) */
 static int write_fd[2];
+/* The epoll instance all sockets are watched with */
+static int epfd = -1;
+/* Payloads larger than this (SOCK_SEQPACKET only) are passed via shared memory; 0 disables it */
+static size_t shm_threshold = 0, admin_shm_threshold = 0;
 
 /* Unix Sockets client session */
 typedef struct janus_pfunix_client {
@@ -126,11 +140,146 @@ typedef struct janus_pfunix_client {
 	struct sockaddr_un addr;	/* Client address (in case SOCK_DGRAM is used) */
 	gboolean admin;				/* Whether this client is for the Admin or Janus API */
 	GAsyncQueue *messages;		/* Queue of outgoing messages to push */
+	char *pending;				/* Message we couldn't send yet because the socket was full */
 	gboolean session_timeout;	/* Whether a Janus session timeout occurred in the core */
 } janus_pfunix_client;
 static GHashTable *clients = NULL, *clients_by_fd = NULL, *clients_by_path = NULL;
 static janus_mutex clients_mutex = JANUS_MUTEX_INITIALIZER;
 
+/* Helper to add, update or remove a file descriptor in the epoll instance */
+static void janus_pfunix_watch(int fd, int op, gboolean writable) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (writable ? EPOLLOUT : 0);
+	ev.data.fd = fd;
+	if(epoll_ctl(epfd, op, fd, &ev) < 0 && op != EPOLL_CTL_DEL)
+		JANUS_LOG(LOG_WARN, "Error updating epoll for %d: %d (%s)\n", fd, errno, strerror(errno));
+}
+
+/* Helper to get rid of a client: the clients mutex must be locked */
+static void janus_pfunix_client_destroy(janus_pfunix_client *client) {
+	if(client->fd > -1) {
+		janus_pfunix_watch(client->fd, EPOLL_CTL_DEL, FALSE);
+		shutdown(client->fd, SHUT_RDWR);
+		close(client->fd);
+		g_hash_table_remove(clients_by_fd, GINT_TO_POINTER(client->fd));
+		client->fd = -1;
+	} else {
+		g_hash_table_remove(clients_by_path, client->addr.sun_path);
+	}
+	g_hash_table_remove(clients, client);
+	free(client->pending);
+	if(client->messages != NULL) {
+		char *response = NULL;
+		while((response = g_async_queue_try_pop(client->messages)) != NULL)
+			free(response);
+		g_async_queue_unref(client->messages);
+	}
+	g_free(client);
+}
+
+/* Helper to write a payload to an anonymous shared memory segment */
+static int janus_pfunix_shm_create(const char *payload, size_t len) {
+	int mfd = -1;
+#ifdef MFD_CLOEXEC
+	mfd = memfd_create("janus-pfunix", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+	char name[] = "/dev/shm/janus-pfunix-XXXXXX";
+	mfd = mkstemp(name);
+	if(mfd > -1)
+		unlink(name);
+#endif
+	if(mfd < 0)
+		return -1;
+	size_t written = 0;
+	while(written < len) {
+		ssize_t res = write(mfd, payload + written, len - written);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			close(mfd);
+			return -1;
+		}
+		written += res;
+	}
+#ifdef F_ADD_SEALS
+	/* Make sure the client sees the payload exactly as we wrote it */
+	(void)fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+	return mfd;
+}
+
+/* Helper to send a payload via shared memory, passing the descriptor with SCM_RIGHTS */
+static int janus_pfunix_send_shm(int fd, const char *payload, size_t len) {
+	int mfd = janus_pfunix_shm_create(payload, len);
+	if(mfd < 0) {
+		JANUS_LOG(LOG_WARN, "Couldn't create shared memory segment (%d, %s), sending %zu bytes inline\n",
+			errno, strerror(errno), len);
+		return write(fd, payload, len);
+	}
+	char header[64];
+	int hlen = g_snprintf(header, sizeof(header), "{\"janus\":\"shm\",\"length\":%zu}", len);
+	struct iovec iov;
+	iov.iov_base = header;
+	iov.iov_len = hlen;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &mfd, sizeof(int));
+	int res = 0;
+	do {
+		res = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while(res == -1 && errno == EINTR);
+	/* The client has its own copy of the descriptor now */
+	int err = errno;
+	close(mfd);
+	errno = err;
+	return res;
+}
+
+/* Helper to send all the queued messages of a client, until the socket is full:
+ * the clients mutex must be locked */
+static void janus_pfunix_client_flush(janus_pfunix_client *client) {
+	size_t threshold = client->admin ? admin_shm_threshold : shm_threshold;
+	while(client->fd > -1) {
+		char *payload = client->pending ? client->pending : g_async_queue_try_pop(client->messages);
+		client->pending = NULL;
+		if(payload == NULL) {
+			/* Nothing left to send, stop watching for writability */
+			janus_pfunix_watch(client->fd, EPOLL_CTL_MOD, FALSE);
+			return;
+		}
+		size_t len = strlen(payload);
+		int res = 0;
+		if(threshold > 0 && len > threshold) {
+			res = janus_pfunix_send_shm(client->fd, payload, len);
+		} else {
+			do {
+				res = write(client->fd, payload, len);
+			} while(res == -1 && errno == EINTR);
+		}
+		if(res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			/* Try again when epoll tells us the socket is writable */
+			client->pending = payload;
+			return;
+		}
+		JANUS_LOG(LOG_HUGE, "Written %d/%zu bytes on %d\n", res, len, client->fd);
+		free(payload);
+	}
+}
+
 
 /* Helper to create a named Unix Socket out of the path to link to */
 static int janus_pfunix_create_socket(char *pfname, gboolean use_dgram) {
@@ -200,17 +349,17 @@ int janus_pfunix_init(janus_transport_callbacks *callback, const char *config_pa
 		if(item && item->value) {
 			/* Check how we need to format/serialize the JSON output */
 			if(!strcasecmp(item->value, "indented")) {
-				/* Default: indented, we use three spaces for that */
+				/* Indented, we use three spaces for that */
 				json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 			} else if(!strcasecmp(item->value, "plain")) {
 				/* Not indented and no new lines, but still readable */
 				json_format = JSON_INDENT(0) | JSON_PRESERVE_ORDER;
 			} else if(!strcasecmp(item->value, "compact")) {
-				/* Compact, so no spaces between separators */
+				/* Default: compact, so no spaces between separators */
 				json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 			} else {
-				JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (indented)\n", item->value);
-				json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+				JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (compact)\n", item->value);
+				json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 			}
 		}
 
@@ -222,11 +371,24 @@ int janus_pfunix_init(janus_transport_callbacks *callback, const char *config_pa
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_PFUNIX_NAME);
 		}
 
-		/* First of all, initialize the socketpair for writeable notifications */
+		/* Should large payloads be passed via shared memory? */
+		item = janus_config_get_item_drilldown(config, "general", "shm_threshold");
+		if(item && item->value && atoi(item->value) > 0)
+			shm_threshold = atoi(item->value);
+		item = janus_config_get_item_drilldown(config, "admin", "admin_shm_threshold");
+		if(item && item->value && atoi(item->value) > 0)
+			admin_shm_threshold = atoi(item->value);
+
+		/* First of all, initialize the socketpair for wake-up notifications, and the epoll instance */
 		if(socketpair(PF_LOCAL, SOCK_STREAM, 0, write_fd) < 0) {
 			JANUS_LOG(LOG_FATAL, "Error creating socket pair for writeable events: %d, %s\n", errno, strerror(errno));
 			return -1;
 		}
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		if(epfd < 0) {
+			JANUS_LOG(LOG_FATAL, "Error creating epoll instance: %d, %s\n", errno, strerror(errno));
+			return -1;
+		}
 
 		/* Setup the Janus API Unix Sockets server(s) */
 		item = janus_config_get_item_drilldown(config, "general", "enabled");
@@ -320,6 +482,9 @@ void janus_pfunix_destroy(void) {
 		g_thread_join(pfunix_thread);
 		pfunix_thread = NULL;
 	}
+	if(epfd > -1)
+		close(epfd);
+	epfd = -1;
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -372,26 +537,20 @@ int janus_pfunix_send_message(void *transport, void *request_id, gboolean admin,
 	}
 	/* Make sure this is related to a still valid Unix Sockets session */
 	janus_pfunix_client *client = (janus_pfunix_client *)transport;
+	/* Convert to string */
+	char *payload = json_dumps(message, json_format);
+	json_decref(message);
 	janus_mutex_lock(&clients_mutex);
 	if(g_hash_table_lookup(clients, client) == NULL) {
 		janus_mutex_unlock(&clients_mutex);
 		JANUS_LOG(LOG_WARN, "Outgoing message for invalid client %p\n", client);
-		json_decref(message);
-		message = NULL;
+		free(payload);
 		return -1;
 	}
-	janus_mutex_unlock(&clients_mutex);
-	/* Convert to string */
-	char *payload = json_dumps(message, json_format);
-	json_decref(message);
 	if(client->fd != -1) {
-		/* SOCK_SEQPACKET, enqueue the packet and have poll tell us when it's time to send it */
+		/* SOCK_SEQPACKET, enqueue the packet and have epoll tell us when it's time to send it */
 		g_async_queue_push(client->messages, payload);
-		/* Notify the thread there's data to send */
-		int res = 0;
-		do {
-			res = write(write_fd[1], "x", 1);
-		} while(res == -1 && errno == EINTR);
+		janus_pfunix_watch(client->fd, EPOLL_CTL_MOD, TRUE);
 	} else {
 		/* SOCK_DGRAM, send it right away */
 		int res = 0;
@@ -400,6 +559,7 @@ int janus_pfunix_send_message(void *transport, void *request_id, gboolean admin,
 		} while(res == -1 && errno == EINTR);
 		free(payload);
 	}
+	janus_mutex_unlock(&clients_mutex);
 	return 0;
 }
 
@@ -416,11 +576,9 @@ void janus_pfunix_session_over(void *transport, guint64 session_id, gboolean tim
 	janus_mutex_lock(&clients_mutex);
 	if(g_hash_table_lookup(clients, client) != NULL) {
 		client->session_timeout = TRUE;
-		/* Notify the thread about this */
-		int res = 0;
-		do {
-			res = write(write_fd[1], "x", 1);
-		} while(res == -1 && errno == EINTR);
+		/* Have the thread close the connection, once it's sent what's queued */
+		if(client->fd > -1)
+			janus_pfunix_watch(client->fd, EPOLL_CTL_MOD, TRUE);
 	}
 	janus_mutex_unlock(&clients_mutex);
 }
@@ -430,8 +588,7 @@ void janus_pfunix_session_over(void *transport, guint64 session_id, gboolean tim
 void *janus_pfunix_thread(void *data) {
 	JANUS_LOG(LOG_INFO, "Unix Sockets thread started\n");
 
-	int fds = 0;
-	struct pollfd poll_fds[1024];	/* FIXME Should we allow for more clients? */
+	struct epoll_event events[JANUS_PFUNIX_MAX_EVENTS];
 	char buffer[BUFFER_SIZE];
 	struct iovec iov[1];
 	struct msghdr msg;
@@ -442,42 +599,15 @@ void *janus_pfunix_thread(void *data) {
 	msg.msg_iov = iov;
 	msg.msg_iovlen = 1;
 
-	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		/* Prepare poll list of file descriptors */
-		fds = 0;
-		/* Writeable monitor */
-		poll_fds[fds].fd = write_fd[0];
-		poll_fds[fds].events = POLLIN;
-		fds++;
-		if(pfd > -1) {
-			/* Janus API */
-			poll_fds[fds].fd = pfd;
-			poll_fds[fds].events = POLLIN;
-			fds++;
-		}
-		if(admin_pfd > -1) {
-			/* Admin API */
-			poll_fds[fds].fd = admin_pfd;
-			poll_fds[fds].events = POLLIN;
-			fds++;
-		}
-		/* Iterate on available clients, to see if we need to POLLIN or POLLOUT too */
-		janus_mutex_lock(&clients_mutex);
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, clients_by_fd);
-		while(g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_pfunix_client *client = value;
-			if(client->fd > -1) {
-				poll_fds[fds].fd = client->fd;
-				poll_fds[fds].events = g_async_queue_length(client->messages) > 0 ? POLLIN | POLLOUT : POLLIN;
-				fds++;
-			}
-		}
-		janus_mutex_unlock(&clients_mutex);
+	/* Servers are watched from the start, clients as soon as they connect */
+	janus_pfunix_watch(write_fd[0], EPOLL_CTL_ADD, FALSE);
+	if(pfd > -1)
+		janus_pfunix_watch(pfd, EPOLL_CTL_ADD, FALSE);
+	if(admin_pfd > -1)
+		janus_pfunix_watch(admin_pfd, EPOLL_CTL_ADD, FALSE);
 
-		/* Start polling */
-		int res = poll(poll_fds, fds, -1);
+	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
+		int res = epoll_wait(epfd, events, JANUS_PFUNIX_MAX_EVENTS, -1);
 		if(res == 0)
 			continue;
 		if(res < 0) {
@@ -485,17 +615,19 @@ void *janus_pfunix_thread(void *data) {
 				JANUS_LOG(LOG_HUGE, "Got an EINTR (%s) polling the Unix Sockets descriptors, ignoring...\n", strerror(errno));
 				continue;
 			}
-			JANUS_LOG(LOG_ERR, "poll() failed: %d (%s)\n", errno, strerror(errno));
+			JANUS_LOG(LOG_ERR, "epoll_wait() failed: %d (%s)\n", errno, strerror(errno));
 			break;
 		}
-		int i = 0;
-		for(i=0; i<fds; i++) {
-			if(poll_fds[i].revents & (POLLERR | POLLHUP)) {
+		int nevents = res, i = 0;
+		for(i=0; i<nevents; i++) {
+			int fd = events[i].data.fd;
+			uint32_t revents = events[i].events;
+			if(revents & (EPOLLERR | EPOLLHUP)) {
 				/* Socket error? Shall we do something? */
-				if(poll_fds[i].fd == write_fd[0]) {
+				if(fd == write_fd[0]) {
 					/* Error in the wake-up socketpair, that sucks: try recreating it */
 					JANUS_LOG(LOG_WARN, "Error polling wake-up socketpair: %s...\n",
-						poll_fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
+						revents & EPOLLERR ? "EPOLLERR" : "EPOLLHUP");
 					close(write_fd[0]);
 					write_fd[0] = -1;
 					close(write_fd[1]);
@@ -504,30 +636,31 @@ void *janus_pfunix_thread(void *data) {
 						JANUS_LOG(LOG_FATAL, "Error creating socket pair for writeable events: %d, %s\n", errno, strerror(errno));
 						continue;
 					}
-				} else if(poll_fds[i].fd == pfd) {
+					janus_pfunix_watch(write_fd[0], EPOLL_CTL_ADD, FALSE);
+				} else if(fd == pfd) {
 					/* Error in the Janus API socket */
 					JANUS_LOG(LOG_WARN, "Error polling Unix Sockets Janus API interface (%s), disabling it\n",
-						poll_fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
+						revents & EPOLLERR ? "EPOLLERR" : "EPOLLHUP");
 					close(pfd);
 					pfd = -1;
 					continue;
-				} else if(poll_fds[i].fd == admin_pfd) {
+				} else if(fd == admin_pfd) {
 					/* Error in the Admin API socket */
 					JANUS_LOG(LOG_WARN, "Error polling Unix Sockets Admin API interface (%s), disabling it\n",
-						poll_fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
+						revents & EPOLLERR ? "EPOLLERR" : "EPOLLHUP");
 					close(admin_pfd);
 					admin_pfd = -1;
 					continue;
 				} else {
 					/* Error in a client socket, find and remove it */
 					janus_mutex_lock(&clients_mutex);
-					janus_pfunix_client *client = g_hash_table_lookup(clients_by_fd, GINT_TO_POINTER(poll_fds[i].fd));
+					janus_pfunix_client *client = g_hash_table_lookup(clients_by_fd, GINT_TO_POINTER(fd));
 					if(client == NULL) {
 						/* We're not handling this, ignore */
 						janus_mutex_unlock(&clients_mutex);
 						continue;
 					}
-					JANUS_LOG(LOG_INFO, "Unix Sockets client disconnected (%d)\n", poll_fds[i].fd);
+					JANUS_LOG(LOG_INFO, "Unix Sockets client disconnected (%d)\n", fd);
 					/* Notify core */
 					gateway->transport_gone(&janus_pfunix_transport, client);
 					/* Notify handlers about this transport being gone */
@@ -536,88 +669,54 @@ void *janus_pfunix_thread(void *data) {
 						json_object_set_new(info, "event", json_string("disconnected"));
 						gateway->notify_event(&janus_pfunix_transport, client, info);
 					}
-					/* Close socket */
-					shutdown(SHUT_RDWR, poll_fds[i].fd);
-					close(poll_fds[i].fd);
-					client->fd = -1;
-					/* Destroy the client */
-					g_hash_table_remove(clients_by_fd, GINT_TO_POINTER(poll_fds[i].fd));
-					g_hash_table_remove(clients, client);
-					if(client->messages != NULL) {
-						char *response = NULL;
-						while((response = g_async_queue_try_pop(client->messages)) != NULL) {
-							g_free(response);
-						}
-						g_async_queue_unref(client->messages);
-					}
-					g_free(client);
+					/* Close the socket and destroy the client */
+					janus_pfunix_client_destroy(client);
 					janus_mutex_unlock(&clients_mutex);
 					continue;
 				}
 				continue;
 			}
-			if(poll_fds[i].revents & POLLOUT) {
+			if(revents & EPOLLOUT) {
 				/* Find the client from its file descriptor */
 				janus_mutex_lock(&clients_mutex);
-				janus_pfunix_client *client = g_hash_table_lookup(clients_by_fd, GINT_TO_POINTER(poll_fds[i].fd));
+				janus_pfunix_client *client = g_hash_table_lookup(clients_by_fd, GINT_TO_POINTER(fd));
 				if(client != NULL) {
-					char *payload = NULL;
-					while((payload = g_async_queue_try_pop(client->messages)) != NULL) {
-						int res = 0;
-						do {
-							if(client->fd < 0)
-								break;
-							res = write(client->fd, payload, strlen(payload));
-						} while(res == -1 && errno == EINTR);
-						/* FIXME Should we check if sent everything? */
-						JANUS_LOG(LOG_HUGE, "Written %d/%zu bytes on %d\n", res, strlen(payload), client->fd);
-						g_free(payload);
-					}
-					if(client->session_timeout) {
+					janus_pfunix_client_flush(client);
+					if(client->session_timeout && client->pending == NULL) {
 						/* We should actually get rid of this connection, now */
-						shutdown(SHUT_RDWR, poll_fds[i].fd);
-						close(poll_fds[i].fd);
-						client->fd = -1;
-						/* Destroy the client */
-						g_hash_table_remove(clients_by_fd, GINT_TO_POINTER(poll_fds[i].fd));
-						g_hash_table_remove(clients, client);
-						if(client->messages != NULL) {
-							char *response = NULL;
-							while((response = g_async_queue_try_pop(client->messages)) != NULL) {
-								g_free(response);
-							}
-							g_async_queue_unref(client->messages);
-						}
-						g_free(client);
+						janus_pfunix_client_destroy(client);
+						janus_mutex_unlock(&clients_mutex);
+						continue;
 					}
 				}
 				janus_mutex_unlock(&clients_mutex);
 			}
-			if(poll_fds[i].revents & POLLIN) {
-				if(poll_fds[i].fd == write_fd[0]) {
-					/* Read and ignore: we use this to unlock the poll if there's data to write */
-					(void)read(poll_fds[i].fd, buffer, BUFFER_SIZE);
-				} else if(poll_fds[i].fd == pfd || poll_fds[i].fd == admin_pfd) {
+			if(revents & EPOLLIN) {
+				if(fd == write_fd[0]) {
+					/* Read and ignore: we use this to wake the loop up */
+					(void)read(fd, buffer, BUFFER_SIZE);
+				} else if(fd == pfd || fd == admin_pfd) {
 					/* Janus/Admin API: accept the new client (SOCK_SEQPACKET) or receive data (SOCK_DGRAM) */
 					struct sockaddr_un address;
 					socklen_t addrlen = sizeof(address);
-					if((poll_fds[i].fd == pfd && !dgram) || (poll_fds[i].fd == admin_pfd && !admin_dgram)) {
-						/* SOCK_SEQPACKET */
-						int cfd = accept(poll_fds[i].fd, (struct sockaddr *) &address, &addrlen);
-						if(cfd > -1) {
+					if((fd == pfd && !dgram) || (fd == admin_pfd && !admin_dgram)) {
+						/* SOCK_SEQPACKET: accept all the clients that are waiting */
+						int cfd = -1;
+						while((cfd = accept4(fd, (struct sockaddr *) &address, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC)) > -1) {
+							addrlen = sizeof(address);
 							JANUS_LOG(LOG_INFO, "Got new Unix Sockets %s API client: %d\n",
-								poll_fds[i].fd == pfd ? "Janus" : "Admin", cfd);
+								fd == pfd ? "Janus" : "Admin", cfd);
 							/* Allocate new client */
-							janus_pfunix_client *client = g_malloc(sizeof(janus_pfunix_client));
+							janus_pfunix_client *client = g_malloc0(sizeof(janus_pfunix_client));
 							client->fd = cfd;
-							memset(&client->addr, 0, sizeof(client->addr));
-							client->admin = (poll_fds[i].fd == admin_pfd);	/* API client type */
+							client->admin = (fd == admin_pfd);	/* API client type */
 							client->messages = g_async_queue_new();
 							client->session_timeout = FALSE;
 							/* Take note of this new client */
 							janus_mutex_lock(&clients_mutex);
 							g_hash_table_insert(clients_by_fd, GINT_TO_POINTER(cfd), client);
 							g_hash_table_insert(clients, client, client);
+							janus_pfunix_watch(cfd, EPOLL_CTL_ADD, FALSE);
 							janus_mutex_unlock(&clients_mutex);
 							/* Notify handlers about this new transport */
 							if(notify_events && gateway->events_is_enabled()) {
@@ -631,11 +730,11 @@ void *janus_pfunix_thread(void *data) {
 					} else {
 						/* SOCK_DGRAM */
 						struct sockaddr_storage address;
-						res = recvfrom(poll_fds[i].fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&address, &addrlen);
+						res = recvfrom(fd, buffer, sizeof(buffer)-1, 0, (struct sockaddr *)&address, &addrlen);
 						if(res < 0) {
 							if(errno != EAGAIN && errno != EWOULDBLOCK) {
 								JANUS_LOG(LOG_ERR, "Error reading from client (%s API)...\n",
-									poll_fds[i].fd == pfd ? "Janus" : "Admin");
+									fd == pfd ? "Janus" : "Admin");
 							}
 							continue;
 						}
@@ -651,16 +750,16 @@ void *janus_pfunix_thread(void *data) {
 						janus_pfunix_client *client = g_hash_table_lookup(clients_by_path, uaddr->sun_path);
 						if(client == NULL) {
 							JANUS_LOG(LOG_INFO, "Got new Unix Sockets %s API client: %s\n",
-								poll_fds[i].fd == pfd ? "Janus" : "Admin", uaddr->sun_path);
+								fd == pfd ? "Janus" : "Admin", uaddr->sun_path);
 							/* Allocate new client */
-							client = g_malloc(sizeof(janus_pfunix_client));
+							client = g_malloc0(sizeof(janus_pfunix_client));
 							client->fd = -1;
 							memcpy(&client->addr, uaddr, sizeof(struct sockaddr_un));
-							client->admin = (poll_fds[i].fd == admin_pfd);	/* API client type */
+							client->admin = (fd == admin_pfd);	/* API client type */
 							client->messages = g_async_queue_new();
 							client->session_timeout = FALSE;
 							/* Take note of this new client */
-							g_hash_table_insert(clients_by_path, uaddr->sun_path, client);
+							g_hash_table_insert(clients_by_path, client->addr.sun_path, client);
 							g_hash_table_insert(clients, client, client);
 							/* Notify handlers about this new transport */
 							if(notify_events && gateway->events_is_enabled()) {
@@ -683,32 +782,33 @@ void *janus_pfunix_thread(void *data) {
 					}
 				} else {
 					/* Client data: receive message */
-					iov[0].iov_len = sizeof(buffer);
-					res = recvmsg(poll_fds[i].fd, &msg, MSG_WAITALL);
+					iov[0].iov_len = sizeof(buffer)-1;
+					res = recvmsg(fd, &msg, 0);
 					if(res < 0) {
 						if(errno != EAGAIN && errno != EWOULDBLOCK) {
-							JANUS_LOG(LOG_ERR, "Error reading from client %d...\n", poll_fds[i].fd);
+							JANUS_LOG(LOG_ERR, "Error reading from client %d...\n", fd);
 						}
 						continue;
 					}
 					if(msg.msg_flags & MSG_TRUNC) {
 						/* Apparently our buffer is not large enough? */
-						JANUS_LOG(LOG_WARN, "Incoming message from client %d truncated (%d bytes), dropping it...\n", poll_fds[i].fd, res);
+						JANUS_LOG(LOG_WARN, "Incoming message from client %d truncated (%d bytes), dropping it...\n", fd, res);
 						continue;
 					}
 					/* Find the client from its file descriptor */
 					janus_mutex_lock(&clients_mutex);
-					janus_pfunix_client *client = g_hash_table_lookup(clients_by_fd, GINT_TO_POINTER(poll_fds[i].fd));
+					janus_pfunix_client *client = g_hash_table_lookup(clients_by_fd, GINT_TO_POINTER(fd));
 					if(client == NULL) {
 						janus_mutex_unlock(&clients_mutex);
-						JANUS_LOG(LOG_WARN, "Got data from unknown Unix Sockets client %d, closing connection...\n", poll_fds[i].fd);
+						JANUS_LOG(LOG_WARN, "Got data from unknown Unix Sockets client %d, closing connection...\n", fd);
 						/* Close socket */
-						shutdown(SHUT_RDWR, poll_fds[i].fd);
-						close(poll_fds[i].fd);
+						janus_pfunix_watch(fd, EPOLL_CTL_DEL, FALSE);
+						shutdown(fd, SHUT_RDWR);
+						close(fd);
 						continue;
 					}
 					if(res == 0) {
-						JANUS_LOG(LOG_INFO, "Unix Sockets client disconnected (%d)\n", poll_fds[i].fd);
+						JANUS_LOG(LOG_INFO, "Unix Sockets client disconnected (%d)\n", fd);
 						/* Notify core */
 						gateway->transport_gone(&janus_pfunix_transport, client);
 						/* Notify handlers about this transport being gone */
@@ -717,28 +817,15 @@ void *janus_pfunix_thread(void *data) {
 							json_object_set_new(info, "event", json_string("disconnected"));
 							gateway->notify_event(&janus_pfunix_transport, client, info);
 						}
-						/* Close socket */
-						shutdown(SHUT_RDWR, poll_fds[i].fd);
-						close(poll_fds[i].fd);
-						client->fd = -1;
-						/* Destroy the client */
-						g_hash_table_remove(clients_by_fd, GINT_TO_POINTER(poll_fds[i].fd));
-						g_hash_table_remove(clients, client);
-						if(client->messages != NULL) {
-							char *response = NULL;
-							while((response = g_async_queue_try_pop(client->messages)) != NULL) {
-								g_free(response);
-							}
-							g_async_queue_unref(client->messages);
-						}
-						g_free(client);
+						/* Close the socket and destroy the client */
+						janus_pfunix_client_destroy(client);
 						janus_mutex_unlock(&clients_mutex);
 						continue;
 					}
 					janus_mutex_unlock(&clients_mutex);
 					/* If we got here, there's data to handle */
 					buffer[res] = '\0';
-					JANUS_LOG(LOG_VERB, "Message from client %d (%d bytes)\n", poll_fds[i].fd, res);
+					JANUS_LOG(LOG_VERB, "Message from client %d (%d bytes)\n", fd, res);
 					JANUS_LOG(LOG_HUGE, "%s\n", buffer);
 					/* Parse the JSON payload */
 					json_error_t error;
@@ -41,6 +41,7 @@
 #include "../debug.h"
 #include "../apierror.h"
 #include "../config.h"
+#include "../metrics.h"
 #include "../mutex.h"
 #include "../utils.h"
 
@@ -111,7 +112,19 @@ static gboolean notify_events = TRUE;
 #define JANUS_RABBITMQ_EXCHANGE_TYPE "fanout"
 
 /* JSON serialization options */
-static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+static size_t json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
+
+/* How many queued messages we publish back to back before yielding */
+#define JANUS_RABBITMQ_DEFAULT_PUBLISH_BATCH	16
+static int publish_batch = JANUS_RABBITMQ_DEFAULT_PUBLISH_BATCH;
+/* How many published messages can be waiting for a confirm, if confirms are enabled */
+#define JANUS_RABBITMQ_DEFAULT_CONFIRM_WINDOW	64
+static int confirm_window = 0;
+/* How many threads parse incoming requests (1 means the incoming thread itself) */
+static int consumers_num = 1;
+
+/* Queue depth metrics */
+static janus_metric *rmq_outgoing_metric = NULL, *rmq_unconfirmed_metric = NULL, *rmq_incoming_metric = NULL;
 
 
 /* RabbitMQ client session: we only create a single one as of now */
@@ -127,6 +140,11 @@ typedef struct janus_rabbitmq_client {
 	amqp_bytes_t from_janus_admin_queue;	/* AMQP incoming messages queue (Admin API) */
 	GThread *in_thread, *out_thread;		/* Threads to handle incoming and outgoing queues */
 	GAsyncQueue *messages;					/* Queue of outgoing messages to push */
+	GThreadPool *consumers;					/* Threads parsing incoming requests, if more than one */
+	guint64 published, confirmed;			/* Delivery tags of the last published message and of the last one confirmed along with all before it */
+	gboolean *acked;						/* Messages after the confirmed one the broker acked individually (ring of confirm_window) */
+	guint64 acked_ahead;					/* How many of those there are */
+	janus_condition confirm_cond;			/* Condition to wait on when the confirm window is full */
 	janus_mutex mutex;						/* Mutex to lock/unlock this session */
 	gint session_timeout:1;					/* Whether a Janus session timeout occurred in the core */
 	gint destroy:1;							/* Flag to trigger a lazy session destruction */
@@ -140,9 +158,19 @@ typedef struct janus_rabbitmq_response {
 } janus_rabbitmq_response;
 static janus_rabbitmq_response exit_message;
 
+/* RabbitMQ request, when parsed by the consumer threads */
+typedef struct janus_rabbitmq_request {
+	gboolean admin;			/* Whether this is a Janus or Admin API request */
+	gchar *correlation_id;	/* Correlation ID, if any */
+	char *payload;			/* Payload as received from the queue */
+	size_t length;			/* Length of the payload */
+} janus_rabbitmq_request;
+
 /* Threads */
 void *janus_rmq_in_thread(void *data);
 void *janus_rmq_out_thread(void *data);
+static void janus_rmq_consumer(gpointer data, gpointer user_data);
+static gint64 janus_rmq_queue_depth(gpointer user_data);
 
 
 /* We only handle a single client per time, as the queues are fixed */
@@ -180,17 +208,17 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 	if(item && item->value) {
 		/* Check how we need to format/serialize the JSON output */
 		if(!strcasecmp(item->value, "indented")) {
-			/* Default: indented, we use three spaces for that */
+			/* Indented, we use three spaces for that */
 			json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 		} else if(!strcasecmp(item->value, "plain")) {
 			/* Not indented and no new lines, but still readable */
 			json_format = JSON_INDENT(0) | JSON_PRESERVE_ORDER;
 		} else if(!strcasecmp(item->value, "compact")) {
-			/* Compact, so no spaces between separators */
+			/* Default: compact, so no spaces between separators */
 			json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 		} else {
-			JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (indented)\n", item->value);
-			json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+			JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (compact)\n", item->value);
+			json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 		}
 	}
 
@@ -256,6 +284,32 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 			ssl_verify_hostname = TRUE;
 	}
 
+	/* Batching, confirms and consumers */
+	item = janus_config_get_item_drilldown(config, "general", "publish_batch");
+	if(item && item->value) {
+		publish_batch = atoi(item->value);
+		if(publish_batch < 1) {
+			JANUS_LOG(LOG_WARN, "Invalid publish_batch value %s, using 1\n", item->value);
+			publish_batch = 1;
+		}
+	}
+	item = janus_config_get_item_drilldown(config, "general", "publish_confirms");
+	if(item && item->value && janus_is_true(item->value)) {
+		confirm_window = JANUS_RABBITMQ_DEFAULT_CONFIRM_WINDOW;
+		item = janus_config_get_item_drilldown(config, "general", "confirm_window");
+		if(item && item->value && atoi(item->value) > 0)
+			confirm_window = atoi(item->value);
+		JANUS_LOG(LOG_INFO, "RabbitMQ publisher confirms enabled (window: %d)\n", confirm_window);
+	}
+	item = janus_config_get_item_drilldown(config, "general", "consumers");
+	if(item && item->value) {
+		consumers_num = atoi(item->value);
+		if(consumers_num < 1) {
+			JANUS_LOG(LOG_WARN, "Invalid consumers value %s, using 1\n", item->value);
+			consumers_num = 1;
+		}
+	}
+
 	/* Now check if the Janus API must be supported */
 	item = janus_config_get_item_drilldown(config, "general", "enable");
 	if(!item || !item->value || !janus_is_true(item->value)) {
@@ -376,6 +430,15 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 			JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error opening channel... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
 			goto error;
 		}
+		if(confirm_window > 0) {
+			JANUS_LOG(LOG_VERB, "Enabling publisher confirms...\n");
+			amqp_confirm_select(rmq_client->rmq_conn, rmq_client->rmq_channel);
+			result = amqp_get_rpc_reply(rmq_client->rmq_conn);
+			if(result.reply_type != AMQP_RESPONSE_NORMAL) {
+				JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error enabling confirms... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+				goto error;
+			}
+		}
 		rmq_client->janus_exchange = amqp_empty_bytes;
 		if(janus_exchange != NULL) {
 			JANUS_LOG(LOG_VERB, "Declaring exchange...\n");
@@ -441,7 +504,34 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 		}
 		rmq_client->messages = g_async_queue_new();
 		rmq_client->destroy = 0;
+		janus_mutex_init(&rmq_client->mutex);
+		janus_condition_init(&rmq_client->confirm_cond);
+		if(confirm_window > 0)
+			rmq_client->acked = g_malloc0(confirm_window * sizeof(gboolean));
 		GError *error = NULL;
+		if(consumers_num > 1) {
+			rmq_client->consumers = g_thread_pool_new(janus_rmq_consumer, NULL, consumers_num, FALSE, &error);
+			if(error != NULL) {
+				/* Something went wrong... */
+				JANUS_LOG(LOG_WARN, "Got error %d (%s) trying to launch the RabbitMQ consumers, parsing requests in the incoming thread\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				error = NULL;
+				rmq_client->consumers = NULL;
+			} else {
+				JANUS_LOG(LOG_INFO, "RabbitMQ requests will be parsed by %d consumer threads\n", consumers_num);
+			}
+		}
+		rmq_outgoing_metric = janus_metrics_add_callback("janus_rabbitmq_queue_depth", "queue=\"outgoing\"",
+			"Messages waiting in the RabbitMQ transport queues", JANUS_METRIC_GAUGE, janus_rmq_queue_depth, GINT_TO_POINTER(0));
+		if(rmq_client->consumers != NULL) {
+			rmq_incoming_metric = janus_metrics_add_callback("janus_rabbitmq_queue_depth", "queue=\"incoming\"",
+				"Messages waiting in the RabbitMQ transport queues", JANUS_METRIC_GAUGE, janus_rmq_queue_depth, GINT_TO_POINTER(1));
+		}
+		if(confirm_window > 0) {
+			rmq_unconfirmed_metric = janus_metrics_add_callback("janus_rabbitmq_unconfirmed", NULL,
+				"Messages published to RabbitMQ and not confirmed yet", JANUS_METRIC_GAUGE, janus_rmq_queue_depth, GINT_TO_POINTER(2));
+		}
 		rmq_client->in_thread = g_thread_try_new("rmq_in_thread", &janus_rmq_in_thread, rmq_client, &error);
 		if(error != NULL) {
 			/* Something went wrong... */
@@ -458,7 +548,6 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 			janus_config_destroy(config);
 			return -1;
 		}
-		janus_mutex_init(&rmq_client->mutex);
 		/* Done */
 		JANUS_LOG(LOG_INFO, "Setup of RabbitMQ integration completed\n");
 		/* Notify handlers about this new transport */
@@ -502,18 +591,34 @@ void janus_rabbitmq_destroy(void) {
 	g_atomic_int_set(&stopping, 1);
 
 	if(rmq_client) {
+		/* Remove the metrics first, as they access the queues we're about to get rid of */
+		janus_metrics_remove(rmq_outgoing_metric);
+		rmq_outgoing_metric = NULL;
+		janus_metrics_remove(rmq_incoming_metric);
+		rmq_incoming_metric = NULL;
+		janus_metrics_remove(rmq_unconfirmed_metric);
+		rmq_unconfirmed_metric = NULL;
 		rmq_client->destroy = 1;
 		g_async_queue_push(rmq_client->messages, &exit_message);
 		if(rmq_client->in_thread)
 			g_thread_join(rmq_client->in_thread);
 		if(rmq_client->out_thread)
 			g_thread_join(rmq_client->out_thread);
+		/* The incoming thread is gone, so nothing else will be added to the consumers */
+		if(rmq_client->consumers)
+			g_thread_pool_free(rmq_client->consumers, FALSE, TRUE);
+		rmq_client->consumers = NULL;
 		if(rmq_client->rmq_conn && rmq_client->rmq_channel) {
 			amqp_channel_close(rmq_client->rmq_conn, rmq_client->rmq_channel, AMQP_REPLY_SUCCESS);
 			amqp_connection_close(rmq_client->rmq_conn, AMQP_REPLY_SUCCESS);
 			amqp_destroy_connection(rmq_client->rmq_conn);
 		}
 	}
+	if(rmq_client) {
+		janus_mutex_destroy(&rmq_client->mutex);
+		janus_condition_destroy(&rmq_client->confirm_cond);
+		g_free(rmq_client->acked);
+	}
 	g_free(rmq_client);
 
 	g_free(rmqhost);
@@ -627,6 +732,44 @@ void *janus_rmq_in_thread(void *data) {
 		if(frame.frame_type != AMQP_FRAME_METHOD)
 			continue;
 		JANUS_LOG(LOG_VERB, "Method %s\n", amqp_method_name(frame.payload.method.id));
+		if(frame.payload.method.id == AMQP_BASIC_ACK_METHOD || frame.payload.method.id == AMQP_BASIC_NACK_METHOD) {
+			/* Publisher confirm: no header or body follows */
+			gboolean ack = (frame.payload.method.id == AMQP_BASIC_ACK_METHOD);
+			uint64_t tag = ack ? ((amqp_basic_ack_t *)frame.payload.method.decoded)->delivery_tag :
+				((amqp_basic_nack_t *)frame.payload.method.decoded)->delivery_tag;
+			gboolean multiple = ack ? ((amqp_basic_ack_t *)frame.payload.method.decoded)->multiple :
+				((amqp_basic_nack_t *)frame.payload.method.decoded)->multiple;
+			if(!ack)
+				JANUS_LOG(LOG_WARN, "RabbitMQ server rejected published message%s #%"SCNu64"\n", multiple ? "s up to" : "", tag);
+			janus_mutex_lock(&rmq_client->mutex);
+			if(rmq_client->acked != NULL && tag > rmq_client->confirmed && tag <= rmq_client->published) {
+				if(multiple) {
+					/* The tag covers everything published before it too */
+					while(rmq_client->confirmed < tag) {
+						rmq_client->confirmed++;
+						gboolean *slot = &rmq_client->acked[rmq_client->confirmed % confirm_window];
+						if(*slot) {
+							*slot = FALSE;
+							rmq_client->acked_ahead--;
+						}
+					}
+				} else if(!rmq_client->acked[tag % confirm_window]) {
+					/* Only this message, which may not be the oldest we're waiting for */
+					rmq_client->acked[tag % confirm_window] = TRUE;
+					rmq_client->acked_ahead++;
+				}
+				/* Move past the messages that were acked individually before */
+				while(rmq_client->confirmed < rmq_client->published &&
+						rmq_client->acked[(rmq_client->confirmed+1) % confirm_window]) {
+					rmq_client->confirmed++;
+					rmq_client->acked[rmq_client->confirmed % confirm_window] = FALSE;
+					rmq_client->acked_ahead--;
+				}
+			}
+			janus_condition_signal(&rmq_client->confirm_cond);
+			janus_mutex_unlock(&rmq_client->mutex);
+			continue;
+		}
 		gboolean admin = FALSE;
 		if(frame.payload.method.id == AMQP_BASIC_DELIVER_METHOD) {
 			amqp_basic_deliver_t *d = (amqp_basic_deliver_t *)frame.payload.method.decoded;
@@ -681,18 +824,101 @@ void *janus_rmq_in_thread(void *data) {
 		JANUS_LOG(LOG_VERB, "Got %"SCNu64"/%"SCNu64" bytes from the %s queue (%"SCNu64")\n",
 			received, total, admin ? "admin API" : "Janus API", frame.payload.body_fragment.len);
 		JANUS_LOG(LOG_VERB, "%s\n", payload);
-		/* Parse the JSON payload */
-		json_error_t error;
-		json_t *root = json_loads(payload, 0, &error);
-		g_free(payload);
-		/* Notify the core, passing both the object and, since it may be needed, the error
-		 * We also specify the correlation ID as an opaque request identifier: we'll need it later */
-		gateway->incoming_request(&janus_rabbitmq_transport, rmq_client, correlation, admin, root, &error);
+		janus_rabbitmq_request *request = g_malloc(sizeof(janus_rabbitmq_request));
+		request->admin = admin;
+		request->correlation_id = correlation;
+		request->payload = payload;
+		request->length = received;
+		if(rmq_client->consumers != NULL) {
+			/* Let one of the consumers parse it, we go back to reading frames */
+			g_thread_pool_push(rmq_client->consumers, request, NULL);
+		} else {
+			janus_rmq_consumer(request, NULL);
+		}
 	}
 	JANUS_LOG(LOG_INFO, "Leaving RabbitMQ in thread\n");
 	return NULL;
 }
 
+static void janus_rmq_consumer(gpointer data, gpointer user_data) {
+	janus_rabbitmq_request *request = (janus_rabbitmq_request *)data;
+	/* Parse the JSON payload */
+	json_error_t error;
+	json_t *root = json_loadb(request->payload, request->length, 0, &error);
+	g_free(request->payload);
+	/* Notify the core, passing both the object and, since it may be needed, the error
+	 * We also specify the correlation ID as an opaque request identifier: we'll need it later */
+	gateway->incoming_request(&janus_rabbitmq_transport, rmq_client, request->correlation_id, request->admin, root, &error);
+	g_free(request);
+}
+
+static gint64 janus_rmq_queue_depth(gpointer user_data) {
+	if(rmq_client == NULL)
+		return 0;
+	switch(GPOINTER_TO_INT(user_data)) {
+		case 0:
+			return g_async_queue_length(rmq_client->messages);
+		case 1:
+			return rmq_client->consumers ? g_thread_pool_unprocessed(rmq_client->consumers) : 0;
+		case 2: {
+			janus_mutex_lock(&rmq_client->mutex);
+			gint64 unconfirmed = rmq_client->published - rmq_client->confirmed - rmq_client->acked_ahead;
+			janus_mutex_unlock(&rmq_client->mutex);
+			return unconfirmed;
+		}
+		default:
+			break;
+	}
+	return 0;
+}
+
+/* Publish a queued message and free it: the mutex must be locked */
+static void janus_rmq_publish(janus_rabbitmq_response *response) {
+	if(confirm_window > 0) {
+		/* Don't get too far ahead of the oldest message the broker didn't confirm yet */
+		while(rmq_client->published - rmq_client->confirmed >= (guint64)confirm_window &&
+				!rmq_client->destroy && !g_atomic_int_get(&stopping)) {
+			gint64 until = g_get_real_time() + 50*G_TIME_SPAN_MILLISECOND;
+			struct timespec ts;
+			ts.tv_sec = until / G_USEC_PER_SEC;
+			ts.tv_nsec = (until % G_USEC_PER_SEC) * 1000;
+			janus_condition_timedwait(&rmq_client->confirm_cond, &rmq_client->mutex, &ts);
+		}
+	}
+	/* Gotcha! Convert json_t to string */
+	char *payload_text = json_dumps(response->payload, json_format);
+	json_decref(response->payload);
+	response->payload = NULL;
+	size_t length = strlen(payload_text);
+	JANUS_LOG(LOG_VERB, "Sending %s API message to RabbitMQ (%zu bytes)...\n", response->admin ? "Admin" : "Janus", length);
+	JANUS_LOG(LOG_VERB, "%s\n", payload_text);
+	amqp_basic_properties_t props;
+	props._flags = 0;
+	props._flags |= AMQP_BASIC_REPLY_TO_FLAG;
+	props.reply_to = amqp_cstring_bytes("Janus");
+	if(response->correlation_id) {
+		props._flags |= AMQP_BASIC_CORRELATION_ID_FLAG;
+		props.correlation_id = amqp_cstring_bytes(response->correlation_id);
+	}
+	props._flags |= AMQP_BASIC_CONTENT_TYPE_FLAG;
+	props.content_type = amqp_cstring_bytes("application/json");
+	amqp_bytes_t message;
+	message.len = length;
+	message.bytes = payload_text;
+	int status = amqp_basic_publish(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->janus_exchange,
+		response->admin ? rmq_client->from_janus_admin_queue : rmq_client->from_janus_queue,
+		0, 0, &props, message);
+	if(status != AMQP_STATUS_OK) {
+		JANUS_LOG(LOG_ERR, "Error publishing... %d, %s\n", status, amqp_error_string2(status));
+	} else if(confirm_window > 0) {
+		/* Delivery tags of confirms are just a counter of what we published on the channel */
+		rmq_client->published++;
+	}
+	g_free(response->correlation_id);
+	free(payload_text);
+	g_free(response);
+}
+
 void *janus_rmq_out_thread(void *data) {
 	if(rmq_client == NULL) {
 		JANUS_LOG(LOG_ERR, "No RabbitMQ connection??\n");
@@ -706,40 +932,30 @@ void *janus_rmq_out_thread(void *data) {
 			continue;
 		if(response == &exit_message)
 			break;
-		if(!rmq_client->destroy && !g_atomic_int_get(&stopping) && response->payload) {
-			janus_mutex_lock(&rmq_client->mutex);
-			/* Gotcha! Convert json_t to string */
-			char *payload_text = json_dumps(response->payload, json_format);
-			json_decref(response->payload);
-			response->payload = NULL;
-			JANUS_LOG(LOG_VERB, "Sending %s API message to RabbitMQ (%zu bytes)...\n", response->admin ? "Admin" : "Janus", strlen(payload_text));
-			JANUS_LOG(LOG_VERB, "%s\n", payload_text);
-			amqp_basic_properties_t props;
-			props._flags = 0;
-			props._flags |= AMQP_BASIC_REPLY_TO_FLAG;
-			props.reply_to = amqp_cstring_bytes("Janus");
-			if(response->correlation_id) {
-				props._flags |= AMQP_BASIC_CORRELATION_ID_FLAG;
-				props.correlation_id = amqp_cstring_bytes(response->correlation_id);
+		/* Publish whatever else is queued back to back, rather than waking up for each message */
+		janus_mutex_lock(&rmq_client->mutex);
+		int batched = 0;
+		while(response != NULL) {
+			if(response == &exit_message) {
+				janus_mutex_unlock(&rmq_client->mutex);
+				goto done;
 			}
-			props._flags |= AMQP_BASIC_CONTENT_TYPE_FLAG;
-			props.content_type = amqp_cstring_bytes("application/json");
-			amqp_bytes_t message = amqp_cstring_bytes(payload_text);
-			int status = amqp_basic_publish(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->janus_exchange,
-				response->admin ? rmq_client->from_janus_admin_queue : rmq_client->from_janus_queue,
-				0, 0, &props, message);
-			if(status != AMQP_STATUS_OK) {
-				JANUS_LOG(LOG_ERR, "Error publishing... %d, %s\n", status, amqp_error_string2(status));
+			if(!rmq_client->destroy && !g_atomic_int_get(&stopping) && response->payload) {
+				janus_rmq_publish(response);
+			} else {
+				if(response->payload)
+					json_decref(response->payload);
+				g_free(response->correlation_id);
+				g_free(response);
 			}
-			g_free(response->correlation_id);
-			response->correlation_id = NULL;
-			free(payload_text);
-			payload_text = NULL;
-			g_free(response);
-			response = NULL;
-			janus_mutex_unlock(&rmq_client->mutex);
+			batched++;
+			if(batched >= publish_batch)
+				break;
+			response = g_async_queue_try_pop(rmq_client->messages);
 		}
+		janus_mutex_unlock(&rmq_client->mutex);
 	}
+done:
 	g_async_queue_unref(rmq_client->messages);
 	JANUS_LOG(LOG_INFO, "Leaving RabbitMQ out thread\n");
 	return NULL;
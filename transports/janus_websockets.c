@@ -39,6 +39,7 @@
 #include "../config.h"
 #include "../mutex.h"
 #include "../utils.h"
+#include "../metrics.h"
 
 
 /* Transport plugin information */
@@ -63,6 +64,7 @@ const char *janus_websockets_get_package(void);
 gboolean janus_websockets_is_janus_api_enabled(void);
 gboolean janus_websockets_is_admin_api_enabled(void);
 int janus_websockets_send_message(void *transport, void *request_id, gboolean admin, json_t *message);
+int janus_websockets_send_message_text(void *transport, void *request_id, gboolean admin, char *text, size_t length);
 void janus_websockets_session_created(void *transport, guint64 session_id);
 void janus_websockets_session_over(void *transport, guint64 session_id, gboolean timeout);
 
@@ -85,6 +87,7 @@ static janus_transport janus_websockets_transport =
 		.is_admin_api_enabled = janus_websockets_is_admin_api_enabled,
 
 		.send_message = janus_websockets_send_message,
+		.send_message_text = janus_websockets_send_message_text,
 		.session_created = janus_websockets_session_created,
 		.session_over = janus_websockets_session_over,
 	);
@@ -104,15 +107,20 @@ static gboolean ws_admin_api_enabled = FALSE;
 static gboolean notify_events = TRUE;
 
 /* JSON serialization options */
-static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+static size_t json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 
 
 /* Logging */
 static int ws_log_level = 0;
 
-/* WebSockets service thread */
-static GThread *ws_thread = NULL;
+/* WebSockets service threads: libwebsockets binds each connection to one of them */
+static int ws_threads = 1;
+static GThread **ws_thread = NULL;
 void *janus_websockets_thread(void *data);
+/* Index of the service thread we're in (plus one, as 0 means none) */
+static GPrivate ws_thread_index;
+/* How many connections each service thread is serving */
+static janus_metric **ws_thread_clients = NULL;
 
 
 /* WebSocket client session */
@@ -125,6 +133,7 @@ typedef struct janus_websockets_client {
 	int bufpending;							/* Data an interrupted previous write couldn't send */
 	int bufoffset;							/* Offset from where the interrupted previous write should resume */
 	janus_mutex mutex;						/* Mutex to lock/unlock this session */
+	int thread;								/* Index of the service thread this connection is bound to */
 	gint session_timeout:1;					/* Whether a Janus session timeout occurred in the core */
 	gint destroy:1;							/* Flag to trigger a lazy session destruction */
 } janus_websockets_client;
@@ -183,6 +192,15 @@ static struct lws_protocols admin_sws_protocols[] = {
 	{ "janus-admin-protocol", janus_websockets_admin_callback_secure, sizeof(janus_websockets_client), 0 },
 	{ NULL, NULL, 0 }
 };
+/* Optional permessage-deflate extension, for large JSON payloads */
+#if !defined(LWS_WITHOUT_EXTENSIONS) && !defined(LWS_NO_EXTENSIONS)
+static const struct lws_extension ws_deflate_extensions[] = {
+	{ "permessage-deflate", lws_extension_callback_pm_deflate,
+		"permessage-deflate; client_no_context_takeover; client_max_window_bits" },
+	{ NULL, NULL, NULL }
+};
+#endif
+static const struct lws_extension *ws_extensions = NULL;
 /* Helper for debugging reasons */
 #define CASE_STR(name) case name: return #name
 static const char *janus_websockets_reason_string(enum lws_callback_reasons reason) {
@@ -338,17 +356,17 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 		if(item && item->value) {
 			/* Check how we need to format/serialize the JSON output */
 			if(!strcasecmp(item->value, "indented")) {
-				/* Default: indented, we use three spaces for that */
+				/* Indented, we use three spaces for that */
 				json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 			} else if(!strcasecmp(item->value, "plain")) {
 				/* Not indented and no new lines, but still readable */
 				json_format = JSON_INDENT(0) | JSON_PRESERVE_ORDER;
 			} else if(!strcasecmp(item->value, "compact")) {
-				/* Compact, so no spaces between separators */
+				/* Default: compact, so no spaces between separators */
 				json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 			} else {
-				JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (indented)\n", item->value);
-				json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+				JANUS_LOG(LOG_WARN, "Unsupported JSON format option '%s', using default (compact)\n", item->value);
+				json_format = JSON_COMPACT | JSON_PRESERVE_ORDER;
 			}
 		}
 
@@ -443,8 +461,38 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 			wscinfo.timeout_secs = pingpong_timeout;
 		}
 #endif
-		/* Force single-thread server */
-		wscinfo.count_threads = 1;
+		/* How many service threads should we use? */
+		item = janus_config_get_item_drilldown(config, "general", "ws_threads");
+		if(item && item->value) {
+			ws_threads = atoi(item->value);
+			if(ws_threads < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid value for ws_threads (%d), using 1 instead...\n", ws_threads);
+				ws_threads = 1;
+			}
+#ifdef LWS_MAX_SMP
+			if(ws_threads > LWS_MAX_SMP) {
+				JANUS_LOG(LOG_WARN, "libwebsockets was built with LWS_MAX_SMP=%d, using %d service threads instead of %d...\n",
+					LWS_MAX_SMP, LWS_MAX_SMP, ws_threads);
+				ws_threads = LWS_MAX_SMP;
+			}
+#else
+			if(ws_threads > 1) {
+				JANUS_LOG(LOG_WARN, "libwebsockets was built without multiple service threads support, using 1 service thread...\n");
+				ws_threads = 1;
+			}
+#endif
+		}
+		wscinfo.count_threads = ws_threads;
+		/* Should we compress messages? */
+		item = janus_config_get_item_drilldown(config, "general", "permessage_deflate");
+		if(item && item->value && janus_is_true(item->value)) {
+#if !defined(LWS_WITHOUT_EXTENSIONS) && !defined(LWS_NO_EXTENSIONS)
+			ws_extensions = ws_deflate_extensions;
+			JANUS_LOG(LOG_INFO, "WebSockets permessage-deflate compression enabled\n");
+#else
+			JANUS_LOG(LOG_WARN, "libwebsockets was built without extensions support, permessage-deflate disabled\n");
+#endif
+		}
 
 		/* Create the base context */
 		wsc = lws_create_context(&wscinfo);
@@ -483,7 +531,7 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 			info.port = wsport;
 			info.iface = ip ? ip : interface;
 			info.protocols = ws_protocols;
-			info.extensions = NULL;
+			info.extensions = ws_extensions;
 			info.ssl_cert_filepath = NULL;
 			info.ssl_private_key_filepath = NULL;
 			info.ssl_private_key_password = NULL;
@@ -541,7 +589,7 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 				info.port = wsport;
 				info.iface = ip ? ip : interface;
 				info.protocols = sws_protocols;
-				info.extensions = NULL;
+				info.extensions = ws_extensions;
 				info.ssl_cert_filepath = server_pem;
 				info.ssl_private_key_filepath = server_key;
 				info.ssl_private_key_password = password;
@@ -591,7 +639,7 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 			info.port = wsport;
 			info.iface = ip ? ip : interface;
 			info.protocols = admin_ws_protocols;
-			info.extensions = NULL;
+			info.extensions = ws_extensions;
 			info.ssl_cert_filepath = NULL;
 			info.ssl_private_key_filepath = NULL;
 			info.ssl_private_key_password = NULL;
@@ -649,7 +697,7 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 				info.port = wsport;
 				info.iface = ip ? ip : interface;
 				info.protocols = admin_sws_protocols;
-				info.extensions = NULL;
+				info.extensions = ws_extensions;
 				info.ssl_cert_filepath = server_pem;
 				info.ssl_private_key_filepath = server_key;
 				info.ssl_private_key_password = password;
@@ -684,14 +732,28 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
-	/* Start the WebSocket service thread */
+	/* Start the WebSocket service threads */
 	if(ws_janus_api_enabled || ws_admin_api_enabled) {
-		ws_thread = g_thread_try_new("ws thread", &janus_websockets_thread, wsc, &error);
-		if(!ws_thread) {
-			g_atomic_int_set(&initialized, 0);
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the WebSockets thread...\n", error->code, error->message ? error->message : "??");
-			return -1;
+		ws_thread = g_malloc0(ws_threads * sizeof(GThread *));
+		ws_thread_clients = g_malloc0(ws_threads * sizeof(janus_metric *));
+		int i = 0;
+		for(i=0; i<ws_threads; i++) {
+			char labels[32], tname[16];
+			g_snprintf(labels, sizeof(labels), "thread=\"%d\"", i);
+			ws_thread_clients[i] = janus_metrics_add("janus_websockets_connections", labels,
+				"WebSocket connections served by each service thread", JANUS_METRIC_GAUGE);
+			g_snprintf(tname, sizeof(tname), "ws thread %d", i);
+			ws_thread[i] = g_thread_try_new(tname, &janus_websockets_thread, GINT_TO_POINTER(i), &error);
+			if(!ws_thread[i]) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the WebSockets thread #%d...\n",
+					error->code, error->message ? error->message : "??", i);
+				g_error_free(error);
+				/* Connections bound to this thread would never be served, give up */
+				janus_websockets_destroy();
+				return -1;
+			}
 		}
+		JANUS_LOG(LOG_INFO, "WebSockets will be served by %d thread(s)\n", ws_threads);
 	}
 
 	/* Done */
@@ -704,9 +766,14 @@ void janus_websockets_destroy(void) {
 		return;
 	g_atomic_int_set(&stopping, 1);
 
-	/* Stop the service thread */
+	/* Stop the service threads */
 	if(ws_thread != NULL) {
-		g_thread_join(ws_thread);
+		int i = 0;
+		for(i=0; i<ws_threads; i++) {
+			if(ws_thread[i] != NULL)
+				g_thread_join(ws_thread[i]);
+		}
+		g_free(ws_thread);
 		ws_thread = NULL;
 	}
 
@@ -715,6 +782,13 @@ void janus_websockets_destroy(void) {
 		lws_context_destroy(wsc);
 		wsc = NULL;
 	}
+	if(ws_thread_clients != NULL) {
+		int i = 0;
+		for(i=0; i<ws_threads; i++)
+			janus_metrics_remove(ws_thread_clients[i]);
+		g_free(ws_thread_clients);
+		ws_thread_clients = NULL;
+	}
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -742,6 +816,9 @@ static void janus_websockets_destroy_client(
 	/* Cleanup */
 	janus_mutex_lock(&ws_client->mutex);
 	JANUS_LOG(LOG_INFO, "[%s-%p] Destroying WebSocket client\n", log_prefix, wsi);
+	if(ws_client->thread >= 0 && ws_client->thread < ws_threads)
+		janus_metrics_dec(ws_thread_clients[ws_client->thread]);
+	ws_client->thread = -1;
 	ws_client->destroy = 1;
 	ws_client->wsi = NULL;
 	/* Remove messages queue too, if needed */
@@ -828,6 +905,30 @@ int janus_websockets_send_message(void *transport, void *request_id, gboolean ad
 	return 0;
 }
 
+int janus_websockets_send_message_text(void *transport, void *request_id, gboolean admin, char *text, size_t length) {
+	if(text == NULL)
+		return -1;
+	if(transport == NULL) {
+		free(text);
+		return -1;
+	}
+	/* Make sure this is not related to a closed /freed WebSocket session */
+	janus_mutex_lock(&old_wss_mutex);
+	janus_websockets_client *client = (janus_websockets_client *)transport;
+	if(g_list_find(old_wss, client) != NULL || !client->wsi) {
+		janus_mutex_unlock(&old_wss_mutex);
+		free(text);
+		return -1;
+	}
+	janus_mutex_lock(&client->mutex);
+	/* Already serialized, just enqueue */
+	g_async_queue_push(client->messages, text);
+	lws_callback_on_writable(client->wsi);
+	janus_mutex_unlock(&client->mutex);
+	janus_mutex_unlock(&old_wss_mutex);
+	return 0;
+}
+
 void janus_websockets_session_created(void *transport, guint64 session_id) {
 	/* We don't care */
 }
@@ -851,23 +952,27 @@ void janus_websockets_session_over(void *transport, guint64 session_id, gboolean
 
 /* Thread */
 void *janus_websockets_thread(void *data) {
-	struct lws_context *service = (struct lws_context *)data;
+	int tsi = GPOINTER_TO_INT(data);
+	struct lws_context *service = wsc;
 	if(service == NULL) {
 		JANUS_LOG(LOG_ERR, "Invalid service\n");
 		return NULL;
 	}
+	/* Callbacks for the connections bound to this thread will be invoked here */
+	g_private_set(&ws_thread_index, GINT_TO_POINTER(tsi+1));
 
-	JANUS_LOG(LOG_INFO, "WebSockets thread started\n");
+	JANUS_LOG(LOG_INFO, "WebSockets thread #%d started\n", tsi);
 
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		/* libwebsockets is single thread, we cycle through events here */
-		lws_service(service, 50);
+		/* Each service thread cycles through the events of its own connections */
+		lws_service_tsi(service, 50, tsi);
 	}
 
 	/* Get rid of the WebSockets server */
-	lws_cancel_service(service);
+	if(tsi == 0)
+		lws_cancel_service(service);
 	/* Done */
-	JANUS_LOG(LOG_INFO, "WebSockets thread ended\n");
+	JANUS_LOG(LOG_INFO, "WebSockets thread #%d ended\n", tsi);
 	return NULL;
 }
 
@@ -928,6 +1033,9 @@ static int janus_websockets_common_callback(
 	switch(reason) {
 		// ws连接建立完成
 		case LWS_CALLBACK_ESTABLISHED: {
+			/* Not bound to a service thread until accepted */
+			if(ws_client != NULL)
+				ws_client->thread = -1;
 			/* Is there any filtering we should apply? */
 			char ip[256];
 #ifdef HAVE_LIBWEBSOCKETS_PEER_SIMPLE
@@ -965,6 +1073,13 @@ static int janus_websockets_common_callback(
 			ws_client->session_timeout = 0;
 			ws_client->destroy = 0;
 			janus_mutex_init(&ws_client->mutex);
+			/* Keep track of the service thread this connection is bound to */
+			ws_client->thread = GPOINTER_TO_INT(g_private_get(&ws_thread_index)) - 1;
+			if(ws_client->thread >= 0 && ws_client->thread < ws_threads) {
+				janus_metrics_inc(ws_thread_clients[ws_client->thread]);
+				JANUS_LOG(LOG_VERB, "[%s-%p]   -- Served by thread #%d (%"SCNi64" connections)\n", log_prefix, wsi,
+					ws_client->thread, janus_metrics_get(ws_thread_clients[ws_client->thread]));
+			}
 			/* Let us know when the WebSocket channel becomes writeable */
 			lws_callback_on_writable(wsi);
 			JANUS_LOG(LOG_VERB, "[%s-%p]   -- Ready to be used!\n", log_prefix, wsi);
@@ -1045,34 +1160,35 @@ static int janus_websockets_common_callback(
 					janus_mutex_unlock(&ws_client->mutex);
 					return 0;
 				}
-				/* Shoot all the pending messages */
+				/* Shoot the next pending message: libwebsockets only allows a single
+				 * lws_write per writable callback (which permessage-deflate needs too),
+				 * so we ask for another callback right away if there's more to send */
 				char *response = g_async_queue_try_pop(ws_client->messages);
-				if(response && !ws_client->destroy && !g_atomic_int_get(&stopping)) {
+				if(response != NULL) {
 					/* Gotcha! */
-					int buflen = LWS_SEND_BUFFER_PRE_PADDING + strlen(response) + LWS_SEND_BUFFER_POST_PADDING;
+					int resplen = strlen(response);
+					int buflen = LWS_SEND_BUFFER_PRE_PADDING + resplen + LWS_SEND_BUFFER_POST_PADDING;
 					if (buflen > ws_client->buflen) {
 						/* We need a larger shared buffer */
-						JANUS_LOG(LOG_HUGE, "[%s-%p] Re-allocating to %d bytes (was %d, response is %zu bytes)\n", log_prefix, wsi, buflen, ws_client->buflen, strlen(response));
+						JANUS_LOG(LOG_HUGE, "[%s-%p] Re-allocating to %d bytes (was %d, response is %d bytes)\n", log_prefix, wsi, buflen, ws_client->buflen, resplen);
 						ws_client->buflen = buflen;
 						ws_client->buffer = g_realloc(ws_client->buffer, buflen);
 					}
-					memcpy(ws_client->buffer + LWS_SEND_BUFFER_PRE_PADDING, response, strlen(response));
-					JANUS_LOG(LOG_HUGE, "[%s-%p] Sending WebSocket message (%zu bytes)...\n", log_prefix, wsi, strlen(response));
-					int sent = lws_write(wsi, ws_client->buffer + LWS_SEND_BUFFER_PRE_PADDING, strlen(response), LWS_WRITE_TEXT);
-					JANUS_LOG(LOG_HUGE, "[%s-%p]   -- Sent %d/%zu bytes\n", log_prefix, wsi, sent, strlen(response));
-					if(sent > -1 && sent < (int)strlen(response)) {
+					memcpy(ws_client->buffer + LWS_SEND_BUFFER_PRE_PADDING, response, resplen);
+					JANUS_LOG(LOG_HUGE, "[%s-%p] Sending WebSocket message (%d bytes)...\n", log_prefix, wsi, resplen);
+					int sent = lws_write(wsi, ws_client->buffer + LWS_SEND_BUFFER_PRE_PADDING, resplen, LWS_WRITE_TEXT);
+					JANUS_LOG(LOG_HUGE, "[%s-%p]   -- Sent %d/%d bytes\n", log_prefix, wsi, sent, resplen);
+					/* We can get rid of the message */
+					free(response);
+					if(sent > -1 && sent < resplen) {
 						/* We couldn't send everything in a single write, we'll complete this in the next round */
-						ws_client->bufpending = strlen(response) - sent;
+						ws_client->bufpending = resplen - sent;
 						ws_client->bufoffset = LWS_SEND_BUFFER_PRE_PADDING + sent;
 						JANUS_LOG(LOG_HUGE, "[%s-%p]   -- Couldn't write all bytes (%d missing), setting offset %d\n",
 							log_prefix, wsi, ws_client->bufpending, ws_client->bufoffset);
 					}
-					/* We can get rid of the message */
-					free(response);
-					/* Done for this round, check the next response/notification later */
+					/* Done for this round, check the next responses/notifications later */
 					lws_callback_on_writable(wsi);
-					janus_mutex_unlock(&ws_client->mutex);
-					return 0;
 				}
 				janus_mutex_unlock(&ws_client->mutex);
 			}
@@ -60,7 +60,10 @@ janus_transport *create(void) {
  * 
  * All the above methods and callbacks are mandatory: the Janus core will
  * reject a transport plugin that doesn't implement any of the
- * mandatory callbacks.
+ * mandatory callbacks. Transports can also implement \c send_message_text(),
+ * which is optional: when available, the core uses it to send events that
+ * it already serialized itself (e.g., the same event pushed by a plugin to
+ * all the participants of a room), rather than passing a json_t object.
  * 
  * The gateway \c janus_transport_callbacks interface is provided to a
  * transport plugin, together with the path to the configurations files
@@ -94,7 +97,7 @@ janus_transport *create(void) {
 
 
 /*! \brief Version of the API, to match the one transport plugins were compiled against */
-#define JANUS_TRANSPORT_API_VERSION	6
+#define JANUS_TRANSPORT_API_VERSION	7
 
 /*! \brief Initialization of all transport plugin properties to NULL
  * 
@@ -125,6 +128,7 @@ static janus_transport janus_http_transport plugin =
 		.send_message = NULL,			\
 		.session_created = NULL,		\
 		.session_over = NULL,			\
+		.send_message_text = NULL,		\
 		## __VA_ARGS__ }
 
 
@@ -188,6 +192,17 @@ struct janus_transport {
 	 * @param[in] 会话关闭的原因是否是超时 */
 	void (* const session_over)(void *transport, guint64 session_id, gboolean timeout);
 
+	/*! \brief Optional method to send a client an event the core already serialized
+	 * \note The transport plugin owns the text, and must free it with \c free when
+	 * done, whether or not it could be sent. Only used for events, for now.
+	 * @param[in] transport Pointer to the transport session instance
+	 * @param[in] request_id Will be NULL, as this is an event
+	 * @param[in] admin Whether this is an admin API or a Janus API message
+	 * @param[in] text The serialized JSON message, in compact format
+	 * @param[in] length The length of the text
+	 * @returns 0 on success, a negative integer otherwise */
+	int (* const send_message_text)(void *transport, void *request_id, gboolean admin, char *text, size_t length);
+
 };
 
 /*! \brief 传输插件调用的网关函数(Callbacks to contact the gateway)*/
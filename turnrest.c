@@ -6,7 +6,9 @@
  * draft, that is a REST API that can be used to access TURN services,
  * more specifically credentials to use. Currently implemented in both
  * rfc5766-turn-server and coturn, and so should be generic enough to
- * be usable here.
+ * be usable here. Credentials are retrieved by a background thread, that
+ * refreshes them before their time-to-live expires: handles just get a
+ * copy of the cached ones, and so never wait for the backend to answer.
  * \note This implementation depends on \c libcurl and is optional.
  * 
  * \ingroup core
@@ -26,11 +28,31 @@
 #include "debug.h"
 #include "mutex.h"
 #include "ip-utils.h"
+#include "utils.h"
+
+/* How long we wait for the backend, at most */
+#define JANUS_TURNREST_TIMEOUT			10
+/* How often we refresh credentials when the backend doesn't tell us their ttl */
+#define JANUS_TURNREST_DEFAULT_TTL		300
+/* How long we wait before trying again, when a request fails */
+#define JANUS_TURNREST_RETRY			(5*G_USEC_PER_SEC)
 
 static const char *api_server = NULL;
 static const char *api_key = NULL;
 static gboolean api_http_get = FALSE;
 static janus_mutex api_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_condition api_cond;
+/* Incremented any time the backend changes, to discard responses from the old one */
+static guint api_generation = 0;
+
+/* Cached credentials, and when they expire/should be refreshed (monotonic time) */
+static janus_turnrest_response *cached = NULL;
+static gint64 cached_expiry = 0, next_refresh = 0;
+
+/* Background thread refreshing the credentials */
+static GThread *refresher = NULL;
+static volatile gint stopping = 0;
+static void *janus_turnrest_thread(void *data);
 
 
 /* Buffer we use to receive the response via libcurl */
@@ -57,17 +79,40 @@ static size_t janus_turnrest_callback(void *payload, size_t size, size_t nmemb,
 void janus_turnrest_init(void) {
 	/* Initialize libcurl, needed for contacting the TURN REST API backend */
 	curl_global_init(CURL_GLOBAL_ALL);
+	janus_condition_init(&api_cond);
+	g_atomic_int_set(&stopping, 0);
+	GError *error = NULL;
+	refresher = g_thread_try_new("turnrest", &janus_turnrest_thread, NULL, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the TURN REST API thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		refresher = NULL;
+	}
 }
 
 void janus_turnrest_deinit(void) {
+	/* Stop the refresher thread: an ongoing request is aborted */
+	janus_mutex_lock(&api_mutex);
+	g_atomic_int_set(&stopping, 1);
+	janus_condition_signal(&api_cond);
+	janus_mutex_unlock(&api_mutex);
+	if(refresher != NULL)
+		g_thread_join(refresher);
+	refresher = NULL;
 	/* Cleanup the libcurl initialization */
 	curl_global_cleanup();
 	janus_mutex_lock(&api_mutex);
 	if(api_server != NULL)
 		g_free((char *)api_server);
+	api_server = NULL;
 	if(api_key != NULL)
 		g_free((char *)api_key);
+	api_key = NULL;
+	janus_turnrest_response_destroy(cached);
+	cached = NULL;
 	janus_mutex_unlock(&api_mutex);
+	janus_condition_destroy(&api_cond);
 }
 
 void janus_turnrest_set_backend(const char *server, const char *key, const char *method) {
@@ -80,6 +125,12 @@ void janus_turnrest_set_backend(const char *server, const char *key, const char
 	if(api_key != NULL)
 		g_free((char *)api_key);
 	api_key = NULL;
+	/* Whatever we cached came from the old backend */
+	janus_turnrest_response_destroy(cached);
+	cached = NULL;
+	cached_expiry = 0;
+	next_refresh = 0;
+	api_generation++;
 
 	if(server != NULL) {
 		/* Set a new server now */
@@ -96,6 +147,8 @@ void janus_turnrest_set_backend(const char *server, const char *key, const char
 				api_http_get = FALSE;
 			}
 		}
+		/* Have the refresher fetch credentials right away */
+		janus_condition_signal(&api_cond);
 	}
 	janus_mutex_unlock(&api_mutex);
 }
@@ -118,6 +171,27 @@ void janus_turnrest_response_destroy(janus_turnrest_response *response) {
 	g_free(response->username);
 	g_free(response->password);
 	g_list_free_full(response->servers, janus_turnrest_instance_destroy);
+	g_free(response);
+}
+
+static janus_turnrest_response *janus_turnrest_response_copy(janus_turnrest_response *response) {
+	janus_turnrest_response *copy = g_malloc(sizeof(janus_turnrest_response));
+	copy->username = g_strdup(response->username);
+	copy->password = g_strdup(response->password);
+	copy->ttl = response->ttl;
+	copy->servers = NULL;
+	GList *temp = response->servers;
+	while(temp) {
+		janus_turnrest_instance *instance = (janus_turnrest_instance *)temp->data;
+		janus_turnrest_instance *ic = g_malloc(sizeof(janus_turnrest_instance));
+		ic->server = g_strdup(instance->server);
+		ic->port = instance->port;
+		ic->transport = instance->transport;
+		copy->servers = g_list_prepend(copy->servers, ic);
+		temp = temp->next;
+	}
+	copy->servers = g_list_reverse(copy->servers);
+	return copy;
 }
 
 janus_turnrest_response *janus_turnrest_request(void) {
@@ -126,32 +200,33 @@ janus_turnrest_response *janus_turnrest_request(void) {
 		janus_mutex_unlock(&api_mutex);
 		return NULL;
 	}
-	/* Prepare the request URI */
-	char query_string[512];
-	g_snprintf(query_string, 512, "service=turn");
-	if(api_key != NULL) {
-		char buffer[256];
-		g_snprintf(buffer, 256, "&api=%s", api_key);
-		g_strlcat(query_string, buffer, 512);
+	if(cached == NULL || janus_get_monotonic_time() >= cached_expiry) {
+		/* Nothing (valid) yet: don't wait, the refresher is already on it */
+		JANUS_LOG(LOG_WARN, "No valid credentials from the TURN REST API backend yet\n");
+		janus_mutex_unlock(&api_mutex);
+		return NULL;
 	}
-	char request_uri[1024];
-	g_snprintf(request_uri, 1024, "%s?%s", api_server, query_string);
-	JANUS_LOG(LOG_VERB, "Sending request: %s\n", request_uri);
+	janus_turnrest_response *response = janus_turnrest_response_copy(cached);
 	janus_mutex_unlock(&api_mutex);
+	return response;
+}
+
+/* Send a request to the backend, using a multi handle so that we can abort it if needed */
+static char *janus_turnrest_fetch(const char *request_uri, const char *query_string, gboolean http_get, guint generation) {
 	/* Prepare the libcurl context */
-	CURLcode res;
 	CURL *curl = curl_easy_init();
 	if(curl == NULL) {
 		JANUS_LOG(LOG_ERR, "libcurl error\n");
 		return NULL;
 	}
 	curl_easy_setopt(curl, CURLOPT_URL, request_uri);
-	curl_easy_setopt(curl, api_http_get ? CURLOPT_HTTPGET : CURLOPT_POST, 1);
-	if(!api_http_get) {
+	curl_easy_setopt(curl, http_get ? CURLOPT_HTTPGET : CURLOPT_POST, 1);
+	if(!http_get) {
 		/* FIXME Some servers don't like a POST with no data */
 		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, query_string);
 	}
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);	/* FIXME Max 10 seconds */
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)JANUS_TURNREST_TIMEOUT);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
 	/* For getting data, we use an helper struct and the libcurl callback */
 	janus_turnrest_buffer data;
 	data.buffer = g_malloc0(1);
@@ -159,57 +234,97 @@ janus_turnrest_response *janus_turnrest_request(void) {
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_turnrest_callback);
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&data);
 	curl_easy_setopt(curl, CURLOPT_USERAGENT, "Janus/1.0");
-	/* Send the request */
-	res = curl_easy_perform(curl);
+	CURLM *multi = curl_multi_init();
+	curl_multi_add_handle(multi, curl);
+	/* Send the request, checking every now and then if we should give up */
+	int running = 1;
+	gboolean aborted = FALSE;
+	while(running) {
+		if(g_atomic_int_get(&stopping) || generation != g_atomic_int_get(&api_generation)) {
+			aborted = TRUE;
+			break;
+		}
+		CURLMcode mc = curl_multi_perform(multi, &running);
+		if(mc != CURLM_OK) {
+			JANUS_LOG(LOG_ERR, "Couldn't send the request: %s\n", curl_multi_strerror(mc));
+			aborted = TRUE;
+			break;
+		}
+		if(running)
+			curl_multi_wait(multi, NULL, 0, 100, NULL);
+	}
+	CURLcode res = CURLE_OK;
+	if(!aborted) {
+		int left = 0;
+		CURLMsg *msg = NULL;
+		while((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if(msg->msg == CURLMSG_DONE)
+				res = msg->data.result;
+		}
+	}
+	/* Cleanup the libcurl context */
+	curl_multi_remove_handle(multi, curl);
+	curl_multi_cleanup(multi);
+	curl_easy_cleanup(curl);
+	if(aborted) {
+		g_free(data.buffer);
+		return NULL;
+	}
 	if(res != CURLE_OK) {
 		JANUS_LOG(LOG_ERR, "Couldn't send the request: %s\n", curl_easy_strerror(res));
 		g_free(data.buffer);
-		curl_easy_cleanup(curl);
 		return NULL;
 	}
-	/* Cleanup the libcurl context */
-	curl_easy_cleanup(curl);
-	/* Process the response */
 	JANUS_LOG(LOG_VERB, "Got %zu bytes from the TURN REST API server\n", data.size);
 	JANUS_LOG(LOG_VERB, "%s\n", data.buffer);
+	return data.buffer;
+}
+
+/* Process a response from the backend */
+static janus_turnrest_response *janus_turnrest_parse(const char *text) {
 	json_error_t error;
-	json_t *root = json_loads(data.buffer, 0, &error);
+	json_t *root = json_loads(text, 0, &error);
 	if(!root) {
 		JANUS_LOG(LOG_ERR, "Couldn't parse response: error on line %d: %s", error.line, error.text);
-		g_free(data.buffer);
 		return NULL;
 	}
-	g_free(data.buffer);
 	json_t *username = json_object_get(root, "username");
 	if(!username) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing username\n");
+		json_decref(root);
 		return NULL;
 	}
 	if(!json_is_string(username)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: username should be a string\n");
+		json_decref(root);
 		return NULL;
 	}
 	json_t *password = json_object_get(root, "password");
 	if(!password) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing password\n");
+		json_decref(root);
 		return NULL;
 	}
 	if(!json_is_string(password)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: password should be a string\n");
+		json_decref(root);
 		return NULL;
 	}
 	json_t *ttl = json_object_get(root, "ttl");
 	if(ttl && (!json_is_integer(ttl) || json_integer_value(ttl) < 0)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: ttl should be a positive integer\n");
+		json_decref(root);
 		return NULL;
 	}
 	json_t *uris = json_object_get(root, "uris");
 	if(!uris) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing uris\n");
+		json_decref(root);
 		return NULL;
 	}
 	if(!json_is_array(uris) || json_array_size(uris) == 0) {
 		JANUS_LOG(LOG_ERR, "Invalid response: uris should be a non-empty array\n");
+		json_decref(root);
 		return NULL;
 	}
 	/* Turn the response into a janus_turnrest_response object we can use */
@@ -253,6 +368,8 @@ janus_turnrest_response *janus_turnrest_request(void) {
 			if(res != NULL)
 				freeaddrinfo(res);
 			g_strfreev(uri_parts);
+			g_strfreev(parts);
+			g_free(instance);
 			continue;
 		}
 		freeaddrinfo(res);
@@ -268,13 +385,92 @@ janus_turnrest_response *janus_turnrest_request(void) {
 		/* Add the server to the list */
 		response->servers = g_list_append(response->servers, instance);
 	}
+	json_decref(root);
 	if(response->servers == NULL) {
 		JANUS_LOG(LOG_ERR, "Couldn't find any valid TURN URI in the response...\n");
 		janus_turnrest_response_destroy(response);
-		return NULL; 
+		return NULL;
 	}
 	/* Done */
 	return response;
 }
 
+/* Wait on the condition until the provided monotonic time (or forever, if 0): the mutex must be locked */
+static void janus_turnrest_wait(gint64 when) {
+	if(when == 0) {
+		janus_condition_wait(&api_cond, &api_mutex);
+		return;
+	}
+	gint64 delay = when - janus_get_monotonic_time();
+	if(delay <= 0)
+		return;
+	gint64 until = g_get_real_time() + delay;
+	struct timespec ts;
+	ts.tv_sec = until / G_USEC_PER_SEC;
+	ts.tv_nsec = (until % G_USEC_PER_SEC) * 1000;
+	janus_condition_timedwait(&api_cond, &api_mutex, &ts);
+}
+
+static void *janus_turnrest_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining TURN REST API thread\n");
+	janus_mutex_lock(&api_mutex);
+	while(!g_atomic_int_get(&stopping)) {
+		if(api_server == NULL) {
+			/* Nothing to do until we get a backend */
+			janus_turnrest_wait(0);
+			continue;
+		}
+		gint64 now = janus_get_monotonic_time();
+		if(next_refresh > now) {
+			janus_turnrest_wait(next_refresh);
+			continue;
+		}
+		/* Prepare the request URI */
+		char query_string[512];
+		g_snprintf(query_string, 512, "service=turn");
+		if(api_key != NULL) {
+			char buffer[256];
+			g_snprintf(buffer, 256, "&api=%s", api_key);
+			g_strlcat(query_string, buffer, 512);
+		}
+		char request_uri[1024];
+		g_snprintf(request_uri, 1024, "%s?%s", api_server, query_string);
+		gboolean http_get = api_http_get;
+		guint generation = api_generation;
+		/* Don't try again until this request is done, whatever handles may ask */
+		next_refresh = now + JANUS_TURNREST_RETRY;
+		janus_mutex_unlock(&api_mutex);
+		JANUS_LOG(LOG_VERB, "Sending request: %s\n", request_uri);
+		janus_turnrest_response *response = NULL;
+		char *text = janus_turnrest_fetch(request_uri, query_string, http_get, generation);
+		if(text != NULL) {
+			response = janus_turnrest_parse(text);
+			g_free(text);
+		}
+		janus_mutex_lock(&api_mutex);
+		if(generation != api_generation) {
+			/* The backend changed in the meanwhile */
+			janus_turnrest_response_destroy(response);
+			continue;
+		}
+		now = janus_get_monotonic_time();
+		if(response == NULL) {
+			JANUS_LOG(LOG_WARN, "Couldn't refresh TURN REST API credentials, retrying in %ds\n",
+				(int)(JANUS_TURNREST_RETRY/G_USEC_PER_SEC));
+			next_refresh = now + JANUS_TURNREST_RETRY;
+			continue;
+		}
+		/* Refresh when three quarters of the ttl are gone, so that handles always find valid credentials */
+		guint32 ttl = response->ttl ? response->ttl : JANUS_TURNREST_DEFAULT_TTL;
+		janus_turnrest_response_destroy(cached);
+		cached = response;
+		cached_expiry = now + (gint64)ttl*G_USEC_PER_SEC;
+		next_refresh = now + MAX((gint64)ttl*G_USEC_PER_SEC*3/4, G_USEC_PER_SEC);
+		JANUS_LOG(LOG_VERB, "Got credentials from the TURN REST API backend (ttl %"SCNu32"s)\n", ttl);
+	}
+	janus_mutex_unlock(&api_mutex);
+	JANUS_LOG(LOG_VERB, "Leaving TURN REST API thread\n");
+	return NULL;
+}
+
 #endif
@@ -6,7 +6,9 @@
  * draft, that is a REST API that can be used to access TURN services,
  * more specifically credentials to use. Currently implemented in both
  * rfc5766-turn-server and coturn, and so should be generic enough to
- * be usable here.
+ * be usable here. Credentials are retrieved by a background thread, that
+ * refreshes them before their time-to-live expires: handles just get a
+ * copy of the cached ones, and so never wait for the backend to answer.
  * \note This implementation depends on \c libcurl and is optional.
  * 
  * \ingroup core
@@ -65,7 +67,10 @@ void janus_turnrest_response_destroy(janus_turnrest_response *response);
 
 
 /*! \brief Retrieve address and credentials for one or more TURN servers
- * @note Use janus_turnrest_response_destroy to get rid of the response, once done
+ * \note This never blocks: credentials are fetched and refreshed by a
+ * background thread, and this returns a copy of the ones currently cached,
+ * if they're still valid. Use janus_turnrest_response_destroy to get rid
+ * of the response, once done
  * @returns A valid janus_turnrest_response instance, if successful, NULL otherwise */
 janus_turnrest_response *janus_turnrest_request(void);
 
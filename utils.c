@@ -475,7 +475,7 @@ gboolean janus_json_is_valid(json_t *val, json_type jtype, unsigned int flags) {
 	else if((flags & JANUS_JSON_PARAM_NONEMPTY) != 0) {
 		switch(jtype) {
 			case JSON_STRING:
-				is_valid = (strlen(json_string_value(val)) > 0);
+				is_valid = (json_string_value(val)[0] != '\0');
 				break;
 			case JSON_ARRAY:
 				is_valid = (json_array_size(val) > 0);
@@ -487,233 +487,298 @@ gboolean janus_json_is_valid(json_t *val, json_type jtype, unsigned int flags) {
 	return is_valid;
 }
 
+/* Index of the names in a table of parameters */
+typedef struct janus_json_parameters_table {
+	/* Name -> position in the table (plus one, as NULL means not found) */
+	GHashTable *names;
+	/* Whether names are unique, which is the only case we can use the index for */
+	gboolean unique;
+} janus_json_parameters_table;
+
+gpointer janus_json_parameters_index(volatile gsize *cache, const struct janus_json_parameter *params, guint count) {
+	if(g_once_init_enter(cache)) {
+		/* Tables are static, so we never free this */
+		janus_json_parameters_table *table = g_malloc0(sizeof(janus_json_parameters_table));
+		table->names = g_hash_table_new(g_str_hash, g_str_equal);
+		table->unique = TRUE;
+		guint i = 0;
+		for(i=0; i<count; i++) {
+			if(g_hash_table_lookup(table->names, params[i].name) != NULL) {
+				table->unique = FALSE;
+				continue;
+			}
+			g_hash_table_insert(table->names, (gpointer)params[i].name, GUINT_TO_POINTER(i+1));
+		}
+		g_once_init_leave(cache, (gsize)table);
+	}
+	return (gpointer)*cache;
+}
+
+void janus_json_parameters_lookup(gpointer index, const struct janus_json_parameter *params, guint count, json_t *obj, json_t **values) {
+	janus_json_parameters_table *table = (janus_json_parameters_table *)index;
+	guint i = 0;
+	if(table == NULL || !table->unique || json_object_size(obj) >= count) {
+		/* The object has as many keys as the table (or more): look the parameters up one by one */
+		for(i=0; i<count; i++)
+			values[i] = json_object_get(obj, params[i].name);
+		return;
+	}
+	/* Go through the (fewer) keys in the object, and find which parameter each is */
+	memset(values, 0, count*sizeof(json_t *));
+	const char *key = NULL;
+	json_t *value = NULL;
+	json_object_foreach(obj, key, value) {
+		guint pos = GPOINTER_TO_UINT(g_hash_table_lookup(table->names, key));
+		if(pos > 0)
+			values[pos-1] = value;
+	}
+}
+
 /* The following code is more related to codec specific helpers */
-#if defined(__ppc__) || defined(__ppc64__)
-	# define swap2(d)  \
-	((d&0x000000ff)<<8) |  \
-	((d&0x0000ff00)>>8)
-#else
-	# define swap2(d) d
-#endif
+janus_videocodec janus_videocodec_from_name(const char *name) {
+	if(name == NULL)
+		return JANUS_VIDEOCODEC_NONE;
+	else if(!strcasecmp(name, "vp8"))
+		return JANUS_VIDEOCODEC_VP8;
+	else if(!strcasecmp(name, "vp9"))
+		return JANUS_VIDEOCODEC_VP9;
+	else if(!strcasecmp(name, "h264"))
+		return JANUS_VIDEOCODEC_H264;
+	return JANUS_VIDEOCODEC_NONE;
+}
 
-gboolean janus_vp8_is_keyframe(char* buffer, int len) {
-	if(!buffer || len < 0)
-		return FALSE;
-	/* Parse VP8 header now */
-	uint8_t vp8pd = *buffer;
-	uint8_t xbit = (vp8pd & 0x80);
-	uint8_t sbit = (vp8pd & 0x10);
-	if(xbit) {
-		JANUS_LOG(LOG_HUGE, "  -- X bit is set!\n");
+/* VP8 payload descriptor: https://tools.ietf.org/html/rfc7741#section-4.2 */
+static int janus_video_info_parse_vp8(uint8_t *buffer, int len, janus_video_info *info) {
+	int offset = 1;
+	uint8_t vp8pd = buffer[0];
+	uint8_t sbit = (vp8pd & 0x10), partid = (vp8pd & 0x07);
+	if(vp8pd & 0x80) {
 		/* Read the Extended control bits octet */
-		buffer++;
-		vp8pd = *buffer;
-		uint8_t ibit = (vp8pd & 0x80);
-		uint8_t lbit = (vp8pd & 0x40);
-		uint8_t tbit = (vp8pd & 0x20);
-		uint8_t kbit = (vp8pd & 0x10);
-		if(ibit) {
-			JANUS_LOG(LOG_HUGE, "  -- I bit is set!\n");
-			/* Read the PictureID octet */
-			buffer++;
-			vp8pd = *buffer;
-			uint16_t picid = vp8pd, wholepicid = picid;
-			uint8_t mbit = (vp8pd & 0x80);
-			if(mbit) {
-				JANUS_LOG(LOG_HUGE, "  -- M bit is set!\n");
-				memcpy(&picid, buffer, sizeof(uint16_t));
-				wholepicid = ntohs(picid);
-				picid = (wholepicid & 0x7FFF);
-				buffer++;
+		if(offset >= len)
+			return -1;
+		uint8_t ext = buffer[offset++];
+		if(ext & 0x80) {
+			/* Read the PictureID, 7 or 15 bits depending on the M bit */
+			if(offset >= len)
+				return -1;
+			info->has_picid = TRUE;
+			if(buffer[offset] & 0x80) {
+				if(offset+1 >= len)
+					return -1;
+				info->picid = ((buffer[offset] & 0x7F) << 8) | buffer[offset+1];
+				offset += 2;
+			} else {
+				info->picid = buffer[offset] & 0x7F;
+				offset++;
 			}
-			JANUS_LOG(LOG_HUGE, "  -- -- PictureID: %"SCNu16"\n", picid);
 		}
-		if(lbit) {
-			JANUS_LOG(LOG_HUGE, "  -- L bit is set!\n");
+		if(ext & 0x40) {
 			/* Read the TL0PICIDX octet */
-			buffer++;
-			vp8pd = *buffer;
+			if(offset >= len)
+				return -1;
+			info->has_tl0picidx = TRUE;
+			info->tl0picidx = buffer[offset++];
 		}
-		if(tbit || kbit) {
-			JANUS_LOG(LOG_HUGE, "  -- T/K bit is set!\n");
-			/* Read the TID/KEYIDX octet */
-			buffer++;
-			vp8pd = *buffer;
-		}
-		buffer++;	/* Now we're in the payload */
-		if(sbit) {
-			JANUS_LOG(LOG_HUGE, "  -- S bit is set!\n");
-			unsigned long int vp8ph = 0;
-			memcpy(&vp8ph, buffer, 4);
-			vp8ph = ntohl(vp8ph);
-			uint8_t pbit = ((vp8ph & 0x01000000) >> 24);
-			if(!pbit) {
-				JANUS_LOG(LOG_HUGE, "  -- P bit is NOT set!\n");
-				/* It is a key frame! Get resolution for debugging */
-				unsigned char *c = (unsigned char *)buffer+3;
-				/* vet via sync code */
-				if(c[0]!=0x9d||c[1]!=0x01||c[2]!=0x2a) {
-					JANUS_LOG(LOG_HUGE, "First 3-bytes after header not what they're supposed to be?\n");
-				} else {
-					int vp8w = swap2(*(unsigned short*)(c+3))&0x3fff;
-					int vp8ws = swap2(*(unsigned short*)(c+3))>>14;
-					int vp8h = swap2(*(unsigned short*)(c+5))&0x3fff;
-					int vp8hs = swap2(*(unsigned short*)(c+5))>>14;
-					JANUS_LOG(LOG_HUGE, "Got a VP8 key frame: %dx%d (scale=%dx%d)\n", vp8w, vp8h, vp8ws, vp8hs);
-					return TRUE;
-				}
+		if(ext & 0x30) {
+			/* Read the TID/Y/KEYIDX octet: TID and Y are only valid with the T bit, KEYIDX with the K bit */
+			if(offset >= len)
+				return -1;
+			if(ext & 0x20) {
+				info->temporal_layer = (buffer[offset] & 0xC0) >> 6;
+				info->ybit = (buffer[offset] & 0x20) >> 5;
 			}
+			if(ext & 0x10)
+				info->keyidx = buffer[offset] & 0x1F;
+			offset++;
 		}
 	}
-	/* If we got here it's not a key frame */
-	return FALSE;
+	info->descriptor_len = offset;
+	info->start = (sbit && partid == 0);
+	/* Keyframes have the P bit of the VP8 payload header unset, followed by the start code */
+	if(info->start && offset+6 <= len && !(buffer[offset] & 0x01) &&
+			buffer[offset+3] == 0x9d && buffer[offset+4] == 0x01 && buffer[offset+5] == 0x2a)
+		info->keyframe = TRUE;
+	return 0;
 }
 
-gboolean janus_vp9_is_keyframe(char* buffer, int len) {
-	if(!buffer || len < 0)
-		return FALSE;
-	/* Parse VP9 header now */
-	uint8_t vp9pd = *buffer;
-	uint8_t ibit = (vp9pd & 0x80);
-	uint8_t pbit = (vp9pd & 0x40);
-	uint8_t lbit = (vp9pd & 0x20);
-	uint8_t fbit = (vp9pd & 0x10);
-	uint8_t vbit = (vp9pd & 0x02);
-	buffer++;
+/* VP9 payload descriptor: https://tools.ietf.org/html/draft-ietf-payload-vp9-04 */
+static int janus_video_info_parse_vp9(uint8_t *buffer, int len, janus_video_info *info) {
+	int offset = 1;
+	uint8_t vp9pd = buffer[0];
+	uint8_t ibit = (vp9pd & 0x80), lbit = (vp9pd & 0x20), fbit = (vp9pd & 0x10), vbit = (vp9pd & 0x02);
+	info->pbit = (vp9pd & 0x40) >> 6;
+	info->bbit = (vp9pd & 0x08) >> 3;
+	info->ebit = (vp9pd & 0x04) >> 2;
+	info->start = info->bbit;
+	info->end = info->ebit;
 	if(ibit) {
-		/* Read the PictureID octet */
-		vp9pd = *buffer;
-		uint16_t picid = vp9pd, wholepicid = picid;
-		uint8_t mbit = (vp9pd & 0x80);
-		if(!mbit) {
-			buffer++;
+		/* Read the PictureID, 7 or 15 bits depending on the M bit */
+		if(offset >= len)
+			return -1;
+		info->has_picid = TRUE;
+		if(buffer[offset] & 0x80) {
+			if(offset+1 >= len)
+				return -1;
+			info->picid = ((buffer[offset] & 0x7F) << 8) | buffer[offset+1];
+			offset += 2;
 		} else {
-			memcpy(&picid, buffer, sizeof(uint16_t));
-			wholepicid = ntohs(picid);
-			picid = (wholepicid & 0x7FFF);
-			buffer += 2;
+			info->picid = buffer[offset] & 0x7F;
+			offset++;
 		}
 	}
 	if(lbit) {
-		buffer++;
+		/* Parse the layer indices */
+		if(offset >= len)
+			return -1;
+		vp9pd = buffer[offset++];
+		info->svc = TRUE;
+		info->temporal_layer = (vp9pd & 0xE0) >> 5;
+		info->ubit = (vp9pd & 0x10) >> 4;
+		info->spatial_layer = (vp9pd & 0x0E) >> 1;
+		info->dbit = (vp9pd & 0x01);
 		if(!fbit) {
-			/* Non-flexible mode, skip TL0PICIDX */
-			buffer++;
+			/* Non-flexible mode, read TL0PICIDX */
+			if(offset >= len)
+				return -1;
+			info->has_tl0picidx = TRUE;
+			info->tl0picidx = buffer[offset++];
 		}
 	}
-	if(fbit && pbit) {
-		/* Skip reference indices */
-		uint8_t nbit = 1;
-		while(nbit) {
-			vp9pd = *buffer;
-			nbit = (vp9pd & 0x01);
-			buffer++;
-		}
+	if(fbit && info->pbit) {
+		/* Skip reference indices (at most 3) */
+		int refs = 0;
+		do {
+			if(offset >= len)
+				return -1;
+			vp9pd = buffer[offset++];
+			refs++;
+		} while((vp9pd & 0x01) && refs < 3);
 	}
 	if(vbit) {
-		/* Parse and skip SS */
-		vp9pd = *buffer;
-		uint n_s = (vp9pd & 0xE0) >> 5;
-		n_s++;
-		uint8_t ybit = (vp9pd & 0x10);
+		/* Parse the scalability structure: keyframes come with the resolution of the spatial layers */
+		if(offset >= len)
+			return -1;
+		vp9pd = buffer[offset++];
+		int n_s = ((vp9pd & 0xE0) >> 5) + 1, i = 0;
+		uint8_t ybit = (vp9pd & 0x10), gbit = (vp9pd & 0x08);
 		if(ybit) {
-			/* Iterate on all spatial layers and get resolution */
-			buffer++;
-			uint i=0;
+			if(offset + 4*n_s > len)
+				return -1;
 			for(i=0; i<n_s; i++) {
-				/* Width */
-				uint16_t *w = (uint16_t *)buffer;
-				int vp9w = ntohs(*w);
-				buffer += 2;
-				/* Height */
-				uint16_t *h = (uint16_t *)buffer;
-				int vp9h = ntohs(*h);
-				buffer += 2;
-				if(vp9w || vp9h) {
-					JANUS_LOG(LOG_HUGE, "Got a VP9 key frame: %dx%d\n", vp9w, vp9h);
-					return TRUE;
-				}
+				if(buffer[offset] || buffer[offset+1] || buffer[offset+2] || buffer[offset+3])
+					info->keyframe = TRUE;
+				offset += 4;
 			}
 		}
+		if(gbit) {
+			if(offset >= len)
+				return -1;
+			int n_g = buffer[offset++];
+			for(i=0; i<n_g; i++) {
+				if(offset >= len)
+					return -1;
+				/* Skip the picture description and its R reference indices */
+				offset += 1 + ((buffer[offset] & 0x0C) >> 2);
+			}
+			if(offset > len)
+				return -1;
+		}
 	}
-	/* If we got here it's not a key frame */
-	return FALSE;
+	info->descriptor_len = offset;
+	return 0;
+}
+
+/* H.264 NAL units: https://tools.ietf.org/html/rfc6184#section-5.2 */
+static inline gboolean janus_h264_nal_is_keyframe(uint8_t nal) {
+	/* IDR slices and SPS both mean a new keyframe is starting */
+	nal &= 0x1F;
+	return nal == 5 || nal == 7;
+}
+
+static int janus_video_info_parse_h264(uint8_t *buffer, int len, janus_video_info *info) {
+	uint8_t type = buffer[0] & 0x1F;
+	if(type == 24 || type == 25) {
+		/* STAP-A or STAP-B: check all the aggregated NAL units (STAP-B also has a DON first) */
+		int offset = (type == 24) ? 1 : 3;
+		info->start = TRUE;
+		while(offset+2 < len) {
+			int size = (buffer[offset] << 8) | buffer[offset+1];
+			offset += 2;
+			if(size == 0 || offset+size > len)
+				break;
+			if(janus_h264_nal_is_keyframe(buffer[offset])) {
+				info->keyframe = TRUE;
+				break;
+			}
+			offset += size;
+		}
+	} else if(type == 28 || type == 29) {
+		/* FU-A or FU-B: the FU header tells us if it's the first fragment, and of which NAL type */
+		if(len < 2)
+			return -1;
+		info->start = (buffer[1] & 0x80) != 0;
+		info->keyframe = info->start && janus_h264_nal_is_keyframe(buffer[1]);
+	} else {
+		/* Single NAL unit */
+		info->start = TRUE;
+		info->keyframe = janus_h264_nal_is_keyframe(buffer[0]);
+	}
+	return 0;
+}
+
+int janus_video_info_parse(janus_videocodec codec, char *buffer, int len, janus_video_info *info) {
+	if(info == NULL)
+		return -1;
+	memset(info, 0, sizeof(*info));
+	if(buffer == NULL || len < 1)
+		return -1;
+	switch(codec) {
+		case JANUS_VIDEOCODEC_VP8:
+			return janus_video_info_parse_vp8((uint8_t *)buffer, len, info);
+		case JANUS_VIDEOCODEC_VP9:
+			return janus_video_info_parse_vp9((uint8_t *)buffer, len, info);
+		case JANUS_VIDEOCODEC_H264:
+			return janus_video_info_parse_h264((uint8_t *)buffer, len, info);
+		default:
+			break;
+	}
+	return -1;
+}
+
+gboolean janus_vp8_is_keyframe(char* buffer, int len) {
+	janus_video_info info;
+	janus_video_info_parse(JANUS_VIDEOCODEC_VP8, buffer, len, &info);
+	return info.keyframe;
+}
+
+gboolean janus_vp9_is_keyframe(char* buffer, int len) {
+	janus_video_info info;
+	janus_video_info_parse(JANUS_VIDEOCODEC_VP9, buffer, len, &info);
+	return info.keyframe;
 }
 
 gboolean janus_h264_is_keyframe(char* buffer, int len) {
-	if(!buffer || len < 0)
-		return FALSE;
-	/* Parse H264 header now */
-	uint8_t fragment = *buffer & 0x1F;
-	uint8_t nal = *(buffer+1) & 0x1F;
-	uint8_t start_bit = *(buffer+1) & 0x80;
-	if(fragment == 5 ||
-			((fragment == 28 || fragment == 29) && nal == 5 && start_bit == 128)) {
-		JANUS_LOG(LOG_HUGE, "Got an H264 key frame\n");
-		return TRUE;
-	}
-	/* If we got here it's not a key frame */
-	return FALSE;
+	janus_video_info info;
+	janus_video_info_parse(JANUS_VIDEOCODEC_H264, buffer, len, &info);
+	return info.keyframe;
 }
 
 int janus_vp8_parse_descriptor(char *buffer, int len,
 		uint16_t *picid, uint8_t *tl0picidx, uint8_t *tid, uint8_t *y, uint8_t *keyidx) {
 	if(!buffer || len < 0)
 		return -1;
+	janus_video_info info;
+	janus_video_info_parse(JANUS_VIDEOCODEC_VP8, buffer, len, &info);
 	if(picid)
-		*picid = 0;
+		*picid = info.picid;
 	if(tl0picidx)
-		*tl0picidx = 0;
+		*tl0picidx = info.tl0picidx;
 	if(tid)
-		*tid = 0;
+		*tid = info.temporal_layer;
 	if(y)
-		*y = 0;
+		*y = info.ybit;
 	if(keyidx)
-		*keyidx = 0;
-	uint8_t vp8pd = *buffer;
-	uint8_t xbit = (vp8pd & 0x80);
-	/* Read the Extended control bits octet */
-	if(xbit) {
-		buffer++;
-		vp8pd = *buffer;
-		uint8_t ibit = (vp8pd & 0x80);
-		uint8_t lbit = (vp8pd & 0x40);
-		uint8_t tbit = (vp8pd & 0x20);
-		uint8_t kbit = (vp8pd & 0x10);
-		if(ibit) {
-			/* Read the PictureID octet */
-			buffer++;
-			vp8pd = *buffer;
-			uint16_t partpicid = vp8pd, wholepicid = partpicid;
-			uint8_t mbit = (vp8pd & 0x80);
-			if(mbit) {
-				memcpy(&partpicid, buffer, sizeof(uint16_t));
-				wholepicid = ntohs(partpicid);
-				partpicid = (wholepicid & 0x7FFF);
-				if(picid)
-					*picid = partpicid;
-				buffer++;
-			}
-		}
-		if(lbit) {
-			/* Read the TL0PICIDX octet */
-			buffer++;
-			vp8pd = *buffer;
-			if(tl0picidx)
-				*tl0picidx = vp8pd;
-		}
-		if(tbit || kbit) {
-			/* Read the TID/Y/KEYIDX octet */
-			buffer++;
-			vp8pd = *buffer;
-			if(tid)
-				*tid = (vp8pd & 0xC0) >> 6;
-			if(y)
-				*y = (vp8pd & 0x20) >> 5;
-			if(keyidx)
-				*keyidx = (vp8pd & 0x1F) >> 4;
-		}
-	}
+		*keyidx = info.keyidx;
 	return 0;
 }
 
@@ -757,6 +822,79 @@ static int janus_vp8_replace_descriptor(char *buffer, int len, uint16_t picid, u
 	return 0;
 }
 
+/* Headroom (in percentage of the estimation) we want before picking a substream, and
+ * how much more we want before switching to a higher one: we also wait a bit after each
+ * switch before going up again, as estimations take a while to settle */
+#define JANUS_SIMULCAST_BWE_HEADROOM		90
+#define JANUS_SIMULCAST_BWE_UPGRADE_HEADROOM	75
+#define JANUS_SIMULCAST_BWE_UPGRADE_DELAY	(5*G_USEC_PER_SEC)
+
+void janus_simulcast_bitrates_update(janus_simulcast_bitrates *rates, int substream, int len, gint64 now) {
+	if(rates == NULL || substream < 0 || substream > 2 || len < 0)
+		return;
+	if(rates->window_start == 0)
+		rates->window_start = now;
+	if(now - rates->window_start >= G_USEC_PER_SEC) {
+		/* Window complete, compute the bitrates: substreams we got nothing on are inactive */
+		gint64 elapsed = now - rates->window_start;
+		int i = 0;
+		for(i=0; i<3; i++) {
+			rates->bitrate[i] = (uint32_t)(((guint64)rates->bytes[i] * 8 * G_USEC_PER_SEC) / elapsed);
+			rates->bytes[i] = 0;
+		}
+		rates->window_start = now;
+	}
+	rates->bytes[substream] += len;
+}
+
+void janus_simulcast_bwe_context_reset(janus_simulcast_bwe_context *context) {
+	if(context == NULL)
+		return;
+	context->estimate = 0;
+	context->max_substream = 2;
+	context->last_switch = 0;
+}
+
+int janus_simulcast_bwe_pick(janus_simulcast_bwe_context *context, janus_simulcast_bitrates *rates,
+		int target, uint32_t estimate, gint64 now) {
+	if(context == NULL || rates == NULL || estimate == 0)
+		return target;
+	context->estimate = estimate;
+	/* Find the highest active substream that fits the estimation (or the lowest, if none does) */
+	int max = context->max_substream, pick = -1, i = 0;
+	if(max < 0 || max > 2)
+		max = 2;
+	for(i=max; i>=0; i--) {
+		uint32_t bitrate = rates->bitrate[i];
+		if(bitrate == 0)
+			continue;
+		pick = i;
+		if((guint64)bitrate*100 <= (guint64)estimate*JANUS_SIMULCAST_BWE_HEADROOM)
+			break;
+	}
+	if(pick < 0) {
+		/* We don't know the bitrates yet */
+		return target;
+	}
+	if(target > max) {
+		/* The recipient asked for a lower substream in the meanwhile */
+		context->last_switch = now;
+		return pick;
+	}
+	if(pick > target) {
+		/* Only go up one step at a time, when there's enough headroom and things have settled */
+		pick = target + 1;
+		while(pick <= max && rates->bitrate[pick] == 0)
+			pick++;
+		if(pick > max || now - context->last_switch < JANUS_SIMULCAST_BWE_UPGRADE_DELAY ||
+				(guint64)rates->bitrate[pick]*100 > (guint64)estimate*JANUS_SIMULCAST_BWE_UPGRADE_HEADROOM)
+			return target;
+	}
+	if(pick != target)
+		context->last_switch = now;
+	return pick;
+}
+
 void janus_vp8_simulcast_context_reset(janus_vp8_simulcast_context *context) {
 	if(context == NULL)
 		return;
@@ -799,131 +937,28 @@ int janus_vp9_parse_svc(char *buffer, int len, int *found,
 		uint8_t *p, uint8_t *d, uint8_t *u, uint8_t *b, uint8_t *e) {
 	if(!buffer || len < 0)
 		return -1;
-	/* VP9 depay: */
-		/* https://tools.ietf.org/html/draft-ietf-payload-vp9-04 */
-	/* Read the first octet (VP9 Payload Descriptor) */
-	uint8_t vp9pd = *buffer;
-	uint8_t ibit = (vp9pd & 0x80) >> 7;
-	uint8_t pbit = (vp9pd & 0x40) >> 6;
-	uint8_t lbit = (vp9pd & 0x20) >> 5;
-	uint8_t fbit = (vp9pd & 0x10) >> 4;
-	uint8_t bbit = (vp9pd & 0x08) >> 3;
-	uint8_t ebit = (vp9pd & 0x04) >> 2;
-	uint8_t vbit = (vp9pd & 0x02) >> 1;
-	if(!lbit) {
-		/* No Layer indices present, no need to go on */
-		if(found)
-			*found = 0;
+	janus_video_info info;
+	janus_video_info_parse(JANUS_VIDEOCODEC_VP9, buffer, len, &info);
+	if(found)
+		*found = info.svc;
+	if(!info.svc) {
+		/* No Layer indices present */
 		return 0;
 	}
-	/* Move to the next octet and see what's there */
-	buffer++;
-	len--;
-	if(ibit) {
-		/* Read the PictureID octet */
-		vp9pd = *buffer;
-		uint16_t picid = vp9pd, wholepicid = picid;
-		uint8_t mbit = (vp9pd & 0x80);
-		if(!mbit) {
-			buffer++;
-			len--;
-		} else {
-			memcpy(&picid, buffer, sizeof(uint16_t));
-			wholepicid = ntohs(picid);
-			picid = (wholepicid & 0x7FFF);
-			buffer += 2;
-			len -= 2;
-		}
-	}
-	if(lbit) {
-		/* Read the octet and parse the layer indices now */
-		vp9pd = *buffer;
-		int tlid = (vp9pd & 0xE0) >> 5;
-		uint8_t ubit = (vp9pd & 0x10) >> 4;
-		int slid = (vp9pd & 0x0E) >> 1;
-		uint8_t dbit = (vp9pd & 0x01);
-		JANUS_LOG(LOG_HUGE, "Parsed Layer indices: Temporal: %d (%u), Spatial: %d (%u)\n",
-			tlid, ubit, slid, dbit);
-		if(temporal_layer)
-			*temporal_layer = tlid;
-		if(spatial_layer)
-			*spatial_layer = slid;
-		if(p)
-			*p = pbit;
-		if(d)
-			*d = dbit;
-		if(u)
-			*u = ubit;
-		if(b)
-			*b = bbit;
-		if(e)
-			*e = ebit;
-		if(found)
-			*found = 1;
-		/* Go on, just to get to the SS, if available (which we currently ignore anyway) */
-		buffer++;
-		len--;
-		if(!fbit) {
-			/* Non-flexible mode, skip TL0PICIDX */
-			buffer++;
-			len--;
-		}
-	}
-	if(fbit && pbit) {
-		/* Skip reference indices */
-		uint8_t nbit = 1;
-		while(nbit) {
-			vp9pd = *buffer;
-			nbit = (vp9pd & 0x01);
-			buffer++;
-			len--;
-		}
-	}
-	if(vbit) {
-		/* Parse and skip SS */
-		vp9pd = *buffer;
-		int n_s = (vp9pd & 0xE0) >> 5;
-		n_s++;
-		JANUS_LOG(LOG_HUGE, "There are %d spatial layers\n", n_s);
-		uint8_t ybit = (vp9pd & 0x10);
-		uint8_t gbit = (vp9pd & 0x08);
-		if(ybit) {
-			/* Iterate on all spatial layers and get resolution */
-			buffer++;
-			len--;
-			int i=0;
-			for(i=0; i<n_s; i++) {
-				/* Been there, done that: skip skip skip */
-				buffer += 4;
-				len -= 4;
-			}
-		}
-		if(gbit) {
-			if(!ybit) {
-				buffer++;
-				len--;
-			}
-			uint8_t n_g = *buffer;
-			JANUS_LOG(LOG_HUGE, "There are %u frames in a GOF\n", n_g);
-			buffer++;
-			len--;
-			if(n_g > 0) {
-				int i=0;
-				for(i=0; i<n_g; i++) {
-					/* Read the R bits */
-					vp9pd = *buffer;
-					int r = (vp9pd & 0x0C) >> 2;
-					if(r > 0) {
-						/* Skip reference indices */
-						buffer += r;
-						len -= r;
-					}
-					buffer++;
-					len--;
-				}
-			}
-		}
-	}
+	if(temporal_layer)
+		*temporal_layer = info.temporal_layer;
+	if(spatial_layer)
+		*spatial_layer = info.spatial_layer;
+	if(p)
+		*p = info.pbit;
+	if(d)
+		*d = info.dbit;
+	if(u)
+		*u = info.ubit;
+	if(b)
+		*b = info.bbit;
+	if(e)
+		*e = info.ebit;
 	return 0;
 }
 
@@ -952,3 +987,69 @@ inline void janus_set4(guint8 *data,size_t i,guint32 val) {
 	data[i+1] = (guint8)(val>>16);
 	data[i]   = (guint8)(val>>24);
 }
+
+guint janus_handler_pool_size(const char *value) {
+	if(value == NULL)
+		return 1;
+	int num = atoi(value);
+	if(num < 1 || num > JANUS_HANDLER_POOL_MAX_THREADS) {
+		JANUS_LOG(LOG_WARN, "Invalid number of handler threads (should be between 1 and %d), using 1\n", JANUS_HANDLER_POOL_MAX_THREADS);
+		return 1;
+	}
+	return num;
+}
+
+janus_handler_pool *janus_handler_pool_create(guint num, GDestroyNotify message_free) {
+	janus_handler_pool *pool = g_malloc0(sizeof(janus_handler_pool));
+	pool->num = num > 0 ? num : 1;
+	pool->queues = g_malloc0(pool->num * sizeof(GAsyncQueue *));
+	pool->threads = g_malloc0(pool->num * sizeof(GThread *));
+	guint i = 0;
+	for(i=0; i<pool->num; i++)
+		pool->queues[i] = g_async_queue_new_full(message_free);
+	return pool;
+}
+
+int janus_handler_pool_start(janus_handler_pool *pool, const char *name, GThreadFunc func, GError **error) {
+	if(pool == NULL || func == NULL)
+		return -1;
+	guint i = 0;
+	for(i=0; i<pool->num; i++) {
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "%s %u", name, i);
+		pool->threads[i] = g_thread_try_new(tname, func, pool->queues[i], error);
+		if(pool->threads[i] == NULL)
+			return -1;
+	}
+	return 0;
+}
+
+GAsyncQueue *janus_handler_pool_queue(janus_handler_pool *pool, gconstpointer handle) {
+	/* Handles are heap allocated, so the lowest bits are always the same */
+	return pool->queues[(GPOINTER_TO_SIZE(handle) >> 4) % pool->num];
+}
+
+void janus_handler_pool_stop(janus_handler_pool *pool, gpointer exit_message) {
+	if(pool == NULL)
+		return;
+	guint i = 0;
+	for(i=0; i<pool->num; i++)
+		g_async_queue_push(pool->queues[i], exit_message);
+	for(i=0; i<pool->num; i++) {
+		if(pool->threads[i] != NULL) {
+			g_thread_join(pool->threads[i]);
+			pool->threads[i] = NULL;
+		}
+	}
+}
+
+void janus_handler_pool_destroy(janus_handler_pool *pool) {
+	if(pool == NULL)
+		return;
+	guint i = 0;
+	for(i=0; i<pool->num; i++)
+		g_async_queue_unref(pool->queues[i]);
+	g_free(pool->queues);
+	g_free(pool->threads);
+	g_free(pool);
+}
@@ -147,6 +147,25 @@ void janus_get_json_type_name(int jtype, unsigned int flags, char *type_name);
  * @returns TRUE if the value is valid */
 gboolean janus_json_is_valid(json_t *val, json_type jtype, unsigned int flags);
 
+/*! \brief Helper to get the (cached) index of the names in a table of parameters
+ * \note The first time a table is validated its names are interned in a hash table,
+ * which is then stored in \c cache: this allows JANUS_VALIDATE_JSON_OBJECT to look up
+ * the few keys an object usually contains in the table, rather than each of the
+ * (often many, and mostly optional) parameters of the table in the object
+ * @param cache Pointer to where the index of this table is cached (usually a static variable)
+ * @param params Array of struct janus_json_parameter to index
+ * @param count Number of parameters in the array
+ * @returns The index of the table (opaque) */
+gpointer janus_json_parameters_index(volatile gsize *cache, const struct janus_json_parameter *params, guint count);
+
+/*! \brief Helper to find the values of all the parameters of a table in a JSON object
+ * @param index The index of the table, as returned by janus_json_parameters_index
+ * @param params Array of struct janus_json_parameter the index was created for
+ * @param count Number of parameters in the array
+ * @param obj The JSON object to look the parameters up in
+ * @param[out] values Array of json_t pointers, as many as the parameters, filled with their values (NULL if missing) */
+void janus_json_parameters_lookup(gpointer index, const struct janus_json_parameter *params, guint count, json_t *obj, json_t **values);
+
 /*! \brief Validates the JSON object against the description of its parameters
  * @param missing_format printf format to indicate a missing required parameter; needs one %s for the parameter name
  * @param invalid_format printf format to indicate an invalid parameter; needs two %s for parameter name and type description from janus_get_json_type_name
@@ -156,13 +175,22 @@ gboolean janus_json_is_valid(json_t *val, json_type jtype, unsigned int flags);
  * @param[out] error_cause Array of char or NULL to return the error descriptions; the array has to be a global or stack variable to make sizeof work; the required size is the length of the format string plus the length of the longest parameter name plus 19 for the type description
  * @param log_error If TRUE, log any error with JANUS_LOG(LOG_ERR)
  * @param missing_code The code to be returned in error_code if a parameter is missing
- * @param invalid_code The code to be returned in error_code if a parameter is invalid */
-#define JANUS_VALIDATE_JSON_OBJECT_FORMAT(missing_format, invalid_format, obj, params, error_code, error_cause, log_error, missing_code, invalid_code) \
+ * @param invalid_code The code to be returned in error_code if a parameter is invalid
+ * @param[out] values Array of json_t pointers (as many as the parameters) or NULL: if provided, it's filled with
+ * the value of each parameter (NULL if missing), so that callers don't need to look the same keys up again */
+#define JANUS_VALIDATE_JSON_OBJECT_FORMAT_VALUES(missing_format, invalid_format, obj, params, error_code, error_cause, log_error, missing_code, invalid_code, values) \
 	do { \
 		error_code = 0; \
 		unsigned int i; \
+		static volatile gsize _index = 0; \
+		json_t *_found[sizeof(params) / sizeof(struct janus_json_parameter)]; \
+		json_t **_values = (values); \
+		if(_values == NULL) \
+			_values = _found; \
+		janus_json_parameters_lookup(janus_json_parameters_index(&_index, params, sizeof(params) / sizeof(struct janus_json_parameter)), \
+			params, sizeof(params) / sizeof(struct janus_json_parameter), obj, _values); \
 		for(i = 0; i < sizeof(params) / sizeof(struct janus_json_parameter); i++) { \
-			json_t *val = json_object_get(obj, params[i].name); \
+			json_t *val = _values[i]; \
 			if(!val) { \
 				if((params[i].flags & JANUS_JSON_PARAM_REQUIRED) != 0) {	\
 					error_code = (missing_code); \
@@ -187,6 +215,11 @@ gboolean janus_json_is_valid(json_t *val, json_type jtype, unsigned int flags);
 		} \
 	} while(0)
 
+/*! \brief Validates the JSON object against the description of its parameters
+ * @see JANUS_VALIDATE_JSON_OBJECT_FORMAT_VALUES, without returning the values */
+#define JANUS_VALIDATE_JSON_OBJECT_FORMAT(missing_format, invalid_format, obj, params, error_code, error_cause, log_error, missing_code, invalid_code) \
+	JANUS_VALIDATE_JSON_OBJECT_FORMAT_VALUES(missing_format, invalid_format, obj, params, error_code, error_cause, log_error, missing_code, invalid_code, NULL)
+
 /*! \brief Validates the JSON object against the description of its parameters
  * @param obj The JSON object to be validated
  * @param params Array of struct janus_json_parameter to describe the parameters; the array has to be a global or stack variable to make sizeof work
@@ -198,6 +231,12 @@ gboolean janus_json_is_valid(json_t *val, json_type jtype, unsigned int flags);
 #define JANUS_VALIDATE_JSON_OBJECT(obj, params, error_code, error_cause, log_error, missing_code, invalid_code) \
 	JANUS_VALIDATE_JSON_OBJECT_FORMAT("Missing mandatory element (%s)", "Invalid element type (%s should be %s)", obj, params, error_code, error_cause, log_error, missing_code, invalid_code)
 
+/*! \brief Validates the JSON object against the description of its parameters, returning their values too
+ * @see JANUS_VALIDATE_JSON_OBJECT
+ * @param[out] values Array of json_t pointers, as many as the parameters, filled with their values (NULL if missing) */
+#define JANUS_VALIDATE_JSON_OBJECT_VALUES(obj, params, values, error_code, error_cause, log_error, missing_code, invalid_code) \
+	JANUS_VALIDATE_JSON_OBJECT_FORMAT_VALUES("Missing mandatory element (%s)", "Invalid element type (%s should be %s)", obj, params, error_code, error_cause, log_error, missing_code, invalid_code, values)
+
 /*! \brief If the secret isn't NULL, check the secret after validating the specified member of the JSON object
  * @param secret The secret to be checked; no check if the secret is NULL
  * @param obj The JSON object to be validated
@@ -236,11 +275,67 @@ gboolean janus_vp8_is_keyframe(char* buffer, int len);
 gboolean janus_vp9_is_keyframe(char* buffer, int len);
 
 /*! \brief Helper method to check if an H.264 frame is a keyframe or not
+ * \note Single NAL units, STAP-A/STAP-B aggregates and the first FU-A/FU-B fragment
+ * of a NAL unit are all checked: an IDR slice or an SPS means it's a keyframe
  * @param[in] buffer The RTP payload to process
  * @param[in] len The length of the RTP payload
  * @returns TRUE if it's a keyframe, FALSE otherwise */
 gboolean janus_h264_is_keyframe(char* buffer, int len);
 
+/*! \brief Video codecs the helpers below can inspect packets of */
+typedef enum janus_videocodec {
+	JANUS_VIDEOCODEC_NONE = 0,
+	JANUS_VIDEOCODEC_VP8,
+	JANUS_VIDEOCODEC_VP9,
+	JANUS_VIDEOCODEC_H264
+} janus_videocodec;
+/*! \brief Helper method to get a janus_videocodec value from its name
+ * @param[in] name The codec name (e.g., "vp8")
+ * @returns The codec, or JANUS_VIDEOCODEC_NONE if it's not supported */
+janus_videocodec janus_videocodec_from_name(const char *name);
+
+/*! \brief Codec specific info on a video packet, as extracted from its
+ * payload (descriptor) in a single pass by janus_video_info_parse, so that
+ * recorders, simulcast switching and SVC dropping can all use the same
+ * info rather than each parsing the same packet again */
+typedef struct janus_video_info {
+	/*! \brief Whether this packet is the beginning of a keyframe */
+	gboolean keyframe;
+	/*! \brief Whether this packet is the beginning of a frame (for H.264, of a NAL unit) */
+	gboolean start;
+	/*! \brief Whether this packet is the end of a frame (VP9 only, FALSE otherwise) */
+	gboolean end;
+	/*! \brief Whether a Picture ID is present (VP8 and VP9) */
+	gboolean has_picid;
+	/*! \brief Picture ID, 7 or 15 bits */
+	uint16_t picid;
+	/*! \brief Whether a temporal level zero index is present (VP8 and VP9 non-flexible mode) */
+	gboolean has_tl0picidx;
+	/*! \brief Temporal level zero index */
+	uint8_t tl0picidx;
+	/*! \brief Temporal layer of the packet (VP8 and VP9), 0 if not present */
+	int temporal_layer;
+	/*! \brief Spatial layer of the packet (VP9 only), 0 if not present */
+	int spatial_layer;
+	/*! \brief VP8 layer sync bit and temporal key frame index */
+	uint8_t ybit, keyidx;
+	/*! \brief Whether VP9 layer indices are present, i.e., whether SVC info is available */
+	gboolean svc;
+	/*! \brief VP9 inter-picture predicted, inter-layer dependency, switching up point, start and end of frame bits */
+	uint8_t pbit, dbit, ubit, bbit, ebit;
+	/*! \brief Size of the payload descriptor (VP8 and VP9), i.e., where the encoded frame starts */
+	int descriptor_len;
+} janus_video_info;
+
+/*! \brief Helper method to inspect a video packet and get all the codec specific info we may need
+ * \note The info is always reset first, so it can be safely checked even if parsing fails
+ * @param[in] codec The codec of the packet
+ * @param[in] buffer The RTP payload to process
+ * @param[in] len The length of the RTP payload
+ * @param[out] info The info to fill in
+ * @returns 0 in case of success, a negative integer otherwise (e.g., truncated descriptor) */
+int janus_video_info_parse(janus_videocodec codec, char *buffer, int len, janus_video_info *info);
+
 /*! \brief VP8 simulcasting context, in order to make sure SSRC changes result in coherent picid/temporal level increases */
 typedef struct janus_vp8_simulcast_context {
 	uint16_t last_picid, base_picid, base_picid_prev;
@@ -251,6 +346,53 @@ typedef struct janus_vp8_simulcast_context {
  * @param[in] context The context to (re)set */
 void janus_vp8_simulcast_context_reset(janus_vp8_simulcast_context *context);
 
+/*! \brief Bitrate of each simulcast substream, as measured on the incoming side */
+typedef struct janus_simulcast_bitrates {
+	/*! \brief Bytes received on each substream in the current window */
+	uint32_t bytes[3];
+	/*! \brief Bitrate of each substream (bits per second) in the last complete window, 0 if it's not active */
+	volatile uint32_t bitrate[3];
+	/*! \brief When the current window started */
+	gint64 window_start;
+} janus_simulcast_bitrates;
+
+/*! \brief Account for a packet received on a simulcast substream
+ * \note The bitrates are recomputed once per second: this is supposed to be called by a
+ * single thread (the one receiving the media), while any thread can read the results
+ * @param[in] rates The bitrates context to update
+ * @param[in] substream The substream the packet was received on
+ * @param[in] len The packet length
+ * @param[in] now The current monotonic time */
+void janus_simulcast_bitrates_update(janus_simulcast_bitrates *rates, int substream, int len, gint64 now);
+
+/*! \brief Per-recipient context to pick the simulcast substream automatically, based on the
+ * bandwidth estimation the recipient sends via REMB */
+typedef struct janus_simulcast_bwe_context {
+	/*! \brief Latest bandwidth estimation (bits per second) */
+	uint32_t estimate;
+	/*! \brief Highest substream we can pick (e.g., the one the recipient asked for) */
+	int max_substream;
+	/*! \brief When we last picked a different substream */
+	gint64 last_switch;
+} janus_simulcast_bwe_context;
+
+/*! \brief Set (or reset) the context fields to their default values
+ * @param[in] context The context to (re)set */
+void janus_simulcast_bwe_context_reset(janus_simulcast_bwe_context *context);
+
+/*! \brief Pick the substream to send, given a new bandwidth estimation
+ * \note Switching to a lower substream happens as soon as the current one doesn't fit the
+ * estimation anymore, while switching to a higher one requires some headroom, and some time
+ * to have passed since the last switch, to avoid oscillating between substreams
+ * @param[in] context The bandwidth estimation context of the recipient
+ * @param[in] rates The bitrates of the substreams
+ * @param[in] target The substream the recipient is currently set to receive
+ * @param[in] estimate The new bandwidth estimation (bits per second)
+ * @param[in] now The current monotonic time
+ * @returns The substream to send, which may be the same as target */
+int janus_simulcast_bwe_pick(janus_simulcast_bwe_context *context, janus_simulcast_bitrates *rates,
+	int target, uint32_t estimate, gint64 now);
+
 /*! \brief Helper method to parse a VP8 payload descriptor for useful info (e.g., when simulcasting)
  * @param[in] buffer The RTP payload to process
  * @param[in] len The length of the RTP payload
@@ -321,4 +463,47 @@ void janus_set3(guint8 *data, size_t i, guint32 val);
  */
 void janus_set4(guint8 *data, size_t i, guint32 val);
 
+/*! \brief Maximum number of threads in a janus_handler_pool */
+#define JANUS_HANDLER_POOL_MAX_THREADS	32
+/*! \brief Pool of threads a plugin can handle its asynchronous requests with
+ * \note Each thread has a queue of its own, and a handle always maps to the
+ * same one: requests for the same handle are still processed in order, while
+ * a slow request only delays the handles sharing its thread */
+typedef struct janus_handler_pool {
+	/*! \brief Number of threads, and so of queues */
+	guint num;
+	/*! \brief The message queue of each thread */
+	GAsyncQueue **queues;
+	/*! \brief The threads */
+	GThread **threads;
+} janus_handler_pool;
+/*! \brief Helper method to parse the number of threads a janus_handler_pool should have (e.g., from a configuration item)
+ * @param[in] value The value to parse
+ * @returns The number of threads, or 1 if the value is missing or out of range */
+guint janus_handler_pool_size(const char *value);
+/*! \brief Helper method to create a janus_handler_pool and its queues (threads are started with janus_handler_pool_start)
+ * @param[in] num The number of threads (and queues)
+ * @param[in] message_free Function to free messages still in the queues when they're destroyed
+ * @returns A new janus_handler_pool instance */
+janus_handler_pool *janus_handler_pool_create(guint num, GDestroyNotify message_free);
+/*! \brief Helper method to start the threads of a janus_handler_pool
+ * @param[in] pool The janus_handler_pool instance
+ * @param[in] name Prefix of the thread names (the index is appended)
+ * @param[in] func The thread function, which gets the queue it must handle as its data
+ * @param[out] error Where to store the error, in case a thread couldn't be started
+ * @returns 0 in case of success, -1 otherwise */
+int janus_handler_pool_start(janus_handler_pool *pool, const char *name, GThreadFunc func, GError **error);
+/*! \brief Helper method to get the queue the messages for a handle must be pushed to
+ * @param[in] pool The janus_handler_pool instance
+ * @param[in] handle The handle the message is for
+ * @returns The queue */
+GAsyncQueue *janus_handler_pool_queue(janus_handler_pool *pool, gconstpointer handle);
+/*! \brief Helper method to stop the threads of a janus_handler_pool, and wait for them
+ * @param[in] pool The janus_handler_pool instance
+ * @param[in] exit_message The message the threads leave their loop on */
+void janus_handler_pool_stop(janus_handler_pool *pool, gpointer exit_message);
+/*! \brief Helper method to destroy a janus_handler_pool and its queues, after it's been stopped
+ * @param[in] pool The janus_handler_pool instance */
+void janus_handler_pool_destroy(janus_handler_pool *pool);
+
 #endif